@@ -0,0 +1,155 @@
+import argparse
+import glob
+import json
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+from app.bench.ffi_bench import FIXTURES, compare, summarize
+
+# Benchmarks of status, unprotect and protect from each cache state, so that a cache's effect shows as the
+# difference between two scenarios. Before every timed call the caches are dropped down to the scenario's
+# layer: cold starts from no context, cold_engine from loaded contexts and profiles, cold_license from loaded
+# engines, and warm keeps everything. The services are answered from HTTP recordings, whose request count
+# gives the service calls each call made:
+#
+#   MSIP_LD_PATH=bins/release/x64/aip_file.so python -m app.bench.cache_bench --application_id=<app-id> \
+#       --replay=<recordings> --token=<token>
+
+# Scenario and the layer dropped before each of its calls, from the coldest
+SCENARIOS = (('cold', 'contexts'), ('cold_engine', 'engines'), ('cold_license', 'licenses'), ('warm', None))
+
+
+def layer_costs(results: dict) -> dict:
+    # Median milliseconds each layer adds to an operation: the difference between the scenario that drops it
+    # and the next warmer one. Operations missing a scenario have no costs
+    costs = {}
+    layers = [(SCENARIOS[i][1], SCENARIOS[i][0], SCENARIOS[i + 1][0]) for i in range(len(SCENARIOS) - 1)]
+    for operation in sorted({name.split('/')[0] for name in results}):
+        for layer, colder, warmer in layers:
+            cold = results.get(f"{operation}/{colder}", {})
+            warm = results.get(f"{operation}/{warmer}", {})
+            if 'p50_ms' in cold and 'p50_ms' in warm:
+                costs[f"{operation}/{layer}"] = cold['p50_ms'] - warm['p50_ms']
+    return costs
+
+
+def _scenario(ext, layer, call, iterations: int) -> dict:
+    # Times iterations calls, each after dropping layer, with their service calls from the replay stats.
+    # The warm scenario gets one untimed call first so the caches hold what it needs
+    if layer is None:
+        call()
+    samples = []
+    service_calls = []
+    for _ in range(iterations):
+        if layer is not None and ext.ext_drop_caches(layer) != 0:
+            return {"skipped": f"dropping {layer} failed"}
+        before = ext.ext_get_http_replay_stats()
+        begin = time.perf_counter_ns()
+        result = call()
+        samples.append((time.perf_counter_ns() - begin) / 1e9)
+        after = ext.ext_get_http_replay_stats()
+        if isinstance(result, dict) and not result.get('status', True):
+            return {"skipped": result.get('error', 'failed')}
+        service_calls.append(after.get('requests', 0) - before.get('requests', 0))
+    return dict(summarize(samples), service_calls=sum(service_calls) / len(service_calls),
+                max_service_calls=max(service_calls))
+
+
+def run(args) -> dict:
+    # Imported here so that --help and layer_costs work without the library
+    from app.pubsub import external_functions as ext
+    from app.pubsub import models
+
+    if ext.ext_configure_http_replay('replay', args.replay, args.latency_ms, args.jitter_ms) != 0:
+        raise SystemExit(f"cannot replay the recordings in {args.replay}")
+    init = ext.ext_init(args.application_id)
+    if not init.get('status', True):
+        raise SystemExit(f"msipInit failed: {init}")
+
+    scratch = tempfile.mkdtemp(prefix='msip-cache-bench-')
+    try:
+        path = os.path.join(scratch, os.path.basename(args.fixture))
+        shutil.copyfile(args.fixture, path)
+        common = {"file": path, "application_id": args.application_id}
+
+        def written(response):
+            # Outputs are written next to the input as <name>_modified<ext>
+            for output in glob.glob(os.path.join(scratch, '*_modified*')):
+                os.remove(output)
+            return response
+
+        operations = {'status': lambda: ext.ext_get_file_status(models.FileData(**common))}
+        if args.token:
+            unprotect = models.UnprotectFileData(**common, scc_token=args.token)
+            operations['unprotect'] = lambda: written(ext.ext_unprotect_file(unprotect))
+            if args.user and args.template:
+                protect = models.ProtectFileData(**common, scc_token=args.token, user=args.user,
+                                                 encrypted_file=args.template)
+                operations['protect'] = lambda: written(ext.ext_protect_file(protect))
+        results = {}
+        for operation in ('status', 'unprotect', 'protect'):
+            for scenario, layer in SCENARIOS:
+                name = f"{operation}/{scenario}"
+                if args.filter and args.filter not in name:
+                    continue
+                if operation not in operations:
+                    results[name] = {"skipped": "no --token" if operation == 'unprotect' else "no --user and --template"}
+                    continue
+                results[name] = _scenario(ext, layer, operations[operation], args.iterations)
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+        ext.ext_shutdown()
+    return results
+
+
+def _print_table(results: dict, costs: dict):
+    print(f"{'benchmark':<32} {'p50 ms':>10} {'p90 ms':>10} {'p99 ms':>10} {'calls':>8} {'max':>5}")
+    for name, result in sorted(results.items()):
+        if 'skipped' in result:
+            print(f"{name:<32} skipped: {result['skipped']}")
+            continue
+        print(f"{name:<32} {result['p50_ms']:>10.3f} {result['p90_ms']:>10.3f} {result['p99_ms']:>10.3f} "
+              f"{result['service_calls']:>8.1f} {result['max_service_calls']:>5}")
+    for name, milliseconds in sorted(costs.items()):
+        print(f"layer {name:<26} {milliseconds:>10.3f}")
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description='Benchmarks operations of aip_file.so from each cache state')
+    parser.add_argument('--application_id', required=True)
+    parser.add_argument('--replay', required=True, help='Directory of HTTP recordings served instead of the services')
+    parser.add_argument('--fixture', default=os.path.join(FIXTURES, 'itar-iss.docx'))
+    parser.add_argument('--token', default='', help='Token for unprotect and protect; without it they are skipped')
+    parser.add_argument('--user', default='')
+    parser.add_argument('--template', default='', help='Template protect applies')
+    parser.add_argument('--latency_ms', type=int, default=0)
+    parser.add_argument('--jitter_ms', type=int, default=0)
+    parser.add_argument('--filter', default='', help='Only benchmarks whose name contains it')
+    parser.add_argument('--iterations', type=int, default=20, help='Timed calls per scenario')
+    parser.add_argument('--out', default='', help='Write the results as JSON')
+    parser.add_argument('--baseline', default='', help='Results JSON to compare against')
+    parser.add_argument('--threshold', type=float, default=0.25,
+                        help='Fraction a median or throughput may be worse than its baseline')
+    args = parser.parse_args(argv)
+
+    results = run(args)
+    costs = layer_costs(results)
+    _print_table(results, costs)
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump({"results": results, "layers_ms": costs}, f, indent=2, sort_keys=True)
+    if not args.baseline:
+        return 0
+    with open(args.baseline) as f:
+        baselines = json.load(f)
+    regressions = compare(results, baselines.get('results', baselines), args.threshold)
+    for regression in regressions:
+        print(f"REGRESSION {regression}", file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
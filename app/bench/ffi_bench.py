@@ -0,0 +1,258 @@
+import argparse
+import ctypes
+import glob
+import json
+import os
+import shutil
+import sys
+import tempfile
+import time
+import zipfile
+
+# Benchmarks of each layer an invocation crosses on its way to aip_file.so and back: the request's JSON,
+# its pydantic model, the ctypes call, the native call and the result's JSON. Run it against a built library,
+# with HTTP replay in place of the services so that native times do not vary with the network:
+#
+#   MSIP_LD_PATH=bins/release/x64/aip_file.so python -m app.bench.ffi_bench --application_id=<app-id> \
+#       --replay=<recordings> --baseline=app/bench/baselines.json
+#
+# Its settings come from the environment like the service's, so MSIP_NATIVE_MODULE=false measures the
+# ctypes bindings end to end.
+
+FIXTURES = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), 'tests', 'fixtures')
+PERCENTILES = (50, 90, 99)
+
+
+def _percentile(sorted_samples: list, percentile: float) -> float:
+    # Nearest rank, so every reported value is one that was measured
+    index = max(int(round(percentile / 100 * len(sorted_samples) + 0.5)) - 1, 0)
+    return sorted_samples[min(index, len(sorted_samples) - 1)]
+
+
+def summarize(samples: list) -> dict:
+    # Per-call seconds as throughput and percentiles in milliseconds
+    ordered = sorted(samples)
+    total = sum(ordered)
+    summary = {"iterations": len(ordered), "ops_per_sec": len(ordered) / total if total > 0 else 0.0,
+               "mean_ms": total / len(ordered) * 1000}
+    for percentile in PERCENTILES:
+        summary[f"p{percentile}_ms"] = _percentile(ordered, percentile) * 1000
+    return summary
+
+
+def measure(run, min_time: float, min_iterations: int) -> list:
+    # Seconds taken by each call of run, called until both minimums are met after one warm-up call
+    run()
+    samples = []
+    started = time.perf_counter()
+    while len(samples) < min_iterations or time.perf_counter() - started < min_time:
+        begin = time.perf_counter_ns()
+        run()
+        samples.append((time.perf_counter_ns() - begin) / 1e9)
+    return samples
+
+
+def generate_large_files(fixture: str, sizes_mb: list, directory: str) -> list:
+    # Copies of the fixture padded with a stored part of random bytes, so each stays a valid document of the
+    # requested size whose content the SDK has to read through
+    paths = []
+    root, extension = os.path.splitext(os.path.basename(fixture))
+    for size_mb in sizes_mb:
+        path = os.path.join(directory, f"{root}-{size_mb}mb{extension}")
+        shutil.copyfile(fixture, path)
+        with zipfile.ZipFile(path, 'a', compression=zipfile.ZIP_STORED) as archive:
+            archive.writestr('customXml/padding.bin', os.urandom(size_mb * 1024 * 1024))
+        paths.append(path)
+    return paths
+
+
+def compare(results: dict, baselines: dict, threshold: float) -> list:
+    # Benchmarks whose median or throughput is worse than their baseline by more than threshold, as messages.
+    # Benchmarks without a baseline, or skipped, are not compared
+    regressions = []
+    for name, result in sorted(results.items()):
+        baseline = baselines.get(name)
+        if not baseline or 'p50_ms' not in result:
+            continue
+        if result['p50_ms'] > baseline['p50_ms'] * (1 + threshold):
+            regressions.append(f"{name}: p50 {result['p50_ms']:.4f} ms against {baseline['p50_ms']:.4f} ms")
+        if result['ops_per_sec'] < baseline['ops_per_sec'] / (1 + threshold):
+            regressions.append(f"{name}: {result['ops_per_sec']:.1f} ops/s against {baseline['ops_per_sec']:.1f} ops/s")
+    return regressions
+
+
+class _Phases:
+    # Native phase time per call, from the library's phase histograms before and after a benchmark
+
+    def __init__(self, ext):
+        self._ext = ext
+        self._before = self._read()
+
+    def _read(self) -> dict:
+        return {name: (phase['count'], phase['sum']) for name, phase in self._ext.ext_get_metrics().get('phases', {}).items()}
+
+    def per_call_ms(self, calls: int) -> dict:
+        phases = {}
+        for name, (count, total) in self._read().items():
+            before_count, before_total = self._before.get(name, (0, 0.0))
+            if count > before_count:
+                phases[name] = (total - before_total) / calls * 1000
+        return phases
+
+
+def _operation_benchmarks(ext, args, name: str, model, payload: dict, export, export_args, scratch: str) -> dict:
+    # The layers of one operation on one input, each measured on its own, then the whole request path as the
+    # Dapr handlers run it. The call layer passes the same arguments as export_args to the *_v2 export
+    request_text = json.dumps(payload)
+    data = model(**payload)
+    result_buffer = ext._result_buffer()
+    needed = ctypes.c_size_t(0)
+    operation = name.split('/')[0]
+    ext_call = {'status': ext.ext_get_file_status, 'unprotect': ext.ext_unprotect_file,
+                'protect': ext.ext_protect_file}[operation]
+
+    def remove_outputs():
+        # Outputs are written next to the input as <name>_modified<ext>; status writes none
+        if operation != 'status':
+            for output in glob.glob(os.path.join(scratch, '*_modified*')):
+                os.remove(output)
+
+    def call():
+        export(*export_args(data), result_buffer, len(result_buffer), ctypes.byref(needed))
+        remove_outputs()
+
+    call()
+    result_json = result_buffer.value.decode('utf-8')
+    result = json.loads(result_json)
+    if not result.get('status', True):
+        return {name: {"skipped": result.get('error', 'failed')}}
+
+    def request():
+        response = ext_call(model(**json.loads(request_text)))
+        json.dumps(response).encode()
+        remove_outputs()
+
+    benchmarks = {
+        'request_decode': lambda: json.loads(request_text),
+        'validate': lambda: model(**payload),
+        'result_decode': lambda: json.loads(result_buffer.value.decode('utf-8')),
+        'response_encode': lambda: json.dumps(result).encode(),
+    }
+    results = {}
+    for layer, run in benchmarks.items():
+        results[f"{name}/{layer}"] = summarize(measure(run, args.min_time, args.min_iterations))
+    phases = _Phases(ext)
+    samples = measure(call, args.min_time, args.min_iterations)
+    results[f"{name}/native"] = dict(summarize(samples), phases_ms=phases.per_call_ms(len(samples) + 1))
+    results[f"{name}/end_to_end"] = summarize(measure(request, args.min_time, args.min_iterations))
+    return results
+
+
+def run(args) -> dict:
+    # Imported here so that --help and the pure helpers above work without the library
+    from app.pubsub import external_functions as ext
+    from app.pubsub import models
+
+    if args.replay:
+        ext.ext_configure_http_replay('replay', args.replay, args.latency_ms, args.jitter_ms)
+    init = ext.ext_init(args.application_id)
+    if not init.get('status', True):
+        raise SystemExit(f"msipInit failed: {init}")
+
+    results = {}
+    # The fixed cost of a ctypes call: a v2 export's argument conversion with nothing for the library to do
+    result_buffer = ext._result_buffer()
+    needed = ctypes.c_size_t(0)
+    results['ctypes/call'] = summarize(measure(
+        lambda: ext.msip_take_result(result_buffer, len(result_buffer), ctypes.byref(needed)), args.min_time,
+        args.min_iterations))
+
+    scratch = tempfile.mkdtemp(prefix='msip-ffi-bench-')
+    try:
+        inputs = [os.path.join(scratch, os.path.basename(args.fixture))]
+        shutil.copyfile(args.fixture, inputs[0])
+        inputs += generate_large_files(args.fixture, args.large_mb, scratch)
+        for path in inputs:
+            label = os.path.basename(path)
+            if args.filter and args.filter not in label:
+                continue
+            common = {"file": path, "application_id": args.application_id}
+            results.update(_operation_benchmarks(
+                ext, args, f"status/{label}", models.FileData, common, ext.get_file_status,
+                lambda d: (d.file.encode(), d.application_id.encode()), scratch))
+            if not args.token:
+                results[f"unprotect/{label}"] = {"skipped": "no --token"}
+                continue
+            results.update(_operation_benchmarks(
+                ext, args, f"unprotect/{label}", models.UnprotectFileData, dict(common, scc_token=args.token),
+                ext.unprotect_file, lambda d: (d.scc_token.encode(), d.file.encode(), d.application_id.encode()),
+                scratch))
+            if not (args.user and args.template):
+                results[f"protect/{label}"] = {"skipped": "no --user and --template"}
+                continue
+            results.update(_operation_benchmarks(
+                ext, args, f"protect/{label}", models.ProtectFileData,
+                dict(common, scc_token=args.token, user=args.user, encrypted_file=args.template), ext.protect_file,
+                lambda d: (d.scc_token.encode(), d.file.encode(), d.encrypted_file.encode(), d.user.encode(),
+                           d.application_id.encode()), scratch))
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+        ext.ext_shutdown()
+    return results
+
+
+def _print_table(results: dict):
+    print(f"{'benchmark':<48} {'ops/s':>12} {'p50 ms':>10} {'p90 ms':>10} {'p99 ms':>10}")
+    for name, result in sorted(results.items()):
+        if 'skipped' in result:
+            print(f"{name:<48} skipped: {result['skipped']}")
+            continue
+        print(f"{name:<48} {result['ops_per_sec']:>12.1f} {result['p50_ms']:>10.4f} {result['p90_ms']:>10.4f} "
+              f"{result['p99_ms']:>10.4f}")
+        for phase, milliseconds in sorted(result.get('phases_ms', {}).items()):
+            print(f"  {phase:<46} {milliseconds:>34.4f}")
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description='Benchmarks each layer between a request and aip_file.so')
+    parser.add_argument('--application_id', required=True)
+    parser.add_argument('--fixture', default=os.path.join(FIXTURES, 'itar-iss.docx'))
+    parser.add_argument('--large_mb', type=lambda v: [int(s) for s in v.split(',') if s], default=[16, 64],
+                        help='Sizes of the generated inputs in MiB, comma separated')
+    parser.add_argument('--token', default='', help='Token for unprotect and protect; without it they are skipped')
+    parser.add_argument('--user', default='')
+    parser.add_argument('--template', default='', help='Template protect applies')
+    parser.add_argument('--replay', default='', help='Directory of HTTP recordings served instead of the services')
+    parser.add_argument('--latency_ms', type=int, default=0)
+    parser.add_argument('--jitter_ms', type=int, default=0)
+    parser.add_argument('--filter', default='', help='Only inputs whose name contains it')
+    parser.add_argument('--min_time', type=float, default=0.5, help='Minimum seconds per benchmark')
+    parser.add_argument('--min_iterations', type=int, default=20)
+    parser.add_argument('--out', default='', help='Write the results as JSON')
+    parser.add_argument('--baseline', default='', help='Results JSON to compare against')
+    parser.add_argument('--threshold', type=float, default=0.25,
+                        help='Fraction a median or throughput may be worse than its baseline')
+    parser.add_argument('--update_baseline', action='store_true', help='Write the results to --baseline instead')
+    args = parser.parse_args(argv)
+
+    results = run(args)
+    _print_table(results)
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    if not args.baseline:
+        return 0
+    if args.update_baseline:
+        with open(args.baseline, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        return 0
+    with open(args.baseline) as f:
+        baselines = json.load(f)
+    regressions = compare(results, baselines, args.threshold)
+    for regression in regressions:
+        print(f"REGRESSION {regression}", file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
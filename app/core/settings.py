@@ -11,13 +11,255 @@ class EnvSettings(BaseSettings):
     NAME: str = 'msip_file_handler_microservice'
 
     MSIP_LD_PATH: Path = Path('/app/lib/aip_file.so')
+    MSIP_LAZY_BINDING: bool = True
+    MSIP_NATIVE_MODULE: bool = True
+    MSIP_WORKERD_SOCKET: str = ''
 
     BASE_DIR: Path = Path(__file__).resolve().parent.parent
 
     ENVIRONMENT: str = 'dev'
 
     PROMETHEUS_PORT: int = 8000
+    MSIP_HEALTH_PORT: int = 0
     GRPC_PORT: int = 50051
+    GRPC_MAX_WORKERS: int = 10
+
+    # Pub/sub consumer, subscribed when MSIP_PUBSUB_NAME names a component; an empty topic is not subscribed
+    MSIP_PUBSUB_NAME: str = ''
+    MSIP_PUBSUB_INSPECT_TOPIC: str = 'inspect_file'
+    MSIP_PUBSUB_UNPROTECT_TOPIC: str = 'unprotect_file'
+    MSIP_PUBSUB_PROTECT_TOPIC: str = 'protect_file'
+    MSIP_PUBSUB_RESULT_TOPIC: str = ''
+    MSIP_PUBSUB_BATCH_SIZE: int = 100
+    MSIP_PUBSUB_BATCH_WINDOW_MS: int = 50
+
+    # Native library
+    MSIP_ENGINE_CACHE_SIZE: int = 16
+    MSIP_POLICY_ENGINE_CACHE_SIZE: int = 0
+    MSIP_POLICY_REFRESH_SECONDS: int = 3600
+    MSIP_ENGINE_IDLE_SECONDS: int = 0
+    MSIP_TEMPLATE_REFRESH_SECONDS: int = 3600
+    MSIP_FAST_SHUTDOWN: bool = True
+    MSIP_NATIVE_JSON: bool = False
+    MSIP_NATIVE_XML: bool = False
+    MSIP_BATCH_DEDUPE: str = 'off'
+    MSIP_READ_AHEAD_QUEUE_DEPTH: int = 0
+    MSIP_READ_AHEAD_BUFFER_BYTES: int = 262144
+    MSIP_READ_AHEAD_MAX_BYTES: int = 268435456
+    MSIP_BATCH_PREFETCH_DEPTH: int = 0
+    MSIP_BATCH_PREFETCH_MAX_BYTES: int = 67108864
+    MSIP_BATCH_PREFETCH_PREFAULT_BYTES: int = 67108864
+    # Workers of the read, open, rights, transform and commit stages of protect and unprotect batches, e.g.
+    # "2,8,1,4,2"; empty processes each file in one call
+    MSIP_BATCH_PIPELINE_WORKERS: str = ''
+    MSIP_BATCH_PIPELINE_QUEUE: int = 16
+    # Pin batch workers round robin to the NUMA nodes and keep their buffers node-local
+    MSIP_NUMA_PLACEMENT: bool = False
+    # Transparent huge pages for large pooled buffers and mapped inputs, and prefaulting of mapped inputs of
+    # at least MSIP_PREFAULT_MIN_BYTES (0 for none) and of new large pool buffers
+    MSIP_HUGE_PAGES: bool = True
+    MSIP_PREFAULT_MIN_BYTES: int = 0
+    MSIP_PREFAULT_POOL: bool = False
+    MSIP_OUTPUT_BUFFER_BYTES: int = 0
+    MSIP_OUTPUT_DIRECT_IO: bool = False
+    MSIP_OUTPUT_DROP_CACHE: bool = False
+    MSIP_OUTPUT_PREALLOCATE: bool = True
+    # Unprotected Office packages written part by part instead of recompressed by the SDK commit
+    MSIP_PACKAGE_REPACK: bool = False
+    MSIP_PACKAGE_REPACK_MAX_BYTES: int = 268435456
+    MSIP_PACKAGE_REPACK_DEFLATE_MIN_BYTES: int = 65536
+    MSIP_PACKAGE_REPACK_LEVEL: int = 6
+    MSIP_CLONE_LABEL_OUTPUTS: bool = False
+    MSIP_PFILE_FAST_PATH: bool = False
+    MSIP_SKIP_UNCHANGED: bool = False
+    MSIP_PDF_KEEP_LINEARIZATION: bool = False
+    MSIP_PDF_INCREMENTAL_UPDATES: bool = False
+    MSIP_INPUT_POOLED_MAX_BYTES: int = 0
+    MSIP_INPUT_MAPPED_MIN_BYTES: int = 16 * 1024 * 1024
+    MSIP_INPUT_WINDOWED_MIN_BYTES: int = 1024 * 1024 * 1024
+    MSIP_INPUT_WINDOW_BYTES: int = 4 * 1024 * 1024
+    MSIP_INPUT_READ_AHEAD_BYTES: int = 8 * 1024 * 1024
+    # Object storage transfers; 0 keeps the library's 256 KiB blocks, 64 cached, 8 MiB parts, 4 in flight and
+    # 16 transfer threads
+    MSIP_OBJECT_BLOCK_BYTES: int = 0
+    MSIP_OBJECT_CACHE_BLOCKS: int = 0
+    MSIP_OBJECT_PART_BYTES: int = 0
+    MSIP_OBJECT_PARTS_IN_FLIGHT: int = 0
+    MSIP_OBJECT_TRANSFER_THREADS: int = 0
+    MSIP_SHM_DIR: str = '/dev/shm'
+    MSIP_REQUEST_TIMEOUT_MS: int = 0
+    # Results kept for invocations carrying an idempotency-key header, 0 to ignore the header
+    MSIP_IDEMPOTENCY_CACHE_SIZE: int = 4096
+    MSIP_IDEMPOTENCY_TTL_SECONDS: int = 600
+    MSIP_CACHE_STORAGE: str = 'in_memory'
+    MSIP_STORAGE_PATH: str = ''
+    MSIP_CACHE_LICENSES: bool = True
+    MSIP_POLICY_TTL_DAYS: int = 0
+    MSIP_POLICY_SNAPSHOT_PATH: str = ''
+    MSIP_POLICY_SNAPSHOT_EXPORT: bool = False
+    MSIP_SHARED_LABELS_DIR: str = ''
+    MSIP_CLASSIFICATION: bool = False
+    MSIP_SENSITIVITY_TYPE_CACHE_PATH: str = ''
+    MSIP_LOCALE: str = 'en-US'
+    MSIP_FLIGHTING_FEATURES: str = ''
+    MSIP_ENABLE_FUNCTIONALITY: str = ''
+    MSIP_DISABLE_FUNCTIONALITY: str = ''
+    MSIP_TASK_TIMEOUT_MS: int = 0
+    MSIP_MAX_FILE_SIZE_FOR_PROTECTION: int = 0
+    MSIP_CUSTOM_SETTINGS: dict[str, str] = {}
+    # Service hosts, with their subdomains, that profiles consent to; with MSIP_CONSENT_REJECT_OTHERS the only ones
+    MSIP_CONSENT_ALLOWED_HOSTS: list[str] = []
+    MSIP_CONSENT_REJECT_OTHERS: bool = False
+    MSIP_LOG_LEVEL: str = 'info'
+    MSIP_LOG_SINK: str = 'file'
+    MSIP_LOG_BUFFER_SIZE: int = 8192
+    MSIP_LOG_TRACE_SAMPLE: int = 1
+    MSIP_LOG_MAX_PER_SECOND: int = 0
+    # Level SDK contexts capture records from, below MSIP_LOG_LEVEL to trace modules and requests on demand; '' captures nothing extra
+    MSIP_LOG_CAPTURE_LEVEL: str = ''
+    # Comma-separated SDK source path fragments whose captured records are always written, e.g. 'http,policy'
+    MSIP_LOG_TRACE_MODULES: str = ''
+    # Signal number that switches the SDK log threshold between MSIP_LOG_LEVEL and the capture level, 0 to disable
+    MSIP_LOG_TRACE_SIGNAL: int = 0
+    MSIP_REDIS_URL: str | None = None
+    MSIP_REDIS_KEY_PREFIX: str = 'msip'
+    MSIP_REDIS_L1_TTL: int = 30
+    # Redis that sharded jobs are split into, shared by every replica; unset turns sharding off
+    MSIP_SHARD_REDIS_URL: str | None = None
+    MSIP_SHARD_KEY_PREFIX: str = 'msip:shards:'
+    # Shards this replica runs at a time, 0 to only submit jobs; a shard whose lease lapses is taken over
+    MSIP_SHARD_WORKERS: int = 0
+    MSIP_SHARD_LEASE_MS: int = 30000
+    MSIP_SHARD_POLL_MS: int = 1000
+    # Comma-separated directories whose written files get a status probe, each with a fresh inspection; unset
+    # turns the watcher off
+    MSIP_WATCH_ROOTS: str = ''
+    MSIP_WATCH_FILTERS: str = ''
+    MSIP_WATCH_APPLICATION_ID: str = ''
+    # File the probes are appended to as NDJSON, empty to only refresh the caches
+    MSIP_WATCH_OUTPUT: str = ''
+    MSIP_WATCH_SETTLE_MS: int = 500
+    # Byte budget of the native in-memory storage tables, 0 to keep the SDK's own storage
+    MSIP_MEMORY_STORAGE_BYTES: int = 0
+    # 64 hex digit key sealing the on-disk storage tables in native encrypted logs, empty to keep the SDK's storage
+    MSIP_STORAGE_KEY: str = ''
+    MSIP_CLIENT_SECRET: str | None = None
+    MSIP_DIAGNOSTIC_ENDPOINT: str | None = None
+    MSIP_DIAGNOSTIC_AUTHORIZATION: str = ''
+    MSIP_DIAGNOSTIC_QUEUE_SIZE: int = 8192
+    MSIP_DIAGNOSTIC_BATCH_SIZE: int = 512
+    MSIP_DIAGNOSTIC_FLUSH_MS: int = 5000
+    MSIP_HTTP_MAX_RETRIES: int = 2
+    MSIP_HTTP_RETRY_BASE_MS: int = 100
+    MSIP_HTTP_RETRY_MAX_MS: int = 2000
+    MSIP_HTTP_HEDGE: bool = True
+    MSIP_HTTP_HEDGE_MIN_MS: int = 50
+    MSIP_HTTP_BREAKER_FAILURES: int = 5
+    MSIP_HTTP_BREAKER_OPEN_MS: int = 30000
+    MSIP_HTTP_RATE_LIMIT: bool = True
+    MSIP_HTTP_RATE_MIN: float = 1.0
+    MSIP_HTTP_RATE_MAX: float = 0.0
+    MSIP_HTTP_RATE_INCREASE: float = 5.0
+    MSIP_HTTP_RATE_DECREASE: float = 0.5
+    MSIP_HTTP_MAX_RETRY_AFTER_MS: int = 60000
+    MSIP_HTTP_RATE_RELAX_MS: int = 60000
+    MSIP_HTTP_REPLAY_MODE: str = ''
+    MSIP_HTTP_REPLAY_DIR: str = ''
+    MSIP_HTTP_REPLAY_LATENCY_MS: int = 0
+    MSIP_HTTP_REPLAY_JITTER_MS: int = 0
+    MSIP_DKE_URLS: str = ''
+    MSIP_DKE_PUBLIC_KEY_TTL_SECONDS: int = 3600
+    MSIP_DKE_UNWRAP_TTL_SECONDS: int = 600
+    MSIP_DKE_CACHE_SIZE: int = 4096
+    MSIP_PROTECTION_CACHE_SIZE: int = 64
+    MSIP_LICENSE_INFO_CACHE_SIZE: int = 256
+    MSIP_USE_LICENSE_CACHE_SIZE: int = 1024
+    MSIP_DELEGATION_LICENSE_CACHE_SIZE: int = 4096
+    MSIP_DELEGATION_LICENSE_TTL: int = 3600
+    MSIP_RIGHTS_CACHE_SIZE: int = 16384
+    MSIP_RIGHTS_CACHE_TTL: int = 3600
+    # Plaintext of hot protected files kept sealed in memory; 0 bytes disables it
+    MSIP_DECRYPTED_CACHE_BYTES: int = 0
+    MSIP_DECRYPTED_CACHE_MAX_ENTRY_BYTES: int = 0
+    # Structural reads of recently opened inputs, reused by the next operation on the same file; 0 disables it
+    MSIP_CONTAINER_CACHE_SIZE: int = 0
+    MSIP_CONTAINER_CACHE_TTL_MS: int = 30000
+    MSIP_CONTAINER_CACHE_MAX_FILE_BYTES: int = 0
+    MSIP_TENANT_CACHE_SIZE: int = 1024
+    MSIP_TENANT_CACHE_TTL: int = 86400
+    MSIP_DATA_BOUNDARY: str = ''
+    MSIP_DNS_REDIRECTION: bool = True
+    MSIP_TENANT_REGIONS: dict[str, dict] = {}
+    MSIP_DELEGATED_IDENTITIES: dict[str, str] = {}
+    MSIP_INSPECTION_CACHE_SIZE: int = 0
+    MSIP_INSPECTION_CACHE_TTL: int = 0
+    MSIP_INSPECTION_CACHE_VERIFY: bool = False
+    # Content keys found clean held at MSIP_KNOWN_CLEAN_FP_RATE, 0 to disable; saved to MSIP_KNOWN_CLEAN_PATH
+    MSIP_KNOWN_CLEAN_SIZE: int = 0
+    MSIP_KNOWN_CLEAN_FP_RATE: float = 0.01
+    MSIP_KNOWN_CLEAN_MAX_AGE: int = 86400
+    MSIP_KNOWN_CLEAN_VERIFY_ONE_IN: int = 1000
+    MSIP_KNOWN_CLEAN_PATH: str = ''
+    MSIP_TRACE_BUFFER_SIZE: int = 1024
+    # Signal number that toggles a CPU profile written under MSIP_CPU_PROFILE_DIR, 0 to disable
+    MSIP_CPU_PROFILE_SIGNAL: int = 0
+    MSIP_CPU_PROFILE_HZ: int = 99
+    MSIP_CPU_PROFILE_SECONDS: int = 30
+    MSIP_CPU_PROFILE_DIR: str = '/tmp'
+    # Protect and unprotect operations taking at least this long are logged with their phases, 0 to disable
+    MSIP_SLOW_OPERATION_MS: int = 0
+    MSIP_SLOW_OPERATION_BUFFER: int = 64
+    # File the shapes of served operations are captured to for msip_loadgen --capture, empty for none
+    MSIP_CAPTURE_PATH: str = ''
+    MSIP_CAPTURE_SAMPLE_EVERY: int = 1
+    MSIP_CAPTURE_MAX_RECORDS: int = 0
+    # One in this many protect and unprotect operations gets a Chrome trace timeline, 0 for none
+    MSIP_TIMELINE_SAMPLE_EVERY: int = 0
+    MSIP_TIMELINE_BUFFER: int = 16
+    MSIP_LOCK_SAMPLE_EVERY: int = 64
+    # Files whose Office, PDF or message extension does not match their first bytes are rejected before being opened
+    MSIP_FORMAT_CHECK: bool = True
+    # Larger files are rejected before being opened, 0 for no limit
+    MSIP_MAX_INPUT_BYTES: int = 0
+    # CPU time and output bytes one file's operation may use, 0 for no limit; inputs over budget are refused for the quarantine seconds
+    MSIP_BUDGET_CPU_MS: int = 0
+    MSIP_BUDGET_OUTPUT_BYTES: int = 0
+    MSIP_QUARANTINE_SECONDS: int = 600
+    MSIP_FILE_SESSION_IDLE_SECONDS: int = 60
+    MSIP_MAX_IN_FLIGHT: int = 0
+    MSIP_MEMORY_BUDGET_BYTES: int = 0
+    MSIP_ADAPTIVE_ADMISSION: bool = False
+    MSIP_ADAPTIVE_INITIAL_LIMIT: int = 16
+    MSIP_ADAPTIVE_MIN_LIMIT: int = 1
+    MSIP_ADAPTIVE_MAX_LIMIT: int = 256
+    MSIP_ADAPTIVE_TOLERANCE: float = 1.5
+    MSIP_ADAPTIVE_WINDOW: int = 1000
+    # Charges each tenant's operations for their CPU time, bytes, HTTP requests and cache lookups
+    MSIP_COST_ACCOUNTING: bool = False
+    MSIP_BUFFER_POOL_BYTES: int = 268435456
+    MSIP_TEMP_DIR: str = ''
+    MSIP_TEMP_POOL_SIZE: int = 16
+    MSIP_TEMP_MAX_FILE_BYTES: int = 0
+    MSIP_TEMP_FALLBACK_DIR: str = ''
+    MSIP_AUTO_TUNE: bool = True
+    MSIP_AUTO_TUNE_PRESSURE: bool = True
+    MSIP_TENANT_MAX_ENGINES: int = 0
+    MSIP_TENANT_MAX_LICENSES: int = 0
+    MSIP_TENANT_MAX_IN_FLIGHT: int = 0
+    MSIP_TENANT_WEIGHTS: dict[str, int] = {}
+    MSIP_RESERVED_INTERACTIVE_WORKERS: int = -1
+    MSIP_MAX_BULK_IN_FLIGHT: int = 0
+    MSIP_WARMUP: list[dict] = []
+    MSIP_RESTORE_ENGINES: bool = False
+    # Snapshot of the warm caches restored before the warm-up and written again on SIGTERM, empty for none
+    MSIP_CACHE_SNAPSHOT_PATH: str = ''
+    MSIP_RELOAD_CONFIG_PATH: str = ''
+    MSIP_RELOAD_SIGNAL: int = 1
+    MSIP_PREFORK_WORKERS: int = 0
+    MSIP_PREFORK_TIMEOUT_MS: int = 5000
+    MSIP_DRAIN_DELAY_MS: int = 0
+    MSIP_DRAIN_TIMEOUT_MS: int = 20000
+    MSIP_DRAIN_FLUSH_MS: int = 5000
 
     
     # Sentry
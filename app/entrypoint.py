@@ -1,19 +1,121 @@
+import atexit
+import json
 import logging
+import os
+import signal
 import threading
+import time
+from concurrent import futures
 from app.core.settings import settings
 from dapr.ext.grpc import App, InvokeMethodRequest, InvokeMethodResponse
 from prometheus_client import start_http_server
-from app.pubsub.internal_functions import inspect_file, protect_file, unprotect_file
+from app.metrics.health import start_health_server
+from app.pubsub.internal_functions import (
+    get_sharded_job, handle_file_event, inspect_archive, inspect_file, protect_file, submit_sharded_job, unprotect_file
+)
+from app.pubsub.prefork import fork_workers
+from app.pubsub.external_functions import (
+    ext_configure_adaptive_admission,
+    ext_configure_cost_accounting,
+    ext_configure_admission,
+    ext_configure_batch_pipeline,
+    ext_configure_batch_prefetch,
+    ext_configure_batch_read_ahead,
+    ext_configure_buffer_pool,
+    ext_configure_temp_files,
+    ext_configure_container_cache,
+    ext_configure_shared_labels,
+    ext_configure_decrypted_content_cache,
+    ext_configure_numa_placement,
+    ext_configure_memory_hints,
+    ext_configure_object_storage,
+    ext_configure_delegation_license_cache,
+    ext_configure_diagnostic_upload,
+    ext_configure_dke_cache,
+    ext_configure_engines,
+    ext_configure_http_replay,
+    ext_configure_http_rate_limit,
+    ext_configure_http_resilience,
+    ext_configure_inspection_cache,
+    ext_configure_known_clean,
+    ext_configure_logging,
+    ext_configure_encrypted_storage,
+    ext_configure_memory_storage,
+    ext_configure_output_writer,
+    ext_configure_package_repack,
+    ext_configure_input_streams,
+    ext_configure_redis_storage,
+    ext_configure_rights_cache,
+    ext_configure_classification,
+    ext_configure_consent,
+    ext_configure_slow_operations,
+    ext_start_capture,
+    ext_stop_capture,
+    ext_configure_timelines,
+    ext_configure_lock_metrics,
+    ext_configure_format_gate,
+    ext_configure_operation_budget,
+    ext_configure_idempotency,
+    ext_configure_shards,
+    ext_configure_watch,
+    ext_configure_policy_snapshot,
+    ext_configure_storage,
+    ext_configure_tenant_cache,
+    ext_configure_region,
+    ext_configure_delegated_identity,
+    ext_configure_tenant_quotas,
+    ext_configure_tracing,
+    ext_enable_cpu_profile_signal,
+    ext_set_client_secret,
+    ext_set_engine_cache_size,
+    ext_set_policy_engine_cache_size,
+    ext_set_policy_refresh,
+    ext_set_engine_idle_timeout,
+    ext_set_template_refresh,
+    ext_set_batch_dedupe,
+    ext_set_fast_shutdown,
+    ext_set_native_json,
+    ext_set_native_xml,
+    ext_set_clone_label_outputs,
+    ext_set_pfile_fast_path,
+    ext_set_skip_unchanged,
+    ext_configure_pdf,
+    ext_set_file_session_idle_timeout,
+    ext_set_tenant_weight,
+    ext_configure_priorities,
+    ext_auto_tune,
+    ext_set_license_info_cache_size,
+    ext_reload_config,
+    ext_set_log_capture_level,
+    ext_set_log_level,
+    ext_set_log_limits,
+    ext_set_module_trace,
+    ext_set_protection_cache_size,
+    ext_set_use_license_cache_size,
+    ext_get_startup_stats,
+    ext_shutdown,
+    ext_drain,
+    ext_warmup,
+    ext_restore_engines,
+    ext_snapshot,
+    ext_restore,
+)
 
 logger = logging.getLogger(__name__)
 
 
-dapr_grpc = App()
+# The native library is safe for concurrent callers and ctypes releases the GIL during each call, so
+# workers run MIP operations in parallel.
+dapr_grpc = App(thread_pool=futures.ThreadPoolExecutor(max_workers=settings.GRPC_MAX_WORKERS))
 
 @dapr_grpc.method(name='inspect_file')
 def dapr_inspect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     return inspect_file(request)
 
+@dapr_grpc.method(name='inspect_archive')
+def dapr_inspect_archive(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    return inspect_archive(request)
+
 @dapr_grpc.method(name='protect_file')
 def dapr_protect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     return protect_file(request)
@@ -22,6 +124,98 @@ def dapr_protect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
 def dapr_unprotect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     return unprotect_file(request)
 
+@dapr_grpc.method(name='submit_sharded_job')
+def dapr_submit_sharded_job(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    return submit_sharded_job(request)
+
+@dapr_grpc.method(name='get_sharded_job')
+def dapr_get_sharded_job(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    return get_sharded_job(request)
+
+
+def _file_event_handler(method_name: str):
+    def dapr_file_event(event):
+        return handle_file_event(method_name, event)
+    dapr_file_event.__name__ = f'dapr_{method_name}_event'
+    return dapr_file_event
+
+# Batch jobs publish the invocation payloads instead; each message holds a gRPC worker until its batch
+# finishes, so GRPC_MAX_WORKERS bounds how many messages one native batch call can take
+if settings.MSIP_PUBSUB_NAME:
+    for _method_name, _topic in (('inspect_file', settings.MSIP_PUBSUB_INSPECT_TOPIC),
+                                 ('unprotect_file', settings.MSIP_PUBSUB_UNPROTECT_TOPIC),
+                                 ('protect_file', settings.MSIP_PUBSUB_PROTECT_TOPIC)):
+        if _topic:
+            dapr_grpc.subscribe(pubsub_name=settings.MSIP_PUBSUB_NAME, topic=_topic)(_file_event_handler(_method_name))
+
+
+# Settings that size each auto-tuned budget; setting any of them keeps that budget as configured
+_AUTO_TUNED_SETTINGS = {
+    'engine_cache': ('MSIP_ENGINE_CACHE_SIZE',),
+    'license_caches': ('MSIP_PROTECTION_CACHE_SIZE', 'MSIP_LICENSE_INFO_CACHE_SIZE', 'MSIP_USE_LICENSE_CACHE_SIZE'),
+    'buffer_pool': ('MSIP_BUFFER_POOL_BYTES',),
+    'admission_budget': ('MSIP_MEMORY_BUDGET_BYTES',),
+}
+
+
+def toggle_log_trace_on_signal(signum: int, level: str, trace_level: str):
+    # Each signal switches the SDK log threshold between level and trace_level, for incidents without a restart
+    tracing = threading.Event()
+
+    def toggle(_signum, _frame):
+        if tracing.is_set():
+            tracing.clear()
+            ext_set_log_level(level)
+        else:
+            tracing.set()
+            ext_set_log_level(trace_level)
+        logger.info('SDK log threshold set to %s', trace_level if tracing.is_set() else level)
+
+    signal.signal(signum, toggle)
+
+
+def reload_config_on_signal(signum: int, path: str):
+    # Each signal applies the JSON object in path to the running library, e.g. from a mounted ConfigMap
+    def reload(_signum, _frame):
+        try:
+            with open(path) as config_file:
+                config = json.load(config_file)
+        except (OSError, ValueError) as e:
+            logger.error('Could not read the configuration to reload from %s: %s', path, e)
+            return
+        result = ext_reload_config(config)
+        if result.get('status'):
+            logger.info('Reloaded the configuration from %s, replacing %d engines', path,
+                        result.get('engines_reloading', 0))
+        else:
+            logger.error('Configuration reload from %s failed: %s', path, result.get('error'))
+
+    signal.signal(signum, reload)
+
+
+def drain_on_signal(signum: int, delay_ms: int, timeout_ms: int, flush_ms: int, snapshot_path: str = '',
+                    snapshot_key: str = ''):
+    # The signal keeps serving for delay_ms while endpoints stop routing here, writes the warm caches to
+    # snapshot_path if set, drains the native library and stops the gRPC server. A second signal during the
+    # drain exits at once
+    def drain(_signum, _frame):
+        signal.signal(signum, signal.SIG_DFL)
+        logger.info('Draining: serving for %d ms, then waiting up to %d ms for work in flight', delay_ms, timeout_ms)
+        time.sleep(delay_ms / 1000)
+        if snapshot_path:
+            snapshot = ext_snapshot(snapshot_path, snapshot_key)
+            if not snapshot.get('status'):
+                logger.warning('Cache snapshot not written: %s', snapshot.get('error'))
+        result = ext_drain(timeout_ms, flush_ms)
+        if result.get('drained') and result.get('flushed'):
+            logger.info('Drained in %d ms, flushed in %d ms', result.get('wait_ms', 0), result.get('flush_ms', 0))
+        else:
+            logger.warning('Drain incomplete: %s', result)
+        dapr_grpc.stop()
+        raise SystemExit(0)
+
+    signal.signal(signum, drain)
+
 
 def start_prometheus_server(port: int = 8000):
     """Start Prometheus HTTP server in a separate thread"""
@@ -36,11 +230,273 @@ def start_prometheus_server(port: int = 8000):
 
 
 if __name__ == "__main__":
-    # Start Prometheus server
-    start_prometheus_server(settings.PROMETHEUS_PORT)
+    # Start Prometheus server; forked workers start their own
+    if not settings.MSIP_PREFORK_WORKERS:
+        start_prometheus_server(settings.PROMETHEUS_PORT)
+        # Up before the warm-up, so liveness holds while readiness waits for it
+        if settings.MSIP_HEALTH_PORT:
+            start_health_server(settings.MSIP_HEALTH_PORT)
     
+    startup = ext_get_startup_stats()
+    logger.info('Loaded the native library in %.1f ms (dynamic linking %.1f ms, static initialization %.1f ms)',
+                startup['load_ms'], startup.get('dynamic_link_ms', 0), startup.get('static_init_ms', 0))
+
+    # Configure the native library and tear down the shared MIP context on exit
+    ext_set_fast_shutdown(settings.MSIP_FAST_SHUTDOWN)
+    ext_set_native_json(settings.MSIP_NATIVE_JSON)
+    ext_set_native_xml(settings.MSIP_NATIVE_XML)
+    ext_set_batch_dedupe(settings.MSIP_BATCH_DEDUPE)
+    if settings.MSIP_READ_AHEAD_QUEUE_DEPTH and ext_configure_batch_read_ahead(
+            settings.MSIP_READ_AHEAD_QUEUE_DEPTH, settings.MSIP_READ_AHEAD_BUFFER_BYTES,
+            settings.MSIP_READ_AHEAD_MAX_BYTES) != 0:
+        logger.warning('io_uring is unavailable or MSIP_READ_AHEAD_* is invalid, batches read inputs synchronously')
+    if ext_configure_batch_prefetch(settings.MSIP_BATCH_PREFETCH_DEPTH, settings.MSIP_BATCH_PREFETCH_MAX_BYTES,
+                                    settings.MSIP_BATCH_PREFETCH_PREFAULT_BYTES) != 0:
+        raise SystemExit('Invalid MSIP_BATCH_PREFETCH_* settings')
+    if settings.MSIP_BATCH_PIPELINE_WORKERS:
+        try:
+            workers = [int(w) for w in settings.MSIP_BATCH_PIPELINE_WORKERS.split(',')]
+        except ValueError:
+            workers = []
+        if len(workers) != 5 or ext_configure_batch_pipeline(*workers, settings.MSIP_BATCH_PIPELINE_QUEUE) != 0:
+            raise SystemExit('Invalid MSIP_BATCH_PIPELINE_WORKERS or MSIP_BATCH_PIPELINE_QUEUE')
+    if settings.MSIP_NUMA_PLACEMENT:
+        nodes = ext_configure_numa_placement(True).get('nodes', 1)
+        if nodes < 2:
+            logger.info('MSIP_NUMA_PLACEMENT has no effect on a single NUMA node')
+    hints = ext_configure_memory_hints(settings.MSIP_HUGE_PAGES, settings.MSIP_PREFAULT_MIN_BYTES,
+                                       settings.MSIP_PREFAULT_POOL)
+    if not hints.get('status', True):
+        raise SystemExit('Invalid MSIP_PREFAULT_MIN_BYTES')
+    if settings.MSIP_HUGE_PAGES and hints.get('transparent_hugepage') == 'never':
+        logger.info('MSIP_HUGE_PAGES has no effect while transparent huge pages are disabled')
+    if ext_configure_output_writer(
+            settings.MSIP_OUTPUT_BUFFER_BYTES, settings.MSIP_OUTPUT_DIRECT_IO, settings.MSIP_OUTPUT_DROP_CACHE,
+            settings.MSIP_OUTPUT_PREALLOCATE) != 0:
+        raise SystemExit('Invalid MSIP_OUTPUT_BUFFER_BYTES')
+    if ext_configure_package_repack(
+            settings.MSIP_PACKAGE_REPACK, settings.MSIP_PACKAGE_REPACK_MAX_BYTES,
+            settings.MSIP_PACKAGE_REPACK_DEFLATE_MIN_BYTES, settings.MSIP_PACKAGE_REPACK_LEVEL) != 0:
+        raise SystemExit('Invalid MSIP_PACKAGE_REPACK_* settings')
+    ext_set_clone_label_outputs(settings.MSIP_CLONE_LABEL_OUTPUTS)
+    ext_set_pfile_fast_path(settings.MSIP_PFILE_FAST_PATH)
+    ext_set_skip_unchanged(settings.MSIP_SKIP_UNCHANGED)
+    ext_configure_pdf(settings.MSIP_PDF_KEEP_LINEARIZATION, settings.MSIP_PDF_INCREMENTAL_UPDATES)
+    if ext_configure_input_streams(
+            settings.MSIP_INPUT_POOLED_MAX_BYTES, settings.MSIP_INPUT_MAPPED_MIN_BYTES,
+            settings.MSIP_INPUT_WINDOWED_MIN_BYTES, settings.MSIP_INPUT_WINDOW_BYTES,
+            settings.MSIP_INPUT_READ_AHEAD_BYTES) != 0:
+        raise SystemExit('Invalid MSIP_INPUT_* settings')
+    if ext_configure_object_storage(
+            block_bytes=settings.MSIP_OBJECT_BLOCK_BYTES, cache_blocks=settings.MSIP_OBJECT_CACHE_BLOCKS,
+            part_bytes=settings.MSIP_OBJECT_PART_BYTES, parts_in_flight=settings.MSIP_OBJECT_PARTS_IN_FLIGHT,
+            transfer_threads=settings.MSIP_OBJECT_TRANSFER_THREADS) != 0:
+        raise SystemExit('Invalid MSIP_OBJECT_* settings')
+    ext_configure_logging(settings.MSIP_LOG_LEVEL, settings.MSIP_LOG_SINK, settings.MSIP_LOG_BUFFER_SIZE)
+    ext_set_log_limits('trace', settings.MSIP_LOG_TRACE_SAMPLE, settings.MSIP_LOG_MAX_PER_SECOND)
+    ext_set_log_limits('info', 1, settings.MSIP_LOG_MAX_PER_SECOND)
+    if settings.MSIP_LOG_CAPTURE_LEVEL:
+        ext_set_log_capture_level(settings.MSIP_LOG_CAPTURE_LEVEL)
+    for module in filter(None, (m.strip() for m in settings.MSIP_LOG_TRACE_MODULES.split(','))):
+        ext_set_module_trace(module)
+    if settings.MSIP_LOG_TRACE_SIGNAL:
+        toggle_log_trace_on_signal(settings.MSIP_LOG_TRACE_SIGNAL, settings.MSIP_LOG_LEVEL,
+                                   settings.MSIP_LOG_CAPTURE_LEVEL or 'trace')
+    ext_configure_storage(
+        settings.MSIP_CACHE_STORAGE,
+        settings.MSIP_STORAGE_PATH,
+        settings.MSIP_CACHE_LICENSES,
+        settings.MSIP_POLICY_TTL_DAYS,
+    )
+    if settings.MSIP_POLICY_SNAPSHOT_PATH and ext_configure_policy_snapshot(
+            settings.MSIP_POLICY_SNAPSHOT_PATH, settings.MSIP_POLICY_SNAPSHOT_EXPORT) != 0:
+        logger.warning('Policy snapshot %s is unreadable, downloading policy', settings.MSIP_POLICY_SNAPSHOT_PATH)
+    if settings.MSIP_SHARED_LABELS_DIR and ext_configure_shared_labels(settings.MSIP_SHARED_LABELS_DIR) != 0:
+        raise SystemExit(f'Invalid MSIP_SHARED_LABELS_DIR: {settings.MSIP_SHARED_LABELS_DIR}')
+    ext_configure_classification(settings.MSIP_CLASSIFICATION, settings.MSIP_SENSITIVITY_TYPE_CACHE_PATH)
+    if ext_configure_engines(
+            settings.MSIP_LOCALE, settings.MSIP_FLIGHTING_FEATURES, settings.MSIP_ENABLE_FUNCTIONALITY,
+            settings.MSIP_DISABLE_FUNCTIONALITY, settings.MSIP_TASK_TIMEOUT_MS,
+            settings.MSIP_MAX_FILE_SIZE_FOR_PROTECTION, settings.MSIP_CUSTOM_SETTINGS) != 0:
+        raise SystemExit('Invalid MSIP_FLIGHTING_FEATURES, MSIP_*_FUNCTIONALITY or MSIP_CUSTOM_SETTINGS')
+    if ext_configure_consent(settings.MSIP_CONSENT_ALLOWED_HOSTS, settings.MSIP_CONSENT_REJECT_OTHERS) != 0:
+        raise SystemExit('MSIP_CONSENT_REJECT_OTHERS needs MSIP_CONSENT_ALLOWED_HOSTS')
+    if settings.MSIP_MEMORY_STORAGE_BYTES:
+        ext_configure_memory_storage(settings.MSIP_MEMORY_STORAGE_BYTES)
+    if settings.MSIP_STORAGE_KEY and ext_configure_encrypted_storage(settings.MSIP_STORAGE_KEY) != 0:
+        raise SystemExit('MSIP_STORAGE_KEY must be 64 hex digits')
+    if settings.MSIP_REDIS_URL and ext_configure_redis_storage(
+            settings.MSIP_REDIS_URL, settings.MSIP_REDIS_KEY_PREFIX, settings.MSIP_REDIS_L1_TTL, settings.MSIP_STORAGE_KEY) != 0:
+        logger.warning('Redis storage is unreachable or MSIP_STORAGE_KEY is unset, keeping MIP storage local')
+    ext_set_engine_cache_size(settings.MSIP_ENGINE_CACHE_SIZE)
+    ext_set_policy_engine_cache_size(settings.MSIP_POLICY_ENGINE_CACHE_SIZE)
+    ext_set_policy_refresh(settings.MSIP_POLICY_REFRESH_SECONDS)
+    ext_set_engine_idle_timeout(settings.MSIP_ENGINE_IDLE_SECONDS)
+    ext_set_template_refresh(settings.MSIP_TEMPLATE_REFRESH_SECONDS)
+    ext_set_protection_cache_size(settings.MSIP_PROTECTION_CACHE_SIZE)
+    ext_set_license_info_cache_size(settings.MSIP_LICENSE_INFO_CACHE_SIZE)
+    ext_set_use_license_cache_size(settings.MSIP_USE_LICENSE_CACHE_SIZE)
+    ext_configure_delegation_license_cache(settings.MSIP_DELEGATION_LICENSE_CACHE_SIZE, settings.MSIP_DELEGATION_LICENSE_TTL)
+    ext_configure_rights_cache(settings.MSIP_RIGHTS_CACHE_SIZE, settings.MSIP_RIGHTS_CACHE_TTL)
+    ext_configure_decrypted_content_cache(settings.MSIP_DECRYPTED_CACHE_BYTES, settings.MSIP_DECRYPTED_CACHE_MAX_ENTRY_BYTES)
+    ext_configure_container_cache(
+        settings.MSIP_CONTAINER_CACHE_SIZE,
+        settings.MSIP_CONTAINER_CACHE_TTL_MS,
+        settings.MSIP_CONTAINER_CACHE_MAX_FILE_BYTES,
+    )
+    ext_configure_tenant_cache(settings.MSIP_TENANT_CACHE_SIZE, settings.MSIP_TENANT_CACHE_TTL)
+    if ext_configure_region('', settings.MSIP_DATA_BOUNDARY, settings.MSIP_DNS_REDIRECTION) != 0:
+        raise SystemExit(f'Invalid MSIP_DATA_BOUNDARY: {settings.MSIP_DATA_BOUNDARY}')
+    for application_id, region in settings.MSIP_TENANT_REGIONS.items():
+        if ext_configure_region(application_id, str(region.get('data_boundary', settings.MSIP_DATA_BOUNDARY)),
+                                bool(region.get('dns_redirection', settings.MSIP_DNS_REDIRECTION))) != 0:
+            raise SystemExit(f'Invalid MSIP_TENANT_REGIONS data boundary for {application_id}')
+    for application_id, service_identity in settings.MSIP_DELEGATED_IDENTITIES.items():
+        if ext_configure_delegated_identity(application_id, service_identity) != 0:
+            raise SystemExit(f'Invalid MSIP_DELEGATED_IDENTITIES application id: {application_id!r}')
+    ext_configure_inspection_cache(
+        settings.MSIP_INSPECTION_CACHE_SIZE,
+        settings.MSIP_INSPECTION_CACHE_TTL,
+        settings.MSIP_INSPECTION_CACHE_VERIFY,
+    )
+    if settings.MSIP_KNOWN_CLEAN_SIZE and ext_configure_known_clean(
+            settings.MSIP_KNOWN_CLEAN_SIZE, settings.MSIP_KNOWN_CLEAN_FP_RATE, settings.MSIP_KNOWN_CLEAN_MAX_AGE,
+            settings.MSIP_KNOWN_CLEAN_VERIFY_ONE_IN, settings.MSIP_KNOWN_CLEAN_PATH) != 0:
+        raise SystemExit('Invalid MSIP_KNOWN_CLEAN_* settings')
+    ext_configure_tracing(settings.MSIP_TRACE_BUFFER_SIZE)
+    if settings.MSIP_CPU_PROFILE_SIGNAL and ext_enable_cpu_profile_signal(
+            settings.MSIP_CPU_PROFILE_SIGNAL, settings.MSIP_CPU_PROFILE_HZ, settings.MSIP_CPU_PROFILE_SECONDS,
+            settings.MSIP_CPU_PROFILE_DIR) != 0:
+        raise SystemExit('Invalid MSIP_CPU_PROFILE_* settings')
+    if ext_configure_slow_operations(settings.MSIP_SLOW_OPERATION_MS, settings.MSIP_SLOW_OPERATION_BUFFER) != 0:
+        raise SystemExit('Invalid MSIP_SLOW_OPERATION_MS')
+    if settings.MSIP_CAPTURE_PATH:
+        if ext_start_capture(settings.MSIP_CAPTURE_PATH, settings.MSIP_CAPTURE_SAMPLE_EVERY,
+                             settings.MSIP_CAPTURE_MAX_RECORDS) != 0:
+            raise SystemExit(f'Cannot capture traffic to {settings.MSIP_CAPTURE_PATH!r}')
+        # Registered before ext_shutdown, so it runs after it and the capture holds every operation
+        atexit.register(ext_stop_capture)
+    if settings.MSIP_TIMELINE_SAMPLE_EVERY < 0 or settings.MSIP_TIMELINE_BUFFER < 0:
+        raise SystemExit('Invalid MSIP_TIMELINE_* settings')
+    ext_configure_timelines(settings.MSIP_TIMELINE_SAMPLE_EVERY, settings.MSIP_TIMELINE_BUFFER)
+    if ext_configure_lock_metrics(settings.MSIP_LOCK_SAMPLE_EVERY) != 0:
+        raise SystemExit('Invalid MSIP_LOCK_SAMPLE_EVERY')
+    if ext_configure_format_gate(settings.MSIP_FORMAT_CHECK, settings.MSIP_MAX_INPUT_BYTES) != 0:
+        raise SystemExit('Invalid MSIP_MAX_INPUT_BYTES')
+    if ext_configure_operation_budget(settings.MSIP_BUDGET_CPU_MS, settings.MSIP_BUDGET_OUTPUT_BYTES,
+                                      settings.MSIP_QUARANTINE_SECONDS) != 0:
+        raise SystemExit('Invalid MSIP_BUDGET_* or MSIP_QUARANTINE_SECONDS')
+    if ext_configure_idempotency(settings.MSIP_IDEMPOTENCY_CACHE_SIZE, settings.MSIP_IDEMPOTENCY_TTL_SECONDS) != 0:
+        raise SystemExit('Invalid MSIP_IDEMPOTENCY_TTL_SECONDS')
+    ext_set_file_session_idle_timeout(settings.MSIP_FILE_SESSION_IDLE_SECONDS)
+    if ext_configure_admission(settings.MSIP_MAX_IN_FLIGHT, settings.MSIP_MEMORY_BUDGET_BYTES) != 0:
+        raise SystemExit('Invalid MSIP_MAX_IN_FLIGHT or MSIP_MEMORY_BUDGET_BYTES')
+    if settings.MSIP_ADAPTIVE_ADMISSION and ext_configure_adaptive_admission(
+            True, settings.MSIP_ADAPTIVE_INITIAL_LIMIT, settings.MSIP_ADAPTIVE_MIN_LIMIT, settings.MSIP_ADAPTIVE_MAX_LIMIT,
+            settings.MSIP_ADAPTIVE_TOLERANCE, settings.MSIP_ADAPTIVE_WINDOW) != 0:
+        raise SystemExit('Invalid MSIP_ADAPTIVE_* limits')
+    if settings.MSIP_COST_ACCOUNTING and ext_configure_cost_accounting(True) != 0:
+        raise SystemExit('Cannot enable MSIP_COST_ACCOUNTING')
+    if ext_configure_buffer_pool(settings.MSIP_BUFFER_POOL_BYTES) != 0:
+        raise SystemExit('Invalid MSIP_BUFFER_POOL_BYTES')
+    if settings.MSIP_TEMP_DIR and ext_configure_temp_files(
+            settings.MSIP_TEMP_DIR, settings.MSIP_TEMP_POOL_SIZE, settings.MSIP_TEMP_MAX_FILE_BYTES,
+            settings.MSIP_TEMP_FALLBACK_DIR) != 0:
+        raise SystemExit(f'Invalid MSIP_TEMP_DIR: {settings.MSIP_TEMP_DIR}')
+    if ext_configure_tenant_quotas(
+            settings.MSIP_TENANT_MAX_ENGINES, settings.MSIP_TENANT_MAX_LICENSES, settings.MSIP_TENANT_MAX_IN_FLIGHT) != 0:
+        raise SystemExit('Invalid MSIP_TENANT_MAX_* quotas')
+    for application_id, weight in settings.MSIP_TENANT_WEIGHTS.items():
+        if ext_set_tenant_weight(application_id, weight) != 0:
+            raise SystemExit(f'Invalid MSIP_TENANT_WEIGHTS weight for {application_id}')
+    if ext_configure_priorities(settings.MSIP_RESERVED_INTERACTIVE_WORKERS, settings.MSIP_MAX_BULK_IN_FLIGHT) != 0:
+        raise SystemExit('Invalid MSIP_RESERVED_INTERACTIVE_WORKERS')
+    if settings.MSIP_AUTO_TUNE:
+        # Budgets whose settings are left at their defaults follow the cgroup's limits instead
+        tuned = [part for part, names in _AUTO_TUNED_SETTINGS.items()
+                 if not any(name in settings.model_fields_set for name in names)]
+        tuning = ext_auto_tune(tuned, settings.MSIP_AUTO_TUNE_PRESSURE)
+        logger.info('Auto-tuned %s for %s CPUs and %s bytes: %s', tuned, tuning.get('cpus'), tuning.get('memory_bytes'), tuning)
+        if settings.MSIP_AUTO_TUNE_PRESSURE and not tuning.get('status'):
+            logger.warning('memory.pressure cannot be watched, auto-tuned budgets stay fixed')
+    if settings.MSIP_DIAGNOSTIC_ENDPOINT and ext_configure_diagnostic_upload(
+            settings.MSIP_DIAGNOSTIC_ENDPOINT, settings.MSIP_DIAGNOSTIC_AUTHORIZATION, settings.MSIP_DIAGNOSTIC_QUEUE_SIZE,
+            settings.MSIP_DIAGNOSTIC_BATCH_SIZE, settings.MSIP_DIAGNOSTIC_FLUSH_MS) != 0:
+        logger.warning('Invalid diagnostic upload settings, keeping the SDK audit pipeline')
+    if ext_configure_http_resilience(
+            settings.MSIP_HTTP_MAX_RETRIES, settings.MSIP_HTTP_RETRY_BASE_MS, settings.MSIP_HTTP_RETRY_MAX_MS,
+            settings.MSIP_HTTP_HEDGE, settings.MSIP_HTTP_HEDGE_MIN_MS, settings.MSIP_HTTP_BREAKER_FAILURES,
+            settings.MSIP_HTTP_BREAKER_OPEN_MS) != 0:
+        raise SystemExit('Invalid MSIP_HTTP_* retry, hedging or circuit breaker settings')
+    if ext_configure_http_rate_limit(
+            settings.MSIP_HTTP_RATE_LIMIT, settings.MSIP_HTTP_RATE_MIN, settings.MSIP_HTTP_RATE_MAX,
+            settings.MSIP_HTTP_RATE_INCREASE, settings.MSIP_HTTP_RATE_DECREASE, settings.MSIP_HTTP_MAX_RETRY_AFTER_MS,
+            settings.MSIP_HTTP_RATE_RELAX_MS) != 0:
+        raise SystemExit('Invalid MSIP_HTTP_RATE_* or MSIP_HTTP_MAX_RETRY_AFTER_MS settings')
+    if settings.MSIP_HTTP_REPLAY_MODE and ext_configure_http_replay(
+            settings.MSIP_HTTP_REPLAY_MODE, settings.MSIP_HTTP_REPLAY_DIR, settings.MSIP_HTTP_REPLAY_LATENCY_MS,
+            settings.MSIP_HTTP_REPLAY_JITTER_MS) != 0:
+        raise SystemExit(f'Cannot {settings.MSIP_HTTP_REPLAY_MODE} HTTP responses in {settings.MSIP_HTTP_REPLAY_DIR!r}')
+    if settings.MSIP_DKE_URLS and ext_configure_dke_cache(
+            [url.strip() for url in settings.MSIP_DKE_URLS.split(',') if url.strip()],
+            settings.MSIP_DKE_PUBLIC_KEY_TTL_SECONDS, settings.MSIP_DKE_UNWRAP_TTL_SECONDS,
+            settings.MSIP_DKE_CACHE_SIZE) != 0:
+        raise SystemExit('Invalid MSIP_DKE_* cache settings')
+    if settings.MSIP_CLIENT_SECRET:
+        ext_set_client_secret(settings.MSIP_CLIENT_SECRET)
+    atexit.register(ext_shutdown)
+    # The gRPC port only opens once warm, so the sidecar reports the app ready with engines loaded
+    if settings.MSIP_RESTORE_ENGINES:
+        restored = ext_restore_engines()
+        if restored.get('status'):
+            logger.info('Restored %s engines from disk, %s no longer stored',
+                        restored.get('restored'), restored.get('missing'))
+        else:
+            logger.warning('Engine restore incomplete: %s', restored.get('engines') or restored.get('error'))
+    if settings.MSIP_CACHE_SNAPSHOT_PATH and os.path.exists(settings.MSIP_CACHE_SNAPSHOT_PATH):
+        restored = ext_restore(settings.MSIP_CACHE_SNAPSHOT_PATH, settings.MSIP_STORAGE_KEY)
+        if restored.get('status'):
+            logger.info('Restored warm caches %s, skipped %s', restored.get('restored'), restored.get('skipped'))
+        else:
+            logger.warning('Cache snapshot unreadable, starting cold: %s', restored.get('error'))
+    if settings.MSIP_WARMUP:
+        warmup = ext_warmup(settings.MSIP_WARMUP)
+        if not warmup.get('status'):
+            logger.warning('Warm-up incomplete, serving cold: %s', warmup.get('steps') or warmup.get('error'))
+
+    prometheus_port = settings.PROMETHEUS_PORT
+    if settings.MSIP_PREFORK_WORKERS:
+        # Each worker shares the warmed library copy-on-write and listens on GRPC_PORT with SO_REUSEPORT
+        worker_index = fork_workers(settings.MSIP_PREFORK_WORKERS, settings.MSIP_PREFORK_TIMEOUT_MS)
+        if worker_index is None:
+            raise SystemExit(0)
+        prometheus_port += worker_index
+        start_prometheus_server(prometheus_port)
+        if settings.MSIP_HEALTH_PORT:
+            start_health_server(settings.MSIP_HEALTH_PORT + worker_index)
+    # After any fork, since a running shard worker cannot be forked; each worker process claims shards of its own
+    if settings.MSIP_SHARD_REDIS_URL and ext_configure_shards(
+            settings.MSIP_SHARD_REDIS_URL, settings.MSIP_SHARD_KEY_PREFIX, '', settings.MSIP_SHARD_WORKERS,
+            settings.MSIP_SHARD_LEASE_MS, settings.MSIP_SHARD_POLL_MS) != 0:
+        raise SystemExit('Invalid MSIP_SHARD_* settings or unreachable MSIP_SHARD_REDIS_URL')
+    # Likewise after any fork; every worker would probe the same files, so only an unforked process watches
+    if settings.MSIP_WATCH_ROOTS and not settings.MSIP_PREFORK_WORKERS:
+        output_fd = -1
+        if settings.MSIP_WATCH_OUTPUT:
+            output_fd = os.open(settings.MSIP_WATCH_OUTPUT, os.O_WRONLY | os.O_APPEND | os.O_CREAT | os.O_CLOEXEC, 0o600)
+        if ext_configure_watch(settings.MSIP_WATCH_ROOTS.split(','), 'status', settings.MSIP_WATCH_APPLICATION_ID,
+                               settings.MSIP_WATCH_FILTERS, output_fd=output_fd,
+                               settle_ms=settings.MSIP_WATCH_SETTLE_MS) != 0:
+            raise SystemExit('Invalid MSIP_WATCH_* settings or unwatchable MSIP_WATCH_ROOTS')
+    if settings.MSIP_RELOAD_CONFIG_PATH and settings.MSIP_RELOAD_SIGNAL:
+        reload_config_on_signal(settings.MSIP_RELOAD_SIGNAL, settings.MSIP_RELOAD_CONFIG_PATH)
+    if settings.MSIP_DRAIN_DELAY_MS < 0 or settings.MSIP_DRAIN_TIMEOUT_MS < 0 or settings.MSIP_DRAIN_FLUSH_MS < 0:
+        raise SystemExit('Invalid MSIP_DRAIN_* settings')
+    drain_on_signal(signal.SIGTERM, settings.MSIP_DRAIN_DELAY_MS, settings.MSIP_DRAIN_TIMEOUT_MS,
+                    settings.MSIP_DRAIN_FLUSH_MS, settings.MSIP_CACHE_SNAPSHOT_PATH, settings.MSIP_STORAGE_KEY)
+
     logger.info('Starting pubsub consumer with Prometheus metrics enabled')
-    logger.info(f'Metrics available at http://localhost:{settings.PROMETHEUS_PORT}/metrics')
+    logger.info(f'Metrics available at http://localhost:{prometheus_port}/metrics')
     
     # Start the Dapr gRPC server
     dapr_grpc.run(settings.GRPC_PORT)
\ No newline at end of file
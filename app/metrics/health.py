@@ -0,0 +1,57 @@
+import json
+import logging
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs
+from app.pubsub.external_functions import ext_get_affinity_key, ext_get_warm_tenants, ext_health
+
+logger = logging.getLogger(__name__)
+
+
+def affinity(query: str) -> tuple[int, dict]:
+    # /affinity lists the tenants warm on this pod; with ?application_id=&user= it gives the key a router
+    # consistent-hashes that request on
+    params = parse_qs(query)
+    if 'application_id' in params:
+        return 200, ext_get_affinity_key(params['application_id'][0], params.get('user', [''])[0])
+    return 200, ext_get_warm_tenants()
+
+
+def probe(path: str, query: str = '') -> tuple[int, dict]:
+    # /livez answers 200 while the library answers at all. /readyz answers 503 during warm-up, once
+    # draining and while overloaded, so traffic only reaches warm pods with room for it
+    if path == '/affinity':
+        return affinity(query)
+    health = ext_health()
+    if path == '/livez':
+        return (200 if health.get('live') else 503), health
+    if path == '/readyz':
+        ready = health.get('ready') and not health.get('overloaded')
+        return (200 if ready else 503), health
+    return 404, {}
+
+
+class _ProbeHandler(BaseHTTPRequestHandler):
+    def do_GET(self):
+        path, _, query = self.path.partition('?')
+        status, health = probe(path, query)
+        body = json.dumps(health).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        # Probes arrive every few seconds; only failures are worth a line
+        pass
+
+
+def start_health_server(port: int) -> threading.Thread:
+    # Serves the probes from msipHealth, which reads only atomics, on a daemon thread
+    server = ThreadingHTTPServer(('', port), _ProbeHandler)
+    server.daemon_threads = True
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    logger.info('Health probes served on port %d at /livez and /readyz, affinity hints at /affinity', port)
+    return thread
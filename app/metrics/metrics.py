@@ -1,7 +1,12 @@
 import time
 import functools
-from prometheus_client import Counter, Histogram, Gauge
-from app.pubsub.external_functions import ext_get_file_status, ext_protect_file, ext_unprotect_file
+import logging
+from prometheus_client import Counter, Histogram, Gauge, REGISTRY
+from prometheus_client.core import HistogramMetricFamily
+from prometheus_client.parser import text_string_to_metric_families
+from app.pubsub.external_functions import ext_get_file_status, ext_get_metrics, ext_protect_file, ext_render_counters, ext_unprotect_file
+
+logger = logging.getLogger(__name__)
 
 
 # Initialize Prometheus metrics
@@ -42,6 +47,54 @@ metrics_active_requests = Gauge(
     ['method']
 )
 
+# Pub/sub messages sharing one native batch call
+metrics_batch_size = Histogram(
+    'msip_pubsub_batch_size',
+    'Messages per native batch call of the pub/sub consumer',
+    ['method'],
+    buckets=(1, 2, 5, 10, 25, 50, 100, 250, 500)
+)
+
+
+# Counters, gauges and latency histograms kept inside the native library, read in two calls per scrape. The
+# histograms, most of the series, come as JSON and skip the text parser, so scraping every second stays cheap.
+class NativeMetricsCollector:
+    _histograms = (
+        ('phases', 'msip_native_phase_seconds', 'Time spent in each MIP SDK phase inside the native library', 'phase'),
+        ('http', 'msip_native_http_latency_seconds', 'Time spent in HTTP requests per host', 'host'),
+    )
+    _lock_histograms = (
+        ('wait', 'msip_native_lock_wait_seconds', 'Time sampled acquisitions of a native lock waited for it'),
+        ('hold', 'msip_native_lock_hold_seconds', 'Time sampled acquisitions of a native lock held it'),
+    )
+
+    def collect(self):
+        try:
+            text = ext_render_counters()
+            histograms = ext_get_metrics()
+        except Exception as e:
+            logger.warning("Failed to read native metrics: %s", e)
+            return
+        yield from text_string_to_metric_families(text)
+        bounds = [repr(float(bound)) for bound in histograms.get('bounds', [])]
+        for key, name, documentation, label in self._histograms:
+            family = HistogramMetricFamily(name, documentation, labels=[label])
+            for value, histogram in histograms.get(key, {}).items():
+                buckets = list(zip(bounds, histogram['buckets'])) + [('+Inf', histogram['count'])]
+                family.add_metric([value], buckets, histogram['sum'])
+            yield family
+        # Lock times are microseconds, so they come on bounds of their own
+        lock_bounds = [repr(float(bound)) for bound in histograms.get('lock_bounds', [])]
+        for kind, name, documentation in self._lock_histograms:
+            family = HistogramMetricFamily(name, documentation, labels=['lock'])
+            for lock, metrics in histograms.get('locks', {}).items():
+                histogram = metrics[kind]
+                buckets = list(zip(lock_bounds, histogram['buckets'])) + [('+Inf', histogram['count'])]
+                family.add_metric([lock], buckets, histogram['sum'])
+            yield family
+
+REGISTRY.register(NativeMetricsCollector())
+
 
 # Decorator to measure time spent in functions
 def timing_decorator(metric, labels=None):
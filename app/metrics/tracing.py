@@ -0,0 +1,124 @@
+import contextlib
+import logging
+import threading
+from collections import OrderedDict
+from datetime import datetime, timezone
+import sentry_sdk
+from app.pubsub.external_functions import ext_set_request_trace, ext_set_trace_context, ext_take_spans
+
+logger = logging.getLogger(__name__)
+
+TRACEPARENT_HEADER = 'traceparent'
+# A caller sets it to 1 to have the SDK records of its request written whatever the log level
+VERBOSE_LOG_HEADER = 'msip-verbose-log'
+
+# Spans drained on behalf of a trace whose request has not finished yet, kept for it by trace id
+MAX_PENDING_TRACES = 256
+_pending_spans = OrderedDict()
+_pending_lock = threading.Lock()
+
+
+def _header(request, name: str) -> str | None:
+    # Dapr forwards the caller's headers as invocation metadata, each value as a list
+    for key, value in (getattr(request, 'metadata', None) or {}).items():
+        if key.lower() != name:
+            continue
+        if isinstance(value, (list, tuple)):
+            value = value[0] if value else ''
+        return value.decode() if isinstance(value, bytes) else str(value)
+    return None
+
+
+def _traceparent(request) -> str | None:
+    return _header(request, TRACEPARENT_HEADER)
+
+
+def _verbose_log(request) -> bool:
+    return (_header(request, VERBOSE_LOG_HEADER) or '').strip().lower() in ('1', 'true')
+
+
+def _sentry_trace(traceparent: str) -> str | None:
+    # W3C "00-<trace-id>-<parent-id>-<flags>" as Sentry's "<trace-id>-<parent-id>-<sampled>"
+    parts = traceparent.strip().split('-')
+    if len(parts) < 4 or len(parts[1]) != 32 or len(parts[2]) != 16:
+        return None
+    try:
+        sampled = int(parts[3][:2], 16) & 0x01
+    except ValueError:
+        return None
+    return f"{parts[1]}-{parts[2]}-{sampled}"
+
+
+def _take_spans_for(trace_id: str) -> list:
+    # Drains the native buffer, which holds spans of every in-flight request, and keeps other traces' spans for them
+    drained = ext_take_spans().get('spans', [])
+    with _pending_lock:
+        for span in drained:
+            _pending_spans.setdefault(span['trace_id'], []).append(span)
+            _pending_spans.move_to_end(span['trace_id'])
+        while len(_pending_spans) > MAX_PENDING_TRACES:
+            _pending_spans.popitem(last=False)
+        return _pending_spans.pop(trace_id, [])
+
+
+def _timestamp(unix_nanos: int) -> datetime:
+    return datetime.fromtimestamp(unix_nanos / 1e9, tz=timezone.utc)
+
+
+def _emit(transaction, spans: list):
+    for native in spans:
+        span = transaction.start_child(
+            op='http.client',
+            name=f"{native['method']} {native['host']}{native['path']}",
+            start_timestamp=_timestamp(native['start_unix_nanos']),
+        )
+        span.set_data('http.request.method', native['method'])
+        span.set_data('server.address', native['host'])
+        span.set_data('url.path', native['path'])
+        span.set_data('http.request.body.size', native['bytes_sent'])
+        span.set_data('http.response.body.size', native['bytes_received'])
+        for phase in ('dns', 'connect', 'tls', 'ttfb'):
+            if native[f'{phase}_micros'] >= 0:
+                span.set_data(f'msip.{phase}_ms', native[f'{phase}_micros'] / 1000)
+        if native['status_code']:
+            span.set_http_status(native['status_code'])
+        elif native['cancelled']:
+            span.set_status('cancelled')
+        else:
+            span.set_status('internal_error')
+            span.set_data('error', native['error'])
+        span.finish(end_timestamp=_timestamp(native['end_unix_nanos']))
+
+
+@contextlib.contextmanager
+def traced_request(request, method_name: str):
+    # Continues the caller's trace for one Dapr invocation and attaches the SDK's HTTP calls made for it as child spans
+    verbose = _verbose_log(request)
+    sentry_trace = _sentry_trace(_traceparent(request) or '')
+    if not sentry_trace:
+        if not verbose:
+            yield
+            return
+        ext_set_request_trace(True)
+        try:
+            yield
+        finally:
+            ext_set_request_trace(False)
+        return
+
+    transaction = sentry_sdk.continue_trace({'sentry-trace': sentry_trace}, op='rpc.server', name=method_name)
+    with sentry_sdk.start_transaction(transaction):
+        # The native span ids hang off this transaction, not the caller's span
+        ext_set_trace_context(
+            f"00-{transaction.trace_id}-{transaction.span_id}-{'01' if transaction.sampled else '00'}")
+        if verbose:
+            ext_set_request_trace(True)
+        try:
+            yield
+        finally:
+            ext_set_trace_context('')
+            if transaction.sampled:
+                try:
+                    _emit(transaction, _take_spans_for(transaction.trace_id))
+                except Exception as e:
+                    logger.warning("Failed to export native HTTP spans: %s", e)
@@ -0,0 +1,58 @@
+import threading
+import time
+
+
+class _Batch:
+    def __init__(self):
+        self.items = []
+        self.outcomes = None
+        self.error = None
+        self.done = threading.Event()
+
+
+class BatchCollector:
+    # Gathers items submitted from concurrent threads into batches of up to max_size, closed at the latest
+    # window_ms after their first item, and runs each batch once with run(items), which returns one outcome
+    # per item. The thread that opened a batch runs it; the others wait for their outcome.
+
+    def __init__(self, run, max_size: int, window_ms: int):
+        self._run = run
+        self._max_size = max(int(max_size), 1)
+        self._window = max(int(window_ms), 0) / 1000
+        self._condition = threading.Condition()
+        self._open = None
+
+    def submit(self, item):
+        # The item's outcome, or the exception run raised for its batch
+        with self._condition:
+            batch = self._open
+            leader = batch is None
+            if leader:
+                batch = self._open = _Batch()
+            index = len(batch.items)
+            batch.items.append(item)
+            if len(batch.items) >= self._max_size:
+                self._open = None
+                self._condition.notify_all()
+            if leader:
+                deadline = time.monotonic() + self._window
+                while self._open is batch:
+                    remaining = deadline - time.monotonic()
+                    if remaining <= 0:
+                        self._open = None
+                        break
+                    self._condition.wait(remaining)
+        if leader:
+            try:
+                outcomes = list(self._run(batch.items))
+                if len(outcomes) != len(batch.items):
+                    raise RuntimeError(f"Batch of {len(batch.items)} items returned {len(outcomes)} outcomes")
+                batch.outcomes = outcomes
+            except Exception as e:
+                batch.error = e
+            batch.done.set()
+        else:
+            batch.done.wait()
+        if batch.error is not None:
+            raise batch.error
+        return batch.outcomes[index]
@@ -1,37 +1,1885 @@
+import asyncio
 import ctypes
+import importlib.machinery
+import importlib.util
+import io
+import itertools
 import logging
 import json
+import os
+import struct
+import threading
+import time
+import weakref
 from app.core.settings import settings
-from app.pubsub.models import FileData, ProtectFileData, UnprotectFileData
+from app.pubsub.models import FileData, ProtectFileData, ProtectTemplateFileData, UnprotectFileData
+from app.pubsub.worker_client import WorkerClient
 
 logger = logging.getLogger(__name__)
 
 
-# Load the shared library
-msip_lib = ctypes.CDLL(settings.MSIP_LD_PATH)
+# Load the shared library. Lazy binding resolves each SDK symbol on its first call rather than all of them
+# here, so a pod that only inspects files never pays for the protection and labeling symbols at startup.
+_load_started_ns = time.time_ns()
+msip_lib = ctypes.CDLL(settings.MSIP_LD_PATH, mode=os.RTLD_LAZY if settings.MSIP_LAZY_BINDING else os.RTLD_NOW)
+_load_finished_ns = time.time_ns()
 
-# Get the function and specify argument types and return type
-get_file_status = msip_lib.getFileStatus
-get_file_status.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+
+def _load_native_module():
+    # msip_native, built next to the library by `scons python`, runs the hot file calls without ctypes and with
+    # the GIL released for the whole SDK call; without it those calls go through the ctypes bindings below
+    if not settings.MSIP_NATIVE_MODULE:
+        return None
+    library_path = os.fspath(settings.MSIP_LD_PATH)
+    path = os.path.join(os.path.dirname(library_path), 'msip_native' + importlib.machinery.EXTENSION_SUFFIXES[0])
+    if not os.path.exists(path):
+        return None
+    try:
+        spec = importlib.util.spec_from_file_location('msip_native', path)
+        module = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(module)
+        module.load(library_path)
+    except (ImportError, OSError) as e:
+        logger.warning("Cannot use %s, file calls go through ctypes: %s", path, e)
+        return None
+    return module
+
+_native = _load_native_module()
+
+# With MSIP_WORKERD_SOCKET set, the hot file calls run in the msip_workerd daemon, which holds the MIP
+# context and engines for every replica on the node, and this process only forwards them
+_worker = WorkerClient(settings.MSIP_WORKERD_SOCKET) if settings.MSIP_WORKERD_SOCKET else None
+_worker_deadline = threading.local()
+
+# File operations use the *_v2 exports, which write into a caller-sized buffer and report the size needed
+get_file_status = msip_lib.getFileStatus_v2
+get_file_status.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
 get_file_status.restype = ctypes.c_int
 
-# Get the function and specify argument types and return type
-unprotect_file = msip_lib.unprotectFile
-unprotect_file.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+get_archive_status = msip_lib.getArchiveStatus
+get_archive_status.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_archive_status.restype = ctypes.c_int
+
+unprotect_file = msip_lib.unprotectFile_v2
+unprotect_file.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
 unprotect_file.restype = ctypes.c_int
 
-protect_file = msip_lib.protectFile
-protect_file.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+protect_file = msip_lib.protectFile_v2
+protect_file.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
 protect_file.restype = ctypes.c_int
 
+# Publishing-license details, read offline
+inspect_license = msip_lib.inspectLicense
+inspect_license.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+inspect_license.restype = ctypes.c_int
 
-def ext_get_file_status(data: FileData) -> dict:
+# Label of a file from the metadata it carries, or its publishing license, without a handler or a license
+read_label = msip_lib.readLabel
+read_label.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+read_label.restype = ctypes.c_int
+
+# Label and protection of a file in one call, read with the user's cached engine
+describe_file = msip_lib.describeFile
+describe_file.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+describe_file.restype = ctypes.c_int
+
+# Attachments of a .msg, decrypted and inspected down to a bounded depth
+inspect_msg = msip_lib.inspectMsg
+inspect_msg.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+inspect_msg.restype = ctypes.c_int
+
+# Parallel walk of a directory tree, streaming file statuses as NDJSON to a descriptor
+scan_tree = msip_lib.scanTree
+scan_tree.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+scan_tree.restype = ctypes.c_int
+
+scan_tree_incremental = msip_lib.scanTreeIncremental
+scan_tree_incremental.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+scan_tree_incremental.restype = ctypes.c_int
+
+# Batch variants: one shared engine for many files, results returned as a JSON array
+get_file_status_batch = msip_lib.getFileStatusBatch_v2
+get_file_status_batch.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_file_status_batch.restype = ctypes.c_int
+
+# The same statuses as packed records instead of JSON; see StatusRecords
+get_file_status_batch_binary = msip_lib.getFileStatusBatchBinary
+get_file_status_batch_binary.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_file_status_batch_binary.restype = ctypes.c_int
+
+unprotect_file_batch = msip_lib.unprotectFileBatch_v2
+unprotect_file_batch.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_batch.restype = ctypes.c_int
+
+# Acquires use licenses ahead of an unprotect, once per distinct publishing license
+prefetch_licenses = msip_lib.prefetchLicenses
+prefetch_licenses.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+prefetch_licenses.restype = ctypes.c_int
+
+# Estimate of a batch's work from the offline probes, before it runs
+plan_batch = msip_lib.planBatch
+plan_batch.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+plan_batch.restype = ctypes.c_int
+
+# Document tracking registration and revocation of many files, many requests in flight at once
+register_content_for_tracking = msip_lib.registerContentForTracking
+register_content_for_tracking.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+register_content_for_tracking.restype = ctypes.c_int
+
+revoke_content = msip_lib.revokeContent
+revoke_content.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+revoke_content.restype = ctypes.c_int
+
+# Delegation licenses for many users of one publishing license, and rights checks against them
+create_delegation_licenses = msip_lib.createDelegationLicenses
+create_delegation_licenses.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+create_delegation_licenses.restype = ctypes.c_int
+
+check_delegated_access = msip_lib.checkDelegatedAccess
+check_delegated_access.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+check_delegated_access.restype = ctypes.c_int
+
+# Rights of one user on a file's content, served from the rights cache once the user's license was consumed
+check_rights = msip_lib.checkRights
+check_rights.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+check_rights.restype = ctypes.c_int
+
+# Protect with a template using a publishing license signed locally from a cached user certificate
+protect_file_offline = msip_lib.protectFileOffline
+protect_file_offline.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_offline.restype = ctypes.c_int
+
+prepare_offline_publishing = msip_lib.prepareOfflinePublishing
+prepare_offline_publishing.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+prepare_offline_publishing.restype = ctypes.c_int
+
+get_tenant_information = msip_lib.getTenantInformation
+get_tenant_information.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_tenant_information.restype = ctypes.c_int
+
+# Stream handles: plaintext of a protected file or any file on disk, read in chunks with nothing written or held whole
+open_decrypted = msip_lib.openDecrypted
+open_decrypted.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+open_decrypted.restype = ctypes.c_int
+
+# Receives a piece of the text extractText hands over: (data, size, user_data), nonzero stops the extraction
+MSIP_TEXT_CALLBACK = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p)
+
+extract_text = msip_lib.extractText
+extract_text.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_uint64, MSIP_TEXT_CALLBACK, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+extract_text.restype = ctypes.c_int
+
+msip_open = msip_lib.msipOpen
+msip_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint64)]
+msip_open.restype = ctypes.c_int
+
+msip_read = msip_lib.msipRead
+msip_read.argtypes = [ctypes.c_uint64, ctypes.c_void_p, ctypes.c_size_t]
+msip_read.restype = ctypes.c_int64
+
+msip_close = msip_lib.msipClose
+msip_close.argtypes = [ctypes.c_uint64]
+msip_close.restype = ctypes.c_int
+
+# File sessions: one opened file serving status, label, rights checks and unprotection
+open_file_session = msip_lib.openFileSession
+open_file_session.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+open_file_session.restype = ctypes.c_int
+
+get_file_session_status = msip_lib.getFileSessionStatus
+get_file_session_status.argtypes = [ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_file_session_status.restype = ctypes.c_int
+
+get_file_session_label = msip_lib.getFileSessionLabel
+get_file_session_label.argtypes = [ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_file_session_label.restype = ctypes.c_int
+
+check_file_session_rights = msip_lib.checkFileSessionRights
+check_file_session_rights.argtypes = [ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+check_file_session_rights.restype = ctypes.c_int
+
+unprotect_file_session = msip_lib.unprotectFileSession
+unprotect_file_session.argtypes = [ctypes.c_uint64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_session.restype = ctypes.c_int
+
+close_file_session = msip_lib.closeFileSession
+close_file_session.argtypes = [ctypes.c_uint64]
+close_file_session.restype = ctypes.c_int
+
+msip_set_file_session_idle_timeout = msip_lib.msipSetFileSessionIdleTimeout
+msip_set_file_session_idle_timeout.argtypes = [ctypes.c_int]
+msip_set_file_session_idle_timeout.restype = ctypes.c_int
+
+msip_configure_admission = msip_lib.msipConfigureAdmission
+msip_configure_admission.argtypes = [ctypes.c_size_t, ctypes.c_int64]
+msip_configure_admission.restype = ctypes.c_int
+
+msip_configure_adaptive_admission = msip_lib.msipConfigureAdaptiveAdmission
+msip_configure_adaptive_admission.argtypes = [ctypes.c_int, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_double, ctypes.c_size_t]
+msip_configure_adaptive_admission.restype = ctypes.c_int
+
+msip_configure_buffer_pool = msip_lib.msipConfigureBufferPool
+msip_configure_buffer_pool.argtypes = [ctypes.c_size_t]
+msip_configure_buffer_pool.restype = ctypes.c_int
+
+msip_auto_tune = msip_lib.msipAutoTune
+msip_auto_tune.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_auto_tune.restype = ctypes.c_int
+
+msip_get_resource_tuner_stats = msip_lib.msipGetResourceTunerStats
+msip_get_resource_tuner_stats.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_resource_tuner_stats.restype = ctypes.c_int
+
+msip_get_buffer_pool_stats = msip_lib.msipGetBufferPoolStats
+msip_get_buffer_pool_stats.argtypes = [ctypes.c_char_p]
+msip_get_buffer_pool_stats.restype = ctypes.c_int
+
+msip_configure_temp_files = msip_lib.msipConfigureTempFiles
+msip_configure_temp_files.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int64, ctypes.c_char_p]
+msip_configure_temp_files.restype = ctypes.c_int
+
+msip_get_temp_file_stats = msip_lib.msipGetTempFileStats
+msip_get_temp_file_stats.argtypes = [ctypes.c_char_p]
+msip_get_temp_file_stats.restype = ctypes.c_int
+
+msip_get_startup_stats = msip_lib.msipGetStartupStats
+msip_get_startup_stats.argtypes = [ctypes.c_char_p]
+msip_get_startup_stats.restype = ctypes.c_int
+
+msip_get_allocator_stats = msip_lib.msipGetAllocatorStats
+msip_get_allocator_stats.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_allocator_stats.restype = ctypes.c_int
+
+msip_configure_cost_accounting = msip_lib.msipConfigureCostAccounting
+msip_configure_cost_accounting.argtypes = [ctypes.c_int]
+msip_configure_cost_accounting.restype = ctypes.c_int
+
+msip_get_costs = msip_lib.msipGetCosts
+msip_get_costs.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_costs.restype = ctypes.c_int
+
+msip_get_admission_stats = msip_lib.msipGetAdmissionStats
+msip_get_admission_stats.argtypes = [ctypes.c_char_p]
+msip_get_admission_stats.restype = ctypes.c_int
+
+msip_get_affinity_key = msip_lib.msipGetAffinityKey
+msip_get_affinity_key.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_affinity_key.restype = ctypes.c_int
+
+msip_get_warm_tenants = msip_lib.msipGetWarmTenants
+msip_get_warm_tenants.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_warm_tenants.restype = ctypes.c_int
+
+msip_health = msip_lib.msipHealth
+msip_health.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_health.restype = ctypes.c_int
+
+msip_configure_tenant_quotas = msip_lib.msipConfigureTenantQuotas
+msip_configure_tenant_quotas.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t]
+msip_configure_tenant_quotas.restype = ctypes.c_int
+
+msip_set_tenant_weight = msip_lib.msipSetTenantWeight
+msip_set_tenant_weight.argtypes = [ctypes.c_char_p, ctypes.c_int]
+msip_set_tenant_weight.restype = ctypes.c_int
+
+msip_configure_priorities = msip_lib.msipConfigurePriorities
+msip_configure_priorities.argtypes = [ctypes.c_int, ctypes.c_size_t]
+msip_configure_priorities.restype = ctypes.c_int
+
+msip_get_file_session_stats = msip_lib.msipGetFileSessionStats
+msip_get_file_session_stats.argtypes = [ctypes.c_char_p]
+msip_get_file_session_stats.restype = ctypes.c_int
+
+# Output written to a caller's descriptor or buffer instead of a "_modified" file
+unprotect_file_to_fd = msip_lib.unprotectFileToFd
+unprotect_file_to_fd.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_to_fd.restype = ctypes.c_int
+
+unprotect_file_to_buffer = msip_lib.unprotectFileToBuffer
+unprotect_file_to_buffer.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t), ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_to_buffer.restype = ctypes.c_int
+
+protect_file_to_fd = msip_lib.protectFileToFd
+protect_file_to_fd.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_to_fd.restype = ctypes.c_int
+
+protect_file_to_buffer = msip_lib.protectFileToBuffer
+protect_file_to_buffer.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t), ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_to_buffer.restype = ctypes.c_int
+
+# Output committed straight into a destination path or directory, or over the input
+unprotect_file_to = msip_lib.unprotectFileTo
+unprotect_file_to.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_to.restype = ctypes.c_int
+
+protect_file_to = msip_lib.protectFileTo
+protect_file_to.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_to.restype = ctypes.c_int
+
+# Flags of unprotectFileTo and protectFileTo: the output replaces the input
+MSIP_OUTPUT_REPLACE_INPUT = 1
+
+# Input read in place from caller memory, named by a hint that only selects the file type
+get_buffer_status = msip_lib.getBufferStatus
+get_buffer_status.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_buffer_status.restype = ctypes.c_int
+
+unprotect_buffer_to_buffer = msip_lib.unprotectBufferToBuffer
+unprotect_buffer_to_buffer.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t), ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_buffer_to_buffer.restype = ctypes.c_int
+
+protect_buffer_to_buffer = msip_lib.protectBufferToBuffer
+protect_buffer_to_buffer.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t), ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_buffer_to_buffer.restype = ctypes.c_int
+
+# Input mapped from and output written to shared-memory segments handed over by descriptor
+get_shared_memory_status = msip_lib.getSharedMemoryStatus
+get_shared_memory_status.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_shared_memory_status.restype = ctypes.c_int
+
+unprotect_shared_memory = msip_lib.unprotectSharedMemory
+unprotect_shared_memory.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_shared_memory.restype = ctypes.c_int
+
+get_object_status = msip_lib.getObjectStatus
+get_object_status.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_object_status.restype = ctypes.c_int
+
+unprotect_object = msip_lib.unprotectObject
+unprotect_object.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_object.restype = ctypes.c_int
+
+protect_object = msip_lib.protectObject
+protect_object.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_object.restype = ctypes.c_int
+
+protect_shared_memory = msip_lib.protectSharedMemory
+protect_shared_memory.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_shared_memory.restype = ctypes.c_int
+
+protect_file_detached = msip_lib.protectFileDetached
+protect_file_detached.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_detached.restype = ctypes.c_int
+
+unprotect_file_detached = msip_lib.unprotectFileDetached
+unprotect_file_detached.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+unprotect_file_detached.restype = ctypes.c_int
+
+# Protect with an RMS template or sensitivity label instead of a reference file
+protect_file_with_template = msip_lib.protectFileWithTemplate
+protect_file_with_template.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_with_template.restype = ctypes.c_int
+
+protect_file_with_template_batch = msip_lib.protectFileWithTemplateBatch
+protect_file_with_template_batch.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_with_template_batch.restype = ctypes.c_int
+
+protect_files_with_permissions = msip_lib.protectFilesWithPermissions
+protect_files_with_permissions.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_int, ctypes.c_int64, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_files_with_permissions.restype = ctypes.c_int
+
+protect_file_batch = msip_lib.protectFileBatch_v2
+protect_file_batch.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+protect_file_batch.restype = ctypes.c_int
+
+# Sensitivity labels of a user's policy, indexed once per engine
+list_labels = msip_lib.listLabels
+list_labels.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+list_labels.restype = ctypes.c_int
+
+# Protection templates and label rights from the engine's template catalogue
+list_templates = msip_lib.listTemplates
+list_templates.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+list_templates.restype = ctypes.c_int
+
+get_rights_for_label = msip_lib.getRightsForLabel
+get_rights_for_label.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_rights_for_label.restype = ctypes.c_int
+
+get_label = msip_lib.getLabel
+get_label.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+get_label.restype = ctypes.c_int
+
+list_sensitivity_types = msip_lib.listSensitivityTypes
+list_sensitivity_types.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+list_sensitivity_types.restype = ctypes.c_int
+
+classify_files = msip_lib.classifyFiles
+classify_files.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+classify_files.restype = ctypes.c_int
+
+label_files = msip_lib.labelFiles
+label_files.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+label_files.restype = ctypes.c_int
+
+label_files_by_label = msip_lib.labelFilesByLabel
+label_files_by_label.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+label_files_by_label.restype = ctypes.c_int
+
+compute_label_actions = msip_lib.computeLabelActions
+compute_label_actions.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+compute_label_actions.restype = ctypes.c_int
+
+# Fetches a *_v2 result that did not fit, without running the operation again
+msip_take_result = msip_lib.msipTakeResult
+msip_take_result.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_take_result.restype = ctypes.c_int
+
+# Async variants report completion through a callback on an SDK thread: (status, result_json, user_data)
+MSIP_RESULT_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_int, ctypes.c_char_p, ctypes.c_void_p)
+
+unprotect_file_async = msip_lib.unprotectFileAsync
+unprotect_file_async.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, MSIP_RESULT_CALLBACK, ctypes.c_void_p]
+unprotect_file_async.restype = ctypes.c_int
+
+protect_file_async = msip_lib.protectFileAsync
+protect_file_async.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, MSIP_RESULT_CALLBACK, ctypes.c_void_p]
+protect_file_async.restype = ctypes.c_int
+
+# Completion queues: the library queues async results itself and signals an eventfd, so an event loop
+# waits on the descriptor and takes every queued result at once, without Python running on SDK threads
+open_completion_queue = msip_lib.msipOpenCompletionQueue
+open_completion_queue.argtypes = [ctypes.POINTER(ctypes.c_int)]
+open_completion_queue.restype = ctypes.c_int
+
+close_completion_queue = msip_lib.msipCloseCompletionQueue
+close_completion_queue.argtypes = [ctypes.c_int]
+close_completion_queue.restype = ctypes.c_int
+
+take_completions = msip_lib.msipTakeCompletions
+take_completions.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_size_t)]
+take_completions.restype = ctypes.c_int
+
+# Native callback for the async exports; user_data is (queue handle << 48) | call id
+queue_completion = ctypes.cast(msip_lib.msipQueueCompletion, MSIP_RESULT_CALLBACK)
+
+# Returned by *_v2 exports when the result buffer is too small
+MSIP_RESULT_TOO_SMALL = 2
+# Returned by file operation exports that admission control turned away without starting them
+MSIP_OVERLOADED = 3
+
+
+class ResourceExhaustedError(Exception):
+    # The library is at its in-flight or memory limit; the caller should back off and retry
+    pass
+
+# Starting size of each thread's result buffer; it grows to the largest result seen on that thread
+RESULT_BUFFER_SIZE = 8192
+
+_result_buffers = threading.local()
+
+
+def _result_buffer(min_size: int = RESULT_BUFFER_SIZE):
+    buffer = getattr(_result_buffers, 'buffer', None)
+    if buffer is None or len(buffer) < min_size:
+        buffer = ctypes.create_string_buffer(max(min_size, RESULT_BUFFER_SIZE))
+        _result_buffers.buffer = buffer
+    return buffer
+
+def _call_with_result(func, *args):
+    # Call a *_v2 export with this thread's buffer, growing it once if the result did not fit
+    result_buffer = _result_buffer()
+    needed = ctypes.c_size_t(0)
+    ret_val = func(*args, result_buffer, len(result_buffer), ctypes.byref(needed))
+    if ret_val == MSIP_RESULT_TOO_SMALL:
+        result_buffer = _result_buffer(needed.value)
+        ret_val = msip_take_result(result_buffer, len(result_buffer), ctypes.byref(needed))
+    if ret_val == MSIP_OVERLOADED:
+        raise ResourceExhaustedError(_parse_result(result_buffer, '').get('error', 'Too many operations in flight'))
+    return ret_val, result_buffer
+
+msip_take_output = msip_lib.msipTakeOutput
+msip_take_output.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_take_output.restype = ctypes.c_int
+
+# Room left above the input size for *ToBuffer output, which covers the protection headers in most cases
+OUTPUT_BUFFER_SLACK = 64 * 1024
+
+def _call_with_output(func, file_path: str, *args):
+    # Call a *ToBuffer export sized to the input, fetching output that outgrew it without running the call again
+    try:
+        input_size = os.path.getsize(file_path)
+    except OSError:
+        input_size = 0
+    return _call_with_sized_output(func, input_size, *args)
+
+def _call_with_sized_output(func, input_size: int, *args):
+    output = ctypes.create_string_buffer(input_size + OUTPUT_BUFFER_SLACK)
+    output_size = ctypes.c_size_t(0)
+    ret_val, result_buffer = _call_with_result(func, *args, output, len(output), ctypes.byref(output_size))
+    if output_size.value > len(output):
+        output = ctypes.create_string_buffer(output_size.value)
+        msip_take_output(output, len(output), ctypes.byref(output_size))
+    return ret_val, result_buffer, output.raw[:output_size.value]
+
+def _input_buffer(content) -> tuple:
+    # (pointer argument, size) for a *Buffer export reading content in place. bytes and writable buffers are
+    # passed without a copy; other read-only buffers are copied once, which ctypes needs to take their address
+    if isinstance(content, bytes):
+        return content, len(content)
+    view = memoryview(content).cast('B')
+    if view.readonly:
+        return bytes(view), view.nbytes
+    return (ctypes.c_char * view.nbytes).from_buffer(view), view.nbytes
+
+def _open_shared_segment(handle: str, flags: int) -> int:
+    # A POSIX shared-memory object by the name it was created with (shm_open), under MSIP_SHM_DIR
+    name = handle[1:] if handle.startswith('/') else handle
+    if not name or '/' in name or name in ('.', '..'):
+        raise ValueError(f"Invalid shared-memory handle: {handle!r}")
+    return os.open(os.path.join(settings.MSIP_SHM_DIR, name), flags | os.O_CLOEXEC)
+
+def _call_with_segments(func, data: FileData, with_output: bool = True) -> dict:
+    # Run an ext_*_shared_memory call over the segments a request names, closing them once it returns
+    fds = []
+    try:
+        fds.append(_open_shared_segment(data.shm_input, os.O_RDONLY))
+        if with_output:
+            if not data.shm_output:
+                raise ValueError("shm_input requests need a shm_output segment")
+            fds.append(_open_shared_segment(data.shm_output, os.O_RDWR))
+        return func(data, *fds)
+    except (OSError, ValueError) as e:
+        return {"path": data.file, "status": False, "error": str(e)}
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+def _call_worker(operation: str, file_path: str, *args, fds=()) -> dict:
+    # An msip_workerd call, parsed and raising when overloaded as through _call_with_result. The thread's
+    # deadline (ext_set_deadline) travels with the request
+    status, result = _worker.call(operation, *args, fds=fds, timeout_ms=getattr(_worker_deadline, 'timeout_ms', 0))
+    try:
+        parsed = json.loads(result.decode('utf-8'))
+    except (json.JSONDecodeError, UnicodeDecodeError) as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {"path": file_path, "status": False, "error": str(e), "raw": result}
+    if status == MSIP_OVERLOADED:
+        raise ResourceExhaustedError(parsed.get('error', 'Too many operations in flight'))
+    return parsed
+
+def _call_native(func, file_path: str, *args) -> tuple:
+    # An msip_native call: (result, output), with output None for calls without one. The result is already
+    # parsed, and an overloaded library raises as it does through _call_with_result
+    try:
+        ret_val, result, *output = func(*args)
+    except ValueError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {"path": file_path, "status": False, "error": str(e)}, b''
+    if ret_val == MSIP_OVERLOADED:
+        raise ResourceExhaustedError(result.get('error', 'Too many operations in flight'))
+    return result, output[0] if output else None
+
+def _parse_result(result_buffer, file_path: str) -> dict:
+    try:
+        return json.loads(result_buffer.value.decode('utf-8'))
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "path": file_path,
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
 
+# Library lifecycle: the MIP context is created lazily on first use and torn down here
+msip_init = msip_lib.msipInit
+msip_init.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+msip_init.restype = ctypes.c_int
+
+msip_warmup = msip_lib.msipWarmup
+msip_warmup.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_int), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_warmup.restype = ctypes.c_int
+
+msip_restore_engines = msip_lib.msipRestoreEngines
+msip_restore_engines.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_restore_engines.restype = ctypes.c_int
+
+# Snapshot of the warm caches a new replica starts from
+msip_snapshot = msip_lib.msipSnapshot
+msip_snapshot.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_snapshot.restype = ctypes.c_int
+
+msip_restore = msip_lib.msipRestore
+msip_restore.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_restore.restype = ctypes.c_int
+
+msip_set_fast_shutdown = msip_lib.msipSetFastShutdown
+msip_set_fast_shutdown.argtypes = [ctypes.c_int]
+msip_set_fast_shutdown.restype = ctypes.c_int
+
+msip_set_native_json = msip_lib.msipSetNativeJson
+msip_set_native_json.argtypes = [ctypes.c_int]
+msip_set_native_json.restype = ctypes.c_int
+
+msip_set_native_xml = msip_lib.msipSetNativeXml
+msip_set_native_xml.argtypes = [ctypes.c_int]
+msip_set_native_xml.restype = ctypes.c_int
+
+msip_set_clone_label_outputs = msip_lib.msipSetCloneLabelOutputs
+msip_set_clone_label_outputs.argtypes = [ctypes.c_int]
+msip_set_clone_label_outputs.restype = ctypes.c_int
+
+msip_set_pfile_fast_path = msip_lib.msipSetPfileFastPath
+msip_set_pfile_fast_path.argtypes = [ctypes.c_int]
+msip_set_pfile_fast_path.restype = ctypes.c_int
+
+msip_set_skip_unchanged = msip_lib.msipSetSkipUnchanged
+msip_set_skip_unchanged.argtypes = [ctypes.c_int]
+msip_set_skip_unchanged.restype = ctypes.c_int
+
+msip_configure_pdf = msip_lib.msipConfigurePdf
+msip_configure_pdf.argtypes = [ctypes.c_int, ctypes.c_int]
+msip_configure_pdf.restype = ctypes.c_int
+
+msip_set_batch_dedupe = msip_lib.msipSetBatchDedupe
+msip_set_batch_dedupe.argtypes = [ctypes.c_int]
+msip_set_batch_dedupe.restype = ctypes.c_int
+
+msip_configure_batch_read_ahead = msip_lib.msipConfigureBatchReadAhead
+msip_configure_batch_read_ahead.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t]
+msip_configure_batch_read_ahead.restype = ctypes.c_int
+
+msip_configure_batch_prefetch = msip_lib.msipConfigureBatchPrefetch
+msip_configure_batch_prefetch.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_int64]
+msip_configure_batch_prefetch.restype = ctypes.c_int
+
+msip_configure_batch_pipeline = msip_lib.msipConfigureBatchPipeline
+msip_configure_batch_pipeline.argtypes = [ctypes.c_size_t] * 6
+msip_configure_batch_pipeline.restype = ctypes.c_int
+
+msip_get_batch_pipeline_stats = msip_lib.msipGetBatchPipelineStats
+msip_get_batch_pipeline_stats.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_batch_pipeline_stats.restype = ctypes.c_int
+
+msip_configure_object_storage = msip_lib.msipConfigureObjectStorage
+msip_configure_object_storage.argtypes = [ctypes.c_size_t] * 6
+msip_configure_object_storage.restype = ctypes.c_int
+
+msip_get_object_storage_stats = msip_lib.msipGetObjectStorageStats
+msip_get_object_storage_stats.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_object_storage_stats.restype = ctypes.c_int
+
+msip_configure_numa_placement = msip_lib.msipConfigureNumaPlacement
+msip_configure_numa_placement.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_configure_numa_placement.restype = ctypes.c_int
+
+msip_configure_memory_hints = msip_lib.msipConfigureMemoryHints
+msip_configure_memory_hints.argtypes = [ctypes.c_int, ctypes.c_int64, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_configure_memory_hints.restype = ctypes.c_int
+
+msip_configure_output_writer = msip_lib.msipConfigureOutputWriter
+msip_configure_output_writer.argtypes = [ctypes.c_size_t, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+msip_configure_output_writer.restype = ctypes.c_int
+
+msip_configure_package_repack = msip_lib.msipConfigurePackageRepack
+msip_configure_package_repack.argtypes = [ctypes.c_int, ctypes.c_int64, ctypes.c_int64, ctypes.c_int]
+msip_configure_package_repack.restype = ctypes.c_int
+
+msip_configure_input_streams = msip_lib.msipConfigureInputStreams
+msip_configure_input_streams.argtypes = [ctypes.c_int64, ctypes.c_int64, ctypes.c_int64, ctypes.c_size_t, ctypes.c_size_t]
+msip_configure_input_streams.restype = ctypes.c_int
+
+msip_configure_storage = msip_lib.msipConfigureStorage
+msip_configure_storage.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+msip_configure_storage.restype = ctypes.c_int
+
+msip_configure_policy_snapshot = msip_lib.msipConfigurePolicySnapshot
+msip_configure_policy_snapshot.argtypes = [ctypes.c_char_p, ctypes.c_int]
+msip_configure_policy_snapshot.restype = ctypes.c_int
+
+msip_configure_shared_labels = msip_lib.msipConfigureSharedLabels
+msip_configure_shared_labels.argtypes = [ctypes.c_char_p]
+msip_configure_shared_labels.restype = ctypes.c_int
+
+msip_configure_classification = msip_lib.msipConfigureClassification
+msip_configure_classification.argtypes = [ctypes.c_int, ctypes.c_char_p]
+msip_configure_classification.restype = ctypes.c_int
+
+msip_configure_engines = msip_lib.msipConfigureEngines
+msip_configure_engines.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int64, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t]
+msip_configure_engines.restype = ctypes.c_int
+
+msip_reload_config = msip_lib.msipReloadConfig
+msip_reload_config.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_reload_config.restype = ctypes.c_int
+
+msip_configure_consent = msip_lib.msipConfigureConsent
+msip_configure_consent.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_int]
+msip_configure_consent.restype = ctypes.c_int
+
+msip_configure_memory_storage = msip_lib.msipConfigureMemoryStorage
+msip_configure_memory_storage.argtypes = [ctypes.c_uint64]
+msip_configure_memory_storage.restype = ctypes.c_int
+
+msip_configure_shards = msip_lib.msipConfigureShards
+msip_configure_shards.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int64, ctypes.c_int64]
+msip_configure_shards.restype = ctypes.c_int
+
+msip_configure_watch = msip_lib.msipConfigureWatch
+msip_configure_watch.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int64, ctypes.c_size_t]
+msip_configure_watch.restype = ctypes.c_int
+
+msip_submit_sharded_job = msip_lib.msipSubmitShardedJob
+msip_submit_sharded_job.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_submit_sharded_job.restype = ctypes.c_int
+
+msip_get_sharded_job_progress = msip_lib.msipGetShardedJobProgress
+msip_get_sharded_job_progress.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_sharded_job_progress.restype = ctypes.c_int
+
+msip_get_sharded_job_results = msip_lib.msipGetShardedJobResults
+msip_get_sharded_job_results.argtypes = [ctypes.c_char_p, ctypes.c_int64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_sharded_job_results.restype = ctypes.c_int
+
+msip_configure_encrypted_storage = msip_lib.msipConfigureEncryptedStorage
+msip_configure_encrypted_storage.argtypes = [ctypes.c_char_p]
+msip_configure_encrypted_storage.restype = ctypes.c_int
+
+msip_configure_redis_storage = msip_lib.msipConfigureRedisStorage
+msip_configure_redis_storage.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p]
+msip_configure_redis_storage.restype = ctypes.c_int
+
+# Asynchronous SDK logger
+msip_configure_logging = msip_lib.msipConfigureLogging
+msip_configure_logging.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_size_t]
+msip_configure_logging.restype = ctypes.c_int
+
+msip_set_log_level = msip_lib.msipSetLogLevel
+msip_set_log_level.argtypes = [ctypes.c_int]
+msip_set_log_level.restype = ctypes.c_int
+
+msip_set_log_limits = msip_lib.msipSetLogLimits
+msip_set_log_limits.argtypes = [ctypes.c_int, ctypes.c_uint, ctypes.c_uint]
+msip_set_log_limits.restype = ctypes.c_int
+
+msip_set_log_capture_level = msip_lib.msipSetLogCaptureLevel
+msip_set_log_capture_level.argtypes = [ctypes.c_int]
+msip_set_log_capture_level.restype = ctypes.c_int
+
+msip_set_module_trace = msip_lib.msipSetModuleTrace
+msip_set_module_trace.argtypes = [ctypes.c_char_p, ctypes.c_int]
+msip_set_module_trace.restype = ctypes.c_int
+
+msip_set_request_trace = msip_lib.msipSetRequestTrace
+msip_set_request_trace.argtypes = [ctypes.c_int]
+msip_set_request_trace.restype = ctypes.c_int
+
+msip_get_log_stats = msip_lib.msipGetLogStats
+msip_get_log_stats.argtypes = [ctypes.c_char_p]
+msip_get_log_stats.restype = ctypes.c_int
+
+# Audit and telemetry events batched to a collector instead of the SDK's pipeline
+msip_configure_diagnostic_upload = msip_lib.msipConfigureDiagnosticUpload
+msip_configure_diagnostic_upload.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_int]
+msip_configure_diagnostic_upload.restype = ctypes.c_int
+
+msip_get_diagnostic_upload_stats = msip_lib.msipGetDiagnosticUploadStats
+msip_get_diagnostic_upload_stats.argtypes = [ctypes.c_char_p]
+msip_get_diagnostic_upload_stats.restype = ctypes.c_int
+
+# Recorded RMS and policy responses served instead of the network, for load tests
+msip_configure_http_replay = msip_lib.msipConfigureHttpReplay
+msip_configure_http_replay.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+msip_configure_http_replay.restype = ctypes.c_int
+
+# Public keys and unwrap results of Double Key Encryption services kept in memory
+msip_configure_dke_cache = msip_lib.msipConfigureDkeCache
+msip_configure_dke_cache.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_size_t]
+msip_configure_dke_cache.restype = ctypes.c_int
+
+msip_clear_dke_cache = msip_lib.msipClearDkeCache
+msip_clear_dke_cache.argtypes = []
+msip_clear_dke_cache.restype = ctypes.c_int
+
+msip_configure_http_resilience = msip_lib.msipConfigureHttpResilience
+msip_configure_http_resilience.argtypes = [ctypes.c_int, ctypes.c_int64, ctypes.c_int64, ctypes.c_int, ctypes.c_int64, ctypes.c_int, ctypes.c_int64]
+msip_configure_http_resilience.restype = ctypes.c_int
+
+msip_configure_http_rate_limit = msip_lib.msipConfigureHttpRateLimit
+msip_configure_http_rate_limit.argtypes = [ctypes.c_int, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_int64, ctypes.c_int64]
+msip_configure_http_rate_limit.restype = ctypes.c_int
+
+msip_get_http_replay_stats = msip_lib.msipGetHttpReplayStats
+msip_get_http_replay_stats.argtypes = [ctypes.c_char_p]
+msip_get_http_replay_stats.restype = ctypes.c_int
+
+msip_set_client_secret = msip_lib.msipSetClientSecret
+msip_set_client_secret.argtypes = [ctypes.c_char_p]
+msip_set_client_secret.restype = ctypes.c_int
+
+msip_shutdown = msip_lib.msipShutdown
+msip_shutdown.argtypes = []
+msip_shutdown.restype = ctypes.c_int
+
+msip_drop_caches = msip_lib.msipDropCaches
+msip_drop_caches.argtypes = [ctypes.c_int]
+msip_drop_caches.restype = ctypes.c_int
+
+# Stopping and restarting the library's threads around fork()
+msip_prepare_fork = msip_lib.msipPrepareFork
+msip_prepare_fork.argtypes = [ctypes.c_int64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_prepare_fork.restype = ctypes.c_int
+
+msip_resume_after_fork = msip_lib.msipResumeAfterFork
+msip_resume_after_fork.argtypes = []
+msip_resume_after_fork.restype = ctypes.c_int
+
+msip_drain = msip_lib.msipDrain
+msip_drain.argtypes = [ctypes.c_int64, ctypes.c_int64, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_drain.restype = ctypes.c_int
+
+# Engine cache tuning and counters
+msip_set_engine_cache_size = msip_lib.msipSetEngineCacheSize
+msip_set_engine_cache_size.argtypes = [ctypes.c_size_t]
+msip_set_engine_cache_size.restype = ctypes.c_int
+
+msip_set_policy_engine_cache_size = msip_lib.msipSetPolicyEngineCacheSize
+msip_set_policy_engine_cache_size.argtypes = [ctypes.c_size_t]
+msip_set_policy_engine_cache_size.restype = ctypes.c_int
+
+msip_get_engine_cache_stats = msip_lib.msipGetEngineCacheStats
+msip_get_engine_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_engine_cache_stats.restype = ctypes.c_int
+
+msip_set_policy_refresh = msip_lib.msipSetPolicyRefresh
+msip_set_policy_refresh.argtypes = [ctypes.c_int]
+msip_set_policy_refresh.restype = ctypes.c_int
+
+msip_set_engine_idle_timeout = msip_lib.msipSetEngineIdleTimeout
+msip_set_engine_idle_timeout.argtypes = [ctypes.c_int]
+msip_set_engine_idle_timeout.restype = ctypes.c_int
+
+msip_set_template_refresh = msip_lib.msipSetTemplateRefresh
+msip_set_template_refresh.argtypes = [ctypes.c_int]
+msip_set_template_refresh.restype = ctypes.c_int
+
+# Protection-status cache in front of getFileStatus
+msip_configure_inspection_cache = msip_lib.msipConfigureInspectionCache
+msip_configure_inspection_cache.argtypes = [ctypes.c_size_t, ctypes.c_int, ctypes.c_int]
+msip_configure_inspection_cache.restype = ctypes.c_int
+
+msip_configure_known_clean = msip_lib.msipConfigureKnownClean
+msip_configure_known_clean.argtypes = [ctypes.c_size_t, ctypes.c_double, ctypes.c_int64, ctypes.c_uint32, ctypes.c_char_p]
+msip_configure_known_clean.restype = ctypes.c_int
+
+msip_get_inspection_cache_stats = msip_lib.msipGetInspectionCacheStats
+msip_get_inspection_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_inspection_cache_stats.restype = ctypes.c_int
+
+# Reference-file protections reused by protectFile
+msip_set_protection_cache_size = msip_lib.msipSetProtectionCacheSize
+msip_set_protection_cache_size.argtypes = [ctypes.c_size_t]
+msip_set_protection_cache_size.restype = ctypes.c_int
+
+msip_get_protection_cache_stats = msip_lib.msipGetProtectionCacheStats
+msip_get_protection_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_protection_cache_stats.restype = ctypes.c_int
+
+# Parsed publishing licenses reused by inspectLicense
+msip_set_license_info_cache_size = msip_lib.msipSetLicenseInfoCacheSize
+msip_set_license_info_cache_size.argtypes = [ctypes.c_size_t]
+msip_set_license_info_cache_size.restype = ctypes.c_int
+
+msip_get_license_info_cache_stats = msip_lib.msipGetLicenseInfoCacheStats
+msip_get_license_info_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_license_info_cache_stats.restype = ctypes.c_int
+
+# (user, content id) licenses held after prefetchLicenses
+msip_set_use_license_cache_size = msip_lib.msipSetUseLicenseCacheSize
+msip_set_use_license_cache_size.argtypes = [ctypes.c_size_t]
+msip_set_use_license_cache_size.restype = ctypes.c_int
+
+msip_get_use_license_cache_stats = msip_lib.msipGetUseLicenseCacheStats
+msip_get_use_license_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_use_license_cache_stats.restype = ctypes.c_int
+
+# Delegation licenses reused by checkDelegatedAccess
+msip_configure_rights_cache = msip_lib.msipConfigureRightsCache
+msip_configure_rights_cache.argtypes = [ctypes.c_size_t, ctypes.c_int]
+msip_configure_rights_cache.restype = ctypes.c_int
+
+msip_configure_decrypted_content_cache = msip_lib.msipConfigureDecryptedContentCache
+msip_configure_decrypted_content_cache.argtypes = [ctypes.c_size_t, ctypes.c_size_t]
+msip_configure_decrypted_content_cache.restype = ctypes.c_int
+
+msip_clear_decrypted_content_cache = msip_lib.msipClearDecryptedContentCache
+msip_clear_decrypted_content_cache.argtypes = []
+msip_clear_decrypted_content_cache.restype = ctypes.c_int
+
+msip_configure_container_cache = msip_lib.msipConfigureContainerCache
+msip_configure_container_cache.argtypes = [ctypes.c_size_t, ctypes.c_int, ctypes.c_size_t]
+msip_configure_container_cache.restype = ctypes.c_int
+
+msip_clear_container_cache = msip_lib.msipClearContainerCache
+msip_clear_container_cache.argtypes = []
+msip_clear_container_cache.restype = ctypes.c_int
+
+msip_configure_delegation_license_cache = msip_lib.msipConfigureDelegationLicenseCache
+msip_configure_delegation_license_cache.argtypes = [ctypes.c_size_t, ctypes.c_int]
+msip_configure_delegation_license_cache.restype = ctypes.c_int
+
+msip_configure_tenant_cache = msip_lib.msipConfigureTenantCache
+msip_configure_tenant_cache.argtypes = [ctypes.c_size_t, ctypes.c_int]
+msip_configure_tenant_cache.restype = ctypes.c_int
+
+msip_configure_region = msip_lib.msipConfigureRegion
+msip_configure_region.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int]
+msip_configure_region.restype = ctypes.c_int
+
+msip_configure_delegated_identity = msip_lib.msipConfigureDelegatedIdentity
+msip_configure_delegated_identity.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+msip_configure_delegated_identity.restype = ctypes.c_int
+
+msip_get_tenant_cache_stats = msip_lib.msipGetTenantCacheStats
+msip_get_tenant_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_tenant_cache_stats.restype = ctypes.c_int
+
+msip_get_delegation_license_cache_stats = msip_lib.msipGetDelegationLicenseCacheStats
+msip_get_delegation_license_cache_stats.argtypes = [ctypes.c_char_p]
+msip_get_delegation_license_cache_stats.restype = ctypes.c_int
+
+# Native task dispatcher counters (shared by every profile)
+msip_get_task_dispatcher_stats = msip_lib.msipGetTaskDispatcherStats
+msip_get_task_dispatcher_stats.argtypes = [ctypes.c_char_p]
+msip_get_task_dispatcher_stats.restype = ctypes.c_int
+
+# Per-phase latency histograms kept inside the library
+msip_get_metrics = msip_lib.msipGetMetrics
+msip_get_metrics.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_get_metrics.restype = ctypes.c_int
+
+msip_render_metrics = msip_lib.msipRenderMetrics
+msip_render_metrics.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_render_metrics.restype = ctypes.c_int
+
+msip_render_counters = msip_lib.msipRenderCounters
+msip_render_counters.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_render_counters.restype = ctypes.c_int
+
+msip_configure_lock_metrics = msip_lib.msipConfigureLockMetrics
+msip_configure_lock_metrics.argtypes = [ctypes.c_uint32]
+msip_configure_lock_metrics.restype = ctypes.c_int
+
+# Trace context for SDK HTTP calls: set per calling thread, spans drained as JSON
+msip_set_trace_context = msip_lib.msipSetTraceContext
+msip_set_trace_context.argtypes = [ctypes.c_char_p]
+msip_set_trace_context.restype = ctypes.c_int
+
+# Deadline of the calling thread's next operations, in milliseconds from now; 0 clears it
+msip_set_deadline = msip_lib.msipSetDeadline
+msip_set_deadline.argtypes = [ctypes.c_int64]
+msip_set_deadline.restype = ctypes.c_int
+
+msip_set_idempotency_key = msip_lib.msipSetIdempotencyKey
+msip_set_idempotency_key.argtypes = [ctypes.c_char_p]
+msip_set_idempotency_key.restype = ctypes.c_int
+
+msip_configure_idempotency = msip_lib.msipConfigureIdempotency
+msip_configure_idempotency.argtypes = [ctypes.c_size_t, ctypes.c_int64]
+msip_configure_idempotency.restype = ctypes.c_int
+
+msip_set_priority = msip_lib.msipSetPriority
+msip_set_priority.argtypes = [ctypes.c_int]
+msip_set_priority.restype = ctypes.c_int
+
+# Receives a run of complete NDJSON lines of a streamed batch: (lines, size, user_data)
+MSIP_BATCH_LINES_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p)
+
+msip_stream_batch_results = msip_lib.msipStreamBatchResults
+msip_stream_batch_results.argtypes = [ctypes.c_int, MSIP_BATCH_LINES_CALLBACK, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int]
+msip_stream_batch_results.restype = ctypes.c_int
+
+# Sampling CPU profiler writing pprof profiles; also toggled by a signal once enabled
+msip_start_cpu_profile = msip_lib.msipStartCpuProfile
+msip_start_cpu_profile.argtypes = [ctypes.c_int, ctypes.c_int64]
+msip_start_cpu_profile.restype = ctypes.c_int
+
+msip_stop_cpu_profile = msip_lib.msipStopCpuProfile
+msip_stop_cpu_profile.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_stop_cpu_profile.restype = ctypes.c_int
+
+msip_enable_cpu_profile_signal = msip_lib.msipEnableCpuProfileSignal
+msip_enable_cpu_profile_signal.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_char_p]
+msip_enable_cpu_profile_signal.restype = ctypes.c_int
+
+# Protect and unprotect operations past a threshold, kept with what they went through
+msip_configure_slow_operations = msip_lib.msipConfigureSlowOperations
+msip_configure_slow_operations.argtypes = [ctypes.c_int64, ctypes.c_size_t]
+msip_configure_slow_operations.restype = ctypes.c_int
+
+msip_take_slow_operations = msip_lib.msipTakeSlowOperations
+msip_take_slow_operations.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_take_slow_operations.restype = ctypes.c_int
+
+# Shapes of the operations served, for msip_loadgen --capture to replay
+msip_start_capture = msip_lib.msipStartCapture
+msip_start_capture.argtypes = [ctypes.c_char_p, ctypes.c_uint32, ctypes.c_uint64]
+msip_start_capture.restype = ctypes.c_int
+
+msip_stop_capture = msip_lib.msipStopCapture
+msip_stop_capture.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_stop_capture.restype = ctypes.c_int
+
+# Chrome trace timelines of sampled or requested protect and unprotect operations
+msip_configure_timelines = msip_lib.msipConfigureTimelines
+msip_configure_timelines.argtypes = [ctypes.c_uint32, ctypes.c_size_t]
+msip_configure_timelines.restype = ctypes.c_int
+
+msip_request_timelines = msip_lib.msipRequestTimelines
+msip_request_timelines.argtypes = [ctypes.c_uint32]
+msip_request_timelines.restype = ctypes.c_int
+
+msip_take_timelines = msip_lib.msipTakeTimelines
+msip_take_timelines.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_take_timelines.restype = ctypes.c_int
+
+msip_configure_format_gate = msip_lib.msipConfigureFormatGate
+msip_configure_format_gate.argtypes = [ctypes.c_int, ctypes.c_int64]
+msip_configure_format_gate.restype = ctypes.c_int
+
+msip_configure_operation_budget = msip_lib.msipConfigureOperationBudget
+msip_configure_operation_budget.argtypes = [ctypes.c_int64, ctypes.c_int64, ctypes.c_int]
+msip_configure_operation_budget.restype = ctypes.c_int
+
+msip_configure_tracing = msip_lib.msipConfigureTracing
+msip_configure_tracing.argtypes = [ctypes.c_size_t]
+msip_configure_tracing.restype = ctypes.c_int
+
+msip_take_spans = msip_lib.msipTakeSpans
+msip_take_spans.argtypes = [ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+msip_take_spans.restype = ctypes.c_int
+
+
+def ext_init(application_id: str) -> dict:
     # Create buffer for result
     result_buffer = ctypes.create_string_buffer(8192)
 
     # Call the function
-    get_file_status(data.file.encode(), data.application_id.encode(), result_buffer)
+    msip_init(application_id.encode(), result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+# Parts msipWarmup loads beyond the profile and protection-only engine of every target
+WARMUP_LABELS = 1
+WARMUP_TEMPLATES = 2
+
+def ext_warmup(targets: list, scc_token: str = "") -> dict:
+    # Each target is {"application_id", "user", "labels", "templates"}; an empty token uses the client secret
+    parts = (ctypes.c_int * len(targets))()
+    parts[:] = [(WARMUP_LABELS if t.get("labels") else 0) | (WARMUP_TEMPLATES if t.get("templates") else 0)
+                for t in targets]
+    ret_val, result_buffer = _call_with_result(
+        msip_warmup,
+        scc_token.encode(),
+        _encode_paths([t["application_id"] for t in targets]),
+        _encode_paths([t.get("user", "") for t in targets]),
+        parts,
+        len(targets)
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_snapshot(path: str, key: str = "") -> dict:
+    # Writes the warm caches to path; the rights and license sections are sealed under the 64 hex digit key,
+    # and left out without one
+    ret_val, result_buffer = _call_with_result(msip_snapshot, path.encode(), key.encode())
+    return _parse_result(result_buffer, '')
+
+def ext_restore(path: str, key: str = "") -> dict:
+    # Restores the caches ext_snapshot wrote to path; sealed sections need the key they were written with
+    ret_val, result_buffer = _call_with_result(msip_restore, path.encode(), key.encode())
+    return _parse_result(result_buffer, '')
+
+def ext_restore_engines(application_ids: list = None, scc_token: str = "") -> dict:
+    # Reloads the engines an earlier run stored on disk; no ids restores every application in the manifest
+    application_ids = application_ids or []
+    ret_val, result_buffer = _call_with_result(
+        msip_restore_engines,
+        scc_token.encode(),
+        _encode_paths(application_ids),
+        len(application_ids)
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_set_fast_shutdown(enabled: bool) -> int:
+    return msip_set_fast_shutdown(1 if enabled else 0)
+
+def ext_set_native_json(enabled: bool) -> int:
+    return msip_set_native_json(1 if enabled else 0)
+
+def ext_set_native_xml(enabled: bool) -> int:
+    return msip_set_native_xml(1 if enabled else 0)
+
+def ext_set_clone_label_outputs(enabled: bool) -> int:
+    return msip_set_clone_label_outputs(1 if enabled else 0)
+
+def ext_set_pfile_fast_path(enabled: bool) -> int:
+    return msip_set_pfile_fast_path(1 if enabled else 0)
+
+def ext_set_skip_unchanged(enabled: bool) -> int:
+    return msip_set_skip_unchanged(1 if enabled else 0)
+
+def ext_configure_pdf(keep_linearization: bool, incremental_updates: bool) -> int:
+    # Call before msipInit; keep_linearization applies to engines loaded afterwards
+    return msip_configure_pdf(1 if keep_linearization else 0, 1 if incremental_updates else 0)
+
+# Values accepted for MSIP_BATCH_DEDUPE, mapped to ContentDedupe::Mode
+BATCH_DEDUPE_MODES = {"off": 0, "copy": 1, "hardlink": 2}
+
+def ext_set_batch_dedupe(mode: str) -> int:
+    if mode not in BATCH_DEDUPE_MODES:
+        raise ValueError(f"Unknown batch dedupe mode: {mode}")
+    return msip_set_batch_dedupe(BATCH_DEDUPE_MODES[mode])
+
+def ext_configure_batch_read_ahead(queue_depth: int, buffer_bytes: int = 256 * 1024,
+                                   max_buffered_bytes: int = 256 * 1024 * 1024) -> int:
+    # queue_depth 0 turns read ahead off; non-zero fails where io_uring is unavailable
+    if queue_depth < 0 or buffer_bytes <= 0 or max_buffered_bytes < 0:
+        return 1
+    return msip_configure_batch_read_ahead(queue_depth, buffer_bytes, max_buffered_bytes)
+
+def ext_configure_batch_prefetch(depth: int, max_buffered_bytes: int = 64 * 1024 * 1024,
+                                 max_prefault_bytes: int = 64 * 1024 * 1024) -> int:
+    # Files prefetched per batch worker when inputs are not read ahead through io_uring; depth 0 turns it off
+    if not 0 <= depth <= 16 or max_buffered_bytes < 0 or max_prefault_bytes < 0:
+        return 1
+    return msip_configure_batch_prefetch(depth, max_buffered_bytes, max_prefault_bytes)
+
+def ext_configure_batch_pipeline(read_workers: int, open_workers: int, rights_workers: int, transform_workers: int,
+                                 commit_workers: int, queue_capacity: int = 0) -> int:
+    # Workers per stage of protect and unprotect batches; all 0 processes each file in one call
+    workers = (read_workers, open_workers, rights_workers, transform_workers, commit_workers)
+    if min(workers) < 0 or queue_capacity < 0:
+        return 1
+    return msip_configure_batch_pipeline(*workers, queue_capacity)
+
+def ext_get_batch_pipeline_stats() -> dict:
+    # Per stage utilization and queue occupancy of the last pipelined batch, and its bottleneck stage
+    ret_val, result_buffer = _call_with_result(msip_get_batch_pipeline_stats)
+    return _parse_result(result_buffer, '')
+
+def ext_configure_object_storage(block_bytes: int = 0, cache_blocks: int = 0, max_read_ahead_blocks: int = 0,
+                                 part_bytes: int = 0, parts_in_flight: int = 0, transfer_threads: int = 0) -> int:
+    # Block cache and readahead of object inputs, part size and concurrency of object outputs; 0 keeps a value
+    values = (block_bytes, cache_blocks, max_read_ahead_blocks, part_bytes, parts_in_flight, transfer_threads)
+    if min(values) < 0:
+        return 1
+    return msip_configure_object_storage(*values)
+
+def ext_get_object_storage_stats() -> dict:
+    ret_val, result_buffer = _call_with_result(msip_get_object_storage_stats)
+    return _parse_result(result_buffer, '')
+
+def ext_configure_numa_placement(enabled: bool) -> dict:
+    # Pins batch workers to NUMA nodes and places pooled buffers by node; "nodes" is 1 where it has no effect
+    ret_val, result_buffer = _call_with_result(msip_configure_numa_placement, 1 if enabled else 0)
+    return _parse_result(result_buffer, '')
+
+def ext_configure_memory_hints(huge_pages: bool = True, prefault_min_bytes: int = 0, prefault_pool: bool = False) -> dict:
+    # Transparent huge pages for large pool buffers and mapped inputs, and prefaulting of mapped inputs of
+    # prefault_min_bytes or more (0 for none) and of new large pool buffers; "transparent_hugepage" is the kernel's mode
+    ret_val, result_buffer = _call_with_result(msip_configure_memory_hints, 1 if huge_pages else 0, int(prefault_min_bytes),
+                                               1 if prefault_pool else 0)
+    return _parse_result(result_buffer, '')
+
+def ext_configure_output_writer(buffer_bytes: int, direct_io: bool = False, drop_cache: bool = False,
+                                preallocate: bool = True) -> int:
+    # buffer_bytes 0 leaves _modified outputs to the SDK's own writer
+    if buffer_bytes < 0:
+        return 1
+    return msip_configure_output_writer(buffer_bytes, int(direct_io), int(drop_cache), int(preallocate))
+
+def ext_configure_package_repack(enabled: bool, max_package_bytes: int = 256 * 1024 * 1024,
+                                 deflate_min_bytes: int = 64 * 1024, level: int = 6) -> int:
+    # deflate_min_bytes 0 copies every part as it is; returns 1 for a level outside 1-9
+    return msip_configure_package_repack(int(enabled), max_package_bytes, deflate_min_bytes, level)
+
+def ext_configure_input_streams(pooled_max_bytes: int, mapped_min_bytes: int, windowed_min_bytes: int,
+                                window_bytes: int, read_ahead_bytes: int) -> int:
+    # pooled_max_bytes and windowed_min_bytes 0 turn those strategies off
+    if min(pooled_max_bytes, mapped_min_bytes, windowed_min_bytes, window_bytes, read_ahead_bytes) < 0:
+        return 1
+    return msip_configure_input_streams(
+        pooled_max_bytes, mapped_min_bytes, windowed_min_bytes, window_bytes, read_ahead_bytes)
+
+# Values accepted for MSIP_CACHE_STORAGE, mapped to mip::CacheStorageType
+CACHE_STORAGE_TYPES = {"in_memory": 0, "on_disk": 1, "on_disk_encrypted": 2}
+
+def ext_configure_storage(storage_type: str, storage_path: str = "", cache_licenses: bool = True,
+                          policy_ttl_days: int = 0) -> int:
+    if storage_type not in CACHE_STORAGE_TYPES:
+        raise ValueError(f"Unknown cache storage type: {storage_type}")
+    return msip_configure_storage(
+        storage_path.encode(), CACHE_STORAGE_TYPES[storage_type], 1 if cache_licenses else 0, policy_ttl_days)
+
+def ext_configure_policy_snapshot(path: str, export: bool = False) -> int:
+    return msip_configure_policy_snapshot(path.encode(), 1 if export else 0)
+
+def ext_configure_shared_labels(directory: str) -> int:
+    # Directory of the label snapshots the node's processes share, best on tmpfs; empty turns them off
+    return msip_configure_shared_labels(directory.encode())
+
+def ext_configure_classification(enabled: bool, cache_dir: str = "") -> int:
+    return msip_configure_classification(1 if enabled else 0, cache_dir.encode())
+
+def ext_configure_engines(locale: str = "", flighting_features: str = "", enable_functionality: str = "",
+                          disable_functionality: str = "", task_timeout_ms: int = 0,
+                          max_file_size_for_protection: int = 0, custom_settings: dict | None = None) -> int:
+    # custom_settings maps SDK custom setting names to values, passed to every engine
+    custom_settings = custom_settings or {}
+    return msip_configure_engines(locale.encode(), flighting_features.encode(), enable_functionality.encode(),
+                                  disable_functionality.encode(), task_timeout_ms, max_file_size_for_protection,
+                                  _encode_paths(list(custom_settings)),
+                                  _encode_paths([str(value) for value in custom_settings.values()]),
+                                  len(custom_settings))
+
+def ext_reload_config(config: dict) -> dict:
+    # Applies cache sizes, refresh intervals and engine settings while requests keep running; cached engines
+    # are replaced in the background. Nothing is applied when a member is unknown or malformed.
+    ret_val, result_buffer = _call_with_result(msip_reload_config, json.dumps(config).encode())
+    return _parse_result(result_buffer, '')
+
+def ext_configure_consent(allowed_hosts: list, reject_others: bool = False) -> int:
+    # allowed_hosts and their subdomains are always consented to; reject_others turns every other endpoint down
+    return msip_configure_consent(_encode_paths(list(allowed_hosts)), len(allowed_hosts), int(reject_others))
+
+def ext_configure_redis_storage(redis_url: str, key_prefix: str = "msip", l1_ttl_seconds: int = 30, key: str = "") -> int:
+    # key: 64 hex digits sealing the encrypted columns; required unless redis_url is empty
+    return msip_configure_redis_storage(redis_url.encode(), key_prefix.encode(), l1_ttl_seconds, key.encode())
+
+def ext_configure_shards(redis_url: str, key_prefix: str = "msip:shards:", worker_id: str = "", threads: int = 0,
+                         lease_ms: int = 30000, poll_ms: int = 1000) -> int:
+    # Shares sharded jobs through Redis at redis_url; with threads above 0 this replica works on their shards,
+    # taking over shards whose lease of lease_ms lapsed. An empty url stops the worker
+    return msip_configure_shards(redis_url.encode(), key_prefix.encode(), worker_id.encode(), max(int(threads), 0),
+                                 int(lease_ms), int(poll_ms))
+
+def ext_configure_watch(roots: list, operation: str, application_id: str, filters: str = "", scc_token: str = "",
+                        user: str = "", encrypted_file: str = "", output_fd: int = -1, settle_ms: int = 500,
+                        max_batch: int = 64) -> int:
+    # Runs operation on every file under roots once it is written and has settled for settle_ms, writing one
+    # NDJSON line of results per batch to output_fd when it is not negative. Empty roots stop the watcher
+    return msip_configure_watch(','.join(roots).encode(), filters.encode(), operation.encode(), scc_token.encode(),
+                                encrypted_file.encode(), user.encode(), application_id.encode(), int(output_fd),
+                                int(settle_ms), max(int(max_batch), 0))
+
+def ext_submit_sharded_job(job_id: str, operation: str, files: list, application_id: str, scc_token: str = "",
+                           user: str = "", encrypted_file: str = "", shard_size: int = 100,
+                           ttl_seconds: int = 86400) -> dict:
+    # Splits files into shards of shard_size for every replica's shard worker to run as operation "status",
+    # "unprotect" or "protect"; "shards" holds their number
+    ret_val, result_buffer = _call_with_result(
+        msip_submit_sharded_job,
+        job_id.encode(),
+        operation.encode(),
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        encrypted_file.encode(),
+        user.encode(),
+        application_id.encode(),
+        max(int(shard_size), 0),
+        int(ttl_seconds)
+    )
+    return _parse_result(result_buffer, '')
+
+def ext_get_sharded_job_progress(job_id: str) -> dict:
+    # Shards done, leased and pending and files succeeded and failed; "found" is false once the job expired
+    ret_val, result_buffer = _call_with_result(msip_get_sharded_job_progress, job_id.encode())
+    return _parse_result(result_buffer, '')
+
+def ext_get_sharded_job_results(job_id: str, first: int = 0) -> dict:
+    # "results" holds each completed shard's batch results, in completion order from the first-th
+    ret_val, result_buffer = _call_with_result(msip_get_sharded_job_results, job_id.encode(), max(int(first), 0))
+    return _parse_result(result_buffer, '')
+
+def ext_configure_memory_storage(budget_bytes: int) -> int:
+    # Keeps the SDK's storage tables in process memory within budget_bytes, evicting least recently used rows; 0 restores the SDK's storage
+    return msip_configure_memory_storage(max(int(budget_bytes), 0))
+
+def ext_configure_encrypted_storage(key_hex: str) -> int:
+    # Keeps the SDK's on-disk tables in append-only logs sealed under the 64 hex digit key_hex; '' restores the SDK's storage
+    return msip_configure_encrypted_storage(key_hex.strip().encode())
+
+# Values accepted for MSIP_LOG_LEVEL and MSIP_LOG_SINK, mapped to mip::LogLevel and the logger sinks
+LOG_LEVELS = {"trace": 0, "info": 1, "warning": 2, "error": 3}
+LOG_SINKS = {"file": 0, "stdout": 1}
+
+def ext_configure_logging(level: str, sink: str = "file", buffer_size: int = 0) -> int:
+    if level not in LOG_LEVELS:
+        raise ValueError(f"Unknown log level: {level}")
+    if sink not in LOG_SINKS:
+        raise ValueError(f"Unknown log sink: {sink}")
+    return msip_configure_logging(LOG_LEVELS[level], LOG_SINKS[sink], buffer_size)
+
+def ext_set_log_level(level: str) -> int:
+    if level not in LOG_LEVELS:
+        raise ValueError(f"Unknown log level: {level}")
+    return msip_set_log_level(LOG_LEVELS[level])
+
+def ext_set_log_limits(level: str, sample_every: int = 1, max_per_second: int = 0) -> int:
+    if level not in LOG_LEVELS:
+        raise ValueError(f"Unknown log level: {level}")
+    return msip_set_log_limits(LOG_LEVELS[level], sample_every, max_per_second)
+
+def ext_set_log_capture_level(level: str) -> int:
+    # Contexts created afterwards hand over records from level up, so modules and requests can be traced on demand
+    if level not in LOG_LEVELS:
+        raise ValueError(f"Unknown log level: {level}")
+    return msip_set_log_capture_level(LOG_LEVELS[level])
+
+def ext_set_module_trace(module: str, enabled: bool = True) -> int:
+    # Captured SDK records whose source path contains module are written whatever the log level
+    return msip_set_module_trace(module.encode(), 1 if enabled else 0)
+
+def ext_set_request_trace(enabled: bool) -> int:
+    # Captured SDK records of this thread's next operations are written whatever the log level;
+    # ext_set_trace_context resets it
+    return msip_set_request_trace(1 if enabled else 0)
+
+def ext_get_log_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_log_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_configure_diagnostic_upload(endpoint: str, authorization: str = "", queue_capacity: int = 0,
+                                    max_batch_events: int = 0, flush_interval_ms: int = 0) -> int:
+    # Call before ext_init; 0 keeps the library default for each limit and an empty endpoint keeps the SDK's pipeline
+    return msip_configure_diagnostic_upload(endpoint.encode(), authorization.encode(), queue_capacity,
+                                            max_batch_events, flush_interval_ms)
+
+def ext_get_diagnostic_upload_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_diagnostic_upload_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+HTTP_REPLAY_MODES = {"": 0, "record": 1, "replay": 2}
+
+def ext_configure_http_resilience(max_retries: int = 2, retry_base_ms: int = 100, retry_max_ms: int = 2000,
+                                  hedge: bool = True, hedge_min_ms: int = 50, breaker_failures: int = 5,
+                                  breaker_open_ms: int = 30000) -> int:
+    # Retries and hedges only apply to GETs; 0 disables retries or the circuit breaker
+    return msip_configure_http_resilience(max_retries, retry_base_ms, retry_max_ms, 1 if hedge else 0,
+                                          hedge_min_ms, breaker_failures, breaker_open_ms)
+
+def ext_configure_http_rate_limit(enabled: bool = True, min_rate: float = 1.0, max_rate: float = 0.0,
+                                  increase_per_second: float = 5.0, decrease: float = 0.5,
+                                  max_retry_after_ms: int = 60000, relax_after_ms: int = 60000) -> int:
+    # Per tenant and host request rate, lowered on 429 and 503 responses; max_rate 0 sets no ceiling
+    return msip_configure_http_rate_limit(1 if enabled else 0, min_rate, max_rate, increase_per_second, decrease,
+                                          max_retry_after_ms, relax_after_ms)
+
+def ext_configure_http_replay(mode: str, directory: str = "", latency_ms: int = 0, jitter_ms: int = 0) -> int:
+    # Call before ext_init; mode is "record", "replay" or "" for the live transport
+    if mode not in HTTP_REPLAY_MODES:
+        return 1
+    return msip_configure_http_replay(HTTP_REPLAY_MODES[mode], directory.encode(), latency_ms, jitter_ms)
+
+def ext_configure_dke_cache(base_urls: list, public_key_ttl_seconds: int = 3600, unwrap_ttl_seconds: int = 600,
+                            capacity: int = 4096) -> int:
+    # Call before ext_init; an empty list turns the cache off
+    return msip_configure_dke_cache(",".join(base_urls).encode(), public_key_ttl_seconds, unwrap_ttl_seconds, capacity)
+
+def ext_clear_dke_cache() -> int:
+    return msip_clear_dke_cache()
+
+def ext_get_http_replay_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_http_replay_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+def ext_set_client_secret(client_secret: str) -> int:
+    return msip_set_client_secret(client_secret.encode())
+
+def ext_shutdown() -> int:
+    return msip_shutdown()
+
+_CACHE_LAYERS = {'licenses': 0, 'engines': 1, 'contexts': 2}
+
+def ext_drop_caches(layer: str) -> int:
+    # Drops cached licenses, engines too, or contexts too, so benchmarks measure each operation from a known
+    # cold layer. Unknown layers are refused with 1
+    if layer not in _CACHE_LAYERS:
+        return 1
+    return msip_drop_caches(_CACHE_LAYERS[layer])
+
+def ext_drain(timeout_ms: int, flush_ms: int) -> dict:
+    # Shutdown for SIGTERM: new calls are turned away, work in flight gets timeout_ms to finish and the
+    # audit, telemetry and log queues flush_ms to empty before every context is shut down
+    ret_val, result_buffer = _call_with_result(msip_drain, max(int(timeout_ms), 0), max(int(flush_ms), 0))
+    return _parse_result(result_buffer, '')
+
+def ext_fork(timeout_ms: int = 5000) -> int:
+    # os.fork() with the native library's threads stopped around it, so the child shares the warmed contexts,
+    # engines and caches copy-on-write. Waits up to timeout_ms for native work in flight; raises RuntimeError
+    # when it does not finish. Returns os.fork()'s pid.
+    ret_val, result_buffer = _call_with_result(msip_prepare_fork, max(int(timeout_ms), 0))
+    if ret_val != 0:
+        raise RuntimeError(_parse_result(result_buffer, '').get('error', 'Cannot prepare the native library for fork'))
+    try:
+        pid = os.fork()
+    finally:
+        msip_resume_after_fork()
+    if pid == 0 and _worker is not None:
+        # This thread's daemon connection belongs to the parent
+        _worker._reset()
+    return pid
+
+def ext_set_engine_cache_size(max_engines: int) -> int:
+    return msip_set_engine_cache_size(max_engines)
+
+def ext_set_policy_refresh(ttl_seconds: int) -> int:
+    # Stale policy engines are replaced in the background; 0 turns refreshing off
+    return msip_set_policy_refresh(ttl_seconds)
+
+def ext_set_engine_idle_timeout(idle_seconds: int) -> int:
+    # Engines unused that long are unloaded and later restored from the profile storage; 0 keeps them loaded
+    return msip_set_engine_idle_timeout(idle_seconds)
+
+def ext_set_template_refresh(refresh_seconds: int) -> int:
+    # Age of a template catalogue before it is refreshed in the background; label rights are reused as long
+    return msip_set_template_refresh(refresh_seconds)
+
+def ext_set_policy_engine_cache_size(max_policy_engines: int) -> int:
+    return msip_set_policy_engine_cache_size(max_policy_engines)
+
+def ext_get_engine_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_engine_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_configure_inspection_cache(capacity: int, ttl_seconds: int = 0, verify_content: bool = False) -> int:
+    return msip_configure_inspection_cache(capacity, ttl_seconds, 1 if verify_content else 0)
+
+def ext_configure_known_clean(capacity: int, false_positive_rate: float = 0.01, max_age_seconds: int = 86400,
+                              verify_one_in: int = 1000, path: str = "") -> int:
+    # Skips the status probe of content already found clean, keyed by cheap hashes; capacity 0 disables it
+    return msip_configure_known_clean(max(int(capacity), 0), float(false_positive_rate), int(max_age_seconds),
+                                      max(int(verify_one_in), 0), path.encode())
+
+def ext_get_inspection_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_inspection_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_set_protection_cache_size(max_entries: int) -> int:
+    return msip_set_protection_cache_size(max_entries)
+
+def ext_get_protection_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_protection_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_set_license_info_cache_size(max_entries: int) -> int:
+    return msip_set_license_info_cache_size(max_entries)
+
+def ext_get_license_info_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_license_info_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_set_use_license_cache_size(max_entries: int) -> int:
+    return msip_set_use_license_cache_size(max_entries)
+
+def ext_get_use_license_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_use_license_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_configure_rights_cache(capacity: int, ttl_seconds: int) -> int:
+    return msip_configure_rights_cache(capacity, ttl_seconds)
+
+def ext_configure_decrypted_content_cache(capacity_bytes: int, max_entry_bytes: int = 0) -> int:
+    # 0 bytes disables the cache; a max_entry_bytes of 0 caches files up to an eighth of the capacity
+    return msip_configure_decrypted_content_cache(capacity_bytes, max_entry_bytes)
+
+def ext_clear_decrypted_content_cache() -> int:
+    return msip_clear_decrypted_content_cache()
+
+def ext_configure_container_cache(capacity: int, ttl_ms: int = 30000, max_bytes_per_file: int = 0) -> int:
+    # capacity is in files, 0 disables the cache; a max_bytes_per_file of 0 records up to 256 KiB of each
+    return msip_configure_container_cache(capacity, ttl_ms, max_bytes_per_file)
+
+def ext_clear_container_cache() -> int:
+    return msip_clear_container_cache()
+
+def ext_configure_delegation_license_cache(capacity: int, ttl_seconds: int) -> int:
+    return msip_configure_delegation_license_cache(capacity, ttl_seconds)
+
+def ext_configure_tenant_cache(capacity: int, ttl_seconds: int) -> int:
+    return msip_configure_tenant_cache(capacity, ttl_seconds)
+
+# mip::DataBoundary values by the names MSIP_DATA_BOUNDARY and MSIP_TENANT_REGIONS accept
+DATA_BOUNDARIES = {"": 0, "default": 0, "us": 1, "eu": 2, "germany": 3, "japan": 4, "australia": 5}
+
+def ext_configure_region(application_id: str, data_boundary: str, dns_redirection: bool = True) -> int:
+    # Region of one application's engines and profiles, or of every application without its own when
+    # application_id is empty. 1 for an unknown data boundary
+    boundary = DATA_BOUNDARIES.get(data_boundary.lower())
+    if boundary is None:
+        return 1
+    return msip_configure_region(application_id.encode(), boundary, 1 if dns_redirection else 0)
+
+def ext_configure_delegated_identity(application_id: str, service_identity: str) -> int:
+    # One engine per application, loaded as service_identity and acting for each operation's user. An empty
+    # service_identity returns to one engine per user
+    return msip_configure_delegated_identity(application_id.encode(), service_identity.encode())
+
+def ext_get_tenant_cache_stats() -> dict:
+    result_buffer = ctypes.create_string_buffer(1024)
+    msip_get_tenant_cache_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+def ext_get_delegation_license_cache_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_delegation_license_cache_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_get_task_dispatcher_stats() -> dict:
+    # Create buffer for result
+    result_buffer = ctypes.create_string_buffer(8192)
+
+    # Call the function
+    msip_get_task_dispatcher_stats(result_buffer)
+    # Parse the JSON result
+    try:
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_get_metrics() -> dict:
+    # "phases" maps each phase, and "http" each host, to count, sum (seconds) and cumulative buckets matching "bounds".
+    # "locks" maps each native lock to its contended count and "wait" and "hold" histograms on "lock_bounds"
+    ret_val, result_buffer = _call_with_result(msip_get_metrics)
+    return _parse_result(result_buffer, "")
+
+def ext_render_metrics() -> str:
+    # Every native counter, gauge and histogram in Prometheus text format
+    ret_val, result_buffer = _call_with_result(msip_render_metrics)
+    return result_buffer.value.decode('utf-8')
+
+def ext_render_counters() -> str:
+    # ext_render_metrics without the latency histograms, which ext_get_metrics returns
+    ret_val, result_buffer = _call_with_result(msip_render_counters)
+    return result_buffer.value.decode('utf-8')
+
+def ext_configure_lock_metrics(sample_every: int) -> int:
+    # Times one in sample_every acquisitions of each native lock, 1 for all of them and 0 for none
+    if sample_every < 0:
+        return 1
+    return msip_configure_lock_metrics(int(sample_every))
+
+def ext_set_trace_context(traceparent: str) -> int:
+    # SDK HTTP calls made by this thread (and the SDK work it starts) belong to this W3C traceparent; '' clears it
+    return msip_set_trace_context(traceparent.encode())
+
+def ext_set_deadline(timeout_ms: int) -> int:
+    # Engine loads and file handler creation this thread starts are cancelled after timeout_ms; 0 clears it
+    _worker_deadline.timeout_ms = max(int(timeout_ms), 0)
+    return msip_set_deadline(max(int(timeout_ms), 0))
+
+def ext_set_idempotency_key(key: str) -> int:
+    # The next protect, unprotect or other admitted call this thread makes runs once per key and paths: a retry
+    # waits for or returns the first call's result. '' clears it
+    return msip_set_idempotency_key((key or '').encode())
+
+def ext_configure_idempotency(capacity: int, ttl_seconds: int = 600) -> int:
+    # Keeps the results of up to capacity keyed calls for ttl_seconds; 0 capacity ignores the keys
+    return msip_configure_idempotency(max(int(capacity), 0), int(ttl_seconds))
+
+PRIORITIES = {'interactive': 0, 'bulk': 1}
+
+def ext_set_priority(priority: str) -> int:
+    # Native work this thread starts runs in the 'interactive' or 'bulk' lane; bulk only runs on unreserved workers
+    if priority not in PRIORITIES:
+        raise ValueError(f"Unknown priority {priority!r}, expected one of {sorted(PRIORITIES)}")
+    return msip_set_priority(PRIORITIES[priority])
+
+def ext_stream_batch_results(fd: int, flush_bytes: int = 0, flush_ms: int = 0) -> int:
+    # Batches this thread runs next write {"index", "result"} lines to fd as files finish and return a summary
+    # dict instead of their results; fd -1 goes back to results. 0 keeps the default flush size and interval.
+    return msip_stream_batch_results(int(fd), MSIP_BATCH_LINES_CALLBACK(), None, max(int(flush_bytes), 0), int(flush_ms))
+
+def ext_start_cpu_profile(hz: int = 99, max_samples: int = 100000) -> int:
+    # Samples every thread's stack hz times per CPU second until ext_stop_cpu_profile, keeping max_samples
+    return msip_start_cpu_profile(int(hz), int(max_samples))
+
+def ext_stop_cpu_profile(output_path: str) -> dict:
+    # Writes the running profile to output_path as gzipped pprof; "samples", "dropped" and "duration_ms" describe it
+    ret_val, result_buffer = _call_with_result(msip_stop_cpu_profile, output_path.encode())
+    return _parse_result(result_buffer, output_path)
+
+def ext_enable_cpu_profile_signal(signum: int, hz: int, seconds: int, directory: str) -> int:
+    # signum starts a profile of at most seconds, written to directory/cpu-<pid>-<unix time>.pb.gz; a second signal ends it early
+    return msip_enable_cpu_profile_signal(int(signum), int(hz), int(seconds), directory.encode())
+
+def ext_configure_slow_operations(threshold_ms: int, buffer_size: int) -> int:
+    # Keeps the buffer_size latest protect and unprotect operations taking threshold_ms or longer, each also logged as a warning; 0 disables
+    return msip_configure_slow_operations(int(threshold_ms), int(buffer_size))
+
+def ext_configure_format_gate(check_content: bool, max_input_bytes: int = 0) -> int:
+    # Rejects files over max_input_bytes (0 for no limit) and, with check_content, Office, PDF and message files whose bytes say otherwise
+    return msip_configure_format_gate(int(check_content), int(max_input_bytes))
+
+def ext_configure_operation_budget(cpu_ms: int, output_bytes: int, quarantine_seconds: int = 600) -> int:
+    # Cancels a file operation past cpu_ms of CPU or output_bytes written (0 for no limit) and quarantines its input for quarantine_seconds
+    return msip_configure_operation_budget(int(cpu_ms), int(output_bytes), int(quarantine_seconds))
+
+def ext_take_slow_operations() -> dict:
+    # "operations" holds the kept slow operations with their phase, HTTP and cache events, removed from the native buffer
+    ret_val, result_buffer = _call_with_result(msip_take_slow_operations)
+    return _parse_result(result_buffer, "")
+
+def ext_start_capture(path: str, sample_every: int = 1, max_records: int = 0) -> int:
+    # Writes the shape of one in sample_every operations to path, without names or content, up to max_records (0 for no limit)
+    return msip_start_capture(path.encode(), max(int(sample_every), 0), max(int(max_records), 0))
+
+def ext_stop_capture() -> dict:
+    # Flushes the capture; "recorded", "sampled_out" and "over_limit" count the operations it saw
+    ret_val, result_buffer = _call_with_result(msip_stop_capture)
+    return _parse_result(result_buffer, "")
+
+def ext_configure_timelines(sample_every: int, buffer_size: int) -> int:
+    # Records one in sample_every protect and unprotect operations (0 for none), keeping buffer_size timelines
+    return msip_configure_timelines(int(sample_every), int(buffer_size))
+
+def ext_request_timelines(count: int = 1) -> int:
+    # Records the next count operations whatever the sampling
+    return msip_request_timelines(int(count))
+
+def ext_take_timelines() -> dict:
+    # "timelines" holds Chrome trace objects, each loadable in chrome://tracing or ui.perfetto.dev once saved as JSON
+    ret_val, result_buffer = _call_with_result(msip_take_timelines)
+    return _parse_result(result_buffer, "")
+
+def ext_configure_tracing(buffer_size: int) -> int:
+    # Finished spans kept until drained; 0 stops recording
+    return msip_configure_tracing(buffer_size)
+
+def ext_take_spans(max_count: int = 1024) -> dict:
+    # "spans" holds the oldest finished HTTP spans, removed from the native buffer
+    ret_val, result_buffer = _call_with_result(msip_take_spans, max_count)
+    return _parse_result(result_buffer, "")
+
+
+def ext_get_file_status(data: FileData) -> dict:
+    if data.shm_input:
+        return _call_with_segments(ext_get_shared_memory_status, data, with_output=False)
+    if _worker:
+        return _call_worker('getFileStatus_v2', data.file, data.file, data.application_id)
+    if _native:
+        return _call_native(_native.get_file_status, data.file, data.file, data.application_id)[0]
+
+    # Call the function
+    ret_val, result_buffer = _call_with_result(get_file_status, data.file.encode(), data.application_id.encode())
+    # Parse the JSON result
+    try:
+        # Decode the bytes to string, then parse as JSON
+        json_str = result_buffer.value.decode('utf-8')
+        return json.loads(json_str)
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "path": data.file,
+            "status": False,
+            "error": str(e),
+            "raw": result_buffer.value
+        }
+
+def ext_get_archive_status(data: FileData) -> dict:
+    # The status of each member of the ZIP or tar archive data.file, probed without extracting it, under
+    # "results" with the archive's format and protected, labeled and failed member counts
+    ret_val, result_buffer = _call_with_result(get_archive_status, data.file.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_get_buffer_status(data: FileData, content) -> dict:
+    # Like ext_get_file_status over bytes-like content instead of a file; data.file only names it
+    if _native:
+        return _call_native(_native.get_buffer_status, data.file, content, data.file, data.application_id)[0]
+    input_data, input_size = _input_buffer(content)
+    ret_val, result_buffer = _call_with_result(
+        get_buffer_status, input_data, input_size, data.file.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_get_shared_memory_status(data: FileData, input_fd: int) -> dict:
+    # Like ext_get_file_status over the content of a shared-memory segment; data.file only names it
+    if _worker:
+        return _call_worker('getSharedMemoryStatus', data.file, data.file, data.application_id, fds=[input_fd])
+    ret_val, result_buffer = _call_with_result(
+        get_shared_memory_status, input_fd, data.file.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_get_object_status(data: FileData) -> dict:
+    # Like ext_get_file_status for an object: data.file is an s3:// URI, an Azure blob URL with its SAS token
+    # or another https URL answering range requests
+    ret_val, result_buffer = _call_with_result(get_object_status, data.file.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_inspect_license(data: FileData) -> dict:
+    # Owner, content id and template of a protected file, without contacting the service
+    if _worker:
+        return _call_worker('inspectLicense', data.file, data.file, data.application_id)
+    if _native:
+        return _call_native(_native.inspect_license, data.file, data.file, data.application_id)[0]
+    ret_val, result_buffer = _call_with_result(inspect_license, data.file.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_read_label(data: FileData, scc_token: str = "", user: str = "") -> dict:
+    # "label_id" and "assignment_method" read offline; with scc_token, "name" comes from the user's policy
+    ret_val, result_buffer = _call_with_result(
+        read_label, scc_token.encode(), data.file.encode(), user.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_describe_file(data: UnprotectFileData, user: str = "") -> dict:
+    # "label" and "protection" of the file, rights and expiry included, each None when the file has none
+    ret_val, result_buffer = _call_with_result(
+        describe_file, data.scc_token.encode(), data.file.encode(), user.encode(), data.application_id.encode())
+    return _parse_result(result_buffer, data.file)
+
+def ext_inspect_msg(data: UnprotectFileData, max_depth: int = 3) -> dict:
+    # "message" is a tree of attachments with name, size, protected and, for nested messages, attachments
+    ret_val, result_buffer = _call_with_result(
+        inspect_msg,
+        data.scc_token.encode(),
+        data.file.encode(),
+        max_depth,
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_unprotect_file(data: UnprotectFileData) -> dict:
+    if data.shm_input:
+        return _call_with_segments(ext_unprotect_shared_memory, data)
+    if _worker:
+        return _call_worker('unprotectFile_v2', data.file, data.scc_token, data.file, data.application_id)
+    if _native:
+        result = _call_native(_native.unprotect_file, data.file, data.scc_token, data.file, data.application_id)[0]
+        logger.info(f"ext_unprotect_file result: {result}")
+        return result
+
+    # Call the function
+    ret_val, result_buffer = _call_with_result(
+        unprotect_file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode()
+    )
+
+    # Print return code
+    logger.info(f"ext_unprotect_file Return code: {ret_val}, result: {result_buffer.value.decode('utf-8')}")
+
     # Parse the JSON result
     try:
         # Decode the bytes to string, then parse as JSON
@@ -46,26 +1894,484 @@ def ext_get_file_status(data: FileData) -> dict:
             "raw": result_buffer.value
         }
 
-def ext_unprotect_file(data: UnprotectFileData) -> dict:
-    # Create buffer for result
+def ext_unprotect_file_to_fd(data: UnprotectFileData, fd: int) -> dict:
+    # Streams the unprotected content into fd (file, pipe or socket); no "_modified" copy is written
+    ret_val, result_buffer = _call_with_result(
+        unprotect_file_to_fd,
+        data.scc_token.encode(),
+        data.file.encode(),
+        fd,
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_unprotect_file_to_path(data: UnprotectFileData, output_path: str = "", replace_input: bool = False) -> dict:
+    # Commits into output_path, a file or a directory that receives the input's name, through a temporary file
+    # renamed into place; replace_input writes over data.file instead. "path" is where the output ended up
+    ret_val, result_buffer = _call_with_result(
+        unprotect_file_to,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode(),
+        output_path.encode(),
+        MSIP_OUTPUT_REPLACE_INPUT if replace_input else 0
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_unprotect_file_to_bytes(data: UnprotectFileData) -> tuple:
+    # Returns (result, unprotected content) without writing a "_modified" copy
+    if _native:
+        return _call_native(_native.unprotect_file_to_bytes, data.file, data.scc_token, data.file, data.application_id)
+    ret_val, result_buffer, output = _call_with_output(
+        unprotect_file_to_buffer,
+        data.file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file), output
+
+def ext_unprotect_buffer(data: UnprotectFileData, content) -> tuple:
+    # Like ext_unprotect_file_to_bytes over bytes-like content instead of a file; data.file only names it
+    if _native:
+        return _call_native(_native.unprotect_buffer, data.file, data.scc_token, content, data.file, data.application_id)
+    input_data, input_size = _input_buffer(content)
+    ret_val, result_buffer, output = _call_with_sized_output(
+        unprotect_buffer_to_buffer,
+        input_size,
+        data.scc_token.encode(),
+        input_data,
+        input_size,
+        data.file.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file), output
+
+def ext_unprotect_shared_memory(data: UnprotectFileData, input_fd: int, output_fd: int) -> dict:
+    # The output segment is emptied and receives the unprotected content; "bytes" is its new size
+    if _worker:
+        return _call_worker('unprotectSharedMemory', data.file, data.scc_token, data.file, data.application_id,
+                            fds=[input_fd, output_fd])
+    ret_val, result_buffer = _call_with_result(
+        unprotect_shared_memory,
+        data.scc_token.encode(),
+        input_fd,
+        data.file.encode(),
+        data.application_id.encode(),
+        output_fd
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_unprotect_object(data: UnprotectFileData, destination: str) -> dict:
+    # Reads the object data.file with range requests and uploads the unprotected content to destination in
+    # parts; "path" is destination, where nothing appears unless the call succeeds
+    ret_val, result_buffer = _call_with_result(
+        unprotect_object,
+        data.scc_token.encode(),
+        data.file.encode(),
+        destination.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_open_decrypted(data: UnprotectFileData) -> dict:
+    # "handle" is read with ext_read_stream and must be released with ext_close_stream
+    ret_val, result_buffer = _call_with_result(
+        open_decrypted,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_extract_text(data: UnprotectFileData, on_text, mode: str = 'text', max_bytes: int = 0) -> dict:
+    # Hands the text of data.file, decrypted in memory, to on_text(bytes) a part at a time for indexing; on_text
+    # returns False to stop. mode "plaintext" hands over the decrypted bytes instead, for an extractor of the
+    # caller's such as one for PDF. An exception raised by on_text stops the extraction and is raised here
+    errors = []
+
+    def deliver(pointer, size, user_data):
+        try:
+            return 1 if on_text(ctypes.string_at(pointer, size)) is False else 0
+        except Exception as ex:
+            errors.append(ex)
+            return 1
+
+    # Kept referenced until the call returns, as the library calls it from this thread
+    callback = MSIP_TEXT_CALLBACK(deliver)
+    ret_val, result_buffer = _call_with_result(
+        extract_text,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode(),
+        mode.encode(),
+        max(int(max_bytes), 0),
+        callback,
+        None
+    )
+    if errors:
+        raise errors[0]
+    return _parse_result(result_buffer, data.file)
+
+def ext_read_stream(handle: int, size: int) -> bytes:
+    buffer = ctypes.create_string_buffer(size)
+    read = msip_read(handle, buffer, size)
+    if read < 0:
+        raise IOError(f"Failed to read stream handle {handle}")
+    return buffer.raw[:read]
+
+def ext_close_stream(handle: int) -> int:
+    return msip_close(handle)
+
+# Chunk size of ext_iter_stream, large enough to keep per-call overhead small against the copy
+STREAM_CHUNK_SIZE = 1024 * 1024
+
+class MsipStream(io.RawIOBase):
+    """Read-only file object over a library stream handle, closed with the object"""
+
+    def __init__(self, handle: int):
+        super().__init__()
+        self.handle = handle
+
+    def readable(self) -> bool:
+        return True
+
+    def readinto(self, b) -> int:
+        view = memoryview(b).cast('B')
+        if not view.nbytes:
+            return 0
+        read = msip_read(self.handle, (ctypes.c_char * view.nbytes).from_buffer(view), view.nbytes)
+        if read < 0:
+            raise IOError(f"Failed to read stream handle {self.handle}")
+        return read
+
+    def close(self):
+        if not self.closed:
+            msip_close(self.handle)
+        super().close()
+
+def ext_open_stream(path: str) -> MsipStream:
+    # Any file, e.g. the output of a protect, without reopening it in Python
+    handle = ctypes.c_uint64(0)
+    if msip_open(path.encode(), ctypes.byref(handle)) != 0:
+        raise IOError(f"Failed to open {path}")
+    return MsipStream(handle.value)
+
+def ext_open_decrypted_stream(data: UnprotectFileData) -> MsipStream:
+    result = ext_open_decrypted(data)
+    if not result.get("status"):
+        raise IOError(result.get("error") or f"Failed to decrypt {data.file}")
+    return MsipStream(result["handle"])
+
+def ext_iter_stream(stream: MsipStream, chunk_size: int = STREAM_CHUNK_SIZE):
+    # Yields views into one preallocated buffer; each view is only valid until the next chunk is read
+    buffer = bytearray(chunk_size)
+    view = memoryview(buffer)
+    while True:
+        read = stream.readinto(buffer)
+        if not read:
+            return
+        yield view[:read]
+
+def ext_open_file_session(data: UnprotectFileData) -> dict:
+    # "session" is passed to the ext_*_file_session calls and released by ext_close_file_session
+    ret_val, result_buffer = _call_with_result(
+        open_file_session,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_get_file_session_status(session: int) -> dict:
+    ret_val, result_buffer = _call_with_result(get_file_session_status, session)
+    return _parse_result(result_buffer, "")
+
+def ext_get_file_session_label(session: int) -> dict:
+    ret_val, result_buffer = _call_with_result(get_file_session_label, session)
+    return _parse_result(result_buffer, "")
+
+def ext_check_file_session_rights(session: int) -> dict:
+    ret_val, result_buffer = _call_with_result(check_file_session_rights, session)
+    return _parse_result(result_buffer, "")
+
+def ext_unprotect_file_session(session: int) -> dict:
+    # Commits the unprotection like ext_unprotect_file; the session is closed afterwards
+    ret_val, result_buffer = _call_with_result(unprotect_file_session, session)
+    return _parse_result(result_buffer, "")
+
+def ext_close_file_session(session: int) -> int:
+    return close_file_session(session)
+
+def ext_set_file_session_idle_timeout(idle_seconds: int) -> int:
+    return msip_set_file_session_idle_timeout(idle_seconds)
+
+def ext_configure_admission(max_in_flight: int = 0, memory_budget_bytes: int = 0) -> int:
+    # 0 leaves a limit unbounded; operations over a limit raise ResourceExhaustedError
+    if max_in_flight < 0:
+        return 1
+    return msip_configure_admission(max_in_flight, memory_budget_bytes)
+
+def ext_configure_adaptive_admission(enabled: bool = True, initial_limit: int = 16, min_limit: int = 1,
+                                     max_limit: int = 256, tolerance: float = 1.5, window: int = 1000) -> int:
+    # Each operation type's in-flight limit follows its latency: it grows while latency stays within
+    # tolerance times the latency the type's last probe measured and shrinks beyond
+    if min(initial_limit, min_limit, max_limit, window) < 0:
+        return 1
+    return msip_configure_adaptive_admission(1 if enabled else 0, initial_limit, min_limit, max_limit,
+                                             float(tolerance), window)
+
+def ext_configure_buffer_pool(max_retained_bytes: int) -> int:
+    # 0 frees input and output buffers as soon as they are released
+    if max_retained_bytes < 0:
+        return 1
+    return msip_configure_buffer_pool(max_retained_bytes)
+
+def ext_get_buffer_pool_stats() -> dict:
+    result_buffer = ctypes.create_string_buffer(1024)
+    msip_get_buffer_pool_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+def ext_configure_temp_files(directory: str, pool_size: int = 16, max_file_bytes: int = 0, fallback_directory: str = "") -> int:
+    # Decrypted temporaries in directory, e.g. a tmpfs, with pool_size files kept open for reuse; larger
+    # than max_file_bytes (0 for no limit) they go to fallback_directory. An empty directory turns it off
+    if pool_size < 0 or max_file_bytes < 0:
+        return 1
+    return msip_configure_temp_files(directory.encode(), pool_size, max_file_bytes, fallback_directory.encode())
+
+def ext_get_temp_file_stats() -> dict:
+    result_buffer = ctypes.create_string_buffer(1024)
+    msip_get_temp_file_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+# Budgets msipAutoTune may size from the cgroup's limits
+AUTO_TUNE_PARTS = {'engine_cache': 1, 'license_caches': 2, 'buffer_pool': 4, 'admission_budget': 8}
+
+def ext_auto_tune(parts: list, watch_pressure: bool = True) -> dict:
+    # Sizes the named budgets from the cgroup's CPU and memory limits and, with watch_pressure, shrinks them
+    # while the cgroup reports memory pressure. "status" is False when memory.pressure cannot be watched.
+    unknown = [part for part in parts if part not in AUTO_TUNE_PARTS]
+    if unknown:
+        raise ValueError(f"Unknown auto-tune parts {unknown}, expected some of {sorted(AUTO_TUNE_PARTS)}")
+    mask = sum(AUTO_TUNE_PARTS[part] for part in set(parts))
+    ret_val, result_buffer = _call_with_result(msip_auto_tune, mask, 1 if watch_pressure else 0)
+    return _parse_result(result_buffer, '')
+
+def ext_get_resource_tuner_stats() -> dict:
+    ret_val, result_buffer = _call_with_result(msip_get_resource_tuner_stats)
+    return _parse_result(result_buffer, '')
+
+def ext_get_startup_stats() -> dict:
+    # Splits loading the library at its first constructor: dynamic linking and the SDK libraries'
+    # initializers before it, the glue's static initialization after. Context creation is reported by
+    # ext_get_metrics as the context_create phase
+    result_buffer = ctypes.create_string_buffer(256)
+    msip_get_startup_stats(result_buffer)
+    stats = _parse_result(result_buffer, "")
+    constructor_ns = stats.get("constructor_time_ns", 0)
+    stats["load_ms"] = (_load_finished_ns - _load_started_ns) / 1e6
+    if constructor_ns:
+        stats["dynamic_link_ms"] = (constructor_ns - _load_started_ns) / 1e6
+        stats["static_init_ms"] = (_load_finished_ns - constructor_ns) / 1e6
+    return stats
+
+def ext_get_allocator_stats() -> dict:
+    # Heap totals of the allocator the library was built with, plus one entry per arena
+    ret_val, result_buffer = _call_with_result(msip_get_allocator_stats)
+    return _parse_result(result_buffer, "")
+
+def ext_configure_cost_accounting(enabled: bool = True) -> int:
+    # Charges each tenant's operations, per type, for their CPU time, bytes, HTTP requests and cache lookups
+    return msip_configure_cost_accounting(1 if enabled else 0)
+
+def ext_get_costs() -> dict:
+    # "operations" holds each tenant's costs per operation type, "hosts" its HTTP requests per host
+    ret_val, result_buffer = _call_with_result(msip_get_costs)
+    return _parse_result(result_buffer, "")
+
+def ext_get_admission_stats() -> dict:
+    # "operations" holds each operation type's in-flight count, adaptive limit and latencies
+    result_buffer = ctypes.create_string_buffer(4096)
+    msip_get_admission_stats(result_buffer)
+    return _parse_result(result_buffer, "")
+
+def ext_get_affinity_key(application_id: str, username: str = "") -> dict:
+    # "key" is what a router consistent-hashes the request on, so one pod keeps the engine warm
+    ret_val, result_buffer = _call_with_result(msip_get_affinity_key, application_id.encode(), username.encode())
+    return _parse_result(result_buffer, "")
+
+def ext_get_warm_tenants() -> dict:
+    # The tenants with engines or licenses on this pod
+    ret_val, result_buffer = _call_with_result(msip_get_warm_tenants)
+    return _parse_result(result_buffer, "")
+
+def ext_health() -> dict:
+    # Readiness and liveness state read from atomics only: warm-up, engines and cache fill, dispatcher
+    # queue depth, operations in flight and recent outcomes
+    ret_val, result_buffer = _call_with_result(msip_health)
+    return _parse_result(result_buffer, "")
+
+def ext_configure_tenant_quotas(max_engines: int = 0, max_licenses: int = 0, max_in_flight: int = 0) -> int:
+    # Per application id; 0 leaves a quota unbounded
+    if min(max_engines, max_licenses, max_in_flight) < 0:
+        return 1
+    return msip_configure_tenant_quotas(max_engines, max_licenses, max_in_flight)
+
+def ext_set_tenant_weight(application_id: str, weight: int) -> int:
+    # The application's share of the native task workers relative to tenants left at 1
+    return msip_set_tenant_weight(application_id.encode(), weight)
+
+def ext_configure_priorities(reserved_workers: int = -1, max_bulk_in_flight: int = 0) -> int:
+    # reserved_workers task workers only run interactive work (-1 keeps a quarter of them); max_bulk_in_flight
+    # caps admitted bulk operations, 0 for no limit beyond MSIP_MAX_IN_FLIGHT
+    return msip_configure_priorities(int(reserved_workers), max(int(max_bulk_in_flight), 0))
+
+def ext_get_file_session_stats() -> dict:
     result_buffer = ctypes.create_string_buffer(8192)
+    msip_get_file_session_stats(result_buffer)
+    return _parse_result(result_buffer, "")
 
-    # Call the function
-    ret_val = unprotect_file(
+def ext_protect_file_to_fd(data: ProtectFileData, fd: int) -> dict:
+    ret_val, result_buffer = _call_with_result(
+        protect_file_to_fd,
         data.scc_token.encode(),
         data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
         data.application_id.encode(),
-        result_buffer
+        fd
     )
+    return _parse_result(result_buffer, data.file)
 
-    # Print return code
-    logger.info(f"ext_unprotect_file Return code: {ret_val}, result: {result_buffer.value.decode('utf-8')}")
+def ext_protect_file_to_path(data: ProtectFileData, output_path: str = "", replace_input: bool = False) -> dict:
+    # Like ext_unprotect_file_to_path, for protect
+    ret_val, result_buffer = _call_with_result(
+        protect_file_to,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode(),
+        output_path.encode(),
+        MSIP_OUTPUT_REPLACE_INPUT if replace_input else 0
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_protect_file_to_bytes(data: ProtectFileData) -> tuple:
+    # Returns (result, protected content) without writing a "_modified" copy
+    if _native:
+        return _call_native(_native.protect_file_to_bytes, data.file, data.scc_token, data.file, data.encrypted_file,
+                            data.user, data.application_id)
+    ret_val, result_buffer, output = _call_with_output(
+        protect_file_to_buffer,
+        data.file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file), output
+
+def ext_protect_buffer(data: ProtectFileData, content) -> tuple:
+    # Like ext_protect_file_to_bytes over bytes-like content instead of a file; data.file only names it
+    if _native:
+        return _call_native(_native.protect_buffer, data.file, data.scc_token, content, data.file, data.encrypted_file,
+                            data.user, data.application_id)
+    input_data, input_size = _input_buffer(content)
+    ret_val, result_buffer, output = _call_with_sized_output(
+        protect_buffer_to_buffer,
+        input_size,
+        data.scc_token.encode(),
+        input_data,
+        input_size,
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file), output
+
+def ext_protect_shared_memory(data: ProtectFileData, input_fd: int, output_fd: int) -> dict:
+    # The output segment is emptied and receives the protected content; "bytes" is its new size
+    if _worker:
+        return _call_worker('protectSharedMemory', data.file, data.scc_token, data.file, data.encrypted_file, data.user,
+                            data.application_id, fds=[input_fd, output_fd])
+    ret_val, result_buffer = _call_with_result(
+        protect_shared_memory,
+        data.scc_token.encode(),
+        input_fd,
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode(),
+        output_fd
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_protect_object(data: ProtectFileData, destination: str) -> dict:
+    # Like ext_unprotect_object, uploading the content protected like data.encrypted_file
+    ret_val, result_buffer = _call_with_result(
+        protect_object,
+        data.scc_token.encode(),
+        data.file.encode(),
+        destination.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_protect_file_detached(data: ProtectFileData, output_path: str = "", license_path: str = "") -> dict:
+    # Raw ciphertext plus a separate publishing license, encrypted in parallel for large files
+    ret_val, result_buffer = _call_with_result(
+        protect_file_detached,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode(),
+        output_path.encode(),
+        license_path.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_unprotect_file_detached(data: UnprotectFileData, license_path: str = "", output_path: str = "") -> dict:
+    # Decrypts what ext_protect_file_detached wrote, in parallel segments like its encryption
+    ret_val, result_buffer = _call_with_result(
+        unprotect_file_detached,
+        data.scc_token.encode(),
+        data.file.encode(),
+        license_path.encode(),
+        data.application_id.encode(),
+        output_path.encode()
+    )
+    return _parse_result(result_buffer, data.file)
 
+def ext_protect_file(data: ProtectFileData) -> dict:
+    if data.shm_input:
+        return _call_with_segments(ext_protect_shared_memory, data)
+    if _worker:
+        return _call_worker('protectFile_v2', data.file, data.scc_token, data.file, data.encrypted_file, data.user,
+                            data.application_id)
+    if _native:
+        return _call_native(_native.protect_file, data.file, data.scc_token, data.file, data.encrypted_file, data.user,
+                            data.application_id)[0]
+
+    # Call the function
+    ret_val, result_buffer = _call_with_result(
+        protect_file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode()
+    )
     # Parse the JSON result
     try:
         # Decode the bytes to string, then parse as JSON
         json_str = result_buffer.value.decode('utf-8')
-        return json.loads(json_str)
+        return json.loads(json_str)       
     except json.JSONDecodeError as e:
         logger.exception("Failed to parse response: %s", e)
         return {
@@ -75,24 +2381,344 @@ def ext_unprotect_file(data: UnprotectFileData) -> dict:
             "raw": result_buffer.value
         }
 
-def ext_protect_file(data: ProtectFileData) -> dict:
-    # Create buffer for result
-    result_buffer = ctypes.create_string_buffer(8192)
 
-    # Call the function
-    protect_file(
+def _encode_paths(files: list):
+    paths = (ctypes.c_char_p * len(files))()
+    paths[:] = [f.encode() for f in files]
+    return paths
+
+def _parse_batch_result(files: list, result_buffer) -> list:
+    try:
+        parsed = json.loads(result_buffer.value.decode('utf-8'))
+    except json.JSONDecodeError as e:
+        logger.exception("Failed to parse batch response: %s", e)
+        return [{"path": f, "status": False, "error": str(e)} for f in files]
+    return _batch_results(files, parsed)
+
+def _batch_results(files: list, parsed) -> list:
+    if isinstance(parsed, dict) and 'streamed' in parsed:
+        # The results went to the stream set with ext_stream_batch_results
+        return parsed
+    if isinstance(parsed, dict):
+        # Shared setup failed: report it against every file
+        return [dict(parsed, path=f) for f in files]
+    return parsed
+
+def ext_scan_tree(root: str, application_id: str, fd: int, filters: str = '') -> dict:
+    # Writes one status per line to fd and returns the walk's counts; filters is e.g. "docx,pdf", "*" for every file
+    ret_val, result_buffer = _call_with_result(scan_tree, root.encode(), filters.encode(), fd, application_id.encode())
+    return _parse_result(result_buffer, root)
+
+def ext_scan_tree_incremental(root: str, application_id: str, fd: int, journal_path: str, filters: str = '') -> dict:
+    # Writes only the files added, modified or removed since the last scan recorded in journal_path
+    ret_val, result_buffer = _call_with_result(
+        scan_tree_incremental, root.encode(), filters.encode(), fd, journal_path.encode(), application_id.encode())
+    return _parse_result(result_buffer, root)
+
+def _iter_scan_lines(run_scan, failure: str = 'Tree scan failed'):
+    # Runs run_scan(fd) on a thread and yields each NDJSON line it writes; closing the generator early stops the walk
+    read_fd, write_fd = os.pipe()
+    summary = {}
+
+    def scan():
+        try:
+            summary.update(run_scan(write_fd))
+        finally:
+            os.close(write_fd)
+
+    worker = threading.Thread(target=scan, daemon=True)
+    worker.start()
+    try:
+        with os.fdopen(read_fd, 'rb') as lines:
+            for line in lines:
+                yield json.loads(line)
+    finally:
+        worker.join()
+    if not summary.get('status', False):
+        raise RuntimeError(summary.get('error') or failure)
+
+def ext_iter_scan_tree(root: str, application_id: str, filters: str = ''):
+    # Yields the status of each file as the native walk finds it
+    return _iter_scan_lines(lambda fd: ext_scan_tree(root, application_id, fd, filters))
+
+def ext_iter_scan_tree_incremental(root: str, application_id: str, journal_path: str, filters: str = ''):
+    # Yields what changed under root since the last scan recorded in journal_path, each with its "change"
+    return _iter_scan_lines(lambda fd: ext_scan_tree_incremental(root, application_id, fd, journal_path, filters))
+
+def ext_iter_batch_results(run_batch):
+    # Runs run_batch(), e.g. lambda: ext_unprotect_file_batch(files, app_id, token), streaming its results, and
+    # yields {"index", "result"} for each file as it finishes, in completion order
+    def streamed(fd):
+        ext_stream_batch_results(fd)
+        try:
+            return run_batch()
+        finally:
+            ext_stream_batch_results(-1)
+
+    return _iter_scan_lines(streamed, 'Batch failed')
+
+def ext_get_file_status_batch(files: list, application_id: str) -> list:
+    if _worker:
+        return _batch_results(files, _call_worker('getFileStatusBatch_v2', '', *files, application_id))
+    if _native:
+        parsed = _call_native(_native.get_file_status_batch, '', files, application_id)[0]
+        return _batch_results(files, parsed)
+    ret_val, result_buffer = _call_with_result(get_file_status_batch, _encode_paths(files), len(files), application_id.encode())
+    return _parse_batch_result(files, result_buffer)
+
+# Layout of getFileStatusBatchBinary results, mirroring sdk_file/msip_file/file/status_records.h
+class _StringRef(ctypes.LittleEndianStructure):
+    _fields_ = [("offset", ctypes.c_uint32), ("length", ctypes.c_uint32)]
+
+class StatusRecordHeader(ctypes.LittleEndianStructure):
+    _fields_ = [
+        ("magic", ctypes.c_char * 4),
+        ("count", ctypes.c_uint32),
+        ("record_size", ctypes.c_uint32),
+        ("strings_offset", ctypes.c_uint32),
+    ]
+
+class StatusRecord(ctypes.LittleEndianStructure):
+    _fields_ = [
+        ("status", ctypes.c_uint8),
+        ("flags", ctypes.c_uint8),
+        ("reserved0", ctypes.c_uint16),
+        ("reserved1", ctypes.c_uint32),
+        ("issued_time", ctypes.c_int64),
+        ("path", _StringRef),
+        ("error", _StringRef),
+        ("label_id", _StringRef),
+        ("owner", _StringRef),
+        ("content_id", _StringRef),
+        ("template_id", _StringRef),
+        ("template_name", _StringRef),
+    ]
+
+class StatusRecords:
+    # Read-only view over a binary status result: records and strings are read in place, and only the
+    # entries actually indexed are turned into the dicts the JSON batch call returns
+    PROTECTED = 1
+    LABELED = 2
+    PROTECTED_OBJECTS = 4
+    LICENSE = 8
+    _LICENSE_FIELDS = ("label_id", "owner", "content_id", "template_id", "template_name")
+
+    def __init__(self, data, size: int):
+        # data is a writable buffer such as a ctypes array or bytearray, holding size bytes of result
+        if size < ctypes.sizeof(StatusRecordHeader):
+            raise ValueError("Truncated status records")
+        self._data = data
+        self._view = memoryview(data).cast('B')[:size]
+        self.header = StatusRecordHeader.from_buffer(data)
+        if self.header.magic != b"MSR1" or self.header.record_size < ctypes.sizeof(StatusRecord):
+            raise ValueError("Unsupported status record format")
+        records_end = ctypes.sizeof(StatusRecordHeader) + self.header.count * self.header.record_size
+        if records_end > self.header.strings_offset or self.header.strings_offset > size:
+            raise ValueError("Truncated status records")
+        self._strings = self._view[self.header.strings_offset:]
+
+    def __len__(self) -> int:
+        return self.header.count
+
+    def record(self, index: int) -> StatusRecord:
+        # The packed record itself, mapped over the result buffer
+        if not 0 <= index < self.header.count:
+            raise IndexError(index)
+        return StatusRecord.from_buffer(self._data, ctypes.sizeof(StatusRecordHeader) + index * self.header.record_size)
+
+    def string(self, ref: _StringRef) -> memoryview:
+        # UTF-8 bytes of a string field, without copying
+        return self._strings[ref.offset:ref.offset + ref.length]
+
+    def text(self, ref: _StringRef) -> str:
+        return str(self.string(ref), 'utf-8')
+
+    def __getitem__(self, index: int) -> dict:
+        if index < 0:
+            index += self.header.count
+        record = self.record(index)
+        item = {"path": self.text(record.path), "status": bool(record.status)}
+        if not record.status:
+            item["error"] = self.text(record.error)
+            return item
+        item["protected"] = bool(record.flags & self.PROTECTED)
+        item["labeled"] = bool(record.flags & self.LABELED)
+        item["protected_objects"] = bool(record.flags & self.PROTECTED_OBJECTS)
+        if record.flags & self.LICENSE:
+            for name in self._LICENSE_FIELDS:
+                item[name] = self.text(getattr(record, name))
+            item["issued_time"] = record.issued_time
+        return item
+
+    def __iter__(self):
+        return (self[i] for i in range(self.header.count))
+
+# Starting guess per file for a binary result buffer, which grows once if the batch needs more
+STATUS_RECORD_BYTES_PER_FILE = 256
+
+def ext_get_file_status_batch_binary(files: list, application_id: str, with_license: bool = False) -> StatusRecords:
+    # With with_license, protected files also carry their owner, content, template and label ids.
+    # Each call gets its own buffer, since the records are read from it after the call returns.
+    result_buffer = ctypes.create_string_buffer(ctypes.sizeof(StatusRecordHeader) + len(files) * STATUS_RECORD_BYTES_PER_FILE)
+    needed = ctypes.c_size_t(0)
+    ret_val = get_file_status_batch_binary(_encode_paths(files), len(files), 1 if with_license else 0,
+                                           application_id.encode(), result_buffer, len(result_buffer), ctypes.byref(needed))
+    if ret_val == MSIP_RESULT_TOO_SMALL:
+        result_buffer = ctypes.create_string_buffer(needed.value)
+        ret_val = msip_take_result(result_buffer, len(result_buffer), ctypes.byref(needed))
+    if needed.value <= 1:
+        raise RuntimeError("Status batch too large for one result; split it")
+    # needed counts the terminator the library appends to every result
+    return StatusRecords(result_buffer, needed.value - 1)
+
+def ext_unprotect_file_batch(files: list, application_id: str, scc_token: str) -> list:
+    ret_val, result_buffer = _call_with_result(
+        unprotect_file_batch,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_prefetch_licenses(files: list, application_id: str, scc_token: str) -> dict:
+    # Returns counts of distinct licenses, already held and newly acquired, plus per-file errors
+    ret_val, result_buffer = _call_with_result(
+        prefetch_licenses,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_plan_batch(files: list, application_id: str) -> dict:
+    # Files and bytes by format, tenant, template and label, the distinct licenses and the license calls to
+    # expect. "license_samples" holds one file per license, for ext_prefetch_licenses
+    ret_val, result_buffer = _call_with_result(
+        plan_batch,
+        _encode_paths(files),
+        len(files),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_register_content_for_tracking(files: list, application_id: str, scc_token: str, notify_owner: bool = False) -> dict:
+    # One entry per file in "results", in order, with its "content_id", "status" and "error"
+    ret_val, result_buffer = _call_with_result(
+        register_content_for_tracking,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        1 if notify_owner else 0,
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_revoke_content(files: list, application_id: str, scc_token: str) -> dict:
+    # One entry per file in "results", in order; "succeeded" and "failed" count them
+    ret_val, result_buffer = _call_with_result(
+        revoke_content,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_create_delegation_licenses(file: str, users: list, application_id: str, scc_token: str) -> dict:
+    ret_val, result_buffer = _call_with_result(
+        create_delegation_licenses,
+        scc_token.encode(),
+        file.encode(),
+        _encode_paths(users),
+        len(users),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, file)
+
+def ext_check_delegated_access(file: str, users: list, right: str, application_id: str, scc_token: str) -> dict:
+    # One result per user with "allowed" and the user's rights; an empty right only lists the rights
+    ret_val, result_buffer = _call_with_result(
+        check_delegated_access,
+        scc_token.encode(),
+        file.encode(),
+        _encode_paths(users),
+        len(users),
+        right.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, file)
+
+def ext_check_rights(file: str, user: str, rights: list, application_id: str, scc_token: str) -> dict:
+    # "allowed" when the user holds every right, with one entry per right in "checks" and the user's full "rights"
+    ret_val, result_buffer = _call_with_result(
+        check_rights,
+        scc_token.encode(),
+        file.encode(),
+        user.encode(),
+        _encode_paths(rights),
+        len(rights),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, file)
+
+def ext_protect_file_batch(files: list, application_id: str, scc_token: str, user: str, encrypted_file: str) -> list:
+    ret_val, result_buffer = _call_with_result(
+        protect_file_batch,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        encrypted_file.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_protect_file_offline(data: ProtectTemplateFileData) -> dict:
+    # Only template_id is used; labels need the policy service and cannot be applied offline
+    ret_val, result_buffer = _call_with_result(
+        protect_file_offline,
         data.scc_token.encode(),
         data.file.encode(),
-        data.encrypted_file.encode(),
+        (data.template_id or "").encode(),
         data.user.encode(),
-        data.application_id.encode(),
-        result_buffer
+        data.application_id.encode()
+    )
+    return _parse_result(result_buffer, data.file)
+
+def ext_prepare_offline_publishing(user: str, application_id: str, scc_token: str) -> dict:
+    ret_val, result_buffer = _call_with_result(
+        prepare_offline_publishing,
+        scc_token.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_get_tenant_information(user: str, application_id: str, scc_token: str) -> dict:
+    # Served from the tenant cache after the first call for a user of the same domain
+    ret_val, result_buffer = _call_with_result(
+        get_tenant_information,
+        scc_token.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_protect_file_with_template(data: ProtectTemplateFileData) -> dict:
+    ret_val, result_buffer = _call_with_result(
+        protect_file_with_template,
+        data.scc_token.encode(),
+        data.file.encode(),
+        (data.template_id or "").encode(),
+        (data.label_id or "").encode(),
+        data.user.encode(),
+        data.application_id.encode()
     )
-    # Parse the JSON result
     try:
-        # Decode the bytes to string, then parse as JSON
         json_str = result_buffer.value.decode('utf-8')
-        return json.loads(json_str)       
+        return json.loads(json_str)
     except json.JSONDecodeError as e:
         logger.exception("Failed to parse response: %s", e)
         return {
@@ -101,3 +2727,280 @@ def ext_protect_file(data: ProtectFileData) -> dict:
             "error": str(e),
             "raw": result_buffer.value
         }
+
+def ext_protect_file_with_template_batch(files: list, application_id: str, scc_token: str, user: str,
+                                         template_id: str | None = None, label_id: str | None = None) -> list:
+    ret_val, result_buffer = _call_with_result(
+        protect_file_with_template_batch,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        (template_id or "").encode(),
+        (label_id or "").encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_protect_files_with_permissions(files: list, application_id: str, scc_token: str, user: str, grants: dict,
+                                       by_roles: bool = False, valid_until: int = 0,
+                                       allow_offline_access: bool = True) -> list:
+    # grants maps each user, or a tuple of users, to its rights (or roles with by_roles). valid_until is in
+    # seconds since the epoch, 0 for content that never expires.
+    encoded = [
+        f"{','.join([users] if isinstance(users, str) else users)}:{','.join(permissions)}"
+        for users, permissions in grants.items()
+    ]
+    ret_val, result_buffer = _call_with_result(
+        protect_files_with_permissions,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        _encode_paths(encoded),
+        len(encoded),
+        int(by_roles),
+        int(valid_until),
+        int(allow_offline_access),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_list_labels(application_id: str, scc_token: str, user: str = "") -> dict:
+    # "labels" in pre-order; each "parent" is the index of its parent in the list, -1 at the top level
+    ret_val, result_buffer = _call_with_result(
+        list_labels,
+        scc_token.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_list_templates(application_id: str, scc_token: str, user: str = "") -> dict:
+    # "templates" with id, name, description and owner_full_access; "age_seconds" of the catalogue they came from
+    ret_val, result_buffer = _call_with_result(
+        list_templates,
+        scc_token.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_get_rights_for_label(label_id: str, owner: str, application_id: str, scc_token: str, user: str = "", delegated_user: str = "") -> dict:
+    # "rights" the label grants; "cached" when the answer was reused
+    ret_val, result_buffer = _call_with_result(
+        get_rights_for_label,
+        scc_token.encode(),
+        label_id.encode(),
+        owner.encode(),
+        delegated_user.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_list_sensitivity_types(application_id: str, scc_token: str, user: str = "") -> dict:
+    ret_val, result_buffer = _call_with_result(
+        list_sensitivity_types,
+        scc_token.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+def ext_classify_files(files: list, application_id: str, scc_token: str, user: str = "") -> list:
+    # One entry per file with the auto-labeling "actions" and the "sensitivity_types" found; nothing is written
+    ret_val, result_buffer = _call_with_result(
+        classify_files,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_get_label(id_or_name: str, application_id: str, scc_token: str, user: str = "") -> dict:
+    # Accepts a label id, a name or a "Parent\Child" path; names ignore case
+    ret_val, result_buffer = _call_with_result(
+        get_label,
+        scc_token.encode(),
+        id_or_name.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+# Label assignment methods accepted by ext_label_files, mapped to mip::AssignmentMethod
+LABEL_ASSIGNMENT_METHODS = {"standard": 0, "privileged": 1, "auto": 2}
+
+def ext_label_files(files: list, label_id: str, application_id: str, scc_token: str, user: str = "",
+                    method: str = "standard", justification: str = "") -> list:
+    # One result per file, in input order; label_id may also be a label name or "Parent\Child" path
+    if method not in LABEL_ASSIGNMENT_METHODS:
+        raise ValueError(f"Unknown label assignment method: {method}")
+    ret_val, result_buffer = _call_with_result(
+        label_files,
+        scc_token.encode(),
+        _encode_paths(files),
+        len(files),
+        label_id.encode(),
+        LABEL_ASSIGNMENT_METHODS[method],
+        justification.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_label_files_by_label(labels: dict, application_id: str, scc_token: str, user: str = "",
+                             method: str = "standard", justification: str = "") -> list:
+    # labels maps each file to its label id, name or path; one result per file, in the dict's order
+    if method not in LABEL_ASSIGNMENT_METHODS:
+        raise ValueError(f"Unknown label assignment method: {method}")
+    files = list(labels)
+    ret_val, result_buffer = _call_with_result(
+        label_files_by_label,
+        scc_token.encode(),
+        _encode_paths(files),
+        _encode_paths([labels[f] for f in files]),
+        len(files),
+        LABEL_ASSIGNMENT_METHODS[method],
+        justification.encode(),
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_batch_result(files, result_buffer)
+
+def ext_compute_label_actions(label_id: str, application_id: str, scc_token: str, prior_label_id: str = "",
+                              content_format: str = "file", user: str = "", method: str = "standard") -> dict:
+    # The actions labeling unprotected content with label_id takes, computed once per combination without a file
+    if method not in LABEL_ASSIGNMENT_METHODS:
+        raise ValueError(f"Unknown label assignment method: {method}")
+    ret_val, result_buffer = _call_with_result(
+        compute_label_actions,
+        scc_token.encode(),
+        label_id.encode(),
+        prior_label_id.encode(),
+        content_format.encode(),
+        LABEL_ASSIGNMENT_METHODS[method],
+        user.encode(),
+        application_id.encode()
+    )
+    return _parse_result(result_buffer, "")
+
+
+# In-flight async calls keyed by the id passed to the library as user_data
+_pending_calls = {}
+_pending_calls_lock = threading.Lock()
+_call_ids = itertools.count(1)
+
+# Records from msipTakeCompletions: call id, status, result length, then the result (native byte order)
+_COMPLETION_HEADER = struct.Struct('=QiI')
+_QUEUE_SHIFT = 48
+_CALL_ID_MASK = (1 << _QUEUE_SHIFT) - 1
+
+# Completion queue of each event loop, or 0 for a loop that falls back to callbacks
+_loop_queues = weakref.WeakKeyDictionary()
+_completion_buffers = {}
+
+
+def _parse_async_result(path: str, raw: bytes) -> dict:
+    try:
+        return json.loads(raw.decode('utf-8'))
+    except (json.JSONDecodeError, AttributeError) as e:
+        logger.exception("Failed to parse response: %s", e)
+        return {
+            "path": path,
+            "status": False,
+            "error": str(e),
+            "raw": raw
+        }
+
+def _resolve_future(future, result: dict):
+    if not future.done():
+        future.set_result(result)
+
+@MSIP_RESULT_CALLBACK
+def _on_async_result(status, result, user_data):
+    # Runs on an SDK thread: hand the parsed result back to the event loop that is awaiting it
+    with _pending_calls_lock:
+        loop, future, path = _pending_calls.pop(user_data)
+    loop.call_soon_threadsafe(_resolve_future, future, _parse_async_result(path, result))
+
+def _close_completion_queue(queue: int):
+    _completion_buffers.pop(queue, None)
+    close_completion_queue(queue)
+
+def _completion_queue(loop) -> int:
+    # Opened on the loop's first async call; a library that cannot open one leaves the loop on callbacks
+    queue = _loop_queues.get(loop)
+    if queue is None:
+        fd = ctypes.c_int(-1)
+        queue = open_completion_queue(ctypes.byref(fd))
+        if queue > 0:
+            _completion_buffers[queue] = ctypes.create_string_buffer(64 * 1024)
+            loop.add_reader(fd.value, _drain_completions, queue)
+            weakref.finalize(loop, _close_completion_queue, queue)
+        _loop_queues[loop] = queue
+    return queue
+
+def _drain_completions(queue: int):
+    # Runs on the loop when the queue's eventfd is readable: resolves every queued call, growing the buffer
+    # when the queued records do not fit
+    written = ctypes.c_size_t(0)
+    remaining = ctypes.c_size_t(0)
+    while True:
+        buffer = _completion_buffers[queue]
+        if take_completions(queue, buffer, len(buffer), ctypes.byref(written), ctypes.byref(remaining)) != 0:
+            return
+        view = memoryview(buffer)
+        offset = 0
+        while offset < written.value:
+            call_id, status, length = _COMPLETION_HEADER.unpack_from(view, offset)
+            offset += _COMPLETION_HEADER.size
+            raw = view[offset:offset + length].tobytes()
+            offset += length
+            with _pending_calls_lock:
+                pending = _pending_calls.pop(call_id, None)
+            if pending is not None:
+                _resolve_future(pending[1], _parse_async_result(pending[2], raw))
+        view.release()
+        if not remaining.value:
+            return
+        if remaining.value > len(buffer):
+            _completion_buffers[queue] = ctypes.create_string_buffer(remaining.value)
+
+async def _await_async_call(func, path: str, *args) -> dict:
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+    call_id = next(_call_ids) & _CALL_ID_MASK
+    with _pending_calls_lock:
+        _pending_calls[call_id] = (loop, future, path)
+    # The callback always fires, even when the call fails to start, so the future always resolves
+    queue = _completion_queue(loop)
+    if queue:
+        func(*args, queue_completion, (queue << _QUEUE_SHIFT) | call_id)
+    else:
+        func(*args, _on_async_result, call_id)
+    return await future
+
+async def ext_unprotect_file_async(data: UnprotectFileData) -> dict:
+    return await _await_async_call(
+        unprotect_file_async,
+        data.file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.application_id.encode()
+    )
+
+async def ext_protect_file_async(data: ProtectFileData) -> dict:
+    return await _await_async_call(
+        protect_file_async,
+        data.file,
+        data.scc_token.encode(),
+        data.file.encode(),
+        data.encrypted_file.encode(),
+        data.user.encode(),
+        data.application_id.encode()
+    )
+
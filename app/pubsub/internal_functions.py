@@ -1,16 +1,98 @@
+import contextlib
 import json
+import threading
 import time
 import logging
+from dapr.clients import DaprClient
+from dapr.clients.grpc._response import TopicEventResponse
 from dapr.ext.grpc import InvokeMethodRequest, InvokeMethodResponse
 from pydantic import ValidationError
-from app.pubsub.models import FileData, ProtectFileData, UnprotectFileData
+from app.pubsub.batching import BatchCollector
+from app.pubsub.models import FileData, ProtectFileData, ShardedJobData, ShardedJobQuery, UnprotectFileData
 from app.metrics.metrics import (
         instrumented_ext_get_file_status, instrumented_ext_protect_file, instrumented_ext_unprotect_file,
-        metrics_active_requests, metrics_req_count, metrics_req_latency
+        metrics_active_requests, metrics_batch_size, metrics_req_count, metrics_req_latency
+)
+from app.metrics.tracing import traced_request
+from app.core.settings import settings
+from app.pubsub.external_functions import (
+    ResourceExhaustedError,
+    ext_get_archive_status,
+    ext_get_file_status_batch,
+    ext_get_sharded_job_progress,
+    ext_get_sharded_job_results,
+    ext_protect_file_batch,
+    ext_set_deadline,
+    ext_set_idempotency_key,
+    ext_set_priority,
+    ext_submit_sharded_job,
+    ext_unprotect_file_batch,
 )
 
 logger = logging.getLogger(__name__)
 
+GRPC_TIMEOUT_HEADER = 'grpc-timeout'
+# Header a caller keeps across the retries of one invocation, so that they do the work once
+IDEMPOTENCY_KEY_HEADER = 'idempotency-key'
+# Units of a grpc-timeout value ("<digits><unit>") in milliseconds
+_GRPC_TIMEOUT_UNITS = {'H': 3600000, 'M': 60000, 'S': 1000, 'm': 1, 'u': 0.001, 'n': 0.000001}
+
+
+def _timeout_ms(request) -> int:
+    # The caller's remaining gRPC deadline as Dapr forwards it, else MSIP_REQUEST_TIMEOUT_MS
+    for key, value in (getattr(request, 'metadata', None) or {}).items():
+        if key.lower() != GRPC_TIMEOUT_HEADER:
+            continue
+        if isinstance(value, (list, tuple)):
+            value = value[0] if value else ''
+        value = value.decode() if isinstance(value, bytes) else str(value)
+        if value[:-1].isdigit() and value[-1:] in _GRPC_TIMEOUT_UNITS:
+            return max(int(int(value[:-1]) * _GRPC_TIMEOUT_UNITS[value[-1]]), 1)
+    return settings.MSIP_REQUEST_TIMEOUT_MS
+
+
+@contextlib.contextmanager
+def request_deadline(request):
+    # SDK work for this invocation is cancelled once the caller stops waiting, which frees the worker thread
+    timeout_ms = _timeout_ms(request)
+    if timeout_ms <= 0:
+        yield
+        return
+    ext_set_deadline(timeout_ms)
+    try:
+        yield
+    finally:
+        ext_set_deadline(0)
+
+
+@contextlib.contextmanager
+def idempotency(request):
+    # A retry carrying the same idempotency-key header waits for or returns the first invocation's result
+    key = ''
+    for name, value in (getattr(request, 'metadata', None) or {}).items():
+        if name.lower() == IDEMPOTENCY_KEY_HEADER:
+            if isinstance(value, (list, tuple)):
+                value = value[0] if value else ''
+            key = value.decode() if isinstance(value, bytes) else str(value)
+    if not key:
+        yield
+        return
+    ext_set_idempotency_key(key)
+    try:
+        yield
+    finally:
+        ext_set_idempotency_key('')
+
+
+@contextlib.contextmanager
+def bulk_priority():
+    # Native work started inside runs as bulk, so it never holds back request/response invocations
+    ext_set_priority('bulk')
+    try:
+        yield
+    finally:
+        ext_set_priority('interactive')
+
 
 def inspect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     method_name = 'inspect_file'
@@ -22,7 +104,8 @@ def inspect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     try:
         data = json.loads(request.text())
         data = FileData(**data)
-        result = instrumented_ext_get_file_status(data)
+        with traced_request(request, method_name), request_deadline(request), idempotency(request):
+            result = instrumented_ext_get_file_status(data)
         response = InvokeMethodResponse(json.dumps(result).encode(), "application/json", status_code=200)
         metrics_req_count.labels(method=method_name, status='success').inc()
         return response
@@ -31,6 +114,46 @@ def inspect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
         logger.exception(f"Validation error in {method_name}: {e}")
         metrics_req_count.labels(method=method_name, status='validation_error').inc()
         return InvokeMethodResponse(str(e), "application/json", status_code=400)
+    except ResourceExhaustedError as e:
+        # 429 reaches gRPC callers as RESOURCE_EXHAUSTED through the Dapr sidecar
+        logger.warning(f"Rejected {method_name}: {e}")
+        metrics_req_count.labels(method=method_name, status='resource_exhausted').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=429)
+    except Exception as e:
+        logger.exception(f"Error in {method_name}: {type(e)}")
+        metrics_req_count.labels(method=method_name, status='error').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=500)
+    finally:
+        metrics_req_latency.labels(method=method_name).observe(time.perf_counter() - start_time)
+        metrics_active_requests.labels(method=method_name).dec()
+
+
+def inspect_archive(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    # inspect_file for each member of a ZIP or tar archive, read in place without extracting it
+    method_name = 'inspect_archive'
+    metrics_active_requests.labels(method=method_name).inc()
+    start_time = time.perf_counter()
+
+    logger.info('--------------Received inspect_archive invocation -----------------------------------------------')
+
+    try:
+        data = json.loads(request.text())
+        data = FileData(**data)
+        with traced_request(request, method_name), request_deadline(request), idempotency(request):
+            result = ext_get_archive_status(data)
+        response = InvokeMethodResponse(json.dumps(result).encode(), "application/json", status_code=200)
+        metrics_req_count.labels(method=method_name, status='success').inc()
+        return response
+    except ValidationError as e:
+        logger.info(e)
+        logger.exception(f"Validation error in {method_name}: {e}")
+        metrics_req_count.labels(method=method_name, status='validation_error').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=400)
+    except ResourceExhaustedError as e:
+        # 429 reaches gRPC callers as RESOURCE_EXHAUSTED through the Dapr sidecar
+        logger.warning(f"Rejected {method_name}: {e}")
+        metrics_req_count.labels(method=method_name, status='resource_exhausted').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=429)
     except Exception as e:
         logger.exception(f"Error in {method_name}: {type(e)}")
         metrics_req_count.labels(method=method_name, status='error').inc()
@@ -49,7 +172,8 @@ def unprotect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     try:
         data = json.loads(request.text())
         data = UnprotectFileData(**data)
-        result = instrumented_ext_unprotect_file(data)
+        with traced_request(request, method_name), request_deadline(request), idempotency(request):
+            result = instrumented_ext_unprotect_file(data)
         response = InvokeMethodResponse(json.dumps(result).encode(), "application/json", status_code=200)
         metrics_req_count.labels(method=method_name, status='success').inc()
         return response
@@ -57,6 +181,11 @@ def unprotect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
         logger.info(e)
         metrics_req_count.labels(method=method_name, status='validation_error').inc()
         return InvokeMethodResponse(str(e), "application/json", status_code=400)
+    except ResourceExhaustedError as e:
+        # 429 reaches gRPC callers as RESOURCE_EXHAUSTED through the Dapr sidecar
+        logger.warning(f"Rejected {method_name}: {e}")
+        metrics_req_count.labels(method=method_name, status='resource_exhausted').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=429)
     except Exception as e:
         logger.exception(f"Error in {method_name}")
         metrics_req_count.labels(method=method_name, status='error').inc()
@@ -75,7 +204,8 @@ def protect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     try:
         data = json.loads(request.text())
         data = ProtectFileData(**data)
-        result = instrumented_ext_protect_file(data)
+        with traced_request(request, method_name), request_deadline(request), idempotency(request):
+            result = instrumented_ext_protect_file(data)
         response = InvokeMethodResponse(json.dumps(result).encode(), "application/json", status_code=200)
         metrics_req_count.labels(method=method_name, status='success').inc()
         return response
@@ -83,6 +213,11 @@ def protect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
         logger.info(e)
         metrics_req_count.labels(method=method_name, status='validation_error').inc()
         return InvokeMethodResponse(str(e), "application/json", status_code=400)
+    except ResourceExhaustedError as e:
+        # 429 reaches gRPC callers as RESOURCE_EXHAUSTED through the Dapr sidecar
+        logger.warning(f"Rejected {method_name}: {e}")
+        metrics_req_count.labels(method=method_name, status='resource_exhausted').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=429)
     except Exception as e:
         logger.exception(f"Error in {method_name}")
         metrics_req_count.labels(method=method_name, status='error').inc()
@@ -90,3 +225,139 @@ def protect_file(request: InvokeMethodRequest) -> InvokeMethodResponse:
     finally:
         metrics_req_latency.labels(method=method_name).observe(time.perf_counter() - start_time)
         metrics_active_requests.labels(method=method_name).dec()
+
+
+def _sharded_job_invocation(request: InvokeMethodRequest, method_name: str, model, run) -> InvokeMethodResponse:
+    # Sharded job calls only reach Redis, so they take neither a deadline nor a native operation slot
+    metrics_active_requests.labels(method=method_name).inc()
+    start_time = time.perf_counter()
+    try:
+        result = run(model(**json.loads(request.text())))
+        metrics_req_count.labels(method=method_name, status='success' if result.get('status') else 'error').inc()
+        return InvokeMethodResponse(json.dumps(result).encode(), "application/json",
+                                    status_code=200 if result.get('status') else 500)
+    except (ValidationError, json.JSONDecodeError) as e:
+        metrics_req_count.labels(method=method_name, status='validation_error').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=400)
+    except Exception as e:
+        logger.exception(f"Error in {method_name}")
+        metrics_req_count.labels(method=method_name, status='error').inc()
+        return InvokeMethodResponse(str(e), "application/json", status_code=500)
+    finally:
+        metrics_req_latency.labels(method=method_name).observe(time.perf_counter() - start_time)
+        metrics_active_requests.labels(method=method_name).dec()
+
+
+def submit_sharded_job(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    # Records a bulk manifest as shards in Redis for every replica's shard worker (MSIP_SHARD_WORKERS) to run
+    return _sharded_job_invocation(request, 'submit_sharded_job', ShardedJobData, lambda data: ext_submit_sharded_job(
+        data.job_id, data.operation, data.files, data.application_id, data.scc_token, data.user,
+        data.encrypted_file, data.shard_size, data.ttl_seconds))
+
+
+def get_sharded_job(request: InvokeMethodRequest) -> InvokeMethodResponse:
+    # A sharded job's progress, with the results of its completed shards from first_result on when given
+    def run(query: ShardedJobQuery) -> dict:
+        progress = ext_get_sharded_job_progress(query.job_id)
+        if progress.get('status') and query.first_result is not None:
+            results = ext_get_sharded_job_results(query.job_id, query.first_result)
+            if not results.get('status'):
+                return results
+            progress['results'] = results.get('results', [])
+        return progress
+    return _sharded_job_invocation(request, 'get_sharded_job', ShardedJobQuery, run)
+
+
+def _event_payload(event) -> dict:
+    data = event.Data() if callable(getattr(event, 'Data', None)) else getattr(event, 'data', None)
+    if isinstance(data, bytes):
+        data = data.decode()
+    return json.loads(data) if isinstance(data, str) else data
+
+
+def _run_grouped(method_name: str, items: list, key, run_group) -> list:
+    # One native batch call per distinct key(item), since a batch export shares its token and application
+    # id across files. Outcomes come back in the order of items.
+    metrics_batch_size.labels(method=method_name).observe(len(items))
+    groups = {}
+    for index, data in enumerate(items):
+        groups.setdefault(key(data), []).append(index)
+    outcomes = [None] * len(items)
+    with bulk_priority():
+        for group_key, indexes in groups.items():
+            for index, result in zip(indexes, run_group(group_key, [items[i].file for i in indexes])):
+                outcomes[index] = result
+    return outcomes
+
+
+def _event_operation(method_name: str, model, key, run_group) -> tuple:
+    collector = BatchCollector(lambda items: _run_grouped(method_name, items, key, run_group),
+                               settings.MSIP_PUBSUB_BATCH_SIZE, settings.MSIP_PUBSUB_BATCH_WINDOW_MS)
+    return model, collector
+
+
+_event_operations = {
+    'inspect_file': _event_operation(
+        'inspect_file', FileData, lambda d: (d.application_id,),
+        lambda k, files: ext_get_file_status_batch(files, *k)),
+    'unprotect_file': _event_operation(
+        'unprotect_file', UnprotectFileData, lambda d: (d.application_id, d.scc_token),
+        lambda k, files: ext_unprotect_file_batch(files, *k)),
+    'protect_file': _event_operation(
+        'protect_file', ProtectFileData, lambda d: (d.application_id, d.scc_token, d.user, d.encrypted_file),
+        lambda k, files: ext_protect_file_batch(files, *k)),
+}
+
+_publisher = None
+_publisher_lock = threading.Lock()
+
+
+def _publish_result(method_name: str, result: dict):
+    global _publisher
+    if not settings.MSIP_PUBSUB_RESULT_TOPIC:
+        return
+    with _publisher_lock:
+        if _publisher is None:
+            _publisher = DaprClient()
+    _publisher.publish_event(
+        pubsub_name=settings.MSIP_PUBSUB_NAME,
+        topic_name=settings.MSIP_PUBSUB_RESULT_TOPIC,
+        data=json.dumps(dict(result, operation=method_name)),
+        data_content_type='application/json',
+    )
+
+
+def handle_file_event(method_name: str, event) -> TopicEventResponse:
+    # A pub/sub message for inspect_file, unprotect_file or protect_file, with the invocation's payload.
+    # Messages delivered concurrently share one native batch call; each is acked on its own outcome.
+    event_method = f'{method_name}_event'
+    model, collector = _event_operations[method_name]
+    metrics_active_requests.labels(method=event_method).inc()
+    start_time = time.perf_counter()
+    try:
+        try:
+            data = model(**_event_payload(event))
+        except (ValidationError, ValueError, TypeError) as e:
+            # Redelivery cannot fix a malformed message; with a dead letter topic Dapr keeps it there
+            logger.warning(f"Dropping invalid {method_name} message: {e}")
+            metrics_req_count.labels(method=event_method, status='validation_error').inc()
+            return TopicEventResponse('drop')
+        result = collector.submit(data) or {"path": data.file, "status": False, "error": "No result"}
+        _publish_result(method_name, result)
+        if not result.get('status'):
+            logger.warning(f"{method_name} failed for {data.file}: {result.get('error')}")
+            metrics_req_count.labels(method=event_method, status='failed').inc()
+            return TopicEventResponse('drop')
+        metrics_req_count.labels(method=event_method, status='success').inc()
+        return TopicEventResponse('success')
+    except ResourceExhaustedError as e:
+        logger.warning(f"Rejected {method_name} message, redelivering: {e}")
+        metrics_req_count.labels(method=event_method, status='resource_exhausted').inc()
+        return TopicEventResponse('retry')
+    except Exception as e:
+        logger.exception(f"Error in {event_method}")
+        metrics_req_count.labels(method=event_method, status='error').inc()
+        return TopicEventResponse('retry')
+    finally:
+        metrics_req_latency.labels(method=event_method).observe(time.perf_counter() - start_time)
+        metrics_active_requests.labels(method=event_method).dec()
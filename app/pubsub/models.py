@@ -4,12 +4,41 @@ from pydantic import BaseModel
 class FileData(BaseModel):
     file: str    
     application_id: str
+    # Shared-memory segment under MSIP_SHM_DIR holding the content; file then only names it
+    shm_input: str | None = None
 
 
 class UnprotectFileData(FileData):
     scc_token: str
+    # Shared-memory segment under MSIP_SHM_DIR that receives the output of a shm_input request
+    shm_output: str | None = None
 
 
 class ProtectFileData(UnprotectFileData):
     user: str
     encrypted_file: str
+
+
+class ShardedJobData(BaseModel):
+    job_id: str
+    # "status", "unprotect" or "protect", run on every file with the fields that operation takes
+    operation: str
+    files: list[str]
+    application_id: str
+    scc_token: str = ''
+    user: str = ''
+    encrypted_file: str = ''
+    shard_size: int = 100
+    ttl_seconds: int = 86400
+
+
+class ShardedJobQuery(BaseModel):
+    job_id: str
+    # Results of the completed shards from this one on; None for progress only
+    first_result: int | None = None
+
+
+class ProtectTemplateFileData(UnprotectFileData):
+    user: str
+    template_id: str | None = None
+    label_id: str | None = None
@@ -0,0 +1,54 @@
+import logging
+import os
+import signal
+from app.pubsub.external_functions import ext_fork
+
+logger = logging.getLogger(__name__)
+
+
+def fork_workers(workers: int, fork_timeout_ms: int):
+    # Forks workers processes off this warmed one, which then only supervises them: a worker that exits is
+    # forked again, and SIGTERM or SIGINT is passed on to every worker. Returns the worker's index in
+    # 0..workers-1 in a worker, and None in the supervisor once every worker has exited after a signal.
+    children = {}
+    stopping = False
+
+    def stop(signum, frame):
+        nonlocal stopping
+        stopping = True
+        for pid in list(children):
+            try:
+                os.kill(pid, signum)
+            except ProcessLookupError:
+                pass
+
+    previous = {signum: signal.signal(signum, stop) for signum in (signal.SIGTERM, signal.SIGINT)}
+
+    def start(index: int) -> bool:
+        pid = ext_fork(fork_timeout_ms)
+        if pid == 0:
+            for signum, handler in previous.items():
+                signal.signal(signum, handler)
+            return True
+        children[pid] = index
+        logger.info('Forked worker %d as pid %d', index, pid)
+        return False
+
+    for index in range(workers):
+        if start(index):
+            return index
+    while children:
+        try:
+            pid, status = os.wait()
+        except ChildProcessError:
+            break
+        index = children.pop(pid, None)
+        if index is None or stopping:
+            continue
+        logger.warning('Worker %d (pid %d) exited with status %d, forking it again', index, pid,
+                       os.waitstatus_to_exitcode(status))
+        if start(index):
+            return index
+    for signum, handler in previous.items():
+        signal.signal(signum, handler)
+    return None
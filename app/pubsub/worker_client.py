@@ -0,0 +1,74 @@
+import array
+import itertools
+import socket
+import struct
+import threading
+
+# Frames exchanged with msip_workerd, mirroring sdk_file/msip_file/workerd/worker_protocol.h. Both ends run
+# on the same node, so fields are in native byte order.
+_REQUEST_HEADER = struct.Struct('=IIIH')   # length of the rest, id, timeout_ms, argument count
+_ARGUMENT_LENGTH = struct.Struct('=I')
+_RESPONSE_HEADER = struct.Struct('=IIi')   # length of the rest, id, status
+
+
+class WorkerClient:
+    # Calls aip_file.so exports in the msip_workerd daemon listening on socket_path. Each thread keeps one
+    # connection, so calls from different threads run on the daemon's workers in parallel.
+
+    def __init__(self, socket_path: str):
+        self.socket_path = socket_path
+        self._local = threading.local()
+        self._ids = itertools.count(1)
+
+    def _connection(self) -> socket.socket:
+        connection = getattr(self._local, 'connection', None)
+        if connection is None:
+            connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                connection.connect(self.socket_path)
+            except OSError:
+                connection.close()
+                raise
+            self._local.connection = connection
+        return connection
+
+    def _reset(self):
+        connection = getattr(self._local, 'connection', None)
+        self._local.connection = None
+        if connection is not None:
+            connection.close()
+
+    def call(self, operation: str, *args, fds=(), timeout_ms: int = 0) -> tuple:
+        # (status, result JSON bytes). fds are passed to the daemon, which closes its copies after the call.
+        # A broken connection is dropped, so the thread's next call reconnects.
+        arguments = [operation.encode()] + [a if isinstance(a, bytes) else str(a).encode() for a in args]
+        request_id = next(self._ids) & 0xFFFFFFFF
+        body = b''.join(_ARGUMENT_LENGTH.pack(len(a)) + a for a in arguments)
+        frame = _REQUEST_HEADER.pack(_REQUEST_HEADER.size - 4 + len(body), request_id, max(int(timeout_ms), 0),
+                                     len(arguments)) + body
+        try:
+            connection = self._connection()
+            ancillary = [(socket.SOL_SOCKET, socket.SCM_RIGHTS, array.array('i', fds))] if fds else []
+            sent = connection.sendmsg([frame], ancillary)
+            if sent < len(frame):
+                connection.sendall(frame[sent:])
+            length, response_id, status = _RESPONSE_HEADER.unpack(self._receive(connection, _RESPONSE_HEADER.size))
+            result = self._receive(connection, length - (_RESPONSE_HEADER.size - 4))
+        except OSError:
+            self._reset()
+            raise
+        if response_id != request_id:
+            self._reset()
+            raise ConnectionError(f"msip_workerd answered request {response_id} instead of {request_id}")
+        return status, result
+
+    @staticmethod
+    def _receive(connection: socket.socket, length: int) -> bytes:
+        chunks = []
+        while length > 0:
+            chunk = connection.recv(min(length, 1 << 20))
+            if not chunk:
+                raise ConnectionError("msip_workerd closed the connection")
+            chunks.append(chunk)
+            length -= len(chunk)
+        return b''.join(chunks)
@@ -1,18 +1,177 @@
 import unittest
 from unittest.mock import patch, MagicMock, mock_open, call
 import json
+import os
 import ctypes
+import struct
+import asyncio
+import tempfile
+import threading
+import socket
 
-from app.pubsub.models import FileData, UnprotectFileData, ProtectFileData
+from app.pubsub.models import FileData, UnprotectFileData, ProtectFileData, ProtectTemplateFileData
+from app.pubsub.worker_client import WorkerClient
 from app.pubsub.external_functions import (
     ext_get_file_status, 
+    ext_get_archive_status,
+    ext_inspect_license,
+    ext_inspect_msg,
     ext_unprotect_file, 
-    ext_protect_file
+    ext_protect_file,
+    ext_init,
+    ext_shutdown,
+    ext_drop_caches,
+    ext_drain,
+    ext_health,
+    ext_get_affinity_key,
+    ext_get_warm_tenants,
+    ext_fork,
+    ext_set_fast_shutdown,
+    ext_set_native_json,
+    ext_set_native_xml,
+    ext_set_clone_label_outputs,
+    ext_set_pfile_fast_path,
+    ext_set_skip_unchanged,
+    ext_configure_pdf,
+    ext_set_batch_dedupe,
+    ext_configure_batch_pipeline,
+    ext_configure_batch_read_ahead,
+    ext_configure_batch_prefetch,
+    ext_get_batch_pipeline_stats,
+    ext_configure_numa_placement,
+    ext_configure_memory_hints,
+    ext_configure_object_storage,
+    ext_reload_config,
+    ext_configure_output_writer,
+    ext_configure_package_repack,
+    ext_configure_input_streams,
+    ext_get_buffer_pool_stats,
+    ext_configure_temp_files,
+    ext_auto_tune,
+    ext_set_deadline,
+    ext_set_priority,
+    ext_configure_priorities,
+    ext_set_client_secret,
+    ext_configure_classification,
+    ext_configure_consent,
+    ext_configure_format_gate,
+    ext_configure_operation_budget,
+    ext_configure_shards,
+    ext_configure_watch,
+    ext_configure_idempotency,
+    ext_submit_sharded_job,
+    ext_configure_encrypted_storage,
+    ext_configure_memory_storage,
+    ext_configure_engines,
+    ext_configure_shared_labels,
+    ext_configure_policy_snapshot,
+    ext_configure_storage,
+    ext_configure_redis_storage,
+    ext_configure_logging,
+    ext_set_log_capture_level,
+    ext_set_log_level,
+    ext_set_log_limits,
+    ext_set_module_trace,
+    ext_set_request_trace,
+    ext_get_log_stats,
+    ext_configure_diagnostic_upload,
+    ext_configure_decrypted_content_cache,
+    ext_configure_container_cache,
+    ext_configure_region,
+    ext_configure_delegated_identity,
+    ext_configure_dke_cache,
+    ext_configure_http_replay,
+    ext_configure_http_rate_limit,
+    ext_configure_http_resilience,
+    ext_open_file_session,
+    ext_get_label,
+    ext_list_sensitivity_types,
+    ext_classify_files,
+    ext_label_files,
+    ext_label_files_by_label,
+    ext_compute_label_actions,
+    ext_unprotect_file_session,
+    ext_set_engine_cache_size,
+    ext_set_policy_engine_cache_size,
+    ext_set_policy_refresh,
+    ext_set_engine_idle_timeout,
+    ext_warmup,
+    ext_restore_engines,
+    ext_snapshot,
+    ext_restore,
+    ext_get_engine_cache_stats,
+    ext_configure_inspection_cache,
+    ext_configure_known_clean,
+    ext_set_protection_cache_size,
+    ext_get_protection_cache_stats,
+    ext_get_inspection_cache_stats,
+    ext_get_task_dispatcher_stats,
+    ext_get_metrics,
+    ext_configure_lock_metrics,
+    ext_render_metrics,
+    ext_stop_cpu_profile,
+    ext_take_slow_operations,
+    ext_start_capture,
+    ext_stop_capture,
+    ext_take_timelines,
+    ext_take_spans,
+    ext_get_file_status_batch,
+    ext_get_file_status_batch_binary,
+    ext_get_allocator_stats,
+    ext_get_startup_stats,
+    ext_prefetch_licenses,
+    ext_plan_batch,
+    ext_check_delegated_access,
+    ext_check_rights,
+    ext_list_templates,
+    ext_revoke_content,
+    ext_unprotect_file_batch,
+    ext_protect_file_batch,
+    ext_unprotect_file_to_fd,
+    ext_unprotect_file_to_path,
+    ext_unprotect_file_to_bytes,
+    ext_open_decrypted,
+    ext_extract_text,
+    ext_read_stream,
+    ext_open_stream,
+    ext_iter_stream,
+    ext_protect_file_to_fd,
+    ext_protect_file_to_path,
+    ext_protect_file_to_bytes,
+    ext_unprotect_buffer,
+    ext_protect_file_detached,
+    ext_unprotect_file_detached,
+    ext_protect_file_offline,
+    ext_protect_file_with_template,
+    ext_protect_file_with_template_batch,
+    ext_protect_files_with_permissions,
+    ext_unprotect_file_async,
+    ext_protect_file_async,
+    ext_configure_admission,
+    ext_configure_adaptive_admission,
+    ext_configure_cost_accounting,
+    ext_get_costs,
+    ext_configure_tenant_quotas,
+    ext_iter_batch_results,
+    ext_iter_scan_tree,
+    ext_iter_scan_tree_incremental,
+    ext_get_tenant_information,
+    ext_unprotect_shared_memory,
+    ext_unprotect_object,
+    ext_read_label,
+    ext_describe_file,
+    ResourceExhaustedError,
+    _on_async_result
 )
 
 class TestExternalFunctions(unittest.TestCase):
     
     def setUp(self):
+        # The ctypes bindings are under test unless a test patches in an msip_native module
+        native_patcher = patch('app.pubsub.external_functions._native', None)
+        native_patcher.start()
+        self.addCleanup(native_patcher.stop)
+
         # Setup common test data
         self.file_data = FileData(
             file="/test/path/document.docx".encode('utf-8'),
@@ -50,7 +209,7 @@ class TestExternalFunctions(unittest.TestCase):
         # Invalid JSON response for error cases
         self.invalid_json_response = b"{invalid-json"
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.get_file_status')
     def test_ext_get_file_status_success(self, mock_get_file_status, mock_create_buffer):
         """Test successful file status retrieval"""
@@ -81,7 +240,7 @@ class TestExternalFunctions(unittest.TestCase):
         self.assertEqual(app_id_arg.decode(), self.file_data.application_id)
         self.assertEqual(buffer_arg, mock_buffer)
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.get_file_status')
     def test_ext_get_file_status_error(self, mock_get_file_status, mock_create_buffer):
         """Test file status retrieval with error response"""
@@ -104,7 +263,7 @@ class TestExternalFunctions(unittest.TestCase):
         # Verify the function was called
         mock_get_file_status.assert_called_once()
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.get_file_status')
     def test_ext_get_file_status_invalid_json(self, mock_get_file_status, mock_create_buffer):
         """Test handling of invalid JSON response"""
@@ -128,7 +287,792 @@ class TestExternalFunctions(unittest.TestCase):
         # Verify the function was called
         mock_get_file_status.assert_called_once()
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.inspect_license')
+    def test_ext_inspect_license_success(self, mock_inspect_license, mock_create_buffer):
+        """Test publishing-license details are returned from the offline inspect"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True,
+            "path": "/test/path/document.docx",
+            "owner": "owner@example.com",
+            "content_id": "{6d1b2f9a-0c1e-4d5a-9a51-3f1c2b7e8d40}",
+            "template_id": "template-1",
+            "domains": ["example.com"],
+            "issued_time": 1700000000,
+            "double_key": False
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_inspect_license.return_value = 0
+
+        result = ext_inspect_license(self.file_data)
+
+        self.assertTrue(result["status"])
+        self.assertEqual(result["owner"], "owner@example.com")
+        self.assertEqual(result["template_id"], "template-1")
+        file_arg = mock_inspect_license.call_args[0][0]
+        app_id_arg = mock_inspect_license.call_args[0][1]
+        self.assertEqual(file_arg.decode(), self.file_data.file)
+        self.assertEqual(app_id_arg.decode(), self.file_data.application_id)
+
+    @patch('app.pubsub.external_functions.msip_close')
+    @patch('app.pubsub.external_functions.msip_read')
+    @patch('app.pubsub.external_functions.msip_open')
+    def test_ext_iter_stream(self, mock_open, mock_read, mock_close):
+        """Test chunks are read into one buffer until the end and the handle is closed once"""
+        def open_handle(path, handle):
+            handle._obj.value = 9
+            return 0
+        mock_open.side_effect = open_handle
+        chunks = [b"abc", b"de", b""]
+
+        def read(handle, buffer, size):
+            chunk = chunks.pop(0)
+            ctypes.memmove(buffer, chunk, len(chunk))
+            return len(chunk)
+        mock_read.side_effect = read
+
+        with ext_open_stream("/test/a_modified.docx") as stream:
+            data = b"".join(bytes(chunk) for chunk in ext_iter_stream(stream, chunk_size=4))
+
+        self.assertEqual(data, b"abcde")
+        self.assertEqual(mock_read.call_args[0][0], 9)
+        self.assertEqual(mock_read.call_args[0][2], 4)
+        mock_close.assert_called_once_with(9)
+
+    @patch('app.pubsub.external_functions.msip_read')
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.open_decrypted')
+    def test_ext_open_decrypted_and_read(self, mock_open, mock_create_buffer, mock_read):
+        """Test the handle from the open is read in chunks and a failed read raises"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": self.unprotect_data.file, "handle": 7, "size": 5}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_open.return_value = 0
+
+        def read(handle, buffer, size):
+            ctypes.memmove(buffer, b"hello", 5)
+            return 5
+        mock_read.side_effect = read
+
+        result = ext_open_decrypted(self.unprotect_data)
+        self.assertEqual(result["handle"], 7)
+        self.assertEqual(ext_read_stream(result["handle"], 1024), b"hello")
+        self.assertEqual(mock_read.call_args[0][0], 7)
+
+        mock_read.side_effect = None
+        mock_read.return_value = -1
+        with self.assertRaises(IOError):
+            ext_read_stream(7, 1024)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.extract_text')
+    def test_ext_extract_text(self, mock_extract, mock_create_buffer):
+        """Test each piece reaches the handler, a False return stops and a handler error is raised"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": self.unprotect_data.file, "bytes": 11}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        pieces = [b"hello ", b"world"]
+        stops = []
+
+        def extract(token, path, application_id, mode, max_bytes, callback, user_data, out, cap, needed):
+            self.assertEqual((mode, max_bytes), (b"plaintext", 64))
+            for piece in pieces:
+                if callback(ctypes.cast(ctypes.c_char_p(piece), ctypes.c_void_p), len(piece), None):
+                    stops.append(piece)
+                    break
+            return 0
+        mock_extract.side_effect = extract
+
+        received = []
+        result = ext_extract_text(self.unprotect_data, received.append, mode='plaintext', max_bytes=64)
+        self.assertEqual(result["bytes"], 11)
+        self.assertEqual(received, pieces)
+        self.assertEqual(stops, [])
+
+        ext_extract_text(self.unprotect_data, lambda text: False, mode='plaintext', max_bytes=64)
+        self.assertEqual(stops, [b"hello "])
+
+        def fail(text):
+            raise ValueError("index unavailable")
+        with self.assertRaises(ValueError):
+            ext_extract_text(self.unprotect_data, fail, mode='plaintext', max_bytes=64)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.get_label')
+    def test_ext_get_label(self, mock_get_label, mock_create_buffer):
+        """Test the label lookup forwards the id or name and parses the record"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "label": {"id": "l-1", "name": "Confidential", "parent": -1}}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_label.return_value = 0
+
+        result = ext_get_label("confidential", "app-id", "token", user="user@example.com")
+        self.assertEqual(result["label"]["id"], "l-1")
+        self.assertEqual(mock_get_label.call_args[0][:4], (b"token", b"confidential", b"user@example.com", b"app-id"))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.list_sensitivity_types')
+    def test_ext_list_sensitivity_types(self, mock_list, mock_create_buffer):
+        """Test the sensitivity type listing forwards the user and parses the entities"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "file_id": "f-1", "from_disk": True,
+                                        "sensitivity_types": [{"id": "e-1", "name": "Credit Card Number"}]}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_list.return_value = 0
+
+        result = ext_list_sensitivity_types("app-id", "token", user="user@example.com")
+        self.assertEqual(result["sensitivity_types"][0]["id"], "e-1")
+        self.assertEqual(mock_list.call_args[0][:3], (b"token", b"user@example.com", b"app-id"))
+
+    @patch('app.pubsub.external_functions.msip_configure_classification')
+    def test_ext_configure_classification(self, mock_configure):
+        """Test classification mode passes the flag and cache directory"""
+        mock_configure.return_value = 0
+
+        ext_configure_classification(True, "/var/cache/msip/sit")
+        ext_configure_classification(False)
+
+        self.assertEqual(mock_configure.call_args_list, [call(1, b"/var/cache/msip/sit"), call(0, b"")])
+
+    @patch('app.pubsub.external_functions.msip_configure_consent')
+    def test_ext_configure_consent(self, mock_configure):
+        """Test allowed hosts are passed as an array with the reject flag"""
+        mock_configure.return_value = 0
+
+        result = ext_configure_consent(["aadrm.com", "*.protection.outlook.com"], reject_others=True)
+
+        self.assertEqual(result, 0)
+        hosts, count, reject_others = mock_configure.call_args[0]
+        self.assertEqual([hosts[i] for i in range(count)], [b"aadrm.com", b"*.protection.outlook.com"])
+        self.assertEqual(reject_others, 1)
+
+    @patch('app.pubsub.external_functions.msip_configure_memory_storage')
+    def test_ext_configure_memory_storage(self, mock_configure):
+        """Test the byte budget is passed through and never goes negative"""
+        mock_configure.return_value = 0
+
+        ext_configure_memory_storage(256 << 20)
+        ext_configure_memory_storage(-1)
+
+        self.assertEqual(mock_configure.call_args_list, [call(256 << 20), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_encrypted_storage')
+    def test_ext_configure_encrypted_storage(self, mock_configure):
+        """Test the hex key is passed encoded, without surrounding whitespace"""
+        mock_configure.return_value = 0
+
+        ext_configure_encrypted_storage(" " + "ab" * 32 + "\n")
+        ext_configure_encrypted_storage("")
+
+        self.assertEqual(mock_configure.call_args_list, [call(b"ab" * 32), call(b"")])
+
+    @patch('app.pubsub.external_functions.msip_configure_format_gate')
+    def test_ext_configure_format_gate(self, mock_configure):
+        """Test the content check flag and size limit are passed as integers"""
+        mock_configure.return_value = 0
+
+        ext_configure_format_gate(True, 64 << 20)
+        ext_configure_format_gate(False)
+
+        self.assertEqual(mock_configure.call_args_list, [call(1, 64 << 20), call(0, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_operation_budget')
+    def test_ext_configure_operation_budget(self, mock_configure):
+        """Test the budget limits and quarantine default are passed through"""
+        mock_configure.return_value = 0
+
+        ext_configure_operation_budget(30000, 1 << 30)
+        ext_configure_operation_budget(0, 0, 0)
+
+        self.assertEqual(mock_configure.call_args_list, [call(30000, 1 << 30, 600), call(0, 0, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_idempotency')
+    def test_ext_configure_idempotency(self, mock_configure):
+        """Test the idempotency TTL default and that capacities never go negative"""
+        mock_configure.return_value = 0
+
+        ext_configure_idempotency(4096)
+        ext_configure_idempotency(-1, 0)
+
+        self.assertEqual(mock_configure.call_args_list, [call(4096, 600), call(0, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_shards')
+    def test_ext_configure_shards(self, mock_configure):
+        """Test the shard worker defaults and that no threads are passed as 0"""
+        mock_configure.return_value = 0
+
+        ext_configure_shards('redis://redis:6379', threads=4)
+        ext_configure_shards('', threads=-1)
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(b'redis://redis:6379', b'msip:shards:', b'', 4, 30000, 1000),
+            call(b'', b'msip:shards:', b'', 0, 30000, 1000)])
+
+    @patch('app.pubsub.external_functions.msip_configure_watch')
+    def test_ext_configure_watch(self, mock_configure):
+        """Test that roots are joined and that the watcher defaults are passed"""
+        mock_configure.return_value = 0
+
+        ext_configure_watch(['/srv/a', '/srv/b'], 'status', 'app-1', filters='docx', output_fd=5)
+        ext_configure_watch([], 'status', 'app-1', max_batch=-1)
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(b'/srv/a,/srv/b', b'docx', b'status', b'', b'', b'', b'app-1', 5, 500, 64),
+            call(b'', b'', b'status', b'', b'', b'', b'app-1', -1, 500, 0)])
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_submit_sharded_job')
+    def test_ext_submit_sharded_job(self, mock_submit, mock_create_buffer):
+        """Test a manifest is passed as a path array with its job's parameters"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "job_id": "job-1", "shards": 2}).encode()
+        mock_create_buffer.return_value = mock_buffer
+        mock_submit.return_value = 0
+
+        result = ext_submit_sharded_job('job-1', 'unprotect', ['/a.docx', '/b.docx'], 'app-id', 'token', shard_size=1)
+
+        self.assertEqual(result["shards"], 2)
+        args = mock_submit.call_args[0]
+        self.assertEqual(args[:3], (b'job-1', b'unprotect', b'token'))
+        self.assertEqual(list(args[3]), [b'/a.docx', b'/b.docx'])
+        self.assertEqual(args[4:10], (2, b'', b'', b'app-id', 1, 86400))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.get_archive_status')
+    def test_ext_get_archive_status(self, mock_get_archive_status, mock_create_buffer):
+        """Test an archive's member results are returned as the library reports them"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "format": "zip", "members": 1, "protected": 1,
+                                        "results": [{"path": "a.docx", "protected": True, "status": True}]}).encode()
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_archive_status.return_value = 0
+
+        result = ext_get_archive_status(FileData(file='/in/bundle.zip', application_id='app-id'))
+
+        self.assertEqual(result["format"], "zip")
+        self.assertEqual(result["results"][0]["path"], "a.docx")
+        self.assertEqual(mock_get_archive_status.call_args[0][:2], (b'/in/bundle.zip', b'app-id'))
+
+    @patch('app.pubsub.external_functions.msip_set_deadline')
+    def test_ext_set_deadline(self, mock_set_deadline):
+        """Test deadlines pass milliseconds and never go negative"""
+        mock_set_deadline.return_value = 0
+
+        ext_set_deadline(1500)
+        ext_set_deadline(-5)
+
+        self.assertEqual(mock_set_deadline.call_args_list, [call(1500), call(0)])
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_health')
+    def test_ext_health(self, mock_health, mock_create_buffer):
+        """Test the probe state is parsed from the library's result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "live": True, "ready": False, "warmup": "running",
+                                        "last_10s": {"error_rate": 0.0}}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_health.return_value = 0
+
+        health = ext_health()
+        self.assertFalse(health["ready"])
+        self.assertEqual(health["warmup"], "running")
+        mock_health.assert_called_once()
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_affinity_key')
+    def test_ext_get_affinity_key(self, mock_get_key, mock_create_buffer):
+        """Test the tenant and user are passed encoded and the key is parsed from the result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "key": "app-1/9a4c3f1e8b7d6a50", "tenant": "app-1",
+                                        "warm": True}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_key.return_value = 0
+
+        result = ext_get_affinity_key("app-1", "user@contoso.com")
+
+        self.assertEqual(result["key"], "app-1/9a4c3f1e8b7d6a50")
+        self.assertTrue(result["warm"])
+        self.assertEqual(mock_get_key.call_args[0][:2], (b"app-1", b"user@contoso.com"))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_warm_tenants')
+    def test_ext_get_warm_tenants(self, mock_get_tenants, mock_create_buffer):
+        """Test the warm tenants are parsed from the library result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "tenants": [
+            {"application_id": "app-1", "engines": 2, "policy_engines": 1, "licenses": 40, "idle_ms": 1200}
+        ]}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_tenants.return_value = 0
+
+        result = ext_get_warm_tenants()
+
+        self.assertEqual(result["tenants"][0]["application_id"], "app-1")
+        self.assertEqual(result["tenants"][0]["licenses"], 40)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_drain')
+    def test_ext_drain(self, mock_drain, mock_create_buffer):
+        """Test the drain and flush timeouts are passed through, clamped at zero"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "drained": True, "in_flight": 0, "flushed": True}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_drain.return_value = 0
+
+        result = ext_drain(20000, 5000)
+        self.assertTrue(result["drained"])
+        self.assertEqual(mock_drain.call_args[0][:2], (20000, 5000))
+
+        ext_drain(-1, -1)
+        self.assertEqual(mock_drain.call_args[0][:2], (0, 0))
+
+    @patch('app.pubsub.external_functions.os.fork')
+    @patch('app.pubsub.external_functions.msip_resume_after_fork')
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_prepare_fork')
+    def test_ext_fork(self, mock_prepare, mock_create_buffer, mock_resume, mock_fork):
+        """Test threads are resumed after the fork and a busy library refuses to fork"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_prepare.return_value = 0
+        mock_fork.return_value = 4242
+
+        self.assertEqual(ext_fork(2000), 4242)
+        self.assertEqual(mock_prepare.call_args[0][0], 2000)
+        mock_resume.assert_called_once_with()
+
+        mock_buffer.value = json.dumps({"status": False, "error": "Operations are still in flight"}).encode('utf-8')
+        mock_prepare.return_value = 1
+        with self.assertRaisesRegex(RuntimeError, "still in flight"):
+            ext_fork(10)
+        mock_fork.assert_called_once()
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_auto_tune')
+    def test_ext_auto_tune(self, mock_auto_tune, mock_create_buffer):
+        """Test tuned parts are passed as a mask and unknown parts are refused"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "cpus": 2, "memory_bytes": 2147483648,
+                                        "engine_cache_size": 32}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_auto_tune.return_value = 0
+
+        result = ext_auto_tune(['engine_cache', 'buffer_pool'], False)
+
+        self.assertEqual(result["engine_cache_size"], 32)
+        self.assertEqual(mock_auto_tune.call_args[0][:2], (5, 0))
+        with self.assertRaises(ValueError):
+            ext_auto_tune(['thread_pool'])
+
+    @patch('app.pubsub.external_functions.msip_configure_priorities')
+    @patch('app.pubsub.external_functions.msip_set_priority')
+    def test_ext_priorities(self, mock_set_priority, mock_configure):
+        """Test priority names map to the native lanes and unknown names are refused"""
+        mock_set_priority.return_value = 0
+        mock_configure.return_value = 0
+
+        ext_set_priority('bulk')
+        ext_set_priority('interactive')
+        with self.assertRaises(ValueError):
+            ext_set_priority('urgent')
+        ext_configure_priorities()
+        ext_configure_priorities(2, -1)
+
+        self.assertEqual(mock_set_priority.call_args_list, [call(1), call(0)])
+        self.assertEqual(mock_configure.call_args_list, [call(-1, 0), call(2, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_engines')
+    def test_ext_configure_engines(self, mock_configure):
+        """Test engine settings pass the filters, timeouts and custom settings once"""
+        mock_configure.return_value = 0
+
+        result = ext_configure_engines("de-DE", "1:true", "CustomProtection", "", task_timeout_ms=60000,
+                                       custom_settings={"enable_msg_file_type": True})
+
+        self.assertEqual(result, 0)
+        args = mock_configure.call_args[0]
+        self.assertEqual(args[:6], (b"de-DE", b"1:true", b"CustomProtection", b"", 60000, 0))
+        self.assertEqual((args[6][0], args[7][0], args[8]), (b"enable_msg_file_type", b"True", 1))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.get_tenant_information')
+    def test_ext_get_tenant_information(self, mock_tenant, mock_create_buffer):
+        """Test tenant information is requested for the user and parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "tenant_id": "72f988bf", "issuer_name": "Contoso",
+                                        "extranet_url": "https://72f988bf.rms.na.aadrm.com/_wmcs/licensing",
+                                        "intranet_url": "https://72f988bf.rms.na.aadrm.com/_wmcs/licensing",
+                                        "cached": True}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_tenant.return_value = 0
+
+        result = ext_get_tenant_information("user@contoso.com", "test-app-id-123", "token")
+
+        self.assertEqual(result["tenant_id"], "72f988bf")
+        self.assertTrue(result["cached"])
+        args = mock_tenant.call_args[0]
+        self.assertEqual(args[:3], (b"token", b"user@contoso.com", b"test-app-id-123"))
+
+    @patch('app.pubsub.external_functions.msip_configure_http_resilience')
+    def test_ext_configure_http_resilience(self, mock_configure):
+        """Test retry, hedging and breaker settings reach the library in order"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_http_resilience(3, 50, 1000, hedge=False, breaker_failures=0), 0)
+
+        mock_configure.assert_called_once_with(3, 50, 1000, 0, 50, 0, 30000)
+
+    @patch('app.pubsub.external_functions.msip_configure_http_rate_limit')
+    def test_ext_configure_http_rate_limit(self, mock_configure):
+        """Test rate limit settings reach the library in order, with the flag as an int"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_http_rate_limit(max_rate=50.0, decrease=0.7), 0)
+        self.assertEqual(ext_configure_http_rate_limit(False), 0)
+
+        self.assertEqual(mock_configure.call_args_list,
+                         [call(1, 1.0, 50.0, 5.0, 0.7, 60000, 60000), call(0, 1.0, 0.0, 5.0, 0.5, 60000, 60000)])
+
+    @patch('app.pubsub.external_functions.msip_configure_admission')
+    def test_ext_configure_admission(self, mock_configure):
+        """Test admission limits are passed through and a negative in-flight limit is refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_admission(32, 1 << 30), 0)
+        mock_configure.assert_called_once_with(32, 1 << 30)
+        self.assertEqual(ext_configure_admission(-1), 1)
+        mock_configure.assert_called_once()
+
+    @patch('app.pubsub.external_functions.msip_configure_adaptive_admission')
+    def test_ext_configure_adaptive_admission(self, mock_configure):
+        """Test adaptive limits are passed through and negative limits are refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_adaptive_admission(max_limit=64, tolerance=1.5), 0)
+        self.assertEqual(ext_configure_adaptive_admission(False), 0)
+        self.assertEqual(ext_configure_adaptive_admission(min_limit=-1), 1)
+
+        self.assertEqual(mock_configure.call_args_list,
+                         [call(1, 16, 1, 64, 1.5, 1000), call(0, 16, 1, 256, 1.5, 1000)])
+
+    @patch('app.pubsub.external_functions.msip_configure_cost_accounting')
+    def test_ext_configure_cost_accounting(self, mock_configure):
+        """Test cost accounting is switched on and off"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_cost_accounting(), 0)
+        self.assertEqual(ext_configure_cost_accounting(False), 0)
+
+        self.assertEqual(mock_configure.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_costs')
+    def test_ext_get_costs(self, mock_get_costs, mock_create_buffer):
+        """Test per-tenant costs are parsed from the library result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "enabled": True, "keys": 2,
+            "operations": [{"tenant": "app-1", "operation": "protect", "operations": 4, "cpu_us": 120000,
+                            "read_bytes": 1048576, "written_bytes": 1114112, "http_requests": 3,
+                            "http_bytes": 24576, "cache_hits": 3, "cache_misses": 1, "cache_hit_ratio": 0.75}],
+            "hosts": [{"tenant": "app-1", "host": "api.aadrm.com", "http_requests": 3, "http_bytes": 24576}]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_costs.return_value = 0
+
+        result = ext_get_costs()
+
+        self.assertEqual(result["operations"][0]["cpu_us"], 120000)
+        self.assertEqual(result["hosts"][0]["host"], "api.aadrm.com")
+
+    @patch('app.pubsub.external_functions.msip_configure_tenant_quotas')
+    def test_ext_configure_tenant_quotas(self, mock_configure):
+        """Test tenant quotas are passed through and negative quotas are refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_tenant_quotas(4, 256, 8), 0)
+        mock_configure.assert_called_once_with(4, 256, 8)
+        self.assertEqual(ext_configure_tenant_quotas(max_in_flight=-1), 1)
+        mock_configure.assert_called_once()
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file')
+    def test_ext_unprotect_file_overloaded(self, mock_unprotect, mock_create_buffer):
+        """Test an operation turned away by admission control raises instead of returning a result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": False, "error": "Too many operations in flight"}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_unprotect.return_value = 3
+
+        with self.assertRaises(ResourceExhaustedError) as raised:
+            ext_unprotect_file(self.unprotect_data)
+
+        self.assertEqual(str(raised.exception), "Too many operations in flight")
+
+    @patch('app.pubsub.external_functions._native')
+    def test_ext_calls_through_native_module(self, mock_native):
+        """Test file calls use msip_native's parsed results when the module is loaded"""
+        mock_native.get_file_status.return_value = (0, {"status": True, "path": "/a.docx"})
+        mock_native.unprotect_file_to_bytes.return_value = (0, {"status": True}, b"content")
+        mock_native.get_file_status_batch.return_value = (1, {"status": False, "error": "No engine"})
+
+        self.assertEqual(ext_get_file_status(self.file_data), {"status": True, "path": "/a.docx"})
+        self.assertEqual(ext_unprotect_file_to_bytes(self.unprotect_data), ({"status": True}, b"content"))
+        self.assertEqual(ext_get_file_status_batch(["/a", "/b"], "app"), [
+            {"status": False, "error": "No engine", "path": "/a"},
+            {"status": False, "error": "No engine", "path": "/b"}])
+
+        mock_native.get_file_status.assert_called_once_with(self.file_data.file, self.file_data.application_id)
+        mock_native.unprotect_file_to_bytes.assert_called_once_with(
+            "test-scc-token-456", "/test/path/document.docx", "test-app-id-123")
+
+    def test_ext_calls_through_worker_daemon(self):
+        """Test file calls are framed to msip_workerd with their fds and deadline when a socket is configured"""
+        requests = []
+
+        def serve(listener):
+            connection, _ = listener.accept()
+            with connection:
+                for answer in ((0, b'{"status": true, "path": "/a.docx"}'), (3, b'{"error": "Worker queue is full"}')):
+                    frame, fds, _, _ = socket.recv_fds(connection, 1 << 16, 4)
+                    length, request_id, timeout_ms, argc = struct.unpack_from('=IIIH', frame)
+                    offset, arguments = 14, []
+                    for _ in range(argc):
+                        size, = struct.unpack_from('=I', frame, offset)
+                        arguments.append(frame[offset + 4:offset + 4 + size].decode())
+                        offset += 4 + size
+                    requests.append((timeout_ms, arguments, len(fds)))
+                    for fd in fds:
+                        os.close(fd)
+                    connection.sendall(struct.pack('=IIi', 8 + len(answer[1]), request_id, answer[0]) + answer[1])
+
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'workerd.sock')
+            listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            listener.bind(path)
+            listener.listen(1)
+            server = threading.Thread(target=serve, args=(listener,))
+            server.start()
+            read_end, write_end = os.pipe()
+            try:
+                with patch('app.pubsub.external_functions._worker', WorkerClient(path)), \
+                        patch('app.pubsub.external_functions.msip_set_deadline'):
+                    ext_set_deadline(250)
+                    self.assertEqual(ext_get_file_status(self.file_data), {"status": True, "path": "/a.docx"})
+                    ext_set_deadline(0)
+                    with self.assertRaises(ResourceExhaustedError):
+                        ext_unprotect_shared_memory(self.unprotect_data, read_end, write_end)
+            finally:
+                server.join()
+                listener.close()
+                os.close(read_end)
+                os.close(write_end)
+
+        self.assertEqual(requests, [
+            (250, ["getFileStatus_v2", self.file_data.file, self.file_data.application_id], 0),
+            (0, ["unprotectSharedMemory", "test-scc-token-456", "/test/path/document.docx", "test-app-id-123"], 2)])
+
+    @patch('app.pubsub.external_functions._native')
+    def test_ext_native_overloaded_and_invalid(self, mock_native):
+        """Test msip_native results raise when overloaded and become an error result when they do not parse"""
+        mock_native.unprotect_file.return_value = (3, {"status": False, "error": "Too many operations in flight"})
+        mock_native.protect_file.side_effect = ValueError("Invalid JSON object")
+
+        with self.assertRaises(ResourceExhaustedError):
+            ext_unprotect_file(self.unprotect_data)
+        result = ext_protect_file(self.protect_data)
+
+        self.assertFalse(result["status"])
+        self.assertEqual(result["error"], "Invalid JSON object")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_session')
+    @patch('app.pubsub.external_functions.open_file_session')
+    def test_ext_file_session(self, mock_open_session, mock_unprotect_session, mock_create_buffer):
+        """Test the session from the open is the one the unprotect commits"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": self.unprotect_data.file, "session": 3,
+                                        "protected": True, "labeled": False}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_open_session.return_value = 0
+        mock_unprotect_session.return_value = 0
+
+        result = ext_open_file_session(self.unprotect_data)
+        self.assertEqual(result["session"], 3)
+        self.assertEqual(mock_open_session.call_args[0][:3], (
+            self.unprotect_data.scc_token.encode(),
+            self.unprotect_data.file.encode(),
+            self.unprotect_data.application_id.encode()
+        ))
+
+        mock_buffer.value = json.dumps({"status": True, "path": "/path/to/file_modified.docx"}).encode('utf-8')
+        self.assertTrue(ext_unprotect_file_session(result["session"])["status"])
+        self.assertEqual(mock_unprotect_session.call_args[0][0], 3)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_metrics')
+    def test_ext_get_metrics(self, mock_get_metrics, mock_create_buffer):
+        """Test the phase and per-host HTTP histograms are parsed from the library result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "bounds": [0.0001, 0.0002],
+            "phases": {"commit": {"count": 3, "sum": 0.00045, "buckets": [1, 2]}},
+            "http": {"api.aadrm.com": {"count": 2, "sum": 0.0003, "buckets": [0, 2]}}
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_metrics.return_value = 0
+
+        result = ext_get_metrics()
+
+        self.assertEqual(result["phases"]["commit"]["count"], 3)
+        self.assertEqual(result["http"]["api.aadrm.com"]["buckets"], [0, 2])
+        self.assertEqual(result["bounds"], [0.0001, 0.0002])
+
+    @patch('app.pubsub.external_functions.msip_configure_lock_metrics')
+    def test_ext_configure_lock_metrics(self, mock_configure):
+        """Test the lock sampling rate is passed through and a negative one is rejected"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_lock_metrics(64), 0)
+        self.assertEqual(ext_configure_lock_metrics(0), 0)
+        self.assertEqual(ext_configure_lock_metrics(-1), 1)
+
+        self.assertEqual(mock_configure.call_args_list, [call(64), call(0)])
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_render_metrics')
+    def test_ext_render_metrics(self, mock_render, mock_create_buffer):
+        """Test the exposition text is returned as is"""
+        text = '# HELP msip_native_file_handlers_total File handlers created\n# TYPE msip_native_file_handlers_total counter\nmsip_native_file_handlers_total 4\n'
+        mock_buffer = MagicMock()
+        mock_buffer.value = text.encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_render.return_value = 0
+
+        self.assertEqual(ext_render_metrics(), text)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_stop_cpu_profile')
+    def test_ext_stop_cpu_profile(self, mock_stop_profile, mock_create_buffer):
+        """Test the output path is passed and the profile summary is parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "path": "/tmp/cpu.pb.gz", "samples": 2970, "dropped": 0, "duration_ms": 30000
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_stop_profile.return_value = 0
+
+        result = ext_stop_cpu_profile("/tmp/cpu.pb.gz")
+
+        self.assertEqual(result["samples"], 2970)
+        self.assertEqual(mock_stop_profile.call_args[0][0], b"/tmp/cpu.pb.gz")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_take_slow_operations')
+    def test_ext_take_slow_operations(self, mock_take, mock_create_buffer):
+        """Test kept slow operations are parsed with their events"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "operations": [{"operation": "unprotect", "path": "/data/a.docx", "format": "docx", "size_bytes": 52311,
+                            "succeeded": True, "duration_ms": 2412.5, "time_ms": 1791983626595,
+                            "events": [{"kind": "http", "name": "POST api.aadrm.com/my/v2/enduserlicenses",
+                                        "offset_ms": 12.1, "duration_ms": 2251.0, "detail": "200"},
+                                       {"kind": "cache", "name": "use_license", "offset_ms": 11.9, "detail": "miss"}],
+                            "dropped_events": 0}],
+            "dropped": 0
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_take.return_value = 0
+
+        result = ext_take_slow_operations()
+
+        self.assertEqual(result["operations"][0]["events"][1]["detail"], "miss")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_stop_capture')
+    @patch('app.pubsub.external_functions.msip_start_capture')
+    def test_ext_capture(self, mock_start, mock_stop, mock_create_buffer):
+        """Test the capture settings reach the library and its counts come back on stop"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/tmp/traffic.tsv", "recorded": 120,
+                                        "sampled_out": 360, "over_limit": 0}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_start.return_value = 0
+        mock_stop.return_value = 0
+
+        self.assertEqual(ext_start_capture("/tmp/traffic.tsv", 4), 0)
+        mock_start.assert_called_once_with(b"/tmp/traffic.tsv", 4, 0)
+
+        result = ext_stop_capture()
+        self.assertEqual(result["recorded"], 120)
+        self.assertEqual(result["sampled_out"], 360)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_take_timelines')
+    def test_ext_take_timelines(self, mock_take, mock_create_buffer):
+        """Test kept timelines are parsed as Chrome trace objects"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "timelines": [{"traceEvents": [{"name": "unprotect", "cat": "operation", "ph": "X", "ts": 0, "dur": 2412500,
+                                            "pid": 7, "tid": 1},
+                                           {"name": "use_license", "cat": "cache", "ph": "i", "s": "t", "ts": 11900,
+                                            "pid": 7, "tid": 1, "args": {"detail": "miss"}}],
+                           "displayTimeUnit": "ms",
+                           "otherData": {"operation": "unprotect", "path": "/data/a.docx", "succeeded": True,
+                                         "start_unix_us": 1791983624182500, "dropped_events": 0}}],
+            "dropped": 0
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_take.return_value = 0
+
+        result = ext_take_timelines()
+
+        self.assertEqual(result["timelines"][0]["traceEvents"][1]["args"]["detail"], "miss")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_take_spans')
+    def test_ext_take_spans(self, mock_take_spans, mock_create_buffer):
+        """Test the batch size is passed and drained spans are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True,
+            "spans": [{"trace_id": "4bf92f3577b34da6a3ce929d0e0e4736", "span_id": "00f067aa0ba902b7",
+                       "parent_span_id": "a2fb4a1d1a96d312", "name": "HTTP POST", "method": "POST",
+                       "host": "api.aadrm.com", "path": "/my/v2/enduserlicenses", "status_code": 200,
+                       "ttfb_micros": 41000, "cancelled": False, "error": ""}]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_take_spans.return_value = 0
+
+        result = ext_take_spans(16)
+
+        self.assertEqual(mock_take_spans.call_args[0][0], 16)
+        self.assertEqual(result["spans"][0]["host"], "api.aadrm.com")
+        self.assertEqual(result["spans"][0]["status_code"], 200)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.inspect_msg')
+    def test_ext_inspect_msg(self, mock_inspect_msg, mock_create_buffer):
+        """Test the depth is passed and the attachment tree is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "path": "/test/journal.msg",
+            "message": {"name": "/test/journal.msg", "size": 2048, "protected": False, "inspected": True, "status": True,
+                        "attachments": [{"name": "original.msg", "size": 1024, "protected": True, "inspected": True,
+                                         "status": True, "attachments": []}]}
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_inspect_msg.return_value = 0
+
+        result = ext_inspect_msg(self.unprotect_data, max_depth=2)
+
+        self.assertTrue(result["message"]["attachments"][0]["protected"])
+        self.assertEqual(mock_inspect_msg.call_args[0][1].decode(), self.unprotect_data.file)
+        self.assertEqual(mock_inspect_msg.call_args[0][2], 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.unprotect_file')
     def test_ext_unprotect_file_success(self, mock_unprotect_file, mock_create_buffer):
         """Test successful file unprotection"""
@@ -160,7 +1104,7 @@ class TestExternalFunctions(unittest.TestCase):
         self.assertEqual(app_id_arg.decode(), self.unprotect_data.application_id)
         self.assertEqual(buffer_arg, mock_buffer)
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.unprotect_file')
     def test_ext_unprotect_file_error(self, mock_unprotect_file, mock_create_buffer):
         """Test file unprotection with error response"""
@@ -183,7 +1127,7 @@ class TestExternalFunctions(unittest.TestCase):
         # Verify the function was called
         mock_unprotect_file.assert_called_once()
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.unprotect_file')
     def test_ext_unprotect_file_invalid_json(self, mock_unprotect_file, mock_create_buffer):
         """Test handling of invalid JSON response in unprotect_file"""
@@ -207,7 +1151,7 @@ class TestExternalFunctions(unittest.TestCase):
         # Verify the function was called
         mock_unprotect_file.assert_called_once()
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.protect_file')
     def test_ext_protect_file_success(self, mock_protect_file, mock_create_buffer):
         """Test successful file protection"""
@@ -243,7 +1187,7 @@ class TestExternalFunctions(unittest.TestCase):
         self.assertEqual(app_id_arg.decode(), self.protect_data.application_id)
         self.assertEqual(buffer_arg, mock_buffer)
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.protect_file')
     def test_ext_protect_file_error(self, mock_protect_file, mock_create_buffer):
         """Test file protection with error response"""
@@ -266,7 +1210,7 @@ class TestExternalFunctions(unittest.TestCase):
         # Verify the function was called
         mock_protect_file.assert_called_once()
 
-    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions._result_buffer')
     @patch('app.pubsub.external_functions.protect_file')
     def test_ext_protect_file_invalid_json(self, mock_protect_file, mock_create_buffer):
         """Test handling of invalid JSON response in protect_file"""
@@ -308,3 +1252,1584 @@ class TestExternalFunctions(unittest.TestCase):
                         "Buffer size should be large enough for typical responses")
         self.assertTrue(8192 >= len(self.error_response), 
                         "Buffer size should be large enough for error responses")
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_init')
+    def test_ext_init_success(self, mock_msip_init, mock_create_buffer):
+        """Test eager initialization of the shared MIP context"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_msip_init.return_value = 0
+
+        result = ext_init("test-app-id-123")
+
+        self.assertTrue(result["status"])
+        mock_msip_init.assert_called_once()
+        self.assertEqual(mock_msip_init.call_args[0][0].decode(), "test-app-id-123")
+        self.assertEqual(mock_msip_init.call_args[0][1], mock_buffer)
+
+    @patch('app.pubsub.external_functions.msip_shutdown')
+    def test_ext_shutdown(self, mock_msip_shutdown):
+        """Test shutdown forwards to the native library"""
+        mock_msip_shutdown.return_value = 0
+
+        self.assertEqual(ext_shutdown(), 0)
+        mock_msip_shutdown.assert_called_once_with()
+
+    @patch('app.pubsub.external_functions.msip_drop_caches')
+    def test_ext_drop_caches(self, mock_drop_caches):
+        """Test each cache layer maps to its native value and unknown layers are refused"""
+        mock_drop_caches.return_value = 0
+
+        self.assertEqual(ext_drop_caches('licenses'), 0)
+        ext_drop_caches('engines')
+        ext_drop_caches('contexts')
+        self.assertEqual(ext_drop_caches('profiles'), 1)
+
+        self.assertEqual(mock_drop_caches.call_args_list, [call(0), call(1), call(2)])
+
+    @patch('app.pubsub.external_functions.msip_set_fast_shutdown')
+    def test_ext_set_fast_shutdown(self, mock_set_fast_shutdown):
+        """Test the shutdown mode is passed as an int flag"""
+        mock_set_fast_shutdown.return_value = 0
+
+        ext_set_fast_shutdown(True)
+        ext_set_fast_shutdown(False)
+
+        self.assertEqual(mock_set_fast_shutdown.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_set_native_json')
+    def test_ext_set_native_json(self, mock_set_native_json):
+        """Test the JSON parser choice is passed as an int flag"""
+        mock_set_native_json.return_value = 0
+
+        ext_set_native_json(True)
+        ext_set_native_json(False)
+
+        self.assertEqual(mock_set_native_json.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_set_native_xml')
+    def test_ext_set_native_xml(self, mock_set_native_xml):
+        """Test the XML parser choice is passed as an int flag"""
+        mock_set_native_xml.return_value = 0
+
+        ext_set_native_xml(True)
+        ext_set_native_xml(False)
+
+        self.assertEqual(mock_set_native_xml.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_region')
+    def test_ext_configure_region(self, mock_configure_region):
+        """Test data boundary names map to mip::DataBoundary values and unknown ones are rejected"""
+        mock_configure_region.return_value = 0
+
+        self.assertEqual(ext_configure_region('', ''), 0)
+        self.assertEqual(ext_configure_region('app-eu', 'EU', False), 0)
+        self.assertEqual(ext_configure_region('app-x', 'mars'), 1)
+
+        self.assertEqual(mock_configure_region.call_args_list, [call(b'', 0, 1), call(b'app-eu', 2, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_delegated_identity')
+    def test_ext_configure_delegated_identity(self, mock_configure_delegated_identity):
+        """Test the application and its service identity are passed through, empty turning delegation off"""
+        mock_configure_delegated_identity.return_value = 0
+
+        self.assertEqual(ext_configure_delegated_identity('app-id', 'svc@contoso.com'), 0)
+        self.assertEqual(ext_configure_delegated_identity('app-id', ''), 0)
+
+        self.assertEqual(mock_configure_delegated_identity.call_args_list,
+                         [call(b'app-id', b'svc@contoso.com'), call(b'app-id', b'')])
+
+    @patch('app.pubsub.external_functions.msip_set_batch_dedupe')
+    def test_ext_set_batch_dedupe(self, mock_set_batch_dedupe):
+        """Test dedupe modes map to the native values and unknown modes are refused"""
+        mock_set_batch_dedupe.return_value = 0
+
+        ext_set_batch_dedupe('hardlink')
+        ext_set_batch_dedupe('off')
+        with self.assertRaises(ValueError):
+            ext_set_batch_dedupe('symlink')
+
+        self.assertEqual(mock_set_batch_dedupe.call_args_list, [call(2), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_batch_read_ahead')
+    def test_ext_configure_batch_read_ahead(self, mock_configure):
+        """Test read ahead settings are passed through and invalid sizes are refused before the native call"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_batch_read_ahead(64, 131072, 1 << 28), 0)
+        self.assertEqual(ext_configure_batch_read_ahead(-1), 1)
+        self.assertEqual(ext_configure_batch_read_ahead(32, 0), 1)
+
+        mock_configure.assert_called_once_with(64, 131072, 1 << 28)
+
+    @patch('app.pubsub.external_functions.msip_configure_batch_prefetch')
+    def test_ext_configure_batch_prefetch(self, mock_configure):
+        """Test prefetch settings are passed through and an out of range depth is refused before the native call"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_batch_prefetch(2, 1 << 26, 1 << 20), 0)
+        self.assertEqual(ext_configure_batch_prefetch(17), 1)
+        self.assertEqual(ext_configure_batch_prefetch(-1), 1)
+        self.assertEqual(ext_configure_batch_prefetch(1, -1), 1)
+
+        mock_configure.assert_called_once_with(2, 1 << 26, 1 << 20)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_batch_pipeline_stats')
+    @patch('app.pubsub.external_functions.msip_configure_batch_pipeline')
+    def test_ext_batch_pipeline(self, mock_configure, mock_stats, mock_create_buffer):
+        """Test stage workers are validated and the last pipelined batch's stage figures returned"""
+        mock_configure.return_value = 0
+        self.assertEqual(ext_configure_batch_pipeline(2, 8, 1, 4, 2, 32), 0)
+        self.assertEqual(mock_configure.call_args[0], (2, 8, 1, 4, 2, 32))
+        self.assertEqual(ext_configure_batch_pipeline(2, -1, 1, 4, 2), 1)
+        self.assertEqual(mock_configure.call_count, 1)
+
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "enabled": True, "batches": 1, "bottleneck": "open",
+                                        "stages": [{"name": "open", "utilization": 0.97, "occupancy": 1.0}]}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_stats.return_value = 0
+        stats = ext_get_batch_pipeline_stats()
+        self.assertEqual(stats["bottleneck"], "open")
+        self.assertEqual(stats["stages"][0]["occupancy"], 1.0)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.read_label')
+    def test_ext_read_label(self, mock_read_label, mock_create_buffer):
+        """Test a label is read without a token unless one is given for the name lookup"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "labeled": True, "label_id": "a1", "name": "General",
+                                        "assignment_method": "privileged", "source": "metadata"}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_read_label.return_value = 0
+
+        result = ext_read_label(self.file_data)
+        self.assertEqual(result["assignment_method"], "privileged")
+        self.assertEqual(mock_read_label.call_args[0][0], b"")
+        ext_read_label(self.file_data, "token", "user@contoso.com")
+        self.assertEqual(mock_read_label.call_args[0][0], b"token")
+        self.assertEqual(mock_read_label.call_args[0][2], b"user@contoso.com")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.describe_file')
+    def test_ext_describe_file(self, mock_describe_file, mock_create_buffer):
+        """Test label and protection come back from one call with the token, path and user"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "labeled": True, "protected": True, "source": "handler",
+                                        "label": {"id": "a1", "name": "General"},
+                                        "protection": {"type": "template", "granted_rights": ["VIEW"]}}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_describe_file.return_value = 0
+
+        result = ext_describe_file(self.unprotect_data, "user@contoso.com")
+        self.assertEqual(result["label"]["name"], "General")
+        self.assertEqual(result["protection"]["granted_rights"], ["VIEW"])
+        self.assertEqual(mock_describe_file.call_args[0][:4],
+                         (b"test-scc-token-456", b"/test/path/document.docx", b"user@contoso.com", b"test-app-id-123"))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_object')
+    @patch('app.pubsub.external_functions.msip_configure_object_storage')
+    def test_ext_unprotect_object(self, mock_configure, mock_unprotect, mock_create_buffer):
+        """Test object storage sizes are validated and an object is unprotected into its destination URI"""
+        mock_configure.return_value = 0
+        self.assertEqual(ext_configure_object_storage(block_bytes=1 << 20, parts_in_flight=8), 0)
+        self.assertEqual(mock_configure.call_args[0], (1 << 20, 0, 0, 0, 8, 0))
+        self.assertEqual(ext_configure_object_storage(part_bytes=-1), 1)
+        self.assertEqual(mock_configure.call_count, 1)
+
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "s3://out/report.docx", "bytes": 4096,
+                                        "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_unprotect.return_value = 0
+        self.unprotect_data.file = "s3://in/report.docx"
+
+        result = ext_unprotect_object(self.unprotect_data, "s3://out/report.docx")
+        self.assertEqual(result["path"], "s3://out/report.docx")
+        self.assertEqual(mock_unprotect.call_args[0][1:3], (b"s3://in/report.docx", b"s3://out/report.docx"))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_configure_numa_placement')
+    def test_ext_configure_numa_placement(self, mock_configure, mock_create_buffer):
+        """Test placement is switched as a flag and the node count is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "enabled": True, "nodes": 2}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_numa_placement(True)["nodes"], 2)
+        self.assertEqual(mock_configure.call_args[0][0], 1)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_configure_memory_hints')
+    def test_ext_configure_memory_hints(self, mock_configure, mock_create_buffer):
+        """Test the hints are passed as flags and a threshold, and the kernel's mode is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "huge_pages": False, "prefault_min_bytes": 1048576,
+                                        "prefault_pool": True, "transparent_hugepage": "madvise"}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_configure.return_value = 0
+
+        result = ext_configure_memory_hints(False, 1048576, True)
+        self.assertEqual(result["transparent_hugepage"], "madvise")
+        self.assertEqual(mock_configure.call_args[0][:3], (0, 1048576, 1))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_reload_config')
+    def test_ext_reload_config(self, mock_reload, mock_create_buffer):
+        """Test the configuration is passed as one JSON object and the reload result returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "applied": ["engine_cache_size"], "engine_options": True,
+                                        "engines_reloading": 3}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_reload.return_value = 0
+
+        result = ext_reload_config({"engine_cache_size": 32, "locale": "de-DE"})
+
+        self.assertEqual(result["engines_reloading"], 3)
+        self.assertEqual(json.loads(mock_reload.call_args[0][0]), {"engine_cache_size": 32, "locale": "de-DE"})
+
+    @patch('app.pubsub.external_functions.msip_set_clone_label_outputs')
+    def test_ext_set_clone_label_outputs(self, mock_set):
+        """Test cloned label outputs are switched with an integer flag"""
+        mock_set.return_value = 0
+
+        ext_set_clone_label_outputs(True)
+        ext_set_clone_label_outputs(False)
+
+        self.assertEqual(mock_set.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_set_pfile_fast_path')
+    def test_ext_set_pfile_fast_path(self, mock_set):
+        """Test the pfile fast path is switched with an integer flag"""
+        mock_set.return_value = 0
+
+        ext_set_pfile_fast_path(True)
+        ext_set_pfile_fast_path(False)
+
+        self.assertEqual(mock_set.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_set_skip_unchanged')
+    def test_ext_set_skip_unchanged(self, mock_set):
+        """Test skipping unchanged files is switched with an integer flag"""
+        mock_set.return_value = 0
+
+        ext_set_skip_unchanged(True)
+        ext_set_skip_unchanged(False)
+
+        self.assertEqual(mock_set.call_args_list, [call(1), call(0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_pdf')
+    def test_ext_configure_pdf(self, mock_configure):
+        """Test both PDF flags are passed as integers, in order"""
+        mock_configure.return_value = 0
+
+        ext_configure_pdf(True, False)
+        ext_configure_pdf(False, True)
+
+        self.assertEqual(mock_configure.call_args_list, [call(1, 0), call(0, 1)])
+
+    @patch('app.pubsub.external_functions.msip_configure_output_writer')
+    def test_ext_configure_output_writer(self, mock_configure):
+        """Test output writer flags are passed as integers and a negative buffer is refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_output_writer(1 << 20, direct_io=True, drop_cache=True), 0)
+        self.assertEqual(ext_configure_output_writer(-1), 1)
+
+        mock_configure.assert_called_once_with(1 << 20, 1, 1, 1)
+
+    @patch('app.pubsub.external_functions.msip_configure_package_repack')
+    def test_ext_configure_package_repack(self, mock_configure):
+        """Test the repack switch is passed as an integer with the default limits and level"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_package_repack(True), 0)
+
+        mock_configure.assert_called_once_with(1, 256 * 1024 * 1024, 64 * 1024, 6)
+
+    @patch('app.pubsub.external_functions.msip_configure_input_streams')
+    def test_ext_configure_input_streams(self, mock_configure):
+        """Test input stream thresholds are passed through and negative sizes are refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_input_streams(1 << 20, 16 << 20, 1 << 30, 4 << 20, 8 << 20), 0)
+        self.assertEqual(ext_configure_input_streams(-1, 16 << 20, 0, 4 << 20, 0), 1)
+
+        mock_configure.assert_called_once_with(1 << 20, 16 << 20, 1 << 30, 4 << 20, 8 << 20)
+
+    @patch('app.pubsub.external_functions.msip_configure_storage')
+    def test_ext_configure_storage(self, mock_configure):
+        """Test storage settings map to the native storage type codes"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_storage("on_disk_encrypted", "/var/cache/msip", True, 7), 0)
+        ext_configure_storage("in_memory")
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(b"/var/cache/msip", 2, 1, 7),
+            call(b"", 0, 1, 0)
+        ])
+
+    @patch('app.pubsub.external_functions.msip_configure_policy_snapshot')
+    def test_ext_configure_policy_snapshot(self, mock_configure):
+        """Test the policy snapshot path and export flag are passed through"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_policy_snapshot("/etc/msip/policy.xml"), 0)
+        ext_configure_policy_snapshot("/var/cache/msip/policy.xml", export=True)
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(b"/etc/msip/policy.xml", 0),
+            call(b"/var/cache/msip/policy.xml", 1)
+        ])
+
+    @patch('app.pubsub.external_functions.msip_configure_shared_labels')
+    def test_ext_configure_shared_labels(self, mock_configure):
+        """Test the shared label directory is passed through, empty turning sharing off"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_shared_labels("/dev/shm"), 0)
+        ext_configure_shared_labels("")
+
+        self.assertEqual(mock_configure.call_args_list, [call(b"/dev/shm"), call(b"")])
+
+    @patch('app.pubsub.external_functions.msip_configure_storage')
+    def test_ext_configure_storage_rejects_unknown_type(self, mock_configure):
+        """Test an unknown storage type is rejected before reaching the library"""
+        with self.assertRaises(ValueError):
+            ext_configure_storage("redis")
+        mock_configure.assert_not_called()
+
+    @patch('app.pubsub.external_functions.msip_configure_redis_storage')
+    def test_ext_configure_redis_storage(self, mock_configure):
+        """Test Redis storage settings are forwarded as bytes with the default prefix, L1 TTL and key"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_redis_storage("redis://:pw@redis:6379/1", key="ab" * 32), 0)
+        ext_configure_redis_storage("", "tenant-a", 0)
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(b"redis://:pw@redis:6379/1", b"msip", 30, b"ab" * 32),
+            call(b"", b"tenant-a", 0, b"")
+        ])
+
+    @patch('app.pubsub.external_functions.msip_configure_logging')
+    def test_ext_configure_logging(self, mock_configure):
+        """Test logger settings map to the native level and sink codes"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_logging("warning", "stdout", 4096), 0)
+        ext_configure_logging("trace")
+
+        self.assertEqual(mock_configure.call_args_list, [call(2, 1, 4096), call(0, 0, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_logging')
+    def test_ext_configure_logging_rejects_unknown_values(self, mock_configure):
+        """Test unknown levels and sinks are rejected before reaching the library"""
+        with self.assertRaises(ValueError):
+            ext_configure_logging("verbose")
+        with self.assertRaises(ValueError):
+            ext_configure_logging("info", "syslog")
+        mock_configure.assert_not_called()
+
+    @patch('app.pubsub.external_functions.msip_set_log_limits')
+    @patch('app.pubsub.external_functions.msip_set_log_level')
+    def test_ext_set_log_level_and_limits(self, mock_set_level, mock_set_limits):
+        """Test runtime log threshold and per-level limits are forwarded"""
+        mock_set_level.return_value = 0
+        mock_set_limits.return_value = 0
+
+        self.assertEqual(ext_set_log_level("error"), 0)
+        self.assertEqual(ext_set_log_limits("trace", 100, 50), 0)
+
+        mock_set_level.assert_called_once_with(3)
+        mock_set_limits.assert_called_once_with(0, 100, 50)
+
+    @patch('app.pubsub.external_functions.msip_set_request_trace')
+    @patch('app.pubsub.external_functions.msip_set_module_trace')
+    @patch('app.pubsub.external_functions.msip_set_log_capture_level')
+    def test_ext_on_demand_trace(self, mock_capture, mock_module, mock_request):
+        """Test capture level, module and request tracing are forwarded and unknown levels rejected"""
+        mock_capture.return_value = 0
+        mock_module.return_value = 0
+        mock_request.return_value = 0
+
+        self.assertEqual(ext_set_log_capture_level("trace"), 0)
+        self.assertEqual(ext_set_module_trace("file_handler"), 0)
+        self.assertEqual(ext_set_module_trace("file_handler", False), 0)
+        self.assertEqual(ext_set_request_trace(True), 0)
+        with self.assertRaises(ValueError):
+            ext_set_log_capture_level("verbose")
+
+        mock_capture.assert_called_once_with(0)
+        mock_module.assert_has_calls([call(b"file_handler", 1), call(b"file_handler", 0)])
+        mock_request.assert_called_once_with(1)
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_log_stats')
+    def test_ext_get_log_stats(self, mock_get_stats, mock_create_buffer):
+        """Test logger counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "written": 10, "dropped_overflow": 2, "dropped_sampled": 0,
+            "dropped_rate_limited": 1, "dropped_below_level": 40
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_log_stats()
+
+        self.assertEqual(result["written"], 10)
+        self.assertEqual(result["dropped_overflow"], 2)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.msip_configure_diagnostic_upload')
+    def test_ext_configure_diagnostic_upload(self, mock_configure):
+        """Test the endpoint and limits are forwarded, with zero meaning the library default"""
+        mock_configure.return_value = 0
+
+        result = ext_configure_diagnostic_upload("https://collector.internal/v1/events", "Bearer abc", max_batch_events=256)
+
+        self.assertEqual(result, 0)
+        mock_configure.assert_called_once_with(b"https://collector.internal/v1/events", b"Bearer abc", 0, 256, 0)
+
+    @patch('app.pubsub.external_functions.msip_configure_decrypted_content_cache')
+    def test_ext_configure_decrypted_content_cache(self, mock_configure):
+        """Test the byte capacity is passed through and the entry limit defaults to the library's"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_decrypted_content_cache(256 * 1024 * 1024), 0)
+
+        mock_configure.assert_called_once_with(256 * 1024 * 1024, 0)
+
+    @patch('app.pubsub.external_functions.msip_configure_container_cache')
+    def test_ext_configure_container_cache(self, mock_configure):
+        """Test the entry capacity is passed through with the default TTL and per-file bound"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_container_cache(512), 0)
+
+        mock_configure.assert_called_once_with(512, 30000, 0)
+
+    @patch('app.pubsub.external_functions.msip_configure_dke_cache')
+    def test_ext_configure_dke_cache(self, mock_configure):
+        """Test the base URLs are joined into one comma-separated argument"""
+        mock_configure.return_value = 0
+
+        result = ext_configure_dke_cache(["https://dke.contoso.com", "https://dke2.contoso.com/keys"], unwrap_ttl_seconds=60)
+
+        self.assertEqual(result, 0)
+        mock_configure.assert_called_once_with(b"https://dke.contoso.com,https://dke2.contoso.com/keys", 3600, 60, 4096)
+
+    @patch('app.pubsub.external_functions.msip_configure_http_replay')
+    def test_ext_configure_http_replay(self, mock_configure):
+        """Test the mode name is mapped to the library's code and unknown modes are refused"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_http_replay("replay", "/fixtures/rms", latency_ms=40, jitter_ms=10), 0)
+        mock_configure.assert_called_once_with(2, b"/fixtures/rms", 40, 10)
+
+        self.assertEqual(ext_configure_http_replay("playback", "/fixtures/rms"), 1)
+        mock_configure.assert_called_once()
+
+    @patch('app.pubsub.external_functions.msip_set_client_secret')
+    def test_ext_set_client_secret(self, mock_set_secret):
+        """Test the client secret is forwarded as bytes"""
+        mock_set_secret.return_value = 0
+
+        self.assertEqual(ext_set_client_secret("s3cret"), 0)
+        mock_set_secret.assert_called_once_with(b"s3cret")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_warmup')
+    def test_ext_warmup(self, mock_warmup, mock_create_buffer):
+        """Test each target's parts are combined into the library's flags"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "steps": []}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_warmup.return_value = 0
+
+        result = ext_warmup([
+            {"application_id": "app-1"},
+            {"application_id": "app-2", "user": "svc@example.com", "labels": True, "templates": True},
+        ])
+
+        self.assertTrue(result["status"])
+        args = mock_warmup.call_args[0]
+        self.assertEqual(args[0], b"")
+        self.assertEqual([args[1][0], args[1][1]], [b"app-1", b"app-2"])
+        self.assertEqual([args[2][0], args[2][1]], [b"", b"svc@example.com"])
+        self.assertEqual(list(args[3]), [0, 3])
+        self.assertEqual(args[4], 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_restore_engines')
+    def test_ext_restore_engines(self, mock_restore, mock_create_buffer):
+        """Test no application ids asks the library to restore every recorded application"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "restored": 2, "failed": 0, "missing": 1,
+                                        "skipped": 0, "engines": []}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_restore.return_value = 0
+
+        result = ext_restore_engines()
+
+        self.assertEqual(result["restored"], 2)
+        args = mock_restore.call_args[0]
+        self.assertEqual(args[0], b"")
+        self.assertEqual(args[2], 0)
+
+        ext_restore_engines(["app-1"], "token")
+        args = mock_restore.call_args[0]
+        self.assertEqual(args[0], b"token")
+        self.assertEqual(args[1][0], b"app-1")
+        self.assertEqual(args[2], 1)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_restore')
+    @patch('app.pubsub.external_functions.msip_snapshot')
+    def test_ext_snapshot_and_restore(self, mock_snapshot, mock_restore, mock_create_buffer):
+        """Test the snapshot path and key reach the library and the restore counts come back"""
+        mock_buffer = MagicMock()
+        mock_create_buffer.return_value = mock_buffer
+        mock_snapshot.return_value = 0
+        mock_restore.return_value = 0
+
+        mock_buffer.value = json.dumps({"status": True, "created_at": 1, "bytes": 4096, "sealed": False,
+                                        "sections": []}).encode('utf-8')
+        self.assertEqual(ext_snapshot("/tmp/caches.snap")["bytes"], 4096)
+        self.assertEqual(mock_snapshot.call_args[0][:2], (b"/tmp/caches.snap", b""))
+
+        mock_buffer.value = json.dumps({"status": True, "created_at": 1, "bytes": 4096,
+                                        "restored": {"endpoints": 3, "rights": 0},
+                                        "skipped": [{"type": "rights", "name": "rights", "reason": "wrong key"}]}
+                                       ).encode('utf-8')
+        result = ext_restore("/tmp/caches.snap", "ab" * 32)
+        self.assertEqual(result["restored"]["endpoints"], 3)
+        self.assertEqual(result["skipped"][0]["reason"], "wrong key")
+        self.assertEqual(mock_restore.call_args[0][:2], (b"/tmp/caches.snap", ("ab" * 32).encode()))
+
+    @patch('app.pubsub.external_functions.msip_set_policy_refresh')
+    def test_ext_set_policy_refresh(self, mock_set_refresh):
+        """Test the policy refresh TTL is forwarded to the native library"""
+        mock_set_refresh.return_value = 0
+
+        self.assertEqual(ext_set_policy_refresh(3600), 0)
+        mock_set_refresh.assert_called_once_with(3600)
+
+    @patch('app.pubsub.external_functions.msip_set_engine_idle_timeout')
+    def test_ext_set_engine_idle_timeout(self, mock_set_idle):
+        """Test the engine idle timeout is forwarded to the native library"""
+        mock_set_idle.return_value = 0
+
+        self.assertEqual(ext_set_engine_idle_timeout(900), 0)
+        mock_set_idle.assert_called_once_with(900)
+
+    @patch('app.pubsub.external_functions.msip_set_engine_cache_size')
+    def test_ext_set_engine_cache_size(self, mock_set_size):
+        """Test engine cache size is forwarded to the native library"""
+        mock_set_size.return_value = 0
+
+        self.assertEqual(ext_set_engine_cache_size(32), 0)
+        mock_set_size.assert_called_once_with(32)
+
+    @patch('app.pubsub.external_functions.msip_set_policy_engine_cache_size')
+    def test_ext_set_policy_engine_cache_size(self, mock_set_size):
+        """Test the policy engine cap is forwarded to the native library"""
+        mock_set_size.return_value = 0
+
+        self.assertEqual(ext_set_policy_engine_cache_size(4), 0)
+        mock_set_size.assert_called_once_with(4)
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_engine_cache_stats')
+    def test_ext_get_engine_cache_stats(self, mock_get_stats, mock_create_buffer):
+        """Test engine cache counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "hits": 3, "misses": 1, "evictions": 0, "size": 1, "capacity": 16
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_engine_cache_stats()
+
+        self.assertEqual(result["hits"], 3)
+        self.assertEqual(result["misses"], 1)
+        self.assertEqual(result["capacity"], 16)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.msip_configure_inspection_cache')
+    def test_ext_configure_inspection_cache(self, mock_configure):
+        """Test inspection cache settings are forwarded with an int verify flag"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_inspection_cache(1024, 300, True), 0)
+        ext_configure_inspection_cache(0)
+
+        self.assertEqual(mock_configure.call_args_list, [call(1024, 300, 1), call(0, 0, 0)])
+
+    @patch('app.pubsub.external_functions.msip_configure_known_clean')
+    def test_ext_configure_known_clean(self, mock_configure):
+        """Test the known-clean filter defaults and that negative counts are passed as 0"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_known_clean(100_000_000, path='/var/lib/msip/clean.bin'), 0)
+        ext_configure_known_clean(-1, verify_one_in=-5)
+
+        self.assertEqual(mock_configure.call_args_list, [
+            call(100_000_000, 0.01, 86400, 1000, b'/var/lib/msip/clean.bin'),
+            call(0, 0.01, 86400, 0, b'')])
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_inspection_cache_stats')
+    def test_ext_get_inspection_cache_stats(self, mock_get_stats, mock_create_buffer):
+        """Test inspection cache counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "hits": 7, "misses": 2, "evictions": 0, "size": 2, "capacity": 1024
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_inspection_cache_stats()
+
+        self.assertEqual(result["hits"], 7)
+        self.assertEqual(result["misses"], 2)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.msip_set_protection_cache_size')
+    def test_ext_set_protection_cache_size(self, mock_set_size):
+        """Test protection cache size is forwarded to the native library"""
+        mock_set_size.return_value = 0
+
+        self.assertEqual(ext_set_protection_cache_size(128), 0)
+        mock_set_size.assert_called_once_with(128)
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_protection_cache_stats')
+    def test_ext_get_protection_cache_stats(self, mock_get_stats, mock_create_buffer):
+        """Test protection cache counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "hits": 999, "misses": 1, "evictions": 0, "size": 1, "capacity": 64
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_protection_cache_stats()
+
+        self.assertEqual(result["hits"], 999)
+        self.assertEqual(result["capacity"], 64)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_buffer_pool_stats')
+    def test_ext_get_buffer_pool_stats(self, mock_get_stats, mock_create_buffer):
+        """Test buffer pool counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "hits": 120, "misses": 3, "oversized": 1,
+            "retained_bytes": 4194304, "max_retained_bytes": 268435456
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_buffer_pool_stats()
+
+        self.assertEqual(result["hits"], 120)
+        self.assertEqual(result["retained_bytes"], 4194304)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.msip_configure_temp_files')
+    def test_ext_configure_temp_files(self, mock_configure):
+        """Test the temp file pool settings are passed through and negative sizes are rejected"""
+        mock_configure.return_value = 0
+
+        self.assertEqual(ext_configure_temp_files('/dev/shm/msip', 8, 64 << 20, '/var/tmp'), 0)
+        self.assertEqual(ext_configure_temp_files('/dev/shm/msip', -1), 1)
+        self.assertEqual(ext_configure_temp_files(''), 0)
+
+        self.assertEqual(mock_configure.call_args_list,
+                         [call(b'/dev/shm/msip', 8, 64 << 20, b'/var/tmp'), call(b'', 16, 0, b'')])
+
+    @patch('app.pubsub.external_functions._load_finished_ns', 1_500_000_000)
+    @patch('app.pubsub.external_functions._load_started_ns', 1_000_000_000)
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_startup_stats')
+    def test_ext_get_startup_stats(self, mock_get_stats, mock_create_buffer):
+        """Test the load time is split at the library's first constructor"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "constructor_time_ns": 1_400_000_000}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_startup_stats()
+
+        self.assertAlmostEqual(result["load_ms"], 500.0)
+        self.assertAlmostEqual(result["dynamic_link_ms"], 400.0)
+        self.assertAlmostEqual(result["static_init_ms"], 100.0)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.msip_get_allocator_stats')
+    def test_ext_get_allocator_stats(self, mock_get_stats, mock_create_buffer):
+        """Test allocator totals and arenas are parsed from the library result"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "allocator": "jemalloc", "allocated": 52428800, "active": 58720256,
+            "resident": 73400320, "mapped": 83886080, "retained": 10485760, "process_resident": 157286400,
+            "arenas": [{"index": 0, "allocated": 41943040, "mapped": 62914560, "threads": 9}]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_allocator_stats()
+
+        self.assertEqual(result["allocator"], "jemalloc")
+        self.assertEqual(result["arenas"][0]["threads"], 9)
+
+    @patch('app.pubsub.external_functions.ctypes.create_string_buffer')
+    @patch('app.pubsub.external_functions.msip_get_task_dispatcher_stats')
+    def test_ext_get_task_dispatcher_stats(self, mock_get_stats, mock_create_buffer):
+        """Test task dispatcher counters are parsed"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "workers": 8, "queue_depth": 2, "delayed": 1,
+            "executed": 40, "steals": 5, "cancelled": 0
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_get_stats.return_value = 0
+
+        result = ext_get_task_dispatcher_stats()
+
+        self.assertEqual(result["workers"], 8)
+        self.assertEqual(result["queue_depth"], 2)
+        self.assertEqual(result["steals"], 5)
+        mock_get_stats.assert_called_once_with(mock_buffer)
+
+    @patch('app.pubsub.external_functions.get_file_status_batch_binary')
+    def test_ext_get_file_status_batch_binary(self, mock_batch):
+        """Test binary statuses are read in place and decode to the same fields as the JSON batch"""
+        strings = b"/share/a.docx" + b"owner@contoso.com" + b"/share/b.docx" + b"Access denied"
+        records = struct.pack("<BBHIq", 1, 1 | 8, 0, 0, 1700000000) + struct.pack(
+            "<14I", 0, 13, 0, 0, 0, 0, 13, 17, 0, 0, 0, 0, 0, 0)
+        records += struct.pack("<BBHIq", 0, 0, 0, 0, 0) + struct.pack(
+            "<14I", 30, 13, 43, 13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+        encoded = b"MSR1" + struct.pack("<III", 2, 72, 16 + len(records)) + records + strings
+
+        def batch(paths, count, with_license, application_id, out, cap, needed):
+            ctypes.memmove(out, encoded + b"\0", len(encoded) + 1)
+            needed._obj.value = len(encoded) + 1
+            return 0
+        mock_batch.side_effect = batch
+
+        result = ext_get_file_status_batch_binary(["/share/a.docx", "/share/b.docx"], "test-app-id-123", with_license=True)
+
+        self.assertEqual(len(result), 2)
+        self.assertEqual(bytes(result.string(result.record(0).owner)), b"owner@contoso.com")
+        self.assertEqual(result[0], {"path": "/share/a.docx", "status": True, "protected": True, "labeled": False,
+                                     "protected_objects": False, "label_id": "", "owner": "owner@contoso.com",
+                                     "content_id": "", "template_id": "", "template_name": "", "issued_time": 1700000000})
+        self.assertEqual(result[1], {"path": "/share/b.docx", "status": False, "error": "Access denied"})
+        self.assertEqual(mock_batch.call_args[0][2], 1)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_batch')
+    @patch('app.pubsub.external_functions.msip_stream_batch_results')
+    def test_ext_iter_batch_results(self, mock_stream, mock_batch, mock_create_buffer):
+        """Test a streamed batch yields the lines written as files finish and stops streaming afterwards"""
+        lines = [
+            {"index": 1, "result": {"status": True, "path": "/share/b.docx", "error": ""}},
+            {"index": 0, "result": {"status": False, "path": "", "error": "Access denied"}}
+        ]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "streamed": 2, "bytes": 120, "flushes": 1, "dropped": 0,
+                                        "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_stream.return_value = 0
+
+        def batch(*args):
+            os.write(mock_stream.call_args[0][0], b''.join(json.dumps(line).encode() + b'\n' for line in lines))
+            return 0
+        mock_batch.side_effect = batch
+
+        files = ["/share/a.docx", "/share/b.docx"]
+        result = list(ext_iter_batch_results(lambda: ext_unprotect_file_batch(files, "test-app-id-123", "token")))
+
+        self.assertEqual(result, lines)
+        self.assertEqual(mock_stream.call_args_list[-1][0][0], -1)
+        self.assertEqual(mock_stream.call_count, 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.scan_tree')
+    def test_ext_iter_scan_tree(self, mock_scan, mock_create_buffer):
+        """Test a tree scan yields each status line the native walk writes to the pipe"""
+        statuses = [
+            {"protected": True, "labeled": False, "protected_objects": False, "path": "/share/a.docx", "status": True},
+            {"status": False, "error": "Permission denied", "path": "/share/private"}
+        ]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "directories": 2, "files": 1, "matched": 1, "errors": 1}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+
+        def scan(root, filters, fd, application_id, *args):
+            os.write(fd, b''.join(json.dumps(status).encode() + b'\n' for status in statuses))
+            return 0
+        mock_scan.side_effect = scan
+
+        result = list(ext_iter_scan_tree("/share", "test-app-id-123", "docx"))
+
+        self.assertEqual(result, statuses)
+        args = mock_scan.call_args[0]
+        self.assertEqual(args[0], b"/share")
+        self.assertEqual(args[1], b"docx")
+        self.assertEqual(args[3], b"test-app-id-123")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.scan_tree_incremental')
+    def test_ext_iter_scan_tree_incremental(self, mock_scan, mock_create_buffer):
+        """Test an incremental scan passes the journal path and yields only the changes"""
+        changes = [
+            {"protected": True, "labeled": True, "protected_objects": False, "change": "modified",
+             "label_id": "label-1", "path": "/share/a.docx", "status": True},
+            {"change": "removed", "path": "/share/b.docx", "status": True}
+        ]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "files": 5, "matched": 5, "errors": 0, "added": 0,
+                                        "modified": 1, "unchanged": 4, "removed": 1}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+
+        def scan(root, filters, fd, journal_path, application_id, *args):
+            os.write(fd, b''.join(json.dumps(change).encode() + b'\n' for change in changes))
+            return 0
+        mock_scan.side_effect = scan
+
+        result = list(ext_iter_scan_tree_incremental("/share", "test-app-id-123", "/var/lib/msip/share.db"))
+
+        self.assertEqual(result, changes)
+        args = mock_scan.call_args[0]
+        self.assertEqual(args[0], b"/share")
+        self.assertEqual(args[1], b"")
+        self.assertEqual(args[3], b"/var/lib/msip/share.db")
+        self.assertEqual(args[4], b"test-app-id-123")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.get_file_status_batch')
+    def test_ext_get_file_status_batch_success(self, mock_batch, mock_create_buffer):
+        """Test a batch status call passes every path and returns the per-file array"""
+        files = ["/test/a.docx", "/test/b.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"protected": True, "labeled": False, "protected_objects": False, "path": files[0], "status": True},
+            {"status": False, "error": "not found", "path": files[1]}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_batch.return_value = 0
+
+        result = ext_get_file_status_batch(files, "test-app-id-123")
+
+        self.assertEqual(len(result), 2)
+        self.assertTrue(result[0]["protected"])
+        self.assertFalse(result[1]["status"])
+        args = mock_batch.call_args[0]
+        self.assertEqual([args[0][i].decode() for i in range(2)], files)
+        self.assertEqual(args[1], 2)
+        self.assertEqual(args[2].decode(), "test-app-id-123")
+        self.assertEqual(args[3], mock_buffer)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_batch')
+    def test_ext_unprotect_file_batch_setup_error(self, mock_batch, mock_create_buffer):
+        """Test a shared setup failure is reported against every file"""
+        files = ["/test/a.docx", "/test/b.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": False, "path": "", "error": "Auth failed"}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_batch.return_value = 1
+
+        result = ext_unprotect_file_batch(files, "test-app-id-123", "test-scc-token-456")
+
+        self.assertEqual([r["path"] for r in result], files)
+        self.assertTrue(all(r["error"] == "Auth failed" for r in result))
+        self.assertEqual(mock_batch.call_args[0][0].decode(), "test-scc-token-456")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.prefetch_licenses')
+    def test_ext_prefetch_licenses(self, mock_prefetch, mock_create_buffer):
+        """Test a prefetch passes every path and returns the license counts"""
+        files = ["/test/a.docx", "/test/b.docx", "/test/c.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "files": 3, "licenses": 1, "cached": 0, "acquired": 1, "shared": 2, "errors": []
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_prefetch.return_value = 0
+
+        result = ext_prefetch_licenses(files, "test-app-id-123", "test-scc-token-456")
+
+        self.assertEqual(result["licenses"], 1)
+        self.assertEqual(result["acquired"], 1)
+        self.assertEqual(result["shared"], 2)
+        self.assertEqual(mock_prefetch.call_args[0][0].decode(), "test-scc-token-456")
+        self.assertEqual(list(mock_prefetch.call_args[0][1]), [f.encode() for f in files])
+        self.assertEqual(mock_prefetch.call_args[0][2], 3)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.plan_batch')
+    def test_ext_plan_batch(self, mock_plan, mock_create_buffer):
+        """Test a plan passes every path and returns the estimate"""
+        files = ["/test/a.docx", "/test/b.pdf"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "files": 2, "bytes": 300, "protected": 1, "licenses": 1, "expected_license_calls": 1,
+            "license_samples": ["/test/a.docx"], "failures": []
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_plan.return_value = 0
+
+        result = ext_plan_batch(files, "test-app-id-123")
+
+        self.assertEqual(result["expected_license_calls"], 1)
+        self.assertEqual(result["license_samples"], ["/test/a.docx"])
+        self.assertEqual(list(mock_plan.call_args[0][0]), [f.encode() for f in files])
+        self.assertEqual(mock_plan.call_args[0][1], 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.check_delegated_access')
+    def test_ext_check_delegated_access(self, mock_check, mock_create_buffer):
+        """Test every user is passed and per-user access results are returned"""
+        users = ["alice@example.com", "bob@example.com"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "path": "/test/a.docx", "content_id": "cid", "right": "VIEW",
+            "results": [
+                {"user": users[0], "allowed": True, "rights": ["VIEW"], "cached": False, "error": ""},
+                {"user": users[1], "allowed": False, "rights": [], "cached": False, "error": "No delegation license was issued for the user"}
+            ]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_check.return_value = 0
+
+        result = ext_check_delegated_access("/test/a.docx", users, "VIEW", "test-app-id-123", "test-scc-token-456")
+
+        self.assertEqual([r["allowed"] for r in result["results"]], [True, False])
+        self.assertEqual(mock_check.call_args[0][1].decode(), "/test/a.docx")
+        self.assertEqual(list(mock_check.call_args[0][2]), [u.encode() for u in users])
+        self.assertEqual(mock_check.call_args[0][3], 2)
+        self.assertEqual(mock_check.call_args[0][4].decode(), "VIEW")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.list_templates')
+    def test_ext_list_templates(self, mock_list, mock_create_buffer):
+        """Test the user is passed and the catalogue's templates are returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "age_seconds": 42,
+            "templates": [{"id": "tid", "name": "Confidential - View Only", "description": "", "owner_full_access": True}]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_list.return_value = 0
+
+        result = ext_list_templates("test-app-id-123", "test-scc-token-456", "alice@example.com")
+
+        self.assertEqual(result["templates"][0]["id"], "tid")
+        self.assertEqual(mock_list.call_args[0][1].decode(), "alice@example.com")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.revoke_content')
+    def test_ext_revoke_content(self, mock_revoke, mock_create_buffer):
+        """Test every file is passed and per-file revocation results are returned"""
+        files = ["/test/a.docx", "/test/b.txt"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "succeeded": 1, "failed": 1,
+            "results": [
+                {"path": files[0], "content_id": "cid", "status": True, "error": ""},
+                {"path": files[1], "content_id": "", "status": False, "error": "File is not protected"}
+            ]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_revoke.return_value = 0
+
+        result = ext_revoke_content(files, "test-app-id-123", "test-scc-token-456")
+
+        self.assertEqual([r["status"] for r in result["results"]], [True, False])
+        self.assertEqual(list(mock_revoke.call_args[0][1]), [f.encode() for f in files])
+        self.assertEqual(mock_revoke.call_args[0][2], 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.check_rights')
+    def test_ext_check_rights(self, mock_check, mock_create_buffer):
+        """Test the user and every right are passed and the cached answer is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "path": "/test/a.docx", "content_id": "cid", "user": "alice@example.com",
+            "allowed": False, "checks": [{"right": "VIEW", "allowed": True}, {"right": "EXPORT", "allowed": False}],
+            "rights": ["VIEW"], "cached": True, "error": ""
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_check.return_value = 0
+
+        result = ext_check_rights("/test/a.docx", "alice@example.com", ["VIEW", "EXPORT"], "test-app-id-123", "test-scc-token-456")
+
+        self.assertFalse(result["allowed"])
+        self.assertTrue(result["cached"])
+        self.assertEqual(mock_check.call_args[0][2].decode(), "alice@example.com")
+        self.assertEqual(list(mock_check.call_args[0][3]), [b"VIEW", b"EXPORT"])
+        self.assertEqual(mock_check.call_args[0][4], 2)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_offline')
+    def test_ext_protect_file_offline(self, mock_protect, mock_create_buffer):
+        """Test the template and user are passed and the commit result is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/test/a_modified.docx", "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+
+        data = ProtectTemplateFileData(file="/test/a.docx", application_id="test-app-id-123", scc_token="test-scc-token-456",
+                                       user="alice@example.com", template_id="tpl-1")
+        result = ext_protect_file_offline(data)
+
+        self.assertTrue(result["status"])
+        self.assertEqual(mock_protect.call_args[0][1].decode(), "/test/a.docx")
+        self.assertEqual(mock_protect.call_args[0][2].decode(), "tpl-1")
+        self.assertEqual(mock_protect.call_args[0][3].decode(), "alice@example.com")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_batch')
+    def test_ext_protect_file_batch_invalid_json(self, mock_batch, mock_create_buffer):
+        """Test an unparsable batch result yields one error per file"""
+        files = ["/test/a.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = self.invalid_json_response
+        mock_create_buffer.return_value = mock_buffer
+        mock_batch.return_value = 0
+
+        result = ext_protect_file_batch(files, "test-app-id-123", "test-scc-token-456", "test-user", "/test/ref.docx")
+
+        self.assertEqual(len(result), 1)
+        self.assertFalse(result[0]["status"])
+        self.assertEqual(result[0]["path"], files[0])
+        args = mock_batch.call_args[0]
+        self.assertEqual(args[3].decode(), "/test/ref.docx")
+        self.assertEqual(args[4].decode(), "test-user")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_to_fd')
+    def test_ext_unprotect_file_to_fd(self, mock_unprotect, mock_create_buffer):
+        """Test the output descriptor is passed through and the byte count is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 1024, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_unprotect.return_value = 0
+
+        result = ext_unprotect_file_to_fd(self.unprotect_data, 7)
+
+        self.assertEqual(result["bytes"], 1024)
+        args = mock_unprotect.call_args[0]
+        self.assertEqual(args[0].decode(), "test-scc-token-456")
+        self.assertEqual(args[1].decode(), "/test/path/document.docx")
+        self.assertEqual(args[2], 7)
+        self.assertEqual(args[3].decode(), "test-app-id-123")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_to_fd')
+    def test_ext_protect_file_to_fd(self, mock_protect, mock_create_buffer):
+        """Test the reference file, user and output descriptor are passed through"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 2048, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+
+        result = ext_protect_file_to_fd(self.protect_data, 9)
+
+        self.assertEqual(result["bytes"], 2048)
+        args = mock_protect.call_args[0]
+        self.assertEqual(args[2].decode(), "encrypted-content-base64")
+        self.assertEqual(args[3].decode(), "test-user")
+        self.assertEqual(args[5], 9)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_to')
+    def test_ext_unprotect_file_to_path(self, mock_unprotect, mock_create_buffer):
+        """Test the destination is passed through and replacing the input sets its flag"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/out/document.docx", "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_unprotect.return_value = 0
+
+        result = ext_unprotect_file_to_path(self.unprotect_data, "/out/")
+
+        self.assertEqual(result["path"], "/out/document.docx")
+        args = mock_unprotect.call_args[0]
+        self.assertEqual(args[1].decode(), "/test/path/document.docx")
+        self.assertEqual(args[3].decode(), "/out/")
+        self.assertEqual(args[4], 0)
+
+        ext_unprotect_file_to_path(self.unprotect_data, replace_input=True)
+        self.assertEqual(mock_unprotect.call_args[0][4], 1)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_to')
+    def test_ext_protect_file_to_path(self, mock_protect, mock_create_buffer):
+        """Test the reference file, user and destination are passed through"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/out/protected.docx", "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+
+        result = ext_protect_file_to_path(self.protect_data, "/out/protected.docx")
+
+        self.assertEqual(result["path"], "/out/protected.docx")
+        args = mock_protect.call_args[0]
+        self.assertEqual(args[2].decode(), "encrypted-content-base64")
+        self.assertEqual(args[3].decode(), "test-user")
+        self.assertEqual(args[5].decode(), "/out/protected.docx")
+        self.assertEqual(args[6], 0)
+
+    @patch('app.pubsub.external_functions.msip_take_output')
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_to_buffer')
+    def test_ext_unprotect_file_to_bytes(self, mock_unprotect, mock_create_buffer, mock_take_output):
+        """Test output that fits the buffer is returned without fetching it again"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 5, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+
+        def unprotect(*args):
+            output, output_size = args[3], args[5]
+            output[:5] = b"plain"
+            output_size._obj.value = 5
+            return 0
+        mock_unprotect.side_effect = unprotect
+
+        result, content = ext_unprotect_file_to_bytes(self.unprotect_data)
+
+        self.assertTrue(result["status"])
+        self.assertEqual(content, b"plain")
+        mock_take_output.assert_not_called()
+
+    @patch('app.pubsub.external_functions.OUTPUT_BUFFER_SLACK', 4)
+    @patch('app.pubsub.external_functions.msip_take_output')
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_to_buffer')
+    def test_ext_protect_file_to_bytes_fetches_overflow(self, mock_protect, mock_create_buffer, mock_take_output):
+        """Test output larger than the buffer is fetched with msipTakeOutput instead of protecting again"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 10, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+
+        def protect(*args):
+            args[7]._obj.value = 10
+            return 0
+        mock_protect.side_effect = protect
+
+        def take_output(output, capacity, output_size):
+            output[:10] = b"0123456789"
+            output_size._obj.value = 10
+            return 0
+        mock_take_output.side_effect = take_output
+
+        result, content = ext_protect_file_to_bytes(self.protect_data)
+
+        self.assertEqual(content, b"0123456789")
+        self.assertEqual(mock_protect.call_count, 1)
+        self.assertEqual(mock_take_output.call_args[0][1], 10)
+
+    @patch('app.pubsub.external_functions.OUTPUT_BUFFER_SLACK', 4)
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_buffer_to_buffer')
+    def test_ext_unprotect_buffer(self, mock_unprotect, mock_create_buffer):
+        """Test in-memory content is passed in place with its size, and the output is sized to it"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 5, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        calls = []
+
+        def unprotect(*args):
+            input_data, input_size, output = args[1], args[2], args[5]
+            calls.append((bytes(input_data)[:input_size], args[3], len(output)))
+            output[:5] = b"plain"
+            args[7]._obj.value = 5
+            return 0
+        mock_unprotect.side_effect = unprotect
+
+        content = bytearray(b"\x00protected")
+        self.assertEqual(ext_unprotect_buffer(self.unprotect_data, content)[1], b"plain")
+        self.assertEqual(ext_unprotect_buffer(self.unprotect_data, memoryview(bytes(content)))[1], b"plain")
+
+        expected = (bytes(content), self.unprotect_data.file.encode(), len(content) + 4)
+        self.assertEqual(calls, [expected, expected])
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_shared_memory')
+    def test_ext_unprotect_file_over_shared_memory(self, mock_unprotect, mock_create_buffer):
+        """Test shm_input requests pass the named segments' descriptors and close them afterwards"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "", "bytes": 5, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        opened = []
+
+        def unprotect(token, input_fd, name_hint, application_id, output_fd, *args):
+            opened.extend([input_fd, output_fd])
+            self.assertEqual(os.read(input_fd, 16), b"protected")
+            os.write(output_fd, b"plain")
+            return 0
+        mock_unprotect.side_effect = unprotect
+
+        with tempfile.TemporaryDirectory() as shm_dir, \
+                patch('app.pubsub.external_functions.settings.MSIP_SHM_DIR', shm_dir):
+            with open(os.path.join(shm_dir, "in"), "wb") as segment:
+                segment.write(b"protected")
+            open(os.path.join(shm_dir, "out"), "wb").close()
+            data = UnprotectFileData(file="report.docx", application_id="app", scc_token="token",
+                                     shm_input="/in", shm_output="out")
+
+            self.assertTrue(ext_unprotect_file(data)["status"])
+            with open(os.path.join(shm_dir, "out"), "rb") as segment:
+                self.assertEqual(segment.read(), b"plain")
+
+            invalid = UnprotectFileData(file="report.docx", application_id="app", scc_token="token",
+                                        shm_input="../in", shm_output="out")
+            result = ext_unprotect_file(invalid)
+
+        self.assertFalse(result["status"])
+        self.assertEqual(mock_unprotect.call_count, 1)
+        self.assertEqual(mock_unprotect.call_args[0][2], b"report.docx")
+        for fd in opened:
+            with self.assertRaises(OSError):
+                os.fstat(fd)
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_detached')
+    def test_ext_protect_file_detached(self, mock_protect, mock_create_buffer):
+        """Test default output paths are sent empty and the license path is returned"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "path": "/test/path/document.docx.enc",
+            "license_path": "/test/path/document.docx.enc.pl", "bytes": 4112, "error": ""
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+
+        result = ext_protect_file_detached(self.protect_data)
+
+        self.assertEqual(result["license_path"], "/test/path/document.docx.enc.pl")
+        args = mock_protect.call_args[0]
+        self.assertEqual(args[5], b"")
+        self.assertEqual(args[6], b"")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.unprotect_file_detached')
+    def test_ext_unprotect_file_detached(self, mock_unprotect, mock_create_buffer):
+        """Test the license path is passed through and an absent output path is sent empty"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/test/path/document.docx.enc.dec",
+                                        "bytes": 4096, "error": ""}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_unprotect.return_value = 0
+
+        result = ext_unprotect_file_detached(self.unprotect_data, "/test/path/document.pl")
+
+        self.assertEqual(result["bytes"], 4096)
+        args = mock_unprotect.call_args[0]
+        self.assertEqual(args[2], b"/test/path/document.pl")
+        self.assertEqual(args[4], b"")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_with_template')
+    def test_ext_protect_file_with_template(self, mock_protect, mock_create_buffer):
+        """Test a template id is passed through and an absent label id is sent empty"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({"status": True, "path": "/test/path/document_modified.docx"}).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+        data = ProtectTemplateFileData(
+            file="/test/path/document.docx",
+            application_id="test-app-id-123",
+            scc_token="test-scc-token-456",
+            user="test-user",
+            template_id="tpl-1"
+        )
+
+        result = ext_protect_file_with_template(data)
+
+        self.assertTrue(result["status"])
+        args = mock_protect.call_args[0]
+        self.assertEqual(args[1].decode(), "/test/path/document.docx")
+        self.assertEqual(args[2].decode(), "tpl-1")
+        self.assertEqual(args[3].decode(), "")
+        self.assertEqual(args[4].decode(), "test-user")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_file_with_template_batch')
+    def test_ext_protect_file_with_template_batch(self, mock_batch, mock_create_buffer):
+        """Test a label-based batch returns one result per file"""
+        files = ["/test/a.docx", "/test/b.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"status": True, "path": "/test/a_modified.docx"},
+            {"status": False, "error": "boom", "path": ""}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_batch.return_value = 0
+
+        result = ext_protect_file_with_template_batch(files, "test-app-id-123", "test-scc-token-456", "test-user", label_id="lbl-1")
+
+        self.assertEqual(len(result), 2)
+        args = mock_batch.call_args[0]
+        self.assertEqual(args[2], 2)
+        self.assertEqual(args[3].decode(), "")
+        self.assertEqual(args[4].decode(), "lbl-1")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.protect_files_with_permissions')
+    def test_ext_protect_files_with_permissions(self, mock_protect, mock_create_buffer):
+        """Test grants are encoded as users:permissions and the flags are passed through"""
+        files = ["/test/a.docx", "/test/b.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"status": True, "path": "/test/a_modified.docx"},
+            {"status": True, "path": "/test/b_modified.docx"}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_protect.return_value = 0
+
+        result = ext_protect_files_with_permissions(
+            files, "test-app-id-123", "test-scc-token-456", "test-user",
+            {("a@contoso.com", "b@contoso.com"): ["VIEW", "EDIT"], "c@contoso.com": ["VIEW"]},
+            valid_until=1700000000, allow_offline_access=False)
+
+        self.assertEqual(len(result), 2)
+        args = mock_protect.call_args[0]
+        self.assertEqual(args[2], 2)
+        self.assertEqual([args[3][i] for i in range(args[4])],
+                         [b"a@contoso.com,b@contoso.com:VIEW,EDIT", b"c@contoso.com:VIEW"])
+        self.assertEqual(args[5:8], (0, 1700000000, 0))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.label_files')
+    def test_ext_label_files(self, mock_label_files, mock_create_buffer):
+        """Test the assignment method is mapped to its code and one result comes back per file"""
+        files = ["/test/a.docx", "/test/b.docx"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"status": True, "path": "/test/a_modified.docx", "error": ""},
+            {"status": False, "path": "", "error": "No changes to commit"}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_label_files.return_value = 0
+
+        result = ext_label_files(files, "lbl-1", "test-app-id-123", "test-scc-token-456", method="privileged")
+
+        self.assertEqual(len(result), 2)
+        args = mock_label_files.call_args[0]
+        self.assertEqual(args[2], 2)
+        self.assertEqual(args[3].decode(), "lbl-1")
+        self.assertEqual(args[4], 1)
+
+        with self.assertRaises(ValueError):
+            ext_label_files(files, "lbl-1", "test-app-id-123", "test-scc-token-456", method="manual")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.label_files_by_label')
+    def test_ext_label_files_by_label(self, mock_label_files, mock_create_buffer):
+        """Test each file is passed with its own label, in the order of the mapping"""
+        labels = {"/test/a.docx": "lbl-1", "/test/b.pdf": "lbl-2", "/test/c.docx": "lbl-1"}
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"status": True, "path": "/test/a_modified.docx", "error": ""},
+            {"status": True, "path": "/test/b_modified.pdf", "error": ""},
+            {"status": False, "path": "", "error": "No changes to commit"}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_label_files.return_value = 0
+
+        result = ext_label_files_by_label(labels, "test-app-id-123", "test-scc-token-456")
+
+        self.assertEqual(len(result), 3)
+        args = mock_label_files.call_args[0]
+        self.assertEqual([args[1][i] for i in range(3)], [b"/test/a.docx", b"/test/b.pdf", b"/test/c.docx"])
+        self.assertEqual([args[2][i] for i in range(3)], [b"lbl-1", b"lbl-2", b"lbl-1"])
+        self.assertEqual(args[3:5], (3, 0))
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.compute_label_actions')
+    def test_ext_compute_label_actions(self, mock_compute, mock_create_buffer):
+        """Test the prior label, content format and method are passed and the plan comes back"""
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps({
+            "status": True, "cached": False, "changes": True, "requires_justification": True,
+            "actions": [{"type": "justify"}, {"type": "metadata", "add": [], "remove": []}]
+        }).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_compute.return_value = 0
+
+        result = ext_compute_label_actions("lbl-1", "test-app-id-123", "test-scc-token-456",
+                                           prior_label_id="lbl-2", content_format="email", method="auto")
+
+        self.assertTrue(result["requires_justification"])
+        self.assertEqual(result["actions"][0]["type"], "justify")
+        args = mock_compute.call_args[0]
+        self.assertEqual([a.decode() for a in args[1:4]], ["lbl-1", "lbl-2", "email"])
+        self.assertEqual(args[4], 2)
+
+        with self.assertRaises(ValueError):
+            ext_compute_label_actions("lbl-1", "test-app-id-123", "test-scc-token-456", method="manual")
+
+    @patch('app.pubsub.external_functions._result_buffer')
+    @patch('app.pubsub.external_functions.classify_files')
+    def test_ext_classify_files(self, mock_classify_files, mock_create_buffer):
+        """Test classification passes the paths and returns the actions and types per file"""
+        files = ["/test/a.docx", "/test/b.txt"]
+        mock_buffer = MagicMock()
+        mock_buffer.value = json.dumps([
+            {"status": True, "path": "/test/a.docx", "classified": True,
+             "actions": [{"type": "recommend_label", "label_id": "lbl-1", "classification_ids": ["e-1"]}],
+             "sensitivity_types": [{"id": "e-1", "name": "Credit Card Number", "count": 3, "confidence": 85}]},
+            {"status": True, "path": "/test/b.txt", "classified": True, "actions": [], "sensitivity_types": []}
+        ]).encode('utf-8')
+        mock_create_buffer.return_value = mock_buffer
+        mock_classify_files.return_value = 0
+
+        result = ext_classify_files(files, "test-app-id-123", "test-scc-token-456", user="user@example.com")
+
+        self.assertEqual(result[0]["sensitivity_types"][0]["count"], 3)
+        self.assertEqual(result[1]["actions"], [])
+        args = mock_classify_files.call_args[0]
+        self.assertEqual(args[2], 2)
+        self.assertEqual(args[3], b"user@example.com")
+
+    @patch('app.pubsub.external_functions.msip_take_result')
+    @patch('app.pubsub.external_functions.get_file_status')
+    def test_ext_get_file_status_grows_buffer(self, mock_get_file_status, mock_take_result):
+        """Test an oversized result is fetched into a larger buffer without rerunning the call"""
+        large_response = json.dumps({
+            "status": False,
+            "path": "/test/path/document.docx",
+            "error": "x" * 10000
+        }).encode('utf-8')
+
+        def too_small(file_arg, app_id_arg, buffer_arg, cap, needed):
+            needed._obj.value = len(large_response) + 1
+            return 2
+
+        def take_result(buffer_arg, cap, needed):
+            self.assertGreaterEqual(cap, len(large_response) + 1)
+            buffer_arg.value = large_response
+            return 1
+
+        mock_get_file_status.side_effect = too_small
+        mock_take_result.side_effect = take_result
+
+        result = ext_get_file_status(self.file_data)
+
+        self.assertFalse(result["status"])
+        self.assertEqual(len(result["error"]), 10000)
+        mock_get_file_status.assert_called_once()
+        mock_take_result.assert_called_once()
+
+    @patch('app.pubsub.external_functions.unprotect_file_async')
+    @patch('app.pubsub.external_functions.open_completion_queue', return_value=0)
+    def test_ext_unprotect_file_async_success(self, mock_open_queue, mock_unprotect_async):
+        """Test the async unprotect resolves when the library callback fires from another thread"""
+        def start(token_arg, file_arg, app_id_arg, callback, call_id):
+            self.assertEqual(token_arg.decode(), self.unprotect_data.scc_token)
+            self.assertEqual(file_arg.decode(), self.unprotect_data.file)
+            threading.Thread(target=_on_async_result, args=(0, self.success_response, call_id)).start()
+            return 0
+
+        mock_unprotect_async.side_effect = start
+
+        result = asyncio.run(ext_unprotect_file_async(self.unprotect_data))
+
+        self.assertTrue(result["status"])
+        self.assertEqual(result["path"], "/test/path/document.docx")
+        mock_unprotect_async.assert_called_once()
+
+    @patch('app.pubsub.external_functions.protect_file_async')
+    @patch('app.pubsub.external_functions.open_completion_queue', return_value=0)
+    def test_ext_protect_file_async_setup_failure(self, mock_open_queue, mock_protect_async):
+        """Test a callback fired before the export returns still resolves the call"""
+        def start(token_arg, file_arg, enc_arg, user_arg, app_id_arg, callback, call_id):
+            self.assertEqual(enc_arg.decode(), self.protect_data.encrypted_file)
+            self.assertEqual(user_arg.decode(), self.protect_data.user)
+            _on_async_result(1, self.error_response, call_id)
+            return 1
+
+        mock_protect_async.side_effect = start
+
+        result = asyncio.run(ext_protect_file_async(self.protect_data))
+
+        self.assertFalse(result["status"])
+        self.assertEqual(result["error"], "Access denied")
+
+    @patch('app.pubsub.external_functions.unprotect_file_async')
+    @patch('app.pubsub.external_functions.open_completion_queue', return_value=0)
+    def test_ext_unprotect_file_async_invalid_json(self, mock_open_queue, mock_unprotect_async):
+        """Test an unparsable async result is reported with the raw payload"""
+        def start(token_arg, file_arg, app_id_arg, callback, call_id):
+            _on_async_result(0, self.invalid_json_response, call_id)
+            return 0
+
+        mock_unprotect_async.side_effect = start
+
+        result = asyncio.run(ext_unprotect_file_async(self.unprotect_data))
+
+        self.assertFalse(result["status"])
+        self.assertEqual(result["path"], self.unprotect_data.file)
+        self.assertEqual(result["raw"], self.invalid_json_response)
+
+    @patch('app.pubsub.external_functions.take_completions')
+    @patch('app.pubsub.external_functions.open_completion_queue')
+    @patch('app.pubsub.external_functions.unprotect_file_async')
+    def test_ext_unprotect_file_async_completion_queue(self, mock_unprotect_async, mock_open_queue, mock_take):
+        """Test concurrent async calls resolve from one drain of the loop's completion queue"""
+        read_fd, write_fd = os.pipe()
+        queued = []
+
+        def open_queue(fd_ref):
+            fd_ref._obj.value = read_fd
+            return 7
+
+        def start(token_arg, file_arg, app_id_arg, callback, user_data):
+            self.assertEqual(user_data >> 48, 7)
+            queued.append(user_data & ((1 << 48) - 1))
+            if len(queued) == 2:
+                os.write(write_fd, b'x')
+            return 0
+
+        def take(queue, buffer, cap, written, remaining):
+            # The first take returns one record and reports the other as still queued
+            if len(queued) == 2:
+                os.read(read_fd, 1)
+            record = struct.pack('=QiI', queued.pop(0), 0, len(self.success_response)) + self.success_response
+            ctypes.memmove(buffer, record, len(record))
+            written._obj.value = len(record)
+            remaining._obj.value = len(record) if queued else 0
+            return 0
+
+        mock_open_queue.side_effect = open_queue
+        mock_unprotect_async.side_effect = start
+        mock_take.side_effect = take
+
+        async def run_both():
+            return await asyncio.gather(ext_unprotect_file_async(self.unprotect_data),
+                                        ext_unprotect_file_async(self.unprotect_data))
+
+        try:
+            results = asyncio.run(run_both())
+        finally:
+            os.close(read_fd)
+            os.close(write_fd)
+
+        self.assertTrue(all(r["status"] for r in results))
+        mock_open_queue.assert_called_once()
+        self.assertEqual(mock_take.call_count, 2)
+
@@ -606,3 +606,116 @@ class TestUnprotectFile(unittest.TestCase):
         mock_req_latency.labels.assert_called_with(method='unprotect_file')
         mock_req_latency.labels.return_value.observe.assert_called_once()
 
+
+
+class TestRequestDeadline(unittest.TestCase):
+
+    @patch('app.pubsub.internal_functions.ext_set_deadline')
+    def test_request_deadline_uses_grpc_timeout(self, mock_set_deadline):
+        request = MagicMock(spec=InvokeMethodRequest)
+        request.metadata = {"grpc-timeout": ["2S"]}
+
+        with app.pubsub.internal_functions.request_deadline(request):
+            pass
+
+        self.assertEqual(mock_set_deadline.call_args_list, [call(2000), call(0)])
+
+    @patch('app.pubsub.internal_functions.settings')
+    @patch('app.pubsub.internal_functions.ext_set_deadline')
+    def test_request_deadline_without_timeout(self, mock_set_deadline, mock_settings):
+        mock_settings.MSIP_REQUEST_TIMEOUT_MS = 0
+        request = MagicMock(spec=InvokeMethodRequest)
+        request.metadata = {"grpc-timeout": ["soon"]}
+
+        with app.pubsub.internal_functions.request_deadline(request):
+            pass
+
+        mock_set_deadline.assert_not_called()
+
+    @patch('app.pubsub.internal_functions.ext_set_idempotency_key')
+    def test_idempotency_key_from_header(self, mock_set_key):
+        request = MagicMock(spec=InvokeMethodRequest)
+        request.metadata = {"Idempotency-Key": ["retry-1"]}
+
+        with app.pubsub.internal_functions.idempotency(request):
+            pass
+
+        self.assertEqual(mock_set_key.call_args_list, [call('retry-1'), call('')])
+
+    @patch('app.pubsub.internal_functions.ext_set_idempotency_key')
+    def test_no_idempotency_key_without_header(self, mock_set_key):
+        request = MagicMock(spec=InvokeMethodRequest)
+        request.metadata = {"Content-Type": "application/json"}
+
+        with app.pubsub.internal_functions.idempotency(request):
+            pass
+
+        mock_set_key.assert_not_called()
+
+    @patch('app.pubsub.internal_functions.metrics_batch_size')
+    @patch('app.pubsub.internal_functions.ext_set_priority')
+    def test_event_batches_run_as_bulk(self, mock_set_priority, mock_batch_size):
+        run_group = MagicMock(side_effect=lambda key, files: [{"path": f} for f in files])
+
+        outcomes = app.pubsub.internal_functions._run_grouped(
+            'inspect_file', [FileData(file="/a.docx", application_id="app-1")], lambda d: (d.application_id,), run_group)
+
+        self.assertEqual(outcomes, [{"path": "/a.docx"}])
+        self.assertEqual(mock_set_priority.call_args_list, [call('bulk'), call('interactive')])
+
+
+class TestFileEvents(unittest.TestCase):
+
+    def _event(self, payload):
+        event = MagicMock()
+        event.Data.return_value = payload if isinstance(payload, str) else json.dumps(payload)
+        return event
+
+    def _collector(self, size):
+        functions = app.pubsub.internal_functions
+        return functions.BatchCollector(lambda items: functions._run_grouped(
+            'inspect_file', items, lambda d: (d.application_id,),
+            lambda k, files: functions.ext_get_file_status_batch(files, *k)), size, 10000)
+
+    @patch('app.pubsub.internal_functions.metrics_batch_size')
+    @patch('app.pubsub.internal_functions.ext_get_file_status_batch')
+    def test_file_events_share_one_batch_call(self, mock_batch, mock_batch_size):
+        """Test concurrent messages run as one native batch per application id and are acked one by one"""
+        import threading
+        mock_batch.side_effect = lambda files, application_id: [
+            {"path": f, "status": f != "/bad.docx"} for f in files]
+        payloads = [{"file": "/a.docx", "application_id": "app-1"},
+                    {"file": "/bad.docx", "application_id": "app-1"},
+                    {"file": "/b.docx", "application_id": "app-2"}]
+        responses = [None] * len(payloads)
+
+        def deliver(index):
+            responses[index] = app.pubsub.internal_functions.handle_file_event('inspect_file', self._event(payloads[index]))
+
+        with patch.dict(app.pubsub.internal_functions._event_operations,
+                        {'inspect_file': (FileData, self._collector(len(payloads)))}):
+            threads = [threading.Thread(target=deliver, args=(i,)) for i in range(len(payloads))]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+
+        self.assertEqual([r.status for r in responses], ['success', 'drop', 'success'])
+        self.assertEqual(sorted((sorted(c.args[0]), c.args[1]) for c in mock_batch.call_args_list), [
+            (["/a.docx", "/bad.docx"], "app-1"), (["/b.docx"], "app-2")])
+        mock_batch_size.labels.return_value.observe.assert_called_once_with(3)
+
+    @patch('app.pubsub.internal_functions.ext_get_file_status_batch')
+    def test_file_event_invalid_or_overloaded(self, mock_batch):
+        """Test malformed messages are dropped and messages of an overloaded batch are redelivered"""
+        mock_batch.side_effect = app.pubsub.internal_functions.ResourceExhaustedError("Too many operations in flight")
+
+        with patch.dict(app.pubsub.internal_functions._event_operations,
+                        {'inspect_file': (FileData, self._collector(1))}):
+            invalid = app.pubsub.internal_functions.handle_file_event('inspect_file', self._event("not json"))
+            missing = app.pubsub.internal_functions.handle_file_event('inspect_file', self._event({"file": "/a.docx"}))
+            overloaded = app.pubsub.internal_functions.handle_file_event(
+                'inspect_file', self._event({"file": "/a.docx", "application_id": "app-1"}))
+
+        self.assertEqual((invalid.status, missing.status, overloaded.status), ('drop', 'drop', 'retry'))
+        mock_batch.assert_called_once_with(["/a.docx"], "app-1")
@@ -0,0 +1,298 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "bench_harness.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace bench {
+
+namespace {
+
+struct Benchmark {
+  string name;
+  Function function;
+};
+
+struct Result {
+  string name;
+  int64_t iterations;
+  double realNanos;
+  double cpuNanos;
+  double bytesPerSecond;
+  double itemsPerSecond;
+  string error;
+  map<string, double> counters;
+};
+
+// Function-local statics, since registrations run during static initialization of other files.
+vector<Benchmark>& Registry() {
+  static vector<Benchmark> registry;
+  return registry;
+}
+
+map<string, string>& Options() {
+  static map<string, string> options;
+  return options;
+}
+
+static const int64_t kMaxIterations = 1000000000;
+
+Result Measure(const Benchmark& benchmark, double minSeconds) {
+  int64_t iterations = 1;
+  while (true) {
+    State state(iterations);
+    benchmark.function(state);
+    Result result = { benchmark.name, iterations, 0, 0, 0, 0, state.error(), state.counters() };
+    if (!state.error().empty())
+      return result;
+    const double seconds = state.realSeconds();
+    if (seconds >= minSeconds || iterations >= kMaxIterations) {
+      result.realNanos = seconds * 1e9 / iterations;
+      result.cpuNanos = state.cpuSeconds() * 1e9 / iterations;
+      if (seconds > 0) {
+        result.bytesPerSecond = state.bytes() / seconds;
+        result.itemsPerSecond = state.items() / seconds;
+      }
+      return result;
+    }
+    // Same growth rule as Google Benchmark: aim 40% past the target, at most ten times more per step.
+    const double multiplier = seconds <= 0 ? 10.0 : std::min(10.0, std::max(1.4 * minSeconds / seconds, 1.1));
+    iterations = std::min(kMaxIterations, std::max(iterations + 1, static_cast<int64_t>(iterations * multiplier)));
+  }
+}
+
+string JsonString(const string& value) {
+  string out = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+string CurrentDate() {
+  const time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+  char buffer[64];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S%z", &local);
+  return buffer;
+}
+
+void WriteJson(const vector<Result>& results, std::ostream& out) {
+  char host[256] = {};
+  gethostname(host, sizeof(host) - 1);
+  out << std::setprecision(12);
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": " << JsonString(CurrentDate()) << ",\n"
+      << "    \"host_name\": " << JsonString(host) << ",\n"
+      << "    \"executable\": " << JsonString(GetOption("executable")) << ",\n"
+      << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+      << "    \"library_build_type\": \"release\"\n"
+#else
+      << "    \"library_build_type\": \"debug\"\n"
+#endif
+      << "  },\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    out << (i ? "," : "") << "\n    {\n"
+        << "      \"name\": " << JsonString(result.name) << ",\n"
+        << "      \"run_name\": " << JsonString(result.name) << ",\n"
+        << "      \"run_type\": \"iteration\",\n";
+    if (!result.error.empty()) {
+      out << "      \"error_occurred\": true,\n"
+          << "      \"error_message\": " << JsonString(result.error) << "\n    }";
+      continue;
+    }
+    out << "      \"iterations\": " << result.iterations << ",\n"
+        << "      \"real_time\": " << result.realNanos << ",\n"
+        << "      \"cpu_time\": " << result.cpuNanos << ",\n"
+        << "      \"time_unit\": \"ns\"";
+    if (result.bytesPerSecond > 0)
+      out << ",\n      \"bytes_per_second\": " << result.bytesPerSecond;
+    if (result.itemsPerSecond > 0)
+      out << ",\n      \"items_per_second\": " << result.itemsPerSecond;
+    for (const auto& counter : result.counters)
+      out << ",\n      " << JsonString(counter.first) << ": " << counter.second;
+    out << "\n    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+void WriteConsole(const Result& result, std::ostream& out) {
+  out << std::left << std::setw(48) << result.name << std::right;
+  if (!result.error.empty()) {
+    out << " ERROR: " << result.error << "\n";
+    return;
+  }
+  out << std::fixed << std::setprecision(0)
+      << std::setw(14) << result.realNanos << " ns"
+      << std::setw(14) << result.cpuNanos << " ns"
+      << std::setw(12) << result.iterations;
+  if (result.bytesPerSecond > 0)
+    out << std::setprecision(1) << std::setw(12) << result.bytesPerSecond / (1024 * 1024) << " MiB/s";
+  if (result.itemsPerSecond > 0)
+    out << std::setprecision(1) << std::setw(12) << result.itemsPerSecond << " items/s";
+  for (const auto& counter : result.counters)
+    out << std::setprecision(1) << " " << counter.first << "=" << counter.second;
+  out << "\n";
+}
+
+} // namespace
+
+State::State(int64_t iterations)
+    : mIterations(iterations),
+      mRemaining(iterations),
+      mStarted(false),
+      mRunning(false),
+      mBytes(0),
+      mItems(0),
+      mCpuStart(0),
+      mRealSeconds(0),
+      mCpuSeconds(0) {
+}
+
+bool State::KeepRunning() {
+  if (!mStarted) {
+    mStarted = true;
+    Start();
+  }
+  if (mError.empty() && mRemaining-- > 0)
+    return true;
+  if (mRunning)
+    Stop();
+  return false;
+}
+
+void State::PauseTiming() {
+  if (mRunning)
+    Stop();
+}
+
+void State::ResumeTiming() {
+  if (!mRunning)
+    Start();
+}
+
+void State::SkipWithError(const string& error) {
+  mError = error;
+  mRemaining = 0;
+}
+
+void State::Start() {
+  mRunning = true;
+  mRealStart = std::chrono::steady_clock::now();
+  mCpuStart = std::clock();
+}
+
+void State::Stop() {
+  mRunning = false;
+  mRealSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - mRealStart).count();
+  mCpuSeconds += static_cast<double>(std::clock() - mCpuStart) / CLOCKS_PER_SEC;
+}
+
+bool Register(const string& name, const Function& function) {
+  Registry().push_back({ name, function });
+  return true;
+}
+
+string GetOption(const string& name, const string& fallback) {
+  auto it = Options().find(name);
+  return it == Options().end() ? fallback : it->second;
+}
+
+int RunAll(int argc, char** argv) {
+  Options()["executable"] = argc > 0 ? argv[0] : "";
+  for (int i = 1; i < argc; ++i) {
+    string argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0) {
+      std::cerr << "Unexpected argument " << argument << "\n";
+      return EXIT_FAILURE;
+    }
+    auto equals = argument.find('=');
+    Options()[argument.substr(2, equals == string::npos ? string::npos : equals - 2)] =
+        equals == string::npos ? "true" : argument.substr(equals + 1);
+  }
+
+  const string filter = GetOption("filter");
+  const double minSeconds = std::stod(GetOption("min_time", "0.5"));
+  const bool json = GetOption("format", "console") == "json";
+  const string outPath = GetOption("out");
+
+  if (!json)
+    std::cout << std::left << std::setw(48) << "Benchmark" << std::right
+              << std::setw(17) << "Time" << std::setw(17) << "CPU" << std::setw(12) << "Iterations" << "\n";
+  vector<Result> results;
+  for (const auto& benchmark : Registry()) {
+    if (!filter.empty() && benchmark.name.find(filter) == string::npos)
+      continue;
+    results.push_back(Measure(benchmark, minSeconds));
+    if (!json)
+      WriteConsole(results.back(), std::cout);
+  }
+
+  if (json) {
+    if (outPath.empty()) {
+      WriteJson(results, std::cout);
+    } else {
+      std::ofstream out(outPath);
+      WriteJson(results, out);
+      if (!out) {
+        std::cerr << "Failed to write " << outPath << "\n";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  // Skipped benchmarks are reported in the output, not through the exit code, so a partial corpus still
+  // produces a comparable run.
+  return EXIT_SUCCESS;
+}
+
+} // namespace bench
+} // namespace sample
+
+int main(int argc, char** argv) {
+  return sample::bench::RunAll(argc, argv);
+}
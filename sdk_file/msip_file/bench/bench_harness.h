@@ -0,0 +1,106 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_BENCH_BENCH_HARNESS_H_
+#define SAMPLE_BENCH_BENCH_HARNESS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace sample {
+namespace bench {
+
+// Minimal stand-in for Google Benchmark, which is not part of the build. A benchmark body loops on
+// KeepRunning(); the harness grows the iteration count until a run lasts --min_time seconds and
+// reports time per iteration. --format=json writes Google Benchmark's JSON layout, so its compare.py
+// can diff two runs.
+class State final {
+public:
+  explicit State(int64_t iterations);
+
+  bool KeepRunning();
+
+  // Excludes per-iteration setup from the measurement.
+  void PauseTiming();
+  void ResumeTiming();
+
+  void SetBytesProcessed(int64_t bytes) { mBytes = bytes; }
+  void SetItemsProcessed(int64_t items) { mItems = items; }
+  void SkipWithError(const std::string& error);
+  // Reported next to the times, like Google Benchmark's user counters, e.g. page faults per iteration.
+  void SetCounter(const std::string& name, double value) { mCounters[name] = value; }
+
+  int64_t iterations() const { return mIterations; }
+  int64_t bytes() const { return mBytes; }
+  int64_t items() const { return mItems; }
+  const std::string& error() const { return mError; }
+  const std::map<std::string, double>& counters() const { return mCounters; }
+  double realSeconds() const { return mRealSeconds; }
+  double cpuSeconds() const { return mCpuSeconds; }
+
+private:
+  void Start();
+  void Stop();
+
+  const int64_t mIterations;
+  int64_t mRemaining;
+  bool mStarted;
+  bool mRunning;
+  int64_t mBytes;
+  int64_t mItems;
+  std::string mError;
+  std::map<std::string, double> mCounters;
+  std::chrono::steady_clock::time_point mRealStart;
+  std::clock_t mCpuStart;
+  double mRealSeconds;
+  double mCpuSeconds;
+};
+
+typedef std::function<void(State&)> Function;
+
+// Registration is static, so it must not depend on command-line options; read them with GetOption
+// inside the body instead.
+bool Register(const std::string& name, const Function& function);
+
+// Value of --name=value, or fallback when it was not given.
+std::string GetOption(const std::string& name, const std::string& fallback = std::string());
+
+// Parses the command line and runs every benchmark matching --filter.
+int RunAll(int argc, char** argv);
+
+} // namespace bench
+} // namespace sample
+
+#define MSIP_BENCH_CONCAT2(a, b) a##b
+#define MSIP_BENCH_CONCAT(a, b) MSIP_BENCH_CONCAT2(a, b)
+#define MSIP_BENCHMARK(name, function) \
+  static const bool MSIP_BENCH_CONCAT(kRegistered, __LINE__) = sample::bench::Register(name, function)
+
+#endif // SAMPLE_BENCH_BENCH_HARNESS_H_
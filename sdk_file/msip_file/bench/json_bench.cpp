@@ -0,0 +1,122 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "bench_harness.h"
+#include "json_delegate_impl.h"
+#include "json_reader.h"
+
+using sample::bench::State;
+using sample::json::JsonDelegateImpl;
+using std::string;
+
+namespace {
+
+static const int kTemplateCount = 200;
+
+// A template list as the protection service returns it: an array of objects of escaped display strings,
+// GUIDs, nested rights and numbers, the shape of the largest responses an engine load parses.
+string MakeTemplateList(int count) {
+  string json = "{\"templates\":[";
+  for (int i = 0; i < count; ++i) {
+    char id[64];
+    snprintf(id, sizeof(id), "%08x-1f2e-4d3c-9b8a-%012x", i * 2654435761u, i);
+    if (i)
+      json += ',';
+    json += "{\"id\":\"";
+    json += id;
+    json += "\",\"name\":\"Confidential \\u2013 Template ";
+    json += std::to_string(i);
+    json += "\",\"description\":\"Recipients can view, edit and reply to \\\"internal\\\" content only.\\n"
+            "Copying and printing are disallowed.\",\"lastModified\":1716800000";
+    json += std::to_string(i % 10);
+    json += ",\"readOnly\":false,\"rights\":[\"VIEW\",\"EDIT\",\"REPLY\",\"REPLYALL\",\"FORWARD\"],"
+            "\"contentExpiration\":null,\"offlineDays\":30,\"owner\":{\"email\":\"admin@contoso.com\",\"sid\":-1}}";
+  }
+  json += "],\"nextLink\":null}";
+  return json;
+}
+
+const string& TemplateList() {
+  static const string json = MakeTemplateList(kTemplateCount);
+  return json;
+}
+
+void BM_DelegateParse(State& state) {
+  const JsonDelegateImpl delegate;
+  while (state.KeepRunning()) {
+    auto result = delegate.Parse(TemplateList());
+    if (!result.GetData()) {
+      state.SkipWithError(result.GetError()->GetMessage());
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(TemplateList().size()));
+}
+MSIP_BENCHMARK("JsonDelegateImpl/Parse/Templates", BM_DelegateParse);
+
+// Parsing, then reading every template's fields through the interface the SDK uses, which is where a
+// response's time goes once parsed.
+void BM_DelegateParseAndRead(State& state) {
+  const JsonDelegateImpl delegate;
+  size_t characters = 0;
+  while (state.KeepRunning()) {
+    auto root = delegate.Parse(TemplateList()).GetData()->Root();
+    auto templates = root->GetMember("templates");
+    for (unsigned int i = 0; i < templates->Size(); ++i) {
+      auto entry = templates->GetMember(i);
+      characters += entry->GetMember("id")->GetString().size() + entry->GetMember("name")->GetString().size();
+      characters += entry->GetMember("rights")->GetStringArray().size();
+      characters += entry->GetMember("offlineDays")->GetUint();
+    }
+  }
+  if (!characters)
+    state.SkipWithError("Read nothing");
+  state.SetItemsProcessed(state.iterations() * kTemplateCount);
+}
+MSIP_BENCHMARK("JsonDelegateImpl/ParseAndRead/Templates", BM_DelegateParseAndRead);
+
+void BM_DelegateSerialize(State& state) {
+  const JsonDelegateImpl delegate;
+  auto root = delegate.Parse(TemplateList()).GetData()->Root();
+  while (state.KeepRunning())
+    root->SerializeToString();
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(TemplateList().size()));
+}
+MSIP_BENCHMARK("JsonDelegateImpl/Serialize/Templates", BM_DelegateSerialize);
+
+// The library's tree of values, one heap allocation per node, as the baseline.
+void BM_JsonReaderParse(State& state) {
+  while (state.KeepRunning())
+    JsonValue::Parse(TemplateList());
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(TemplateList().size()));
+}
+MSIP_BENCHMARK("JsonReader/Parse/Templates", BM_JsonReaderParse);
+
+} // namespace
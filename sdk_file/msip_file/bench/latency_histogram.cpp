@@ -0,0 +1,109 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sample {
+namespace bench {
+
+namespace {
+
+const int kSubBucketBits = 8;
+const uint64_t kSubBucketCount = 1 << kSubBucketBits;
+const uint64_t kSubBucketHalf = kSubBucketCount / 2;
+const uint64_t kHighestTrackable = (1ULL << 36) - 1;
+
+int Log2(uint64_t value) {
+  int log = 0;
+  while (value >>= 1) ++log;
+  return log;
+}
+
+size_t IndexOf(uint64_t value) {
+  if (value < kSubBucketCount)
+    return static_cast<size_t>(value);
+  const int shift = Log2(value) - (kSubBucketBits - 1);
+  return static_cast<size_t>((shift + 1) * kSubBucketHalf + ((value >> shift) - kSubBucketHalf));
+}
+
+uint64_t HighestEquivalent(size_t index) {
+  if (index < kSubBucketCount)
+    return index;
+  const int shift = static_cast<int>(index / kSubBucketHalf) - 1;
+  const uint64_t lowest = (index % kSubBucketHalf + kSubBucketHalf) << shift;
+  return lowest + (1ULL << shift) - 1;
+}
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : mBuckets(IndexOf(kHighestTrackable) + 1), mCount(0), mMax(0), mSum(0) {}
+
+void LatencyHistogram::Record(uint64_t micros) {
+  const uint64_t value = std::min(micros, kHighestTrackable);
+  ++mBuckets[IndexOf(value)];
+  ++mCount;
+  mMax = std::max(mMax, value);
+  mSum += static_cast<double>(value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < mBuckets.size(); ++i)
+    mBuckets[i] += other.mBuckets[i];
+  mCount += other.mCount;
+  mMax = std::max(mMax, other.mMax);
+  mSum += other.mSum;
+}
+
+void LatencyHistogram::Reset() {
+  std::fill(mBuckets.begin(), mBuckets.end(), 0);
+  mCount = 0;
+  mMax = 0;
+  mSum = 0;
+}
+
+double LatencyHistogram::GetMean() const {
+  return mCount == 0 ? 0 : mSum / static_cast<double>(mCount);
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percent) const {
+  if (mCount == 0)
+    return 0;
+  const double clamped = std::min(std::max(percent, 0.0), 100.0);
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(mCount))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < mBuckets.size(); ++i) {
+    seen += mBuckets[i];
+    if (seen >= rank)
+      return std::min(HighestEquivalent(i), mMax);
+  }
+  return mMax;
+}
+
+} // namespace bench
+} // namespace sample
@@ -0,0 +1,63 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_BENCH_LATENCY_HISTOGRAM_H_
+#define SAMPLE_BENCH_LATENCY_HISTOGRAM_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace sample {
+namespace bench {
+
+// Latency histogram in the HdrHistogram layout: exact below 256 microseconds, then 128 linear
+// sub-buckets per power of two, so every recorded value and percentile is within 1% of the true value
+// from 1 microsecond to 19 hours in about 30 KB. Not thread-safe; keep one per thread and Merge.
+class LatencyHistogram final {
+public:
+  LatencyHistogram();
+
+  void Record(uint64_t micros);
+  void Merge(const LatencyHistogram& other);
+  void Reset();
+
+  uint64_t GetCount() const { return mCount; }
+  uint64_t GetMax() const { return mMax; }
+  double GetMean() const;
+  // Smallest value at least percent of the recorded values are at or below, rounded up to its bucket.
+  uint64_t GetPercentile(double percent) const;
+
+private:
+  std::vector<uint64_t> mBuckets;
+  uint64_t mCount;
+  uint64_t mMax;
+  double mSum;
+};
+
+} // namespace bench
+} // namespace sample
+
+#endif // SAMPLE_BENCH_LATENCY_HISTOGRAM_H_
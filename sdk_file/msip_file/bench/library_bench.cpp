@@ -0,0 +1,401 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <dirent.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench_harness.h"
+#include "msip_library.h"
+
+using sample::bench::GetOption;
+using sample::bench::MsipLibrary;
+using sample::bench::State;
+using std::string;
+using std::vector;
+
+// Benchmarks of aip_file.so through the same C ABI the service calls, loaded with dlopen so the stream
+// benchmarks build and run without the MIP SDK. Options:
+//   --library=PATH         aip_file.so to load (default: next to this executable)
+//   --application_id=ID    application id for every call
+//   --corpus=DIR           inputs for GetFileStatus, picked by extension (docx, pdf, pfile, msg)
+//   --token=T --username=U --plain=PATH --protected=PATH --reference=PATH
+//                          end-to-end protect/unprotect; each benchmark is skipped without its inputs
+//   --scratch=DIR          where the detached benchmarks write their outputs (default: /tmp)
+//   --record=DIR           write the service responses of this run to DIR
+//   --replay=DIR           answer service requests from the recording in DIR instead of the network
+//   --latency_ms=N --jitter_ms=N
+//                          delay each replayed response by N plus up to N ms
+//   --static_library=PATH  aip_file.so built with --static, loaded against --library by Startup/*
+//   --binding=lazy|now     how Startup/* binds symbols, as MSIP_LAZY_BINDING does (default: lazy)
+
+namespace {
+
+typedef MsipLibrary::StatusFn StatusFn;
+typedef MsipLibrary::ResultFn ResultFn;
+typedef MsipLibrary::UnprotectToBufferFn UnprotectToBufferFn;
+typedef MsipLibrary::ProtectToBufferFn ProtectToBufferFn;
+typedef MsipLibrary::ProtectDetachedFn ProtectDetachedFn;
+typedef MsipLibrary::UnprotectDetachedFn UnprotectDetachedFn;
+
+static const size_t kResultCapacity = 1024 * 1024;
+static const size_t kOutputCapacity = 64 * 1024 * 1024;
+
+class Library final {
+public:
+  static MsipLibrary& Get() {
+    static MsipLibrary library(GetOption("library"));
+    return library;
+  }
+
+  // Applications are initialized once per process, like the service does at startup. Replay has to be
+  // set up before msipInit creates the application's context.
+  static const string& ApplicationId() {
+    static const string applicationId = GetOption("application_id");
+    static bool initialized = false;
+    if (!initialized && Get().IsLoaded()) {
+      initialized = true;
+      if (!Get().ConfigureHttpReplay(GetOption("record"), GetOption("replay"), atoi(GetOption("latency_ms", "0").c_str()),
+              atoi(GetOption("jitter_ms", "0").c_str()))) {
+        fprintf(stderr, "%s\n", Get().GetError().c_str());
+        exit(EXIT_FAILURE);
+      }
+      Get().Initialize(applicationId);
+    }
+    return applicationId;
+  }
+};
+
+// First file in --corpus whose extension is one of extensions.
+string FindInput(const vector<string>& extensions) {
+  const string corpus = GetOption("corpus");
+  DIR* directory = corpus.empty() ? nullptr : opendir(corpus.c_str());
+  if (!directory)
+    return string();
+  vector<string> names;
+  while (auto entry = readdir(directory))
+    names.push_back(entry->d_name);
+  closedir(directory);
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    const auto dot = name.rfind('.');
+    if (dot == string::npos)
+      continue;
+    string extension = name.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end())
+      return corpus + "/" + name;
+  }
+  return string();
+}
+
+bool Require(State& state, const vector<string>& options) {
+  if (!Library::Get().IsLoaded()) {
+    state.SkipWithError(Library::Get().GetError());
+    return false;
+  }
+  for (const auto& option : options) {
+    if (GetOption(option).empty()) {
+      state.SkipWithError("--" + option + " not given");
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Fn>
+Fn RequireSymbol(State& state, const char* name) {
+  auto function = Library::Get().Symbol<Fn>(name);
+  if (!function)
+    state.SkipWithError(string("Library does not export ") + name);
+  return function;
+}
+
+void SkipOnFailure(State& state, int status, const vector<char>& result) {
+  if (status != EXIT_SUCCESS)
+    state.SkipWithError(string(result.data(), std::min<size_t>(200, strlen(result.data()))));
+}
+
+int64_t FileSize(const string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? static_cast<int64_t>(info.st_size) : 0;
+}
+
+void RunResultExport(State& state, const char* name) {
+  if (!Require(state, {}))
+    return;
+  auto function = RequireSymbol<ResultFn>(state, name);
+  if (!function)
+    return;
+  vector<char> result(kResultCapacity);
+  size_t needed = 0;
+  int64_t bytes = 0;
+  while (state.KeepRunning()) {
+    function(result.data(), result.size(), &needed);
+    bytes += static_cast<int64_t>(needed);
+  }
+  state.SetBytesProcessed(bytes);
+}
+
+// Loads path into a new process the way the service's ctypes.CDLL does, once per iteration: a forked child pays the loader's work and the static initializers again each time,
+// which a second dlopen in this process would not. An empty path times the fork alone, to subtract.
+void RunStartup(State& state, const string& option) {
+  const string path = option.empty() ? string() : GetOption(option);
+  if (!option.empty() && path.empty()) {
+    state.SkipWithError("--" + option + " not given");
+    return;
+  }
+  if (void* loaded = path.empty() ? nullptr : dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD)) {
+    dlclose(loaded);
+    state.SkipWithError(path + " is loaded in this process already; run --filter=Startup on its own");
+    return;
+  }
+  const int binding = GetOption("binding", "lazy") == "now" ? RTLD_NOW : RTLD_LAZY;
+  while (state.KeepRunning()) {
+    const pid_t child = fork();
+    if (child == 0) {
+      void* handle = path.empty() ? nullptr : dlopen(path.c_str(), binding | RTLD_LOCAL);
+      _exit(path.empty() || (handle && dlsym(handle, "getFileStatus_v2")) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      state.SkipWithError("Failed to load " + path + " in a child process");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// First in the file, so they run before any other benchmark loads --library into this process.
+void BM_StartupFork(State& state) { RunStartup(state, string()); }
+void BM_StartupShared(State& state) { RunStartup(state, "library"); }
+void BM_StartupStatic(State& state) { RunStartup(state, "static_library"); }
+MSIP_BENCHMARK("Startup/fork", BM_StartupFork);
+MSIP_BENCHMARK("Startup/shared", BM_StartupShared);
+MSIP_BENCHMARK("Startup/static", BM_StartupStatic);
+
+void BM_GetMetricsJson(State& state) { RunResultExport(state, "msipGetMetrics"); }
+MSIP_BENCHMARK("Json/msipGetMetrics", BM_GetMetricsJson);
+
+void BM_RenderMetrics(State& state) { RunResultExport(state, "msipRenderMetrics"); }
+MSIP_BENCHMARK("Json/msipRenderMetrics", BM_RenderMetrics);
+
+void RunGetFileStatus(State& state, const vector<string>& extensions) {
+  if (!Require(state, { "application_id", "corpus" }))
+    return;
+  const string path = FindInput(extensions);
+  if (path.empty()) {
+    state.SkipWithError("No " + extensions.front() + " input in --corpus");
+    return;
+  }
+  auto getFileStatus = RequireSymbol<StatusFn>(state, "getFileStatus_v2");
+  if (!getFileStatus)
+    return;
+  const string& applicationId = Library::ApplicationId();
+  vector<char> result(kResultCapacity);
+  size_t needed = 0;
+  while (state.KeepRunning()) {
+    const int status = getFileStatus(path.c_str(), applicationId.c_str(), result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GetFileStatusDocx(State& state) { RunGetFileStatus(state, { "docx" }); }
+void BM_GetFileStatusPdf(State& state) { RunGetFileStatus(state, { "pdf" }); }
+void BM_GetFileStatusPfile(State& state) {
+  RunGetFileStatus(state, { "pfile", "ptxt", "pxml", "pjpg", "pjpeg", "ppng", "ptif", "ptiff", "pbmp", "pgif" });
+}
+void BM_GetFileStatusMsg(State& state) { RunGetFileStatus(state, { "msg" }); }
+MSIP_BENCHMARK("GetFileStatus/docx", BM_GetFileStatusDocx);
+MSIP_BENCHMARK("GetFileStatus/pdf", BM_GetFileStatusPdf);
+MSIP_BENCHMARK("GetFileStatus/pfile", BM_GetFileStatusPfile);
+MSIP_BENCHMARK("GetFileStatus/msg", BM_GetFileStatusMsg);
+
+void BM_InspectProtected(State& state) {
+  if (!Require(state, { "application_id", "protected" }))
+    return;
+  auto getFileStatus = RequireSymbol<StatusFn>(state, "getFileStatus_v2");
+  if (!getFileStatus)
+    return;
+  const string path = GetOption("protected");
+  const string& applicationId = Library::ApplicationId();
+  vector<char> result(kResultCapacity);
+  size_t needed = 0;
+  while (state.KeepRunning()) {
+    const int status = getFileStatus(path.c_str(), applicationId.c_str(), result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+MSIP_BENCHMARK("EndToEnd/Inspect", BM_InspectProtected);
+
+void BM_UnprotectToBuffer(State& state) {
+  if (!Require(state, { "application_id", "token", "protected" }))
+    return;
+  auto unprotect = RequireSymbol<UnprotectToBufferFn>(state, "unprotectFileToBuffer");
+  if (!unprotect)
+    return;
+  const string token = GetOption("token");
+  const string path = GetOption("protected");
+  const string& applicationId = Library::ApplicationId();
+  vector<uint8_t> output(kOutputCapacity);
+  vector<char> result(kResultCapacity);
+  size_t outputSize = 0;
+  size_t needed = 0;
+  int64_t bytes = 0;
+  while (state.KeepRunning()) {
+    const int status = unprotect(token.c_str(), path.c_str(), applicationId.c_str(),
+        output.data(), output.size(), &outputSize, result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+    bytes += static_cast<int64_t>(outputSize);
+  }
+  state.SetBytesProcessed(bytes);
+  state.SetItemsProcessed(state.iterations());
+}
+MSIP_BENCHMARK("EndToEnd/UnprotectToBuffer", BM_UnprotectToBuffer);
+
+void BM_ProtectToBuffer(State& state) {
+  if (!Require(state, { "application_id", "token", "username", "plain", "reference" }))
+    return;
+  auto protect = RequireSymbol<ProtectToBufferFn>(state, "protectFileToBuffer");
+  if (!protect)
+    return;
+  const string token = GetOption("token");
+  const string path = GetOption("plain");
+  const string reference = GetOption("reference");
+  const string username = GetOption("username");
+  const string& applicationId = Library::ApplicationId();
+  vector<uint8_t> output(kOutputCapacity);
+  vector<char> result(kResultCapacity);
+  size_t outputSize = 0;
+  size_t needed = 0;
+  int64_t bytes = 0;
+  while (state.KeepRunning()) {
+    const int status = protect(token.c_str(), path.c_str(), reference.c_str(), username.c_str(), applicationId.c_str(),
+        output.data(), output.size(), &outputSize, result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+    bytes += static_cast<int64_t>(outputSize);
+  }
+  state.SetBytesProcessed(bytes);
+  state.SetItemsProcessed(state.iterations());
+}
+MSIP_BENCHMARK("EndToEnd/ProtectToBuffer", BM_ProtectToBuffer);
+
+// The detached pair runs the content's AES in parallel segments; compare with the *ToBuffer pair above,
+// where the SDK encrypts and decrypts each file on one thread.
+void BM_ProtectDetached(State& state) {
+  if (!Require(state, { "application_id", "token", "username", "plain", "reference" }))
+    return;
+  auto protect = RequireSymbol<ProtectDetachedFn>(state, "protectFileDetached");
+  if (!protect)
+    return;
+  const string token = GetOption("token");
+  const string path = GetOption("plain");
+  const string reference = GetOption("reference");
+  const string username = GetOption("username");
+  const string output = GetOption("scratch", "/tmp") + "/msip_bench_detached.enc";
+  const string license = output + ".pl";
+  const string& applicationId = Library::ApplicationId();
+  const int64_t inputSize = FileSize(path);
+  vector<char> result(kResultCapacity);
+  size_t needed = 0;
+  while (state.KeepRunning()) {
+    const int status = protect(token.c_str(), path.c_str(), reference.c_str(), username.c_str(), applicationId.c_str(),
+        output.c_str(), license.c_str(), result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+  }
+  state.SetBytesProcessed(inputSize * state.iterations());
+  state.SetItemsProcessed(state.iterations());
+  remove(output.c_str());
+  remove(license.c_str());
+}
+MSIP_BENCHMARK("EndToEnd/ProtectDetached", BM_ProtectDetached);
+
+void BM_UnprotectDetached(State& state) {
+  if (!Require(state, { "application_id", "token", "username", "plain", "reference" }))
+    return;
+  auto protect = RequireSymbol<ProtectDetachedFn>(state, "protectFileDetached");
+  auto unprotect = RequireSymbol<UnprotectDetachedFn>(state, "unprotectFileDetached");
+  if (!protect || !unprotect)
+    return;
+  const string token = GetOption("token");
+  const string path = GetOption("plain");
+  const string encrypted = GetOption("scratch", "/tmp") + "/msip_bench_detached.enc";
+  const string license = encrypted + ".pl";
+  const string output = encrypted + ".dec";
+  const string& applicationId = Library::ApplicationId();
+  vector<char> result(kResultCapacity);
+  size_t needed = 0;
+  // The ciphertext to decrypt is written once, outside the measurement.
+  int status = protect(token.c_str(), path.c_str(), GetOption("reference").c_str(), GetOption("username").c_str(),
+      applicationId.c_str(), encrypted.c_str(), license.c_str(), result.data(), result.size(), &needed);
+  if (status != EXIT_SUCCESS) {
+    SkipOnFailure(state, status, result);
+    return;
+  }
+  const int64_t inputSize = FileSize(encrypted);
+  while (state.KeepRunning()) {
+    status = unprotect(token.c_str(), encrypted.c_str(), license.c_str(), applicationId.c_str(), output.c_str(),
+        result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS) {
+      SkipOnFailure(state, status, result);
+      break;
+    }
+  }
+  state.SetBytesProcessed(inputSize * state.iterations());
+  state.SetItemsProcessed(state.iterations());
+  remove(encrypted.c_str());
+  remove(license.c_str());
+  remove(output.c_str());
+}
+MSIP_BENCHMARK("EndToEnd/UnprotectDetached", BM_UnprotectDetached);
+
+} // namespace
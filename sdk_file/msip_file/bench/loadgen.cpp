@@ -0,0 +1,687 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "msip_library.h"
+
+using sample::bench::LatencyHistogram;
+using sample::bench::MsipLibrary;
+using std::map;
+using std::string;
+using std::vector;
+
+// Load generator for aip_file.so: N threads call the exported functions over a corpus with a weighted
+// mix of operations, like the service's gRPC workers do, and report throughput, latency percentiles
+// and RSS and open-fd growth. Options:
+//   --library=PATH           aip_file.so to load (default: next to this executable)
+//   --application_id=ID      application id for every call
+//   --threads=N              concurrent callers (default: hardware threads)
+//   --duration=S --warmup=S  measured seconds (default 60) after S seconds that are not measured (default 0)
+//   --mix=inspect:70,unprotect:20,protect:10
+//                            relative weight of each operation
+//   --corpus=DIR             plain files, inspected and protected
+//   --protected_corpus=DIR   protected files, inspected and unprotected
+//   --token=T --username=U --reference=PATH
+//                            needed by protect and unprotect
+//   --interval=S             seconds between timeline samples (default 1)
+//   --out=PATH               also write the report as JSON
+//   --record=DIR --replay=DIR --latency_ms=N --jitter_ms=N
+//                            record or replay service responses, see msipConfigureHttpReplay
+//   --capture=PATH           replay a traffic capture (see msipStartCapture) instead of the mix: each
+//                            operation runs once, in order, on the corpus file of its format nearest its size
+//   --pace=F                 replay the capture at F times its arrival rate, 0 as fast as the threads go
+//                            (default 0); --duration then only stops it early
+//   --churn=S                every S seconds, switch the engine settings with msipReloadConfig while the
+//                            workers run, so engines are evicted, replaced and drained under load
+//   --check                  exit with a failure when any operation or settings switch failed, for stress
+//                            runs such as `scons stress`
+
+namespace {
+
+enum Operation { kInspect, kProtect, kUnprotect, kOperationCount };
+
+const char* const kOperationNames[kOperationCount] = { "inspect", "protect", "unprotect" };
+
+const size_t kResultCapacity = 64 * 1024;
+const size_t kInitialOutputCapacity = 16 * 1024 * 1024;
+const double kPercentiles[] = { 50, 90, 99, 99.9 };
+
+// What --churn alternates between. The engine cache shrinks to one engine, which evicts the others while
+// callers hold them, and a new task timeout makes every cached engine be replaced by a reload.
+const char* const kChurnConfigs[] = {
+    "{\"engine_cache_size\": 1, \"task_timeout_ms\": 600000}",
+    "{\"engine_cache_size\": 16, \"task_timeout_ms\": 0}",
+};
+
+typedef std::chrono::steady_clock Clock;
+
+map<string, string> ParseArguments(int argc, char** argv) {
+  map<string, string> options;
+  for (int i = 1; i < argc; ++i) {
+    string argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0)
+      throw std::invalid_argument("Unexpected argument " + argument);
+    auto equals = argument.find('=');
+    options[argument.substr(2, equals == string::npos ? string::npos : equals - 2)] =
+        equals == string::npos ? "true" : argument.substr(equals + 1);
+  }
+  return options;
+}
+
+string GetOption(const map<string, string>& options, const string& name, const string& fallback = string()) {
+  auto it = options.find(name);
+  return it == options.end() ? fallback : it->second;
+}
+
+vector<string> ListFiles(const string& directory) {
+  vector<string> files;
+  DIR* dir = directory.empty() ? nullptr : opendir(directory.c_str());
+  if (!dir)
+    return files;
+  while (auto entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      files.push_back(directory + "/" + entry->d_name);
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// Weights in "name:weight,..." form, indexed by Operation.
+vector<double> ParseMix(const string& mix) {
+  vector<double> weights(kOperationCount, 0);
+  std::istringstream entries(mix);
+  string entry;
+  while (std::getline(entries, entry, ',')) {
+    auto colon = entry.find(':');
+    const string name = entry.substr(0, colon);
+    auto operation = std::find(kOperationNames, kOperationNames + kOperationCount, name) - kOperationNames;
+    if (operation == kOperationCount)
+      throw std::invalid_argument("Unknown operation in --mix: " + name);
+    weights[operation] = colon == string::npos ? 1 : std::stod(entry.substr(colon + 1));
+  }
+  return weights;
+}
+
+long ReadRssKb() {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0)
+      return std::atol(line.c_str() + 6);
+  }
+  return 0;
+}
+
+long CountOpenFds() {
+  long count = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  if (!dir)
+    return 0;
+  while (auto entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      ++count;
+  }
+  closedir(dir);
+  // The directory listing holds one fd of its own.
+  return count - 1;
+}
+
+struct Sample {
+  double seconds;
+  uint64_t operations;
+  uint64_t errors;
+  long rssKb;
+  long openFds;
+};
+
+// Least-squares slope of value over time, per minute, so steady growth stands out from allocator noise.
+template <typename Value>
+double GrowthPerMinute(const vector<Sample>& samples, Value value) {
+  if (samples.size() < 2)
+    return 0;
+  double meanTime = 0, meanValue = 0;
+  for (const auto& sample : samples) {
+    meanTime += sample.seconds;
+    meanValue += value(sample);
+  }
+  meanTime /= samples.size();
+  meanValue /= samples.size();
+  double covariance = 0, variance = 0;
+  for (const auto& sample : samples) {
+    covariance += (sample.seconds - meanTime) * (value(sample) - meanValue);
+    variance += (sample.seconds - meanTime) * (sample.seconds - meanTime);
+  }
+  return variance == 0 ? 0 : covariance / variance * 60;
+}
+
+// One operation of a traffic capture, on the corpus file standing in for its input.
+struct Step {
+  Operation operation;
+  const string* file;
+  int64_t offsetMicros;
+};
+
+// The steps of a capture, which the workers take in order.
+struct Replay {
+  vector<Step> steps;
+  std::atomic<size_t> next;
+  // Speed-up of the captured arrival times, 0 for none.
+  double pace;
+  Clock::time_point start;
+  uint64_t captured;
+  uint64_t skipped;
+};
+
+struct CorpusFile {
+  const string* path;
+  string format;
+  int64_t size;
+};
+
+string FormatOf(const string& path) {
+  const auto slash = path.find_last_of('/');
+  const auto dot = path.find_last_of('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return string();
+  string format = path.substr(dot + 1);
+  std::transform(format.begin(), format.end(), format.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return format;
+}
+
+vector<CorpusFile> DescribeCorpus(const vector<string>& files) {
+  vector<CorpusFile> corpus;
+  for (const auto& file : files) {
+    struct stat info;
+    corpus.push_back({ &file, FormatOf(file), stat(file.c_str(), &info) == 0 ? static_cast<int64_t>(info.st_size) : 0 });
+  }
+  return corpus;
+}
+
+// The file of format whose size is nearest size on a log scale, or of any format when none has it.
+// nullptr for an empty corpus.
+const string* NearestFile(const vector<CorpusFile>& corpus, const string& format, int64_t size) {
+  const CorpusFile* nearest = nullptr;
+  double nearestDistance = 0;
+  bool nearestMatches = false;
+  for (const auto& file : corpus) {
+    const bool matches = file.format == format;
+    const double distance = size < 0 ? 0 : std::fabs(std::log1p(static_cast<double>(file.size)) - std::log1p(static_cast<double>(size)));
+    if (!nearest || (matches && !nearestMatches) || (matches == nearestMatches && distance < nearestDistance)) {
+      nearest = &file;
+      nearestDistance = distance;
+      nearestMatches = matches;
+    }
+  }
+  return nearest ? nearest->path : nullptr;
+}
+
+vector<string> SplitTabs(const string& line) {
+  vector<string> fields;
+  size_t begin = 0;
+  while (true) {
+    const auto tab = line.find('\t', begin);
+    fields.push_back(line.substr(begin, tab == string::npos ? string::npos : tab - begin));
+    if (tab == string::npos)
+      return fields;
+    begin = tab + 1;
+  }
+}
+
+struct Config {
+  string applicationId;
+  string token;
+  string username;
+  string reference;
+  vector<string> plainFiles;
+  vector<string> protectedFiles;
+  vector<string> inspectFiles;
+  vector<double> mix;
+  // nullptr unless --capture was given.
+  Replay* replay;
+  // Seconds between settings switches, 0 for none.
+  double churn;
+};
+
+// Reads a capture into steps over the config's corpora. Operations the load generator does not call, and
+// those no corpus file can stand in for, are skipped; a batch becomes one step per file.
+void LoadCapture(const string& path, Config& config, Replay& replay) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::invalid_argument("Cannot read --capture " + path);
+  string line;
+  if (!std::getline(in, line) || line.compare(0, 16, "# msip-capture 1") != 0)
+    throw std::invalid_argument(path + " is not a traffic capture");
+  const vector<CorpusFile> corpora[kOperationCount] = {
+      DescribeCorpus(config.inspectFiles), DescribeCorpus(config.plainFiles), DescribeCorpus(config.protectedFiles) };
+  const char* const capturedNames[kOperationCount] = { "status", "protect", "unprotect" };
+  replay.captured = 0;
+  replay.skipped = 0;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    const auto fields = SplitTabs(line);
+    ++replay.captured;
+    const auto operation = static_cast<Operation>(
+        std::find(capturedNames, capturedNames + kOperationCount, fields.size() >= 10 ? fields[1] : string()) - capturedNames);
+    if (operation == kOperationCount) {
+      ++replay.skipped;
+      continue;
+    }
+    const int64_t files = std::max<int64_t>(std::atoll(fields[3].c_str()), 1);
+    const int64_t size = std::atoll(fields[4].c_str());
+    const string* file = NearestFile(corpora[operation], fields[2], size < 0 ? size : size / files);
+    if (!file) {
+      ++replay.skipped;
+      continue;
+    }
+    for (int64_t i = 0; i < files; ++i)
+      replay.steps.push_back({ operation, file, std::atoll(fields[0].c_str()) });
+    config.mix[operation] = 1;
+  }
+}
+
+struct Counters {
+  std::atomic<uint64_t> operations;
+  std::atomic<uint64_t> errors;
+};
+
+// Switches the engine settings every period until stopping is set. Returns the switches that failed.
+uint64_t Churn(const MsipLibrary& library, std::chrono::duration<double> period, const std::atomic<bool>& stopping,
+               uint64_t& switches, string& lastError) {
+  const auto reloadConfig = library.Symbol<MsipLibrary::ReloadConfigFn>("msipReloadConfig");
+  vector<char> result(kResultCapacity);
+  uint64_t failures = 0;
+  auto next = Clock::now();
+  while (true) {
+    next += std::chrono::duration_cast<Clock::duration>(period);
+    // Woken often enough that stopping does not wait out a long period.
+    while (!stopping.load(std::memory_order_relaxed) && Clock::now() < next)
+      std::this_thread::sleep_for(std::min<Clock::duration>(next - Clock::now(), std::chrono::milliseconds(100)));
+    if (stopping.load(std::memory_order_relaxed))
+      return failures;
+    size_t needed = 0;
+    const int status = reloadConfig(kChurnConfigs[switches++ % 2], result.data(), result.size(), &needed);
+    if (status != EXIT_SUCCESS && status != MsipLibrary::kResultTooSmall) {
+      ++failures;
+      lastError.assign(result.data(), strnlen(result.data(), result.size()));
+    }
+  }
+}
+
+class Worker final {
+public:
+  Worker(const MsipLibrary& library, const Config& config, size_t index, Counters& counters)
+      : mConfig(config),
+        mCounters(counters),
+        mGetFileStatus(library.Symbol<MsipLibrary::StatusFn>("getFileStatus_v2")),
+        mProtect(library.Symbol<MsipLibrary::ProtectToBufferFn>("protectFileToBuffer")),
+        mUnprotect(library.Symbol<MsipLibrary::UnprotectToBufferFn>("unprotectFileToBuffer")),
+        mTakeOutput(library.Symbol<MsipLibrary::TakeOutputFn>("msipTakeOutput")),
+        mRandom(static_cast<std::mt19937::result_type>(index + 1)),
+        mPick(config.mix.begin(), config.mix.end()),
+        mResult(kResultCapacity),
+        mOutput(kInitialOutputCapacity),
+        mHistograms(kOperationCount),
+        mErrors(kOperationCount, 0),
+        mNext(kOperationCount, index) {}
+
+  void Run(const std::atomic<bool>& measuring, const std::atomic<bool>& stopping) {
+    auto* replay = mConfig.replay;
+    while (!stopping.load(std::memory_order_relaxed)) {
+      Operation operation;
+      const string* file;
+      if (replay) {
+        const size_t index = replay->next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= replay->steps.size())
+          break;
+        const auto& step = replay->steps[index];
+        if (replay->pace > 0)
+          std::this_thread::sleep_until(replay->start + std::chrono::duration_cast<Clock::duration>(
+              std::chrono::duration<double, std::micro>(step.offsetMicros / replay->pace)));
+        operation = step.operation;
+        file = step.file;
+      } else {
+        operation = static_cast<Operation>(mPick(mRandom));
+        file = &NextFile(operation);
+      }
+      const auto start = Clock::now();
+      const bool ok = Call(operation, *file);
+      const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+      if (!measuring.load(std::memory_order_relaxed))
+        continue;
+      mHistograms[operation].Record(static_cast<uint64_t>(micros));
+      mCounters.operations.fetch_add(1, std::memory_order_relaxed);
+      if (!ok) {
+        ++mErrors[operation];
+        mCounters.errors.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  const LatencyHistogram& GetHistogram(Operation operation) const { return mHistograms[operation]; }
+  uint64_t GetErrors(Operation operation) const { return mErrors[operation]; }
+  const string& GetLastError() const { return mLastError; }
+
+private:
+  // Threads start at different offsets so they do not all open the same file at once.
+  const string& NextFile(Operation operation) {
+    const auto& files = operation == kInspect ? mConfig.inspectFiles : operation == kProtect ? mConfig.plainFiles : mConfig.protectedFiles;
+    return files[mNext[operation]++ % files.size()];
+  }
+
+  bool Call(Operation operation, const string& file) {
+    size_t needed = 0;
+    size_t outputSize = 0;
+    int status = EXIT_FAILURE;
+    const char* applicationId = mConfig.applicationId.c_str();
+    switch (operation) {
+      case kInspect:
+        status = mGetFileStatus(file.c_str(), applicationId, mResult.data(), mResult.size(), &needed);
+        break;
+      case kProtect:
+        status = mProtect(mConfig.token.c_str(), file.c_str(), mConfig.reference.c_str(),
+            mConfig.username.c_str(), applicationId, mOutput.data(), mOutput.size(), &outputSize, mResult.data(), mResult.size(), &needed);
+        break;
+      case kUnprotect:
+        status = mUnprotect(mConfig.token.c_str(), file.c_str(), applicationId,
+            mOutput.data(), mOutput.size(), &outputSize, mResult.data(), mResult.size(), &needed);
+        break;
+      default:
+        break;
+    }
+    if (outputSize > mOutput.size()) {
+      // The library kept the output for this thread; take it so it is not held until the next call.
+      mOutput.resize(outputSize);
+      mTakeOutput(mOutput.data(), mOutput.size(), &outputSize);
+    }
+    if (status == EXIT_SUCCESS || status == MsipLibrary::kResultTooSmall)
+      return true;
+    mLastError.assign(mResult.data(), strnlen(mResult.data(), mResult.size()));
+    return false;
+  }
+
+  const Config& mConfig;
+  Counters& mCounters;
+  const MsipLibrary::StatusFn mGetFileStatus;
+  const MsipLibrary::ProtectToBufferFn mProtect;
+  const MsipLibrary::UnprotectToBufferFn mUnprotect;
+  const MsipLibrary::TakeOutputFn mTakeOutput;
+  std::mt19937 mRandom;
+  std::discrete_distribution<int> mPick;
+  vector<char> mResult;
+  vector<uint8_t> mOutput;
+  vector<LatencyHistogram> mHistograms;
+  vector<uint64_t> mErrors;
+  vector<size_t> mNext;
+  string mLastError;
+};
+
+string Validate(const MsipLibrary& library, const Config& config) {
+  if (config.applicationId.empty())
+    return "--application_id not given";
+  const char* required[kOperationCount] = { "getFileStatus_v2", "protectFileToBuffer", "unprotectFileToBuffer" };
+  for (int operation = 0; operation < kOperationCount; ++operation) {
+    if (config.mix[operation] > 0 && !library.Symbol<void*>(required[operation]))
+      return string("Library does not export ") + required[operation];
+  }
+  if (!library.Symbol<void*>("msipTakeOutput"))
+    return "Library does not export msipTakeOutput";
+  if (config.churn > 0 && !library.Symbol<void*>("msipReloadConfig"))
+    return "Library does not export msipReloadConfig";
+  if (config.mix[kInspect] > 0 && config.inspectFiles.empty())
+    return "inspect needs --corpus or --protected_corpus";
+  if (config.mix[kProtect] > 0 && (config.plainFiles.empty() || config.token.empty() || config.username.empty() || config.reference.empty()))
+    return "protect needs --corpus, --token, --username and --reference";
+  if (config.mix[kUnprotect] > 0 && (config.protectedFiles.empty() || config.token.empty()))
+    return "unprotect needs --protected_corpus and --token";
+  return string();
+}
+
+void WriteReport(std::ostream& out, bool json, size_t threads, double seconds, const vector<LatencyHistogram>& histograms,
+                 const vector<uint64_t>& errors, const vector<Sample>& timeline) {
+  auto rssGrowth = GrowthPerMinute(timeline, [](const Sample& sample) { return static_cast<double>(sample.rssKb); });
+  auto fdGrowth = GrowthPerMinute(timeline, [](const Sample& sample) { return static_cast<double>(sample.openFds); });
+  if (!json) {
+    out << std::fixed << std::setprecision(2);
+    out << "threads " << threads << ", " << seconds << " s measured\n";
+    out << std::left << std::setw(10) << "operation" << std::right << std::setw(10) << "count" << std::setw(8) << "errors"
+        << std::setw(10) << "ops/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms"
+        << std::setw(10) << "p99.9 ms" << std::setw(10) << "max ms" << "\n";
+    for (int operation = 0; operation < kOperationCount; ++operation) {
+      const auto& histogram = histograms[operation];
+      if (histogram.GetCount() == 0)
+        continue;
+      out << std::left << std::setw(10) << kOperationNames[operation] << std::right << std::setw(10) << histogram.GetCount()
+          << std::setw(8) << errors[operation] << std::setw(10) << histogram.GetCount() / seconds;
+      for (double percentile : kPercentiles)
+        out << std::setw(10) << histogram.GetPercentile(percentile) / 1000.0;
+      out << std::setw(10) << histogram.GetMax() / 1000.0 << "\n";
+    }
+    if (!timeline.empty())
+      out << "rss " << timeline.front().rssKb / 1024.0 << " -> " << timeline.back().rssKb / 1024.0 << " MB ("
+          << rssGrowth / 1024.0 << " MB/min), open fds " << timeline.front().openFds << " -> " << timeline.back().openFds
+          << " (" << fdGrowth << "/min)\n";
+    return;
+  }
+
+  out << "{\n  \"threads\": " << threads << ",\n  \"seconds\": " << seconds << ",\n  \"operations\": {";
+  bool first = true;
+  for (int operation = 0; operation < kOperationCount; ++operation) {
+    const auto& histogram = histograms[operation];
+    if (histogram.GetCount() == 0)
+      continue;
+    out << (first ? "\n" : ",\n") << "    \"" << kOperationNames[operation] << "\": {\"count\": " << histogram.GetCount()
+        << ", \"errors\": " << errors[operation] << ", \"ops_per_second\": " << histogram.GetCount() / seconds
+        << ", \"mean_us\": " << histogram.GetMean();
+    for (double percentile : kPercentiles) {
+      std::ostringstream name;
+      name << percentile;
+      string key = name.str();
+      std::replace(key.begin(), key.end(), '.', '_');
+      out << ", \"p" << key << "_us\": " << histogram.GetPercentile(percentile);
+    }
+    out << ", \"max_us\": " << histogram.GetMax() << "}";
+    first = false;
+  }
+  out << "\n  },\n  \"rss_growth_kb_per_minute\": " << rssGrowth << ",\n  \"open_fd_growth_per_minute\": " << fdGrowth
+      << ",\n  \"timeline\": [";
+  for (size_t i = 0; i < timeline.size(); ++i) {
+    const auto& sample = timeline[i];
+    out << (i == 0 ? "\n" : ",\n") << "    {\"seconds\": " << sample.seconds << ", \"operations\": " << sample.operations
+        << ", \"errors\": " << sample.errors << ", \"rss_kb\": " << sample.rssKb << ", \"open_fds\": " << sample.openFds << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int Run(const map<string, string>& options) {
+  Config config;
+  config.applicationId = GetOption(options, "application_id");
+  config.token = GetOption(options, "token");
+  config.username = GetOption(options, "username");
+  config.reference = GetOption(options, "reference");
+  config.plainFiles = ListFiles(GetOption(options, "corpus"));
+  config.protectedFiles = ListFiles(GetOption(options, "protected_corpus"));
+  config.inspectFiles = config.plainFiles;
+  config.inspectFiles.insert(config.inspectFiles.end(), config.protectedFiles.begin(), config.protectedFiles.end());
+  config.replay = nullptr;
+  config.churn = std::max(0.0, std::stod(GetOption(options, "churn", "0")));
+  const bool check = GetOption(options, "check") == "true";
+  Replay replay;
+  const string capture = GetOption(options, "capture");
+  if (capture.empty()) {
+    config.mix = ParseMix(GetOption(options, "mix", "inspect:1"));
+  } else {
+    config.mix.assign(kOperationCount, 0);
+    LoadCapture(capture, config, replay);
+    if (replay.steps.empty())
+      throw std::invalid_argument("No operation of " + capture + " can be replayed over the corpus");
+    replay.next = 0;
+    replay.pace = std::max(0.0, std::stod(GetOption(options, "pace", "0")));
+    config.replay = &replay;
+  }
+
+  const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t threads = static_cast<size_t>(std::max(1, std::stoi(GetOption(options, "threads", std::to_string(hardwareThreads)))));
+  // A capture runs to its end unless a duration is given, and every one of its operations is measured.
+  const double duration = std::stod(GetOption(options, "duration", capture.empty() ? "60" : "1e9"));
+  const double warmup = capture.empty() ? std::stod(GetOption(options, "warmup", "0")) : 0;
+  const double interval = std::max(0.1, std::stod(GetOption(options, "interval", "1")));
+
+  MsipLibrary library(GetOption(options, "library"));
+  string error = library.IsLoaded() ? Validate(library, config) : library.GetError();
+  if (error.empty() && (!library.ConfigureHttpReplay(GetOption(options, "record"), GetOption(options, "replay"),
+                            std::stoi(GetOption(options, "latency_ms", "0")), std::stoi(GetOption(options, "jitter_ms", "0"))) ||
+                        !library.Initialize(config.applicationId)))
+    error = library.GetError();
+  if (!error.empty()) {
+    std::cerr << error << "\n";
+    return EXIT_FAILURE;
+  }
+
+  Counters counters;
+  counters.operations = 0;
+  counters.errors = 0;
+  std::atomic<bool> measuring(warmup <= 0);
+  std::atomic<bool> stopping(false);
+  vector<std::unique_ptr<Worker>> workers;
+  vector<std::thread> workerThreads;
+  // Paced steps are due from the moment the workers start.
+  replay.start = Clock::now();
+  for (size_t i = 0; i < threads; ++i)
+    workers.emplace_back(new Worker(library, config, i, counters));
+  for (auto& worker : workers)
+    workerThreads.emplace_back([&worker, &measuring, &stopping]() { worker->Run(measuring, stopping); });
+  uint64_t switches = 0;
+  uint64_t switchFailures = 0;
+  string churnError;
+  std::thread churnThread;
+  if (config.churn > 0) {
+    churnThread = std::thread([&]() {
+      switchFailures = Churn(library, std::chrono::duration<double>(config.churn), stopping, switches, churnError);
+    });
+  }
+
+  if (warmup > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+    measuring = true;
+  }
+
+  // Sampled on this thread, so the timeline costs the workers nothing.
+  vector<Sample> timeline;
+  const auto start = Clock::now();
+  const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+  uint64_t reportedOperations = 0;
+  auto next = start;
+  while (true) {
+    const auto now = Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - start).count();
+    const Sample sample = { elapsed, counters.operations.load(), counters.errors.load(), ReadRssKb(), CountOpenFds() };
+    timeline.push_back(sample);
+    if (timeline.size() > 1)
+      std::cerr << std::fixed << std::setprecision(1) << elapsed << " s  " << (sample.operations - reportedOperations) / interval
+                << " ops/s  errors " << sample.errors << "  rss " << sample.rssKb / 1024.0 << " MB  fds " << sample.openFds << "\n";
+    reportedOperations = sample.operations;
+    if (now >= end || (config.replay && replay.next.load() >= replay.steps.size()))
+      break;
+    next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+    std::this_thread::sleep_until(std::min(next, end));
+  }
+  stopping = true;
+  for (auto& thread : workerThreads)
+    thread.join();
+  if (churnThread.joinable())
+    churnThread.join();
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  vector<LatencyHistogram> histograms(kOperationCount);
+  vector<uint64_t> errors(kOperationCount, 0);
+  for (const auto& worker : workers) {
+    for (int operation = 0; operation < kOperationCount; ++operation) {
+      histograms[operation].Merge(worker->GetHistogram(static_cast<Operation>(operation)));
+      errors[operation] += worker->GetErrors(static_cast<Operation>(operation));
+    }
+    if (!worker->GetLastError().empty())
+      error = worker->GetLastError();
+  }
+
+  if (config.replay)
+    std::cout << "capture " << capture << ": " << std::min(replay.next.load(), replay.steps.size()) << " of " << replay.steps.size()
+              << " steps replayed from " << replay.captured << " operations, " << replay.skipped << " skipped\n";
+  WriteReport(std::cout, false, threads, seconds, histograms, errors, timeline);
+  if (!error.empty())
+    std::cout << "last error: " << error.substr(0, 300) << "\n";
+  if (config.churn > 0) {
+    std::cout << "churn: " << switches << " settings switches, " << switchFailures << " failed\n";
+    if (!churnError.empty())
+      std::cout << "last churn error: " << churnError.substr(0, 300) << "\n";
+  }
+  const string outPath = GetOption(options, "out");
+  if (!outPath.empty()) {
+    std::ofstream out(outPath);
+    WriteReport(out, true, threads, seconds, histograms, errors, timeline);
+  }
+  if (check && (counters.operations.load() == 0 || counters.errors.load() > 0 || switchFailures > 0)) {
+    std::cerr << "check failed: " << counters.operations.load() << " operations, " << counters.errors.load() << " errors, "
+              << switchFailures << " failed settings switches\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  try {
+    return Run(ParseArguments(argc, argv));
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << "\n";
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,101 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "msip_library.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace bench {
+
+namespace {
+
+string ExecutableDirectory() {
+  char path[4096];
+  const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (length <= 0)
+    return ".";
+  string executable(path, static_cast<size_t>(length));
+  const auto slash = executable.rfind('/');
+  return slash == string::npos ? "." : executable.substr(0, slash);
+}
+
+} // namespace
+
+MsipLibrary::MsipLibrary(const string& path) : mHandle(nullptr), mInitialized(false) {
+  const string libraryPath = path.empty() ? ExecutableDirectory() + "/aip_file.so" : path;
+  mHandle = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!mHandle)
+    mError = string("Failed to load ") + libraryPath + ": " + dlerror();
+}
+
+MsipLibrary::~MsipLibrary() {
+  if (!mInitialized)
+    return;
+  if (auto shutdown = Symbol<ShutdownFn>("msipShutdown"))
+    shutdown();
+}
+
+void* MsipLibrary::LookUp(const char* name) const {
+  return mHandle ? dlsym(mHandle, name) : nullptr;
+}
+
+bool MsipLibrary::ConfigureHttpReplay(const string& recordDirectory, const string& replayDirectory, int latencyMs, int jitterMs) {
+  if (recordDirectory.empty() && replayDirectory.empty())
+    return true;
+  const string& directory = replayDirectory.empty() ? recordDirectory : replayDirectory;
+  auto configure = Symbol<ConfigureHttpReplayFn>("msipConfigureHttpReplay");
+  if (!configure || configure(replayDirectory.empty() ? 1 : 2, directory.c_str(), latencyMs, jitterMs) != EXIT_SUCCESS) {
+    mError = "Cannot use HTTP recording " + directory;
+    return false;
+  }
+  return true;
+}
+
+bool MsipLibrary::Initialize(const string& applicationId) {
+  auto init = Symbol<InitFn>("msipInit");
+  if (!init) {
+    mError = IsLoaded() ? "Library does not export msipInit" : mError;
+    return false;
+  }
+  vector<char> result(8192);
+  mInitialized = true;
+  if (init(applicationId.c_str(), result.data()) != EXIT_SUCCESS) {
+    mError = string("msipInit failed: ") + result.data();
+    return false;
+  }
+  return true;
+}
+
+} // namespace bench
+} // namespace sample
@@ -0,0 +1,90 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_BENCH_MSIP_LIBRARY_H_
+#define SAMPLE_BENCH_MSIP_LIBRARY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sample {
+namespace bench {
+
+// aip_file.so loaded with dlopen, so the bench and load generator build without the MIP SDK and drive
+// the library through the same C ABI the service calls.
+class MsipLibrary final {
+public:
+  typedef int (*StatusFn)(const char*, const char*, char*, size_t, size_t*);
+  typedef int (*ResultFn)(char*, size_t, size_t*);
+  typedef int (*UnprotectToBufferFn)(const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+  typedef int (*ProtectToBufferFn)(const char*, const char*, const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+  typedef int (*ProtectDetachedFn)(const char*, const char*, const char*, const char*, const char*, const char*, const char*, char*, size_t, size_t*);
+  typedef int (*UnprotectDetachedFn)(const char*, const char*, const char*, const char*, const char*, char*, size_t, size_t*);
+  typedef int (*TakeOutputFn)(uint8_t*, size_t, size_t*);
+  typedef int (*InitFn)(const char*, char*);
+  typedef int (*ConfigureHttpReplayFn)(int, const char*, int, int);
+  typedef int (*ReloadConfigFn)(const char*, char*, size_t, size_t*);
+  typedef int (*ShutdownFn)();
+
+  // Status the *_v2 and *ToBuffer exports return when their result JSON outgrew the caller's buffer.
+  static const int kResultTooSmall = 2;
+
+  // An empty path loads aip_file.so from the directory of the running executable.
+  explicit MsipLibrary(const std::string& path);
+  // Calls msipShutdown when the library was initialized.
+  ~MsipLibrary();
+
+  MsipLibrary(const MsipLibrary&) = delete;
+  MsipLibrary& operator=(const MsipLibrary&) = delete;
+
+  bool IsLoaded() const { return mHandle != nullptr; }
+  const std::string& GetError() const { return mError; }
+
+  template <typename Fn>
+  Fn Symbol(const char* name) const {
+    return reinterpret_cast<Fn>(LookUp(name));
+  }
+
+  // Records service responses to recordDirectory or replays them from replayDirectory, whichever is set,
+  // through msipConfigureHttpReplay. Must run before Initialize. Returns false and sets GetError on failure.
+  bool ConfigureHttpReplay(const std::string& recordDirectory, const std::string& replayDirectory, int latencyMs, int jitterMs);
+
+  // msipInit for applicationId. Returns false and sets GetError on failure.
+  bool Initialize(const std::string& applicationId);
+
+private:
+  void* LookUp(const char* name) const;
+
+  void* mHandle;
+  bool mInitialized;
+  std::string mError;
+};
+
+} // namespace bench
+} // namespace sample
+
+#endif // SAMPLE_BENCH_MSIP_LIBRARY_H_
@@ -0,0 +1,327 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_harness.h"
+#include "buffer_pool.h"
+#include "editable_stream_over_buffer.h"
+#include "mapped_file_stream.h"
+#include "piece_table_editable_stream.h"
+#include "stream_over_buffer.h"
+
+using sample::bench::GetOption;
+using sample::bench::State;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const int64_t kDocumentSize = 16 * 1024 * 1024;
+static const int64_t kChunkSize = 64 * 1024;
+static const int kEditCount = 256;
+static const int64_t kEditSize = 512;
+
+vector<uint8_t> MakeDocument(int64_t size) {
+  vector<uint8_t> document(static_cast<size_t>(size));
+  std::minstd_rand random(42);
+  for (auto& byte : document)
+    byte = static_cast<uint8_t>(random());
+  return document;
+}
+
+const vector<uint8_t>& Document() {
+  static const vector<uint8_t> document = MakeDocument(kDocumentSize);
+  return document;
+}
+
+// Offsets spread over the document, fixed across runs so results stay comparable.
+vector<int64_t> EditOffsets(int64_t size) {
+  vector<int64_t> offsets;
+  std::minstd_rand random(7);
+  for (int i = 0; i < kEditCount; ++i)
+    offsets.push_back(static_cast<int64_t>(random() % static_cast<uint64_t>(size)));
+  return offsets;
+}
+
+void SequentialRead(mip::Stream& stream, vector<uint8_t>& chunk) {
+  stream.Seek(0);
+  while (stream.Read(chunk.data(), static_cast<int64_t>(chunk.size())) > 0) {
+  }
+}
+
+void BM_StreamOverBufferSequentialRead(State& state) {
+  StreamOverBuffer stream(Document().data(), kDocumentSize);
+  vector<uint8_t> chunk(kChunkSize);
+  while (state.KeepRunning())
+    SequentialRead(stream, chunk);
+  state.SetBytesProcessed(state.iterations() * kDocumentSize);
+}
+MSIP_BENCHMARK("StreamOverBuffer/SequentialRead/64KiB", BM_StreamOverBufferSequentialRead);
+
+void BM_StreamOverBufferRandomRead(State& state) {
+  StreamOverBuffer stream(Document().data(), kDocumentSize);
+  const auto offsets = EditOffsets(kDocumentSize - 4096);
+  vector<uint8_t> chunk(4096);
+  while (state.KeepRunning()) {
+    for (auto offset : offsets) {
+      stream.Seek(offset);
+      stream.Read(chunk.data(), static_cast<int64_t>(chunk.size()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(offsets.size()));
+}
+MSIP_BENCHMARK("StreamOverBuffer/RandomRead/4KiB", BM_StreamOverBufferRandomRead);
+
+// Runs kEditCount edits of one kind at spread offsets on a fresh copy of the document. Building the
+// copy is excluded from the time.
+template <typename EditableStream, typename Edit>
+void RunEdits(State& state, const Edit& edit) {
+  const auto offsets = EditOffsets(kDocumentSize / 2);
+  const vector<uint8_t> payload(kEditSize, 0x5a);
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    vector<uint8_t> copy(Document());
+    EditableStream stream(std::move(copy));
+    state.ResumeTiming();
+    for (auto offset : offsets) {
+      stream.Seek(offset);
+      edit(stream, payload);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kEditCount);
+}
+
+template <typename EditableStream>
+void BM_Insert(State& state) {
+  RunEdits<EditableStream>(state, [](EditableStream& stream, const vector<uint8_t>& payload) {
+    stream.Insert(payload.data(), static_cast<int64_t>(payload.size()));
+  });
+}
+
+template <typename EditableStream>
+void BM_Delete(State& state) {
+  RunEdits<EditableStream>(state, [](EditableStream& stream, const vector<uint8_t>&) {
+    stream.Delete(kEditSize);
+  });
+}
+
+template <typename EditableStream>
+void BM_Update(State& state) {
+  // Replaces a region with a longer one, as relabeling does with metadata blocks.
+  RunEdits<EditableStream>(state, [](EditableStream& stream, const vector<uint8_t>& payload) {
+    stream.Update(payload.data(), static_cast<int64_t>(payload.size()), kEditSize / 2);
+  });
+}
+
+MSIP_BENCHMARK("EditableStreamOverBuffer/Insert", BM_Insert<EditableStreamOverBuffer>);
+MSIP_BENCHMARK("EditableStreamOverBuffer/Delete", BM_Delete<EditableStreamOverBuffer>);
+MSIP_BENCHMARK("EditableStreamOverBuffer/Update", BM_Update<EditableStreamOverBuffer>);
+MSIP_BENCHMARK("PieceTableEditableStream/Insert", BM_Insert<PieceTableEditableStream>);
+MSIP_BENCHMARK("PieceTableEditableStream/Delete", BM_Delete<PieceTableEditableStream>);
+MSIP_BENCHMARK("PieceTableEditableStream/Update", BM_Update<PieceTableEditableStream>);
+
+void BM_PieceTableReadAfterEdits(State& state) {
+  vector<uint8_t> copy(Document());
+  PieceTableEditableStream stream(std::move(copy));
+  const vector<uint8_t> payload(kEditSize, 0x5a);
+  for (auto offset : EditOffsets(kDocumentSize / 2)) {
+    stream.Seek(offset);
+    stream.Insert(payload.data(), static_cast<int64_t>(payload.size()));
+  }
+  vector<uint8_t> chunk(kChunkSize);
+  while (state.KeepRunning())
+    SequentialRead(stream, chunk);
+  state.SetBytesProcessed(state.iterations() * stream.Size());
+}
+MSIP_BENCHMARK("PieceTableEditableStream/SequentialReadAfterEdits", BM_PieceTableReadAfterEdits);
+
+// The stream GetInputStreamFromFilePath returns for every input: opening, then mapping once per call.
+void BM_MappedFileStreamOpenAndRead(State& state) {
+  char path[] = "/tmp/msip_bench_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0 || write(fd, Document().data(), Document().size()) != static_cast<ssize_t>(Document().size())) {
+    state.SkipWithError("Failed to write the benchmark input");
+    if (fd >= 0) {
+      close(fd);
+      unlink(path);
+    }
+    return;
+  }
+  close(fd);
+  vector<uint8_t> chunk(kChunkSize);
+  while (state.KeepRunning()) {
+    MappedFileStream stream(path);
+    SequentialRead(stream, chunk);
+  }
+  state.SetBytesProcessed(state.iterations() * kDocumentSize);
+  unlink(path);
+}
+MSIP_BENCHMARK("MappedFileStream/OpenAndSequentialRead", BM_MappedFileStreamOpenAndRead);
+
+// A relabel: one small update near the front of a file edited in place over its mapping, then written out
+// whole. Only the update passes through memory; the rest is copied by the kernel.
+void BM_PieceTableFileEditAndWrite(State& state) {
+  char path[] = "/tmp/msip_bench_XXXXXX";
+  char outputPath[] = "/tmp/msip_bench_out_XXXXXX";
+  const int fd = mkstemp(path);
+  const int outputFd = mkstemp(outputPath);
+  if (fd < 0 || outputFd < 0 ||
+      write(fd, Document().data(), Document().size()) != static_cast<ssize_t>(Document().size())) {
+    state.SkipWithError("Failed to write the benchmark input");
+    if (fd >= 0) {
+      close(fd);
+      unlink(path);
+    }
+    if (outputFd >= 0) {
+      close(outputFd);
+      unlink(outputPath);
+    }
+    return;
+  }
+  close(fd);
+  const vector<uint8_t> payload(kEditSize, 0x5a);
+  while (state.KeepRunning()) {
+    PieceTableEditableStream stream{string(path)};
+    stream.Seek(4096);
+    stream.Update(payload.data(), static_cast<int64_t>(payload.size()), kEditSize / 2);
+    if (ftruncate(outputFd, 0) != 0 || lseek(outputFd, 0, SEEK_SET) != 0) {
+      state.SkipWithError("Failed to reset the benchmark output");
+      break;
+    }
+    stream.WriteTo(outputFd);
+  }
+  state.SetBytesProcessed(state.iterations() * kDocumentSize);
+  close(outputFd);
+  unlink(outputPath);
+  unlink(path);
+}
+MSIP_BENCHMARK("PieceTableEditableStream/FileEditAndWrite", BM_PieceTableFileEditAndWrite);
+
+// Size of the inputs of the page hint benchmarks, from --hints_mb: large enough that faults and TLB
+// misses, not the cache, decide the throughput.
+int64_t HintsInputSize() {
+  static const int64_t size = std::atoll(GetOption("hints_mb", "256").c_str()) * 1024 * 1024;
+  return size;
+}
+
+// Faults the process took, those of prefaulting included, so the counters compare faults per page
+// size rather than who took them.
+uint64_t PageFaults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<uint64_t>(usage.ru_minflt + usage.ru_majflt);
+}
+
+// Keeps the scans from being optimized away.
+volatile uint64_t gScanSum;
+
+// Reads every word the way a decrypt or a zip scan does, so each page and TLB entry is touched.
+uint64_t Scan(const uint8_t* data, size_t size) {
+  uint64_t sum = 0;
+  for (size_t offset = 0; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + offset, sizeof(word));
+    sum += word;
+  }
+  return sum;
+}
+
+// Maps a file of HintsInputSize() with hints per iteration and scans it whole, as the SDK does with a
+// mapped input. The file stays in the page cache, so only mapping and fault costs differ. Point TMPDIR
+// at a tmpfs mounted with huge= to see kHugePages take effect on file mappings.
+void BM_MappedScan(State& state, unsigned hints) {
+  const char* directory = getenv("TMPDIR");
+  string path = string(directory && *directory ? directory : "/tmp") + "/msip_bench_hints_XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  const int64_t size = HintsInputSize();
+  bool written = fd >= 0;
+  for (int64_t offset = 0; written && offset < size; offset += kDocumentSize)
+    written = write(fd, Document().data(), Document().size()) == static_cast<ssize_t>(Document().size());
+  if (fd >= 0)
+    close(fd);
+  if (!written) {
+    state.SkipWithError("Failed to write the benchmark input");
+    unlink(path.c_str());
+    return;
+  }
+  uint64_t sum = 0;
+  const uint64_t faultsBefore = PageFaults();
+  while (state.KeepRunning()) {
+    MappedFileStream stream(path, hints);
+    sum += Scan(stream.Data(), static_cast<size_t>(stream.Size()));
+  }
+  state.SetCounter("faults", static_cast<double>(PageFaults() - faultsBefore) / state.iterations());
+  gScanSum = sum;
+  state.SetBytesProcessed(state.iterations() * size);
+  unlink(path.c_str());
+}
+
+MSIP_BENCHMARK("PageHints/MappedScan/Default", [](State& state) { BM_MappedScan(state, MappedFileStream::kNoHints); });
+MSIP_BENCHMARK("PageHints/MappedScan/Prefault", [](State& state) { BM_MappedScan(state, MappedFileStream::kPrefault); });
+MSIP_BENCHMARK("PageHints/MappedScan/HugePages", [](State& state) { BM_MappedScan(state, MappedFileStream::kHugePages); });
+MSIP_BENCHMARK("PageHints/MappedScan/PrefaultHugePages",
+               [](State& state) { BM_MappedScan(state, MappedFileStream::kPrefault | MappedFileStream::kHugePages); });
+
+// A decrypt into a fresh pool buffer: the output is written once, then scanned, as an in-memory stream
+// handed to a zip scan. The pool retains nothing, so every iteration maps, faults and unmaps its buffer.
+void BM_PoolWriteScan(State& state, bool hugePages, bool prefault) {
+  auto& pool = BufferPool::Shared();
+  pool.SetMaxRetainedBytes(0);
+  pool.SetHugePages(hugePages);
+  pool.SetPrefault(prefault);
+  const size_t size = static_cast<size_t>(HintsInputSize());
+  uint64_t sum = 0;
+  const uint64_t faultsBefore = PageFaults();
+  while (state.KeepRunning()) {
+    BufferPool::Buffer buffer = pool.Acquire(size);
+    for (size_t offset = 0; offset < size; offset += static_cast<size_t>(kDocumentSize))
+      memcpy(buffer.Data() + offset, Document().data(), std::min(size - offset, Document().size()));
+    sum += Scan(buffer.Data(), size);
+  }
+  state.SetCounter("faults", static_cast<double>(PageFaults() - faultsBefore) / state.iterations());
+  gScanSum = sum;
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+  pool.SetHugePages(true);
+  pool.SetPrefault(false);
+  pool.SetMaxRetainedBytes(BufferPool::kDefaultMaxRetainedBytes);
+}
+
+MSIP_BENCHMARK("PageHints/PoolWriteScan/SmallPages", [](State& state) { BM_PoolWriteScan(state, false, false); });
+MSIP_BENCHMARK("PageHints/PoolWriteScan/HugePages", [](State& state) { BM_PoolWriteScan(state, true, false); });
+MSIP_BENCHMARK("PageHints/PoolWriteScan/HugePagesPrefault", [](State& state) { BM_PoolWriteScan(state, true, true); });
+MSIP_BENCHMARK("PageHints/PoolWriteScan/SmallPagesPrefault", [](State& state) { BM_PoolWriteScan(state, false, true); });
+
+} // namespace
@@ -0,0 +1,152 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "bench_harness.h"
+#include "mip/xml_document.h"
+#include "mip/xml_reader.h"
+#include "xml_delegate_impl.h"
+#include "xml_scanner.h"
+
+using sample::bench::GetOption;
+using sample::bench::State;
+using std::string;
+
+namespace {
+
+static const int kLabelCount = 2000;
+
+// A policy of kLabelCount labels shaped as GetPolicyDataXml returns them: namespaced elements, attributes
+// on every element, escaped display strings and nested settings, about 4 MiB.
+string MakePolicy(int count) {
+  string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<SyncFile xmlns=\"urn:mip:policy\" version=\"2\">\n"
+               "  <Content><labels>\n";
+  for (int i = 0; i < count; ++i) {
+    char id[64];
+    snprintf(id, sizeof(id), "%08x-1f2e-4d3c-9b8a-%012x", i * 2654435761u, i);
+    xml += "    <label id=\"";
+    xml += id;
+    xml += "\" name=\"Confidential &amp; Internal ";
+    xml += std::to_string(i);
+    xml += "\" order=\"" + std::to_string(i) + "\" sensitivity=\"" + std::to_string(i % 10) + "\" enabled=\"true\">\n"
+           "      <description>Recipients can view and edit &quot;internal&quot; content only.</description>\n"
+           "      <settings>\n";
+    for (int setting = 0; setting < 8; ++setting) {
+      xml += "        <setting key=\"contentmarking." + std::to_string(setting) + "\" value=\"Header text &#x2013; " +
+             std::to_string(setting) + "\"/>\n";
+    }
+    xml += "      </settings>\n      <actions><action type=\"protect\" template=\"";
+    xml += id;
+    xml += "\"/></actions>\n    </label>\n";
+  }
+  xml += "  </labels></Content>\n</SyncFile>\n";
+  return xml;
+}
+
+// --policy_xml=<file> measures a policy saved from a tenant instead of the synthesized one.
+const string& Policy() {
+  static const string xml = []() {
+    const string path = GetOption("policy_xml");
+    if (path.empty())
+      return MakePolicy(kLabelCount);
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+  }();
+  return xml;
+}
+
+// Reading every node and attribute value through the interface the SDK pulls policy with.
+void BM_ReaderRead(State& state) {
+  const XmlDelegateImpl delegate;
+  size_t values = 0;
+  while (state.KeepRunning()) {
+    auto reader = delegate.CreateXmlReader(Policy()).GetData();
+    string value;
+    while (reader->Read()) {
+      if (reader->MoveToFirstAttribute()) {
+        do {
+          values += reader->GetValue(value);
+        } while (reader->MoveToNextAttribute());
+        reader->MoveToElement();
+      } else if (reader->GetValue(value)) {
+        ++values;
+      }
+    }
+  }
+  if (!values)
+    state.SkipWithError("Read nothing");
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(Policy().size()));
+}
+MSIP_BENCHMARK("XmlDelegateImpl/Read/Policy", BM_ReaderRead);
+
+void BM_DocumentParse(State& state) {
+  const XmlDelegateImpl delegate;
+  while (state.KeepRunning()) {
+    auto result = delegate.ParseData(Policy());
+    if (!result.GetData()) {
+      state.SkipWithError(result.GetError()->GetMessage());
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(Policy().size()));
+}
+MSIP_BENCHMARK("XmlDelegateImpl/ParseData/Policy", BM_DocumentParse);
+
+void BM_DocumentSelect(State& state) {
+  const XmlDelegateImpl delegate;
+  auto document = delegate.ParseData(Policy()).GetData();
+  if (!document) {
+    state.SkipWithError("Failed to parse the policy");
+    return;
+  }
+  size_t selected = 0;
+  while (state.KeepRunning())
+    selected += document->SelectNodes("//label/settings/setting[@key='contentmarking.3']").size();
+  if (!selected)
+    state.SkipWithError("Selected nothing");
+  state.SetItemsProcessed(state.iterations());
+}
+MSIP_BENCHMARK("XmlDelegateImpl/SelectNodes/Policy", BM_DocumentSelect);
+
+// The library's own scanner, which copies every name and value, as the baseline.
+void BM_ScannerRead(State& state) {
+  while (state.KeepRunning()) {
+    XmlScanner scanner(Policy());
+    while (scanner.Next() != XmlScanner::Token::End) {
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(Policy().size()));
+}
+MSIP_BENCHMARK("XmlScanner/Next/Policy", BM_ScannerRead);
+
+} // namespace
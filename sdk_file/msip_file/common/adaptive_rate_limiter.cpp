@@ -0,0 +1,190 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "adaptive_rate_limiter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+
+namespace sample {
+namespace http {
+
+namespace {
+
+// A throttled bucket holds a tenth of a second of requests, and at least one.
+const double kBurstSeconds = 0.1;
+const std::chrono::seconds kWindow(1);
+
+} // namespace
+
+AdaptiveRateLimiter::Policy::Policy()
+    : enabled(true),
+      minRate(1.0),
+      maxRate(0.0),
+      increasePerSecond(5.0),
+      decrease(0.5),
+      maxRetryAfterMs(60000),
+      relaxAfterMs(60000) {}
+
+AdaptiveRateLimiter::Bucket::Bucket()
+    : rate(0.0), tokens(0.0), windowRequests(0), previousWindowRequests(0) {}
+
+bool AdaptiveRateLimiter::IsValid(const Policy& policy) {
+  return policy.minRate > 0 && policy.maxRate >= 0 && (policy.maxRate == 0 || policy.maxRate >= policy.minRate) &&
+      policy.increasePerSecond >= 0 && policy.decrease > 0 && policy.decrease < 1 && policy.maxRetryAfterMs >= 0 &&
+      policy.relaxAfterMs >= 0;
+}
+
+void AdaptiveRateLimiter::SetPolicy(const Policy& policy) {
+  mPolicy = policy;
+  if (!policy.enabled) {
+    mBuckets.clear();
+    return;
+  }
+  for (auto& entry : mBuckets) {
+    auto& bucket = entry.second;
+    if (bucket.rate > 0)
+      bucket.rate = std::max(bucket.rate, policy.minRate);
+    if (policy.maxRate > 0)
+      bucket.rate = bucket.rate > 0 ? std::min(bucket.rate, policy.maxRate) : policy.maxRate;
+  }
+}
+
+void AdaptiveRateLimiter::Refill(Bucket& bucket, Clock::time_point now) const {
+  if (bucket.rate <= 0)
+    return;
+  const double seconds = std::chrono::duration<double>(now - bucket.refilledAt).count();
+  if (seconds > 0)
+    bucket.tokens = std::min(std::max(1.0, bucket.rate * kBurstSeconds), bucket.tokens + seconds * bucket.rate);
+  bucket.refilledAt = now;
+}
+
+bool AdaptiveRateLimiter::TryAcquire(const Key& key, Clock::time_point now, Clock::time_point& readyAt) {
+  if (!mPolicy.enabled)
+    return true;
+  auto inserted = mBuckets.emplace(key, Bucket());
+  auto& bucket = inserted.first->second;
+  if (inserted.second) {
+    bucket.rate = mPolicy.maxRate;
+    bucket.tokens = std::max(1.0, bucket.rate * kBurstSeconds);
+    bucket.refilledAt = bucket.windowStart = now;
+  }
+
+  if (now < bucket.blockedUntil) {
+    bucket.waitedAt = now;
+    readyAt = bucket.blockedUntil;
+    return false;
+  }
+  // A bucket that has not limited anything for a while goes back to the static limit, if any.
+  const auto relaxAfter = std::chrono::milliseconds(mPolicy.relaxAfterMs);
+  if (bucket.rate > 0 && bucket.rate != mPolicy.maxRate && now - bucket.waitedAt > relaxAfter && now - bucket.throttledAt > relaxAfter)
+    bucket.rate = mPolicy.maxRate;
+  if (bucket.rate > 0) {
+    Refill(bucket, now);
+    if (bucket.tokens < 1.0) {
+      bucket.waitedAt = now;
+      readyAt = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1.0 - bucket.tokens) / bucket.rate));
+      return false;
+    }
+    bucket.tokens -= 1.0;
+  }
+
+  if (now - bucket.windowStart >= kWindow) {
+    bucket.previousWindowRequests = now - bucket.windowStart >= 2 * kWindow ? 0 : bucket.windowRequests;
+    bucket.windowRequests = 0;
+    bucket.windowStart = now;
+  }
+  ++bucket.windowRequests;
+  return true;
+}
+
+void AdaptiveRateLimiter::OnSuccess(const Key& key, Clock::time_point now) {
+  auto it = mBuckets.find(key);
+  if (it == mBuckets.end())
+    return;
+  auto& bucket = it->second;
+  // Only a rate that limits something is raised, so an idle bucket does not drift up to where the next
+  // decrease means nothing. Per response, increasePerSecond / rate adds up to increasePerSecond a second.
+  if (bucket.rate <= 0 || now - bucket.waitedAt > kWindow)
+    return;
+  bucket.rate += mPolicy.increasePerSecond / bucket.rate;
+  if (mPolicy.maxRate > 0)
+    bucket.rate = std::min(bucket.rate, mPolicy.maxRate);
+}
+
+bool AdaptiveRateLimiter::OnThrottled(const Key& key, Clock::time_point admittedAt, Clock::time_point now, int64_t retryAfterMs) {
+  if (!mPolicy.enabled)
+    return false;
+  auto it = mBuckets.find(key);
+  if (it == mBuckets.end())
+    return false;
+  auto& bucket = it->second;
+  bucket.throttledAt = now;
+  if (retryAfterMs > 0)
+    bucket.blockedUntil = std::max(bucket.blockedUntil, now + std::chrono::milliseconds(std::min(retryAfterMs, mPolicy.maxRetryAfterMs)));
+
+  // The requests in flight when the service started throttling all come back throttled; they count as
+  // one signal, so only a request sent after the last decrease lowers the rate again.
+  if (bucket.rate > 0 && admittedAt < bucket.decreasedAt)
+    return false;
+  if (bucket.rate > 0) {
+    bucket.rate = std::max(mPolicy.minRate, bucket.rate * mPolicy.decrease);
+  } else {
+    const double seconds = std::max(1.0, std::chrono::duration<double>(now - bucket.windowStart).count());
+    const double observed = std::max(static_cast<double>(bucket.previousWindowRequests), bucket.windowRequests / seconds);
+    bucket.rate = std::max(mPolicy.minRate, observed * mPolicy.decrease);
+  }
+  bucket.tokens = 0;
+  bucket.refilledAt = std::max(now, bucket.blockedUntil);
+  bucket.decreasedAt = now;
+  return true;
+}
+
+double AdaptiveRateLimiter::GetRate(const Key& key) const {
+  auto it = mBuckets.find(key);
+  return it == mBuckets.end() ? 0.0 : it->second.rate;
+}
+
+int64_t AdaptiveRateLimiter::ParseRetryAfter(const std::string& value, std::chrono::system_clock::time_point now) {
+  if (value.empty())
+    return -1;
+  if (std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+    const long long seconds = std::strtoll(value.c_str(), nullptr, 10);
+    return seconds > 0 && seconds < 86400LL * 365 ? seconds * 1000 : 0;
+  }
+  // IMF-fixdate, e.g. "Wed, 21 Oct 2015 07:28:00 GMT"; the obsolete formats are not used by the services.
+  std::tm date = {};
+  const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &date);
+  if (!end || *end != '\0')
+    return -1;
+  const auto at = std::chrono::system_clock::from_time_t(timegm(&date));
+  return at > now ? std::chrono::duration_cast<std::chrono::milliseconds>(at - now).count() : 0;
+}
+
+} // namespace http
+} // namespace sample
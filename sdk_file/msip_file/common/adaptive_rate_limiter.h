@@ -0,0 +1,114 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_ADAPTIVE_RATE_LIMITER_H_
+#define SAMPLES_COMMON_ADAPTIVE_RATE_LIMITER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace sample {
+namespace http {
+
+// Token buckets per (tenant, host) whose rate follows the service's throttling: unlimited until a 429 or
+// 503 answers a request, then halved (multiplicative decrease) on each throttled response to a request
+// sent since the last decrease, and raised by increasePerSecond every second of successful requests that
+// had to wait for a token (additive increase). A Retry-After stops the bucket until it has passed. A bucket
+// that neither throttled nor made a request wait for relaxAfterMs is unlimited again. Not thread safe; the
+// HTTP event loop owns it.
+class AdaptiveRateLimiter final {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Policy {
+    bool enabled;
+    // Requests per second a throttled bucket never goes below, and never above when maxRate is not 0.
+    double minRate;
+    double maxRate;
+    double increasePerSecond;
+    // Fraction of its rate a bucket keeps on a throttled response, in (0, 1).
+    double decrease;
+    // Longest Retry-After honored, so a wrong header cannot stall a host for long.
+    int64_t maxRetryAfterMs;
+    int64_t relaxAfterMs;
+
+    Policy();
+  };
+
+  struct Bucket {
+    // Requests per second; 0 is unlimited.
+    double rate;
+    double tokens;
+    Clock::time_point refilledAt;
+    Clock::time_point blockedUntil;
+    Clock::time_point decreasedAt;
+    Clock::time_point waitedAt;
+    Clock::time_point throttledAt;
+    // Requests admitted in the current second and the one before, to start from the rate that was throttled.
+    Clock::time_point windowStart;
+    uint64_t windowRequests;
+    uint64_t previousWindowRequests;
+
+    Bucket();
+  };
+
+  typedef std::pair<std::string, std::string> Key;
+
+  static bool IsValid(const Policy& policy);
+
+  void SetPolicy(const Policy& policy);
+  const Policy& GetPolicy() const { return mPolicy; }
+
+  // Takes a token from key's bucket. When there is none, returns false and sets readyAt to when the next
+  // one is due; the caller asks again then.
+  bool TryAcquire(const Key& key, Clock::time_point now, Clock::time_point& readyAt);
+  // A response that was not throttled.
+  void OnSuccess(const Key& key, Clock::time_point now);
+  // retryAfterMs is the response's Retry-After, or -1 without one. Returns true when the bucket's rate changed.
+  bool OnThrottled(const Key& key, Clock::time_point admittedAt, Clock::time_point now, int64_t retryAfterMs);
+
+  // Requests per second key is limited to; 0 while unlimited.
+  double GetRate(const Key& key) const;
+  const std::map<Key, Bucket>& GetBuckets() const { return mBuckets; }
+
+  // Milliseconds a Retry-After value asks to wait: delay-seconds or an HTTP date. -1 when it is neither.
+  static int64_t ParseRetryAfter(const std::string& value, std::chrono::system_clock::time_point now);
+
+private:
+  void Refill(Bucket& bucket, Clock::time_point now) const;
+
+  Policy mPolicy;
+  std::map<Key, Bucket> mBuckets;
+};
+
+} // namespace http
+} // namespace sample
+
+#endif // SAMPLES_COMMON_ADAPTIVE_RATE_LIMITER_H_
@@ -0,0 +1,220 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "allocation_account.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace sample {
+namespace alloc {
+
+namespace {
+
+const size_t kSubsystemCount = static_cast<size_t>(Subsystem::Count);
+// Threads spread their counts over this many cache lines, so allocating threads rarely share one.
+const size_t kShardCount = 32;
+
+struct alignas(64) Shard {
+  std::atomic<int64_t> liveBytes[kSubsystemCount];
+  std::atomic<uint64_t> allocatedBytes[kSubsystemCount];
+};
+
+// Zero-initialized before any constructor runs, so allocations made during static initialization count.
+Shard gShards[kShardCount];
+std::atomic<uint32_t> gThreadCount(0);
+
+// Plain values, so the replacement operator new can read them even while the thread is being torn down.
+thread_local Subsystem tSubsystem = Subsystem::Sdk;
+thread_local Account* tAccount = nullptr;
+thread_local uint32_t tShard = kShardCount;
+thread_local std::shared_ptr<Account> tCurrentAccount;
+
+Shard& LocalShard() {
+  if (tShard == kShardCount)
+    tShard = gThreadCount.fetch_add(1, std::memory_order_relaxed) % kShardCount;
+  return gShards[tShard];
+}
+
+class Registry final {
+public:
+  static Registry& Instance() {
+    static Registry* instance = new Registry(); // Never destroyed, so operations ending during exit still record.
+    return *instance;
+  }
+
+  void Add(const char* operation, const Account& account) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& stats = mOperations[operation];
+    const uint64_t peak = static_cast<uint64_t>(std::max<int64_t>(account.GetPeakBytes(), 0));
+    ++stats.operations;
+    stats.allocations += account.GetAllocations();
+    stats.allocatedBytes += account.GetAllocatedBytes();
+    stats.peakBytesSum += peak;
+    stats.peakBytesMax = std::max(stats.peakBytesMax, peak);
+  }
+
+  std::vector<OperationStats> Snapshot() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<OperationStats> operations;
+    for (const auto& entry : mOperations) {
+      operations.push_back(entry.second);
+      operations.back().operation = entry.first;
+    }
+    return operations;
+  }
+
+private:
+  std::mutex mMutex;
+  std::map<std::string, OperationStats> mOperations;
+};
+
+} // namespace
+
+Account::Account()
+    : mAllocations(0),
+      mAllocatedBytes(0),
+      mLiveBytes(0),
+      mPeakBytes(0) {
+}
+
+void Account::Charge(size_t bytes) {
+  mAllocations.fetch_add(1, std::memory_order_relaxed);
+  mAllocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  const int64_t live = mLiveBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed) + static_cast<int64_t>(bytes);
+  int64_t peak = mPeakBytes.load(std::memory_order_relaxed);
+  while (live > peak && !mPeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void Account::Credit(size_t bytes) {
+  mLiveBytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+bool IsEnabled() {
+#ifdef MSIP_ALLOCATION_ACCOUNTING
+  return true;
+#else
+  return false;
+#endif
+}
+
+void OnAllocate(size_t bytes) {
+  OnAllocate(tSubsystem, bytes);
+}
+
+void OnFree(size_t bytes) {
+  OnFree(tSubsystem, bytes);
+}
+
+void OnAllocate(Subsystem subsystem, size_t bytes) {
+  auto& shard = LocalShard();
+  const auto index = static_cast<size_t>(subsystem);
+  shard.liveBytes[index].fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  shard.allocatedBytes[index].fetch_add(bytes, std::memory_order_relaxed);
+  if (tAccount)
+    tAccount->Charge(bytes);
+}
+
+void OnFree(Subsystem subsystem, size_t bytes) {
+  LocalShard().liveBytes[static_cast<size_t>(subsystem)].fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  if (tAccount)
+    tAccount->Credit(bytes);
+}
+
+Snapshot Read() {
+  Snapshot snapshot = {};
+  snapshot.enabled = IsEnabled();
+  for (const auto& shard : gShards) {
+    for (size_t index = 0; index < kSubsystemCount; ++index) {
+      snapshot.liveBytes[index] += shard.liveBytes[index].load(std::memory_order_relaxed);
+      snapshot.allocatedBytes[index] += shard.allocatedBytes[index].load(std::memory_order_relaxed);
+    }
+  }
+  snapshot.operations = Registry::Instance().Snapshot();
+  return snapshot;
+}
+
+const char* GetName(Subsystem subsystem) {
+  switch (subsystem) {
+    case Subsystem::Sdk: return "sdk";
+    case Subsystem::Streams: return "streams";
+    case Subsystem::Caches: return "caches";
+    case Subsystem::Engines: return "engines";
+    default: return "unknown";
+  }
+}
+
+Subsystem CurrentSubsystem() {
+  return tSubsystem;
+}
+
+const std::shared_ptr<Account>& CurrentAccount() {
+  return tCurrentAccount;
+}
+
+ScopedSubsystem::ScopedSubsystem(Subsystem subsystem)
+    : mPrevious(tSubsystem) {
+  tSubsystem = subsystem;
+}
+
+ScopedSubsystem::~ScopedSubsystem() {
+  tSubsystem = mPrevious;
+}
+
+ScopedAccount::ScopedAccount(const std::shared_ptr<Account>& account)
+    : mPrevious(tCurrentAccount) {
+  tCurrentAccount = account;
+  tAccount = account.get();
+}
+
+ScopedAccount::~ScopedAccount() {
+  tAccount = mPrevious.get();
+  tCurrentAccount.swap(mPrevious);
+}
+
+ScopedOperation::ScopedOperation(const char* operation)
+    : mOperation(operation) {
+  if (!IsEnabled())
+    return;
+  mAccount = std::make_shared<Account>();
+  mScope.reset(new ScopedAccount(mAccount));
+}
+
+ScopedOperation::~ScopedOperation() {
+  if (!mAccount)
+    return;
+  mScope.reset();
+  try {
+    Registry::Instance().Add(mOperation, *mAccount);
+  } catch (const std::exception&) {
+    // Accounting is best effort; the operation's result stands.
+  }
+}
+
+} // namespace alloc
+} // namespace sample
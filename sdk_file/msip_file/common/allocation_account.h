@@ -0,0 +1,155 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_ALLOCATION_ACCOUNT_H_
+#define SAMPLES_COMMON_ALLOCATION_ACCOUNT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace alloc {
+
+// Heap accounting for builds made with scons --allocation_accounting, which defines
+// MSIP_ALLOCATION_ACCOUNTING and replaces operator new and delete in aip_file.so (see operator_new.cpp).
+// Every allocation is charged, at the allocator's usable size, to the subsystem the allocating thread
+// runs under and to the account of the operation it runs for. Like the priority, the task dispatcher
+// carries both onto the SDK's background work. A free is credited to the subsystem current at the free,
+// so memory that outlives the code that allocated it, e.g. a license handler an operation still holds
+// when its cache evicts it, moves between subsystems while the totals stay exact. Without the build
+// option nothing is counted and every scope is a no-op.
+enum class Subsystem : uint8_t {
+  Sdk,      // The SDK and anything not tagged otherwise.
+  Streams,  // Buffer pool memory behind read ahead inputs and output streams.
+  Caches,   // Cache entries and what the SDK allocated while filling them.
+  Engines,  // Engines, with what the SDK allocated loading and unloading them.
+  Count
+};
+
+// The memory one operation allocated: in total, and the most it held at once.
+class Account final {
+public:
+  Account();
+
+  void Charge(size_t bytes);
+  void Credit(size_t bytes);
+
+  uint64_t GetAllocations() const { return mAllocations.load(std::memory_order_relaxed); }
+  uint64_t GetAllocatedBytes() const { return mAllocatedBytes.load(std::memory_order_relaxed); }
+  int64_t GetPeakBytes() const { return mPeakBytes.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> mAllocations;
+  std::atomic<uint64_t> mAllocatedBytes;
+  std::atomic<int64_t> mLiveBytes;
+  std::atomic<int64_t> mPeakBytes;
+};
+
+struct OperationStats {
+  std::string operation;
+  uint64_t operations;
+  uint64_t allocations;
+  uint64_t allocatedBytes;
+  // Sum and largest of the operations' peaks.
+  uint64_t peakBytesSum;
+  uint64_t peakBytesMax;
+};
+
+struct Snapshot {
+  bool enabled;
+  // Charged minus credited per subsystem, indexed by Subsystem; may dip below 0 (see above).
+  int64_t liveBytes[static_cast<size_t>(Subsystem::Count)];
+  uint64_t allocatedBytes[static_cast<size_t>(Subsystem::Count)];
+  std::vector<OperationStats> operations;
+};
+
+// Whether the library was built with allocation accounting.
+bool IsEnabled();
+
+// Called by the replacement operator new and delete with the usable size of each allocation, and by the
+// buffer pool for the memory it maps itself. Must not allocate.
+void OnAllocate(size_t bytes);
+void OnFree(size_t bytes);
+void OnAllocate(Subsystem subsystem, size_t bytes);
+void OnFree(Subsystem subsystem, size_t bytes);
+
+Snapshot Read();
+
+const char* GetName(Subsystem subsystem);
+
+Subsystem CurrentSubsystem();
+// nullptr when no operation on this thread is accounted.
+const std::shared_ptr<Account>& CurrentAccount();
+
+// Charges this thread's allocations to subsystem for the lifetime of the scope.
+class ScopedSubsystem final {
+public:
+  explicit ScopedSubsystem(Subsystem subsystem);
+  ~ScopedSubsystem();
+
+  ScopedSubsystem(const ScopedSubsystem&) = delete;
+  ScopedSubsystem& operator=(const ScopedSubsystem&) = delete;
+
+private:
+  Subsystem mPrevious;
+};
+
+// Installs an account on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedAccount final {
+public:
+  explicit ScopedAccount(const std::shared_ptr<Account>& account);
+  ~ScopedAccount();
+
+  ScopedAccount(const ScopedAccount&) = delete;
+  ScopedAccount& operator=(const ScopedAccount&) = delete;
+
+private:
+  std::shared_ptr<Account> mPrevious;
+};
+
+// Accounts one operation of the named type, whose totals are added to the type's when the scope ends.
+class ScopedOperation final {
+public:
+  explicit ScopedOperation(const char* operation);
+  ~ScopedOperation();
+
+  ScopedOperation(const ScopedOperation&) = delete;
+  ScopedOperation& operator=(const ScopedOperation&) = delete;
+
+private:
+  const char* mOperation;
+  std::shared_ptr<Account> mAccount;
+  std::unique_ptr<ScopedAccount> mScope;
+};
+
+} // namespace alloc
+} // namespace sample
+
+#endif // SAMPLES_COMMON_ALLOCATION_ACCOUNT_H_
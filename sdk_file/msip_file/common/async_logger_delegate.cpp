@@ -0,0 +1,421 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "async_logger_delegate.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "trace_context.h"
+
+using mip::LogLevel;
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::lock_guard;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace sample {
+namespace log {
+
+namespace {
+
+static const char kLogFileName[] = "/mip_sdk.log";
+static const size_t kMaxBatchSize = 256;
+static const milliseconds kWriteInterval(100);
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 2;
+  while (result < value)
+    result <<= 1;
+  return result;
+}
+
+const char* LevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::Trace: return "Trace";
+    case LogLevel::Info: return "Info";
+    case LogLevel::Warning: return "Warning";
+    case LogLevel::Error: return "Error";
+  }
+  return "Unknown";
+}
+
+void AppendJsonString(const string& value, string& out) {
+  static const char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (unsigned char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          out += "\\u00";
+          out += kHex[c >> 4];
+          out += kHex[c & 0xf];
+        } else {
+          out += static_cast<char>(c);
+        }
+    }
+  }
+  out += '"';
+}
+
+void AppendTimestamp(system_clock::time_point time, string& out) {
+  const auto sinceEpoch = duration_cast<milliseconds>(time.time_since_epoch());
+  const time_t secondsSinceEpoch = static_cast<time_t>(sinceEpoch.count() / 1000);
+  tm utc;
+  gmtime_r(&secondsSinceEpoch, &utc);
+  char buffer[32];
+  const size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", static_cast<int>(sinceEpoch.count() % 1000));
+  out += buffer;
+}
+
+} // namespace
+
+AsyncLoggerDelegate::AsyncLoggerDelegate(Sink sink, LogLevel level, size_t capacity)
+    : mSink(sink),
+      mLevel(static_cast<unsigned int>(level)),
+      mCaptureLevel(static_cast<unsigned int>(level)),
+      mSlots(RoundUpToPowerOfTwo(capacity)),
+      mMask(mSlots.size() - 1),
+      mEnqueuePosition(0),
+      mDequeuePosition(0),
+      mWritten(0),
+      mDroppedOverflow(0),
+      mDroppedSampled(0),
+      mDroppedRateLimited(0),
+      mDroppedBelowLevel(0),
+      mTracedBelowLevel(0),
+      mFile(nullptr),
+      mFlushRequested(0),
+      mFlushCompleted(0),
+      mStopping(false) {
+  for (size_t i = 0; i < mSlots.size(); ++i)
+    mSlots[i].sequence.store(i, memory_order_relaxed);
+  for (auto& state : mLevels) {
+    state.sampleEvery.store(1, memory_order_relaxed);
+    state.maxPerSecond.store(0, memory_order_relaxed);
+    state.sampleCounter.store(0, memory_order_relaxed);
+    state.windowSecond.store(0, memory_order_relaxed);
+    state.windowCount.store(0, memory_order_relaxed);
+  }
+  mWriter = std::thread(&AsyncLoggerDelegate::Run, this);
+}
+
+AsyncLoggerDelegate::~AsyncLoggerDelegate() {
+  {
+    lock_guard<mutex> lock(mWakeMutex);
+    mStopping = true;
+  }
+  mWake.notify_all();
+  if (mWriter.joinable())
+    mWriter.join();
+  if (mFile)
+    fclose(mFile);
+}
+
+void AsyncLoggerDelegate::PauseThreads() {
+  {
+    lock_guard<mutex> lock(mWakeMutex);
+    if (!mWriter.joinable())
+      return;
+    mStopping = true;
+  }
+  mWake.notify_all();
+  mWriter.join();
+  lock_guard<mutex> lock(mFileMutex);
+  if (mFile)
+    fflush(mFile);
+}
+
+void AsyncLoggerDelegate::ResumeThreads() {
+  {
+    lock_guard<mutex> lock(mWakeMutex);
+    if (mWriter.joinable())
+      return;
+    mStopping = false;
+  }
+  mWriter = std::thread(&AsyncLoggerDelegate::Run, this);
+}
+
+void AsyncLoggerDelegate::Init(const string& storagePath) {
+  if (mSink != Sink::File)
+    return;
+  lock_guard<mutex> lock(mFileMutex);
+  // Every context calls Init; the first storage path wins so all records land in one file.
+  if (!mFile)
+    mFile = fopen((storagePath + kLogFileName).c_str(), "a");
+}
+
+void AsyncLoggerDelegate::Flush() {
+  unique_lock<mutex> lock(mWakeMutex);
+  const uint64_t request = ++mFlushRequested;
+  mWake.notify_all();
+  mFlushed.wait(lock, [this, request] { return mFlushCompleted >= request || mStopping; });
+}
+
+bool AsyncLoggerDelegate::FlushUntil(std::chrono::steady_clock::time_point deadline) {
+  unique_lock<mutex> lock(mWakeMutex);
+  const uint64_t request = ++mFlushRequested;
+  mWake.notify_all();
+  return mFlushed.wait_until(lock, deadline, [this, request] { return mFlushCompleted >= request || mStopping; });
+}
+
+void AsyncLoggerDelegate::WriteToLog(
+    const LogLevel level,
+    const string& message,
+    const string& function,
+    const string& file,
+    const int32_t line) {
+  if (!Admit(level, file))
+    return;
+
+  Record record;
+  record.level = level;
+  record.time = system_clock::now();
+  record.threadId = std::this_thread::get_id();
+  record.message = message;
+  record.function = function;
+  record.file = file;
+  record.line = line;
+  if (!TryPush(record))
+    mDroppedOverflow.fetch_add(1, memory_order_relaxed);
+}
+
+void AsyncLoggerDelegate::SetLevel(LogLevel level) {
+  mLevel.store(static_cast<unsigned int>(level), memory_order_relaxed);
+}
+
+LogLevel AsyncLoggerDelegate::GetLevel() const {
+  return static_cast<LogLevel>(mLevel.load(memory_order_relaxed));
+}
+
+void AsyncLoggerDelegate::SetLevelLimits(LogLevel level, const LevelLimits& limits) {
+  const auto index = static_cast<size_t>(level);
+  if (index >= kLevelCount)
+    return;
+  mLevels[index].sampleEvery.store(limits.sampleEvery > 0 ? limits.sampleEvery : 1, memory_order_relaxed);
+  mLevels[index].maxPerSecond.store(limits.maxPerSecond, memory_order_relaxed);
+}
+
+void AsyncLoggerDelegate::SetCaptureLevel(LogLevel level) {
+  mCaptureLevel.store(static_cast<unsigned int>(level), memory_order_relaxed);
+}
+
+LogLevel AsyncLoggerDelegate::GetCaptureLevel() const {
+  return static_cast<LogLevel>(std::min(mCaptureLevel.load(memory_order_relaxed), mLevel.load(memory_order_relaxed)));
+}
+
+void AsyncLoggerDelegate::SetModuleTrace(const string& module, bool enabled) {
+  if (module.empty())
+    return;
+  lock_guard<mutex> lock(mModulesMutex);
+  auto current = std::atomic_load(&mTracedModules);
+  vector<string> modules = current ? *current : vector<string>();
+  auto found = std::find(modules.begin(), modules.end(), module);
+  if (enabled && found == modules.end())
+    modules.push_back(module);
+  else if (!enabled && found != modules.end())
+    modules.erase(found);
+  else
+    return;
+  std::shared_ptr<const vector<string>> replaced;
+  if (!modules.empty())
+    replaced = std::make_shared<const vector<string>>(std::move(modules));
+  std::atomic_store(&mTracedModules, replaced);
+}
+
+AsyncLoggerDelegate::Stats AsyncLoggerDelegate::GetStats() const {
+  Stats stats;
+  stats.written = mWritten.load(memory_order_relaxed);
+  stats.droppedOverflow = mDroppedOverflow.load(memory_order_relaxed);
+  stats.droppedSampled = mDroppedSampled.load(memory_order_relaxed);
+  stats.droppedRateLimited = mDroppedRateLimited.load(memory_order_relaxed);
+  stats.droppedBelowLevel = mDroppedBelowLevel.load(memory_order_relaxed);
+  stats.tracedBelowLevel = mTracedBelowLevel.load(memory_order_relaxed);
+  return stats;
+}
+
+bool AsyncLoggerDelegate::IsTraced(const string& file) const {
+  if (trace::TraceContext::Current().verbose)
+    return true;
+  const auto modules = std::atomic_load(&mTracedModules);
+  if (!modules)
+    return false;
+  return std::any_of(modules->begin(), modules->end(), [&file](const string& module) {
+    return file.find(module) != string::npos;
+  });
+}
+
+bool AsyncLoggerDelegate::Admit(LogLevel level, const string& file) {
+  const auto index = static_cast<unsigned int>(level);
+  if (index >= kLevelCount) {
+    mDroppedBelowLevel.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+  // Traced records skip sampling and rate limits: they were asked for.
+  if (index < mLevel.load(memory_order_relaxed)) {
+    if (!IsTraced(file)) {
+      mDroppedBelowLevel.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+    mTracedBelowLevel.fetch_add(1, memory_order_relaxed);
+    return true;
+  }
+
+  LevelState& state = mLevels[index];
+  const uint32_t sampleEvery = state.sampleEvery.load(memory_order_relaxed);
+  if (sampleEvery > 1 && state.sampleCounter.fetch_add(1, memory_order_relaxed) % sampleEvery != 0) {
+    mDroppedSampled.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  const uint32_t maxPerSecond = state.maxPerSecond.load(memory_order_relaxed);
+  if (maxPerSecond > 0) {
+    const int64_t now = duration_cast<seconds>(steady_clock::now().time_since_epoch()).count();
+    int64_t window = state.windowSecond.load(memory_order_relaxed);
+    // Whoever moves the window resets its count; records racing with the reset may land in either window.
+    if (window != now && state.windowSecond.compare_exchange_strong(window, now, memory_order_relaxed))
+      state.windowCount.store(0, memory_order_relaxed);
+    if (state.windowCount.fetch_add(1, memory_order_relaxed) >= maxPerSecond) {
+      mDroppedRateLimited.fetch_add(1, memory_order_relaxed);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AsyncLoggerDelegate::TryPush(Record& record) {
+  size_t position = mEnqueuePosition.load(memory_order_relaxed);
+  for (;;) {
+    Slot& slot = mSlots[position & mMask];
+    const size_t sequence = slot.sequence.load(memory_order_acquire);
+    const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+    if (difference == 0) {
+      if (mEnqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+        slot.record = std::move(record);
+        slot.sequence.store(position + 1, memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      return false; // full: the writer has not yet consumed this slot's previous record
+    } else {
+      position = mEnqueuePosition.load(memory_order_relaxed);
+    }
+  }
+}
+
+bool AsyncLoggerDelegate::TryPop(Record& record) {
+  Slot& slot = mSlots[mDequeuePosition & mMask];
+  if (slot.sequence.load(memory_order_acquire) != mDequeuePosition + 1)
+    return false;
+  record = std::move(slot.record);
+  slot.sequence.store(mDequeuePosition + mMask + 1, memory_order_release);
+  ++mDequeuePosition;
+  return true;
+}
+
+void AsyncLoggerDelegate::Run() {
+  vector<Record> batch;
+  batch.reserve(kMaxBatchSize);
+  for (;;) {
+    uint64_t flushTarget;
+    bool stopping;
+    {
+      unique_lock<mutex> lock(mWakeMutex);
+      mWake.wait_for(lock, kWriteInterval, [this] { return mStopping || mFlushRequested > mFlushCompleted; });
+      flushTarget = mFlushRequested;
+      stopping = mStopping;
+    }
+
+    Record record;
+    while (TryPop(record)) {
+      batch.push_back(std::move(record));
+      if (batch.size() == kMaxBatchSize) {
+        WriteBatch(batch);
+        batch.clear();
+      }
+    }
+    if (!batch.empty()) {
+      WriteBatch(batch);
+      batch.clear();
+    }
+
+    {
+      lock_guard<mutex> lock(mWakeMutex);
+      mFlushCompleted = flushTarget;
+    }
+    mFlushed.notify_all();
+    if (stopping)
+      return;
+  }
+}
+
+void AsyncLoggerDelegate::WriteBatch(const vector<Record>& batch) {
+  string lines;
+  for (const auto& record : batch) {
+    lines += "{\"time\": \"";
+    AppendTimestamp(record.time, lines);
+    lines += "\", \"level\": \"";
+    lines += LevelName(record.level);
+    lines += "\", \"thread\": ";
+    lines += std::to_string(std::hash<std::thread::id>()(record.threadId));
+    lines += ", \"message\": ";
+    AppendJsonString(record.message, lines);
+    lines += ", \"function\": ";
+    AppendJsonString(record.function, lines);
+    lines += ", \"file\": ";
+    AppendJsonString(record.file, lines);
+    lines += ", \"line\": ";
+    lines += std::to_string(record.line);
+    lines += "}\n";
+  }
+
+  lock_guard<mutex> lock(mFileMutex);
+  FILE* out = mFile ? mFile : stdout;
+  fwrite(lines.data(), 1, lines.size(), out);
+  fflush(out);
+  mWritten.fetch_add(batch.size(), memory_order_relaxed);
+}
+
+} // namespace log
+} // namespace sample
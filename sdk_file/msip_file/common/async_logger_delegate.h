@@ -0,0 +1,183 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_ASYNC_LOGGER_DELEGATE_H_
+#define SAMPLES_COMMON_ASYNC_LOGGER_DELEGATE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mip/logger_delegate.h"
+
+namespace sample {
+namespace log {
+
+// LoggerDelegate that never blocks the logging thread on I/O. Records go into a bounded lock-free ring
+// and a background thread writes them as JSON lines in batches, to <storagePath>/mip_sdk.log or stdout.
+// When the ring is full the record is dropped and counted. Each level can be sampled (keep one record
+// in sampleEvery) and rate limited (at most maxPerSecond records per second). Records below the level can
+// still be let through for modules and requests being traced, when contexts capture them (SetCaptureLevel).
+class AsyncLoggerDelegate final : public mip::LoggerDelegate {
+public:
+  enum class Sink { File, Stdout };
+
+  struct LevelLimits {
+    uint32_t sampleEvery = 1;
+    uint32_t maxPerSecond = 0; // 0 means unlimited
+  };
+
+  struct Stats {
+    uint64_t written;
+    uint64_t droppedOverflow;
+    uint64_t droppedSampled;
+    uint64_t droppedRateLimited;
+    uint64_t droppedBelowLevel;
+    // Records below the level let through for a traced module or request.
+    uint64_t tracedBelowLevel;
+  };
+
+  static const size_t kDefaultCapacity = 8192;
+
+  // capacity is rounded up to a power of two.
+  AsyncLoggerDelegate(Sink sink, mip::LogLevel level, size_t capacity = kDefaultCapacity);
+  ~AsyncLoggerDelegate();
+
+  void Init(const std::string& storagePath) override;
+
+  // Returns once every record queued before the call has been written.
+  void Flush() override;
+  // Flush giving up at deadline. Returns false when the records were still being written then.
+  bool FlushUntil(std::chrono::steady_clock::time_point deadline);
+
+  void WriteToLog(
+      const mip::LogLevel level,
+      const std::string& message,
+      const std::string& function,
+      const std::string& file,
+      const int32_t line) override;
+
+  // Takes effect immediately. The SDK only hands a context's records at or above the level the context
+  // was created with, so lowering it below that level affects contexts created afterwards only.
+  void SetLevel(mip::LogLevel level);
+  mip::LogLevel GetLevel() const;
+
+  void SetLevelLimits(mip::LogLevel level, const LevelLimits& limits);
+
+  // Level contexts created afterwards hand their records over at, when it is below GetLevel(). Records
+  // under the level cost the SDK's formatting and one relaxed load here before they are dropped, unless a
+  // traced module or request lets them through. Set it at or above the level to capture nothing extra.
+  void SetCaptureLevel(mip::LogLevel level);
+  // The lower of the capture level and GetLevel(), for new contexts' MipConfiguration.
+  mip::LogLevel GetCaptureLevel() const;
+
+  // Lets through every captured record whose source file path contains module, e.g. "http" or "policy".
+  void SetModuleTrace(const std::string& module, bool enabled);
+
+  Stats GetStats() const;
+
+  // Writes the queued records and joins the writer thread, so the process can fork with no buffered
+  // output to write twice. Records logged meanwhile wait in the queue. ResumeThreads starts the writer again.
+  void PauseThreads();
+  void ResumeThreads();
+
+private:
+  struct Record {
+    mip::LogLevel level;
+    std::chrono::system_clock::time_point time;
+    std::thread::id threadId;
+    std::string message;
+    std::string function;
+    std::string file;
+    int32_t line;
+  };
+
+  // Slot of a bounded multi-producer queue: sequence tells producers and the consumer whose turn it is.
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Record record;
+  };
+
+  struct LevelState {
+    std::atomic<uint32_t> sampleEvery;
+    std::atomic<uint32_t> maxPerSecond;
+    std::atomic<uint64_t> sampleCounter;
+    std::atomic<int64_t> windowSecond;
+    std::atomic<uint32_t> windowCount;
+  };
+
+  static const size_t kLevelCount = 4;
+
+  bool Admit(mip::LogLevel level, const std::string& file);
+  // For records under the level: whether a traced request or module lets this one through.
+  bool IsTraced(const std::string& file) const;
+  bool TryPush(Record& record);
+  bool TryPop(Record& record);
+  void Run();
+  void WriteBatch(const std::vector<Record>& batch);
+
+  const Sink mSink;
+  std::atomic<unsigned int> mLevel;
+  std::atomic<unsigned int> mCaptureLevel;
+  // Replaced whole on change, so WriteToLog reads it without a lock; null when no module is traced.
+  std::shared_ptr<const std::vector<std::string>> mTracedModules;
+  std::mutex mModulesMutex;
+  std::vector<Slot> mSlots;
+  const size_t mMask;
+  std::atomic<size_t> mEnqueuePosition;
+  size_t mDequeuePosition;
+  LevelState mLevels[kLevelCount];
+
+  std::atomic<uint64_t> mWritten;
+  std::atomic<uint64_t> mDroppedOverflow;
+  std::atomic<uint64_t> mDroppedSampled;
+  std::atomic<uint64_t> mDroppedRateLimited;
+  std::atomic<uint64_t> mDroppedBelowLevel;
+  std::atomic<uint64_t> mTracedBelowLevel;
+
+  std::mutex mFileMutex;
+  FILE* mFile;
+
+  std::mutex mWakeMutex;
+  std::condition_variable mWake;
+  std::condition_variable mFlushed;
+  uint64_t mFlushRequested;
+  uint64_t mFlushCompleted;
+  bool mStopping;
+  std::thread mWriter;
+};
+
+} // namespace log
+} // namespace sample
+
+#endif // SAMPLES_COMMON_ASYNC_LOGGER_DELEGATE_H_
@@ -128,7 +128,7 @@ string AcquireToken(
   cmd += " -r ";
   cmd += resource;
   cmd += " -c ";
-  cmd += (!clientId.empty() ? clientId : "6b069eef-9dde-4a29-b402-8ce866edc897");
+  cmd += (!clientId.empty() ? clientId : kDefaultClientId);
 
   string result = Execute(cmd.c_str());
   if (result.empty())
@@ -33,6 +33,9 @@
 namespace sample {
 namespace auth {
 
+// Public client id used when none is configured.
+const char* const kDefaultClientId = "6b069eef-9dde-4a29-b402-8ce866edc897";
+
 std::string AcquireToken(
     const std::string& userName,
     const std::string& password,
@@ -27,11 +27,14 @@
 
 #include "auth_delegate_impl.h"
 
-#include <iostream>
+#include <chrono>
 #include <stdexcept>
-#include <thread>
+
+#include <openssl/evp.h>
 
 #include "auth.h"
+#include "event_log.h"
+#include "protection_token_context.h"
 
 using std::runtime_error;
 using std::shared_ptr;
@@ -40,6 +43,31 @@ using std::string;
 namespace sample {
 namespace auth {
 
+namespace {
+
+const char kSyncServiceResource[] = "https://syncservice.o365syncservice.com/";
+
+// An engine challenges for a handful of resources, so a few per client ID are plenty.
+const size_t kMaxChallengesPerClient = 16;
+
+// SHA-256 in hex, so cache keys tell credentials apart without holding them.
+string Sha256Hex(const string& data) {
+  static const char kHex[] = "0123456789abcdef";
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestSize = 0;
+  if (EVP_Digest(data.data(), data.size(), digest, &digestSize, EVP_sha256(), nullptr) != 1)
+    throw runtime_error("SHA-256 failed");
+  string hex;
+  hex.reserve(digestSize * 2);
+  for (unsigned int i = 0; i < digestSize; ++i) {
+    hex += kHex[digest[i] >> 4];
+    hex += kHex[digest[i] & 15];
+  }
+  return hex;
+}
+
+} // namespace
+
 AuthDelegateImpl::AuthDelegateImpl(
     bool isVerbose,
     const string& username,
@@ -47,14 +75,18 @@ AuthDelegateImpl::AuthDelegateImpl(
     const string& clientId,
     const string& sccToken,
     const string& protectionToken,
-    const string& workingDirectory)
+    const string& workingDirectory,
+    const shared_ptr<TokenAcquirer>& tokenAcquirer,
+    const string& clientSecret)
     : mIsVerbose(isVerbose),
       mUsername(username),
       mPassword(password),
       mClientId(clientId),
       mSccToken(sccToken),
       mProtectionToken(protectionToken),
-      mWorkingDirectory(workingDirectory) {
+      mWorkingDirectory(workingDirectory),
+      mTokenAcquirer(tokenAcquirer),
+      mClientSecret(clientSecret) {
 }
 
 bool AuthDelegateImpl::AcquireOAuth2Token(
@@ -68,34 +100,141 @@ bool AuthDelegateImpl::AcquireOAuth2Token(
     username = mUsername;
 
   if (mIsVerbose) {
-    std::cout << "AUTH DELEGATE" <<
-        "\n\tThread ID: " << std::this_thread::get_id() <<
-        "\n\tUsername: " << username <<
-        "\n\tUser: " << identity.GetEmail() <<
-        "\n\tResource: " << challenge.GetResource() <<
-        "\n\tAuthority: " << challenge.GetAuthority() <<
-        "\n\tClaims: " << challenge.GetClaims() << std::endl;
+    MSIP_EVENT(mip::LogLevel::Info, "auth_challenge",
+        {"username", username},
+        {"user", identity.GetEmail()},
+        {"resource", challenge.GetResource()},
+        {"authority", challenge.GetAuthority()},
+        {"claims", challenge.GetClaims()});
   }
 
-  if (challenge.GetResource() == "https://syncservice.o365syncservice.com/") {
+  const Challenge asked { challenge.GetResource(), challenge.GetAuthority(), challenge.GetClaims() };
+  RememberChallenge(asked);
+  if (challenge.GetResource() == kSyncServiceResource) {
     if (!mSccToken.empty()) {
       token.SetAccessToken(mSccToken);
       return true;
     }
   } else {
-    if (!mProtectionToken.empty()) {
-      token.SetAccessToken(mProtectionToken);
+    const string protectionToken = GetProtectionToken();
+    // A caller-supplied token that is known to have expired is only worth handing out when there is
+    // no credential to acquire a fresh one with.
+    if (!protectionToken.empty() && (!CanAcquireToken() || !IsExpired(protectionToken))) {
+      token.SetAccessToken(protectionToken);
       return true;
     }
   }
 
-  if (mPassword.empty())
+  if (!CanAcquireToken())
     throw runtime_error("Empty password");
 
-  const string& tokenStr = AcquireToken(username, mPassword, mClientId, challenge.GetResource(), challenge.GetAuthority(), mWorkingDirectory);
-  token.SetAccessToken(tokenStr);
+  TokenCache::Acquirer acquire;
+  const auto key = MakeAcquisition(username, asked, acquire);
+  token.SetAccessToken(TokenCache::Shared().GetToken(key, acquire));
   return true;
 }
 
+void AuthDelegateImpl::Prefetch() {
+  if (!CanAcquireToken())
+    return;
+  std::vector<Challenge> known;
+  {
+    std::lock_guard<std::mutex> lock(KnownChallengesMutex());
+    known = KnownChallenges()[mClientId];
+  }
+  for (const auto& challenge : known) {
+    if (HasSuppliedToken(challenge.resource))
+      continue;
+    TokenCache::Acquirer acquire;
+    const auto key = MakeAcquisition(mUsername, challenge, acquire);
+    TokenCache::Shared().Prefetch(key, acquire);
+  }
+}
+
+bool AuthDelegateImpl::CanAcquireToken() const {
+  return !mPassword.empty() || (mTokenAcquirer && !mClientSecret.empty());
+}
+
+string AuthDelegateImpl::GetProtectionToken() const {
+  const auto& current = token::Current();
+  std::lock_guard<std::mutex> lock(mProtectionTokenMutex);
+  if (!current)
+    return mProtectionToken;
+  if (!current->empty())
+    mProtectionToken = *current;
+  return *current;
+}
+
+bool AuthDelegateImpl::HasSuppliedToken(const string& resource) const {
+  if (resource == kSyncServiceResource)
+    return !mSccToken.empty();
+  const string protectionToken = GetProtectionToken();
+  return !protectionToken.empty() && !IsExpired(protectionToken);
+}
+
+TokenCache::Key AuthDelegateImpl::MakeAcquisition(
+    const string& username, const Challenge& challenge, TokenCache::Acquirer& acquire) const {
+  // Copies, since the cache keeps the acquirer for background refreshes after this call returns.
+  const auto tokenAcquirer = mTokenAcquirer;
+  const string clientId = !mClientId.empty() ? mClientId : kDefaultClientId;
+  const string resource = challenge.resource;
+  const string authority = challenge.authority;
+
+  if (tokenAcquirer && !mClientSecret.empty()) {
+    const string clientSecret = mClientSecret;
+    acquire = [=]() {
+      return tokenAcquirer->AcquireWithClientSecret(authority, resource, clientId, clientSecret);
+    };
+    return TokenCache::Key { "app:" + clientId + ":" + Sha256Hex(clientSecret), resource, authority, challenge.claims };
+  }
+
+  const string password = mPassword;
+  const string workingDirectory = mWorkingDirectory;
+  const bool isVerbose = mIsVerbose;
+  acquire = [=]() {
+    if (tokenAcquirer) {
+      try {
+        return tokenAcquirer->AcquireWithPassword(authority, resource, clientId, username, password);
+      } catch (const TokenRequestRejectedError&) {
+        // The credentials were refused; auth.py would only send the failed login again.
+        throw;
+      } catch (const std::exception& ex) {
+        if (isVerbose)
+          MSIP_EVENT(mip::LogLevel::Warning, "native_token_failed", {"fallback", "auth.py"}, {"error", ex.what()});
+      }
+    }
+    return AcquireToken(username, password, clientId, resource, authority, workingDirectory);
+  };
+  // Delegates of the same user with another client ID or password must not be handed each other's tokens.
+  return TokenCache::Key { username + ":" + clientId + ":" + Sha256Hex(password), resource, authority, challenge.claims };
+}
+
+void AuthDelegateImpl::RememberChallenge(const Challenge& challenge) const {
+  std::lock_guard<std::mutex> lock(KnownChallengesMutex());
+  auto& known = KnownChallenges()[mClientId];
+  for (const auto& existing : known) {
+    if (existing == challenge)
+      return;
+  }
+  if (known.size() < kMaxChallengesPerClient)
+    known.push_back(challenge);
+}
+
+std::map<string, std::vector<AuthDelegateImpl::Challenge>>& AuthDelegateImpl::KnownChallenges() {
+  // Intentionally leaked, like TokenCache::Shared(), for delegates still in use at process exit.
+  static auto* challenges = new std::map<string, std::vector<Challenge>>();
+  return *challenges;
+}
+
+std::mutex& AuthDelegateImpl::KnownChallengesMutex() {
+  static auto* challengesMutex = new std::mutex();
+  return *challengesMutex;
+}
+
+bool AuthDelegateImpl::IsExpired(const string& accessToken) {
+  const auto expiry = TokenCache::GetExpiry(accessToken);
+  return expiry != std::chrono::system_clock::time_point() && expiry <= std::chrono::system_clock::now();
+}
+
 } // namespace sample
 } // namespace auth
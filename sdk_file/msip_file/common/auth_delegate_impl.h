@@ -28,14 +28,29 @@
 #ifndef SAMPLES_COMMON_AUTH_DELEGATE_IMPL_H_
 #define SAMPLES_COMMON_AUTH_DELEGATE_IMPL_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "mip/common_types.h"
+#include "token_acquirer.h"
+#include "token_cache.h"
 
 namespace sample {
 namespace auth {
 
+// Tokens acquired with the configured password or client secret are served from TokenCache::Shared(),
+// so every engine and profile in the process reuses them until shortly before they expire. With a
+// TokenAcquirer they are fetched over HTTP in-process; password tokens fall back to auth.py when the
+// request fails without the endpoint refusing it. The challenges of each client ID are remembered, so
+// Prefetch can fetch those a new engine will make in parallel before it makes them one after the other.
+// One delegate serves every caller of a cached
+// engine, so the protection token it hands out is the calling operation's (see protection_token_context.h).
+// Challenges made outside any caller's operation, such as policy refresh or a reload, get the token of the
+// most recent caller that supplied one, so they keep working after the token the delegate was created with
+// expires.
 class AuthDelegateImpl final : public mip::AuthDelegate {
 public:
   AuthDelegateImpl() = delete;
@@ -47,7 +62,9 @@ public:
       const std::string& clientId,
       const std::string& sccToken,
       const std::string& protectionToken,
-      const std::string& workingDirectory = "");
+      const std::string& workingDirectory = "",
+      const std::shared_ptr<TokenAcquirer>& tokenAcquirer = nullptr,
+      const std::string& clientSecret = "");
 
   bool AcquireOAuth2Token(
       const mip::Identity& identity,
@@ -55,14 +72,49 @@ public:
       const std::shared_ptr<void>& context,
       OAuth2Token& token) override;
 
+  // Starts acquiring, each on its own thread, the tokens for the challenges earlier engines of this
+  // client ID made that the supplied tokens do not answer. Returns at once; the engine's challenges
+  // then wait for those acquisitions instead of starting their own.
+  void Prefetch();
+
 private:
+  struct Challenge {
+    std::string resource;
+    std::string authority;
+    std::string claims;
+
+    bool operator==(const Challenge& other) const {
+      return resource == other.resource && authority == other.authority && claims == other.claims;
+    }
+  };
+
+  // Challenges remembered per client ID, and the mutex guarding them.
+  static std::map<std::string, std::vector<Challenge>>& KnownChallenges();
+  static std::mutex& KnownChallengesMutex();
+
+  bool CanAcquireToken() const;
+  // The calling operation's protection token, or the latest one a caller supplied outside any caller's
+  // operation. A non-empty calling token becomes the latest.
+  std::string GetProtectionToken() const;
+  // Whether a supplied token answers challenges for resource.
+  bool HasSuppliedToken(const std::string& resource) const;
+  TokenCache::Key MakeAcquisition(
+      const std::string& username, const Challenge& challenge, TokenCache::Acquirer& acquire) const;
+  void RememberChallenge(const Challenge& challenge) const;
+  static bool IsExpired(const std::string& accessToken);
+
   bool mIsVerbose;
   std::string mUsername;
   std::string mPassword;
   std::string mClientId;
   std::string mSccToken;
-  std::string mProtectionToken;
+  // The latest token a caller supplied, starting with the one the delegate was created with, and the
+  // mutex guarding it.
+  mutable std::string mProtectionToken;
+  mutable std::mutex mProtectionTokenMutex;
   std::string mWorkingDirectory;
+  std::shared_ptr<TokenAcquirer> mTokenAcquirer;
+  std::string mClientSecret;
 };
 
 } // namespace sample
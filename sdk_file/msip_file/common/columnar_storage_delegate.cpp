@@ -0,0 +1,661 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "columnar_storage_delegate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include <zlib.h>
+
+#include "mip/storage_table.h"
+#include "tenant_context.h"
+
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+const size_t ColumnarStorageDelegate::kCompressMinBytes;
+const size_t ColumnarStorageDelegate::kDictionaryBytes;
+const size_t ColumnarStorageDelegate::kMaxDictionaries;
+
+namespace {
+
+typedef vector<string> Row;
+
+// Bookkeeping a row costs besides its values: its key, stamp and size, and the string headers.
+static const uint64_t kRowOverheadBytes = 64;
+static const uint64_t kValueOverheadBytes = 32;
+
+// Order-preserving key encoding: every value ends with "\0\1" and its own NULs become "\0\xff", so
+// encoded keys sort like their values column by column, and the key of leading columns is a prefix.
+void AppendKeyValue(string& key, const string& value) {
+  for (char c : value) {
+    key += c;
+    if (c == '\0')
+      key += '\xff';
+  }
+  key += '\0';
+  key += '\x01';
+}
+
+// Every non-key value is stored behind a tag byte. A deflated value's tag is followed by its dictionary
+// id and its inflated size, two and four bytes little endian.
+static const char kRawTag = '\0';
+static const char kDeflatedTag = '\1';
+static const size_t kDeflatedHeaderBytes = 7;
+static const uint16_t kNoDictionary = 0xffff;
+
+// Raw deflate streams kept per thread, reset for every value instead of allocating their window again.
+class Deflater final {
+public:
+  Deflater() : mReady(false) {
+    mStream = z_stream();
+    mReady = deflateInit2(&mStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+
+  ~Deflater() {
+    if (mReady)
+      deflateEnd(&mStream);
+  }
+
+  // False when deflating fails or does not fit in out, which holds the value's size.
+  bool Deflate(const string& value, const string* dictionary, string& out) {
+    if (!mReady || deflateReset(&mStream) != Z_OK)
+      return false;
+    if (dictionary && deflateSetDictionary(&mStream, reinterpret_cast<const Bytef*>(dictionary->data()),
+        static_cast<uInt>(dictionary->size())) != Z_OK)
+      return false;
+    const size_t header = out.size();
+    out.resize(header + value.size());
+    mStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(value.data()));
+    mStream.avail_in = static_cast<uInt>(value.size());
+    mStream.next_out = reinterpret_cast<Bytef*>(&out[header]);
+    mStream.avail_out = static_cast<uInt>(value.size());
+    if (deflate(&mStream, Z_FINISH) != Z_STREAM_END)
+      return false;
+    out.resize(header + value.size() - mStream.avail_out);
+    return true;
+  }
+
+private:
+  z_stream mStream;
+  bool mReady;
+};
+
+class Inflater final {
+public:
+  Inflater() : mReady(false) {
+    mStream = z_stream();
+    mReady = inflateInit2(&mStream, -MAX_WBITS) == Z_OK;
+  }
+
+  ~Inflater() {
+    if (mReady)
+      inflateEnd(&mStream);
+  }
+
+  string Inflate(const char* data, size_t size, size_t inflatedSize, const string* dictionary) {
+    if (!mReady || inflateReset(&mStream) != Z_OK)
+      throw std::runtime_error("Unable to initialize inflate");
+    if (dictionary && inflateSetDictionary(&mStream, reinterpret_cast<const Bytef*>(dictionary->data()),
+        static_cast<uInt>(dictionary->size())) != Z_OK)
+      throw std::runtime_error("Unable to set the inflate dictionary");
+    string value(inflatedSize, '\0');
+    mStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    mStream.avail_in = static_cast<uInt>(size);
+    mStream.next_out = reinterpret_cast<Bytef*>(&value[0]);
+    mStream.avail_out = static_cast<uInt>(inflatedSize);
+    if (inflate(&mStream, Z_FINISH) != Z_STREAM_END || mStream.avail_out != 0)
+      throw std::runtime_error("Corrupt deflated storage value");
+    return value;
+  }
+
+private:
+  z_stream mStream;
+  bool mReady;
+};
+
+class ColumnarTable;
+
+} // namespace
+
+struct ColumnarStorageDelegate::Budget {
+  explicit Budget(uint64_t limit)
+      : limit(limit), bytes(0), rows(0), evictedRows(0), clock(0), compressedValues(0), compressedRawBytes(0),
+        compressedBytes(0), decodes(0), decodeNanoseconds(0) {}
+
+  uint64_t Tick() { return clock.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+  void Charge(int64_t deltaBytes, int64_t deltaRows) {
+    bytes.fetch_add(static_cast<uint64_t>(deltaBytes), std::memory_order_relaxed);
+    rows.fetch_add(static_cast<uint64_t>(deltaRows), std::memory_order_relaxed);
+  }
+
+  // Evicts the least recently used rows of every table once the budget is exceeded. Called with no
+  // table lock held.
+  void EvictIfOver();
+
+  vector<shared_ptr<ColumnarTable>> LiveTables();
+
+  // The value as stored: tagged, and deflated with the calling tenant's dictionary when that pays off.
+  string Encode(const string& value);
+  // The value Encode was given. Counts the time spent inflating.
+  string Decode(const string& stored);
+  // Whether the stored value equals value, inflating only deflated values.
+  bool StoredEquals(const string& stored, const string& value);
+
+  // The tenant's dictionary and its id, or kNoDictionary while it is still being filled, which value
+  // then goes towards.
+  uint16_t DictionaryFor(const string& tenant, const string& value, shared_ptr<const string>& dictionary);
+  shared_ptr<const string> Dictionary(uint16_t id);
+
+  const uint64_t limit;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> rows;
+  std::atomic<uint64_t> evictedRows;
+  std::atomic<uint64_t> clock;
+  mutex tablesMutex;
+  std::map<string, std::weak_ptr<ColumnarTable>> tables;
+  mutex evictionMutex;
+  std::atomic<uint64_t> compressedValues;
+  std::atomic<uint64_t> compressedRawBytes;
+  std::atomic<uint64_t> compressedBytes;
+  std::atomic<uint64_t> decodes;
+  std::atomic<uint64_t> decodeNanoseconds;
+  mutex dictionariesMutex;
+  // Samples of each tenant's values until they fill a dictionary, then its id.
+  std::map<string, string> samples;
+  std::map<string, uint16_t> tenantDictionaries;
+  vector<shared_ptr<const string>> dictionaries;
+};
+
+namespace {
+
+class ColumnarTable final : public mip::StorageTable {
+public:
+  ColumnarTable(
+      const shared_ptr<ColumnarStorageDelegate::Budget>& budget,
+      const vector<string>& allColumns,
+      const vector<string>& keyColumns)
+      : mBudget(budget),
+        mAllColumns(allColumns),
+        mKeyColumns(keyColumns),
+        mColumns(allColumns.size()),
+        mEncoded(allColumns.size(), true),
+        mBytes(0) {
+    mKeyIndexes = ColumnIndexes(keyColumns.empty() ? allColumns : keyColumns);
+    // Key columns stay as given, so that keys and their prefixes are built from them directly.
+    for (auto index : mKeyIndexes)
+      mEncoded[index] = false;
+  }
+
+  ~ColumnarTable() {
+    mBudget->Charge(-static_cast<int64_t>(mBytes), -static_cast<int64_t>(mKeys.size()));
+  }
+
+  bool HasLayout(const vector<string>& allColumns, const vector<string>& keyColumns) const {
+    return mAllColumns == allColumns && mKeyColumns == keyColumns;
+  }
+
+  void InsertOrReplace(const vector<string>& allColumnValues) override {
+    if (allColumnValues.size() != mAllColumns.size())
+      throw std::invalid_argument("Column value count does not match the table");
+    Row stored(allColumnValues.size());
+    for (size_t c = 0; c < stored.size(); ++c)
+      stored[c] = EncodeColumn(c, allColumnValues[c]);
+    {
+      lock_guard<mutex> lock(mMutex);
+      Put(stored);
+    }
+    mBudget->EvictIfOver();
+  }
+
+  vector<vector<string>> List() override {
+    vector<vector<string>> rows;
+    {
+      lock_guard<mutex> lock(mMutex);
+      rows.reserve(mKeys.size());
+      for (size_t row = 0; row < mKeys.size(); ++row)
+        rows.push_back(StoredAt(row));
+    }
+    DecodeRows(rows);
+    return rows;
+  }
+
+  void Update(
+      const vector<string>& updateColumns,
+      const vector<string>& updateValues,
+      const vector<string>& queryColumns,
+      const vector<string>& queryValues) override {
+    if (updateColumns.size() != updateValues.size())
+      throw std::invalid_argument("Update columns and values differ in count");
+    const auto updateIndexes = ColumnIndexes(updateColumns);
+    Row storedUpdates(updateValues.size());
+    for (size_t i = 0; i < updateIndexes.size(); ++i)
+      storedUpdates[i] = EncodeColumn(updateIndexes[i], updateValues[i]);
+    {
+      lock_guard<mutex> lock(mMutex);
+      const auto rows = Match(queryColumns, queryValues);
+      vector<Row> updated;
+      for (auto row : rows) {
+        Row values = StoredAt(row);
+        for (size_t i = 0; i < updateIndexes.size(); ++i)
+          values[updateIndexes[i]] = storedUpdates[i];
+        updated.push_back(std::move(values));
+      }
+      // Rows are removed before being put back, since updating a key column moves the row.
+      EraseRows(rows);
+      for (const auto& values : updated)
+        Put(values);
+    }
+    mBudget->EvictIfOver();
+  }
+
+  void Delete(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    lock_guard<mutex> lock(mMutex);
+    EraseRows(Match(queryColumns, queryValues));
+  }
+
+  vector<vector<string>> Find(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    vector<vector<string>> rows;
+    {
+      lock_guard<mutex> lock(mMutex);
+      const uint64_t now = mBudget->Tick();
+      for (auto row : Match(queryColumns, queryValues)) {
+        mLastUsed[row] = now;
+        rows.push_back(StoredAt(row));
+      }
+    }
+    // Inflated without the lock, so a hit on a large license does not hold up the table.
+    DecodeRows(rows);
+    return rows;
+  }
+
+  // Appends the stamp and size of every row, for the budget to pick an eviction cutoff.
+  void CollectUsage(vector<std::pair<uint64_t, uint64_t>>& usage) {
+    lock_guard<mutex> lock(mMutex);
+    for (size_t row = 0; row < mKeys.size(); ++row)
+      usage.emplace_back(mLastUsed[row], mRowBytes[row]);
+  }
+
+  // Evicts the rows last used at or before cutoff. Returns how many were evicted.
+  uint64_t EvictUsedBefore(uint64_t cutoff) {
+    lock_guard<mutex> lock(mMutex);
+    vector<size_t> stale;
+    for (size_t row = 0; row < mKeys.size(); ++row) {
+      if (mLastUsed[row] <= cutoff)
+        stale.push_back(row);
+    }
+    EraseRows(stale);
+    return stale.size();
+  }
+
+private:
+  vector<size_t> ColumnIndexes(const vector<string>& columns) const {
+    vector<size_t> indexes;
+    for (const auto& column : columns) {
+      auto it = std::find(mAllColumns.begin(), mAllColumns.end(), column);
+      if (it == mAllColumns.end())
+        throw std::invalid_argument("Unknown storage column: " + column);
+      indexes.push_back(static_cast<size_t>(it - mAllColumns.begin()));
+    }
+    return indexes;
+  }
+
+  string KeyOf(const Row& values) const {
+    string key;
+    for (auto index : mKeyIndexes)
+      AppendKeyValue(key, values[index]);
+    return key;
+  }
+
+  string EncodeColumn(size_t column, const string& value) const {
+    return mEncoded[column] ? mBudget->Encode(value) : value;
+  }
+
+  Row StoredAt(size_t row) const {
+    Row values;
+    values.reserve(mColumns.size());
+    for (const auto& column : mColumns)
+      values.push_back(column[row]);
+    return values;
+  }
+
+  void DecodeRows(vector<Row>& rows) const {
+    for (auto& values : rows) {
+      for (size_t c = 0; c < values.size(); ++c) {
+        if (mEncoded[c])
+          values[c] = mBudget->Decode(values[c]);
+      }
+    }
+  }
+
+  static uint64_t RowBytes(const string& key, const Row& values) {
+    uint64_t bytes = kRowOverheadBytes + key.size();
+    for (const auto& value : values)
+      bytes += kValueOverheadBytes + value.size();
+    return bytes;
+  }
+
+  // Inserts the stored values at their key's position, or replaces the row already there. With mMutex held.
+  void Put(const Row& values) {
+    const string key = KeyOf(values);
+    const uint64_t bytes = RowBytes(key, values);
+    const uint64_t now = mBudget->Tick();
+    auto position = std::lower_bound(mKeys.begin(), mKeys.end(), key);
+    const size_t row = static_cast<size_t>(position - mKeys.begin());
+    if (position != mKeys.end() && *position == key) {
+      for (size_t c = 0; c < mColumns.size(); ++c)
+        mColumns[c][row] = values[c];
+      mBudget->Charge(static_cast<int64_t>(bytes) - static_cast<int64_t>(mRowBytes[row]), 0);
+      mBytes += bytes - mRowBytes[row];
+      mRowBytes[row] = bytes;
+      mLastUsed[row] = now;
+      return;
+    }
+    mKeys.insert(position, key);
+    for (size_t c = 0; c < mColumns.size(); ++c)
+      mColumns[c].insert(mColumns[c].begin() + static_cast<ptrdiff_t>(row), values[c]);
+    mRowBytes.insert(mRowBytes.begin() + static_cast<ptrdiff_t>(row), bytes);
+    mLastUsed.insert(mLastUsed.begin() + static_cast<ptrdiff_t>(row), now);
+    mBytes += bytes;
+    mBudget->Charge(static_cast<int64_t>(bytes), 1);
+  }
+
+  // Removes the rows, given in ascending order, compacting every column in one pass. With mMutex held.
+  void EraseRows(const vector<size_t>& rows) {
+    if (rows.empty())
+      return;
+    uint64_t freed = 0;
+    size_t next = 0;
+    size_t kept = 0;
+    for (size_t row = 0; row < mKeys.size(); ++row) {
+      if (next < rows.size() && rows[next] == row) {
+        freed += mRowBytes[row];
+        ++next;
+        continue;
+      }
+      if (kept != row) {
+        mKeys[kept] = std::move(mKeys[row]);
+        for (auto& column : mColumns)
+          column[kept] = std::move(column[row]);
+        mRowBytes[kept] = mRowBytes[row];
+        mLastUsed[kept] = mLastUsed[row];
+      }
+      ++kept;
+    }
+    mKeys.resize(kept);
+    for (auto& column : mColumns)
+      column.resize(kept);
+    mRowBytes.resize(kept);
+    mLastUsed.resize(kept);
+    mBytes -= freed;
+    mBudget->Charge(-static_cast<int64_t>(freed), -static_cast<int64_t>(rows.size()));
+  }
+
+  // Rows matching every query column, in ascending order. A query naming the leading key columns is
+  // answered from the sorted keys; any other query scans only the columns it names. With mMutex held.
+  vector<size_t> Match(const vector<string>& queryColumns, const vector<string>& queryValues) const {
+    if (queryColumns.size() != queryValues.size())
+      throw std::invalid_argument("Query columns and values differ in count");
+    const auto queryIndexes = ColumnIndexes(queryColumns);
+
+    size_t leading = 0;
+    string prefix;
+    while (leading < mKeyIndexes.size()) {
+      auto it = std::find(queryIndexes.begin(), queryIndexes.end(), mKeyIndexes[leading]);
+      if (it == queryIndexes.end())
+        break;
+      AppendKeyValue(prefix, queryValues[static_cast<size_t>(it - queryIndexes.begin())]);
+      ++leading;
+    }
+
+    size_t begin = 0;
+    size_t end = mKeys.size();
+    if (leading > 0) {
+      begin = static_cast<size_t>(std::lower_bound(mKeys.begin(), mKeys.end(), prefix) - mKeys.begin());
+      end = begin;
+      while (end < mKeys.size() && mKeys[end].compare(0, prefix.size(), prefix) == 0)
+        ++end;
+    }
+
+    vector<size_t> rows;
+    for (size_t row = begin; row < end; ++row)
+      rows.push_back(row);
+    for (size_t q = 0; q < queryIndexes.size(); ++q) {
+      if (std::find(mKeyIndexes.begin(), mKeyIndexes.begin() + static_cast<ptrdiff_t>(leading), queryIndexes[q]) !=
+          mKeyIndexes.begin() + static_cast<ptrdiff_t>(leading))
+        continue;
+      const auto& column = mColumns[queryIndexes[q]];
+      const bool encoded = mEncoded[queryIndexes[q]];
+      rows.erase(std::remove_if(rows.begin(), rows.end(), [&](size_t row) {
+        return encoded ? !mBudget->StoredEquals(column[row], queryValues[q]) : column[row] != queryValues[q];
+      }), rows.end());
+    }
+    return rows;
+  }
+
+  shared_ptr<ColumnarStorageDelegate::Budget> mBudget;
+  const vector<string> mAllColumns;
+  const vector<string> mKeyColumns;
+  vector<size_t> mKeyIndexes;
+  mutable mutex mMutex;
+  vector<string> mKeys;
+  // Values as Budget::Encode stores them in the columns marked in mEncoded.
+  vector<vector<string>> mColumns;
+  vector<bool> mEncoded;
+  vector<uint64_t> mRowBytes;
+  vector<uint64_t> mLastUsed;
+  uint64_t mBytes;
+};
+
+} // namespace
+
+vector<shared_ptr<ColumnarTable>> ColumnarStorageDelegate::Budget::LiveTables() {
+  vector<shared_ptr<ColumnarTable>> live;
+  lock_guard<mutex> lock(tablesMutex);
+  for (auto it = tables.begin(); it != tables.end();) {
+    auto table = it->second.lock();
+    if (table) {
+      live.push_back(table);
+      ++it;
+    } else {
+      it = tables.erase(it);
+    }
+  }
+  return live;
+}
+
+string ColumnarStorageDelegate::Budget::Encode(const string& value) {
+  if (value.size() < kCompressMinBytes || value.size() > UINT32_MAX)
+    return kRawTag + value;
+
+  shared_ptr<const string> dictionary;
+  const uint16_t id = DictionaryFor(sample::tenant::Current(), value, dictionary);
+  string stored(kDeflatedHeaderBytes, '\0');
+  stored[0] = kDeflatedTag;
+  stored[1] = static_cast<char>(id & 0xff);
+  stored[2] = static_cast<char>(id >> 8);
+  for (int i = 0; i < 4; ++i)
+    stored[3 + i] = static_cast<char>((value.size() >> (8 * i)) & 0xff);
+  static thread_local Deflater deflater;
+  // Values that do not shrink by more than the header are kept raw.
+  if (!deflater.Deflate(value, dictionary.get(), stored) || stored.size() >= value.size())
+    return kRawTag + value;
+  compressedValues.fetch_add(1, std::memory_order_relaxed);
+  compressedRawBytes.fetch_add(value.size(), std::memory_order_relaxed);
+  compressedBytes.fetch_add(stored.size(), std::memory_order_relaxed);
+  stored.shrink_to_fit();
+  return stored;
+}
+
+string ColumnarStorageDelegate::Budget::Decode(const string& stored) {
+  if (stored.empty())
+    return stored;
+  if (stored[0] != kDeflatedTag)
+    return stored.substr(1);
+
+  const auto started = std::chrono::steady_clock::now();
+  const auto* header = reinterpret_cast<const unsigned char*>(stored.data());
+  const uint16_t id = static_cast<uint16_t>(header[1] | (header[2] << 8));
+  size_t inflatedSize = 0;
+  for (int i = 0; i < 4; ++i)
+    inflatedSize |= static_cast<size_t>(header[3 + i]) << (8 * i);
+  const auto dictionary = id == kNoDictionary ? nullptr : Dictionary(id);
+  static thread_local Inflater inflater;
+  string value = inflater.Inflate(stored.data() + kDeflatedHeaderBytes, stored.size() - kDeflatedHeaderBytes, inflatedSize,
+      dictionary.get());
+  decodes.fetch_add(1, std::memory_order_relaxed);
+  decodeNanoseconds.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - started).count()), std::memory_order_relaxed);
+  return value;
+}
+
+bool ColumnarStorageDelegate::Budget::StoredEquals(const string& stored, const string& value) {
+  if (!stored.empty() && stored[0] == kRawTag)
+    return stored.size() == value.size() + 1 && stored.compare(1, string::npos, value) == 0;
+  return Decode(stored) == value;
+}
+
+uint16_t ColumnarStorageDelegate::Budget::DictionaryFor(const string& tenant, const string& value, shared_ptr<const string>& dictionary) {
+  lock_guard<mutex> lock(dictionariesMutex);
+  auto known = tenantDictionaries.find(tenant);
+  if (known != tenantDictionaries.end()) {
+    dictionary = dictionaries[known->second];
+    return known->second;
+  }
+  if (dictionaries.size() >= kMaxDictionaries)
+    return kNoDictionary;
+
+  auto& sample = samples[tenant];
+  sample.append(value, 0, kDictionaryBytes - sample.size());
+  if (sample.size() < kDictionaryBytes)
+    return kNoDictionary;
+  // The dictionary covers later values; this one is deflated without it, as the samples before it were.
+  const auto id = static_cast<uint16_t>(dictionaries.size());
+  dictionaries.push_back(make_shared<const string>(std::move(sample)));
+  samples.erase(tenant);
+  tenantDictionaries[tenant] = id;
+  return kNoDictionary;
+}
+
+shared_ptr<const string> ColumnarStorageDelegate::Budget::Dictionary(uint16_t id) {
+  lock_guard<mutex> lock(dictionariesMutex);
+  if (id >= dictionaries.size())
+    throw std::runtime_error("Unknown storage dictionary");
+  return dictionaries[id];
+}
+
+void ColumnarStorageDelegate::Budget::EvictIfOver() {
+  if (limit == 0 || bytes.load(std::memory_order_relaxed) <= limit)
+    return;
+  lock_guard<mutex> lock(evictionMutex);
+  const uint64_t used = bytes.load(std::memory_order_relaxed);
+  if (used <= limit)
+    return;
+
+  const auto live = LiveTables();
+  vector<std::pair<uint64_t, uint64_t>> usage;
+  for (const auto& table : live)
+    table->CollectUsage(usage);
+  std::sort(usage.begin(), usage.end());
+
+  const uint64_t target = used - (limit - limit / 10);
+  uint64_t freed = 0;
+  uint64_t cutoff = 0;
+  for (const auto& entry : usage) {
+    cutoff = entry.first;
+    freed += entry.second;
+    if (freed >= target)
+      break;
+  }
+  uint64_t evicted = 0;
+  for (const auto& table : live)
+    evicted += table->EvictUsedBefore(cutoff);
+  evictedRows.fetch_add(evicted, std::memory_order_relaxed);
+}
+
+ColumnarStorageDelegate::ColumnarStorageDelegate(uint64_t budgetBytes)
+    : mBudget(make_shared<Budget>(budgetBytes)) {
+}
+
+mip::StorageTableResult ColumnarStorageDelegate::CreateStorageTable(
+    const string& path,
+    const mip::MipComponent mipComponent,
+    const string& tableName,
+    const vector<string>& allColumns,
+    const vector<string>& /*encryptedColumns*/,
+    const vector<string>& keyColumns) const {
+  try {
+    const string name = std::to_string(static_cast<unsigned int>(mipComponent)) + ":" + path + ":" + tableName;
+    lock_guard<mutex> lock(mBudget->tablesMutex);
+    auto& slot = mBudget->tables[name];
+    auto table = slot.lock();
+    if (!table || !table->HasLayout(allColumns, keyColumns)) {
+      table = make_shared<ColumnarTable>(mBudget, allColumns, keyColumns);
+      slot = table;
+    }
+    return mip::StorageTableResult(std::static_pointer_cast<mip::StorageTable>(table));
+  } catch (...) {
+    return mip::StorageTableResult(std::current_exception());
+  }
+}
+
+mip::StorageDelegate::StorageSettings ColumnarStorageDelegate::GetSettings() const {
+  return StorageSettings(false /*isRemoteStorage*/, true /*isInMemoryStorageSupported*/);
+}
+
+ColumnarStorageDelegate::Stats ColumnarStorageDelegate::GetStats() const {
+  Stats stats;
+  stats.tables = mBudget->LiveTables().size();
+  stats.rows = mBudget->rows.load(std::memory_order_relaxed);
+  stats.bytes = mBudget->bytes.load(std::memory_order_relaxed);
+  stats.budgetBytes = mBudget->limit;
+  stats.evictedRows = mBudget->evictedRows.load(std::memory_order_relaxed);
+  stats.compressedValues = mBudget->compressedValues.load(std::memory_order_relaxed);
+  stats.compressedRawBytes = mBudget->compressedRawBytes.load(std::memory_order_relaxed);
+  stats.compressedBytes = mBudget->compressedBytes.load(std::memory_order_relaxed);
+  stats.decodes = mBudget->decodes.load(std::memory_order_relaxed);
+  stats.decodeNanoseconds = mBudget->decodeNanoseconds.load(std::memory_order_relaxed);
+  lock_guard<mutex> lock(mBudget->dictionariesMutex);
+  stats.dictionaries = mBudget->dictionaries.size();
+  return stats;
+}
+
+} // namespace storage
+} // namespace sample
@@ -0,0 +1,97 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_COLUMNAR_STORAGE_DELEGATE_H_
+#define SAMPLES_COMMON_COLUMNAR_STORAGE_DELEGATE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/storage_delegate.h"
+
+namespace sample {
+namespace storage {
+
+// Keeps the SDK's policy, license and engine tables in process memory, within one byte budget shared by
+// every table. Each table holds its rows column by column, in arrays sorted by the key columns, so a
+// lookup by key (or by a leading part of it) is a binary search and other queries compare only the
+// columns they name. Once the budget is exceeded, the least recently used rows of all tables are evicted
+// until a tenth of it is free again. Columns the SDK marks as encrypted are kept as given.
+//
+// Values of non-key columns from kCompressMinBytes up, the serialized licenses and templates, are held
+// deflated and inflated again when a row is returned. Each tenant's values are deflated against a preset
+// dictionary made of the first kDictionaryBytes of that tenant's values, since its licenses repeat the
+// same issuer, endpoints and rights; values stored while the dictionary fills are deflated without one.
+class ColumnarStorageDelegate final : public mip::StorageDelegate {
+public:
+  struct Stats {
+    uint64_t tables;
+    uint64_t rows;
+    uint64_t bytes;
+    uint64_t budgetBytes;
+    uint64_t evictedRows;
+    // Values held deflated, their bytes before and after, and what inflating them back has cost.
+    uint64_t compressedValues;
+    uint64_t compressedRawBytes;
+    uint64_t compressedBytes;
+    uint64_t decodes;
+    uint64_t decodeNanoseconds;
+    uint64_t dictionaries;
+  };
+
+  static const size_t kCompressMinBytes = 256;
+  static const size_t kDictionaryBytes = 32 * 1024;
+  // Tenants past this many deflate without a dictionary.
+  static const size_t kMaxDictionaries = 4096;
+
+  explicit ColumnarStorageDelegate(uint64_t budgetBytes);
+
+  // Tables are shared by name: creating one that exists with the same columns returns it, and a
+  // different layout replaces it with an empty table.
+  mip::StorageTableResult CreateStorageTable(
+      const std::string& path,
+      const mip::MipComponent mipComponent,
+      const std::string& tableName,
+      const std::vector<std::string>& allColumns,
+      const std::vector<std::string>& encryptedColumns,
+      const std::vector<std::string>& keyColumns) const override;
+
+  StorageSettings GetSettings() const override;
+
+  Stats GetStats() const;
+
+  struct Budget;
+
+private:
+  std::shared_ptr<Budget> mBudget;
+};
+
+} // namespace storage
+} // namespace sample
+
+#endif // SAMPLES_COMMON_COLUMNAR_STORAGE_DELEGATE_H_
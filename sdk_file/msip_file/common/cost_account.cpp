@@ -0,0 +1,290 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "cost_account.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace sample {
+namespace cost {
+
+namespace {
+
+const size_t kCounters = static_cast<size_t>(Counter::Count);
+const size_t kSlabKeys = 64;
+const size_t kSlabs = kMaxKeys / kSlabKeys;
+// Where keys go once the others are in use, for operations and for hosts
+const Key kOperationOverflow = 1;
+const Key kHostOverflow = 2;
+const Key kFirstKey = 3;
+
+enum class Kind : uint8_t { Operation, Host };
+
+struct Descriptor {
+  Kind kind;
+  std::string tenant;
+  std::string name;
+};
+
+// The counters of kSlabKeys keys on one thread; only that thread writes them
+struct Slab {
+  Slab() {
+    for (auto& key : values) {
+      for (auto& value : key) {
+        value.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  std::atomic<uint64_t> values[kSlabKeys][kCounters];
+};
+
+struct ThreadCounters;
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<Descriptor> keys;
+  std::unordered_map<std::string, Key> index;
+  std::vector<ThreadCounters*> threads;
+  // What exited threads counted
+  std::vector<std::array<uint64_t, kCounters>> retired;
+};
+
+// Leaked, so that threads exiting after static destruction can still fold their counts into it
+Registry& GetRegistry() {
+  static Registry* registry = [] {
+    auto* created = new Registry();
+    created->keys.resize(kFirstKey);
+    created->keys[kOperationOverflow] = Descriptor{Kind::Operation, "other", "other"};
+    created->keys[kHostOverflow] = Descriptor{Kind::Host, "other", "other"};
+    created->retired.resize(kMaxKeys);
+    return created;
+  }();
+  return *registry;
+}
+
+struct ThreadCounters {
+  ThreadCounters() {
+    for (auto& slab : slabs) {
+      slab.store(nullptr, std::memory_order_relaxed);
+    }
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(this);
+  }
+
+  ~ThreadCounters() {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    for (size_t i = 0; i < kSlabs; ++i) {
+      Slab* slab = slabs[i].load(std::memory_order_relaxed);
+      if (slab == nullptr) {
+        continue;
+      }
+      for (size_t key = 0; key < kSlabKeys; ++key) {
+        for (size_t counter = 0; counter < kCounters; ++counter) {
+          registry.retired[i * kSlabKeys + key][counter] += slab->values[key][counter].load(std::memory_order_relaxed);
+        }
+      }
+      delete slab;
+    }
+  }
+
+  std::atomic<Slab*> slabs[kSlabs];
+};
+
+std::atomic<bool> gEnabled(false);
+thread_local Key tKey = kNoKey;
+// This thread's CPU time when it was last charged
+thread_local uint64_t tCheckpoint = 0;
+
+ThreadCounters& LocalCounters() {
+  static thread_local ThreadCounters counters;
+  return counters;
+}
+
+uint64_t ThreadCpuMicros() {
+  timespec now;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+}
+
+// Charges the CPU time since the last checkpoint to the current key
+void ChargeCpu() {
+  uint64_t now = ThreadCpuMicros();
+  if (tKey != kNoKey && tCheckpoint != 0 && now > tCheckpoint) {
+    Add(tKey, Counter::CpuMicros, now - tCheckpoint);
+  }
+  tCheckpoint = now;
+}
+
+Key Intern(Kind kind, const std::string& tenant, const std::string& name) {
+  if (tenant.empty() || !IsEnabled()) {
+    return kNoKey;
+  }
+  // Keys are never removed, so each thread remembers those it has seen and takes the lock once for each
+  std::string id;
+  id.reserve(tenant.size() + name.size() + 2);
+  id.push_back(kind == Kind::Operation ? 'o' : 'h');
+  id.append(tenant).push_back('\0');
+  id.append(name);
+  static thread_local std::unordered_map<std::string, Key> seen;
+  auto found = seen.find(id);
+  if (found != seen.end()) {
+    return found->second;
+  }
+  Key key;
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto existing = registry.index.find(id);
+    if (existing != registry.index.end()) {
+      key = existing->second;
+    } else if (registry.keys.size() < kMaxKeys) {
+      key = static_cast<Key>(registry.keys.size());
+      registry.keys.push_back(Descriptor{kind, tenant, name});
+      registry.index.emplace(id, key);
+    } else {
+      key = kind == Kind::Operation ? kOperationOverflow : kHostOverflow;
+    }
+  }
+  // The thread's cache is bounded like the registry; past it, lookups take the lock
+  if (seen.size() < kMaxKeys) {
+    seen.emplace(std::move(id), key);
+  }
+  return key;
+}
+
+} // namespace
+
+void SetEnabled(bool enabled) {
+  gEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool IsEnabled() {
+  return gEnabled.load(std::memory_order_relaxed);
+}
+
+Key OperationKey(const std::string& tenant, const std::string& operation) {
+  return Intern(Kind::Operation, tenant, operation);
+}
+
+Key HostKey(const std::string& tenant, const std::string& host) {
+  return Intern(Kind::Host, tenant, host);
+}
+
+Key CurrentKey() {
+  return tKey;
+}
+
+void Add(Counter counter, uint64_t value) {
+  Add(tKey, counter, value);
+}
+
+void Add(Key key, Counter counter, uint64_t value) {
+  if (key == kNoKey || key >= kMaxKeys || value == 0 || !IsEnabled()) {
+    return;
+  }
+  auto& slot = LocalCounters().slabs[key / kSlabKeys];
+  Slab* slab = slot.load(std::memory_order_relaxed);
+  if (slab == nullptr) {
+    slab = new Slab();
+    slot.store(slab, std::memory_order_release);
+  }
+  // This thread is the only writer, so a load and a store are enough
+  auto& cell = slab->values[key % kSlabKeys][static_cast<size_t>(counter)];
+  cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+ScopedKey::ScopedKey(Key key)
+    : mPrevious(tKey) {
+  if (key != mPrevious) {
+    if (IsEnabled()) {
+      ChargeCpu();
+    }
+    tKey = key;
+  }
+}
+
+ScopedKey::~ScopedKey() {
+  if (tKey != mPrevious) {
+    if (IsEnabled()) {
+      ChargeCpu();
+    }
+    tKey = mPrevious;
+  }
+}
+
+Snapshot GetSnapshot() {
+  Snapshot snapshot;
+  snapshot.enabled = IsEnabled();
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::vector<std::array<uint64_t, kCounters>> totals(registry.retired.begin(),
+                                                        registry.retired.begin() + registry.keys.size());
+  for (ThreadCounters* thread : registry.threads) {
+    for (size_t i = 0; i < kSlabs; ++i) {
+      Slab* slab = thread->slabs[i].load(std::memory_order_acquire);
+      if (slab == nullptr) {
+        continue;
+      }
+      for (size_t key = 0; key < kSlabKeys && i * kSlabKeys + key < totals.size(); ++key) {
+        for (size_t counter = 0; counter < kCounters; ++counter) {
+          totals[i * kSlabKeys + key][counter] += slab->values[key][counter].load(std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+  for (size_t key = kOperationOverflow; key < totals.size(); ++key) {
+    if (std::all_of(totals[key].begin(), totals[key].end(), [](uint64_t value) { return value == 0; })) {
+      continue;
+    }
+    const Descriptor& descriptor = registry.keys[key];
+    Entry entry;
+    entry.tenant = descriptor.tenant;
+    entry.name = descriptor.name;
+    std::copy(totals[key].begin(), totals[key].end(), entry.values);
+    (descriptor.kind == Kind::Operation ? snapshot.operations : snapshot.hosts).push_back(std::move(entry));
+  }
+  snapshot.keys = registry.keys.size() - kFirstKey;
+  auto byName = [](const Entry& a, const Entry& b) {
+    return a.tenant != b.tenant ? a.tenant < b.tenant : a.name < b.name;
+  };
+  std::sort(snapshot.operations.begin(), snapshot.operations.end(), byName);
+  std::sort(snapshot.hosts.begin(), snapshot.hosts.end(), byName);
+  return snapshot;
+}
+
+} // namespace cost
+} // namespace sample
@@ -0,0 +1,113 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_COST_ACCOUNT_H_
+#define SAMPLES_COMMON_COST_ACCOUNT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace cost {
+
+// What each tenant's operations cost, per operation type, and what its requests to each host cost, for
+// internal billing and for finding heavy consumers. Costs are charged to the key current on the calling
+// thread, which the operation installs and which, like the tenant, the task dispatcher carries onto the
+// SDK's background work. The thread CPU time is charged to whichever key is current while it is spent,
+// so nested or interleaved work is never counted twice. Each thread counts into counters of its own that
+// only it writes, with plain relaxed stores; a scrape sums them under a lock the charging threads never
+// take. Off by default, when every charge returns at once.
+enum class Counter : uint8_t {
+  CpuMicros,
+  BytesRead,
+  BytesWritten,
+  HttpRequests,
+  HttpBytes,
+  CacheHits,
+  CacheMisses,
+  Operations,
+  Count
+};
+
+typedef uint32_t Key;
+// Charges to it are dropped.
+const Key kNoKey = 0;
+
+void SetEnabled(bool enabled);
+bool IsEnabled();
+
+// The key of tenant's operations of type operation, or of its requests to host. Keys are kept for good;
+// once kMaxKeys are in use, new ones share an overflow key reported under the tenant "other". kNoKey
+// when accounting is off or tenant is empty.
+const size_t kMaxKeys = 4096;
+Key OperationKey(const std::string& tenant, const std::string& operation);
+Key HostKey(const std::string& tenant, const std::string& host);
+
+// The key current on this thread.
+Key CurrentKey();
+
+// Adds value to counter of the key current on this thread, or of key.
+void Add(Counter counter, uint64_t value);
+void Add(Key key, Counter counter, uint64_t value);
+
+// Installs key on this thread for the lifetime of the scope, then restores the previous one. The thread's
+// CPU time in between is charged to key.
+class ScopedKey final {
+public:
+  explicit ScopedKey(Key key);
+  ~ScopedKey();
+
+  ScopedKey(const ScopedKey&) = delete;
+  ScopedKey& operator=(const ScopedKey&) = delete;
+
+private:
+  Key mPrevious;
+};
+
+struct Entry {
+  std::string tenant;
+  // The operation type, or the host.
+  std::string name;
+  uint64_t values[static_cast<size_t>(Counter::Count)];
+};
+
+struct Snapshot {
+  bool enabled;
+  // Only keys with costs, in tenant and name order.
+  std::vector<Entry> operations;
+  std::vector<Entry> hosts;
+  size_t keys;
+};
+
+Snapshot GetSnapshot();
+
+} // namespace cost
+} // namespace sample
+
+#endif // SAMPLES_COMMON_COST_ACCOUNT_H_
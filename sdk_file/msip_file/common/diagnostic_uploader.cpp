@@ -0,0 +1,429 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "diagnostic_uploader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "mip/common_types.h"
+#include "mip/event_context.h"
+#include "mip/event_property.h"
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+
+using mip::CaseInsensitiveComparator;
+using mip::EventPropertyType;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using mip::Pii;
+using mip::TransportLayerSecurityMinimumVersion;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace sample {
+namespace diag {
+
+namespace {
+
+// Batches kept for another attempt. Past this the oldest is given up on.
+static const size_t kMaxRetryBatches = 4;
+
+typedef map<string, string, CaseInsensitiveComparator> HeaderMap;
+
+class UploadRequest final : public HttpRequest {
+public:
+  UploadRequest(const string& url, const string& authorization, vector<uint8_t> body)
+      : mId(NextId()), mUrl(url), mBody(std::move(body)) {
+    mHeaders["Content-Type"] = "application/x-ndjson";
+    mHeaders["Content-Encoding"] = "gzip";
+    if (!authorization.empty())
+      mHeaders["Authorization"] = authorization;
+  }
+
+  const string& GetId() const override { return mId; }
+  HttpRequestType GetRequestType() const override { return HttpRequestType::Post; }
+  const string& GetUrl() const override { return mUrl; }
+  const vector<uint8_t>& GetBody() const override { return mBody; }
+  const HeaderMap& GetHeaders() const override { return mHeaders; }
+  TransportLayerSecurityMinimumVersion GetTransportLayerSecurityMinimumVersion() const override {
+    return TransportLayerSecurityMinimumVersion::TLS1_2;
+  }
+
+private:
+  static string NextId() {
+    static std::atomic<uint64_t> counter(0);
+    return "diagnostic-" + std::to_string(++counter);
+  }
+
+  string mId;
+  string mUrl;
+  vector<uint8_t> mBody;
+  HeaderMap mHeaders;
+};
+
+vector<uint8_t> Gzip(const string& data) {
+  z_stream stream = {};
+  // 15 window bits plus 16 selects the gzip wrapper instead of raw zlib.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("Failed to initialize gzip compression");
+  vector<uint8_t> compressed(deflateBound(&stream, static_cast<uLong>(data.size())) + 32);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = compressed.data();
+  stream.avail_out = static_cast<uInt>(compressed.size());
+  const int result = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END)
+    throw std::runtime_error("Failed to gzip diagnostic batch");
+  return compressed;
+}
+
+void AppendJsonString(const string& value, string& out) {
+  static const char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (unsigned char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          out += "\\u00";
+          out += kHex[c >> 4];
+          out += kHex[c & 0xf];
+        } else {
+          out += static_cast<char>(c);
+        }
+    }
+  }
+  out += '"';
+}
+
+const char* LevelName(mip::EventLevel level) {
+  switch (level) {
+    case mip::EventLevel::Basic: return "Basic";
+    case mip::EventLevel::ImportantServiceData: return "ImportantServiceData";
+    case mip::EventLevel::NecessaryServiceData: return "NecessaryServiceData";
+  }
+  return "Unknown";
+}
+
+} // namespace
+
+DiagnosticUploader::DiagnosticUploader(const Settings& settings, const shared_ptr<mip::HttpDelegate>& httpDelegate)
+    : mSettings(settings),
+      mHttpDelegate(httpDelegate),
+      mFlushRequested(0),
+      mFlushCompleted(0),
+      mStopping(false),
+      mStats() {
+  if (mSettings.endpoint.empty())
+    throw std::invalid_argument("Diagnostic upload endpoint must not be empty");
+  if (mSettings.maxBatchEvents == 0 || mSettings.queueCapacity == 0)
+    throw std::invalid_argument("Diagnostic queue and batch sizes must be positive");
+  mUploader = std::thread(&DiagnosticUploader::Run, this);
+}
+
+DiagnosticUploader::~DiagnosticUploader() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mWake.notify_all();
+  if (mUploader.joinable())
+    mUploader.join();
+}
+
+void DiagnosticUploader::PauseThreads() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mUploader.joinable())
+      return;
+    mStopping = true;
+  }
+  mWake.notify_all();
+  mUploader.join();
+}
+
+void DiagnosticUploader::ResumeThreads() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mUploader.joinable())
+      return;
+    mStopping = false;
+  }
+  mUploader = std::thread(&DiagnosticUploader::Run, this);
+}
+
+bool DiagnosticUploader::Enqueue(string record) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mQueue.size() >= mSettings.queueCapacity) {
+      ++mStats.droppedOverflow;
+      return false;
+    }
+    if (mQueue.empty())
+      mOldestQueued = steady_clock::now();
+    mQueue.push_back(std::move(record));
+    ++mStats.queued;
+    if (mQueue.size() < mSettings.maxBatchEvents)
+      return true;
+  }
+  mWake.notify_one();
+  return true;
+}
+
+void DiagnosticUploader::Flush() {
+  unique_lock<mutex> lock(mMutex);
+  const uint64_t request = ++mFlushRequested;
+  mWake.notify_all();
+  mFlushed.wait(lock, [this, request] { return mFlushCompleted >= request; });
+}
+
+bool DiagnosticUploader::FlushUntil(std::chrono::steady_clock::time_point deadline) {
+  unique_lock<mutex> lock(mMutex);
+  const uint64_t request = ++mFlushRequested;
+  mWake.notify_all();
+  return mFlushed.wait_until(lock, deadline, [this, request] { return mFlushCompleted >= request; });
+}
+
+DiagnosticUploader::Stats DiagnosticUploader::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  Stats stats = mStats;
+  stats.pending = mQueue.size();
+  return stats;
+}
+
+bool DiagnosticUploader::Upload(Batch& batch) {
+  ++batch.attempts;
+  try {
+    auto request = std::make_shared<UploadRequest>(mSettings.endpoint, mSettings.authorization, batch.body);
+    auto operation = mHttpDelegate->Send(request, nullptr);
+    auto response = operation ? operation->GetResponse() : nullptr;
+    return response && response->GetStatusCode() >= 200 && response->GetStatusCode() < 300;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+void DiagnosticUploader::Run() {
+  std::deque<Batch> retries;
+  unique_lock<mutex> lock(mMutex);
+  while (true) {
+    auto due = [this] {
+      return mStopping || mFlushRequested > mFlushCompleted || mQueue.size() >= mSettings.maxBatchEvents ||
+          (!mQueue.empty() && steady_clock::now() >= mOldestQueued + mSettings.flushInterval);
+    };
+    if (mQueue.empty() && retries.empty())
+      mWake.wait(lock, due);
+    else
+      mWake.wait_until(lock, (mQueue.empty() ? steady_clock::now() : mOldestQueued) + mSettings.flushInterval, due);
+    const uint64_t flushRequest = mFlushRequested;
+    const bool stopping = mStopping;
+
+    // Events are only taken once due, so a steady trickle still goes out in full batches.
+    std::deque<string> events;
+    events.swap(mQueue);
+    lock.unlock();
+
+    uint64_t droppedFailed = 0;
+    vector<Batch> sent;
+    for (auto& batch : retries)
+      sent.push_back(std::move(batch));
+    retries.clear();
+    while (!events.empty()) {
+      const size_t count = std::min(events.size(), mSettings.maxBatchEvents);
+      string body;
+      for (size_t i = 0; i < count; ++i) {
+        body += events.front();
+        body += '\n';
+        events.pop_front();
+      }
+      Batch batch;
+      batch.events = count;
+      batch.attempts = 0;
+      try {
+        batch.body = Gzip(body);
+      } catch (const std::exception&) {
+        droppedFailed += count;
+        continue;
+      }
+      sent.push_back(std::move(batch));
+    }
+
+    uint64_t uploaded = 0;
+    uint64_t batches = 0;
+    uint64_t failedBatches = 0;
+    uint64_t bytesSent = 0;
+    for (auto& batch : sent) {
+      if (Upload(batch)) {
+        uploaded += batch.events;
+        ++batches;
+        bytesSent += batch.body.size();
+        continue;
+      }
+      ++failedBatches;
+      if (stopping || batch.attempts >= kMaxAttempts) {
+        droppedFailed += batch.events;
+        continue;
+      }
+      retries.push_back(std::move(batch));
+      if (retries.size() > kMaxRetryBatches) {
+        droppedFailed += retries.front().events;
+        retries.pop_front();
+      }
+    }
+
+    lock.lock();
+    mStats.uploaded += uploaded;
+    mStats.batches += batches;
+    mStats.failedBatches += failedBatches;
+    mStats.droppedFailed += droppedFailed;
+    mStats.bytesSent += bytesSent;
+    if (flushRequest > mFlushCompleted) {
+      mFlushCompleted = flushRequest;
+      mFlushed.notify_all();
+    }
+    if (stopping && mQueue.empty())
+      return;
+  }
+}
+
+string SerializeEvent(const mip::Event& event, const mip::EventContext* eventContext, bool isAudit) {
+  // Event times are steady-clock; shift them onto the wall clock for the collector.
+  const auto age = steady_clock::now() - event.GetStartTime();
+  const auto time = system_clock::now() - duration_cast<system_clock::duration>(age);
+
+  string line = "{\"pipeline\":";
+  line += isAudit ? "\"audit\"" : "\"telemetry\"";
+  line += ",\"name\":";
+  AppendJsonString(event.GetName(), line);
+  line += ",\"level\":\"";
+  line += LevelName(event.GetLevel());
+  line += "\",\"time_unix_ms\":";
+  line += std::to_string(duration_cast<milliseconds>(time.time_since_epoch()).count());
+  if (eventContext) {
+    line += ",\"cloud\":" + std::to_string(static_cast<int>(eventContext->GetCloud()));
+    line += ",\"data_boundary\":" + std::to_string(static_cast<int>(eventContext->GetDataBoundary()));
+  }
+  line += ",\"properties\":{";
+  bool first = true;
+  for (const auto& property : event.GetProperties()) {
+    if (!property)
+      continue;
+    if (!isAudit && (property->IsAuditOnly() || property->GetPii() != Pii::None))
+      continue;
+    if (!first)
+      line += ',';
+    first = false;
+    AppendJsonString(property->GetName(), line);
+    line += ':';
+    switch (property->GetPropertyType()) {
+      case EventPropertyType::Double: {
+        const double value = property->GetDouble();
+        if (std::isfinite(value)) {
+          char buffer[32];
+          snprintf(buffer, sizeof(buffer), "%.17g", value);
+          line += buffer;
+        } else {
+          line += "null";
+        }
+        break;
+      }
+      case EventPropertyType::Int64:
+        line += std::to_string(property->GetInt64());
+        break;
+      case EventPropertyType::String:
+        AppendJsonString(property->GetString(), line);
+        break;
+    }
+  }
+  line += "}}";
+  return line;
+}
+
+AuditUploadDelegate::AuditUploadDelegate(const shared_ptr<DiagnosticUploader>& uploader)
+    : mUploader(uploader),
+      mDisabled(false) {
+}
+
+void AuditUploadDelegate::WriteEvent(const shared_ptr<mip::AuditEvent>& event) {
+  if (event && !mDisabled)
+    mUploader->Enqueue(SerializeEvent(*event, nullptr, true /*isAudit*/));
+}
+
+void AuditUploadDelegate::WriteEvent(const shared_ptr<mip::AuditEvent>& event, const mip::EventContext& eventContext) {
+  if (event && !mDisabled)
+    mUploader->Enqueue(SerializeEvent(*event, &eventContext, true /*isAudit*/));
+}
+
+void AuditUploadDelegate::Flush() {
+  mUploader->Flush();
+}
+
+void AuditUploadDelegate::SetEnableAuditSetting(const mip::EnableAuditSetting auditSetting) {
+  mDisabled = auditSetting == mip::EnableAuditSetting::Disabled;
+}
+
+TelemetryUploadDelegate::TelemetryUploadDelegate(const shared_ptr<DiagnosticUploader>& uploader)
+    : mUploader(uploader) {
+}
+
+void TelemetryUploadDelegate::WriteEvent(const shared_ptr<mip::TelemetryEvent>& event) {
+  if (event)
+    mUploader->Enqueue(SerializeEvent(*event, nullptr, false /*isAudit*/));
+}
+
+void TelemetryUploadDelegate::WriteEvent(const shared_ptr<mip::TelemetryEvent>& event, const mip::EventContext& eventContext) {
+  if (event)
+    mUploader->Enqueue(SerializeEvent(*event, &eventContext, false /*isAudit*/));
+}
+
+void TelemetryUploadDelegate::Flush() {
+  mUploader->Flush();
+}
+
+} // namespace diag
+} // namespace sample
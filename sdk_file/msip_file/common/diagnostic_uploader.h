@@ -0,0 +1,156 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_DIAGNOSTIC_UPLOADER_H_
+#define SAMPLES_COMMON_DIAGNOSTIC_UPLOADER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mip/audit_delegate.h"
+#include "mip/http_delegate.h"
+#include "mip/telemetry_delegate.h"
+
+namespace sample {
+namespace diag {
+
+// Uploads audit and telemetry events in batches from a background thread, so no SDK call waits on an
+// upload. Events are queued as JSON lines in a bounded queue; a batch is gzip-compressed and posted to
+// the collector endpoint once it holds maxBatchEvents or its oldest event has waited flushInterval.
+// Events arriving while the queue is full are dropped and counted. A batch the collector rejects is
+// retried on the next flush, up to kMaxAttempts times.
+class DiagnosticUploader final {
+public:
+  struct Settings {
+    std::string endpoint;
+    // Sent as the Authorization header when set.
+    std::string authorization;
+    size_t queueCapacity = 8192;
+    size_t maxBatchEvents = 512;
+    std::chrono::milliseconds flushInterval = std::chrono::milliseconds(5000);
+  };
+
+  struct Stats {
+    uint64_t queued;
+    uint64_t uploaded;
+    uint64_t batches;
+    uint64_t failedBatches;
+    uint64_t droppedOverflow;
+    uint64_t droppedFailed;
+    uint64_t bytesSent;
+    size_t pending;
+  };
+
+  static const int kMaxAttempts = 3;
+
+  DiagnosticUploader(const Settings& settings, const std::shared_ptr<mip::HttpDelegate>& httpDelegate);
+  // Uploads whatever is still queued before returning.
+  ~DiagnosticUploader();
+
+  // Takes one serialized event. Returns false when the queue is full.
+  bool Enqueue(std::string record);
+
+  // Returns once every event queued before the call has been uploaded or given up on.
+  void Flush();
+  // Flush giving up at deadline. Returns false when the events were still being uploaded then.
+  bool FlushUntil(std::chrono::steady_clock::time_point deadline);
+
+  Stats GetStats() const;
+
+  // Uploads the queued events and joins the uploader thread so the process can fork. Batches that fail
+  // are dropped rather than retried. ResumeThreads starts the uploader again.
+  void PauseThreads();
+  void ResumeThreads();
+
+private:
+  struct Batch {
+    std::vector<uint8_t> body;
+    size_t events;
+    int attempts;
+  };
+
+  void Run();
+  bool Upload(Batch& batch);
+
+  const Settings mSettings;
+  const std::shared_ptr<mip::HttpDelegate> mHttpDelegate;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mWake;
+  std::condition_variable mFlushed;
+  std::deque<std::string> mQueue;
+  std::chrono::steady_clock::time_point mOldestQueued;
+  uint64_t mFlushRequested;
+  uint64_t mFlushCompleted;
+  bool mStopping;
+  Stats mStats;
+  std::thread mUploader;
+};
+
+// Serializes an SDK event as one JSON line: name, level, time, cloud, data boundary and properties.
+// Telemetry lines leave out audit-only and PII-classified properties; audit lines keep every property.
+std::string SerializeEvent(const mip::Event& event, const mip::EventContext* eventContext, bool isAudit);
+
+class AuditUploadDelegate final : public mip::AuditDelegate {
+public:
+  explicit AuditUploadDelegate(const std::shared_ptr<DiagnosticUploader>& uploader);
+
+  void WriteEvent(const std::shared_ptr<mip::AuditEvent>& event) override;
+  void WriteEvent(const std::shared_ptr<mip::AuditEvent>& event, const mip::EventContext& eventContext) override;
+  void Flush() override;
+
+  // A tenant whose policy disables audit gets no audit events uploaded.
+  void SetEnableAuditSetting(const mip::EnableAuditSetting auditSetting) override;
+
+private:
+  std::shared_ptr<DiagnosticUploader> mUploader;
+  std::atomic<bool> mDisabled;
+};
+
+class TelemetryUploadDelegate final : public mip::TelemetryDelegate {
+public:
+  explicit TelemetryUploadDelegate(const std::shared_ptr<DiagnosticUploader>& uploader);
+
+  void WriteEvent(const std::shared_ptr<mip::TelemetryEvent>& event) override;
+  void WriteEvent(const std::shared_ptr<mip::TelemetryEvent>& event, const mip::EventContext& eventContext) override;
+  void Flush() override;
+
+private:
+  std::shared_ptr<DiagnosticUploader> mUploader;
+};
+
+} // namespace diag
+} // namespace sample
+
+#endif // SAMPLES_COMMON_DIAGNOSTIC_UPLOADER_H_
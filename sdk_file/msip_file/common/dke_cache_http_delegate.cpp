@@ -0,0 +1,356 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "dke_cache_http_delegate.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+
+using mip::CaseInsensitiveComparator;
+using mip::HttpOperation;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using mip::HttpResponse;
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace http {
+
+namespace {
+
+typedef map<string, string, CaseInsensitiveComparator> HeaderMap;
+
+// Same bounds as HttpDelegateImpl's per-host histograms, so both render with the phase histogram bounds.
+const int64_t kFirstLatencyBoundMicros = 100;
+const char kUnwrapSuffix[] = "/decrypt";
+
+class CachedResponse final : public HttpResponse {
+public:
+  CachedResponse(const string& id, int32_t statusCode, const shared_ptr<const vector<uint8_t>>& body, const HeaderMap& headers)
+      : mId(id), mStatusCode(statusCode), mBody(body), mHeaders(headers) {}
+
+  const string& GetId() const override { return mId; }
+  int32_t GetStatusCode() const override { return mStatusCode; }
+  const vector<uint8_t>& GetBody() const override { return *mBody; }
+  const HeaderMap& GetHeaders() const override { return mHeaders; }
+
+private:
+  string mId;
+  int32_t mStatusCode;
+  shared_ptr<const vector<uint8_t>> mBody;
+  HeaderMap mHeaders;
+};
+
+class CachedOperation final : public HttpOperation {
+public:
+  CachedOperation(const string& id, const shared_ptr<HttpResponse>& response) : mId(id), mResponse(response) {}
+
+  const string& GetId() const override { return mId; }
+  shared_ptr<HttpResponse> GetResponse() override { return mResponse; }
+  bool IsCancelled() override { return false; }
+
+private:
+  string mId;
+  shared_ptr<HttpResponse> mResponse;
+};
+
+// Host and path of url with the host lowercased and no trailing slash; the scheme, query and fragment are
+// dropped.
+string UrlKey(const string& url) {
+  auto hostStart = url.find("://");
+  hostStart = hostStart == string::npos ? 0 : hostStart + 3;
+  auto pathStart = url.find('/', hostStart);
+  auto end = url.find_first_of("?#", hostStart);
+  if (pathStart != string::npos && end != string::npos && end < pathStart) pathStart = string::npos;
+  auto hostEnd = pathStart != string::npos ? pathStart : (end != string::npos ? end : url.size());
+  string key = url.substr(hostStart, hostEnd - hostStart);
+  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  if (pathStart != string::npos) key += url.substr(pathStart, (end == string::npos ? url.size() : end) - pathStart);
+  return key.empty() || key.back() != '/' ? key : key.substr(0, key.size() - 1);
+}
+
+// SHA-256 in hex, so no two callers' credentials or requests can share a cache entry.
+string Sha256Hex(const void* data, size_t size) {
+  static const char kHex[] = "0123456789abcdef";
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestSize = 0;
+  if (EVP_Digest(data, size, digest, &digestSize, EVP_sha256(), nullptr) != 1)
+    throw std::runtime_error("SHA-256 failed");
+  string hex;
+  hex.reserve(digestSize * 2);
+  for (unsigned int i = 0; i < digestSize; ++i) {
+    hex += kHex[digest[i] >> 4];
+    hex += kHex[digest[i] & 15];
+  }
+  return hex;
+}
+
+bool EndsWith(const string& value, const string& suffix) {
+  return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The UTC time in the "exp" member of a public key response ("cache": {"exp": "2030-01-01T00:00:00"}).
+bool ReadCacheExpiry(const vector<uint8_t>& body, std::chrono::system_clock::time_point& expiry) {
+  const string text(body.begin(), body.end());
+  auto member = text.find("\"exp\"");
+  if (member == string::npos)
+    return false;
+  auto open = text.find('"', text.find(':', member + 5));
+  if (open == string::npos)
+    return false;
+  struct tm fields = {};
+  if (sscanf(text.c_str() + open + 1, "%4d-%2d-%2dT%2d:%2d:%2d", &fields.tm_year, &fields.tm_mon, &fields.tm_mday,
+      &fields.tm_hour, &fields.tm_min, &fields.tm_sec) != 6)
+    return false;
+  fields.tm_year -= 1900;
+  fields.tm_mon -= 1;
+  expiry = std::chrono::system_clock::from_time_t(timegm(&fields));
+  return true;
+}
+
+size_t GetLatencyBucket(int64_t micros) {
+  size_t bucket = 0;
+  for (int64_t bound = kFirstLatencyBoundMicros; bucket < HttpDelegateImpl::kLatencyBucketCount && micros > bound; bound *= 2)
+    ++bucket;
+  return bucket;
+}
+
+} // namespace
+
+DkeCacheHttpDelegate::DkeCacheHttpDelegate(
+    const Settings& settings,
+    const shared_ptr<mip::HttpDelegate>& inner,
+    const shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher)
+    : mSettings(settings),
+      mInner(inner),
+      mCallbackDispatcher(callbackDispatcher),
+      mStats() {
+  if (!mInner)
+    throw std::invalid_argument("The DKE cache needs a delegate to forward requests to");
+  for (const auto& baseUrl : mSettings.baseUrls) {
+    const string prefix = UrlKey(baseUrl);
+    if (!prefix.empty())
+      mPrefixes.push_back(prefix);
+  }
+}
+
+DkeCacheHttpDelegate::Kind DkeCacheHttpDelegate::Classify(const HttpRequest& request, string& key) const {
+  const string urlKey = UrlKey(request.GetUrl());
+  const bool matches = std::any_of(mPrefixes.begin(), mPrefixes.end(), [&urlKey](const string& prefix) {
+    return urlKey.compare(0, prefix.size(), prefix) == 0 && urlKey.size() > prefix.size() && urlKey[prefix.size()] == '/';
+  });
+  if (!matches)
+    return Kind::Other;
+  if (request.GetRequestType() == HttpRequestType::Get) {
+    key = urlKey;
+    return Kind::PublicKey;
+  }
+  if (!EndsWith(urlKey, kUnwrapSuffix))
+    return Kind::Other;
+  const auto& headers = request.GetHeaders();
+  const auto authorization = headers.find("Authorization");
+  const string credentials = authorization == headers.end() ? string() : authorization->second;
+  const auto& body = request.GetBody();
+  key = urlKey + "\n" + Sha256Hex(credentials.data(), credentials.size()) + "\n" + Sha256Hex(body.data(), body.size());
+  return Kind::Unwrap;
+}
+
+shared_ptr<HttpResponse> DkeCacheHttpDelegate::Find(Kind kind, const string& key, const string& requestId) {
+  const auto now = Clock::now();
+  lock_guard<mutex> lock(mMutex);
+  if (kind == Kind::PublicKey) {
+    auto it = mPublicKeys.find(key);
+    if (it == mPublicKeys.end() || it->second.expires <= now) {
+      ++mStats.publicKeyMisses;
+      return nullptr;
+    }
+    ++mStats.publicKeyHits;
+    return make_shared<CachedResponse>(requestId, it->second.statusCode, it->second.body, it->second.headers);
+  }
+
+  auto it = mUnwraps.find(key);
+  if (it != mUnwraps.end() && it->second.response.expires <= now) {
+    mLru.erase(it->second.lru);
+    mUnwraps.erase(it);
+    it = mUnwraps.end();
+  }
+  if (it == mUnwraps.end()) {
+    ++mStats.unwrapMisses;
+    return nullptr;
+  }
+  ++mStats.unwrapHits;
+  mLru.splice(mLru.begin(), mLru, it->second.lru);
+  const auto& cached = it->second.response;
+  return make_shared<CachedResponse>(requestId, cached.statusCode, cached.body, cached.headers);
+}
+
+void DkeCacheHttpDelegate::Store(Kind kind, const string& key, const shared_ptr<HttpOperation>& operation) {
+  auto response = operation && !operation->IsCancelled() ? operation->GetResponse() : nullptr;
+  if (!response || response->GetStatusCode() != 200)
+    return;
+
+  Cached cached;
+  cached.statusCode = response->GetStatusCode();
+  cached.body = make_shared<const vector<uint8_t>>(response->GetBody());
+  cached.headers = response->GetHeaders();
+  const auto now = Clock::now();
+  if (kind == Kind::PublicKey) {
+    cached.expires = now + mSettings.publicKeyTtl;
+    std::chrono::system_clock::time_point expiry;
+    if (ReadCacheExpiry(*cached.body, expiry)) {
+      const auto remaining = expiry - std::chrono::system_clock::now();
+      if (now + remaining < cached.expires)
+        cached.expires = now + std::chrono::duration_cast<Clock::duration>(remaining);
+    }
+  } else {
+    cached.expires = now + mSettings.unwrapTtl;
+  }
+
+  lock_guard<mutex> lock(mMutex);
+  if (kind == Kind::PublicKey) {
+    auto previous = mPublicKeys.find(key);
+    if (previous != mPublicKeys.end() && *previous->second.body != *cached.body) {
+      // The key was rotated: results unwrapped with its earlier private part are not served again.
+      const string prefix = key + "/";
+      for (auto it = mUnwraps.lower_bound(prefix); it != mUnwraps.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+        mLru.erase(it->second.lru);
+        it = mUnwraps.erase(it);
+        ++mStats.rotations;
+      }
+    }
+    mPublicKeys[key] = cached;
+    return;
+  }
+
+  if (mSettings.capacity == 0)
+    return;
+  auto existing = mUnwraps.find(key);
+  if (existing != mUnwraps.end()) {
+    existing->second.response = cached;
+    mLru.splice(mLru.begin(), mLru, existing->second.lru);
+    return;
+  }
+  mLru.push_front(key);
+  mUnwraps[key] = Unwrap{ cached, mLru.begin() };
+  while (mUnwraps.size() > mSettings.capacity) {
+    mUnwraps.erase(mLru.back());
+    mLru.pop_back();
+    ++mStats.evictions;
+  }
+}
+
+void DkeCacheHttpDelegate::RecordHop(Clock::time_point start) {
+  const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+  lock_guard<mutex> lock(mMutex);
+  ++mStats.hops;
+  mStats.hopLatencyMicros += static_cast<uint64_t>(micros);
+  ++mStats.hopLatencyBuckets[GetLatencyBucket(micros)];
+}
+
+shared_ptr<HttpOperation> DkeCacheHttpDelegate::Send(const shared_ptr<HttpRequest>& request, const shared_ptr<void>& context) {
+  string key;
+  const Kind kind = Classify(*request, key);
+  if (kind == Kind::Other)
+    return mInner->Send(request, context);
+  if (auto response = Find(kind, key, request->GetId()))
+    return make_shared<CachedOperation>(request->GetId(), response);
+
+  const auto start = Clock::now();
+  auto operation = mInner->Send(request, context);
+  RecordHop(start);
+  Store(kind, key, operation);
+  return operation;
+}
+
+shared_ptr<HttpOperation> DkeCacheHttpDelegate::SendAsync(
+    const shared_ptr<HttpRequest>& request,
+    const shared_ptr<void>& context,
+    const function<void(shared_ptr<HttpOperation>)>& callbackFn) {
+  string key;
+  const Kind kind = Classify(*request, key);
+  if (kind == Kind::Other)
+    return mInner->SendAsync(request, context, callbackFn);
+  if (auto response = Find(kind, key, request->GetId())) {
+    shared_ptr<HttpOperation> operation = make_shared<CachedOperation>(request->GetId(), response);
+    if (callbackFn) {
+      if (mCallbackDispatcher)
+        mCallbackDispatcher->DispatchTask("dke-cache-callback-" + operation->GetId(), [callbackFn, operation]() { callbackFn(operation); });
+      else
+        callbackFn(operation);
+    }
+    return operation;
+  }
+
+  const auto start = Clock::now();
+  return mInner->SendAsync(request, context, [this, kind, key, start, callbackFn](shared_ptr<HttpOperation> operation) {
+    RecordHop(start);
+    Store(kind, key, operation);
+    if (callbackFn)
+      callbackFn(operation);
+  });
+}
+
+void DkeCacheHttpDelegate::CancelOperation(const string& requestId) {
+  mInner->CancelOperation(requestId);
+}
+
+void DkeCacheHttpDelegate::CancelAllOperations() {
+  mInner->CancelAllOperations();
+}
+
+void DkeCacheHttpDelegate::Clear() {
+  lock_guard<mutex> lock(mMutex);
+  mPublicKeys.clear();
+  mUnwraps.clear();
+  mLru.clear();
+}
+
+DkeCacheHttpDelegate::Stats DkeCacheHttpDelegate::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  Stats stats = mStats;
+  stats.size = mUnwraps.size();
+  return stats;
+}
+
+} // namespace http
+} // namespace sample
@@ -0,0 +1,150 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_DKE_CACHE_HTTP_DELEGATE_H_
+#define SAMPLES_COMMON_DKE_CACHE_HTTP_DELEGATE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/http_delegate.h"
+#include "mip/task_dispatcher_delegate.h"
+
+#include "http_delegate_impl.h"
+
+namespace sample {
+namespace http {
+
+// Decorates the SDK-facing HTTP delegate and answers repeated requests to Double Key Encryption key
+// services from memory. Opening a DKE-protected file makes the SDK fetch the key's public part
+// (GET <base>/<key name>) and unwrap the content key with the private part (POST <base>/<key name>/<key
+// id>/decrypt), both against the customer's service on top of the usual license round trip.
+//
+// Public keys are cached per URL until publicKeyTtl, or the expiry the service sends in "cache.exp" when it
+// is earlier. Unwrap results are cached per URL, request body and Authorization header, so a result is only
+// served to the engine identity the service authorized, and expire after unwrapTtl. A new key id means a
+// new URL, and a public key that comes back changed drops the unwrap results under its key name, so a
+// rotated key is never answered from the cache. Only 200 responses are cached. Requests to other URLs pass
+// straight through.
+class DkeCacheHttpDelegate final : public mip::HttpDelegate {
+public:
+  struct Settings {
+    // Base URLs of the DKE services, e.g. "https://dke.contoso.com". Matched on host and path prefix.
+    std::vector<std::string> baseUrls;
+    std::chrono::seconds publicKeyTtl = std::chrono::seconds(3600);
+    std::chrono::seconds unwrapTtl = std::chrono::seconds(600);
+    // Unwrap results kept; the least recently used go first. 0 turns the unwrap cache off.
+    size_t capacity = 4096;
+  };
+
+  struct Stats {
+    uint64_t publicKeyHits;
+    uint64_t publicKeyMisses;
+    uint64_t unwrapHits;
+    uint64_t unwrapMisses;
+    uint64_t evictions;
+    // Unwrap results dropped because their key's public part changed.
+    uint64_t rotations;
+    size_t size;
+    // Requests that went to a DKE service, and their latency in the HTTP delegate's buckets.
+    uint64_t hops;
+    uint64_t hopLatencyMicros;
+    uint64_t hopLatencyBuckets[HttpDelegateImpl::kLatencyBucketCount + 1];
+  };
+
+  // Async completions served from the cache are handed to callbackDispatcher like HttpDelegateImpl does.
+  DkeCacheHttpDelegate(
+      const Settings& settings,
+      const std::shared_ptr<mip::HttpDelegate>& inner,
+      const std::shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher);
+
+  std::shared_ptr<mip::HttpOperation> Send(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context) override;
+
+  std::shared_ptr<mip::HttpOperation> SendAsync(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context,
+      const std::function<void(std::shared_ptr<mip::HttpOperation>)>& callbackFn) override;
+
+  void CancelOperation(const std::string& requestId) override;
+
+  void CancelAllOperations() override;
+
+  // Drops every cached key and result.
+  void Clear();
+
+  Stats GetStats() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Cached {
+    int32_t statusCode;
+    std::shared_ptr<const std::vector<uint8_t>> body;
+    std::map<std::string, std::string, mip::CaseInsensitiveComparator> headers;
+    Clock::time_point expires;
+  };
+
+  struct Unwrap {
+    Cached response;
+    std::list<std::string>::iterator lru;
+  };
+
+  enum class Kind { Other, PublicKey, Unwrap };
+
+  // Classifies request and sets key to its cache key.
+  Kind Classify(const mip::HttpRequest& request, std::string& key) const;
+  std::shared_ptr<mip::HttpResponse> Find(Kind kind, const std::string& key, const std::string& requestId);
+  void Store(Kind kind, const std::string& key, const std::shared_ptr<mip::HttpOperation>& operation);
+  void RecordHop(Clock::time_point start);
+
+  const Settings mSettings;
+  const std::shared_ptr<mip::HttpDelegate> mInner;
+  const std::shared_ptr<mip::TaskDispatcherDelegate> mCallbackDispatcher;
+  // Host and path prefixes of mSettings.baseUrls.
+  std::vector<std::string> mPrefixes;
+
+  mutable std::mutex mMutex;
+  std::map<std::string, Cached> mPublicKeys;
+  // Ordered, so the results under one key name can be dropped by prefix.
+  std::map<std::string, Unwrap> mUnwraps;
+  std::list<std::string> mLru;
+  Stats mStats;
+};
+
+} // namespace http
+} // namespace sample
+
+#endif // SAMPLES_COMMON_DKE_CACHE_HTTP_DELEGATE_H_
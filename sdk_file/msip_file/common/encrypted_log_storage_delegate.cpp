@@ -0,0 +1,685 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "encrypted_log_storage_delegate.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "mip/storage_table.h"
+
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+namespace {
+
+typedef vector<string> Row;
+
+const char kLogMagic[] = "MSIPLOG1";
+const size_t kLogMagicSize = 8;
+const uint8_t kPutRecord = 1;
+const uint8_t kDeleteRecord = 2;
+const size_t kNonceSize = 12;
+const size_t kTagSize = 16;
+// Logs smaller than this are never compacted; the dead records cost less than a rewrite.
+const uint64_t kMinCompactionBytes = 1 << 20;
+
+// Length-prefixed values, so any byte (including the separator) can appear in a column.
+string Encode(const vector<string>& values) {
+  string encoded;
+  for (const auto& value : values) {
+    encoded += std::to_string(value.size());
+    encoded += ':';
+    encoded += value;
+  }
+  return encoded;
+}
+
+bool Decode(const string& encoded, Row& values) {
+  values.clear();
+  size_t position = 0;
+  while (position < encoded.size()) {
+    const size_t colon = encoded.find(':', position);
+    if (colon == string::npos)
+      return false;
+    const size_t length = strtoul(encoded.c_str() + position, nullptr, 10);
+    if (colon + 1 + length > encoded.size())
+      return false;
+    values.push_back(encoded.substr(colon + 1, length));
+    position = colon + 1 + length;
+  }
+  return true;
+}
+
+void AppendUInt32(string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+uint32_t ReadUInt32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+      (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// nonce | ciphertext | tag, with aad authenticated alongside.
+string Seal(const string& key, const string& aad, const string& plaintext) {
+  string blob(kNonceSize + plaintext.size() + kTagSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&blob[0]);
+  if (RAND_bytes(out, static_cast<int>(kNonceSize)) != 1)
+    throw runtime_error("Unable to generate a storage nonce");
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  if (!context ||
+      EVP_EncryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), out) != 1 ||
+      EVP_EncryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1 ||
+      EVP_EncryptUpdate(context.get(), out + kNonceSize, &length, reinterpret_cast<const unsigned char*>(plaintext.data()), static_cast<int>(plaintext.size())) != 1 ||
+      EVP_EncryptFinal_ex(context.get(), out + kNonceSize + length, &length) != 1 ||
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_GET_TAG, static_cast<int>(kTagSize), out + kNonceSize + plaintext.size()) != 1)
+    throw runtime_error("Unable to encrypt a storage record");
+  return blob;
+}
+
+// False when the blob was not sealed under key with aad, e.g. after corruption or a key change.
+bool Open(const string& key, const string& aad, const uint8_t* blob, size_t size, string& plaintext) {
+  if (size < kNonceSize + kTagSize)
+    return false;
+  const size_t cipherSize = size - kNonceSize - kTagSize;
+  plaintext.assign(cipherSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  return context &&
+      EVP_DecryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), blob) == 1 &&
+      EVP_DecryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) == 1 &&
+      EVP_DecryptUpdate(context.get(), out, &length, blob + kNonceSize, static_cast<int>(cipherSize)) == 1 &&
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_SET_TAG, static_cast<int>(kTagSize),
+          const_cast<uint8_t*>(blob + kNonceSize + cipherSize)) == 1 &&
+      EVP_DecryptFinal_ex(context.get(), out + length, &length) == 1;
+}
+
+void CreateParentDirectories(const string& path) {
+  for (size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash + 1)) {
+    const string directory = path.substr(0, slash);
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+      throw runtime_error("Unable to create storage directory " + directory);
+  }
+}
+
+void WriteAll(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t result = write(fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      throw runtime_error("Unable to write a storage record");
+    }
+    written += static_cast<size_t>(result);
+  }
+}
+
+// A read-only map of a log, kept alive by readers while the log grows or is compacted underneath.
+struct Mapping {
+  Mapping(int fd, size_t size) : data(nullptr), size(size) {
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+      throw runtime_error("Unable to map a storage log");
+    data = static_cast<const uint8_t*>(mapped);
+  }
+  ~Mapping() { munmap(const_cast<uint8_t*>(data), size); }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  const uint8_t* data;
+  size_t size;
+};
+
+class LogTable;
+
+} // namespace
+
+struct EncryptedLogStorageDelegate::Shared {
+  explicit Shared(const string& key) : key(key), compactions(0) {}
+
+  vector<shared_ptr<LogTable>> LiveTables();
+
+  const string key;
+  std::atomic<uint64_t> compactions;
+  mutex tablesMutex;
+  std::map<string, std::weak_ptr<LogTable>> tables;
+};
+
+namespace {
+
+class LogTable final : public mip::StorageTable, public std::enable_shared_from_this<LogTable> {
+public:
+  struct Usage {
+    uint64_t records;
+    uint64_t liveBytes;
+    uint64_t fileBytes;
+  };
+
+  LogTable(
+      const shared_ptr<EncryptedLogStorageDelegate::Shared>& shared,
+      const string& logPath,
+      const string& tableName,
+      const vector<string>& allColumns,
+      const vector<string>& keyColumns)
+      : mShared(shared),
+        mLogPath(logPath),
+        mTableName(tableName),
+        mAllColumns(allColumns),
+        mKeyColumns(keyColumns),
+        mFd(-1),
+        mFileBytes(0),
+        mLiveBytes(0),
+        mCompacting(false) {
+    mKeyIndexes = ColumnIndexes(keyColumns.empty() ? allColumns : keyColumns);
+    CreateParentDirectories(mLogPath);
+    mFd = open(mLogPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (mFd < 0)
+      throw runtime_error("Unable to open storage log " + mLogPath);
+    try {
+      Load();
+    } catch (...) {
+      close(mFd);
+      throw;
+    }
+  }
+
+  ~LogTable() {
+    mMap.reset();
+    if (mFd >= 0)
+      close(mFd);
+  }
+
+  void InsertOrReplace(const vector<string>& allColumnValues) override {
+    if (allColumnValues.size() != mAllColumns.size())
+      throw std::invalid_argument("Column value count does not match the table");
+    {
+      lock_guard<mutex> lock(mMutex);
+      Put(KeyOf(allColumnValues), allColumnValues);
+    }
+    MaybeCompact();
+  }
+
+  vector<vector<string>> List() override {
+    return Scan(vector<size_t>(), vector<string>());
+  }
+
+  void Update(
+      const vector<string>& updateColumns,
+      const vector<string>& updateValues,
+      const vector<string>& queryColumns,
+      const vector<string>& queryValues) override {
+    if (updateColumns.size() != updateValues.size())
+      throw std::invalid_argument("Update columns and values differ in count");
+    const auto updateIndexes = ColumnIndexes(updateColumns);
+    auto rows = Find(queryColumns, queryValues);
+    {
+      lock_guard<mutex> lock(mMutex);
+      for (auto& row : rows) {
+        const string oldKey = KeyOf(row);
+        for (size_t i = 0; i < updateIndexes.size(); ++i)
+          row[updateIndexes[i]] = updateValues[i];
+        const string newKey = KeyOf(row);
+        if (newKey != oldKey)
+          Erase(oldKey);
+        Put(newKey, row);
+      }
+    }
+    MaybeCompact();
+  }
+
+  void Delete(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    vector<string> keys;
+    string key;
+    if (IsKeyQuery(queryColumns, queryValues, key)) {
+      keys.push_back(key);
+    } else {
+      for (const auto& row : Find(queryColumns, queryValues))
+        keys.push_back(KeyOf(row));
+    }
+    {
+      lock_guard<mutex> lock(mMutex);
+      for (const auto& stale : keys)
+        Erase(stale);
+    }
+    MaybeCompact();
+  }
+
+  vector<vector<string>> Find(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    if (queryColumns.size() != queryValues.size())
+      throw std::invalid_argument("Query columns and values differ in count");
+
+    string key;
+    if (!IsKeyQuery(queryColumns, queryValues, key))
+      return Scan(ColumnIndexes(queryColumns), queryValues);
+
+    Slot slot;
+    shared_ptr<Mapping> mapping;
+    {
+      lock_guard<mutex> lock(mMutex);
+      auto it = mIndex.find(key);
+      if (it == mIndex.end())
+        return vector<vector<string>>();
+      slot = it->second;
+      mapping = MapThrough(slot.rowOffset + slot.rowBytes);
+    }
+    vector<vector<string>> rows;
+    rows.push_back(ReadRow(*mapping, key, slot));
+    return rows;
+  }
+
+  bool HasLayout(const vector<string>& allColumns, const vector<string>& keyColumns) const {
+    return mAllColumns == allColumns && mKeyColumns == keyColumns;
+  }
+
+  Usage GetUsage() {
+    lock_guard<mutex> lock(mMutex);
+    Usage usage = { mIndex.size(), mLiveBytes, mFileBytes };
+    return usage;
+  }
+
+  // Holding the mutex also waits out a compaction that has started.
+  bool Sync() {
+    lock_guard<mutex> lock(mMutex);
+    return fsync(mFd) == 0;
+  }
+
+private:
+  struct Slot {
+    uint64_t recordOffset;
+    uint32_t recordBytes;
+    uint64_t rowOffset;
+    uint32_t rowBytes;
+  };
+
+  vector<size_t> ColumnIndexes(const vector<string>& columns) const {
+    vector<size_t> indexes;
+    for (const auto& column : columns) {
+      auto it = std::find(mAllColumns.begin(), mAllColumns.end(), column);
+      if (it == mAllColumns.end())
+        throw std::invalid_argument("Unknown storage column: " + column);
+      indexes.push_back(static_cast<size_t>(it - mAllColumns.begin()));
+    }
+    return indexes;
+  }
+
+  string KeyOf(const Row& row) const {
+    vector<string> keyValues;
+    for (auto index : mKeyIndexes)
+      keyValues.push_back(row[index]);
+    return Encode(keyValues);
+  }
+
+  // True when the query names exactly the key columns, in any order, so the row can be read directly.
+  bool IsKeyQuery(const vector<string>& queryColumns, const vector<string>& queryValues, string& key) const {
+    if (queryColumns.size() != mKeyIndexes.size())
+      return false;
+    const auto queryIndexes = ColumnIndexes(queryColumns);
+    vector<string> keyValues;
+    for (auto keyIndex : mKeyIndexes) {
+      auto it = std::find(queryIndexes.begin(), queryIndexes.end(), keyIndex);
+      if (it == queryIndexes.end())
+        return false;
+      keyValues.push_back(queryValues[static_cast<size_t>(it - queryIndexes.begin())]);
+    }
+    key = Encode(keyValues);
+    return true;
+  }
+
+  string Header() const {
+    string header(kLogMagic, kLogMagicSize);
+    const string schema = Encode({ Encode(mAllColumns), Encode(mKeyColumns) });
+    AppendUInt32(header, static_cast<uint32_t>(schema.size()));
+    header += schema;
+    return header;
+  }
+
+  // Maps the log through at least size bytes, remapping it when it has grown. With mMutex held.
+  shared_ptr<Mapping> MapThrough(uint64_t size) {
+    if (!mMap || mMap->size < size)
+      mMap = make_shared<Mapping>(mFd, static_cast<size_t>(mFileBytes));
+    return mMap;
+  }
+
+  Row ReadRow(const Mapping& mapping, const string& key, const Slot& slot) const {
+    string encoded;
+    Row row;
+    if (!Open(mShared->key, key, mapping.data + slot.rowOffset, slot.rowBytes, encoded) || !Decode(encoded, row) ||
+        row.size() != mAllColumns.size())
+      throw runtime_error("Corrupt record in storage log " + mLogPath);
+    return row;
+  }
+
+  // Rebuilds the index from the log, starting a new one when the log is empty or has another layout.
+  void Load() {
+    struct stat fileInfo;
+    if (fstat(mFd, &fileInfo) != 0)
+      throw runtime_error("Unable to read storage log " + mLogPath);
+    const string header = Header();
+    mFileBytes = static_cast<uint64_t>(fileInfo.st_size);
+    if (mFileBytes < header.size() || !SameHeader(header)) {
+      if (ftruncate(mFd, 0) != 0)
+        throw runtime_error("Unable to reset storage log " + mLogPath);
+      WriteAll(mFd, header);
+      mFileBytes = header.size();
+      return;
+    }
+
+    auto mapping = MapThrough(mFileBytes);
+    uint64_t position = header.size();
+    while (position + 4 <= mFileBytes) {
+      const uint8_t* record = mapping->data + position;
+      const uint64_t recordBytes = 4 + static_cast<uint64_t>(ReadUInt32(record));
+      if (recordBytes < 4 + 1 + 4 + 4 || position + recordBytes > mFileBytes)
+        break;
+      const uint8_t type = record[4];
+      const uint32_t keyBlobBytes = ReadUInt32(record + 5);
+      if (9 + static_cast<uint64_t>(keyBlobBytes) + 4 > recordBytes)
+        break;
+      const uint32_t rowBlobBytes = ReadUInt32(record + 9 + keyBlobBytes);
+      if (13 + static_cast<uint64_t>(keyBlobBytes) + rowBlobBytes != recordBytes)
+        break;
+      string key;
+      if (!Open(mShared->key, mTableName, record + 9, keyBlobBytes, key))
+        break;
+
+      if (type == kPutRecord) {
+        Slot slot = { position, static_cast<uint32_t>(recordBytes), position + 13 + keyBlobBytes, rowBlobBytes };
+        Index(key, slot);
+      } else if (type == kDeleteRecord) {
+        Unindex(key);
+      } else {
+        break;
+      }
+      position += recordBytes;
+    }
+    // Whatever follows the last whole record was torn by a crash, or written under another key.
+    if (position < mFileBytes) {
+      mMap.reset();
+      if (ftruncate(mFd, static_cast<off_t>(position)) != 0)
+        throw runtime_error("Unable to truncate storage log " + mLogPath);
+      mFileBytes = position;
+    }
+  }
+
+  bool SameHeader(const string& header) {
+    vector<char> existing(header.size());
+    return pread(mFd, existing.data(), existing.size(), 0) == static_cast<ssize_t>(existing.size()) &&
+        memcmp(existing.data(), header.data(), header.size()) == 0;
+  }
+
+  void Index(const string& key, const Slot& slot) {
+    Unindex(key);
+    mIndex[key] = slot;
+    mLiveBytes += slot.recordBytes;
+  }
+
+  void Unindex(const string& key) {
+    auto it = mIndex.find(key);
+    if (it == mIndex.end())
+      return;
+    mLiveBytes -= it->second.recordBytes;
+    mIndex.erase(it);
+  }
+
+  // Appends a record and returns where it landed. With mMutex held.
+  Slot Append(uint8_t type, const string& key, const string& rowBlob) {
+    const string keyBlob = Seal(mShared->key, mTableName, key);
+    string record;
+    AppendUInt32(record, static_cast<uint32_t>(1 + 4 + keyBlob.size() + 4 + rowBlob.size()));
+    record += static_cast<char>(type);
+    AppendUInt32(record, static_cast<uint32_t>(keyBlob.size()));
+    record += keyBlob;
+    AppendUInt32(record, static_cast<uint32_t>(rowBlob.size()));
+    record += rowBlob;
+    WriteAll(mFd, record);
+
+    Slot slot = { mFileBytes, static_cast<uint32_t>(record.size()), mFileBytes + 13 + keyBlob.size(), static_cast<uint32_t>(rowBlob.size()) };
+    mFileBytes += record.size();
+    return slot;
+  }
+
+  void Put(const string& key, const Row& row) {
+    Index(key, Append(kPutRecord, key, Seal(mShared->key, key, Encode(row))));
+  }
+
+  void Erase(const string& key) {
+    if (mIndex.find(key) == mIndex.end())
+      return;
+    Append(kDeleteRecord, key, string());
+    Unindex(key);
+  }
+
+  vector<vector<string>> Scan(const vector<size_t>& queryIndexes, const vector<string>& queryValues) {
+    vector<std::pair<string, Slot>> slots;
+    shared_ptr<Mapping> mapping;
+    {
+      lock_guard<mutex> lock(mMutex);
+      slots.assign(mIndex.begin(), mIndex.end());
+      mapping = MapThrough(mFileBytes);
+    }
+    vector<vector<string>> rows;
+    for (const auto& entry : slots) {
+      Row row = ReadRow(*mapping, entry.first, entry.second);
+      bool matches = true;
+      for (size_t q = 0; q < queryIndexes.size() && matches; ++q)
+        matches = row[queryIndexes[q]] == queryValues[q];
+      if (matches)
+        rows.push_back(std::move(row));
+    }
+    return rows;
+  }
+
+  void MaybeCompact() {
+    {
+      lock_guard<mutex> lock(mMutex);
+      if (mCompacting || mFileBytes < kMinCompactionBytes || mLiveBytes * 2 > mFileBytes)
+        return;
+      mCompacting = true;
+    }
+    auto self = shared_from_this();
+    std::thread([self]() { self->Compact(); }).detach();
+  }
+
+  // Copies the live records, unchanged, into a new log that then replaces this one. Readers holding the
+  // old map keep reading the old file until they let go of it.
+  void Compact() {
+    lock_guard<mutex> lock(mMutex);
+    mCompacting = false;
+    const string compactPath = mLogPath + ".compact";
+    const int fd = open(compactPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0)
+      return;
+    try {
+      auto mapping = MapThrough(mFileBytes);
+      string log = Header();
+      unordered_map<string, Slot> index;
+      for (const auto& entry : mIndex) {
+        Slot slot = entry.second;
+        const uint64_t offset = log.size();
+        log.append(reinterpret_cast<const char*>(mapping->data + slot.recordOffset), slot.recordBytes);
+        slot.rowOffset = offset + (slot.rowOffset - slot.recordOffset);
+        slot.recordOffset = offset;
+        index[entry.first] = slot;
+      }
+      WriteAll(fd, log);
+      if (fsync(fd) != 0 || rename(compactPath.c_str(), mLogPath.c_str()) != 0)
+        throw runtime_error("Unable to replace storage log " + mLogPath);
+      close(mFd);
+      mFd = fd;
+      mFileBytes = log.size();
+      mIndex.swap(index);
+      mMap.reset();
+      mShared->compactions.fetch_add(1, std::memory_order_relaxed);
+    } catch (const std::exception&) {
+      // The old log stays in place and keeps serving; the next write past the threshold retries.
+      close(fd);
+      unlink(compactPath.c_str());
+    }
+  }
+
+  shared_ptr<EncryptedLogStorageDelegate::Shared> mShared;
+  const string mLogPath;
+  const string mTableName;
+  const vector<string> mAllColumns;
+  const vector<string> mKeyColumns;
+  vector<size_t> mKeyIndexes;
+  mutex mMutex;
+  int mFd;
+  shared_ptr<Mapping> mMap;
+  uint64_t mFileBytes;
+  uint64_t mLiveBytes;
+  unordered_map<string, Slot> mIndex;
+  bool mCompacting;
+};
+
+string LogPath(const string& path, const string& tableName) {
+  string name;
+  for (char c : tableName)
+    name += isalnum(static_cast<unsigned char>(c)) || c == '_' ? c : '_';
+  return path + "." + name + ".log";
+}
+
+} // namespace
+
+vector<shared_ptr<LogTable>> EncryptedLogStorageDelegate::Shared::LiveTables() {
+  vector<shared_ptr<LogTable>> live;
+  lock_guard<mutex> lock(tablesMutex);
+  for (auto it = tables.begin(); it != tables.end();) {
+    auto table = it->second.lock();
+    if (table) {
+      live.push_back(table);
+      ++it;
+    } else {
+      it = tables.erase(it);
+    }
+  }
+  return live;
+}
+
+const size_t EncryptedLogStorageDelegate::kKeySize;
+
+EncryptedLogStorageDelegate::EncryptedLogStorageDelegate(const string& key) {
+  if (key.size() != kKeySize)
+    throw std::invalid_argument("Storage key must be 32 bytes");
+  mShared = make_shared<Shared>(key);
+}
+
+string EncryptedLogStorageDelegate::ParseHexKey(const string& hex) {
+  if (hex.size() != 2 * kKeySize)
+    throw std::invalid_argument("Storage key must be 64 hex digits");
+  string key;
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    const string digits = hex.substr(i, 2);
+    if (!isxdigit(static_cast<unsigned char>(digits[0])) || !isxdigit(static_cast<unsigned char>(digits[1])))
+      throw std::invalid_argument("Storage key must be 64 hex digits");
+    key += static_cast<char>(strtoul(digits.c_str(), nullptr, 16));
+  }
+  return key;
+}
+
+mip::StorageTableResult EncryptedLogStorageDelegate::CreateStorageTable(
+    const string& path,
+    const mip::MipComponent mipComponent,
+    const string& tableName,
+    const vector<string>& allColumns,
+    const vector<string>& /*encryptedColumns*/,
+    const vector<string>& keyColumns) const {
+  try {
+    const string logPath = LogPath(path + "." + std::to_string(static_cast<unsigned int>(mipComponent)), tableName);
+    // One table per log: two appending to the same file would each miss the other's records.
+    lock_guard<mutex> lock(mShared->tablesMutex);
+    auto& slot = mShared->tables[logPath];
+    auto table = slot.lock();
+    if (!table || !table->HasLayout(allColumns, keyColumns)) {
+      table.reset();
+      table = make_shared<LogTable>(mShared, logPath, tableName, allColumns, keyColumns);
+      slot = table;
+    }
+    return mip::StorageTableResult(std::static_pointer_cast<mip::StorageTable>(table));
+  } catch (...) {
+    return mip::StorageTableResult(std::current_exception());
+  }
+}
+
+mip::StorageDelegate::StorageSettings EncryptedLogStorageDelegate::GetSettings() const {
+  // In-memory caches keep using the SDK's own storage.
+  return StorageSettings(false /*isRemoteStorage*/, false /*isInMemoryStorageSupported*/, ".msiplog");
+}
+
+EncryptedLogStorageDelegate::Stats EncryptedLogStorageDelegate::GetStats() const {
+  Stats stats = {};
+  const auto live = mShared->LiveTables();
+  stats.tables = live.size();
+  for (const auto& table : live) {
+    const auto usage = table->GetUsage();
+    stats.records += usage.records;
+    stats.liveBytes += usage.liveBytes;
+    stats.fileBytes += usage.fileBytes;
+  }
+  stats.compactions = mShared->compactions.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool EncryptedLogStorageDelegate::Sync() const {
+  bool synced = true;
+  for (const auto& table : mShared->LiveTables())
+    synced = table->Sync() && synced;
+  return synced;
+}
+
+} // namespace storage
+} // namespace sample
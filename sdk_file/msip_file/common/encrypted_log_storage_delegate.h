@@ -0,0 +1,91 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_ENCRYPTED_LOG_STORAGE_DELEGATE_H_
+#define SAMPLES_COMMON_ENCRYPTED_LOG_STORAGE_DELEGATE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/storage_delegate.h"
+
+namespace sample {
+namespace storage {
+
+// Keeps each of the SDK's on-disk tables in an append-only log next to the path the SDK names. Every
+// write appends one record, so writes are sequential. Reads go through a memory map of the log and an
+// in-memory index of the latest record per key. Keys and rows are encrypted separately with AES-256-GCM
+// under key, with a fresh nonce per record. Keys are decrypted once, when the index is rebuilt on open,
+// and rows only when a Find or List returns them, so a restart reads no more than the keys. Once
+// superseded records fill half of a log, it is compacted on a background thread by copying the live
+// records into a new log, which then replaces the old one. A torn record at the end of a log, left by a
+// crash, is cut off on open.
+class EncryptedLogStorageDelegate final : public mip::StorageDelegate {
+public:
+  struct Stats {
+    uint64_t tables;
+    uint64_t records;
+    uint64_t liveBytes;
+    uint64_t fileBytes;
+    uint64_t compactions;
+  };
+
+  static const size_t kKeySize = 32;
+
+  // key must be kKeySize bytes. Throws std::invalid_argument otherwise.
+  explicit EncryptedLogStorageDelegate(const std::string& key);
+
+  // Parses 2 * kKeySize hex digits. Throws std::invalid_argument on anything else.
+  static std::string ParseHexKey(const std::string& hex);
+
+  mip::StorageTableResult CreateStorageTable(
+      const std::string& path,
+      const mip::MipComponent mipComponent,
+      const std::string& tableName,
+      const std::vector<std::string>& allColumns,
+      const std::vector<std::string>& encryptedColumns,
+      const std::vector<std::string>& keyColumns) const override;
+
+  StorageSettings GetSettings() const override;
+
+  Stats GetStats() const;
+
+  // Writes every open log through to disk, after any compaction in progress. Returns false when a log
+  // could not be synced.
+  bool Sync() const;
+
+  struct Shared;
+
+private:
+  std::shared_ptr<Shared> mShared;
+};
+
+} // namespace storage
+} // namespace sample
+
+#endif // SAMPLES_COMMON_ENCRYPTED_LOG_STORAGE_DELEGATE_H_
@@ -0,0 +1,107 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "event_log.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using std::shared_ptr;
+using std::string;
+
+namespace sample {
+namespace log {
+
+namespace {
+
+std::atomic<AsyncLoggerDelegate*>& CurrentLogger() {
+  static std::atomic<AsyncLoggerDelegate*> logger(nullptr);
+  return logger;
+}
+
+void AppendValue(string& out, const string& value) {
+  if (!value.empty() && value.find_first_of(" \"=\\\n\r\t") == string::npos) {
+    out += value;
+    return;
+  }
+  out += '"';
+  for (char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default: out += c;
+    }
+  }
+  out += '"';
+}
+
+} // namespace
+
+void EventLog::SetLogger(const shared_ptr<AsyncLoggerDelegate>& logger) {
+  // Leaked, like the loggers it keeps, so events logged during exit still find theirs.
+  static auto& kept = *new std::vector<shared_ptr<AsyncLoggerDelegate>>();
+  static auto& keptMutex = *new std::mutex();
+  std::lock_guard<std::mutex> lock(keptMutex);
+  kept.push_back(logger);
+  CurrentLogger().store(logger.get(), std::memory_order_release);
+}
+
+bool EventLog::IsEnabled(mip::LogLevel level) {
+  const auto* logger = CurrentLogger().load(std::memory_order_acquire);
+  return logger && static_cast<int>(level) >= static_cast<int>(logger->GetLevel());
+}
+
+void EventLog::Write(
+    mip::LogLevel level,
+    const char* event,
+    std::initializer_list<Field> fields,
+    const char* function,
+    const char* file,
+    int line) {
+  auto* logger = CurrentLogger().load(std::memory_order_acquire);
+  if (logger)
+    logger->WriteToLog(level, Format(event, fields), function, file, line);
+}
+
+string EventLog::Format(const char* event, std::initializer_list<Field> fields) {
+  string record = "event=";
+  record += event;
+  for (const auto& field : fields) {
+    record += ' ';
+    record += field.first;
+    record += '=';
+    AppendValue(record, field.second);
+  }
+  return record;
+}
+
+} // namespace log
+} // namespace sample
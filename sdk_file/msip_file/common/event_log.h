@@ -0,0 +1,88 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_EVENT_LOG_H_
+#define SAMPLES_COMMON_EVENT_LOG_H_
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "async_logger_delegate.h"
+
+namespace sample {
+namespace log {
+
+// What the glue layer has to say about a request (an output written, a commit skipped, a cache that
+// failed), as one structured record: the event name and its fields in logfmt, e.g.
+//   event=output_written path=/data/a_modified.docx
+// Records go through the process's AsyncLoggerDelegate, so they are filtered by its level, queued and
+// written in batches with the SDK's records; a request never waits on the console. Events before a
+// logger is set are dropped. Use MSIP_EVENT rather than Write: it formats nothing below the logger's
+// level, and a build with MSIP_QUIET_EVENTS compiles every event out, arguments included.
+class EventLog final {
+public:
+  typedef std::pair<const char*, std::string> Field;
+
+  // Loggers set are kept for the process lifetime, so an event never races the logger's replacement.
+  static void SetLogger(const std::shared_ptr<AsyncLoggerDelegate>& logger);
+
+  // Whether an event at level would be written; one atomic load and the level check.
+  static bool IsEnabled(mip::LogLevel level);
+
+  static void Write(
+      mip::LogLevel level,
+      const char* event,
+      std::initializer_list<Field> fields,
+      const char* function,
+      const char* file,
+      int line);
+
+  // The record Write hands the logger.
+  static std::string Format(const char* event, std::initializer_list<Field> fields);
+};
+
+} // namespace log
+} // namespace sample
+
+// The quiet variant still compiles the call, so variables only events use stay used, but never runs it.
+#ifdef MSIP_QUIET_EVENTS
+#define MSIP_EVENT(level, event, ...) \
+  do { \
+    if (false) \
+      sample::log::EventLog::Write(level, event, {__VA_ARGS__}, __func__, __FILE__, __LINE__); \
+  } while (false)
+#else
+#define MSIP_EVENT(level, event, ...) \
+  do { \
+    if (sample::log::EventLog::IsEnabled(level)) \
+      sample::log::EventLog::Write(level, event, {__VA_ARGS__}, __func__, __FILE__, __LINE__); \
+  } while (false)
+#endif
+
+#endif // SAMPLES_COMMON_EVENT_LOG_H_
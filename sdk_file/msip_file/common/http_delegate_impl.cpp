@@ -0,0 +1,938 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "http_delegate_impl.h"
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <stdexcept>
+
+#include "cost_account.h"
+#include "mip/common_types.h"
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+#include "request_deadline.h"
+#include "tenant_context.h"
+
+using mip::CaseInsensitiveComparator;
+using mip::HttpOperation;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using mip::HttpResponse;
+using mip::TransportLayerSecurityMinimumVersion;
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace http {
+
+namespace {
+
+typedef map<string, string, CaseInsensitiveComparator> HeaderMap;
+
+const long kConnectTimeoutMs = 30000;
+const long kTransferTimeoutMs = 120000;
+const long kDnsCacheTimeoutSec = 300;
+const long kMaxHostConnections = 8;
+const long kMaxCachedConnections = 32;
+const int kPollTimeoutMs = 1000;
+// Latencies kept per host for its p95, and how many are needed before GETs to it are hedged.
+const size_t kLatencySamples = 64;
+const size_t kMinHedgeSamples = 20;
+const int kMaxBackoffShift = 20;
+const int64_t kFirstLatencyBoundMicros = 100;
+// How often attempts waiting for a rate limit token are checked against their deadlines.
+const int64_t kExpirySweepMs = 100;
+
+class HttpResponseImpl final : public HttpResponse {
+public:
+  HttpResponseImpl(const string& id, int32_t statusCode, vector<uint8_t>&& body, HeaderMap&& headers)
+      : mId(id), mStatusCode(statusCode), mBody(std::move(body)), mHeaders(std::move(headers)) {}
+
+  const string& GetId() const override { return mId; }
+  int32_t GetStatusCode() const override { return mStatusCode; }
+  const vector<uint8_t>& GetBody() const override { return mBody; }
+  const HeaderMap& GetHeaders() const override { return mHeaders; }
+
+private:
+  string mId;
+  int32_t mStatusCode;
+  vector<uint8_t> mBody;
+  HeaderMap mHeaders;
+};
+
+class HttpOperationImpl final : public HttpOperation {
+public:
+  explicit HttpOperationImpl(const string& id) : mId(id), mCancelled(false) {}
+
+  const string& GetId() const override { return mId; }
+
+  shared_ptr<HttpResponse> GetResponse() override {
+    lock_guard<mutex> lock(mMutex);
+    return mResponse;
+  }
+
+  bool IsCancelled() override { return mCancelled; }
+
+  void Complete(const shared_ptr<HttpResponse>& response, bool cancelled) {
+    lock_guard<mutex> lock(mMutex);
+    mResponse = response;
+    mCancelled = cancelled;
+  }
+
+private:
+  string mId;
+  mutex mMutex;
+  shared_ptr<HttpResponse> mResponse;
+  std::atomic<bool> mCancelled;
+};
+
+void InitializeCurlOnce() {
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+      throw std::runtime_error("Failed to initialize libcurl");
+  });
+}
+
+long ToCurlSslVersion(TransportLayerSecurityMinimumVersion version) {
+  switch (version) {
+    case TransportLayerSecurityMinimumVersion::TLS1_3:
+      return CURL_SSLVERSION_TLSv1_3;
+    case TransportLayerSecurityMinimumVersion::TLS1_2:
+    default:
+      return CURL_SSLVERSION_TLSv1_2;
+  }
+}
+
+size_t OnBody(char* data, size_t size, size_t count, void* userData) {
+  auto body = static_cast<vector<uint8_t>*>(userData);
+  body->insert(body->end(), data, data + size * count);
+  return size * count;
+}
+
+size_t OnHeader(char* data, size_t size, size_t count, void* userData) {
+  auto headers = static_cast<HeaderMap*>(userData);
+  const string line(data, size * count);
+  if (line.compare(0, 5, "HTTP/") == 0) {
+    // A new status line starts a new header block (redirects, 100-continue).
+    headers->clear();
+    return size * count;
+  }
+  auto colon = line.find(':');
+  if (colon != string::npos) {
+    auto valueStart = line.find_first_not_of(" \t", colon + 1);
+    auto valueEnd = line.find_last_not_of("\r\n");
+    string value = (valueStart == string::npos || valueEnd < valueStart) ? "" : line.substr(valueStart, valueEnd - valueStart + 1);
+    (*headers)[line.substr(0, colon)] = value;
+  }
+  return size * count;
+}
+
+// Host of an absolute URL, without scheme, credentials, port or path.
+string GetHost(const string& url) {
+  auto start = url.find("://");
+  start = start == string::npos ? 0 : start + 3;
+  auto end = url.find_first_of("/?#", start);
+  auto host = url.substr(start, end == string::npos ? string::npos : end - start);
+  auto credentials = host.rfind('@');
+  if (credentials != string::npos)
+    host = host.substr(credentials + 1);
+  auto port = host.rfind(':');
+  if (port != string::npos && host.find(']', port) == string::npos)
+    host = host.substr(0, port);
+  return host;
+}
+
+// Statuses of a service that is throttling or briefly unavailable, worth retrying after a backoff.
+bool IsRetryableStatus(long statusCode) {
+  return statusCode == 429 || statusCode == 500 || statusCode == 502 || statusCode == 503 || statusCode == 504;
+}
+
+// Statuses of a service that is shedding load, which slow down the caller's requests to it.
+bool IsThrottlingStatus(long statusCode) {
+  return statusCode == 429 || statusCode == 503;
+}
+
+int64_t GetTimeMicros(CURL* easy, CURLINFO info) {
+  curl_off_t micros = 0;
+  return curl_easy_getinfo(easy, info, &micros) == CURLE_OK ? static_cast<int64_t>(micros) : -1;
+}
+
+size_t GetLatencyBucket(int64_t micros) {
+  size_t bucket = 0;
+  for (int64_t bound = kFirstLatencyBoundMicros; bucket < HttpDelegateImpl::kLatencyBucketCount && micros > bound; bound *= 2)
+    ++bucket;
+  return bucket;
+}
+
+} // namespace
+
+const size_t HttpDelegateImpl::kLatencyBucketCount;
+
+HttpDelegateImpl::ResiliencePolicy::ResiliencePolicy()
+    : maxRetries(2),
+      retryBaseMs(100),
+      retryMaxMs(2000),
+      hedge(true),
+      hedgeMinMs(50),
+      breakerFailures(5),
+      breakerOpenMs(30000) {}
+
+HttpDelegateImpl::EndpointHealth::EndpointHealth()
+    : nextSample(0), p95LatencyMicros(-1), consecutiveFailures(0), probing(false) {}
+
+// One request from the SDK. It completes once, with the first attempt that succeeds or the last one to fail.
+struct HttpDelegateImpl::Exchange {
+  shared_ptr<HttpRequest> request;
+  function<void(shared_ptr<HttpOperation>)> callback;
+  bool inlineCallback = false;
+  shared_ptr<HttpOperationImpl> operation;
+  string host;
+  string tenant;
+  // Where its attempts are charged: the caller's operation, and the tenant's requests to host.
+  cost::Key operationCost = cost::kNoKey;
+  cost::Key hostCost = cost::kNoKey;
+  bool idempotent = false;
+  deadline::Deadline requestDeadline;
+  ResiliencePolicy policy;
+  int retries = 0;
+  bool hedged = false;
+  // Attempts queued, waiting out a backoff or a rate limit, or running.
+  size_t live = 0;
+  // Attempts waiting for a rate limit token.
+  size_t throttled = 0;
+  bool done = false;
+};
+
+// One attempt at an exchange, on its own easy handle.
+struct HttpDelegateImpl::Transfer {
+  shared_ptr<Exchange> exchange;
+  Clock::time_point startAt;
+  Clock::time_point hedgeAt = Clock::time_point::max();
+  Clock::time_point queuedAt;
+  Clock::time_point admittedAt;
+  bool probe = false;
+  CURL* easy = nullptr;
+  curl_slist* headers = nullptr;
+  vector<uint8_t> body;
+  HeaderMap responseHeaders;
+
+  ~Transfer() {
+    if (headers) curl_slist_free_all(headers);
+    if (easy) curl_easy_cleanup(easy);
+  }
+};
+
+HttpDelegateImpl::HttpDelegateImpl(const shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher)
+    : mCallbackDispatcher(callbackDispatcher),
+      mMulti(nullptr),
+      mShare(nullptr),
+      mCancelAll(false),
+      mRatePolicyChanged(false),
+      mRandom(std::random_device()()),
+      mStopping(false),
+      mPaused(false),
+      mRequests(0),
+      mFailed(0),
+      mCancelled(0),
+      mInFlight(0) {
+  InitializeCurlOnce();
+
+  mMulti = NewMulti();
+  mShare = curl_share_init();
+  if (!mMulti || !mShare) {
+    if (mMulti) curl_multi_cleanup(mMulti);
+    if (mShare) curl_share_cleanup(mShare);
+    throw std::runtime_error("Failed to create libcurl handles");
+  }
+  // Every easy handle is driven from the event-loop thread, so the share needs no lock callbacks.
+  curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  mThread = std::thread(&HttpDelegateImpl::EventLoop, this);
+}
+
+HttpDelegateImpl::~HttpDelegateImpl() {
+  mStopping = true;
+  curl_multi_wakeup(mMulti);
+  if (mThread.joinable())
+    mThread.join();
+  curl_multi_cleanup(mMulti);
+  curl_share_cleanup(mShare);
+}
+
+CURLM* HttpDelegateImpl::NewMulti() {
+  CURLM* multi = curl_multi_init();
+  if (!multi)
+    return nullptr;
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, kMaxHostConnections);
+  curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, kMaxCachedConnections);
+  return multi;
+}
+
+void HttpDelegateImpl::PauseThreads() {
+  if (mPaused.exchange(true))
+    return;
+  curl_multi_wakeup(mMulti);
+  mThread.join();
+  // The connection cache lives in the multi handle. The DNS and TLS session caches in the share are
+  // plain memory, so both processes keep them.
+  if (!mActive.empty())
+    return;
+  CURLM* multi = NewMulti();
+  if (multi) {
+    curl_multi_cleanup(mMulti);
+    mMulti = multi;
+  }
+}
+
+void HttpDelegateImpl::ResumeThreads() {
+  if (!mPaused)
+    return;
+  mPaused = false;
+  mThread = std::thread(&HttpDelegateImpl::EventLoop, this);
+}
+
+shared_ptr<HttpOperation> HttpDelegateImpl::Send(const shared_ptr<HttpRequest>& request, const shared_ptr<void>& /*context*/) {
+  auto done = make_shared<std::promise<void>>();
+  auto future = done->get_future();
+  // Only releases the waiting caller, so it runs inline: queuing it behind a busy dispatcher could deadlock.
+  auto operation = Start(request, [done](shared_ptr<HttpOperation>) { done->set_value(); }, true /*inlineCallback*/);
+  future.wait();
+  return operation;
+}
+
+shared_ptr<HttpOperation> HttpDelegateImpl::SendAsync(
+    const shared_ptr<HttpRequest>& request,
+    const shared_ptr<void>& /*context*/,
+    const function<void(shared_ptr<HttpOperation>)>& callbackFn) {
+  return Start(request, callbackFn, false /*inlineCallback*/);
+}
+
+shared_ptr<HttpOperation> HttpDelegateImpl::Start(
+    const shared_ptr<HttpRequest>& request,
+    const function<void(shared_ptr<HttpOperation>)>& callbackFn,
+    bool inlineCallback) {
+  auto exchange = make_shared<Exchange>();
+  exchange->request = request;
+  exchange->callback = callbackFn;
+  exchange->inlineCallback = inlineCallback;
+  exchange->operation = make_shared<HttpOperationImpl>(request->GetId());
+  exchange->host = GetHost(request->GetUrl());
+  exchange->tenant = tenant::Current();
+  exchange->operationCost = cost::CurrentKey();
+  exchange->hostCost = cost::HostKey(exchange->tenant, exchange->host);
+  exchange->idempotent = request->GetRequestType() == HttpRequestType::Get;
+  // A request made for a caller with a deadline gives up with it, retries and hedges included, so a
+  // stalled service releases the caller's resources.
+  exchange->requestDeadline = deadline::Deadline::Current();
+  {
+    lock_guard<mutex> lock(mMutex);
+    exchange->policy = mPolicy;
+  }
+
+  auto transfer = NewAttempt(exchange);
+  if (!transfer)
+    throw std::runtime_error("Failed to create libcurl request");
+
+  ++mRequests;
+  ++mInFlight;
+  {
+    lock_guard<mutex> lock(mMutex);
+    mPending.push_back(transfer);
+  }
+  curl_multi_wakeup(mMulti);
+  return exchange->operation;
+}
+
+shared_ptr<HttpDelegateImpl::Transfer> HttpDelegateImpl::NewAttempt(const shared_ptr<Exchange>& exchange) {
+  CURL* easy = curl_easy_init();
+  if (!easy)
+    return nullptr;
+  auto transfer = make_shared<Transfer>();
+  transfer->exchange = exchange;
+  transfer->startAt = Clock::now();
+  transfer->easy = easy;
+
+  const auto& request = exchange->request;
+  curl_easy_setopt(easy, CURLOPT_URL, request->GetUrl().c_str());
+  if (request->GetRequestType() == HttpRequestType::Post) {
+    const auto& body = request->GetBody();
+    curl_easy_setopt(easy, CURLOPT_POST, 1L);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size()));
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, body.empty() ? "" : reinterpret_cast<const char*>(body.data()));
+  }
+  for (const auto& header : request->GetHeaders())
+    transfer->headers = curl_slist_append(transfer->headers, (header.first + ": " + header.second).c_str());
+  // Skip the 100-continue round trip on POSTs.
+  transfer->headers = curl_slist_append(transfer->headers, "Expect:");
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headers);
+
+  curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // Prefer queuing on an existing connection that can multiplex over opening a new one.
+  curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(easy, CURLOPT_SHARE, mShare);
+  curl_easy_setopt(easy, CURLOPT_DNS_CACHE_TIMEOUT, kDnsCacheTimeoutSec);
+  curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  const auto& requestDeadline = exchange->requestDeadline;
+  const long timeoutMs = requestDeadline.IsSet() ? std::min(kTransferTimeoutMs, requestDeadline.RemainingMs()) : kTransferTimeoutMs;
+  curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, std::min(kConnectTimeoutMs, timeoutMs));
+  curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeoutMs);
+  curl_easy_setopt(easy, CURLOPT_SSLVERSION, ToCurlSslVersion(request->GetTransportLayerSecurityMinimumVersion()));
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, OnBody);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, &transfer->body);
+  curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, OnHeader);
+  curl_easy_setopt(easy, CURLOPT_HEADERDATA, &transfer->responseHeaders);
+
+  ++exchange->live;
+  return transfer;
+}
+
+void HttpDelegateImpl::CancelOperation(const string& requestId) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mCancelRequests.push_back(requestId);
+  }
+  curl_multi_wakeup(mMulti);
+}
+
+void HttpDelegateImpl::CancelAllOperations() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mCancelAll = true;
+  }
+  curl_multi_wakeup(mMulti);
+}
+
+HttpDelegateImpl::Stats HttpDelegateImpl::GetStats() const {
+  Stats stats;
+  stats.requests = mRequests;
+  stats.failed = mFailed;
+  stats.cancelled = mCancelled;
+  stats.inFlight = mInFlight;
+  return stats;
+}
+
+map<string, HttpDelegateImpl::EndpointStats> HttpDelegateImpl::GetEndpointStats() const {
+  lock_guard<mutex> lock(mEndpointMutex);
+  return mEndpoints;
+}
+
+map<AdaptiveRateLimiter::Key, double> HttpDelegateImpl::GetRateLimits() const {
+  lock_guard<mutex> lock(mEndpointMutex);
+  return mRateLimits;
+}
+
+void HttpDelegateImpl::SetTransferListener(const TransferListener& listener) {
+  lock_guard<mutex> lock(mEndpointMutex);
+  mTransferListener = listener;
+}
+
+void HttpDelegateImpl::SetResiliencePolicy(const ResiliencePolicy& policy) {
+  lock_guard<mutex> lock(mMutex);
+  mPolicy = policy;
+}
+
+void HttpDelegateImpl::SetRateLimitPolicy(const AdaptiveRateLimiter::Policy& policy) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mRatePolicy = policy;
+    mRatePolicyChanged = true;
+  }
+  curl_multi_wakeup(mMulti);
+}
+
+void HttpDelegateImpl::EventLoop() {
+  while (!mStopping) {
+    if (mPaused)
+      return;
+    ApplyCancellations();
+    StartPending();
+    StartDue();
+
+    int running = 0;
+    curl_multi_perform(mMulti, &running);
+
+    CURLMsg* message = nullptr;
+    int remaining = 0;
+    while ((message = curl_multi_info_read(mMulti, &remaining)) != nullptr) {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+      auto it = mActive.find(message->easy_handle);
+      if (it == mActive.end())
+        continue;
+      auto transfer = it->second;
+      mActive.erase(it);
+      curl_multi_remove_handle(mMulti, transfer->easy);
+      OnAttemptDone(transfer, message->data.result);
+    }
+
+    curl_multi_poll(mMulti, nullptr, 0, NextWakeupMs(), nullptr);
+  }
+
+  // Nothing completes after shutdown; report whatever is left as cancelled.
+  {
+    lock_guard<mutex> lock(mMutex);
+    mCancelAll = true;
+  }
+  ApplyCancellations();
+}
+
+void HttpDelegateImpl::StartPending() {
+  vector<shared_ptr<Transfer>> pending;
+  {
+    lock_guard<mutex> lock(mMutex);
+    pending.swap(mPending);
+    mLoopPolicy = mPolicy;
+    if (mRatePolicyChanged) {
+      mRateLimiter.SetPolicy(mRatePolicy);
+      mRatePolicyChanged = false;
+    }
+  }
+  for (auto& transfer : pending)
+    Activate(transfer);
+}
+
+void HttpDelegateImpl::StartDue() {
+  const auto now = Clock::now();
+  vector<shared_ptr<Transfer>> due;
+  for (auto it = mDelayed.begin(); it != mDelayed.end();) {
+    if ((*it)->startAt <= now) {
+      due.push_back(*it);
+      it = mDelayed.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto& transfer : due)
+    Activate(transfer);
+  StartThrottled();
+
+  // A GET still running after its host's p95 is sent once more; the slower attempt is cancelled.
+  vector<shared_ptr<Exchange>> hedges;
+  for (auto& active : mActive) {
+    auto& transfer = active.second;
+    if (transfer->hedgeAt > now)
+      continue;
+    transfer->hedgeAt = Clock::time_point::max();
+    if (!transfer->exchange->hedged && !transfer->exchange->done) {
+      transfer->exchange->hedged = true;
+      hedges.push_back(transfer->exchange);
+    }
+  }
+  for (auto& exchange : hedges) {
+    // A hedge is extra load, which a host that throttles the tenant does not get.
+    if (exchange->requestDeadline.HasExpired() || mRateLimiter.GetRate(AdaptiveRateLimiter::Key(exchange->tenant, exchange->host)) > 0)
+      continue;
+    auto hedge = NewAttempt(exchange);
+    if (!hedge)
+      continue;
+    {
+      lock_guard<mutex> lock(mEndpointMutex);
+      ++mEndpoints[exchange->host].hedges;
+    }
+    Activate(hedge);
+  }
+}
+
+void HttpDelegateImpl::Activate(const shared_ptr<Transfer>& transfer, bool admitted) {
+  if (!admitted && !Admit(transfer))
+    return;
+  auto exchange = transfer->exchange;
+  auto& health = mHealth[exchange->host];
+  const auto now = Clock::now();
+  if (mLoopPolicy.breakerFailures > 0 && health.consecutiveFailures >= mLoopPolicy.breakerFailures) {
+    if (now < health.openUntil || health.probing) {
+      // The host keeps failing: fail fast instead of queuing more work on it, and do not retry.
+      {
+        lock_guard<mutex> lock(mEndpointMutex);
+        ++mEndpoints[exchange->host].shortCircuited;
+      }
+      if (--exchange->live == 0 && !exchange->done)
+        Finish(exchange, nullptr, CURLE_COULDNT_CONNECT, false);
+      return;
+    }
+    // Half open: this attempt probes whether the host has recovered.
+    health.probing = true;
+    transfer->probe = true;
+  }
+  if (curl_multi_add_handle(mMulti, transfer->easy) != CURLM_OK) {
+    OnAttemptDone(transfer, CURLE_FAILED_INIT);
+    return;
+  }
+  transfer->admittedAt = now;
+  if (exchange->idempotent && exchange->policy.hedge && !exchange->hedged && health.p95LatencyMicros >= 0) {
+    transfer->hedgeAt = now + std::max<Clock::duration>(
+        std::chrono::microseconds(health.p95LatencyMicros), std::chrono::milliseconds(exchange->policy.hedgeMinMs));
+  }
+  mActive[transfer->easy] = transfer;
+}
+
+bool HttpDelegateImpl::Admit(const shared_ptr<Transfer>& transfer) {
+  const auto& exchange = transfer->exchange;
+  const AdaptiveRateLimiter::Key key(exchange->tenant, exchange->host);
+  const auto now = Clock::now();
+  auto queue = mThrottled.find(key);
+  // Attempts already waiting for a token get the next one, so a burst of new requests cannot starve them.
+  if (queue == mThrottled.end() || queue->second.transfers.empty()) {
+    Clock::time_point readyAt;
+    if (mRateLimiter.TryAcquire(key, now, readyAt))
+      return true;
+    queue = mThrottled.emplace(key, ThrottleQueue()).first;
+    queue->second.readyAt = readyAt;
+  }
+  transfer->queuedAt = now;
+  queue->second.transfers.push_back(transfer);
+  ++exchange->throttled;
+  {
+    lock_guard<mutex> lock(mEndpointMutex);
+    ++mEndpoints[exchange->host].rateLimited;
+  }
+  return false;
+}
+
+void HttpDelegateImpl::StartThrottled() {
+  if (mThrottled.empty())
+    return;
+  const auto now = Clock::now();
+  vector<shared_ptr<Transfer>> expired;
+  if (now >= mNextExpirySweep) {
+    mNextExpirySweep = now + std::chrono::milliseconds(kExpirySweepMs);
+    for (auto& entry : mThrottled) {
+      auto& transfers = entry.second.transfers;
+      for (auto it = transfers.begin(); it != transfers.end();) {
+        if ((*it)->exchange->requestDeadline.HasExpired()) {
+          expired.push_back(*it);
+          it = transfers.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+  vector<shared_ptr<Transfer>> admitted;
+  for (auto entry = mThrottled.begin(); entry != mThrottled.end();) {
+    auto& queue = entry->second;
+    while (!queue.transfers.empty() && queue.readyAt <= now) {
+      if (!mRateLimiter.TryAcquire(entry->first, now, queue.readyAt))
+        break;
+      auto transfer = queue.transfers.front();
+      queue.transfers.pop_front();
+      admitted.push_back(transfer);
+    }
+    if (queue.transfers.empty())
+      entry = mThrottled.erase(entry);
+    else
+      ++entry;
+  }
+  if (!admitted.empty()) {
+    lock_guard<mutex> lock(mEndpointMutex);
+    // Queues are per tenant and host, but waits are reported per host like the other stats.
+    for (const auto& transfer : admitted)
+      mEndpoints[transfer->exchange->host].rateLimitWaitMicros +=
+          static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - transfer->queuedAt).count());
+  }
+
+  for (auto& transfer : expired) {
+    auto exchange = transfer->exchange;
+    --exchange->throttled;
+    if (--exchange->live == 0 && !exchange->done)
+      Finish(exchange, nullptr, CURLE_OPERATION_TIMEDOUT, false);
+  }
+  for (auto& transfer : admitted) {
+    auto exchange = transfer->exchange;
+    --exchange->throttled;
+    // A token taken for an exchange that finished meanwhile is not given back; it is rare and costs one slot.
+    if (exchange->done)
+      continue;
+    // The transfer timeout was set when the attempt was created; the wait comes out of the caller's deadline.
+    const auto& requestDeadline = exchange->requestDeadline;
+    if (requestDeadline.IsSet())
+      curl_easy_setopt(transfer->easy, CURLOPT_TIMEOUT_MS, std::max(1L, std::min(kTransferTimeoutMs, requestDeadline.RemainingMs())));
+    Activate(transfer, true /*admitted*/);
+  }
+}
+
+void HttpDelegateImpl::ApplyCancellations() {
+  vector<string> requestIds;
+  bool cancelAll = false;
+  vector<shared_ptr<Transfer>> cancelled;
+  {
+    lock_guard<mutex> lock(mMutex);
+    requestIds.swap(mCancelRequests);
+    cancelAll = mCancelAll;
+    mCancelAll = false;
+    if (!cancelAll && requestIds.empty())
+      return;
+
+    auto matches = [&](const shared_ptr<Transfer>& transfer) {
+      return cancelAll ||
+          std::find(requestIds.begin(), requestIds.end(), transfer->exchange->request->GetId()) != requestIds.end();
+    };
+    for (auto it = mPending.begin(); it != mPending.end();) {
+      if (matches(*it)) {
+        cancelled.push_back(*it);
+        it = mPending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (const auto& active : mActive) {
+      if (matches(active.second))
+        cancelled.push_back(active.second);
+    }
+    for (const auto& delayed : mDelayed) {
+      if (matches(delayed))
+        cancelled.push_back(delayed);
+    }
+    for (const auto& queue : mThrottled) {
+      for (const auto& throttled : queue.second.transfers) {
+        if (matches(throttled))
+          cancelled.push_back(throttled);
+      }
+    }
+  }
+  for (auto& transfer : cancelled) {
+    auto exchange = transfer->exchange;
+    if (exchange->done)
+      continue;
+    CancelAttempts(exchange);
+    Finish(exchange, nullptr, CURLE_ABORTED_BY_CALLBACK, true);
+  }
+}
+
+void HttpDelegateImpl::OnAttemptDone(const shared_ptr<Transfer>& transfer, CURLcode result) {
+  auto exchange = transfer->exchange;
+  --exchange->live;
+  const long statusCode = RecordAttempt(transfer, result);
+  if (exchange->done)
+    return;
+
+  const bool failed = result != CURLE_OK || IsRetryableStatus(statusCode);
+  if (failed && exchange->live > 0)
+    return; // The other attempt of a hedged GET may still succeed.
+  if (failed && exchange->idempotent && exchange->retries < exchange->policy.maxRetries) {
+    // Full jitter keeps retries from many callers off the same instant.
+    const int shift = std::min(exchange->retries, kMaxBackoffShift);
+    const int64_t capMs = std::min(exchange->policy.retryMaxMs, exchange->policy.retryBaseMs << shift);
+    const auto delay = std::chrono::milliseconds(
+        capMs > 0 ? std::uniform_int_distribution<int64_t>(0, capMs)(mRandom) : 0);
+    const auto& requestDeadline = exchange->requestDeadline;
+    if (!requestDeadline.IsSet() || Clock::now() + delay < requestDeadline.GetExpiry()) {
+      if (auto retry = NewAttempt(exchange)) {
+        ++exchange->retries;
+        retry->startAt = Clock::now() + delay;
+        {
+          lock_guard<mutex> lock(mEndpointMutex);
+          ++mEndpoints[exchange->host].retries;
+        }
+        mDelayed.push_back(retry);
+        return;
+      }
+    }
+  }
+  CancelAttempts(exchange);
+  Finish(exchange, transfer, result, false);
+}
+
+long HttpDelegateImpl::RecordAttempt(const shared_ptr<Transfer>& transfer, CURLcode result) {
+  const auto& exchange = transfer->exchange;
+  curl_off_t bytesSent = 0;
+  curl_off_t bytesReceived = 0;
+  long statusCode = 0;
+  curl_easy_getinfo(transfer->easy, CURLINFO_SIZE_UPLOAD_T, &bytesSent);
+  curl_easy_getinfo(transfer->easy, CURLINFO_SIZE_DOWNLOAD_T, &bytesReceived);
+  if (result == CURLE_OK)
+    curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &statusCode);
+  const int64_t totalMicros = GetTimeMicros(transfer->easy, CURLINFO_TOTAL_TIME_T);
+  // Hedges and retries are charged too: each is a request the service served.
+  const uint64_t bytes = static_cast<uint64_t>(bytesSent) + static_cast<uint64_t>(bytesReceived);
+  for (cost::Key charged : {exchange->operationCost, exchange->hostCost}) {
+    cost::Add(charged, cost::Counter::HttpRequests, 1);
+    cost::Add(charged, cost::Counter::HttpBytes, bytes);
+  }
+
+  const AdaptiveRateLimiter::Key key(exchange->tenant, exchange->host);
+  const bool throttled = result == CURLE_OK && IsThrottlingStatus(statusCode);
+  if (throttled) {
+    auto retryAfter = transfer->responseHeaders.find("Retry-After");
+    const int64_t retryAfterMs = retryAfter == transfer->responseHeaders.end()
+        ? -1 : AdaptiveRateLimiter::ParseRetryAfter(retryAfter->second, std::chrono::system_clock::now());
+    mRateLimiter.OnThrottled(key, transfer->admittedAt, Clock::now(), retryAfterMs);
+  } else if (result == CURLE_OK && statusCode < 500) {
+    mRateLimiter.OnSuccess(key, Clock::now());
+  }
+
+  auto& health = mHealth[exchange->host];
+  if (transfer->probe)
+    health.probing = false;
+  if (result != CURLE_OK || statusCode >= 500) {
+    ++health.consecutiveFailures;
+    if (mLoopPolicy.breakerFailures > 0 && health.consecutiveFailures >= mLoopPolicy.breakerFailures)
+      health.openUntil = Clock::now() + std::chrono::milliseconds(mLoopPolicy.breakerOpenMs);
+  } else {
+    health.consecutiveFailures = 0;
+  }
+  if (result == CURLE_OK && totalMicros >= 0) {
+    if (health.latencyMicros.size() < kLatencySamples) {
+      health.latencyMicros.push_back(totalMicros);
+    } else {
+      health.latencyMicros[health.nextSample] = totalMicros;
+      health.nextSample = (health.nextSample + 1) % kLatencySamples;
+    }
+    if (health.latencyMicros.size() >= kMinHedgeSamples) {
+      auto samples = health.latencyMicros;
+      auto p95 = samples.begin() + (samples.size() * 95) / 100;
+      std::nth_element(samples.begin(), p95, samples.end());
+      health.p95LatencyMicros = *p95;
+    }
+  }
+
+  TransferListener listener;
+  {
+    lock_guard<mutex> lock(mEndpointMutex);
+    auto& endpoint = mEndpoints[exchange->host];
+    ++endpoint.requests;
+    if (result != CURLE_OK)
+      ++endpoint.failed;
+    else if (statusCode >= 500)
+      ++endpoint.serverErrors;
+    else if (statusCode >= 400)
+      ++endpoint.clientErrors;
+    if (throttled)
+      ++endpoint.throttled;
+    const double rate = mRateLimiter.GetRate(key);
+    if (rate > 0)
+      mRateLimits[key] = rate;
+    else
+      mRateLimits.erase(key);
+    endpoint.bytesSent += static_cast<uint64_t>(bytesSent);
+    endpoint.bytesReceived += static_cast<uint64_t>(bytesReceived);
+    if (totalMicros > 0)
+      endpoint.latencyMicros += static_cast<uint64_t>(totalMicros);
+    if (totalMicros >= 0)
+      ++endpoint.latencyBuckets[GetLatencyBucket(totalMicros)];
+    endpoint.p95LatencyMicros = health.p95LatencyMicros;
+    endpoint.circuitOpen = mLoopPolicy.breakerFailures > 0 && health.consecutiveFailures >= mLoopPolicy.breakerFailures;
+    listener = mTransferListener;
+  }
+  if (listener) {
+    TransferInfo info;
+    info.nameLookupMicros = GetTimeMicros(transfer->easy, CURLINFO_NAMELOOKUP_TIME_T);
+    info.connectMicros = GetTimeMicros(transfer->easy, CURLINFO_CONNECT_TIME_T);
+    info.tlsMicros = GetTimeMicros(transfer->easy, CURLINFO_APPCONNECT_TIME_T);
+    info.firstByteMicros = GetTimeMicros(transfer->easy, CURLINFO_STARTTRANSFER_TIME_T);
+    info.totalMicros = totalMicros;
+    info.bytesSent = static_cast<uint64_t>(bytesSent);
+    info.bytesReceived = static_cast<uint64_t>(bytesReceived);
+    listener(exchange->request->GetId(), info);
+  }
+  return statusCode;
+}
+
+void HttpDelegateImpl::CancelAttempts(const shared_ptr<Exchange>& exchange) {
+  for (auto it = mActive.begin(); it != mActive.end();) {
+    if (it->second->exchange == exchange) {
+      if (it->second->probe)
+        mHealth[exchange->host].probing = false;
+      curl_multi_remove_handle(mMulti, it->first);
+      it = mActive.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  mDelayed.erase(std::remove_if(mDelayed.begin(), mDelayed.end(),
+      [&](const shared_ptr<Transfer>& transfer) { return transfer->exchange == exchange; }), mDelayed.end());
+  if (exchange->throttled > 0) {
+    auto queue = mThrottled.find(AdaptiveRateLimiter::Key(exchange->tenant, exchange->host));
+    if (queue != mThrottled.end()) {
+      auto& transfers = queue->second.transfers;
+      transfers.erase(std::remove_if(transfers.begin(), transfers.end(),
+          [&](const shared_ptr<Transfer>& transfer) { return transfer->exchange == exchange; }), transfers.end());
+    }
+    exchange->throttled = 0;
+  }
+  exchange->live = 0;
+}
+
+long HttpDelegateImpl::NextWakeupMs() const {
+  const auto now = Clock::now();
+  auto next = now + std::chrono::milliseconds(kPollTimeoutMs);
+  for (const auto& delayed : mDelayed)
+    next = std::min(next, delayed->startAt);
+  for (const auto& active : mActive)
+    next = std::min(next, active.second->hedgeAt);
+  for (const auto& queue : mThrottled)
+    next = std::min(next, queue.second.readyAt);
+  if (next <= now)
+    return 0;
+  // Round up so the loop wakes at or after the due time rather than spinning just before it.
+  return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+}
+
+void HttpDelegateImpl::Finish(
+    const shared_ptr<Exchange>& exchange, const shared_ptr<Transfer>& transfer, CURLcode result, bool cancelled) {
+  exchange->done = true;
+  shared_ptr<HttpResponse> response;
+  if (cancelled) {
+    ++mCancelled;
+  } else if (result != CURLE_OK || !transfer) {
+    // A null response tells the SDK the request failed at the transport level.
+    ++mFailed;
+  } else {
+    long statusCode = 0;
+    curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &statusCode);
+    response = make_shared<HttpResponseImpl>(
+        exchange->request->GetId(), static_cast<int32_t>(statusCode), std::move(transfer->body), std::move(transfer->responseHeaders));
+  }
+  exchange->operation->Complete(response, cancelled);
+  --mInFlight;
+
+  auto operation = exchange->operation;
+  auto callback = exchange->callback;
+  if (!callback)
+    return;
+  if (mCallbackDispatcher && !exchange->inlineCallback && !mStopping) {
+    mCallbackDispatcher->DispatchTask("http-callback-" + operation->GetId(), [callback, operation]() { callback(operation); });
+  } else {
+    callback(operation);
+  }
+}
+
+} // namespace http
+} // namespace sample
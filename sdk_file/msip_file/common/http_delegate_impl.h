@@ -0,0 +1,247 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_HTTP_DELEGATE_IMPL_H_
+#define SAMPLES_COMMON_HTTP_DELEGATE_IMPL_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "adaptive_rate_limiter.h"
+#include "mip/http_delegate.h"
+#include "mip/task_dispatcher_delegate.h"
+
+namespace sample {
+namespace http {
+
+// HttpDelegate over a single libcurl multi handle driven by one event-loop thread. All requests share
+// the multi handle's connection pool, so connections stay alive across calls and HTTP/2 streams to the
+// same host are multiplexed over one connection. A share handle caches DNS lookups and TLS sessions so
+// new connections resume instead of doing a full handshake.
+//
+// GETs are idempotent, so a GET that fails at the transport level or with a 429 or 5xx is retried
+// after a jittered backoff, and a GET still running after its host's p95 latency is sent again, taking
+// whichever response arrives first. Each host has a circuit breaker: after enough consecutive failures
+// its requests fail fast until a single probe gets through.
+//
+// Requests of each tenant to each host also take a token from an AdaptiveRateLimiter bucket, which starts
+// limiting once the host answers 429 or 503 and then follows its Retry-After and throttling. A request with
+// no token waits in its bucket's queue, in order, instead of adding to the throttling.
+class HttpDelegateImpl final : public mip::HttpDelegate {
+public:
+  // 0 disables retries, hedging or the breaker respectively.
+  struct ResiliencePolicy {
+    int maxRetries;
+    int64_t retryBaseMs;
+    int64_t retryMaxMs;
+    bool hedge;
+    int64_t hedgeMinMs;
+    int breakerFailures;
+    int64_t breakerOpenMs;
+
+    ResiliencePolicy();
+  };
+
+  struct Stats {
+    uint64_t requests;
+    uint64_t failed;
+    uint64_t cancelled;
+    size_t inFlight;
+  };
+
+  // Latency buckets per host share the native phase histograms' bounds: 100 us doubling to about 105 s.
+  static const size_t kLatencyBucketCount = 21;
+
+  // Completed attempts per host, including retries and hedges. Failed counts transport failures, not HTTP
+  // error statuses. Hosts the SDK reaches through DNS redirection are tracked like any other.
+  struct EndpointStats {
+    uint64_t requests;
+    uint64_t failed;
+    uint64_t clientErrors;
+    uint64_t serverErrors;
+    uint64_t retries;
+    uint64_t hedges;
+    uint64_t shortCircuited;
+    // Responses with a 429 or 503 status, attempts that waited for a rate limit token, and their waits.
+    uint64_t throttled;
+    uint64_t rateLimited;
+    uint64_t rateLimitWaitMicros;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t latencyMicros;
+    // Attempts per latency bucket (not cumulative), so latencyMicros is their sum; the last entry is above every bound.
+    uint64_t latencyBuckets[kLatencyBucketCount + 1];
+    int64_t p95LatencyMicros;
+    bool circuitOpen;
+  };
+
+  // Timings of one completed transfer in microseconds from its start, as libcurl reports them. A reused
+  // connection reports no lookup, connect or TLS time.
+  struct TransferInfo {
+    int64_t nameLookupMicros;
+    int64_t connectMicros;
+    int64_t tlsMicros;
+    int64_t firstByteMicros;
+    int64_t totalMicros;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+  };
+
+  // Runs on the event-loop thread before the request's operation completes, so it must be quick.
+  typedef std::function<void(const std::string& requestId, const TransferInfo& info)> TransferListener;
+
+  // Completion callbacks are handed to callbackDispatcher so SDK code never runs on the event loop.
+  // Without one they run inline on the loop thread.
+  explicit HttpDelegateImpl(const std::shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher = nullptr);
+  ~HttpDelegateImpl();
+
+  std::shared_ptr<mip::HttpOperation> Send(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context) override;
+
+  std::shared_ptr<mip::HttpOperation> SendAsync(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context,
+      const std::function<void(std::shared_ptr<mip::HttpOperation>)>& callbackFn) override;
+
+  void CancelOperation(const std::string& requestId) override;
+
+  void CancelAllOperations() override;
+
+  Stats GetStats() const;
+
+  std::map<std::string, EndpointStats> GetEndpointStats() const;
+
+  // Requests per second each (tenant, host) is limited to, for the buckets that limit something.
+  std::map<AdaptiveRateLimiter::Key, double> GetRateLimits() const;
+
+  void SetTransferListener(const TransferListener& listener);
+
+  // Applies to requests sent afterwards.
+  void SetResiliencePolicy(const ResiliencePolicy& policy);
+  void SetRateLimitPolicy(const AdaptiveRateLimiter::Policy& policy);
+
+  // Joins the event-loop thread and closes the pooled connections, so a forked child never shares a
+  // socket or TLS session with its parent. Call with no request in flight and none starting until
+  // ResumeThreads, which starts the loop again in the parent and the child alike.
+  void PauseThreads();
+  void ResumeThreads();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  struct Exchange;
+  struct Transfer;
+
+  // Breaker and latency state of one host. Only touched on the event-loop thread.
+  struct EndpointHealth {
+    std::vector<int64_t> latencyMicros;
+    size_t nextSample;
+    int64_t p95LatencyMicros;
+    int consecutiveFailures;
+    Clock::time_point openUntil;
+    bool probing;
+
+    EndpointHealth();
+  };
+
+  // Attempts waiting for a token of one rate limit bucket, oldest first.
+  struct ThrottleQueue {
+    std::deque<std::shared_ptr<Transfer>> transfers;
+    Clock::time_point readyAt;
+  };
+
+  std::shared_ptr<mip::HttpOperation> Start(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::function<void(std::shared_ptr<mip::HttpOperation>)>& callbackFn,
+      bool inlineCallback);
+  std::shared_ptr<Transfer> NewAttempt(const std::shared_ptr<Exchange>& exchange);
+  static CURLM* NewMulti();
+  void EventLoop();
+  void StartPending();
+  void StartDue();
+  void Activate(const std::shared_ptr<Transfer>& transfer, bool admitted = false);
+  bool Admit(const std::shared_ptr<Transfer>& transfer);
+  void StartThrottled();
+  void ApplyCancellations();
+  void OnAttemptDone(const std::shared_ptr<Transfer>& transfer, CURLcode result);
+  long RecordAttempt(const std::shared_ptr<Transfer>& transfer, CURLcode result);
+  void CancelAttempts(const std::shared_ptr<Exchange>& exchange);
+  long NextWakeupMs() const;
+  void Finish(const std::shared_ptr<Exchange>& exchange, const std::shared_ptr<Transfer>& transfer, CURLcode result, bool cancelled);
+
+  std::shared_ptr<mip::TaskDispatcherDelegate> mCallbackDispatcher;
+  CURLM* mMulti;
+  CURLSH* mShare;
+
+  mutable std::mutex mMutex;
+  std::vector<std::shared_ptr<Transfer>> mPending;
+  std::vector<std::string> mCancelRequests;
+  bool mCancelAll;
+  ResiliencePolicy mPolicy;
+  AdaptiveRateLimiter::Policy mRatePolicy;
+  bool mRatePolicyChanged;
+
+  // Only touched on the event-loop thread.
+  std::unordered_map<CURL*, std::shared_ptr<Transfer>> mActive;
+  std::vector<std::shared_ptr<Transfer>> mDelayed;
+  std::map<std::string, EndpointHealth> mHealth;
+  ResiliencePolicy mLoopPolicy;
+  AdaptiveRateLimiter mRateLimiter;
+  std::map<AdaptiveRateLimiter::Key, ThrottleQueue> mThrottled;
+  Clock::time_point mNextExpirySweep;
+  std::mt19937 mRandom;
+
+  std::atomic<bool> mStopping;
+  std::atomic<bool> mPaused;
+  std::atomic<uint64_t> mRequests;
+  std::atomic<uint64_t> mFailed;
+  std::atomic<uint64_t> mCancelled;
+  std::atomic<size_t> mInFlight;
+
+  mutable std::mutex mEndpointMutex;
+  std::map<std::string, EndpointStats> mEndpoints;
+  std::map<AdaptiveRateLimiter::Key, double> mRateLimits;
+  TransferListener mTransferListener;
+  std::thread mThread;
+};
+
+} // namespace http
+} // namespace sample
+
+#endif // SAMPLES_COMMON_HTTP_DELEGATE_IMPL_H_
@@ -0,0 +1,194 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "instrumented_mutex.h"
+
+#include <chrono>
+#include <map>
+#include <memory>
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace lock {
+
+struct InstrumentedMutex::Metrics {
+  struct Timings {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sumNanoseconds;
+    std::atomic<uint64_t> buckets[kBucketCount + 1];
+  };
+
+  std::atomic<uint64_t> contended;
+  Timings wait;
+  Timings hold;
+};
+
+namespace {
+
+const int64_t kFirstBoundNanoseconds = 1000;
+
+std::atomic<uint32_t> gSampling(64);
+// Acquisitions this thread has left before it times the next one.
+thread_local uint32_t tUntilSample = 0;
+
+int64_t Now() {
+  // 0 marks an untimed acquisition, so never return it.
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() | 1;
+}
+
+bool ShouldSample() {
+  const uint32_t every = gSampling.load(memory_order_relaxed);
+  if (every == 0)
+    return false;
+  if (tUntilSample == 0 || tUntilSample > every) {
+    tUntilSample = every;
+    return true;
+  }
+  --tUntilSample;
+  return false;
+}
+
+void Record(InstrumentedMutex::Metrics::Timings& timings, int64_t elapsed) {
+  size_t bucket = 0;
+  for (int64_t bound = kFirstBoundNanoseconds; bucket < kBucketCount && elapsed > bound; bound *= 2)
+    ++bucket;
+  timings.count.fetch_add(1, memory_order_relaxed);
+  timings.sumNanoseconds.fetch_add(static_cast<uint64_t>(elapsed), memory_order_relaxed);
+  timings.buckets[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+Histogram Read(const InstrumentedMutex::Metrics::Timings& timings) {
+  Histogram histogram;
+  histogram.count = timings.count.load(memory_order_relaxed);
+  histogram.sumNanoseconds = timings.sumNanoseconds.load(memory_order_relaxed);
+  for (size_t bucket = 0; bucket <= kBucketCount; ++bucket)
+    histogram.buckets[bucket] = timings.buckets[bucket].load(memory_order_relaxed);
+  return histogram;
+}
+
+// Metrics per lock name, created on first use and never freed, so mutexes can keep a reference.
+class Registry final {
+public:
+  static Registry& Instance() {
+    // Intentionally leaked: mutexes in other leaked singletons record until process exit.
+    static Registry* registry = new Registry();
+    return *registry;
+  }
+
+  InstrumentedMutex::Metrics& Get(const string& name) {
+    lock_guard<mutex> lock(mMutex);
+    auto& metrics = mMetrics[name];
+    if (!metrics)
+      metrics.reset(new InstrumentedMutex::Metrics());
+    return *metrics;
+  }
+
+  vector<Stats> Snapshot() {
+    lock_guard<mutex> lock(mMutex);
+    vector<Stats> snapshot;
+    for (const auto& entry : mMetrics) {
+      Stats stats;
+      stats.name = entry.first;
+      stats.contended = entry.second->contended.load(memory_order_relaxed);
+      stats.wait = Read(entry.second->wait);
+      stats.hold = Read(entry.second->hold);
+      snapshot.push_back(stats);
+    }
+    return snapshot;
+  }
+
+private:
+  mutex mMutex;
+  std::map<string, std::unique_ptr<InstrumentedMutex::Metrics>> mMetrics;
+};
+
+} // namespace
+
+void SetSampling(uint32_t every) {
+  gSampling.store(every, memory_order_relaxed);
+}
+
+uint32_t GetSampling() {
+  return gSampling.load(memory_order_relaxed);
+}
+
+vector<Stats> Snapshot() {
+  return Registry::Instance().Snapshot();
+}
+
+double GetBucketBoundSeconds(size_t bucket) {
+  return static_cast<double>(kFirstBoundNanoseconds << bucket) / 1e9;
+}
+
+InstrumentedMutex::InstrumentedMutex(const string& name) : mMetrics(Registry::Instance().Get(name)), mLockedAt(0) {
+}
+
+void InstrumentedMutex::lock() {
+  const bool sampled = ShouldSample();
+  if (mMutex.try_lock()) {
+    if (sampled) {
+      mLockedAt = Now();
+      Record(mMetrics.wait, 0);
+    }
+    return;
+  }
+  mMetrics.contended.fetch_add(1, memory_order_relaxed);
+  if (!sampled) {
+    mMutex.lock();
+    return;
+  }
+  const int64_t asked = Now();
+  mMutex.lock();
+  mLockedAt = Now();
+  Record(mMetrics.wait, mLockedAt - asked);
+}
+
+bool InstrumentedMutex::try_lock() {
+  if (!mMutex.try_lock())
+    return false;
+  if (ShouldSample())
+    mLockedAt = Now();
+  return true;
+}
+
+void InstrumentedMutex::unlock() {
+  if (mLockedAt != 0) {
+    Record(mMetrics.hold, Now() - mLockedAt);
+    mLockedAt = 0;
+  }
+  mMutex.unlock();
+}
+
+} // namespace lock
+} // namespace sample
@@ -0,0 +1,98 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_INSTRUMENTED_MUTEX_H_
+#define SAMPLES_COMMON_INSTRUMENTED_MUTEX_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace lock {
+
+// Upper bounds run from 1 us doubling to about 1 s, plus an overflow bucket.
+const size_t kBucketCount = 21;
+
+struct Histogram {
+  uint64_t count;
+  uint64_t sumNanoseconds;
+  // Per-bucket (not cumulative) counts; the last entry counts samples above every bound.
+  uint64_t buckets[kBucketCount + 1];
+};
+
+// What every mutex of one name recorded.
+struct Stats {
+  std::string name;
+  // Acquisitions that found the mutex held, counted whether or not they were sampled.
+  uint64_t contended;
+  // Time from asking for the mutex to owning it, and from owning it to releasing it, of the sampled
+  // acquisitions.
+  Histogram wait;
+  Histogram hold;
+};
+
+// Times one acquisition in every, per thread, so timing costs two clock reads on 1 / every of them.
+// 1 times all of them and 0 none. Contention is counted either way, with one try_lock on the fast path.
+void SetSampling(uint32_t every);
+uint32_t GetSampling();
+
+// One entry per lock name, in name order.
+std::vector<Stats> Snapshot();
+
+double GetBucketBoundSeconds(size_t bucket);
+
+// A std::mutex that records contention, wait and hold times against its name. Every mutex created with
+// the same name, e.g. the shards of one cache, adds to the same Stats. Works with lock_guard and
+// unique_lock; not with std::condition_variable, so a mutex a condition waits on stays a std::mutex.
+class InstrumentedMutex final {
+public:
+  explicit InstrumentedMutex(const std::string& name);
+
+  InstrumentedMutex(const InstrumentedMutex&) = delete;
+  InstrumentedMutex& operator=(const InstrumentedMutex&) = delete;
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+  struct Metrics;
+
+private:
+  std::mutex mMutex;
+  Metrics& mMetrics;
+  // Steady clock nanoseconds when a sampled acquisition took the mutex, 0 otherwise. Only the owner
+  // reads or writes it.
+  int64_t mLockedAt;
+};
+
+} // namespace lock
+} // namespace sample
+
+#endif // SAMPLES_COMMON_INSTRUMENTED_MUTEX_H_
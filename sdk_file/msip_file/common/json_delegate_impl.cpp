@@ -0,0 +1,601 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "json_delegate_impl.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "mip/error.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace json {
+
+namespace {
+
+// Nesting deeper than any service response, so a hostile one cannot exhaust the stack.
+const int kMaxDepth = 256;
+
+enum class Type { Null, False, True, Number, String, Array, Object };
+
+struct Node {
+  explicit Node(Type nodeType) : type(nodeType) {}
+
+  Type type;
+  // The unescaped string, or the text of a number.
+  string text;
+  vector<Node*> items;
+  vector<std::pair<string, Node*>> members;
+};
+
+// Owns every node of a document; the values handed out keep it alive.
+struct Arena {
+  Node* New(Type type) {
+    nodes.emplace_back(type);
+    return &nodes.back();
+  }
+
+  // Copies node, which may belong to another arena, into this one.
+  Node* Copy(const Node& node) {
+    Node* copy = New(node.type);
+    copy->text = node.text;
+    copy->items.reserve(node.items.size());
+    for (const auto* item : node.items)
+      copy->items.push_back(Copy(*item));
+    copy->members.reserve(node.members.size());
+    for (const auto& member : node.members)
+      copy->members.emplace_back(member.first, Copy(*member.second));
+    return copy;
+  }
+
+  // A deque never moves its elements, so nodes keep their addresses as the document grows.
+  std::deque<Node> nodes;
+};
+
+class Parser final {
+public:
+  Parser(const string& json, Arena& arena)
+      : mBegin(json.data()),
+        mPos(json.data()),
+        mEnd(json.data() + json.size()),
+        mArena(arena) {
+  }
+
+  Node* ParseDocument() {
+    Node* root = ParseValue(0);
+    SkipWhitespace();
+    if (mPos != mEnd)
+      Fail("trailing characters");
+    return root;
+  }
+
+private:
+  [[noreturn]] void Fail(const char* what) const {
+    throw mip::BadInputError(string("Invalid JSON at offset ") + std::to_string(mPos - mBegin) + ": " + what);
+  }
+
+  void SkipWhitespace() {
+    while (mPos < mEnd && (*mPos == ' ' || *mPos == '\n' || *mPos == '\r' || *mPos == '\t'))
+      ++mPos;
+  }
+
+  bool Consume(const char* literal, size_t size) {
+    if (static_cast<size_t>(mEnd - mPos) < size || memcmp(mPos, literal, size) != 0)
+      return false;
+    mPos += size;
+    return true;
+  }
+
+  Node* ParseValue(int depth) {
+    if (depth > kMaxDepth)
+      Fail("nested too deeply");
+    SkipWhitespace();
+    if (mPos == mEnd)
+      Fail("expected a value");
+    switch (*mPos) {
+      case '{': return ParseObject(depth);
+      case '[': return ParseArray(depth);
+      case '"': {
+        Node* node = mArena.New(Type::String);
+        ParseString(node->text);
+        return node;
+      }
+      case 't':
+        if (!Consume("true", 4))
+          Fail("expected a value");
+        return mArena.New(Type::True);
+      case 'f':
+        if (!Consume("false", 5))
+          Fail("expected a value");
+        return mArena.New(Type::False);
+      case 'n':
+        if (!Consume("null", 4))
+          Fail("expected a value");
+        return mArena.New(Type::Null);
+      default:
+        return ParseNumber();
+    }
+  }
+
+  Node* ParseObject(int depth) {
+    Node* node = mArena.New(Type::Object);
+    ++mPos;
+    SkipWhitespace();
+    if (mPos < mEnd && *mPos == '}') {
+      ++mPos;
+      return node;
+    }
+    for (;;) {
+      SkipWhitespace();
+      if (mPos == mEnd || *mPos != '"')
+        Fail("expected a member name");
+      string key;
+      ParseString(key);
+      SkipWhitespace();
+      if (mPos == mEnd || *mPos++ != ':')
+        Fail("expected ':'");
+      node->members.emplace_back(std::move(key), ParseValue(depth + 1));
+      SkipWhitespace();
+      if (mPos == mEnd)
+        Fail("unterminated object");
+      const char next = *mPos++;
+      if (next == '}')
+        return node;
+      if (next != ',')
+        Fail("expected ',' or '}'");
+    }
+  }
+
+  Node* ParseArray(int depth) {
+    Node* node = mArena.New(Type::Array);
+    ++mPos;
+    SkipWhitespace();
+    if (mPos < mEnd && *mPos == ']') {
+      ++mPos;
+      return node;
+    }
+    for (;;) {
+      node->items.push_back(ParseValue(depth + 1));
+      SkipWhitespace();
+      if (mPos == mEnd)
+        Fail("unterminated array");
+      const char next = *mPos++;
+      if (next == ']')
+        return node;
+      if (next != ',')
+        Fail("expected ',' or ']'");
+    }
+  }
+
+  Node* ParseNumber() {
+    const char* start = mPos;
+    if (*mPos != '-' && (*mPos < '0' || *mPos > '9'))
+      Fail("expected a value");
+    if (mPos < mEnd && *mPos == '-')
+      ++mPos;
+    const char* digits = mPos;
+    while (mPos < mEnd && *mPos >= '0' && *mPos <= '9')
+      ++mPos;
+    if (mPos == digits || (*digits == '0' && mPos - digits > 1))
+      Fail("malformed number");
+    if (mPos < mEnd && *mPos == '.') {
+      const char* fraction = ++mPos;
+      while (mPos < mEnd && *mPos >= '0' && *mPos <= '9')
+        ++mPos;
+      if (mPos == fraction)
+        Fail("malformed number");
+    }
+    if (mPos < mEnd && (*mPos == 'e' || *mPos == 'E')) {
+      ++mPos;
+      if (mPos < mEnd && (*mPos == '+' || *mPos == '-'))
+        ++mPos;
+      const char* exponent = mPos;
+      while (mPos < mEnd && *mPos >= '0' && *mPos <= '9')
+        ++mPos;
+      if (mPos == exponent)
+        Fail("malformed number");
+    }
+    Node* node = mArena.New(Type::Number);
+    node->text.assign(start, mPos);
+    return node;
+  }
+
+  unsigned ParseHex4() {
+    if (mEnd - mPos < 4)
+      Fail("truncated \\u escape");
+    unsigned code = 0;
+    for (int i = 0; i < 4; ++i, ++mPos) {
+      const char h = *mPos;
+      code <<= 4;
+      if (h >= '0' && h <= '9')
+        code |= h - '0';
+      else if (h >= 'a' && h <= 'f')
+        code |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F')
+        code |= h - 'A' + 10;
+      else
+        Fail("malformed \\u escape");
+    }
+    return code;
+  }
+
+  static void AppendUtf8(string& out, unsigned code) {
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xC0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      out += static_cast<char>(0xE0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (code >> 18));
+      out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  // Called with mPos on the opening quote. Runs without escapes, most of any response, are appended whole.
+  void ParseString(string& out) {
+    ++mPos;
+    for (;;) {
+      const char* run = mPos;
+      while (mPos < mEnd && *mPos != '"' && *mPos != '\\' && static_cast<unsigned char>(*mPos) >= 0x20)
+        ++mPos;
+      out.append(run, mPos);
+      if (mPos == mEnd)
+        Fail("unterminated string");
+      const char c = *mPos++;
+      if (c == '"')
+        return;
+      if (c != '\\')
+        Fail("control character in string");
+      if (mPos == mEnd)
+        Fail("unterminated string");
+      switch (*mPos++) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          unsigned code = ParseHex4();
+          // A high surrogate must be followed by its low half.
+          if (code >= 0xD800 && code < 0xDC00) {
+            if (!Consume("\\u", 2))
+              Fail("unpaired surrogate");
+            const unsigned low = ParseHex4();
+            if (low < 0xDC00 || low >= 0xE000)
+              Fail("unpaired surrogate");
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          } else if (code >= 0xDC00 && code < 0xE000) {
+            Fail("unpaired surrogate");
+          }
+          AppendUtf8(out, code);
+          break;
+        }
+        default:
+          Fail("unknown escape");
+      }
+    }
+  }
+
+  const char* const mBegin;
+  const char* mPos;
+  const char* const mEnd;
+  Arena& mArena;
+};
+
+void AppendEscaped(string& out, const string& value) {
+  static const char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out += "\\u00";
+          out += kHex[(c >> 4) & 0xF];
+          out += kHex[c & 0xF];
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+void Serialize(const Node& node, string& out) {
+  switch (node.type) {
+    case Type::Null: out += "null"; break;
+    case Type::False: out += "false"; break;
+    case Type::True: out += "true"; break;
+    case Type::Number: out += node.text; break;
+    case Type::String: AppendEscaped(out, node.text); break;
+    case Type::Array:
+      out += '[';
+      for (size_t i = 0; i < node.items.size(); ++i) {
+        if (i)
+          out += ',';
+        Serialize(*node.items[i], out);
+      }
+      out += ']';
+      break;
+    case Type::Object:
+      out += '{';
+      for (size_t i = 0; i < node.members.size(); ++i) {
+        if (i)
+          out += ',';
+        AppendEscaped(out, node.members[i].first);
+        out += ':';
+        Serialize(*node.members[i].second, out);
+      }
+      out += '}';
+      break;
+  }
+}
+
+// An integer literal, without a fraction or exponent.
+bool IsIntegerText(const string& text) {
+  return text.find_first_of(".eE") == string::npos;
+}
+
+class Value final : public mip::JsonValue {
+public:
+  Value(const shared_ptr<Arena>& arena, Node* node) : mArena(arena), mNode(node) {}
+
+  Node* GetNode() const { return mNode; }
+  const shared_ptr<Arena>& GetArena() const { return mArena; }
+
+  bool IsString() const override { return mNode->type == Type::String; }
+  bool IsArray() const override { return mNode->type == Type::Array; }
+  bool IsObject() const override { return mNode->type == Type::Object; }
+
+  bool HasMember(const string& key) const override {
+    return Find(key) != nullptr;
+  }
+
+  void PushBack(const shared_ptr<mip::JsonValue>& jsonValue) override {
+    Expect(Type::Array, "an array");
+    mNode->items.push_back(Adopt(jsonValue));
+  }
+
+  void PushBack(const string& member) override {
+    Expect(Type::Array, "an array");
+    Node* node = mArena->New(Type::String);
+    node->text = member;
+    mNode->items.push_back(node);
+  }
+
+  void AddMember(const string& key, const shared_ptr<mip::JsonValue>& jsonValue) override {
+    Add(key, Adopt(jsonValue));
+  }
+
+  void AddMember(const string& key, const string& member) override {
+    Node* node = mArena->New(Type::String);
+    node->text = member;
+    Add(key, node);
+  }
+
+  void AddMember(const string& key, bool member) override {
+    Add(key, mArena->New(member ? Type::True : Type::False));
+  }
+
+  void AddMember(const string& key, int member) override {
+    Node* node = mArena->New(Type::Number);
+    node->text = std::to_string(member);
+    Add(key, node);
+  }
+
+  void AddMember(const string& key, unsigned int member) override {
+    Node* node = mArena->New(Type::Number);
+    node->text = std::to_string(member);
+    Add(key, node);
+  }
+
+  shared_ptr<mip::JsonValue> GetMember(const string& key) const override {
+    Node* member = Find(key);
+    if (!member)
+      throw mip::BadInputError("JSON object has no member " + key);
+    return make_shared<Value>(mArena, member);
+  }
+
+  shared_ptr<mip::JsonValue> GetMember(unsigned int index) const override {
+    Expect(Type::Array, "an array");
+    if (index >= mNode->items.size())
+      throw mip::BadInputError("JSON array index " + std::to_string(index) + " is out of range");
+    return make_shared<Value>(mArena, mNode->items[index]);
+  }
+
+  size_t Size() const override {
+    return mNode->type == Type::Array ? mNode->items.size() : mNode->members.size();
+  }
+
+  vector<string> GetStringArray() const override {
+    Expect(Type::Array, "an array");
+    vector<string> strings;
+    for (const auto* item : mNode->items) {
+      if (item->type == Type::String)
+        strings.push_back(item->text);
+    }
+    return strings;
+  }
+
+  vector<std::pair<string, string>> GetStringObjectMembers() const override {
+    Expect(Type::Object, "an object");
+    vector<std::pair<string, string>> strings;
+    for (const auto& member : mNode->members) {
+      if (member.second->type == Type::String)
+        strings.emplace_back(member.first, member.second->text);
+    }
+    return strings;
+  }
+
+  string GetString() const override {
+    Expect(Type::String, "a string");
+    return mNode->text;
+  }
+
+  bool IsInt() const override {
+    if (mNode->type != Type::Number || !IsIntegerText(mNode->text))
+      return false;
+    errno = 0;
+    const long long value = strtoll(mNode->text.c_str(), nullptr, 10);
+    return errno == 0 && value >= INT_MIN && value <= INT_MAX;
+  }
+
+  int GetInt() const override {
+    if (!IsInt())
+      throw mip::BadInputError("JSON value is not an int");
+    return static_cast<int>(strtoll(mNode->text.c_str(), nullptr, 10));
+  }
+
+  bool IsBool() const override { return mNode->type == Type::True || mNode->type == Type::False; }
+
+  bool IsUint() const override {
+    if (mNode->type != Type::Number || !IsIntegerText(mNode->text) || mNode->text[0] == '-')
+      return false;
+    errno = 0;
+    const unsigned long long value = strtoull(mNode->text.c_str(), nullptr, 10);
+    return errno == 0 && value <= UINT_MAX;
+  }
+
+  unsigned int GetUint() const override {
+    if (!IsUint())
+      throw mip::BadInputError("JSON value is not an unsigned int");
+    return static_cast<unsigned int>(strtoull(mNode->text.c_str(), nullptr, 10));
+  }
+
+  bool IsNumber() const override { return mNode->type == Type::Number; }
+
+  double GetDouble() const override {
+    Expect(Type::Number, "a number");
+    return strtod(mNode->text.c_str(), nullptr);
+  }
+
+  bool GetBool() const override {
+    if (!IsBool())
+      throw mip::BadInputError("JSON value is not a boolean");
+    return mNode->type == Type::True;
+  }
+
+  string SerializeToString() const override {
+    string out;
+    Serialize(*mNode, out);
+    return out;
+  }
+
+private:
+  void Expect(Type type, const char* what) const {
+    if (mNode->type != type)
+      throw mip::BadInputError(string("JSON value is not ") + what);
+  }
+
+  Node* Find(const string& key) const {
+    if (mNode->type != Type::Object)
+      return nullptr;
+    for (const auto& member : mNode->members) {
+      if (member.first == key)
+        return member.second;
+    }
+    return nullptr;
+  }
+
+  void Add(const string& key, Node* node) {
+    Expect(Type::Object, "an object");
+    mNode->members.emplace_back(key, node);
+  }
+
+  // The node of jsonValue in this document: its own when it was created here, since the SDK does not
+  // modify a value once added, otherwise a copy.
+  Node* Adopt(const shared_ptr<mip::JsonValue>& jsonValue) {
+    if (!jsonValue)
+      throw mip::BadInputError("Cannot add an empty JSON value");
+    if (auto* value = dynamic_cast<const Value*>(jsonValue.get()))
+      return value->GetArena() == mArena ? value->GetNode() : mArena->Copy(*value->GetNode());
+    return Parser(jsonValue->SerializeToString(), *mArena).ParseDocument();
+  }
+
+  shared_ptr<Arena> mArena;
+  Node* mNode;
+};
+
+class Document final : public mip::JsonDocument {
+public:
+  explicit Document(const shared_ptr<Arena>& arena, Node* root) : mArena(arena), mRoot(root) {}
+
+  shared_ptr<mip::JsonValue> Root() const override { return make_shared<Value>(mArena, mRoot); }
+  shared_ptr<mip::JsonValue> CreateObjectValue() override { return make_shared<Value>(mArena, mArena->New(Type::Object)); }
+  shared_ptr<mip::JsonValue> CreateArrayValue() override { return make_shared<Value>(mArena, mArena->New(Type::Array)); }
+
+private:
+  shared_ptr<Arena> mArena;
+  Node* mRoot;
+};
+
+} // namespace
+
+mip::JsonResult JsonDelegateImpl::CreateJsonObjectDocument() const {
+  auto arena = make_shared<Arena>();
+  Node* root = arena->New(Type::Object);
+  return mip::JsonResult(make_shared<Document>(arena, root));
+}
+
+mip::JsonResult JsonDelegateImpl::Parse(const string& value) const {
+  try {
+    auto arena = make_shared<Arena>();
+    Node* root = Parser(value, *arena).ParseDocument();
+    return mip::JsonResult(make_shared<Document>(arena, root));
+  } catch (...) {
+    return mip::JsonResult(std::current_exception());
+  }
+}
+
+} // namespace json
+} // namespace sample
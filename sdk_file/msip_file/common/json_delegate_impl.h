@@ -0,0 +1,55 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_JSON_DELEGATE_IMPL_H_
+#define SAMPLES_COMMON_JSON_DELEGATE_IMPL_H_
+
+#include <memory>
+#include <string>
+
+#include "mip/json_delegate.h"
+
+namespace sample {
+namespace json {
+
+// JsonDelegate parsing the SDK's service responses in one pass over the text into a document whose values
+// are all allocated from one arena and freed with it, instead of one heap node per value. Lookups walk the
+// members in document order, which for the small objects of service responses beats hashing. Numbers keep
+// their text and are converted by the accessor the SDK calls. Values are never shared between threads by
+// the SDK, so documents take no locks.
+class JsonDelegateImpl final : public mip::JsonDelegate {
+public:
+  mip::JsonResult CreateJsonObjectDocument() const override;
+
+  // Fails with a mip::BadInputError naming the offset of the first error.
+  mip::JsonResult Parse(const std::string& value) const override;
+};
+
+} // namespace json
+} // namespace sample
+
+#endif // SAMPLES_COMMON_JSON_DELEGATE_IMPL_H_
@@ -0,0 +1,133 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_MPMC_RING_H_
+#define SAMPLES_COMMON_MPMC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace sample {
+namespace queue {
+
+// Bounded multi-producer multi-consumer queue without locks (Vyukov's ring). Each cell carries a sequence
+// number that says whether it is free for the producer claiming its position or full for the consumer
+// claiming it, so producers and consumers only contend on their own position counter. TryPush and TryPop
+// never block; callers that need to wait pair the ring with a semaphore.
+template <typename T>
+class MpmcRing final {
+public:
+  // capacity is rounded up to a power of two.
+  explicit MpmcRing(size_t capacity)
+    : mCells(RoundUp(capacity)),
+      mMask(mCells.size() - 1),
+      mEnqueuePosition(0),
+      mDequeuePosition(0) {
+    for (size_t i = 0; i < mCells.size(); ++i)
+      mCells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  MpmcRing(const MpmcRing&) = delete;
+  MpmcRing& operator=(const MpmcRing&) = delete;
+
+  // false when the ring is full; value is left untouched then.
+  bool TryPush(T& value) {
+    size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = mCells[position & mMask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (difference == 0) {
+        if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = mEnqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // false when the ring is empty.
+  bool TryPop(T& value) {
+    size_t position = mDequeuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = mCells[position & mMask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (difference == 0) {
+        if (mDequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.value = T();
+          cell.sequence.store(position + mMask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = mDequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t Capacity() const { return mCells.size(); }
+
+private:
+  struct Cell {
+    Cell() : sequence(0) {}
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static size_t RoundUp(size_t capacity) {
+    if (capacity < 2)
+      capacity = 2;
+    if (capacity > (static_cast<size_t>(1) << (sizeof(size_t) * 8 - 2)))
+      throw std::invalid_argument("Ring capacity is too large");
+    size_t rounded = 1;
+    while (rounded < capacity)
+      rounded <<= 1;
+    return rounded;
+  }
+
+  std::vector<Cell> mCells;
+  const size_t mMask;
+  // Apart, so producers and consumers do not share a cache line.
+  alignas(64) std::atomic<size_t> mEnqueuePosition;
+  alignas(64) std::atomic<size_t> mDequeuePosition;
+};
+
+} // namespace queue
+} // namespace sample
+
+#endif // SAMPLES_COMMON_MPMC_RING_H_
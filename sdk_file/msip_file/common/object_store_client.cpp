@@ -0,0 +1,699 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "object_store_client.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+
+#include "request_deadline.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::runtime_error;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+namespace {
+
+const size_t kMaxIdleHandles = 64;
+// Of an error answer's body, enough for its code and message.
+const size_t kMaxErrorBody = 16 * 1024;
+const char* const kUnsignedPayload = "UNSIGNED-PAYLOAD";
+const char* const kAzureVersion = "2021-08-06";
+
+// A failure before any HTTP status arrived, which is worth retrying.
+class TransportError final : public runtime_error {
+public:
+  explicit TransportError(const string& message) : runtime_error(message) {}
+};
+
+string Env(const char* name) {
+  const char* value = getenv(name);
+  return value ? value : "";
+}
+
+bool EndsWith(const string& value, const string& suffix) {
+  return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool HeaderIs(const char* line, size_t size, const char* name, string& value) {
+  const size_t length = strlen(name);
+  if (size <= length || line[length] != ':' || strncasecmp(line, name, length) != 0)
+    return false;
+  size_t start = length + 1;
+  size_t end = size;
+  while (start < end && (line[start] == ' ' || line[start] == '\t'))
+    ++start;
+  while (end > start && (line[end - 1] == '\r' || line[end - 1] == '\n' || line[end - 1] == ' '))
+    --end;
+  value.assign(line + start, end - start);
+  return true;
+}
+
+// Percent-encodes everything but RFC 3986's unreserved characters, and '/' when keepSlash is set.
+string Encode(const string& value, bool keepSlash) {
+  static const char kHex[] = "0123456789ABCDEF";
+  string encoded;
+  encoded.reserve(value.size() * 3 / 2);
+  for (unsigned char c : value) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || (keepSlash && c == '/')) {
+      encoded += static_cast<char>(c);
+    } else {
+      encoded += '%';
+      encoded += kHex[c >> 4];
+      encoded += kHex[c & 15];
+    }
+  }
+  return encoded;
+}
+
+string Decode(const string& value) {
+  string decoded;
+  decoded.reserve(value.size());
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 2 < value.size() && isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+        isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+      decoded += static_cast<char>(strtol(value.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      decoded += value[i];
+    }
+  }
+  return decoded;
+}
+
+string Base64(const string& value) {
+  static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  string encoded;
+  size_t i = 0;
+  for (; i + 2 < value.size(); i += 3) {
+    const uint32_t bits = (static_cast<uint8_t>(value[i]) << 16) | (static_cast<uint8_t>(value[i + 1]) << 8) | static_cast<uint8_t>(value[i + 2]);
+    encoded += kAlphabet[(bits >> 18) & 63];
+    encoded += kAlphabet[(bits >> 12) & 63];
+    encoded += kAlphabet[(bits >> 6) & 63];
+    encoded += kAlphabet[bits & 63];
+  }
+  if (i < value.size()) {
+    uint32_t bits = static_cast<uint8_t>(value[i]) << 16;
+    if (i + 1 < value.size())
+      bits |= static_cast<uint8_t>(value[i + 1]) << 8;
+    encoded += kAlphabet[(bits >> 18) & 63];
+    encoded += kAlphabet[(bits >> 12) & 63];
+    encoded += i + 1 < value.size() ? kAlphabet[(bits >> 6) & 63] : '=';
+    encoded += '=';
+  }
+  return encoded;
+}
+
+string Hex(const unsigned char* data, size_t size) {
+  static const char kHex[] = "0123456789abcdef";
+  string hex;
+  hex.reserve(size * 2);
+  for (size_t i = 0; i < size; ++i) {
+    hex += kHex[data[i] >> 4];
+    hex += kHex[data[i] & 15];
+  }
+  return hex;
+}
+
+string Sha256Hex(const string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  if (EVP_Digest(data.data(), data.size(), digest, &size, EVP_sha256(), nullptr) != 1)
+    throw runtime_error("SHA-256 failed");
+  return Hex(digest, size);
+}
+
+string HmacSha256(const string& key, const string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  if (!HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), reinterpret_cast<const unsigned char*>(data.data()), data.size(), digest, &size))
+    throw runtime_error("HMAC-SHA256 failed");
+  return string(reinterpret_cast<const char*>(digest), size);
+}
+
+string XmlEscape(const string& value) {
+  string escaped;
+  for (char c : value) {
+    switch (c) {
+      case '&': escaped += "&amp;"; break;
+      case '<': escaped += "&lt;"; break;
+      case '>': escaped += "&gt;"; break;
+      case '"': escaped += "&quot;"; break;
+      default: escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Text of the first <name> element, empty when there is none.
+string XmlElement(const string& xml, const string& name) {
+  const string open = "<" + name + ">";
+  const size_t start = xml.find(open);
+  if (start == string::npos)
+    return "";
+  const size_t end = xml.find("</" + name + ">", start + open.size());
+  return end == string::npos ? "" : xml.substr(start + open.size(), end - start - open.size());
+}
+
+// Total size from a Content-Range of "bytes a-b/size" or "bytes */size"; -1 when it is not given.
+int64_t ObjectSizeFromContentRange(const string& contentRange) {
+  const size_t slash = contentRange.rfind('/');
+  if (slash == string::npos || slash + 1 >= contentRange.size() || contentRange[slash + 1] == '*')
+    return -1;
+  return strtoll(contentRange.c_str() + slash + 1, nullptr, 10);
+}
+
+void InitializeCurlOnce() {
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+      throw runtime_error("Failed to initialize libcurl");
+  });
+}
+
+} // namespace
+
+struct ObjectStoreClient::Request {
+  string method;
+  // Query parameters besides the location's own, not encoded.
+  vector<pair<string, string>> parameters;
+  vector<string> headers;
+  const uint8_t* body = nullptr;
+  size_t bodySize = 0;
+  // Where a successful answer's body goes, instead of Response::body.
+  uint8_t* into = nullptr;
+  size_t intoCapacity = 0;
+  bool retry = true;
+};
+
+struct ObjectStoreClient::Response {
+  long status = 0;
+  string body;
+  size_t received = 0;
+  string etag;
+  string contentRange;
+  int64_t contentLength = -1;
+};
+
+struct ObjectStoreClient::Transfer {
+  CURL* easy;
+  const Request* request;
+  Response* response;
+};
+
+ObjectStoreClient::Options ObjectStoreClient::Defaults() {
+  Options options;
+  options.accessKeyId = Env("AWS_ACCESS_KEY_ID");
+  options.secretAccessKey = Env("AWS_SECRET_ACCESS_KEY");
+  options.sessionToken = Env("AWS_SESSION_TOKEN");
+  options.region = Env("AWS_REGION");
+  if (options.region.empty())
+    options.region = Env("AWS_DEFAULT_REGION");
+  if (options.region.empty())
+    options.region = "us-east-1";
+  options.s3Endpoint = Env("AWS_ENDPOINT_URL_S3");
+  if (options.s3Endpoint.empty())
+    options.s3Endpoint = Env("AWS_ENDPOINT_URL");
+  return options;
+}
+
+ObjectStoreClient& ObjectStoreClient::Shared() {
+  // Never destroyed, so transfers still finishing at exit do not outlive their client.
+  static ObjectStoreClient* client = new ObjectStoreClient(Defaults());
+  return *client;
+}
+
+ObjectStoreClient::ObjectStoreClient(const Options& options)
+    : mOptions(options),
+      mStopping(false),
+      mRequests(0),
+      mFailed(0),
+      mRetries(0),
+      mBytesRead(0),
+      mBytesWritten(0) {
+  InitializeCurlOnce();
+}
+
+ObjectStoreClient::~ObjectStoreClient() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mTasksCondition.notify_all();
+  for (auto& thread : mThreads)
+    thread.join();
+  for (CURL* easy : mIdleHandles)
+    curl_easy_cleanup(easy);
+}
+
+void ObjectStoreClient::Configure(const Options& options) {
+  lock_guard<mutex> lock(mMutex);
+  mOptions = options;
+}
+
+ObjectStoreClient::Options ObjectStoreClient::GetOptions() {
+  lock_guard<mutex> lock(mMutex);
+  return mOptions;
+}
+
+ObjectStoreClient::Stats ObjectStoreClient::GetStats() const {
+  Stats stats;
+  stats.requests = mRequests.load();
+  stats.failed = mFailed.load();
+  stats.retries = mRetries.load();
+  stats.bytesRead = mBytesRead.load();
+  stats.bytesWritten = mBytesWritten.load();
+  return stats;
+}
+
+ObjectLocation ObjectStoreClient::Parse(const string& uri) {
+  ObjectLocation location;
+  if (uri.compare(0, 5, "s3://") == 0) {
+    const size_t slash = uri.find('/', 5);
+    if (slash == string::npos || slash == 5 || slash + 1 >= uri.size())
+      throw std::invalid_argument("Expected s3://bucket/key: " + uri);
+    const string bucket = uri.substr(5, slash - 5);
+    const string key = uri.substr(slash + 1);
+    const auto options = GetOptions();
+    location.provider = ObjectLocation::Provider::S3;
+    if (options.s3Endpoint.empty()) {
+      location.host = bucket + ".s3." + options.region + ".amazonaws.com";
+      location.origin = "https://" + location.host;
+      location.path = "/" + Encode(key, true);
+    } else {
+      location.origin = options.s3Endpoint;
+      while (!location.origin.empty() && location.origin.back() == '/')
+        location.origin.pop_back();
+      const size_t scheme = location.origin.find("://");
+      location.host = scheme == string::npos ? location.origin : location.origin.substr(scheme + 3);
+      location.path = "/" + bucket + "/" + Encode(key, true);
+    }
+    location.name = key.substr(key.rfind('/') + 1);
+    return location;
+  }
+
+  const bool https = uri.compare(0, 8, "https://") == 0;
+  if (!https && uri.compare(0, 7, "http://") != 0)
+    throw std::invalid_argument("Expected an s3:// or http(s):// URI: " + uri);
+  const size_t hostStart = https ? 8 : 7;
+  const size_t pathStart = std::min(uri.find('/', hostStart), uri.find('?', hostStart));
+  if (pathStart == string::npos || uri[pathStart] != '/')
+    throw std::invalid_argument("URI does not name an object: " + uri);
+  location.host = uri.substr(hostStart, pathStart - hostStart);
+  location.origin = uri.substr(0, pathStart);
+  const size_t queryStart = uri.find('?', pathStart);
+  location.path = uri.substr(pathStart, queryStart == string::npos ? string::npos : queryStart - pathStart);
+  if (queryStart != string::npos)
+    location.query = uri.substr(queryStart + 1);
+  const string hostName = location.host.substr(0, location.host.find(':'));
+  location.provider = EndsWith(hostName, ".blob.core.windows.net") ? ObjectLocation::Provider::AzureBlob : ObjectLocation::Provider::Http;
+  location.name = Decode(location.path.substr(location.path.rfind('/') + 1));
+  return location;
+}
+
+CURL* ObjectStoreClient::AcquireHandle() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mIdleHandles.empty()) {
+      CURL* easy = mIdleHandles.back();
+      mIdleHandles.pop_back();
+      return easy;
+    }
+  }
+  CURL* easy = curl_easy_init();
+  if (!easy)
+    throw runtime_error("Failed to create libcurl request");
+  return easy;
+}
+
+void ObjectStoreClient::ReleaseHandle(CURL* easy) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mIdleHandles.size() < kMaxIdleHandles) {
+      mIdleHandles.push_back(easy);
+      return;
+    }
+  }
+  curl_easy_cleanup(easy);
+}
+
+void ObjectStoreClient::Sign(const ObjectLocation& location, const Request& request, const Options& options,
+                             vector<string>& headers, string& query) {
+  vector<pair<string, string>> parameters;
+  for (const auto& parameter : request.parameters)
+    parameters.emplace_back(Encode(parameter.first, false), Encode(parameter.second, false));
+  std::sort(parameters.begin(), parameters.end());
+  query.clear();
+  for (const auto& parameter : parameters) {
+    if (!query.empty())
+      query += '&';
+    query += parameter.first + "=" + parameter.second;
+  }
+  if (options.accessKeyId.empty())
+    return;
+
+  const std::time_t now = std::time(nullptr);
+  std::tm utc;
+  gmtime_r(&now, &utc);
+  char amzDate[17];
+  strftime(amzDate, sizeof(amzDate), "%Y%m%dT%H%M%SZ", &utc);
+  const string date(amzDate, 8);
+  const string scope = date + "/" + options.region + "/s3/aws4_request";
+
+  string canonicalHeaders = "host:" + location.host + "\nx-amz-content-sha256:" + kUnsignedPayload + "\nx-amz-date:" + amzDate + "\n";
+  string signedHeaders = "host;x-amz-content-sha256;x-amz-date";
+  if (!options.sessionToken.empty()) {
+    canonicalHeaders += "x-amz-security-token:" + options.sessionToken + "\n";
+    signedHeaders += ";x-amz-security-token";
+  }
+  const string canonicalRequest = request.method + "\n" + location.path + "\n" + query + "\n" + canonicalHeaders + "\n" +
+      signedHeaders + "\n" + kUnsignedPayload;
+  const string stringToSign = string("AWS4-HMAC-SHA256\n") + amzDate + "\n" + scope + "\n" + Sha256Hex(canonicalRequest);
+  string key = HmacSha256("AWS4" + options.secretAccessKey, date);
+  key = HmacSha256(key, options.region);
+  key = HmacSha256(key, "s3");
+  key = HmacSha256(key, "aws4_request");
+  const string signature = HmacSha256(key, stringToSign);
+
+  headers.push_back(string("x-amz-content-sha256: ") + kUnsignedPayload);
+  headers.push_back(string("x-amz-date: ") + amzDate);
+  if (!options.sessionToken.empty())
+    headers.push_back("x-amz-security-token: " + options.sessionToken);
+  headers.push_back("Authorization: AWS4-HMAC-SHA256 Credential=" + options.accessKeyId + "/" + scope +
+                    ", SignedHeaders=" + signedHeaders + ", Signature=" +
+                    Hex(reinterpret_cast<const unsigned char*>(signature.data()), signature.size()));
+}
+
+ObjectStoreClient::Response ObjectStoreClient::SendOnce(const ObjectLocation& location, const Request& request, const Options& options) {
+  vector<string> headers = request.headers;
+  string query;
+  if (location.provider == ObjectLocation::Provider::S3) {
+    Sign(location, request, options, headers, query);
+  } else {
+    query = location.query;
+    for (const auto& parameter : request.parameters)
+      query += (query.empty() ? "" : "&") + Encode(parameter.first, false) + "=" + Encode(parameter.second, false);
+    if (location.provider == ObjectLocation::Provider::AzureBlob)
+      headers.push_back(string("x-ms-version: ") + kAzureVersion);
+  }
+  const string url = location.origin + location.path + (query.empty() ? "" : "?" + query);
+
+  const auto& deadline = sample::deadline::Deadline::Current();
+  if (deadline.HasExpired())
+    throw sample::deadline::DeadlineExceededError();
+  const long timeoutMs = deadline.IsSet() ? std::min(options.requestTimeoutMs, deadline.RemainingMs()) : options.requestTimeoutMs;
+
+  Response response;
+  CURL* easy = AcquireHandle();
+  curl_easy_reset(easy);
+  curl_slist* headerList = nullptr;
+  for (const auto& header : headers)
+    headerList = curl_slist_append(headerList, header.c_str());
+  headerList = curl_slist_append(headerList, "Expect:");
+  Transfer context = { easy, &request, &response };
+
+  curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+  if (request.method == "GET") {
+    curl_easy_setopt(easy, CURLOPT_HTTPGET, 1L);
+  } else {
+    curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request.bodySize));
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, request.body ? reinterpret_cast<const char*>(request.body) : "");
+  }
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headerList);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, std::min(options.connectTimeoutMs, timeoutMs));
+  curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeoutMs);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, &context);
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, +[](char* data, size_t size, size_t count, void* userData) -> size_t {
+    auto& transfer = *static_cast<Transfer*>(userData);
+    const size_t length = size * count;
+    long status = 0;
+    curl_easy_getinfo(transfer.easy, CURLINFO_RESPONSE_CODE, &status);
+    auto& response = *transfer.response;
+    if (transfer.request->into && status >= 200 && status < 300) {
+      // More than asked for, e.g. the whole object from a server that ignored the range, ends the transfer.
+      if (response.received + length > transfer.request->intoCapacity) {
+        response.received += length;
+        return 0;
+      }
+      memcpy(transfer.request->into + response.received, data, length);
+    } else if (response.body.size() < kMaxErrorBody) {
+      response.body.append(data, std::min(length, kMaxErrorBody - response.body.size()));
+    }
+    response.received += length;
+    return length;
+  });
+  curl_easy_setopt(easy, CURLOPT_HEADERDATA, &response);
+  curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, +[](char* data, size_t size, size_t count, void* userData) -> size_t {
+    auto& response = *static_cast<Response*>(userData);
+    const size_t length = size * count;
+    string value;
+    if (HeaderIs(data, length, "ETag", value))
+      response.etag = value;
+    else if (HeaderIs(data, length, "Content-Range", value))
+      response.contentRange = value;
+    else if (HeaderIs(data, length, "Content-Length", value))
+      response.contentLength = strtoll(value.c_str(), nullptr, 10);
+    return length;
+  });
+
+  const CURLcode code = curl_easy_perform(easy);
+  curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &response.status);
+  curl_slist_free_all(headerList);
+  ReleaseHandle(easy);
+  ++mRequests;
+  if (code != CURLE_OK && !(code == CURLE_WRITE_ERROR && response.status == 200))
+    throw TransportError(string("Object store request to ") + location.host + " failed: " + curl_easy_strerror(code));
+  return response;
+}
+
+ObjectStoreClient::Response ObjectStoreClient::Send(const ObjectLocation& location, Request& request) {
+  const auto options = GetOptions();
+  static thread_local std::minstd_rand random(std::random_device{}());
+  for (int attempt = 0;; ++attempt) {
+    try {
+      Response response = SendOnce(location, request, options);
+      const bool transient = response.status == 429 || response.status >= 500;
+      if (!transient || !request.retry || attempt >= options.maxRetries) {
+        if (response.status >= 400)
+          ++mFailed;
+        return response;
+      }
+    }
+    catch (const TransportError&) {
+      if (!request.retry || attempt >= options.maxRetries) {
+        ++mFailed;
+        throw;
+      }
+    }
+    ++mRetries;
+    const long backoffMs = std::min(100L << std::min(attempt, 5), 2000L);
+    std::uniform_int_distribution<long> jitter(backoffMs / 2, backoffMs);
+    std::this_thread::sleep_for(std::chrono::milliseconds(jitter(random)));
+  }
+}
+
+namespace {
+
+[[noreturn]] void ThrowFor(const ObjectLocation& location, long status, const string& body) {
+  string detail = XmlElement(body, "Code");
+  if (detail.empty())
+    detail = body.substr(0, 200);
+  throw runtime_error("Object store answered HTTP " + std::to_string(status) + " for " + location.host + location.path +
+                      (detail.empty() ? "" : ": " + detail));
+}
+
+} // namespace
+
+ObjectStoreClient::RangeRead ObjectStoreClient::ReadRange(
+    const ObjectLocation& location, const string& etag, int64_t offset, uint8_t* buffer, size_t length) {
+  Request request;
+  request.method = "GET";
+  request.headers.push_back("Range: bytes=" + std::to_string(offset) + "-" + std::to_string(offset + static_cast<int64_t>(length) - 1));
+  if (!etag.empty())
+    request.headers.push_back("If-Match: " + etag);
+  request.into = buffer;
+  request.intoCapacity = length;
+  const Response response = Send(location, request);
+
+  RangeRead read;
+  read.etag = response.etag;
+  if (response.status == 412)
+    throw ObjectChangedError();
+  if (response.status == 416) {
+    read.bytes = 0;
+    read.objectSize = ObjectSizeFromContentRange(response.contentRange);
+    if (read.objectSize < 0)
+      read.objectSize = offset;
+    return read;
+  }
+  if (response.status == 206) {
+    read.bytes = response.received;
+    read.objectSize = ObjectSizeFromContentRange(response.contentRange);
+  } else if (response.status == 200) {
+    // The whole object, which only fits the buffer when it is no larger than the range.
+    if (offset != 0 || response.received > length || (response.contentLength >= 0 && response.contentLength > static_cast<int64_t>(length)))
+      throw runtime_error(location.host + " does not answer range requests");
+    read.bytes = response.received;
+    read.objectSize = static_cast<int64_t>(response.received);
+  } else {
+    ThrowFor(location, response.status, response.body);
+  }
+  mBytesRead += read.bytes;
+  return read;
+}
+
+string ObjectStoreClient::BeginUpload(const ObjectLocation& location) {
+  if (location.provider == ObjectLocation::Provider::AzureBlob)
+    return "";
+  if (location.provider != ObjectLocation::Provider::S3)
+    throw std::invalid_argument("Uploads need an s3:// URI or an Azure blob URL");
+  Request request;
+  request.method = "POST";
+  request.parameters.emplace_back("uploads", "");
+  request.headers.push_back("Content-Type: application/octet-stream");
+  const Response response = Send(location, request);
+  const string uploadId = XmlElement(response.body, "UploadId");
+  if (response.status != 200 || uploadId.empty())
+    ThrowFor(location, response.status, response.body);
+  return uploadId;
+}
+
+string ObjectStoreClient::UploadPart(const ObjectLocation& location, const string& uploadId, int partNumber, const uint8_t* data, size_t size) {
+  Request request;
+  request.method = "PUT";
+  request.body = data;
+  request.bodySize = size;
+  request.headers.push_back("Content-Type: application/octet-stream");
+  string blockId;
+  if (location.provider == ObjectLocation::Provider::AzureBlob) {
+    // Every block id of a blob must have the same length.
+    char number[16];
+    snprintf(number, sizeof(number), "%08d", partNumber);
+    blockId = Base64(number);
+    request.parameters.emplace_back("comp", "block");
+    request.parameters.emplace_back("blockid", blockId);
+  } else {
+    request.parameters.emplace_back("partNumber", std::to_string(partNumber));
+    request.parameters.emplace_back("uploadId", uploadId);
+  }
+  const Response response = Send(location, request);
+  if (response.status < 200 || response.status >= 300)
+    ThrowFor(location, response.status, response.body);
+  mBytesWritten += size;
+  if (location.provider == ObjectLocation::Provider::AzureBlob)
+    return blockId;
+  if (response.etag.empty())
+    throw runtime_error("Object store returned no ETag for part " + std::to_string(partNumber));
+  return response.etag;
+}
+
+void ObjectStoreClient::CompleteUpload(const ObjectLocation& location, const string& uploadId, const vector<string>& parts) {
+  Request request;
+  request.headers.push_back("Content-Type: application/xml");
+  string body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
+  if (location.provider == ObjectLocation::Provider::AzureBlob) {
+    request.method = "PUT";
+    request.parameters.emplace_back("comp", "blocklist");
+    body += "<BlockList>";
+    for (const auto& part : parts)
+      body += "<Latest>" + XmlEscape(part) + "</Latest>";
+    body += "</BlockList>";
+  } else {
+    // Not retried: when an answer is lost after the upload completed, a second attempt finds no upload.
+    request.method = "POST";
+    request.retry = false;
+    request.parameters.emplace_back("uploadId", uploadId);
+    body += "<CompleteMultipartUpload>";
+    for (size_t i = 0; i < parts.size(); ++i)
+      body += "<Part><PartNumber>" + std::to_string(i + 1) + "</PartNumber><ETag>" + XmlEscape(parts[i]) + "</ETag></Part>";
+    body += "</CompleteMultipartUpload>";
+  }
+  request.body = reinterpret_cast<const uint8_t*>(body.data());
+  request.bodySize = body.size();
+  const Response response = Send(location, request);
+  // S3 can report a failed completion in the body of a 200.
+  if (response.status < 200 || response.status >= 300 || response.body.find("<Error>") != string::npos)
+    ThrowFor(location, response.status, response.body);
+}
+
+void ObjectStoreClient::AbortUpload(const ObjectLocation& location, const string& uploadId) {
+  if (location.provider != ObjectLocation::Provider::S3 || uploadId.empty())
+    return;
+  Request request;
+  request.method = "DELETE";
+  request.parameters.emplace_back("uploadId", uploadId);
+  try {
+    Send(location, request);
+  }
+  catch (const std::exception&) {
+    // A lifecycle rule has to clean up after an upload that cannot be aborted.
+  }
+}
+
+void ObjectStoreClient::Submit(std::function<void()> task) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mTasks.push_back(std::move(task));
+    if (mThreads.size() < std::max<size_t>(mOptions.transferThreads, 1))
+      mThreads.emplace_back(&ObjectStoreClient::TransferLoop, this);
+  }
+  mTasksCondition.notify_one();
+}
+
+void ObjectStoreClient::TransferLoop() {
+  unique_lock<mutex> lock(mMutex);
+  while (true) {
+    mTasksCondition.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+    if (mTasks.empty())
+      return;
+    auto task = std::move(mTasks.front());
+    mTasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+
+} // namespace storage
+} // namespace sample
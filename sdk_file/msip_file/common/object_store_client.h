@@ -0,0 +1,173 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_OBJECT_STORE_CLIENT_H_
+#define SAMPLES_COMMON_OBJECT_STORE_CLIENT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+namespace sample {
+namespace storage {
+
+// An object named by s3://bucket/key, or by the https URL of an Azure blob carrying its SAS token, or of
+// any other server that answers range requests, such as a presigned S3 URL.
+struct ObjectLocation {
+  enum class Provider { S3, AzureBlob, Http };
+
+  Provider provider;
+  // scheme://host, the URI-encoded path and the query without '?', e.g. the SAS token.
+  std::string origin;
+  std::string host;
+  std::string path;
+  std::string query;
+  // Last segment of the key, which names the object in results and selects its handler.
+  std::string name;
+};
+
+// The object changed between two reads of one stream, so its ranges no longer belong together.
+class ObjectChangedError final : public std::runtime_error {
+public:
+  ObjectChangedError() : std::runtime_error("Object changed while it was being read") {}
+};
+
+// Blocking client for range reads and multipart uploads of objects, over libcurl. Easy handles are pooled,
+// so requests to one endpoint reuse its connections. S3 requests are signed with AWS Signature Version 4;
+// Azure and plain HTTP URLs carry their own authorization in the query. Transport failures, 429 and 5xx
+// answers are retried with a jittered backoff, except for the commit of an upload. Failures throw
+// std::runtime_error. Submit runs work, such as prefetches and part uploads, on the client's transfer
+// threads.
+class ObjectStoreClient final {
+public:
+  struct Options {
+    // S3 credentials and region; from AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY, AWS_SESSION_TOKEN and
+    // AWS_REGION by default.
+    std::string accessKeyId;
+    std::string secretAccessKey;
+    std::string sessionToken;
+    std::string region;
+    // scheme://host[:port] of an S3-compatible store, addressed path-style. Empty for AWS, addressed
+    // virtual-hosted style. AWS_ENDPOINT_URL_S3 by default.
+    std::string s3Endpoint;
+    long connectTimeoutMs = 5000;
+    long requestTimeoutMs = 60000;
+    int maxRetries = 3;
+    size_t transferThreads = 16;
+  };
+
+  struct Stats {
+    uint64_t requests;
+    uint64_t failed;
+    uint64_t retries;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+  };
+
+  // Bytes of the range read, plus the object's size and entity tag, which every answer carries.
+  struct RangeRead {
+    size_t bytes;
+    int64_t objectSize;
+    std::string etag;
+  };
+
+  // Options from the environment.
+  static Options Defaults();
+
+  static ObjectStoreClient& Shared();
+
+  explicit ObjectStoreClient(const Options& options);
+  ~ObjectStoreClient();
+
+  ObjectStoreClient(const ObjectStoreClient&) = delete;
+  ObjectStoreClient& operator=(const ObjectStoreClient&) = delete;
+
+  // Applies to requests started afterwards; the transfer thread count only grows.
+  void Configure(const Options& options);
+  Options GetOptions();
+  Stats GetStats() const;
+
+  // Throws std::invalid_argument for anything but s3:// and http(s):// URIs.
+  ObjectLocation Parse(const std::string& uri);
+
+  // Reads up to length bytes at offset into buffer. With an etag, fails with ObjectChangedError once the
+  // object has another. A range at or past the end reads nothing.
+  RangeRead ReadRange(const ObjectLocation& location, const std::string& etag, int64_t offset, uint8_t* buffer, size_t length);
+
+  // Multipart uploads: the upload id, empty for Azure, whose staged blocks need none. UploadPart returns
+  // what CompleteUpload needs of the part: its entity tag, or its block id. Parts are numbered from 1 and
+  // can be uploaded in any order; S3 needs every part but the last to be 5 MiB or more.
+  std::string BeginUpload(const ObjectLocation& location);
+  std::string UploadPart(const ObjectLocation& location, const std::string& uploadId, int partNumber, const uint8_t* data, size_t size);
+  void CompleteUpload(const ObjectLocation& location, const std::string& uploadId, const std::vector<std::string>& parts);
+  // Best effort; Azure drops uncommitted blocks by itself.
+  void AbortUpload(const ObjectLocation& location, const std::string& uploadId);
+
+  void Submit(std::function<void()> task);
+
+private:
+  struct Request;
+  struct Response;
+  // What libcurl's callbacks of one transfer see.
+  struct Transfer;
+
+  Response Send(const ObjectLocation& location, Request& request);
+  Response SendOnce(const ObjectLocation& location, const Request& request, const Options& options);
+  void Sign(const ObjectLocation& location, const Request& request, const Options& options,
+            std::vector<std::string>& headers, std::string& query);
+  CURL* AcquireHandle();
+  void ReleaseHandle(CURL* easy);
+  void TransferLoop();
+
+  std::mutex mMutex;
+  Options mOptions;
+  std::vector<CURL*> mIdleHandles;
+  std::condition_variable mTasksCondition;
+  std::deque<std::function<void()>> mTasks;
+  std::vector<std::thread> mThreads;
+  bool mStopping;
+  std::atomic<uint64_t> mRequests;
+  std::atomic<uint64_t> mFailed;
+  std::atomic<uint64_t> mRetries;
+  std::atomic<uint64_t> mBytesRead;
+  std::atomic<uint64_t> mBytesWritten;
+};
+
+} // namespace storage
+} // namespace sample
+
+#endif // SAMPLES_COMMON_OBJECT_STORE_CLIENT_H_
@@ -0,0 +1,123 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "operation_log.h"
+
+#include <atomic>
+
+#include "cost_account.h"
+
+namespace sample {
+namespace oplog {
+
+namespace {
+
+thread_local std::shared_ptr<OperationLog> tCurrent;
+thread_local ScopedCacheTally* tTally = nullptr;
+std::atomic<uint32_t> gThreadCount(0);
+
+int64_t ToMicros(OperationLog::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+} // namespace
+
+const size_t OperationLog::kMaxEvents;
+
+OperationLog::OperationLog(size_t maxEvents)
+    : mStart(Clock::now()),
+      mThread(GetThreadNumber()),
+      mMaxEvents(maxEvents),
+      mDropped(0) {
+}
+
+void OperationLog::Add(const char* kind, const std::string& name, Clock::time_point start, Clock::time_point end, const std::string& detail) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mEvents.size() >= mMaxEvents) {
+    ++mDropped;
+    return;
+  }
+  const bool instant = start == end;
+  mEvents.push_back({ kind, name, ToMicros(start - mStart), instant ? -1 : ToMicros(end - start), detail, GetThreadNumber() });
+}
+
+std::vector<OperationLog::Event> OperationLog::GetEvents(uint64_t* dropped) const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  *dropped = mDropped;
+  return mEvents;
+}
+
+const std::shared_ptr<OperationLog>& OperationLog::Current() {
+  return tCurrent;
+}
+
+void OperationLog::SetCurrent(const std::shared_ptr<OperationLog>& log) {
+  tCurrent = log;
+}
+
+ScopedOperationLog::ScopedOperationLog(const std::shared_ptr<OperationLog>& log)
+    : mPrevious(OperationLog::Current()) {
+  OperationLog::SetCurrent(log);
+}
+
+ScopedOperationLog::~ScopedOperationLog() {
+  OperationLog::SetCurrent(mPrevious);
+}
+
+ScopedCacheTally::ScopedCacheTally()
+    : mPrevious(tTally),
+      mHits(0),
+      mMisses(0) {
+  tTally = this;
+}
+
+ScopedCacheTally::~ScopedCacheTally() {
+  tTally = mPrevious;
+}
+
+void Record(const char* kind, const std::string& name, OperationLog::Clock::time_point start, OperationLog::Clock::time_point end,
+    const std::string& detail) {
+  if (const auto& log = tCurrent)
+    log->Add(kind, name, start, end, detail);
+}
+
+void RecordCacheLookup(const char* cache, bool hit) {
+  cost::Add(hit ? cost::Counter::CacheHits : cost::Counter::CacheMisses, 1);
+  for (auto* tally = tTally; tally; tally = tally->mPrevious)
+    ++(hit ? tally->mHits : tally->mMisses);
+  if (const auto& log = tCurrent) {
+    const auto now = OperationLog::Clock::now();
+    log->Add("cache", cache, now, now, hit ? "hit" : "miss");
+  }
+}
+
+uint32_t GetThreadNumber() {
+  thread_local const uint32_t number = ++gThreadCount;
+  return number;
+}
+
+} // namespace oplog
+} // namespace sample
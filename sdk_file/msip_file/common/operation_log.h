@@ -0,0 +1,131 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_OPERATION_LOG_H_
+#define SAMPLES_COMMON_OPERATION_LOG_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace oplog {
+
+// What happened during one file operation, kept so a slow one can explain itself. Like the deadline, the
+// task dispatcher carries the current log onto the SDK's background work, so phases and HTTP requests made
+// on the operation's behalf land in it. Recording is a thread-local check when no log is current.
+class OperationLog final {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Events past this many are counted as dropped, unless the log is given another bound.
+  static const size_t kMaxEvents = 256;
+
+  // kind is "phase", "http", "cache", "task" or "storage". Offsets and durations are microseconds from the
+  // start of the operation; a cache lookup has no duration (-1). detail holds the HTTP status or error,
+  // hit/miss, or how long a task was queued. thread numbers the thread the event happened on.
+  struct Event {
+    std::string kind;
+    std::string name;
+    int64_t offsetMicros;
+    int64_t durationMicros;
+    std::string detail;
+    uint32_t thread;
+  };
+
+  explicit OperationLog(size_t maxEvents = kMaxEvents);
+
+  void Add(const char* kind, const std::string& name, Clock::time_point start, Clock::time_point end, const std::string& detail);
+
+  Clock::time_point GetStart() const { return mStart; }
+  // The thread that created the log, i.e. the one running the operation.
+  uint32_t GetThread() const { return mThread; }
+  std::vector<Event> GetEvents(uint64_t* dropped) const;
+
+  static const std::shared_ptr<OperationLog>& Current();
+  static void SetCurrent(const std::shared_ptr<OperationLog>& log);
+
+private:
+  const Clock::time_point mStart;
+  const uint32_t mThread;
+  const size_t mMaxEvents;
+  mutable std::mutex mMutex;
+  std::vector<Event> mEvents;
+  uint64_t mDropped;
+};
+
+// Installs a log on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedOperationLog final {
+public:
+  explicit ScopedOperationLog(const std::shared_ptr<OperationLog>& log);
+  ~ScopedOperationLog();
+
+  ScopedOperationLog(const ScopedOperationLog&) = delete;
+  ScopedOperationLog& operator=(const ScopedOperationLog&) = delete;
+
+private:
+  std::shared_ptr<OperationLog> mPrevious;
+};
+
+// Counts the cache lookups made on this thread for the lifetime of the scope, nested scopes included, so
+// a capture of the operation can record its cache outcomes without an operation log. Lookups the SDK makes
+// on its own threads are not counted.
+class ScopedCacheTally final {
+public:
+  ScopedCacheTally();
+  ~ScopedCacheTally();
+
+  ScopedCacheTally(const ScopedCacheTally&) = delete;
+  ScopedCacheTally& operator=(const ScopedCacheTally&) = delete;
+
+  uint32_t GetHits() const { return mHits; }
+  uint32_t GetMisses() const { return mMisses; }
+
+private:
+  friend void RecordCacheLookup(const char* cache, bool hit);
+
+  ScopedCacheTally* const mPrevious;
+  uint32_t mHits;
+  uint32_t mMisses;
+};
+
+// Add to this thread's current log, if any.
+void Record(const char* kind, const std::string& name, OperationLog::Clock::time_point start, OperationLog::Clock::time_point end,
+    const std::string& detail);
+// Also charged to this thread's cost key (see cost_account.h).
+void RecordCacheLookup(const char* cache, bool hit);
+
+// A small number for the calling thread, unique in the process and stable for the thread's life.
+uint32_t GetThreadNumber();
+
+} // namespace oplog
+} // namespace sample
+
+#endif // SAMPLES_COMMON_OPERATION_LOG_H_
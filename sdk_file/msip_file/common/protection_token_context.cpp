@@ -0,0 +1,56 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "protection_token_context.h"
+
+namespace sample {
+namespace token {
+
+namespace {
+
+thread_local std::shared_ptr<const std::string> tCurrent;
+
+} // namespace
+
+const std::shared_ptr<const std::string>& Current() {
+  return tCurrent;
+}
+
+ScopedToken::ScopedToken(const std::string& token)
+    : ScopedToken(std::make_shared<const std::string>(token)) {
+}
+
+ScopedToken::ScopedToken(const std::shared_ptr<const std::string>& token)
+    : mPrevious(tCurrent) {
+  tCurrent = token;
+}
+
+ScopedToken::~ScopedToken() {
+  tCurrent = mPrevious;
+}
+
+} // namespace token
+} // namespace sample
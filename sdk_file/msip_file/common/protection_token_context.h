@@ -0,0 +1,60 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_PROTECTION_TOKEN_CONTEXT_H_
+#define SAMPLES_COMMON_PROTECTION_TOKEN_CONTEXT_H_
+
+#include <memory>
+#include <string>
+
+namespace sample {
+namespace token {
+
+// Protection token the caller of the operation running on this thread supplied, possibly empty, or nullptr
+// on threads no caller's operation runs on. Engines are shared by every caller of their key, so their auth
+// delegate answers each challenge with this token rather than one stored in the delegate. Like the
+// deadline, the task dispatcher carries it onto the SDK's background work.
+const std::shared_ptr<const std::string>& Current();
+
+// Installs a token on this thread for the lifetime of the scope, then restores the previous one. Each export
+// taking a token scopes it to its call, so it never outlives the call into the thread's next one.
+class ScopedToken final {
+public:
+  explicit ScopedToken(const std::string& token);
+  explicit ScopedToken(const std::shared_ptr<const std::string>& token);
+  ~ScopedToken();
+
+  ScopedToken(const ScopedToken&) = delete;
+  ScopedToken& operator=(const ScopedToken&) = delete;
+
+private:
+  std::shared_ptr<const std::string> mPrevious;
+};
+
+} // namespace token
+} // namespace sample
+
+#endif // SAMPLES_COMMON_PROTECTION_TOKEN_CONTEXT_H_
@@ -0,0 +1,314 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "redis_client.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+namespace {
+
+void AppendCommand(const RedisClient::Command& command, string& out) {
+  out += '*';
+  out += std::to_string(command.size());
+  out += "\r\n";
+  for (const auto& argument : command) {
+    out += '$';
+    out += std::to_string(argument.size());
+    out += "\r\n";
+    out += argument;
+    out += "\r\n";
+  }
+}
+
+} // namespace
+
+class RedisClient::Connection final {
+public:
+  explicit Connection(const Options& options) : mFd(-1), mReadPosition(0) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    const string port = std::to_string(options.port);
+    const int lookup = getaddrinfo(options.host.c_str(), port.c_str(), &hints, &addresses);
+    if (lookup != 0)
+      throw runtime_error("Redis host lookup failed for " + options.host + ": " + gai_strerror(lookup));
+
+    for (addrinfo* address = addresses; address && mFd < 0; address = address->ai_next) {
+      mFd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+      if (mFd < 0)
+        continue;
+      timeval timeout;
+      timeout.tv_sec = options.timeoutMs / 1000;
+      timeout.tv_usec = (options.timeoutMs % 1000) * 1000;
+      setsockopt(mFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(mFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      int noDelay = 1;
+      setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+      if (connect(mFd, address->ai_addr, address->ai_addrlen) != 0) {
+        close(mFd);
+        mFd = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+    if (mFd < 0)
+      throw runtime_error("Unable to connect to Redis at " + options.host + ":" + port);
+
+    vector<Command> handshake;
+    if (!options.password.empty())
+      handshake.push_back({ "AUTH", options.password });
+    if (options.database != 0)
+      handshake.push_back({ "SELECT", std::to_string(options.database) });
+    if (!handshake.empty()) {
+      for (const auto& reply : Exchange(handshake)) {
+        if (reply.type == Reply::Type::Error)
+          throw runtime_error("Redis handshake failed: " + reply.str);
+      }
+    }
+  }
+
+  ~Connection() {
+    if (mFd >= 0)
+      close(mFd);
+  }
+
+  vector<Reply> Exchange(const vector<Command>& commands) {
+    string request;
+    for (const auto& command : commands)
+      AppendCommand(command, request);
+    WriteAll(request);
+
+    vector<Reply> replies;
+    replies.reserve(commands.size());
+    for (size_t i = 0; i < commands.size(); ++i)
+      replies.push_back(ReadReply());
+    return replies;
+  }
+
+private:
+  void WriteAll(const string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      const ssize_t count = send(mFd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        throw runtime_error(string("Redis write failed: ") + strerror(errno));
+      written += static_cast<size_t>(count);
+    }
+  }
+
+  void Fill() {
+    if (mReadPosition > 0 && mReadPosition == mBuffer.size()) {
+      mBuffer.clear();
+      mReadPosition = 0;
+    }
+    char chunk[16384];
+    ssize_t count;
+    do {
+      count = recv(mFd, chunk, sizeof(chunk), 0);
+    } while (count < 0 && errno == EINTR);
+    if (count == 0)
+      throw runtime_error("Redis closed the connection");
+    if (count < 0)
+      throw runtime_error(string("Redis read failed: ") + strerror(errno));
+    mBuffer.append(chunk, static_cast<size_t>(count));
+  }
+
+  string ReadLine() {
+    size_t end;
+    while ((end = mBuffer.find("\r\n", mReadPosition)) == string::npos)
+      Fill();
+    string line = mBuffer.substr(mReadPosition, end - mReadPosition);
+    mReadPosition = end + 2;
+    return line;
+  }
+
+  string ReadBytes(size_t length) {
+    while (mBuffer.size() - mReadPosition < length + 2)
+      Fill();
+    string bytes = mBuffer.substr(mReadPosition, length);
+    mReadPosition += length + 2;
+    return bytes;
+  }
+
+  Reply ReadReply() {
+    const string line = ReadLine();
+    if (line.empty())
+      throw runtime_error("Malformed Redis reply");
+
+    Reply reply;
+    const string payload = line.substr(1);
+    switch (line[0]) {
+      case '+':
+        reply.type = Reply::Type::Status;
+        reply.str = payload;
+        break;
+      case '-':
+        reply.type = Reply::Type::Error;
+        reply.str = payload;
+        break;
+      case ':':
+        reply.type = Reply::Type::Integer;
+        reply.integer = strtoll(payload.c_str(), nullptr, 10);
+        break;
+      case '$': {
+        const long long length = strtoll(payload.c_str(), nullptr, 10);
+        if (length >= 0) {
+          reply.type = Reply::Type::Bulk;
+          reply.str = ReadBytes(static_cast<size_t>(length));
+        }
+        break;
+      }
+      case '*': {
+        const long long count = strtoll(payload.c_str(), nullptr, 10);
+        if (count >= 0) {
+          reply.type = Reply::Type::Array;
+          reply.elements.reserve(static_cast<size_t>(count));
+          for (long long i = 0; i < count; ++i)
+            reply.elements.push_back(ReadReply());
+        }
+        break;
+      }
+      default:
+        throw runtime_error("Malformed Redis reply");
+    }
+    return reply;
+  }
+
+  int mFd;
+  string mBuffer;
+  size_t mReadPosition;
+};
+
+RedisClient::Options RedisClient::ParseUrl(const string& url) {
+  Options options;
+  string rest = url;
+  const string scheme = "redis://";
+  if (rest.compare(0, scheme.size(), scheme) == 0)
+    rest = rest.substr(scheme.size());
+
+  auto slash = rest.find('/');
+  if (slash != string::npos) {
+    const string database = rest.substr(slash + 1);
+    if (!database.empty())
+      options.database = atoi(database.c_str());
+    rest = rest.substr(0, slash);
+  }
+  auto at = rest.rfind('@');
+  if (at != string::npos) {
+    const string credentials = rest.substr(0, at);
+    auto colon = credentials.find(':');
+    options.password = colon == string::npos ? credentials : credentials.substr(colon + 1);
+    rest = rest.substr(at + 1);
+  }
+  auto colon = rest.rfind(':');
+  if (colon != string::npos && rest.find(']') == string::npos) {
+    options.port = atoi(rest.substr(colon + 1).c_str());
+    rest = rest.substr(0, colon);
+  }
+  if (!rest.empty())
+    options.host = rest;
+  return options;
+}
+
+RedisClient::RedisClient(const Options& options) : mOptions(options) {
+}
+
+RedisClient::~RedisClient() {
+}
+
+RedisClient::Reply RedisClient::Execute(const Command& command) {
+  auto replies = Pipeline({ command });
+  if (replies[0].type == Reply::Type::Error)
+    throw runtime_error("Redis " + command[0] + " failed: " + replies[0].str);
+  return replies[0];
+}
+
+vector<RedisClient::Reply> RedisClient::Pipeline(const vector<Command>& commands) {
+  if (commands.empty())
+    return vector<Reply>();
+
+  bool reused = false;
+  auto connection = Acquire(reused);
+  try {
+    auto replies = connection->Exchange(commands);
+    Release(std::move(connection));
+    return replies;
+  } catch (const runtime_error&) {
+    // An idle connection may have been closed by the server; retry once on a fresh one.
+    if (!reused)
+      throw;
+  }
+  connection.reset(new Connection(mOptions));
+  auto replies = connection->Exchange(commands);
+  Release(std::move(connection));
+  return replies;
+}
+
+unique_ptr<RedisClient::Connection> RedisClient::Acquire(bool& reused) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mIdle.empty()) {
+      auto connection = std::move(mIdle.back());
+      mIdle.pop_back();
+      reused = true;
+      return connection;
+    }
+  }
+  reused = false;
+  return unique_ptr<Connection>(new Connection(mOptions));
+}
+
+void RedisClient::Release(unique_ptr<Connection> connection) {
+  lock_guard<mutex> lock(mMutex);
+  if (mIdle.size() < mOptions.maxIdleConnections)
+    mIdle.push_back(std::move(connection));
+}
+
+} // namespace storage
+} // namespace sample
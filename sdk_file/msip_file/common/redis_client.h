@@ -0,0 +1,89 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_REDIS_CLIENT_H_
+#define SAMPLES_COMMON_REDIS_CLIENT_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace storage {
+
+// Minimal synchronous Redis (RESP2) client with a pool of idle connections. Commands sent together
+// through Pipeline share one round trip. I/O failures throw std::runtime_error; Redis error replies are
+// returned as Reply::Type::Error so pipelined callers can inspect each one.
+class RedisClient final {
+public:
+  struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    std::string password;
+    int database = 0;
+    int timeoutMs = 2000;
+    size_t maxIdleConnections = 8;
+  };
+
+  struct Reply {
+    enum class Type { Nil, Status, Error, Integer, Bulk, Array };
+
+    Type type = Type::Nil;
+    std::string str;
+    int64_t integer = 0;
+    std::vector<Reply> elements;
+  };
+
+  typedef std::vector<std::string> Command;
+
+  // Parses redis://[[user]:password@]host[:port][/database].
+  static Options ParseUrl(const std::string& url);
+
+  explicit RedisClient(const Options& options);
+  ~RedisClient();
+
+  // Throws std::runtime_error on an error reply as well.
+  Reply Execute(const Command& command);
+
+  std::vector<Reply> Pipeline(const std::vector<Command>& commands);
+
+private:
+  class Connection;
+
+  std::unique_ptr<Connection> Acquire(bool& reused);
+  void Release(std::unique_ptr<Connection> connection);
+
+  Options mOptions;
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<Connection>> mIdle;
+};
+
+} // namespace storage
+} // namespace sample
+
+#endif // SAMPLES_COMMON_REDIS_CLIENT_H_
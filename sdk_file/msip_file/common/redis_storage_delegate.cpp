@@ -0,0 +1,451 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "redis_storage_delegate.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "mip/storage_table.h"
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+namespace {
+
+typedef vector<string> Row;
+
+static const char kScanBatchSize[] = "512";
+static const size_t kMaxL1Entries = 4096;
+const size_t kNonceSize = 12;
+const size_t kTagSize = 16;
+
+// Drops the table and records its new schema in one step, so a replica that opens the table at the same
+// time cannot delete rows written under the schema the other one just set.
+static const char kResetScript[] =
+    "if redis.call('GET', KEYS[2]) ~= ARGV[1] then "
+    "redis.call('DEL', KEYS[1]) "
+    "redis.call('SET', KEYS[2], ARGV[1]) "
+    "end "
+    "return 0";
+
+// Length-prefixed values, so any byte (including the separator) can appear in a column.
+string Encode(const vector<string>& values) {
+  string encoded;
+  for (const auto& value : values) {
+    encoded += std::to_string(value.size());
+    encoded += ':';
+    encoded += value;
+  }
+  return encoded;
+}
+
+Row Decode(const string& encoded) {
+  Row values;
+  size_t position = 0;
+  while (position < encoded.size()) {
+    const size_t colon = encoded.find(':', position);
+    if (colon == string::npos)
+      throw runtime_error("Corrupt row in Redis storage");
+    const size_t length = strtoul(encoded.c_str() + position, nullptr, 10);
+    if (colon + 1 + length > encoded.size())
+      throw runtime_error("Corrupt row in Redis storage");
+    values.push_back(encoded.substr(colon + 1, length));
+    position = colon + 1 + length;
+  }
+  return values;
+}
+
+// nonce | ciphertext | tag, with aad authenticated alongside.
+string Seal(const string& key, const string& aad, const string& plaintext) {
+  string blob(kNonceSize + plaintext.size() + kTagSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&blob[0]);
+  if (RAND_bytes(out, static_cast<int>(kNonceSize)) != 1)
+    throw runtime_error("Unable to generate a storage nonce");
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  if (!context ||
+      EVP_EncryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), out) != 1 ||
+      EVP_EncryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1 ||
+      EVP_EncryptUpdate(context.get(), out + kNonceSize, &length, reinterpret_cast<const unsigned char*>(plaintext.data()), static_cast<int>(plaintext.size())) != 1 ||
+      EVP_EncryptFinal_ex(context.get(), out + kNonceSize + length, &length) != 1 ||
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_GET_TAG, static_cast<int>(kTagSize), out + kNonceSize + plaintext.size()) != 1)
+    throw runtime_error("Unable to encrypt a storage column");
+  return blob;
+}
+
+// False when blob was not sealed under key with aad, e.g. after corruption.
+bool Open(const string& key, const string& aad, const string& blob, string& plaintext) {
+  if (blob.size() < kNonceSize + kTagSize)
+    return false;
+  const size_t cipherSize = blob.size() - kNonceSize - kTagSize;
+  const auto* in = reinterpret_cast<const unsigned char*>(blob.data());
+  plaintext.assign(cipherSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  return context &&
+      EVP_DecryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), in) == 1 &&
+      EVP_DecryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) == 1 &&
+      EVP_DecryptUpdate(context.get(), out, &length, in + kNonceSize, static_cast<int>(cipherSize)) == 1 &&
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_SET_TAG, static_cast<int>(kTagSize),
+          const_cast<unsigned char*>(in + kNonceSize + cipherSize)) == 1 &&
+      EVP_DecryptFinal_ex(context.get(), out + length, &length) == 1;
+}
+
+string Hmac(const string& key, const string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  if (!HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), reinterpret_cast<const unsigned char*>(data.data()),
+          data.size(), digest, &length))
+    throw runtime_error("Unable to hash a storage key");
+  return string(reinterpret_cast<const char*>(digest), length);
+}
+
+void ThrowOnError(const vector<RedisClient::Reply>& replies) {
+  for (const auto& reply : replies) {
+    if (reply.type == RedisClient::Reply::Type::Error)
+      throw runtime_error("Redis storage write failed: " + reply.str);
+  }
+}
+
+class RedisStorageTable final : public mip::StorageTable {
+public:
+  RedisStorageTable(
+      const shared_ptr<RedisClient>& client,
+      const string& hashKey,
+      const vector<string>& allColumns,
+      const vector<string>& encryptedColumns,
+      const vector<string>& keyColumns,
+      seconds l1Ttl,
+      const string& key)
+      : mClient(client),
+        mHashKey(hashKey),
+        mAllColumns(allColumns),
+        mHashedKeys(false),
+        mL1Ttl(l1Ttl),
+        mKey(key) {
+    mKeyIndexes = ColumnIndexes(keyColumns.empty() ? allColumns : keyColumns);
+    mEncryptedIndexes = ColumnIndexes(encryptedColumns);
+    for (auto index : mEncryptedIndexes)
+      mHashedKeys = mHashedKeys || std::find(mKeyIndexes.begin(), mKeyIndexes.end(), index) != mKeyIndexes.end();
+
+    // A table created by another build with a different layout, or sealed under another key, is dropped
+    // rather than misread.
+    const string schemaKey = hashKey + ":schema";
+    const string schema = Encode({ Encode(allColumns), Encode(keyColumns), Encode(encryptedColumns), Hmac(mKey, schemaKey) });
+    ThrowOnError({ mClient->Execute({ "EVAL", kResetScript, "2", hashKey, schemaKey, schema }) });
+  }
+
+  void InsertOrReplace(const vector<string>& allColumnValues) override {
+    if (allColumnValues.size() != mAllColumns.size())
+      throw std::invalid_argument("Column value count does not match the table");
+
+    const string field = KeyOf(allColumnValues);
+    ThrowOnError({ mClient->Execute({ "HSET", mHashKey, field, SealRow(field, allColumnValues) }) });
+    CacheRow(field, allColumnValues);
+  }
+
+  vector<vector<string>> List() override {
+    return Scan(vector<size_t>(), vector<string>());
+  }
+
+  void Update(
+      const vector<string>& updateColumns,
+      const vector<string>& updateValues,
+      const vector<string>& queryColumns,
+      const vector<string>& queryValues) override {
+    if (updateColumns.size() != updateValues.size())
+      throw std::invalid_argument("Update columns and values differ in count");
+
+    const auto updateIndexes = ColumnIndexes(updateColumns);
+    vector<RedisClient::Command> commands;
+    vector<string> staleFields;
+    vector<std::pair<string, Row>> updatedRows;
+    for (auto& row : Find(queryColumns, queryValues)) {
+      const string oldField = KeyOf(row);
+      for (size_t i = 0; i < updateIndexes.size(); ++i)
+        row[updateIndexes[i]] = updateValues[i];
+      const string newField = KeyOf(row);
+      if (newField != oldField) {
+        commands.push_back({ "HDEL", mHashKey, oldField });
+        staleFields.push_back(oldField);
+      }
+      commands.push_back({ "HSET", mHashKey, newField, SealRow(newField, row) });
+      updatedRows.emplace_back(newField, row);
+    }
+    ThrowOnError(mClient->Pipeline(commands));
+
+    for (const auto& field : staleFields)
+      EvictRow(field);
+    for (const auto& updated : updatedRows)
+      CacheRow(updated.first, updated.second);
+  }
+
+  void Delete(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    vector<string> fields;
+    string field;
+    if (IsKeyQuery(queryColumns, queryValues, field)) {
+      fields.push_back(field);
+    } else {
+      for (const auto& row : Find(queryColumns, queryValues))
+        fields.push_back(KeyOf(row));
+    }
+
+    vector<RedisClient::Command> commands;
+    for (const auto& stale : fields) {
+      commands.push_back({ "HDEL", mHashKey, stale });
+      EvictRow(stale);
+    }
+    ThrowOnError(mClient->Pipeline(commands));
+  }
+
+  vector<vector<string>> Find(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    if (queryColumns.size() != queryValues.size())
+      throw std::invalid_argument("Query columns and values differ in count");
+
+    string field;
+    if (!IsKeyQuery(queryColumns, queryValues, field))
+      return Scan(ColumnIndexes(queryColumns), queryValues);
+
+    vector<vector<string>> rows;
+    Row row;
+    if (FindCachedRow(field, row)) {
+      rows.push_back(row);
+      return rows;
+    }
+    auto reply = mClient->Execute({ "HGET", mHashKey, field });
+    if (reply.type == RedisClient::Reply::Type::Bulk && OpenRow(field, reply.str, row)) {
+      CacheRow(field, row);
+      rows.push_back(row);
+    }
+    return rows;
+  }
+
+private:
+  struct CachedRow {
+    Row row;
+    steady_clock::time_point expiry;
+  };
+
+  vector<size_t> ColumnIndexes(const vector<string>& columns) const {
+    vector<size_t> indexes;
+    for (const auto& column : columns) {
+      auto it = std::find(mAllColumns.begin(), mAllColumns.end(), column);
+      if (it == mAllColumns.end())
+        throw std::invalid_argument("Unknown storage column: " + column);
+      indexes.push_back(static_cast<size_t>(it - mAllColumns.begin()));
+    }
+    return indexes;
+  }
+
+  string KeyOf(const Row& row) const {
+    vector<string> keyValues;
+    for (auto index : mKeyIndexes)
+      keyValues.push_back(row[index]);
+    return FieldOf(keyValues);
+  }
+
+  // The hash field of a row with keyValues, kept out of the clear when a key column is encrypted.
+  string FieldOf(const vector<string>& keyValues) const {
+    const string field = Encode(keyValues);
+    return mHashedKeys ? Hmac(mKey, field) : field;
+  }
+
+  // The encoded row with its encrypted columns sealed, each bound to the table, the row and the column.
+  string SealRow(const string& field, Row row) const {
+    for (auto index : mEncryptedIndexes)
+      row[index] = Seal(mKey, ColumnAad(field, index), row[index]);
+    return Encode(row);
+  }
+
+  // False when stored is not a row of this table sealed under the key, which callers treat as missing.
+  bool OpenRow(const string& field, const string& stored, Row& row) const {
+    row = Decode(stored);
+    if (row.size() != mAllColumns.size())
+      return false;
+    string plaintext;
+    for (auto index : mEncryptedIndexes) {
+      if (!Open(mKey, ColumnAad(field, index), row[index], plaintext))
+        return false;
+      row[index].swap(plaintext);
+    }
+    return true;
+  }
+
+  string ColumnAad(const string& field, size_t index) const {
+    return Encode({ mHashKey, field, mAllColumns[index] });
+  }
+
+  // True when the query names exactly the key columns, in any order, so the row can be fetched directly.
+  bool IsKeyQuery(const vector<string>& queryColumns, const vector<string>& queryValues, string& field) const {
+    if (queryColumns.size() != mKeyIndexes.size())
+      return false;
+
+    const auto queryIndexes = ColumnIndexes(queryColumns);
+    vector<string> keyValues;
+    for (auto keyIndex : mKeyIndexes) {
+      auto it = std::find(queryIndexes.begin(), queryIndexes.end(), keyIndex);
+      if (it == queryIndexes.end())
+        return false;
+      keyValues.push_back(queryValues[it - queryIndexes.begin()]);
+    }
+    field = FieldOf(keyValues);
+    return true;
+  }
+
+  vector<vector<string>> Scan(const vector<size_t>& queryIndexes, const vector<string>& queryValues) {
+    vector<vector<string>> rows;
+    unordered_set<string> seen;
+    string cursor = "0";
+    do {
+      auto reply = mClient->Execute({ "HSCAN", mHashKey, cursor, "COUNT", kScanBatchSize });
+      if (reply.elements.size() != 2)
+        throw runtime_error("Unexpected HSCAN reply");
+      cursor = reply.elements[0].str;
+      const auto& entries = reply.elements[1].elements;
+      for (size_t i = 0; i + 1 < entries.size(); i += 2) {
+        // HSCAN may return a field more than once while the hash is being resized.
+        if (!seen.insert(entries[i].str).second)
+          continue;
+        Row row;
+        if (!OpenRow(entries[i].str, entries[i + 1].str, row))
+          continue;
+        bool matches = true;
+        for (size_t q = 0; q < queryIndexes.size() && matches; ++q)
+          matches = row[queryIndexes[q]] == queryValues[q];
+        if (matches)
+          rows.push_back(std::move(row));
+      }
+    } while (cursor != "0");
+    return rows;
+  }
+
+  bool FindCachedRow(const string& field, Row& row) {
+    lock_guard<mutex> lock(mL1Mutex);
+    auto it = mL1.find(field);
+    if (it == mL1.end())
+      return false;
+    if (steady_clock::now() >= it->second.expiry) {
+      mL1.erase(it);
+      return false;
+    }
+    row = it->second.row;
+    return true;
+  }
+
+  void CacheRow(const string& field, const Row& row) {
+    if (mL1Ttl.count() <= 0)
+      return;
+    lock_guard<mutex> lock(mL1Mutex);
+    if (mL1.size() >= kMaxL1Entries && mL1.find(field) == mL1.end())
+      mL1.clear();
+    CachedRow& cached = mL1[field];
+    cached.row = row;
+    cached.expiry = steady_clock::now() + mL1Ttl;
+  }
+
+  void EvictRow(const string& field) {
+    lock_guard<mutex> lock(mL1Mutex);
+    mL1.erase(field);
+  }
+
+  shared_ptr<RedisClient> mClient;
+  string mHashKey;
+  vector<string> mAllColumns;
+  vector<size_t> mKeyIndexes;
+  vector<size_t> mEncryptedIndexes;
+  // Set when a key column is encrypted, so hash fields are HMACs of the key values.
+  bool mHashedKeys;
+  seconds mL1Ttl;
+  string mKey;
+  mutex mL1Mutex;
+  unordered_map<string, CachedRow> mL1;
+};
+
+} // namespace
+
+const size_t RedisStorageDelegate::kKeySize;
+
+RedisStorageDelegate::RedisStorageDelegate(
+    const shared_ptr<RedisClient>& client,
+    const string& keyPrefix,
+    seconds l1Ttl,
+    const string& key)
+    : mClient(client),
+      mKeyPrefix(keyPrefix),
+      mL1Ttl(l1Ttl),
+      mKey(key) {
+  if (key.size() != kKeySize)
+    throw std::invalid_argument("Redis storage key must be 32 bytes");
+}
+
+mip::StorageTableResult RedisStorageDelegate::CreateStorageTable(
+    const string& path,
+    const mip::MipComponent mipComponent,
+    const string& tableName,
+    const vector<string>& allColumns,
+    const vector<string>& encryptedColumns,
+    const vector<string>& keyColumns) const {
+  try {
+    const string hashKey = mKeyPrefix + ":" + std::to_string(static_cast<unsigned int>(mipComponent)) + ":" +
+        path + ":" + tableName;
+    return mip::StorageTableResult(
+        make_shared<RedisStorageTable>(mClient, hashKey, allColumns, encryptedColumns, keyColumns, mL1Ttl, mKey));
+  } catch (...) {
+    return mip::StorageTableResult(std::current_exception());
+  }
+}
+
+mip::StorageDelegate::StorageSettings RedisStorageDelegate::GetSettings() const {
+  // Tables live outside the process; in-memory caches keep using the SDK's own storage.
+  return StorageSettings(true /*isRemoteStorage*/, false /*isInMemoryStorageSupported*/);
+}
+
+} // namespace storage
+} // namespace sample
@@ -0,0 +1,77 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_REDIS_STORAGE_DELEGATE_H_
+#define SAMPLES_COMMON_REDIS_STORAGE_DELEGATE_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/storage_delegate.h"
+#include "redis_client.h"
+
+namespace sample {
+namespace storage {
+
+// Keeps the SDK's policy, license and engine tables in Redis so every replica shares one warm cache.
+// Each table is a hash at <prefix>:<component>:<path>:<table> keyed by the key columns; rows found by key
+// are kept in a per-table local L1 for l1Ttl, which bounds how stale a row written by another replica can be.
+// Columns the SDK marks as encrypted, such as licenses and keys, are sealed with AES-256-GCM under key before
+// they leave the process; a key column among them is stored as its HMAC, so lookups by key still work.
+class RedisStorageDelegate final : public mip::StorageDelegate {
+public:
+  static const size_t kKeySize = 32;
+
+  // key must be kKeySize bytes, the same on every replica. Throws std::invalid_argument otherwise.
+  RedisStorageDelegate(
+      const std::shared_ptr<RedisClient>& client,
+      const std::string& keyPrefix,
+      std::chrono::seconds l1Ttl,
+      const std::string& key);
+
+  mip::StorageTableResult CreateStorageTable(
+      const std::string& path,
+      const mip::MipComponent mipComponent,
+      const std::string& tableName,
+      const std::vector<std::string>& allColumns,
+      const std::vector<std::string>& encryptedColumns,
+      const std::vector<std::string>& keyColumns) const override;
+
+  StorageSettings GetSettings() const override;
+
+private:
+  std::shared_ptr<RedisClient> mClient;
+  std::string mKeyPrefix;
+  std::chrono::seconds mL1Ttl;
+  std::string mKey;
+};
+
+} // namespace storage
+} // namespace sample
+
+#endif // SAMPLES_COMMON_REDIS_STORAGE_DELEGATE_H_
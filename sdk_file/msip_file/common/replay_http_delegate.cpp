@@ -0,0 +1,439 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "replay_http_delegate.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+
+using mip::CaseInsensitiveComparator;
+using mip::HttpOperation;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using mip::HttpResponse;
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace sample {
+namespace http {
+
+namespace {
+
+typedef map<string, string, CaseInsensitiveComparator> HeaderMap;
+
+const char kIndexFile[] = "index.tsv";
+const int32_t kMissStatusCode = 404;
+
+class ReplayResponse final : public HttpResponse {
+public:
+  ReplayResponse(const string& id, int32_t statusCode, const shared_ptr<const vector<uint8_t>>& body, const HeaderMap& headers)
+      : mId(id), mStatusCode(statusCode), mBody(body), mHeaders(headers) {}
+
+  const string& GetId() const override { return mId; }
+  int32_t GetStatusCode() const override { return mStatusCode; }
+  const vector<uint8_t>& GetBody() const override { return *mBody; }
+  const HeaderMap& GetHeaders() const override { return mHeaders; }
+
+private:
+  string mId;
+  int32_t mStatusCode;
+  // Shared with the recording so replaying a large template or policy does not copy it per request.
+  shared_ptr<const vector<uint8_t>> mBody;
+  HeaderMap mHeaders;
+};
+
+class ReplayOperation final : public HttpOperation {
+public:
+  explicit ReplayOperation(const string& id) : mId(id), mCancelled(false) {}
+
+  const string& GetId() const override { return mId; }
+
+  shared_ptr<HttpResponse> GetResponse() override {
+    lock_guard<mutex> lock(mMutex);
+    return mResponse;
+  }
+
+  bool IsCancelled() override { return mCancelled; }
+
+  void Complete(const shared_ptr<HttpResponse>& response, bool cancelled) {
+    lock_guard<mutex> lock(mMutex);
+    mResponse = response;
+    mCancelled = cancelled;
+  }
+
+private:
+  string mId;
+  mutex mMutex;
+  shared_ptr<HttpResponse> mResponse;
+  std::atomic<bool> mCancelled;
+};
+
+// FNV-1a, so body hashes in a recording stay valid across builds.
+uint64_t Fnv1a64(const vector<uint8_t>& value) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto byte : value) {
+    hash ^= byte;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+string HashHex(const vector<uint8_t>& body) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(Fnv1a64(body)));
+  return hex;
+}
+
+const char* MethodName(HttpRequestType type) {
+  return type == HttpRequestType::Post ? "POST" : "GET";
+}
+
+// Host and path of url with the host lowercased; the scheme, query and fragment are dropped because
+// they carry request ids and cache busters that differ between recording and replay.
+string UrlKey(const string& url) {
+  auto hostStart = url.find("://");
+  hostStart = hostStart == string::npos ? 0 : hostStart + 3;
+  auto pathStart = url.find('/', hostStart);
+  auto end = url.find_first_of("?#", hostStart);
+  if (pathStart != string::npos && end != string::npos && end < pathStart) pathStart = string::npos;
+  auto hostEnd = pathStart != string::npos ? pathStart : (end != string::npos ? end : url.size());
+  string key = url.substr(hostStart, hostEnd - hostStart);
+  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  if (pathStart != string::npos) key += url.substr(pathStart, (end == string::npos ? url.size() : end) - pathStart);
+  return key.empty() || key.back() != '/' ? key : key.substr(0, key.size() - 1);
+}
+
+string PathKey(const string& method, const string& urlKey) {
+  return method + " " + urlKey;
+}
+
+string ExactKey(const string& method, const string& urlKey, const string& bodyHash) {
+  return method + " " + urlKey + " " + bodyHash;
+}
+
+string JoinPath(const string& directory, const string& name) {
+  return directory.empty() || directory.back() == '/' ? directory + name : directory + "/" + name;
+}
+
+shared_ptr<const vector<uint8_t>> ReadBody(const string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Failed to read recorded response " + path);
+  auto body = make_shared<vector<uint8_t>>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  return body;
+}
+
+HeaderMap ReadHeaders(const string& path) {
+  HeaderMap headers;
+  std::ifstream in(path);
+  string line;
+  while (std::getline(in, line)) {
+    auto colon = line.find(':');
+    if (colon == string::npos) continue;
+    auto valueStart = line.find_first_not_of(' ', colon + 1);
+    headers[line.substr(0, colon)] = valueStart == string::npos ? "" : line.substr(valueStart);
+  }
+  return headers;
+}
+
+void WriteFile(const string& path, const char* data, size_t size) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(data, static_cast<std::streamsize>(size));
+  if (!out) throw std::runtime_error("Failed to write recorded response " + path);
+}
+
+} // namespace
+
+struct ReplayHttpDelegate::Pending {
+  string id;
+  std::chrono::steady_clock::time_point deadline;
+  shared_ptr<ReplayOperation> operation;
+  shared_ptr<HttpResponse> response;
+  function<void(shared_ptr<HttpOperation>)> callback;
+  bool cancelled = false;
+};
+
+bool ReplayHttpDelegate::PendingLater::operator()(const shared_ptr<Pending>& left, const shared_ptr<Pending>& right) const {
+  return left->deadline > right->deadline;
+}
+
+ReplayHttpDelegate::ReplayHttpDelegate(
+    const Settings& settings,
+    const shared_ptr<mip::HttpDelegate>& inner,
+    const shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher)
+    : mSettings(settings),
+      mInner(inner),
+      mCallbackDispatcher(callbackDispatcher),
+      mRandom(std::random_device()()),
+      mStats(),
+      mNextRecording(0),
+      mStopping(false) {
+  if (mSettings.directory.empty())
+    throw std::invalid_argument("HTTP replay needs a recording directory");
+  if (mSettings.mode == Mode::Record) {
+    if (!mInner)
+      throw std::invalid_argument("HTTP recording needs a delegate to forward requests to");
+    if (mkdir(mSettings.directory.c_str(), 0755) != 0 && errno != EEXIST)
+      throw std::runtime_error("Failed to create recording directory " + mSettings.directory);
+  }
+  Load();
+  if (mSettings.mode == Mode::Replay)
+    mTimer = std::thread(&ReplayHttpDelegate::TimerLoop, this);
+}
+
+ReplayHttpDelegate::~ReplayHttpDelegate() {
+  {
+    lock_guard<mutex> lock(mTimerMutex);
+    mStopping = true;
+  }
+  mTimerWake.notify_all();
+  if (mTimer.joinable())
+    mTimer.join();
+}
+
+void ReplayHttpDelegate::Load() {
+  std::ifstream index(JoinPath(mSettings.directory, kIndexFile));
+  if (!index) {
+    // A new recording starts empty; replaying needs one to exist.
+    if (mSettings.mode == Mode::Replay)
+      throw std::runtime_error("No HTTP recording found in " + mSettings.directory);
+    return;
+  }
+
+  string line;
+  while (std::getline(index, line)) {
+    std::istringstream fields(line);
+    string method, urlKey, bodyHash, status, name;
+    if (!std::getline(fields, method, '\t') || !std::getline(fields, urlKey, '\t') || !std::getline(fields, bodyHash, '\t') ||
+        !std::getline(fields, status, '\t') || !std::getline(fields, name, '\t'))
+      continue;
+    ++mNextRecording;
+    ++mStats.recordings;
+    if (mSettings.mode == Mode::Record)
+      continue;
+
+    Recording recording;
+    recording.statusCode = static_cast<int32_t>(std::stol(status));
+    recording.body = ReadBody(JoinPath(mSettings.directory, name + ".body"));
+    recording.headers = ReadHeaders(JoinPath(mSettings.directory, name + ".headers"));
+    mExact[ExactKey(method, urlKey, bodyHash)].recordings.push_back(recording);
+    mByPath[PathKey(method, urlKey)].recordings.push_back(recording);
+  }
+}
+
+shared_ptr<HttpResponse> ReplayHttpDelegate::Replay(const HttpRequest& request) {
+  const string method = MethodName(request.GetRequestType());
+  const string urlKey = UrlKey(request.GetUrl());
+
+  lock_guard<mutex> lock(mMutex);
+  ++mStats.requests;
+  Candidates* candidates = nullptr;
+  auto exact = mExact.find(ExactKey(method, urlKey, HashHex(request.GetBody())));
+  if (exact != mExact.end()) {
+    ++mStats.exactMatches;
+    candidates = &exact->second;
+  } else {
+    auto byPath = mByPath.find(PathKey(method, urlKey));
+    if (byPath == mByPath.end()) {
+      ++mStats.misses;
+      mStats.lastMiss = PathKey(method, urlKey);
+      return make_shared<ReplayResponse>(request.GetId(), kMissStatusCode, make_shared<const vector<uint8_t>>(), HeaderMap());
+    }
+    ++mStats.pathMatches;
+    candidates = &byPath->second;
+  }
+
+  // Cycle through the recordings so a request answered differently over a session replays the same way.
+  const auto& recording = candidates->recordings[candidates->next];
+  candidates->next = (candidates->next + 1) % candidates->recordings.size();
+  return make_shared<ReplayResponse>(request.GetId(), recording.statusCode, recording.body, recording.headers);
+}
+
+void ReplayHttpDelegate::Record(const HttpRequest& request, const shared_ptr<HttpOperation>& operation) {
+  auto response = operation ? operation->GetResponse() : nullptr;
+  if (!response || operation->IsCancelled())
+    return;
+
+  string headers;
+  for (const auto& header : response->GetHeaders())
+    headers += header.first + ": " + header.second + "\n";
+  const auto& body = response->GetBody();
+
+  lock_guard<mutex> lock(mMutex);
+  char name[32];
+  snprintf(name, sizeof(name), "%06llu", static_cast<unsigned long long>(mNextRecording++));
+  WriteFile(JoinPath(mSettings.directory, string(name) + ".body"), reinterpret_cast<const char*>(body.data()), body.size());
+  WriteFile(JoinPath(mSettings.directory, string(name) + ".headers"), headers.data(), headers.size());
+
+  std::ofstream index(JoinPath(mSettings.directory, kIndexFile), std::ios::app);
+  index << MethodName(request.GetRequestType()) << '\t' << UrlKey(request.GetUrl()) << '\t' << HashHex(request.GetBody()) << '\t'
+        << response->GetStatusCode() << '\t' << name << '\n';
+  ++mStats.recorded;
+  ++mStats.recordings;
+}
+
+std::chrono::milliseconds ReplayHttpDelegate::NextDelay() {
+  if (mSettings.jitter.count() <= 0)
+    return mSettings.latency;
+  lock_guard<mutex> lock(mMutex);
+  std::uniform_int_distribution<long long> jitter(0, mSettings.jitter.count());
+  return mSettings.latency + std::chrono::milliseconds(jitter(mRandom));
+}
+
+shared_ptr<HttpOperation> ReplayHttpDelegate::Send(const shared_ptr<HttpRequest>& request, const shared_ptr<void>& context) {
+  if (mSettings.mode == Mode::Record) {
+    auto operation = mInner->Send(request, context);
+    Record(*request, operation);
+    return operation;
+  }
+
+  auto delay = NextDelay();
+  if (delay.count() > 0)
+    std::this_thread::sleep_for(delay);
+  auto operation = make_shared<ReplayOperation>(request->GetId());
+  operation->Complete(Replay(*request), false);
+  return operation;
+}
+
+shared_ptr<HttpOperation> ReplayHttpDelegate::SendAsync(
+    const shared_ptr<HttpRequest>& request,
+    const shared_ptr<void>& context,
+    const function<void(shared_ptr<HttpOperation>)>& callbackFn) {
+  if (mSettings.mode == Mode::Record) {
+    auto recordRequest = request;
+    return mInner->SendAsync(request, context, [this, recordRequest, callbackFn](shared_ptr<HttpOperation> operation) {
+      Record(*recordRequest, operation);
+      if (callbackFn) callbackFn(operation);
+    });
+  }
+
+  auto pending = make_shared<Pending>();
+  pending->id = request->GetId();
+  pending->deadline = std::chrono::steady_clock::now() + NextDelay();
+  pending->operation = make_shared<ReplayOperation>(request->GetId());
+  pending->response = Replay(*request);
+  pending->callback = callbackFn;
+  {
+    lock_guard<mutex> lock(mTimerMutex);
+    mTimers.push(pending);
+    mPending[pending->id] = pending;
+  }
+  mTimerWake.notify_one();
+  return pending->operation;
+}
+
+void ReplayHttpDelegate::CancelOperation(const string& requestId) {
+  if (mSettings.mode == Mode::Record) {
+    mInner->CancelOperation(requestId);
+    return;
+  }
+  {
+    lock_guard<mutex> lock(mTimerMutex);
+    auto pending = mPending.find(requestId);
+    if (pending != mPending.end())
+      pending->second->cancelled = true;
+  }
+  mTimerWake.notify_one();
+}
+
+void ReplayHttpDelegate::CancelAllOperations() {
+  if (mSettings.mode == Mode::Record) {
+    mInner->CancelAllOperations();
+    return;
+  }
+  {
+    lock_guard<mutex> lock(mTimerMutex);
+    for (auto& pending : mPending)
+      pending.second->cancelled = true;
+  }
+  mTimerWake.notify_one();
+}
+
+ReplayHttpDelegate::Stats ReplayHttpDelegate::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  return mStats;
+}
+
+void ReplayHttpDelegate::TimerLoop() {
+  unique_lock<mutex> lock(mTimerMutex);
+  while (true) {
+    if (mStopping) {
+      // Nothing will answer what is still waiting, so finish it as cancelled rather than leave the SDK hanging.
+      for (auto& pending : mPending)
+        pending.second->cancelled = true;
+    }
+    if (mTimers.empty()) {
+      if (mStopping)
+        return;
+      mTimerWake.wait(lock);
+      continue;
+    }
+    auto next = mTimers.top();
+    if (!mStopping && !next->cancelled && next->deadline > std::chrono::steady_clock::now()) {
+      mTimerWake.wait_until(lock, next->deadline);
+      continue;
+    }
+    mTimers.pop();
+    mPending.erase(next->id);
+    const bool cancelled = next->cancelled;
+    lock.unlock();
+    Complete(next, cancelled);
+    lock.lock();
+  }
+}
+
+void ReplayHttpDelegate::Complete(const shared_ptr<Pending>& pending, bool cancelled) {
+  pending->operation->Complete(cancelled ? nullptr : pending->response, cancelled);
+  if (!pending->callback)
+    return;
+  auto operation = pending->operation;
+  auto callback = pending->callback;
+  if (mCallbackDispatcher && !cancelled) {
+    mCallbackDispatcher->DispatchTask("http-callback-" + operation->GetId(), [callback, operation]() { callback(operation); });
+  } else {
+    callback(operation);
+  }
+}
+
+} // namespace http
+} // namespace sample
@@ -0,0 +1,152 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_REPLAY_HTTP_DELEGATE_H_
+#define SAMPLES_COMMON_REPLAY_HTTP_DELEGATE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/http_delegate.h"
+#include "mip/task_dispatcher_delegate.h"
+
+namespace sample {
+namespace http {
+
+// HttpDelegate that records the protection and policy service responses the SDK receives, or replays
+// them without a network, so throughput can be measured without a tenant and SDK CPU cost separated
+// from service latency.
+//
+// A recording is a directory holding index.tsv plus one .body and one .headers file per response. A
+// request is answered with the recording of the same method, host, path and body when there is one,
+// otherwise with the recordings of the same method, host and path in turn; query strings are ignored.
+// Requests with no recording get a 404 and are counted as misses. Replayed responses are delayed by
+// latency plus a uniform random jitter, on a timer thread, so async requests keep no thread busy
+// while they wait.
+class ReplayHttpDelegate final : public mip::HttpDelegate {
+public:
+  enum class Mode { Record, Replay };
+
+  struct Settings {
+    Mode mode = Mode::Replay;
+    std::string directory;
+    std::chrono::milliseconds latency = std::chrono::milliseconds(0);
+    std::chrono::milliseconds jitter = std::chrono::milliseconds(0);
+  };
+
+  struct Stats {
+    uint64_t requests;
+    uint64_t exactMatches;
+    uint64_t pathMatches;
+    uint64_t misses;
+    uint64_t recorded;
+    size_t recordings;
+    std::string lastMiss;
+  };
+
+  // Replay loads the recording up front and throws if it cannot be read. Record forwards every request
+  // to inner and appends each response to the directory, creating it if needed. Async completions are
+  // handed to callbackDispatcher like HttpDelegateImpl does.
+  ReplayHttpDelegate(
+      const Settings& settings,
+      const std::shared_ptr<mip::HttpDelegate>& inner,
+      const std::shared_ptr<mip::TaskDispatcherDelegate>& callbackDispatcher);
+  ~ReplayHttpDelegate();
+
+  std::shared_ptr<mip::HttpOperation> Send(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context) override;
+
+  std::shared_ptr<mip::HttpOperation> SendAsync(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context,
+      const std::function<void(std::shared_ptr<mip::HttpOperation>)>& callbackFn) override;
+
+  void CancelOperation(const std::string& requestId) override;
+
+  void CancelAllOperations() override;
+
+  Stats GetStats() const;
+
+private:
+  struct Recording {
+    int32_t statusCode;
+    std::shared_ptr<const std::vector<uint8_t>> body;
+    std::map<std::string, std::string, mip::CaseInsensitiveComparator> headers;
+  };
+
+  struct Candidates {
+    std::vector<Recording> recordings;
+    size_t next = 0;
+  };
+
+  struct Pending;
+  struct PendingLater {
+    bool operator()(const std::shared_ptr<Pending>& left, const std::shared_ptr<Pending>& right) const;
+  };
+
+  void Load();
+  std::shared_ptr<mip::HttpResponse> Replay(const mip::HttpRequest& request);
+  void Record(const mip::HttpRequest& request, const std::shared_ptr<mip::HttpOperation>& operation);
+  std::chrono::milliseconds NextDelay();
+  void TimerLoop();
+  void Complete(const std::shared_ptr<Pending>& pending, bool cancelled);
+
+  const Settings mSettings;
+  const std::shared_ptr<mip::HttpDelegate> mInner;
+  const std::shared_ptr<mip::TaskDispatcherDelegate> mCallbackDispatcher;
+
+  mutable std::mutex mMutex;
+  std::map<std::string, Candidates> mExact;
+  std::map<std::string, Candidates> mByPath;
+  std::mt19937 mRandom;
+  Stats mStats;
+  uint64_t mNextRecording;
+
+  std::mutex mTimerMutex;
+  std::condition_variable mTimerWake;
+  std::priority_queue<std::shared_ptr<Pending>, std::vector<std::shared_ptr<Pending>>, PendingLater> mTimers;
+  std::map<std::string, std::shared_ptr<Pending>> mPending;
+  bool mStopping;
+  std::thread mTimer;
+};
+
+} // namespace http
+} // namespace sample
+
+#endif // SAMPLES_COMMON_REPLAY_HTTP_DELEGATE_H_
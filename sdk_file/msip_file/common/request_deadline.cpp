@@ -0,0 +1,71 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "request_deadline.h"
+
+#include <algorithm>
+
+namespace sample {
+namespace deadline {
+
+namespace {
+
+thread_local Deadline tCurrent;
+
+} // namespace
+
+Deadline::Deadline() : mExpiry(Clock::time_point::max()) {}
+
+Deadline::Deadline(Clock::time_point expiry) : mExpiry(expiry) {}
+
+Deadline Deadline::After(std::chrono::milliseconds timeout) {
+  return Deadline(Clock::now() + timeout);
+}
+
+long Deadline::RemainingMs() const {
+  const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(mExpiry - Clock::now()).count();
+  return static_cast<long>(std::max<decltype(remaining)>(remaining, 1));
+}
+
+const Deadline& Deadline::Current() {
+  return tCurrent;
+}
+
+void Deadline::SetCurrent(const Deadline& deadline) {
+  tCurrent = deadline;
+}
+
+ScopedDeadline::ScopedDeadline(const Deadline& deadline)
+    : mPrevious(Deadline::Current()) {
+  Deadline::SetCurrent(deadline);
+}
+
+ScopedDeadline::~ScopedDeadline() {
+  Deadline::SetCurrent(mPrevious);
+}
+
+} // namespace deadline
+} // namespace sample
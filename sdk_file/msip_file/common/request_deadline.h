@@ -0,0 +1,101 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_REQUEST_DEADLINE_H_
+#define SAMPLES_COMMON_REQUEST_DEADLINE_H_
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <stdexcept>
+
+namespace sample {
+namespace deadline {
+
+// Deadline of the operation running on this thread, set from the caller's gRPC deadline. Like the trace
+// context, the task dispatcher carries it onto the SDK's background work, so HTTP requests made on a
+// caller's behalf give up when the caller does.
+class Deadline final {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // No deadline: waits are unbounded.
+  Deadline();
+  explicit Deadline(Clock::time_point expiry);
+
+  static Deadline After(std::chrono::milliseconds timeout);
+
+  bool IsSet() const { return mExpiry != Clock::time_point::max(); }
+  bool HasExpired() const { return IsSet() && Clock::now() >= mExpiry; }
+  Clock::time_point GetExpiry() const { return mExpiry; }
+
+  // Milliseconds left, at least 1 so the result can bound another timeout. Only meaningful when IsSet.
+  long RemainingMs() const;
+
+  static const Deadline& Current();
+  static void SetCurrent(const Deadline& deadline);
+
+private:
+  Clock::time_point mExpiry;
+};
+
+// Installs a deadline on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedDeadline final {
+public:
+  explicit ScopedDeadline(const Deadline& deadline);
+  ~ScopedDeadline();
+
+  ScopedDeadline(const ScopedDeadline&) = delete;
+  ScopedDeadline& operator=(const ScopedDeadline&) = delete;
+
+private:
+  Deadline mPrevious;
+};
+
+class DeadlineExceededError final : public std::runtime_error {
+public:
+  DeadlineExceededError() : std::runtime_error("Deadline exceeded") {}
+};
+
+// Waits for future until this thread's deadline. On expiry runs onExpired, e.g. to cancel the operation
+// the future belongs to, and throws DeadlineExceededError; the operation completes into its abandoned
+// promise later.
+template <typename Future>
+auto WaitUntilDeadline(Future& future, const std::function<void()>& onExpired = nullptr) -> decltype(future.get()) {
+  const Deadline& deadline = Deadline::Current();
+  if (deadline.IsSet() && future.wait_until(deadline.GetExpiry()) == std::future_status::timeout) {
+    if (onExpired)
+      onExpired();
+    throw DeadlineExceededError();
+  }
+  return future.get();
+}
+
+} // namespace deadline
+} // namespace sample
+
+#endif // SAMPLES_COMMON_REQUEST_DEADLINE_H_
@@ -0,0 +1,494 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "task_dispatcher_impl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include "allocation_account.h"
+#include "cost_account.h"
+#include "operation_log.h"
+#include "protection_token_context.h"
+#include "request_deadline.h"
+#include "tenant_context.h"
+#include "trace_context.h"
+#include "work_priority.h"
+
+using std::condition_variable;
+using std::function;
+using std::ifstream;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace sample {
+namespace task {
+
+namespace {
+
+// Slots on the delay wheel, one per second. Longer delays wrap and count down rounds.
+const size_t kWheelSlots = 64;
+
+// SDK tasks can wait on other SDK tasks, so a single worker could deadlock.
+const size_t kMinWorkers = 2;
+
+// Identifies the pool and worker the current thread belongs to, so nested dispatches stay local.
+thread_local const TaskDispatcherImpl* tCurrentDispatcher = nullptr;
+thread_local size_t tCurrentWorker = 0;
+
+size_t CeilDiv(long long quota, long long period) {
+  return static_cast<size_t>((quota + period - 1) / period);
+}
+
+} // namespace
+
+TaskDispatcherImpl::TaskDispatcherImpl(size_t workerCount)
+    : mQueued(0),
+      mBulkQueued(0),
+      mReservedWorkers(0),
+      mNextWorker(0),
+      mStopping(false),
+      mPaused(false),
+      mRunning(0),
+      mWheel(kWheelSlots),
+      mWheelCursor(0),
+      mDelayed(0),
+      mExecuted(0),
+      mSteals(0),
+      mCancelled(0),
+      mBulkExecuted(0) {
+  if (workerCount == 0)
+    workerCount = GetCpuQuota();
+  workerCount = std::max(workerCount, kMinWorkers);
+  mReservedWorkers = std::min(workerCount / 4, workerCount - kMinWorkers);
+
+  for (size_t i = 0; i < workerCount; ++i)
+    mWorkers.emplace_back(new Worker());
+  StartThreads();
+}
+
+TaskDispatcherImpl::~TaskDispatcherImpl() {
+  {
+    lock_guard<mutex> idleLock(mIdleMutex);
+    lock_guard<mutex> timerLock(mTimerMutex);
+    mStopping = true;
+  }
+  mIdle.notify_all();
+  mTimerWake.notify_all();
+  if (mTimer.joinable())
+    mTimer.join();
+  for (auto& worker : mWorkers) {
+    if (worker->thread.joinable())
+      worker->thread.join();
+  }
+}
+
+void TaskDispatcherImpl::StartThreads() {
+  for (size_t i = 0; i < mWorkers.size(); ++i)
+    mWorkers[i]->thread = std::thread(&TaskDispatcherImpl::WorkerLoop, this, i);
+  mTimer = std::thread(&TaskDispatcherImpl::TimerLoop, this);
+}
+
+void TaskDispatcherImpl::PauseThreads() {
+  {
+    lock_guard<mutex> idleLock(mIdleMutex);
+    lock_guard<mutex> timerLock(mTimerMutex);
+    if (mPaused)
+      return;
+    mPaused = true;
+  }
+  mIdle.notify_all();
+  mTimerWake.notify_all();
+  mTimer.join();
+  for (auto& worker : mWorkers)
+    worker->thread.join();
+}
+
+void TaskDispatcherImpl::ResumeThreads() {
+  {
+    lock_guard<mutex> idleLock(mIdleMutex);
+    lock_guard<mutex> timerLock(mTimerMutex);
+    if (!mPaused)
+      return;
+    mPaused = false;
+  }
+  StartThreads();
+}
+
+void TaskDispatcherImpl::DispatchTask(const string& taskId, function<void()> task) {
+  Enqueue(MakeTask(taskId, std::move(task)));
+}
+
+void TaskDispatcherImpl::DispatchTask(const string& taskId, function<void()> task, int64_t delaySeconds) {
+  if (delaySeconds <= 0) {
+    DispatchTask(taskId, std::move(task));
+    return;
+  }
+
+  // The next tick is less than a second away, so wait one extra tick to never fire early.
+  const uint64_t ticks = static_cast<uint64_t>(delaySeconds) + 1;
+  TimedTask timed;
+  timed.rounds = (ticks - 1) / kWheelSlots;
+  timed.task = MakeTask(taskId, std::move(task));
+  lock_guard<mutex> lock(mTimerMutex);
+  mWheel[(mWheelCursor + ticks) % kWheelSlots].push_back(std::move(timed));
+  ++mDelayed;
+}
+
+void TaskDispatcherImpl::ExecuteTaskOnIndependentThread(const string& /*taskId*/, function<void()> task) {
+  // Long-running by contract, so it must not occupy a pool worker.
+  const auto context = trace::TraceContext::Current();
+  const auto requestDeadline = deadline::Deadline::Current();
+  const string taskTenant = tenant::Current();
+  const auto taskPriority = priority::Current();
+  const auto log = oplog::OperationLog::Current();
+  const auto subsystem = alloc::CurrentSubsystem();
+  const auto account = alloc::CurrentAccount();
+  const auto costKey = cost::CurrentKey();
+  const auto protectionToken = token::Current();
+  std::thread([context, requestDeadline, taskTenant, taskPriority, log, subsystem, account, costKey, protectionToken, task]() {
+    trace::ScopedTraceContext scope(context);
+    deadline::ScopedDeadline deadlineScope(requestDeadline);
+    tenant::ScopedTenant tenantScope(taskTenant);
+    priority::ScopedPriority priorityScope(taskPriority);
+    oplog::ScopedOperationLog logScope(log);
+    alloc::ScopedSubsystem subsystemScope(subsystem);
+    alloc::ScopedAccount accountScope(account);
+    cost::ScopedKey costScope(costKey);
+    token::ScopedToken tokenScope(protectionToken);
+    task();
+  }).detach();
+}
+
+bool TaskDispatcherImpl::CancelTask(const string& taskId) {
+  lock_guard<mutex> lock(mPendingMutex);
+  auto range = mPending.equal_range(taskId);
+  if (range.first == range.second)
+    return false;
+  for (auto it = range.first; it != range.second; ++it)
+    *it->second = true;
+  mPending.erase(range.first, range.second);
+  return true;
+}
+
+void TaskDispatcherImpl::CancelAllTasks() {
+  lock_guard<mutex> lock(mPendingMutex);
+  for (auto& pending : mPending)
+    *pending.second = true;
+  mPending.clear();
+}
+
+TaskDispatcherImpl::Stats TaskDispatcherImpl::GetStats() const {
+  Stats stats;
+  stats.workers = mWorkers.size();
+  stats.queueDepth = mQueued;
+  stats.delayed = mDelayed;
+  stats.executed = mExecuted;
+  stats.steals = mSteals;
+  stats.cancelled = mCancelled;
+  stats.reservedWorkers = mReservedWorkers;
+  stats.bulkQueueDepth = mBulkQueued;
+  stats.bulkExecuted = mBulkExecuted;
+  return stats;
+}
+
+void TaskDispatcherImpl::SetReservedWorkers(size_t reservedWorkers) {
+  {
+    lock_guard<mutex> lock(mIdleMutex);
+    mReservedWorkers = std::min(reservedWorkers, mWorkers.size() - kMinWorkers);
+  }
+  // Workers no longer reserved may have bulk tasks waiting for them.
+  mIdle.notify_all();
+}
+
+void TaskDispatcherImpl::SetTenantWeight(const string& tenant, int weight) {
+  lock_guard<mutex> lock(mWeightMutex);
+  if (weight <= 1)
+    mWeights.erase(tenant);
+  else
+    mWeights[tenant] = weight;
+}
+
+size_t TaskDispatcherImpl::GetCpuQuota() {
+  size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+
+  ifstream cpuMax("/sys/fs/cgroup/cpu.max");
+  string quota;
+  long long period = 0;
+  if (cpuMax >> quota >> period && quota != "max" && period > 0) {
+    try {
+      auto granted = std::stoll(quota);
+      if (granted > 0)
+        return std::min(CeilDiv(granted, period), hardware);
+    } catch (const std::exception&) {
+    }
+  }
+
+  ifstream cfsQuota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+  ifstream cfsPeriod("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+  long long quotaUs = 0;
+  long long periodUs = 0;
+  if (cfsQuota >> quotaUs && cfsPeriod >> periodUs && quotaUs > 0 && periodUs > 0)
+    return std::min(CeilDiv(quotaUs, periodUs), hardware);
+
+  return hardware;
+}
+
+TaskDispatcherImpl::Task TaskDispatcherImpl::MakeTask(const string& taskId, function<void()> run) {
+  Task task;
+  task.id = taskId;
+  task.tenant = tenant::Current();
+  task.weight = 1;
+  task.priority = priority::Current();
+  {
+    lock_guard<mutex> lock(mWeightMutex);
+    auto weight = mWeights.find(task.tenant);
+    if (weight != mWeights.end())
+      task.weight = weight->second;
+  }
+  // Tasks run under the trace context, deadline, tenant, priority, operation log, allocation accounting,
+  // cost key and protection token of whoever dispatched them.
+  const auto context = trace::TraceContext::Current();
+  const auto requestDeadline = deadline::Deadline::Current();
+  const auto log = oplog::OperationLog::Current();
+  const auto subsystem = alloc::CurrentSubsystem();
+  const auto account = alloc::CurrentAccount();
+  const auto costKey = cost::CurrentKey();
+  const auto protectionToken = token::Current();
+  if (context.IsValid() || context.verbose || requestDeadline.IsSet() || !task.tenant.empty() || task.priority != priority::Priority::Interactive || log ||
+      subsystem != alloc::Subsystem::Sdk || account || costKey != cost::kNoKey || protectionToken) {
+    const string taskTenant = task.tenant;
+    const auto taskPriority = task.priority;
+    // A logged operation also sees when each of its tasks ran and how long it waited for a worker.
+    const auto queued = oplog::OperationLog::Clock::now();
+    task.run = [context, requestDeadline, taskTenant, taskPriority, log, subsystem, account, costKey, protectionToken, taskId, queued, run]() {
+      trace::ScopedTraceContext scope(context);
+      deadline::ScopedDeadline deadlineScope(requestDeadline);
+      tenant::ScopedTenant tenantScope(taskTenant);
+      priority::ScopedPriority priorityScope(taskPriority);
+      oplog::ScopedOperationLog logScope(log);
+      alloc::ScopedSubsystem subsystemScope(subsystem);
+      alloc::ScopedAccount accountScope(account);
+      cost::ScopedKey costScope(costKey);
+      token::ScopedToken tokenScope(protectionToken);
+      if (!log) {
+        run();
+        return;
+      }
+      const auto start = oplog::OperationLog::Clock::now();
+      run();
+      log->Add("task", taskId, start, oplog::OperationLog::Clock::now(),
+          "queued " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(start - queued).count()) + " us");
+    };
+  } else {
+    task.run = std::move(run);
+  }
+  task.cancelled = std::make_shared<std::atomic<bool>>(false);
+  lock_guard<mutex> lock(mPendingMutex);
+  mPending.emplace(taskId, task.cancelled);
+  return task;
+}
+
+void TaskDispatcherImpl::Enqueue(Task task) {
+  const bool bulk = task.priority == priority::Priority::Bulk;
+  size_t index = tCurrentDispatcher == this
+      ? tCurrentWorker
+      : mNextWorker++ % mWorkers.size();
+  // Bulk tasks are queued where they can run; reserved workers would only leave them to be stolen.
+  const size_t reserved = mReservedWorkers;
+  if (bulk && index < reserved)
+    index = reserved + mNextWorker++ % (mWorkers.size() - reserved);
+  {
+    auto& worker = *mWorkers[index];
+    lock_guard<mutex> lock(worker.mutex);
+    auto& lanes = bulk ? worker.bulk.lanes : worker.interactive.lanes;
+    auto lane = std::find_if(lanes.begin(), lanes.end(),
+        [&](const Lane& candidate) { return candidate.tenant == task.tenant; });
+    if (lane == lanes.end()) {
+      lanes.push_back(Lane());
+      lane = std::prev(lanes.end());
+      lane->tenant = task.tenant;
+      lane->credit = task.weight;
+    }
+    lane->weight = task.weight;
+    lane->tasks.push_back(std::move(task));
+  }
+  {
+    lock_guard<mutex> lock(mIdleMutex);
+    ++mQueued;
+    if (bulk)
+      ++mBulkQueued;
+  }
+  // A reserved worker woken for a bulk task would go back to sleep with the wakeup, so wake them all.
+  if (bulk && reserved > 0)
+    mIdle.notify_all();
+  else
+    mIdle.notify_one();
+}
+
+// Every interactive task, the worker's own and then the others', comes before any bulk task.
+bool TaskDispatcherImpl::TryPop(size_t index, Task& task) {
+  if (TryPop(index, &Worker::interactive, task))
+    return true;
+  if (!RunsBulk(index) || !TryPop(index, &Worker::bulk, task))
+    return false;
+  --mBulkQueued;
+  return true;
+}
+
+bool TaskDispatcherImpl::TryPop(size_t index, Lanes Worker::*lanes, Task& task) {
+  {
+    auto& own = *mWorkers[index];
+    lock_guard<mutex> lock(own.mutex);
+    if (PopLane(own.*lanes, true /*newest*/, task)) {
+      --mQueued;
+      return true;
+    }
+  }
+  for (size_t offset = 1; offset < mWorkers.size(); ++offset) {
+    auto& victim = *mWorkers[(index + offset) % mWorkers.size()];
+    lock_guard<mutex> lock(victim.mutex);
+    if (PopLane(victim.*lanes, false /*newest*/, task)) {
+      --mQueued;
+      ++mSteals;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Deficit round robin over the worker's lanes of one priority. The owner takes a lane's newest task,
+// which is likely still in cache; thieves take its oldest.
+bool TaskDispatcherImpl::PopLane(Lanes& lanes, bool newest, Task& task) {
+  while (!lanes.lanes.empty()) {
+    if (lanes.cursor >= lanes.lanes.size())
+      lanes.cursor = 0;
+    auto& lane = lanes.lanes[lanes.cursor];
+    if (lane.tasks.empty()) {
+      lanes.lanes.erase(lanes.lanes.begin() + lanes.cursor);
+      continue;
+    }
+    if (lane.credit <= 0) {
+      lane.credit = lane.weight;
+      ++lanes.cursor;
+      continue;
+    }
+    if (newest) {
+      task = std::move(lane.tasks.back());
+      lane.tasks.pop_back();
+    } else {
+      task = std::move(lane.tasks.front());
+      lane.tasks.pop_front();
+    }
+    --lane.credit;
+    return true;
+  }
+  return false;
+}
+
+void TaskDispatcherImpl::Run(Task& task) {
+  {
+    lock_guard<mutex> lock(mPendingMutex);
+    auto range = mPending.equal_range(task.id);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == task.cancelled) {
+        mPending.erase(it);
+        break;
+      }
+    }
+  }
+  if (*task.cancelled) {
+    ++mCancelled;
+    return;
+  }
+  try {
+    task.run();
+  } catch (const std::exception&) {
+    // A throwing task must not take the worker down with it.
+  }
+  ++mExecuted;
+  if (task.priority == priority::Priority::Bulk)
+    ++mBulkExecuted;
+}
+
+void TaskDispatcherImpl::WorkerLoop(size_t index) {
+  tCurrentDispatcher = this;
+  tCurrentWorker = index;
+  while (!mPaused) {
+    Task task;
+    ++mRunning;
+    if (TryPop(index, task)) {
+      Run(task);
+      --mRunning;
+      continue;
+    }
+    --mRunning;
+    unique_lock<mutex> lock(mIdleMutex);
+    // Reserved workers sleep through queued bulk tasks.
+    mIdle.wait(lock, [this, index]() {
+      return mStopping || mPaused || mQueued > (RunsBulk(index) ? 0 : mBulkQueued.load());
+    });
+    if (mStopping && (mQueued == 0 || (!RunsBulk(index) && mQueued == mBulkQueued)))
+      return;
+  }
+}
+
+void TaskDispatcherImpl::TimerLoop() {
+  auto nextTick = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  unique_lock<mutex> lock(mTimerMutex);
+  while (!mStopping && !mPaused) {
+    if (mTimerWake.wait_until(lock, nextTick, [this]() { return mStopping || mPaused; }))
+      return;
+    nextTick += std::chrono::seconds(1);
+
+    mWheelCursor = (mWheelCursor + 1) % kWheelSlots;
+    vector<Task> due;
+    auto& slot = mWheel[mWheelCursor];
+    for (auto it = slot.begin(); it != slot.end();) {
+      if (it->rounds == 0) {
+        due.push_back(std::move(it->task));
+        it = slot.erase(it);
+      } else {
+        --it->rounds;
+        ++it;
+      }
+    }
+    mDelayed -= due.size();
+
+    lock.unlock();
+    for (auto& task : due)
+      Enqueue(std::move(task));
+    lock.lock();
+  }
+}
+
+} // namespace task
+} // namespace sample
@@ -0,0 +1,190 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_TASK_DISPATCHER_IMPL_H_
+#define SAMPLES_COMMON_TASK_DISPATCHER_IMPL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mip/task_dispatcher_delegate.h"
+#include "work_priority.h"
+
+namespace sample {
+namespace task {
+
+// Fixed-size work-stealing pool for the SDK's background tasks. Each worker owns a deque: tasks
+// dispatched from a worker stay on that worker, and idle workers steal from the front of the others.
+// Delayed tasks sit on a one-second timer wheel until due. One instance is meant to be shared by every
+// profile so SDK work never needs more threads than the CPU quota allows.
+//
+// Within each deque, tasks are kept in one lane per tenant (see tenant_context.h) and lanes take turns,
+// each running up to its tenant's weight of tasks per turn. A tenant's bulk job therefore delays another
+// tenant's engine load by at most a turn, however many tasks it has queued.
+//
+// Tasks are also split by priority (see work_priority.h). A worker runs every queued interactive task,
+// its own or stolen, before any bulk one, and the first reserved workers never run bulk tasks, so
+// interactive work always finds a free worker once the task it is running finishes.
+class TaskDispatcherImpl final : public mip::TaskDispatcherDelegate {
+public:
+  struct Stats {
+    size_t workers;
+    size_t queueDepth;
+    size_t delayed;
+    uint64_t executed;
+    uint64_t steals;
+    uint64_t cancelled;
+    size_t reservedWorkers;
+    size_t bulkQueueDepth;
+    uint64_t bulkExecuted;
+  };
+
+  // workerCount of 0 sizes the pool to the container's CPU quota.
+  explicit TaskDispatcherImpl(size_t workerCount = 0);
+  ~TaskDispatcherImpl();
+
+  void DispatchTask(const std::string& taskId, std::function<void()> task) override;
+  void DispatchTask(const std::string& taskId, std::function<void()> task, int64_t delaySeconds) override;
+  void ExecuteTaskOnIndependentThread(const std::string& taskId, std::function<void()> task) override;
+  bool CancelTask(const std::string& taskId) override;
+  void CancelAllTasks() override;
+
+  Stats GetStats() const;
+
+  // Tasks the tenant's lane runs per turn, at least 1, which is also the weight of tenants never set.
+  void SetTenantWeight(const std::string& tenant, int weight);
+
+  // Workers kept for interactive tasks, at most all but kMinWorkers so bulk tasks waiting on each other
+  // still progress. Defaults to a quarter of the workers.
+  void SetReservedWorkers(size_t reservedWorkers);
+
+  // Joins the workers and the timer once the tasks they run return, so the process can fork with no
+  // dispatcher thread holding a lock. Queued and delayed tasks stay queued. ResumeThreads starts the
+  // threads again, in the parent and the child alike.
+  void PauseThreads();
+  void ResumeThreads();
+
+  // No task queued or running. Delayed tasks and tasks on independent threads are not counted.
+  bool IsIdle() const { return mQueued == 0 && mRunning == 0; }
+
+  // Tasks waiting for a worker, without locking.
+  size_t GetQueueDepth() const { return mQueued; }
+
+  // CPUs granted by the cgroup (v2 cpu.max or v1 cfs quota), rounded up. Falls back to the core count.
+  static size_t GetCpuQuota();
+
+private:
+  struct Task {
+    std::string id;
+    std::string tenant;
+    int weight;
+    priority::Priority priority;
+    std::function<void()> run;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+  };
+
+  struct Lane {
+    std::string tenant;
+    int weight;
+    // Tasks left in the lane's current turn.
+    int credit;
+    std::deque<Task> tasks;
+  };
+
+  struct Lanes {
+    Lanes() : cursor(0) {}
+
+    std::vector<Lane> lanes;
+    size_t cursor;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    Lanes interactive;
+    Lanes bulk;
+    std::thread thread;
+  };
+
+  struct TimedTask {
+    uint64_t rounds;
+    Task task;
+  };
+
+  Task MakeTask(const std::string& taskId, std::function<void()> run);
+  void Enqueue(Task task);
+  bool TryPop(size_t index, Task& task);
+  bool TryPop(size_t index, Lanes Worker::*lanes, Task& task);
+  static bool PopLane(Lanes& lanes, bool newest, Task& task);
+  bool RunsBulk(size_t index) const { return index >= mReservedWorkers; }
+  void Run(Task& task);
+  void StartThreads();
+  void WorkerLoop(size_t index);
+  void TimerLoop();
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  std::mutex mIdleMutex;
+  std::condition_variable mIdle;
+  std::atomic<size_t> mQueued;
+  std::atomic<size_t> mBulkQueued;
+  std::atomic<size_t> mReservedWorkers;
+  std::atomic<size_t> mNextWorker;
+  std::atomic<bool> mStopping;
+  std::atomic<bool> mPaused;
+  // Workers popping or running a task.
+  std::atomic<size_t> mRunning;
+
+  mutable std::mutex mWeightMutex;
+  std::unordered_map<std::string, int> mWeights;
+
+  std::mutex mPendingMutex;
+  std::unordered_multimap<std::string, std::shared_ptr<std::atomic<bool>>> mPending;
+
+  std::mutex mTimerMutex;
+  std::condition_variable mTimerWake;
+  std::vector<std::vector<TimedTask>> mWheel;
+  size_t mWheelCursor;
+  std::atomic<size_t> mDelayed;
+  std::thread mTimer;
+
+  std::atomic<uint64_t> mExecuted;
+  std::atomic<uint64_t> mSteals;
+  std::atomic<uint64_t> mCancelled;
+  std::atomic<uint64_t> mBulkExecuted;
+};
+
+} // namespace task
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TASK_DISPATCHER_IMPL_H_
@@ -0,0 +1,57 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_TENANT_CONTEXT_H_
+#define SAMPLES_COMMON_TENANT_CONTEXT_H_
+
+#include <string>
+
+namespace sample {
+namespace tenant {
+
+// Tenant, i.e. the application id, of the operation running on this thread. Like the deadline, the task
+// dispatcher carries it onto the SDK's background work, where it schedules each tenant's tasks fairly
+// against the others'. Empty outside any tenant's operation.
+const std::string& Current();
+
+// Installs a tenant on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedTenant final {
+public:
+  explicit ScopedTenant(const std::string& tenant);
+  ~ScopedTenant();
+
+  ScopedTenant(const ScopedTenant&) = delete;
+  ScopedTenant& operator=(const ScopedTenant&) = delete;
+
+private:
+  std::string mPrevious;
+};
+
+} // namespace tenant
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TENANT_CONTEXT_H_
@@ -0,0 +1,233 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "token_acquirer.h"
+
+#include <atomic>
+#include <cctype>
+#include <stdexcept>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+
+using mip::CaseInsensitiveComparator;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using mip::TransportLayerSecurityMinimumVersion;
+using std::map;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace auth {
+
+namespace {
+
+typedef map<string, string, CaseInsensitiveComparator> HeaderMap;
+
+class TokenRequest final : public HttpRequest {
+public:
+  TokenRequest(const string& url, const string& body)
+      : mId(NextId()), mUrl(url), mBody(body.begin(), body.end()) {
+    mHeaders["Content-Type"] = "application/x-www-form-urlencoded";
+    mHeaders["Accept"] = "application/json";
+  }
+
+  const string& GetId() const override { return mId; }
+  HttpRequestType GetRequestType() const override { return HttpRequestType::Post; }
+  const string& GetUrl() const override { return mUrl; }
+  const vector<uint8_t>& GetBody() const override { return mBody; }
+  const HeaderMap& GetHeaders() const override { return mHeaders; }
+  TransportLayerSecurityMinimumVersion GetTransportLayerSecurityMinimumVersion() const override {
+    return TransportLayerSecurityMinimumVersion::TLS1_2;
+  }
+
+private:
+  static string NextId() {
+    static std::atomic<uint64_t> counter(0);
+    return "token-" + std::to_string(++counter);
+  }
+
+  string mId;
+  string mUrl;
+  vector<uint8_t> mBody;
+  HeaderMap mHeaders;
+};
+
+string UrlEncode(const string& value) {
+  static const char* kHex = "0123456789ABCDEF";
+  string encoded;
+  encoded.reserve(value.size());
+  for (unsigned char c : value) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded.push_back(static_cast<char>(c));
+    } else {
+      encoded.push_back('%');
+      encoded.push_back(kHex[c >> 4]);
+      encoded.push_back(kHex[c & 0x0F]);
+    }
+  }
+  return encoded;
+}
+
+// Reads a top-level string member from the token endpoint's flat JSON response.
+string GetJsonString(const string& json, const string& name) {
+  const string quoted = "\"" + name + "\"";
+  auto position = json.find(quoted);
+  if (position == string::npos)
+    return "";
+  position = json.find(':', position + quoted.size());
+  if (position == string::npos)
+    return "";
+  position = json.find('"', position + 1);
+  if (position == string::npos)
+    return "";
+
+  string value;
+  for (++position; position < json.size() && json[position] != '"'; ++position) {
+    char c = json[position];
+    if (c == '\\' && position + 1 < json.size()) {
+      c = json[++position];
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+          // Token endpoints only escape ASCII this way; anything wider is dropped.
+          if (position + 4 < json.size()) {
+            const int code = std::stoi(json.substr(position + 1, 4), nullptr, 16);
+            position += 4;
+            if (code >= 0x80)
+              continue;
+            c = static_cast<char>(code);
+          }
+          break;
+        default: break;
+      }
+    }
+    value.push_back(c);
+  }
+  return value;
+}
+
+string GetTokenEndpoint(const string& authority) {
+  if (authority.size() >= 5 && authority.compare(authority.size() - 5, 5, "token") == 0)
+    return authority;
+  if (!authority.empty() && authority.back() == '/')
+    return authority + "oauth2/token";
+  return authority + "/oauth2/token";
+}
+
+} // namespace
+
+TokenAcquirer::TokenAcquirer(const shared_ptr<mip::HttpDelegate>& httpDelegate)
+    : mHttpDelegate(httpDelegate) {
+  if (!mHttpDelegate)
+    throw std::invalid_argument("TokenAcquirer requires an HttpDelegate");
+}
+
+string TokenAcquirer::AcquireWithPassword(
+    const string& authority,
+    const string& resource,
+    const string& clientId,
+    const string& userName,
+    const string& password) {
+  return RequestToken(authority, {
+    { "grant_type", "password" },
+    { "resource", resource },
+    { "client_id", clientId },
+    { "username", userName },
+    { "password", password },
+  });
+}
+
+string TokenAcquirer::AcquireWithClientSecret(
+    const string& authority,
+    const string& resource,
+    const string& clientId,
+    const string& clientSecret) {
+  return RequestToken(authority, {
+    { "grant_type", "client_credentials" },
+    { "resource", resource },
+    { "client_id", clientId },
+    { "client_secret", clientSecret },
+  });
+}
+
+string TokenAcquirer::AcquireOnBehalfOf(
+    const string& authority,
+    const string& resource,
+    const string& clientId,
+    const string& clientSecret,
+    const string& userAssertion) {
+  return RequestToken(authority, {
+    { "grant_type", "urn:ietf:params:oauth:grant-type:jwt-bearer" },
+    { "requested_token_use", "on_behalf_of" },
+    { "resource", resource },
+    { "client_id", clientId },
+    { "client_secret", clientSecret },
+    { "assertion", userAssertion },
+  });
+}
+
+string TokenAcquirer::RequestToken(const string& authority, const map<string, string>& parameters) {
+  string body;
+  for (const auto& parameter : parameters) {
+    if (!body.empty())
+      body += '&';
+    body += UrlEncode(parameter.first) + '=' + UrlEncode(parameter.second);
+  }
+
+  const string endpoint = GetTokenEndpoint(authority);
+  auto operation = mHttpDelegate->Send(std::make_shared<TokenRequest>(endpoint, body), nullptr);
+  auto response = operation ? operation->GetResponse() : nullptr;
+  if (!response)
+    throw runtime_error("Token request to " + endpoint + " failed before a response was received");
+
+  const auto& responseBody = response->GetBody();
+  const string json(responseBody.begin(), responseBody.end());
+  const string accessToken = GetJsonString(json, "access_token");
+  if (response->GetStatusCode() == 200 && !accessToken.empty())
+    return accessToken;
+
+  string error = GetJsonString(json, "error_description");
+  if (error.empty())
+    error = GetJsonString(json, "error");
+  const int statusCode = response->GetStatusCode();
+  const string message = "Token request to " + endpoint + " failed with HTTP " + std::to_string(statusCode) +
+      (error.empty() ? "" : ": " + error);
+  if (statusCode >= 400 && statusCode < 500)
+    throw TokenRequestRejectedError(message);
+  throw runtime_error(message);
+}
+
+} // namespace auth
+} // namespace sample
@@ -0,0 +1,86 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_TOKEN_ACQUIRER_H_
+#define SAMPLES_COMMON_TOKEN_ACQUIRER_H_
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "mip/http_delegate.h"
+
+namespace sample {
+namespace auth {
+
+// Acquires tokens from the Azure AD v1 token endpoint (<authority>/oauth2/token) through an
+// HttpDelegate, so token requests reuse the same connection pool as the SDK's own traffic.
+// Failed requests throw std::runtime_error carrying the endpoint's error_description when present, and
+// TokenRequestRejectedError when the endpoint refused the request, e.g. for a wrong password.
+class TokenAcquirer final {
+public:
+  explicit TokenAcquirer(const std::shared_ptr<mip::HttpDelegate>& httpDelegate);
+
+  // Resource owner password grant, equivalent to auth.py.
+  std::string AcquireWithPassword(
+      const std::string& authority,
+      const std::string& resource,
+      const std::string& clientId,
+      const std::string& userName,
+      const std::string& password);
+
+  // Client credentials grant for an application identity.
+  std::string AcquireWithClientSecret(
+      const std::string& authority,
+      const std::string& resource,
+      const std::string& clientId,
+      const std::string& clientSecret);
+
+  // Exchanges a user token issued to clientId for a token to resource (on-behalf-of flow).
+  std::string AcquireOnBehalfOf(
+      const std::string& authority,
+      const std::string& resource,
+      const std::string& clientId,
+      const std::string& clientSecret,
+      const std::string& userAssertion);
+
+private:
+  std::string RequestToken(const std::string& authority, const std::map<std::string, std::string>& parameters);
+
+  std::shared_ptr<mip::HttpDelegate> mHttpDelegate;
+};
+
+// The token endpoint answered with a 4xx status. Retrying the same request elsewhere fails the same way.
+class TokenRequestRejectedError final : public std::runtime_error {
+public:
+  explicit TokenRequestRejectedError(const std::string& message) : std::runtime_error(message) {}
+};
+
+} // namespace auth
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TOKEN_ACQUIRER_H_
@@ -0,0 +1,252 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "token_cache.h"
+
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using sample::lock::InstrumentedMutex;
+using std::chrono::seconds;
+using std::chrono::system_clock;
+using std::lock_guard;
+using std::mutex;
+using std::promise;
+using std::shared_future;
+using std::string;
+
+namespace sample {
+namespace auth {
+
+namespace {
+
+// Lifetime assumed for tokens whose expiry cannot be read.
+const seconds kUnknownTokenLifetime(600);
+
+string DecodeBase64Url(const string& input) {
+  string output;
+  int value = 0;
+  int bits = -8;
+  for (char c : input) {
+    int digit;
+    if (c >= 'A' && c <= 'Z') digit = c - 'A';
+    else if (c >= 'a' && c <= 'z') digit = c - 'a' + 26;
+    else if (c >= '0' && c <= '9') digit = c - '0' + 52;
+    else if (c == '-' || c == '+') digit = 62;
+    else if (c == '_' || c == '/') digit = 63;
+    else break;
+    value = (value << 6) | digit;
+    bits += 6;
+    if (bits >= 0) {
+      output.push_back(static_cast<char>((value >> bits) & 0xFF));
+      bits -= 8;
+    }
+  }
+  return output;
+}
+
+} // namespace
+
+string TokenCache::Key::ToString() const {
+  return identity + '\x1f' + resource + '\x1f' + authority + '\x1f' + claims;
+}
+
+TokenCache& TokenCache::Shared() {
+  // Intentionally leaked: background refreshes may still be running at process exit.
+  static TokenCache* cache = new TokenCache();
+  return *cache;
+}
+
+TokenCache::TokenCache(seconds refreshWindow)
+    : mRefreshWindow(refreshWindow),
+      mHits(0),
+      mMisses(0),
+      mRefreshes(0),
+      mPrefetches(0) {
+}
+
+string TokenCache::GetToken(const Key& key, const Acquirer& acquire) {
+  const string keyString = key.ToString();
+  std::shared_ptr<promise<string>> acquisition;
+  {
+    std::unique_lock<InstrumentedMutex> lock(mMutex);
+    auto& entry = mEntries[keyString];
+    const auto now = system_clock::now();
+    if (!entry.token.empty() && now < entry.expiry) {
+      ++mHits;
+      if (now >= entry.expiry - mRefreshWindow && !entry.refreshing) {
+        entry.refreshing = true;
+        RefreshInBackground(keyString, acquire);
+      }
+      return entry.token;
+    }
+
+    if (entry.pending.valid()) {
+      auto pending = entry.pending;
+      lock.unlock();
+      return pending.get();
+    }
+
+    ++mMisses;
+    acquisition = std::make_shared<promise<string>>();
+    entry.pending = acquisition->get_future().share();
+  }
+
+  string token;
+  try {
+    token = acquire();
+  } catch (...) {
+    {
+      lock_guard<InstrumentedMutex> lock(mMutex);
+      mEntries[keyString].pending = shared_future<string>();
+    }
+    acquisition->set_exception(std::current_exception());
+    throw;
+  }
+  Store(keyString, token);
+  acquisition->set_value(token);
+  return token;
+}
+
+void TokenCache::Prefetch(const Key& key, const Acquirer& acquire) {
+  const string keyString = key.ToString();
+  auto acquisition = std::make_shared<promise<string>>();
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    auto& entry = mEntries[keyString];
+    if ((!entry.token.empty() && system_clock::now() < entry.expiry) || entry.pending.valid())
+      return;
+    ++mPrefetches;
+    entry.pending = acquisition->get_future().share();
+  }
+  std::thread([this, keyString, acquire, acquisition]() {
+    string token;
+    try {
+      token = acquire();
+    } catch (...) {
+      // Callers already waiting get the failure, as they would have sharing their own acquisition; the
+      // next caller tries again.
+      {
+        lock_guard<InstrumentedMutex> lock(mMutex);
+        mEntries[keyString].pending = shared_future<string>();
+      }
+      acquisition->set_exception(std::current_exception());
+      return;
+    }
+    Store(keyString, token);
+    acquisition->set_value(token);
+  }).detach();
+}
+
+void TokenCache::Invalidate(const Key& key) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  auto it = mEntries.find(key.ToString());
+  if (it != mEntries.end() && !it->second.pending.valid() && !it->second.refreshing)
+    mEntries.erase(it);
+  else if (it != mEntries.end())
+    it->second.token.clear();
+}
+
+void TokenCache::Clear() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  for (auto it = mEntries.begin(); it != mEntries.end();) {
+    // Entries with an acquisition in flight are kept so waiters still find their result.
+    if (it->second.pending.valid() || it->second.refreshing) {
+      it->second.token.clear();
+      ++it;
+    } else {
+      it = mEntries.erase(it);
+    }
+  }
+}
+
+TokenCache::Stats TokenCache::GetStats() const {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  Stats stats;
+  stats.hits = mHits;
+  stats.misses = mMisses;
+  stats.refreshes = mRefreshes;
+  stats.prefetches = mPrefetches;
+  stats.size = mEntries.size();
+  return stats;
+}
+
+system_clock::time_point TokenCache::GetExpiry(const string& token) {
+  auto first = token.find('.');
+  auto second = first == string::npos ? string::npos : token.find('.', first + 1);
+  if (second == string::npos)
+    return system_clock::time_point();
+
+  const string payload = DecodeBase64Url(token.substr(first + 1, second - first - 1));
+  auto claim = payload.find("\"exp\"");
+  if (claim == string::npos)
+    return system_clock::time_point();
+  auto position = payload.find(':', claim + 5);
+  if (position == string::npos)
+    return system_clock::time_point();
+  ++position;
+  while (position < payload.size() && isspace(static_cast<unsigned char>(payload[position])))
+    ++position;
+
+  int64_t exp = 0;
+  bool any = false;
+  while (position < payload.size() && isdigit(static_cast<unsigned char>(payload[position]))) {
+    exp = exp * 10 + (payload[position++] - '0');
+    any = true;
+  }
+  return any ? system_clock::time_point(seconds(exp)) : system_clock::time_point();
+}
+
+void TokenCache::Store(const string& key, const string& token) {
+  auto expiry = GetExpiry(token);
+  if (expiry == system_clock::time_point())
+    expiry = system_clock::now() + kUnknownTokenLifetime;
+
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  auto& entry = mEntries[key];
+  entry.token = token;
+  entry.expiry = expiry;
+  entry.refreshing = false;
+  entry.pending = shared_future<string>();
+}
+
+void TokenCache::RefreshInBackground(const string& key, const Acquirer& acquire) {
+  ++mRefreshes;
+  std::thread([this, key, acquire]() {
+    try {
+      Store(key, acquire());
+    } catch (...) {
+      // Keep serving the current token until it expires; the next caller inside the window retries.
+      lock_guard<InstrumentedMutex> lock(mMutex);
+      mEntries[key].refreshing = false;
+    }
+  }).detach();
+}
+
+} // namespace auth
+} // namespace sample
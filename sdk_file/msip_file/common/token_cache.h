@@ -0,0 +1,109 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_TOKEN_CACHE_H_
+#define SAMPLES_COMMON_TOKEN_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "instrumented_mutex.h"
+
+namespace sample {
+namespace auth {
+
+// Process-wide cache of OAuth access tokens keyed by (identity, resource, authority, claims). Expiry is
+// read from the JWT exp claim. A token inside the refresh window is still returned while a single
+// background refresh replaces it, so callers only block when there is no usable token at all, and
+// concurrent callers for the same key share one acquisition.
+class TokenCache final {
+public:
+  struct Key {
+    std::string identity;
+    std::string resource;
+    std::string authority;
+    std::string claims;
+
+    std::string ToString() const;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refreshes;
+    uint64_t prefetches;
+    size_t size;
+  };
+
+  // Fetches a new token. Kept for background refreshes, so it must own everything it captures.
+  typedef std::function<std::string()> Acquirer;
+
+  static TokenCache& Shared();
+
+  explicit TokenCache(std::chrono::seconds refreshWindow = std::chrono::seconds(300));
+
+  std::string GetToken(const Key& key, const Acquirer& acquire);
+
+  // Starts acquiring the token for key on a thread of its own, unless a usable token or an acquisition
+  // is already there, and returns at once. A GetToken for key meanwhile waits for that acquisition.
+  void Prefetch(const Key& key, const Acquirer& acquire);
+
+  void Invalidate(const Key& key);
+  void Clear();
+  Stats GetStats() const;
+
+  // Expiry from the token's exp claim, or the epoch when the token is not a JWT or carries no exp.
+  static std::chrono::system_clock::time_point GetExpiry(const std::string& token);
+
+private:
+  struct Entry {
+    std::string token;
+    std::chrono::system_clock::time_point expiry;
+    bool refreshing = false;
+    std::shared_future<std::string> pending;
+  };
+
+  void Store(const std::string& key, const std::string& token);
+  void RefreshInBackground(const std::string& key, const Acquirer& acquire);
+
+  const std::chrono::seconds mRefreshWindow;
+  mutable sample::lock::InstrumentedMutex mMutex{"token"};
+  std::unordered_map<std::string, Entry> mEntries;
+  uint64_t mHits;
+  uint64_t mMisses;
+  uint64_t mRefreshes;
+  uint64_t mPrefetches;
+};
+
+} // namespace auth
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TOKEN_CACHE_H_
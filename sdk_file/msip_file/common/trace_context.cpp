@@ -0,0 +1,115 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "trace_context.h"
+
+#include <cstdint>
+#include <random>
+
+using std::string;
+
+namespace sample {
+namespace trace {
+
+namespace {
+
+thread_local TraceContext tCurrent;
+
+bool IsLowerHex(const string& value, size_t offset, size_t length) {
+  bool allZero = true;
+  for (size_t i = offset; i < offset + length; ++i) {
+    const char c = value[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+      return false;
+    allZero = allZero && c == '0';
+  }
+  // All-zero trace and parent ids are invalid by spec.
+  return !allZero;
+}
+
+} // namespace
+
+TraceContext TraceContext::Parse(const string& traceparent) {
+  // version(2) - trace-id(32) - parent-id(16) - flags(2)
+  static const size_t kLength = 55;
+  TraceContext context;
+  if (traceparent.size() < kLength || traceparent[2] != '-' || traceparent[35] != '-' || traceparent[52] != '-')
+    return context;
+  const string version = traceparent.substr(0, 2);
+  if (version == "ff" || version.find_first_not_of("0123456789abcdef") != string::npos)
+    return context;
+  // Version 00 is exactly 55 characters; later versions may append fields after another dash.
+  if (traceparent.size() > kLength && (version == "00" || traceparent[kLength] != '-'))
+    return context;
+  if (!IsLowerHex(traceparent, 3, 32) || !IsLowerHex(traceparent, 36, 16))
+    return context;
+  const string flags = traceparent.substr(53, 2);
+  if (flags.find_first_not_of("0123456789abcdef") != string::npos)
+    return context;
+
+  context.traceId = traceparent.substr(3, 32);
+  context.spanId = traceparent.substr(36, 16);
+  context.sampled = (std::stoi(flags, nullptr, 16) & 0x01) != 0;
+  return context;
+}
+
+string TraceContext::ToTraceparent() const {
+  if (!IsValid())
+    return string();
+  return "00-" + traceId + "-" + spanId + (sampled ? "-01" : "-00");
+}
+
+const TraceContext& TraceContext::Current() {
+  return tCurrent;
+}
+
+void TraceContext::SetCurrent(const TraceContext& context) {
+  tCurrent = context;
+}
+
+string TraceContext::NewSpanId() {
+  static const char kDigits[] = "0123456789abcdef";
+  thread_local std::mt19937_64 generator(std::random_device{}());
+  uint64_t value = 0;
+  while (value == 0)
+    value = generator();
+  string id(16, '0');
+  for (size_t i = 0; i < id.size(); ++i, value >>= 4)
+    id[id.size() - 1 - i] = kDigits[value & 0x0f];
+  return id;
+}
+
+ScopedTraceContext::ScopedTraceContext(const TraceContext& context)
+    : mPrevious(TraceContext::Current()) {
+  TraceContext::SetCurrent(context);
+}
+
+ScopedTraceContext::~ScopedTraceContext() {
+  TraceContext::SetCurrent(mPrevious);
+}
+
+} // namespace trace
+} // namespace sample
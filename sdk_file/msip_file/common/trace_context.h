@@ -0,0 +1,74 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_TRACE_CONTEXT_H_
+#define SAMPLES_COMMON_TRACE_CONTEXT_H_
+
+#include <string>
+
+namespace sample {
+namespace trace {
+
+// W3C trace context (https://www.w3.org/TR/trace-context/) for the operation running on this thread.
+// Callers set it from an incoming traceparent header; the task dispatcher carries it onto the SDK's
+// background work so HTTP calls made on a caller's behalf can be attributed to its trace.
+struct TraceContext {
+  std::string traceId;  // 32 lowercase hex digits
+  std::string spanId;   // 16 lowercase hex digits
+  bool sampled = false;
+  // SDK log records of this operation are written whatever the log level (see AsyncLoggerDelegate).
+  bool verbose = false;
+
+  bool IsValid() const { return !traceId.empty() && !spanId.empty(); }
+
+  // "00-<trace-id>-<parent-id>-<flags>". Returns an invalid context for anything malformed.
+  static TraceContext Parse(const std::string& traceparent);
+  std::string ToTraceparent() const;
+
+  static const TraceContext& Current();
+  static void SetCurrent(const TraceContext& context);
+
+  // A random, non-zero span id.
+  static std::string NewSpanId();
+};
+
+// Installs a context on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedTraceContext final {
+public:
+  explicit ScopedTraceContext(const TraceContext& context);
+  ~ScopedTraceContext();
+
+  ScopedTraceContext(const ScopedTraceContext&) = delete;
+  ScopedTraceContext& operator=(const ScopedTraceContext&) = delete;
+
+private:
+  TraceContext mPrevious;
+};
+
+} // namespace trace
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TRACE_CONTEXT_H_
@@ -0,0 +1,289 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "tracing_http_delegate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+#include "mip/http_operation.h"
+#include "mip/http_request.h"
+#include "mip/http_response.h"
+
+#include "operation_log.h"
+#include "trace_context.h"
+
+using mip::HttpOperation;
+using mip::HttpRequest;
+using mip::HttpRequestType;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace http {
+
+namespace {
+
+int64_t NowUnixNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Splits an absolute URL into host and path, dropping credentials, port, query and fragment so
+// tokens and document identifiers in query strings never reach the trace backend.
+void SplitUrl(const string& url, string& host, string& path) {
+  auto start = url.find("://");
+  start = start == string::npos ? 0 : start + 3;
+  auto pathStart = url.find_first_of("/?#", start);
+  host = url.substr(start, pathStart == string::npos ? string::npos : pathStart - start);
+  auto credentials = host.rfind('@');
+  if (credentials != string::npos)
+    host = host.substr(credentials + 1);
+  auto port = host.rfind(':');
+  if (port != string::npos && host.find(']', port) == string::npos)
+    host = host.substr(0, port);
+
+  path = "/";
+  if (pathStart != string::npos && url[pathStart] == '/') {
+    auto pathEnd = url.find_first_of("?#", pathStart);
+    path = url.substr(pathStart, pathEnd == string::npos ? string::npos : pathEnd - pathStart);
+  }
+}
+
+// A request made for an operation whose log is current, added to the log when it completes.
+class LoggedRequest final {
+public:
+  explicit LoggedRequest(const shared_ptr<HttpRequest>& request)
+      : mLog(oplog::OperationLog::Current()) {
+    if (!mLog)
+      return;
+    string host;
+    string path;
+    SplitUrl(request->GetUrl(), host, path);
+    mName = string(request->GetRequestType() == HttpRequestType::Post ? "POST " : "GET ") + host + path;
+    mStart = oplog::OperationLog::Clock::now();
+  }
+
+  bool IsLogged() const { return mLog != nullptr; }
+
+  void End(const shared_ptr<HttpOperation>& operation, const string& error) const {
+    if (!mLog)
+      return;
+    string detail = error;
+    if (operation && operation->IsCancelled())
+      detail = "cancelled";
+    else if (auto response = operation ? operation->GetResponse() : nullptr)
+      detail = std::to_string(response->GetStatusCode());
+    else if (detail.empty())
+      detail = "no response";
+    mLog->Add("http", mName, mStart, oplog::OperationLog::Clock::now(), detail);
+  }
+
+private:
+  shared_ptr<oplog::OperationLog> mLog;
+  string mName;
+  oplog::OperationLog::Clock::time_point mStart;
+};
+
+} // namespace
+
+struct TracingHttpDelegate::State {
+  mutex spansMutex;
+  size_t capacity;
+  std::unordered_map<string, HttpSpan> pending;
+  std::deque<HttpSpan> finished;
+  uint64_t recorded = 0;
+  uint64_t dropped = 0;
+
+  void OnTransfer(const string& requestId, const HttpDelegateImpl::TransferInfo& info) {
+    lock_guard<mutex> lock(spansMutex);
+    auto it = pending.find(requestId);
+    if (it == pending.end())
+      return;
+    auto& span = it->second;
+    span.nameLookupMicros = info.nameLookupMicros;
+    span.connectMicros = info.connectMicros;
+    span.tlsMicros = info.tlsMicros;
+    span.firstByteMicros = info.firstByteMicros;
+    span.bytesSent = info.bytesSent;
+    span.bytesReceived = info.bytesReceived;
+  }
+
+  void End(const string& requestId, const shared_ptr<HttpOperation>& operation, const string& error) {
+    const auto end = NowUnixNanos();
+    lock_guard<mutex> lock(spansMutex);
+    auto it = pending.find(requestId);
+    if (it == pending.end())
+      return;
+    HttpSpan span = std::move(it->second);
+    pending.erase(it);
+    span.endUnixNanos = end;
+    span.error = error;
+    if (operation) {
+      span.cancelled = operation->IsCancelled();
+      auto response = span.cancelled ? nullptr : operation->GetResponse();
+      if (response)
+        span.statusCode = response->GetStatusCode();
+      else if (!span.cancelled && span.error.empty())
+        span.error = "no response";
+    }
+    ++recorded;
+    if (capacity == 0) {
+      ++dropped;
+      return;
+    }
+    while (finished.size() >= capacity) {
+      finished.pop_front();
+      ++dropped;
+    }
+    finished.push_back(std::move(span));
+  }
+};
+
+TracingHttpDelegate::TracingHttpDelegate(const shared_ptr<HttpDelegateImpl>& inner, size_t capacity)
+    : mInner(inner),
+      mState(std::make_shared<State>()) {
+  mState->capacity = capacity;
+  std::weak_ptr<State> weakState = mState;
+  mInner->SetTransferListener([weakState](const string& requestId, const HttpDelegateImpl::TransferInfo& info) {
+    if (auto state = weakState.lock())
+      state->OnTransfer(requestId, info);
+  });
+}
+
+TracingHttpDelegate::~TracingHttpDelegate() {
+  mInner->SetTransferListener(nullptr);
+}
+
+bool TracingHttpDelegate::Begin(const shared_ptr<HttpRequest>& request) {
+  const auto& context = trace::TraceContext::Current();
+  if (!context.IsValid() || !context.sampled)
+    return false;
+
+  HttpSpan span;
+  span.traceId = context.traceId;
+  span.parentSpanId = context.spanId;
+  span.spanId = trace::TraceContext::NewSpanId();
+  span.method = request->GetRequestType() == HttpRequestType::Post ? "POST" : "GET";
+  span.name = "HTTP " + span.method;
+  SplitUrl(request->GetUrl(), span.host, span.path);
+  span.startUnixNanos = NowUnixNanos();
+
+  lock_guard<mutex> lock(mState->spansMutex);
+  if (mState->capacity == 0)
+    return false;
+  mState->pending[request->GetId()] = std::move(span);
+  return true;
+}
+
+shared_ptr<HttpOperation> TracingHttpDelegate::Send(
+    const shared_ptr<HttpRequest>& request,
+    const shared_ptr<void>& context) {
+  const LoggedRequest logged(request);
+  const bool traced = Begin(request);
+  if (!traced && !logged.IsLogged())
+    return mInner->Send(request, context);
+  try {
+    auto operation = mInner->Send(request, context);
+    if (traced)
+      mState->End(request->GetId(), operation, string());
+    logged.End(operation, string());
+    return operation;
+  } catch (const std::exception& ex) {
+    if (traced)
+      mState->End(request->GetId(), nullptr, ex.what());
+    logged.End(nullptr, ex.what());
+    throw;
+  }
+}
+
+shared_ptr<HttpOperation> TracingHttpDelegate::SendAsync(
+    const shared_ptr<HttpRequest>& request,
+    const shared_ptr<void>& context,
+    const function<void(shared_ptr<HttpOperation>)>& callbackFn) {
+  const LoggedRequest logged(request);
+  const bool traced = Begin(request);
+  if (!traced && !logged.IsLogged())
+    return mInner->SendAsync(request, context, callbackFn);
+  auto state = traced ? mState : nullptr;
+  const auto requestId = request->GetId();
+  try {
+    return mInner->SendAsync(request, context, [state, requestId, logged, callbackFn](shared_ptr<HttpOperation> operation) {
+      if (state)
+        state->End(requestId, operation, string());
+      logged.End(operation, string());
+      callbackFn(operation);
+    });
+  } catch (const std::exception& ex) {
+    if (state)
+      state->End(requestId, nullptr, ex.what());
+    logged.End(nullptr, ex.what());
+    throw;
+  }
+}
+
+void TracingHttpDelegate::CancelOperation(const string& requestId) {
+  mInner->CancelOperation(requestId);
+}
+
+void TracingHttpDelegate::CancelAllOperations() {
+  mInner->CancelAllOperations();
+}
+
+void TracingHttpDelegate::SetCapacity(size_t capacity) {
+  lock_guard<mutex> lock(mState->spansMutex);
+  mState->capacity = capacity;
+  while (mState->finished.size() > capacity) {
+    mState->finished.pop_front();
+    ++mState->dropped;
+  }
+}
+
+vector<HttpSpan> TracingHttpDelegate::TakeSpans(size_t maxCount) {
+  lock_guard<mutex> lock(mState->spansMutex);
+  const size_t count = std::min(maxCount, mState->finished.size());
+  vector<HttpSpan> spans(std::make_move_iterator(mState->finished.begin()),
+                         std::make_move_iterator(mState->finished.begin() + count));
+  mState->finished.erase(mState->finished.begin(), mState->finished.begin() + count);
+  return spans;
+}
+
+TracingHttpDelegate::Stats TracingHttpDelegate::GetStats() const {
+  lock_guard<mutex> lock(mState->spansMutex);
+  Stats stats;
+  stats.recorded = mState->recorded;
+  stats.dropped = mState->dropped;
+  stats.buffered = mState->finished.size();
+  return stats;
+}
+
+} // namespace http
+} // namespace sample
@@ -0,0 +1,119 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLES_COMMON_TRACING_HTTP_DELEGATE_H_
+#define SAMPLES_COMMON_TRACING_HTTP_DELEGATE_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mip/http_delegate.h"
+
+#include "http_delegate_impl.h"
+
+namespace sample {
+namespace http {
+
+// One SDK HTTP request as a client span. Times are Unix nanoseconds; phase offsets are microseconds
+// from the start of the transfer, or -1 when libcurl did not report them.
+struct HttpSpan {
+  std::string traceId;
+  std::string spanId;
+  std::string parentSpanId;
+  std::string name;
+  std::string method;
+  std::string host;
+  std::string path;
+  int32_t statusCode = 0;
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+  int64_t startUnixNanos = 0;
+  int64_t endUnixNanos = 0;
+  int64_t nameLookupMicros = -1;
+  int64_t connectMicros = -1;
+  int64_t tlsMicros = -1;
+  int64_t firstByteMicros = -1;
+  bool cancelled = false;
+  std::string error;
+};
+
+// Decorates the SDK-facing HTTP delegate and records a span for every request made while a sampled
+// trace context is current (see trace_context.h). Spans are kept in a bounded buffer until drained, so
+// an exporter that stops draining costs memory for at most `capacity` spans. Requests made without a
+// trace context pass straight through.
+class TracingHttpDelegate final : public mip::HttpDelegate {
+public:
+  struct Stats {
+    uint64_t recorded;
+    uint64_t dropped;
+    size_t buffered;
+  };
+
+  // Installs itself as inner's transfer listener.
+  TracingHttpDelegate(const std::shared_ptr<HttpDelegateImpl>& inner, size_t capacity);
+  ~TracingHttpDelegate();
+
+  std::shared_ptr<mip::HttpOperation> Send(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context) override;
+
+  std::shared_ptr<mip::HttpOperation> SendAsync(
+      const std::shared_ptr<mip::HttpRequest>& request,
+      const std::shared_ptr<void>& context,
+      const std::function<void(std::shared_ptr<mip::HttpOperation>)>& callbackFn) override;
+
+  void CancelOperation(const std::string& requestId) override;
+
+  void CancelAllOperations() override;
+
+  // 0 disables recording. Shrinking drops the oldest buffered spans.
+  void SetCapacity(size_t capacity);
+
+  // Removes and returns up to maxCount finished spans, oldest first.
+  std::vector<HttpSpan> TakeSpans(size_t maxCount);
+
+  Stats GetStats() const;
+
+private:
+  // Shared with the inner delegate's listener and in-flight callbacks, which may outlive this object.
+  struct State;
+
+  bool Begin(const std::shared_ptr<mip::HttpRequest>& request);
+
+  std::shared_ptr<HttpDelegateImpl> mInner;
+  std::shared_ptr<State> mState;
+};
+
+} // namespace http
+} // namespace sample
+
+#endif // SAMPLES_COMMON_TRACING_HTTP_DELEGATE_H_
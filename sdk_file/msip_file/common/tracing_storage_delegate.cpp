@@ -0,0 +1,153 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "tracing_storage_delegate.h"
+
+#include <stdexcept>
+
+#include "operation_log.h"
+
+using sample::oplog::OperationLog;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace sample {
+namespace storage {
+
+namespace {
+
+// Logs one table call as "<table>.<call>" with the rows it returned, or "failed" if it threw.
+class ScopedTableCall final {
+public:
+  ScopedTableCall(const string& table, const char* call)
+      : mLog(OperationLog::Current()),
+        mStart(mLog ? OperationLog::Clock::now() : OperationLog::Clock::time_point()),
+        mTable(table),
+        mCall(call),
+        mDetail("failed") {
+  }
+
+  ~ScopedTableCall() {
+    if (mLog)
+      mLog->Add("storage", mTable + "." + mCall, mStart, OperationLog::Clock::now(), mDetail);
+  }
+
+  ScopedTableCall(const ScopedTableCall&) = delete;
+  ScopedTableCall& operator=(const ScopedTableCall&) = delete;
+
+  void Done() { mDetail.clear(); }
+
+  vector<vector<string>> Done(vector<vector<string>> rows) {
+    if (mLog)
+      mDetail = std::to_string(rows.size()) + " rows";
+    return rows;
+  }
+
+private:
+  const shared_ptr<OperationLog> mLog;
+  const OperationLog::Clock::time_point mStart;
+  const string& mTable;
+  const char* mCall;
+  string mDetail;
+};
+
+class TracingTable final : public mip::StorageTable {
+public:
+  TracingTable(const shared_ptr<mip::StorageTable>& inner, const string& name)
+      : mInner(inner),
+        mName(name) {
+  }
+
+  void InsertOrReplace(const vector<string>& allColumnValues) override {
+    ScopedTableCall call(mName, "insert");
+    mInner->InsertOrReplace(allColumnValues);
+    call.Done();
+  }
+
+  vector<vector<string>> List() override {
+    ScopedTableCall call(mName, "list");
+    return call.Done(mInner->List());
+  }
+
+  void Update(
+      const vector<string>& updateColumns,
+      const vector<string>& updateValues,
+      const vector<string>& queryColumns,
+      const vector<string>& queryValues) override {
+    ScopedTableCall call(mName, "update");
+    mInner->Update(updateColumns, updateValues, queryColumns, queryValues);
+    call.Done();
+  }
+
+  void Delete(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    ScopedTableCall call(mName, "delete");
+    mInner->Delete(queryColumns, queryValues);
+    call.Done();
+  }
+
+  vector<vector<string>> Find(const vector<string>& queryColumns, const vector<string>& queryValues) override {
+    ScopedTableCall call(mName, "find");
+    return call.Done(mInner->Find(queryColumns, queryValues));
+  }
+
+private:
+  shared_ptr<mip::StorageTable> mInner;
+  string mName;
+};
+
+} // namespace
+
+TracingStorageDelegate::TracingStorageDelegate(const shared_ptr<mip::StorageDelegate>& inner)
+    : mInner(inner) {
+  if (!mInner)
+    throw std::invalid_argument("Storage tracing needs a delegate to forward to");
+}
+
+mip::StorageTableResult TracingStorageDelegate::CreateStorageTable(
+    const string& path,
+    const mip::MipComponent mipComponent,
+    const string& tableName,
+    const vector<string>& allColumns,
+    const vector<string>& encryptedColumns,
+    const vector<string>& keyColumns) const {
+  auto result = mInner->CreateStorageTable(path, mipComponent, tableName, allColumns, encryptedColumns, keyColumns);
+  auto table = result.GetData();
+  if (!table)
+    return result;
+  try {
+    return mip::StorageTableResult(std::static_pointer_cast<mip::StorageTable>(std::make_shared<TracingTable>(table, tableName)));
+  } catch (...) {
+    return mip::StorageTableResult(std::current_exception());
+  }
+}
+
+mip::StorageDelegate::StorageSettings TracingStorageDelegate::GetSettings() const {
+  return mInner->GetSettings();
+}
+
+} // namespace storage
+} // namespace sample
@@ -0,0 +1,62 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_COMMON_WORK_PRIORITY_H_
+#define SAMPLES_COMMON_WORK_PRIORITY_H_
+
+namespace sample {
+namespace priority {
+
+// Scheduling class of the operation running on this thread, chosen by the caller through msipSetPriority.
+// Like the tenant, the task dispatcher carries it onto the SDK's background work, where interactive tasks
+// run before bulk ones and some workers never run bulk work at all.
+enum class Priority {
+  Interactive = 0,
+  Bulk = 1,
+};
+
+// Interactive unless set on this thread.
+Priority Current();
+void SetCurrent(Priority priority);
+
+// Installs a priority on this thread for the lifetime of the scope, then restores the previous one.
+class ScopedPriority final {
+public:
+  explicit ScopedPriority(Priority priority);
+  ~ScopedPriority();
+
+  ScopedPriority(const ScopedPriority&) = delete;
+  ScopedPriority& operator=(const ScopedPriority&) = delete;
+
+private:
+  Priority mPrevious;
+};
+
+} // namespace priority
+} // namespace sample
+
+#endif // SAMPLES_COMMON_WORK_PRIORITY_H_
@@ -27,24 +27,105 @@
 
 #include "consent_delegate_impl.h"
 
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <thread>
 
 using mip::Consent;
+using std::lock_guard;
+using std::mutex;
 using std::runtime_error;
 using std::string;
+using std::vector;
 
 namespace sample {
 namespace consent {
 
+namespace {
+
+string ToLower(string value) {
+  std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return value;
+}
+
+// Whether host is allowedHost or one of its subdomains.
+bool MatchesHost(const string& host, const string& allowedHost) {
+  if (host.size() == allowedHost.size())
+    return host == allowedHost;
+  return host.size() > allowedHost.size() &&
+      host.compare(host.size() - allowedHost.size(), allowedHost.size(), allowedHost) == 0 &&
+      host[host.size() - allowedHost.size() - 1] == '.';
+}
+
+} // namespace
+
 Consent ConsentDelegateImpl::GetUserConsent(const string& url) {
-  if (mIsVerbose) {
+  Consent consent;
+  bool decided = false;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mDecisions.find(url);
+    if (it == mDecisions.end()) {
+      it = mDecisions.emplace(url, Decide(url)).first;
+      decided = true;
+    }
+    consent = it->second;
+  }
+
+  if (mIsVerbose && decided) {
     std::cout << "CONSENT DELEGATE" <<
         "\n\tThread ID: " << std::this_thread::get_id() <<
-        "\n\tURL: " << url << std::endl;
+        "\n\tURL: " << url <<
+        "\n\tConsent: " << (consent == Consent::Reject ? "reject" : "accept") << std::endl;
   }
+  return consent;
+}
 
-  return Consent::AcceptAlways;
+void ConsentDelegateImpl::SetPolicy(const vector<string>& allowedHosts, bool rejectOthers) {
+  vector<string> hosts;
+  for (const auto& host : allowedHosts) {
+    auto lowerHost = ToLower(host);
+    // "*.example.com" reads as "example.com and its subdomains", which is what every entry means.
+    if (lowerHost.compare(0, 2, "*.") == 0)
+      lowerHost.erase(0, 2);
+    if (!lowerHost.empty())
+      hosts.push_back(lowerHost);
+  }
+  lock_guard<mutex> lock(mMutex);
+  mAllowedHosts.swap(hosts);
+  mRejectOthers = rejectOthers;
+  mDecisions.clear();
+}
+
+size_t ConsentDelegateImpl::GetDecisionCount() const {
+  lock_guard<mutex> lock(mMutex);
+  return mDecisions.size();
+}
+
+string ConsentDelegateImpl::GetHost(const string& url) {
+  auto begin = url.find("://");
+  begin = begin == string::npos ? 0 : begin + 3;
+  auto end = url.find_first_of("/?#", begin);
+  string authority = url.substr(begin, end == string::npos ? string::npos : end - begin);
+  const auto at = authority.rfind('@');
+  if (at != string::npos)
+    authority.erase(0, at + 1);
+  const auto colon = authority.find(':');
+  if (colon != string::npos)
+    authority.erase(colon);
+  return ToLower(authority);
+}
+
+Consent ConsentDelegateImpl::Decide(const string& url) const {
+  if (!mRejectOthers)
+    return Consent::AcceptAlways;
+  const string host = GetHost(url);
+  for (const auto& allowedHost : mAllowedHosts) {
+    if (MatchesHost(host, allowedHost))
+      return Consent::AcceptAlways;
+  }
+  return Consent::Reject;
 }
 
 } // namespace consent
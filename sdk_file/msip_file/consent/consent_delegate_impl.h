@@ -30,19 +30,41 @@
 
 #include "mip/common_types.h"
 
+#include <cstddef>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace sample {
 namespace consent {
 
+// Decides consent once per URL and remembers it, so profiles sharing one delegate are not asked again.
+// Hosts on the allowlist, and their subdomains, are always accepted; other hosts are accepted too unless
+// rejectOthers is set.
 class ConsentDelegateImpl final : public mip::ConsentDelegate {
 public:
-  ConsentDelegateImpl(bool isVerbose) : mIsVerbose(isVerbose) {}
+  ConsentDelegateImpl(bool isVerbose) : mIsVerbose(isVerbose), mRejectOthers(false) {}
   mip::Consent GetUserConsent(const std::string& url) override;
 
+  // Replaces the policy and forgets earlier decisions. Profiles already loaded keep what they were told.
+  void SetPolicy(const std::vector<std::string>& allowedHosts, bool rejectOthers);
+
+  // URLs decided so far.
+  size_t GetDecisionCount() const;
+
+  // Lower-cased host of url, without user info or port.
+  static std::string GetHost(const std::string& url);
+
 private:
+  mip::Consent Decide(const std::string& url) const;
+
   bool mIsVerbose;
+  mutable std::mutex mMutex;
+  std::vector<std::string> mAllowedHosts;
+  bool mRejectOthers;
+  std::unordered_map<std::string, mip::Consent> mDecisions;
 };
 
 } // namespace sample
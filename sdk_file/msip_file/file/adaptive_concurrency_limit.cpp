@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "adaptive_concurrency_limit.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Weight of a sample in the smoothed latency, about the last ten samples'.
+const double kLatencySmoothing = 0.2;
+// Weight of a sample's new limit in the limit, so a single slow operation does not halve it.
+const double kLimitSmoothing = 0.2;
+// The most a sample may scale the limit down by.
+const double kMinGradient = 0.5;
+// Samples under the probe limit whose mean is the minimum latency.
+const size_t kProbeSamples = 10;
+
+} // namespace
+
+AdaptiveConcurrencyLimit::AdaptiveConcurrencyLimit(const Options& options)
+    : mOptions(options),
+      mLatency(0),
+      mMinimumLatency(0),
+      mSamplesUntilProbe(0),
+      mProbing(false),
+      mProbeLimit(0),
+      mProbeSum(0),
+      mProbeSamples(0) {
+  mOptions.minLimit = std::max<size_t>(mOptions.minLimit, 1);
+  mOptions.maxLimit = std::max(mOptions.maxLimit, mOptions.minLimit);
+  mOptions.tolerance = std::max(mOptions.tolerance, 1.0);
+  mLimit = static_cast<double>(std::min(std::max(mOptions.initialLimit, mOptions.minLimit), mOptions.maxLimit));
+  StartProbe();
+}
+
+void AdaptiveConcurrencyLimit::StartProbe() {
+  mProbing = true;
+  mProbeLimit = std::max(mOptions.minLimit, static_cast<size_t>(mLimit / (2 * mOptions.tolerance)));
+  mProbeSum = 0;
+  mProbeSamples = 0;
+}
+
+void AdaptiveConcurrencyLimit::OnSample(int64_t latencyMicros, size_t inFlight) {
+  const double sample = static_cast<double>(std::max<int64_t>(latencyMicros, 1));
+  mLatency = mLatency == 0 ? sample : mLatency + kLatencySmoothing * (sample - mLatency);
+  if (mProbing) {
+    // Operations admitted before the probe began ran under the old limit.
+    if (inFlight > mProbeLimit)
+      return;
+    mProbeSum += sample;
+    if (++mProbeSamples < kProbeSamples)
+      return;
+    mMinimumLatency = mProbeSum / mProbeSamples;
+    mLatency = mMinimumLatency;
+    mProbing = false;
+    mSamplesUntilProbe = mOptions.minimumWindow;
+    return;
+  }
+  if (mOptions.minimumWindow > 0 && --mSamplesUntilProbe == 0) {
+    StartProbe();
+    return;
+  }
+
+  const double gradient = std::max(kMinGradient, std::min(1.0, mOptions.tolerance * mMinimumLatency / mLatency));
+  double limit = mLimit * gradient;
+  if (gradient == 1.0 && inFlight * 2 >= static_cast<size_t>(mLimit))
+    limit += std::sqrt(mLimit);
+  limit = mLimit + kLimitSmoothing * (limit - mLimit);
+  mLimit = std::min(std::max(limit, static_cast<double>(mOptions.minLimit)), static_cast<double>(mOptions.maxLimit));
+}
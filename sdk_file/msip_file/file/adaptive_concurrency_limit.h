@@ -0,0 +1,84 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ADAPTIVE_CONCURRENCY_LIMIT_H_
+#define SAMPLE_FILE_ADAPTIVE_CONCURRENCY_LIMIT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// A concurrency limit learned from the latency of the operations it admits, in the manner of gradient
+// limiters. The latency without queueing is measured by probing: the limit drops to a fraction of itself
+// until enough operations complete under it, and their mean latency becomes the minimum. Latency is then
+// smoothed over the last few samples. While it stays within tolerance times the minimum, the limit grows by
+// about the square root of itself per sample; beyond it, the limit is scaled down by how far latency rose,
+// at most by half at once. It settles where the growth and the shrinking balance, just above the
+// concurrency the services, the disk and the CPU sustain without queueing. Probing again every
+// minimumWindow samples lets the limit follow conditions as they change. The probe limit is the limit
+// divided by twice the tolerance, so a minimum measured while still queueing keeps the limit from growing
+// instead of ratcheting it up. Not thread-safe: callers serialize.
+class AdaptiveConcurrencyLimit final {
+public:
+  struct Options {
+    size_t initialLimit;
+    size_t minLimit;
+    size_t maxLimit;
+    // Multiple of the minimum latency still taken as no queueing; at least 1.
+    double tolerance;
+    // Samples between probes; 0 probes only once.
+    size_t minimumWindow;
+  };
+
+  explicit AdaptiveConcurrencyLimit(const Options& options);
+
+  size_t GetLimit() const { return mProbing ? mProbeLimit : static_cast<size_t>(mLimit); }
+  bool IsProbing() const { return mProbing; }
+  // 0 until the first probe ends.
+  int64_t GetMinimumLatencyMicros() const { return static_cast<int64_t>(mMinimumLatency); }
+  int64_t GetLatencyMicros() const { return static_cast<int64_t>(mLatency); }
+
+  // Adjusts the limit after an operation that took latencyMicros while inFlight operations, itself
+  // included, were in flight. While fewer than half the limit are in flight the limit does not grow, as
+  // such samples say nothing about the concurrency it could sustain.
+  void OnSample(int64_t latencyMicros, size_t inFlight);
+
+private:
+  void StartProbe();
+
+  Options mOptions;
+  double mLimit;
+  // Smoothed latency and the minimum, in microseconds; 0 before the first sample.
+  double mLatency;
+  double mMinimumLatency;
+  size_t mSamplesUntilProbe;
+  bool mProbing;
+  size_t mProbeLimit;
+  double mProbeSum;
+  size_t mProbeSamples;
+};
+
+#endif // SAMPLE_FILE_ADAPTIVE_CONCURRENCY_LIMIT_H_
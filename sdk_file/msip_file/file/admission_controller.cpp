@@ -0,0 +1,230 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "admission_controller.h"
+
+#include <algorithm>
+#include <utility>
+
+using sample::lock::InstrumentedMutex;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+AdmissionController::Ticket::Ticket(Ticket&& other)
+    : mController(other.mController),
+      mBytes(other.mBytes),
+      mTenant(std::move(other.mTenant)),
+      mBulk(other.mBulk),
+      mOperation(other.mOperation),
+      mAdmitted(other.mAdmitted) {
+  other.mController = nullptr;
+}
+
+AdmissionController::Ticket& AdmissionController::Ticket::operator=(Ticket&& other) {
+  if (this != &other) {
+    Release();
+    mController = other.mController;
+    mBytes = other.mBytes;
+    mTenant = std::move(other.mTenant);
+    mBulk = other.mBulk;
+    mOperation = other.mOperation;
+    mAdmitted = other.mAdmitted;
+    other.mController = nullptr;
+  }
+  return *this;
+}
+
+AdmissionController::Ticket::~Ticket() {
+  Release();
+}
+
+void AdmissionController::Ticket::Release() {
+  if (mController)
+    mController->Release(mBytes, mTenant, mBulk, mOperation, mAdmitted);
+  mController = nullptr;
+}
+
+AdmissionController::AdmissionController()
+    : mMaxInFlight(0),
+      mMemoryBudget(0),
+      mInFlight(0),
+      mBytesInFlight(0),
+      mAdmitted(0),
+      mRejected(0),
+      mMaxInFlightPerTenant(0),
+      mTenantRejected(0),
+      mMaxBulkInFlight(0),
+      mBulkInFlight(0),
+      mBulkRejected(0),
+      mDraining(false),
+      mDrainRejected(0),
+      mAdaptive(false),
+      mAdaptiveOptions(),
+      mAdaptiveRejected(0) {
+}
+
+void AdmissionController::SetLimits(size_t maxInFlight, int64_t memoryBudget) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mMaxInFlight = maxInFlight;
+  mMemoryBudget = memoryBudget > 0 ? memoryBudget : 0;
+}
+
+void AdmissionController::SetTenantLimit(size_t maxInFlightPerTenant) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mMaxInFlightPerTenant = maxInFlightPerTenant;
+}
+
+void AdmissionController::SetBulkLimit(size_t maxBulkInFlight) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mMaxBulkInFlight = maxBulkInFlight;
+}
+
+void AdmissionController::SetAdaptiveLimits(bool enabled, const AdaptiveConcurrencyLimit::Options& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mAdaptive = enabled;
+  mAdaptiveOptions = options;
+  for (auto& operation : mOperations)
+    operation.second.limit = AdaptiveConcurrencyLimit(options);
+}
+
+void AdmissionController::SetDraining(bool draining) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mDraining = draining;
+}
+
+bool AdmissionController::TryAdmit(
+    int64_t bytes, const string& tenant, sample::priority::Priority priority, const char* operation, Ticket& ticket) {
+  if (bytes < 0)
+    bytes = 0;
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (mDraining) {
+    ++mRejected;
+    ++mDrainRejected;
+    return false;
+  }
+  const bool tooMany = mMaxInFlight > 0 && mInFlight >= mMaxInFlight;
+  const bool overBudget = mMemoryBudget > 0 && mInFlight > 0 && mBytesInFlight + bytes > mMemoryBudget;
+  bool tenantTooMany = false;
+  if (!tenant.empty() && mMaxInFlightPerTenant > 0) {
+    auto tenantInFlight = mTenantInFlight.find(tenant);
+    tenantTooMany = tenantInFlight != mTenantInFlight.end() && tenantInFlight->second >= mMaxInFlightPerTenant;
+  }
+  const bool bulk = priority == sample::priority::Priority::Bulk;
+  const bool bulkTooMany = bulk && mMaxBulkInFlight > 0 && mBulkInFlight >= mMaxBulkInFlight;
+  Operation* type = nullptr;
+  if (operation) {
+    auto found = mOperations.find(operation);
+    if (found == mOperations.end())
+      found = mOperations.emplace(operation, Operation(mAdaptiveOptions)).first;
+    type = &found->second;
+  }
+  const bool typeTooMany = mAdaptive && type && type->inFlight >= type->limit.GetLimit();
+  if (tooMany || overBudget || tenantTooMany || bulkTooMany || typeTooMany) {
+    ++mRejected;
+    if (tenantTooMany && !tooMany && !overBudget)
+      ++mTenantRejected;
+    if (bulkTooMany && !tooMany && !overBudget && !tenantTooMany)
+      ++mBulkRejected;
+    if (typeTooMany && !tooMany && !overBudget && !tenantTooMany && !bulkTooMany)
+      ++mAdaptiveRejected;
+    return false;
+  }
+  ++mInFlight;
+  if (bulk)
+    ++mBulkInFlight;
+  mBytesInFlight += bytes;
+  ++mAdmitted;
+  if (!tenant.empty())
+    ++mTenantInFlight[tenant];
+  if (type)
+    ++type->inFlight;
+  ticket = Ticket(this, bytes, tenant, bulk, operation);
+  return true;
+}
+
+AdmissionController::Stats AdmissionController::GetStats() const {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  Stats stats;
+  stats.admitted = mAdmitted;
+  stats.rejected = mRejected;
+  stats.inFlight = mInFlight;
+  stats.bytesInFlight = mBytesInFlight;
+  stats.maxInFlight = mMaxInFlight;
+  stats.memoryBudget = mMemoryBudget;
+  stats.tenantRejected = mTenantRejected;
+  stats.maxInFlightPerTenant = mMaxInFlightPerTenant;
+  stats.bulkInFlight = mBulkInFlight;
+  stats.bulkRejected = mBulkRejected;
+  stats.maxBulkInFlight = mMaxBulkInFlight;
+  stats.draining = mDraining;
+  stats.drainRejected = mDrainRejected;
+  stats.adaptive = mAdaptive;
+  stats.adaptiveRejected = mAdaptiveRejected;
+  return stats;
+}
+
+std::vector<AdmissionController::OperationStats> AdmissionController::GetOperationStats() const {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  std::vector<OperationStats> operations;
+  operations.reserve(mOperations.size());
+  for (const auto& operation : mOperations) {
+    OperationStats stats;
+    stats.operation = operation.first;
+    stats.inFlight = operation.second.inFlight;
+    stats.limit = mAdaptive ? operation.second.limit.GetLimit() : 0;
+    stats.latencyMicros = operation.second.limit.GetLatencyMicros();
+    stats.minimumLatencyMicros = operation.second.limit.GetMinimumLatencyMicros();
+    operations.push_back(stats);
+  }
+  std::sort(operations.begin(), operations.end(), [](const OperationStats& a, const OperationStats& b) {
+    return a.operation < b.operation;
+  });
+  return operations;
+}
+
+void AdmissionController::Release(
+    int64_t bytes, const string& tenant, bool bulk, const char* operation, std::chrono::steady_clock::time_point admitted) {
+  const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - admitted);
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  --mInFlight;
+  if (bulk)
+    --mBulkInFlight;
+  mBytesInFlight -= bytes;
+  if (!tenant.empty()) {
+    auto tenantInFlight = mTenantInFlight.find(tenant);
+    if (tenantInFlight != mTenantInFlight.end() && --tenantInFlight->second == 0)
+      mTenantInFlight.erase(tenantInFlight);
+  }
+  if (operation) {
+    auto type = mOperations.find(operation);
+    if (type != mOperations.end()) {
+      // Sampled while adaptive limits are off too, for the latencies GetOperationStats reports.
+      type->second.limit.OnSample(latency.count(), type->second.inFlight);
+      --type->second.inFlight;
+    }
+  }
+}
@@ -0,0 +1,179 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ADMISSION_CONTROLLER_H_
+#define SAMPLE_FILE_ADMISSION_CONTROLLER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "adaptive_concurrency_limit.h"
+#include "instrumented_mutex.h"
+#include "work_priority.h"
+
+// Bounds the file operations in flight and the memory they are estimated to hold. An operation over a
+// limit is turned away immediately, so overload fails fast instead of queueing until the pod runs out of
+// memory. An operation larger than the whole budget is admitted only when nothing else is in flight.
+// Each tenant may also be held to its own share of the operations in flight, so one tenant's burst is
+// turned away before it crowds out the others. Bulk operations (see work_priority.h) may be held to a
+// smaller limit still, which leaves the rest of the operations in flight to interactive callers. A limit
+// of 0 is unbounded. With adaptive limits on, each operation type, e.g. "protect", is also held to a limit
+// learned from its own latency (see adaptive_concurrency_limit.h), so slow protects do not hold down
+// status probes. Once draining, every operation is turned away while those in flight finish.
+class AdmissionController final {
+public:
+  struct Stats {
+    uint64_t admitted;
+    uint64_t rejected;
+    size_t inFlight;
+    int64_t bytesInFlight;
+    size_t maxInFlight;
+    int64_t memoryBudget;
+    // Rejections because the caller's tenant was at its own limit, included in rejected.
+    uint64_t tenantRejected;
+    size_t maxInFlightPerTenant;
+    size_t bulkInFlight;
+    // Rejections because bulk operations were at their limit, included in rejected.
+    uint64_t bulkRejected;
+    size_t maxBulkInFlight;
+    bool draining;
+    // Rejections because the controller was draining, included in rejected.
+    uint64_t drainRejected;
+    bool adaptive;
+    // Rejections because the operation's type was at its adaptive limit, included in rejected.
+    uint64_t adaptiveRejected;
+  };
+
+  struct OperationStats {
+    std::string operation;
+    size_t inFlight;
+    // 0 while adaptive limits are off.
+    size_t limit;
+    int64_t latencyMicros;
+    int64_t minimumLatencyMicros;
+  };
+
+  // Holds an admitted operation's share of the limits until it is destroyed.
+  class Ticket final {
+  public:
+    Ticket() : mController(nullptr), mBytes(0), mBulk(false), mOperation(nullptr) {}
+    Ticket(Ticket&& other);
+    Ticket& operator=(Ticket&& other);
+    ~Ticket();
+
+    Ticket(const Ticket&) = delete;
+    Ticket& operator=(const Ticket&) = delete;
+
+  private:
+    friend class AdmissionController;
+    Ticket(AdmissionController* controller, int64_t bytes, const std::string& tenant, bool bulk, const char* operation)
+        : mController(controller), mBytes(bytes), mTenant(tenant), mBulk(bulk), mOperation(operation),
+          mAdmitted(std::chrono::steady_clock::now()) {}
+    void Release();
+
+    AdmissionController* mController;
+    int64_t mBytes;
+    std::string mTenant;
+    bool mBulk;
+    const char* mOperation;
+    std::chrono::steady_clock::time_point mAdmitted;
+  };
+
+  AdmissionController();
+
+  // Applies to operations admitted afterwards. Operations in flight keep their tickets.
+  void SetLimits(size_t maxInFlight, int64_t memoryBudget);
+
+  // Operations each tenant may have in flight. Applies to operations admitted afterwards.
+  void SetTenantLimit(size_t maxInFlightPerTenant);
+
+  // Bulk operations that may be in flight at once. Applies to operations admitted afterwards.
+  void SetBulkLimit(size_t maxBulkInFlight);
+
+  // Holds each operation type to a limit learned from its latency, starting from options.initialLimit, or
+  // stops when !enabled. Reconfiguring starts every type's limit afresh; its operations in flight still count.
+  void SetAdaptiveLimits(bool enabled, const AdaptiveConcurrencyLimit::Options& options);
+
+  // Turns away every operation admitted afterwards until cleared. Operations in flight keep their tickets.
+  void SetDraining(bool draining);
+  bool IsDraining() const { return mDraining.load(std::memory_order_relaxed); }
+
+  // Admits an operation of tenant estimated to hold bytes into ticket, or returns false without waiting.
+  // An empty tenant is only held to the global limits. operation names the operation's type, in static
+  // storage; nullptr holds it to no adaptive limit.
+  bool TryAdmit(int64_t bytes, const std::string& tenant, sample::priority::Priority priority, const char* operation,
+      Ticket& ticket);
+
+  Stats GetStats() const;
+  // The operation types admitted so far, in name order.
+  std::vector<OperationStats> GetOperationStats() const;
+
+  // Operations in flight and their limit, without locking. May lag a concurrent change.
+  size_t GetInFlight() const { return mInFlight.load(std::memory_order_relaxed); }
+  size_t GetMaxInFlight() const { return mMaxInFlight.load(std::memory_order_relaxed); }
+
+private:
+  struct Operation {
+    explicit Operation(const AdaptiveConcurrencyLimit::Options& options) : inFlight(0), limit(options) {}
+    size_t inFlight;
+    AdaptiveConcurrencyLimit limit;
+  };
+
+  void Release(int64_t bytes, const std::string& tenant, bool bulk, const char* operation,
+      std::chrono::steady_clock::time_point admitted);
+
+  mutable sample::lock::InstrumentedMutex mMutex{"admission"};
+  // Written with the mutex held, like the rest; atomic for the lock-free getters.
+  std::atomic<size_t> mMaxInFlight;
+  int64_t mMemoryBudget;
+  std::atomic<size_t> mInFlight;
+  int64_t mBytesInFlight;
+  uint64_t mAdmitted;
+  uint64_t mRejected;
+  size_t mMaxInFlightPerTenant;
+  // Operations in flight per tenant, without tenants that have none.
+  std::unordered_map<std::string, size_t> mTenantInFlight;
+  uint64_t mTenantRejected;
+  size_t mMaxBulkInFlight;
+  size_t mBulkInFlight;
+  uint64_t mBulkRejected;
+  std::atomic<bool> mDraining;
+  uint64_t mDrainRejected;
+  bool mAdaptive;
+  AdaptiveConcurrencyLimit::Options mAdaptiveOptions;
+  // Kept once admitted, so that tickets in flight find theirs.
+  std::unordered_map<std::string, Operation> mOperations;
+  uint64_t mAdaptiveRejected;
+};
+
+#endif // SAMPLE_FILE_ADMISSION_CONTROLLER_H_
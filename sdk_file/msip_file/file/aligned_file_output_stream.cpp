@@ -0,0 +1,273 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "aligned_file_output_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+string ErrnoMessage(const string& what, const string& path) {
+  return what + " '" + path + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& DirectBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_output_direct_bytes_total", "Output bytes written with O_DIRECT, bypassing the page cache");
+  return counter;
+}
+
+} // namespace
+
+const size_t AlignedFileOutputStream::kAlignment;
+
+AlignedFileOutputStream::AlignedFileOutputStream(const string& filePath, const Options& options, int64_t sizeHint)
+    : mFilePath(filePath),
+      mOptions(options),
+      mFd(-1),
+      mDirectFd(-1),
+      mPreallocated(false),
+      mBuffer(nullptr),
+      mBufferBytes(std::max<size_t>((options.bufferBytes + kAlignment - 1) / kAlignment, 1) * kAlignment),
+      mBufferStart(0),
+      mBufferLength(0),
+      mPosition(0),
+      mSize(0),
+      mWritebackStarted(0),
+      mWritebackDropped(0) {
+  void* buffer = nullptr;
+  if (posix_memalign(&buffer, kAlignment, mBufferBytes) != 0)
+    throw runtime_error("Failed to allocate output buffer for '" + filePath + "'");
+  mBuffer = static_cast<uint8_t*>(buffer);
+
+  mFd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (mFd < 0) {
+    const string message = ErrnoMessage("Failed to create output", filePath);
+    free(mBuffer);
+    throw runtime_error(message);
+  }
+  // Filesystems without O_DIRECT, e.g. tmpfs, refuse the flag; their outputs are written through the cache.
+  if (options.directIo)
+    mDirectFd = open(filePath.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+  // Keeping the size lets a failed commit leave no trailing zeros. Filesystems without fallocate allocate
+  // as the output is written, as before.
+  if (options.preallocate && sizeHint > 0)
+    mPreallocated = fallocate(mFd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(sizeHint)) == 0;
+}
+
+AlignedFileOutputStream::~AlignedFileOutputStream() {
+  try {
+    Close();
+  } catch (const std::exception&) {
+  }
+  free(mBuffer);
+}
+
+void AlignedFileOutputStream::Close() {
+  if (mFd < 0)
+    return;
+  try {
+    FlushBuffer(true);
+    // Truncating to the current size frees the blocks reserved past it.
+    if (mPreallocated && ftruncate(mFd, static_cast<off_t>(mSize)) != 0)
+      throw runtime_error(ErrnoMessage("Failed to trim output", mFilePath));
+    if (mOptions.dropCache)
+      DropCache();
+  } catch (...) {
+    if (mDirectFd >= 0)
+      close(mDirectFd);
+    close(mFd);
+    mDirectFd = mFd = -1;
+    throw;
+  }
+  if (mDirectFd >= 0)
+    close(mDirectFd);
+  const int result = close(mFd);
+  mDirectFd = mFd = -1;
+  if (result != 0)
+    throw runtime_error(ErrnoMessage("Failed to close output", mFilePath));
+}
+
+int64_t AlignedFileOutputStream::Read(uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is write-only");
+}
+
+int64_t AlignedFileOutputStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  if (mFd < 0)
+    throw runtime_error("Output '" + mFilePath + "' is closed");
+  int64_t written = 0;
+  while (written < bufferLength) {
+    // The buffer holds one contiguous range, so a write elsewhere, such as a header patched after the
+    // body, first writes out what is buffered.
+    if (mPosition < mBufferStart || mPosition > mBufferStart + static_cast<int64_t>(mBufferLength)) {
+      FlushBuffer(true);
+      mBufferStart = mPosition;
+    }
+    size_t offset = static_cast<size_t>(mPosition - mBufferStart);
+    if (offset == mBufferBytes) {
+      FlushBuffer(false);
+      if (mBufferLength == 0)
+        mBufferStart = mPosition;
+      offset = static_cast<size_t>(mPosition - mBufferStart);
+    }
+    const size_t count = std::min(static_cast<size_t>(bufferLength - written), mBufferBytes - offset);
+    memcpy(mBuffer + offset, buffer + written, count);
+    written += static_cast<int64_t>(count);
+    mPosition += static_cast<int64_t>(count);
+    mBufferLength = std::max(mBufferLength, offset + count);
+  }
+  mSize = std::max(mSize, mPosition);
+  return written;
+}
+
+bool AlignedFileOutputStream::Flush() {
+  if (mFd < 0)
+    return false;
+  try {
+    FlushBuffer(true);
+    if (mOptions.dropCache)
+      DropCache();
+  } catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+void AlignedFileOutputStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  mPosition = position;
+}
+
+bool AlignedFileOutputStream::CanRead() const { return false; }
+
+bool AlignedFileOutputStream::CanWrite() const { return true; }
+
+int64_t AlignedFileOutputStream::Position() { return mPosition; }
+
+int64_t AlignedFileOutputStream::Size() { return mSize; }
+
+void AlignedFileOutputStream::Size(int64_t value) {
+  if (value == mSize)
+    return;
+  if (value < 0 || mFd < 0)
+    throw runtime_error("Output '" + mFilePath + "' cannot be resized");
+  FlushBuffer(true);
+  if (ftruncate(mFd, static_cast<off_t>(value)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to resize output", mFilePath));
+  mSize = value;
+  mBufferStart = std::min(mBufferStart, mSize);
+  if (mPosition > mSize)
+    mPosition = mSize;
+}
+
+void AlignedFileOutputStream::FlushBuffer(bool all) {
+  if (mBufferLength == 0)
+    return;
+  size_t aligned = 0;
+  if (mDirectFd >= 0) {
+    // O_DIRECT needs block-aligned offsets, lengths and memory: the bytes up to the first block boundary
+    // go through the cache, and the rest is moved to the start of the buffer. That only happens after a
+    // seek, since flushes otherwise end on a block boundary.
+    const size_t misalignment = static_cast<size_t>(mBufferStart % static_cast<int64_t>(kAlignment));
+    if (misalignment != 0) {
+      const size_t head = std::min(mBufferLength, kAlignment - misalignment);
+      WriteAt(mFd, mBuffer, head, mBufferStart);
+      mBufferLength -= head;
+      mBufferStart += static_cast<int64_t>(head);
+      memmove(mBuffer, mBuffer + head, mBufferLength);
+    }
+    aligned = mBufferLength / kAlignment * kAlignment;
+    if (aligned > 0) {
+      WriteAt(mDirectFd, mBuffer, aligned, mBufferStart);
+      DirectBytes().Add(aligned);
+    }
+  }
+
+  const size_t tail = mBufferLength - aligned;
+  if (tail > 0 && !all && mDirectFd >= 0) {
+    // Keeps the partial block so the next block starts aligned.
+    memmove(mBuffer, mBuffer + aligned, tail);
+  } else if (tail > 0) {
+    WriteAt(mFd, mBuffer + aligned, tail, mBufferStart + static_cast<int64_t>(aligned));
+    aligned += tail;
+  }
+  mBufferStart += static_cast<int64_t>(aligned);
+  mBufferLength -= aligned;
+  if (mOptions.dropCache)
+    WriteBehind(mBufferStart);
+}
+
+void AlignedFileOutputStream::WriteAt(int fd, const uint8_t* data, size_t length, int64_t offset) {
+  size_t written = 0;
+  while (written < length) {
+    const ssize_t count = pwrite(fd, data + written, length - written, static_cast<off_t>(offset) + written);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw runtime_error(ErrnoMessage("Failed to write output", mFilePath));
+    written += static_cast<size_t>(count);
+  }
+}
+
+// Writeback of each buffer's worth is started as soon as it is written and waited for one buffer later,
+// so the disk stays busy while dirty pages never pile up in the cache.
+void AlignedFileOutputStream::WriteBehind(int64_t end) {
+  if (end <= mWritebackStarted)
+    return;
+  sync_file_range(mFd, static_cast<off_t>(mWritebackStarted), static_cast<off_t>(end - mWritebackStarted),
+      SYNC_FILE_RANGE_WRITE);
+  if (mWritebackDropped < mWritebackStarted) {
+    const off_t offset = static_cast<off_t>(mWritebackDropped);
+    const off_t length = static_cast<off_t>(mWritebackStarted - mWritebackDropped);
+    sync_file_range(mFd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(mFd, offset, length, POSIX_FADV_DONTNEED);
+  }
+  mWritebackDropped = mWritebackStarted;
+  mWritebackStarted = end;
+}
+
+// Pages still dirty are not dropped, so the whole file is written back first. That includes writes behind
+// the write-behind window, e.g. patched headers.
+void AlignedFileOutputStream::DropCache() {
+  if (fdatasync(mFd) != 0)
+    throw runtime_error(ErrnoMessage("Failed to write back output", mFilePath));
+  posix_fadvise(mFd, 0, 0, POSIX_FADV_DONTNEED);
+  mWritebackStarted = mWritebackDropped = mSize;
+}
@@ -0,0 +1,102 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ALIGNED_FILE_OUTPUT_STREAM_H_
+#define SAMPLE_FILE_ALIGNED_FILE_OUTPUT_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mip/stream.h"
+
+// Write-only mip::Stream that creates a file and writes it through one large aligned buffer, so the SDK's
+// small writes reach the kernel as few large ones. Optionally bypasses the page cache with O_DIRECT for
+// every aligned block, drops what went through the cache once it is on disk, and preallocates the file
+// from a size hint. Data still in the buffer is only written by Flush or Close.
+class AlignedFileOutputStream final : public mip::Stream {
+public:
+  struct Options {
+    // Rounded up to a multiple of kAlignment. 0 leaves outputs to the SDK.
+    size_t bufferBytes;
+    bool directIo;
+    // Writes back and drops the output's cached pages as it is written, and after each Flush.
+    bool dropCache;
+    bool preallocate;
+  };
+
+  static const size_t kAlignment = 4096;
+
+  // Creates or truncates filePath. sizeHint, when positive and options.preallocate is set, reserves that
+  // much disk for the output up front. Throws std::runtime_error.
+  AlignedFileOutputStream(const std::string& filePath, const Options& options, int64_t sizeHint);
+  ~AlignedFileOutputStream();
+
+  // Writes what is buffered and closes the file, releasing preallocated space past its end. Throws when the
+  // output could not be written.
+  void Close();
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  AlignedFileOutputStream(const AlignedFileOutputStream&) = delete;
+  AlignedFileOutputStream& operator=(const AlignedFileOutputStream&) = delete;
+
+  // Writes out the buffer. Unless all is set, a tail that is not a whole block stays buffered while
+  // O_DIRECT is in use.
+  void FlushBuffer(bool all);
+  void WriteAt(int fd, const uint8_t* data, size_t length, int64_t offset);
+  // Starts writeback up to end and drops the range whose writeback the previous call started.
+  void WriteBehind(int64_t end);
+  void DropCache();
+
+  const std::string mFilePath;
+  const Options mOptions;
+  int mFd;
+  // The same file opened with O_DIRECT, or -1.
+  int mDirectFd;
+  bool mPreallocated;
+  uint8_t* mBuffer;
+  size_t mBufferBytes;
+  // File offset of the buffer's first byte, and how many bytes of it are valid.
+  int64_t mBufferStart;
+  size_t mBufferLength;
+  int64_t mPosition;
+  int64_t mSize;
+  int64_t mWritebackStarted;
+  int64_t mWritebackDropped;
+};
+
+#endif // SAMPLE_FILE_ALIGNED_FILE_OUTPUT_STREAM_H_
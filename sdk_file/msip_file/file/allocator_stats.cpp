@@ -0,0 +1,201 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "allocator_stats.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#if defined(MSIP_ALLOCATOR_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#elif defined(MSIP_ALLOCATOR_MIMALLOC)
+#include <mimalloc.h>
+#else
+#include <malloc.h>
+#endif
+
+namespace {
+
+uint64_t ProcessResident() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm)
+    return 0;
+  unsigned long long size = 0;
+  unsigned long long resident = 0;
+  const int fields = fscanf(statm, "%llu %llu", &size, &resident);
+  fclose(statm);
+  return fields == 2 ? resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+#if defined(MSIP_ALLOCATOR_JEMALLOC)
+
+uint64_t ReadSize(const char* name) {
+  size_t value = 0;
+  size_t length = sizeof(value);
+  return mallctl(name, &value, &length, nullptr, 0) == 0 ? value : 0;
+}
+
+unsigned ReadUnsigned(const char* name) {
+  unsigned value = 0;
+  size_t length = sizeof(value);
+  return mallctl(name, &value, &length, nullptr, 0) == 0 ? value : 0;
+}
+
+void ReadJemalloc(AllocatorStats::Snapshot& snapshot) {
+  // Statistics are cached by jemalloc until the epoch advances.
+  uint64_t epoch = 1;
+  size_t length = sizeof(epoch);
+  mallctl("epoch", &epoch, &length, &epoch, length);
+
+  snapshot.allocated = ReadSize("stats.allocated");
+  snapshot.active = ReadSize("stats.active");
+  snapshot.resident = ReadSize("stats.resident");
+  snapshot.mapped = ReadSize("stats.mapped");
+  snapshot.retained = ReadSize("stats.retained");
+
+  const unsigned arenas = ReadUnsigned("arenas.narenas");
+  const uint64_t pageSize = ReadSize("arenas.page");
+  char name[64];
+  for (unsigned i = 0; i < arenas; ++i) {
+    AllocatorStats::Arena arena;
+    arena.index = i;
+    snprintf(name, sizeof(name), "stats.arenas.%u.small.allocated", i);
+    arena.allocated = ReadSize(name);
+    snprintf(name, sizeof(name), "stats.arenas.%u.large.allocated", i);
+    arena.allocated += ReadSize(name);
+    snprintf(name, sizeof(name), "stats.arenas.%u.mapped", i);
+    arena.mapped = ReadSize(name);
+    snprintf(name, sizeof(name), "stats.arenas.%u.nthreads", i);
+    arena.threads = ReadUnsigned(name);
+    // Arenas that were never used report nothing; pactive tells them apart from empty ones.
+    snprintf(name, sizeof(name), "stats.arenas.%u.pactive", i);
+    if (arena.mapped == 0 && arena.threads == 0 && ReadSize(name) * pageSize == 0)
+      continue;
+    snapshot.arenas.push_back(arena);
+  }
+}
+
+#elif defined(MSIP_ALLOCATOR_MIMALLOC)
+
+void ReadMimalloc(AllocatorStats::Snapshot& snapshot) {
+  size_t elapsed = 0, user = 0, system = 0, currentRss = 0, peakRss = 0, currentCommit = 0, peakCommit = 0,
+         pageFaults = 0;
+  mi_process_info(&elapsed, &user, &system, &currentRss, &peakRss, &currentCommit, &peakCommit, &pageFaults);
+  // mimalloc keeps a heap per thread rather than shared arenas and only reports process totals.
+  snapshot.active = currentCommit;
+  snapshot.resident = currentRss;
+  snapshot.mapped = currentCommit;
+}
+
+#else
+
+// Pulls the number in name="..." out of the malloc_info element at element.
+uint64_t Attribute(const char* element, const char* end, const char* name) {
+  const std::string key = std::string(" ") + name + "=\"";
+  const char* p = strstr(element, key.c_str());
+  return p && p < end ? strtoull(p + key.size(), nullptr, 10) : 0;
+}
+
+void ReadGlibc(AllocatorStats::Snapshot& snapshot) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+#else
+  // The int fields wrap past 2 GiB; mallinfo2 arrived in glibc 2.33.
+  const struct mallinfo info = mallinfo();
+#endif
+  snapshot.allocated = static_cast<uint64_t>(info.uordblks) + static_cast<uint64_t>(info.hblkhd);
+  snapshot.mapped = static_cast<uint64_t>(info.arena) + static_cast<uint64_t>(info.hblkhd);
+  snapshot.active = snapshot.allocated;
+  // Only the top chunk of the main heap is given back by trimming, so the rest of what is mapped is
+  // treated as resident.
+  snapshot.resident = snapshot.mapped - static_cast<uint64_t>(info.keepcost);
+
+  // Per-arena figures are only available as malloc_info's XML.
+  char* text = nullptr;
+  size_t size = 0;
+  FILE* stream = open_memstream(&text, &size);
+  if (!stream)
+    return;
+  const bool written = malloc_info(0, stream) == 0;
+  fclose(stream);
+  if (written) {
+    for (const char* heap = strstr(text, "<heap nr=\""); heap; ) {
+      const char* next = strstr(heap + 1, "<heap nr=\"");
+      const char* end = strstr(heap, "</heap>");
+      if (!end)
+        break;
+      AllocatorStats::Arena arena;
+      arena.index = static_cast<unsigned>(strtoul(heap + strlen("<heap nr=\""), nullptr, 10));
+      arena.threads = 0;
+      const char* current = strstr(heap, "<system type=\"current\"");
+      arena.mapped = current && current < end ? Attribute(current, end, "size") : 0;
+      // The "fast" and "rest" totals together are the heap's free chunks.
+      uint64_t free = 0;
+      for (const char* total = strstr(heap, "<total type=\""); total && total < end; total = strstr(total + 1, "<total type=\""))
+        free += Attribute(total, end, "size");
+      arena.allocated = arena.mapped > free ? arena.mapped - free : 0;
+      snapshot.arenas.push_back(arena);
+      heap = next;
+    }
+  }
+  free(text);
+}
+
+#endif
+
+}  // namespace
+
+const char* AllocatorStats::Name() {
+#if defined(MSIP_ALLOCATOR_JEMALLOC)
+  return "jemalloc";
+#elif defined(MSIP_ALLOCATOR_MIMALLOC)
+  return "mimalloc";
+#else
+  return "glibc";
+#endif
+}
+
+AllocatorStats::Snapshot AllocatorStats::Read() {
+  Snapshot snapshot;
+  snapshot.allocator = Name();
+  snapshot.allocated = 0;
+  snapshot.active = 0;
+  snapshot.resident = 0;
+  snapshot.mapped = 0;
+  snapshot.retained = 0;
+#if defined(MSIP_ALLOCATOR_JEMALLOC)
+  ReadJemalloc(snapshot);
+#elif defined(MSIP_ALLOCATOR_MIMALLOC)
+  ReadMimalloc(snapshot);
+#else
+  ReadGlibc(snapshot);
+#endif
+  snapshot.processResident = ProcessResident();
+  return snapshot;
+}
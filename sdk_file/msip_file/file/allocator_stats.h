@@ -0,0 +1,75 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ALLOCATOR_STATS_H_
+#define SAMPLE_FILE_ALLOCATOR_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads what the allocator linked into the library reports about its heap, so RSS growth can be told apart
+// from live data: a fragmented heap shows resident far above allocated. Which allocator that is gets
+// chosen at build time with SConstruct's --allocator option, which defines MSIP_ALLOCATOR_JEMALLOC or
+// MSIP_ALLOCATOR_MIMALLOC. Without either, glibc malloc is read through mallinfo and malloc_info.
+class AllocatorStats {
+public:
+  struct Arena {
+    unsigned index;
+    // Bytes held by the arena's live allocations.
+    uint64_t allocated;
+    // Bytes the arena has taken from the system, used or not.
+    uint64_t mapped;
+    // Threads bound to the arena, where the allocator tracks it.
+    unsigned threads;
+  };
+
+  struct Snapshot {
+    const char* allocator;
+    // Bytes in live allocations.
+    uint64_t allocated;
+    // Bytes in pages that hold at least one live allocation.
+    uint64_t active;
+    // Bytes of the heap resident in memory.
+    uint64_t resident;
+    // Bytes mapped from the system for the heap.
+    uint64_t mapped;
+    // Bytes the allocator keeps mapped for reuse without counting them as resident, where it does.
+    uint64_t retained;
+    // Resident set of the whole process, from /proc/self/statm.
+    uint64_t processResident;
+    std::vector<Arena> arenas;
+  };
+
+  static Snapshot Read();
+
+  // Name of the allocator the library was built with: "jemalloc", "mimalloc" or "glibc".
+  static const char* Name();
+};
+
+#endif  // SAMPLE_FILE_ALLOCATOR_STATS_H_
@@ -0,0 +1,347 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "archive_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "stream_over_buffer.h"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const size_t kLocalHeaderSize = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfCentralDirectorySize = 22;
+const size_t kMaxCommentSize = 0xFFFF;
+const uint32_t kZip64Marker = 0xFFFFFFFF;
+const uint16_t kEncryptedFlag = 0x1;
+const uint16_t kStored = 0;
+const uint16_t kDeflated = 8;
+
+// First allocation for an inflated member, doubled as it fills.
+const size_t kInflateChunk = 256 * 1024;
+
+const size_t kTarBlockSize = 512;
+const size_t kTarChecksumOffset = 148;
+const size_t kTarChecksumSize = 8;
+
+uint16_t ReadLe16(const uint8_t* data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLe32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool IsDirectoryName(const string& name) {
+  return !name.empty() && (name.back() == '/' || name.back() == '\\');
+}
+
+// Offset of the end of central directory record, or size when there is none.
+size_t FindEndOfCentralDirectory(const uint8_t* data, size_t size) {
+  if (size < kEndOfCentralDirectorySize)
+    return size;
+  const size_t last = size - kEndOfCentralDirectorySize;
+  const size_t first = last > kMaxCommentSize ? last - kMaxCommentSize : 0;
+  for (size_t offset = last + 1; offset-- > first;) {
+    if (ReadLe32(data + offset) == kEndOfCentralDirectorySignature)
+      return offset;
+  }
+  return size;
+}
+
+void ListZipMembers(
+    const uint8_t* data, size_t size, size_t end, size_t maxMembers, vector<ArchiveMember>& members, bool& truncated) {
+  const uint32_t directorySize = ReadLe32(data + end + 12);
+  const uint32_t directoryOffset = ReadLe32(data + end + 16);
+  if (directoryOffset == kZip64Marker || directoryOffset > end || directorySize > end - directoryOffset)
+    return;
+  const size_t directoryEnd = directoryOffset + directorySize;
+  size_t offset = directoryOffset;
+  while (offset + kCentralHeaderSize <= directoryEnd && ReadLe32(data + offset) == kCentralHeaderSignature) {
+    const uint8_t* header = data + offset;
+    const uint16_t nameLength = ReadLe16(header + 28);
+    const size_t next = offset + kCentralHeaderSize + nameLength + ReadLe16(header + 30) + ReadLe16(header + 32);
+    if (next > directoryEnd)
+      return;
+    ArchiveMember member;
+    member.name.assign(reinterpret_cast<const char*>(header + kCentralHeaderSize), nameLength);
+    offset = next;
+    if (IsDirectoryName(member.name))
+      continue;
+    if (members.size() == maxMembers) {
+      truncated = true;
+      return;
+    }
+    member.encrypted = (ReadLe16(header + 8) & kEncryptedFlag) != 0;
+    member.method = ReadLe16(header + 10);
+    const uint32_t compressedSize = ReadLe32(header + 20);
+    const uint32_t memberSize = ReadLe32(header + 24);
+    const uint32_t localOffset = ReadLe32(header + 42);
+    member.compressedSize = compressedSize;
+    member.size = memberSize;
+    member.zip64 = compressedSize == kZip64Marker || memberSize == kZip64Marker || localOffset == kZip64Marker;
+    if (!member.zip64 && localOffset + kLocalHeaderSize <= size &&
+        ReadLe32(data + localOffset) == kLocalHeaderSignature) {
+      const uint8_t* local = data + localOffset;
+      member.dataOffset = static_cast<uint64_t>(localOffset) + kLocalHeaderSize + ReadLe16(local + 26) + ReadLe16(local + 28);
+    } else {
+      // Past the end, so that opening it fails.
+      member.dataOffset = size;
+    }
+    members.push_back(std::move(member));
+  }
+}
+
+// The NUL or space terminated octal number of a tar header field, or its base-256 form for numbers that
+// do not fit.
+bool ParseTarNumber(const uint8_t* field, size_t length, uint64_t& value) {
+  value = 0;
+  if (field[0] & 0x80) {
+    for (size_t i = 1; i < length; ++i) {
+      if (value >> 56)
+        return false;
+      value = (value << 8) | field[i];
+    }
+    return (field[0] & 0x7F) == 0;
+  }
+  size_t i = 0;
+  while (i < length && field[i] == ' ')
+    ++i;
+  bool digits = false;
+  for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+    if (value >> 61)
+      return false;
+    value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+    digits = true;
+  }
+  return digits && (i == length || field[i] == '\0' || field[i] == ' ');
+}
+
+// Whether block is a tar header: its checksum, the sum of its bytes with the checksum field taken as
+// spaces, matches. Some writers summed signed bytes.
+bool IsTarHeader(const uint8_t* block) {
+  uint64_t expected = 0;
+  if (!ParseTarNumber(block + kTarChecksumOffset, kTarChecksumSize, expected))
+    return false;
+  uint64_t unsignedSum = 0;
+  int64_t signedSum = 0;
+  for (size_t i = 0; i < kTarBlockSize; ++i) {
+    const bool inChecksum = i >= kTarChecksumOffset && i < kTarChecksumOffset + kTarChecksumSize;
+    const uint8_t byte = inChecksum ? ' ' : block[i];
+    unsignedSum += byte;
+    signedSum += static_cast<int8_t>(byte);
+  }
+  return expected == unsignedSum || static_cast<int64_t>(expected) == signedSum;
+}
+
+bool IsZeroBlock(const uint8_t* block) {
+  for (size_t i = 0; i < kTarBlockSize; ++i) {
+    if (block[i])
+      return false;
+  }
+  return true;
+}
+
+string TarString(const uint8_t* field, size_t length) {
+  const void* nul = memchr(field, '\0', length);
+  return string(reinterpret_cast<const char*>(field), nul ? static_cast<const uint8_t*>(nul) - field : length);
+}
+
+// The path and size of a pax extended header's "<length> <key>=<value>\n" records.
+void ParsePaxRecords(const uint8_t* data, size_t size, string& path, uint64_t& memberSize, bool& hasSize) {
+  size_t offset = 0;
+  while (offset < size) {
+    size_t length = 0;
+    size_t i = offset;
+    for (; i < size && data[i] >= '0' && data[i] <= '9' && length < size; ++i)
+      length = length * 10 + (data[i] - '0');
+    // A record holds at least its length, the space and the newline.
+    if (i >= size || data[i] != ' ' || length <= i - offset + 1 || length > size - offset)
+      return;
+    const string record(reinterpret_cast<const char*>(data + i + 1), offset + length - i - 1);
+    offset += length;
+    const size_t equals = record.find('=');
+    if (equals == string::npos || record.empty() || record.back() != '\n')
+      continue;
+    const string key = record.substr(0, equals);
+    const string value = record.substr(equals + 1, record.size() - equals - 2);
+    if (key == "path") {
+      path = value;
+    } else if (key == "size") {
+      char* end = nullptr;
+      memberSize = strtoull(value.c_str(), &end, 10);
+      hasSize = end && *end == '\0' && !value.empty();
+    }
+  }
+}
+
+void ListTarMembers(const uint8_t* data, size_t size, size_t maxMembers, vector<ArchiveMember>& members, bool& truncated) {
+  string longName;
+  uint64_t paxSize = 0;
+  bool hasPaxSize = false;
+  size_t offset = 0;
+  while (offset + kTarBlockSize <= size) {
+    const uint8_t* header = data + offset;
+    if (IsZeroBlock(header) || !IsTarHeader(header))
+      return;
+    uint64_t entrySize = 0;
+    if (!ParseTarNumber(header + 124, 12, entrySize))
+      return;
+    const char type = static_cast<char>(header[156]);
+    const bool isFile = type == '0' || type == '\0' || type == '7';
+    if (isFile && hasPaxSize)
+      entrySize = paxSize;
+    const size_t dataOffset = offset + kTarBlockSize;
+    if (entrySize > size - dataOffset)
+      return;
+    const uint8_t* content = data + dataOffset;
+    offset = dataOffset + static_cast<size_t>((entrySize + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize);
+    if (type == 'L') {
+      longName = TarString(content, static_cast<size_t>(entrySize));
+      continue;
+    }
+    if (type == 'x') {
+      ParsePaxRecords(content, static_cast<size_t>(entrySize), longName, paxSize, hasPaxSize);
+      continue;
+    }
+    if (type == 'g')
+      continue;
+    ArchiveMember member;
+    if (!longName.empty()) {
+      member.name.swap(longName);
+    } else {
+      member.name = TarString(header, 100);
+      // POSIX ustar, not GNU's "ustar  ", splits long names into a prefix and a name.
+      const string prefix = memcmp(header + 257, "ustar", 6) == 0 ? TarString(header + 345, 155) : string();
+      if (!prefix.empty())
+        member.name = prefix + '/' + member.name;
+    }
+    longName.clear();
+    hasPaxSize = false;
+    if (!isFile || IsDirectoryName(member.name))
+      continue;
+    if (members.size() == maxMembers) {
+      truncated = true;
+      return;
+    }
+    member.size = entrySize;
+    member.compressedSize = entrySize;
+    member.dataOffset = dataOffset;
+    members.push_back(std::move(member));
+  }
+}
+
+} // namespace
+
+ArchiveFormat ListArchiveMembers(
+    const uint8_t* data, size_t size, size_t maxMembers, vector<ArchiveMember>& members, bool& truncated) {
+  members.clear();
+  truncated = false;
+  // Tar first: a tarball of zips may end in a zip's directory record, while a zip starts with a local header.
+  if (size >= kTarBlockSize && IsTarHeader(data)) {
+    ListTarMembers(data, size, maxMembers, members, truncated);
+    return ArchiveFormat::Tar;
+  }
+  const size_t end = FindEndOfCentralDirectory(data, size);
+  if (end == size)
+    return ArchiveFormat::None;
+  ListZipMembers(data, size, end, maxMembers, members, truncated);
+  return ArchiveFormat::Zip;
+}
+
+shared_ptr<mip::Stream> OpenArchiveMember(
+    const shared_ptr<const uint8_t>& archive, size_t size, const ArchiveMember& member, size_t maxInflatedBytes) {
+  if (member.encrypted)
+    throw std::runtime_error("The member is encrypted");
+  if (member.zip64)
+    throw std::runtime_error("Zip64 members are not supported");
+  if (member.dataOffset > size || member.compressedSize > size - member.dataOffset)
+    throw std::runtime_error("The member's content is not in the archive");
+  // Aliases the archive, so that the stream keeps it alive.
+  shared_ptr<const uint8_t> content(archive, archive.get() + member.dataOffset);
+  if (member.method == kStored)
+    return std::make_shared<StreamOverBuffer>(content, static_cast<int64_t>(member.compressedSize));
+  if (member.method != kDeflated)
+    throw std::runtime_error("Compression method " + std::to_string(member.method) + " is not supported");
+  if (member.size > maxInflatedBytes)
+    throw std::runtime_error("The member inflates to more than " + std::to_string(maxInflatedBytes) + " bytes");
+
+  if (member.size == 0)
+    return std::make_shared<StreamOverBuffer>(vector<uint8_t>());
+
+  // The declared size is only trusted as a limit: the buffer grows with what actually inflates, so a small
+  // archive declaring large members cannot make every worker allocate maxInflatedBytes. One byte past the
+  // declared size tells a member that inflates to more.
+  const size_t limit = static_cast<size_t>(member.size) + 1;
+  vector<uint8_t> inflated;
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    throw std::runtime_error("The member cannot be inflated");
+  zs.next_in = const_cast<Bytef*>(content.get());
+  zs.avail_in = static_cast<uInt>(member.compressedSize);
+  int status = Z_OK;
+  while (status == Z_OK) {
+    if (zs.total_out == inflated.size()) {
+      if (inflated.size() == limit)
+        break;
+      inflated.resize(std::min(limit, std::max(kInflateChunk, 2 * inflated.size())));
+    }
+    zs.next_out = inflated.data() + zs.total_out;
+    zs.avail_out = static_cast<uInt>(inflated.size() - zs.total_out);
+    status = inflate(&zs, Z_NO_FLUSH);
+  }
+  const uLong inflatedSize = zs.total_out;
+  inflateEnd(&zs);
+  if (status != Z_STREAM_END || inflatedSize != member.size)
+    throw std::runtime_error("The member cannot be inflated");
+  inflated.resize(static_cast<size_t>(inflatedSize));
+  return std::make_shared<StreamOverBuffer>(std::move(inflated));
+}
+
+const char* ArchiveFormatName(ArchiveFormat format) {
+  switch (format) {
+    case ArchiveFormat::Zip:
+      return "zip";
+    case ArchiveFormat::Tar:
+      return "tar";
+    default:
+      return "none";
+  }
+}
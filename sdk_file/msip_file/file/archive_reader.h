@@ -0,0 +1,71 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ARCHIVE_READER_H_
+#define SAMPLE_FILE_ARCHIVE_READER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/stream.h"
+
+// Members of a ZIP or tar archive held in memory, e.g. mapped from disk, read without extracting anything:
+// - ZIP: the members of the central directory, stored or deflated; Zip64 and encrypted members are listed
+//   but cannot be opened;
+// - tar: ustar, GNU and pax archives, long names included. Compressed tarballs are not archives here, as
+//   listing them would inflate the whole file.
+// Directories, links and other entries without content are not members.
+enum class ArchiveFormat { None, Zip, Tar };
+
+struct ArchiveMember {
+  std::string name;
+  uint64_t size = 0;
+  uint64_t compressedSize = 0;
+  // Of the member's content in the archive.
+  uint64_t dataOffset = 0;
+  // The ZIP compression method; 0, stored, for tar.
+  uint16_t method = 0;
+  bool encrypted = false;
+  bool zip64 = false;
+};
+
+// The format of the size bytes at data and, when it is an archive, its first maxMembers members;
+// truncated tells whether there were more. A damaged archive lists the members before the damage.
+ArchiveFormat ListArchiveMembers(
+    const uint8_t* data, size_t size, size_t maxMembers, std::vector<ArchiveMember>& members, bool& truncated);
+
+// A read-only stream of member's content. Stored members are read in place from archive, which the stream
+// keeps alive; deflated members are inflated into memory first. Throws std::runtime_error for members it
+// cannot open, and for deflated members whose content is larger than maxInflatedBytes.
+std::shared_ptr<mip::Stream> OpenArchiveMember(
+    const std::shared_ptr<const uint8_t>& archive, size_t size, const ArchiveMember& member, size_t maxInflatedBytes);
+
+const char* ArchiveFormatName(ArchiveFormat format);
+
+#endif // SAMPLE_FILE_ARCHIVE_READER_H_
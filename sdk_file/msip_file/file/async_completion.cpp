@@ -0,0 +1,178 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "async_completion.h"
+
+#include "context_manager.h"
+#include "file_handler_observer.h"
+#include "metrics_registry.h"
+#include "tenant_context.h"
+
+using mip::AsyncControl;
+using mip::FileEngine;
+using mip::FileHandler;
+using mip::FileInspector;
+using mip::FileProfile;
+using std::shared_ptr;
+using std::string;
+
+AsyncCaller::AsyncCaller()
+    : mPriority(sample::priority::Priority::Interactive),
+      mSubsystem(sample::alloc::Subsystem::Sdk),
+      mCostKey(sample::cost::kNoKey) {
+}
+
+void AsyncCaller::Capture() {
+  mTraceContext = sample::trace::TraceContext::Current();
+  mDeadline = sample::deadline::Deadline::Current();
+  mTenant = sample::tenant::Current();
+  mPriority = sample::priority::Current();
+  mLog = sample::oplog::OperationLog::Current();
+  mSubsystem = sample::alloc::CurrentSubsystem();
+  mAccount = sample::alloc::CurrentAccount();
+  mCostKey = sample::cost::CurrentKey();
+  mProtectionToken = sample::token::Current();
+}
+
+void AsyncCaller::Resume(std::function<void()> step) const {
+  // The dispatcher runs each task under the context of whoever dispatched it, so dispatching from
+  // within the caller's context is all it takes.
+  sample::trace::ScopedTraceContext traceScope(mTraceContext);
+  sample::deadline::ScopedDeadline deadlineScope(mDeadline);
+  sample::tenant::ScopedTenant tenantScope(mTenant);
+  sample::priority::ScopedPriority priorityScope(mPriority);
+  sample::oplog::ScopedOperationLog logScope(mLog);
+  sample::alloc::ScopedSubsystem subsystemScope(mSubsystem);
+  sample::alloc::ScopedAccount accountScope(mAccount);
+  sample::cost::ScopedKey costScope(mCostKey);
+  sample::token::ScopedToken tokenScope(mProtectionToken);
+  ContextManager::Instance().GetTaskDispatcher()->DispatchTask("continuation", std::move(step));
+}
+
+namespace {
+
+const uint32_t kNoBlock = UINT32_MAX;
+
+uint64_t Top(uint64_t generation, uint32_t index) {
+  return (generation << 32) | index;
+}
+
+MetricsRegistry::Counter& PoolMisses() {
+  static auto& misses = MetricsRegistry::Shared().GetCounter(
+      "msip_native_completion_pool_misses_total", "Async call completions allocated on the heap because no pooled block was free");
+  return misses;
+}
+
+} // namespace
+
+CompletionPool::CompletionPool()
+    : mBlocks(new Block[kBlocks]),
+      mNext(new std::atomic<uint32_t>[kBlocks]),
+      mTop(Top(0, 0)) {
+  for (uint32_t i = 0; i < kBlocks; i++)
+    mNext[i].store(i + 1 < kBlocks ? i + 1 : kNoBlock, std::memory_order_relaxed);
+}
+
+CompletionPool& CompletionPool::Shared() {
+  // Never destroyed: the SDK may release a completion from its own threads during static teardown.
+  static CompletionPool* pool = new CompletionPool();
+  return *pool;
+}
+
+void* CompletionPool::Allocate(size_t bytes) {
+  if (bytes <= kBlockSize) {
+    uint64_t top = mTop.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(top) != kNoBlock) {
+      const uint32_t index = static_cast<uint32_t>(top);
+      const uint32_t next = mNext[index].load(std::memory_order_relaxed);
+      if (mTop.compare_exchange_weak(top, Top((top >> 32) + 1, next), std::memory_order_acquire))
+        return mBlocks[index].bytes;
+    }
+  }
+  PoolMisses().Add(1);
+  return ::operator new(bytes);
+}
+
+void CompletionPool::Deallocate(void* block, size_t bytes) {
+  const Block* first = mBlocks.get();
+  const Block* candidate = static_cast<const Block*>(block);
+  if (bytes > kBlockSize || candidate < first || candidate >= first + kBlocks) {
+    ::operator delete(block);
+    return;
+  }
+  const uint32_t index = static_cast<uint32_t>(candidate - first);
+  uint64_t top = mTop.load(std::memory_order_relaxed);
+  do {
+    mNext[index].store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+  } while (!mTop.compare_exchange_weak(top, Top((top >> 32) + 1, index), std::memory_order_release));
+}
+
+shared_ptr<AsyncControl> SdkAsync::LoadProfile(
+    const FileProfile::Settings& settings,
+    const shared_ptr<AsyncCompletion<shared_ptr<FileProfile>>>& completion) {
+  return FileProfile::LoadAsync(settings, completion);
+}
+
+shared_ptr<AsyncControl> SdkAsync::AddEngine(
+    const shared_ptr<FileProfile>& profile,
+    const FileEngine::Settings& settings,
+    const shared_ptr<AsyncCompletion<shared_ptr<FileEngine>>>& completion) {
+  return profile->AddEngineAsync(settings, completion);
+}
+
+shared_ptr<AsyncControl> SdkAsync::CreateFileHandler(
+    const shared_ptr<FileEngine>& engine,
+    const shared_ptr<mip::Stream>& stream,
+    const string& filePath,
+    bool auditDiscoveryEnabled,
+    const shared_ptr<mip::FileExecutionState>& executionState,
+    const shared_ptr<AsyncCompletion<shared_ptr<FileHandler>>>& completion) {
+  const auto& observer = FileHandlerObserver::Shared();
+  if (stream)
+    return engine->CreateFileHandlerAsync(stream, filePath, auditDiscoveryEnabled, observer, completion, executionState);
+  return engine->CreateFileHandlerAsync(filePath, filePath, auditDiscoveryEnabled, observer, completion, executionState);
+}
+
+void SdkAsync::Commit(
+    const shared_ptr<FileHandler>& handler,
+    const string& outputFilePath,
+    const shared_ptr<AsyncCompletion<bool>>& completion) {
+  handler->CommitAsync(outputFilePath, completion);
+}
+
+void SdkAsync::Commit(
+    const shared_ptr<FileHandler>& handler,
+    const shared_ptr<mip::Stream>& outputStream,
+    const shared_ptr<AsyncCompletion<bool>>& completion) {
+  handler->CommitAsync(outputStream, completion);
+}
+
+void SdkAsync::Inspect(
+    const shared_ptr<FileHandler>& handler,
+    const shared_ptr<AsyncCompletion<shared_ptr<FileInspector>>>& completion) {
+  handler->InspectAsync(completion);
+}
@@ -0,0 +1,272 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ASYNC_COMPLETION_H_
+#define SAMPLE_FILE_ASYNC_COMPLETION_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "allocation_account.h"
+#include "cost_account.h"
+#include "mip/common_types.h"
+#include "mip/file/file_engine.h"
+#include "mip/file/file_handler.h"
+#include "mip/file/file_profile.h"
+#include "operation_log.h"
+#include "protection_token_context.h"
+#include "request_deadline.h"
+#include "trace_context.h"
+#include "work_priority.h"
+
+// The context of the thread that started an SDK async call, so the step continuing it runs as if on
+// that thread: same trace, deadline, tenant, priority, operation log, allocation accounting and protection
+// token.
+class AsyncCaller final {
+public:
+  // Empty until Capture.
+  AsyncCaller();
+
+  void Capture();
+
+  // Runs step as a task on the library's dispatcher under the captured context.
+  void Resume(std::function<void()> step) const;
+
+private:
+  sample::trace::TraceContext mTraceContext;
+  sample::deadline::Deadline mDeadline;
+  std::string mTenant;
+  sample::priority::Priority mPriority;
+  std::shared_ptr<sample::oplog::OperationLog> mLog;
+  sample::alloc::Subsystem mSubsystem;
+  std::shared_ptr<sample::alloc::Account> mAccount;
+  sample::cost::Key mCostKey;
+  std::shared_ptr<const std::string> mProtectionToken;
+};
+
+// Fixed-size blocks preallocated for completions, each holding an AsyncCompletion together with its
+// shared_ptr control block. Free blocks form a lock-free stack, so starting an SDK call allocates
+// nothing while fewer than kBlocks are in flight; past that, or for larger completions, blocks come
+// from the heap and are counted in msip_native_completion_pool_misses_total.
+class CompletionPool final {
+public:
+  static const size_t kBlockSize = 512;
+  static const uint32_t kBlocks = 1024;
+
+  static CompletionPool& Shared();
+
+  void* Allocate(size_t bytes);
+  void Deallocate(void* block, size_t bytes);
+
+private:
+  struct Block {
+    alignas(std::max_align_t) unsigned char bytes[kBlockSize];
+  };
+
+  CompletionPool();
+
+  std::unique_ptr<Block[]> mBlocks;
+  // Next free block after each free block, and the top of the stack as a generation in the upper 32
+  // bits over an index in the lower, so a block popped and pushed back between a load and its
+  // exchange does not pass for the same top.
+  std::unique_ptr<std::atomic<uint32_t>[]> mNext;
+  std::atomic<uint64_t> mTop;
+};
+
+// Allocates from CompletionPool, for std::allocate_shared.
+template <typename U>
+struct CompletionAllocator {
+  typedef U value_type;
+
+  CompletionAllocator() {}
+  template <typename V>
+  CompletionAllocator(const CompletionAllocator<V>&) {}
+
+  U* allocate(size_t count) { return static_cast<U*>(CompletionPool::Shared().Allocate(count * sizeof(U))); }
+  void deallocate(U* block, size_t count) { CompletionPool::Shared().Deallocate(block, count * sizeof(U)); }
+};
+
+template <typename U, typename V>
+bool operator==(const CompletionAllocator<U>&, const CompletionAllocator<V>&) { return true; }
+template <typename U, typename V>
+bool operator!=(const CompletionAllocator<U>&, const CompletionAllocator<V>&) { return false; }
+
+// The context of one SDK async call, which the shared FileHandlerObserver and ProfileObserver
+// complete. Made without continuations it fulfils the Future GetFuture returns, for callers that wait.
+// Made with them it resumes then with the result, or fail with the error, on the library's dispatcher,
+// so no thread waits between the steps of a chain. An exception then throws goes to fail. Create
+// places completions in CompletionPool, and they wait on their own mutex rather than a promise's
+// shared state, so a call allocates nothing.
+template <typename T>
+class AsyncCompletion final {
+public:
+  typedef std::function<void(const T&)> Then;
+  typedef std::function<void(const std::exception_ptr&)> Fail;
+
+  // The result of a waiting completion, named like std::future so that WaitUntilDeadline takes it.
+  // The completion must outlive it.
+  class Future final {
+  public:
+    explicit Future(AsyncCompletion* completion) : mCompletion(completion) {}
+
+    template <typename Clock, typename Duration>
+    std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& until) const {
+      std::unique_lock<std::mutex> lock(mCompletion->mMutex);
+      return mCompletion->mDone.wait_until(lock, until, [this]() { return mCompletion->mReady; })
+          ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    T get() {
+      std::unique_lock<std::mutex> lock(mCompletion->mMutex);
+      mCompletion->mDone.wait(lock, [this]() { return mCompletion->mReady; });
+      if (mCompletion->mError)
+        std::rethrow_exception(mCompletion->mError);
+      return std::move(mCompletion->mValue);
+    }
+
+  private:
+    AsyncCompletion* mCompletion;
+  };
+
+  static std::shared_ptr<AsyncCompletion> Create() {
+    return std::allocate_shared<AsyncCompletion>(CompletionAllocator<AsyncCompletion>());
+  }
+
+  static std::shared_ptr<AsyncCompletion> Create(Then then, Fail fail) {
+    return std::allocate_shared<AsyncCompletion>(
+        CompletionAllocator<AsyncCompletion>(), std::move(then), std::move(fail));
+  }
+
+  AsyncCompletion() : mReady(false), mContinues(false) {}
+
+  AsyncCompletion(Then then, Fail fail)
+      : mReady(false), mContinues(true), mThen(std::move(then)), mFail(std::move(fail)) {
+    mCaller.Capture();
+  }
+
+  AsyncCompletion(const AsyncCompletion&) = delete;
+  AsyncCompletion& operator=(const AsyncCompletion&) = delete;
+
+  // Only for completions made without continuations.
+  Future GetFuture() { return Future(this); }
+
+  void Succeed(const T& value) {
+    if (!mContinues) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mValue = value;
+      mReady = true;
+      mDone.notify_all();
+      return;
+    }
+    Then then = std::move(mThen);
+    Fail fail = std::move(mFail);
+    mCaller.Resume([then, fail, value]() {
+      try {
+        then(value);
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+  }
+
+  void Failed(const std::exception_ptr& error) {
+    if (!mContinues) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mError = error;
+      mReady = true;
+      mDone.notify_all();
+      return;
+    }
+    Fail fail = std::move(mFail);
+    mCaller.Resume([fail, error]() { fail(error); });
+  }
+
+  // The completion an observer was handed as the call's context.
+  static AsyncCompletion& FromContext(const std::shared_ptr<void>& context) {
+    return *static_cast<AsyncCompletion*>(context.get());
+  }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mDone;
+  bool mReady;
+  T mValue;
+  std::exception_ptr mError;
+  const bool mContinues;
+  AsyncCaller mCaller;
+  Then mThen;
+  Fail mFail;
+};
+
+// The SDK's async calls with an AsyncCompletion as their context, the C++11 counterpart of awaiting
+// them: each starts the call and returns at once. Profiles must observe with ProfileObserver and
+// handlers with FileHandlerObserver::Shared(), as every profile and handler in the library does.
+class SdkAsync final {
+public:
+  static std::shared_ptr<mip::AsyncControl> LoadProfile(
+      const mip::FileProfile::Settings& settings,
+      const std::shared_ptr<AsyncCompletion<std::shared_ptr<mip::FileProfile>>>& completion);
+
+  static std::shared_ptr<mip::AsyncControl> AddEngine(
+      const std::shared_ptr<mip::FileProfile>& profile,
+      const mip::FileEngine::Settings& settings,
+      const std::shared_ptr<AsyncCompletion<std::shared_ptr<mip::FileEngine>>>& completion);
+
+  // Opens stream, or the file at filePath without one, under the name filePath.
+  static std::shared_ptr<mip::AsyncControl> CreateFileHandler(
+      const std::shared_ptr<mip::FileEngine>& engine,
+      const std::shared_ptr<mip::Stream>& stream,
+      const std::string& filePath,
+      bool auditDiscoveryEnabled,
+      const std::shared_ptr<mip::FileExecutionState>& executionState,
+      const std::shared_ptr<AsyncCompletion<std::shared_ptr<mip::FileHandler>>>& completion);
+
+  static void Commit(
+      const std::shared_ptr<mip::FileHandler>& handler,
+      const std::string& outputFilePath,
+      const std::shared_ptr<AsyncCompletion<bool>>& completion);
+
+  static void Commit(
+      const std::shared_ptr<mip::FileHandler>& handler,
+      const std::shared_ptr<mip::Stream>& outputStream,
+      const std::shared_ptr<AsyncCompletion<bool>>& completion);
+
+  static void Inspect(
+      const std::shared_ptr<mip::FileHandler>& handler,
+      const std::shared_ptr<AsyncCompletion<std::shared_ptr<mip::FileInspector>>>& completion);
+};
+
+#endif // SAMPLE_FILE_ASYNC_COMPLETION_H_
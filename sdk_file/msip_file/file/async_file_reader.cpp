@@ -0,0 +1,504 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "async_file_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "stream_over_buffer.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+// Tag of an open in the low bits of a completion's user data; reads carry their buffer index there.
+static const uint64_t kOpenTag = 0xFFFF;
+static const size_t kPageSize = 4096;
+
+uint64_t MakeUserData(size_t index, uint64_t tag) {
+  return (static_cast<uint64_t>(index) << 16) | tag;
+}
+
+string ErrnoMessage(const string& what) {
+  return what + ": " + strerror(errno);
+}
+
+} // namespace
+
+const size_t AsyncFileReader::kMaxQueueDepth;
+
+// A submission and a completion queue shared with the kernel, without liburing. Only the reading thread
+// touches it.
+struct AsyncFileReader::Ring {
+  Ring(unsigned entries, size_t bufferCount, size_t bufferBytes)
+      : fd(-1),
+        sqMap(MAP_FAILED),
+        cqMap(MAP_FAILED),
+        sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+        buffers(static_cast<uint8_t*>(MAP_FAILED)),
+        buffersSize(bufferCount * bufferBytes),
+        fixedBuffers(false),
+        leakBuffers(false) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+      throw runtime_error(ErrnoMessage("io_uring is unavailable"));
+    try {
+      sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (singleMap)
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+      sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if (sqMap == MAP_FAILED)
+        throw runtime_error(ErrnoMessage("Failed to map the io_uring submission queue"));
+      if (singleMap) {
+        cqMap = sqMap;
+      } else {
+        cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED)
+          throw runtime_error(ErrnoMessage("Failed to map the io_uring completion queue"));
+      }
+      sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+      sqes = static_cast<io_uring_sqe*>(
+          mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+      if (sqes == MAP_FAILED)
+        throw runtime_error(ErrnoMessage("Failed to map the io_uring submission entries"));
+
+      uint8_t* sq = static_cast<uint8_t*>(sqMap);
+      sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+      sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+      sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+      sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+      sqEntries = params.sq_entries;
+      uint8_t* cq = static_cast<uint8_t*>(cqMap);
+      cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+      cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+      cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+      buffers = static_cast<uint8_t*>(mmap(nullptr, buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (buffers == MAP_FAILED)
+        throw runtime_error(ErrnoMessage("Failed to allocate read buffers"));
+      iovecs.resize(bufferCount);
+      for (size_t i = 0; i < bufferCount; ++i) {
+        iovecs[i].iov_base = buffers + i * bufferBytes;
+        iovecs[i].iov_len = bufferBytes;
+      }
+      // Registered buffers are pinned once instead of on every read. Registration counts against
+      // RLIMIT_MEMLOCK on older kernels; without it reads use the same buffers unregistered.
+      fixedBuffers = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(),
+          static_cast<unsigned>(bufferCount)) == 0;
+    } catch (...) {
+      Release();
+      throw;
+    }
+  }
+
+  ~Ring() { Release(); }
+
+  void Release() {
+    // Closing the ring cancels what is in flight, but the kernel may still be writing into unregistered
+    // buffers, so buffers of a ring that failed mid-batch are left mapped.
+    if (fd >= 0)
+      close(fd);
+    if (buffers != MAP_FAILED && !leakBuffers)
+      munmap(buffers, buffersSize);
+    if (sqes != MAP_FAILED)
+      munmap(sqes, sqesSize);
+    if (cqMap != MAP_FAILED && cqMap != sqMap)
+      munmap(cqMap, cqMapSize);
+    if (sqMap != MAP_FAILED)
+      munmap(sqMap, sqMapSize);
+  }
+
+  unsigned SpaceLeft() const {
+    return sqEntries - (localTail() - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+  }
+
+  // A cleared entry, published to the kernel by the next Submit.
+  io_uring_sqe* Next() {
+    const unsigned tail = localTail();
+    const unsigned index = tail & sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  // Submits every queued entry and waits for at least one completion.
+  void SubmitAndWait() {
+    for (;;) {
+      const unsigned pending = localTail() - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+      if (syscall(__NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+        return;
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        throw runtime_error(ErrnoMessage("io_uring_enter failed"));
+    }
+  }
+
+  bool Reap(uint64_t& userData, int32_t& result) {
+    const unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+      return false;
+    const io_uring_cqe& cqe = cqes[head & cqMask];
+    userData = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  unsigned localTail() const { return *sqTail; }
+
+  int fd;
+  void* sqMap;
+  size_t sqMapSize;
+  void* cqMap;
+  size_t cqMapSize;
+  io_uring_sqe* sqes;
+  size_t sqesSize;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned sqMask;
+  unsigned* sqArray;
+  unsigned sqEntries;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  io_uring_cqe* cqes;
+  uint8_t* buffers;
+  size_t buffersSize;
+  vector<iovec> iovecs;
+  bool fixedBuffers;
+  bool leakBuffers;
+};
+
+AsyncFileReader::AsyncFileReader(const vector<string>& filePaths, const Settings& settings)
+    : mSettings(settings),
+      mFiles(filePaths.size()),
+      mOpensInFlight(0),
+      mReadsInFlight(0),
+      mSyncOpen(false),
+      mBufferedBytes(0),
+      mDemand(0),
+      mStopping(false),
+      mFinished(false) {
+  if (mSettings.queueDepth == 0 || mSettings.queueDepth > kMaxQueueDepth)
+    throw std::invalid_argument("Read ahead queue depth must be between 1 and 1024");
+  mSettings.bufferBytes = std::max<size_t>((mSettings.bufferBytes + kPageSize - 1) / kPageSize, 1) * kPageSize;
+  // Reads and opens are each capped at the queue depth, so the completion queue, twice the
+  // submission queue, can never overflow.
+  mRing.reset(new Ring(static_cast<unsigned>(2 * mSettings.queueDepth), mSettings.queueDepth, mSettings.bufferBytes));
+  mRequests.resize(mSettings.queueDepth);
+  for (size_t i = mSettings.queueDepth; i > 0; --i)
+    mFreeBuffers.push_back(static_cast<unsigned>(i - 1));
+  for (size_t i = 0; i < filePaths.size(); ++i) {
+    File& file = mFiles[i];
+    file.path = filePaths[i];
+    file.state = State::Queued;
+    file.fd = -1;
+    file.size = 0;
+    file.nextOffset = 0;
+    file.received = 0;
+    file.inFlight = 0;
+    file.failed = false;
+  }
+  mThread = std::thread(&AsyncFileReader::Run, this);
+}
+
+AsyncFileReader::~AsyncFileReader() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mWorkCondition.notify_all();
+  mThread.join();
+}
+
+shared_ptr<mip::Stream> AsyncFileReader::Take(size_t index) {
+  unique_lock<mutex> lock(mMutex);
+  if (index >= mFiles.size())
+    return nullptr;
+  if (index > mDemand) {
+    mDemand = index;
+    mWorkCondition.notify_all();
+  }
+  File& file = mFiles[index];
+  mReadyCondition.wait(lock, [&]() { return file.state == State::Ready || file.state == State::Unread || mFinished; });
+  if (file.state != State::Ready)
+    return nullptr;
+  BufferPool::Buffer data(std::move(file.data));
+  file.state = State::Unread;
+  mBufferedBytes -= static_cast<size_t>(file.size);
+  mWorkCondition.notify_all();
+  lock.unlock();
+  return std::make_shared<StreamOverBuffer>(BufferPool::Share(std::move(data)), file.size);
+}
+
+bool AsyncFileReader::IsSupported() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &params));
+  if (fd < 0)
+    return false;
+  close(fd);
+  return true;
+}
+
+void AsyncFileReader::Run() {
+  size_t nextOpen = 0;
+  try {
+    for (;;) {
+      QueueWork(nextOpen);
+      if (mOpensInFlight + mReadsInFlight == 0) {
+        // Nothing in flight means every open file has been read, so what is left waits on the cap.
+        unique_lock<mutex> lock(mMutex);
+        if (mStopping || nextOpen == mFiles.size())
+          break;
+        mWorkCondition.wait(lock, [&]() {
+          return mStopping || mBufferedBytes < mSettings.maxBufferedBytes || nextOpen <= mDemand;
+        });
+        continue;
+      }
+      mRing->SubmitAndWait();
+      uint64_t userData;
+      int32_t result;
+      while (mRing->Reap(userData, result))
+        Complete(userData, result);
+    }
+  } catch (const std::exception&) {
+    if (mOpensInFlight + mReadsInFlight > 0)
+      mRing->leakBuffers = true;
+  }
+
+  // Files not read by now are left to the workers, e.g. after a stop or a failed ring.
+  lock_guard<mutex> lock(mMutex);
+  for (auto& file : mFiles) {
+    if (file.fd >= 0) {
+      close(file.fd);
+      file.fd = -1;
+    }
+    if (file.state != State::Ready) {
+      if (file.data)
+        mBufferedBytes -= static_cast<size_t>(file.size);
+      file.data.Reset();
+      file.state = State::Unread;
+    }
+  }
+  mFinished = true;
+  mReadyCondition.notify_all();
+}
+
+unsigned AsyncFileReader::QueueWork(size_t& nextOpen) {
+  bool stopping;
+  size_t demand;
+  size_t bufferedBytes;
+  {
+    lock_guard<mutex> lock(mMutex);
+    stopping = mStopping;
+    demand = mDemand;
+    bufferedBytes = mBufferedBytes;
+  }
+  if (stopping)
+    return 0;
+
+  // Reads come first: they complete files workers may be waiting on.
+  unsigned queued = 0;
+  for (size_t r = 0; r < mReading.size() && !mFreeBuffers.empty() && mRing->SpaceLeft() > 0;) {
+    File& file = mFiles[mReading[r]];
+    std::pair<int64_t, int64_t> range;
+    if (file.failed) {
+      ++r;
+      continue;
+    } else if (!file.retries.empty()) {
+      range = file.retries.back();
+      file.retries.pop_back();
+    } else if (file.nextOffset < file.size) {
+      range.first = file.nextOffset;
+      range.second = std::min<int64_t>(static_cast<int64_t>(mSettings.bufferBytes), file.size - file.nextOffset);
+      file.nextOffset += range.second;
+    } else {
+      ++r;
+      continue;
+    }
+
+    const unsigned buffer = mFreeBuffers.back();
+    mFreeBuffers.pop_back();
+    mRequests[buffer] = range;
+    io_uring_sqe* sqe = mRing->Next();
+    sqe->fd = file.fd;
+    sqe->off = static_cast<uint64_t>(range.first);
+    if (mRing->fixedBuffers) {
+      sqe->opcode = IORING_OP_READ_FIXED;
+      sqe->addr = reinterpret_cast<uint64_t>(mRing->iovecs[buffer].iov_base);
+      sqe->len = static_cast<uint32_t>(range.second);
+      sqe->buf_index = static_cast<uint16_t>(buffer);
+    } else {
+      mRing->iovecs[buffer].iov_len = static_cast<size_t>(range.second);
+      sqe->opcode = IORING_OP_READV;
+      sqe->addr = reinterpret_cast<uint64_t>(&mRing->iovecs[buffer]);
+      sqe->len = 1;
+    }
+    sqe->user_data = MakeUserData(mReading[r], buffer);
+    ++file.inFlight;
+    ++mReadsInFlight;
+    ++queued;
+  }
+
+  while (nextOpen < mFiles.size() && mOpensInFlight < mSettings.queueDepth && mRing->SpaceLeft() > 0 &&
+         (bufferedBytes < mSettings.maxBufferedBytes || nextOpen <= demand)) {
+    const size_t index = nextOpen++;
+    if (mSyncOpen) {
+      const int fd = open(mFiles[index].path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        SetState(index, State::Unread);
+      else
+        Opened(index, fd);
+      continue;
+    }
+    SetState(index, State::Opening);
+    io_uring_sqe* sqe = mRing->Next();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(mFiles[index].path.c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = MakeUserData(index, kOpenTag);
+    ++mOpensInFlight;
+    ++queued;
+  }
+  return queued;
+}
+
+void AsyncFileReader::Complete(uint64_t userData, int32_t result) {
+  const size_t index = static_cast<size_t>(userData >> 16);
+  const uint64_t tag = userData & 0xFFFF;
+  File& file = mFiles[index];
+  if (tag == kOpenTag) {
+    --mOpensInFlight;
+    if (result == -EINVAL || result == -EOPNOTSUPP) {
+      // The kernel predates asynchronous opens: open this file and the rest from the reading thread.
+      mSyncOpen = true;
+      result = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (result < 0)
+        result = -errno;
+    }
+    if (result < 0)
+      SetState(index, State::Unread);
+    else
+      Opened(index, result);
+    return;
+  }
+
+  const unsigned buffer = static_cast<unsigned>(tag);
+  const auto range = mRequests[buffer];
+  --mReadsInFlight;
+  --file.inFlight;
+  if (result == -EINTR || result == -EAGAIN) {
+    file.retries.push_back(range);
+  } else if (result <= 0) {
+    // An error, or the end of a file that shrank since it was sized.
+    file.failed = true;
+  } else {
+    memcpy(file.data.Data() + range.first, mRing->iovecs[buffer].iov_base, static_cast<size_t>(result));
+    file.received += result;
+    if (result < range.second)
+      file.retries.push_back(std::make_pair(range.first + result, range.second - result));
+  }
+  mFreeBuffers.push_back(buffer);
+  if (file.inFlight == 0 && (file.failed || file.received == file.size))
+    FinishFile(index);
+}
+
+void AsyncFileReader::Opened(size_t index, int fd) {
+  File& file = mFiles[index];
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode) || fileInfo.st_size <= 0 ||
+      fileInfo.st_size > mSettings.maxFileBytes) {
+    close(fd);
+    SetState(index, State::Unread);
+    return;
+  }
+  file.size = fileInfo.st_size;
+  try {
+    file.data = BufferPool::Shared().Acquire(static_cast<size_t>(file.size));
+  } catch (const std::bad_alloc&) {
+    close(fd);
+    SetState(index, State::Unread);
+    return;
+  }
+  file.fd = fd;
+  mReading.push_back(index);
+  lock_guard<mutex> lock(mMutex);
+  mBufferedBytes += static_cast<size_t>(file.size);
+  file.state = State::Reading;
+}
+
+void AsyncFileReader::FinishFile(size_t index) {
+  File& file = mFiles[index];
+  close(file.fd);
+  file.fd = -1;
+  mReading.erase(std::find(mReading.begin(), mReading.end(), index));
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (file.failed) {
+      mBufferedBytes -= static_cast<size_t>(file.size);
+      file.data.Reset();
+      file.state = State::Unread;
+    } else {
+      file.state = State::Ready;
+    }
+  }
+  mReadyCondition.notify_all();
+  mWorkCondition.notify_all();
+}
+
+void AsyncFileReader::SetState(size_t index, State state) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mFiles[index].state = state;
+  }
+  if (state == State::Unread)
+    mReadyCondition.notify_all();
+}
@@ -0,0 +1,131 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ASYNC_FILE_READER_H_
+#define SAMPLE_FILE_ASYNC_FILE_READER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "mip/stream.h"
+
+// Reads the files of a batch ahead of the workers that process them, through one io_uring with the queue
+// depth's worth of registered buffers, so a batch keeps the disk or the NAS busy from a single thread
+// instead of blocking one worker per file in read(). Files are opened and read in the order given, and a
+// worker takes each one as an in-memory stream once it has been read completely. At most maxBufferedBytes
+// of read files wait to be taken, plus the files being opened when that cap is reached, except for a file a
+// worker is already waiting on.
+class AsyncFileReader final {
+public:
+  struct Settings {
+    // Reads in flight, and registered buffers. 0 disables read ahead.
+    size_t queueDepth;
+    size_t bufferBytes;
+    size_t maxBufferedBytes;
+    // Larger files, and empty ones, are left for the caller to open.
+    int64_t maxFileBytes;
+  };
+
+  static const size_t kMaxQueueDepth = 1024;
+
+  // Starts reading filePaths on a background thread. Throws std::runtime_error when io_uring is unavailable,
+  // e.g. on a kernel without it or under a seccomp profile that blocks it.
+  AsyncFileReader(const std::vector<std::string>& filePaths, const Settings& settings);
+  // Stops reading and waits for the reads in flight.
+  ~AsyncFileReader();
+
+  AsyncFileReader(const AsyncFileReader&) = delete;
+  AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+  // Blocks until filePaths[index] has been read and returns its content, once. nullptr when this reader did
+  // not read it: the file was too large, empty or failed to read, or it was already taken.
+  std::shared_ptr<mip::Stream> Take(size_t index);
+
+  // True when io_uring can be set up in this process.
+  static bool IsSupported();
+
+private:
+  enum class State { Queued, Opening, Reading, Ready, Unread };
+
+  struct File {
+    std::string path;
+    State state;
+    int fd;
+    int64_t size;
+    // Next offset to request, bytes received and reads in flight. Owned by the reading thread.
+    int64_t nextOffset;
+    int64_t received;
+    size_t inFlight;
+    bool failed;
+    // Ranges a short read left to request again.
+    std::vector<std::pair<int64_t, int64_t>> retries;
+    BufferPool::Buffer data;
+  };
+
+  struct Ring;
+
+  void Run();
+  // Queues reads and opens while the ring has room. Returns how many were queued.
+  unsigned QueueWork(size_t& nextOpen);
+  void Complete(uint64_t userData, int32_t result);
+  // Sizes the file opened on fd, or leaves it unread.
+  void Opened(size_t index, int fd);
+  void FinishFile(size_t index);
+  void SetState(size_t index, State state);
+
+  Settings mSettings;
+  std::unique_ptr<Ring> mRing;
+  std::vector<File> mFiles;
+  // Open files still being read, in order.
+  std::vector<size_t> mReading;
+  std::vector<unsigned> mFreeBuffers;
+  // Offset and length each buffer's read was issued for.
+  std::vector<std::pair<int64_t, int64_t>> mRequests;
+  size_t mOpensInFlight;
+  size_t mReadsInFlight;
+  // Set once the kernel turned down an asynchronous open, which needs Linux 5.6.
+  bool mSyncOpen;
+
+  std::mutex mMutex;
+  std::condition_variable mReadyCondition;
+  std::condition_variable mWorkCondition;
+  size_t mBufferedBytes;
+  // Highest index a worker has asked for; it is opened even over the buffered bytes cap.
+  size_t mDemand;
+  bool mStopping;
+  bool mFinished;
+  std::thread mThread;
+};
+
+#endif // SAMPLE_FILE_ASYNC_FILE_READER_H_
@@ -0,0 +1,219 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "batch_prefetcher.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file_stream.h"
+#include "metrics_registry.h"
+
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+MetricsRegistry::Counter& Prefetched() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_prefetch_hits_total", "Batch inputs a worker found already opened by the prefetcher");
+  return counter;
+}
+
+MetricsRegistry::Counter& NotPrefetched() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_prefetch_misses_total", "Batch inputs a worker reached before the prefetcher did, and opened itself");
+  return counter;
+}
+
+MetricsRegistry::Counter& Waited() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_prefetch_waits_total", "Batch inputs a worker waited on while the prefetcher was opening them");
+  return counter;
+}
+
+// Faults in up to maxBytes of the mapping, one read per page, after advising the kernel of the rest.
+void Prefault(MappedFileStream& stream, int64_t maxBytes) {
+  const uint8_t* data = stream.Data();
+  const int64_t size = stream.Size();
+  if (!data || size <= 0)
+    return;
+  madvise(const_cast<uint8_t*>(data), static_cast<size_t>(size), MADV_WILLNEED);
+  const int64_t pageSize = sysconf(_SC_PAGESIZE) > 0 ? sysconf(_SC_PAGESIZE) : 4096;
+  const int64_t end = std::min(size, maxBytes);
+  volatile uint8_t sink = 0;
+  for (int64_t offset = 0; offset < end; offset += pageSize)
+    sink = static_cast<uint8_t>(sink + data[offset]);
+}
+
+// Asks the kernel to read the first length bytes of filePath into the page cache.
+void AdviseWillNeed(const string& filePath, int64_t length) {
+  const int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  posix_fadvise(fd, 0, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+} // namespace
+
+const size_t BatchPrefetcher::kMaxDepth;
+
+BatchPrefetcher::BatchPrefetcher(
+    vector<string> filePaths, const Settings& settings, const InputStreams::Options& options, size_t workers)
+    : mFilePaths(std::move(filePaths)),
+      mSettings(settings),
+      mOptions(options),
+      mWindow(std::max<size_t>(settings.depth, 1) * std::max<size_t>(workers, 1)),
+      mFiles(mFilePaths.size()),
+      mNext(0),
+      mLimit(std::min(mWindow, mFilePaths.size())),
+      mDemand(0),
+      mBufferedBytes(0),
+      mStopping(false) {
+  // Everything the SDK would open by path below the mapped threshold is read whole instead.
+  mOptions.pooledMaxBytes = std::min(mOptions.mappedMinBytes, InputStreams::kMaxPooledBytes);
+  for (auto& file : mFiles) {
+    file.state = State::Queued;
+    file.bufferedBytes = 0;
+  }
+  const size_t threads = std::min(std::max<size_t>(workers, 1), mFilePaths.size());
+  for (size_t i = 0; i < threads; ++i)
+    mThreads.emplace_back(&BatchPrefetcher::Run, this);
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mWorkCondition.notify_all();
+  for (auto& thread : mThreads)
+    thread.join();
+}
+
+shared_ptr<mip::Stream> BatchPrefetcher::Take(size_t index) {
+  unique_lock<std::mutex> lock(mMutex);
+  if (index >= mFiles.size())
+    return nullptr;
+  mDemand = std::max(mDemand, index);
+  mLimit = std::max(mLimit, std::min(mFiles.size(), index + 1 + mWindow));
+  mWorkCondition.notify_all();
+
+  File& file = mFiles[index];
+  if (file.state == State::Queued) {
+    file.state = State::Taken;
+    NotPrefetched().Add(1);
+    return nullptr;
+  }
+  if (file.state == State::Opening) {
+    Waited().Add(1);
+    mReadyCondition.wait(lock, [&file] { return file.state != State::Opening; });
+  }
+  if (file.state == State::Taken)
+    return nullptr;
+  file.state = State::Taken;
+  mBufferedBytes -= file.bufferedBytes;
+  file.bufferedBytes = 0;
+  mWorkCondition.notify_all();
+  if (file.stream)
+    Prefetched().Add(1);
+  return std::move(file.stream);
+}
+
+void BatchPrefetcher::Run() {
+  unique_lock<std::mutex> lock(mMutex);
+  while (true) {
+    mWorkCondition.wait(lock, [this] { return mStopping || mNext < mLimit; });
+    if (mStopping)
+      return;
+    const size_t index = mNext++;
+    File& file = mFiles[index];
+    if (file.state != State::Queued)
+      continue;
+    file.state = State::Opening;
+    lock.unlock();
+
+    size_t bufferedBytes = 0;
+    shared_ptr<mip::Stream> stream = Open(index, bufferedBytes);
+
+    lock.lock();
+    file.stream = std::move(stream);
+    file.bufferedBytes = bufferedBytes;
+    file.state = State::Ready;
+    mReadyCondition.notify_all();
+  }
+}
+
+shared_ptr<mip::Stream> BatchPrefetcher::Open(size_t index, size_t& bufferedBytes) {
+  const string& filePath = mFilePaths[index];
+  struct stat fileInfo;
+  if (stat(filePath.c_str(), &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode))
+    return nullptr;
+  const int64_t size = static_cast<int64_t>(fileInfo.st_size);
+  const InputStreams::Strategy strategy = InputStreams::Choose(mOptions, size);
+  if (strategy == InputStreams::Strategy::Path)
+    return nullptr;
+
+  if (strategy == InputStreams::Strategy::Pooled) {
+    // Read files wait within the budget, except the one a worker already waits on, which is read regardless.
+    unique_lock<std::mutex> lock(mMutex);
+    mWorkCondition.wait(lock, [&] {
+      return mStopping || mBufferedBytes == 0 || mBufferedBytes + static_cast<size_t>(size) <= mSettings.maxBufferedBytes ||
+          index <= mDemand;
+    });
+    if (mStopping)
+      return nullptr;
+    bufferedBytes = static_cast<size_t>(size);
+    mBufferedBytes += bufferedBytes;
+  } else if (strategy == InputStreams::Strategy::Windowed) {
+    AdviseWillNeed(filePath, static_cast<int64_t>(mOptions.windowBytes));
+  }
+
+  shared_ptr<mip::Stream> stream;
+  try {
+    stream = InputStreams::Open(mOptions, filePath);
+  } catch (const std::exception&) {
+    // The worker opens it again and reports the error with the item.
+  }
+  if (!stream && bufferedBytes > 0) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBufferedBytes -= bufferedBytes;
+    bufferedBytes = 0;
+    mWorkCondition.notify_all();
+  }
+  // Open stats the file again, so a file that grew since may not be mapped after all.
+  if (auto mapped = std::dynamic_pointer_cast<MappedFileStream>(stream))
+    Prefault(*mapped, mSettings.maxPrefaultBytes);
+  return stream;
+}
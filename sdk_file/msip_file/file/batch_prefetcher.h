@@ -0,0 +1,107 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_BATCH_PREFETCHER_H_
+#define SAMPLE_FILE_BATCH_PREFETCHER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_streams.h"
+#include "mip/stream.h"
+
+// Opens the files of a batch a few items ahead of the workers, so a worker busy with one file's license or
+// crypto already has its next file in memory when it gets to it. Without io_uring (see AsyncFileReader)
+// this is plain reads on a few threads of its own: files below the mapped threshold are read whole into a
+// pooled buffer, larger ones are mapped and their pages faulted in, and windowed ones get their first
+// window read ahead by the kernel. Files are prefetched in the order they are taken, up to depth files
+// per worker past the furthest one taken, and at most maxBufferedBytes of read files wait to be taken.
+class BatchPrefetcher final {
+public:
+  struct Settings {
+    // Files prefetched per worker ahead of the one it is processing. 0 disables prefetch.
+    size_t depth;
+    size_t maxBufferedBytes;
+    // Mapped files are faulted in up to this many bytes; the rest is only advised.
+    int64_t maxPrefaultBytes;
+  };
+
+  static const size_t kMaxDepth = 16;
+
+  // Starts prefetching filePaths for workers workers, with inputs opened the way options chooses.
+  BatchPrefetcher(std::vector<std::string> filePaths, const Settings& settings, const InputStreams::Options& options,
+      size_t workers);
+  // Stops prefetching and waits for the files being opened.
+  ~BatchPrefetcher();
+
+  BatchPrefetcher(const BatchPrefetcher&) = delete;
+  BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+  // The stream for filePaths[index], once, waiting for it while it is being opened. nullptr when it was not
+  // prefetched: not reached yet, left to the SDK by path, failed or already taken.
+  std::shared_ptr<mip::Stream> Take(size_t index);
+
+private:
+  enum class State { Queued, Opening, Ready, Taken };
+
+  struct File {
+    State state;
+    std::shared_ptr<mip::Stream> stream;
+    // Bytes read into memory, released when taken.
+    size_t bufferedBytes;
+  };
+
+  void Run();
+  // Opens filePaths[index] outside the lock. Sets bufferedBytes to what it holds in memory.
+  std::shared_ptr<mip::Stream> Open(size_t index, size_t& bufferedBytes);
+
+  const std::vector<std::string> mFilePaths;
+  const Settings mSettings;
+  InputStreams::Options mOptions;
+  const size_t mWindow;
+
+  std::mutex mMutex;
+  std::condition_variable mWorkCondition;
+  std::condition_variable mReadyCondition;
+  std::vector<File> mFiles;
+  size_t mNext;
+  // Files before this may be prefetched.
+  size_t mLimit;
+  // The furthest file taken.
+  size_t mDemand;
+  size_t mBufferedBytes;
+  bool mStopping;
+  std::vector<std::thread> mThreads;
+};
+
+#endif // SAMPLE_FILE_BATCH_PREFETCHER_H_
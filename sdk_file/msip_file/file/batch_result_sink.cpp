@@ -0,0 +1,184 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "batch_result_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "json_writer.h"
+#include "metrics_registry.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+
+namespace {
+
+thread_local BatchResultSink::Settings tSettings;
+
+} // namespace
+
+const size_t BatchResultSink::kDefaultFlushBytes;
+const std::chrono::milliseconds BatchResultSink::kDefaultFlushInterval(100);
+
+void BatchResultSink::SetCurrent(const Settings& settings) {
+  tSettings = settings;
+}
+
+void BatchResultSink::ClearCurrent() {
+  tSettings = Settings();
+}
+
+std::unique_ptr<BatchResultSink> BatchResultSink::OpenCurrent() {
+  if (tSettings.fd < 0 && !tSettings.callback)
+    return nullptr;
+  return std::unique_ptr<BatchResultSink>(new BatchResultSink(tSettings));
+}
+
+BatchResultSink::BatchResultSink(const Settings& settings)
+    : mSettings(settings),
+      mBufferedLines(0),
+      mStats(),
+      mClosed(false) {
+  mBuffer.reserve(mSettings.flushBytes + 1024);
+  if (mSettings.flushInterval.count() > 0)
+    mFlushThread = std::thread(&BatchResultSink::FlushLoop, this);
+}
+
+BatchResultSink::~BatchResultSink() {
+  Close();
+}
+
+void BatchResultSink::Write(size_t index, const string& item) {
+  static auto& streamed = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_results_streamed_total", "Batch item results streamed as NDJSON lines");
+  bool full;
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mStats.error != 0) {
+      ++mStats.dropped;
+      return;
+    }
+    mBuffer += "{\"index\": ";
+    mBuffer += std::to_string(index);
+    mBuffer += ", \"result\": ";
+    mBuffer += item;
+    mBuffer += "}\n";
+    ++mBufferedLines;
+    full = mBuffer.size() >= mSettings.flushBytes;
+  }
+  streamed.Add(1);
+  if (full)
+    Flush();
+}
+
+BatchResultSink::Stats BatchResultSink::Close() {
+  std::thread flushThread;
+  {
+    lock_guard<mutex> lock(mMutex);
+    mClosed = true;
+    flushThread.swap(mFlushThread);
+    mCondition.notify_all();
+  }
+  if (flushThread.joinable())
+    flushThread.join();
+  Flush();
+  lock_guard<mutex> lock(mMutex);
+  return mStats;
+}
+
+void BatchResultSink::Flush() {
+  lock_guard<mutex> writeLock(mWriteMutex);
+  string lines;
+  uint64_t count;
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mBuffer.empty())
+      return;
+    lines.swap(mBuffer);
+    mBuffer.reserve(mSettings.flushBytes + 1024);
+    count = mBufferedLines;
+    mBufferedLines = 0;
+  }
+  // Workers keep buffering lines while this run is written.
+  const int error = Deliver(lines);
+  lock_guard<mutex> lock(mMutex);
+  if (error == 0) {
+    mStats.lines += count;
+    mStats.bytes += lines.size();
+    ++mStats.flushes;
+  } else {
+    if (mStats.error == 0)
+      mStats.error = error;
+    mStats.dropped += count;
+  }
+}
+
+int BatchResultSink::Deliver(const string& lines) {
+  if (mSettings.callback) {
+    mSettings.callback(lines.data(), lines.size(), mSettings.userData);
+    return 0;
+  }
+  const char* data = lines.data();
+  size_t remaining = lines.size();
+  while (remaining > 0) {
+    const ssize_t written = ::write(mSettings.fd, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    data += written;
+    remaining -= static_cast<size_t>(written);
+  }
+  return 0;
+}
+
+void BatchResultSink::FlushLoop() {
+  unique_lock<mutex> lock(mMutex);
+  while (!mCondition.wait_for(lock, mSettings.flushInterval, [this]() { return mClosed; })) {
+    lock.unlock();
+    Flush();
+    lock.lock();
+  }
+}
+
+string BatchResultSink::SummaryJSON(const Stats& stats) {
+  JsonWriter json(160);
+  json.BeginObject()
+      .Key("status").Bool(stats.error == 0)
+      .Key("streamed").UInt(stats.lines)
+      .Key("bytes").UInt(stats.bytes)
+      .Key("flushes").UInt(stats.flushes)
+      .Key("dropped").UInt(stats.dropped)
+      .Key("error").String(stats.error != 0 ? string("Failed to write batch results: ") + strerror(stats.error) : string())
+      .EndObject();
+  return json.Take();
+}
@@ -0,0 +1,118 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_BATCH_RESULT_SINK_H_
+#define SAMPLE_FILE_BATCH_RESULT_SINK_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Streams the results of a batch as NDJSON, one {"index": i, "result": ...} line per item in the order
+// items finish, to a descriptor or a callback, so the caller can start on each result while the batch runs
+// and the library never holds the whole batch's results. Lines are buffered and written once flushBytes are
+// buffered, and at least every flushInterval. Write is called from every worker of the batch; lines are
+// written whole and in the order they were buffered. After a failed write the remaining lines are dropped
+// and counted.
+class BatchResultSink final {
+public:
+  // Receives a run of complete lines. Runs on a batch worker or the flush thread, one call at a time.
+  typedef void (*Callback)(const char* lines, size_t size, void* userData);
+
+  struct Settings {
+    Settings() : fd(-1), callback(nullptr), userData(nullptr), flushBytes(kDefaultFlushBytes), flushInterval(kDefaultFlushInterval) {}
+
+    // A descriptor left open for the caller, used when callback is null.
+    int fd;
+    Callback callback;
+    void* userData;
+    size_t flushBytes;
+    // Zero only flushes on size and when the batch ends.
+    std::chrono::milliseconds flushInterval;
+  };
+
+  struct Stats {
+    // Lines written, and lines dropped after a failed write.
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t flushes;
+    uint64_t dropped;
+    // errno of the failed write, 0 when every write succeeded.
+    int error;
+  };
+
+  static const size_t kDefaultFlushBytes = 64 * 1024;
+  static const std::chrono::milliseconds kDefaultFlushInterval;
+
+  // The calling thread's next batch exports stream their results with settings. Cleared with ClearCurrent;
+  // settings without a descriptor or callback clear it too.
+  static void SetCurrent(const Settings& settings);
+  static void ClearCurrent();
+  // A sink for a batch starting on this thread, or nullptr when its results are not streamed.
+  static std::unique_ptr<BatchResultSink> OpenCurrent();
+
+  explicit BatchResultSink(const Settings& settings);
+  // Flushes what is left, as Close does.
+  ~BatchResultSink();
+
+  BatchResultSink(const BatchResultSink&) = delete;
+  BatchResultSink& operator=(const BatchResultSink&) = delete;
+
+  // item must be a JSON value.
+  void Write(size_t index, const std::string& item);
+
+  // Stops the flush thread and writes the buffered lines. Returns the totals, which Write no longer changes.
+  Stats Close();
+
+  // {"status": ..., "streamed": ..., "bytes": ..., "flushes": ..., "dropped": ..., "error": "..."}, which a
+  // streamed batch returns instead of its results.
+  static std::string SummaryJSON(const Stats& stats);
+
+private:
+  void Flush();
+  // Returns 0, or the errno of the failed write.
+  int Deliver(const std::string& lines);
+  void FlushLoop();
+
+  const Settings mSettings;
+  // Held while a run of lines is written, so runs go out in the order they were taken from mBuffer.
+  std::mutex mWriteMutex;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::string mBuffer;
+  uint64_t mBufferedLines;
+  Stats mStats;
+  bool mClosed;
+  std::thread mFlushThread;
+};
+
+#endif  // SAMPLE_FILE_BATCH_RESULT_SINK_H_
@@ -0,0 +1,315 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "allocation_account.h"
+#include "memory_hints.h"
+#include "numa_topology.h"
+
+using sample::lock::InstrumentedMutex;
+using std::lock_guard;
+using std::mutex;
+
+namespace {
+
+// Set once this thread's cache is destroyed. Buffers released after that, e.g. by another thread_local,
+// go straight to the pool.
+thread_local bool tCacheDestroyed = false;
+
+// Pool memory bypasses operator new, so the allocation accounting is told about it here, whether a stream
+// holds it or the pool retains it for reuse.
+void CountAllocation(size_t capacity) {
+  if (sample::alloc::IsEnabled())
+    sample::alloc::OnAllocate(sample::alloc::Subsystem::Streams, capacity);
+}
+
+} // namespace
+
+// Buffers a thread holds on to. They are handed back to the pool when the thread exits.
+struct BufferPool::ThreadCache {
+  Retained slots[kThreadCachedClasses];
+
+  ThreadCache() {
+    for (auto& slot : slots)
+      slot = Retained{nullptr, -1};
+  }
+
+  ~ThreadCache() {
+    tCacheDestroyed = true;
+    for (int sizeClass = 0; sizeClass < kThreadCachedClasses; ++sizeClass) {
+      if (slots[sizeClass].data)
+        BufferPool::Shared().ReleaseShared(slots[sizeClass].data, sizeClass, slots[sizeClass].node);
+    }
+  }
+};
+
+const size_t BufferPool::kMinClassBytes;
+const size_t BufferPool::kMaxClassBytes;
+const size_t BufferPool::kHugePageBytes;
+const size_t BufferPool::kDefaultMaxRetainedBytes;
+const int BufferPool::kClassCount;
+const int BufferPool::kThreadCachedClasses;
+
+BufferPool::Buffer::Buffer(Buffer&& other)
+    : mData(other.mData), mCapacity(other.mCapacity), mSizeClass(other.mSizeClass), mNode(other.mNode) {
+  other.mData = nullptr;
+  other.mCapacity = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) {
+  if (this != &other) {
+    Reset();
+    mData = other.mData;
+    mCapacity = other.mCapacity;
+    mSizeClass = other.mSizeClass;
+    mNode = other.mNode;
+    other.mData = nullptr;
+    other.mCapacity = 0;
+  }
+  return *this;
+}
+
+void BufferPool::Buffer::Reset() {
+  if (!mData)
+    return;
+  BufferPool::Shared().Release(mData, mCapacity, mSizeClass, mNode);
+  mData = nullptr;
+  mCapacity = 0;
+}
+
+BufferPool::BufferPool()
+    : mRetainedBytes(0),
+      mMaxRetainedBytes(kDefaultMaxRetainedBytes),
+      mHits(0),
+      mMisses(0),
+      mOversized(0),
+      mRemoteHits(0),
+      mNumaPlacement(false),
+      mHugePages(true),
+      mPrefault(false) {
+}
+
+BufferPool& BufferPool::Shared() {
+  static BufferPool* pool = new BufferPool(); // Never destroyed; thread caches release into it at exit.
+  return *pool;
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size) {
+  const int sizeClass = SizeClass(size);
+  const int node = mNumaPlacement ? NumaTopology::CurrentNode() : -1;
+  if (sizeClass < 0) {
+    ++mOversized;
+    return Buffer(Allocate(size, node), size, -1, node);
+  }
+
+  const size_t capacity = ClassBytes(sizeClass);
+  ThreadCache* cache = sizeClass < kThreadCachedClasses ? LocalCache() : nullptr;
+  if (cache && cache->slots[sizeClass].data) {
+    const Retained slot = cache->slots[sizeClass];
+    cache->slots[sizeClass] = Retained{nullptr, -1};
+    ++mHits;
+    return Buffer(slot.data, capacity, sizeClass, slot.node);
+  }
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    auto& freeList = mFree[sizeClass];
+    if (!freeList.empty()) {
+      // The most recently released buffer of the thread's node, else the most recently released one.
+      auto chosen = freeList.end() - 1;
+      if (node >= 0) {
+        auto local = std::find_if(freeList.rbegin(), freeList.rend(), [node](const Retained& r) { return r.node == node; });
+        if (local != freeList.rend())
+          chosen = local.base() - 1;
+        else if (chosen->node >= 0)
+          ++mRemoteHits;
+      }
+      const Retained retained = *chosen;
+      freeList.erase(chosen);
+      mRetainedBytes -= capacity;
+      ++mHits;
+      return Buffer(retained.data, capacity, sizeClass, retained.node);
+    }
+  }
+  ++mMisses;
+  return Buffer(Allocate(capacity, node), capacity, sizeClass, node);
+}
+
+std::shared_ptr<const uint8_t> BufferPool::Share(Buffer&& buffer) {
+  // The deleter hands the memory back through a Buffer, so it lands in the releasing thread's cache.
+  const uint8_t* data = buffer.mData;
+  const size_t capacity = buffer.mCapacity;
+  const int sizeClass = buffer.mSizeClass;
+  const int node = buffer.mNode;
+  buffer.mData = nullptr;
+  buffer.mCapacity = 0;
+  try {
+    return std::shared_ptr<const uint8_t>(data, [capacity, sizeClass, node](const uint8_t* memory) {
+      Buffer released(const_cast<uint8_t*>(memory), capacity, sizeClass, node);
+    });
+  } catch (...) {
+    Buffer released(const_cast<uint8_t*>(data), capacity, sizeClass, node);
+    throw;
+  }
+}
+
+void BufferPool::SetMaxRetainedBytes(size_t bytes) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mMaxRetainedBytes = bytes;
+  TrimLocked();
+}
+
+void BufferPool::SetNumaPlacement(bool enabled) {
+  mNumaPlacement = enabled;
+}
+
+void BufferPool::SetHugePages(bool enabled) {
+  mHugePages = enabled;
+}
+
+void BufferPool::SetPrefault(bool enabled) {
+  mPrefault = enabled;
+}
+
+BufferPool::Stats BufferPool::GetStats() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  Stats stats;
+  stats.hits = mHits;
+  stats.misses = mMisses;
+  stats.oversized = mOversized;
+  stats.remoteHits = mRemoteHits;
+  stats.retainedBytes = mRetainedBytes;
+  stats.maxRetainedBytes = mMaxRetainedBytes;
+  return stats;
+}
+
+int BufferPool::SizeClass(size_t size) {
+  if (size > kMaxClassBytes)
+    return -1;
+  int sizeClass = 0;
+  while (ClassBytes(sizeClass) < size)
+    ++sizeClass;
+  return sizeClass;
+}
+
+size_t BufferPool::ClassBytes(int sizeClass) {
+  return kMinClassBytes << sizeClass;
+}
+
+uint8_t* BufferPool::Allocate(size_t capacity, int node) {
+  if (capacity < kHugePageBytes) {
+    void* data = nullptr;
+    if (posix_memalign(&data, 4096, capacity) != 0)
+      throw std::bad_alloc();
+    CountAllocation(capacity);
+    return static_cast<uint8_t*>(data);
+  }
+
+  // Huge pages need 2 MiB aligned memory, so a larger region is mapped and its unaligned ends unmapped.
+  const size_t mapped = (capacity + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes + kHugePageBytes;
+  void* region = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    throw std::bad_alloc();
+  uint8_t* start = static_cast<uint8_t*>(region);
+  uint8_t* aligned = reinterpret_cast<uint8_t*>(
+      (reinterpret_cast<uintptr_t>(start) + kHugePageBytes - 1) & ~(static_cast<uintptr_t>(kHugePageBytes) - 1));
+  const size_t length = (capacity + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes;
+  if (aligned > start)
+    munmap(start, static_cast<size_t>(aligned - start));
+  if (aligned + length < start + mapped)
+    munmap(aligned + length, static_cast<size_t>(start + mapped - (aligned + length)));
+  if (mHugePages)
+    AdviseHugePages(aligned, length);
+  // Nothing is touched yet, so the policy covers every page. Smaller classes rely on first touch.
+  if (node >= 0)
+    NumaTopology::PreferNode(aligned, length, node);
+  // After the advice and the policy, so the faulted pages are huge and on node.
+  if (mPrefault)
+    PrefaultWrite(aligned, length);
+  CountAllocation(capacity);
+  return aligned;
+}
+
+void BufferPool::Free(uint8_t* data, size_t capacity) {
+  if (sample::alloc::IsEnabled())
+    sample::alloc::OnFree(sample::alloc::Subsystem::Streams, capacity);
+  if (capacity < kHugePageBytes)
+    free(data);
+  else
+    munmap(data, (capacity + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes);
+}
+
+BufferPool::ThreadCache* BufferPool::LocalCache() {
+  if (tCacheDestroyed)
+    return nullptr;
+  thread_local ThreadCache cache;
+  return &cache;
+}
+
+void BufferPool::Release(uint8_t* data, size_t capacity, int sizeClass, int node) {
+  if (sizeClass < 0) {
+    Free(data, capacity);
+    return;
+  }
+  // With retention off a thread keeps nothing either.
+  ThreadCache* cache = sizeClass < kThreadCachedClasses && mMaxRetainedBytes > 0 ? LocalCache() : nullptr;
+  if (cache && !cache->slots[sizeClass].data) {
+    cache->slots[sizeClass] = Retained{data, node};
+    return;
+  }
+  ReleaseShared(data, sizeClass, node);
+}
+
+void BufferPool::ReleaseShared(uint8_t* data, int sizeClass, int node) {
+  const size_t capacity = ClassBytes(sizeClass);
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    if (mRetainedBytes + capacity <= mMaxRetainedBytes) {
+      mFree[sizeClass].push_back(Retained{data, node});
+      mRetainedBytes += capacity;
+      return;
+    }
+  }
+  Free(data, capacity);
+}
+
+// Frees the largest buffers first: they are the least likely to be asked for again soon.
+void BufferPool::TrimLocked() {
+  for (int sizeClass = kClassCount - 1; sizeClass >= 0 && mRetainedBytes > mMaxRetainedBytes; --sizeClass) {
+    auto& freeList = mFree[sizeClass];
+    while (!freeList.empty() && mRetainedBytes > mMaxRetainedBytes) {
+      Free(freeList.back().data, ClassBytes(sizeClass));
+      freeList.pop_back();
+      mRetainedBytes -= ClassBytes(sizeClass);
+    }
+  }
+}
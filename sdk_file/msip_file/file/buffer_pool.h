@@ -0,0 +1,160 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_BUFFER_POOL_H_
+#define SAMPLE_FILE_BUFFER_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "instrumented_mutex.h"
+
+// Recycles the large buffers that hold file inputs and outputs, so a steady stream of multi-megabyte files
+// stops going through malloc and mmap for every request. Sizes are rounded up to power-of-two classes from
+// 64 KiB to 256 MiB. Each thread keeps one buffer per class up to 1 MiB, and the pool keeps up to a byte
+// budget of freed buffers shared by all threads. Classes from 2 MiB up are mapped on 2 MiB boundaries and
+// backed by transparent huge pages where the kernel allows. Larger requests bypass the pool.
+// With NUMA placement on, buffers remember the node they were allocated on and the shared lists hand a
+// thread a buffer of its own node first.
+class BufferPool final {
+public:
+  // Memory from the pool, returned to it on destruction. Contents are not zeroed.
+  class Buffer final {
+  public:
+    Buffer() : mData(nullptr), mCapacity(0), mSizeClass(-1), mNode(-1) {}
+    Buffer(Buffer&& other);
+    Buffer& operator=(Buffer&& other);
+    ~Buffer() { Reset(); }
+
+    uint8_t* Data() const { return mData; }
+    size_t Capacity() const { return mCapacity; }
+    explicit operator bool() const { return mData != nullptr; }
+
+    // Returns the memory to the pool.
+    void Reset();
+
+  private:
+    friend class BufferPool;
+    Buffer(uint8_t* data, size_t capacity, int sizeClass, int node)
+        : mData(data), mCapacity(capacity), mSizeClass(sizeClass), mNode(node) {}
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    uint8_t* mData;
+    size_t mCapacity;
+    // -1 for memory allocated outside the classes.
+    int mSizeClass;
+    // NUMA node the memory was allocated on, -1 when placement was off.
+    int mNode;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t oversized;
+    // Hits served with a buffer of another node while NUMA placement was on.
+    uint64_t remoteHits;
+    size_t retainedBytes;
+    size_t maxRetainedBytes;
+  };
+
+  static const size_t kMinClassBytes = 64 * 1024;
+  static const size_t kMaxClassBytes = 256 * 1024 * 1024;
+  static const size_t kHugePageBytes = 2 * 1024 * 1024;
+  static const size_t kDefaultMaxRetainedBytes = 256 * 1024 * 1024;
+
+  static BufferPool& Shared();
+
+  // At least size bytes. Throws std::bad_alloc.
+  Buffer Acquire(size_t size);
+
+  // Keeps buffer's memory alive, and out of the pool, while the returned pointer or a copy of it is.
+  static std::shared_ptr<const uint8_t> Share(Buffer&& buffer);
+
+  // Bytes of freed buffers the pool keeps across threads. 0 frees every buffer as it is released.
+  void SetMaxRetainedBytes(size_t bytes);
+
+  // Tags buffers with the node of the thread allocating them, maps the huge page classes on that node, and
+  // prefers same-node buffers on reuse. Off by default: on a single node host it only costs the lookups.
+  void SetNumaPlacement(bool enabled);
+
+  // Asks for transparent huge pages for the classes of kHugePageBytes and up, which are aligned for them
+  // either way. On by default.
+  void SetHugePages(bool enabled);
+
+  // Faults in the memory of those classes when it is mapped, in one call instead of a fault per page on
+  // first use. Off by default: memory the pool retains is only faulted in once anyway.
+  void SetPrefault(bool enabled);
+
+  Stats GetStats();
+
+private:
+  static const int kClassCount = 13;
+  // Classes a thread keeps one buffer of without taking the pool's lock.
+  static const int kThreadCachedClasses = 5;
+
+  struct ThreadCache;
+
+  struct Retained {
+    uint8_t* data;
+    int node;
+  };
+
+  BufferPool();
+
+  static int SizeClass(size_t size);
+  static size_t ClassBytes(int sizeClass);
+  // Prefers node's memory for the huge page classes when node is not -1.
+  uint8_t* Allocate(size_t capacity, int node);
+  static void Free(uint8_t* data, size_t capacity);
+  // nullptr once the calling thread is exiting.
+  static ThreadCache* LocalCache();
+
+  void Release(uint8_t* data, size_t capacity, int sizeClass, int node);
+  // Called when a thread exits, and when the thread cache has no room.
+  void ReleaseShared(uint8_t* data, int sizeClass, int node);
+  void TrimLocked();
+
+  sample::lock::InstrumentedMutex mMutex{"buffer_pool"};
+  std::vector<Retained> mFree[kClassCount];
+  size_t mRetainedBytes;
+  // Read without the lock to skip thread caches when retention is off.
+  std::atomic<size_t> mMaxRetainedBytes;
+  std::atomic<uint64_t> mHits;
+  std::atomic<uint64_t> mMisses;
+  std::atomic<uint64_t> mOversized;
+  std::atomic<uint64_t> mRemoteHits;
+  std::atomic<bool> mNumaPlacement;
+  std::atomic<bool> mHugePages;
+  std::atomic<bool> mPrefault;
+};
+
+#endif // SAMPLE_FILE_BUFFER_POOL_H_
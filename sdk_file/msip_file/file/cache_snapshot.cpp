@@ -0,0 +1,324 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "cache_snapshot.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "content_hash.h"
+
+using std::invalid_argument;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace {
+
+const char kMagic[8] = { 'M', 'S', 'I', 'P', 'S', 'N', 'P', '1' };
+const uint32_t kSealed = 1;
+const size_t kNonceSize = 12;
+const size_t kTagSize = 16;
+const size_t kAlignment = 8;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  int64_t createdAt;
+  // XXH64 of the section table.
+  uint64_t checksum;
+};
+
+struct StoredSection {
+  uint32_t type;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t size;
+  // XXH64 of the section as stored.
+  uint64_t checksum;
+  char name[CacheSnapshot::kMaxNameSize + 1];
+};
+
+static_assert(sizeof(Header) == 32, "Header is part of the snapshot format");
+static_assert(sizeof(StoredSection) == 56, "StoredSection is part of the snapshot format");
+
+string ErrnoMessage(const string& what, const string& path) {
+  return what + " '" + path + "': " + strerror(errno);
+}
+
+size_t Align(size_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+uint64_t Checksum(const void* data, size_t size) {
+  return XxHash64(static_cast<const uint8_t*>(data), size, 0);
+}
+
+// Binds the ciphertext to its section, so a sealed section cannot be moved under another type or name.
+string AssociatedData(uint32_t type, const string& name) {
+  return string(kMagic, sizeof(kMagic)) + std::to_string(type) + '\n' + name;
+}
+
+string Seal(const string& key, const string& aad, const string& plaintext) {
+  string sealed(kNonceSize + plaintext.size() + kTagSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&sealed[0]);
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  if (!context || RAND_bytes(out, static_cast<int>(kNonceSize)) != 1 ||
+      EVP_EncryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), out) != 1 ||
+      EVP_EncryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1 ||
+      EVP_EncryptUpdate(context.get(), out + kNonceSize, &length, reinterpret_cast<const unsigned char*>(plaintext.data()), static_cast<int>(plaintext.size())) != 1 ||
+      EVP_EncryptFinal_ex(context.get(), out + kNonceSize + length, &length) != 1 ||
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_GET_TAG, static_cast<int>(kTagSize), out + kNonceSize + plaintext.size()) != 1)
+    throw runtime_error("Failed to seal a snapshot section");
+  return sealed;
+}
+
+} // namespace
+
+const uint32_t CacheSnapshot::kVersion;
+const size_t CacheSnapshot::kKeySize;
+const size_t CacheSnapshot::kMaxNameSize;
+
+void SnapshotWriter::PutU32(uint32_t value) {
+  char bytes[4];
+  for (size_t i = 0; i < sizeof(bytes); ++i)
+    bytes[i] = static_cast<char>(value >> (8 * i));
+  mData.append(bytes, sizeof(bytes));
+}
+
+void SnapshotWriter::PutU64(uint64_t value) {
+  char bytes[8];
+  for (size_t i = 0; i < sizeof(bytes); ++i)
+    bytes[i] = static_cast<char>(value >> (8 * i));
+  mData.append(bytes, sizeof(bytes));
+}
+
+void SnapshotWriter::PutString(const string& value) {
+  PutU32(static_cast<uint32_t>(value.size()));
+  mData += value;
+}
+
+const char* SnapshotReader::Take(size_t size) {
+  if (size > mSize - mOffset)
+    throw runtime_error("Snapshot section is truncated");
+  const char* data = mData + mOffset;
+  mOffset += size;
+  return data;
+}
+
+uint32_t SnapshotReader::GetU32() {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(Take(4));
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i)
+    value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+  return value;
+}
+
+uint64_t SnapshotReader::GetU64() {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(Take(8));
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; ++i)
+    value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+  return value;
+}
+
+string SnapshotReader::GetString() {
+  const uint32_t size = GetU32();
+  return string(Take(size), size);
+}
+
+void CacheSnapshot::Write(const string& path, const vector<Section>& sections, const string& key) {
+  vector<StoredSection> table(sections.size());
+  vector<string> sealed(sections.size());
+  size_t offset = Align(sizeof(Header) + table.size() * sizeof(StoredSection));
+  for (size_t i = 0; i < sections.size(); ++i) {
+    const auto& section = sections[i];
+    if (section.name.size() > kMaxNameSize)
+      throw invalid_argument("Snapshot section name too long: " + section.name);
+    auto& stored = table[i];
+    memset(&stored, 0, sizeof(stored));
+    stored.type = static_cast<uint32_t>(section.type);
+    memcpy(stored.name, section.name.data(), section.name.size());
+    const string* data = &section.data;
+    if (section.sealed) {
+      if (key.size() != kKeySize)
+        throw invalid_argument("Sealed snapshot sections need a 32-byte key");
+      sealed[i] = Seal(key, AssociatedData(stored.type, section.name), section.data);
+      stored.flags = kSealed;
+      data = &sealed[i];
+    }
+    stored.offset = offset;
+    stored.size = data->size();
+    stored.checksum = Checksum(data->data(), data->size());
+    offset = Align(offset + data->size());
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.count = static_cast<uint32_t>(table.size());
+  header.createdAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  header.checksum = Checksum(table.data(), table.size() * sizeof(StoredSection));
+
+  string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+  contents.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(StoredSection));
+  for (size_t i = 0; i < sections.size(); ++i) {
+    contents.resize(table[i].offset, '\0');
+    contents += sections[i].sealed ? sealed[i] : sections[i].data;
+  }
+
+  // Written under a name of its own, then renamed over the snapshot, so a reader maps either the whole
+  // earlier snapshot or the whole new one.
+  const string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+  const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("Failed to create", temporary));
+  size_t written = 0;
+  while (written < contents.size()) {
+    const ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0) {
+      const string error = ErrnoMessage("Failed to write", temporary);
+      close(fd);
+      unlink(temporary.c_str());
+      throw runtime_error(error);
+    }
+    written += static_cast<size_t>(count);
+  }
+  if (fsync(fd) != 0 || close(fd) != 0) {
+    const string error = ErrnoMessage("Failed to write", temporary);
+    unlink(temporary.c_str());
+    throw runtime_error(error);
+  }
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    const string error = ErrnoMessage("Failed to write", path);
+    unlink(temporary.c_str());
+    throw runtime_error(error);
+  }
+}
+
+std::unique_ptr<CacheSnapshot> CacheSnapshot::Map(const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", path));
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+    close(fd);
+    throw runtime_error("Not a cache snapshot: " + path);
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (data == MAP_FAILED)
+    throw runtime_error(ErrnoMessage("Failed to map", path));
+  std::unique_ptr<CacheSnapshot> snapshot(new CacheSnapshot(static_cast<const uint8_t*>(data), size));
+
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    throw runtime_error("Not a cache snapshot: " + path);
+  if (header.version != kVersion)
+    throw runtime_error("Unsupported cache snapshot version " + std::to_string(header.version) + ": " + path);
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  if (header.count > (size - sizeof(Header)) / sizeof(StoredSection) ||
+      Checksum(bytes + sizeof(Header), header.count * sizeof(StoredSection)) != header.checksum)
+    throw runtime_error("Corrupt cache snapshot: " + path);
+  snapshot->mCreatedAt = header.createdAt;
+  for (uint32_t i = 0; i < header.count; ++i) {
+    StoredSection stored;
+    memcpy(&stored, bytes + sizeof(Header) + i * sizeof(StoredSection), sizeof(stored));
+    if (stored.offset > size || stored.size > size - stored.offset ||
+        Checksum(bytes + stored.offset, static_cast<size_t>(stored.size)) != stored.checksum)
+      throw runtime_error("Corrupt cache snapshot: " + path);
+    stored.name[kMaxNameSize] = '\0';
+    View view;
+    view.type = static_cast<SectionType>(stored.type);
+    view.name = stored.name;
+    view.sealed = (stored.flags & kSealed) != 0;
+    view.data = reinterpret_cast<const char*>(bytes + stored.offset);
+    view.size = static_cast<size_t>(stored.size);
+    snapshot->mSections.push_back(view);
+  }
+  return snapshot;
+}
+
+bool CacheSnapshot::Unseal(const View& section, const string& key, string& plaintext) {
+  if (!section.sealed) {
+    plaintext.assign(section.data, section.size);
+    return true;
+  }
+  if (key.size() != kKeySize || section.size < kNonceSize + kTagSize)
+    return false;
+  const string aad = AssociatedData(static_cast<uint32_t>(section.type), section.name);
+  const size_t cipherSize = section.size - kNonceSize - kTagSize;
+  const auto* in = reinterpret_cast<const unsigned char*>(section.data);
+  plaintext.assign(cipherSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  const bool opened = context &&
+      EVP_DecryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), in) == 1 &&
+      EVP_DecryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) == 1 &&
+      EVP_DecryptUpdate(context.get(), out, &length, in + kNonceSize, static_cast<int>(cipherSize)) == 1 &&
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_SET_TAG, static_cast<int>(kTagSize),
+          const_cast<unsigned char*>(in + kNonceSize + cipherSize)) == 1 &&
+      EVP_DecryptFinal_ex(context.get(), out + length, &length) == 1;
+  if (!opened)
+    plaintext.clear();
+  return opened;
+}
+
+const char* CacheSnapshot::TypeName(SectionType type) {
+  switch (type) {
+    case SectionType::Labels: return "labels";
+    case SectionType::Endpoints: return "endpoints";
+    case SectionType::Inspection: return "inspection";
+    case SectionType::Rights: return "rights";
+    case SectionType::LicenseInfo: return "license_info";
+  }
+  return "unknown";
+}
+
+CacheSnapshot::CacheSnapshot(const uint8_t* data, size_t size) : mData(data), mSize(size), mCreatedAt(0) {}
+
+CacheSnapshot::~CacheSnapshot() {
+  munmap(const_cast<uint8_t*>(mData), mSize);
+}
@@ -0,0 +1,139 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_CACHE_SNAPSHOT_H_
+#define SAMPLE_FILE_CACHE_SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Records of one snapshot section, encoded little-endian with length-prefixed strings.
+class SnapshotWriter final {
+public:
+  void PutU32(uint32_t value);
+  void PutU64(uint64_t value);
+  void PutI64(int64_t value) { PutU64(static_cast<uint64_t>(value)); }
+  void PutBool(bool value) { PutU32(value ? 1 : 0); }
+  void PutString(const std::string& value);
+
+  std::string& Data() { return mData; }
+
+private:
+  std::string mData;
+};
+
+// Reads what a SnapshotWriter wrote. Throws std::runtime_error past the end of the section.
+class SnapshotReader final {
+public:
+  SnapshotReader(const char* data, size_t size) : mData(data), mSize(size), mOffset(0) {}
+
+  uint32_t GetU32();
+  uint64_t GetU64();
+  int64_t GetI64() { return static_cast<int64_t>(GetU64()); }
+  bool GetBool() { return GetU32() != 0; }
+  std::string GetString();
+
+  bool AtEnd() const { return mOffset == mSize; }
+
+private:
+  const char* Take(size_t size);
+
+  const char* mData;
+  size_t mSize;
+  size_t mOffset;
+};
+
+// The warm caches of a process in one file, for a new replica to start from: a header, a table of sections
+// and the sections, each at an 8-byte aligned offset so a reader maps the file and reads them in place. The
+// table and every section carry an XXH64 checksum. Sealed sections are encrypted with AES-256-GCM under the
+// caller's key and authenticated with their type and name.
+class CacheSnapshot final {
+public:
+  enum class SectionType : uint32_t {
+    // A shared label snapshot (see shared_label_snapshot.h) of the policy engine the name is the id of.
+    Labels = 1,
+    Endpoints = 2,
+    Inspection = 3,
+    Rights = 4,
+    LicenseInfo = 5,
+  };
+
+  struct Section {
+    SectionType type;
+    // At most kMaxNameSize bytes.
+    std::string name;
+    bool sealed;
+    std::string data;
+  };
+
+  // A section inside the mapping; a sealed one still encrypted.
+  struct View {
+    SectionType type;
+    std::string name;
+    bool sealed;
+    const char* data;
+    size_t size;
+  };
+
+  static const uint32_t kVersion = 1;
+  static const size_t kKeySize = 32;
+  static const size_t kMaxNameSize = 23;
+
+  // Writes sections to path atomically. Sealed sections need key, kKeySize bytes. Throws
+  // std::invalid_argument for a missing key or a long name, and std::runtime_error when writing fails.
+  static void Write(const std::string& path, const std::vector<Section>& sections, const std::string& key);
+
+  // Maps path and checks its version and checksums. Throws std::runtime_error.
+  static std::unique_ptr<CacheSnapshot> Map(const std::string& path);
+
+  // The plaintext of a sealed section, false when key does not open it.
+  static bool Unseal(const View& section, const std::string& key, std::string& plaintext);
+
+  ~CacheSnapshot();
+
+  CacheSnapshot(const CacheSnapshot&) = delete;
+  CacheSnapshot& operator=(const CacheSnapshot&) = delete;
+
+  const std::vector<View>& GetSections() const { return mSections; }
+  int64_t GetSize() const { return static_cast<int64_t>(mSize); }
+  // When it was written, in milliseconds since the epoch.
+  int64_t GetCreatedAt() const { return mCreatedAt; }
+
+  static const char* TypeName(SectionType type);
+
+private:
+  CacheSnapshot(const uint8_t* data, size_t size);
+
+  const uint8_t* mData;
+  size_t mSize;
+  int64_t mCreatedAt;
+  std::vector<View> mSections;
+};
+
+#endif // SAMPLE_FILE_CACHE_SNAPSHOT_H_
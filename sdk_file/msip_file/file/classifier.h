@@ -0,0 +1,50 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_CLASSIFIER_H_
+#define SAMPLE_FILE_CLASSIFIER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/upe/classification_result.h"
+
+// Native classifier behind FileExecutionStateImpl::GetClassificationResults. The SDK asks for the
+// sensitive information types its auto-labeling rules need and applies the labels from the answer,
+// so an implementation decides how fast ClassifyAsync runs. Must be safe to call from several threads.
+class Classifier {
+public:
+  virtual ~Classifier() {}
+
+  // Results keyed by classification id, for the ids found in text. Ids the classifier does not know
+  // or did not find are left out.
+  virtual std::shared_ptr<mip::ClassificationResults> Classify(
+      const std::string& text,
+      const std::vector<std::string>& classificationIds) const = 0;
+};
+
+#endif // SAMPLE_FILE_CLASSIFIER_H_
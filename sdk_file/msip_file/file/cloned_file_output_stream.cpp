@@ -0,0 +1,274 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "cloned_file_output_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+// Unchanged runs shorter than this are written anyway, so a scattered edit is a few writes, not many.
+const int64_t kBlockSize = 4096;
+
+string ErrnoMessage(const string& what, const string& path) {
+  return what + " '" + path + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& ClonedOutputs() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_cloned_outputs_total", "Outputs created as a reflink clone of their input");
+  return counter;
+}
+
+MetricsRegistry::Counter& CloneUnsupported() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_clone_unsupported_total", "Outputs written in full because the filesystem cannot clone");
+  return counter;
+}
+
+MetricsRegistry::Counter& SkippedBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_cloned_output_skipped_bytes_total", "Bytes of cloned outputs left shared with their input");
+  return counter;
+}
+
+MetricsRegistry::Counter& WrittenBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_cloned_output_written_bytes_total", "Bytes written to cloned outputs");
+  return counter;
+}
+
+} // namespace
+
+shared_ptr<ClonedFileOutputStream> ClonedFileOutputStream::Create(const string& outputPath, const string& inputPath) {
+  const int inputFd = open(inputPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (inputFd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", inputPath));
+  struct stat fileInfo;
+  if (fstat(inputFd, &fileInfo) != 0) {
+    const string message = ErrnoMessage("Failed to stat", inputPath);
+    close(inputFd);
+    throw runtime_error(message);
+  }
+  const int fd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    const string message = ErrnoMessage("Failed to create output", outputPath);
+    close(inputFd);
+    throw runtime_error(message);
+  }
+  if (ioctl(fd, FICLONE, inputFd) != 0) {
+    close(fd);
+    close(inputFd);
+    unlink(outputPath.c_str());
+    CloneUnsupported().Add(1);
+    return nullptr;
+  }
+
+  const int64_t inputSize = static_cast<int64_t>(fileInfo.st_size);
+  void* mapping = nullptr;
+  if (inputSize > 0) {
+    mapping = mmap(nullptr, static_cast<size_t>(inputSize), PROT_READ, MAP_PRIVATE, inputFd, 0);
+    if (mapping == MAP_FAILED) {
+      const string message = ErrnoMessage("Failed to map", inputPath);
+      close(fd);
+      close(inputFd);
+      unlink(outputPath.c_str());
+      throw runtime_error(message);
+    }
+  }
+  // The mapping keeps its own reference to the input.
+  close(inputFd);
+  ClonedOutputs().Add(1);
+  return shared_ptr<ClonedFileOutputStream>(
+      new ClonedFileOutputStream(outputPath, fd, static_cast<const uint8_t*>(mapping), inputSize));
+}
+
+ClonedFileOutputStream::ClonedFileOutputStream(const string& outputPath, int fd, const uint8_t* input, int64_t inputSize)
+    : mFilePath(outputPath),
+      mFd(fd),
+      mInput(input),
+      mInputSize(inputSize),
+      mPosition(0),
+      // Nothing is written yet; Close trims the clone to what the SDK wrote.
+      mSize(0) {
+}
+
+ClonedFileOutputStream::~ClonedFileOutputStream() {
+  try {
+    Close();
+  } catch (const std::exception&) {
+  }
+  if (mInput)
+    munmap(const_cast<uint8_t*>(mInput), static_cast<size_t>(mInputSize));
+}
+
+void ClonedFileOutputStream::Close() {
+  if (mFd < 0)
+    return;
+  int result = 0;
+  string message;
+  if (ftruncate(mFd, static_cast<off_t>(mSize)) != 0) {
+    result = -1;
+    message = ErrnoMessage("Failed to trim output", mFilePath);
+  }
+  if (close(mFd) != 0 && result == 0) {
+    result = -1;
+    message = ErrnoMessage("Failed to close output", mFilePath);
+  }
+  mFd = -1;
+  if (result != 0)
+    throw runtime_error(message);
+}
+
+bool ClonedFileOutputStream::KeptInput() const {
+  return mSize >= mInputSize && Unwritten(0, mInputSize);
+}
+
+int64_t ClonedFileOutputStream::Read(uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is write-only");
+}
+
+bool ClonedFileOutputStream::Unwritten(int64_t offset, int64_t length) const {
+  auto next = mWritten.upper_bound(offset);
+  if (next != mWritten.end() && next->first < offset + length)
+    return false;
+  if (next == mWritten.begin())
+    return true;
+  --next;
+  return next->first + next->second <= offset;
+}
+
+void ClonedFileOutputStream::MarkWritten(int64_t offset, int64_t length) {
+  int64_t start = offset;
+  int64_t end = offset + length;
+  auto it = mWritten.upper_bound(offset);
+  if (it != mWritten.begin()) {
+    auto previous = std::prev(it);
+    if (previous->first + previous->second >= start) {
+      start = previous->first;
+      end = std::max(end, previous->first + previous->second);
+      it = mWritten.erase(previous);
+    }
+  }
+  while (it != mWritten.end() && it->first <= end) {
+    end = std::max(end, it->first + it->second);
+    it = mWritten.erase(it);
+  }
+  mWritten[start] = end - start;
+}
+
+void ClonedFileOutputStream::WriteAt(const uint8_t* data, int64_t length, int64_t offset) {
+  MarkWritten(offset, length);
+  WrittenBytes().Add(static_cast<uint64_t>(length));
+  while (length > 0) {
+    const ssize_t count = pwrite(mFd, data, static_cast<size_t>(length), static_cast<off_t>(offset));
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw runtime_error(ErrnoMessage("Failed to write output", mFilePath));
+    data += count;
+    length -= count;
+    offset += count;
+  }
+}
+
+int64_t ClonedFileOutputStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  if (mFd < 0)
+    throw runtime_error("Output '" + mFilePath + "' is closed");
+  if (bufferLength <= 0)
+    return 0;
+  // Walks the write block by block, skipping blocks that match the input where the output still holds it
+  // and writing each run of the others at once.
+  int64_t done = 0;
+  int64_t pending = -1;
+  while (done < bufferLength) {
+    const int64_t offset = mPosition + done;
+    const int64_t length = std::min(bufferLength - done, kBlockSize - offset % kBlockSize);
+    const bool unchanged = offset + length <= mInputSize && Unwritten(offset, length) &&
+        memcmp(buffer + done, mInput + offset, static_cast<size_t>(length)) == 0;
+    if (unchanged) {
+      if (pending >= 0) {
+        WriteAt(buffer + pending, done - pending, mPosition + pending);
+        pending = -1;
+      }
+      SkippedBytes().Add(static_cast<uint64_t>(length));
+    } else if (pending < 0) {
+      pending = done;
+    }
+    done += length;
+  }
+  if (pending >= 0)
+    WriteAt(buffer + pending, done - pending, mPosition + pending);
+  mPosition += bufferLength;
+  mSize = std::max(mSize, mPosition);
+  return bufferLength;
+}
+
+bool ClonedFileOutputStream::Flush() { return true; }
+
+void ClonedFileOutputStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  mPosition = position;
+}
+
+bool ClonedFileOutputStream::CanRead() const { return false; }
+
+bool ClonedFileOutputStream::CanWrite() const { return true; }
+
+int64_t ClonedFileOutputStream::Position() { return mPosition; }
+
+int64_t ClonedFileOutputStream::Size() { return mSize; }
+
+void ClonedFileOutputStream::Size(int64_t value) {
+  if (value < 0 || mFd < 0)
+    throw runtime_error("Output '" + mFilePath + "' cannot be resized");
+  // Growing must read back as zeros, as it does for a new file, not as the rest of the clone.
+  const int64_t kept = std::min(value, mSize);
+  if (ftruncate(mFd, static_cast<off_t>(kept)) != 0 || ftruncate(mFd, static_cast<off_t>(value)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to resize output", mFilePath));
+  if (kept < mInputSize)
+    MarkWritten(kept, mInputSize - kept);
+  mSize = value;
+  if (mPosition > mSize)
+    mPosition = mSize;
+}
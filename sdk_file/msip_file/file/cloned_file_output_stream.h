@@ -0,0 +1,86 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_CLONED_FILE_OUTPUT_STREAM_H_
+#define SAMPLE_FILE_CLONED_FILE_OUTPUT_STREAM_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "mip/stream.h"
+
+// Write-only mip::Stream for an output that differs from its input in a few places, such as a relabelled
+// file. The output starts as a reflink clone of the input, sharing its extents, and a write only reaches
+// the file where it differs from what the file already holds, so the blocks the SDK leaves unchanged stay
+// shared and are never written. Only filesystems that clone files, such as XFS and btrfs, support this.
+class ClonedFileOutputStream final : public mip::Stream {
+public:
+  // Creates or truncates outputPath as a clone of inputPath. nullptr, with no output left behind, when the
+  // filesystem cannot clone it. Throws std::runtime_error when either file cannot be opened.
+  static std::shared_ptr<ClonedFileOutputStream> Create(const std::string& outputPath, const std::string& inputPath);
+  ~ClonedFileOutputStream();
+
+  // Trims the clone to what was written and closes the file. Throws when the output could not be written.
+  void Close();
+
+  // True when the output still starts with the whole input, as after an update appended to it.
+  bool KeptInput() const;
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  ClonedFileOutputStream(const std::string& outputPath, int fd, const uint8_t* input, int64_t inputSize);
+  ClonedFileOutputStream(const ClonedFileOutputStream&) = delete;
+  ClonedFileOutputStream& operator=(const ClonedFileOutputStream&) = delete;
+
+  // True when [offset, offset + length) still holds the input's bytes.
+  bool Unwritten(int64_t offset, int64_t length) const;
+  void MarkWritten(int64_t offset, int64_t length);
+  void WriteAt(const uint8_t* data, int64_t length, int64_t offset);
+
+  const std::string mFilePath;
+  int mFd;
+  // A read-only mapping of the input, compared against instead of reading the output back.
+  const uint8_t* mInput;
+  int64_t mInputSize;
+  // Ranges of the output written since the clone, by start offset, merged when they touch.
+  std::map<int64_t, int64_t> mWritten;
+  int64_t mPosition;
+  int64_t mSize;
+};
+
+#endif // SAMPLE_FILE_CLONED_FILE_OUTPUT_STREAM_H_
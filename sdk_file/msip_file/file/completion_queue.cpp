@@ -0,0 +1,130 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "completion_queue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+CompletionQueue::CompletionQueue()
+    : mFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      mQueuedBytes(0) {
+  if (mFd < 0) {
+    throw std::runtime_error(std::string("eventfd failed: ") + strerror(errno));
+  }
+}
+
+CompletionQueue::~CompletionQueue() {
+  close(mFd);
+}
+
+void CompletionQueue::Signal() {
+  // A full counter already wakes the reader; EAGAIN is the only failure on a valid eventfd
+  uint64_t one = 1;
+  ssize_t ignored = write(mFd, &one, sizeof(one));
+  (void)ignored;
+}
+
+void CompletionQueue::Push(uint64_t id, int status, const char* result) {
+  Completion completion;
+  completion.id = id;
+  completion.status = status;
+  if (result) {
+    completion.result = result;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  bool wasEmpty = mQueue.empty();
+  mQueuedBytes += kHeaderBytes + completion.result.size();
+  mQueue.push_back(std::move(completion));
+  if (wasEmpty) {
+    Signal();
+  }
+}
+
+void CompletionQueue::Take(uint8_t* out, size_t cap, size_t* written, size_t* remaining) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  uint64_t count;
+  ssize_t ignored = read(mFd, &count, sizeof(count));
+  (void)ignored;
+  size_t offset = 0;
+  while (!mQueue.empty()) {
+    const Completion& completion = mQueue.front();
+    size_t size = kHeaderBytes + completion.result.size();
+    if (size > cap - offset) {
+      break;
+    }
+    uint32_t length = static_cast<uint32_t>(completion.result.size());
+    memcpy(out + offset, &completion.id, sizeof(completion.id));
+    memcpy(out + offset + 8, &completion.status, sizeof(completion.status));
+    memcpy(out + offset + 12, &length, sizeof(length));
+    memcpy(out + offset + kHeaderBytes, completion.result.data(), completion.result.size());
+    offset += size;
+    mQueuedBytes -= size;
+    mQueue.pop_front();
+  }
+  if (!mQueue.empty()) {
+    Signal();
+  }
+  *written = offset;
+  *remaining = mQueuedBytes;
+}
+
+CompletionQueueTable::CompletionQueueTable()
+    : mNextHandle(1) {
+}
+
+int CompletionQueueTable::Open(int* fd) {
+  std::shared_ptr<CompletionQueue> queue;
+  try {
+    queue = std::make_shared<CompletionQueue>();
+  } catch (const std::exception&) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (int tried = 0; tried < kMaxHandle; ++tried) {
+    int handle = mNextHandle;
+    mNextHandle = mNextHandle == kMaxHandle ? 1 : mNextHandle + 1;
+    if (mQueues.emplace(handle, queue).second) {
+      *fd = queue->GetFd();
+      return handle;
+    }
+  }
+  return 0;
+}
+
+bool CompletionQueueTable::Close(int handle) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mQueues.erase(handle) > 0;
+}
+
+std::shared_ptr<CompletionQueue> CompletionQueueTable::Find(int handle) const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = mQueues.find(handle);
+  return it == mQueues.end() ? nullptr : it->second;
+}
@@ -0,0 +1,100 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_COMPLETION_QUEUE_H_
+#define SAMPLE_FILE_COMPLETION_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Results of async exports kept for a caller that waits on an eventfd instead of running callbacks on SDK
+// threads. Push copies the result and signals the eventfd when the queue was empty, so a burst of
+// completions wakes the caller once, and the caller takes everything queued when the descriptor is
+// readable. Neither side ever waits for the other.
+class CompletionQueue final {
+public:
+  // Bytes before each result in Take's output: uint64 id, int32 status, uint32 result length, in native
+  // byte order. The result follows without a terminator.
+  static const size_t kHeaderBytes = 16;
+
+  // Throws std::runtime_error when no eventfd can be created.
+  CompletionQueue();
+  ~CompletionQueue();
+
+  CompletionQueue(const CompletionQueue&) = delete;
+  CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+  int GetFd() const { return mFd; }
+
+  void Push(uint64_t id, int status, const char* result);
+
+  // Moves the queued completions that fit into out, oldest first. *written gets the bytes written and
+  // *remaining the bytes of those still queued, which leave the eventfd signalled.
+  void Take(uint8_t* out, size_t cap, size_t* written, size_t* remaining);
+
+private:
+  struct Completion {
+    uint64_t id;
+    int32_t status;
+    std::string result;
+  };
+
+  void Signal();
+
+  const int mFd;
+  std::mutex mMutex;
+  std::deque<Completion> mQueue;
+  size_t mQueuedBytes;
+};
+
+// Queues opened through the C ABI, by small integer handles. Async callers put the handle in the top
+// kHandleShift bits of userData, above the call id.
+class CompletionQueueTable final {
+public:
+  static const int kHandleShift = 48;
+  static const int kMaxHandle = 0xFFFF;
+
+  CompletionQueueTable();
+
+  // The new queue's handle, with its eventfd in *fd, or 0 when no eventfd or handle is available.
+  int Open(int* fd);
+  // Returns false when the handle was not open. Completions for a closed queue are dropped.
+  bool Close(int handle);
+  std::shared_ptr<CompletionQueue> Find(int handle) const;
+
+private:
+  mutable std::mutex mMutex;
+  int mNextHandle;
+  std::unordered_map<int, std::shared_ptr<CompletionQueue>> mQueues;
+};
+
+#endif // SAMPLE_FILE_COMPLETION_QUEUE_H_
@@ -0,0 +1,239 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "container_structure_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::shared_ptr;
+using std::string;
+
+// Read-only stream over inner that answers reads held by the cached ranges without touching inner, and
+// records the small reads it passes on. inner is sought lazily, only when a read has to reach it.
+class ContainerStructureCache::CachingStream final : public mip::Stream {
+public:
+  CachingStream(ContainerStructureCache& cache, shared_ptr<mip::Stream> inner, const FileIdentity& identity,
+      shared_ptr<const Ranges> cached, size_t maxBytes)
+      : mCache(cache),
+        mInner(std::move(inner)),
+        mIdentity(identity),
+        mCached(std::move(cached)),
+        mRecordedBytes(0),
+        mMaxBytes(maxBytes),
+        mPosition(mInner->Position()),
+        mInnerPosition(mPosition) {
+  }
+
+  ~CachingStream() {
+    if (mRecorded.empty())
+      return;
+    try {
+      mCache.Merge(mIdentity, mRecorded);
+    } catch (...) {
+      // A structure the next stream cannot reuse only costs it the reads.
+    }
+  }
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override {
+    if (bufferLength <= 0)
+      return 0;
+    const int64_t available = std::min(bufferLength, mIdentity.size - mPosition);
+    if (available > 0 && static_cast<uint64_t>(available) <= kMaxRecordedRead &&
+        ((mCached && ReadRange(*mCached, mPosition, buffer, static_cast<size_t>(available))) ||
+         ReadRange(mRecorded, mPosition, buffer, static_cast<size_t>(available)))) {
+      mPosition += available;
+      mCache.CountServed(static_cast<size_t>(available));
+      return available;
+    }
+
+    if (mInnerPosition != mPosition)
+      mInner->Seek(mPosition);
+    const int64_t offset = mPosition;
+    const int64_t count = mInner->Read(buffer, bufferLength);
+    if (count > 0) {
+      mPosition += count;
+      if (static_cast<uint64_t>(bufferLength) <= kMaxRecordedRead && mRecordedBytes + static_cast<size_t>(count) <= mMaxBytes)
+        mRecordedBytes += AddRange(mRecorded, offset, buffer, static_cast<size_t>(count));
+    }
+    mInnerPosition = mPosition;
+    return count;
+  }
+
+  int64_t Write(const uint8_t* /* buffer */, int64_t /* bufferLength */) override {
+    throw std::runtime_error("Stream is read-only");
+  }
+
+  bool Flush() override { return true; }
+
+  void Seek(int64_t position) override {
+    if (position < 0)
+      throw std::runtime_error("Position must not be less than zero.");
+    if (position > mIdentity.size)
+      throw std::runtime_error("Position must not be larger than size.");
+    mPosition = position;
+  }
+
+  bool CanRead() const override { return true; }
+  bool CanWrite() const override { return false; }
+  int64_t Position() override { return mPosition; }
+  int64_t Size() override { return mIdentity.size; }
+  void Size(int64_t /* value */) override { throw std::runtime_error("Stream is read-only"); }
+
+private:
+  CachingStream(const CachingStream&) = delete;
+  CachingStream& operator=(const CachingStream&) = delete;
+
+  ContainerStructureCache& mCache;
+  shared_ptr<mip::Stream> mInner;
+  const FileIdentity mIdentity;
+  const shared_ptr<const Ranges> mCached;
+  Ranges mRecorded;
+  size_t mRecordedBytes;
+  const size_t mMaxBytes;
+  int64_t mPosition;
+  int64_t mInnerPosition;
+};
+
+const size_t ContainerStructureCache::kMaxRecordedRead;
+const size_t ContainerStructureCache::kDefaultMaxBytesPerFile;
+
+ContainerStructureCache::ContainerStructureCache()
+    : mEntries(0, "container_structure"),
+      mTtlMs(0),
+      mMaxBytesPerFile(kDefaultMaxBytesPerFile),
+      mServedReads(0),
+      mServedBytes(0) {
+}
+
+void ContainerStructureCache::Configure(size_t capacity, milliseconds ttl, size_t maxBytesPerFile) {
+  mTtlMs = ttl.count() > 0 ? ttl.count() : 0;
+  mMaxBytesPerFile = maxBytesPerFile ? maxBytesPerFile : kDefaultMaxBytesPerFile;
+  mEntries.SetCapacity(capacity);
+}
+
+shared_ptr<mip::Stream> ContainerStructureCache::Wrap(shared_ptr<mip::Stream> inner, const FileIdentity& identity) {
+  if (!inner || !IsEnabled())
+    return inner;
+  Slot slot;
+  if (!mEntries.Find(identity.ToKey(), slot, [this](const Slot& cached) { return !IsExpired(cached); }))
+    slot.ranges.reset();
+  return std::make_shared<CachingStream>(*this, std::move(inner), identity, slot.ranges, mMaxBytesPerFile.load());
+}
+
+void ContainerStructureCache::Clear() {
+  mEntries.Clear();
+}
+
+ContainerStructureCache::Stats ContainerStructureCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.servedReads = mServedReads.load(std::memory_order_relaxed);
+  stats.servedBytes = mServedBytes.load(std::memory_order_relaxed);
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+size_t ContainerStructureCache::AddRange(Ranges& ranges, int64_t offset, const uint8_t* data, size_t length) {
+  if (length == 0)
+    return 0;
+  int64_t start = offset;
+  int64_t end = offset + static_cast<int64_t>(length);
+  // The first range that ends at or after start, then every range up to the first that starts after end.
+  auto first = ranges.upper_bound(start);
+  if (first != ranges.begin()) {
+    auto previous = std::prev(first);
+    if (previous->first + static_cast<int64_t>(previous->second.size()) >= start)
+      first = previous;
+  }
+  auto last = first;
+  size_t replaced = 0;
+  while (last != ranges.end() && last->first <= end) {
+    start = std::min(start, last->first);
+    end = std::max(end, last->first + static_cast<int64_t>(last->second.size()));
+    replaced += last->second.size();
+    ++last;
+  }
+
+  string merged(static_cast<size_t>(end - start), '\0');
+  for (auto it = first; it != last; ++it)
+    std::memcpy(&merged[static_cast<size_t>(it->first - start)], it->second.data(), it->second.size());
+  std::memcpy(&merged[static_cast<size_t>(offset - start)], data, length);
+  ranges.erase(first, last);
+  ranges.emplace(start, std::move(merged));
+  return static_cast<size_t>(end - start) - replaced;
+}
+
+bool ContainerStructureCache::ReadRange(const Ranges& ranges, int64_t offset, uint8_t* buffer, size_t length) {
+  auto it = ranges.upper_bound(offset);
+  if (it == ranges.begin())
+    return false;
+  --it;
+  const int64_t end = it->first + static_cast<int64_t>(it->second.size());
+  if (offset + static_cast<int64_t>(length) > end)
+    return false;
+  std::memcpy(buffer, it->second.data() + (offset - it->first), length);
+  return true;
+}
+
+bool ContainerStructureCache::IsExpired(const Slot& slot) const {
+  const int64_t ttlMs = mTtlMs.load();
+  return ttlMs > 0 && steady_clock::now() - slot.insertedAt >= milliseconds(ttlMs);
+}
+
+void ContainerStructureCache::Merge(const FileIdentity& identity, const Ranges& recorded) {
+  const size_t maxBytes = mMaxBytesPerFile.load();
+  mEntries.Upsert(identity.ToKey(), [&](Slot& slot) {
+    Ranges ranges;
+    if (slot.ranges && !IsExpired(slot)) {
+      ranges = *slot.ranges;
+    } else {
+      slot.insertedAt = steady_clock::now();
+      slot.bytes = 0;
+    }
+    for (const auto& range : recorded) {
+      if (slot.bytes + range.second.size() > maxBytes)
+        break;
+      slot.bytes += AddRange(ranges, range.first, reinterpret_cast<const uint8_t*>(range.second.data()), range.second.size());
+    }
+    slot.ranges = std::make_shared<const Ranges>(std::move(ranges));
+  });
+}
+
+void ContainerStructureCache::CountServed(size_t bytes) {
+  mServedReads.fetch_add(1, std::memory_order_relaxed);
+  mServedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
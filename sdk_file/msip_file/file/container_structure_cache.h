@@ -0,0 +1,121 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_CONTAINER_STRUCTURE_CACHE_H_
+#define SAMPLE_FILE_CONTAINER_STRUCTURE_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "mip/stream.h"
+
+#include "file_identity.h"
+#include "sharded_lru.h"
+
+// Short-lived cache of the bytes a file's container structure was parsed from, so an inspect followed by an
+// unprotect or a label read of the same file does not fetch them twice. The SDK parses the container
+// itself and cannot be handed a parsed directory, but it reads through the stream it is given: a wrapped
+// stream records the small reads made while the file is open (the ZIP end record and central directory,
+// the CFB header, FAT and directory sectors, the publishing license and label parts) and serves later
+// streams over the same file the same ranges from memory. Entries are keyed by device, inode, size and
+// mtime, so a rewritten file misses, and expire after a TTL counted from the first parse.
+class ContainerStructureCache final {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // Reads served from recorded ranges instead of the file.
+    uint64_t servedReads;
+    uint64_t servedBytes;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  // Reads larger than this are content, not structure, and are neither recorded nor served.
+  static const size_t kMaxRecordedRead = 64 * 1024;
+  static const size_t kDefaultMaxBytesPerFile = 256 * 1024;
+
+  ContainerStructureCache();
+
+  // capacity 0, the default, disables the cache. ttl 0 keeps entries until evicted. maxBytesPerFile bounds
+  // what one file records; 0 uses kDefaultMaxBytesPerFile.
+  void Configure(size_t capacity, std::chrono::milliseconds ttl, size_t maxBytesPerFile);
+
+  bool IsEnabled() const { return mEntries.GetCapacity() != 0; }
+
+  // Returns inner wrapped in a stream that serves the ranges recorded for identity and, once released,
+  // records what it read for the next one. Returns inner itself while the cache is disabled. identity must
+  // describe the file inner reads, as stat'ed once it was open.
+  std::shared_ptr<mip::Stream> Wrap(std::shared_ptr<mip::Stream> inner, const FileIdentity& identity);
+
+  void Clear();
+
+  Stats GetStats() const;
+
+  // Offset to bytes, non-overlapping and never adjacent.
+  typedef std::map<int64_t, std::string> Ranges;
+
+  // Adds length bytes at offset to ranges, merging them with the ranges they touch. Returns how many bytes
+  // ranges grew by.
+  static size_t AddRange(Ranges& ranges, int64_t offset, const uint8_t* data, size_t length);
+
+  // Copies length bytes at offset from ranges into buffer when one range holds all of them.
+  static bool ReadRange(const Ranges& ranges, int64_t offset, uint8_t* buffer, size_t length);
+
+private:
+  ContainerStructureCache(const ContainerStructureCache&) = delete;
+  ContainerStructureCache& operator=(const ContainerStructureCache&) = delete;
+
+  class CachingStream;
+
+  struct Slot {
+    std::chrono::steady_clock::time_point insertedAt;
+    std::shared_ptr<const Ranges> ranges;
+    size_t bytes;
+  };
+
+  bool IsExpired(const Slot& slot) const;
+  // Adds what a released stream recorded to the entry for identity.
+  void Merge(const FileIdentity& identity, const Ranges& recorded);
+  void CountServed(size_t bytes);
+
+  ShardedLru<Slot> mEntries;
+  std::atomic<int64_t> mTtlMs;
+  std::atomic<size_t> mMaxBytesPerFile;
+  std::atomic<uint64_t> mServedReads;
+  std::atomic<uint64_t> mServedBytes;
+};
+
+#endif // SAMPLE_FILE_CONTAINER_STRUCTURE_CACHE_H_
@@ -0,0 +1,227 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "content_dedupe.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "content_hash.h"
+#include "mapped_file_stream.h"
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Extensions stripped from an input before looking for its name in the output, covering "x.docx.pfile".
+static const int kMaxStrippedExtensions = 2;
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+string LowerExtension(const string& filePath) {
+  const auto slash = filePath.find_last_of('/');
+  const auto dot = filePath.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return "";
+  string extension = filePath.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return extension;
+}
+
+// filePath without its last extension, or unchanged when its file name has none.
+string StripExtension(const string& filePath) {
+  const auto slash = filePath.find_last_of('/');
+  const auto dot = filePath.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return filePath;
+  return filePath.substr(0, dot);
+}
+
+bool SameContent(const string& first, const string& second) {
+  MappedFileStream a(first);
+  MappedFileStream b(second);
+  return a.Size() == b.Size() && memcmp(a.Data(), b.Data(), static_cast<size_t>(a.Size())) == 0;
+}
+
+void CopyFile(const string& source, const string& target) {
+  int input = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (input < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", source));
+  struct stat info;
+  if (fstat(input, &info) != 0) {
+    auto message = ErrnoMessage("Failed to stat", source);
+    close(input);
+    throw runtime_error(message);
+  }
+  int output = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 0777);
+  if (output < 0) {
+    auto message = ErrnoMessage("Failed to create", target);
+    close(input);
+    throw runtime_error(message);
+  }
+  // Copied in the kernel, without passing through user space.
+  off_t offset = 0;
+  string error;
+  while (offset < info.st_size) {
+    const ssize_t copied = sendfile(output, input, &offset, static_cast<size_t>(info.st_size - offset));
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0) {
+      error = copied < 0 ? ErrnoMessage("Failed to copy to", target) : "Source shrank while copying to '" + target + "'";
+      break;
+    }
+  }
+  close(input);
+  if (close(output) != 0 && error.empty())
+    error = ErrnoMessage("Failed to write", target);
+  if (!error.empty()) {
+    unlink(target.c_str());
+    throw runtime_error(error);
+  }
+}
+
+} // namespace
+
+vector<size_t> ContentDedupe::FindOriginals(const char* const* filePaths, size_t count, const ParallelFor& parallelFor) {
+  vector<size_t> originals(count);
+  for (size_t i = 0; i < count; ++i)
+    originals[i] = i;
+
+  // Only a file whose size and extension another file shares can have a duplicate.
+  vector<int64_t> sizes(count, -1);
+  vector<string> extensions(count);
+  parallelFor(count, [&](size_t i) {
+    struct stat info;
+    if (filePaths[i] && stat(filePaths[i], &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      sizes[i] = static_cast<int64_t>(info.st_size);
+      extensions[i] = LowerExtension(filePaths[i]);
+    }
+  });
+  std::map<std::pair<int64_t, string>, vector<size_t>> bySize;
+  for (size_t i = 0; i < count; ++i) {
+    if (sizes[i] > 0)
+      bySize[std::make_pair(sizes[i], extensions[i])].push_back(i);
+  }
+  vector<size_t> candidates;
+  for (const auto& group : bySize) {
+    if (group.second.size() > 1)
+      candidates.insert(candidates.end(), group.second.begin(), group.second.end());
+  }
+  if (candidates.empty())
+    return originals;
+
+  vector<uint64_t> hashes(candidates.size());
+  vector<bool> hashed(candidates.size(), false);
+  parallelFor(candidates.size(), [&](size_t c) {
+    try {
+      MappedFileStream file(filePaths[candidates[c]]);
+      // The file changed since it was stat'ed; leave it out rather than compare it against a stale size.
+      if (file.Size() != sizes[candidates[c]])
+        return;
+      hashes[c] = XxHash64(file.Data(), static_cast<size_t>(file.Size()), 0);
+      hashed[c] = true;
+    } catch (const std::exception&) {
+    }
+  });
+
+  // The first file of each content, in batch order, is its original.
+  std::map<std::tuple<int64_t, string, uint64_t>, size_t> firstByContent;
+  vector<size_t> duplicates;
+  vector<size_t> ordered(candidates.size());
+  for (size_t c = 0; c < candidates.size(); ++c)
+    ordered[c] = c;
+  std::sort(ordered.begin(), ordered.end(), [&](size_t a, size_t b) { return candidates[a] < candidates[b]; });
+  for (size_t c : ordered) {
+    if (!hashed[c])
+      continue;
+    const size_t i = candidates[c];
+    auto inserted = firstByContent.insert(std::make_pair(std::make_tuple(sizes[i], extensions[i], hashes[c]), i));
+    if (!inserted.second) {
+      originals[i] = inserted.first->second;
+      duplicates.push_back(i);
+    }
+  }
+
+  parallelFor(duplicates.size(), [&](size_t d) {
+    const size_t i = duplicates[d];
+    try {
+      if (!SameContent(filePaths[originals[i]], filePaths[i]))
+        originals[i] = i;
+    } catch (const std::exception&) {
+      originals[i] = i;
+    }
+  });
+  return originals;
+}
+
+bool ContentDedupe::DeriveOutputPath(
+    const string& originalPath,
+    const string& originalOutput,
+    const string& duplicatePath,
+    string& duplicateOutput) {
+  string originalStem = originalPath;
+  string duplicateStem = duplicatePath;
+  for (int stripped = 0; stripped < kMaxStrippedExtensions; ++stripped) {
+    originalStem = StripExtension(originalStem);
+    duplicateStem = StripExtension(duplicateStem);
+    if (originalOutput.compare(0, originalStem.size(), originalStem) == 0 && originalOutput.size() > originalStem.size()) {
+      const string suffix = originalOutput.substr(originalStem.size());
+      // A suffix holding a separator would put the duplicate's output in another directory.
+      if (suffix.find('/') != string::npos)
+        return false;
+      duplicateOutput = duplicateStem + suffix;
+      return duplicateOutput != duplicatePath;
+    }
+  }
+  return false;
+}
+
+void ContentDedupe::Materialize(const string& source, const string& target, Mode mode) {
+  if (source == target)
+    return;
+  if (mode == Mode::HardLink) {
+    if (unlink(target.c_str()) != 0 && errno != ENOENT)
+      throw runtime_error(ErrnoMessage("Failed to replace", target));
+    if (link(source.c_str(), target.c_str()) == 0)
+      return;
+  }
+  CopyFile(source, target);
+}
@@ -0,0 +1,70 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_CONTENT_DEDUPE_H_
+#define SAMPLE_FILE_CONTENT_DEDUPE_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Finds the byte-identical files of a batch, so an expensive operation runs once per distinct content and
+// the other copies reuse its output. Only files whose size and extension match another file of the batch
+// are read. Those are hashed over a mapping of the file, and every match is confirmed byte for byte
+// before it is reported, so a hash collision can never hand one file another file's output.
+class ContentDedupe final {
+public:
+  enum class Mode {
+    Off = 0,
+    // Duplicates get their own copy of the output.
+    Copy = 1,
+    // Duplicates get a hard link to the output, or a copy when the link fails, e.g. across file systems.
+    HardLink = 2,
+  };
+
+  // Runs task(i) for every i in [0, count), possibly in parallel.
+  typedef std::function<void(size_t count, const std::function<void(size_t)>& task)> ParallelFor;
+
+  // For each path, the index of the first path of the batch with the same content, or its own index when
+  // it has none. Unreadable and empty files are their own originals.
+  static std::vector<size_t> FindOriginals(const char* const* filePaths, size_t count, const ParallelFor& parallelFor);
+
+  // Output path for duplicatePath, named the way the operation named originalOutput for originalPath, e.g.
+  // "b/y_modified.docx" for "b/y.docx" when "a/x.docx" became "a/x_modified.docx". False when the output
+  // does not follow the input's name.
+  static bool DeriveOutputPath(
+      const std::string& originalPath,
+      const std::string& originalOutput,
+      const std::string& duplicatePath,
+      std::string& duplicateOutput);
+
+  // Replaces target with a copy of, or a hard link to, source. Throws std::runtime_error on failure.
+  static void Materialize(const std::string& source, const std::string& target, Mode mode);
+};
+
+#endif // SAMPLE_FILE_CONTENT_DEDUPE_H_
@@ -0,0 +1,114 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "content_hash.h"
+
+#include <cstring>
+
+namespace {
+
+static const uint64_t kPrime1 = 11400714785074694791ULL;
+static const uint64_t kPrime2 = 14029467366897019727ULL;
+static const uint64_t kPrime3 = 1609587929392839161ULL;
+static const uint64_t kPrime4 = 9650029242287828579ULL;
+static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+inline uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t Read64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline uint32_t Read32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline uint64_t Round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * kPrime2;
+  accumulator = RotateLeft(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t accumulator, uint64_t value) {
+  accumulator ^= Round(0, value);
+  return accumulator * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+uint64_t XxHash64(const uint8_t* data, size_t length, uint64_t seed) {
+  const uint8_t* end = data + length;
+  uint64_t hash;
+  if (length >= 32) {
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+    const uint8_t* limit = end - 32;
+    do {
+      v1 = Round(v1, Read64(data));
+      v2 = Round(v2, Read64(data + 8));
+      v3 = Round(v3, Read64(data + 16));
+      v4 = Round(v4, Read64(data + 24));
+      data += 32;
+    } while (data <= limit);
+    hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+    hash = MergeRound(hash, v1);
+    hash = MergeRound(hash, v2);
+    hash = MergeRound(hash, v3);
+    hash = MergeRound(hash, v4);
+  } else {
+    hash = seed + kPrime5;
+  }
+  hash += static_cast<uint64_t>(length);
+
+  for (; data + 8 <= end; data += 8) {
+    hash ^= Round(0, Read64(data));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (data + 4 <= end) {
+    hash ^= static_cast<uint64_t>(Read32(data)) * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    data += 4;
+  }
+  for (; data < end; ++data) {
+    hash ^= (*data) * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
@@ -0,0 +1,183 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "content_tracker.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+#include "request_deadline.h"
+
+using mip::AsyncControl;
+using mip::ProtectionEngine;
+using sample::deadline::Deadline;
+using std::exception_ptr;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Outcomes of one Run. Callbacks may arrive after Run gave up at its deadline, so they hold it too.
+struct Batch {
+  explicit Batch(size_t count) : inFlight(0), finished(count, false), errors(count) {}
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  size_t inFlight;
+  vector<bool> finished;
+  vector<string> errors;
+
+  void Finish(size_t index, const string& error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (finished[index])
+      return;
+    finished[index] = true;
+    errors[index] = error;
+    --inFlight;
+    changed.notify_all();
+  }
+};
+
+struct Request {
+  shared_ptr<Batch> batch;
+  size_t index;
+};
+
+string Describe(const exception_ptr& error) {
+  try {
+    std::rethrow_exception(error);
+  }
+  catch (const std::exception& ex) {
+    return ex.what();
+  }
+  catch (...) {
+    return "Unknown error";
+  }
+}
+
+class TrackingObserver final : public ProtectionEngine::Observer {
+public:
+  void OnRegisterContentForTrackingAndRevocationSuccess(const shared_ptr<void>& context) override {
+    Complete(context, string());
+  }
+
+  void OnRegisterContentForTrackingAndRevocationFailure(const exception_ptr& error, const shared_ptr<void>& context) override {
+    Complete(context, Describe(error));
+  }
+
+  void OnRevokeContentSuccess(const shared_ptr<void>& context) override {
+    Complete(context, string());
+  }
+
+  void OnRevokeContentFailure(const exception_ptr& error, const shared_ptr<void>& context) override {
+    Complete(context, Describe(error));
+  }
+
+private:
+  static void Complete(const shared_ptr<void>& context, const string& error) {
+    auto request = static_cast<Request*>(context.get());
+    request->batch->Finish(request->index, error);
+  }
+};
+
+} // namespace
+
+const size_t ContentTracker::kDefaultMaxInFlight;
+
+void ContentTracker::Run(
+    const shared_ptr<ProtectionEngine>& engine,
+    Action action,
+    bool notifyOwner,
+    vector<Item>& items,
+    size_t maxInFlight) {
+  if (maxInFlight == 0)
+    maxInFlight = 1;
+  auto batch = std::make_shared<Batch>(items.size());
+  auto observer = std::make_shared<TrackingObserver>();
+  vector<shared_ptr<AsyncControl>> controls(items.size());
+  const Deadline deadline = Deadline::Current();
+
+  auto waitUntil = [&](std::unique_lock<std::mutex>& lock, const std::function<bool()>& ready) {
+    if (deadline.IsSet())
+      return batch->changed.wait_until(lock, deadline.GetExpiry(), ready);
+    batch->changed.wait(lock, ready);
+    return true;
+  };
+
+  bool expired = false;
+  for (size_t i = 0; i < items.size() && !expired; ++i) {
+    if (!items[i].error.empty()) {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->finished[i] = true;
+      batch->errors[i] = items[i].error;
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> lock(batch->mutex);
+      expired = !waitUntil(lock, [&]() { return batch->inFlight < maxInFlight; });
+      if (expired)
+        break;
+      ++batch->inFlight;
+    }
+    auto request = std::make_shared<Request>();
+    request->batch = batch;
+    request->index = i;
+    try {
+      if (action == Action::Register) {
+        controls[i] = engine->RegisterContentForTrackingAndRevocationAsync(
+            items[i].publishingLicense, items[i].contentName, notifyOwner, observer, request);
+      } else {
+        controls[i] = engine->RevokeContentAsync(items[i].publishingLicense, observer, request);
+      }
+    }
+    catch (const std::exception& ex) {
+      batch->Finish(i, ex.what());
+    }
+  }
+
+  vector<shared_ptr<AsyncControl>> outstanding;
+  {
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    if (!expired)
+      waitUntil(lock, [&]() { return batch->inFlight == 0; });
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (batch->finished[i]) {
+        items[i].error = batch->errors[i];
+      } else {
+        items[i].error = sample::deadline::DeadlineExceededError().what();
+        if (controls[i])
+          outstanding.push_back(controls[i]);
+      }
+      items[i].succeeded = items[i].error.empty();
+    }
+  }
+  // Outside the lock: a cancelled request may report its failure before Cancel returns.
+  for (auto& control : outstanding)
+    control->Cancel();
+}
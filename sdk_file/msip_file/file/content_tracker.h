@@ -0,0 +1,64 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_CONTENT_TRACKER_H_
+#define SAMPLE_FILE_CONTENT_TRACKER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/protection/protection_engine.h"
+
+// Registers many publishing licenses for document tracking, or revokes them, through the engine's async
+// calls. Up to maxInFlight requests are outstanding at once and share the pooled HTTP delegate, so a batch
+// of thousands takes about count / maxInFlight service round trips instead of count, with no thread per
+// request. Requests still outstanding at the calling thread's deadline are cancelled.
+class ContentTracker final {
+public:
+  enum class Action { Register, Revoke };
+
+  struct Item {
+    std::vector<uint8_t> publishingLicense;
+    std::string contentName;  // Only sent when registering; the license's own name takes precedence.
+    bool succeeded;
+    std::string error;        // Items that already have an error are skipped.
+  };
+
+  static const size_t kDefaultMaxInFlight = 64;
+
+  static void Run(
+      const std::shared_ptr<mip::ProtectionEngine>& engine,
+      Action action,
+      bool notifyOwner,
+      std::vector<Item>& items,
+      size_t maxInFlight = kDefaultMaxInFlight);
+};
+
+#endif // SAMPLE_FILE_CONTENT_TRACKER_H_
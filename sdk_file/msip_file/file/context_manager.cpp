@@ -0,0 +1,1122 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "context_manager.h"
+
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "allocation_account.h"
+#include "async_completion.h"
+#include "consent_delegate_impl.h"
+#include "encrypted_log_storage_delegate.h"
+#include "event_log.h"
+#include "mip/common_types.h"
+#include "mip/diagnostic_configuration.h"
+#include "mip/mip_configuration.h"
+#include "phase_metrics.h"
+#include "profile_observer.h"
+#include "resource_tuner.h"
+#include "tracing_storage_delegate.h"
+
+using mip::ApplicationInfo;
+using mip::CacheStorageType;
+using mip::FileProfile;
+using mip::MipConfiguration;
+using mip::MipContext;
+using mip::PolicyProfile;
+using mip::ProtectionProfile;
+using sample::auth::TokenAcquirer;
+using sample::consent::ConsentDelegateImpl;
+using sample::diag::AuditUploadDelegate;
+using sample::diag::DiagnosticUploader;
+using sample::diag::TelemetryUploadDelegate;
+using sample::http::HttpDelegateImpl;
+using sample::http::ReplayHttpDelegate;
+using sample::http::TracingHttpDelegate;
+using sample::lock::InstrumentedMutex;
+using sample::log::AsyncLoggerDelegate;
+using sample::task::TaskDispatcherImpl;
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+static const char kApplicationName[] = "MsipFileApp";
+static const char kApplicationVersion[] = "1.0.0.0";
+static const char kDefaultStoragePath[] = "file_sample_storage";
+static const char kDefaultLocale[] = "en-US";
+static const char kInspectionStorageDirectory[] = "/inspection";
+// Next to the SDK's own storage, so removing the storage directory forgets the engines with it.
+static const char kEngineManifestFile[] = "/engine_manifest.json";
+
+static const int kGracefulTeardownTimeSec = 2;
+// Spans are only recorded for requests made under a sampled trace context, so this bounds what an
+// exporter that never drains can cost.
+static const size_t kDefaultTraceBufferSize = 1024;
+
+// The SDK only takes JSON and XML delegates through a subclass of its configuration.
+class DelegatingMipConfiguration final : public MipConfiguration {
+public:
+  DelegatingMipConfiguration(
+      const ApplicationInfo& appInfo,
+      const string& path,
+      mip::LogLevel thresholdLogLevel,
+      bool isOfflineOnly,
+      const shared_ptr<mip::JsonDelegate>& jsonDelegate,
+      const shared_ptr<mip::xml::XmlDelegate>& xmlDelegate)
+      : MipConfiguration(appInfo, path, thresholdLogLevel, isOfflineOnly) {
+    mJsonDelegate = jsonDelegate;
+    mXmlDelegate = xmlDelegate;
+  }
+};
+
+shared_ptr<MipContext> CreateMipContext(
+    const string& applicationId,
+    bool fastShutdown,
+    const string& storagePath,
+    const shared_ptr<mip::StorageDelegate>& storageDelegate,
+    const shared_ptr<AsyncLoggerDelegate>& loggerDelegate,
+    const shared_ptr<mip::HttpDelegate>& httpDelegate,
+    const shared_ptr<mip::JsonDelegate>& jsonDelegate,
+    const shared_ptr<mip::xml::XmlDelegate>& xmlDelegate,
+    const shared_ptr<DiagnosticUploader>& diagnosticUploader,
+    const map<mip::FlightingFeature, bool>& featureSettings) {
+  ApplicationInfo appInfo;
+  appInfo.applicationId = applicationId;
+  appInfo.applicationName = kApplicationName;
+  appInfo.applicationVersion = kApplicationVersion;
+
+  auto diagnosticOverride = make_shared<mip::DiagnosticConfiguration>();
+  // Audit events are uploaded by the SDK's background pipeline as soon as they are logged, so
+  // nothing is left for a request (or for shutdown) to flush.
+  diagnosticOverride->isAuditPriorityEnhanced = true;
+  if (diagnosticUploader) {
+    // Events go to the collector in compressed batches instead of the SDK's own pipeline.
+    diagnosticOverride->auditPipelineDelegateOverride = make_shared<AuditUploadDelegate>(diagnosticUploader);
+    diagnosticOverride->telemetryPipelineDelegateOverride = make_shared<TelemetryUploadDelegate>(diagnosticUploader);
+  }
+  if (fastShutdown) {
+    diagnosticOverride->isFastShutdownEnabled = true;
+  } else {
+    diagnosticOverride->maxTeardownTimeSec = kGracefulTeardownTimeSec;
+    diagnosticOverride->isMaxTeardownTimeEnabled = true;
+  }
+  auto mipConfiguration = make_shared<DelegatingMipConfiguration>(
+      appInfo, storagePath, loggerDelegate->GetCaptureLevel(), false /*isOfflineOnly*/, jsonDelegate, xmlDelegate);
+  mipConfiguration->SetDiagnosticConfiguration(diagnosticOverride);
+  mipConfiguration->SetLoggerDelegate(loggerDelegate);
+  mipConfiguration->SetHttpDelegate(httpDelegate);
+  if (storageDelegate)
+    mipConfiguration->SetStorageDelegate(make_shared<sample::storage::TracingStorageDelegate>(storageDelegate));
+  mipConfiguration->SetFeatureSettings(featureSettings);
+
+  ScopedPhase phase(PhaseMetrics::Phase::ContextCreate);
+  return MipContext::Create(mipConfiguration);
+}
+
+// Context for FileHandler::GetFileStatus, which only parses the file's container header and label
+// metadata locally. It never touches the network, logs errors only and skips the audit/telemetry
+// pipeline's network probing and disk cache, so it is much cheaper to keep around than the full context.
+shared_ptr<MipContext> CreateInspectionContext(
+    const string& applicationId,
+    const string& storagePath,
+    const shared_ptr<AsyncLoggerDelegate>& loggerDelegate,
+    const shared_ptr<mip::JsonDelegate>& jsonDelegate,
+    const shared_ptr<mip::xml::XmlDelegate>& xmlDelegate) {
+  ApplicationInfo appInfo;
+  appInfo.applicationId = applicationId;
+  appInfo.applicationName = kApplicationName;
+  appInfo.applicationVersion = kApplicationVersion;
+
+  auto diagnosticOverride = make_shared<mip::DiagnosticConfiguration>();
+  diagnosticOverride->isNetworkDetectionEnabled = false;
+  diagnosticOverride->isLocalCachingEnabled = false;
+  diagnosticOverride->isMinimalTelemetryEnabled = true;
+  diagnosticOverride->isFastShutdownEnabled = true;
+  auto mipConfiguration = make_shared<DelegatingMipConfiguration>(
+      appInfo, storagePath + kInspectionStorageDirectory, mip::LogLevel::Error, true /*isOfflineOnly*/, jsonDelegate, xmlDelegate);
+  mipConfiguration->SetDiagnosticConfiguration(diagnosticOverride);
+  mipConfiguration->SetLoggerDelegate(loggerDelegate);
+
+  ScopedPhase phase(PhaseMetrics::Phase::ContextCreate);
+  return MipContext::Create(mipConfiguration);
+}
+
+shared_ptr<FileProfile> CreateProfile(
+    const shared_ptr<MipContext>& mipContext,
+    const ContextManager::StorageOptions& storageOptions,
+    mip::DnsRedirection dnsRedirection,
+    const shared_ptr<ConsentDelegateImpl>& consentDelegate,
+    const shared_ptr<TaskDispatcherImpl>& taskDispatcher,
+    const shared_ptr<mip::HttpDelegate>& httpDelegate) {
+  FileProfile::Settings profileSettings(
+      mipContext,
+      storageOptions.cacheStorageType,
+      consentDelegate,
+      make_shared<ProfileObserver>());
+  profileSettings.SetCanCacheLicenses(storageOptions.canCacheLicenses);
+  profileSettings.SetDnsRedirection(dnsRedirection);
+  // Audit and telemetry keep their own dispatcher (the SDK advises against sharing one with them).
+  profileSettings.SetTaskDispatcherDelegate(taskDispatcher);
+  profileSettings.SetHttpDelegate(httpDelegate);
+
+  auto loadCompletion = AsyncCompletion<shared_ptr<FileProfile>>::Create();
+  auto loadFuture = loadCompletion->GetFuture();
+  ScopedPhase phase(PhaseMetrics::Phase::ProfileLoad);
+  SdkAsync::LoadProfile(profileSettings, loadCompletion);
+  return loadFuture.get();
+}
+
+shared_ptr<ProtectionProfile> CreateProtectionProfile(
+    const shared_ptr<MipContext>& mipContext,
+    const ContextManager::StorageOptions& storageOptions,
+    mip::DnsRedirection dnsRedirection,
+    const shared_ptr<ConsentDelegateImpl>& consentDelegate,
+    const shared_ptr<TaskDispatcherImpl>& taskDispatcher,
+    const shared_ptr<mip::HttpDelegate>& httpDelegate) {
+  ProtectionProfile::Settings profileSettings(
+      mipContext,
+      storageOptions.cacheStorageType,
+      consentDelegate);
+  profileSettings.SetCanCacheLicenses(storageOptions.canCacheLicenses);
+  profileSettings.SetDnsRedirection(dnsRedirection);
+  profileSettings.SetTaskDispatcherDelegate(taskDispatcher);
+  profileSettings.SetHttpDelegate(httpDelegate);
+#ifdef MIP_OFFLINE_PUBLISHING_ENABLED
+  // Only lets engines publish with a cached certificate; calls that do not ask for it still go online.
+  profileSettings.SetOfflinePublishing(true);
+#endif // MIP_OFFLINE_PUBLISHING_ENABLED
+  ScopedPhase phase(PhaseMetrics::Phase::ProfileLoad);
+  return ProtectionProfile::Load(profileSettings);
+}
+
+shared_ptr<PolicyProfile> CreatePolicyProfile(
+    const shared_ptr<MipContext>& mipContext,
+    const ContextManager::StorageOptions& storageOptions,
+    const shared_ptr<TaskDispatcherImpl>& taskDispatcher,
+    const shared_ptr<mip::HttpDelegate>& httpDelegate) {
+  PolicyProfile::Settings profileSettings(mipContext, storageOptions.cacheStorageType, nullptr /*observer*/);
+  profileSettings.SetTaskDispatcherDelegate(taskDispatcher);
+  profileSettings.SetHttpDelegate(httpDelegate);
+  ScopedPhase phase(PhaseMetrics::Phase::ProfileLoad);
+  return PolicyProfile::Load(profileSettings);
+}
+
+// A protection engine is released with its last reference, but a policy profile keeps its engines loaded
+// until they are unloaded.
+void UnloadPolicyEngines(const EngineLru<ContextManager::PolicyEngineEntry>::Entries& engines) {
+  for (const auto& entry : engines) {
+    auto profile = entry.second.profile.lock();
+    if (profile && entry.second.engine)
+      // Fire and forget, as the EngineCache unloads file engines.
+      profile->UnloadEngineAsync(entry.second.engine->GetSettings().GetEngineId(), nullptr);
+  }
+}
+
+} // namespace
+
+ContextManager::ContextManager()
+    : mProtectionEngineLoads(MetricsRegistry::Shared().GetCounter(
+          "msip_native_engine_loads_coalesced_total", "Engine loads that waited for one already in flight")),
+      mPolicyEngineLoads(MetricsRegistry::Shared().GetCounter(
+          "msip_native_engine_loads_coalesced_total", "Engine loads that waited for one already in flight")),
+      mConsentDelegate(make_shared<ConsentDelegateImpl>(false /*isVerbose*/)),
+      mForkPrepared(false),
+      mContextCount(0),
+      mWarmupState(static_cast<int>(WarmupState::None)),
+      mHealthDispatcher(nullptr),
+      mFastShutdown(true),
+      mCloneLabelOutputs(false),
+      mPfileFastPath(false),
+      mSkipUnchanged(false),
+      mBatchDedupe(ContentDedupe::Mode::Off),
+      mNumaPlacement(false),
+      mBatchPipeline(),
+      mLastBatchPipelineRun(),
+      mBatchPipelineRuns(0),
+      mDelegating(false) {
+  mPdfOptions.keepLinearization = false;
+  mPdfOptions.incrementalUpdates = false;
+  mBatchReadAhead = AsyncFileReader::Settings();
+  mBatchPrefetch = BatchPrefetcher::Settings();
+  mInputStreams = InputStreams::Defaults();
+  mObjectInputStream = ObjectInputStream::Defaults();
+  mObjectOutputStream = ObjectOutputStream::Defaults();
+  mOutputWriter = AlignedFileOutputStream::Options();
+  mPackageRepack = PackageRepacker::Defaults();
+  mStorageOptions.cacheStorageType = CacheStorageType::InMemory;
+  mStorageOptions.storagePath = kDefaultStoragePath;
+  mStorageOptions.canCacheLicenses = true;
+  mStorageOptions.policyTtlDays = 0;
+  mStorageOptions.exportPolicySnapshot = false;
+  mStorageOptions.loadSensitivityTypes = false;
+  auto engineOptions = make_shared<EngineOptions>();
+  engineOptions->locale = kDefaultLocale;
+  engineOptions->maxFileSizeForProtection = 0;
+  mEngineOptions = engineOptions;
+  mDefaultRegion.dataBoundary = mip::DataBoundary::Default;
+  mDefaultRegion.dnsRedirection = mip::DnsRedirection::MDEDiscovery;
+}
+
+ContextManager& ContextManager::Instance() {
+  // Intentionally leaked: MipContext must be shut down explicitly (see ShutDown) and must not be
+  // torn down from a static destructor after the SDK's own globals are gone.
+  static ContextManager* instance = new ContextManager();
+  return *instance;
+}
+
+void ContextManager::Initialize(const string& applicationId) {
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    GetOrCreateState(applicationId);
+  }
+  GetInspectionContext(applicationId);
+}
+
+void ContextManager::ShutDown(std::chrono::steady_clock::time_point flushDeadline) {
+  ScopedPhase phase(PhaseMetrics::Phase::ShutDown);
+  // Its running shards and batches still use the contexts torn down below.
+  ConfigureShards(nullptr, nullptr);
+  ConfigureWatcher(nullptr);
+  map<string, ApplicationState> states;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    states.swap(mStates);
+  }
+  mContextCount = 0;
+
+  map<string, shared_ptr<MipContext>> inspectionContexts;
+  {
+    lock_guard<mutex> lock(mInspectionMutex);
+    inspectionContexts.swap(mInspectionContexts);
+  }
+
+  EngineLru<ProtectionEngineEntry>::Entries protectionEngines;
+  {
+    lock_guard<mutex> lock(mProtectionEngineMutex);
+    protectionEngines = mProtectionEngines.TakeAll();
+  }
+  // Their profiles are released below, engines and all.
+  EngineLru<PolicyEngineEntry>::Entries policyEngines;
+  {
+    lock_guard<mutex> lock(mPolicyEngineMutex);
+    policyEngines = mPolicyEngines.TakeAll();
+  }
+
+  // Protection handlers belong to engines, and engines hold references into their profile.
+  mStreamHandles.Clear();
+  mFileSessions.Clear();
+  mProtectionCache.Clear();
+  mDescriptorInterner.Clear();
+  mUseLicenseCache.Clear();
+  mDelegationLicenseCache.Clear();
+  mEngineCache.Clear();
+  {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+    protectionEngines.clear();
+    policyEngines.clear();
+  }
+  for (auto& entry : states) {
+    entry.second.policyProfile.reset();
+    entry.second.protectionProfile.reset();
+    entry.second.profile.reset();
+    if (entry.second.mipContext)
+      entry.second.mipContext->ShutDown();
+  }
+  for (auto& entry : inspectionContexts)
+    entry.second->ShutDown();
+  mKnownCleanFilter.Save();
+  // The contexts log and audit their own shutdown, so the queues are flushed last.
+  const bool bounded = flushDeadline != std::chrono::steady_clock::time_point::max();
+  if (auto diagnosticUploader = GetDiagnosticUploader()) {
+    if (bounded)
+      diagnosticUploader->FlushUntil(flushDeadline);
+    else
+      diagnosticUploader->Flush();
+  }
+  if (bounded)
+    GetLoggerDelegate()->FlushUntil(flushDeadline);
+  else
+    GetLoggerDelegate()->Flush();
+}
+
+void ContextManager::DropCaches(CacheLayer layer) {
+  if (layer == CacheLayer::Contexts) {
+    ShutDown();
+    return;
+  }
+  mInspectionCache.Clear();
+  mKnownCleanFilter.Clear();
+  mProtectionCache.Clear();
+  mDescriptorInterner.Clear();
+  mLicenseInfoCache.Clear();
+  mUseLicenseCache.Clear();
+  mDelegationLicenseCache.Clear();
+  mRightsCache.Clear();
+  mDecryptedContentCache.Clear();
+  mContainerStructureCache.Clear();
+  if (layer != CacheLayer::Engines)
+    return;
+
+  EngineLru<ProtectionEngineEntry>::Entries protectionEngines;
+  {
+    lock_guard<mutex> lock(mProtectionEngineMutex);
+    protectionEngines = mProtectionEngines.TakeAll();
+  }
+  EngineLru<PolicyEngineEntry>::Entries policyEngines;
+  {
+    lock_guard<mutex> lock(mPolicyEngineMutex);
+    policyEngines = mPolicyEngines.TakeAll();
+  }
+  mEngineCache.Clear();
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  UnloadPolicyEngines(policyEngines);
+  protectionEngines.clear();
+  policyEngines.clear();
+}
+
+ContextManager::DrainResult ContextManager::Drain(std::chrono::milliseconds timeout, std::chrono::milliseconds flushTimeout) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  using std::chrono::steady_clock;
+  DrainResult result = {};
+  mAdmissionController.SetDraining(true);
+  // No more shards are claimed; the running ones finish as in-flight work, or are released once refused.
+  {
+    lock_guard<mutex> lock(mShardMutex);
+    if (mShardWorker)
+      mShardWorker->Stop();
+  }
+  // Files written from now on are left to the replica that replaces this one.
+  ConfigureWatcher(nullptr);
+  const auto started = steady_clock::now();
+  result.drained = WaitForIdle(started + timeout);
+  result.inFlight = mAdmissionController.GetStats().inFlight;
+  const auto flushStarted = steady_clock::now();
+  result.waited = duration_cast<milliseconds>(flushStarted - started);
+
+  // Events queued by the finished work go out while the contexts and transport are still up.
+  const auto flushDeadline = flushStarted + flushTimeout;
+  result.flushed = true;
+  if (auto diagnosticUploader = GetDiagnosticUploader())
+    result.flushed = diagnosticUploader->FlushUntil(flushDeadline);
+  result.flushed = GetLoggerDelegate()->FlushUntil(flushDeadline) && result.flushed;
+  auto storage = std::dynamic_pointer_cast<sample::storage::EncryptedLogStorageDelegate>(GetStorageOptions().storageDelegate);
+  result.synced = !storage || storage->Sync();
+
+  ShutDown(flushDeadline);
+  result.flushing = duration_cast<milliseconds>(steady_clock::now() - flushStarted);
+  return result;
+}
+
+void ContextManager::SetFastShutdown(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mFastShutdown = enabled;
+}
+
+void ContextManager::SetNativeJson(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (!enabled)
+    mJsonDelegate.reset();
+  else if (!mJsonDelegate)
+    mJsonDelegate = make_shared<sample::json::JsonDelegateImpl>();
+}
+
+void ContextManager::SetNativeXml(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (!enabled)
+    mXmlDelegate.reset();
+  else if (!mXmlDelegate)
+    mXmlDelegate = make_shared<XmlDelegateImpl>();
+}
+
+void ContextManager::SetCloneLabelOutputs(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mCloneLabelOutputs = enabled;
+}
+
+bool ContextManager::GetCloneLabelOutputs() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mCloneLabelOutputs;
+}
+
+void ContextManager::SetPfileFastPath(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mPfileFastPath = enabled;
+}
+
+bool ContextManager::GetPfileFastPath() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mPfileFastPath;
+}
+
+void ContextManager::SetSkipUnchanged(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mSkipUnchanged = enabled;
+}
+
+bool ContextManager::GetSkipUnchanged() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mSkipUnchanged;
+}
+
+void ContextManager::SetPdfOptions(const PdfOptions& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mPdfOptions = options;
+}
+
+ContextManager::PdfOptions ContextManager::GetPdfOptions() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mPdfOptions;
+}
+
+void ContextManager::SetBatchDedupe(ContentDedupe::Mode mode) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mBatchDedupe = mode;
+}
+
+ContentDedupe::Mode ContextManager::GetBatchDedupe() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mBatchDedupe;
+}
+
+void ContextManager::SetBatchReadAhead(const AsyncFileReader::Settings& settings) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mBatchReadAhead = settings;
+}
+
+AsyncFileReader::Settings ContextManager::GetBatchReadAhead() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mBatchReadAhead;
+}
+
+void ContextManager::SetBatchPrefetch(const BatchPrefetcher::Settings& settings) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mBatchPrefetch = settings;
+}
+
+BatchPrefetcher::Settings ContextManager::GetBatchPrefetch() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mBatchPrefetch;
+}
+
+void ContextManager::SetNumaPlacement(bool enabled) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mNumaPlacement = enabled;
+}
+
+bool ContextManager::GetNumaPlacement() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mNumaPlacement;
+}
+
+void ContextManager::SetBatchPipeline(const BatchPipelineOptions& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mBatchPipeline = options;
+}
+
+ContextManager::BatchPipelineOptions ContextManager::GetBatchPipeline() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mBatchPipeline;
+}
+
+void ContextManager::RecordBatchPipelineRun(const StagedPipeline::Stats& stats) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mLastBatchPipelineRun = stats;
+  ++mBatchPipelineRuns;
+}
+
+StagedPipeline::Stats ContextManager::GetLastBatchPipelineRun(uint64_t& runs) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  runs = mBatchPipelineRuns;
+  return mLastBatchPipelineRun;
+}
+
+void ContextManager::SetInputStreams(const InputStreams::Options& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mInputStreams = options;
+}
+
+InputStreams::Options ContextManager::GetInputStreams() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mInputStreams;
+}
+
+void ContextManager::SetObjectStreams(const ObjectInputStream::Options& input, const ObjectOutputStream::Options& output) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mObjectInputStream = input;
+  mObjectOutputStream = output;
+}
+
+ObjectInputStream::Options ContextManager::GetObjectInputStream() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mObjectInputStream;
+}
+
+ObjectOutputStream::Options ContextManager::GetObjectOutputStream() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mObjectOutputStream;
+}
+
+void ContextManager::SetOutputWriter(const AlignedFileOutputStream::Options& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mOutputWriter = options;
+}
+
+AlignedFileOutputStream::Options ContextManager::GetOutputWriter() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mOutputWriter;
+}
+
+void ContextManager::SetPackageRepack(const PackageRepacker::Options& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mPackageRepack = options;
+}
+
+PackageRepacker::Options ContextManager::GetPackageRepack() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mPackageRepack;
+}
+
+void ContextManager::SetStorageOptions(const StorageOptions& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mStorageOptions = options;
+  if (mStorageOptions.storagePath.empty())
+    mStorageOptions.storagePath = kDefaultStoragePath;
+  mEngineManifest.reset();
+}
+
+ContextManager::StorageOptions ContextManager::GetStorageOptions() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mStorageOptions;
+}
+
+void ContextManager::SetEngineOptions(const EngineOptions& options) {
+  auto engineOptions = make_shared<EngineOptions>(options);
+  if (engineOptions->locale.empty())
+    engineOptions->locale = kDefaultLocale;
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mEngineOptions = engineOptions;
+}
+
+shared_ptr<const ContextManager::EngineOptions> ContextManager::GetEngineOptions() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mEngineOptions;
+}
+
+void ContextManager::SetRegionOptions(const string& applicationId, const RegionOptions& options) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (applicationId.empty())
+    mDefaultRegion = options;
+  else
+    mRegions[applicationId] = options;
+}
+
+ContextManager::RegionOptions ContextManager::GetRegionOptions(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return FindRegion(applicationId);
+}
+
+const ContextManager::RegionOptions& ContextManager::FindRegion(const string& applicationId) const {
+  auto it = mRegions.find(applicationId);
+  return it != mRegions.end() ? it->second : mDefaultRegion;
+}
+
+void ContextManager::SetServiceIdentity(const string& applicationId, const string& serviceIdentity) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (serviceIdentity.empty())
+    mServiceIdentities.erase(applicationId);
+  else
+    mServiceIdentities[applicationId] = serviceIdentity;
+  mDelegating = !mServiceIdentities.empty();
+}
+
+string ContextManager::GetServiceIdentity(const string& applicationId) {
+  if (!mDelegating.load(std::memory_order_relaxed))
+    return "";
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  auto it = mServiceIdentities.find(applicationId);
+  return it != mServiceIdentities.end() ? it->second : "";
+}
+
+void ContextManager::SetClientSecret(const string& clientSecret) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  mClientSecret = clientSecret;
+}
+
+string ContextManager::GetClientSecret() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mClientSecret;
+}
+
+void ContextManager::SetWarmupState(WarmupState state) {
+  mWarmupState = static_cast<int>(state);
+}
+
+ContextManager::Health ContextManager::GetHealth() {
+  Health health;
+  health.contexts = mContextCount;
+  health.warmup = static_cast<WarmupState>(mWarmupState.load());
+  health.engines = mEngineCache.GetSize();
+  health.engineCapacity = mEngineCache.GetCapacity();
+  health.inspectionCache = { mInspectionCache.GetSize(), mInspectionCache.GetCapacity() };
+  health.protectionCache = { mProtectionCache.GetSize(), mProtectionCache.GetCapacity() };
+  health.useLicenseCache = { mUseLicenseCache.GetSize(), mUseLicenseCache.GetCapacity() };
+  health.licenseInfoCache = { mLicenseInfoCache.GetSize(), mLicenseInfoCache.GetCapacity() };
+  const auto* dispatcher = mHealthDispatcher.load();
+  health.dispatcherQueueDepth = dispatcher ? dispatcher->GetQueueDepth() : 0;
+  health.inFlight = mAdmissionController.GetInFlight();
+  health.maxInFlight = mAdmissionController.GetMaxInFlight();
+  health.draining = mAdmissionController.IsDraining();
+  health.last10Seconds = mRecentOutcomes.Get(10);
+  health.last60Seconds = mRecentOutcomes.Get(RecentOutcomes::kWindowSeconds);
+  return health;
+}
+
+bool ContextManager::WaitForIdle(std::chrono::steady_clock::time_point deadline) {
+  shared_ptr<TaskDispatcherImpl> taskDispatcher;
+  {
+    lock_guard<mutex> lock(mTaskDispatcherMutex);
+    taskDispatcher = mTaskDispatcher;
+  }
+  shared_ptr<HttpDelegateImpl> httpDelegate;
+  {
+    lock_guard<mutex> lock(mHttpDelegateMutex);
+    httpDelegate = mHttpDelegate;
+  }
+  while (mAdmissionController.GetStats().inFlight > 0 || (taskDispatcher && !taskDispatcher->IsIdle()) ||
+         (httpDelegate && httpDelegate->GetStats().inFlight > 0)) {
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+void ContextManager::PrepareFork(std::chrono::milliseconds timeout) {
+  if (GetReplayHttpDelegate())
+    throw std::runtime_error("HTTP replay cannot be forked");
+  {
+    lock_guard<mutex> lock(mShardMutex);
+    if (mShardWorker)
+      throw std::runtime_error("A shard worker cannot be forked");
+  }
+  {
+    lock_guard<mutex> lock(mWatcherMutex);
+    if (mWatcher)
+      throw std::runtime_error("A directory watcher cannot be forked");
+  }
+  if (mForkPrepared.exchange(true))
+    throw std::runtime_error("Already prepared for fork");
+  // Only components already created have threads to stop.
+  shared_ptr<TaskDispatcherImpl> taskDispatcher;
+  {
+    lock_guard<mutex> lock(mTaskDispatcherMutex);
+    taskDispatcher = mTaskDispatcher;
+  }
+  shared_ptr<HttpDelegateImpl> httpDelegate;
+  {
+    lock_guard<mutex> lock(mHttpDelegateMutex);
+    httpDelegate = mHttpDelegate;
+  }
+  shared_ptr<AsyncLoggerDelegate> loggerDelegate;
+  {
+    lock_guard<mutex> lock(mLoggerMutex);
+    loggerDelegate = mLoggerDelegate;
+  }
+  auto diagnosticUploader = GetDiagnosticUploader();
+
+  if (!WaitForIdle(std::chrono::steady_clock::now() + timeout)) {
+    mForkPrepared = false;
+    throw std::runtime_error("Operations are still in flight");
+  }
+
+  // Uploads and policy refreshes still use the dispatcher and the transport, so they stop first.
+  if (diagnosticUploader)
+    diagnosticUploader->PauseThreads();
+  ResourceTuner::Shared().PauseThreads();
+  mEngineCache.PauseThreads();
+  mFileSessions.PauseThreads();
+  if (taskDispatcher)
+    taskDispatcher->PauseThreads();
+  if (httpDelegate)
+    httpDelegate->PauseThreads();
+  if (loggerDelegate)
+    loggerDelegate->PauseThreads();
+}
+
+void ContextManager::ResumeAfterFork() {
+  if (!mForkPrepared.exchange(false))
+    return;
+  {
+    lock_guard<mutex> lock(mLoggerMutex);
+    if (mLoggerDelegate)
+      mLoggerDelegate->ResumeThreads();
+  }
+  {
+    lock_guard<mutex> lock(mHttpDelegateMutex);
+    if (mHttpDelegate)
+      mHttpDelegate->ResumeThreads();
+  }
+  {
+    lock_guard<mutex> lock(mTaskDispatcherMutex);
+    if (mTaskDispatcher)
+      mTaskDispatcher->ResumeThreads();
+  }
+  mFileSessions.ResumeThreads();
+  mEngineCache.ResumeThreads();
+  ResourceTuner::Shared().ResumeThreads();
+  if (auto diagnosticUploader = GetDiagnosticUploader())
+    diagnosticUploader->ResumeThreads();
+}
+
+bool ContextManager::IsInitialized(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return mStates.find(applicationId) != mStates.end();
+}
+
+shared_ptr<MipContext> ContextManager::GetMipContext(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return GetOrCreateState(applicationId).mipContext;
+}
+
+shared_ptr<MipContext> ContextManager::GetInspectionContext(const string& applicationId) {
+  if (applicationId.empty())
+    throw std::invalid_argument("Application id must not be empty");
+
+  const string storagePath = GetStorageOptions().storagePath;
+  auto loggerDelegate = GetLoggerDelegate();
+  shared_ptr<mip::JsonDelegate> jsonDelegate;
+  shared_ptr<mip::xml::XmlDelegate> xmlDelegate;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    jsonDelegate = mJsonDelegate;
+    xmlDelegate = mXmlDelegate;
+  }
+  lock_guard<mutex> lock(mInspectionMutex);
+  auto it = mInspectionContexts.find(applicationId);
+  if (it != mInspectionContexts.end())
+    return it->second;
+  auto& created = mInspectionContexts.emplace(applicationId, CreateInspectionContext(applicationId, storagePath, loggerDelegate, jsonDelegate, xmlDelegate)).first->second;
+  ++mContextCount;
+  return created;
+}
+
+shared_ptr<FileProfile> ContextManager::GetProfile(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return GetOrCreateState(applicationId).profile;
+}
+
+shared_ptr<EngineManifest> ContextManager::GetEngineManifest() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  if (mStorageOptions.cacheStorageType == CacheStorageType::InMemory)
+    return nullptr;
+  if (!mEngineManifest)
+    mEngineManifest = make_shared<EngineManifest>(mStorageOptions.storagePath + kEngineManifestFile);
+  return mEngineManifest;
+}
+
+shared_ptr<ProtectionProfile> ContextManager::GetProtectionProfile(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  auto& state = GetOrCreateState(applicationId);
+  if (!state.protectionProfile)
+    state.protectionProfile = CreateProtectionProfile(state.mipContext, mStorageOptions, FindRegion(applicationId).dnsRedirection,
+        mConsentDelegate, GetTaskDispatcher(), GetSdkHttpDelegate());
+  return state.protectionProfile;
+}
+
+ContextManager::ProtectionEngineEntry ContextManager::GetProtectionEngine(
+    const EngineCache::Key& key,
+    const ProtectionEngineFactory& create) {
+  const string id = key.ToString();
+  // Evicted with the file engines' capacity and idle timeout, on each request rather than on a thread.
+  const size_t capacity = mEngineCache.GetCapacity();
+  const auto idle = mEngineCache.GetIdleTimeout();
+  EngineLru<ProtectionEngineEntry>::Entries released;
+  ProtectionEngineEntry found;
+  bool hit;
+  {
+    lock_guard<mutex> lock(mProtectionEngineMutex);
+    hit = mProtectionEngines.Find(id, found);
+    mProtectionEngines.Evict(capacity, idle);
+    released = mProtectionEngines.TakeDrained(false);
+  }
+  {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+    released.clear();
+  }
+  if (hit)
+    return found;
+
+  // Adding an engine takes service round trips, so it runs unlocked. Concurrent misses wait for one load.
+  return mProtectionEngineLoads.Do(id, [&]() {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+    auto created = create(GetProtectionProfile(key.applicationId));
+    lock_guard<mutex> lock(mProtectionEngineMutex);
+    created = mProtectionEngines.Insert(id, created);
+    mProtectionEngines.Evict(capacity, idle);
+    return created;
+  });
+}
+
+shared_ptr<PolicyProfile> ContextManager::GetPolicyProfile(const string& applicationId) {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  auto& state = GetOrCreateState(applicationId);
+  if (!state.policyProfile)
+    state.policyProfile = CreatePolicyProfile(state.mipContext, mStorageOptions, GetTaskDispatcher(), GetSdkHttpDelegate());
+  return state.policyProfile;
+}
+
+ContextManager::PolicyEngineEntry ContextManager::GetPolicyEngine(
+    const EngineCache::Key& key,
+    const PolicyEngineFactory& create) {
+  const string id = key.ToString();
+  const size_t capacity = mEngineCache.GetCapacity();
+  const auto idle = mEngineCache.GetIdleTimeout();
+  EngineLru<PolicyEngineEntry>::Entries released;
+  PolicyEngineEntry found;
+  bool hit;
+  {
+    lock_guard<mutex> lock(mPolicyEngineMutex);
+    hit = mPolicyEngines.Find(id, found);
+    mPolicyEngines.Evict(capacity, idle);
+    released = mPolicyEngines.TakeDrained(false);
+  }
+  {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+    UnloadPolicyEngines(released);
+    released.clear();
+  }
+  if (hit)
+    return found;
+
+  return mPolicyEngineLoads.Do(id, [&]() {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+    auto profile = GetPolicyProfile(key.applicationId);
+    auto created = create(profile);
+    created.profile = profile;
+    lock_guard<mutex> lock(mPolicyEngineMutex);
+    created = mPolicyEngines.Insert(id, created);
+    mPolicyEngines.Evict(capacity, idle);
+    return created;
+  });
+}
+
+shared_ptr<LabelActionPlanner> ContextManager::FindLabelActionPlanner(const EngineCache::Key& key) {
+  lock_guard<mutex> lock(mPolicyEngineMutex);
+  const auto* entry = mPolicyEngines.Peek(key.ToString());
+  return entry ? entry->planner : nullptr;
+}
+
+ContextManager::ApplicationState& ContextManager::GetOrCreateState(const string& applicationId) {
+  if (applicationId.empty())
+    throw std::invalid_argument("Application id must not be empty");
+
+  auto it = mStates.find(applicationId);
+  if (it != mStates.end())
+    return it->second;
+
+  ApplicationState state;
+  state.mipContext = CreateMipContext(
+      applicationId,
+      mFastShutdown,
+      mStorageOptions.storagePath,
+      mStorageOptions.storageDelegate,
+      GetLoggerDelegate(),
+      GetSdkHttpDelegate(),
+      mJsonDelegate,
+      mXmlDelegate,
+      GetDiagnosticUploader(),
+      mEngineOptions->featureSettings);
+  try {
+    state.profile = CreateProfile(state.mipContext, mStorageOptions, FindRegion(applicationId).dnsRedirection,
+        mConsentDelegate, GetTaskDispatcher(), GetSdkHttpDelegate());
+  } catch (...) {
+    state.mipContext->ShutDown();
+    throw;
+  }
+  ++mContextCount;
+  return mStates.emplace(applicationId, state).first->second;
+}
+
+shared_ptr<TaskDispatcherImpl> ContextManager::GetTaskDispatcher() {
+  lock_guard<mutex> lock(mTaskDispatcherMutex);
+  if (!mTaskDispatcher) {
+    mTaskDispatcher = make_shared<TaskDispatcherImpl>();
+    mHealthDispatcher = mTaskDispatcher.get();
+  }
+  return mTaskDispatcher;
+}
+
+shared_ptr<HttpDelegateImpl> ContextManager::GetHttpDelegate() {
+  // Completions are handed to the shared dispatcher so SDK callbacks never run on the HTTP event loop.
+  auto taskDispatcher = GetTaskDispatcher();
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  if (!mHttpDelegate)
+    mHttpDelegate = make_shared<HttpDelegateImpl>(taskDispatcher);
+  return mHttpDelegate;
+}
+
+shared_ptr<TracingHttpDelegate> ContextManager::GetTracingHttpDelegate() {
+  auto httpDelegate = GetHttpDelegate();
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  if (!mTracingHttpDelegate)
+    mTracingHttpDelegate = make_shared<TracingHttpDelegate>(httpDelegate, kDefaultTraceBufferSize);
+  return mTracingHttpDelegate;
+}
+
+void ContextManager::ConfigureHttpReplay(const ReplayHttpDelegate::Settings& settings) {
+  shared_ptr<ReplayHttpDelegate> replayDelegate;
+  if (!settings.directory.empty())
+    replayDelegate = make_shared<ReplayHttpDelegate>(settings, GetTracingHttpDelegate(), GetTaskDispatcher());
+  sample::http::DkeCacheHttpDelegate::Settings dkeSettings;
+  {
+    lock_guard<mutex> lock(mHttpDelegateMutex);
+    mReplayHttpDelegate = replayDelegate;
+    dkeSettings = mDkeCacheSettings;
+  }
+  // The DKE cache forwards to whatever transport is below it, so it is rebuilt on the new one.
+  if (!dkeSettings.baseUrls.empty())
+    ConfigureDkeCache(dkeSettings);
+}
+
+void ContextManager::ConfigureDkeCache(const sample::http::DkeCacheHttpDelegate::Settings& settings) {
+  shared_ptr<sample::http::DkeCacheHttpDelegate> dkeDelegate;
+  if (!settings.baseUrls.empty()) {
+    shared_ptr<mip::HttpDelegate> inner = GetReplayHttpDelegate();
+    if (!inner)
+      inner = GetTracingHttpDelegate();
+    dkeDelegate = make_shared<sample::http::DkeCacheHttpDelegate>(settings, inner, GetTaskDispatcher());
+  }
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  mDkeCacheHttpDelegate = dkeDelegate;
+  mDkeCacheSettings = settings;
+}
+
+shared_ptr<sample::http::DkeCacheHttpDelegate> ContextManager::GetDkeCacheHttpDelegate() {
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  return mDkeCacheHttpDelegate;
+}
+
+shared_ptr<ReplayHttpDelegate> ContextManager::GetReplayHttpDelegate() {
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  return mReplayHttpDelegate;
+}
+
+shared_ptr<mip::HttpDelegate> ContextManager::GetSdkHttpDelegate() {
+  if (auto dkeDelegate = GetDkeCacheHttpDelegate())
+    return dkeDelegate;
+  if (auto replayDelegate = GetReplayHttpDelegate())
+    return replayDelegate;
+  return GetTracingHttpDelegate();
+}
+
+void ContextManager::ConfigureDiagnosticUpload(const DiagnosticUploader::Settings& settings) {
+  shared_ptr<DiagnosticUploader> uploader;
+  if (!settings.endpoint.empty())
+    uploader = make_shared<DiagnosticUploader>(settings, GetHttpDelegate());
+  lock_guard<mutex> lock(mDiagnosticMutex);
+  mDiagnosticUploader = uploader;
+}
+
+shared_ptr<DiagnosticUploader> ContextManager::GetDiagnosticUploader() {
+  lock_guard<mutex> lock(mDiagnosticMutex);
+  return mDiagnosticUploader;
+}
+
+void ContextManager::ConfigureShards(const shared_ptr<ShardCoordinator>& coordinator, std::unique_ptr<ShardWorker> worker) {
+  std::unique_ptr<ShardWorker> previous;
+  {
+    lock_guard<mutex> lock(mShardMutex);
+    mShardCoordinator = coordinator;
+    previous = std::move(mShardWorker);
+    mShardWorker = std::move(worker);
+  }
+  // Joined outside the lock, since its running shards may call back into the context manager.
+}
+
+shared_ptr<ShardCoordinator> ContextManager::GetShardCoordinator() {
+  lock_guard<mutex> lock(mShardMutex);
+  return mShardCoordinator;
+}
+
+bool ContextManager::GetShardWorkerStats(ShardWorker::Stats& stats) {
+  lock_guard<mutex> lock(mShardMutex);
+  if (!mShardWorker)
+    return false;
+  stats = mShardWorker->GetStats();
+  return true;
+}
+
+void ContextManager::ConfigureWatcher(std::unique_ptr<DirectoryWatcher> watcher) {
+  std::unique_ptr<DirectoryWatcher> previous;
+  {
+    lock_guard<mutex> lock(mWatcherMutex);
+    previous = std::move(mWatcher);
+    mWatcher = std::move(watcher);
+  }
+  // Stopped outside the lock, since its running batch may call back into the context manager.
+  if (previous)
+    previous->Stop();
+}
+
+bool ContextManager::GetWatcherStats(DirectoryWatcher::Stats& stats) {
+  lock_guard<mutex> lock(mWatcherMutex);
+  if (!mWatcher)
+    return false;
+  stats = mWatcher->GetStats();
+  return true;
+}
+
+void ContextManager::ConfigureLogging(mip::LogLevel level, AsyncLoggerDelegate::Sink sink, size_t capacity) {
+  lock_guard<mutex> lock(mLoggerMutex);
+  mLoggerDelegate = make_shared<AsyncLoggerDelegate>(sink, level, capacity);
+  sample::log::EventLog::SetLogger(mLoggerDelegate);
+}
+
+shared_ptr<AsyncLoggerDelegate> ContextManager::GetLoggerDelegate() {
+  lock_guard<mutex> lock(mLoggerMutex);
+  if (!mLoggerDelegate) {
+    mLoggerDelegate = make_shared<AsyncLoggerDelegate>(AsyncLoggerDelegate::Sink::File, mip::LogLevel::Info);
+    sample::log::EventLog::SetLogger(mLoggerDelegate);
+  }
+  return mLoggerDelegate;
+}
+
+shared_ptr<TokenAcquirer> ContextManager::GetTokenAcquirer() {
+  auto httpDelegate = GetHttpDelegate();
+  lock_guard<mutex> lock(mHttpDelegateMutex);
+  if (!mTokenAcquirer)
+    mTokenAcquirer = make_shared<TokenAcquirer>(httpDelegate);
+  return mTokenAcquirer;
+}
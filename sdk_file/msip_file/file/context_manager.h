@@ -0,0 +1,609 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_CONTEXT_MANAGER_H_
+#define SAMPLE_FILE_CONTEXT_MANAGER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "admission_controller.h"
+#include "aligned_file_output_stream.h"
+#include "async_file_reader.h"
+#include "async_logger_delegate.h"
+#include "batch_prefetcher.h"
+#include "completion_queue.h"
+#include "consent_delegate_impl.h"
+#include "container_structure_cache.h"
+#include "content_dedupe.h"
+#include "decrypted_content_cache.h"
+#include "delegation_license_cache.h"
+#include "diagnostic_uploader.h"
+#include "directory_watcher.h"
+#include "dke_cache_http_delegate.h"
+#include "engine_cache.h"
+#include "engine_lru.h"
+#include "engine_manifest.h"
+#include "file_session_table.h"
+#include "http_delegate_impl.h"
+#include "input_streams.h"
+#include "inspection_cache.h"
+#include "instrumented_mutex.h"
+#include "json_delegate_impl.h"
+#include "known_clean_filter.h"
+#include "label_action_planner.h"
+#include "license_info_cache.h"
+#include "mip/common_types.h"
+#include "mip/dns_redirection.h"
+#include "mip/file/file_profile.h"
+#include "mip/mip_context.h"
+#include "mip/protection/protection_engine.h"
+#include "mip/protection/protection_profile.h"
+#include "mip/storage_delegate.h"
+#include "mip/upe/policy_engine.h"
+#include "mip/upe/policy_profile.h"
+#include "object_input_stream.h"
+#include "object_output_stream.h"
+#include "offline_publisher.h"
+#include "package_repacker.h"
+#include "protection_cache.h"
+#include "protection_descriptor_interner.h"
+#include "recent_outcomes.h"
+#include "replay_http_delegate.h"
+#include "rights_cache.h"
+#include "shard_coordinator.h"
+#include "shared_label_snapshot.h"
+#include "single_flight.h"
+#include "staged_pipeline.h"
+#include "stream_handle_table.h"
+#include "task_dispatcher_impl.h"
+#include "template_catalog.h"
+#include "tenant_endpoint_cache.h"
+#include "token_acquirer.h"
+#include "tracing_http_delegate.h"
+#include "use_license_cache.h"
+#include "xml_delegate_impl.h"
+
+// Owns the process-wide MipContext, FileProfile, engine cache and task dispatcher used by the exported entry points.
+// State is created lazily on first use for a given application id and lives until ShutDown.
+class ContextManager final {
+public:
+  // Where the SDK keeps policy, license and engine state. InMemory loses it with the process; the OnDisk
+  // types keep it under storagePath so a restarted process starts warm.
+  struct StorageOptions {
+    mip::CacheStorageType cacheStorageType;
+    std::string storagePath;
+    bool canCacheLicenses;
+    // Policy lifetime passed to engines as the PolicyTtlDays custom setting. 0 keeps the SDK default.
+    int policyTtlDays;
+    // Policy XML that policy engines load instead of downloading it, e.g. from a mounted ConfigMap. With
+    // exportPolicySnapshot set, engines download their policy as usual and write it to this path instead.
+    std::string policySnapshotPath;
+    bool exportPolicySnapshot;
+    // Policy engines also load the tenant's sensitivity types, compiled once per rule package version
+    // into sensitivityTypeCachePath (in memory only when empty).
+    bool loadSensitivityTypes;
+    std::string sensitivityTypeCachePath;
+    // Replaces the SDK's SQLite store for the OnDisk types, e.g. with tables shared between replicas.
+    std::shared_ptr<mip::StorageDelegate> storageDelegate;
+  };
+
+  // How label changes to PDFs are written. Both off by default.
+  struct PdfOptions {
+    // Engines loaded afterwards keep a linearized ("fast web view") PDF linearized when they rewrite it.
+    bool keepLinearization;
+    // Label commits of PDF inputs go to a clone of their input, so an update the SDK appends after the
+    // original bytes is the only data written.
+    bool incrementalUpdates;
+  };
+
+  // Workers of each stage batch protect and unprotect calls run their files through, and the capacity of
+  // the queue in front of each stage. With every worker count 0, the default, each file is processed in one
+  // call instead.
+  struct BatchPipelineOptions {
+    size_t readWorkers;
+    size_t openWorkers;
+    size_t rightsWorkers;
+    size_t transformWorkers;
+    size_t commitWorkers;
+    size_t queueCapacity;
+  };
+
+  // Context and engine settings parsed once by msipConfigureEngines instead of on every engine load.
+  struct EngineOptions {
+    // Locale of label names, descriptions and errors returned by file and protection engines.
+    std::string locale;
+    std::map<mip::FlightingFeature, bool> featureSettings;
+    std::vector<mip::LabelFilterType> enabledFunctionality;
+    std::vector<mip::LabelFilterType> disabledFunctionality;
+    // Largest file engines protect, 0 for the SDK default. Also caps admission estimates.
+    int64_t maxFileSizeForProtection;
+    // Added to the custom settings of every engine, after the ones derived from the storage options.
+    std::vector<std::pair<std::string, std::string>> customSettings;
+  };
+
+  // Where a tenant's service calls go: the data boundary its engines declare, so the services route them to
+  // the tenant's region, and whether its profiles may follow the DNS record of the user's domain to the
+  // tenant's endpoints.
+  struct RegionOptions {
+    mip::DataBoundary dataBoundary;
+    mip::DnsRedirection dnsRedirection;
+  };
+
+  static ContextManager& Instance();
+
+  // Eagerly creates the contexts and profile for applicationId. Safe to call more than once.
+  void Initialize(const std::string& applicationId);
+
+  // Unloads cached engines, releases every profile and shuts each MipContext down, then flushes the
+  // uploader and logger, giving up on them at flushDeadline. Later calls re-initialize lazily.
+  void ShutDown(std::chrono::steady_clock::time_point flushDeadline = std::chrono::steady_clock::time_point::max());
+
+  // What DropCaches drops. Each layer includes the ones before it.
+  enum class CacheLayer : int {
+    // Cached inspection results, protection handlers, licenses, rights, plaintext and container reads.
+    Licenses,
+    // Loaded engines and protection engines as well; contexts and profiles stay.
+    Engines,
+    // Everything, as ShutDown does.
+    Contexts
+  };
+
+  // Puts the caches in a known cold state so an operation's cost can be measured per layer. The next
+  // operations load what was dropped again. Stream handles and file sessions the caller holds stay open.
+  void DropCaches(CacheLayer layer);
+
+  struct DrainResult {
+    // Whether the work in flight finished within the timeout.
+    bool drained;
+    // Admitted operations still in flight when the wait ended.
+    size_t inFlight;
+    // Whether the audit, telemetry and log queues were flushed within the flush timeout.
+    bool flushed;
+    // Whether the storage logs were written through to disk. True without encrypted storage.
+    bool synced;
+    std::chrono::milliseconds waited;
+    std::chrono::milliseconds flushing;
+  };
+
+  // Whether the engines and caches an earlier msipWarmup or msipRestoreEngines loaded are in place.
+  enum class WarmupState : int {
+    // No warm-up was run; the service serves as it loads.
+    None,
+    Running,
+    Done,
+    // Some step failed; the service serves partly cold.
+    Incomplete
+  };
+
+  void SetWarmupState(WarmupState state);
+
+  // Outcomes of the admitted file operations, and of those admission control turned away.
+  RecentOutcomes& GetRecentOutcomes() { return mRecentOutcomes; }
+
+  struct Health {
+    // Shared and inspection contexts up.
+    size_t contexts;
+    WarmupState warmup;
+    size_t engines;
+    size_t engineCapacity;
+    struct Fill {
+      size_t size;
+      size_t capacity;
+    };
+    Fill inspectionCache;
+    Fill protectionCache;
+    Fill useLicenseCache;
+    Fill licenseInfoCache;
+    // Tasks waiting for a dispatcher worker; 0 until the dispatcher is created.
+    size_t dispatcherQueueDepth;
+    size_t inFlight;
+    size_t maxInFlight;
+    bool draining;
+    RecentOutcomes::Counts last10Seconds;
+    RecentOutcomes::Counts last60Seconds;
+  };
+
+  // What a readiness or liveness probe needs, read from atomics only, so it takes constant time and
+  // never waits on a lock the request path holds. Values may lag concurrent changes.
+  Health GetHealth();
+
+  // Shuts down for process exit without dropping admitted work: turns every new operation away, waits up
+  // to timeout for file operations, HTTP requests and dispatched tasks to finish, flushes the audit,
+  // telemetry and log queues and syncs the storage logs within flushTimeout, then shuts down as ShutDown
+  // does. Operations stay turned away afterwards, so nothing re-initializes behind the shutdown.
+  DrainResult Drain(std::chrono::milliseconds timeout, std::chrono::milliseconds flushTimeout);
+
+  bool IsInitialized(const std::string& applicationId);
+
+  // Applies to contexts created after the call. With fast shutdown the SDK uploads audit events as they
+  // are logged and drops queued telemetry at exit; otherwise ShutDown waits up to two seconds to flush.
+  void SetFastShutdown(bool enabled);
+
+  // Whether contexts created after the call parse service responses with sample::json::JsonDelegateImpl
+  // instead of the SDK's own JSON library. Off by default.
+  void SetNativeJson(bool enabled);
+
+  // Whether contexts created after the call hand XmlDelegateImpl to the SDK for policy and template XML.
+  // The SDK only honours it in protection engines. Off by default.
+  void SetNativeXml(bool enabled);
+
+  // Whether label calls commit into a clone of their input. Off by default.
+  void SetCloneLabelOutputs(bool enabled);
+  bool GetCloneLabelOutputs();
+
+  // Whether unprotect calls decrypt .pfile inputs with a protection engine instead of a file engine. Off
+  // by default.
+  void SetPfileFastPath(bool enabled);
+  bool GetPfileFastPath();
+
+  // Whether label and template protect calls skip files that already have the label or template asked for,
+  // read offline. Off by default.
+  void SetSkipUnchanged(bool enabled);
+  bool GetSkipUnchanged();
+
+  void SetPdfOptions(const PdfOptions& options);
+  PdfOptions GetPdfOptions();
+
+  // How batch protect and unprotect calls treat byte-identical inputs. Off by default.
+  void SetBatchDedupe(ContentDedupe::Mode mode);
+  ContentDedupe::Mode GetBatchDedupe();
+
+  // How batch status, protect and unprotect calls read their inputs ahead. Off (queue depth 0) by default.
+  void SetBatchReadAhead(const AsyncFileReader::Settings& settings);
+  AsyncFileReader::Settings GetBatchReadAhead();
+
+  // How batch calls prefetch their inputs when they do not read them ahead. Off (depth 0) by default.
+  void SetBatchPrefetch(const BatchPrefetcher::Settings& settings);
+  BatchPrefetcher::Settings GetBatchPrefetch();
+
+  // Whether batch workers are pinned round robin to the NUMA nodes, so each file's buffers, decryption and
+  // writes stay on one node. Off by default.
+  void SetNumaPlacement(bool enabled);
+  bool GetNumaPlacement();
+
+  void SetBatchPipeline(const BatchPipelineOptions& options);
+  BatchPipelineOptions GetBatchPipeline();
+  // The stats of the last batch run through the pipeline, and how many batches were.
+  void RecordBatchPipelineRun(const StagedPipeline::Stats& stats);
+  StagedPipeline::Stats GetLastBatchPipelineRun(uint64_t& runs);
+
+  // How inputs are handed to the SDK by size. InputStreams::Defaults() until set.
+  void SetInputStreams(const InputStreams::Options& options);
+  InputStreams::Options GetInputStreams();
+
+  // How objects in S3 and Azure Blob storage are read and uploaded. The streams' Defaults() until set.
+  void SetObjectStreams(const ObjectInputStream::Options& input, const ObjectOutputStream::Options& output);
+  ObjectInputStream::Options GetObjectInputStream();
+  ObjectOutputStream::Options GetObjectOutputStream();
+
+  // How outputs committed by path are written. With bufferBytes 0, the default, the SDK writes them itself.
+  void SetOutputWriter(const AlignedFileOutputStream::Options& options);
+  AlignedFileOutputStream::Options GetOutputWriter();
+
+  // How unprotects of Office Open XML files write their package. PackageRepacker::Defaults(), which is off,
+  // until set.
+  void SetPackageRepack(const PackageRepacker::Options& options);
+  PackageRepacker::Options GetPackageRepack();
+
+  // Applies to contexts, profiles and engines created after the call. Call before msipInit.
+  void SetStorageOptions(const StorageOptions& options);
+  StorageOptions GetStorageOptions();
+
+  // featureSettings applies to contexts created after the call, the rest to engines loaded after it.
+  void SetEngineOptions(const EngineOptions& options);
+  std::shared_ptr<const EngineOptions> GetEngineOptions();
+
+  // Region of applicationId, or of every tenant without its own when applicationId is empty. The data
+  // boundary applies to engines loaded after the call, the DNS redirection to profiles created after it.
+  void SetRegionOptions(const std::string& applicationId, const RegionOptions& options);
+  RegionOptions GetRegionOptions(const std::string& applicationId);
+
+  // Delegated mode: applicationId's engines load as serviceIdentity, which acts for each user per
+  // operation, instead of one engine per user. An empty serviceIdentity turns it off.
+  void SetServiceIdentity(const std::string& applicationId, const std::string& serviceIdentity);
+  // Empty unless applicationId is in delegated mode.
+  std::string GetServiceIdentity(const std::string& applicationId);
+
+  std::shared_ptr<mip::MipContext> GetMipContext(const std::string& applicationId);
+  std::shared_ptr<mip::FileProfile> GetProfile(const std::string& applicationId);
+
+  // Keys of the file engines loaded with on-disk storage, kept in the storage directory for
+  // msipRestoreEngines. nullptr with in-memory storage, whose engines do not outlive the process.
+  std::shared_ptr<EngineManifest> GetEngineManifest();
+
+  // Protection profile for the APIs the File SDK does not expose, such as delegation licenses. Loaded on
+  // first use on the application's context, with the same delegates as the file profile.
+  std::shared_ptr<mip::ProtectionProfile> GetProtectionProfile(const std::string& applicationId);
+
+  struct ProtectionEngineEntry {
+    std::shared_ptr<mip::ProtectionEngine> engine;
+    std::shared_ptr<sample::auth::AuthDelegateImpl> authDelegate;
+    // Keeps the engine's certificate and templates warm for protectFileOffline.
+    std::shared_ptr<OfflinePublisher> publisher;
+    // Templates and label rights the engine's identity may use, for listTemplates and getRightsForLabel.
+    std::shared_ptr<TemplateCatalog> templates;
+  };
+
+  typedef std::function<ProtectionEngineEntry(const std::shared_ptr<mip::ProtectionProfile>& profile)> ProtectionEngineFactory;
+
+  // ProtectionEngine for key, created with create on first use. Kept within the EngineCache's capacity and
+  // idle timeout, in an EngineLru of their own; an evicted engine is released once no caller holds it.
+  ProtectionEngineEntry GetProtectionEngine(const EngineCache::Key& key, const ProtectionEngineFactory& create);
+
+  // Policy profile for computing label actions without content (see computeLabelActions). Loaded on first
+  // use on the application's context, with the same delegates as the file profile.
+  std::shared_ptr<mip::PolicyProfile> GetPolicyProfile(const std::string& applicationId);
+
+  struct PolicyEngineEntry {
+    std::shared_ptr<mip::PolicyEngine> engine;
+    std::shared_ptr<sample::auth::AuthDelegateImpl> authDelegate;
+    // Action plans computed on the engine, which batch labeling consults before opening files.
+    std::shared_ptr<LabelActionPlanner> planner;
+    // Profile the engine was added to, which keeps it loaded until it is unloaded there.
+    std::weak_ptr<mip::PolicyProfile> profile;
+  };
+
+  typedef std::function<PolicyEngineEntry(const std::shared_ptr<mip::PolicyProfile>& profile)> PolicyEngineFactory;
+
+  // PolicyEngine for key, created with create on first use and kept like the protection engines; an evicted
+  // engine is unloaded from its profile once no caller holds it.
+  PolicyEngineEntry GetPolicyEngine(const EngineCache::Key& key, const PolicyEngineFactory& create);
+  // Planner of the policy engine already loaded for key, or nullptr; never loads one.
+  std::shared_ptr<LabelActionPlanner> FindLabelActionPlanner(const EngineCache::Key& key);
+
+  // Replaces the logger used by contexts created afterwards. Call before msipInit.
+  void ConfigureLogging(mip::LogLevel level, sample::log::AsyncLoggerDelegate::Sink sink, size_t capacity);
+
+  // Logger of every context. Created on first use with Info level and the file sink. Contexts are
+  // created with its current level, and SetLevel on it applies to them immediately.
+  std::shared_ptr<sample::log::AsyncLoggerDelegate> GetLoggerDelegate();
+
+  // Offline-only context with error-level logging, used for protection-status probes. It is separate
+  // from the full context, so inspecting a file never loads a profile or opens a connection.
+  std::shared_ptr<mip::MipContext> GetInspectionContext(const std::string& applicationId);
+
+  EngineCache& GetEngineCache() { return mEngineCache; }
+
+  InspectionCache& GetInspectionCache() { return mInspectionCache; }
+
+  // Saved to its path by ShutDown.
+  KnownCleanFilter& GetKnownCleanFilter() { return mKnownCleanFilter; }
+
+  ProtectionCache& GetProtectionCache() { return mProtectionCache; }
+
+  ProtectionDescriptorInterner& GetDescriptorInterner() { return mDescriptorInterner; }
+
+  LicenseInfoCache& GetLicenseInfoCache() { return mLicenseInfoCache; }
+
+  UseLicenseCache& GetUseLicenseCache() { return mUseLicenseCache; }
+
+  DelegationLicenseCache& GetDelegationLicenseCache() { return mDelegationLicenseCache; }
+
+  RightsCache& GetRightsCache() { return mRightsCache; }
+
+  // Plaintext of hot protected files, off until configured (see msipConfigureDecryptedContentCache).
+  DecryptedContentCache& GetDecryptedContentCache() { return mDecryptedContentCache; }
+
+  // Structural reads of recently opened inputs, off until configured (see msipConfigureContainerCache).
+  ContainerStructureCache& GetContainerStructureCache() { return mContainerStructureCache; }
+  TenantEndpointCache& GetTenantEndpoints() { return mTenantEndpoints; }
+
+  // Label snapshots shared with the node's other processes, off until configured (see msipConfigureSharedLabels).
+  SharedLabelSnapshots& GetSharedLabelSnapshots() { return mSharedLabelSnapshots; }
+
+  StreamHandleTable& GetStreamHandles() { return mStreamHandles; }
+
+  CompletionQueueTable& GetCompletionQueues() { return mCompletionQueues; }
+
+  FileSessionTable& GetFileSessions() { return mFileSessions; }
+
+  AdmissionController& GetAdmissionController() { return mAdmissionController; }
+
+  // Consent delegate every profile is created with, so each endpoint URL is decided once per process.
+  sample::consent::ConsentDelegateImpl& GetConsentDelegate() { return *mConsentDelegate; }
+
+  // Runs async work for every profile. Created with the first profile and kept for the process lifetime,
+  // since the SDK may still dispatch tasks while a profile is being released.
+  std::shared_ptr<sample::task::TaskDispatcherImpl> GetTaskDispatcher();
+
+  // Pooled HTTP transport shared by every context and profile. Lives for the process lifetime.
+  std::shared_ptr<sample::http::HttpDelegateImpl> GetHttpDelegate();
+
+  // The shared transport as handed to contexts and profiles: records a span for each SDK request made
+  // under a sampled trace context. Token requests bypass it.
+  std::shared_ptr<sample::http::TracingHttpDelegate> GetTracingHttpDelegate();
+
+  // Records the SDK's service responses to settings.directory, or answers SDK requests from a recording
+  // there, for contexts and profiles created afterwards. An empty directory restores the live transport.
+  // Call before msipInit. Throws if a recording to replay cannot be read.
+  void ConfigureHttpReplay(const sample::http::ReplayHttpDelegate::Settings& settings);
+  // nullptr while the live transport is in use.
+  std::shared_ptr<sample::http::ReplayHttpDelegate> GetReplayHttpDelegate();
+
+  // Answers repeated requests to the DKE key services at settings.baseUrls from memory, for contexts and
+  // profiles created afterwards. No base URLs turns the cache off. Call before msipInit.
+  void ConfigureDkeCache(const sample::http::DkeCacheHttpDelegate::Settings& settings);
+  // nullptr while no DKE service is cached.
+  std::shared_ptr<sample::http::DkeCacheHttpDelegate> GetDkeCacheHttpDelegate();
+
+  // The transport handed to contexts and profiles: the DKE cache when configured, in front of the replay
+  // delegate when configured, otherwise the tracing one.
+  std::shared_ptr<mip::HttpDelegate> GetSdkHttpDelegate();
+
+  // Routes audit and telemetry events of contexts created afterwards to settings.endpoint in batches,
+  // instead of the SDK's pipeline. An empty endpoint restores the SDK's pipeline. Call before msipInit.
+  void ConfigureDiagnosticUpload(const sample::diag::DiagnosticUploader::Settings& settings);
+  // nullptr while the SDK's pipeline is in use.
+  std::shared_ptr<sample::diag::DiagnosticUploader> GetDiagnosticUploader();
+
+  // The coordinator of sharded jobs and this replica's worker on them; either may be nullptr. Replacing
+  // them waits for the previous worker's running shards. ShutDown and Drain stop the worker.
+  void ConfigureShards(const std::shared_ptr<ShardCoordinator>& coordinator, std::unique_ptr<ShardWorker> worker);
+  // nullptr while no coordinator is configured.
+  std::shared_ptr<ShardCoordinator> GetShardCoordinator();
+  // False while no worker runs.
+  bool GetShardWorkerStats(ShardWorker::Stats& stats);
+
+  // The watcher that runs operations on files written under its roots; nullptr stops the current one,
+  // waiting for its running batch. ShutDown and Drain stop it.
+  void ConfigureWatcher(std::unique_ptr<DirectoryWatcher> watcher);
+  // False while no watcher runs.
+  bool GetWatcherStats(DirectoryWatcher::Stats& stats);
+
+  // Fetches tokens over the shared HTTP transport. Lives for the process lifetime.
+  std::shared_ptr<sample::auth::TokenAcquirer> GetTokenAcquirer();
+
+  // Client secret of the application id. When set, engines created afterwards acquire their own
+  // tokens with the client credentials grant once the caller-supplied token has expired.
+  void SetClientSecret(const std::string& clientSecret);
+  std::string GetClientSecret();
+
+  // Stops the library's own threads so the process can fork and share its contexts, engines and caches
+  // copy-on-write: waits up to timeout for file operations, HTTP requests and dispatched tasks to finish,
+  // then joins the uploader, memory pressure watcher, policy refresh, engine hibernation, session reaper, dispatcher, HTTP and
+  // logger threads. The
+  // pooled connections are closed, so no socket is shared. Throws std::runtime_error, with nothing
+  // stopped, while work is still in flight, under HTTP replay or while a shard worker runs. Nothing may call into the library
+  // until ResumeAfterFork, which the parent and the child each call once fork returns.
+  void PrepareFork(std::chrono::milliseconds timeout);
+  void ResumeAfterFork();
+
+private:
+  struct ApplicationState {
+    std::shared_ptr<mip::MipContext> mipContext;
+    std::shared_ptr<mip::FileProfile> profile;
+    std::shared_ptr<mip::ProtectionProfile> protectionProfile;
+    std::shared_ptr<mip::PolicyProfile> policyProfile;
+  };
+
+  ContextManager();
+  ContextManager(const ContextManager&) = delete;
+  ContextManager& operator=(const ContextManager&) = delete;
+
+  ApplicationState& GetOrCreateState(const std::string& applicationId);
+
+  // Region of applicationId. Called with mMutex held.
+  const RegionOptions& FindRegion(const std::string& applicationId) const;
+
+  // Waits until no admitted operation, dispatched task or HTTP request is in flight. Returns false at
+  // deadline when some still are.
+  bool WaitForIdle(std::chrono::steady_clock::time_point deadline);
+
+  sample::lock::InstrumentedMutex mMutex{"context_manager"};
+  std::map<std::string, ApplicationState> mStates;
+  std::mutex mInspectionMutex;
+  std::map<std::string, std::shared_ptr<mip::MipContext>> mInspectionContexts;
+  EngineCache mEngineCache;
+  InspectionCache mInspectionCache;
+  KnownCleanFilter mKnownCleanFilter;
+  ProtectionCache mProtectionCache;
+  ProtectionDescriptorInterner mDescriptorInterner;
+  LicenseInfoCache mLicenseInfoCache;
+  UseLicenseCache mUseLicenseCache;
+  DelegationLicenseCache mDelegationLicenseCache;
+  RightsCache mRightsCache;
+  DecryptedContentCache mDecryptedContentCache;
+  ContainerStructureCache mContainerStructureCache;
+  TenantEndpointCache mTenantEndpoints;
+  SharedLabelSnapshots mSharedLabelSnapshots;
+  StreamHandleTable mStreamHandles;
+  CompletionQueueTable mCompletionQueues;
+  FileSessionTable mFileSessions;
+  AdmissionController mAdmissionController;
+  std::mutex mProtectionEngineMutex;
+  EngineLru<ProtectionEngineEntry> mProtectionEngines;
+  SingleFlight<ProtectionEngineEntry> mProtectionEngineLoads;
+  std::mutex mPolicyEngineMutex;
+  EngineLru<PolicyEngineEntry> mPolicyEngines;
+  SingleFlight<PolicyEngineEntry> mPolicyEngineLoads;
+  std::shared_ptr<sample::task::TaskDispatcherImpl> mTaskDispatcher;
+  std::mutex mTaskDispatcherMutex;
+  std::shared_ptr<sample::http::HttpDelegateImpl> mHttpDelegate;
+  std::shared_ptr<sample::http::TracingHttpDelegate> mTracingHttpDelegate;
+  std::shared_ptr<sample::http::ReplayHttpDelegate> mReplayHttpDelegate;
+  std::shared_ptr<sample::http::DkeCacheHttpDelegate> mDkeCacheHttpDelegate;
+  sample::http::DkeCacheHttpDelegate::Settings mDkeCacheSettings;
+  std::mutex mHttpDelegateMutex;
+  std::shared_ptr<sample::auth::TokenAcquirer> mTokenAcquirer;
+  std::shared_ptr<sample::diag::DiagnosticUploader> mDiagnosticUploader;
+  std::mutex mDiagnosticMutex;
+  std::shared_ptr<ShardCoordinator> mShardCoordinator;
+  std::unique_ptr<ShardWorker> mShardWorker;
+  std::mutex mShardMutex;
+  std::unique_ptr<DirectoryWatcher> mWatcher;
+  std::mutex mWatcherMutex;
+  std::shared_ptr<sample::log::AsyncLoggerDelegate> mLoggerDelegate;
+  std::mutex mLoggerMutex;
+  std::string mClientSecret;
+  std::shared_ptr<sample::consent::ConsentDelegateImpl> mConsentDelegate;
+  std::atomic<bool> mForkPrepared;
+  // Mirrors of state kept under locks, for GetHealth. The dispatcher lives until process exit once created.
+  std::atomic<size_t> mContextCount;
+  std::atomic<int> mWarmupState;
+  std::atomic<sample::task::TaskDispatcherImpl*> mHealthDispatcher;
+  RecentOutcomes mRecentOutcomes;
+  bool mFastShutdown;
+  // nullptr while the SDK's own JSON library is in use.
+  std::shared_ptr<mip::JsonDelegate> mJsonDelegate;
+  // nullptr while the SDK's own XML parser is in use.
+  std::shared_ptr<mip::xml::XmlDelegate> mXmlDelegate;
+  bool mCloneLabelOutputs;
+  bool mPfileFastPath;
+  bool mSkipUnchanged;
+  PdfOptions mPdfOptions;
+  ContentDedupe::Mode mBatchDedupe;
+  AsyncFileReader::Settings mBatchReadAhead;
+  BatchPrefetcher::Settings mBatchPrefetch;
+  bool mNumaPlacement;
+  BatchPipelineOptions mBatchPipeline;
+  StagedPipeline::Stats mLastBatchPipelineRun;
+  uint64_t mBatchPipelineRuns;
+  InputStreams::Options mInputStreams;
+  ObjectInputStream::Options mObjectInputStream;
+  ObjectOutputStream::Options mObjectOutputStream;
+  AlignedFileOutputStream::Options mOutputWriter;
+  PackageRepacker::Options mPackageRepack;
+  StorageOptions mStorageOptions;
+  std::shared_ptr<EngineManifest> mEngineManifest;
+  std::shared_ptr<const EngineOptions> mEngineOptions;
+  RegionOptions mDefaultRegion;
+  std::map<std::string, RegionOptions> mRegions;
+  std::map<std::string, std::string> mServiceIdentities;
+  // Whether mServiceIdentities has any, so engine lookups of a tree without delegation take no lock.
+  std::atomic<bool> mDelegating;
+};
+
+#endif // SAMPLE_FILE_CONTEXT_MANAGER_H_
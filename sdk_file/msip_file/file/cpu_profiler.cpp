@@ -0,0 +1,512 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+using std::vector;
+
+struct CpuProfiler::Sample {
+  std::atomic<int> depth;
+  void* frames[kMaxDepth];
+};
+
+namespace {
+
+// The handler and the frames it records itself: OnProfileSignal and the kernel's signal trampoline.
+const int kSkippedFrames = 2;
+
+// State the signal handlers read. Set before the timer starts and cleared after it stops; the handlers
+// never take a lock.
+std::atomic<CpuProfiler::Sample*> gSamples(nullptr);
+std::atomic<size_t> gCapacity(0);
+std::atomic<size_t> gNextSample(0);
+std::atomic<uint64_t> gDropped(0);
+std::atomic<int> gActiveHandlers(0);
+std::atomic<int> gTogglePipe(-1);
+
+int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool SetTimer(int hz) {
+  itimerval timer = {};
+  if (hz > 0) {
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+  }
+  return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+// Minimal protobuf encoding for the pprof Profile message (github.com/google/pprof, proto/profile.proto).
+class ProtoWriter final {
+public:
+  void AddVarint(uint64_t value) {
+    while (value >= 0x80) {
+      mOut.push_back(static_cast<char>((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    mOut.push_back(static_cast<char>(value));
+  }
+
+  void AddInt(int field, uint64_t value) {
+    if (!value)
+      return;
+    AddVarint(static_cast<uint64_t>(field) << 3);
+    AddVarint(value);
+  }
+
+  void AddBytes(int field, const string& value) {
+    AddVarint((static_cast<uint64_t>(field) << 3) | 2);
+    AddVarint(value.size());
+    mOut.append(value);
+  }
+
+  void AddMessage(int field, const ProtoWriter& message) { AddBytes(field, message.mOut); }
+
+  void AddPacked(int field, const vector<uint64_t>& values) {
+    ProtoWriter packed;
+    for (auto value : values)
+      packed.AddVarint(value);
+    AddBytes(field, packed.mOut);
+  }
+
+  const string& Get() const { return mOut; }
+
+private:
+  string mOut;
+};
+
+class StringTable final {
+public:
+  StringTable() { Get(""); }
+
+  uint64_t Get(const string& value) {
+    auto it = mIndex.find(value);
+    if (it != mIndex.end())
+      return it->second;
+    mStrings.push_back(value);
+    return mIndex[value] = mStrings.size() - 1;
+  }
+
+  const vector<string>& GetAll() const { return mStrings; }
+
+private:
+  map<string, uint64_t> mIndex;
+  vector<string> mStrings;
+};
+
+struct Mapping {
+  uintptr_t start;
+  uintptr_t limit;
+  uint64_t offset;
+  string file;
+  string buildId;
+};
+
+int AddMapping(dl_phdr_info* info, size_t, void* data) {
+  auto& mappings = *static_cast<vector<Mapping>*>(data);
+  string buildId;
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const auto& header = info->dlpi_phdr[i];
+    if (header.p_type != PT_NOTE)
+      continue;
+    const char* note = reinterpret_cast<const char*>(info->dlpi_addr + header.p_vaddr);
+    const char* end = note + header.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      const auto* noteHeader = reinterpret_cast<const ElfW(Nhdr)*>(note);
+      const char* name = note + sizeof(ElfW(Nhdr));
+      const char* desc = name + ((noteHeader->n_namesz + 3) & ~3u);
+      if (noteHeader->n_type == NT_GNU_BUILD_ID && noteHeader->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+        static const char kHex[] = "0123456789abcdef";
+        for (uint32_t b = 0; b < noteHeader->n_descsz; ++b) {
+          buildId.push_back(kHex[static_cast<uint8_t>(desc[b]) >> 4]);
+          buildId.push_back(kHex[static_cast<uint8_t>(desc[b]) & 0xF]);
+        }
+      }
+      note = desc + ((noteHeader->n_descsz + 3) & ~3u);
+    }
+  }
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const auto& header = info->dlpi_phdr[i];
+    if (header.p_type != PT_LOAD || !(header.p_flags & PF_X))
+      continue;
+    Mapping mapping;
+    mapping.start = info->dlpi_addr + header.p_vaddr;
+    mapping.limit = mapping.start + header.p_memsz;
+    mapping.offset = header.p_offset;
+    mapping.file = info->dlpi_name && *info->dlpi_name ? info->dlpi_name : "/proc/self/exe";
+    mapping.buildId = buildId;
+    mappings.push_back(mapping);
+  }
+  return 0;
+}
+
+string GetFunctionName(void* address) {
+  Dl_info info;
+  if (!dladdr(address, &info) || !info.dli_sname)
+    return "";
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+  string name = status == 0 && demangled ? demangled : info.dli_sname;
+  free(demangled);
+  return name;
+}
+
+string Gzip(const string& data) {
+  z_stream stream = {};
+  // 15 window bits plus 16 selects the gzip wrapper instead of raw zlib.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("Failed to initialize gzip compression");
+  string compressed(deflateBound(&stream, static_cast<uLong>(data.size())) + 32, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = static_cast<uInt>(compressed.size());
+  const int result = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END)
+    throw std::runtime_error("Failed to gzip the profile");
+  return compressed;
+}
+
+// Identical stacks are merged into one pprof sample. The leaf keeps the sampled address; callers' return
+// addresses are moved back one byte into the call instruction, so they symbolize to the calling line.
+string BuildProfile(const vector<vector<uintptr_t>>& stacks, int hz, int64_t startNanoseconds, int64_t durationNanoseconds) {
+  map<vector<uintptr_t>, uint64_t> counts;
+  for (const auto& stack : stacks)
+    ++counts[stack];
+
+  vector<Mapping> mappings;
+  dl_iterate_phdr(AddMapping, &mappings);
+
+  StringTable strings;
+  ProtoWriter profile;
+  const int64_t period = 1000000000LL / hz;
+  const struct { const char* type; const char* unit; } sampleTypes[] = { { "samples", "count" }, { "cpu", "nanoseconds" } };
+  for (const auto& sampleType : sampleTypes) {
+    ProtoWriter valueType;
+    valueType.AddInt(1, strings.Get(sampleType.type));
+    valueType.AddInt(2, strings.Get(sampleType.unit));
+    profile.AddMessage(1, valueType);
+  }
+
+  map<uintptr_t, uint64_t> locations;
+  for (const auto& entry : counts) {
+    vector<uint64_t> locationIds;
+    for (auto address : entry.first)
+      locationIds.push_back(locations.emplace(address, locations.size() + 1).first->second);
+    ProtoWriter sample;
+    sample.AddPacked(1, locationIds);
+    sample.AddPacked(2, { entry.second, entry.second * static_cast<uint64_t>(period) });
+    profile.AddMessage(2, sample);
+  }
+
+  for (size_t i = 0; i < mappings.size(); ++i) {
+    ProtoWriter mapping;
+    mapping.AddInt(1, i + 1);
+    mapping.AddInt(2, mappings[i].start);
+    mapping.AddInt(3, mappings[i].limit);
+    mapping.AddInt(4, mappings[i].offset);
+    mapping.AddInt(5, strings.Get(mappings[i].file));
+    mapping.AddInt(6, strings.Get(mappings[i].buildId));
+    profile.AddMessage(3, mapping);
+  }
+
+  map<string, uint64_t> functions;
+  for (const auto& location : locations) {
+    ProtoWriter message;
+    message.AddInt(1, location.second);
+    for (size_t i = 0; i < mappings.size(); ++i) {
+      if (location.first >= mappings[i].start && location.first < mappings[i].limit) {
+        message.AddInt(2, i + 1);
+        break;
+      }
+    }
+    message.AddInt(3, location.first);
+    const string name = GetFunctionName(reinterpret_cast<void*>(location.first));
+    if (!name.empty()) {
+      ProtoWriter line;
+      line.AddInt(1, functions.emplace(name, functions.size() + 1).first->second);
+      message.AddMessage(4, line);
+    }
+    profile.AddMessage(4, message);
+  }
+  for (const auto& function : functions) {
+    ProtoWriter message;
+    message.AddInt(1, function.second);
+    message.AddInt(2, strings.Get(function.first));
+    message.AddInt(3, strings.Get(function.first));
+    profile.AddMessage(5, message);
+  }
+
+  ProtoWriter periodType;
+  periodType.AddInt(1, strings.Get("cpu"));
+  periodType.AddInt(2, strings.Get("nanoseconds"));
+  for (const auto& value : strings.GetAll())
+    profile.AddBytes(6, value);
+  profile.AddInt(9, static_cast<uint64_t>(startNanoseconds));
+  profile.AddInt(10, static_cast<uint64_t>(durationNanoseconds));
+  profile.AddMessage(11, periodType);
+  profile.AddInt(12, static_cast<uint64_t>(period));
+  return Gzip(profile.Get());
+}
+
+} // namespace
+
+const size_t CpuProfiler::kMaxDepth;
+
+CpuProfiler& CpuProfiler::Instance() {
+  static CpuProfiler* instance = new CpuProfiler(); // Never destroyed, so a late signal finds it.
+  return *instance;
+}
+
+CpuProfiler::CpuProfiler()
+    : mRunning(false),
+      mHandlerInstalled(false),
+      mHz(0),
+      mCapacity(0),
+      mStartNanoseconds(0),
+      mSignalEnabled(false) {
+}
+
+void CpuProfiler::OnProfileSignal(int) {
+  const int savedErrno = errno;
+  gActiveHandlers.fetch_add(1, std::memory_order_acquire);
+  auto* samples = gSamples.load(std::memory_order_acquire);
+  if (samples) {
+    const size_t index = gNextSample.fetch_add(1, std::memory_order_relaxed);
+    if (index < gCapacity.load(std::memory_order_relaxed)) {
+      auto& sample = samples[index];
+      void* frames[kMaxDepth + kSkippedFrames];
+      const int depth = backtrace(frames, static_cast<int>(kMaxDepth + kSkippedFrames)) - kSkippedFrames;
+      if (depth > 0)
+        memcpy(sample.frames, frames + kSkippedFrames, depth * sizeof(void*));
+      sample.depth.store(std::max(depth, 0), std::memory_order_release);
+    } else {
+      gDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  gActiveHandlers.fetch_sub(1, std::memory_order_release);
+  errno = savedErrno;
+}
+
+bool CpuProfiler::Start(int hz, size_t maxSamples) {
+  if (hz < 1 || hz > 1000 || maxSamples == 0)
+    return false;
+  lock_guard<mutex> lock(mMutex);
+  if (mRunning)
+    return false;
+  if (!mHandlerInstalled) {
+    // backtrace loads libgcc's unwinder on first use, which is not safe inside a signal handler.
+    void* warmup[1];
+    backtrace(warmup, 1);
+    // The handler stays installed: a SIGPROF still pending when a profile stops must not kill the process.
+    struct sigaction action = {};
+    action.sa_handler = OnProfileSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+      return false;
+    mHandlerInstalled = true;
+  }
+  try {
+    mSamples.reset(new Sample[maxSamples]);
+  } catch (const std::bad_alloc&) {
+    return false;
+  }
+  for (size_t i = 0; i < maxSamples; ++i)
+    mSamples[i].depth.store(0, std::memory_order_relaxed);
+  mCapacity = maxSamples;
+  mHz = hz;
+  gNextSample.store(0, std::memory_order_relaxed);
+  gDropped.store(0, std::memory_order_relaxed);
+  gCapacity.store(maxSamples, std::memory_order_relaxed);
+  gSamples.store(mSamples.get(), std::memory_order_release);
+  mStartNanoseconds = NowNanoseconds();
+  if (!SetTimer(hz)) {
+    gSamples.store(nullptr, std::memory_order_release);
+    mSamples.reset();
+    return false;
+  }
+  mRunning = true;
+  return true;
+}
+
+bool CpuProfiler::Stop(const string& path, Result* result, string* error) {
+  vector<vector<uintptr_t>> stacks;
+  int hz;
+  int64_t startNanoseconds;
+  int64_t durationNanoseconds;
+  uint64_t dropped;
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mRunning) {
+      *error = "No CPU profile is running";
+      return false;
+    }
+    SetTimer(0);
+    gSamples.store(nullptr, std::memory_order_release);
+    while (gActiveHandlers.load(std::memory_order_acquire) > 0)
+      std::this_thread::yield();
+    mRunning = false;
+    durationNanoseconds = NowNanoseconds() - mStartNanoseconds;
+    startNanoseconds = mStartNanoseconds;
+    hz = mHz;
+    dropped = gDropped.load(std::memory_order_relaxed);
+    const size_t count = std::min(gNextSample.load(std::memory_order_relaxed), mCapacity);
+    stacks.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      const auto& sample = mSamples[i];
+      const int depth = sample.depth.load(std::memory_order_acquire);
+      if (depth <= 0)
+        continue;
+      vector<uintptr_t> stack(depth);
+      for (int frame = 0; frame < depth; ++frame)
+        stack[frame] = reinterpret_cast<uintptr_t>(sample.frames[frame]) - (frame ? 1 : 0);
+      stacks.push_back(std::move(stack));
+    }
+    mSamples.reset();
+  }
+
+  result->samples = stacks.size();
+  result->dropped = dropped;
+  result->durationMs = durationNanoseconds / 1000000;
+  try {
+    const string profile = BuildProfile(stacks, hz, startNanoseconds, durationNanoseconds);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(profile.data(), static_cast<std::streamsize>(profile.size()));
+    if (!out) {
+      *error = "Cannot write " + path;
+      return false;
+    }
+  } catch (const std::exception& ex) {
+    *error = ex.what();
+    return false;
+  }
+  return true;
+}
+
+bool CpuProfiler::IsRunning() {
+  lock_guard<mutex> lock(mMutex);
+  return mRunning;
+}
+
+void CpuProfiler::OnToggleSignal(int) {
+  const int savedErrno = errno;
+  const int fd = gTogglePipe.load(std::memory_order_relaxed);
+  if (fd >= 0) {
+    const char byte = 1;
+    ssize_t ignored = write(fd, &byte, 1);
+    (void)ignored;
+  }
+  errno = savedErrno;
+}
+
+bool CpuProfiler::EnableSignal(int signum, int hz, int seconds, const string& directory) {
+  if (signum <= 0 || signum == SIGPROF || hz < 1 || hz > 1000 || seconds < 1 || directory.empty())
+    return false;
+  bool expected = false;
+  if (!mSignalEnabled.compare_exchange_strong(expected, true))
+    return false;
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+    mSignalEnabled.store(false);
+    return false;
+  }
+  gTogglePipe.store(fds[1], std::memory_order_relaxed);
+  struct sigaction action = {};
+  action.sa_handler = OnToggleSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(signum, &action, nullptr) != 0) {
+    gTogglePipe.store(-1, std::memory_order_relaxed);
+    close(fds[0]);
+    close(fds[1]);
+    mSignalEnabled.store(false);
+    return false;
+  }
+  const int readFd = fds[0];
+  std::thread([this, readFd, hz, seconds, directory]() {
+    const size_t maxSamples = static_cast<size_t>(hz) * seconds * std::max(1u, std::thread::hardware_concurrency());
+    std::chrono::steady_clock::time_point stopAt;
+    bool profiling = false;
+    string path;
+    for (;;) {
+      int timeoutMs = -1;
+      if (profiling) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(stopAt - std::chrono::steady_clock::now()).count();
+        timeoutMs = static_cast<int>(std::max<int64_t>(left, 0));
+      }
+      pollfd wait = { readFd, POLLIN, 0 };
+      const int ready = poll(&wait, 1, timeoutMs);
+      if (ready < 0 && errno == EINTR)
+        continue;
+      bool toggled = false;
+      char drained[64];
+      while (ready > 0 && read(readFd, drained, sizeof(drained)) > 0)
+        toggled = true;
+      if (!profiling && toggled) {
+        path = directory + "/cpu-" + std::to_string(getpid()) + "-" + std::to_string(time(nullptr)) + ".pb.gz";
+        profiling = Start(hz, maxSamples);
+        stopAt = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+      } else if (profiling && (toggled || std::chrono::steady_clock::now() >= stopAt)) {
+        Result result;
+        string error;
+        Stop(path, &result, &error);
+        profiling = false;
+      }
+    }
+  }).detach();
+  return true;
+}
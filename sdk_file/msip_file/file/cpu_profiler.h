@@ -0,0 +1,89 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_CPU_PROFILER_H_
+#define SAMPLE_FILE_CPU_PROFILER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Sampling CPU profiler for the whole process. While a profile runs, ITIMER_PROF raises SIGPROF after every
+// 1/hz of CPU time the process uses, and the handler copies the interrupted thread's stack into a buffer
+// allocated at Start, without locking or allocating. Stop symbolizes the stacks with dladdr and writes a
+// gzipped pprof profile whose mappings carry the loaded objects' build ids, so frames dladdr cannot name
+// can be symbolized offline against the same binaries.
+class CpuProfiler final {
+public:
+  static const size_t kMaxDepth = 64;
+
+  struct Result {
+    uint64_t samples;
+    // Samples that found the buffer full.
+    uint64_t dropped;
+    int64_t durationMs;
+  };
+
+  static CpuProfiler& Instance();
+
+  // Returns false when a profile is already running, hz is outside 1..1000, maxSamples is 0 or the
+  // timer cannot be set.
+  bool Start(int hz, size_t maxSamples);
+
+  // Stops the running profile and writes it to path. Returns false, with the reason in *error, when no
+  // profile runs or path cannot be written; the profile is stopped either way.
+  bool Stop(const std::string& path, Result* result, std::string* error);
+
+  bool IsRunning();
+
+  // On signum, starts a profile that stops after seconds, or at the next signum, and is written to
+  // directory/cpu-<pid>-<unix time>.pb.gz. The signal handler only wakes a control thread, which does
+  // the rest. Returns false when already enabled or the handler cannot be installed.
+  bool EnableSignal(int signum, int hz, int seconds, const std::string& directory);
+
+  // One recorded stack; defined with the signal handler that fills it.
+  struct Sample;
+
+private:
+  CpuProfiler();
+
+  static void OnProfileSignal(int signum);
+  static void OnToggleSignal(int signum);
+
+  std::mutex mMutex;
+  bool mRunning;
+  bool mHandlerInstalled;
+  int mHz;
+  std::unique_ptr<Sample[]> mSamples;
+  size_t mCapacity;
+  int64_t mStartNanoseconds;
+  std::atomic<bool> mSignalEnabled;
+};
+
+#endif // SAMPLE_FILE_CPU_PROFILER_H_
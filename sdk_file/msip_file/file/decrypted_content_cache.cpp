@@ -0,0 +1,295 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "decrypted_content_cache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include "mip/protection/rights.h"
+
+using sample::lock::InstrumentedMutex;
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+const size_t kKeySize = 32;
+const size_t kNonceSize = 12;
+const size_t kTagSize = 16;
+// Token digests remembered before the oldest are forgotten; tokens are replaced within the hour.
+const size_t kMaxUsers = 4096;
+
+string GenerateSealKey() {
+  string key(kKeySize, '\0');
+  if (RAND_bytes(reinterpret_cast<unsigned char*>(&key[0]), static_cast<int>(key.size())) != 1)
+    throw runtime_error("Unable to generate the decrypted content cache key");
+  return key;
+}
+
+string Sha256(const string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  if (EVP_Digest(data.data(), data.size(), digest, &size, EVP_sha256(), nullptr) != 1)
+    throw runtime_error("SHA-256 failed");
+  return string(reinterpret_cast<const char*>(digest), size);
+}
+
+// nonce | ciphertext | tag, with aad authenticated alongside.
+string Seal(const string& key, const string& aad, const string& plaintext) {
+  string blob(kNonceSize + plaintext.size() + kTagSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&blob[0]);
+  if (RAND_bytes(out, static_cast<int>(kNonceSize)) != 1)
+    throw runtime_error("Unable to generate a decrypted content nonce");
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  if (!context ||
+      EVP_EncryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), out) != 1 ||
+      EVP_EncryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) != 1 ||
+      EVP_EncryptUpdate(context.get(), out + kNonceSize, &length, reinterpret_cast<const unsigned char*>(plaintext.data()), static_cast<int>(plaintext.size())) != 1 ||
+      EVP_EncryptFinal_ex(context.get(), out + kNonceSize + length, &length) != 1 ||
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_GET_TAG, static_cast<int>(kTagSize), out + kNonceSize + plaintext.size()) != 1)
+    throw runtime_error("Unable to encrypt decrypted content");
+  return blob;
+}
+
+bool Open(const string& key, const string& aad, const string& blob, string& plaintext) {
+  if (blob.size() < kNonceSize + kTagSize)
+    return false;
+  const auto* in = reinterpret_cast<const unsigned char*>(blob.data());
+  const size_t cipherSize = blob.size() - kNonceSize - kTagSize;
+  plaintext.assign(cipherSize, '\0');
+  auto* out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+  int length = 0;
+  return context &&
+      EVP_DecryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), in) == 1 &&
+      EVP_DecryptUpdate(context.get(), nullptr, &length, reinterpret_cast<const unsigned char*>(aad.data()), static_cast<int>(aad.size())) == 1 &&
+      EVP_DecryptUpdate(context.get(), out, &length, in + kNonceSize, static_cast<int>(cipherSize)) == 1 &&
+      EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_SET_TAG, static_cast<int>(kTagSize),
+          const_cast<unsigned char*>(in + kNonceSize + cipherSize)) == 1 &&
+      EVP_DecryptFinal_ex(context.get(), out + length, &length) == 1;
+}
+
+} // namespace
+
+DecryptedContentCache::DecryptedContentCache()
+    : mSealKey(GenerateSealKey()),
+      mCapacityBytes(0),
+      mMaxEntryBytes(0),
+      mBytes(0),
+      mHits(0),
+      mMisses(0),
+      mRevalidationFailures(0),
+      mEvictions(0),
+      mRevocations(0) {
+}
+
+void DecryptedContentCache::Configure(size_t capacityBytes, size_t maxEntryBytes) {
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  mCapacityBytes.store(capacityBytes, std::memory_order_relaxed);
+  mMaxEntryBytes.store(maxEntryBytes ? maxEntryBytes : capacityBytes / 8, std::memory_order_relaxed);
+  EvictLocked(capacityBytes);
+  if (capacityBytes == 0)
+    mUsers.clear();
+}
+
+bool DecryptedContentCache::Admits(int64_t size) const {
+  return IsEnabled() && size >= 0 && static_cast<uint64_t>(size) <= mMaxEntryBytes.load(std::memory_order_relaxed);
+}
+
+void DecryptedContentCache::HashFile(const string& path, Digest& digest) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw runtime_error("Unable to open '" + path + "': " + strerror(errno));
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+  bool hashed = context && EVP_DigestInit_ex(context.get(), EVP_sha256(), nullptr) == 1;
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[1 << 20]);
+  while (hashed) {
+    const ssize_t length = read(fd, buffer.get(), 1 << 20);
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0) {
+      hashed = length == 0;
+      break;
+    }
+    hashed = EVP_DigestUpdate(context.get(), buffer.get(), static_cast<size_t>(length)) == 1;
+  }
+  close(fd);
+  unsigned int size = 0;
+  if (!hashed || EVP_DigestFinal_ex(context.get(), digest.data(), &size) != 1 || size != digest.size())
+    throw runtime_error("Unable to hash '" + path + "'");
+}
+
+string DecryptedContentCache::MakeKey(const Digest& digest, const Identity& identity) {
+  string key(reinterpret_cast<const char*>(digest.data()), digest.size());
+  key += identity.applicationId;
+  key += '\0';
+  for (char c : identity.user)
+    key += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  return key;
+}
+
+string DecryptedContentCache::MakeTokenKey(const string& applicationId, const string& protectionToken) {
+  return Sha256(applicationId + '\0' + protectionToken);
+}
+
+bool DecryptedContentCache::FindUser(const string& applicationId, const string& protectionToken, string& user) {
+  if (!IsEnabled())
+    return false;
+  const string tokenKey = MakeTokenKey(applicationId, protectionToken);
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  auto found = mUsers.find(tokenKey);
+  if (found == mUsers.end()) {
+    ++mMisses;
+    return false;
+  }
+  user = found->second;
+  return true;
+}
+
+bool DecryptedContentCache::Find(const Digest& digest, const Identity& identity, RightsCache& rightsCache, string& plaintext) {
+  if (!IsEnabled())
+    return false;
+  const string key = MakeKey(digest, identity);
+  string contentId;
+  string user;
+  string sealed;
+  {
+    std::lock_guard<InstrumentedMutex> lock(mMutex);
+    auto found = mIndex.find(key);
+    if (found == mIndex.end()) {
+      ++mMisses;
+      return false;
+    }
+    const Slot& slot = *found->second;
+    if (slot.expires && slot.validUntil <= std::chrono::system_clock::now()) {
+      ++mRevalidationFailures;
+      EraseLocked(found->second);
+      return false;
+    }
+    mSlots.splice(mSlots.begin(), mSlots, found->second);
+    contentId = slot.contentId;
+    user = slot.user;
+    sealed = slot.sealed;
+  }
+
+  // The same check every unprotect makes, against the rights the identity's license last granted.
+  RightsCache::Entry rights;
+  if (!rightsCache.Find(contentId, user, rights) || !RightsCache::Allows(rights, mip::rights::Export()) ||
+      !Open(mSealKey, key, sealed, plaintext)) {
+    std::lock_guard<InstrumentedMutex> lock(mMutex);
+    ++mRevalidationFailures;
+    auto found = mIndex.find(key);
+    if (found != mIndex.end())
+      EraseLocked(found->second);
+    return false;
+  }
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  ++mHits;
+  return true;
+}
+
+void DecryptedContentCache::Put(const Digest& digest, const Identity& identity, const string& protectionToken,
+    const string& contentId, const RightsCache::Entry& rights, const string& plaintext) {
+  if (!Admits(static_cast<int64_t>(plaintext.size())))
+    return;
+  Slot slot;
+  slot.key = MakeKey(digest, identity);
+  slot.contentId = contentId;
+  slot.user = identity.user;
+  slot.expires = rights.expires;
+  slot.validUntil = rights.validUntil;
+  slot.sealed = Seal(mSealKey, slot.key, plaintext);
+  const string tokenKey = MakeTokenKey(identity.applicationId, protectionToken);
+
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  const size_t capacityBytes = mCapacityBytes.load(std::memory_order_relaxed);
+  if (slot.sealed.size() > capacityBytes)
+    return;
+  auto found = mIndex.find(slot.key);
+  if (found != mIndex.end())
+    EraseLocked(found->second);
+  mBytes += slot.sealed.size();
+  const string key = slot.key;
+  mSlots.push_front(std::move(slot));
+  mIndex[key] = mSlots.begin();
+  EvictLocked(capacityBytes);
+  if (mUsers.size() >= kMaxUsers)
+    mUsers.clear();
+  mUsers[tokenKey] = identity.user;
+}
+
+void DecryptedContentCache::InvalidateContent(const string& contentId) {
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  for (auto slot = mSlots.begin(); slot != mSlots.end();) {
+    auto next = std::next(slot);
+    if (slot->contentId == contentId) {
+      ++mRevocations;
+      EraseLocked(slot);
+    }
+    slot = next;
+  }
+}
+
+void DecryptedContentCache::Clear() {
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  mSlots.clear();
+  mIndex.clear();
+  mUsers.clear();
+  mBytes = 0;
+}
+
+DecryptedContentCache::Stats DecryptedContentCache::GetStats() const {
+  std::lock_guard<InstrumentedMutex> lock(mMutex);
+  return { mHits, mMisses, mRevalidationFailures, mEvictions, mRevocations, mIndex.size(), mBytes,
+      mCapacityBytes.load(std::memory_order_relaxed) };
+}
+
+void DecryptedContentCache::EraseLocked(std::list<Slot>::iterator slot) {
+  mBytes -= slot->sealed.size();
+  mIndex.erase(slot->key);
+  mSlots.erase(slot);
+}
+
+void DecryptedContentCache::EvictLocked(size_t capacityBytes) {
+  while (mBytes > capacityBytes && !mSlots.empty()) {
+    ++mEvictions;
+    EraseLocked(std::prev(mSlots.end()));
+  }
+}
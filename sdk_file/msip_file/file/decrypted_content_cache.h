@@ -0,0 +1,141 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_DECRYPTED_CONTENT_CACHE_H_
+#define SAMPLE_FILE_DECRYPTED_CONTENT_CACHE_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "instrumented_mutex.h"
+#include "rights_cache.h"
+
+// Byte-bounded LRU of decrypted file content, for protected files that are unprotected over and over. Entries
+// are keyed by the SHA-256 of the protected file and the identity that unprotected it, and hold the plaintext
+// sealed with AES-256-GCM under a key generated at start and never written out, so the cache's pages show no
+// plaintext. An entry is served only while the rights cache still grants its identity EXPORT on the content,
+// so a rights entry that expired or was dropped sends the next request back through the SDK. Entries are
+// also dropped once their license expires and when their content is revoked.
+class DecryptedContentCache final {
+public:
+  typedef std::array<uint8_t, 32> Digest;
+
+  // The identity unprotecting a file: the application plus the user its token was issued to, learned from
+  // the first license consumed with that token.
+  struct Identity {
+    std::string applicationId;
+    std::string user;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    // Entries found but not served, because the rights cache no longer allows them or the license expired.
+    uint64_t revalidationFailures;
+    uint64_t evictions;
+    uint64_t revocations;
+    size_t entries;
+    size_t bytes;
+    size_t capacityBytes;
+  };
+
+  DecryptedContentCache();
+
+  // capacityBytes 0 disables the cache and drops every entry. Files larger than maxEntryBytes are not
+  // cached; 0 allows an eighth of the capacity.
+  void Configure(size_t capacityBytes, size_t maxEntryBytes);
+
+  bool IsEnabled() const { return mCapacityBytes.load(std::memory_order_relaxed) != 0; }
+
+  // Whether a file of size bytes may be cached.
+  bool Admits(int64_t size) const;
+
+  // Fills digest with the SHA-256 of the file at path. Throws std::runtime_error.
+  static void HashFile(const std::string& path, Digest& digest);
+
+  // The user protectionToken was issued to for applicationId, once a license was consumed with it.
+  bool FindUser(const std::string& applicationId, const std::string& protectionToken, std::string& user);
+
+  // The plaintext of the file with digest as unprotected by identity, once rightsCache allowed it again.
+  bool Find(const Digest& digest, const Identity& identity, RightsCache& rightsCache, std::string& plaintext);
+
+  // Keeps plaintext for (digest, identity), under the content id and license validity of rights, and
+  // remembers the token's user.
+  void Put(const Digest& digest, const Identity& identity, const std::string& protectionToken,
+      const std::string& contentId, const RightsCache::Entry& rights, const std::string& plaintext);
+
+  // Drops every entry of contentId, for revoked content.
+  void InvalidateContent(const std::string& contentId);
+
+  void Clear();
+
+  Stats GetStats() const;
+
+private:
+  DecryptedContentCache(const DecryptedContentCache&) = delete;
+  DecryptedContentCache& operator=(const DecryptedContentCache&) = delete;
+
+  struct Slot {
+    std::string key;
+    std::string contentId;
+    std::string user;
+    bool expires;
+    std::chrono::system_clock::time_point validUntil;
+    // nonce | ciphertext | tag
+    std::string sealed;
+  };
+
+  static std::string MakeKey(const Digest& digest, const Identity& identity);
+  static std::string MakeTokenKey(const std::string& applicationId, const std::string& protectionToken);
+  void EraseLocked(std::list<Slot>::iterator slot);
+  void EvictLocked(size_t capacityBytes);
+
+  const std::string mSealKey;
+  std::atomic<size_t> mCapacityBytes;
+  std::atomic<size_t> mMaxEntryBytes;
+  mutable sample::lock::InstrumentedMutex mMutex{"decrypted_content"};
+  // Most recently used first.
+  std::list<Slot> mSlots;
+  std::unordered_map<std::string, std::list<Slot>::iterator> mIndex;
+  // Token digest to user, at most one per entry.
+  std::unordered_map<std::string, std::string> mUsers;
+  size_t mBytes;
+  uint64_t mHits;
+  uint64_t mMisses;
+  uint64_t mRevalidationFailures;
+  uint64_t mEvictions;
+  uint64_t mRevocations;
+};
+
+#endif // SAMPLE_FILE_DECRYPTED_CONTENT_CACHE_H_
@@ -0,0 +1,107 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "delegation_license_cache.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "mip/protection_descriptor.h"
+#include "tenant_context.h"
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::string;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+
+} // namespace
+
+const size_t DelegationLicenseCache::kDefaultCapacity;
+const int DelegationLicenseCache::kDefaultTtlSeconds;
+
+DelegationLicenseCache::DelegationLicenseCache() : mEntries(kDefaultCapacity, "delegation_license"), mTtlSeconds(kDefaultTtlSeconds) {
+}
+
+void DelegationLicenseCache::Configure(size_t capacity, seconds ttl) {
+  mTtlSeconds = ttl.count();
+  mEntries.SetCapacity(capacity);
+}
+
+void DelegationLicenseCache::SetTenantCapacity(size_t capacity) {
+  mEntries.SetGroupCapacity(capacity);
+}
+
+bool DelegationLicenseCache::Find(const string& engineId, const string& contentId, const string& user, Entry& entry) {
+  const seconds ttl(mTtlSeconds.load());
+  Slot slot;
+  if (!mEntries.Find(MakeKey(engineId, contentId, user), slot, [ttl](const Slot& cached) { return !IsExpired(cached, ttl); }))
+    return false;
+  entry = slot.entry;
+  return true;
+}
+
+void DelegationLicenseCache::Put(const string& engineId, const string& contentId, const string& user, const Entry& entry) {
+  if (!entry.license || contentId.empty())
+    return;
+
+  Slot slot;
+  slot.insertedAt = steady_clock::now();
+  slot.entry = entry;
+  mEntries.Put(MakeKey(engineId, contentId, user), slot, sample::tenant::Current());
+}
+
+DelegationLicenseCache::Stats DelegationLicenseCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void DelegationLicenseCache::Clear() {
+  mEntries.Clear();
+}
+
+string DelegationLicenseCache::MakeKey(const string& engineId, const string& contentId, const string& user) {
+  string lowerUser(user);
+  std::transform(lowerUser.begin(), lowerUser.end(), lowerUser.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return engineId + kKeySeparator + contentId + kKeySeparator + lowerUser;
+}
+
+bool DelegationLicenseCache::IsExpired(const Slot& slot, seconds ttl) {
+  if (ttl.count() > 0 && steady_clock::now() - slot.insertedAt >= ttl)
+    return true;
+  auto descriptor = slot.entry.protection ? slot.entry.protection->GetProtectionDescriptor() : nullptr;
+  return descriptor && descriptor->DoesContentExpire() &&
+      descriptor->GetContentValidUntil() <= std::chrono::system_clock::now();
+}
@@ -0,0 +1,98 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_DELEGATION_LICENSE_CACHE_H_
+#define SAMPLE_FILE_DELEGATION_LICENSE_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "mip/protection/delegation_license.h"
+#include "mip/protection/protection_handler.h"
+#include "sharded_lru.h"
+
+// LRU of delegation licenses keyed by engine id, content id and user. Each entry also keeps a consumption
+// handler built offline from the user's license, so access checks for a known (content, user) pair run
+// locally. Entries expire after a TTL and, for content with an expiry, once that passes.
+class DelegationLicenseCache final {
+public:
+  struct Entry {
+    std::shared_ptr<mip::DelegationLicense> license;
+    std::shared_ptr<mip::ProtectionHandler> protection;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  static const size_t kDefaultCapacity = 4096;
+  static const int kDefaultTtlSeconds = 3600;
+
+  DelegationLicenseCache();
+
+  // capacity 0 disables the cache and drops every entry. ttl 0 keeps entries until evicted.
+  void Configure(size_t capacity, std::chrono::seconds ttl);
+
+  // Caps the licenses put by each tenant (see tenant_context.h). Zero lifts the cap.
+  void SetTenantCapacity(size_t capacity);
+
+  // False when nothing valid is cached for the user. Users compare case-insensitively.
+  bool Find(const std::string& engineId, const std::string& contentId, const std::string& user, Entry& entry);
+
+  void Put(const std::string& engineId, const std::string& contentId, const std::string& user, const Entry& entry);
+
+  Stats GetStats() const;
+
+  // Entries each tenant put, by tenant (see SetTenantCapacity).
+  std::map<std::string, size_t> GetTenantSizes() const { return mEntries.GetGroupSizes(); }
+
+  // Drops every entry. Called before the engines they were created with are released.
+  void Clear();
+
+private:
+  struct Slot {
+    std::chrono::steady_clock::time_point insertedAt;
+    Entry entry;
+  };
+
+  static std::string MakeKey(const std::string& engineId, const std::string& contentId, const std::string& user);
+  static bool IsExpired(const Slot& slot, std::chrono::seconds ttl);
+
+  ShardedLru<Slot> mEntries;
+  std::atomic<int64_t> mTtlSeconds;
+};
+
+#endif // SAMPLE_FILE_DELEGATION_LICENSE_CACHE_H_
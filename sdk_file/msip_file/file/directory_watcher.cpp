@@ -0,0 +1,317 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "directory_watcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+using std::chrono::steady_clock;
+
+namespace {
+
+// What is watched on every directory. Creating a file is not an event of its own: it is ready once closed.
+const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE |
+    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+string ErrorText(const string& what, int error) {
+  if (error == ENOSPC)
+    return what + ": the inotify watch limit is reached (see fs.inotify.max_user_watches)";
+  return what + ": " + strerror(error);
+}
+
+bool IsUnder(const string& path, const string& directory) {
+  return path.size() > directory.size() && path.compare(0, directory.size(), directory) == 0 && path[directory.size()] == '/';
+}
+
+} // namespace
+
+const size_t DirectoryWatcher::kDefaultMaxBatch;
+
+DirectoryWatcher::DirectoryWatcher(const Options& options, const BatchHandler& handleBatch, const ErrorHandler& handleError)
+    : mOptions(options),
+      mHandleBatch(handleBatch),
+      mHandleError(handleError),
+      mFilter(options.extensions, 1),
+      mInotifyFd(-1),
+      mStopping(false),
+      mDirectoryCount(0),
+      mEvents(0),
+      mWritten(0),
+      mRemoved(0),
+      mBatches(0),
+      mOverflows(0),
+      mErrors(0) {
+  mStopPipe[0] = mStopPipe[1] = -1;
+  if (mOptions.roots.empty())
+    throw std::invalid_argument("No directory to watch");
+  mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mInotifyFd < 0)
+    throw std::runtime_error(ErrorText("inotify_init1", errno));
+  if (pipe2(mStopPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+    const int error = errno;
+    close(mInotifyFd);
+    throw std::runtime_error(ErrorText("pipe2", error));
+  }
+  for (const auto& root : mOptions.roots) {
+    string error;
+    string directory = root;
+    while (directory.size() > 1 && directory.back() == '/')
+      directory.pop_back();
+    if (!WatchTree(directory, false, error)) {
+      close(mInotifyFd);
+      close(mStopPipe[0]);
+      close(mStopPipe[1]);
+      throw std::runtime_error(error);
+    }
+  }
+  mReader = std::thread(&DirectoryWatcher::ReadLoop, this);
+  mDispatcher = std::thread(&DirectoryWatcher::DispatchLoop, this);
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  Stop();
+}
+
+void DirectoryWatcher::Stop() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mStopping)
+      return;
+    mStopping = true;
+    mPending.clear();
+  }
+  mChanged.notify_all();
+  const char stop = 0;
+  while (write(mStopPipe[1], &stop, 1) < 0 && errno == EINTR) {
+  }
+  mReader.join();
+  mDispatcher.join();
+  close(mInotifyFd);
+  close(mStopPipe[0]);
+  close(mStopPipe[1]);
+}
+
+DirectoryWatcher::Stats DirectoryWatcher::GetStats() const {
+  Stats stats;
+  stats.roots = mOptions.roots.size();
+  stats.directories = mDirectoryCount.load(std::memory_order_relaxed);
+  stats.events = mEvents.load(std::memory_order_relaxed);
+  stats.written = mWritten.load(std::memory_order_relaxed);
+  stats.removed = mRemoved.load(std::memory_order_relaxed);
+  stats.batches = mBatches.load(std::memory_order_relaxed);
+  stats.overflows = mOverflows.load(std::memory_order_relaxed);
+  stats.errors = mErrors.load(std::memory_order_relaxed);
+  lock_guard<mutex> lock(mMutex);
+  stats.pending = mPending.size();
+  return stats;
+}
+
+bool DirectoryWatcher::WatchTree(const string& directory, bool report, string& error) {
+  // Each directory is watched before it is listed, so a file written in between is either listed or
+  // raises an event, and at worst both, which the pending paths merge.
+  vector<string> directories(1, directory);
+  while (!directories.empty()) {
+    const string current = std::move(directories.back());
+    directories.pop_back();
+    const int watch = inotify_add_watch(mInotifyFd, current.c_str(), kWatchMask);
+    if (watch < 0) {
+      const string message = ErrorText("Failed to watch '" + current + "'", errno);
+      if (current == directory) {
+        error = message;
+        return false;
+      }
+      ++mErrors;
+      mHandleError(current, message);
+      continue;
+    }
+    auto previous = mDirectories.find(watch);
+    if (previous != mDirectories.end())
+      mWatches.erase(previous->second);
+    mDirectories[watch] = current;
+    mWatches[current] = watch;
+
+    DIR* listing = opendir(current.c_str());
+    if (!listing)
+      continue;
+    while (dirent* entry = readdir(listing)) {
+      const char* name = entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        continue;
+      const string path = current + '/' + name;
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN) {
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0)
+          continue;
+        type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+      if (type == DT_DIR)
+        directories.push_back(path);
+      else if (type == DT_REG && report && mFilter.Matches(name))
+        AddPending(path, Change::Written);
+    }
+    closedir(listing);
+  }
+  mDirectoryCount.store(mDirectories.size(), std::memory_order_relaxed);
+  return true;
+}
+
+void DirectoryWatcher::UnwatchTree(const string& directory) {
+  for (auto it = mWatches.begin(); it != mWatches.end();) {
+    if (it->first == directory || IsUnder(it->first, directory)) {
+      inotify_rm_watch(mInotifyFd, it->second);
+      mDirectories.erase(it->second);
+      it = mWatches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  mDirectoryCount.store(mDirectories.size(), std::memory_order_relaxed);
+}
+
+void DirectoryWatcher::AddPending(const string& path, Change change) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mStopping)
+      return;
+    Pending& pending = mPending[path];
+    pending.change = change;
+    pending.at = steady_clock::now();
+  }
+  mChanged.notify_one();
+}
+
+void DirectoryWatcher::ReadLoop() {
+  alignas(inotify_event) char buffer[64 * 1024];
+  pollfd fds[2] = { { mInotifyFd, POLLIN, 0 }, { mStopPipe[0], POLLIN, 0 } };
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents)
+      return;
+    for (;;) {
+      const ssize_t length = read(mInotifyFd, buffer, sizeof(buffer));
+      if (length <= 0)
+        break;
+      for (ssize_t offset = 0; offset < length;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        ++mEvents;
+        if (event->mask & IN_Q_OVERFLOW) {
+          ++mOverflows;
+          mHandleError(mOptions.roots.front(), "The inotify event queue overflowed and events were lost (see fs.inotify.max_queued_events)");
+          continue;
+        }
+        auto directory = mDirectories.find(event->wd);
+        if (directory == mDirectories.end())
+          continue;
+        if (event->mask & IN_IGNORED) {
+          // The directory was deleted, or its file system unmounted.
+          mWatches.erase(directory->second);
+          mDirectories.erase(directory);
+          mDirectoryCount.store(mDirectories.size(), std::memory_order_relaxed);
+          continue;
+        }
+        if (event->len == 0)
+          continue;
+        const string path = directory->second + '/' + event->name;
+        if (event->mask & IN_ISDIR) {
+          string error;
+          if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (!WatchTree(path, true, error)) {
+              ++mErrors;
+              mHandleError(path, error);
+            }
+          } else if (event->mask & IN_MOVED_FROM) {
+            // Its files are gone from the tree, under a path they can no longer be listed at.
+            UnwatchTree(path);
+            AddPending(path, Change::Removed);
+          }
+          continue;
+        }
+        if (!mFilter.Matches(event->name))
+          continue;
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+          AddPending(path, Change::Written);
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+          AddPending(path, Change::Removed);
+      }
+    }
+  }
+}
+
+void DirectoryWatcher::DispatchLoop() {
+  const size_t maxBatch = mOptions.maxBatch > 0 ? mOptions.maxBatch : kDefaultMaxBatch;
+  unique_lock<mutex> lock(mMutex);
+  while (!mStopping) {
+    if (mPending.empty()) {
+      mChanged.wait(lock);
+      continue;
+    }
+    const auto now = steady_clock::now();
+    auto next = steady_clock::time_point::max();
+    vector<Event> batch;
+    for (auto it = mPending.begin(); it != mPending.end();) {
+      const auto settled = it->second.at + mOptions.settle;
+      if (settled <= now && batch.size() < maxBatch) {
+        batch.push_back(Event{ it->second.change, it->first });
+        it = mPending.erase(it);
+      } else {
+        next = std::min(next, settled);
+        ++it;
+      }
+    }
+    if (batch.empty()) {
+      mChanged.wait_until(lock, next);
+      continue;
+    }
+    lock.unlock();
+    std::sort(batch.begin(), batch.end(), [](const Event& a, const Event& b) { return a.path < b.path; });
+    for (const auto& event : batch)
+      ++(event.change == Change::Written ? mWritten : mRemoved);
+    ++mBatches;
+    mHandleBatch(batch);
+    lock.lock();
+  }
+}
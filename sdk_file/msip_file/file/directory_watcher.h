@@ -0,0 +1,149 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_DIRECTORY_WATCHER_H_
+#define SAMPLE_FILE_DIRECTORY_WATCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "tree_scanner.h"
+
+// Watches directory trees with inotify and hands the files written or moved into them to a handler in
+// batches, so drop folders are processed as files arrive instead of by rescanning them. A file counts as
+// written once a writer closes it (IN_CLOSE_WRITE) or it is moved in complete (IN_MOVED_TO); files that are
+// deleted or moved away are reported as removed. A path is handed over once no event for it arrived for the
+// settle time, so a file written in several passes is processed once. Directories created or moved into a
+// tree are watched as they appear, and the files already in them reported, so nothing written before the
+// watch was added is missed. One thread reads the events and another runs the handler, so a slow batch does
+// not leave the kernel's event queue to overflow; when it does all the same, the overflow is counted and
+// reported to the error handler, since events were lost. fanotify would need CAP_SYS_ADMIN, so it is not used.
+class DirectoryWatcher final {
+public:
+  enum class Change { Written, Removed };
+
+  struct Event {
+    Change change;
+    std::string path;
+  };
+
+  struct Options {
+    std::vector<std::string> roots;
+    // As TreeScanner takes them; empty accepts every file.
+    std::unordered_set<std::string> extensions;
+    std::chrono::milliseconds settle;
+    // Most files handed to the handler at once.
+    size_t maxBatch;
+  };
+
+  struct Stats {
+    size_t roots;
+    size_t directories;
+    uint64_t events;
+    uint64_t written;
+    uint64_t removed;
+    uint64_t batches;
+    uint64_t overflows;
+    uint64_t errors;
+    // Paths waiting for their settle time.
+    size_t pending;
+  };
+
+  // Called on the watcher's dispatch thread, one batch at a time. Must not throw.
+  typedef std::function<void(const std::vector<Event>& events)> BatchHandler;
+  // Called for a directory that could not be watched, and for an overflow of the event queue. Must not throw.
+  typedef std::function<void(const std::string& path, const std::string& error)> ErrorHandler;
+
+  static const size_t kDefaultMaxBatch = 64;
+
+  // Watches every directory under the roots and starts the threads. Throws std::runtime_error when inotify
+  // is unavailable or a root is not a directory that can be watched.
+  DirectoryWatcher(const Options& options, const BatchHandler& handleBatch, const ErrorHandler& handleError);
+  ~DirectoryWatcher();
+
+  DirectoryWatcher(const DirectoryWatcher&) = delete;
+  DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+  // Waits for the running batch; paths still settling are dropped.
+  void Stop();
+
+  Stats GetStats() const;
+
+private:
+  struct Pending {
+    Change change;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  // Watches directory and every directory under it, and with report adds the files found to the pending
+  // paths. Returns false when directory itself cannot be watched.
+  bool WatchTree(const std::string& directory, bool report, std::string& error);
+  // Stops watching directory and everything under it, which moved away.
+  void UnwatchTree(const std::string& directory);
+  void AddPending(const std::string& path, Change change);
+  void ReadLoop();
+  void DispatchLoop();
+
+  const Options mOptions;
+  const BatchHandler mHandleBatch;
+  const ErrorHandler mHandleError;
+  const TreeScanner mFilter;
+  int mInotifyFd;
+  int mStopPipe[2];
+
+  // Only the read thread uses the watch descriptors once it runs.
+  std::unordered_map<int, std::string> mDirectories;
+  std::unordered_map<std::string, int> mWatches;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mChanged;
+  std::unordered_map<std::string, Pending> mPending;
+  bool mStopping;
+
+  std::atomic<size_t> mDirectoryCount;
+  std::atomic<uint64_t> mEvents;
+  std::atomic<uint64_t> mWritten;
+  std::atomic<uint64_t> mRemoved;
+  std::atomic<uint64_t> mBatches;
+  std::atomic<uint64_t> mOverflows;
+  std::atomic<uint64_t> mErrors;
+
+  std::thread mReader;
+  std::thread mDispatcher;
+};
+
+#endif // SAMPLE_FILE_DIRECTORY_WATCHER_H_
@@ -41,8 +41,8 @@ using std::vector;
 #endif // _WIN32
 
 EditableStreamOverBuffer::EditableStreamOverBuffer(vector<uint8_t>&& buffer)
-    : mBuffer(buffer),
-      mSize(static_cast<uint64_t>(buffer.size())),
+    : mBuffer(std::move(buffer)),
+      mSize(static_cast<int64_t>(mBuffer.size())),
       mPosition(0) {
 }
 
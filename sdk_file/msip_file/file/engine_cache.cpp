@@ -0,0 +1,830 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "engine_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <exception>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "allocation_account.h"
+#include "metrics_registry.h"
+#include "operation_log.h"
+#include "request_deadline.h"
+
+using sample::lock::InstrumentedMutex;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+// Separates a replacement engine's generation from the key hash. Key-derived ids never contain it.
+static const char kGenerationSeparator = '-';
+
+// FNV-1a, used instead of std::hash so engine ids stay stable across builds.
+uint64_t Fnv1a64(const string& value) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto c : value) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+} // namespace
+
+const size_t EngineCache::kDefaultCapacity;
+const size_t EngineCache::kMaxHibernated;
+
+string EngineCache::Key::ToString() const {
+  string result;
+  result.reserve(applicationId.size() + username.size() + protectionBaseUrl.size() + policyBaseUrl.size() + 10);
+  result += applicationId;
+  result += kKeySeparator;
+  result += username;
+  result += kKeySeparator;
+  result += protectionBaseUrl;
+  result += kKeySeparator;
+  result += policyBaseUrl;
+  result += kKeySeparator;
+  result += protectionOnly ? '1' : '0';
+  // Only appended when set, so the ids of existing engines and their storage stay the same.
+  if (msgContainers) {
+    result += kKeySeparator;
+    result += "msg";
+  }
+  return result;
+}
+
+EngineCache::EngineCache(size_t capacity)
+    : mCapacity(capacity > 0 ? capacity : 1),
+      mSize(0),
+      mPolicyCapacity(0),
+      mTenantCapacity(0),
+      mHits(0),
+      mMisses(0),
+      mEvictions(0),
+      mPolicyRefreshes(0),
+      mPolicyRefreshFailures(0),
+      mReloads(0),
+      mReloadFailures(0),
+      mLockWaits(0),
+      mHibernations(0),
+      mRestores(0),
+      mRestoreMs(0),
+      mGeneration(1),
+      mRefreshTtl(0),
+      mStopRefresh(false),
+      mRefreshPaused(false),
+      mIdleTimeout(0),
+      mStopHibernate(false),
+      mHibernatePaused(false),
+      mDrainTimeout(0),
+      mReloadPending(false),
+      mReloadRunning(false),
+      mStopReload(false) {
+}
+
+EngineCache::~EngineCache() {
+  StopPolicyRefresh();
+  StopHibernation();
+  StopReload();
+}
+
+EngineCache::Entry EngineCache::GetOrCreate(const Key& key, const Factory& factory) {
+  const string keyString = key.ToString();
+  {
+    EpochReclaimer::ReadGuard guard;
+    if (const Slot* slot = FindSlot(keyString)) {
+      Touch(*slot);
+      mHits.fetch_add(1, std::memory_order_relaxed);
+      sample::oplog::RecordCacheLookup("engine", true);
+      return slot->entry;
+    }
+  }
+
+  std::shared_future<Entry> pending;
+  std::promise<Entry> creating;
+  bool restoring = false;
+  {
+    unique_lock<InstrumentedMutex> lock(mMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      mLockWaits.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+    // Loaded by another caller since the lookup above.
+    if (const Slot* slot = FindSlot(keyString)) {
+      Touch(*slot);
+      mHits.fetch_add(1, std::memory_order_relaxed);
+      sample::oplog::RecordCacheLookup("engine", true);
+      return slot->entry;
+    }
+    ++mMisses;
+    sample::oplog::RecordCacheLookup("engine", false);
+    auto loading = mCreating.find(keyString);
+    if (loading != mCreating.end()) {
+      pending = loading->second;
+    } else if (TakeBackDraining(keyString, MakeEngineId(key))) {
+      // Still loaded, so it is served again instead of being loaded a second time.
+      if (mHibernated.erase(keyString) > 0)
+        ++mRestores;
+      const Entry entry = mLru.front().second;
+      EvictOverCapacity();
+      lock.unlock();
+      UnloadDrained(false);
+      return entry;
+    } else {
+      mCreating[keyString] = creating.get_future().share();
+      restoring = mHibernated.erase(keyString) > 0;
+    }
+  }
+
+  // Both engines would share one engine id, so loading a second one would only unload the first.
+  if (pending.valid()) {
+    static auto& coalesced = MetricsRegistry::Shared().GetCounter(
+        "msip_native_engine_loads_coalesced_total", "Engine loads that waited for one already in flight");
+    coalesced.Add(1);
+    return sample::deadline::WaitUntilDeadline(pending);
+  }
+
+  // Engine creation involves network round trips, so it runs without holding the lock. What it allocates,
+  // and what evicting older engines frees, is counted as engine memory.
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  const auto loadStarted = steady_clock::now();
+  Entry created;
+  try {
+    created = factory(MakeEngineId(key));
+    created.protectionOnly = key.protectionOnly;
+    created.applicationId = key.applicationId;
+  } catch (...) {
+    {
+      lock_guard<InstrumentedMutex> lock(mMutex);
+      mCreating.erase(keyString);
+    }
+    creating.set_exception(std::current_exception());
+    throw;
+  }
+
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mCreating.erase(keyString);
+    if (restoring) {
+      ++mRestores;
+      mRestoreMs += static_cast<uint64_t>(std::chrono::duration_cast<milliseconds>(steady_clock::now() - loadStarted).count());
+    }
+    mLru.emplace_front(keyString, created);
+    mIndex[keyString] = mLru.begin();
+    EvictOverCapacity();
+  }
+  creating.set_value(created);
+
+  // Also unloads engines evicted earlier whose last caller has returned since.
+  UnloadDrained(false);
+  return created;
+}
+
+bool EngineCache::Contains(const Key& key) const {
+  EpochReclaimer::ReadGuard guard;
+  return FindSlot(key.ToString()) != nullptr;
+}
+
+const EngineCache::Entry* EngineCache::Find(const Key& key) const {
+  const Slot* slot = FindSlot(key.ToString());
+  if (!slot)
+    return nullptr;
+  Touch(*slot);
+  return &slot->entry;
+}
+
+void EngineCache::SetCapacity(size_t capacity) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mCapacity = capacity > 0 ? capacity : 1;
+    EvictOverCapacity();
+  }
+  UnloadDrained(false);
+}
+
+void EngineCache::SetPolicyCapacity(size_t policyCapacity) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mPolicyCapacity = policyCapacity;
+    EvictOverCapacity();
+  }
+  UnloadDrained(false);
+}
+
+void EngineCache::SetTenantCapacity(size_t tenantCapacity) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mTenantCapacity = tenantCapacity;
+    EvictOverCapacity();
+  }
+  UnloadDrained(false);
+}
+
+EngineCache::Stats EngineCache::GetStats() const {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  Stats stats;
+  stats.hits = mHits.load(std::memory_order_relaxed);
+  stats.misses = mMisses;
+  stats.evictions = mEvictions;
+  stats.size = mLru.size();
+  stats.capacity = mCapacity;
+  stats.policyEngines = static_cast<size_t>(std::count_if(mLru.begin(), mLru.end(), [](const LruList::value_type& entry) {
+    return !entry.second.protectionOnly;
+  }));
+  stats.policyCapacity = mPolicyCapacity;
+  stats.tenantCapacity = mTenantCapacity;
+  stats.policyRefreshes = mPolicyRefreshes;
+  stats.policyRefreshFailures = mPolicyRefreshFailures;
+  stats.reloads = mReloads;
+  stats.reloadFailures = mReloadFailures;
+  stats.draining = mDraining.size();
+  stats.lockWaits = mLockWaits.load(std::memory_order_relaxed);
+  stats.hibernations = mHibernations;
+  stats.restores = mRestores;
+  stats.restoreMs = mRestoreMs;
+  stats.hibernated = mHibernated.size();
+  return stats;
+}
+
+vector<EngineCache::TenantStats> EngineCache::GetTenants() const {
+  const int64_t now = std::chrono::duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+  std::map<string, TenantStats> tenants;
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  for (const auto& entry : mLru) {
+    auto inserted = tenants.emplace(entry.second.applicationId, TenantStats{ entry.second.applicationId, 0, 0, std::numeric_limits<int64_t>::max() });
+    TenantStats& tenant = inserted.first->second;
+    ++tenant.engines;
+    if (!entry.second.protectionOnly)
+      ++tenant.policyEngines;
+    if (const Slot* slot = FindSlot(entry.first))
+      tenant.idleMs = std::min(tenant.idleMs, std::max<int64_t>(now - slot->lastUsed.load(std::memory_order_relaxed), 0));
+  }
+  vector<TenantStats> result;
+  result.reserve(tenants.size());
+  for (auto& tenant : tenants) {
+    if (tenant.second.idleMs == std::numeric_limits<int64_t>::max())
+      tenant.second.idleMs = 0;
+    result.push_back(std::move(tenant.second));
+  }
+  return result;
+}
+
+vector<pair<string, shared_ptr<const LabelIndex>>> EngineCache::GetLabelIndexes() const {
+  vector<pair<string, shared_ptr<const LabelIndex>>> result;
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  for (const auto& entry : mLru) {
+    if (!entry.second.labels)
+      continue;
+    char engineId[17];
+    snprintf(engineId, sizeof(engineId), "%016llx", static_cast<unsigned long long>(Fnv1a64(entry.first)));
+    result.emplace_back(engineId, entry.second.labels);
+  }
+  return result;
+}
+
+void EngineCache::SetPolicyRefresh(seconds ttl) {
+  StopPolicyRefresh();
+  if (ttl.count() <= 0)
+    return;
+  lock_guard<mutex> lock(mRefreshMutex);
+  mRefreshTtl = ttl;
+  mStopRefresh = false;
+  mRefreshThread = std::thread(&EngineCache::PolicyRefreshLoop, this);
+}
+
+void EngineCache::SetIdleTimeout(seconds idle) {
+  StopHibernation();
+  if (idle.count() <= 0)
+    return;
+  lock_guard<mutex> lock(mHibernateMutex);
+  mIdleTimeout = idle;
+  mStopHibernate = false;
+  mHibernateThread = std::thread(&EngineCache::HibernationLoop, this);
+}
+
+seconds EngineCache::GetIdleTimeout() {
+  lock_guard<mutex> lock(mHibernateMutex);
+  return mHibernateThread.joinable() || mHibernatePaused ? mIdleTimeout : seconds(0);
+}
+
+size_t EngineCache::Reload(seconds drainTimeout) {
+  size_t queued;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    queued = static_cast<size_t>(std::count_if(mLru.begin(), mLru.end(), [](const LruList::value_type& entry) {
+      return entry.second.reload && entry.second.engine;
+    }));
+  }
+  std::thread finished;
+  {
+    lock_guard<mutex> lock(mReloadMutex);
+    mDrainTimeout = drainTimeout;
+    mReloadPending = true;
+    mReloadCondition.notify_all();
+    // A running pass picks the request up when it is done; a paused one when the threads resume.
+    if (mReloadRunning || mStopReload)
+      return queued;
+    finished.swap(mReloadThread);
+    mReloadRunning = true;
+    mReloadThread = std::thread(&EngineCache::ReloadLoop, this);
+  }
+  // The previous reload thread already returned, so this does not wait.
+  if (finished.joinable())
+    finished.join();
+  return queued;
+}
+
+void EngineCache::PauseThreads() {
+  bool refreshing;
+  {
+    lock_guard<mutex> lock(mRefreshMutex);
+    refreshing = mRefreshThread.joinable();
+    if (refreshing)
+      mRefreshPaused = true;
+  }
+  if (refreshing)
+    StopPolicyRefresh();
+  bool hibernating;
+  {
+    lock_guard<mutex> lock(mHibernateMutex);
+    hibernating = mHibernateThread.joinable();
+    if (hibernating)
+      mHibernatePaused = true;
+  }
+  if (hibernating)
+    StopHibernation();
+  StopReload();
+}
+
+void EngineCache::ResumeThreads() {
+  seconds ttl(0);
+  {
+    lock_guard<mutex> lock(mRefreshMutex);
+    if (mRefreshPaused) {
+      mRefreshPaused = false;
+      ttl = mRefreshTtl;
+    }
+  }
+  if (ttl.count() > 0)
+    SetPolicyRefresh(ttl);
+
+  seconds idle(0);
+  {
+    lock_guard<mutex> lock(mHibernateMutex);
+    if (mHibernatePaused) {
+      mHibernatePaused = false;
+      idle = mIdleTimeout;
+    }
+  }
+  if (idle.count() > 0)
+    SetIdleTimeout(idle);
+
+  bool pending;
+  seconds drainTimeout;
+  {
+    lock_guard<mutex> lock(mReloadMutex);
+    mStopReload = false;
+    pending = mReloadPending;
+    drainTimeout = mDrainTimeout;
+  }
+  if (pending)
+    Reload(drainTimeout);
+}
+
+void EngineCache::Clear() {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  StopPolicyRefresh();
+  StopHibernation();
+  StopReload();
+  {
+    lock_guard<mutex> lock(mReloadMutex);
+    mReloadPending = false;
+    mStopReload = false;
+  }
+  LruList evicted;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    evicted.swap(mLru);
+    mIndex.clear();
+    mHibernated.clear();
+    mSize = 0;
+    evicted.splice(evicted.end(), mDraining);
+    Publish();
+  }
+  // The retired copy of the pool holds the engines too, and they must be gone before the profiles are.
+  EpochReclaimer::Shared().Reclaim();
+  Unload(evicted);
+}
+
+string EngineCache::MakeEngineId(const Key& key) {
+  char engineId[17];
+  snprintf(engineId, sizeof(engineId), "%016llx", static_cast<unsigned long long>(Fnv1a64(key.ToString())));
+  return string(engineId);
+}
+
+string EngineCache::MakeAffinityKey(const string& applicationId, const string& identity) {
+  string folded(identity);
+  std::transform(folded.begin(), folded.end(), folded.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(Fnv1a64(folded)));
+  return applicationId + '/' + hash;
+}
+
+const EngineCache::Slot* EngineCache::FindSlot(const string& key) const {
+  const Slots* slots = mSlots.Load();
+  if (!slots)
+    return nullptr;
+  auto it = slots->find(key);
+  return it != slots->end() ? it->second.get() : nullptr;
+}
+
+void EngineCache::Touch(const Slot& slot) {
+  // A store only once per millisecond, so hits on a hot engine do not keep its cache line moving.
+  const int64_t now = std::chrono::duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+  if (slot.lastUsed.load(std::memory_order_relaxed) != now)
+    slot.lastUsed.store(now, std::memory_order_relaxed);
+}
+
+void EngineCache::Publish() {
+  const int64_t now = std::chrono::duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+  std::unique_ptr<Slots> slots(new Slots());
+  slots->reserve(mLru.size());
+  for (const auto& entry : mLru) {
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->entry = entry.second;
+    const Slot* previous = FindSlot(entry.first);
+    slot->lastUsed.store(previous ? previous->lastUsed.load(std::memory_order_relaxed) : now, std::memory_order_relaxed);
+    slots->emplace(entry.first, std::move(slot));
+  }
+  mSlots.Store(slots.release());
+}
+
+void EngineCache::SyncRecency() {
+  // Engines added since the last publish are the most recent.
+  auto lastUsed = [this](const LruList::value_type& entry) {
+    const Slot* slot = FindSlot(entry.first);
+    return slot ? slot->lastUsed.load(std::memory_order_relaxed) : std::numeric_limits<int64_t>::max();
+  };
+  // Stable, so engines used within the same millisecond keep their order.
+  mLru.sort([&lastUsed](const LruList::value_type& a, const LruList::value_type& b) {
+    return lastUsed(a) > lastUsed(b);
+  });
+}
+
+void EngineCache::EvictOverCapacity() {
+  // In-flight callers may still hold an evicted engine, so it drains like a replaced one. Until it is
+  // unloaded, a request for its key takes it back instead of loading a second engine under its id.
+  SyncRecency();
+  // Tenants over their own cap go first, so they give up their engines before anyone else's are evicted.
+  if (mTenantCapacity > 0) {
+    std::unordered_map<string, size_t> tenantEngines;
+    for (const auto& entry : mLru)
+      ++tenantEngines[entry.second.applicationId];
+    auto it = mLru.end();
+    while (it != mLru.begin()) {
+      --it;
+      size_t& engines = tenantEngines[it->second.applicationId];
+      if (engines <= mTenantCapacity)
+        continue;
+      auto victim = it++;
+      mIndex.erase(victim->first);
+      mDraining.splice(mDraining.end(), mLru, victim);
+      ++mEvictions;
+      --engines;
+    }
+  }
+
+  while (mLru.size() > mCapacity) {
+    auto last = std::prev(mLru.end());
+    mIndex.erase(last->first);
+    mDraining.splice(mDraining.end(), mLru, last);
+    ++mEvictions;
+  }
+  mSize = mLru.size();
+  if (mPolicyCapacity == 0) {
+    Publish();
+    return;
+  }
+
+  size_t policyEngines = static_cast<size_t>(std::count_if(mLru.begin(), mLru.end(), [](const LruList::value_type& entry) {
+    return !entry.second.protectionOnly;
+  }));
+  // From the least recently used end, skipping protection-only engines.
+  auto it = mLru.end();
+  while (policyEngines > mPolicyCapacity && it != mLru.begin()) {
+    --it;
+    if (it->second.protectionOnly)
+      continue;
+    auto victim = it++;
+    mIndex.erase(victim->first);
+    mDraining.splice(mDraining.end(), mLru, victim);
+    ++mEvictions;
+    --policyEngines;
+  }
+  mSize = mLru.size();
+  Publish();
+}
+
+void EngineCache::Unload(const LruList& evicted) {
+  for (const auto& entry : evicted) {
+    shared_ptr<mip::FileProfile> profile = entry.second.profile.lock();
+    if (profile && entry.second.engine) {
+      // Fire and forget: nothing waits on the unload, and ProfileObserver ignores the outcome.
+      const string& engineId = entry.second.engine->GetSettings().GetEngineId();
+      // Replacement ids are never reused, so their cached data is deleted rather than kept for a later load.
+      if (engineId.find(kGenerationSeparator) != string::npos)
+        profile->DeleteEngineAsync(engineId, nullptr);
+      else
+        profile->UnloadEngineAsync(engineId, nullptr);
+    }
+  }
+}
+
+void EngineCache::StopPolicyRefresh() {
+  std::thread refreshThread;
+  {
+    lock_guard<mutex> lock(mRefreshMutex);
+    mStopRefresh = true;
+    refreshThread.swap(mRefreshThread);
+    mRefreshCondition.notify_all();
+  }
+  if (refreshThread.joinable())
+    refreshThread.join();
+}
+
+void EngineCache::PolicyRefreshLoop() {
+  unique_lock<mutex> lock(mRefreshMutex);
+  const seconds ttl = mRefreshTtl;
+  // Checking is a clock read per engine, so it runs often enough to replace an engine soon after it expires.
+  const seconds interval = std::min(std::max(ttl / 10, seconds(1)), seconds(60));
+  while (!mRefreshCondition.wait_for(lock, interval, [this]() { return mStopRefresh; })) {
+    lock.unlock();
+    RefreshStalePolicies(ttl);
+    lock.lock();
+  }
+}
+
+void EngineCache::RefreshStalePolicies(seconds ttl) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  const auto staleBefore = system_clock::now() - ttl;
+  vector<pair<string, Entry>> stale;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    for (const auto& entry : mLru) {
+      if (entry.second.reload && entry.second.engine && !entry.second.protectionOnly &&
+          entry.second.engine->GetLastPolicyFetchTime() < staleBefore)
+        stale.push_back(entry);
+    }
+  }
+  // A long operation may still hold the engine it picked up before it went stale, so the replaced engines
+  // drain like Reload's and are unloaded once their last caller returns, on this pass or a later one.
+  LruList retired = Replace(stale, mPolicyRefreshes, mPolicyRefreshFailures, []() { return false; });
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mDraining.splice(mDraining.end(), retired);
+  }
+  UnloadDrained(false);
+}
+
+void EngineCache::StopHibernation() {
+  std::thread hibernateThread;
+  {
+    lock_guard<mutex> lock(mHibernateMutex);
+    mStopHibernate = true;
+    hibernateThread.swap(mHibernateThread);
+    mHibernateCondition.notify_all();
+  }
+  if (hibernateThread.joinable())
+    hibernateThread.join();
+}
+
+void EngineCache::HibernationLoop() {
+  unique_lock<mutex> lock(mHibernateMutex);
+  const seconds idle = mIdleTimeout;
+  // Like the policy refresh check, a clock read per engine, so an engine goes soon after its timeout.
+  const seconds interval = std::min(std::max(idle / 10, seconds(1)), seconds(60));
+  while (!mHibernateCondition.wait_for(lock, interval, [this]() { return mStopHibernate; })) {
+    lock.unlock();
+    HibernateIdle(idle);
+    lock.lock();
+  }
+}
+
+void EngineCache::HibernateIdle(milliseconds idle) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  const int64_t idleBefore = std::chrono::duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count() - idle.count();
+  LruList hibernated;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    auto it = mLru.begin();
+    while (it != mLru.end()) {
+      const Slot* slot = FindSlot(it->first);
+      if (!slot || slot->lastUsed.load(std::memory_order_relaxed) > idleBefore) {
+        ++it;
+        continue;
+      }
+      auto victim = it++;
+      mIndex.erase(victim->first);
+      if (mHibernated.size() >= kMaxHibernated)
+        mHibernated.clear();
+      mHibernated.insert(victim->first);
+      hibernated.splice(hibernated.end(), mLru, victim);
+      ++mHibernations;
+    }
+    if (!hibernated.empty()) {
+      mSize = mLru.size();
+      Publish();
+      // Idle only means no new request picked it up: a long operation may still hold the engine, so it
+      // drains and is unloaded once that operation returns, on this pass or a later one.
+      mDraining.splice(mDraining.end(), hibernated);
+    }
+  }
+  // Unloading keeps each engine's cached data in the profile storage, which the next load reads back.
+  UnloadDrained(false);
+}
+
+EngineCache::LruList EngineCache::Replace(const vector<pair<string, Entry>>& current, uint64_t& replaced,
+    uint64_t& failed, const std::function<bool()>& stop) {
+  LruList retired;
+  for (const auto& entry : current) {
+    if (stop())
+      break;
+    string engineId;
+    {
+      lock_guard<InstrumentedMutex> lock(mMutex);
+      char suffix[24];
+      snprintf(suffix, sizeof(suffix), "%c%llu", kGenerationSeparator, static_cast<unsigned long long>(mGeneration++));
+      const string& currentId = entry.second.engine->GetSettings().GetEngineId();
+      engineId = currentId.substr(0, currentId.find(kGenerationSeparator)) + suffix;
+    }
+
+    // Loading downloads the policy, so it runs without holding the lock while callers keep the current engine.
+    Entry fresh;
+    try {
+      fresh = entry.second.reload(engineId);
+      fresh.protectionOnly = entry.second.protectionOnly;
+      fresh.applicationId = entry.second.applicationId;
+    } catch (const std::exception&) {
+      lock_guard<InstrumentedMutex> lock(mMutex);
+      ++failed;
+      continue;
+    }
+
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    auto it = mIndex.find(entry.first);
+    if (it != mIndex.end() && it->second->second.engine == entry.second.engine) {
+      // Swaps the entry in place, so it keeps its position in the LRU order.
+      retired.emplace_back(entry.first, it->second->second);
+      it->second->second = fresh;
+      Publish();
+      ++replaced;
+    } else {
+      // Evicted while the replacement loaded.
+      retired.emplace_back(entry.first, fresh);
+    }
+  }
+  return retired;
+}
+
+void EngineCache::StopReload() {
+  std::thread reloadThread;
+  {
+    lock_guard<mutex> lock(mReloadMutex);
+    mStopReload = true;
+    reloadThread.swap(mReloadThread);
+    mReloadCondition.notify_all();
+  }
+  if (reloadThread.joinable())
+    reloadThread.join();
+}
+
+void EngineCache::ReloadLoop() {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  unique_lock<mutex> lock(mReloadMutex);
+  while (mReloadPending && !mStopReload) {
+    mReloadPending = false;
+    const seconds drainTimeout = mDrainTimeout;
+    lock.unlock();
+
+    bool interrupted = false;
+    // Scoped so that the copies taken here do not count as callers holding the replaced engines.
+    {
+      vector<pair<string, Entry>> current;
+      {
+        lock_guard<InstrumentedMutex> cacheLock(mMutex);
+        for (const auto& entry : mLru) {
+          if (entry.second.reload && entry.second.engine)
+            current.push_back(entry);
+        }
+      }
+      // One engine at a time, so a reload never adds more than one load to what the service is doing.
+      LruList retired = Replace(current, mReloads, mReloadFailures, [this, &interrupted]() {
+        lock_guard<mutex> reloadLock(mReloadMutex);
+        interrupted = mStopReload;
+        return interrupted;
+      });
+      lock_guard<InstrumentedMutex> cacheLock(mMutex);
+      mDraining.splice(mDraining.end(), retired);
+    }
+
+    const auto deadline = steady_clock::now() + drainTimeout;
+    lock.lock();
+    while (!mStopReload && !mReloadPending) {
+      lock.unlock();
+      UnloadDrained(false);
+      bool drained;
+      {
+        lock_guard<InstrumentedMutex> cacheLock(mMutex);
+        drained = mDraining.empty();
+      }
+      lock.lock();
+      if (drained || steady_clock::now() >= deadline)
+        break;
+      mReloadCondition.wait_for(lock, milliseconds(100), [this]() { return mStopReload || mReloadPending; });
+    }
+    if (interrupted) {
+      // Stopped, e.g. to fork: ResumeThreads reloads the engines this pass did not get to.
+      mReloadPending = true;
+    } else if (!mStopReload && !mReloadPending) {
+      lock.unlock();
+      UnloadDrained(true);
+      lock.lock();
+    }
+  }
+  mReloadRunning = false;
+}
+
+bool EngineCache::TakeBackDraining(const string& keyString, const string& engineId) {
+  auto it = std::find_if(mDraining.rbegin(), mDraining.rend(), [&keyString, &engineId](const LruList::value_type& entry) {
+    return entry.first == keyString && entry.second.engine && entry.second.engine->GetSettings().GetEngineId() == engineId;
+  });
+  if (it == mDraining.rend())
+    return false;
+  mLru.splice(mLru.begin(), mDraining, std::next(it).base());
+  mIndex[keyString] = mLru.begin();
+  return true;
+}
+
+void EngineCache::UnloadDrained(bool force) {
+  sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Engines);
+  // Retired copies of the pool would otherwise count as callers still holding the replaced engines.
+  EpochReclaimer::Shared().Reclaim();
+  LruList drained;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    auto it = mDraining.begin();
+    while (it != mDraining.end()) {
+      auto next = std::next(it);
+      // Only mDraining holds it once the last request that picked it up has returned.
+      if (force || it->second.engine.use_count() <= 1)
+        drained.splice(drained.end(), mDraining, it);
+      it = next;
+    }
+  }
+  Unload(drained);
+}
@@ -0,0 +1,312 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ENGINE_CACHE_H_
+#define SAMPLE_FILE_ENGINE_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "auth_delegate_impl.h"
+#include "classifier.h"
+#include "epoch_reclaimer.h"
+#include "instrumented_mutex.h"
+#include "label_index.h"
+#include "mip/file/file_engine.h"
+#include "mip/file/file_profile.h"
+#include "sensitivity_type_index.h"
+
+// LRU pool of loaded FileEngines. Evicted engines are unloaded from the profile that created them once
+// no caller holds them any more.
+// Engines are shared by every concurrent caller and only read after creation; callers create their
+// own FileHandlers from them. With policy refresh on, a background thread replaces engines whose policy
+// has gone stale with freshly loaded ones. Callers keep the engine they already hold, so a handler never
+// sees its engine change and no request waits for a policy download. Hits read an immutable copy of the
+// pool published under an epoch guard (see epoch_reclaimer.h), so they take no lock; every change to the
+// pool publishes a new copy.
+class EngineCache final {
+public:
+  struct Key {
+    std::string applicationId;
+    std::string username;
+    std::string protectionBaseUrl;
+    std::string policyBaseUrl;
+    bool protectionOnly;
+    // Opens .msg files and decrypts their attachments at every level (ContainerDecryptionOption::All).
+    bool msgContainers;
+
+    std::string ToString() const;
+  };
+
+  struct Entry {
+    Entry() : protectionOnly(false) {}
+
+    std::shared_ptr<mip::FileEngine> engine;
+    // Shared by every caller of the engine; it hands each challenge the calling operation's token.
+    std::shared_ptr<sample::auth::AuthDelegateImpl> authDelegate;
+    std::weak_ptr<mip::FileProfile> profile;
+    // Sensitivity labels indexed when the engine was loaded; nullptr for protection-only engines.
+    std::shared_ptr<const LabelIndex> labels;
+    // Compiled rule packages of the engine's sensitivity types; nullptr unless classification is on.
+    std::shared_ptr<const SensitivityTypeIndex> sensitivityTypes;
+    // Answers the engine's classification requests from sensitivityTypes; nullptr without them.
+    std::shared_ptr<const Classifier> classifier;
+    // Loads a replacement under the given engine id, which the profile has no cached policy for. Policy
+    // refresh skips protection-only engines, which hold no policy; Reload replaces them too.
+    std::function<Entry(const std::string& engineId)> reload;
+    // Copied from the key by the cache. Protection-only engines hold no policy and are far cheaper to
+    // load and keep, so they are budgeted separately from policy engines.
+    bool protectionOnly;
+    // Copied from the key by the cache, which budgets each tenant's engines against the tenant capacity.
+    std::string applicationId;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Policy engines in the pool and the most allowed, 0 when only the pool capacity limits them.
+    size_t policyEngines;
+    size_t policyCapacity;
+    // Most engines one application may hold, 0 when only the pool capacity limits them.
+    size_t tenantCapacity;
+    uint64_t policyRefreshes;
+    uint64_t policyRefreshFailures;
+    // Engines replaced by Reload, replacements that failed to load, and replaced, evicted or hibernated
+    // engines still held by in-flight callers.
+    uint64_t reloads;
+    uint64_t reloadFailures;
+    size_t draining;
+    // Lookups that found the pool's lock held.
+    uint64_t lockWaits;
+    // Engines unloaded for being idle, loads of an engine hibernated before, and the milliseconds those
+    // loads took (see SetIdleTimeout).
+    uint64_t hibernations;
+    uint64_t restores;
+    uint64_t restoreMs;
+    // Hibernated engines not loaded again since.
+    size_t hibernated;
+  };
+
+  // The engines one application holds.
+  struct TenantStats {
+    std::string applicationId;
+    size_t engines;
+    size_t policyEngines;
+    // Milliseconds since any of them was last used.
+    int64_t idleMs;
+  };
+
+  // Creates the engine for a miss. The engine id is stable for a given key so the profile cache can be reused.
+  typedef std::function<Entry(const std::string& engineId)> Factory;
+
+  static const size_t kDefaultCapacity = 16;
+
+  // Hibernated keys remembered for counting restores; past it they are forgotten all at once.
+  static const size_t kMaxHibernated = 4096;
+
+  explicit EngineCache(size_t capacity = kDefaultCapacity);
+  ~EngineCache();
+
+  // Concurrent misses on one key wait for a single factory call and share its engine, or its exception.
+  Entry GetOrCreate(const Key& key, const Factory& factory);
+
+  // True when key is loaded, letting callers predict whether GetOrCreate will block on a network load.
+  bool Contains(const Key& key) const;
+
+  // The loaded entry for key, read in place without taking a reference, or nullptr. Valid while the
+  // calling thread holds an EpochReclaimer::ReadGuard. Counts as a use of the engine, but not as a hit.
+  const Entry* Find(const Key& key) const;
+
+  // Shrinking the capacity evicts least recently used engines immediately; each is unloaded once its last
+  // caller has returned, on this or a later change or miss. Minimum capacity is 1.
+  void SetCapacity(size_t capacity);
+
+  // Caps the policy engines within the pool, evicting the least recently used policy engine beyond it, so
+  // label operations on many users cannot push out the protection-only engines most calls use. 0 lifts the cap.
+  void SetPolicyCapacity(size_t policyCapacity);
+
+  // Caps the engines of each application id, evicting that application's least recently used engine
+  // beyond it, so one tenant loading many users cannot push every other tenant's engines out. 0 lifts the cap.
+  void SetTenantCapacity(size_t tenantCapacity);
+
+  Stats GetStats() const;
+
+  // Applications with engines loaded, in application id order.
+  std::vector<TenantStats> GetTenants() const;
+
+  // Label indexes of the loaded policy engines, by engine id (see MakeEngineId).
+  std::vector<std::pair<std::string, std::shared_ptr<const LabelIndex>>> GetLabelIndexes() const;
+
+  // Engines loaded and the most kept, without locking. May lag a concurrent change.
+  size_t GetSize() const { return mSize.load(std::memory_order_relaxed); }
+  size_t GetCapacity() const { return mCapacity.load(std::memory_order_relaxed); }
+
+  // Replaces engines whose last policy fetch is older than ttl. Zero stops refreshing. A failed reload
+  // keeps the current engine, which is tried again on the next check.
+  void SetPolicyRefresh(std::chrono::seconds ttl);
+
+  // Unloads engines unused for idle, once no caller holds them, so memory follows the tenants that are
+  // active. A request for one that is still held takes it back without a load. Their engine ids are
+  // kept, so with on-disk storage the profile still holds their policy, certificates, templates and
+  // licenses, and the next request restores the engine from storage rather than bootstrapping it. Zero
+  // stops hibernating.
+  void SetIdleTimeout(std::chrono::seconds idle);
+  // The idle timeout engines hibernate after, or zero when they are not hibernated.
+  std::chrono::seconds GetIdleTimeout();
+
+  // Replaces every cached engine with one loaded under the current settings, one at a time on a background
+  // thread, so a configuration change never leaves callers without a loaded engine. Each replacement is
+  // swapped in place once loaded; the engine it replaces is unloaded once no caller holds it any more, or
+  // after drainTimeout. A failed load keeps the current engine. Returns the engines queued for replacement.
+  size_t Reload(std::chrono::seconds drainTimeout);
+
+  // Joins the policy refresh, hibernation and reload threads so the process can fork. ResumeThreads starts them again
+  // when they were running.
+  void PauseThreads();
+  void ResumeThreads();
+
+  // Stops policy refresh and hibernation and unloads every cached engine. Must be called before the owning profiles are released.
+  void Clear();
+
+  static std::string MakeEngineId(const Key& key);
+
+  // The key a load balancer hashes to send every request for applicationId's engine of identity, the user,
+  // or the service identity in delegated mode, to the same pod. Stable across pods and builds like engine
+  // ids; identity is compared ignoring case.
+  static std::string MakeAffinityKey(const std::string& applicationId, const std::string& identity);
+
+private:
+  typedef std::list<std::pair<std::string, Entry>> LruList;
+
+  // An engine as hits see it. lastUsed is the only field written after publishing.
+  struct Slot {
+    Entry entry;
+    // Steady clock milliseconds of the last use, carried over to the next copy of the pool.
+    mutable std::atomic<int64_t> lastUsed;
+  };
+  typedef std::unordered_map<std::string, std::unique_ptr<Slot>> Slots;
+
+  // Slot of the published pool. Called under a ReadGuard, or with the mutex held.
+  const Slot* FindSlot(const std::string& key) const;
+  // Records a use, writing the slot only when the clock has moved on since the last one.
+  static void Touch(const Slot& slot);
+  // Publishes a copy of mLru for hits and retires the previous one. Called with the mutex held.
+  void Publish();
+  // Orders mLru by the uses hits recorded since the last change, most recent first. Called with the
+  // mutex held.
+  void SyncRecency();
+  // Moves the engines beyond the capacities to mDraining. Called with the mutex held.
+  void EvictOverCapacity();
+  static void Unload(const LruList& evicted);
+  void StopPolicyRefresh();
+  void PolicyRefreshLoop();
+  void RefreshStalePolicies(std::chrono::seconds ttl);
+  void StopHibernation();
+  void HibernationLoop();
+  void HibernateIdle(std::chrono::milliseconds idle);
+  // Loads a replacement for each of current and swaps it in, returning the engines it replaced. Stops
+  // early once stop returns true.
+  LruList Replace(const std::vector<std::pair<std::string, Entry>>& current, uint64_t& replaced, uint64_t& failed,
+      const std::function<bool()>& stop);
+  void StopReload();
+  void ReloadLoop();
+  // Unloads the draining engines no caller holds any more, and all of them once force is set.
+  void UnloadDrained(bool force);
+  // Moves the engine draining under engineId back to the front of mLru, so that a load under the same id
+  // does not get unloaded once the draining one is. Called with the mutex held; false when there is none.
+  bool TakeBackDraining(const std::string& keyString, const std::string& engineId);
+
+  mutable sample::lock::InstrumentedMutex mMutex{"engine"};
+  // Written with the mutex held; atomic for GetSize and GetCapacity.
+  std::atomic<size_t> mCapacity;
+  std::atomic<size_t> mSize;
+  size_t mPolicyCapacity;
+  size_t mTenantCapacity;
+  LruList mLru;
+  std::unordered_map<std::string, LruList::iterator> mIndex;
+  // Engines being created, so a concurrent miss waits instead of loading the same engine again.
+  std::unordered_map<std::string, std::shared_future<Entry>> mCreating;
+  // Stored with the mutex held.
+  EpochPointer<Slots> mSlots;
+  std::atomic<uint64_t> mHits;
+  uint64_t mMisses;
+  uint64_t mEvictions;
+  uint64_t mPolicyRefreshes;
+  uint64_t mPolicyRefreshFailures;
+  uint64_t mReloads;
+  uint64_t mReloadFailures;
+  std::atomic<uint64_t> mLockWaits;
+  std::unordered_set<std::string> mHibernated;
+  uint64_t mHibernations;
+  uint64_t mRestores;
+  uint64_t mRestoreMs;
+  // Engines replaced by Reload or policy refresh, evicted or hibernated, kept until their last caller lets go of them.
+  LruList mDraining;
+  // Suffix of the next replacement engine's id.
+  uint64_t mGeneration;
+
+  std::mutex mRefreshMutex;
+  std::condition_variable mRefreshCondition;
+  std::chrono::seconds mRefreshTtl;
+  bool mStopRefresh;
+  bool mRefreshPaused;
+  std::thread mRefreshThread;
+
+  std::mutex mHibernateMutex;
+  std::condition_variable mHibernateCondition;
+  std::chrono::seconds mIdleTimeout;
+  bool mStopHibernate;
+  bool mHibernatePaused;
+  std::thread mHibernateThread;
+
+  std::mutex mReloadMutex;
+  std::condition_variable mReloadCondition;
+  std::chrono::seconds mDrainTimeout;
+  // Set by Reload and cleared when a pass starts, so a change during a pass gets a pass of its own.
+  bool mReloadPending;
+  bool mReloadRunning;
+  bool mStopReload;
+  std::thread mReloadThread;
+};
+
+#endif // SAMPLE_FILE_ENGINE_CACHE_H_
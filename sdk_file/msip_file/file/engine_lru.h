@@ -0,0 +1,130 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_ENGINE_LRU_H_
+#define SAMPLE_FILE_ENGINE_LRU_H_
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Engines kept outside the EngineCache, such as ContextManager's protection and policy engines, in least
+// recently used order. Like the EngineCache, an engine evicted over capacity or for being idle drains: it
+// is handed out for unloading only once no caller holds it any more, and a request for it before then takes
+// it back without a load. T has an engine member, a shared_ptr that only the cache and callers hold. Not
+// synchronized; the owner locks around every call.
+template <typename T>
+class EngineLru final {
+public:
+  typedef std::vector<std::pair<std::string, T>> Entries;
+
+  // Copies the entry for id into entry and counts it as a use, taking it back from the draining engines if
+  // it was evicted. False when id is not loaded.
+  bool Find(const std::string& id, T& entry) {
+    auto it = mIndex.find(id);
+    if (it != mIndex.end()) {
+      mLru.splice(mLru.begin(), mLru, it->second);
+    } else {
+      auto draining = mDraining.begin();
+      while (draining != mDraining.end() && std::get<0>(*draining) != id)
+        ++draining;
+      if (draining == mDraining.end())
+        return false;
+      mLru.splice(mLru.begin(), mDraining, draining);
+      mIndex[id] = mLru.begin();
+    }
+    std::get<2>(mLru.front()) = std::chrono::steady_clock::now();
+    entry = std::get<1>(mLru.front());
+    return true;
+  }
+
+  // The loaded entry for id, or nullptr, without counting a use. Valid until the next call.
+  const T* Peek(const std::string& id) const {
+    auto it = mIndex.find(id);
+    return it != mIndex.end() ? &std::get<1>(*it->second) : nullptr;
+  }
+
+  // Adds entry as the most recently used one, or returns the one a concurrent load added first.
+  T Insert(const std::string& id, const T& entry) {
+    T existing;
+    if (Find(id, existing))
+      return existing;
+    mLru.emplace_front(id, entry, std::chrono::steady_clock::now());
+    mIndex[id] = mLru.begin();
+    return entry;
+  }
+
+  // Moves the engines unused for idle, and the least recently used ones beyond capacity, to the draining
+  // engines. A zero idle keeps engines however long they are unused; capacity is at least 1.
+  void Evict(size_t capacity, std::chrono::seconds idle) {
+    const auto now = std::chrono::steady_clock::now();
+    capacity = std::max<size_t>(capacity, 1);
+    while (!mLru.empty() &&
+        (mLru.size() > capacity || (idle.count() > 0 && now - std::get<2>(mLru.back()) >= idle))) {
+      mIndex.erase(std::get<0>(mLru.back()));
+      mDraining.splice(mDraining.end(), mLru, std::prev(mLru.end()));
+    }
+  }
+
+  // Removes and returns the draining engines no caller holds any more, or all of them when force.
+  Entries TakeDrained(bool force) {
+    Entries drained;
+    auto it = mDraining.begin();
+    while (it != mDraining.end()) {
+      if (force || std::get<1>(*it).engine.use_count() <= 1) {
+        drained.emplace_back(std::get<0>(*it), std::get<1>(*it));
+        it = mDraining.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return drained;
+  }
+
+  // Removes and returns every engine, loaded or draining.
+  Entries TakeAll() {
+    mIndex.clear();
+    mDraining.splice(mDraining.end(), mLru);
+    return TakeDrained(true);
+  }
+
+  size_t GetSize() const { return mLru.size(); }
+
+private:
+  typedef std::list<std::tuple<std::string, T, std::chrono::steady_clock::time_point>> LruList;
+
+  LruList mLru;
+  std::unordered_map<std::string, typename LruList::iterator> mIndex;
+  LruList mDraining;
+};
+
+#endif // SAMPLE_FILE_ENGINE_LRU_H_
@@ -0,0 +1,154 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "engine_manifest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+#include "json_reader.h"
+#include "json_writer.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::string;
+using std::vector;
+
+EngineManifest::EngineManifest(const string& path) : mPath(path), mLoaded(false) {
+}
+
+void EngineManifest::Record(const string& engineId, const EngineCache::Key& key) {
+  lock_guard<mutex> lock(mMutex);
+  EnsureLoaded();
+  for (const auto& entry : mEntries) {
+    if (entry.first == engineId)
+      return;
+  }
+  mEntries.emplace_back(engineId, key);
+  Save();
+}
+
+vector<pair<string, EngineCache::Key>> EngineManifest::Load() {
+  lock_guard<mutex> lock(mMutex);
+  EnsureLoaded();
+  return mEntries;
+}
+
+void EngineManifest::Remove(const vector<string>& engineIds) {
+  lock_guard<mutex> lock(mMutex);
+  EnsureLoaded();
+  const auto size = mEntries.size();
+  mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(), [&engineIds](const pair<string, EngineCache::Key>& entry) {
+    return std::find(engineIds.begin(), engineIds.end(), entry.first) != engineIds.end();
+  }), mEntries.end());
+  if (mEntries.size() != size)
+    Save();
+}
+
+void EngineManifest::EnsureLoaded() {
+  if (mLoaded)
+    return;
+  mLoaded = true;
+  std::ifstream file(mPath, std::ios::binary);
+  if (!file)
+    return;
+  const string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  try {
+    const JsonValue document = JsonValue::Parse(content);
+    const JsonValue* engines = nullptr;
+    for (const auto& member : document.AsObject()) {
+      if (member.first == "engines")
+        engines = &member.second;
+    }
+    if (!engines)
+      return;
+    for (const auto& item : engines->AsArray()) {
+      string engineId;
+      EngineCache::Key key = { "", "", "", "", false, false };
+      for (const auto& member : item.AsObject()) {
+        if (member.first == "engine_id")
+          engineId = member.second.AsString();
+        else if (member.first == "application_id")
+          key.applicationId = member.second.AsString();
+        else if (member.first == "username")
+          key.username = member.second.AsString();
+        else if (member.first == "protection_base_url")
+          key.protectionBaseUrl = member.second.AsString();
+        else if (member.first == "policy_base_url")
+          key.policyBaseUrl = member.second.AsString();
+        else if (member.first == "protection_only")
+          key.protectionOnly = member.second.AsBool();
+        else if (member.first == "msg_containers")
+          key.msgContainers = member.second.AsBool();
+      }
+      // An entry whose key no longer hashes to its id was written by another build, and would load a
+      // different engine than the one on disk.
+      if (!engineId.empty() && !key.applicationId.empty() && EngineCache::MakeEngineId(key) == engineId)
+        mEntries.emplace_back(engineId, key);
+    }
+  } catch (const std::exception&) {
+    // A damaged manifest is rebuilt as engines are loaded again.
+    mEntries.clear();
+  }
+}
+
+void EngineManifest::Save() {
+  JsonWriter writer;
+  writer.BeginObject().Key("engines").BeginArray();
+  for (const auto& entry : mEntries) {
+    const auto& key = entry.second;
+    writer.BeginObject()
+        .Key("engine_id").String(entry.first)
+        .Key("application_id").String(key.applicationId)
+        .Key("username").String(key.username)
+        .Key("protection_base_url").String(key.protectionBaseUrl)
+        .Key("policy_base_url").String(key.policyBaseUrl)
+        .Key("protection_only").Bool(key.protectionOnly)
+        .Key("msg_containers").Bool(key.msgContainers)
+        .EndObject();
+  }
+  writer.EndArray().EndObject();
+
+  // Written aside and renamed over the manifest, so a crash never leaves a truncated one.
+  static std::atomic<unsigned> sequence(0);
+  const string temporary = mPath + ".tmp." + std::to_string(getpid()) + "." + std::to_string(sequence++);
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file << writer.Str();
+    if (!file.flush()) {
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), mPath.c_str()) != 0)
+    std::remove(temporary.c_str());
+}
@@ -0,0 +1,67 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_ENGINE_MANIFEST_H_
+#define SAMPLE_FILE_ENGINE_MANIFEST_H_
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "engine_cache.h"
+
+// Keys of the engines loaded with on-disk storage, by engine id, kept in a JSON file next to the profile
+// storage. Engine ids are hashes of their key, so the key cannot be recovered from the ids a profile lists
+// after a restart; the manifest maps them back, letting msipRestoreEngines reload each engine from the
+// certificates and policy the SDK cached for it. Calls are serialized.
+class EngineManifest final {
+public:
+  explicit EngineManifest(const std::string& path);
+
+  // Adds key under engineId and rewrites the file when it was not recorded yet. Write errors are ignored,
+  // since a missing entry only costs a cold load.
+  void Record(const std::string& engineId, const EngineCache::Key& key);
+
+  // Recorded entries in the order they were first recorded. Empty when the file is missing or unreadable.
+  std::vector<std::pair<std::string, EngineCache::Key>> Load();
+
+  // Drops the entries of engines the profile no longer holds and rewrites the file when any was dropped.
+  void Remove(const std::vector<std::string>& engineIds);
+
+private:
+  // Called with the mutex held.
+  void EnsureLoaded();
+  void Save();
+
+  std::mutex mMutex;
+  const std::string mPath;
+  bool mLoaded;
+  std::vector<std::pair<std::string, EngineCache::Key>> mEntries;
+};
+
+#endif  // SAMPLE_FILE_ENGINE_MANIFEST_H_
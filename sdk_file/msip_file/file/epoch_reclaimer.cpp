@@ -0,0 +1,167 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "epoch_reclaimer.h"
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+
+using std::lock_guard;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+using std::mutex;
+
+namespace {
+
+thread_local void* tReader = nullptr;
+
+// Releases the thread's reader record when the thread exits, for a later thread to claim. The thread
+// forgets the record first, so a guard taken after this ran claims a record of its own.
+struct ReaderRelease {
+  std::atomic<bool>* inUse = nullptr;
+
+  ~ReaderRelease() {
+    if (inUse) {
+      tReader = nullptr;
+      inUse->store(false, memory_order_release);
+    }
+  }
+};
+
+} // namespace
+
+const size_t EpochReclaimer::kReclaimBatch;
+const size_t EpochReclaimer::kCacheLine;
+
+EpochReclaimer::ReadGuard::ReadGuard() {
+  Reader& reader = Shared().GetReader();
+  if (reader.depth++ == 0)
+    Shared().Pin(reader);
+}
+
+EpochReclaimer::ReadGuard::~ReadGuard() {
+  Reader& reader = Shared().GetReader();
+  if (--reader.depth == 0)
+    Unpin(reader);
+}
+
+EpochReclaimer& EpochReclaimer::Shared() {
+  // Intentionally leaked: caches retire entries until process exit.
+  static EpochReclaimer* reclaimer = new EpochReclaimer();
+  return *reclaimer;
+}
+
+EpochReclaimer::EpochReclaimer() : mEpoch(1), mReaders(nullptr), mSinceReclaim(0) {
+}
+
+EpochReclaimer::Reader& EpochReclaimer::GetReader() {
+  if (tReader)
+    return *static_cast<Reader*>(tReader);
+  Reader* reader = nullptr;
+  for (Reader* known = mReaders.load(memory_order_acquire); known; known = known->next) {
+    bool free = false;
+    if (known->inUse.compare_exchange_strong(free, true, memory_order_acquire)) {
+      reader = known;
+      break;
+    }
+  }
+  if (!reader) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, kCacheLine, sizeof(Reader)) != 0)
+      throw std::bad_alloc();
+    reader = new (memory) Reader();
+    reader->epoch.store(0, memory_order_relaxed);
+    reader->inUse.store(true, memory_order_relaxed);
+    reader->next = mReaders.load(memory_order_relaxed);
+    while (!mReaders.compare_exchange_weak(reader->next, reader, memory_order_release, memory_order_relaxed)) {
+    }
+  }
+  reader->depth = 0;
+  tReader = reader;
+  // A guard taken by another thread_local's destructor after this one ran claims a record it never
+  // releases, which only keeps that record out of reuse.
+  thread_local ReaderRelease release;
+  release.inUse = &reader->inUse;
+  return *reader;
+}
+
+void EpochReclaimer::Pin(Reader& reader) {
+  reader.epoch.store(mEpoch.load(memory_order_seq_cst), memory_order_seq_cst);
+  // Orders the pin before the loads the guard protects, against the fence in GetOldestPinned.
+  std::atomic_thread_fence(memory_order_seq_cst);
+}
+
+void EpochReclaimer::Unpin(Reader& reader) {
+  reader.epoch.store(0, memory_order_release);
+}
+
+uint64_t EpochReclaimer::GetOldestPinned() const {
+  std::atomic_thread_fence(memory_order_seq_cst);
+  uint64_t oldest = mEpoch.load(memory_order_seq_cst);
+  for (Reader* reader = mReaders.load(memory_order_acquire); reader; reader = reader->next) {
+    const uint64_t pinned = reader->epoch.load(memory_order_acquire);
+    if (pinned != 0)
+      oldest = std::min(oldest, pinned);
+  }
+  return oldest;
+}
+
+void EpochReclaimer::Retire(void* object, void (*deleter)(void*)) {
+  bool reclaim;
+  {
+    lock_guard<mutex> lock(mRetiredMutex);
+    // Readers pinning this epoch or an older one may hold object. Later ones start after it was unlinked.
+    mRetired.push_back(Retired{object, deleter, mEpoch.fetch_add(1, memory_order_seq_cst)});
+    reclaim = ++mSinceReclaim >= kReclaimBatch;
+  }
+  if (reclaim)
+    Reclaim();
+}
+
+void EpochReclaimer::Reclaim() {
+  std::vector<Retired> freed;
+  {
+    lock_guard<mutex> lock(mRetiredMutex);
+    mSinceReclaim = 0;
+    const uint64_t oldest = GetOldestPinned();
+    auto reachable = std::find_if(mRetired.begin(), mRetired.end(), [oldest](const Retired& retired) {
+      return retired.epoch >= oldest;
+    });
+    freed.assign(mRetired.begin(), reachable);
+    mRetired.erase(mRetired.begin(), reachable);
+  }
+  // Outside the lock: a deleter may release the last reference to something that retires more.
+  for (const auto& retired : freed)
+    retired.deleter(retired.object);
+}
+
+size_t EpochReclaimer::GetPending() const {
+  lock_guard<mutex> lock(mRetiredMutex);
+  return mRetired.size();
+}
@@ -0,0 +1,139 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_EPOCH_RECLAIMER_H_
+#define SAMPLE_FILE_EPOCH_RECLAIMER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation for structures read without locks. A reader holds a ReadGuard while it follows
+// pointers it loaded from the structure; a writer that unlinks an object hands it to Retire instead of
+// deleting it, and the object is freed once every guard that could have seen it is gone. Guards are two
+// atomic stores on a record of the calling thread's own and never wait; Retire never waits for readers
+// either, it only frees what no guard can reach, every kReclaimBatch retirements or on Reclaim.
+class EpochReclaimer final {
+public:
+  static const size_t kReclaimBatch = 32;
+
+  // Pins the current epoch for the calling thread. Guards nest; only the outermost one pins.
+  class ReadGuard final {
+  public:
+    ReadGuard();
+    ~ReadGuard();
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+  };
+
+  static EpochReclaimer& Shared();
+
+  // Frees object once no guard taken before this call remains. object must already be unreachable for
+  // readers that start after the call.
+  template <typename T>
+  void Retire(T* object) {
+    Retire(object, [](void* retired) { delete static_cast<T*>(retired); });
+  }
+
+  void Retire(void* object, void (*deleter)(void*));
+
+  // Frees every retired object no guard can still reach.
+  void Reclaim();
+
+  // Objects retired and not yet freed.
+  size_t GetPending() const;
+
+private:
+  static const size_t kCacheLine = 64;
+
+  // Written by its own thread only, on a cache line of its own so that pinning never touches a line
+  // another thread writes. Allocated with kCacheLine alignment, which new does not promise before C++17.
+  struct alignas(kCacheLine) Reader {
+    // The epoch pinned, 0 while the thread holds no guard.
+    std::atomic<uint64_t> epoch;
+    unsigned depth;
+    char padding[kCacheLine - sizeof(std::atomic<uint64_t>) - sizeof(unsigned)];
+    std::atomic<bool> inUse;
+    Reader* next;
+  };
+
+  struct Retired {
+    void* object;
+    void (*deleter)(void*);
+    uint64_t epoch;
+  };
+
+  EpochReclaimer();
+
+  // The calling thread's record, claimed from the list or added to it on first use and released when
+  // the thread exits. Records are never freed.
+  Reader& GetReader();
+  void Pin(Reader& reader);
+  static void Unpin(Reader& reader);
+  // The oldest epoch a guard still pins, or the current epoch when there are none.
+  uint64_t GetOldestPinned() const;
+
+  std::atomic<uint64_t> mEpoch;
+  std::atomic<Reader*> mReaders;
+  mutable std::mutex mRetiredMutex;
+  // In retirement order, so in epoch order.
+  std::vector<Retired> mRetired;
+  size_t mSinceReclaim;
+};
+
+// A pointer to an immutable T that writers replace as a whole, for state read on every request and
+// swapped rarely, like a refreshed policy or a reloaded engine. Readers Load it under a ReadGuard and
+// use the object in place, without taking a lock or a reference; Store retires the object it replaces.
+// Writers serialize among themselves.
+template <typename T>
+class EpochPointer final {
+public:
+  EpochPointer() : mPointer(nullptr) {}
+
+  // The current object is no longer reachable once its owner is gone, so it is freed at once.
+  ~EpochPointer() { delete mPointer.load(std::memory_order_relaxed); }
+
+  EpochPointer(const EpochPointer&) = delete;
+  EpochPointer& operator=(const EpochPointer&) = delete;
+
+  // Valid while the calling thread holds a ReadGuard, or for the writer between its own Stores.
+  const T* Load() const { return mPointer.load(std::memory_order_acquire); }
+
+  // Publishes replacement, which may be nullptr, and retires the object it replaces.
+  void Store(T* replacement) {
+    T* previous = mPointer.exchange(replacement, std::memory_order_acq_rel);
+    if (previous)
+      EpochReclaimer::Shared().Retire(previous);
+  }
+
+private:
+  std::atomic<T*> mPointer;
+};
+
+#endif // SAMPLE_FILE_EPOCH_RECLAIMER_H_
@@ -0,0 +1,122 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "fd_output_stream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+string ErrnoMessage(const string& what) {
+  return what + ": " + strerror(errno);
+}
+
+MetricsRegistry::Counter& OutputBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_output_bytes_total", "Bytes the SDK wrote to caller descriptors and buffers");
+  return counter;
+}
+
+} // namespace
+
+// Output starts at the descriptor's current offset, so callers can reserve a header before handing it over.
+FdOutputStream::FdOutputStream(int fd)
+    : mFd(fd),
+      mSeekable(lseek(fd, 0, SEEK_CUR) >= 0),
+      mOrigin(mSeekable ? static_cast<int64_t>(lseek(fd, 0, SEEK_CUR)) : 0),
+      mPosition(0),
+      mSize(0) {
+  if (fd < 0)
+    throw runtime_error("Invalid output file descriptor");
+}
+
+int64_t FdOutputStream::Read(uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is write-only");
+}
+
+int64_t FdOutputStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  int64_t written = 0;
+  while (written < bufferLength) {
+    const size_t remaining = static_cast<size_t>(bufferLength - written);
+    const ssize_t count = mSeekable
+        ? pwrite(mFd, buffer + written, remaining, static_cast<off_t>(mOrigin + mPosition))
+        : write(mFd, buffer + written, remaining);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw runtime_error(ErrnoMessage("Failed to write output"));
+    written += count;
+    mPosition += count;
+  }
+  if (mPosition > mSize)
+    mSize = mPosition;
+  OutputBytes().Add(static_cast<uint64_t>(written));
+  return written;
+}
+
+bool FdOutputStream::Flush() {
+  // Data already lives in the kernel; durability is the caller's decision.
+  return true;
+}
+
+void FdOutputStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (!mSeekable && position != mPosition)
+    throw runtime_error("Output descriptor does not support seeking");
+  mPosition = position;
+}
+
+bool FdOutputStream::CanRead() const { return false; }
+
+bool FdOutputStream::CanWrite() const { return true; }
+
+int64_t FdOutputStream::Position() { return mPosition; }
+
+int64_t FdOutputStream::Size() { return mSize; }
+
+void FdOutputStream::Size(int64_t value) {
+  if (value == mSize)
+    return;
+  if (!mSeekable || value < 0)
+    throw runtime_error("Output descriptor cannot be resized");
+  if (ftruncate(mFd, static_cast<off_t>(mOrigin + value)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to resize output"));
+  mSize = value;
+  if (mPosition > mSize)
+    mPosition = mSize;
+}
@@ -31,18 +31,33 @@
 #include "mip/file/file_execution_state.h"
 
 #include <iostream>
+#include <mutex>
 
+#include "classifier.h"
+#include "mapped_file_stream.h"
+#include "text_extractor.h"
+
+// With a classifier, GetClassificationResults extracts the text of the file at contentPath and lets the
+// classifier answer; otherwise it returns the simulated results.
 class FileExecutionStateImpl final : public mip::FileExecutionState {
 public:
+  // Text beyond this is not classified, which bounds the memory a huge file can take.
+  static const size_t kMaxClassifiedText = 32 * 1024 * 1024;
+
   FileExecutionStateImpl(
       mip::DataState dataState, 
       std::shared_ptr<mip::ClassificationResults> simulatedClassificationResults = nullptr,
       bool displayClassificationSITs = false,
-      std::string applicationScenarioId = std::string())
+      std::string applicationScenarioId = std::string(),
+      std::shared_ptr<const Classifier> classifier = nullptr,
+      std::string contentPath = std::string())
     : mDataState(dataState),
-      mClassificationResults(simulatedClassificationResults),
       mDisplayClassificationSITs(displayClassificationSITs),
-      mApplicationScenarioId(applicationScenarioId) {}
+      mApplicationScenarioId(applicationScenarioId),
+      mClassifier(classifier),
+      mContentPath(contentPath),
+      mClassificationResults(simulatedClassificationResults),
+      mClassified(false) {}
 
   mip::DataState GetDataState() const override { return mDataState; }
 
@@ -57,17 +72,38 @@ public:
         std::cout << "\t" << (*it)->GetClassificationId() << " " << (*it)->GetRulePackageId() << std::endl;
       }
     }
-    return mClassificationResults;
-  }
+    if (!mClassifier || mContentPath.empty())
+      return mClassificationResults;
 
+    std::vector<std::string> ids;
+    ids.reserve(classificationIds.size());
+    for (const auto& request : classificationIds)
+      ids.push_back(request->GetClassificationId());
+    MappedFileStream content(mContentPath);
+    auto results = mClassifier->Classify(ExtractText(content, kMaxClassifiedText), ids);
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClassificationResults = results;
+    mClassified = true;
+    return results;
+  }
 
+  // Whether the SDK asked the classifier, and what it answered. The SDK only asks when the policy has
+  // auto-labeling or recommendation rules.
+  bool WasClassified(std::shared_ptr<mip::ClassificationResults>& results) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    results = mClassificationResults;
+    return mClassified;
+  }
 
 private:
   mip::DataState mDataState;
-  std::shared_ptr<mip::ClassificationResults> mClassificationResults;
-  
   bool mDisplayClassificationSITs;
   std::string mApplicationScenarioId;
+  std::shared_ptr<const Classifier> mClassifier;
+  std::string mContentPath;
+  mutable std::mutex mMutex;
+  mutable std::shared_ptr<mip::ClassificationResults> mClassificationResults;
+  mutable bool mClassified;
 };
 
 #endif //SAMPLE_FILE_EXECUTION_STATE_IMPL_H
\ No newline at end of file
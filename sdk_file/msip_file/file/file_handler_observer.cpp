@@ -27,72 +27,80 @@
 
 #include "file_handler_observer.h"
 
+#include "async_completion.h"
+
 using std::exception_ptr;
-using std::promise;
 using std::shared_ptr;
 using std::string;
 using std::vector;
 using mip::ContentLabel;
 using mip::FileHandler;
 using mip::FileInspector;
+using mip::Stream;
+
+const shared_ptr<FileHandlerObserver>& FileHandlerObserver::Shared() {
+  // Never destroyed: handlers released during static teardown still hold it.
+  static auto* observer = new shared_ptr<FileHandlerObserver>(std::make_shared<FileHandlerObserver>());
+  return *observer;
+}
 
 void FileHandlerObserver::OnCreateFileHandlerSuccess(
     const shared_ptr<FileHandler>& fileHandler, 
     const shared_ptr<void>& context) {
-  auto fileHandlerPromise = static_cast<promise<shared_ptr<FileHandler>>*>(context.get());
-  fileHandlerPromise->set_value(fileHandler);
+  AsyncCompletion<shared_ptr<FileHandler>>::FromContext(context).Succeed(fileHandler);
 }
 
 void FileHandlerObserver::OnCreateFileHandlerFailure(
     const exception_ptr& error, 
     const shared_ptr<void>& context) {
-  auto fileHandlerPromise = static_cast<promise<shared_ptr<FileHandler>>*>(context.get());
-  fileHandlerPromise->set_exception(error);
+  AsyncCompletion<shared_ptr<FileHandler>>::FromContext(context).Failed(error);
 }
 
 void FileHandlerObserver::OnCommitSuccess(bool committed, const shared_ptr<void>& context) {
-  auto onCommitPromise = static_cast<promise<bool>*>(context.get());
-  onCommitPromise->set_value(committed);
+  AsyncCompletion<bool>::FromContext(context).Succeed(committed);
 }
 
 void FileHandlerObserver::OnCommitFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto onCommitPromise = static_cast<promise<bool>*>(context.get());
-  onCommitPromise->set_exception(error);
+  AsyncCompletion<bool>::FromContext(context).Failed(error);
 }
 
 void FileHandlerObserver::OnClassifySuccess(
     const vector<shared_ptr<mip::Action>>& actions, const std::shared_ptr<void>& context) {
-  auto onClassifyPromise = static_cast<promise<vector<shared_ptr<mip::Action>>>*>(context.get());
-  onClassifyPromise->set_value(actions);
+  AsyncCompletion<vector<shared_ptr<mip::Action>>>::FromContext(context).Succeed(actions);
 }
 
 void FileHandlerObserver::OnClassifyFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto onClassify = static_cast<promise<vector<shared_ptr<mip::Action>>>*>(context.get());
-  onClassify->set_exception(error);
+  AsyncCompletion<vector<shared_ptr<mip::Action>>>::FromContext(context).Failed(error);
 }
 
 void FileHandlerObserver::OnInspectSuccess(
     const std::shared_ptr<FileInspector>& fileInspector,
     const std::shared_ptr<void>& context) {
-  auto onInspect = static_cast<promise<shared_ptr<FileInspector>>*>(context.get());
-  onInspect->set_value(fileInspector);
+  AsyncCompletion<shared_ptr<FileInspector>>::FromContext(context).Succeed(fileInspector);
 }
 
 void FileHandlerObserver::OnInspectFailure(
     const std::exception_ptr& error,
     const std::shared_ptr<void>& context) {
-  auto onInspect = static_cast<promise<shared_ptr<FileInspector>>*>(context.get());
-  onInspect->set_exception(error);
+  AsyncCompletion<shared_ptr<FileInspector>>::FromContext(context).Failed(error);
 }
 
 void FileHandlerObserver::OnGetDecryptedTemporaryFileSuccess(
     const string& decryptedFilePath, const std::shared_ptr<void>& context) {
-  auto onGetDecrypted = static_cast<promise<string>*>(context.get());
-  onGetDecrypted->set_value(decryptedFilePath);
+  AsyncCompletion<string>::FromContext(context).Succeed(decryptedFilePath);
 }
 
 void FileHandlerObserver::OnGetDecryptedTemporaryFileFailure(
     const std::exception_ptr& error, const std::shared_ptr<void>& context) {
-  auto onGetDecrypted = static_cast<std::promise<string>*>(context.get());
-  onGetDecrypted->set_exception(error);
+  AsyncCompletion<string>::FromContext(context).Failed(error);
+}
+
+void FileHandlerObserver::OnGetDecryptedTemporaryStreamSuccess(
+    const shared_ptr<Stream>& decryptedStream, const std::shared_ptr<void>& context) {
+  AsyncCompletion<shared_ptr<Stream>>::FromContext(context).Succeed(decryptedStream);
+}
+
+void FileHandlerObserver::OnGetDecryptedTemporaryStreamFailure(
+    const std::exception_ptr& error, const std::shared_ptr<void>& context) {
+  AsyncCompletion<shared_ptr<Stream>>::FromContext(context).Failed(error);
 }
@@ -30,8 +30,11 @@
 
 #include "mip/file/file_handler.h"
 
+// Completes the AsyncCompletion each call carries as its context, so one observer serves every handler.
 class FileHandlerObserver final : public mip::FileHandler::Observer {
 public:
+  static const std::shared_ptr<FileHandlerObserver>& Shared();
+
   void OnCreateFileHandlerSuccess(
       const std::shared_ptr<mip::FileHandler>& fileHandler,
       const std::shared_ptr<void>& context) override;
@@ -71,6 +74,14 @@ public:
   void OnGetDecryptedTemporaryFileFailure(
     const std::exception_ptr& error, 
     const std::shared_ptr<void>& context) override;
+
+  void OnGetDecryptedTemporaryStreamSuccess(
+    const std::shared_ptr<mip::Stream>& decryptedStream,
+    const std::shared_ptr<void>& context) override;
+
+  void OnGetDecryptedTemporaryStreamFailure(
+    const std::exception_ptr& error,
+    const std::shared_ptr<void>& context) override;
 };
 
 #endif //SAMPLE_FILE_HANDLER_OBSERVER_H_
\ No newline at end of file
@@ -0,0 +1,59 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "file_identity.h"
+
+#include <sys/stat.h>
+
+#include <cstring>
+
+using std::string;
+
+string FileIdentity::ToKey() const {
+  string key(sizeof(device) + sizeof(inode) + sizeof(size) + sizeof(mtimeNs), '\0');
+  char* out = &key[0];
+  memcpy(out, &device, sizeof(device));
+  memcpy(out + sizeof(device), &inode, sizeof(inode));
+  memcpy(out + sizeof(device) + sizeof(inode), &size, sizeof(size));
+  memcpy(out + sizeof(device) + sizeof(inode) + sizeof(size), &mtimeNs, sizeof(mtimeNs));
+  return key;
+}
+
+bool GetFileIdentity(const string& filePath, FileIdentity& identity) {
+  struct stat fileInfo;
+  if (stat(filePath.c_str(), &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode))
+    return false;
+
+  identity.device = static_cast<uint64_t>(fileInfo.st_dev);
+  identity.inode = static_cast<uint64_t>(fileInfo.st_ino);
+  identity.size = static_cast<int64_t>(fileInfo.st_size);
+#if defined(__APPLE__)
+  identity.mtimeNs = static_cast<int64_t>(fileInfo.st_mtimespec.tv_sec) * 1000000000LL + fileInfo.st_mtimespec.tv_nsec;
+#else
+  identity.mtimeNs = static_cast<int64_t>(fileInfo.st_mtim.tv_sec) * 1000000000LL + fileInfo.st_mtim.tv_nsec;
+#endif
+  return true;
+}
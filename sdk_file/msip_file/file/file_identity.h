@@ -0,0 +1,55 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_FILE_IDENTITY_H_
+#define SAMPLE_FILE_FILE_IDENTITY_H_
+
+#include <cstdint>
+#include <string>
+
+// What stat() says about a regular file. Two identities compare equal only when the file has not been
+// replaced or rewritten in between, within the filesystem's mtime resolution.
+struct FileIdentity {
+  uint64_t device;
+  uint64_t inode;
+  int64_t size;
+  int64_t mtimeNs;
+
+  bool operator==(const FileIdentity& other) const {
+    return device == other.device && inode == other.inode && size == other.size && mtimeNs == other.mtimeNs;
+  }
+  bool operator!=(const FileIdentity& other) const { return !(*this == other); }
+
+  bool IsSameFile(const FileIdentity& other) const { return device == other.device && inode == other.inode; }
+
+  // Fixed-size binary key, usable in hash maps.
+  std::string ToKey() const;
+};
+
+// False when filePath cannot be stat()ed or is not a regular file.
+bool GetFileIdentity(const std::string& filePath, FileIdentity& identity);
+
+#endif // SAMPLE_FILE_FILE_IDENTITY_H_
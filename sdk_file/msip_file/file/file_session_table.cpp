@@ -0,0 +1,218 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "file_session_table.h"
+
+#include <stdexcept>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::unordered_map;
+using std::vector;
+using mip::FileHandler;
+
+namespace {
+// Sessions hold a parsed file and its license, so idle ones are given back after a minute by default.
+const milliseconds kDefaultIdleTimeout(60 * 1000);
+} // namespace
+
+FileSessionTable::FileSessionTable()
+    : mNextHandle(1),
+      mIdleTimeout(kDefaultIdleTimeout),
+      mOpened(0),
+      mExpired(0),
+      mStopping(false) {
+}
+
+FileSessionTable::~FileSessionTable() {
+  Clear();
+}
+
+FileSessionTable::Handle FileSessionTable::Open(
+    const shared_ptr<FileHandler>& handler,
+    const string& filePath,
+    const shared_ptr<void>& owner) {
+  if (!handler)
+    throw std::invalid_argument("File handler must not be null");
+  auto entry = make_shared<Entry>();
+  entry->session.handler = handler;
+  entry->session.filePath = filePath;
+  entry->owner = owner;
+
+  lock_guard<mutex> lock(mMutex);
+  entry->lastUsed = steady_clock::now();
+  const auto handle = mNextHandle++;
+  mEntries.emplace(handle, entry);
+  ++mOpened;
+  // The reaper is started with the first session, so processes that never open one have no extra thread.
+  if (!mReaper.joinable()) {
+    mStopping = false;
+    mReaper = std::thread(&FileSessionTable::ReapLoop, this);
+  } else {
+    mReapCondition.notify_one();
+  }
+  return handle;
+}
+
+void FileSessionTable::With(Handle handle, const std::function<void(const Session& session)>& action) {
+  shared_ptr<Entry> entry;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mEntries.find(handle);
+    if (it == mEntries.end())
+      throw std::invalid_argument("File session is not open");
+    entry = it->second;
+    ++entry->inUse;
+  }
+  struct Done {
+    FileSessionTable& table;
+    const shared_ptr<Entry>& entry;
+    ~Done() {
+      lock_guard<mutex> lock(table.mMutex);
+      --entry->inUse;
+      entry->lastUsed = steady_clock::now();
+    }
+  } done = { *this, entry };
+
+  // The action runs outside the table lock, so a slow call never holds up other sessions.
+  lock_guard<mutex> lock(entry->mutex);
+  if (!entry->session.handler)
+    throw std::invalid_argument("File session is not open");
+  action(entry->session);
+}
+
+bool FileSessionTable::Close(Handle handle) {
+  shared_ptr<Entry> entry;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mEntries.find(handle);
+    if (it == mEntries.end())
+      return false;
+    entry = it->second;
+    mEntries.erase(it);
+  }
+  Release(entry);
+  return true;
+}
+
+void FileSessionTable::SetIdleTimeout(milliseconds idleTimeout) {
+  lock_guard<mutex> lock(mMutex);
+  mIdleTimeout = idleTimeout.count() > 0 ? idleTimeout : kDefaultIdleTimeout;
+  mReapCondition.notify_one();
+}
+
+milliseconds FileSessionTable::GetIdleTimeout() const {
+  lock_guard<mutex> lock(mMutex);
+  return mIdleTimeout;
+}
+
+FileSessionTable::Stats FileSessionTable::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  Stats stats;
+  stats.open = mEntries.size();
+  stats.opened = mOpened;
+  stats.expired = mExpired;
+  return stats;
+}
+
+void FileSessionTable::Clear() {
+  unordered_map<Handle, shared_ptr<Entry>> entries;
+  std::thread reaper;
+  {
+    lock_guard<mutex> lock(mMutex);
+    entries.swap(mEntries);
+    mStopping = true;
+    reaper.swap(mReaper);
+    mReapCondition.notify_one();
+  }
+  if (reaper.joinable())
+    reaper.join();
+  for (auto& entry : entries)
+    Release(entry.second);
+}
+
+void FileSessionTable::PauseThreads() {
+  std::thread reaper;
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+    reaper.swap(mReaper);
+    mReapCondition.notify_one();
+  }
+  if (reaper.joinable())
+    reaper.join();
+}
+
+void FileSessionTable::ResumeThreads() {
+  lock_guard<mutex> lock(mMutex);
+  if (mEntries.empty() || mReaper.joinable())
+    return;
+  mStopping = false;
+  mReaper = std::thread(&FileSessionTable::ReapLoop, this);
+}
+
+void FileSessionTable::Release(const shared_ptr<Entry>& entry) {
+  // Waits for a call in flight, then releases the handler and its owner outside the table lock.
+  lock_guard<mutex> lock(entry->mutex);
+  entry->session.handler.reset();
+  entry->owner.reset();
+}
+
+void FileSessionTable::ReapLoop() {
+  unique_lock<mutex> lock(mMutex);
+  while (!mStopping) {
+    const auto now = steady_clock::now();
+    auto nextDeadline = now + mIdleTimeout;
+    vector<shared_ptr<Entry>> expired;
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+      const auto deadline = it->second->lastUsed + mIdleTimeout;
+      if (it->second->inUse == 0 && deadline <= now) {
+        expired.push_back(it->second);
+        it = mEntries.erase(it);
+        continue;
+      }
+      if (deadline > now && deadline < nextDeadline)
+        nextDeadline = deadline;
+      ++it;
+    }
+    mExpired += expired.size();
+    if (!expired.empty()) {
+      lock.unlock();
+      for (const auto& entry : expired)
+        Release(entry);
+      expired.clear();
+      lock.lock();
+      continue;
+    }
+    mReapCondition.wait_until(lock, nextDeadline);
+  }
+}
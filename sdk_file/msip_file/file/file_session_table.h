@@ -0,0 +1,111 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_FILE_SESSION_TABLE_H_
+#define SAMPLE_FILE_FILE_SESSION_TABLE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "mip/file/file_handler.h"
+
+// Open FileHandlers handed to callers of the C ABI as opaque handles, so a file parsed once can be
+// inspected, checked for rights and then unprotected without being opened again. Sessions left idle for
+// longer than the idle timeout are closed by a background thread. Calls on one session are serialized;
+// sessions are independent.
+class FileSessionTable final {
+public:
+  // Zero is never issued, so callers can use it as "no session".
+  typedef uint64_t Handle;
+
+  struct Session {
+    std::shared_ptr<mip::FileHandler> handler;
+    std::string filePath;
+  };
+
+  struct Stats {
+    size_t open = 0;
+    uint64_t opened = 0;
+    uint64_t expired = 0;
+  };
+
+  FileSessionTable();
+  ~FileSessionTable();
+
+  // owner, e.g. the engine the handler belongs to, is kept alive with the session.
+  Handle Open(const std::shared_ptr<mip::FileHandler>& handler, const std::string& filePath, const std::shared_ptr<void>& owner);
+
+  // Runs action on the session and restarts its idle timer. A session in use never expires.
+  // Throws std::invalid_argument for a handle that is not open.
+  void With(Handle handle, const std::function<void(const Session& session)>& action);
+
+  // Returns false when the handle was not open. Waits for a call in flight on the session.
+  bool Close(Handle handle);
+
+  void SetIdleTimeout(std::chrono::milliseconds idleTimeout);
+  std::chrono::milliseconds GetIdleTimeout() const;
+
+  Stats GetStats() const;
+
+  // Closes every session. Called before the engines their handlers belong to are unloaded.
+  void Clear();
+
+  // Joins the reaper so the process can fork; sessions stay open. ResumeThreads starts it again while any is open.
+  void PauseThreads();
+  void ResumeThreads();
+
+private:
+  struct Entry {
+    Session session;
+    std::shared_ptr<void> owner;
+    std::mutex mutex;
+    // Guarded by the table mutex.
+    std::chrono::steady_clock::time_point lastUsed;
+    size_t inUse = 0;
+  };
+
+  static void Release(const std::shared_ptr<Entry>& entry);
+  void ReapLoop();
+
+  mutable std::mutex mMutex;
+  std::condition_variable mReapCondition;
+  Handle mNextHandle;
+  std::unordered_map<Handle, std::shared_ptr<Entry>> mEntries;
+  std::chrono::milliseconds mIdleTimeout;
+  uint64_t mOpened;
+  uint64_t mExpired;
+  bool mStopping;
+  std::thread mReaper;
+};
+
+#endif // SAMPLE_FILE_FILE_SESSION_TABLE_H_
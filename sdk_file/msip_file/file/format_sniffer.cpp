@@ -0,0 +1,343 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "format_sniffer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint8_t kCfbMagic[] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+const char kZipMagic[] = "PK\x03\x04";
+const char kEmptyZipMagic[] = "PK\x05\x06";
+const char kPdfMagic[] = "%PDF-";
+const char kPfileMagic[] = ".pfile";
+
+// PDF allows junk ahead of its header, which readers skip within the first KB.
+const int64_t kPdfHeaderWindow = 1024;
+
+const size_t kCfbHeaderSize = 512;
+const size_t kCfbDirectoryEntrySize = 128;
+const uint32_t kCfbEndOfChain = 0xFFFFFFFE;
+
+const size_t kZipLocalHeaderSize = 30;
+
+enum FormatMask : unsigned {
+  kAllowCfb = 1 << 0,
+  kAllowZip = 1 << 1,
+  kAllowPdf = 1 << 2,
+  kAllowPfile = 1 << 3,
+};
+
+struct ExtensionRule {
+  const char* extension;
+  unsigned allowed;
+};
+
+// Formats the content of each known extension may have. Office files with protection are compound files
+// whatever their extension.
+const ExtensionRule kExtensionRules[] = {
+  { ".doc", kAllowCfb }, { ".dot", kAllowCfb },
+  { ".xls", kAllowCfb }, { ".xlt", kAllowCfb },
+  { ".ppt", kAllowCfb }, { ".pot", kAllowCfb }, { ".pps", kAllowCfb },
+  { ".msg", kAllowCfb },
+  { ".docx", kAllowZip | kAllowCfb }, { ".docm", kAllowZip | kAllowCfb },
+  { ".dotx", kAllowZip | kAllowCfb }, { ".dotm", kAllowZip | kAllowCfb },
+  { ".xlsx", kAllowZip | kAllowCfb }, { ".xlsm", kAllowZip | kAllowCfb }, { ".xlsb", kAllowZip | kAllowCfb },
+  { ".xltx", kAllowZip | kAllowCfb }, { ".xltm", kAllowZip | kAllowCfb },
+  { ".pptx", kAllowZip | kAllowCfb }, { ".pptm", kAllowZip | kAllowCfb },
+  { ".potx", kAllowZip | kAllowCfb }, { ".potm", kAllowZip | kAllowCfb },
+  { ".ppsx", kAllowZip | kAllowCfb }, { ".ppsm", kAllowZip | kAllowCfb },
+  { ".vsdx", kAllowZip | kAllowCfb }, { ".vsdm", kAllowZip | kAllowCfb },
+  { ".pdf", kAllowPdf },
+  { ".pfile", kAllowPfile },
+};
+
+unsigned MaskOf(FileFormat format) {
+  switch (format) {
+    case FileFormat::Cfb:
+    case FileFormat::Msg: return kAllowCfb;
+    case FileFormat::Zip:
+    case FileFormat::Ooxml: return kAllowZip;
+    case FileFormat::Pdf: return kAllowPdf;
+    case FileFormat::Pfile: return kAllowPfile;
+    case FileFormat::Unknown:
+    case FileFormat::Empty: break;
+  }
+  return 0;
+}
+
+uint16_t ReadUInt16(const uint8_t* data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadUInt32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+      (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool StartsWith(const vector<uint8_t>& data, const void* prefix, size_t size) {
+  return data.size() >= size && memcmp(data.data(), prefix, size) == 0;
+}
+
+bool StartsWith(const string& value, const char* prefix) {
+  return value.compare(0, strlen(prefix), prefix) == 0;
+}
+
+string LowerExtension(const string& name) {
+  const auto slash = name.find_last_of("/\\");
+  const auto dot = name.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return string();
+  string extension = name.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return extension;
+}
+
+// Names the compound file's first directory sector lists, ASCII only. Entries in later sectors are not
+// read, so a missing name proves nothing.
+vector<string> ReadCfbNames(const FormatSniffer::Reader& read, const vector<uint8_t>& header) {
+  vector<string> names;
+  if (header.size() < kCfbHeaderSize)
+    return names;
+  const uint16_t sectorShift = ReadUInt16(&header[30]);
+  const uint32_t directorySector = ReadUInt32(&header[48]);
+  if ((sectorShift != 9 && sectorShift != 12) || directorySector >= kCfbEndOfChain)
+    return names;
+
+  const int64_t sectorSize = int64_t(1) << sectorShift;
+  vector<uint8_t> sector(static_cast<size_t>(sectorSize));
+  const int64_t got = read((static_cast<int64_t>(directorySector) + 1) * sectorSize, sector.data(), sectorSize);
+  if (got < static_cast<int64_t>(kCfbDirectoryEntrySize))
+    return names;
+
+  for (size_t offset = 0; offset + kCfbDirectoryEntrySize <= static_cast<size_t>(got); offset += kCfbDirectoryEntrySize) {
+    const uint8_t* entry = &sector[offset];
+    const uint16_t nameBytes = std::min<uint16_t>(ReadUInt16(entry + 64), 64);
+    string name;
+    for (size_t i = 0; i + 1 < nameBytes; i += 2) {
+      if (entry[i] == 0 && entry[i + 1] == 0)
+        break;
+      name += entry[i + 1] == 0 ? static_cast<char>(entry[i]) : '?';
+    }
+    if (!name.empty())
+      names.push_back(name);
+  }
+  return names;
+}
+
+void ClassifyCfb(const FormatSniffer::Reader& read, const vector<uint8_t>& header, FormatSniffer::Result& result) {
+  result.format = FileFormat::Cfb;
+  for (const auto& name : ReadCfbNames(read, header)) {
+    if (StartsWith(name, "__substg1.0_") || name == "__properties_version1.0") {
+      result.format = FileFormat::Msg;
+      result.extension = ".msg";
+      return;
+    }
+    if (name == "WordDocument")
+      result.extension = ".doc";
+    else if (name == "Workbook" || name == "Book")
+      result.extension = ".xls";
+    else if (name == "PowerPoint Document")
+      result.extension = ".ppt";
+  }
+}
+
+// Walks the local file headers in the sniffed bytes. Entries written with a data descriptor have no
+// sizes in their header, so the walk stops at the first of them.
+void ClassifyZip(const vector<uint8_t>& header, FormatSniffer::Result& result) {
+  result.format = FileFormat::Zip;
+  size_t offset = 0;
+  while (offset + kZipLocalHeaderSize <= header.size() && memcmp(&header[offset], kZipMagic, 4) == 0) {
+    const uint8_t* entry = &header[offset];
+    const uint16_t flags = ReadUInt16(entry + 6);
+    const uint32_t compressedSize = ReadUInt32(entry + 18);
+    const uint16_t nameLength = ReadUInt16(entry + 26);
+    const uint16_t extraLength = ReadUInt16(entry + 28);
+    if (offset + kZipLocalHeaderSize + nameLength > header.size())
+      return;
+    const string name(reinterpret_cast<const char*>(entry + kZipLocalHeaderSize), nameLength);
+    if (name == "[Content_Types].xml") {
+      result.format = FileFormat::Ooxml;
+    } else if (StartsWith(name, "word/")) {
+      result.format = FileFormat::Ooxml;
+      result.extension = ".docx";
+      return;
+    } else if (StartsWith(name, "xl/")) {
+      result.format = FileFormat::Ooxml;
+      result.extension = ".xlsx";
+      return;
+    } else if (StartsWith(name, "ppt/")) {
+      result.format = FileFormat::Ooxml;
+      result.extension = ".pptx";
+      return;
+    }
+    if (flags & 0x08)
+      return;
+    offset += kZipLocalHeaderSize + nameLength + extraLength + compressedSize;
+  }
+}
+
+} // namespace
+
+const int64_t FormatSniffer::kHeaderBytes;
+
+FormatSniffer::Result FormatSniffer::Sniff(const Reader& read, int64_t sizeBytes) {
+  Result result;
+  result.format = FileFormat::Unknown;
+  result.sizeBytes = sizeBytes;
+  if (sizeBytes == 0) {
+    result.format = FileFormat::Empty;
+    return result;
+  }
+
+  vector<uint8_t> header(static_cast<size_t>(kHeaderBytes));
+  const int64_t got = read(0, header.data(), kHeaderBytes);
+  if (got <= 0) {
+    if (got == 0)
+      result.format = FileFormat::Empty;
+    return result;
+  }
+  header.resize(static_cast<size_t>(got));
+
+  if (StartsWith(header, kCfbMagic, sizeof(kCfbMagic))) {
+    ClassifyCfb(read, header, result);
+  } else if (StartsWith(header, kZipMagic, 4) || StartsWith(header, kEmptyZipMagic, 4)) {
+    ClassifyZip(header, result);
+  } else if (StartsWith(header, kPfileMagic, strlen(kPfileMagic))) {
+    result.format = FileFormat::Pfile;
+    result.extension = ".pfile";
+  } else {
+    const auto window = header.begin() + static_cast<ptrdiff_t>(std::min<int64_t>(got, kPdfHeaderWindow));
+    if (std::search(header.begin(), window, kPdfMagic, kPdfMagic + strlen(kPdfMagic)) != window) {
+      result.format = FileFormat::Pdf;
+      result.extension = ".pdf";
+    }
+  }
+  return result;
+}
+
+FormatSniffer::Result FormatSniffer::SniffFile(const string& path) {
+  Result unreadable = { FileFormat::Unknown, string(), -1 };
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return unreadable;
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode)) {
+    close(fd);
+    return unreadable;
+  }
+  auto result = Sniff([fd](int64_t offset, uint8_t* buffer, int64_t size) -> int64_t {
+    return pread(fd, buffer, static_cast<size_t>(size), static_cast<off_t>(offset));
+  }, fileInfo.st_size);
+  close(fd);
+  return result;
+}
+
+FormatSniffer::Result FormatSniffer::SniffStream(mip::Stream& stream) {
+  auto result = Sniff([&stream](int64_t offset, uint8_t* buffer, int64_t size) -> int64_t {
+    stream.Seek(offset);
+    int64_t total = 0;
+    while (total < size) {
+      const int64_t got = stream.Read(buffer + total, size - total);
+      if (got <= 0)
+        break;
+      total += got;
+    }
+    return total;
+  }, stream.Size());
+  stream.Seek(0);
+  return result;
+}
+
+const char* FormatSniffer::Name(FileFormat format) {
+  switch (format) {
+    case FileFormat::Unknown: return "unknown";
+    case FileFormat::Empty: return "empty";
+    case FileFormat::Cfb: return "compound file";
+    case FileFormat::Msg: return "message";
+    case FileFormat::Zip: return "zip";
+    case FileFormat::Ooxml: return "office open xml";
+    case FileFormat::Pdf: return "pdf";
+    case FileFormat::Pfile: return "pfile";
+  }
+  return "unknown";
+}
+
+FormatGate& FormatGate::Instance() {
+  static FormatGate instance;
+  return instance;
+}
+
+FormatGate::FormatGate() : mCheckContent(true), mMaxInputBytes(0) {
+}
+
+void FormatGate::Configure(bool checkContent, int64_t maxInputBytes) {
+  mCheckContent.store(checkContent, std::memory_order_relaxed);
+  mMaxInputBytes.store(maxInputBytes > 0 ? maxInputBytes : 0, std::memory_order_relaxed);
+}
+
+string FormatGate::Check(const string& name, const FormatSniffer::Result& sniffed) const {
+  const int64_t maxInputBytes = mMaxInputBytes.load(std::memory_order_relaxed);
+  if (maxInputBytes > 0 && sniffed.sizeBytes > maxInputBytes)
+    return "File is larger than the " + std::to_string(maxInputBytes) + " bytes allowed";
+  if (!mCheckContent.load(std::memory_order_relaxed) || sniffed.sizeBytes < 0)
+    return string();
+
+  const string extension = LowerExtension(name);
+  for (const auto& rule : kExtensionRules) {
+    if (extension != rule.extension)
+      continue;
+    if (sniffed.format == FileFormat::Empty)
+      return "File is empty";
+    if (!(rule.allowed & MaskOf(sniffed.format)))
+      return "Content is not a " + extension.substr(1) + " file (detected " + FormatSniffer::Name(sniffed.format) + ")";
+    break;
+  }
+  return string();
+}
+
+string FormatGate::CheckFile(const string& path) const {
+  if (!mCheckContent.load(std::memory_order_relaxed) && mMaxInputBytes.load(std::memory_order_relaxed) == 0)
+    return string();
+  return Check(path, FormatSniffer::SniffFile(path));
+}
+
+string FormatGate::HintedName(const string& name, const FormatSniffer::Result& sniffed) {
+  if (sniffed.extension.empty() || !LowerExtension(name).empty())
+    return name;
+  return name + sniffed.extension;
+}
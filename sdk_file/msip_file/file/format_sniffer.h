@@ -0,0 +1,104 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_FORMAT_SNIFFER_H_
+#define SAMPLE_FILE_FORMAT_SNIFFER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "mip/stream.h"
+
+// Container formats told apart from their first bytes.
+enum class FileFormat {
+  Unknown,
+  Empty,
+  Cfb,    // OLE compound file: Office 97-2003 documents, and Office documents with protection.
+  Msg,    // Outlook message, a compound file with message property streams.
+  Zip,
+  Ooxml,  // Office Open XML package, a zip with [Content_Types].xml or Office parts.
+  Pdf,
+  Pfile,  // Generic MIP protection of any other file type.
+};
+
+// Detects a file's format from its header and, for compound files, their first directory sector, reading
+// at most a few KB. The extension is the one the content implies (".docx", ".msg"...), empty when it
+// only names the container.
+class FormatSniffer final {
+public:
+  struct Result {
+    FileFormat format;
+    std::string extension;
+    int64_t sizeBytes;  // -1 when unknown.
+  };
+
+  static const int64_t kHeaderBytes = 4096;
+
+  // Reads up to size bytes at offset into buffer and returns how many it read, or -1.
+  typedef std::function<int64_t(int64_t offset, uint8_t* buffer, int64_t size)> Reader;
+
+  static Result Sniff(const Reader& read, int64_t sizeBytes);
+
+  // Unknown, with a size of -1, when path cannot be read.
+  static Result SniffFile(const std::string& path);
+
+  // Leaves the stream at position 0.
+  static Result SniffStream(mip::Stream& stream);
+
+  static const char* Name(FileFormat format);
+};
+
+// Turns away inputs before an engine or file handler is built for them: files larger than a limit, and
+// files whose extension names a format their content is not (an empty or truncated upload, or junk sent
+// under an Office, PDF or message name). Extensions it does not know are let through, since any file can
+// be given generic protection.
+class FormatGate final {
+public:
+  static FormatGate& Instance();
+
+  // maxInputBytes 0 lifts the size limit. checkContent false only enforces the limit.
+  void Configure(bool checkContent, int64_t maxInputBytes);
+
+  // Empty when name, with the content sniffed, may be opened; otherwise why it is rejected.
+  std::string Check(const std::string& name, const FormatSniffer::Result& sniffed) const;
+
+  // Check of a file on disk. Paths that cannot be read are let through, to fail where they are opened.
+  std::string CheckFile(const std::string& path) const;
+
+  // The name the SDK should be given for content called name: name with the extension the content
+  // implies when name has none, otherwise name.
+  static std::string HintedName(const std::string& name, const FormatSniffer::Result& sniffed);
+
+private:
+  FormatGate();
+
+  std::atomic<bool> mCheckContent;
+  std::atomic<int64_t> mMaxInputBytes;
+};
+
+#endif // SAMPLE_FILE_FORMAT_SNIFFER_H_
@@ -0,0 +1,163 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "idempotency_cache.h"
+
+#include <cstdlib>
+
+#include "request_deadline.h"
+
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+thread_local string tKey;
+
+const char kConflictError[] = "Idempotency key was used for another request";
+
+} // namespace
+
+const size_t IdempotencyCache::kMaxResultBytes;
+
+IdempotencyCache& IdempotencyCache::Instance() {
+  static IdempotencyCache cache;
+  return cache;
+}
+
+IdempotencyCache::IdempotencyCache() : mEntries(0, "idempotency"), mTtlSeconds(0), mCoalesced(0), mConflicts(0) {
+}
+
+void IdempotencyCache::Configure(size_t capacity, seconds ttl) {
+  mTtlSeconds = ttl.count() > 0 ? ttl.count() : 0;
+  mEntries.SetCapacity(capacity);
+}
+
+void IdempotencyCache::SetCurrentKey(const string& key) {
+  tKey = key;
+}
+
+string IdempotencyCache::TakeCurrentKey() {
+  string key;
+  key.swap(tKey);
+  return key;
+}
+
+int IdempotencyCache::Run(
+    const string& key,
+    const string& request,
+    string& result,
+    const std::function<int()>& run,
+    const std::function<string(const string&)>& errorJson) {
+  std::promise<shared_ptr<const Outcome>> running;
+  std::shared_future<shared_ptr<const Outcome>> pending;
+  {
+    // Kept results are only looked up under the lock, so a call finishing in between, which keeps its
+    // result before leaving mInFlight, is found in one or the other.
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mInFlight.find(key);
+    Slot slot;
+    if (it != mInFlight.end()) {
+      if (it->second.request != request) {
+        ++mConflicts;
+        result = errorJson(kConflictError);
+        return EXIT_FAILURE;
+      }
+      pending = it->second.outcome;
+    } else if (mEntries.Find(key, slot, [this](const Slot& cached) { return !IsExpired(cached); })) {
+      if (slot.request != request) {
+        ++mConflicts;
+        result = errorJson(kConflictError);
+        return EXIT_FAILURE;
+      }
+      result = slot.outcome->result;
+      return slot.outcome->status;
+    } else {
+      InFlight inFlight;
+      inFlight.request = request;
+      inFlight.outcome = running.get_future().share();
+      mInFlight[key] = inFlight;
+    }
+  }
+  if (pending.valid()) {
+    ++mCoalesced;
+    const auto outcome = sample::deadline::WaitUntilDeadline(pending);
+    result = outcome->result;
+    return outcome->status;
+  }
+
+  int status = EXIT_FAILURE;
+  try {
+    status = run();
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mInFlight.erase(key);
+    }
+    running.set_exception(std::current_exception());
+    throw;
+  }
+  auto outcome = std::make_shared<Outcome>();
+  outcome->status = status;
+  outcome->result = result;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (status == EXIT_SUCCESS && result.size() <= kMaxResultBytes) {
+      Slot slot;
+      slot.insertedAt = steady_clock::now();
+      slot.request = request;
+      slot.outcome = outcome;
+      mEntries.Put(key, slot);
+    }
+    mInFlight.erase(key);
+  }
+  running.set_value(outcome);
+  return status;
+}
+
+void IdempotencyCache::Clear() {
+  mEntries.Clear();
+}
+
+IdempotencyCache::Stats IdempotencyCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.coalesced = mCoalesced.load();
+  stats.conflicts = mConflicts.load();
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  return stats;
+}
+
+bool IdempotencyCache::IsExpired(const Slot& slot) const {
+  const int64_t ttlSeconds = mTtlSeconds.load();
+  return ttlSeconds > 0 && steady_clock::now() - slot.insertedAt >= seconds(ttlSeconds);
+}
@@ -0,0 +1,122 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_IDEMPOTENCY_CACHE_H_
+#define SAMPLE_FILE_IDEMPOTENCY_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "sharded_lru.h"
+
+// Results of operations the caller tagged with an idempotency key (see msipSetIdempotencyKey), so a
+// retry of a call whose caller gave up, e.g. Dapr retrying after a timeout, neither protects nor
+// unprotects the file again. A retry while the original still runs waits for it, up to the retry's own
+// deadline, and gets its outcome; a retry after it succeeded gets its result as returned then. Failures
+// are handed to the waiters but not kept, so a later retry runs again. Each key also records its
+// request, and a key reused for another request fails instead of returning someone else's result.
+class IdempotencyCache final {
+public:
+  struct Stats {
+    // Retries answered from a kept result.
+    uint64_t hits;
+    // Retries that waited for the original call.
+    uint64_t coalesced;
+    // Keys reused for another request.
+    uint64_t conflicts;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+  };
+
+  // Larger results are handed to waiters but not kept.
+  static const size_t kMaxResultBytes = 1 << 20;
+
+  static IdempotencyCache& Instance();
+
+  // capacity 0, the default, disables the cache. ttl 0 keeps results until evicted.
+  void Configure(size_t capacity, std::chrono::seconds ttl);
+
+  bool IsEnabled() const { return mEntries.GetCapacity() != 0; }
+
+  // Key of the next operation the calling thread runs; empty runs it untagged. Taking it clears it, so
+  // a key tags exactly one operation.
+  static void SetCurrentKey(const std::string& key);
+  static std::string TakeCurrentKey();
+
+  // Runs run, which fills result and returns its status, once for key: see the class comment. A
+  // conflicting request fails with EXIT_FAILURE and result holding the error JSON of errorJson.
+  int Run(
+      const std::string& key,
+      const std::string& request,
+      std::string& result,
+      const std::function<int()>& run,
+      const std::function<std::string(const std::string&)>& errorJson);
+
+  void Clear();
+
+  Stats GetStats() const;
+
+private:
+  IdempotencyCache();
+  IdempotencyCache(const IdempotencyCache&) = delete;
+  IdempotencyCache& operator=(const IdempotencyCache&) = delete;
+
+  struct Outcome {
+    int status;
+    std::string result;
+  };
+
+  struct Slot {
+    std::chrono::steady_clock::time_point insertedAt;
+    std::string request;
+    std::shared_ptr<const Outcome> outcome;
+  };
+
+  struct InFlight {
+    std::string request;
+    std::shared_future<std::shared_ptr<const Outcome>> outcome;
+  };
+
+  bool IsExpired(const Slot& slot) const;
+
+  ShardedLru<Slot> mEntries;
+  std::atomic<int64_t> mTtlSeconds;
+  std::mutex mMutex;
+  std::map<std::string, InFlight> mInFlight;
+  std::atomic<uint64_t> mCoalesced;
+  std::atomic<uint64_t> mConflicts;
+};
+
+#endif // SAMPLE_FILE_IDEMPOTENCY_CACHE_H_
@@ -0,0 +1,160 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "input_streams.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer_pool.h"
+#include "mapped_file_stream.h"
+#include "metrics_registry.h"
+#include "stream_over_buffer.h"
+#include "windowed_file_stream.h"
+
+using std::make_shared;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+const int64_t kDefaultMappedMinBytes = 16 * 1024 * 1024;
+const size_t kDefaultWindowBytes = 4 * 1024 * 1024;
+const size_t kDefaultReadAheadBytes = 8 * 1024 * 1024;
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& Opened(InputStreams::Strategy strategy) {
+  static auto& path = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_path_total", "Inputs the SDK opened by path");
+  static auto& pooled = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_pooled_total", "Inputs read whole into a pooled buffer");
+  static auto& mapped = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_mapped_total", "Inputs mapped into memory");
+  static auto& windowed = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_windowed_total", "Inputs read through a sliding window");
+  switch (strategy) {
+    case InputStreams::Strategy::Pooled: return pooled;
+    case InputStreams::Strategy::Mapped: return mapped;
+    case InputStreams::Strategy::Windowed: return windowed;
+    default: return path;
+  }
+}
+
+shared_ptr<mip::Stream> ReadPooled(const string& filePath, int64_t size) {
+  const int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", filePath));
+  BufferPool::Buffer buffer;
+  size_t done = 0;
+  try {
+    buffer = BufferPool::Shared().Acquire(static_cast<size_t>(size));
+    while (done < static_cast<size_t>(size)) {
+      const ssize_t count = read(fd, buffer.Data() + done, static_cast<size_t>(size) - done);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count < 0)
+        throw runtime_error(ErrnoMessage("Failed to read", filePath));
+      if (count == 0)
+        break;  // The file shrank since it was stat'ed.
+      done += static_cast<size_t>(count);
+    }
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  return make_shared<StreamOverBuffer>(BufferPool::Share(std::move(buffer)), static_cast<int64_t>(done));
+}
+
+} // namespace
+
+const int64_t InputStreams::kMaxPooledBytes;
+const size_t InputStreams::kMinWindowBytes;
+const size_t InputStreams::kMaxWindowBytes;
+
+InputStreams::Options InputStreams::Defaults() {
+  Options options = Options();
+  options.mappedMinBytes = kDefaultMappedMinBytes;
+  options.windowBytes = kDefaultWindowBytes;
+  options.readAheadBytes = kDefaultReadAheadBytes;
+  return options;
+}
+
+bool InputStreams::IsValid(const Options& options) {
+  if (options.pooledMaxBytes < 0 || options.pooledMaxBytes > kMaxPooledBytes)
+    return false;
+  if (options.mappedMinBytes <= 0 || options.windowedMinBytes < 0 || options.prefaultMinBytes < 0)
+    return false;
+  return options.windowBytes >= kMinWindowBytes && options.windowBytes <= kMaxWindowBytes;
+}
+
+InputStreams::Strategy InputStreams::Choose(const Options& options, int64_t size) {
+  // Empty files go to the SDK, which handles them itself.
+  if (size <= 0)
+    return Strategy::Path;
+  if (options.windowedMinBytes > 0 && size >= options.windowedMinBytes)
+    return Strategy::Windowed;
+  if (size >= options.mappedMinBytes)
+    return Strategy::Mapped;
+  if (size < options.pooledMaxBytes)
+    return Strategy::Pooled;
+  return Strategy::Path;
+}
+
+unsigned InputStreams::MapHints(const Options& options, int64_t size) {
+  unsigned hints = MappedFileStream::kNoHints;
+  if (options.prefaultMinBytes > 0 && size >= options.prefaultMinBytes)
+    hints |= MappedFileStream::kPrefault;
+  if (options.hugePages)
+    hints |= MappedFileStream::kHugePages;
+  return hints;
+}
+
+shared_ptr<mip::Stream> InputStreams::Open(const Options& options, const string& filePath) {
+  struct stat fileInfo;
+  if (stat(filePath.c_str(), &fileInfo) != 0) {
+    Opened(Strategy::Path).Add(1);
+    return nullptr;
+  }
+  const int64_t size = static_cast<int64_t>(fileInfo.st_size);
+  const Strategy strategy = Choose(options, size);
+  Opened(strategy).Add(1);
+  switch (strategy) {
+    case Strategy::Pooled: return ReadPooled(filePath, size);
+    case Strategy::Mapped: return make_shared<MappedFileStream>(filePath, MapHints(options, size));
+    case Strategy::Windowed: return make_shared<WindowedFileStream>(filePath, options.windowBytes, options.readAheadBytes);
+    default: return nullptr;
+  }
+}
@@ -0,0 +1,78 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_INPUT_STREAMS_H_
+#define SAMPLE_FILE_INPUT_STREAMS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "mip/stream.h"
+
+// Chooses how an input file is handed to the SDK from its size: small files read whole into a pooled
+// buffer, medium files left to the SDK to open by path or mapped, and files above a threshold read through
+// a sliding window, so the memory one input holds stays bounded however large it is.
+class InputStreams final {
+public:
+  enum class Strategy { Path, Pooled, Mapped, Windowed };
+
+  struct Options {
+    // Files smaller than this are read whole into a pooled buffer. 0 disables it.
+    int64_t pooledMaxBytes;
+    // Files of this size or more are mapped.
+    int64_t mappedMinBytes;
+    // Files of this size or more are read through a window of windowBytes. 0 disables it.
+    int64_t windowedMinBytes;
+    size_t windowBytes;
+    size_t readAheadBytes;
+    // Mapped files of this size or more are faulted in when opened, so the SDK's scans take no page
+    // faults. 0 disables it.
+    int64_t prefaultMinBytes;
+    // Asks for transparent huge pages for mapped files.
+    bool hugePages;
+  };
+
+  static const int64_t kMaxPooledBytes = 256 * 1024 * 1024;
+  static const size_t kMinWindowBytes = 4096;
+  static const size_t kMaxWindowBytes = 256 * 1024 * 1024;
+
+  // The SDK's by-path open below 16 MiB, mapped streams above it.
+  static Options Defaults();
+  // True when options can be passed to Open.
+  static bool IsValid(const Options& options);
+
+  static Strategy Choose(const Options& options, int64_t size);
+  // MappedFileStream hints for a mapped file of size bytes.
+  static unsigned MapHints(const Options& options, int64_t size);
+  // Returns the stream for filePath, or nullptr for Strategy::Path and for files that cannot be stat'ed, to
+  // let the SDK open the file itself. Counts the strategy taken. Throws std::runtime_error.
+  static std::shared_ptr<mip::Stream> Open(const Options& options, const std::string& filePath);
+};
+
+#endif // SAMPLE_FILE_INPUT_STREAMS_H_
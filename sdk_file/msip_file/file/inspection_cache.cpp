@@ -0,0 +1,187 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "inspection_cache.h"
+
+#include <fstream>
+#include <vector>
+
+#include "content_hash.h"
+#include "string_utils.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::ifstream;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const int64_t kFingerprintBlockSize = 4096;
+
+bool ReadBlock(ifstream& file, int64_t offset, int64_t length, vector<uint8_t>& block) {
+  block.resize(static_cast<size_t>(length));
+  file.seekg(offset);
+  file.read(reinterpret_cast<char*>(block.data()), length);
+  return file.gcount() == length;
+}
+
+} // namespace
+
+InspectionCache::InspectionCache() : mEntries(0, "inspection"), mTtlSeconds(0), mVerifyContent(false) {
+}
+
+void InspectionCache::Configure(size_t capacity, seconds ttl, bool verifyContent) {
+  lock_guard<mutex> lock(mConfigureMutex);
+  mTtlSeconds = ttl.count();
+  if (mVerifyContent != verifyContent) {
+    // Entries stored without a fingerprint cannot be verified, so start over. A lookup racing this
+    // compares a fingerprint of 0 against a real one, or the reverse, and misses.
+    mEntries.Clear();
+    mVerifyContent = verifyContent;
+  }
+  mEntries.SetCapacity(capacity);
+}
+
+InspectionCache::Result InspectionCache::GetOrInspect(const string& filePath, const Inspector& inspect) {
+  FileIdentity identity;
+  if (mEntries.GetCapacity() == 0 || !GetFileIdentity(filePath, identity))
+    return inspect();
+  const bool verifyContent = mVerifyContent;
+  const seconds ttl(mTtlSeconds.load());
+  const string key = identity.ToKey();
+  const uint64_t fingerprint = verifyContent ? GetFingerprint(filePath, identity.size) : 0;
+
+  Entry entry;
+  const bool hit = mEntries.Find(key, entry, [ttl, fingerprint](const Entry& cached) {
+    const bool expired = ttl.count() > 0 && steady_clock::now() - cached.insertedAt >= ttl;
+    return !expired && cached.fingerprint == fingerprint;
+  });
+  if (hit)
+    return entry.result;
+
+  // Inspection reads the file, so it runs without holding a lock. The identity was taken first, so a
+  // file modified meanwhile gets a newer mtime and misses on the next lookup.
+  Result result = inspect();
+
+  if (mVerifyContent != verifyContent)
+    return result;
+  entry.identity = identity;
+  entry.fingerprint = fingerprint;
+  entry.insertedAt = steady_clock::now();
+  entry.result = result;
+  mEntries.Put(key, entry);
+  return result;
+}
+
+void InspectionCache::Invalidate(const string& filePath) {
+  FileIdentity identity;
+  if (!GetFileIdentity(filePath, identity))
+    return;
+
+  // The rewritten file may keep its inode but not necessarily its size or mtime, so match on the inode.
+  mEntries.EraseIf([&identity](const Entry& entry) { return entry.identity.IsSameFile(identity); });
+}
+
+InspectionCache::Stats InspectionCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void InspectionCache::SnapshotTo(SnapshotWriter& writer) const {
+  const auto now = steady_clock::now();
+  mEntries.ForEach([&](const string& key, const Entry& entry, const string&) {
+    writer.PutString(key);
+    writer.PutU64(entry.identity.device);
+    writer.PutU64(entry.identity.inode);
+    writer.PutI64(entry.identity.size);
+    writer.PutI64(entry.identity.mtimeNs);
+    writer.PutU64(entry.fingerprint);
+    writer.PutI64(std::chrono::duration_cast<milliseconds>(now - entry.insertedAt).count());
+    writer.PutBool(entry.result.isProtected);
+    writer.PutBool(entry.result.isLabeled);
+    writer.PutBool(entry.result.containsProtectedObjects);
+  });
+}
+
+size_t InspectionCache::RestoreFrom(SnapshotReader& reader) {
+  const bool verifyContent = mVerifyContent;
+  const seconds ttl(mTtlSeconds.load());
+  const auto now = steady_clock::now();
+  size_t restored = 0;
+  while (!reader.AtEnd()) {
+    const string key = reader.GetString();
+    Entry entry;
+    entry.identity.device = reader.GetU64();
+    entry.identity.inode = reader.GetU64();
+    entry.identity.size = reader.GetI64();
+    entry.identity.mtimeNs = reader.GetI64();
+    entry.fingerprint = reader.GetU64();
+    entry.insertedAt = now - milliseconds(reader.GetI64());
+    entry.result.isProtected = reader.GetBool();
+    entry.result.isLabeled = reader.GetBool();
+    entry.result.containsProtectedObjects = reader.GetBool();
+    const bool expired = ttl.count() > 0 && now - entry.insertedAt >= ttl;
+    if (mEntries.GetCapacity() == 0 || expired || (entry.fingerprint != 0) != verifyContent)
+      continue;
+    mEntries.Put(key, entry);
+    ++restored;
+  }
+  return restored;
+}
+
+void InspectionCache::Clear() {
+  mEntries.Clear();
+}
+
+uint64_t InspectionCache::GetFingerprint(const string& filePath, int64_t size) {
+  ifstream file(FILENAME_STRING(filePath), std::ios::binary);
+  if (!file)
+    return 0;
+
+  vector<uint8_t> block;
+  const int64_t headLength = size < kFingerprintBlockSize ? size : kFingerprintBlockSize;
+  if (!ReadBlock(file, 0, headLength, block))
+    return 0;
+  uint64_t fingerprint = XxHash64(block.data(), block.size(), 0);
+  if (size > kFingerprintBlockSize) {
+    const int64_t tailOffset = size - kFingerprintBlockSize > headLength ? size - kFingerprintBlockSize : headLength;
+    if (!ReadBlock(file, tailOffset, size - tailOffset, block))
+      return 0;
+    fingerprint = XxHash64(block.data(), block.size(), fingerprint);
+  }
+  return fingerprint;
+}
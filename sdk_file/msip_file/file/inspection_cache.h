@@ -0,0 +1,108 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_INSPECTION_CACHE_H_
+#define SAMPLE_FILE_INSPECTION_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "cache_snapshot.h"
+#include "file_identity.h"
+#include "sharded_lru.h"
+
+// LRU cache of protection-status results keyed by file identity (device, inode, size, mtime). A repeat
+// inspect of an unchanged file costs one stat(). Disabled (capacity 0) until configured.
+class InspectionCache final {
+public:
+  struct Result {
+    bool isProtected;
+    bool isLabeled;
+    bool containsProtectedObjects;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  typedef std::function<Result()> Inspector;
+
+  InspectionCache();
+
+  // capacity 0 disables the cache and drops every entry. ttl 0 keeps entries until the file changes.
+  // With verifyContent a hit also compares an xxHash64 of the file's first and last 4 KiB, which
+  // catches rewrites that preserve size and mtime at the cost of two small reads.
+  void Configure(size_t capacity, std::chrono::seconds ttl, bool verifyContent);
+
+  // Returns the cached result for filePath, or runs inspect and caches what it returns.
+  // Exceptions from inspect propagate and nothing is cached.
+  Result GetOrInspect(const std::string& filePath, const Inspector& inspect);
+
+  // Drops the entry for filePath. Called after a commit writes to it.
+  void Invalidate(const std::string& filePath);
+
+  Stats GetStats() const;
+
+  // Entries held and the most kept, without locking (see ShardedLru::GetSize).
+  size_t GetSize() const { return mEntries.GetSize(); }
+  size_t GetCapacity() const { return mEntries.GetCapacity(); }
+
+  // Writes the entries to a snapshot section (see cache_snapshot.h), and puts a section's entries back,
+  // returning how many. RestoreFrom throws std::runtime_error for a malformed section.
+  void SnapshotTo(SnapshotWriter& writer) const;
+  size_t RestoreFrom(SnapshotReader& reader);
+
+  void Clear();
+
+  // xxHash64 of the first and last 4 KiB of a file of the given size; 0 when it cannot be read.
+  static uint64_t GetFingerprint(const std::string& filePath, int64_t size);
+
+private:
+  struct Entry {
+    FileIdentity identity;
+    uint64_t fingerprint;
+    std::chrono::steady_clock::time_point insertedAt;
+    Result result;
+  };
+
+  // Serializes Configure. Lookups read the settings below without it.
+  std::mutex mConfigureMutex;
+  ShardedLru<Entry> mEntries;
+  std::atomic<int64_t> mTtlSeconds;
+  std::atomic<bool> mVerifyContent;
+};
+
+#endif // SAMPLE_FILE_INSPECTION_CACHE_H_
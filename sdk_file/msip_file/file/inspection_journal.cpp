@@ -0,0 +1,234 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "inspection_journal.h"
+
+#include <stdexcept>
+
+#include <sqlite3.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+// Scanner threads write while a scan runs; waiting out another process's commit beats failing the scan.
+static const int kBusyTimeoutMs = 5000;
+
+const char* const kSchema =
+    "CREATE TABLE IF NOT EXISTS files ("
+    "path TEXT PRIMARY KEY, device INTEGER, inode INTEGER, size INTEGER, mtime_ns INTEGER, fingerprint INTEGER, "
+    "protected INTEGER, labeled INTEGER, protected_objects INTEGER, label_id TEXT, scan_id INTEGER);"
+    "CREATE TABLE IF NOT EXISTS scans (id INTEGER PRIMARY KEY AUTOINCREMENT, started_at INTEGER);";
+
+// Rows strictly inside a directory sort between "root/" and "root0", '0' being the character after '/'.
+string ChildUpperBound(const string& prefix) {
+  return prefix.substr(0, prefix.size() - 1) + static_cast<char>('/' + 1);
+}
+
+} // namespace
+
+const size_t InspectionJournal::kWriteBatch;
+
+InspectionJournal::InspectionJournal(const string& databasePath)
+    : mDatabase(nullptr),
+      mFind(nullptr),
+      mRecord(nullptr),
+      mKeep(nullptr),
+      mScanId(0),
+      mPendingWrites(0) {
+  // Calls are serialized by mMutex, so SQLite's own locking is not needed.
+  if (sqlite3_open_v2(databasePath.c_str(), &mDatabase, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+    const string message = mDatabase ? sqlite3_errmsg(mDatabase) : "out of memory";
+    sqlite3_close(mDatabase);
+    throw runtime_error("Failed to open inspection journal '" + databasePath + "': " + message);
+  }
+  try {
+    sqlite3_busy_timeout(mDatabase, kBusyTimeoutMs);
+    // The journal can be rebuilt by a full scan, so a crash may lose the last transaction.
+    Execute("PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+    Execute(kSchema);
+    Execute("INSERT INTO scans (started_at) VALUES (strftime('%s', 'now'));");
+    mScanId = sqlite3_last_insert_rowid(mDatabase);
+    mFind = Prepare(
+        "SELECT device, inode, size, mtime_ns, fingerprint, protected, labeled, protected_objects, label_id "
+        "FROM files WHERE path = ?1;");
+    mRecord = Prepare(
+        "INSERT OR REPLACE INTO files (path, device, inode, size, mtime_ns, fingerprint, protected, labeled, "
+        "protected_objects, label_id, scan_id) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11);");
+    mKeep = Prepare("UPDATE files SET scan_id = ?2 WHERE path = ?1;");
+  } catch (...) {
+    sqlite3_finalize(mFind);
+    sqlite3_finalize(mRecord);
+    sqlite3_finalize(mKeep);
+    sqlite3_close(mDatabase);
+    throw;
+  }
+}
+
+InspectionJournal::~InspectionJournal() {
+  try {
+    lock_guard<mutex> lock(mMutex);
+    Commit();
+  } catch (const std::exception&) {
+  }
+  sqlite3_finalize(mFind);
+  sqlite3_finalize(mRecord);
+  sqlite3_finalize(mKeep);
+  sqlite3_close(mDatabase);
+}
+
+bool InspectionJournal::Find(const string& path, Entry& entry) {
+  lock_guard<mutex> lock(mMutex);
+  sqlite3_reset(mFind);
+  sqlite3_bind_text(mFind, 1, path.data(), static_cast<int>(path.size()), SQLITE_TRANSIENT);
+  const int result = sqlite3_step(mFind);
+  if (result == SQLITE_DONE)
+    return false;
+  if (result != SQLITE_ROW)
+    throw runtime_error(string("Failed to read inspection journal: ") + sqlite3_errmsg(mDatabase));
+  entry.path = path;
+  entry.identity.device = static_cast<uint64_t>(sqlite3_column_int64(mFind, 0));
+  entry.identity.inode = static_cast<uint64_t>(sqlite3_column_int64(mFind, 1));
+  entry.identity.size = sqlite3_column_int64(mFind, 2);
+  entry.identity.mtimeNs = sqlite3_column_int64(mFind, 3);
+  entry.fingerprint = static_cast<uint64_t>(sqlite3_column_int64(mFind, 4));
+  entry.status.isProtected = sqlite3_column_int(mFind, 5) != 0;
+  entry.status.isLabeled = sqlite3_column_int(mFind, 6) != 0;
+  entry.status.containsProtectedObjects = sqlite3_column_int(mFind, 7) != 0;
+  const unsigned char* labelId = sqlite3_column_text(mFind, 8);
+  entry.labelId = labelId ? reinterpret_cast<const char*>(labelId) : "";
+  sqlite3_reset(mFind);
+  return true;
+}
+
+void InspectionJournal::Record(const Entry& entry) {
+  lock_guard<mutex> lock(mMutex);
+  sqlite3_reset(mRecord);
+  sqlite3_bind_text(mRecord, 1, entry.path.data(), static_cast<int>(entry.path.size()), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(mRecord, 2, static_cast<sqlite3_int64>(entry.identity.device));
+  sqlite3_bind_int64(mRecord, 3, static_cast<sqlite3_int64>(entry.identity.inode));
+  sqlite3_bind_int64(mRecord, 4, entry.identity.size);
+  sqlite3_bind_int64(mRecord, 5, entry.identity.mtimeNs);
+  sqlite3_bind_int64(mRecord, 6, static_cast<sqlite3_int64>(entry.fingerprint));
+  sqlite3_bind_int(mRecord, 7, entry.status.isProtected ? 1 : 0);
+  sqlite3_bind_int(mRecord, 8, entry.status.isLabeled ? 1 : 0);
+  sqlite3_bind_int(mRecord, 9, entry.status.containsProtectedObjects ? 1 : 0);
+  sqlite3_bind_text(mRecord, 10, entry.labelId.data(), static_cast<int>(entry.labelId.size()), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(mRecord, 11, mScanId);
+  Step(mRecord);
+  CommitIfDue();
+}
+
+void InspectionJournal::Keep(const string& path) {
+  lock_guard<mutex> lock(mMutex);
+  sqlite3_reset(mKeep);
+  sqlite3_bind_text(mKeep, 1, path.data(), static_cast<int>(path.size()), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(mKeep, 2, mScanId);
+  Step(mKeep);
+  CommitIfDue();
+}
+
+void InspectionJournal::FinishScan(const string& root, const std::function<void(const string& path)>& removed) {
+  lock_guard<mutex> lock(mMutex);
+  string directory = root;
+  while (directory.size() > 1 && directory.back() == '/')
+    directory.pop_back();
+  const string prefix = directory == "/" ? directory : directory + "/";
+  const string upper = ChildUpperBound(prefix);
+
+  const char* const where = " WHERE scan_id < ?1 AND (path = ?2 OR (path >= ?3 AND path < ?4));";
+  sqlite3_stmt* select = Prepare((string("SELECT path FROM files") + where).c_str());
+  sqlite3_stmt* erase = nullptr;
+  try {
+    sqlite3_bind_int64(select, 1, mScanId);
+    sqlite3_bind_text(select, 2, directory.data(), static_cast<int>(directory.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(select, 3, prefix.data(), static_cast<int>(prefix.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(select, 4, upper.data(), static_cast<int>(upper.size()), SQLITE_TRANSIENT);
+    int result;
+    while ((result = sqlite3_step(select)) == SQLITE_ROW)
+      removed(reinterpret_cast<const char*>(sqlite3_column_text(select, 0)));
+    if (result != SQLITE_DONE)
+      throw runtime_error(string("Failed to read inspection journal: ") + sqlite3_errmsg(mDatabase));
+
+    erase = Prepare((string("DELETE FROM files") + where).c_str());
+    sqlite3_bind_int64(erase, 1, mScanId);
+    sqlite3_bind_text(erase, 2, directory.data(), static_cast<int>(directory.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(erase, 3, prefix.data(), static_cast<int>(prefix.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(erase, 4, upper.data(), static_cast<int>(upper.size()), SQLITE_TRANSIENT);
+    if (mPendingWrites == 0)
+      Execute("BEGIN;");
+    ++mPendingWrites;
+    Step(erase);
+    Commit();
+  } catch (...) {
+    sqlite3_finalize(select);
+    sqlite3_finalize(erase);
+    throw;
+  }
+  sqlite3_finalize(select);
+  sqlite3_finalize(erase);
+}
+
+void InspectionJournal::Execute(const char* sql) {
+  char* error = nullptr;
+  if (sqlite3_exec(mDatabase, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+    const string message = error ? error : sqlite3_errmsg(mDatabase);
+    sqlite3_free(error);
+    throw runtime_error("Inspection journal: " + message);
+  }
+}
+
+sqlite3_stmt* InspectionJournal::Prepare(const char* sql) {
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(mDatabase, sql, -1, &statement, nullptr) != SQLITE_OK)
+    throw runtime_error(string("Inspection journal: ") + sqlite3_errmsg(mDatabase));
+  return statement;
+}
+
+// Opens the scan's next transaction before the write, so writes are grouped kWriteBatch at a time.
+void InspectionJournal::Step(sqlite3_stmt* statement) {
+  if (mPendingWrites == 0)
+    Execute("BEGIN;");
+  ++mPendingWrites;
+  if (sqlite3_step(statement) != SQLITE_DONE)
+    throw runtime_error(string("Failed to write inspection journal: ") + sqlite3_errmsg(mDatabase));
+  sqlite3_reset(statement);
+}
+
+void InspectionJournal::CommitIfDue() {
+  if (mPendingWrites >= kWriteBatch)
+    Commit();
+}
+
+void InspectionJournal::Commit() {
+  if (mPendingWrites == 0)
+    return;
+  mPendingWrites = 0;
+  Execute("COMMIT;");
+}
@@ -0,0 +1,98 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_INSPECTION_JOURNAL_H_
+#define SAMPLE_FILE_INSPECTION_JOURNAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "file_identity.h"
+#include "inspection_cache.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// SQLite store of what earlier tree scans found, so a later scan only probes the files whose identity
+// changed since and reports the rest as a diff. One row per path holds the file's identity, a fingerprint
+// of its first and last 4 KiB, its status and the label id read from its publishing license. Writes are
+// grouped into transactions of kWriteBatch rows. Calls are serialized, so scanner threads may share one
+// journal.
+class InspectionJournal final {
+public:
+  struct Entry {
+    std::string path;
+    FileIdentity identity;
+    uint64_t fingerprint;
+    InspectionCache::Result status;
+    std::string labelId;
+  };
+
+  static const size_t kWriteBatch = 1000;
+
+  // Opens or creates the journal at databasePath and starts a scan. Throws std::runtime_error.
+  explicit InspectionJournal(const std::string& databasePath);
+  // Commits what the scan recorded. Rows of a scan that never finishes are kept.
+  ~InspectionJournal();
+
+  InspectionJournal(const InspectionJournal&) = delete;
+  InspectionJournal& operator=(const InspectionJournal&) = delete;
+
+  // False when path was never recorded.
+  bool Find(const std::string& path, Entry& entry);
+
+  // Stores entry, replacing any earlier one for its path, as seen by this scan.
+  void Record(const Entry& entry);
+
+  // Marks the entry for path as seen by this scan, unchanged.
+  void Keep(const std::string& path);
+
+  // Calls removed for every entry at or below root that this scan did not see, and deletes them. The
+  // scan's rows are committed.
+  void FinishScan(const std::string& root, const std::function<void(const std::string& path)>& removed);
+
+private:
+  void Execute(const char* sql);
+  sqlite3_stmt* Prepare(const char* sql);
+  void Step(sqlite3_stmt* statement);
+  // Called with the mutex held after each write.
+  void CommitIfDue();
+  void Commit();
+
+  std::mutex mMutex;
+  sqlite3* mDatabase;
+  sqlite3_stmt* mFind;
+  sqlite3_stmt* mRecord;
+  sqlite3_stmt* mKeep;
+  int64_t mScanId;
+  size_t mPendingWrites;
+};
+
+#endif // SAMPLE_FILE_INSPECTION_JOURNAL_H_
@@ -0,0 +1,294 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "json_reader.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using std::string;
+
+class JsonValue::Parser {
+public:
+  explicit Parser(const string& json) : mJson(json), mPos(0) {}
+
+  JsonValue ParseDocument() {
+    JsonValue value = ParseValue(0);
+    SkipSpace();
+    if (mPos != mJson.size())
+      Fail("unexpected characters after the value");
+    return value;
+  }
+
+private:
+  // Deep enough for any configuration, shallow enough that a hostile document cannot exhaust the stack.
+  static const int kMaxDepth = 32;
+
+  [[noreturn]] void Fail(const char* what) const {
+    throw std::invalid_argument(string("Invalid JSON at offset ") + std::to_string(mPos) + ": " + what);
+  }
+
+  void SkipSpace() {
+    while (mPos < mJson.size() && (mJson[mPos] == ' ' || mJson[mPos] == '\t' || mJson[mPos] == '\n' || mJson[mPos] == '\r'))
+      ++mPos;
+  }
+
+  bool Consume(const char* literal) {
+    const size_t size = strlen(literal);
+    if (mJson.compare(mPos, size, literal) != 0)
+      return false;
+    mPos += size;
+    return true;
+  }
+
+  JsonValue ParseValue(int depth) {
+    if (depth > kMaxDepth)
+      Fail("nested too deeply");
+    SkipSpace();
+    if (mPos >= mJson.size())
+      Fail("expected a value");
+    JsonValue value;
+    const char c = mJson[mPos];
+    if (c == '{') {
+      value.mType = Type::Object;
+      ++mPos;
+      SkipSpace();
+      if (mPos < mJson.size() && mJson[mPos] == '}') {
+        ++mPos;
+        return value;
+      }
+      for (;;) {
+        SkipSpace();
+        if (mPos >= mJson.size() || mJson[mPos] != '"')
+          Fail("expected a member name");
+        string name = ParseString();
+        SkipSpace();
+        if (mPos >= mJson.size() || mJson[mPos] != ':')
+          Fail("expected ':'");
+        ++mPos;
+        value.mMembers.emplace_back(std::move(name), ParseValue(depth + 1));
+        SkipSpace();
+        if (mPos < mJson.size() && mJson[mPos] == ',') {
+          ++mPos;
+          continue;
+        }
+        if (mPos < mJson.size() && mJson[mPos] == '}') {
+          ++mPos;
+          return value;
+        }
+        Fail("expected ',' or '}'");
+      }
+    }
+    if (c == '[') {
+      value.mType = Type::Array;
+      ++mPos;
+      SkipSpace();
+      if (mPos < mJson.size() && mJson[mPos] == ']') {
+        ++mPos;
+        return value;
+      }
+      for (;;) {
+        value.mItems.push_back(ParseValue(depth + 1));
+        SkipSpace();
+        if (mPos < mJson.size() && mJson[mPos] == ',') {
+          ++mPos;
+          continue;
+        }
+        if (mPos < mJson.size() && mJson[mPos] == ']') {
+          ++mPos;
+          return value;
+        }
+        Fail("expected ',' or ']'");
+      }
+    }
+    if (c == '"') {
+      value.mType = Type::String;
+      value.mText = ParseString();
+      return value;
+    }
+    if (Consume("true")) {
+      value.mType = Type::Bool;
+      value.mBool = true;
+      return value;
+    }
+    if (Consume("false")) {
+      value.mType = Type::Bool;
+      return value;
+    }
+    if (Consume("null"))
+      return value;
+    if (c == '-' || (c >= '0' && c <= '9')) {
+      const size_t start = mPos;
+      while (mPos < mJson.size() && (strchr("+-.eE", mJson[mPos]) || (mJson[mPos] >= '0' && mJson[mPos] <= '9')))
+        ++mPos;
+      value.mType = Type::Number;
+      value.mText = mJson.substr(start, mPos - start);
+      char* end = nullptr;
+      strtod(value.mText.c_str(), &end);
+      if (end != value.mText.c_str() + value.mText.size())
+        Fail("malformed number");
+      return value;
+    }
+    Fail("expected a value");
+  }
+
+  unsigned ParseHex4() {
+    if (mPos + 4 > mJson.size())
+      Fail("truncated \\u escape");
+    unsigned code = 0;
+    for (int i = 0; i < 4; ++i, ++mPos) {
+      const char h = mJson[mPos];
+      code <<= 4;
+      if (h >= '0' && h <= '9')
+        code |= h - '0';
+      else if (h >= 'a' && h <= 'f')
+        code |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F')
+        code |= h - 'A' + 10;
+      else
+        Fail("malformed \\u escape");
+    }
+    return code;
+  }
+
+  static void AppendUtf8(string& out, unsigned code) {
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xC0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      out += static_cast<char>(0xE0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (code >> 18));
+      out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  // Called with mPos on the opening quote.
+  string ParseString() {
+    ++mPos;
+    string out;
+    for (;;) {
+      if (mPos >= mJson.size())
+        Fail("unterminated string");
+      const char c = mJson[mPos++];
+      if (c == '"')
+        return out;
+      if (static_cast<unsigned char>(c) < 0x20)
+        Fail("control character in string");
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (mPos >= mJson.size())
+        Fail("unterminated string");
+      const char escaped = mJson[mPos++];
+      switch (escaped) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          unsigned code = ParseHex4();
+          // A high surrogate must be followed by its low half.
+          if (code >= 0xD800 && code < 0xDC00) {
+            if (!Consume("\\u"))
+              Fail("unpaired surrogate");
+            const unsigned low = ParseHex4();
+            if (low < 0xDC00 || low >= 0xE000)
+              Fail("unpaired surrogate");
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          } else if (code >= 0xDC00 && code < 0xE000) {
+            Fail("unpaired surrogate");
+          }
+          AppendUtf8(out, code);
+          break;
+        }
+        default:
+          Fail("unknown escape");
+      }
+    }
+  }
+
+  const string& mJson;
+  size_t mPos;
+};
+
+JsonValue JsonValue::Parse(const string& json) {
+  return Parser(json).ParseDocument();
+}
+
+bool JsonValue::AsBool() const {
+  if (mType != Type::Bool)
+    throw std::invalid_argument("Expected a boolean");
+  return mBool;
+}
+
+int64_t JsonValue::AsInt() const {
+  if (mType != Type::Number || mText.find_first_of(".eE") != string::npos)
+    throw std::invalid_argument("Expected an integer");
+  errno = 0;
+  const long long value = strtoll(mText.c_str(), nullptr, 10);
+  if (errno == ERANGE)
+    throw std::invalid_argument("Integer out of range: " + mText);
+  return static_cast<int64_t>(value);
+}
+
+uint64_t JsonValue::AsUInt() const {
+  const int64_t value = AsInt();
+  if (value < 0)
+    throw std::invalid_argument("Expected a non-negative integer: " + mText);
+  return static_cast<uint64_t>(value);
+}
+
+const string& JsonValue::AsString() const {
+  if (mType != Type::String)
+    throw std::invalid_argument("Expected a string");
+  return mText;
+}
+
+const std::vector<JsonValue>& JsonValue::AsArray() const {
+  if (mType != Type::Array)
+    throw std::invalid_argument("Expected an array");
+  return mItems;
+}
+
+const std::vector<std::pair<string, JsonValue>>& JsonValue::AsObject() const {
+  if (mType != Type::Object)
+    throw std::invalid_argument("Expected an object");
+  return mMembers;
+}
@@ -0,0 +1,73 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_JSON_READER_H_
+#define SAMPLE_FILE_JSON_READER_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Parses a JSON document into a tree of values, for the few exports that take a JSON argument. Documents
+// are small configuration objects, so the reader favours a simple recursive descent over speed. Numbers
+// keep their text, and are converted by the accessor the caller picks.
+class JsonValue {
+public:
+  enum class Type { Null, Bool, Number, String, Array, Object };
+
+  JsonValue() : mType(Type::Null), mBool(false) {}
+
+  // Parses json, which must hold exactly one value. Throws std::invalid_argument naming the offset of
+  // the first error.
+  static JsonValue Parse(const std::string& json);
+
+  Type GetType() const { return mType; }
+  bool IsObject() const { return mType == Type::Object; }
+
+  // Each accessor throws std::invalid_argument when the value has another type, or a number is out of its range.
+  bool AsBool() const;
+  int64_t AsInt() const;
+  // Rejects negative numbers.
+  uint64_t AsUInt() const;
+  const std::string& AsString() const;
+  const std::vector<JsonValue>& AsArray() const;
+  // Members in document order.
+  const std::vector<std::pair<std::string, JsonValue>>& AsObject() const;
+
+private:
+  class Parser;
+
+  Type mType;
+  bool mBool;
+  // The text of a number, or the unescaped string.
+  std::string mText;
+  std::vector<JsonValue> mItems;
+  std::vector<std::pair<std::string, JsonValue>> mMembers;
+};
+
+#endif  // SAMPLE_FILE_JSON_READER_H_
@@ -0,0 +1,225 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "json_writer.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Bytes that must be escaped: quote, backslash and the control characters.
+inline bool NeedsEscape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+}  // namespace
+
+JsonWriter::JsonWriter(size_t reserve)
+    : mAfterKey(false) {
+  mOut.reserve(reserve);
+}
+
+void JsonWriter::BeforeValue() {
+  if (mAfterKey) {
+    mAfterKey = false;
+    return;
+  }
+  if (!mHasValue.empty()) {
+    if (mHasValue.back())
+      mOut += ", ";
+    mHasValue.back() = true;
+  }
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+  BeforeValue();
+  mOut += '{';
+  mHasValue.push_back(false);
+  return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+  mOut += '}';
+  if (!mHasValue.empty())
+    mHasValue.pop_back();
+  return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+  BeforeValue();
+  mOut += '[';
+  mHasValue.push_back(false);
+  return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+  mOut += ']';
+  if (!mHasValue.empty())
+    mHasValue.pop_back();
+  return *this;
+}
+
+JsonWriter& JsonWriter::Key(const char* key) {
+  BeforeValue();
+  mOut += '"';
+  AppendEscaped(mOut, key, strlen(key));
+  mOut += "\": ";
+  mAfterKey = true;
+  return *this;
+}
+
+JsonWriter& JsonWriter::String(const std::string& value) {
+  return String(value.data(), value.size());
+}
+
+JsonWriter& JsonWriter::String(const char* value, size_t size) {
+  BeforeValue();
+  mOut += '"';
+  AppendEscaped(mOut, value, size);
+  mOut += '"';
+  return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+  BeforeValue();
+  mOut += value ? "true" : "false";
+  return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+  BeforeValue();
+  char buffer[24];
+  const int length = snprintf(buffer, sizeof(buffer), "%" PRId64, value);
+  mOut.append(buffer, static_cast<size_t>(length));
+  return *this;
+}
+
+JsonWriter& JsonWriter::UInt(uint64_t value) {
+  BeforeValue();
+  char buffer[24];
+  const int length = snprintf(buffer, sizeof(buffer), "%" PRIu64, value);
+  mOut.append(buffer, static_cast<size_t>(length));
+  return *this;
+}
+
+JsonWriter& JsonWriter::Double(double value) {
+  BeforeValue();
+  // JSON has no literal for NaN or infinity.
+  if (!std::isfinite(value)) {
+    mOut += "null";
+    return *this;
+  }
+  char buffer[32];
+  const int length = snprintf(buffer, sizeof(buffer), "%.17g", value);
+  mOut.append(buffer, static_cast<size_t>(length));
+  return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+  BeforeValue();
+  mOut += "null";
+  return *this;
+}
+
+JsonWriter& JsonWriter::Raw(const std::string& value) {
+  BeforeValue();
+  mOut += value;
+  return *this;
+}
+
+JsonWriter& JsonWriter::RawMembers(const std::string& members) {
+  if (members.empty())
+    return *this;
+  mOut += members;
+  if (!mHasValue.empty())
+    mHasValue.back() = true;
+  return *this;
+}
+
+bool JsonWriter::CopyTo(char* out, size_t cap, size_t* needed) const {
+  const size_t required = mOut.size() + 1;
+  if (needed) *needed = required;
+  if (!out || cap < required)
+    return false;
+  memcpy(out, mOut.c_str(), required);
+  return true;
+}
+
+size_t JsonWriter::FindEscape(const char* data, size_t size) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  // Signed compare against 0x20 would also flag bytes >= 0x80, so bias both sides into signed range first.
+  const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+  const __m128i controlLimit = _mm_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+  for (; i + 16 <= size; i += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const __m128i hits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+        _mm_cmplt_epi8(_mm_xor_si128(chunk, bias), controlLimit));
+    const int mask = _mm_movemask_epi8(hits);
+    if (mask != 0)
+      return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+  }
+#endif
+  for (; i < size; ++i) {
+    if (NeedsEscape(static_cast<unsigned char>(data[i])))
+      return i;
+  }
+  return size;
+}
+
+void JsonWriter::AppendEscaped(std::string& out, const char* data, size_t size) {
+  static const char kHex[] = "0123456789abcdef";
+  size_t start = 0;
+  while (start < size) {
+    const size_t hit = start + FindEscape(data + start, size - start);
+    out.append(data + start, hit - start);
+    if (hit == size)
+      break;
+    const unsigned char c = static_cast<unsigned char>(data[hit]);
+    switch (c) {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      out += "\\u00";
+      out += kHex[c >> 4];
+      out += kHex[c & 0xF];
+    }
+    start = hit + 1;
+  }
+}
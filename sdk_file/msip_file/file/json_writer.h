@@ -0,0 +1,89 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_JSON_WRITER_H_
+#define SAMPLE_FILE_JSON_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Builds a JSON document by appending to one string, escaping as it goes. Separators are tracked per open
+// object or array, so callers write keys and values in order without managing commas. String values are
+// scanned for characters that need escaping sixteen bytes at a time where SSE2 is available, and copied in
+// whole runs between them, so long error messages and label listings serialize in one linear pass.
+class JsonWriter {
+public:
+  explicit JsonWriter(size_t reserve = 256);
+
+  JsonWriter& BeginObject();
+  JsonWriter& EndObject();
+  JsonWriter& BeginArray();
+  JsonWriter& EndArray();
+
+  // Writes the key of the next object member.
+  JsonWriter& Key(const char* key);
+
+  JsonWriter& String(const std::string& value);
+  JsonWriter& String(const char* value, size_t size);
+  JsonWriter& Bool(bool value);
+  JsonWriter& Int(int64_t value);
+  JsonWriter& UInt(uint64_t value);
+  JsonWriter& Double(double value);
+  JsonWriter& Null();
+
+  // Writes value, which must already be valid JSON, as the next value.
+  JsonWriter& Raw(const std::string& value);
+
+  // Appends raw ", \"name\": value" member text to the open object, for callers that assemble fields
+  // elsewhere.
+  JsonWriter& RawMembers(const std::string& members);
+
+  const std::string& Str() const { return mOut; }
+  std::string Take() { return std::move(mOut); }
+
+  // Copies the document and its terminator into out when cap allows. Sets needed to the bytes required
+  // either way, and returns whether it fit.
+  bool CopyTo(char* out, size_t cap, size_t* needed) const;
+
+  // Appends the escaped form of data, without quotes, to out.
+  static void AppendEscaped(std::string& out, const char* data, size_t size);
+
+  // Returns the offset of the first byte in data that needs escaping, or size when there is none.
+  static size_t FindEscape(const char* data, size_t size);
+
+private:
+  void BeforeValue();
+
+  std::string mOut;
+  // One entry per open object or array: whether a value has been written into it yet.
+  std::vector<bool> mHasValue;
+  bool mAfterKey;
+};
+
+#endif  // SAMPLE_FILE_JSON_WRITER_H_
@@ -0,0 +1,295 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "known_clean_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "content_hash.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace {
+
+// A block is one cache line, so a lookup or addition touches a single line.
+const size_t kBlockWords = 8;
+const unsigned kBlockBitShift = 9;
+// Bit positions come 9 bits at a time from one 64-bit hash.
+const unsigned kMaxHashes = 7;
+const char kMagic[8] = { 'M', 'S', 'I', 'P', 'K', 'C', 'F', '1' };
+
+int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64's finalizer, for bit positions independent of the block the key picked.
+uint64_t Mix(uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+size_t BlockOf(uint64_t key, size_t blocks) {
+  return static_cast<size_t>((static_cast<unsigned __int128>(key) * blocks) >> 64);
+}
+
+template <typename T>
+bool ReadValue(std::istream& in, T& value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+void WriteValue(std::ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+} // namespace
+
+KnownCleanFilter::Generation::Generation(size_t count)
+    : wordCount(count), words(new std::atomic<uint64_t>[count]()), keys(0), startedAt(Now()) {}
+
+KnownCleanFilter::KnownCleanFilter()
+    : mSettings(),
+      mFilter(),
+      mEnabled(false),
+      mPositives(0),
+      mHits(0),
+      mMisses(0),
+      mVerified(0),
+      mFalsePositives(0),
+      mRotations(0) {}
+
+bool KnownCleanFilter::Configure(const Settings& settings) {
+  if (settings.capacity > 0 && !(settings.falsePositiveRate > 0 && settings.falsePositiveRate <= 0.5))
+    throw std::invalid_argument("The known-clean false positive rate must be above 0 and at most 0.5");
+  Filter filter = Filter();
+  bool loaded = false;
+  if (settings.capacity > 0) {
+    const double ln2 = std::log(2.0);
+    const double bitsPerKey = -std::log(settings.falsePositiveRate) / (ln2 * ln2);
+    filter.blocks = std::max<size_t>(1, static_cast<size_t>(std::ceil(settings.capacity * bitsPerKey / (kBlockWords * 64))));
+    filter.hashes = std::min(kMaxHashes, std::max(1u, static_cast<unsigned>(std::lround(bitsPerKey * ln2))));
+    filter.verifyOneIn = settings.verifyOneIn;
+    if (!settings.path.empty())
+      loaded = Read(settings.path, filter);
+    if (!loaded) {
+      filter.current = std::make_shared<Generation>(filter.blocks * kBlockWords);
+      filter.previous = nullptr;
+    }
+  }
+  lock_guard<mutex> lock(mMutex);
+  mSettings = settings;
+  mFilter = filter;
+  mEnabled = settings.capacity > 0;
+  return loaded;
+}
+
+KnownCleanFilter::Filter KnownCleanFilter::Acquire() {
+  lock_guard<mutex> lock(mMutex);
+  if (mFilter.current && mSettings.maxAge.count() > 0 && 2 * (Now() - mFilter.current->startedAt) >= mSettings.maxAge.count()) {
+    mFilter.previous = std::move(mFilter.current);
+    mFilter.current = std::make_shared<Generation>(mFilter.blocks * kBlockWords);
+    ++mRotations;
+  }
+  return mFilter;
+}
+
+KnownCleanFilter::Answer KnownCleanFilter::Lookup(uint64_t key) {
+  if (key == 0 || !IsEnabled())
+    return Answer::Unknown;
+  const Filter filter = Acquire();
+  if (!filter.current)
+    return Answer::Unknown;
+  const size_t first = BlockOf(key, filter.blocks) * kBlockWords;
+  const uint64_t bits = Mix(key);
+  auto contains = [&](const Generation* generation) {
+    if (!generation)
+      return false;
+    for (unsigned i = 0; i < filter.hashes; ++i) {
+      const unsigned bit = (bits >> (i * kBlockBitShift)) & ((1u << kBlockBitShift) - 1);
+      if (!(generation->words[first + bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))))
+        return false;
+    }
+    return true;
+  };
+  if (!contains(filter.current.get()) && !contains(filter.previous.get())) {
+    ++mMisses;
+    return Answer::Unknown;
+  }
+  const uint64_t positive = ++mPositives;
+  if (filter.verifyOneIn > 0 && positive % filter.verifyOneIn == 0) {
+    ++mVerified;
+    return Answer::Verify;
+  }
+  ++mHits;
+  return Answer::Clean;
+}
+
+void KnownCleanFilter::Record(uint64_t key, bool clean, Answer answer) {
+  if (key == 0 || !IsEnabled())
+    return;
+  if (!clean) {
+    if (answer == Answer::Verify)
+      ++mFalsePositives;
+    return;
+  }
+  const Filter filter = Acquire();
+  if (!filter.current)
+    return;
+  const size_t first = BlockOf(key, filter.blocks) * kBlockWords;
+  const uint64_t bits = Mix(key);
+  for (unsigned i = 0; i < filter.hashes; ++i) {
+    const unsigned bit = (bits >> (i * kBlockBitShift)) & ((1u << kBlockBitShift) - 1);
+    filter.current->words[first + bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+  }
+  ++filter.current->keys;
+}
+
+bool KnownCleanFilter::Save() {
+  string path;
+  Filter filter;
+  {
+    lock_guard<mutex> lock(mMutex);
+    path = mSettings.path;
+    filter = mFilter;
+  }
+  if (path.empty() || !filter.current)
+    return false;
+
+  // Additions racing the write land in it or not; either way the bits written were all set.
+  const string temporary = path + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(kMagic, sizeof(kMagic));
+    WriteValue(out, static_cast<uint64_t>(filter.blocks));
+    WriteValue(out, static_cast<uint32_t>(filter.hashes));
+    WriteValue(out, static_cast<uint32_t>(filter.previous ? 2 : 1));
+    std::vector<uint64_t> chunk;
+    for (const Generation* generation : { filter.current.get(), filter.previous.get() }) {
+      if (!generation)
+        continue;
+      WriteValue(out, generation->startedAt);
+      WriteValue(out, generation->keys.load());
+      for (size_t begin = 0; begin < generation->wordCount; begin += 8192) {
+        const size_t end = std::min(generation->wordCount, begin + 8192);
+        chunk.resize(end - begin);
+        for (size_t i = begin; i < end; ++i)
+          chunk[i - begin] = generation->words[i].load(std::memory_order_relaxed);
+        out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(uint64_t));
+      }
+    }
+    out.flush();
+    if (!out) {
+      out.close();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+void KnownCleanFilter::Clear() {
+  lock_guard<mutex> lock(mMutex);
+  if (!mFilter.current)
+    return;
+  mFilter.current = std::make_shared<Generation>(mFilter.blocks * kBlockWords);
+  mFilter.previous = nullptr;
+}
+
+bool KnownCleanFilter::Read(const string& path, Filter& filter) const {
+  std::ifstream in(path, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  uint64_t blocks = 0;
+  uint32_t hashes = 0;
+  uint32_t generations = 0;
+  if (!in || !in.read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !ReadValue(in, blocks) || !ReadValue(in, hashes) || !ReadValue(in, generations))
+    return false;
+  // Another capacity or rate maps keys to other bits, so its filter cannot be reused.
+  if (blocks != filter.blocks || hashes != filter.hashes || generations < 1 || generations > 2)
+    return false;
+  std::shared_ptr<Generation> read[2];
+  for (uint32_t g = 0; g < generations; ++g) {
+    auto generation = std::make_shared<Generation>(filter.blocks * kBlockWords);
+    uint64_t keys = 0;
+    if (!ReadValue(in, generation->startedAt) || !ReadValue(in, keys))
+      return false;
+    generation->keys = keys;
+    std::vector<uint64_t> chunk;
+    for (size_t begin = 0; begin < generation->wordCount; begin += 8192) {
+      const size_t end = std::min(generation->wordCount, begin + 8192);
+      chunk.resize(end - begin);
+      if (!in.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(uint64_t)))
+        return false;
+      for (size_t i = begin; i < end; ++i)
+        generation->words[i].store(chunk[i - begin], std::memory_order_relaxed);
+    }
+    read[g] = std::move(generation);
+  }
+  filter.current = std::move(read[0]);
+  filter.previous = std::move(read[1]);
+  return true;
+}
+
+KnownCleanFilter::Stats KnownCleanFilter::GetStats() const {
+  Stats stats = Stats();
+  {
+    lock_guard<mutex> lock(mMutex);
+    stats.enabled = mFilter.current != nullptr;
+    stats.capacity = mSettings.capacity;
+    if (mFilter.current) {
+      stats.bytes = mFilter.current->wordCount * sizeof(uint64_t) * (mFilter.previous ? 2 : 1);
+      stats.keys = mFilter.current->keys.load();
+    }
+  }
+  stats.hits = mHits.load();
+  stats.misses = mMisses.load();
+  stats.verified = mVerified.load();
+  stats.falsePositives = mFalsePositives.load();
+  stats.rotations = mRotations.load();
+  return stats;
+}
+
+uint64_t KnownCleanFilter::ObjectKey(const string& etag, int64_t size) {
+  if (etag.empty())
+    return 0;
+  const uint64_t key = XxHash64(reinterpret_cast<const uint8_t*>(etag.data()), etag.size(), static_cast<uint64_t>(size));
+  return key != 0 ? key : 1;
+}
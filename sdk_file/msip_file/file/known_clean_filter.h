@@ -0,0 +1,140 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_KNOWN_CLEAN_FILTER_H_
+#define SAMPLE_FILE_KNOWN_CLEAN_FILTER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Blocked Bloom filter of content keys whose probe found them unprotected, unlabeled and without protected
+// objects, so a repeat of the same content skips the probe wherever a hash of all of it is at hand. Keys
+// live in two generations: lookups test both, additions go to the current one, and once it is half of
+// maxAge old the previous one is dropped, so every key is probed again within maxAge. One positive answer
+// in verifyOneIn is probed anyway, which bounds how long a false positive goes unnoticed and counts them.
+// Disabled (capacity 0) until configured.
+class KnownCleanFilter final {
+public:
+  enum class Answer {
+    Unknown,
+    Clean,
+    // In the filter, but chosen to be probed again.
+    Verify,
+  };
+
+  struct Settings {
+    // Keys each generation holds at falsePositiveRate; more raise the rate.
+    size_t capacity;
+    double falsePositiveRate;
+    // 0 keeps keys until the filter is reconfigured.
+    std::chrono::seconds maxAge;
+    // 0 never probes a positive answer.
+    uint32_t verifyOneIn;
+    // Where Save writes the filter and Configure reads it back; empty keeps it in memory only.
+    std::string path;
+  };
+
+  struct Stats {
+    bool enabled;
+    size_t capacity;
+    uint64_t bytes;
+    // Keys added to the current generation, repeats included.
+    uint64_t keys;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t verified;
+    uint64_t falsePositives;
+    uint64_t rotations;
+  };
+
+  KnownCleanFilter();
+
+  // Replaces the filter with an empty one, or with the one saved at settings.path when it was saved with
+  // the same capacity and rate. Returns true when it was read back. Throws std::invalid_argument for a
+  // rate outside (0, 0.5].
+  bool Configure(const Settings& settings);
+
+  bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+  Answer Lookup(uint64_t key);
+  // Records what probing key found after answer: clean content is added, and content a Verify answer
+  // found not clean counts as a false positive.
+  void Record(uint64_t key, bool clean, Answer answer);
+
+  // Writes the filter to its path, through a temporary file renamed over it. False when it has no path or
+  // the write fails.
+  bool Save();
+
+  // Empties the filter, keeping its settings.
+  void Clear();
+
+  Stats GetStats() const;
+
+  // Key of an object's entity tag with the content's size. 0 when there is no tag, which Lookup never
+  // finds. A head and tail fingerprint such as InspectionCache's is no key: it misses changes in between.
+  static uint64_t ObjectKey(const std::string& etag, int64_t size);
+
+private:
+  struct Generation {
+    explicit Generation(size_t wordCount);
+
+    const size_t wordCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    std::atomic<uint64_t> keys;
+    // Seconds since the epoch, so that a saved generation keeps its age.
+    int64_t startedAt;
+  };
+
+  struct Filter {
+    size_t blocks;
+    unsigned hashes;
+    uint32_t verifyOneIn;
+    std::shared_ptr<Generation> current;
+    std::shared_ptr<Generation> previous;
+  };
+
+  // The filter, after rotating its generations when the current one is due.
+  Filter Acquire();
+  bool Read(const std::string& path, Filter& filter) const;
+
+  mutable std::mutex mMutex;
+  Settings mSettings;
+  Filter mFilter;
+  std::atomic<bool> mEnabled;
+  std::atomic<uint64_t> mPositives;
+  std::atomic<uint64_t> mHits;
+  std::atomic<uint64_t> mMisses;
+  std::atomic<uint64_t> mVerified;
+  std::atomic<uint64_t> mFalsePositives;
+  std::atomic<uint64_t> mRotations;
+};
+
+#endif // SAMPLE_FILE_KNOWN_CLEAN_FILTER_H_
@@ -0,0 +1,306 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "label_action_planner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <vector>
+
+#include "json_writer.h"
+#include "mip/upe/action.h"
+#include "mip/upe/add_content_footer_action.h"
+#include "mip/upe/add_content_header_action.h"
+#include "mip/upe/add_watermark_action.h"
+#include "mip/upe/apply_label_action.h"
+#include "mip/upe/custom_action.h"
+#include "mip/upe/execution_state.h"
+#include "mip/upe/label.h"
+#include "mip/upe/metadata_action.h"
+#include "mip/upe/metadata_entry.h"
+#include "mip/upe/protect_by_encrypt_only_action.h"
+#include "mip/upe/protect_by_template_action.h"
+#include "mip/upe/recommend_label_action.h"
+
+using mip::Action;
+using mip::ActionType;
+using mip::AssignmentMethod;
+using mip::Label;
+using mip::MetadataEntry;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+const unsigned int kAllActions = (1u << 21) - 1;
+
+const unsigned int kProtectingActions = static_cast<unsigned int>(ActionType::PROTECT_ADHOC) |
+    static_cast<unsigned int>(ActionType::PROTECT_BY_TEMPLATE) | static_cast<unsigned int>(ActionType::PROTECT_DO_NOT_FORWARD) |
+    static_cast<unsigned int>(ActionType::PROTECT_ADHOC_DK) | static_cast<unsigned int>(ActionType::PROTECT_DO_NOT_FORWARD_DK) |
+    static_cast<unsigned int>(ActionType::PROTECT_BY_ENCRYPT_ONLY);
+
+// Content that carries priorLabel, if any, and is given label with method. The prior label is described
+// by the metadata a labeled file holds, so the handler computes the same removals and justification a
+// file with it would get.
+class PlanningExecutionState final : public mip::ExecutionState {
+public:
+  PlanningExecutionState(const shared_ptr<Label>& label, const shared_ptr<Label>& priorLabel, const string& tenantId,
+      const string& contentFormat, AssignmentMethod method)
+      : mLabel(label), mContentFormat(contentFormat), mMethod(method) {
+    if (!priorLabel)
+      return;
+    const string prefix = "MSIP_Label_" + priorLabel->GetId() + "_";
+    mMetadata.emplace_back(prefix + "Enabled", "true");
+    // A fixed date: actions never depend on when the prior label was set.
+    mMetadata.emplace_back(prefix + "SetDate", "2000-01-01T00:00:00Z");
+    mMetadata.emplace_back(prefix + "Method", "Standard");
+    mMetadata.emplace_back(prefix + "Name", priorLabel->GetName());
+    mMetadata.emplace_back(prefix + "SiteId", tenantId);
+    mMetadata.emplace_back(prefix + "ActionId", "00000000-0000-0000-0000-000000000000");
+    mMetadata.emplace_back(prefix + "ContentBits", "0");
+  }
+
+  shared_ptr<Label> GetNewLabel() const override { return mLabel; }
+  string GetContentIdentifier() const override { return "label-action-plan"; }
+  std::pair<bool, string> IsDowngradeJustified() const override { return std::make_pair(false, string()); }
+  AssignmentMethod GetNewLabelAssignmentMethod() const override { return mMethod; }
+
+  vector<MetadataEntry> GetContentMetadata(const vector<string>& names, const vector<string>& namePrefixes) const override {
+    if (names.empty() && namePrefixes.empty())
+      return mMetadata;
+    vector<MetadataEntry> matching;
+    for (const auto& entry : mMetadata) {
+      const string& key = entry.GetKey();
+      const bool named = std::find(names.begin(), names.end(), key) != names.end();
+      const bool prefixed = std::any_of(namePrefixes.begin(), namePrefixes.end(), [&key](const string& prefix) {
+        return key.compare(0, prefix.size(), prefix) == 0;
+      });
+      if (named || prefixed)
+        matching.push_back(entry);
+    }
+    return matching;
+  }
+
+  shared_ptr<mip::ProtectionDescriptor> GetProtectionDescriptor() const override { return nullptr; }
+  string GetContentFormat() const override { return mContentFormat; }
+  ActionType GetSupportedActions() const override { return static_cast<ActionType>(kAllActions); }
+
+private:
+  const shared_ptr<Label> mLabel;
+  const string mContentFormat;
+  const AssignmentMethod mMethod;
+  vector<MetadataEntry> mMetadata;
+};
+
+const char* ActionTypeName(ActionType type) {
+  switch (type) {
+    case ActionType::ADD_CONTENT_FOOTER: return "add_content_footer";
+    case ActionType::ADD_CONTENT_HEADER: return "add_content_header";
+    case ActionType::ADD_WATERMARK: return "add_watermark";
+    case ActionType::CUSTOM: return "custom";
+    case ActionType::JUSTIFY: return "justify";
+    case ActionType::METADATA: return "metadata";
+    case ActionType::PROTECT_ADHOC: return "protect_adhoc";
+    case ActionType::PROTECT_BY_TEMPLATE: return "protect_by_template";
+    case ActionType::PROTECT_DO_NOT_FORWARD: return "protect_do_not_forward";
+    case ActionType::REMOVE_CONTENT_FOOTER: return "remove_content_footer";
+    case ActionType::REMOVE_CONTENT_HEADER: return "remove_content_header";
+    case ActionType::REMOVE_PROTECTION: return "remove_protection";
+    case ActionType::REMOVE_WATERMARK: return "remove_watermark";
+    case ActionType::APPLY_LABEL: return "apply_label";
+    case ActionType::RECOMMEND_LABEL: return "recommend_label";
+    case ActionType::PROTECT_ADHOC_DK: return "protect_adhoc_dk";
+    case ActionType::PROTECT_DO_NOT_FORWARD_DK: return "protect_do_not_forward_dk";
+    case ActionType::PROTECT_BY_ENCRYPT_ONLY: return "protect_by_encrypt_only";
+    case ActionType::ADD_DYNAMIC_WATERMARK: return "add_dynamic_watermark";
+    case ActionType::REMOVE_DYNAMIC_WATERMARK: return "remove_dynamic_watermark";
+  }
+  return "unknown";
+}
+
+const char* AlignmentName(mip::ContentMarkAlignment alignment) {
+  switch (alignment) {
+    case mip::ContentMarkAlignment::RIGHT: return "right";
+    case mip::ContentMarkAlignment::CENTER: return "center";
+    default: return "left";
+  }
+}
+
+template <typename Marking>
+void AppendMarking(JsonWriter& json, const Marking& marking) {
+  json.Key("text").String(marking.GetText())
+      .Key("font_name").String(marking.GetFontName())
+      .Key("font_size").Int(marking.GetFontSize())
+      .Key("font_color").String(marking.GetFontColor())
+      .Key("alignment").String(AlignmentName(marking.GetAlignment()))
+      .Key("margin").Int(marking.GetMargin());
+}
+
+void AppendAction(JsonWriter& json, const Action& action) {
+  const ActionType type = action.GetType();
+  json.BeginObject().Key("type").String(ActionTypeName(type));
+  switch (type) {
+    case ActionType::ADD_CONTENT_FOOTER:
+      AppendMarking(json, static_cast<const mip::AddContentFooterAction&>(action));
+      break;
+    case ActionType::ADD_CONTENT_HEADER:
+      AppendMarking(json, static_cast<const mip::AddContentHeaderAction&>(action));
+      break;
+    case ActionType::ADD_WATERMARK: {
+      const auto& watermark = static_cast<const mip::AddWatermarkAction&>(action);
+      json.Key("text").String(watermark.GetText())
+          .Key("font_name").String(watermark.GetFontName())
+          .Key("font_size").Int(watermark.GetFontSize())
+          .Key("font_color").String(watermark.GetFontColor())
+          .Key("layout").String(watermark.GetLayout() == mip::WatermarkLayout::DIAGONAL ? "diagonal" : "horizontal");
+      break;
+    }
+    case ActionType::METADATA: {
+      const auto& metadata = static_cast<const mip::MetadataAction&>(action);
+      json.Key("add").BeginArray();
+      for (const auto& entry : metadata.GetMetadataToAdd())
+        json.BeginObject().Key("key").String(entry.GetKey()).Key("value").String(entry.GetValue()).EndObject();
+      json.EndArray().Key("remove").BeginArray();
+      for (const auto& name : metadata.GetMetadataToRemove())
+        json.String(name);
+      json.EndArray();
+      break;
+    }
+    case ActionType::PROTECT_BY_TEMPLATE:
+      json.Key("template_id").String(static_cast<const mip::ProtectByTemplateAction&>(action).GetTemplateId());
+      break;
+    case ActionType::PROTECT_BY_ENCRYPT_ONLY:
+      json.Key("template_id").String(static_cast<const mip::ProtectByEncryptOnlyAction&>(action).GetTemplateId());
+      break;
+    case ActionType::CUSTOM: {
+      const auto& custom = static_cast<const mip::CustomAction&>(action);
+      json.Key("name").String(custom.GetName()).Key("properties").BeginObject();
+      for (const auto& property : custom.GetProperties())
+        json.Key(property.first.c_str()).String(property.second);
+      json.EndObject();
+      break;
+    }
+    case ActionType::APPLY_LABEL: {
+      const auto& label = static_cast<const mip::ApplyLabelAction&>(action).GetLabel();
+      json.Key("label_id").String(label ? label->GetId() : "");
+      break;
+    }
+    case ActionType::RECOMMEND_LABEL: {
+      const auto& label = static_cast<const mip::RecommendLabelAction&>(action).GetLabel();
+      json.Key("label_id").String(label ? label->GetId() : "");
+      break;
+    }
+    default:
+      break;
+  }
+  json.EndObject();
+}
+
+string Lower(string value) {
+  std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return value;
+}
+
+} // namespace
+
+const size_t LabelActionPlanner::kMaxPlans;
+
+LabelActionPlanner::LabelActionPlanner(const shared_ptr<mip::PolicyEngine>& engine)
+    : mEngine(engine) {}
+
+string LabelActionPlanner::MakeKey(const string& labelId, const string& priorLabelId, const string& contentFormat, AssignmentMethod method) {
+  return Lower(labelId) + '\n' + Lower(priorLabelId) + '\n' + Lower(contentFormat) + '\n' + std::to_string(static_cast<unsigned int>(method));
+}
+
+shared_ptr<const LabelActionPlanner::Plan> LabelActionPlanner::Compute(
+    const string& labelId, const string& priorLabelId, const string& contentFormat, AssignmentMethod method, bool& cached) {
+  const string key = MakeKey(labelId, priorLabelId, contentFormat, method);
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mPlans.find(key);
+    if (it != mPlans.end()) {
+      cached = true;
+      return it->second;
+    }
+  }
+  cached = false;
+
+  auto label = mEngine->GetLabelById(labelId);
+  if (!label)
+    throw std::invalid_argument("Label not found: " + labelId);
+  shared_ptr<Label> priorLabel;
+  if (!priorLabelId.empty()) {
+    priorLabel = mEngine->GetLabelById(priorLabelId);
+    if (!priorLabel)
+      throw std::invalid_argument("Label not found: " + priorLabelId);
+  }
+  const PlanningExecutionState state(label, priorLabel, mEngine->GetTenantId(), contentFormat, method);
+  vector<shared_ptr<Action>> actions;
+  {
+    lock_guard<mutex> lock(mHandlerMutex);
+    if (!mHandler)
+      mHandler = mEngine->CreatePolicyHandler(false /*isAuditDiscoveryEnabled*/);
+    actions = mHandler->ComputeActions(state);
+  }
+
+  auto plan = std::make_shared<Plan>();
+  plan->types = 0;
+  JsonWriter json(128 * (actions.size() + 1));
+  json.BeginArray();
+  for (const auto& action : actions) {
+    if (!action)
+      continue;
+    plan->types |= static_cast<unsigned int>(action->GetType());
+    AppendAction(json, *action);
+  }
+  json.EndArray();
+  plan->actions = json.Take();
+
+  lock_guard<mutex> lock(mMutex);
+  if (mPlans.size() >= kMaxPlans)
+    mPlans.clear();
+  return mPlans.emplace(key, std::move(plan)).first->second;
+}
+
+shared_ptr<const LabelActionPlanner::Plan> LabelActionPlanner::Find(
+    const string& labelId, const string& priorLabelId, const string& contentFormat, AssignmentMethod method) const {
+  const string key = MakeKey(labelId, priorLabelId, contentFormat, method);
+  lock_guard<mutex> lock(mMutex);
+  auto it = mPlans.find(key);
+  return it != mPlans.end() ? it->second : nullptr;
+}
+
+bool LabelActionPlanner::Protects(const Plan& plan) {
+  return (plan.types & kProtectingActions) != 0;
+}
+
+bool LabelActionPlanner::NeedsJustification(const Plan& plan) {
+  return (plan.types & static_cast<unsigned int>(ActionType::JUSTIFY)) != 0;
+}
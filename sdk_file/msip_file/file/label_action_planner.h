@@ -0,0 +1,85 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_LABEL_ACTION_PLANNER_H_
+#define SAMPLE_FILE_LABEL_ACTION_PLANNER_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "mip/common_types.h"
+#include "mip/upe/policy_engine.h"
+#include "mip/upe/policy_handler.h"
+
+// What applying a label does to content, computed by a PolicyEngine's handler from a synthetic execution
+// state instead of from a file. The actions depend only on the label, the label the content carries now,
+// the content format and the assignment method, so each combination is computed once and kept. Content
+// is taken to be unprotected: a plan says nothing about the protection a file carries now.
+class LabelActionPlanner final {
+public:
+  struct Plan {
+    // JSON array of the actions, each an object with its "type" and details.
+    std::string actions;
+    // mip::ActionType bits of the actions.
+    unsigned int types;
+  };
+
+  // Plans kept; past it the oldest computations are dropped all at once.
+  static const size_t kMaxPlans = 4096;
+
+  explicit LabelActionPlanner(const std::shared_ptr<mip::PolicyEngine>& engine);
+
+  // The plan for labeling content that carries priorLabelId (empty for none) with labelId. Throws
+  // std::invalid_argument for a label the engine does not know, and what the handler throws; nothing
+  // is kept then. cached tells whether the plan had been computed before.
+  std::shared_ptr<const Plan> Compute(const std::string& labelId, const std::string& priorLabelId,
+      const std::string& contentFormat, mip::AssignmentMethod method, bool& cached);
+
+  // The plan Compute kept for these, or nullptr, without computing it.
+  std::shared_ptr<const Plan> Find(const std::string& labelId, const std::string& priorLabelId,
+      const std::string& contentFormat, mip::AssignmentMethod method) const;
+
+  static bool Changes(const Plan& plan) { return plan.types != 0; }
+  static bool Protects(const Plan& plan);
+  static bool NeedsJustification(const Plan& plan);
+
+private:
+  static std::string MakeKey(const std::string& labelId, const std::string& priorLabelId,
+      const std::string& contentFormat, mip::AssignmentMethod method);
+
+  const std::shared_ptr<mip::PolicyEngine> mEngine;
+  // Whether ComputeActions may run concurrently is not documented, so computations take turns.
+  std::mutex mHandlerMutex;
+  std::shared_ptr<mip::PolicyHandler> mHandler;
+
+  mutable std::mutex mMutex;
+  std::unordered_map<std::string, std::shared_ptr<const Plan>> mPlans;
+};
+
+#endif // SAMPLE_FILE_LABEL_ACTION_PLANNER_H_
@@ -0,0 +1,99 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "label_index.h"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using mip::Label;
+
+LabelIndex::LabelIndex(const vector<shared_ptr<Label>>& labels) {
+  for (const auto& label : labels)
+    Add(label, kNoParent, 0);
+
+  mById.reserve(mRecords.size());
+  mByName.reserve(mRecords.size() * 2);
+  for (uint32_t i = 0; i < mRecords.size(); ++i) {
+    const auto& record = mRecords[i];
+    mById.emplace(record.id, i);
+    // emplace keeps the first entry, which gives names their documented pre-order precedence.
+    mByName.emplace(Fold(record.name), i);
+    if (record.parent != kNoParent)
+      mByName.emplace(Fold(record.path), i);
+  }
+}
+
+const LabelIndex::Record* LabelIndex::FindById(const string& id) const {
+  auto it = mById.find(id);
+  return it == mById.end() ? nullptr : &mRecords[it->second];
+}
+
+const LabelIndex::Record* LabelIndex::FindByName(const string& name) const {
+  auto it = mByName.find(Fold(name));
+  return it == mByName.end() ? nullptr : &mRecords[it->second];
+}
+
+const LabelIndex::Record* LabelIndex::Find(const string& idOrName) const {
+  const auto* record = FindById(idOrName);
+  return record ? record : FindByName(idOrName);
+}
+
+void LabelIndex::Add(const shared_ptr<Label>& label, int32_t parent, uint32_t depth) {
+  if (!label)
+    return;
+  Record record;
+  record.id = label->GetId();
+  record.name = label->GetName();
+  record.path = parent == kNoParent ? record.name : mRecords[parent].path + "\\" + record.name;
+  record.description = label->GetDescription();
+  record.color = label->GetColor();
+  record.tooltip = label->GetTooltip();
+  record.parent = parent;
+  record.depth = depth;
+  record.childCount = static_cast<uint32_t>(label->GetChildren().size());
+  record.sensitivity = label->GetSensitivity();
+  record.active = label->IsActive();
+  record.doubleKey = !label->GetDoubleKeyUrl().empty();
+  record.label = label;
+
+  const auto index = static_cast<int32_t>(mRecords.size());
+  mRecords.push_back(std::move(record));
+  for (const auto& child : label->GetChildren())
+    Add(child, index, depth + 1);
+}
+
+string LabelIndex::Fold(const string& value) {
+  string folded(value);
+  std::transform(folded.begin(), folded.end(), folded.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return folded;
+}
@@ -0,0 +1,86 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_LABEL_INDEX_H_
+#define SAMPLE_FILE_LABEL_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mip/upe/label.h"
+
+// Immutable snapshot of an engine's sensitivity label tree, flattened in pre-order so a parent always
+// precedes its children. Built once when the engine is loaded; lookups by id or name are hash-map hits
+// and never walk the tree or call into the SDK. Safe to share between threads.
+class LabelIndex final {
+public:
+  static const int32_t kNoParent = -1;
+
+  struct Record {
+    std::string id;
+    std::string name;
+    // "Parent\Child" for sublabels, the name otherwise.
+    std::string path;
+    std::string description;
+    std::string color;
+    std::string tooltip;
+    int32_t parent;
+    uint32_t depth;
+    uint32_t childCount;
+    int sensitivity;
+    bool active;
+    // The label's protection needs a second key from a double key encryption service.
+    bool doubleKey;
+    std::shared_ptr<mip::Label> label;
+  };
+
+  explicit LabelIndex(const std::vector<std::shared_ptr<mip::Label>>& labels);
+
+  const std::vector<Record>& GetRecords() const { return mRecords; }
+
+  // nullptr when no label has that id.
+  const Record* FindById(const std::string& id) const;
+
+  // Matches a name or a "Parent\Child" path, ignoring ASCII case. A name shared by sublabels of
+  // different parents resolves to the first in pre-order; use the path to pick another.
+  const Record* FindByName(const std::string& name) const;
+
+  // FindById, then FindByName.
+  const Record* Find(const std::string& idOrName) const;
+
+private:
+  void Add(const std::shared_ptr<mip::Label>& label, int32_t parent, uint32_t depth);
+  static std::string Fold(const std::string& value);
+
+  std::vector<Record> mRecords;
+  std::unordered_map<std::string, uint32_t> mById;
+  std::unordered_map<std::string, uint32_t> mByName;
+};
+
+#endif // SAMPLE_FILE_LABEL_INDEX_H_
@@ -0,0 +1,319 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "label_metadata.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "xml_scanner.h"
+
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace {
+
+const char kLabelPrefix[] = "MSIP_Label_";
+const size_t kLabelPrefixLength = sizeof(kLabelPrefix) - 1;
+// Of files that are not zips, the range at each end scanned for entries.
+const int64_t kScanBytes = 1024 * 1024;
+// Metadata parts larger than this are not metadata.
+const uint32_t kMaxPartBytes = 16 * 1024 * 1024;
+const uint32_t kMaxCentralDirectoryBytes = 64 * 1024 * 1024;
+
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const size_t kLocalHeaderSize = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfCentralDirectorySize = 22;
+const uint16_t kStored = 0;
+const uint16_t kDeflated = 8;
+
+const char kCustomPropertiesPart[] = "docProps/custom.xml";
+const char kLabelInfoPart[] = "docMetadata/LabelInfo.xml";
+
+uint16_t ReadLe16(const uint8_t* data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLe32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool EqualsIgnoreCase(const string& a, const char* b) {
+  const size_t size = strlen(b);
+  if (a.size() != size)
+    return false;
+  for (size_t i = 0; i < size; ++i) {
+    if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+      return false;
+  }
+  return true;
+}
+
+// length bytes at offset, fewer at the end of the stream.
+vector<uint8_t> ReadAt(mip::Stream& stream, int64_t offset, size_t length) {
+  vector<uint8_t> data(length);
+  stream.Seek(offset);
+  size_t done = 0;
+  while (done < length) {
+    const int64_t count = stream.Read(data.data() + done, static_cast<int64_t>(length - done));
+    if (count <= 0)
+      break;
+    done += static_cast<size_t>(count);
+  }
+  data.resize(done);
+  return data;
+}
+
+bool Inflate(const uint8_t* data, size_t size, size_t expected, string& out) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    return false;
+  out.resize(expected);
+  zs.next_in = const_cast<Bytef*>(data);
+  zs.avail_in = static_cast<uInt>(size);
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = static_cast<uInt>(expected);
+  const int status = expected ? inflate(&zs, Z_FINISH) : Z_STREAM_END;
+  out.resize(zs.total_out);
+  inflateEnd(&zs);
+  return status == Z_STREAM_END;
+}
+
+// <property name="MSIP_Label_<id>_Enabled" ...><vt:lpwstr>true</vt:lpwstr></property>
+void ParseCustomProperties(const string& xml, vector<pair<string, string>>& entries) {
+  XmlScanner scanner(xml);
+  string name;
+  string value;
+  for (auto token = scanner.Next(); token != XmlScanner::Token::End; token = scanner.Next()) {
+    if (token == XmlScanner::Token::Open && scanner.Name() == "property") {
+      name = scanner.Attribute("name");
+      value.clear();
+    } else if (token == XmlScanner::Token::Text && !name.empty()) {
+      value += scanner.Text();
+    } else if (token == XmlScanner::Token::Close && scanner.Name() == "property") {
+      if (name.compare(0, kLabelPrefixLength, kLabelPrefix) == 0)
+        entries.emplace_back(name, value);
+      name.clear();
+    }
+  }
+}
+
+// <clbl:label id="{id}" enabled="1" method="Standard" siteId="{site}" removed="0" />, written by newer
+// Office versions next to or instead of the custom properties.
+void ParseLabelInfo(const string& xml, vector<pair<string, string>>& entries) {
+  XmlScanner scanner(xml);
+  for (auto token = scanner.Next(); token != XmlScanner::Token::End; token = scanner.Next()) {
+    if (token != XmlScanner::Token::Open || scanner.Name() != "label")
+      continue;
+    string id = scanner.Attribute("id");
+    id.erase(std::remove(id.begin(), id.end(), '{'), id.end());
+    id.erase(std::remove(id.begin(), id.end(), '}'), id.end());
+    if (id.empty())
+      continue;
+    const string prefix = kLabelPrefix + id + "_";
+    const bool enabled = scanner.Attribute("enabled") == "1" && scanner.Attribute("removed") != "1";
+    entries.emplace_back(prefix + "Enabled", enabled ? "true" : "false");
+    string siteId = scanner.Attribute("siteId");
+    siteId.erase(std::remove(siteId.begin(), siteId.end(), '{'), siteId.end());
+    siteId.erase(std::remove(siteId.begin(), siteId.end(), '}'), siteId.end());
+    if (!siteId.empty())
+      entries.emplace_back(prefix + "SiteId", siteId);
+    if (!scanner.Attribute("method").empty())
+      entries.emplace_back(prefix + "Method", scanner.Attribute("method"));
+  }
+}
+
+// Returns false when stream is not a zip whose central directory could be read.
+bool ReadPackageEntries(mip::Stream& stream, int64_t size, vector<pair<string, string>>& entries) {
+  // The end record is last, followed by a comment of at most 64 KiB.
+  const int64_t tailStart = std::max<int64_t>(size - static_cast<int64_t>(kEndOfCentralDirectorySize + 0xFFFF), 0);
+  const auto tail = ReadAt(stream, tailStart, static_cast<size_t>(size - tailStart));
+  if (tail.size() < kEndOfCentralDirectorySize)
+    return false;
+  size_t end = tail.size() - kEndOfCentralDirectorySize;
+  while (ReadLe32(&tail[end]) != kEndOfCentralDirectorySignature) {
+    if (end == 0)
+      return false;
+    --end;
+  }
+  const uint16_t count = ReadLe16(&tail[end + 10]);
+  const uint32_t directorySize = ReadLe32(&tail[end + 12]);
+  const uint32_t directoryOffset = ReadLe32(&tail[end + 16]);
+  if (directorySize > kMaxCentralDirectoryBytes || static_cast<int64_t>(directoryOffset) + directorySize > size)
+    return false;
+  const auto directory = ReadAt(stream, directoryOffset, directorySize);
+
+  size_t offset = 0;
+  for (uint16_t i = 0; i < count; ++i) {
+    if (offset + kCentralHeaderSize > directory.size() || ReadLe32(&directory[offset]) != kCentralHeaderSignature)
+      break;
+    const uint8_t* header = &directory[offset];
+    const uint16_t method = ReadLe16(header + 10);
+    const uint32_t compressedSize = ReadLe32(header + 20);
+    const uint32_t partSize = ReadLe32(header + 24);
+    const uint16_t nameLength = ReadLe16(header + 28);
+    const size_t extraLength = ReadLe16(header + 30) + ReadLe16(header + 32);
+    const uint32_t localOffset = ReadLe32(header + 42);
+    if (offset + kCentralHeaderSize + nameLength > directory.size())
+      break;
+    const string name(reinterpret_cast<const char*>(header + kCentralHeaderSize), nameLength);
+    offset += kCentralHeaderSize + nameLength + extraLength;
+
+    const bool custom = name == kCustomPropertiesPart;
+    if ((!custom && name != kLabelInfoPart) || (method != kStored && method != kDeflated) ||
+        compressedSize > kMaxPartBytes || partSize > kMaxPartBytes)
+      continue;
+    const auto local = ReadAt(stream, localOffset, kLocalHeaderSize);
+    if (local.size() < kLocalHeaderSize || ReadLe32(local.data()) != kLocalHeaderSignature)
+      continue;
+    const int64_t dataOffset = static_cast<int64_t>(localOffset) + kLocalHeaderSize + ReadLe16(&local[26]) + ReadLe16(&local[28]);
+    const auto data = ReadAt(stream, dataOffset, compressedSize);
+    if (data.size() != compressedSize)
+      continue;
+    string xml;
+    if (method == kStored)
+      xml.assign(reinterpret_cast<const char*>(data.data()), data.size());
+    else if (!Inflate(data.data(), data.size(), partSize, xml))
+      continue;
+    xml = ToUtf8(xml);
+    if (custom)
+      ParseCustomProperties(xml, entries);
+    else
+      ParseLabelInfo(xml, entries);
+  }
+  return true;
+}
+
+bool IsKeyCharacter(uint8_t c) {
+  return isalnum(c) || c == '_' || c == '-';
+}
+
+// True when key starts at the name of a closing tag, such as </pdfx:MSIP_Label_...>.
+bool InClosingTag(const uint8_t* begin, const uint8_t* key) {
+  const uint8_t* at = key;
+  while (at > begin && key - at < 32 && (IsKeyCharacter(at[-1]) || at[-1] == ':'))
+    --at;
+  return at - begin >= 2 && at[-1] == '/' && at[-2] == '<';
+}
+
+// MSIP_Label_* keys followed by their value as an XMP element (>value<), an XMP attribute (="value") or
+// a PDF literal string (/Key (value)). Hex strings, which only UTF-16 values need, are skipped.
+void ScanEntries(const vector<uint8_t>& data, vector<pair<string, string>>& entries) {
+  const uint8_t* begin = data.data();
+  const uint8_t* end = begin + data.size();
+  const uint8_t* at = begin;
+  while ((at = std::search(at, end, kLabelPrefix, kLabelPrefix + kLabelPrefixLength)) != end) {
+    const uint8_t* keyEnd = at + kLabelPrefixLength;
+    while (keyEnd < end && IsKeyCharacter(*keyEnd))
+      ++keyEnd;
+    const string key(reinterpret_cast<const char*>(at), keyEnd - at);
+    // The closing tag of an XMP element repeats the key.
+    const bool closingTag = InClosingTag(begin, at);
+    at = keyEnd;
+    if (closingTag)
+      continue;
+    const uint8_t* value = keyEnd;
+    while (value < end && (*value == ' ' || *value == '\r' || *value == '\n'))
+      ++value;
+    if (value >= end)
+      break;
+    uint8_t terminator;
+    if (*value == '>') {
+      terminator = '<';
+    } else if (*value == '=' && value + 1 < end && (value[1] == '"' || value[1] == '\'')) {
+      terminator = *++value;
+    } else if (*value == '(') {
+      terminator = ')';
+    } else {
+      continue;
+    }
+    const uint8_t* valueEnd = std::find(value + 1, std::min(end, value + 1 + 4096), terminator);
+    if (valueEnd == end)
+      continue;
+    entries.emplace_back(key, DecodeEntities(string(reinterpret_cast<const char*>(value + 1), valueEnd - value - 1)));
+    at = valueEnd;
+  }
+}
+
+} // namespace
+
+LabelMetadata ParseLabelEntries(vector<pair<string, string>> entries) {
+  LabelMetadata metadata;
+  // A key seen twice, such as from both the custom properties and LabelInfo.xml, keeps its first value.
+  for (auto& entry : entries) {
+    const bool seen = std::any_of(metadata.entries.begin(), metadata.entries.end(),
+        [&entry](const pair<string, string>& kept) { return kept.first == entry.first; });
+    if (!seen)
+      metadata.entries.push_back(std::move(entry));
+  }
+  for (const auto& entry : metadata.entries) {
+    const string& key = entry.first;
+    const size_t idEnd = key.find('_', kLabelPrefixLength);
+    if (idEnd == string::npos || key.compare(idEnd + 1, string::npos, "Enabled") != 0 ||
+        !(EqualsIgnoreCase(entry.second, "true") || entry.second == "1"))
+      continue;
+    metadata.labelId = key.substr(kLabelPrefixLength, idEnd - kLabelPrefixLength);
+    const string prefix = key.substr(0, idEnd + 1);
+    for (const auto& field : metadata.entries) {
+      if (field.first.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      const string name = field.first.substr(prefix.size());
+      if (name == "Name")
+        metadata.name = field.second;
+      else if (name == "SiteId")
+        metadata.siteId = field.second;
+      else if (name == "Method")
+        metadata.method = field.second;
+      else if (name == "SetDate")
+        metadata.setDate = field.second;
+    }
+    break;
+  }
+  return metadata;
+}
+
+LabelMetadata ReadLabelMetadata(mip::Stream& stream) {
+  const int64_t size = stream.Size();
+  vector<pair<string, string>> entries;
+  const auto head = ReadAt(stream, 0, static_cast<size_t>(std::min(size, kScanBytes)));
+  const bool isZip = head.size() >= 4 && ReadLe32(head.data()) == kLocalHeaderSignature;
+  if (!isZip || !ReadPackageEntries(stream, size, entries)) {
+    ScanEntries(head, entries);
+    if (size > kScanBytes)
+      ScanEntries(ReadAt(stream, std::max(size - kScanBytes, kScanBytes), static_cast<size_t>(std::min(size - kScanBytes, kScanBytes))), entries);
+  }
+  return ParseLabelEntries(std::move(entries));
+}
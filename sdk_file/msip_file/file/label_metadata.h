@@ -0,0 +1,63 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_LABEL_METADATA_H_
+#define SAMPLE_FILE_LABEL_METADATA_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mip/stream.h"
+
+// The sensitivity label a file carries in the clear, read without the SDK and so without a handler, a
+// protection handler or a license:
+// - Office Open XML packages: the MSIP_Label_* custom properties of docProps/custom.xml and the labels of
+//   docMetadata/LabelInfo.xml, inflated out of the zip after reading only its central directory;
+// - anything else, PDF among them: MSIP_Label_* entries of XMP metadata and of the document information
+//   dictionary, found in the first and last MiB of the file.
+// The content of protected Office files is encrypted, metadata included; their label is in the
+// publishing license instead.
+struct LabelMetadata {
+  // The label whose _Enabled entry is true; empty when the file is not labeled.
+  std::string labelId;
+  std::string name;
+  std::string siteId;
+  // "Standard", "Privileged" or "Auto", as written.
+  std::string method;
+  std::string setDate;
+  // Every MSIP_Label_* entry found, by key.
+  std::vector<std::pair<std::string, std::string>> entries;
+};
+
+// Reads stream from where it needs; throws std::runtime_error when it cannot be read.
+LabelMetadata ReadLabelMetadata(mip::Stream& stream);
+
+// Picks the enabled label out of MSIP_Label_<id>_<field> entries.
+LabelMetadata ParseLabelEntries(std::vector<std::pair<std::string, std::string>> entries);
+
+#endif // SAMPLE_FILE_LABEL_METADATA_H_
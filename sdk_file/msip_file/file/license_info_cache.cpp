@@ -0,0 +1,113 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "license_info_cache.h"
+
+using std::string;
+using std::vector;
+
+const size_t LicenseInfoCache::kDefaultCapacity;
+
+LicenseInfoCache::LicenseInfoCache(size_t capacity) : mEntries(capacity, "license_info") {
+}
+
+LicenseInfoCache::Info LicenseInfoCache::GetOrParse(const vector<uint8_t>& publishingLicense, const Parser& parse) {
+  // The whole license is the key, so equal hashes of different licenses can never share an entry.
+  const string key(publishingLicense.begin(), publishingLicense.end());
+  Info info;
+  if (mEntries.Find(key, info))
+    return info;
+
+  // Parsing runs without the lock. Concurrent misses on one license both parse and the later one wins.
+  info = parse();
+  mEntries.Put(key, info);
+  return info;
+}
+
+void LicenseInfoCache::SetCapacity(size_t capacity) {
+  mEntries.SetCapacity(capacity);
+}
+
+LicenseInfoCache::Stats LicenseInfoCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void LicenseInfoCache::SnapshotTo(SnapshotWriter& writer) const {
+  mEntries.ForEach([&](const string& key, const Info& info, const string&) {
+    writer.PutString(key);
+    writer.PutString(info.owner);
+    writer.PutString(info.contentId);
+    writer.PutString(info.templateId);
+    writer.PutString(info.templateName);
+    writer.PutString(info.issuerId);
+    writer.PutU32(static_cast<uint32_t>(info.domains.size()));
+    for (const auto& domain : info.domains)
+      writer.PutString(domain);
+    writer.PutString(info.labelId);
+    writer.PutString(info.tenantId);
+    writer.PutString(info.referralUrl);
+    writer.PutI64(info.issuedTime);
+    writer.PutBool(info.doubleKey);
+  });
+}
+
+size_t LicenseInfoCache::RestoreFrom(SnapshotReader& reader) {
+  size_t restored = 0;
+  while (!reader.AtEnd()) {
+    const string key = reader.GetString();
+    Info info;
+    info.owner = reader.GetString();
+    info.contentId = reader.GetString();
+    info.templateId = reader.GetString();
+    info.templateName = reader.GetString();
+    info.issuerId = reader.GetString();
+    const uint32_t domains = reader.GetU32();
+    for (uint32_t i = 0; i < domains; ++i)
+      info.domains.push_back(reader.GetString());
+    info.labelId = reader.GetString();
+    info.tenantId = reader.GetString();
+    info.referralUrl = reader.GetString();
+    info.issuedTime = reader.GetI64();
+    info.doubleKey = reader.GetBool();
+    if (mEntries.GetCapacity() == 0)
+      continue;
+    mEntries.Put(key, info);
+    ++restored;
+  }
+  return restored;
+}
+
+void LicenseInfoCache::Clear() {
+  mEntries.Clear();
+}
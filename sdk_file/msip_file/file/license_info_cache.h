@@ -0,0 +1,96 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_LICENSE_INFO_CACHE_H_
+#define SAMPLE_FILE_LICENSE_INFO_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cache_snapshot.h"
+#include "sharded_lru.h"
+
+// LRU of parsed publishing licenses keyed by the serialized license itself, so every file protected with
+// the same license (copies, bulk protects from one template) is parsed once. Entries never go stale:
+// a publishing license is signed and immutable, and a changed file simply carries a different one.
+class LicenseInfoCache final {
+public:
+  // What a publishing license says without contacting the service.
+  struct Info {
+    std::string owner;
+    std::string contentId;
+    std::string templateId;
+    std::string templateName;
+    std::string issuerId;
+    std::vector<std::string> domains;
+    std::string labelId;
+    std::string tenantId;
+    std::string referralUrl;
+    int64_t issuedTime;
+    bool doubleKey;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  typedef std::function<Info()> Parser;
+
+  static const size_t kDefaultCapacity = 256;
+
+  explicit LicenseInfoCache(size_t capacity = kDefaultCapacity);
+
+  Info GetOrParse(const std::vector<uint8_t>& publishingLicense, const Parser& parse);
+
+  // Shrinking the capacity evicts least recently used entries immediately. Zero disables the cache.
+  void SetCapacity(size_t capacity);
+
+  Stats GetStats() const;
+
+  // Entries held and the most kept, without locking (see ShardedLru::GetSize).
+  size_t GetSize() const { return mEntries.GetSize(); }
+  size_t GetCapacity() const { return mEntries.GetCapacity(); }
+
+  // Writes the entries to a snapshot section (see cache_snapshot.h), and puts a section's entries back,
+  // returning how many. RestoreFrom throws std::runtime_error for a malformed section.
+  void SnapshotTo(SnapshotWriter& writer) const;
+  size_t RestoreFrom(SnapshotReader& reader);
+
+  void Clear();
+
+private:
+  ShardedLru<Info> mEntries;
+};
+
+#endif // SAMPLE_FILE_LICENSE_INFO_CACHE_H_
@@ -25,20 +25,28 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <map>
+#include <set>
 #include <memory>
 #include <sstream>
+#include <thread>
 #include <iomanip>
 #include <time.h>
 #include <codecvt>
+#include <deque>
 
 #ifdef __linux__
+#include <sys/stat.h>
 #include <unistd.h>
 #ifndef MAX_PATH
 #define MAX_PATH 4096
@@ -47,11 +55,83 @@
 
 #include "cxxopts.hpp"
 
+#include "async_completion.h"
+#include "async_file_reader.h"
+#include "admission_controller.h"
+#include "aligned_file_output_stream.h"
+#include "cloned_file_output_stream.h"
+#include "allocation_account.h"
+#include "columnar_storage_delegate.h"
+#include "encrypted_log_storage_delegate.h"
+#include "allocator_stats.h"
+#include "archive_reader.h"
 #include "auth_delegate_impl.h"
-#include "consent_delegate_impl.h"
+#include "batch_prefetcher.h"
+#include "batch_result_sink.h"
+#include "buffer_pool.h"
+#include "cache_snapshot.h"
+#include "content_dedupe.h"
+#include "content_tracker.h"
+#include "context_manager.h"
+#include "cost_account.h"
+#include "cpu_profiler.h"
+#include "delegation_license_cache.h"
+#include "engine_cache.h"
+#include "engine_manifest.h"
+#include "event_log.h"
+#include "fd_output_stream.h"
 #include "file_execution_state_impl.h"
+#include "file_identity.h"
 #include "file_handler_observer.h"
+#include "format_sniffer.h"
+#include "idempotency_cache.h"
+#include "inspection_cache.h"
+#include "inspection_journal.h"
+#include "instrumented_mutex.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "label_index.h"
+#include "label_metadata.h"
+#include "license_info_cache.h"
+#include "protection_cache.h"
+#include "protection_descriptor_interner.h"
+#include "use_license_cache.h"
+#include "redis_storage_delegate.h"
+#include "resource_tuner.h"
+#include "rights_cache.h"
+#include "sensitivity_type_classifier.h"
+#include "sensitivity_type_index.h"
+#include "shard_coordinator.h"
+#include "slow_operation_recorder.h"
+#include "staged_pipeline.h"
+#include "status_records.h"
+#include "mapped_file_stream.h"
+#include "memory_hints.h"
+#include "metrics_registry.h"
+#include "numa_topology.h"
+#include "object_input_stream.h"
+#include "object_output_stream.h"
+#include "object_store_client.h"
+#include "offline_publisher.h"
+#include "operation_budget.h"
+#include "phase_metrics.h"
+#include "protection_token_context.h"
+#include "request_deadline.h"
+#include "temp_file_pool.h"
+#include "temp_file_stream.h"
+#include "template_catalog.h"
+#include "tenant_context.h"
+#include "text_extractor.h"
+#include "timeline_recorder.h"
+#include "trace_context.h"
+#include "traffic_capture.h"
+#include "work_priority.h"
+#include "output_buffer_stream.h"
+#include "output_destination.h"
+#include "package_repacker.h"
 #include "stream_over_buffer.h"
+#include "parallel_encryption.h"
+#include "pfile_header.h"
 #include "mip/common_types.h"
 #include "mip/error.h"
 #include "mip/file/file_handler.h"
@@ -63,26 +143,35 @@
 #include "mip/mip_context.h"
 #include "mip/protection_descriptor.h"
 #include "mip/protection_descriptor_builder.h"
+#include "mip/protection/delegation_license_settings.h"
+#include "mip/protection/protection_engine.h"
 #include "mip/protection/protection_handler.h"
+#include "mip/protection/protection_profile.h"
 #include "mip/protection/rights.h"
 #include "mip/stream_utils.h"
 #include "mip/stream_utils.h"
+#include "mip/upe/apply_label_action.h"
 #include "mip/upe/policy_engine.h"
+#include "mip/upe/policy_profile.h"
+#include "mip/upe/recommend_label_action.h"
 #include "mip/user_rights.h"
 #include "mip/user_roles.h"
 #include "mip/version.h"
-#include "profile_observer.h"
-#include "shutdown_manager.h"
 #include "string_utils.h"
+#include "token_cache.h"
+#include "tree_scanner.h"
 #include "utils.h"
 
+// The C ABI of aip_file.so. It stays exported when the release-pgo build hides every other symbol.
+#if defined(__GNUC__)
+#define MSIP_EXPORT __attribute__((visibility("default")))
+#else
+#define MSIP_EXPORT
+#endif
 
 using mip::ActionSource;
-using mip::ApplicationInfo;
 using mip::AssignmentMethod;
 using mip::AuthDelegate;
-using mip::CacheStorageType;
-using mip::ConsentDelegate;
 using mip::DataState;
 using mip::FileEngine;
 using mip::FileHandler;
@@ -97,18 +186,20 @@ using mip::MipContext;
 using mip::MsgInspector;
 using mip::NoPermissionsError;
 using mip::PolicyEngine;
+using mip::PolicyProfile;
 using mip::ProtectionDescriptor;
 using mip::ProtectionDescriptorBuilder;
+using mip::ProtectionEngine;
 using mip::ProtectionHandler;
+using mip::ProtectionProfile;
 using mip::Stream;
 using mip::UserRights;
 using mip::UserRoles;
 using sample::auth::AuthDelegateImpl;
-using sample::consent::ConsentDelegateImpl;
+using sample::storage::ObjectLocation;
+using sample::storage::ObjectStoreClient;
 using std::cin;
 using std::codecvt_utf8_utf16;
-using std::cout;
-using std::endl;
 using std::fstream;
 using std::get_time;
 using std::getline;
@@ -117,10 +208,8 @@ using std::iostream;
 using std::istream;
 using std::make_shared;
 using std::map;
-using std::ostream_iterator;
 using std::ostringstream;
 using std::pair;
-using std::put_time;
 using std::shared_ptr;
 using std::static_pointer_cast;
 using std::string;
@@ -135,6 +224,10 @@ namespace {
 static const char kPathSeparatorWindows = '\\';
 static const char kPathSeparatorUnix = '/';
 static const char kExtensionSeparator = '.';
+// Protected messages the SDK opens within one message, and the deepest nesting inspectMsg walks.
+static const size_t kMaxNestedProtectedMsgs = 8;
+// Classification results kept per policy engine, one per distinct content and set of requested types.
+static const size_t kClassificationCacheSize = 4096;
 
 // Explicit null character at the end is required since array initializer does NOT add it.
 static const char kPathSeparatorCStringWindows[] = {kPathSeparatorWindows, '\0'};
@@ -152,17 +245,19 @@ void Trim(string& a, const char* trim_char = whiteSpaceCharacters) {
     a.erase(a.begin(), a.end());
 }
 
+// Splits on every delim, keeping empty fields, so "a,,b" gives three and "" gives one.
 vector<string> SplitString(const string& str, char delim) {
   vector<string> output;
-  stringstream ss(str);
-  string substr;
-
-  while (ss.good()) {
-    getline(ss, substr, delim);
-    output.emplace_back(std::move(substr));
+  size_t start = 0;
+  for (;;) {
+    const size_t end = str.find(delim, start);
+    if (end == string::npos) {
+      output.emplace_back(str, start, string::npos);
+      return output;
+    }
+    output.emplace_back(str, start, end - start);
+    start = end + 1;
   }
-
-  return output;
 }
 
 map<string, string> SplitDict(const string& str) {
@@ -191,6 +286,7 @@ string GetFileExtension(const string& filePath) {
 
 shared_ptr<FileStatus> GetFileStatus(const string& filePath, const shared_ptr<Stream>& fileStream, const shared_ptr<MipContext>& mipContext) {
   if (fileStream) {
+    fileStream->Seek(0);
     return FileHandler::GetFileStatus(fileStream, filePath, mipContext);
   } else {
     return FileHandler::GetFileStatus(filePath, mipContext);
@@ -225,111 +321,196 @@ map<mip::FlightingFeature, bool> SplitFeatures(const string& str) {
   return dict;
 }
 
-shared_ptr<mip::Stream> GetInputStreamFromFilePath(const string& filePath) {
-  auto ifStream = make_shared<fstream>(filePath, std::ios_base::in | std::ios_base::binary);
-  uint8_t buffer[4096] = {0};
-  std::streamsize bytesRead = 0;
-  vector<uint8_t> memoryFile;
-  do {
-    ifStream->clear();
-    ifStream->read(reinterpret_cast<char*>(buffer), sizeof(buffer));
-    bytesRead = ifStream->gcount();
-    if (bytesRead > 0) {
-      memoryFile.insert(memoryFile.end(), &buffer[0], &buffer[bytesRead]);
-    }
-  } while (bytesRead > 0);
-
-  return make_shared<StreamOverBuffer>(std::move(memoryFile));
-}
-
-// Get the current label and protection on this file and print to console label and protection information
-void GetLabel(
-  const shared_ptr<FileHandler>& fileHandler) {
-  auto protection = fileHandler->GetProtection(); // Get the current protection on the file
-  auto label = fileHandler->GetLabel(); //Get the current label on the file
-
-  if (!label && !protection) {
-    cout << "File is neither labeled nor protected" << endl;
-    return;
+// future.get(), failing with BudgetExceededError instead of the SDK's own error when the operation's
+// budget (see msipConfigureOperationBudget) stopped it.
+template <typename Future>
+auto GetWithinBudget(Future& future) -> decltype(future.get()) {
+  try {
+    return future.get();
   }
+  catch (const std::exception&) {
+    OperationBudget::ThrowIfCurrentExceeded();
+    throw;
+  }
+}
 
-  if (label) {
-    bool isPrivileged = label->GetAssignmentMethod() == AssignmentMethod::PRIVILEGED;
-    auto extendedProperties = label->GetExtendedProperties();
-    cout << "File is labeled as: " << label->GetLabel()->GetName() << endl;
-    cout << "Id: " << label->GetLabel()->GetId() << endl;
-
-    if (const shared_ptr<mip::Label> parent = label->GetLabel()->GetParent().lock()) {
-      cout << "Parent label: " << parent->GetName() << endl;
-      cout << "Parent Id: " << parent->GetId() << endl;
-    }
-    auto time = std::chrono::system_clock::to_time_t(label->GetCreationTime());
-    std::stringstream ss;
-    ss << time;
-    cout << "Set time: " << ss.str() << endl;
-    cout << "Privileged: " << (isPrivileged ? "True" : "False") << endl;
-    if (!extendedProperties.empty()) {
-      cout << "Extended Properties: " << endl;
-    }
-    for (size_t j = 0; j < extendedProperties.size(); j++) {
-      cout << "Key: " << extendedProperties[j].GetKey() <<
-          ", Value: " << extendedProperties[j].GetValue() << endl;
-    }
+// Waits for an SDK operation until the caller's deadline (see msipSetDeadline), cancelling it through
+// control when the deadline passes first or the operation goes over its budget.
+template <typename Future>
+auto WaitForOperation(Future& future, const shared_ptr<mip::AsyncControl>& control) -> decltype(future.get()) {
+  static auto& deadlinesExceeded = MetricsRegistry::Shared().GetCounter(
+      "msip_native_deadline_exceeded_total", "SDK operations cancelled because the caller's deadline passed");
+  if (const auto& budget = OperationBudget::Current())
+    budget->Watch(control);
+  try {
+    return sample::deadline::WaitUntilDeadline(future, [&control]() {
+      deadlinesExceeded.Add(1);
+      if (control)
+        control->Cancel();
+    });
+  }
+  catch (const sample::deadline::DeadlineExceededError&) {
+    throw;
+  }
+  catch (const std::exception&) {
+    OperationBudget::ThrowIfCurrentExceeded();
+    throw;
+  }
+}
 
-  } else
-    cout << "File is not labeled by an official policy" << endl;
+// Maps an input with the hints msipConfigureMemoryHints asks for at its size. The input is only stat'ed
+// when prefaulting is on, as the hints depend on its size only then.
+shared_ptr<MappedFileStream> MapInput(const string& filePath) {
+  const InputStreams::Options options = ContextManager::Instance().GetInputStreams();
+  struct stat fileInfo;
+  const int64_t size = options.prefaultMinBytes > 0 && stat(filePath.c_str(), &fileInfo) == 0 ? static_cast<int64_t>(fileInfo.st_size) : 0;
+  return make_shared<MappedFileStream>(filePath, InputStreams::MapHints(options, size));
+}
 
-  if (protection) {
-    cout << "File is protected with ";
+shared_ptr<MappedFileStream> MapInput(int fd, const string& name) {
+  const InputStreams::Options options = ContextManager::Instance().GetInputStreams();
+  struct stat fileInfo;
+  const int64_t size = options.prefaultMinBytes > 0 && fstat(fd, &fileInfo) == 0 ? static_cast<int64_t>(fileInfo.st_size) : 0;
+  return make_shared<MappedFileStream>(fd, name, InputStreams::MapHints(options, size));
+}
 
-    const shared_ptr<ProtectionDescriptor> protectionDescriptor = protection->GetProtectionDescriptor();
-    if (protectionDescriptor->GetProtectionType() == mip::ProtectionType::TemplateBased)
-      cout << "template." << endl;
-    else
-      cout << "custom permissions." << endl;
+shared_ptr<mip::Stream> GetInputStreamFromFilePath(const string& filePath) {
+  return MapInput(filePath);
+}
 
-    cout << "Name: " << protectionDescriptor->GetName() << endl;
-    cout << "Template Id: " << protectionDescriptor->GetTemplateId() << endl;
+// The input of the file a batch worker is processing, when it was read ahead (see StartReadAhead).
+struct ReadAheadInput {
+  const char* filePath;
+  shared_ptr<mip::Stream> stream;
+};
+thread_local ReadAheadInput tReadAheadInput;
 
-    for (const auto& usersRights : protectionDescriptor->GetUserRights()) {
-      cout << "Rights: ";
-      auto rights = usersRights.Rights();
-      copy(rights.cbegin(), rights.cend() - 1, ostream_iterator<string>(cout, ", "));
-      cout << *rights.crbegin() << endl;
+// Offers stream to the next GetLargeInputStream(filePath) on this thread.
+class ScopedReadAheadInput final {
+public:
+  ScopedReadAheadInput(const char* filePath, shared_ptr<mip::Stream> stream) {
+    tReadAheadInput.filePath = filePath;
+    tReadAheadInput.stream = std::move(stream);
+  }
+  ~ScopedReadAheadInput() {
+    tReadAheadInput.filePath = nullptr;
+    tReadAheadInput.stream.reset();
+  }
+};
 
-      cout << "For Users: ";
-      auto users = usersRights.Users();
-      copy(users.cbegin(), users.cend() - 1, ostream_iterator<string>(cout, "; "));
-      cout << *users.crbegin() << endl;
-    }
+// Returns the stream InputStreams chooses for the input's size (see msipConfigureInputStreams), or nullptr
+// to let the SDK open the file by path. An input read ahead for this thread is returned instead, once: a
+// second handler over the file needs its own stream. While the container structure cache is on, inputs not
+// read whole into memory are mapped rather than left to the SDK, and wrapped so the structure the last
+// stream over the same file read is served from memory (see msipConfigureContainerCache).
+shared_ptr<mip::Stream> GetLargeInputStream(const string& filePath) {
+  if (tReadAheadInput.stream && filePath == tReadAheadInput.filePath)
+    return std::move(tReadAheadInput.stream);
+  auto& contextManager = ContextManager::Instance();
+  const InputStreams::Options options = contextManager.GetInputStreams();
+  auto& structures = contextManager.GetContainerStructureCache();
+  if (!structures.IsEnabled())
+    return InputStreams::Open(options, filePath);
 
-    for (const auto& usersRoles : protectionDescriptor->GetUserRoles()) {
-      cout << "Roles: ";
-      auto roles = usersRoles.Roles();
-      copy(roles.cbegin(), roles.cend() - 1, ostream_iterator<string>(cout, ", "));
-      cout << *roles.crbegin() << endl;
+  FileIdentity opened;
+  if (!GetFileIdentity(filePath, opened) || opened.size <= 0 ||
+      InputStreams::Choose(options, opened.size) == InputStreams::Strategy::Pooled)
+    return InputStreams::Open(options, filePath);
+  shared_ptr<mip::Stream> stream = InputStreams::Open(options, filePath);
+  if (!stream)
+    stream = MapInput(filePath);
+  // Stat'ed again now that it is open, so a file replaced in between is not recorded under the old one.
+  FileIdentity identity;
+  if (!GetFileIdentity(filePath, identity) || identity != opened)
+    return stream;
+  return structures.Wrap(std::move(stream), identity);
+}
 
-      cout << "For Users: ";
-      auto users = usersRoles.Users();
-      copy(users.cbegin(), users.cend() - 1, ostream_iterator<string>(cout, "; "));
-      cout << *users.crbegin() << endl;
-    }
+void AppendStringArrayJSON(JsonWriter& json, const vector<string>& items) {
+  json.BeginArray();
+  for (const auto& item : items)
+    json.String(item);
+  json.EndArray();
+}
 
-    if (protectionDescriptor->DoesContentExpire()) {
-      time_t validUntilTime = std::chrono::system_clock::to_time_t(protectionDescriptor->GetContentValidUntil());
-      tm validUntilUtc = {};
-      tm validUntil = {};
+// "label" of describeFile: what the file's label records, named and placed from the policy's label index
+// when the index knows it. A label read from a pfile's publishing license has no handler behind it, so it
+// carries neither an assignment method, a set time nor extended properties.
+void AppendDescribedLabelJSON(
+    JsonWriter& json,
+    const shared_ptr<mip::ContentLabel>& label,
+    const string& labelId,
+    const LabelIndex& labels) {
+  const auto* record = labels.FindById(labelId);
+  json.BeginObject()
+      .Key("id").String(labelId)
+      .Key("name").String(record ? record->name : label ? label->GetLabel()->GetName() : string())
+      .Key("path").String(record ? record->path : string())
+      .Key("in_policy").Bool(record != nullptr)
+      .Key("parent_id");
+  const shared_ptr<mip::Label> parent = label ? label->GetLabel()->GetParent().lock() : nullptr;
+  if (parent)
+    json.String(parent->GetId());
+  else if (record && record->parent != LabelIndex::kNoParent)
+    json.String(labels.GetRecords()[record->parent].id);
+  else
+    json.Null();
+  json.Key("sensitivity");
+  if (record)
+    json.Int(record->sensitivity);
+  else
+    json.Null();
+  json.Key("privileged").Bool(label && label->GetAssignmentMethod() == AssignmentMethod::PRIVILEGED)
+      .Key("set_time");
+  if (label)
+    json.Int(static_cast<int64_t>(std::chrono::system_clock::to_time_t(label->GetCreationTime())));
+  else
+    json.Null();
+  json.Key("extended_properties").BeginArray();
+  if (label) {
+    for (const auto& property : label->GetExtendedProperties())
+      json.BeginObject().Key("key").String(property.GetKey()).Key("value").String(property.GetValue()).EndObject();
+  }
+  json.EndArray().EndObject();
+}
 
-      gmtime_r(&validUntilTime, &validUntilUtc);
-      localtime_r(&validUntilTime, &validUntil);
-      cout << "Content Expiration (UTC): " << put_time(&validUntilUtc, "%FT%TZ") << endl;
-      cout << "Content Expiration: " << put_time(&validUntil, "%FT%T%z") << endl;
-    }
+// "protection" of describeFile, from the protection handler the file was opened with.
+void AppendDescribedProtectionJSON(JsonWriter& json, const shared_ptr<ProtectionHandler>& protection) {
+  const shared_ptr<ProtectionDescriptor> descriptor = protection->GetProtectionDescriptor();
+  json.BeginObject()
+      .Key("type").String(descriptor->GetProtectionType() == mip::ProtectionType::TemplateBased ? "template" : "custom")
+      .Key("name").String(descriptor->GetName())
+      .Key("template_id").String(descriptor->GetTemplateId())
+      .Key("owner").String(protection->GetOwner())
+      .Key("content_id").String(protection->GetContentId())
+      .Key("valid_until");
+  if (descriptor->DoesContentExpire())
+    json.Int(static_cast<int64_t>(std::chrono::system_clock::to_time_t(descriptor->GetContentValidUntil())));
+  else
+    json.Null();
+  json.Key("granted_rights");
+  AppendStringArrayJSON(json, protection->GetRights());
+  json.Key("user_rights").BeginArray();
+  for (const auto& usersRights : descriptor->GetUserRights()) {
+    json.BeginObject().Key("users");
+    AppendStringArrayJSON(json, usersRights.Users());
+    json.Key("rights");
+    AppendStringArrayJSON(json, usersRights.Rights());
+    json.EndObject();
+  }
+  json.EndArray().Key("user_roles").BeginArray();
+  for (const auto& usersRoles : descriptor->GetUserRoles()) {
+    json.BeginObject().Key("users");
+    AppendStringArrayJSON(json, usersRoles.Users());
+    json.Key("roles");
+    AppendStringArrayJSON(json, usersRoles.Roles());
+    json.EndObject();
   }
+  json.EndArray().EndObject();
 }
 
-string CreateOutput(FileHandler* fileHandler) {
-  auto outputFileName = fileHandler->GetOutputFileName();
+// The "_modified" sibling of outputFileName, keeping a ".pfile" suffix together with the extension before it.
+string CreateOutputPath(const string& outputFileName) {
   auto fileExtension = GetFileExtension(outputFileName);
   auto outputFileNameWithoutExtension = outputFileName.substr(0, outputFileName.length() - fileExtension.length());
 
@@ -341,6 +522,25 @@ string CreateOutput(FileHandler* fileHandler) {
   return outputFileNameWithoutExtension + "_modified" + fileExtension;
 }
 
+// The path a protect or unprotect commits to: the stage of this thread's output destination (see
+// protectFileTo), or else the "_modified" sibling of outputFileName.
+string CreateProtectionOutputPath(const string& outputFileName) {
+  if (auto destination = OutputDestination::Current())
+    return destination->Stage();
+  return CreateOutputPath(outputFileName);
+}
+
+string CreateOutput(FileHandler* fileHandler) {
+  return CreateOutputPath(fileHandler->GetOutputFileName());
+}
+
+// Moves an output committed to CreateProtectionOutputPath to this thread's destination, if one is set, and
+// returns where the output now is.
+string PublishOutput(const string& outputFilePath) {
+  auto destination = OutputDestination::Current();
+  return destination ? destination->Publish() : outputFilePath;
+}
+
 char PathSeparator() {
 #ifdef _WIN32
   return kPathSeparatorWindows;
@@ -366,38 +566,173 @@ string CombinePaths(const string& folder, const string& relativePath) {
 }
 
 
-void SetLabel(
-  const shared_ptr<FileHandler>& fileHandler,
-  const shared_ptr<Label>& label,
-  const string& filePath,
-  AssignmentMethod method,
-  const string& justificationMessage,
-  const vector<pair<string, string>>& extendedProperties) {
+// Size of the handler's input, used to preallocate its output. The SDK names pfile outputs after the input
+// plus ".pfile"; -1 when the input cannot be found.
+int64_t InputSizeHint(FileHandler* fileHandler) {
+  const auto outputFileName = fileHandler->GetOutputFileName();
+  struct stat fileInfo;
+  if (stat(outputFileName.c_str(), &fileInfo) == 0)
+    return static_cast<int64_t>(fileInfo.st_size);
+  const auto extension = GetFileExtension(outputFileName);
+  if (EqualsIgnoreCase(extension, ".pfile") &&
+      stat(outputFileName.substr(0, outputFileName.size() - extension.size()).c_str(), &fileInfo) == 0)
+    return static_cast<int64_t>(fileInfo.st_size);
+  return -1;
+}
+
+// Commits the handler's pending changes into outputStream, an output created at outputFilePath, closing it.
+// An output that was not committed is removed, as the SDK does for its own.
+template <typename OutputStream>
+bool CommitToOutputStream(
+    const shared_ptr<FileHandler>& fileHandler, const shared_ptr<OutputStream>& outputStream, const string& outputFilePath) {
+  auto commitCompletion = AsyncCompletion<bool>::Create();
+  auto commitFuture = commitCompletion->GetFuture();
+  bool committed = false;
+  try {
+    SdkAsync::Commit(fileHandler, BudgetedStream::Wrap(outputStream, OperationBudget::Current()), commitCompletion);
+    committed = GetWithinBudget(commitFuture);
+    // The tail of the output is still buffered, or the clone untrimmed, until the stream is closed.
+    if (committed)
+      outputStream->Close();
+  }
+  catch (const std::exception&) {
+    try {
+      outputStream->Close();
+    }
+    catch (const std::exception&) {
+    }
+    unlink(outputFilePath.c_str());
+    throw;
+  }
+  if (!committed) {
+    try {
+      outputStream->Close();
+    }
+    catch (const std::exception&) {
+    }
+    unlink(outputFilePath.c_str());
+  }
+  return committed;
+}
+
+// Commits a PDF label change into a clone of inputFilePath and counts whether the SDK appended an
+// incremental update or rewrote the file. False, with nothing committed, when the filesystem cannot clone.
+bool CommitPdfIncrementally(
+    const shared_ptr<FileHandler>& fileHandler, const string& outputFilePath, const string& inputFilePath, bool& committed) {
+  static auto& incremental = MetricsRegistry::Shared().GetCounter(
+      "msip_native_pdf_incremental_updates_total", "PDF label changes written as an update appended to the input");
+  static auto& rewritten = MetricsRegistry::Shared().GetCounter(
+      "msip_native_pdf_rewrites_total", "PDF label changes the SDK wrote as a new file");
+  auto clonedStream = ClonedFileOutputStream::Create(outputFilePath, inputFilePath);
+  if (!clonedStream)
+    return false;
+  committed = CommitToOutputStream(fileHandler, clonedStream, outputFilePath);
+  if (committed)
+    (clonedStream->KeptInput() ? incremental : rewritten).Add(1);
+  return true;
+}
+
+// Buffer of the native writer used for outputs counted against an output budget.
+static const size_t kBudgetedOutputBufferBytes = 1 << 20;
+
+// Commits the handler's pending changes to outputFilePath. With an output writer configured (see
+// msipConfigureOutputWriter) the SDK writes into an AlignedFileOutputStream instead of opening the path
+// itself. A label change given its inputFilePath, with cloned label outputs on (see
+// msipSetCloneLabelOutputs), or of a PDF with incremental updates on (see msipConfigurePdf), is committed
+// into a clone of the input instead, where the filesystem allows.
+bool CommitToPath(const shared_ptr<FileHandler>& fileHandler, const string& outputFilePath, const string& inputFilePath = "") {
+  ScopedPhase phase(PhaseMetrics::Phase::Commit);
+  if (!inputFilePath.empty() && ContextManager::Instance().GetPdfOptions().incrementalUpdates &&
+      FormatSniffer::SniffFile(inputFilePath).format == FileFormat::Pdf) {
+    bool committed = false;
+    if (CommitPdfIncrementally(fileHandler, outputFilePath, inputFilePath, committed))
+      return committed;
+  } else if (!inputFilePath.empty() && ContextManager::Instance().GetCloneLabelOutputs()) {
+    if (auto clonedStream = ClonedFileOutputStream::Create(outputFilePath, inputFilePath))
+      return CommitToOutputStream(fileHandler, clonedStream, outputFilePath);
+  }
+  auto options = ContextManager::Instance().GetOutputWriter();
+  // Outputs the SDK writes itself cannot be counted, so an output budget has them written natively.
+  const auto& budget = OperationBudget::Current();
+  if (options.bufferBytes == 0 && budget && OperationBudget::GetLimits().outputBytes > 0)
+    options.bufferBytes = kBudgetedOutputBufferBytes;
+  if (options.bufferBytes == 0) {
+    auto commitCompletion = AsyncCompletion<bool>::Create();
+    auto commitFuture = commitCompletion->GetFuture();
+    SdkAsync::Commit(fileHandler, outputFilePath, commitCompletion);
+    return commitFuture.get();
+  }
+  return CommitToOutputStream(
+      fileHandler, make_shared<AlignedFileOutputStream>(outputFilePath, options, InputSizeHint(fileHandler.get())),
+      outputFilePath);
+}
 
+LabelingOptions MakeLabelingOptions(
+    AssignmentMethod method,
+    const string& justificationMessage,
+    const vector<pair<string, string>>& extendedProperties) {
   LabelingOptions labelingOptions(method);
   labelingOptions.SetDowngradeJustification(!justificationMessage.empty(), justificationMessage);
   labelingOptions.SetExtendedProperties(extendedProperties);
+  return labelingOptions;
+}
+
+// The key key's engine is cached under. An application in delegated mode (see msipConfigureDelegatedIdentity)
+// loads its users' engines as its service identity, so one warm engine serves all of them.
+EngineCache::Key ServiceEngineKey(const EngineCache::Key& key) {
+  const string serviceIdentity = ContextManager::Instance().GetServiceIdentity(key.applicationId);
+  if (serviceIdentity.empty() || key.username.empty())
+    return key;
+  EngineCache::Key serviceKey = key;
+  serviceKey.username = serviceIdentity;
+  return serviceKey;
+}
+
+// The user an operation on applicationId's service engine acts for, or empty outside delegated mode.
+string DelegatedUserOf(const string& applicationId, const string& username) {
+  const string serviceIdentity = ContextManager::Instance().GetServiceIdentity(applicationId);
+  return serviceIdentity.empty() || EqualsIgnoreCase(serviceIdentity, username) ? "" : username;
+}
+
+// Protection set for delegatedUser, who owns what it publishes; the engine's identity without one.
+mip::ProtectionSettings DelegatedProtectionSettings(const string& delegatedUser) {
+  return mip::ProtectionSettings(delegatedUser, mip::PFileExtensionBehavior::Default);
+}
+
+// Where protections published for delegatedUser are cached: a service engine publishes a license per user.
+string ProtectionScope(const string& engineId, const string& delegatedUser) {
+  return delegatedUser.empty() ? engineId : engineId + "/" + delegatedUser;
+}
+
+// Sets label, or deletes the current one when label is null, and commits to the _modified output. A label's
+// protection is published for delegatedUser when set. Returns the output path, or an empty string when the
+// file already had that label.
+string SetLabel(
+  const shared_ptr<FileHandler>& fileHandler,
+  const shared_ptr<Label>& label,
+  const string& filePath,
+  const LabelingOptions& labelingOptions,
+  const string& delegatedUser) {
 
   if (label == nullptr) {
     fileHandler->DeleteLabel(labelingOptions); // Delete the current label from the file
   } else {
-    fileHandler->SetLabel(label, labelingOptions, mip::ProtectionSettings());  // Set a label with label Id to the file
+    fileHandler->SetLabel(label, labelingOptions, DelegatedProtectionSettings(delegatedUser));  // Set a label with label Id to the file
   }
 
-  auto commitPromise = make_shared<std::promise<bool>>();
-  auto commitFuture = commitPromise->get_future();
   auto modified = fileHandler->IsModified();
  
   if (modified) {
     auto outputFilePath = CreateOutput(fileHandler.get());
     try {
-      fileHandler->CommitAsync(outputFilePath, commitPromise);
-      auto committed = commitFuture.get();
+      const bool committed = CommitToPath(fileHandler, outputFilePath, filePath);
 
       if (committed) {
-        cout << "New file created: " << outputFilePath << endl;
+        MSIP_EVENT(mip::LogLevel::Info, "output_written", {"path", outputFilePath});
+        ContextManager::Instance().GetInspectionCache().Invalidate(outputFilePath);
         //Triggers audit event
         fileHandler->NotifyCommitSuccessful(filePath);
+        return outputFilePath;
       } else {
         ifstream ifs(FILENAME_STRING(outputFilePath));
         if (!ifs.fail()) {
@@ -407,189 +742,272 @@ void SetLabel(
     } catch (const std::exception& /*ex*/) {
       ifstream ifs(FILENAME_STRING(outputFilePath));
       if (!ifs.fail()) {
-        cout << "commitAsync unable to delete outputfile: " << outputFilePath << endl;
+        MSIP_EVENT(mip::LogLevel::Warning, "output_left_behind", {"path", outputFilePath});
       }
       throw;
     }
   } else {
-      cout << "No changes to commit" << endl;
+      MSIP_EVENT(mip::LogLevel::Info, "commit_skipped", {"path", filePath});
   }
+  return "";
 }
 
-// Helper function to escape JSON string values
+// Escapes input for a JSON string literal. Inputs with nothing to escape, which is nearly all paths, ids and
+// messages, cost one vector scan and a copy.
 std::string escapeJsonString(const std::string& input) {
-    std::string output = input;
-    
-    // Replace backslashes with double backslashes
-    size_t pos = 0;
-    while ((pos = output.find("\\", pos)) != std::string::npos) {
-        output.replace(pos, 1, "\\\\");
-        pos += 2;
-    }
-    
-    // Replace unescaped double quotes with escaped double quotes
-    pos = 0;
-    while ((pos = output.find("\"", pos)) != std::string::npos) {
-        // Check if this quote is already escaped
-        if (pos == 0 || output[pos-1] != '\\') {
-            output.replace(pos, 1, "\\\"");
-            pos += 2;
-        } else {
-            pos += 1;
-        }
-    }
-    
+    const size_t first = JsonWriter::FindEscape(input.data(), input.size());
+    if (first == input.size())
+        return input;
+    std::string output;
+    output.reserve(input.size() + input.size() / 8 + 8);
+    output.append(input, 0, first);
+    JsonWriter::AppendEscaped(output, input.data() + first, input.size() - first);
     return output;
 }
 
 std::string getUnprotectStatusJSON(bool status, const std::string& error, const std::string& outputPath) {
-    std::ostringstream oss;
-    oss << "{\"status\": " << (status ? "true" : "false") 
-        << ", \"path\": \"" << outputPath << "\""
-        << ", \"error\": \"" << escapeJsonString(error) << "\"}";
-    return oss.str();
+    JsonWriter json(48 + outputPath.size() + error.size());
+    json.BeginObject()
+        .Key("status").Bool(status)
+        .Key("path").String(outputPath)
+        .Key("error").String(error)
+        .EndObject();
+    return json.Take();
 }
 
-
-void Unprotect(
-  const shared_ptr<MipContext>& mipContext,
-  const shared_ptr<FileHandler>& fileHandler,
-  shared_ptr<Stream> fileStream,
-  const string& filePath,
-  char * result) {
-  cout << filePath << endl;
-  auto fileStatus = GetFileStatus(filePath, fileStream, mipContext);
-  auto isProtected = fileStatus->IsProtected();
-  auto containsProtectedObjects = fileStatus->ContainsProtectedObjects();
-  // Note that only checking if the file is protected does not require any network IO or auth
-  string fileStatus_str;
-  
-  if (!isProtected && !containsProtectedObjects) {
-    cout << "File is not protected and does not contain protected objects, no change made." << endl;
-    strcpy(result, getUnprotectStatusJSON(false, "File is not protected and does not contain protected objects, no change made.", "").c_str());
-    return;
+// Removes protection using what the handler parsed when it was opened, instead of reading the container
+// again through GetFileStatus. A handler without protection that RemoveProtection leaves unmodified had no
+// protected objects either. Returns false when there was nothing to remove.
+bool RemoveProtectionIfAny(const shared_ptr<FileHandler>& fileHandler) {
+  const bool isProtected = fileHandler->GetProtection() != nullptr;
+  try {
+    fileHandler->RemoveProtection();
+  } catch (const std::exception&) {
+    if (isProtected)
+      throw;
+    return false;
   }
+  return isProtected || fileHandler->IsModified();
+}
+
+string NotProtectedJSON() {
+  MSIP_EVENT(mip::LogLevel::Info, "unprotect_skipped", {"reason", "not_protected"});
+  return getUnprotectStatusJSON(false, "File is not protected and does not contain protected objects, no change made.", "");
+}
 
-  fileHandler->RemoveProtection(); // Remove the protection from the file
-  auto outputFilePath = CreateOutput(fileHandler.get());
+// Writes the handler's content, once its protection was removed, to the _modified output and reports it.
+// Sets committedPath, when given, to the output written.
+string CommitUnprotectedFile(const shared_ptr<FileHandler>& fileHandler, string* committedPath = nullptr) {
+  auto outputFilePath = CreateProtectionOutputPath(fileHandler->GetOutputFileName());
 
-  auto commitPromise = make_shared<std::promise<bool>>();
-  auto commitFuture = commitPromise->get_future();
   auto modified = fileHandler->IsModified();
   if (modified) {
-    fileHandler->CommitAsync(outputFilePath, commitPromise);
-    auto committed = commitFuture.get();
+    const bool committed = CommitToPath(fileHandler, outputFilePath);
 
     if (committed) {
-      cout << "New file created: " << outputFilePath << endl;
-        strcpy(result, getUnprotectStatusJSON(true, "", outputFilePath).c_str());
-    } else {
-      ifstream ifs(FILENAME_STRING(outputFilePath));
-      if (!ifs.fail()) {
-        throw std::runtime_error("commitAsync unable to delete outputfile");
-      }
+      outputFilePath = PublishOutput(outputFilePath);
+      MSIP_EVENT(mip::LogLevel::Info, "output_written", {"path", outputFilePath});
+      ContextManager::Instance().GetInspectionCache().Invalidate(outputFilePath);
+      if (committedPath)
+        *committedPath = outputFilePath;
+      return getUnprotectStatusJSON(true, "", outputFilePath);
     }
-  } else {
-    cout << "No changes to commit" << endl;
-    strcpy(result, getUnprotectStatusJSON(false, "No changes to commit", "").c_str());
+    ifstream ifs(FILENAME_STRING(outputFilePath));
+    if (!ifs.fail()) {
+      throw std::runtime_error("commitAsync unable to delete outputfile");
+    }
+    return getUnprotectStatusJSON(false, "No changes to commit", "");
   }
+  MSIP_EVENT(mip::LogLevel::Info, "commit_skipped", {"path", outputFilePath});
+  return getUnprotectStatusJSON(false, "No changes to commit", "");
+}
+
+// With package repacking on (see msipConfigurePackageRepack), writes the Office Open XML package the SDK
+// decrypts out of a protected file to the _modified output, copying its parts' compressed bytes instead of
+// having the SDK commit recompress every part. Returns false, leaving result untouched, for files that
+// are not protected OOXML packages or that the repacker leaves to the SDK.
+bool RepackUnprotectedPackage(const shared_ptr<FileHandler>& fileHandler, string& result, string* committedPath) {
+  static auto& repacked = MetricsRegistry::Shared().GetCounter(
+      "msip_native_package_repack_total", "Unprotected Office packages written by the repacker instead of an SDK commit");
+  static auto& fallbacks = MetricsRegistry::Shared().GetCounter(
+      "msip_native_package_repack_fallbacks_total", "Unprotected Office packages the repacker left to the SDK");
+  static auto& copiedParts = MetricsRegistry::Shared().GetCounter(
+      "msip_native_package_repack_copied_parts_total", "Package parts written with their original bytes");
+  static auto& deflatedParts = MetricsRegistry::Shared().GetCounter(
+      "msip_native_package_repack_deflated_parts_total", "Stored package parts deflated by the repacker");
+  auto& contextManager = ContextManager::Instance();
+  const PackageRepacker::Options options = contextManager.GetPackageRepack();
+  if (!options.enabled || !fileHandler->GetProtection())
+    return false;
+
+  auto decryptedCompletion = AsyncCompletion<shared_ptr<Stream>>::Create();
+  auto decryptedFuture = decryptedCompletion->GetFuture();
+  fileHandler->GetDecryptedTemporaryStreamAsync(decryptedCompletion);
+  auto decryptedStream = decryptedFuture.get();
+  const int64_t size = decryptedStream ? decryptedStream->Size() : 0;
+  if (size <= 0 || size > options.maxPackageBytes || FormatSniffer::SniffStream(*decryptedStream).format != FileFormat::Ooxml) {
+    fallbacks.Add(1);
+    return false;
+  }
+
+  ScopedPhase phase(PhaseMetrics::Phase::Commit);
+  BufferPool::Buffer package = BufferPool::Shared().Acquire(static_cast<size_t>(size));
+  decryptedStream->Seek(0);
+  int64_t done = 0;
+  while (done < size) {
+    const int64_t count = decryptedStream->Read(package.Data() + done, size - done);
+    if (count <= 0)
+      throw std::runtime_error("Decrypted package ended after " + std::to_string(done) + " of " + std::to_string(size) + " bytes");
+    done += count;
+  }
+
+  auto outputFilePath = CreateProtectionOutputPath(fileHandler->GetOutputFileName());
+  PackageRepacker::Stats stats;
+  if (!PackageRepacker::Repack(package.Data(), static_cast<size_t>(size), outputFilePath, options,
+      contextManager.GetTaskDispatcher(), stats)) {
+    fallbacks.Add(1);
+    return false;
+  }
+  repacked.Add(1);
+  copiedParts.Add(stats.copied);
+  deflatedParts.Add(stats.deflated);
+  outputFilePath = PublishOutput(outputFilePath);
+  MSIP_EVENT(mip::LogLevel::Info, "output_written", {"path", outputFilePath}, {"writer", "repacker"});
+  contextManager.GetInspectionCache().Invalidate(outputFilePath);
+  if (committedPath)
+    *committedPath = outputFilePath;
+  result = getUnprotectStatusJSON(true, "", outputFilePath);
+  return true;
+}
+
+// Sets committedPath, when given, to the output written.
+string Unprotect(const shared_ptr<FileHandler>& fileHandler, const string& filePath, string* committedPath = nullptr) {
+  MSIP_EVENT(mip::LogLevel::Info, "unprotect", {"path", filePath});
+  string repacked;
+  if (RepackUnprotectedPackage(fileHandler, repacked, committedPath))
+    return repacked;
+  if (!RemoveProtectionIfAny(fileHandler))
+    return NotProtectedJSON();
+  return CommitUnprotectedFile(fileHandler, committedPath);
+}
+
+// Commits the handler's pending changes into outputStream rather than a file, so there is no output path
+// to clean up after a failed commit. The result reports the number of bytes written.
+// Commits the handler's changes into outputStream within the operation's budget. False when there were none.
+bool CommitInto(const shared_ptr<FileHandler>& fileHandler, const shared_ptr<Stream>& outputStream) {
+  auto commitCompletion = AsyncCompletion<bool>::Create();
+  auto commitFuture = commitCompletion->GetFuture();
+  ScopedPhase phase(PhaseMetrics::Phase::Commit);
+  SdkAsync::Commit(fileHandler, BudgetedStream::Wrap(outputStream, OperationBudget::Current()), commitCompletion);
+  return GetWithinBudget(commitFuture);
 }
 
-// Print the labels and sublabels to the console
-void ListLabels(const vector<shared_ptr<mip::Label>>& labels, const string& delimiter = "") {
+string CommitToStream(const shared_ptr<FileHandler>& fileHandler, const shared_ptr<Stream>& outputStream) {
+  if (!CommitInto(fileHandler, outputStream))
+    return getUnprotectStatusJSON(false, "No changes to commit", "");
+
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"path\": \"\", \"bytes\": " << outputStream->Size() << ", \"error\": \"\"}";
+  return oss.str();
+}
+
+// Removes protection and commits the decrypted content into outputStream. The SDK writes it in chunks as
+// it decrypts, so nothing is staged on disk and the whole file is never held in memory.
+string UnprotectToStream(const shared_ptr<FileHandler>& fileHandler, const shared_ptr<Stream>& outputStream) {
+  if (!RemoveProtectionIfAny(fileHandler))
+    return getUnprotectStatusJSON(false, "File is not protected and does not contain protected objects, no change made.", "");
+  if (!fileHandler->IsModified())
+    return getUnprotectStatusJSON(false, "No changes to commit", "");
+  return CommitToStream(fileHandler, outputStream);
+}
+
+// Logs the labels and sublabels as events, a sublabel's parent as its parent_id.
+void ListLabels(const vector<shared_ptr<mip::Label>>& labels, const string& parentId = "") {
   static const size_t kMaxTooltipSize = 70;
   for (const auto& label : labels) {
     string labelTooltip = label->GetTooltip();
     if (labelTooltip.size() > kMaxTooltipSize)
-      labelTooltip.substr(0, kMaxTooltipSize) + "...";
-    
-    string labelAutoTooltip = label->GetAutoTooltip();
-    if (labelAutoTooltip.size() > kMaxTooltipSize)
-      labelAutoTooltip.substr(0, kMaxTooltipSize) + "...";
-    string isActive = (label->IsActive()) ? "true" : "false";
-    cout << delimiter << "Label ID: " << label->GetId() << "\n" <<
-        delimiter << "Label name: " << label->GetName() << "\n" <<
-        delimiter << "Label sensitivity: " << label->GetSensitivity() << "\n" <<
-        delimiter << "Label IsActive: " << isActive << "\n" <<
-        delimiter << "Label tooltip: " << labelTooltip << "\n" <<
-        delimiter << "Label autoTooltip: " << labelAutoTooltip << "\n" << endl;
-    
-    const vector<shared_ptr<mip::Label>>& childLabels = label->GetChildren();
-    if (!childLabels.empty()) {
-      cout << delimiter << "Child labels:" << endl;
-      ListLabels(childLabels, delimiter + "  ");
-    }
+      labelTooltip = labelTooltip.substr(0, kMaxTooltipSize) + "...";
+    MSIP_EVENT(mip::LogLevel::Info, "label_listed",
+        {"id", label->GetId()},
+        {"name", label->GetName()},
+        {"parent_id", parentId},
+        {"sensitivity", std::to_string(label->GetSensitivity())},
+        {"active", label->IsActive() ? "true" : "false"},
+        {"tooltip", labelTooltip});
+    ListLabels(label->GetChildren(), label->GetId());
   }
 }
 
+// Writes the handler's pending changes to the _modified output and reports it.
+// Sets committedPath, when given, to the output written.
+string CommitProtectedFile(const shared_ptr<FileHandler>& fileHandler, string* committedPath = nullptr) {
+  auto outputFilePath = CreateProtectionOutputPath(fileHandler->GetOutputFileName());
 
-void ProtectWithCustomPermissions(
-  const shared_ptr<FileHandler>& fileHandler,
-  const shared_ptr<FileHandler>& encfileHandler,
-  char * result) {
-  
-  fileHandler->SetProtection(encfileHandler->GetProtection());
-  auto outputFilePath = CreateOutput(fileHandler.get());
-
-  auto commitPromise = make_shared<std::promise<bool>>();
-  auto commitFuture = commitPromise->get_future();
-  fileHandler->CommitAsync(outputFilePath, commitPromise);
-  auto committed = commitFuture.get();
+  const bool committed = CommitToPath(fileHandler, outputFilePath);
 
   if (committed) {
-    cout << "New file created: " << outputFilePath << endl;
-    strcpy(result, getUnprotectStatusJSON(true, "", outputFilePath).c_str());
-  } else {
-    ifstream ifs(FILENAME_STRING(outputFilePath));
-    if (!ifs.fail()) {
-      throw std::runtime_error("commitAsync unable to delete outputfile");
-      strcpy(result, getUnprotectStatusJSON(false, "commitAsync unable to delete outputfile", "").c_str());
-    } else {
-      strcpy(result, getUnprotectStatusJSON(false, "No changes to commit", "").c_str());
-     }
+    outputFilePath = PublishOutput(outputFilePath);
+    MSIP_EVENT(mip::LogLevel::Info, "output_written", {"path", outputFilePath});
+    ContextManager::Instance().GetInspectionCache().Invalidate(outputFilePath);
+    if (committedPath)
+      *committedPath = outputFilePath;
+    return getUnprotectStatusJSON(true, "", outputFilePath);
   }
- }
+  ifstream ifs(FILENAME_STRING(outputFilePath));
+  if (!ifs.fail()) {
+    throw std::runtime_error("commitAsync unable to delete outputfile");
+  }
+  return getUnprotectStatusJSON(false, "No changes to commit", "");
+}
+
+string ProtectWithCustomPermissions(
+  const shared_ptr<FileHandler>& fileHandler,
+  const shared_ptr<ProtectionHandler>& protection,
+  string* committedPath = nullptr) {
+  
+  fileHandler->SetProtection(protection);
+  return CommitProtectedFile(fileHandler, committedPath);
+}
 
+// Copies the policy straight out of a mapping of the file, so the only copy is the one the engine settings
+// hold. Policy files shared read-only between processes stay in the page cache once.
 string ReadPolicyFile(const string& policyPath) {
-  ifstream ifs(FILENAME_STRING(policyPath));
-  if (ifs.fail())
-    throw std::runtime_error("Failed to read path: " + policyPath);
+  MappedFileStream policyFile(policyPath);
 
-  cout << "Using policy from file: " << policyPath << endl;
+  MSIP_EVENT(mip::LogLevel::Info, "policy_file_used", {"path", policyPath});
 
-  ostringstream policyContent;
-  policyContent << ifs.rdbuf();
-  ifs.close();
-  return policyContent.str();
+  string policyContent(static_cast<size_t>(policyFile.Size()), '\0');
+  if (!policyContent.empty())
+    policyFile.Read(reinterpret_cast<uint8_t*>(&policyContent[0]), policyFile.Size());
+  return policyContent;
 }
 
-void EnsureUserHasRights(const shared_ptr<FileHandler>& fileHandler) {
-  if (!fileHandler->GetProtection() || fileHandler->GetProtection()->AccessCheck(mip::rights::Export())) {
+// The rights are read from the rights cache, or put there for later checkRights calls on the same content.
+void EnsureUserHasRights(const shared_ptr<ProtectionHandler>& protection) {
+  if (!protection)
     return;
+
+  auto& rightsCache = ContextManager::Instance().GetRightsCache();
+  const string contentId = protection->GetContentId();
+  const string user = protection->GetIssuedTo();
+  RightsCache::Entry rights;
+  if (!rightsCache.Find(contentId, user, rights)) {
+    rights = RightsCache::FromProtection(*protection);
+    rightsCache.Put(contentId, user, rights);
   }
+  if (RightsCache::Allows(rights, mip::rights::Export()))
+    return;
 
   throw NoPermissionsError(
       NoPermissionsError::Category::AccessDenied,
       "A minimum right of EXPORT is required to change label or protection",
-      fileHandler->GetProtection()->GetProtectionDescriptor()->GetReferrer(),
-      fileHandler->GetProtection()->GetOwner());
+      protection->GetProtectionDescriptor()->GetReferrer(),
+      protection->GetOwner());
 }
 
-shared_ptr<FileProfile> CreateProfile(
-    const shared_ptr<MipContext>& mipContext,
-    const shared_ptr<ConsentDelegate>& consentDelegate) {
-  const shared_ptr<ProfileObserver> sampleProfileObserver = make_shared<ProfileObserver>();
-
-  FileProfile::Settings profileSettings(
-      mipContext,
-      CacheStorageType::InMemory,
-      consentDelegate,
-      sampleProfileObserver);
-
-  auto loadPromise = make_shared<std::promise<shared_ptr<FileProfile>>>();
-  auto loadFuture = loadPromise->get_future();
-  FileProfile::LoadAsync(profileSettings, loadPromise); // Getting the profile
-  return loadFuture.get();
+void EnsureUserHasRights(const shared_ptr<FileHandler>& fileHandler) {
+  EnsureUserHasRights(fileHandler->GetProtection());
 }
 
 vector<mip::LabelFilterType> CreateLabelFiltersFromString(const string& labelFilter) {
@@ -632,13 +1050,13 @@ vector<mip::LabelFilterType> CreateLabelFiltersFromString(const string& labelFil
 
 void ConfigureFunctionality(
     FileEngine::Settings& settings,
-    const string& enableFunctionality,
-    const string& disableFunctionality) {
-  for(const auto& filter : CreateLabelFiltersFromString(enableFunctionality)) {
+    const vector<mip::LabelFilterType>& enabledFunctionality,
+    const vector<mip::LabelFilterType>& disabledFunctionality) {
+  for(const auto& filter : enabledFunctionality) {
     settings.ConfigureFunctionality(filter, true);
   }
 
-  for(const auto& filter : CreateLabelFiltersFromString(disableFunctionality)) {
+  for(const auto& filter : disabledFunctionality) {
     settings.ConfigureFunctionality(filter, false);
   }
 }
@@ -646,6 +1064,7 @@ void ConfigureFunctionality(
 shared_ptr<FileEngine> GetFileEngine(
     const shared_ptr<FileProfile>& fileProfile,
     const shared_ptr<AuthDelegate>& authDelegate,
+    const string& engineId,
     const string& username,
     const string& protectionBaseUrl,
     const string& policyBaseUrl,
@@ -655,29 +1074,47 @@ shared_ptr<FileEngine> GetFileEngine(
     bool decryptAll,
     bool enablePowerBI,
     bool protectionOnly,
-    const string& locale,
-    const string& enableFunctionality,
-    const string& disableFunctionality,
-    bool keepPdfLinearization) {
-  FileEngine::Settings settings(Identity(username), authDelegate, "" /*clientData*/, locale, false /* loadSensitivityTypes*/);
+    bool keepPdfLinearization,
+    mip::DataBoundary dataBoundary) {
+  const auto storageOptions = ContextManager::Instance().GetStorageOptions();
+  const auto engineOptions = ContextManager::Instance().GetEngineOptions();
+  const bool loadSensitivityTypes = !protectionOnly && storageOptions.loadSensitivityTypes;
+  FileEngine::Settings settings(Identity(username), authDelegate, "" /*clientData*/, engineOptions->locale, loadSensitivityTypes);
+  settings.SetEngineId(engineId);
 
   settings.SetCloud(mip::Cloud::Commercial);
+  settings.SetDataBoundary(dataBoundary);
   settings.SetProtectionOnlyEngine(protectionOnly);
 
-  if (!protectionBaseUrl.empty() && !policyBaseUrl.empty()) {
-    settings.SetProtectionCloudEndpointBaseUrl(protectionBaseUrl);
-    settings.SetPolicyCloudEndpointBaseUrl(policyBaseUrl);
+  // Endpoints learned for the user's tenant spare a new user's engine the service discovery round trips.
+  auto& tenantEndpoints = ContextManager::Instance().GetTenantEndpoints();
+  TenantEndpointCache::Endpoints endpoints = { protectionBaseUrl, policyBaseUrl };
+  TenantEndpointCache::Endpoints known;
+  const bool useKnown = protectionBaseUrl.empty() && policyBaseUrl.empty() &&
+      tenantEndpoints.FindEndpoints(username, known) && !known.protectionBaseUrl.empty() && !known.policyBaseUrl.empty();
+  if (useKnown)
+    endpoints = known;
+  if (!endpoints.protectionBaseUrl.empty() && !endpoints.policyBaseUrl.empty()) {
+    settings.SetProtectionCloudEndpointBaseUrl(endpoints.protectionBaseUrl);
+    settings.SetPolicyCloudEndpointBaseUrl(endpoints.policyBaseUrl);
     settings.SetCloud(mip::Cloud::Custom);
   }
 
-  ConfigureFunctionality(settings, enableFunctionality, disableFunctionality);
+  ConfigureFunctionality(settings, engineOptions->enabledFunctionality, engineOptions->disabledFunctionality);
   
   vector<pair<string, string>> customSettings;
   if (!policyPath.empty()) { // If Policy path was given, saving the policy in custom setting
     customSettings.emplace_back(mip::GetCustomSettingPolicyDataName(), ReadPolicyFile(policyPath)); //Save the content of the policy in custom setting
   }
+  if (storageOptions.policyTtlDays > 0) {
+    customSettings.emplace_back(mip::GetCustomSettingPolicyTtlDays(), std::to_string(storageOptions.policyTtlDays));
+  }
+  if (!protectionOnly && storageOptions.exportPolicySnapshot && !storageOptions.policySnapshotPath.empty()) {
+    customSettings.emplace_back(mip::GetCustomSettingExportPolicyFileName(), storageOptions.policySnapshotPath);
+  }
   if (enableMsg) {
     customSettings.emplace_back(mip::GetCustomSettingEnableMsgFileType(), "true"); // enable msg format for sample application testing.
+    customSettings.emplace_back(mip::GetCustomSettingMaxNestedProtectedMsgs(), std::to_string(kMaxNestedProtectedMsgs));
   }
   if (enablePowerBI) {
     customSettings.emplace_back(mip::GetCustomSettingEnablePowerBIFileType(), "true"); // enable PowerBI format for sample application testing.
@@ -698,32 +1135,312 @@ shared_ptr<FileEngine> GetFileEngine(
     customSettings.emplace_back(mip::GetCustomSettingContainerDecryptionOption(),
         mip::ContainerDecryptionOptionString(mip::ContainerDecryptionOption::All)); 
   }
+  customSettings.insert(customSettings.end(), engineOptions->customSettings.begin(), engineOptions->customSettings.end());
   settings.SetCustomSettings(customSettings);
 
-  auto addEnginePromise = make_shared<std::promise<shared_ptr<FileEngine>>>();
-  auto addEngineFuture = addEnginePromise->get_future();
-  fileProfile->AddEngineAsync(settings, addEnginePromise); // Getting the engine
-  return addEngineFuture.get();
+  ScopedPhase phase(PhaseMetrics::Phase::EngineLoad);
+  auto addEngine = [&]() {
+    auto addEngineCompletion = AsyncCompletion<shared_ptr<FileEngine>>::Create();
+    auto addEngineFuture = addEngineCompletion->GetFuture();
+    auto addEngineControl = SdkAsync::AddEngine(fileProfile, settings, addEngineCompletion); // Getting the engine
+    return WaitForOperation(addEngineFuture, addEngineControl);
+  };
+  shared_ptr<FileEngine> engine;
+  try {
+    engine = addEngine();
+  } catch (const sample::deadline::DeadlineExceededError&) {
+    throw;
+  } catch (const std::exception&) {
+    if (!useKnown)
+      throw;
+    // The tenant's endpoints may have moved: forget them and let the SDK discover them again.
+    tenantEndpoints.Forget(username);
+    settings.SetProtectionCloudEndpointBaseUrl("");
+    settings.SetPolicyCloudEndpointBaseUrl("");
+    settings.SetCloud(mip::Cloud::Commercial);
+    engine = addEngine();
+  }
+  if (!useKnown) {
+    const auto& loaded = engine->GetSettings();
+    if (endpoints.protectionBaseUrl.empty() || endpoints.policyBaseUrl.empty())
+      endpoints = { loaded.GetProtectionCloudEndpointBaseUrl(), loaded.GetPolicyCloudEndpointBaseUrl() };
+    tenantEndpoints.PutEndpoints(username, endpoints);
+  }
+  return engine;
+}
+
+// Loads the engine for key into an EngineCache entry. Policy engines get a label index, and every engine a
+// reload that loads a replacement with the same auth delegate; policy refresh runs outside any caller's
+// operation, so its challenges get the token of the engine's most recent caller.
+EngineCache::Entry LoadCachedFileEngine(
+    const EngineCache::Key& key,
+    const shared_ptr<FileProfile>& profile,
+    const shared_ptr<AuthDelegateImpl>& authDelegate,
+    const string& engineId) {
+  // Loads, and policy refreshes on the cache's thread, dispatch their SDK work under the engine's tenant.
+  sample::tenant::ScopedTenant tenantScope(key.applicationId);
+  // Read again on every load, so a policy engine refresh picks up an updated snapshot.
+  const auto storageOptions = ContextManager::Instance().GetStorageOptions();
+  const string policyPath = key.protectionOnly || storageOptions.exportPolicySnapshot ? "" : storageOptions.policySnapshotPath;
+
+  EngineCache::Entry created;
+  created.protectionOnly = key.protectionOnly;
+  created.authDelegate = authDelegate;
+  created.profile = profile;
+  created.engine = GetFileEngine(
+      profile,
+      created.authDelegate,
+      engineId,
+      key.username,
+      key.protectionBaseUrl,
+      key.policyBaseUrl,
+      policyPath,
+      key.msgContainers /*enableMsg*/,
+      false,
+      key.msgContainers /*decryptAll*/,
+      false,
+      key.protectionOnly,
+      ContextManager::Instance().GetPdfOptions().keepLinearization,
+      ContextManager::Instance().GetRegionOptions(key.applicationId).dataBoundary);
+  if (!key.protectionOnly) {
+    created.labels = make_shared<LabelIndex>(created.engine->ListSensitivityLabels());
+    // Under the key's engine id, which a reload's replacement id is not, so other processes find it.
+    ContextManager::Instance().GetSharedLabelSnapshots().Publish(EngineCache::MakeEngineId(key), *created.labels);
+    if (storageOptions.loadSensitivityTypes) {
+      created.sensitivityTypes = SensitivityTypeIndex::Load(
+          created.engine->GetSensitivityFileId(), created.engine->ListSensitivityTypes(), storageOptions.sensitivityTypeCachePath);
+      created.classifier = make_shared<SensitivityTypeClassifier>(created.sensitivityTypes, kClassificationCacheSize);
+    }
+  }
+  // Weak, so a cached entry never keeps its profile alive past shutdown.
+  std::weak_ptr<FileProfile> weakProfile = profile;
+  created.reload = [key, weakProfile, authDelegate](const string& replacementId) {
+    auto currentProfile = weakProfile.lock();
+    if (!currentProfile)
+      throw std::runtime_error("The engine's profile was released");
+    return LoadCachedFileEngine(key, currentProfile, authDelegate, replacementId);
+  };
+  return created;
+}
+
+// Returns the cached engine for key, creating it on first use. Every caller of the key shares the engine and
+// its auth delegate, so the caller's token is not stored in it: each export scopes its token to its thread
+// (see protection_token_context.h), and the delegate answers each challenge with it.
+EngineCache::Entry GetCachedFileEngineEntry(
+    const EngineCache::Key& userKey,
+    const string& protectionToken,
+    const string& workingDirectory) {
+  const auto key = ServiceEngineKey(userKey);
+  auto& contextManager = ContextManager::Instance();
+  auto profile = contextManager.GetProfile(key.applicationId);
+
+  return contextManager.GetEngineCache().GetOrCreate(key, [&](const string& engineId) {
+    const string password = "";
+    const string sccToken = "";
+    auto authDelegate = make_shared<AuthDelegateImpl>(false /*isVerbose*/, key.username, password, key.applicationId, sccToken, protectionToken, workingDirectory,
+        contextManager.GetTokenAcquirer(), contextManager.GetClientSecret());
+    // The engine's challenges come one after the other while it loads; tokens for those earlier engines
+    // made are fetched in parallel first.
+    authDelegate->Prefetch();
+    auto created = LoadCachedFileEngine(key, profile, authDelegate, engineId);
+    // Recorded once loaded, so msipRestoreEngines after a restart only reloads engines the profile stored.
+    if (auto manifest = contextManager.GetEngineManifest())
+      manifest->Record(engineId, key);
+    return created;
+  });
+}
+
+shared_ptr<FileEngine> GetCachedFileEngine(
+    const EngineCache::Key& key,
+    const string& protectionToken,
+    const string& workingDirectory) {
+  return GetCachedFileEngineEntry(key, protectionToken, workingDirectory).engine;
 }
 
-shared_ptr<FileHandler> GetFileHandler(
+// Keeps the protection engines apart from the file engines of the same key, which share the storage.
+static const char kProtectionEngineSuffix[] = "-protection";
+
+// ProtectionEngine counterpart of GetCachedFileEngine, for the APIs only the protection engine offers.
+ContextManager::ProtectionEngineEntry GetCachedProtectionEngine(
+    const EngineCache::Key& userKey,
+    const string& protectionToken,
+    const string& workingDirectory) {
+  const auto key = ServiceEngineKey(userKey);
+  auto& contextManager = ContextManager::Instance();
+  return contextManager.GetProtectionEngine(key, [&](const shared_ptr<ProtectionProfile>& profile) {
+    const string password = "";
+    const string sccToken = "";
+
+    ContextManager::ProtectionEngineEntry created;
+    created.authDelegate = make_shared<AuthDelegateImpl>(false /*isVerbose*/, key.username, password, key.applicationId, sccToken, protectionToken, workingDirectory,
+        contextManager.GetTokenAcquirer(), contextManager.GetClientSecret());
+    created.authDelegate->Prefetch();
+    const auto engineOptions = contextManager.GetEngineOptions();
+    ProtectionEngine::Settings settings(EngineCache::MakeEngineId(key) + kProtectionEngineSuffix, created.authDelegate, "" /*clientData*/, engineOptions->locale);
+    settings.SetCustomSettings(engineOptions->customSettings);
+    if (!key.username.empty())
+      settings.SetIdentity(Identity(key.username));
+    settings.SetCloud(mip::Cloud::Commercial);
+    settings.SetDataBoundary(contextManager.GetRegionOptions(key.applicationId).dataBoundary);
+    auto& tenantEndpoints = contextManager.GetTenantEndpoints();
+    TenantEndpointCache::Endpoints known;
+    const bool useKnown = key.protectionBaseUrl.empty() && tenantEndpoints.FindEndpoints(key.username, known) &&
+        !known.protectionBaseUrl.empty();
+    const string protectionBaseUrl = useKnown ? known.protectionBaseUrl : key.protectionBaseUrl;
+    if (!protectionBaseUrl.empty()) {
+      settings.SetCloudEndpointBaseUrl(protectionBaseUrl);
+      settings.SetCloud(mip::Cloud::Custom);
+    }
+    ScopedPhase phase(PhaseMetrics::Phase::EngineLoad);
+    try {
+      created.engine = profile->AddEngine(settings);
+    } catch (const std::exception&) {
+      if (!useKnown)
+        throw;
+      tenantEndpoints.Forget(key.username);
+      settings.SetCloudEndpointBaseUrl("");
+      settings.SetCloud(mip::Cloud::Commercial);
+      created.engine = profile->AddEngine(settings);
+    }
+    // The endpoint the SDK discovered, through the DNS record of the user's domain or the service, spares
+    // the tenant's next engine that lookup.
+    if (!key.protectionBaseUrl.empty())
+      tenantEndpoints.PutEndpoints(key.username, { key.protectionBaseUrl, "" });
+    else if (!useKnown)
+      tenantEndpoints.PutEndpoints(key.username, { created.engine->GetSettings().GetCloudEndpointBaseUrl(), "" });
+    created.publisher = make_shared<OfflinePublisher>(created.engine);
+    created.templates = make_shared<TemplateCatalog>(created.engine);
+    created.templates->Prefetch();
+    return created;
+  });
+}
+
+// Keeps the policy engines apart from the file and protection engines of the same key.
+static const char kPolicyEngineSuffix[] = "-policy";
+
+// PolicyEngine counterpart of GetCachedProtectionEngine, for computing label actions without content.
+ContextManager::PolicyEngineEntry GetCachedPolicyEngine(
+    const EngineCache::Key& userKey,
+    const string& protectionToken,
+    const string& workingDirectory) {
+  const auto key = ServiceEngineKey(userKey);
+  auto& contextManager = ContextManager::Instance();
+  return contextManager.GetPolicyEngine(key, [&](const shared_ptr<PolicyProfile>& profile) {
+    const string password = "";
+    const string sccToken = "";
+
+    ContextManager::PolicyEngineEntry created;
+    created.authDelegate = make_shared<AuthDelegateImpl>(false /*isVerbose*/, key.username, password, key.applicationId, sccToken, protectionToken, workingDirectory,
+        contextManager.GetTokenAcquirer(), contextManager.GetClientSecret());
+    created.authDelegate->Prefetch();
+    const auto engineOptions = contextManager.GetEngineOptions();
+    PolicyEngine::Settings settings(EngineCache::MakeEngineId(key) + kPolicyEngineSuffix, created.authDelegate, "" /*clientData*/, engineOptions->locale);
+    settings.SetCustomSettings(engineOptions->customSettings);
+    if (!key.username.empty())
+      settings.SetIdentity(Identity(key.username));
+    settings.SetCloud(mip::Cloud::Commercial);
+    settings.SetDataBoundary(contextManager.GetRegionOptions(key.applicationId).dataBoundary);
+    auto& tenantEndpoints = contextManager.GetTenantEndpoints();
+    TenantEndpointCache::Endpoints known;
+    const bool useKnown = key.policyBaseUrl.empty() && tenantEndpoints.FindEndpoints(key.username, known) &&
+        !known.policyBaseUrl.empty();
+    const string policyBaseUrl = useKnown ? known.policyBaseUrl : key.policyBaseUrl;
+    if (!policyBaseUrl.empty()) {
+      settings.SetCloudEndpointBaseUrl(policyBaseUrl);
+      settings.SetCloud(mip::Cloud::Custom);
+    }
+    ScopedPhase phase(PhaseMetrics::Phase::EngineLoad);
+    try {
+      created.engine = profile->AddEngine(settings, nullptr /*context*/);
+    } catch (const std::exception&) {
+      if (!useKnown)
+        throw;
+      tenantEndpoints.Forget(key.username);
+      settings.SetCloudEndpointBaseUrl("");
+      settings.SetCloud(mip::Cloud::Commercial);
+      created.engine = profile->AddEngine(settings, nullptr /*context*/);
+    }
+    created.planner = make_shared<LabelActionPlanner>(created.engine);
+    return created;
+  });
+}
+
+// Passes rejection, a reason FormatGate gave for turning an input away, counting it when there is one.
+const string& CountRejection(const string& rejection) {
+  static auto& rejected = MetricsRegistry::Shared().GetCounter(
+      "msip_native_inputs_rejected_total", "Inputs turned away by their size or format before being opened");
+  if (!rejection.empty())
+    rejected.Add(1);
+  return rejection;
+}
+
+static const char* const kQuarantinedError = "Input is quarantined after going over its operation budget";
+
+shared_ptr<mip::AsyncControl> StartCreateFileHandler(
     const shared_ptr<FileEngine>& fileEngine,
-    const shared_ptr<Stream>& stream,
+    shared_ptr<Stream> stream,
     const string& filePath,
     DataState dataState,
     bool displayClassificationRequests,
-    string applicationScenarioId) {
-  auto fileExecutionState = make_shared<FileExecutionStateImpl>(dataState, nullptr, displayClassificationRequests, applicationScenarioId);
-  auto createFileHandlerPromise = make_shared<std::promise<shared_ptr<FileHandler>>>();
-  auto createFileHandlerFuture = createFileHandlerPromise->get_future();
+    const string& applicationScenarioId,
+    const shared_ptr<FileHandler::Observer>& observer,
+    const shared_ptr<void>& context,
+    shared_ptr<FileExecutionStateImpl> fileExecutionState = nullptr) {
+  static auto& handlersCreated = MetricsRegistry::Shared().GetCounter(
+      "msip_native_file_handlers_total", "File handlers created, one per file opened");
+  // Junk is turned away before the SDK parses it. A stream's name gains the extension its content
+  // implies when it has none, since the SDK picks the file format from the name.
+  FormatSniffer::Result sniffed = { FileFormat::Unknown, string(), -1 };
+  string rejection;
+  if (stream) {
+    sniffed = FormatSniffer::SniffStream(*stream);
+    rejection = FormatGate::Instance().Check(filePath, sniffed);
+  } else {
+    rejection = FormatGate::Instance().CheckFile(filePath);
+  }
+  if (!CountRejection(rejection).empty())
+    throw std::runtime_error(rejection);
+  if (InputQuarantine::Instance().Contains(filePath))
+    throw std::runtime_error(kQuarantinedError);
+  // The handler reads the input through the budget, which quarantines it if the operation goes over, and
+  // the bytes it reads are charged to the operation's cost key. An input opened by path is read by the SDK
+  // itself, so it is charged its size.
+  const auto& budget = OperationBudget::Current();
+  if (budget)
+    budget->SetInput(filePath);
+  if (stream) {
+    stream = BudgetedStream::Wrap(stream, budget);
+  } else if (sample::cost::CurrentKey() != sample::cost::kNoKey) {
+    struct stat fileInfo;
+    if (stat(filePath.c_str(), &fileInfo) == 0 && fileInfo.st_size > 0)
+      sample::cost::Add(sample::cost::Counter::BytesRead, static_cast<uint64_t>(fileInfo.st_size));
+  }
+  handlersCreated.Add(1);
+  if (!fileExecutionState)
+    fileExecutionState = make_shared<FileExecutionStateImpl>(dataState, nullptr, displayClassificationRequests, applicationScenarioId);
   bool auditDiscoveryEnabled = !displayClassificationRequests;
   // Here content identifier is same as the filePath
   if (stream) {
-    fileEngine->CreateFileHandlerAsync(stream, filePath, auditDiscoveryEnabled, make_shared<FileHandlerObserver>(), createFileHandlerPromise, fileExecutionState); // create the file handler
-  } else {
-    fileEngine->CreateFileHandlerAsync(filePath, filePath, auditDiscoveryEnabled, make_shared<FileHandlerObserver>(), createFileHandlerPromise, fileExecutionState); // create the file handler
+    stream->Seek(0); // The stream may already have been scanned by GetFileStatus
+    return fileEngine->CreateFileHandlerAsync(stream, FormatGate::HintedName(filePath, sniffed), auditDiscoveryEnabled, observer, context, fileExecutionState); // create the file handler
   }
-  return createFileHandlerFuture.get();
+  return fileEngine->CreateFileHandlerAsync(filePath, filePath, auditDiscoveryEnabled, observer, context, fileExecutionState); // create the file handler
+}
+
+shared_ptr<FileHandler> GetFileHandler(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<Stream>& stream,
+    const string& filePath,
+    DataState dataState,
+    bool displayClassificationRequests,
+    string applicationScenarioId) {
+  auto createFileHandlerCompletion = AsyncCompletion<shared_ptr<FileHandler>>::Create();
+  auto createFileHandlerFuture = createFileHandlerCompletion->GetFuture();
+  ScopedPhase phase(PhaseMetrics::Phase::HandlerCreate);
+  auto createControl = StartCreateFileHandler(
+      fileEngine, stream, filePath, dataState, displayClassificationRequests, applicationScenarioId,
+      FileHandlerObserver::Shared(), createFileHandlerCompletion);
+  return WaitForOperation(createFileHandlerFuture, createControl);
 }
 
 string GetWorkingDirectory() {
@@ -737,214 +1454,8277 @@ string GetWorkingDirectory() {
   return fileSamplePath;
 }
 
-} // namespace
+InspectionCache::Result InspectFileStatus(
+    const string& filePath, const shared_ptr<Stream>& stream, const shared_ptr<MipContext>& mipContext) {
+  auto fileStatus = GetFileStatus(filePath, stream, mipContext);
+  InspectionCache::Result result;
+  result.isProtected = fileStatus->IsProtected();
+  result.isLabeled = fileStatus->IsLabeled();
+  result.containsProtectedObjects = fileStatus->ContainsProtectedObjects();
+  return result;
+}
 
+// Answers from the known-clean filter when it holds key, and otherwise runs inspect and adds key when the
+// content is unprotected, unlabeled and without protected objects. Key 0 always runs inspect.
+InspectionCache::Result ProbeKnownClean(uint64_t key, const std::function<InspectionCache::Result()>& inspect) {
+  auto& knownClean = ContextManager::Instance().GetKnownCleanFilter();
+  const auto answer = knownClean.Lookup(key);
+  if (answer == KnownCleanFilter::Answer::Clean)
+    return InspectionCache::Result{ false, false, false };
+  const auto result = inspect();
+  knownClean.Record(key, !result.isProtected && !result.isLabeled && !result.containsProtectedObjects, answer);
+  return result;
+}
 
-extern "C" int getFileStatus(const char *filePath_str, const char *applicationId_str, char *result)
-{
-  try {
-    shared_ptr<mip::Stream> fileStream = nullptr;
-    map<string, string> telemetrySettings;
-    const string filePath(filePath_str);
-    const string applicationId(applicationId_str);
-    ApplicationInfo appInfo;
-    appInfo.applicationId = applicationId;
-    appInfo.applicationName = "MsipFileApp";
-    appInfo.applicationVersion = "1.0.0.0";
-    auto fileSampleWorkingDirectory = GetWorkingDirectory();
+// Files are not looked up in the known-clean filter: their fingerprint covers only the first and last 4 KiB,
+// so a same-sized file changed in the middle, e.g. a .msg that gained a protected attachment, would be
+// answered clean without a probe.
+InspectionCache::Result ProbeFileStatus(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  return ContextManager::Instance().GetInspectionCache().GetOrInspect(filePath, [&]() {
+    return InspectFileStatus(filePath, GetLargeInputStream(filePath), mipContext);
+  });
+}
 
-    auto diagnosticOverride = make_shared<mip::DiagnosticConfiguration>();
-    diagnosticOverride->customSettings = telemetrySettings;
-    diagnosticOverride->isAuditPriorityEnhanced = true;
-    diagnosticOverride->maxTeardownTimeSec = 2;
-    diagnosticOverride->isMaxTeardownTimeEnabled = true;
-    auto mipConfiguration = make_shared<mip::MipConfiguration>(appInfo, "file_sample_storage", mip::LogLevel::Trace, 0);
-    mipConfiguration->SetDiagnosticConfiguration(diagnosticOverride);
-    map<mip::FlightingFeature, bool> featureSettingsOverride;
-    mipConfiguration->SetFeatureSettings(featureSettingsOverride);
-
-    auto mipContext = MipContext::Create(mipConfiguration);
-    sample::ShutdownManager lifetimeManager(mipContext);
-    string fileStatus_str;
-    auto fileStatus = GetFileStatus(filePath, fileStream, mipContext);
-    fileStatus_str += "{\"protected\": ";
-    fileStatus_str += fileStatus->IsProtected() ? "true" : "false";
-    fileStatus_str += ", \"labeled\": ";
-    fileStatus_str += fileStatus->IsLabeled() ? "true" : "false";
-    fileStatus_str += ", \"protected_objects\": ";
-    fileStatus_str += fileStatus->ContainsProtectedObjects() ? "true" : "false";
-    fileStatus_str += ", \"path\": \"";
-    fileStatus_str += filePath_str;
-    fileStatus_str += "\", \"status\": true";
-    fileStatus_str += "}";
-    strcpy(result, fileStatus_str.c_str());
-    return EXIT_SUCCESS;   
-  }
-  catch (const std::exception& ex) {
-    string fileStatus_str;
-    fileStatus_str += "{\"status\": false, \"error\": \"";
-    fileStatus_str += escapeJsonString(ex.what());
-    fileStatus_str += "\", \"path\": \"";
-    fileStatus_str += filePath_str;
-    fileStatus_str += "\"}";
-    strcpy(result, fileStatus_str.c_str());
-    return EXIT_FAILURE;
-  }
-}    
-
-
-extern "C" int unprotectFile(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, char *result)
-{
-  try {
-    shared_ptr<mip::Stream> fileStream = nullptr;
-    map<string, string> telemetrySettings;
-    const string filePath(filePath_str);
-    const string protectionToken(protectionToken_str);
-    const string applicationId(applicationId_str);
-    ApplicationInfo appInfo;
-    appInfo.applicationId = applicationId;
-    appInfo.applicationName = "MsipFileApp";
-    appInfo.applicationVersion = "1.0.0.0";
-    auto fileSampleWorkingDirectory = GetWorkingDirectory();
+// extraFields, when given, is inserted before the path as ", \"name\": value" pairs.
+string FileStatusJSON(const string& filePath, const InspectionCache::Result& status, const string& extraFields = "") {
+  JsonWriter json(96 + filePath.size() + extraFields.size());
+  json.BeginObject()
+      .Key("protected").Bool(status.isProtected)
+      .Key("labeled").Bool(status.isLabeled)
+      .Key("protected_objects").Bool(status.containsProtectedObjects)
+      .RawMembers(extraFields)
+      .Key("path").String(filePath)
+      .Key("status").Bool(true)
+      .EndObject();
+  return json.Take();
+}
 
-    const string username = "";
-    const string password = "";
-    const string sccToken = "";
+string FileStatusJSON(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  return FileStatusJSON(filePath, ProbeFileStatus(filePath, mipContext));
+}
 
-    auto authDelegate = make_shared<AuthDelegateImpl>(false /*isVerbose*/, username, password, applicationId, sccToken, protectionToken, fileSampleWorkingDirectory);
+string FileStatusErrorJSON(const string& filePath, const string& error) {
+  JsonWriter json(40 + error.size() + filePath.size());
+  json.BeginObject()
+      .Key("status").Bool(false)
+      .Key("error").String(error)
+      .Key("path").String(filePath)
+      .EndObject();
+  return json.Take();
+}
 
-    auto consentDelegate = make_shared<ConsentDelegateImpl>(false /*isVerbose*/);
+// Reads the publishing license from the file header without opening a handler.
+vector<uint8_t> ReadPublishingLicense(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  auto publishingLicense = FileHandler::GetSerializedPublishingLicense(GetLargeInputStream(filePath), filePath, mipContext);
+  if (publishingLicense.empty())
+    throw std::runtime_error("File is not protected");
+  return publishingLicense;
+}
 
-    auto diagnosticOverride = make_shared<mip::DiagnosticConfiguration>();
-    diagnosticOverride->customSettings = telemetrySettings;
-    diagnosticOverride->isAuditPriorityEnhanced = true;
-    diagnosticOverride->maxTeardownTimeSec = 2;
-    diagnosticOverride->isMaxTeardownTimeEnabled = true;
-    auto mipConfiguration = make_shared<mip::MipConfiguration>(appInfo, "file_sample_storage", mip::LogLevel::Trace, 0);
-    mipConfiguration->SetDiagnosticConfiguration(diagnosticOverride);
-    map<mip::FlightingFeature, bool> featureSettingsOverride;
-    mipConfiguration->SetFeatureSettings(featureSettingsOverride);
+// Parses publishingLicense offline, once per distinct license.
+LicenseInfoCache::Info ParseLicenseInfo(const vector<uint8_t>& publishingLicense, const shared_ptr<MipContext>& mipContext) {
+  return ContextManager::Instance().GetLicenseInfoCache().GetOrParse(publishingLicense, [&]() {
+    auto licenseInfo = ProtectionProfile::GetPublishingLicenseInfo(publishingLicense, mipContext);
+    LicenseInfoCache::Info result;
+    result.owner = licenseInfo->GetOwner();
+    result.contentId = licenseInfo->GetContentId();
+    auto descriptor = licenseInfo->GetDescriptor();
+    if (descriptor) {
+      result.templateId = descriptor->GetId();
+      const auto& items = descriptor->GetDescriptorItems();
+      if (!items.empty() && items.front())
+        result.templateName = items.front()->GetName();
+    }
+    result.issuerId = licenseInfo->GetIssuerId();
+    result.domains = licenseInfo->GetDomains();
+    const auto labelInfo = licenseInfo->GetLabelInfo();
+    result.labelId = labelInfo.labelId;
+    result.tenantId = labelInfo.tenantId;
+    result.referralUrl = licenseInfo->GetReferralInfoUrl();
+    result.issuedTime = static_cast<int64_t>(std::chrono::system_clock::to_time_t(licenseInfo->GetIssuedTime()));
+    result.doubleKey = licenseInfo->GetIsDoubleKeyLicense();
+    return result;
+  });
+}
 
-    auto mipContext = MipContext::Create(mipConfiguration);
-    sample::ShutdownManager lifetimeManager(mipContext);
+LicenseInfoCache::Info ReadLicenseInfo(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  return ParseLicenseInfo(ReadPublishingLicense(filePath, mipContext), mipContext);
+}
 
-    const string protectionBaseUrl = "";
-    const string policyBaseUrl = "";
-    const string policyPath = "";
-    const string enableFunctionality = "";
-    const string disableFunctionality = "";
-
-    auto profile = CreateProfile(mipContext, consentDelegate);   
-    auto fileEngine = GetFileEngine(
-        profile,
-        authDelegate,
-        username, // set for protect
-        protectionBaseUrl,
-        policyBaseUrl,
-        policyPath, 
-        false,
-        false,
-        false,
-        false,
-        true, // true for protect
-        "en-US",
-        enableFunctionality,
-        disableFunctionality,
-        false
-    );
-    
-    DataState dataState = DataState::REST;
-    string applicationScenarioId = "";
-    auto fileHandler = GetFileHandler(fileEngine, fileStream, filePath, dataState, false, applicationScenarioId);
+// Rights holders are not reported: they are encrypted for the service and need a license acquisition to read.
+string LicenseInfoJSON(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  auto info = ReadLicenseInfo(filePath, mipContext);
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"path\": \"" << escapeJsonString(filePath) << "\""
+      << ", \"owner\": \"" << escapeJsonString(info.owner) << "\""
+      << ", \"content_id\": \"" << escapeJsonString(info.contentId) << "\""
+      << ", \"template_id\": \"" << escapeJsonString(info.templateId) << "\""
+      << ", \"template_name\": \"" << escapeJsonString(info.templateName) << "\""
+      << ", \"issuer_id\": \"" << escapeJsonString(info.issuerId) << "\""
+      << ", \"domains\": [";
+  for (size_t i = 0; i < info.domains.size(); ++i)
+    oss << (i ? ", " : "") << "\"" << escapeJsonString(info.domains[i]) << "\"";
+  oss << "]"
+      << ", \"label_id\": \"" << escapeJsonString(info.labelId) << "\""
+      << ", \"tenant_id\": \"" << escapeJsonString(info.tenantId) << "\""
+      << ", \"referral_url\": \"" << escapeJsonString(info.referralUrl) << "\""
+      << ", \"issued_time\": " << info.issuedTime
+      << ", \"double_key\": " << (info.doubleKey ? "true" : "false") << "}";
+  return oss.str();
+}
 
-    EnsureUserHasRights(fileHandler);
-    Unprotect(mipContext, fileHandler, fileStream, filePath, result);
-    return EXIT_SUCCESS;
-        
-  }
-  catch (const std::exception& ex) {    
-    strcpy(result, getUnprotectStatusJSON(false, ex.what(), "").c_str());
-    return EXIT_FAILURE;
+// Opens a protected file. While the engine holds no use license for the file's content, concurrent opens
+// of that content wait for the first one to acquire it and then open against the SDK's license cache.
+shared_ptr<FileHandler> GetProtectedFileHandler(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<MipContext>& mipContext,
+    const shared_ptr<mip::Stream>& fileStream,
+    const string& filePath) {
+  string contentId;
+  if (ContextManager::Instance().GetStorageOptions().canCacheLicenses) {
+    try {
+      contentId = ReadLicenseInfo(filePath, mipContext).contentId;
+    }
+    catch (const std::exception&) {
+      // Not protected, or unreadable: opening it reports why.
+    }
   }
+  if (contentId.empty())
+    return GetFileHandler(fileEngine, fileStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+
+  shared_ptr<FileHandler> acquired;
+  ContextManager::Instance().GetUseLicenseCache().GetOrAcquire(fileEngine->GetSettings().GetEngineId(), contentId, [&]() {
+    ScopedPhase phase(PhaseMetrics::Phase::LicenseAcquire);
+    acquired = GetFileHandler(fileEngine, fileStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    return acquired->GetProtection();
+  });
+  return acquired ? acquired : GetFileHandler(fileEngine, fileStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
 }
 
+string UnprotectFileJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<MipContext>& mipContext,
+    const string& filePath,
+    string* committedPath = nullptr,
+    shared_ptr<ProtectionHandler>* usedProtection = nullptr) {
+  shared_ptr<mip::Stream> fileStream = GetLargeInputStream(filePath);
+  auto fileHandler = GetProtectedFileHandler(fileEngine, mipContext, fileStream, filePath);
+  EnsureUserHasRights(fileHandler);
+  if (usedProtection)
+    *usedProtection = fileHandler->GetProtection();
+  return Unprotect(fileHandler, filePath, committedPath);
+}
 
-extern "C" int protectFile(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *result)
-{
+// Whether filePath is a .pfile the fast path reads (see msipSetPfileFastPath).
+bool UsesPfileFastPath(const string& filePath) {
+  static const string kPfileExtension = ".pfile";
+  return ContextManager::Instance().GetPfileFastPath() && EqualsIgnoreCase(GetFileExtension(filePath), kPfileExtension);
+}
+
+// Protection of the pfile whose header is header, from the protection engine of key. Handlers are kept in the
+// use license cache by content id, so later files of the same license need no service call.
+shared_ptr<ProtectionHandler> AcquirePfileProtection(
+    const EngineCache::Key& key,
+    const string& protectionToken,
+    const PfileHeader& header) {
+  auto& contextManager = ContextManager::Instance();
+  auto protectionEngine = GetCachedProtectionEngine(key, protectionToken, GetWorkingDirectory()).engine;
+  const auto licenseInfo = ProtectionProfile::GetPublishingLicenseInfo(header.publishingLicense, contextManager.GetMipContext(key.applicationId));
+  return contextManager.GetUseLicenseCache().GetOrAcquire(
+      protectionEngine->GetSettings().GetEngineId(), licenseInfo->GetContentId(), [&]() {
+    ScopedPhase phase(PhaseMetrics::Phase::LicenseAcquire);
+    ProtectionHandler::ConsumptionSettings consumptionSettings(header.publishingLicense);
+    return protectionEngine->CreateProtectionHandlerForConsumption(consumptionSettings, nullptr);
+  });
+}
+
+// Unprotects a .pfile with the protection engine of key alone. The pfile header holds the publishing license
+// and the offset of the ciphertext, so no file engine, policy or label evaluation is involved. Handlers are
+// kept in the use license cache by content id, so later files of the same license decrypt without a service
+// call. Returns false, leaving result untouched, when the fast path is off or the file is not a pfile this
+// reader knows; the caller then opens it through the File SDK.
+bool UnprotectPfile(
+    const EngineCache::Key& key,
+    const string& protectionToken,
+    const string& filePath,
+    string& result,
+    string* committedPath = nullptr,
+    shared_ptr<ProtectionHandler>* usedProtection = nullptr) {
+  static auto& decrypted = MetricsRegistry::Shared().GetCounter(
+      "msip_native_pfile_fast_path_total", "Pfiles decrypted with a protection engine, without a file engine");
+  static auto& fallbacks = MetricsRegistry::Shared().GetCounter(
+      "msip_native_pfile_fast_path_fallbacks_total", "Pfiles the fast path could not read, opened through the File SDK");
+  static const string kPfileExtension = ".pfile";
+  auto& contextManager = ContextManager::Instance();
+  if (!UsesPfileFastPath(filePath))
+    return false;
+
+  PfileHeader header;
+  int64_t fileSize;
+  {
+    auto fileStream = GetLargeInputStream(filePath);
+    fileSize = fileStream->Size();
+    if (!ReadPfileHeader(*fileStream, header)) {
+      fallbacks.Add(1);
+      return false;
+    }
+  }
+
+  auto protection = AcquirePfileProtection(key, protectionToken, header);
+  EnsureUserHasRights(protection);
+  if (usedProtection)
+    *usedProtection = protection;
+
+  // A ciphertext that does not match the original size under this cipher was cut or laid out differently.
+  const int64_t contentSize = fileSize - static_cast<int64_t>(header.contentStart);
+  const int64_t originalSize = static_cast<int64_t>(header.originalSize);
+  if (contentSize < originalSize || contentSize > protection->GetProtectedContentLength(originalSize, true)) {
+    fallbacks.Add(1);
+    return false;
+  }
+
+  string outputFilePath = CreateProtectionOutputPath(filePath.substr(0, filePath.size() - kPfileExtension.size()));
+  {
+    ScopedPhase phase(PhaseMetrics::Phase::Commit);
+    DecryptFileRange(protection, filePath, static_cast<int64_t>(header.contentStart), originalSize, outputFilePath,
+        contextManager.GetTaskDispatcher());
+  }
+  outputFilePath = PublishOutput(outputFilePath);
+  decrypted.Add(1);
+  contextManager.GetInspectionCache().Invalidate(outputFilePath);
+  if (committedPath)
+    *committedPath = outputFilePath;
+  result = getUnprotectStatusJSON(true, "", outputFilePath);
+  return true;
+}
+
+string FileSessionJSON(FileSessionTable::Handle handle, const FileSessionTable::Session& session) {
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"path\": \"" << escapeJsonString(session.filePath) << "\""
+      << ", \"session\": " << handle
+      << ", \"protected\": " << (session.handler->GetProtection() ? "true" : "false")
+      << ", \"labeled\": " << (session.handler->GetLabel() ? "true" : "false") << "}";
+  return oss.str();
+}
+
+// Label and protection of an open session, read from what the handler parsed when it was opened.
+string FileSessionLabelJSON(const FileSessionTable::Session& session) {
+  auto label = session.handler->GetLabel();
+  auto protection = session.handler->GetProtection();
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"path\": \"" << escapeJsonString(session.filePath) << "\", \"label\": ";
+  if (label) {
+    oss << "{\"id\": \"" << escapeJsonString(label->GetLabel()->GetId()) << "\""
+        << ", \"name\": \"" << escapeJsonString(label->GetLabel()->GetName()) << "\"";
+    if (const shared_ptr<mip::Label> parent = label->GetLabel()->GetParent().lock())
+      oss << ", \"parent_id\": \"" << escapeJsonString(parent->GetId()) << "\"";
+    oss << ", \"privileged\": " << (label->GetAssignmentMethod() == AssignmentMethod::PRIVILEGED ? "true" : "false")
+        << ", \"set_time\": " << static_cast<int64_t>(std::chrono::system_clock::to_time_t(label->GetCreationTime())) << "}";
+  } else {
+    oss << "null";
+  }
+  oss << ", \"protection\": ";
+  if (protection) {
+    const auto descriptor = protection->GetProtectionDescriptor();
+    oss << "{\"owner\": \"" << escapeJsonString(protection->GetOwner()) << "\""
+        << ", \"template_id\": \"" << escapeJsonString(descriptor->GetTemplateId()) << "\""
+        << ", \"name\": \"" << escapeJsonString(descriptor->GetName()) << "\""
+        << ", \"template_based\": " << (descriptor->GetProtectionType() == mip::ProtectionType::TemplateBased ? "true" : "false")
+        << ", \"export\": " << (protection->AccessCheck(mip::rights::Export()) ? "true" : "false") << "}";
+  } else {
+    oss << "null";
+  }
+  oss << "}";
+  return oss.str();
+}
+
+// Protection of the reference file, read once per engine until the file changes.
+shared_ptr<ProtectionHandler> GetReferenceProtection(
+    const shared_ptr<FileEngine>& fileEngine,
+    const string& encryptedFilePath) {
+  return ContextManager::Instance().GetProtectionCache().GetOrLoad(
+      fileEngine->GetSettings().GetEngineId(), encryptedFilePath, [&]() {
+    auto encFileHandler = GetFileHandler(fileEngine, GetLargeInputStream(encryptedFilePath), encryptedFilePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    return encFileHandler->GetProtection();
+  });
+}
+
+// Protects filePath into its "_modified" copy, or into outputStream when one is given.
+string ProtectFileJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<ProtectionHandler>& protection,
+    const string& filePath,
+    const shared_ptr<Stream>& outputStream = nullptr,
+    string* committedPath = nullptr) {
+  auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+  EnsureUserHasRights(fileHandler);
+  if (!outputStream)
+    return ProtectWithCustomPermissions(fileHandler, protection, committedPath);
+  fileHandler->SetProtection(protection);
+  return CommitToStream(fileHandler, outputStream);
+}
+
+// Protects filePath with an RMS template or a sensitivity label, without a reference file, published for
+// delegatedUser when set. The handler the SDK creates for a template is cached per engine and delegated user,
+// so later files reuse its publishing license instead of requesting a new one. Labels come from the engine's
+// already loaded policy.
+string ProtectWithTemplateJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const string& templateId,
+    const string& labelId,
+    const string& filePath,
+    const string& delegatedUser) {
+  auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+  EnsureUserHasRights(fileHandler);
+
+  if (!labelId.empty()) {
+    auto label = fileEngine->GetLabelById(labelId);
+    if (!label)
+      throw std::runtime_error("Label not found: " + labelId);
+    fileHandler->SetLabel(label, LabelingOptions(AssignmentMethod::STANDARD), DelegatedProtectionSettings(delegatedUser));
+    return CommitProtectedFile(fileHandler);
+  }
+
+  auto& protectionCache = ContextManager::Instance().GetProtectionCache();
+  const string scope = ProtectionScope(fileEngine->GetSettings().GetEngineId(), delegatedUser);
+  auto protection = protectionCache.FindTemplate(scope, templateId);
+  if (protection) {
+    fileHandler->SetProtection(protection);
+  } else {
+    auto descriptor = ProtectionDescriptorBuilder::CreateFromTemplate(templateId)->Build();
+    fileHandler->SetProtection(descriptor, DelegatedProtectionSettings(delegatedUser));
+    protectionCache.PutTemplate(scope, templateId, fileHandler->GetProtection());
+  }
+  return CommitProtectedFile(fileHandler);
+}
+
+// Protects filePath with custom permissions. Like a template's, the handler created from the interned
+// descriptor is cached per engine, so files protected with the same permissions share its publishing license.
+string ProtectWithPermissionsJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const ProtectionDescriptorInterner::Interned& permissions,
+    const string& filePath,
+    const string& delegatedUser) {
+  auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+  EnsureUserHasRights(fileHandler);
+
+  auto& protectionCache = ContextManager::Instance().GetProtectionCache();
+  const string scope = ProtectionScope(fileEngine->GetSettings().GetEngineId(), delegatedUser);
+  auto protection = protectionCache.FindAdhoc(scope, permissions.key);
+  if (protection) {
+    fileHandler->SetProtection(protection);
+  } else {
+    fileHandler->SetProtection(permissions.descriptor, DelegatedProtectionSettings(delegatedUser));
+    protectionCache.PutAdhoc(scope, permissions.key, fileHandler->GetProtection());
+  }
+  return CommitProtectedFile(fileHandler);
+}
+
+string LabelFileJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<Label>& label,
+    const LabelingOptions& labelingOptions,
+    const string& filePath,
+    const string& delegatedUser,
+    string& committedPath) {
+  auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+  EnsureUserHasRights(fileHandler);
+  committedPath = SetLabel(fileHandler, label, filePath, labelingOptions, delegatedUser);
+  if (committedPath.empty())
+    return getUnprotectStatusJSON(false, "No changes to commit", "");
+  return getUnprotectStatusJSON(true, "", committedPath);
+}
+
+const char* ActionTypeName(mip::ActionType type) {
+  switch (type) {
+    case mip::ActionType::ADD_CONTENT_FOOTER: return "add_content_footer";
+    case mip::ActionType::ADD_CONTENT_HEADER: return "add_content_header";
+    case mip::ActionType::ADD_WATERMARK: return "add_watermark";
+    case mip::ActionType::ADD_DYNAMIC_WATERMARK: return "add_dynamic_watermark";
+    case mip::ActionType::CUSTOM: return "custom";
+    case mip::ActionType::JUSTIFY: return "justify";
+    case mip::ActionType::METADATA: return "metadata";
+    case mip::ActionType::PROTECT_ADHOC: return "protect_adhoc";
+    case mip::ActionType::PROTECT_ADHOC_DK: return "protect_adhoc_dk";
+    case mip::ActionType::PROTECT_BY_TEMPLATE: return "protect_by_template";
+    case mip::ActionType::PROTECT_BY_ENCRYPT_ONLY: return "protect_by_encrypt_only";
+    case mip::ActionType::PROTECT_DO_NOT_FORWARD: return "protect_do_not_forward";
+    case mip::ActionType::PROTECT_DO_NOT_FORWARD_DK: return "protect_do_not_forward_dk";
+    case mip::ActionType::REMOVE_CONTENT_FOOTER: return "remove_content_footer";
+    case mip::ActionType::REMOVE_CONTENT_HEADER: return "remove_content_header";
+    case mip::ActionType::REMOVE_PROTECTION: return "remove_protection";
+    case mip::ActionType::REMOVE_WATERMARK: return "remove_watermark";
+    case mip::ActionType::REMOVE_DYNAMIC_WATERMARK: return "remove_dynamic_watermark";
+    case mip::ActionType::APPLY_LABEL: return "apply_label";
+    case mip::ActionType::RECOMMEND_LABEL: return "recommend_label";
+  }
+  return "unknown";
+}
+
+void AppendClassificationIdsJSON(std::ostringstream& oss, const vector<string>& ids) {
+  oss << ", \"classification_ids\": [";
+  for (size_t i = 0; i < ids.size(); ++i)
+    oss << (i ? ", " : "") << "\"" << escapeJsonString(ids[i]) << "\"";
+  oss << "]";
+}
+
+// Runs the policy's auto-labeling and recommendation rules over the file with classifier answering the
+// SDK's classification requests. Nothing is written; the actions say what applying them would do.
+string ClassifyFileJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<const Classifier>& classifier,
+    const string& filePath) {
+  auto executionState = make_shared<FileExecutionStateImpl>(
+      DataState::REST, nullptr, false, "" /*applicationScenarioId*/, classifier, filePath);
+  auto createFileHandlerCompletion = AsyncCompletion<shared_ptr<FileHandler>>::Create();
+  auto createFileHandlerFuture = createFileHandlerCompletion->GetFuture();
+  shared_ptr<FileHandler> fileHandler;
+  {
+    ScopedPhase phase(PhaseMetrics::Phase::HandlerCreate);
+    auto createControl = StartCreateFileHandler(
+        fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/,
+        FileHandlerObserver::Shared(), createFileHandlerCompletion, executionState);
+    fileHandler = WaitForOperation(createFileHandlerFuture, createControl);
+  }
+
+  auto classifyCompletion = AsyncCompletion<vector<shared_ptr<mip::Action>>>::Create();
+  auto classifyFuture = classifyCompletion->GetFuture();
+  fileHandler->ClassifyAsync(classifyCompletion);
+  const auto actions = classifyFuture.get();
+
+  shared_ptr<mip::ClassificationResults> results;
+  const bool classified = executionState->WasClassified(results);
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"path\": \"" << escapeJsonString(filePath) << "\""
+      << ", \"classified\": " << (classified ? "true" : "false") << ", \"actions\": [";
+  for (size_t i = 0; i < actions.size(); ++i) {
+    const auto& action = actions[i];
+    oss << (i ? ", " : "") << "{\"type\": \"" << ActionTypeName(action->GetType()) << "\"";
+    if (action->GetType() == mip::ActionType::APPLY_LABEL) {
+      const auto& applyLabel = static_cast<const mip::ApplyLabelAction&>(*action);
+      oss << ", \"label_id\": \"" << escapeJsonString(applyLabel.GetLabel() ? applyLabel.GetLabel()->GetId() : "") << "\"";
+      AppendClassificationIdsJSON(oss, applyLabel.GetClassificationIds());
+    } else if (action->GetType() == mip::ActionType::RECOMMEND_LABEL) {
+      const auto& recommendLabel = static_cast<const mip::RecommendLabelAction&>(*action);
+      oss << ", \"label_id\": \"" << escapeJsonString(recommendLabel.GetLabel() ? recommendLabel.GetLabel()->GetId() : "") << "\"";
+      AppendClassificationIdsJSON(oss, recommendLabel.GetClassificationIds());
+    }
+    oss << "}";
+  }
+  oss << "], \"sensitivity_types\": [";
+  if (results) {
+    bool first = true;
+    for (const auto& result : *results) {
+      oss << (first ? "" : ", ") << "{\"id\": \"" << escapeJsonString(result.second->GetId()) << "\""
+          << ", \"name\": \"" << escapeJsonString(result.second->GetName()) << "\""
+          << ", \"count\": " << result.second->GetCount()
+          << ", \"confidence\": " << result.second->GetConfidenceLevel() << "}";
+      first = false;
+    }
+  }
+  oss << "]}";
+  return oss.str();
+}
+
+// Protects with a publishing license signed locally, so the only round trips are the file engine's.
+string ProtectOfflineJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<OfflinePublisher>& publisher,
+    const string& templateId,
+    const string& filePath) {
+  auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+  EnsureUserHasRights(fileHandler);
+  fileHandler->SetProtection(publisher->Publish(templateId));
+  return CommitProtectedFile(fileHandler);
+}
+
+string OfflinePublisherJSON(const OfflinePublisher::Stats& stats) {
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"ready\": " << (stats.ready ? "true" : "false")
+      << ", \"templates\": " << stats.templates
+      << ", \"loads\": " << stats.loads
+      << ", \"published\": " << stats.published
+      << ", \"retries\": " << stats.retries << "}";
+  return oss.str();
+}
+
+string TenantInfoJSON(const TenantEndpointCache::TenantInfo& info, bool cached) {
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"tenant_id\": \"" << escapeJsonString(info.tenantId) << "\""
+      << ", \"issuer_name\": \"" << escapeJsonString(info.issuerName) << "\""
+      << ", \"extranet_url\": \"" << escapeJsonString(info.extranetUrl) << "\""
+      << ", \"intranet_url\": \"" << escapeJsonString(info.intranetUrl) << "\""
+      << ", \"cached\": " << (cached ? "true" : "false") << "}";
+  return oss.str();
+}
+
+static_assert(PhaseMetrics::kBucketCount == sample::http::HttpDelegateImpl::kLatencyBucketCount,
+    "HTTP latency histograms share the phase histograms' bounds");
+
+// {"count", "sum" (seconds), "buckets"}, with the per-bucket counts made cumulative like Prometheus ones.
+void WriteHistogramJSON(std::ostream& oss, const uint64_t* buckets, uint64_t count, double sumSeconds) {
+  oss << "{\"count\": " << count << ", \"sum\": " << sumSeconds << ", \"buckets\": [";
+  uint64_t cumulative = 0;
+  for (size_t bucket = 0; bucket < PhaseMetrics::kBucketCount; ++bucket) {
+    cumulative += buckets[bucket];
+    oss << (bucket ? ", " : "") << cumulative;
+  }
+  oss << "]}";
+}
+
+uint64_t SumBuckets(const uint64_t* buckets) {
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket <= PhaseMetrics::kBucketCount; ++bucket)
+    count += buckets[bucket];
+  return count;
+}
+
+static_assert(sample::lock::kBucketCount == PhaseMetrics::kBucketCount, "lock histograms are written like phase ones");
+
+// Every native latency histogram in one result, phases under "phases" and HTTP requests per host under
+// "http", each with cumulative counts per bound in "bounds", then the total. Lock wait and hold times per
+// lock are under "locks", with their finer bounds in "lock_bounds".
+string PhaseMetricsJSON() {
+  const auto histograms = PhaseMetrics::Snapshot();
+  const auto endpoints = ContextManager::Instance().GetHttpDelegate()->GetEndpointStats();
+  const auto locks = sample::lock::Snapshot();
+  std::ostringstream oss;
+  oss.precision(12);
+  oss << "{\"status\": true, \"bounds\": [";
+  for (size_t bucket = 0; bucket < PhaseMetrics::kBucketCount; ++bucket)
+    oss << (bucket ? ", " : "") << PhaseMetrics::GetBucketBoundSeconds(bucket);
+  oss << "], \"phases\": {";
+  for (size_t phase = 0; phase < histograms.size(); ++phase) {
+    const auto& histogram = histograms[phase];
+    oss << (phase ? ", " : "") << "\"" << PhaseMetrics::GetName(static_cast<PhaseMetrics::Phase>(phase)) << "\": ";
+    WriteHistogramJSON(oss, histogram.buckets, histogram.count, static_cast<double>(histogram.sumNanoseconds) / 1e9);
+  }
+  oss << "}, \"http\": {";
+  bool first = true;
+  for (const auto& endpoint : endpoints) {
+    oss << (first ? "" : ", ") << "\"" << escapeJsonString(endpoint.first) << "\": ";
+    WriteHistogramJSON(oss, endpoint.second.latencyBuckets, SumBuckets(endpoint.second.latencyBuckets),
+        static_cast<double>(endpoint.second.latencyMicros) / 1e6);
+    first = false;
+  }
+  oss << "}, \"lock_bounds\": [";
+  for (size_t bucket = 0; bucket < sample::lock::kBucketCount; ++bucket)
+    oss << (bucket ? ", " : "") << sample::lock::GetBucketBoundSeconds(bucket);
+  oss << "], \"locks\": {";
+  for (size_t lock = 0; lock < locks.size(); ++lock) {
+    oss << (lock ? ", " : "") << "\"" << escapeJsonString(locks[lock].name) << "\": {\"contended\": " << locks[lock].contended
+        << ", \"wait\": ";
+    WriteHistogramJSON(oss, locks[lock].wait.buckets, locks[lock].wait.count, static_cast<double>(locks[lock].wait.sumNanoseconds) / 1e9);
+    oss << ", \"hold\": ";
+    WriteHistogramJSON(oss, locks[lock].hold.buckets, locks[lock].hold.count, static_cast<double>(locks[lock].hold.sumNanoseconds) / 1e9);
+    oss << "}";
+  }
+  oss << "}}";
+  return oss.str();
+}
+
+struct CacheSample {
+  string cache;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t size;
+  size_t capacity;
+  uint64_t lockWaits;
+};
+
+template <typename Stats>
+CacheSample MakeCacheSample(const string& cache, const Stats& stats) {
+  return { cache, stats.hits, stats.misses, stats.evictions, stats.size, stats.capacity, stats.lockWaits };
+}
+
+void AddCacheFamily(
+    PrometheusWriter& writer,
+    const vector<CacheSample>& caches,
+    const string& name,
+    const string& help,
+    const string& type,
+    const std::function<double(const CacheSample&)>& value) {
+  writer.BeginFamily(name, help, type);
+  for (const auto& cache : caches)
+    writer.AddSample(name, { { "cache", cache.cache } }, value(cache));
+}
+
+// The _bucket, _sum and _count samples of one series, from per-bucket counts on the native bounds, or on
+// the lock metrics' bounds.
+void AddHistogramSamples(
+    PrometheusWriter& writer,
+    const string& family,
+    const std::pair<string, string>& label,
+    const uint64_t* buckets,
+    uint64_t count,
+    double sumSeconds,
+    double (*getBound)(size_t) = PhaseMetrics::GetBucketBoundSeconds) {
+  uint64_t cumulative = 0;
+  for (size_t bucket = 0; bucket < PhaseMetrics::kBucketCount; ++bucket) {
+    cumulative += buckets[bucket];
+    std::ostringstream bound;
+    bound << getBound(bucket);
+    writer.AddSample(family + "_bucket", { label, { "le", bound.str() } }, static_cast<double>(cumulative));
+  }
+  writer.AddSample(family + "_bucket", { label, { "le", "+Inf" } }, static_cast<double>(count));
+  writer.AddSample(family + "_sum", { label }, sumSeconds);
+  writer.AddSample(family + "_count", { label }, static_cast<double>(count));
+}
+
+// Every native counter and gauge in Prometheus text format, so one call per scrape replaces the
+// per-cache stats exports. Values are read from the components' own counters; nothing here sits on a hot path.
+// Without withHistograms the latency histograms are left out, for a collector that reads them from
+// PhaseMetricsJSON instead.
+string RenderPrometheus(bool withHistograms = true) {
+  auto& contextManager = ContextManager::Instance();
+  PrometheusWriter writer;
+  MetricsRegistry::Shared().Render(writer);
+
+  const vector<CacheSample> caches = {
+    MakeCacheSample("engine", contextManager.GetEngineCache().GetStats()),
+    MakeCacheSample("inspection", contextManager.GetInspectionCache().GetStats()),
+    MakeCacheSample("protection", contextManager.GetProtectionCache().GetStats()),
+    MakeCacheSample("protection_descriptor", contextManager.GetDescriptorInterner().GetStats()),
+    MakeCacheSample("license_info", contextManager.GetLicenseInfoCache().GetStats()),
+    MakeCacheSample("use_license", contextManager.GetUseLicenseCache().GetStats()),
+    MakeCacheSample("delegation_license", contextManager.GetDelegationLicenseCache().GetStats()),
+    MakeCacheSample("rights", contextManager.GetRightsCache().GetStats()),
+    MakeCacheSample("tenant", contextManager.GetTenantEndpoints().GetStats()),
+    MakeCacheSample("container_structure", contextManager.GetContainerStructureCache().GetStats()),
+  };
+  AddCacheFamily(writer, caches, "msip_native_cache_hits_total", "Cache lookups served from the cache", "counter",
+      [](const CacheSample& cache) { return static_cast<double>(cache.hits); });
+  AddCacheFamily(writer, caches, "msip_native_cache_misses_total", "Cache lookups that had to load", "counter",
+      [](const CacheSample& cache) { return static_cast<double>(cache.misses); });
+  AddCacheFamily(writer, caches, "msip_native_cache_evictions_total", "Entries evicted to stay within capacity", "counter",
+      [](const CacheSample& cache) { return static_cast<double>(cache.evictions); });
+  AddCacheFamily(writer, caches, "msip_native_cache_entries", "Entries held; for the engine cache, the loaded engines", "gauge",
+      [](const CacheSample& cache) { return static_cast<double>(cache.size); });
+  AddCacheFamily(writer, caches, "msip_native_cache_capacity", "Configured cache capacity", "gauge",
+      [](const CacheSample& cache) { return static_cast<double>(cache.capacity); });
+  AddCacheFamily(writer, caches, "msip_native_cache_lock_waits_total",
+      "Cache writes that waited for their shard's lock; for the engine cache, lookups that waited for the pool's lock", "counter",
+      [](const CacheSample& cache) { return static_cast<double>(cache.lockWaits); });
+
+  const auto decrypted = contextManager.GetDecryptedContentCache().GetStats();
+  writer.AddCounter("msip_native_decrypted_cache_hits_total", "Unprotects served from the decrypted content cache",
+      static_cast<double>(decrypted.hits));
+  writer.AddCounter("msip_native_decrypted_cache_misses_total", "Cacheable unprotects the decrypted content cache could not serve",
+      static_cast<double>(decrypted.misses));
+  writer.AddCounter("msip_native_decrypted_cache_revalidation_failures_total",
+      "Decrypted content dropped because its rights were no longer cached or its license expired",
+      static_cast<double>(decrypted.revalidationFailures));
+  writer.AddCounter("msip_native_decrypted_cache_evictions_total", "Decrypted content evicted to stay within the byte capacity",
+      static_cast<double>(decrypted.evictions));
+  writer.AddCounter("msip_native_decrypted_cache_revocations_total", "Decrypted content dropped because its content was revoked",
+      static_cast<double>(decrypted.revocations));
+  writer.AddGauge("msip_native_decrypted_cache_entries", "Files held by the decrypted content cache", static_cast<double>(decrypted.entries));
+  writer.AddGauge("msip_native_decrypted_cache_bytes", "Sealed bytes held by the decrypted content cache", static_cast<double>(decrypted.bytes));
+  writer.AddGauge("msip_native_decrypted_cache_capacity_bytes", "Configured decrypted content cache capacity",
+      static_cast<double>(decrypted.capacityBytes));
+
+  const auto structures = contextManager.GetContainerStructureCache().GetStats();
+  writer.AddCounter("msip_native_container_structure_served_reads_total",
+      "Input reads served from the container structure an earlier stream over the file recorded",
+      static_cast<double>(structures.servedReads));
+  writer.AddCounter("msip_native_container_structure_served_bytes_total", "Bytes of those reads",
+      static_cast<double>(structures.servedBytes));
+
+  const auto engines = contextManager.GetEngineCache().GetStats();
+  writer.AddGauge("msip_native_policy_engines", "Policy engines in the engine cache; the rest are protection-only",
+      static_cast<double>(engines.policyEngines));
+  writer.AddCounter("msip_native_policy_refreshes_total", "Policy engines replaced after their policy went stale",
+      static_cast<double>(engines.policyRefreshes));
+  writer.AddCounter("msip_native_policy_refresh_failures_total", "Policy engine replacements that failed to load",
+      static_cast<double>(engines.policyRefreshFailures));
+  writer.AddCounter("msip_native_engine_hibernations_total", "Engines unloaded after being idle past the idle timeout",
+      static_cast<double>(engines.hibernations));
+  writer.AddCounter("msip_native_engine_restores_total", "Loads of an engine hibernated before", static_cast<double>(engines.restores));
+  writer.AddCounter("msip_native_engine_restore_seconds_total", "Time those loads took", engines.restoreMs / 1000.0);
+  writer.AddGauge("msip_native_engines_hibernated", "Hibernated engines not loaded again since", static_cast<double>(engines.hibernated));
+
+  auto memoryStorage = std::dynamic_pointer_cast<sample::storage::ColumnarStorageDelegate>(
+      contextManager.GetStorageOptions().storageDelegate);
+  if (memoryStorage) {
+    const auto storage = memoryStorage->GetStats();
+    writer.AddGauge("msip_native_memory_storage_rows", "Rows held by the in-memory storage tables", static_cast<double>(storage.rows));
+    writer.AddGauge("msip_native_memory_storage_bytes", "Bytes held by the in-memory storage tables", static_cast<double>(storage.bytes));
+    writer.AddCounter("msip_native_memory_storage_evicted_rows_total", "Rows evicted to keep the in-memory storage within its budget",
+        static_cast<double>(storage.evictedRows));
+    writer.AddCounter("msip_native_memory_storage_compressed_values_total", "Storage values held deflated",
+        static_cast<double>(storage.compressedValues));
+    writer.AddCounter("msip_native_memory_storage_compressed_raw_bytes_total", "Bytes of those values before deflating",
+        static_cast<double>(storage.compressedRawBytes));
+    writer.AddCounter("msip_native_memory_storage_compressed_bytes_total", "Bytes of those values as held",
+        static_cast<double>(storage.compressedBytes));
+    writer.AddGauge("msip_native_memory_storage_compression_ratio", "Bytes before deflating per byte held, over every deflated value",
+        storage.compressedBytes > 0 ? static_cast<double>(storage.compressedRawBytes) / static_cast<double>(storage.compressedBytes) : 0.0);
+    writer.AddCounter("msip_native_memory_storage_decodes_total", "Deflated storage values inflated for a read",
+        static_cast<double>(storage.decodes));
+    writer.AddCounter("msip_native_memory_storage_decode_seconds_total", "Time spent inflating them",
+        static_cast<double>(storage.decodeNanoseconds) / 1e9);
+    writer.AddGauge("msip_native_memory_storage_dictionaries", "Tenant dictionaries the in-memory storage deflates against",
+        static_cast<double>(storage.dictionaries));
+  }
+
+  auto encryptedStorage = std::dynamic_pointer_cast<sample::storage::EncryptedLogStorageDelegate>(
+      contextManager.GetStorageOptions().storageDelegate);
+  if (encryptedStorage) {
+    const auto storage = encryptedStorage->GetStats();
+    writer.AddGauge("msip_native_encrypted_storage_records", "Live records in the encrypted storage logs", static_cast<double>(storage.records));
+    writer.AddGauge("msip_native_encrypted_storage_live_bytes", "Bytes of the live records in the encrypted storage logs",
+        static_cast<double>(storage.liveBytes));
+    writer.AddGauge("msip_native_encrypted_storage_file_bytes", "Bytes of the encrypted storage logs on disk", static_cast<double>(storage.fileBytes));
+    writer.AddCounter("msip_native_encrypted_storage_compactions_total", "Encrypted storage logs rewritten without their dead records",
+        static_cast<double>(storage.compactions));
+  }
+
+  writer.AddGauge("msip_native_open_stream_handles", "Stream handles open through openDecrypted or msipOpen",
+      static_cast<double>(contextManager.GetStreamHandles().Count()));
+  const auto sessions = contextManager.GetFileSessions().GetStats();
+  writer.AddGauge("msip_native_open_file_sessions", "File sessions open through openFileSession", static_cast<double>(sessions.open));
+  writer.AddCounter("msip_native_file_sessions_expired_total", "File sessions closed after the idle timeout", static_cast<double>(sessions.expired));
+  const auto admission = contextManager.GetAdmissionController().GetStats();
+  writer.AddGauge("msip_native_admitted_in_flight", "File operations admitted and still running", static_cast<double>(admission.inFlight));
+  writer.AddGauge("msip_native_admitted_bytes", "Estimated memory held by admitted file operations", static_cast<double>(admission.bytesInFlight));
+  writer.AddCounter("msip_native_admission_rejected_total", "File operations rejected by admission control", static_cast<double>(admission.rejected));
+  writer.AddCounter("msip_native_admission_tenant_rejected_total", "File operations rejected because their tenant was at its own limit",
+      static_cast<double>(admission.tenantRejected));
+  writer.AddGauge("msip_native_admission_bulk_in_flight", "Bulk file operations in flight", static_cast<double>(admission.bulkInFlight));
+  writer.AddCounter("msip_native_admission_bulk_rejected_total", "Bulk file operations rejected because bulk work was at its limit",
+      static_cast<double>(admission.bulkRejected));
+  if (admission.adaptive) {
+    writer.AddCounter("msip_native_admission_adaptive_rejected_total",
+        "File operations rejected because their type was at its adaptive limit", static_cast<double>(admission.adaptiveRejected));
+    const auto operations = contextManager.GetAdmissionController().GetOperationStats();
+    writer.BeginFamily("msip_native_admission_adaptive_limit", "Adaptive concurrency limit of each operation type", "gauge");
+    for (const auto& operation : operations)
+      writer.AddSample("msip_native_admission_adaptive_limit", { { "operation", operation.operation } }, static_cast<double>(operation.limit));
+    writer.BeginFamily("msip_native_admission_operation_in_flight", "File operations of each type in flight", "gauge");
+    for (const auto& operation : operations)
+      writer.AddSample("msip_native_admission_operation_in_flight", { { "operation", operation.operation } }, static_cast<double>(operation.inFlight));
+    writer.BeginFamily("msip_native_admission_operation_latency_microseconds",
+        "Smoothed latency of each operation type, from admission to completion", "gauge");
+    for (const auto& operation : operations)
+      writer.AddSample("msip_native_admission_operation_latency_microseconds", { { "operation", operation.operation } },
+          static_cast<double>(operation.latencyMicros));
+  }
+
+  const auto idempotency = IdempotencyCache::Instance().GetStats();
+  if (idempotency.capacity != 0) {
+    writer.AddCounter("msip_native_idempotency_hits_total", "Retries answered with the kept result of their idempotency key",
+        static_cast<double>(idempotency.hits));
+    writer.AddCounter("msip_native_idempotency_coalesced_total", "Retries that waited for the call of their idempotency key",
+        static_cast<double>(idempotency.coalesced));
+    writer.AddCounter("msip_native_idempotency_conflicts_total", "Idempotency keys reused for another request",
+        static_cast<double>(idempotency.conflicts));
+    writer.AddGauge("msip_native_idempotency_results", "Results kept for idempotency keys", static_cast<double>(idempotency.size));
+  }
+
+  ShardWorker::Stats shards;
+  if (contextManager.GetShardWorkerStats(shards)) {
+    writer.AddCounter("msip_native_shards_claimed_total", "Shards of sharded jobs this replica claimed", static_cast<double>(shards.claimed));
+    writer.AddCounter("msip_native_shards_stolen_total", "Claimed shards whose previous worker's lease had lapsed",
+        static_cast<double>(shards.stolen));
+    writer.AddCounter("msip_native_shards_completed_total", "Claimed shards run and recorded", static_cast<double>(shards.completed));
+    writer.AddCounter("msip_native_shards_released_total", "Claimed shards given back unrun, e.g. while draining",
+        static_cast<double>(shards.released));
+    writer.AddCounter("msip_native_shards_lost_leases_total", "Shards run whose lease another worker took over before they were recorded",
+        static_cast<double>(shards.lostLeases));
+    writer.AddCounter("msip_native_shard_errors_total", "Shard claims, renewals and completions that failed to reach Redis",
+        static_cast<double>(shards.errors));
+  }
+
+  const auto knownClean = contextManager.GetKnownCleanFilter().GetStats();
+  if (knownClean.enabled) {
+    writer.AddGauge("msip_native_known_clean_bytes", "Memory held by the known-clean filter", static_cast<double>(knownClean.bytes));
+    writer.AddGauge("msip_native_known_clean_keys", "Clean content keys added to the filter's current generation", static_cast<double>(knownClean.keys));
+    writer.AddCounter("msip_native_known_clean_hits_total", "Probes skipped because the filter held their content", static_cast<double>(knownClean.hits));
+    writer.AddCounter("msip_native_known_clean_misses_total", "Probes of content the filter did not hold", static_cast<double>(knownClean.misses));
+    writer.AddCounter("msip_native_known_clean_verified_total", "Positive answers probed again to check them", static_cast<double>(knownClean.verified));
+    writer.AddCounter("msip_native_known_clean_false_positives_total", "Positive answers whose probe found the content protected or labeled",
+        static_cast<double>(knownClean.falsePositives));
+    writer.AddCounter("msip_native_known_clean_rotations_total", "Generations of keys the filter dropped for age", static_cast<double>(knownClean.rotations));
+  }
+
+  DirectoryWatcher::Stats watch;
+  if (contextManager.GetWatcherStats(watch)) {
+    writer.AddGauge("msip_native_watch_directories", "Directories the watcher has an inotify watch on", static_cast<double>(watch.directories));
+    writer.AddGauge("msip_native_watch_pending", "Changed files waiting for their settle time", static_cast<double>(watch.pending));
+    writer.AddCounter("msip_native_watch_events_total", "inotify events the watcher read", static_cast<double>(watch.events));
+    writer.AddCounter("msip_native_watch_written_total", "Written files the watcher handed to its operation", static_cast<double>(watch.written));
+    writer.AddCounter("msip_native_watch_removed_total", "Removed files the watcher dropped from the caches", static_cast<double>(watch.removed));
+    writer.AddCounter("msip_native_watch_batches_total", "Batches the watcher ran", static_cast<double>(watch.batches));
+    writer.AddCounter("msip_native_watch_overflows_total", "inotify queue overflows, each losing events", static_cast<double>(watch.overflows));
+    writer.AddCounter("msip_native_watch_errors_total", "Directories the watcher could not watch", static_cast<double>(watch.errors));
+  }
+
+  const auto tuner = ResourceTuner::Shared().GetStats();
+  if (tuner.parts != 0) {
+    writer.AddGauge("msip_native_resource_shrink", "Halvings of the auto-tuned budgets in effect under memory pressure",
+        static_cast<double>(tuner.shrink));
+    writer.AddCounter("msip_native_memory_pressure_events_total", "Memory pressure events the cgroup reported",
+        static_cast<double>(tuner.pressureEvents));
+  }
+
+  const auto tokens = sample::auth::TokenCache::Shared().GetStats();
+  writer.AddCounter("msip_native_token_cache_hits_total", "Access tokens served from the token cache", static_cast<double>(tokens.hits));
+  writer.AddCounter("msip_native_token_cache_misses_total", "Access tokens acquired while the caller waited", static_cast<double>(tokens.misses));
+  writer.AddCounter("msip_native_token_refreshes_total", "Background refreshes of tokens about to expire", static_cast<double>(tokens.refreshes));
+  writer.AddCounter("msip_native_token_prefetches_total", "Tokens acquired ahead of the challenge of an engine being created",
+      static_cast<double>(tokens.prefetches));
+
+  const auto dispatcher = contextManager.GetTaskDispatcher()->GetStats();
+  writer.AddGauge("msip_native_task_queue_depth", "SDK tasks waiting for a worker", static_cast<double>(dispatcher.queueDepth));
+  writer.AddCounter("msip_native_tasks_executed_total", "SDK tasks run by the native dispatcher", static_cast<double>(dispatcher.executed));
+  writer.AddGauge("msip_native_bulk_task_queue_depth", "Bulk SDK tasks waiting for a worker", static_cast<double>(dispatcher.bulkQueueDepth));
+  writer.AddCounter("msip_native_bulk_tasks_executed_total", "Bulk SDK tasks run by the native dispatcher",
+      static_cast<double>(dispatcher.bulkExecuted));
+
+  auto httpDelegate = contextManager.GetHttpDelegate();
+  writer.AddGauge("msip_native_http_in_flight", "HTTP requests in flight", static_cast<double>(httpDelegate->GetStats().inFlight));
+  const auto endpoints = httpDelegate->GetEndpointStats();
+  const struct {
+    const char* name;
+    const char* help;
+    uint64_t sample::http::HttpDelegateImpl::EndpointStats::*value;
+  } endpointFamilies[] = {
+    { "msip_native_http_requests_total", "HTTP requests completed per host", &sample::http::HttpDelegateImpl::EndpointStats::requests },
+    { "msip_native_http_failures_total", "HTTP requests per host that failed before a response", &sample::http::HttpDelegateImpl::EndpointStats::failed },
+    { "msip_native_http_sent_bytes_total", "HTTP request bytes sent per host", &sample::http::HttpDelegateImpl::EndpointStats::bytesSent },
+    { "msip_native_http_received_bytes_total", "HTTP response bytes received per host", &sample::http::HttpDelegateImpl::EndpointStats::bytesReceived },
+    { "msip_native_http_client_errors_total", "HTTP responses per host with a 4xx status", &sample::http::HttpDelegateImpl::EndpointStats::clientErrors },
+    { "msip_native_http_server_errors_total", "HTTP responses per host with a 5xx status", &sample::http::HttpDelegateImpl::EndpointStats::serverErrors },
+    { "msip_native_http_retries_total", "GETs per host retried after a failure", &sample::http::HttpDelegateImpl::EndpointStats::retries },
+    { "msip_native_http_hedges_total", "GETs per host sent again after the host's p95 latency", &sample::http::HttpDelegateImpl::EndpointStats::hedges },
+    { "msip_native_http_short_circuited_total", "HTTP requests per host failed by an open circuit breaker", &sample::http::HttpDelegateImpl::EndpointStats::shortCircuited },
+    { "msip_native_http_throttled_total", "HTTP responses per host with a 429 or 503 status", &sample::http::HttpDelegateImpl::EndpointStats::throttled },
+    { "msip_native_http_rate_limited_total", "HTTP attempts per host that waited for a rate limit token", &sample::http::HttpDelegateImpl::EndpointStats::rateLimited },
+    { "msip_native_http_rate_limit_wait_microseconds_total", "Time HTTP attempts per host waited for a rate limit token", &sample::http::HttpDelegateImpl::EndpointStats::rateLimitWaitMicros },
+    { "msip_native_http_latency_microseconds_total", "Time spent in HTTP requests per host", &sample::http::HttpDelegateImpl::EndpointStats::latencyMicros },
+  };
+  for (const auto& family : endpointFamilies) {
+    writer.BeginFamily(family.name, family.help, "counter");
+    for (const auto& endpoint : endpoints)
+      writer.AddSample(family.name, { { "host", endpoint.first } }, static_cast<double>(endpoint.second.*family.value));
+  }
+  writer.BeginFamily("msip_native_http_p95_latency_microseconds", "p95 of recent HTTP request latencies per host", "gauge");
+  for (const auto& endpoint : endpoints) {
+    if (endpoint.second.p95LatencyMicros >= 0)
+      writer.AddSample("msip_native_http_p95_latency_microseconds", { { "host", endpoint.first } }, static_cast<double>(endpoint.second.p95LatencyMicros));
+  }
+  writer.BeginFamily("msip_native_http_circuit_open", "1 while the host's circuit breaker fails requests fast", "gauge");
+  for (const auto& endpoint : endpoints)
+    writer.AddSample("msip_native_http_circuit_open", { { "host", endpoint.first } }, endpoint.second.circuitOpen ? 1.0 : 0.0);
+  writer.BeginFamily("msip_native_http_rate_limit", "Requests per second a tenant is limited to on a host that throttled it", "gauge");
+  for (const auto& limit : httpDelegate->GetRateLimits())
+    writer.AddSample("msip_native_http_rate_limit", { { "tenant", limit.first.first }, { "host", limit.first.second } }, limit.second);
+
+  const auto tracing = contextManager.GetTracingHttpDelegate()->GetStats();
+  writer.AddCounter("msip_native_http_spans_total", "HTTP spans recorded under a sampled trace context", static_cast<double>(tracing.recorded));
+  writer.AddCounter("msip_native_http_spans_dropped_total", "HTTP spans dropped because the span buffer was full", static_cast<double>(tracing.dropped));
+
+  if (auto diagnosticUploader = contextManager.GetDiagnosticUploader()) {
+    const auto diagnostics = diagnosticUploader->GetStats();
+    writer.AddCounter("msip_native_diagnostic_events_uploaded_total", "Audit and telemetry events uploaded to the collector", static_cast<double>(diagnostics.uploaded));
+    writer.AddCounter("msip_native_diagnostic_events_dropped_total", "Audit and telemetry events dropped on a full queue or after failed uploads",
+        static_cast<double>(diagnostics.droppedOverflow + diagnostics.droppedFailed));
+    writer.AddCounter("msip_native_diagnostic_failed_batches_total", "Diagnostic batch uploads the collector did not accept", static_cast<double>(diagnostics.failedBatches));
+    writer.AddGauge("msip_native_diagnostic_events_pending", "Audit and telemetry events waiting for upload", static_cast<double>(diagnostics.pending));
+  }
+
+  if (auto replayDelegate = contextManager.GetReplayHttpDelegate()) {
+    const auto replay = replayDelegate->GetStats();
+    writer.AddCounter("msip_native_http_replay_requests_total", "SDK requests answered from the HTTP recording", static_cast<double>(replay.requests));
+    writer.AddCounter("msip_native_http_replay_misses_total", "SDK requests with no recorded response", static_cast<double>(replay.misses));
+    writer.AddCounter("msip_native_http_replay_recorded_total", "SDK responses written to the HTTP recording", static_cast<double>(replay.recorded));
+  }
+
+  const auto dkeDelegate = contextManager.GetDkeCacheHttpDelegate();
+  sample::http::DkeCacheHttpDelegate::Stats dke = {};
+  if (dkeDelegate) {
+    dke = dkeDelegate->GetStats();
+    writer.AddCounter("msip_native_dke_public_key_hits_total", "DKE public key requests answered from the cache", static_cast<double>(dke.publicKeyHits));
+    writer.AddCounter("msip_native_dke_public_key_misses_total", "DKE public key requests sent to the service", static_cast<double>(dke.publicKeyMisses));
+    writer.AddCounter("msip_native_dke_unwrap_hits_total", "DKE unwrap requests answered from the cache", static_cast<double>(dke.unwrapHits));
+    writer.AddCounter("msip_native_dke_unwrap_misses_total", "DKE unwrap requests sent to the service", static_cast<double>(dke.unwrapMisses));
+    writer.AddCounter("msip_native_dke_evictions_total", "Cached DKE unwrap results evicted by the size bound", static_cast<double>(dke.evictions));
+    writer.AddCounter("msip_native_dke_rotations_total", "Cached DKE unwrap results dropped after their key rotated", static_cast<double>(dke.rotations));
+    writer.AddCounter("msip_native_dke_hops_total", "Requests sent to a DKE service", static_cast<double>(dke.hops));
+    writer.AddGauge("msip_native_dke_cache_entries", "DKE unwrap results in the cache", static_cast<double>(dke.size));
+  }
+
+  const auto allocation = sample::alloc::Read();
+  if (allocation.enabled) {
+    writer.BeginFamily("msip_native_allocated_bytes_total", "Bytes allocated per subsystem, at the allocator's usable size", "counter");
+    for (size_t subsystem = 0; subsystem < static_cast<size_t>(sample::alloc::Subsystem::Count); ++subsystem) {
+      writer.AddSample("msip_native_allocated_bytes_total", { { "subsystem", sample::alloc::GetName(static_cast<sample::alloc::Subsystem>(subsystem)) } },
+          static_cast<double>(allocation.allocatedBytes[subsystem]));
+    }
+    writer.BeginFamily("msip_native_live_bytes", "Bytes allocated and not yet freed per subsystem", "gauge");
+    for (size_t subsystem = 0; subsystem < static_cast<size_t>(sample::alloc::Subsystem::Count); ++subsystem) {
+      writer.AddSample("msip_native_live_bytes", { { "subsystem", sample::alloc::GetName(static_cast<sample::alloc::Subsystem>(subsystem)) } },
+          static_cast<double>(allocation.liveBytes[subsystem]));
+    }
+    const struct {
+      const char* name;
+      const char* help;
+      const char* type;
+      uint64_t sample::alloc::OperationStats::*value;
+    } operationFamilies[] = {
+      { "msip_native_operation_allocations_total", "Allocations made for each type of operation", "counter", &sample::alloc::OperationStats::allocations },
+      { "msip_native_operation_allocated_bytes_total", "Bytes allocated for each type of operation", "counter", &sample::alloc::OperationStats::allocatedBytes },
+      { "msip_native_operation_peak_bytes_total", "Sum of the most each operation held at once, per type", "counter", &sample::alloc::OperationStats::peakBytesSum },
+      { "msip_native_operation_peak_bytes_max", "Most any operation of the type held at once", "gauge", &sample::alloc::OperationStats::peakBytesMax },
+      { "msip_native_operations_accounted_total", "Operations whose allocations were accounted, per type", "counter", &sample::alloc::OperationStats::operations },
+    };
+    for (const auto& family : operationFamilies) {
+      writer.BeginFamily(family.name, family.help, family.type);
+      for (const auto& operation : allocation.operations)
+        writer.AddSample(family.name, { { "operation", operation.operation } }, static_cast<double>(operation.*family.value));
+    }
+  }
+
+  const auto costs = sample::cost::GetSnapshot();
+  if (costs.enabled) {
+    using sample::cost::Counter;
+    const struct {
+      const char* name;
+      const char* help;
+      Counter counter;
+      double scale;
+    } costFamilies[] = {
+      { "msip_native_tenant_operations_total", "Operations each tenant ran, per type", Counter::Operations, 1 },
+      { "msip_native_tenant_cpu_seconds_total", "Thread CPU time each tenant's operations used, per type", Counter::CpuMicros, 1e-6 },
+      { "msip_native_tenant_read_bytes_total", "Bytes each tenant's operations read, per type", Counter::BytesRead, 1 },
+      { "msip_native_tenant_written_bytes_total", "Bytes each tenant's operations wrote, per type", Counter::BytesWritten, 1 },
+      { "msip_native_tenant_http_requests_total", "HTTP requests each tenant's operations made, per type", Counter::HttpRequests, 1 },
+      { "msip_native_tenant_http_bytes_total", "HTTP bytes each tenant's operations sent and received, per type", Counter::HttpBytes, 1 },
+      { "msip_native_tenant_cache_hits_total", "Cache lookups of each tenant's operations that hit, per type", Counter::CacheHits, 1 },
+      { "msip_native_tenant_cache_misses_total", "Cache lookups of each tenant's operations that missed, per type", Counter::CacheMisses, 1 },
+    };
+    for (const auto& family : costFamilies) {
+      writer.BeginFamily(family.name, family.help, "counter");
+      for (const auto& entry : costs.operations) {
+        writer.AddSample(family.name, { { "tenant", entry.tenant }, { "operation", entry.name } },
+            static_cast<double>(entry.values[static_cast<size_t>(family.counter)]) * family.scale);
+      }
+    }
+    writer.BeginFamily("msip_native_tenant_host_http_requests_total", "HTTP requests each tenant made to each host", "counter");
+    for (const auto& entry : costs.hosts) {
+      writer.AddSample("msip_native_tenant_host_http_requests_total", { { "tenant", entry.tenant }, { "host", entry.name } },
+          static_cast<double>(entry.values[static_cast<size_t>(Counter::HttpRequests)]));
+    }
+    writer.BeginFamily("msip_native_tenant_host_http_bytes_total", "HTTP bytes each tenant sent to and received from each host", "counter");
+    for (const auto& entry : costs.hosts) {
+      writer.AddSample("msip_native_tenant_host_http_bytes_total", { { "tenant", entry.tenant }, { "host", entry.name } },
+          static_cast<double>(entry.values[static_cast<size_t>(Counter::HttpBytes)]));
+    }
+  }
+
+  const auto locks = sample::lock::Snapshot();
+  writer.BeginFamily("msip_native_lock_contended_total", "Acquisitions of a native lock that found it held", "counter");
+  for (const auto& lock : locks)
+    writer.AddSample("msip_native_lock_contended_total", { { "lock", lock.name } }, static_cast<double>(lock.contended));
+
+  if (!withHistograms)
+    return writer.ToString();
+
+  const auto histograms = PhaseMetrics::Snapshot();
+  writer.BeginFamily("msip_native_phase_seconds", "Time spent in each MIP SDK phase inside the native library", "histogram");
+  for (size_t phase = 0; phase < histograms.size(); ++phase) {
+    const auto& histogram = histograms[phase];
+    AddHistogramSamples(writer, "msip_native_phase_seconds", { "phase", PhaseMetrics::GetName(static_cast<PhaseMetrics::Phase>(phase)) },
+        histogram.buckets, histogram.count, static_cast<double>(histogram.sumNanoseconds) / 1e9);
+  }
+  writer.BeginFamily("msip_native_http_latency_seconds", "Time spent in HTTP requests per host", "histogram");
+  for (const auto& endpoint : endpoints) {
+    AddHistogramSamples(writer, "msip_native_http_latency_seconds", { "host", endpoint.first }, endpoint.second.latencyBuckets,
+        SumBuckets(endpoint.second.latencyBuckets), static_cast<double>(endpoint.second.latencyMicros) / 1e6);
+  }
+  writer.BeginFamily("msip_native_lock_wait_seconds", "Time sampled acquisitions of a native lock waited for it", "histogram");
+  for (const auto& lock : locks) {
+    AddHistogramSamples(writer, "msip_native_lock_wait_seconds", { "lock", lock.name }, lock.wait.buckets, lock.wait.count,
+        static_cast<double>(lock.wait.sumNanoseconds) / 1e9, sample::lock::GetBucketBoundSeconds);
+  }
+  writer.BeginFamily("msip_native_lock_hold_seconds", "Time sampled acquisitions of a native lock held it", "histogram");
+  for (const auto& lock : locks) {
+    AddHistogramSamples(writer, "msip_native_lock_hold_seconds", { "lock", lock.name }, lock.hold.buckets, lock.hold.count,
+        static_cast<double>(lock.hold.sumNanoseconds) / 1e9, sample::lock::GetBucketBoundSeconds);
+  }
+  if (dkeDelegate) {
+    writer.BeginFamily("msip_native_dke_hop_latency_seconds", "Time spent in requests to DKE services", "histogram");
+    AddHistogramSamples(writer, "msip_native_dke_hop_latency_seconds", { "service", "dke" }, dke.hopLatencyBuckets,
+        SumBuckets(dke.hopLatencyBuckets), static_cast<double>(dke.hopLatencyMicros) / 1e6);
+  }
+  return writer.ToString();
+}
+
+// Drained HTTP spans as a JSON array; every value but the ids, names and error is numeric.
+string HttpSpansJSON(const vector<sample::http::HttpSpan>& spans) {
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"spans\": [";
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const auto& span = spans[i];
+    oss << (i ? ", " : "") << "{"
+        << "\"trace_id\": \"" << span.traceId << "\""
+        << ", \"span_id\": \"" << span.spanId << "\""
+        << ", \"parent_span_id\": \"" << span.parentSpanId << "\""
+        << ", \"name\": \"" << span.name << "\""
+        << ", \"method\": \"" << span.method << "\""
+        << ", \"host\": \"" << escapeJsonString(span.host) << "\""
+        << ", \"path\": \"" << escapeJsonString(span.path) << "\""
+        << ", \"status_code\": " << span.statusCode
+        << ", \"bytes_sent\": " << span.bytesSent
+        << ", \"bytes_received\": " << span.bytesReceived
+        << ", \"start_unix_nanos\": " << span.startUnixNanos
+        << ", \"end_unix_nanos\": " << span.endUnixNanos
+        << ", \"dns_micros\": " << span.nameLookupMicros
+        << ", \"connect_micros\": " << span.connectMicros
+        << ", \"tls_micros\": " << span.tlsMicros
+        << ", \"ttfb_micros\": " << span.firstByteMicros
+        << ", \"cancelled\": " << (span.cancelled ? "true" : "false")
+        << ", \"error\": \"" << escapeJsonString(span.error) << "\"}";
+  }
+  oss << "]}";
+  return oss.str();
+}
+
+typedef void (*MsipResultCallback)(int status, const char* result, void* userData);
+
+// Runs an unprotect or protect through the SDK's async calls without blocking any thread on a future.
+// Each step is an AsyncCompletion continuation, resumed on the library's dispatcher under the caller's
+// context, and the callback fires exactly once with the same status and JSON the blocking export would return.
+class AsyncFileOperation final : public std::enable_shared_from_this<AsyncFileOperation> {
+public:
+  AsyncFileOperation(
+      const shared_ptr<MipContext>& mipContext,
+      const string& filePath,
+      MsipResultCallback callback,
+      void* userData)
+      : mMipContext(mipContext),
+        mFilePath(filePath),
+        mReadingReference(false),
+        mReferenceCacheable(false),
+        mProtect(false),
+        mCallback(callback),
+        mUserData(userData),
+        mFinished(false) {
+  }
+
+  void StartUnprotect(const shared_ptr<FileEngine>& fileEngine) {
+    try {
+      mFileEngine = fileEngine;
+      mFileStream = GetLargeInputStream(mFilePath);
+      // The handler tells whether there is protection to remove, so the file is only parsed once.
+      OpenHandler(mFileStream, mFilePath);
+    } catch (...) {
+      Fail(std::current_exception());
+    }
+  }
+
+  void StartProtect(const shared_ptr<FileEngine>& fileEngine, const string& encryptedFilePath) {
+    try {
+      mFileEngine = fileEngine;
+      mProtect = true;
+      mReferencePath = encryptedFilePath;
+      mProtection = ContextManager::Instance().GetProtectionCache().Find(
+          fileEngine->GetSettings().GetEngineId(), encryptedFilePath, mReferenceIdentity, mReferenceCacheable);
+      if (mProtection) {
+        mFileStream = GetLargeInputStream(mFilePath);
+        OpenHandler(mFileStream, mFilePath);
+        return;
+      }
+      mReadingReference = true;
+      OpenHandler(GetLargeInputStream(encryptedFilePath), encryptedFilePath);
+    } catch (...) {
+      Fail(std::current_exception());
+    }
+  }
+
+  void Fail(const string& error) {
+    Finish(EXIT_FAILURE, getUnprotectStatusJSON(false, error, ""));
+  }
+
+private:
+  void OnHandlerCreated(const shared_ptr<FileHandler>& fileHandler) {
+    try {
+      if (mReadingReference) {
+        mReadingReference = false;
+        mProtection = fileHandler->GetProtection();
+        if (mReferenceCacheable) {
+          ContextManager::Instance().GetProtectionCache().Put(
+              mFileEngine->GetSettings().GetEngineId(), mReferencePath, mReferenceIdentity, mProtection);
+        }
+        mFileStream = GetLargeInputStream(mFilePath);
+        OpenHandler(mFileStream, mFilePath);
+        return;
+      }
+
+      mFileHandler = fileHandler;
+      EnsureUserHasRights(fileHandler);
+      if (mProtect) {
+        fileHandler->SetProtection(mProtection);
+      } else {
+        if (!RemoveProtectionIfAny(fileHandler)) {
+          Finish(EXIT_SUCCESS, getUnprotectStatusJSON(false, "File is not protected and does not contain protected objects, no change made.", ""));
+          return;
+        }
+        if (!fileHandler->IsModified()) {
+          Finish(EXIT_SUCCESS, getUnprotectStatusJSON(false, "No changes to commit", ""));
+          return;
+        }
+      }
+      mOutputFilePath = CreateOutput(fileHandler.get());
+      auto self = shared_from_this();
+      SdkAsync::Commit(fileHandler, mOutputFilePath, AsyncCompletion<bool>::Create(
+          [self](bool committed) { self->OnCommitted(committed); },
+          [self](const std::exception_ptr& error) { self->Fail(error); }));
+    } catch (...) {
+      Fail(std::current_exception());
+    }
+  }
+
+  void OnCommitted(bool committed) {
+    if (committed) {
+      ContextManager::Instance().GetInspectionCache().Invalidate(mOutputFilePath);
+      Finish(EXIT_SUCCESS, getUnprotectStatusJSON(true, "", mOutputFilePath));
+      return;
+    }
+    ifstream ifs(FILENAME_STRING(mOutputFilePath));
+    if (!ifs.fail()) {
+      Fail("commitAsync unable to delete outputfile");
+    } else {
+      Finish(EXIT_SUCCESS, getUnprotectStatusJSON(false, "No changes to commit", ""));
+    }
+  }
+
+  void OpenHandler(const shared_ptr<Stream>& stream, const string& filePath) {
+    auto self = shared_from_this();
+    StartCreateFileHandler(
+        mFileEngine, stream, filePath, DataState::REST, false, "" /*applicationScenarioId*/,
+        FileHandlerObserver::Shared(), AsyncCompletion<shared_ptr<FileHandler>>::Create(
+            [self](const shared_ptr<FileHandler>& fileHandler) { self->OnHandlerCreated(fileHandler); },
+            [self](const std::exception_ptr& error) { self->Fail(error); }));
+  }
+
+  void Fail(const std::exception_ptr& error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const std::exception& ex) {
+      Fail(string(ex.what()));
+    } catch (...) {
+      Fail(string("Unknown error"));
+    }
+  }
+
+  void Finish(int status, const string& json) {
+    if (mFinished.exchange(true))
+      return;
+    // Release the handler and its input before reporting, so the caller may reuse the file at once.
+    mFileHandler.reset();
+    mFileStream.reset();
+    mCallback(status, json.c_str(), mUserData);
+  }
+
+  shared_ptr<MipContext> mMipContext;
+  shared_ptr<FileEngine> mFileEngine;
+  string mFilePath;
+  bool mReadingReference;
+  string mReferencePath;
+  FileIdentity mReferenceIdentity;
+  bool mReferenceCacheable;
+  bool mProtect;
+  shared_ptr<ProtectionHandler> mProtection;
+  shared_ptr<Stream> mFileStream;
+  shared_ptr<FileHandler> mFileHandler;
+  string mOutputFilePath;
+  MsipResultCallback mCallback;
+  void* mUserData;
+  std::atomic<bool> mFinished;
+};
+
+// Engine loads of async calls that missed the engine cache, waiting for a task dispatcher worker. A load
+// blocks its worker on the SDK tasks it dispatches to the same pool, so at most half the workers run loads;
+// the rest wait here, in order, and each finished load dispatches the next one.
+struct AsyncEngineLoads {
+  struct Load {
+    string tenant;
+    sample::priority::Priority priority;
+    std::function<void()> run;
+  };
+
+  std::mutex mutex;
+  std::deque<Load> waiting;
+  size_t running = 0;
+};
+
+AsyncEngineLoads& GetAsyncEngineLoads() {
+  static AsyncEngineLoads loads;
+  return loads;
+}
+
+void DispatchEngineLoad(AsyncEngineLoads::Load load) {
+  // Queued in the lane of the load's tenant and priority, whichever thread dispatches it.
+  sample::tenant::ScopedTenant tenantScope(load.tenant);
+  sample::priority::ScopedPriority priorityScope(load.priority);
+  const auto run = std::move(load.run);
+  ContextManager::Instance().GetTaskDispatcher()->DispatchTask("engine-load", [run]() {
+    run();
+    auto& loads = GetAsyncEngineLoads();
+    AsyncEngineLoads::Load next;
+    {
+      std::lock_guard<std::mutex> lock(loads.mutex);
+      if (loads.waiting.empty()) {
+        --loads.running;
+        return;
+      }
+      next = std::move(loads.waiting.front());
+      loads.waiting.pop_front();
+    }
+    // Dispatched before this task returns, so the dispatcher is not idle until every waiting load has run.
+    DispatchEngineLoad(std::move(next));
+  });
+}
+
+// Hands the cached engine for key to start. A loaded engine is used inline; loading one takes network
+// round trips, so a miss is resolved on the task dispatcher and the caller returns immediately. The load
+// then counts toward the dispatcher's work, which msipShutdown and msipDrain wait for.
+void WithCachedFileEngine(
+    const EngineCache::Key& key,
+    const string& protectionToken,
+    const shared_ptr<AsyncFileOperation>& operation,
+    const std::function<void(const shared_ptr<FileEngine>&)>& start) {
+  if (ContextManager::Instance().GetEngineCache().Contains(ServiceEngineKey(key))) {
+    start(GetCachedFileEngine(key, protectionToken, GetWorkingDirectory()));
+    return;
+  }
+  const auto costKey = sample::cost::CurrentKey();
+  AsyncEngineLoads::Load load;
+  load.tenant = key.applicationId;
+  load.priority = sample::priority::Current();
+  load.run = [key, protectionToken, operation, start, costKey]() {
+    sample::cost::ScopedKey costScope(costKey);
+    sample::token::ScopedToken tokenScope(protectionToken);
+    try {
+      start(GetCachedFileEngine(key, protectionToken, GetWorkingDirectory()));
+    } catch (const std::exception& ex) {
+      operation->Fail(ex.what());
+    }
+  };
+
+  auto& loads = GetAsyncEngineLoads();
+  {
+    std::lock_guard<std::mutex> lock(loads.mutex);
+    const size_t limit = std::max<size_t>(ContextManager::Instance().GetTaskDispatcher()->GetStats().workers / 2, 1);
+    if (loads.running >= limit) {
+      loads.waiting.push_back(std::move(load));
+      return;
+    }
+    ++loads.running;
+  }
+  DispatchEngineLoad(std::move(load));
+}
+
+// Upper bound on threads a single batch call fans out to. Work is I/O and network bound, so a few
+// workers beyond the core count still help, but the engine's HTTP stack gains nothing past this.
+static const size_t kMaxBatchWorkers = 8;
+// Bulk batches fan out to fewer, so a migration leaves cores and connections to interactive callers.
+static const size_t kMaxBulkBatchWorkers = kMaxBatchWorkers / 4;
+
+// Workers ForEachParallel(count, ...) runs on for the calling thread's priority.
+size_t BatchWorkers(size_t count) {
+  const size_t maxWorkers = sample::priority::Current() == sample::priority::Priority::Bulk ? kMaxBulkBatchWorkers : kMaxBatchWorkers;
+  // Sized to the cgroup's CPU quota, so a 1-vCPU sidecar does not run a large host's worth of files at once.
+  static const size_t cpus = sample::task::TaskDispatcherImpl::GetCpuQuota();
+  return std::min(std::min<size_t>(cpus, maxWorkers), count);
+}
+
+// Runs task(i) for every i in [0, count) across a short-lived worker pool. task must not throw.
+void ForEachParallel(size_t count, const std::function<void(size_t)>& task) {
+  const auto priority = sample::priority::Current();
+  const size_t workers = BatchWorkers(count);
+  std::atomic<size_t> next(0);
+  // Every file of the batch shares the caller's deadline, tenant, priority, cost key and protection token.
+  const auto deadline = sample::deadline::Deadline::Current();
+  const string tenant = sample::tenant::Current();
+  const auto costKey = sample::cost::CurrentKey();
+  const auto protectionToken = sample::token::Current();
+  const auto& topology = NumaTopology::Shared();
+  const bool place = topology.NodeCount() > 1 && ContextManager::Instance().GetNumaPlacement();
+  auto work = [&](size_t worker) {
+    // The caller's own thread keeps its affinity; the workers it starts are spread over the nodes, and
+    // the buffers a worker allocates for its files come from its node.
+    if (place && worker > 0)
+      topology.PinCurrentThread(worker);
+    sample::deadline::ScopedDeadline deadlineScope(deadline);
+    sample::tenant::ScopedTenant tenantScope(tenant);
+    sample::priority::ScopedPriority priorityScope(priority);
+    sample::cost::ScopedKey costScope(costKey);
+    sample::token::ScopedToken tokenScope(protectionToken);
+    for (size_t i = next++; i < count; i = next++) {
+      // Each file is budgeted on its own (see msipConfigureOperationBudget).
+      ScopedOperationBudget budget;
+      task(i);
+    }
+  };
+
+  vector<std::thread> threads;
+  for (size_t i = 1; i < workers; ++i)
+    threads.emplace_back(work, i);
+  work(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+// The inputs of a batch, read ahead through io_uring or prefetched by threads of their own.
+class BatchInputs final {
+public:
+  explicit BatchInputs(std::unique_ptr<AsyncFileReader> reader) : mReader(std::move(reader)) {}
+  explicit BatchInputs(std::unique_ptr<BatchPrefetcher> prefetcher) : mPrefetcher(std::move(prefetcher)) {}
+
+  shared_ptr<mip::Stream> Take(size_t index) {
+    return mReader ? mReader->Take(index) : mPrefetcher->Take(index);
+  }
+
+private:
+  std::unique_ptr<AsyncFileReader> mReader;
+  std::unique_ptr<BatchPrefetcher> mPrefetcher;
+};
+
+// Starts reading filePaths[order[0]], filePaths[order[1]], ... ahead of the batch workers, which take them
+// in that order. Through io_uring when read ahead is on, for inputs too small to be mapped; otherwise, when
+// prefetch is on, with a prefetcher per batch (see msipConfigureBatchPrefetch). nullptr when both are off,
+// leaving workers to read their own inputs.
+std::unique_ptr<BatchInputs> StartReadAhead(const char* const* filePaths, const vector<size_t>& order) {
+  static auto& readAheadFailures = MetricsRegistry::Shared().GetCounter(
+      "msip_native_read_ahead_failures_total", "Batches that read their inputs synchronously because io_uring could not be set up");
+  auto& contextManager = ContextManager::Instance();
+  auto settings = contextManager.GetBatchReadAhead();
+  const auto prefetch = contextManager.GetBatchPrefetch();
+  if ((settings.queueDepth == 0 && prefetch.depth == 0) || order.size() < 2)
+    return nullptr;
+  const InputStreams::Options options = contextManager.GetInputStreams();
+  vector<string> paths;
+  paths.reserve(order.size());
+  for (size_t i : order)
+    paths.emplace_back(filePaths[i]);
+  if (settings.queueDepth > 0) {
+    settings.maxFileBytes = options.mappedMinBytes - 1;
+    try {
+      return std::unique_ptr<BatchInputs>(new BatchInputs(std::unique_ptr<AsyncFileReader>(new AsyncFileReader(paths, settings))));
+    }
+    catch (const std::exception&) {
+      readAheadFailures.Add(1);
+    }
+  }
+  if (prefetch.depth == 0)
+    return nullptr;
+  const size_t workers = BatchWorkers(order.size());
+  return std::unique_ptr<BatchInputs>(new BatchInputs(
+      std::unique_ptr<BatchPrefetcher>(new BatchPrefetcher(std::move(paths), prefetch, options, workers))));
+}
+
+vector<size_t> BatchOrder(size_t count) {
+  vector<size_t> order(count);
+  for (size_t i = 0; i < count; ++i)
+    order[i] = i;
+  return order;
+}
+
+// Runs operation(i, committedPath) for every file of a batch, in parallel, and hands each file's result to
+// finished(i, result) as soon as it is final, on the worker that produced it. With batch dedupe on, a file with the same content as an earlier file of the batch is not processed:
+// its original's output is copied or linked to the path the operation would have written. A duplicate
+// whose output cannot be derived or materialized is processed like any other file. operation must set
+// committedPath when it writes an output.
+void RunBatchOperation(
+    const char* const* filePaths,
+    size_t count,
+    const std::function<string(size_t i, string& committedPath)>& operation,
+    const std::function<void(size_t i, string result)>& finished) {
+  static auto& deduplicated = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_deduplicated_total", "Batch files given the output of an identical file instead of being processed");
+  vector<string> items(count);
+  vector<string> outputs(count);
+  std::unique_ptr<BatchInputs> readAhead;
+  auto runOne = [&](size_t i, size_t readAheadIndex) {
+    ScopedReadAheadInput input(filePaths[i], readAhead ? readAhead->Take(readAheadIndex) : nullptr);
+    try {
+      items[i] = operation(i, outputs[i]);
+    }
+    catch (const std::exception& ex) {
+      items[i] = getUnprotectStatusJSON(false, ex.what(), "");
+    }
+  };
+
+  const auto mode = ContextManager::Instance().GetBatchDedupe();
+  if (mode == ContentDedupe::Mode::Off || count < 2) {
+    readAhead = StartReadAhead(filePaths, BatchOrder(count));
+    ForEachParallel(count, [&](size_t i) {
+      runOne(i, i);
+      finished(i, std::move(items[i]));
+    });
+    return;
+  }
+
+  const auto originals = ContentDedupe::FindOriginals(filePaths, count, ForEachParallel);
+  vector<size_t> unique;
+  vector<size_t> duplicates;
+  for (size_t i = 0; i < count; ++i)
+    (originals[i] == i ? unique : duplicates).push_back(i);
+  // Duplicates are mostly served from their original's output, so only originals are read ahead.
+  readAhead = StartReadAhead(filePaths, unique);
+  ForEachParallel(unique.size(), [&](size_t u) {
+    const size_t i = unique[u];
+    runOne(i, u);
+    // The result of an original that failed is also its duplicates', so it is kept for them.
+    if (outputs[i].empty())
+      finished(i, items[i]);
+    else
+      finished(i, std::move(items[i]));
+  });
+  readAhead.reset();
+  ForEachParallel(duplicates.size(), [&](size_t d) {
+    const size_t i = duplicates[d];
+    const size_t original = originals[i];
+    // Identical content fails identically, e.g. for lack of rights, so there is no point trying again.
+    if (outputs[original].empty()) {
+      finished(i, items[original]);
+      return;
+    }
+    string output;
+    if (ContentDedupe::DeriveOutputPath(filePaths[original], outputs[original], filePaths[i], output)) {
+      try {
+        ContentDedupe::Materialize(outputs[original], output, mode);
+        ContextManager::Instance().GetInspectionCache().Invalidate(output);
+        outputs[i] = output;
+        std::ostringstream oss;
+        oss << "{\"status\": true, \"path\": \"" << escapeJsonString(output) << "\", \"error\": \"\""
+            << ", \"duplicate_of\": \"" << escapeJsonString(filePaths[original]) << "\"}";
+        finished(i, oss.str());
+        deduplicated.Add(1);
+        return;
+      }
+      catch (const std::exception&) {
+      }
+    }
+    runOne(i, 0);
+    finished(i, std::move(items[i]));
+  });
+}
+
+string BatchJSON(const vector<string>& items) {
+  size_t size = 2;
+  for (const auto& item : items)
+    size += item.size() + 2;
+  string json;
+  json.reserve(size);
+  json += "[";
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (i) json += ", ";
+    json += items[i];
+  }
+  json += "]";
+  return json;
+}
+
+// The results of a batch's items, kept for the JSON array the batch returns, or written as each item
+// finishes when the calling thread streams batch results (msipStreamBatchResults). Set is called from the
+// batch's workers, once per item.
+class BatchResults final {
+public:
+  explicit BatchResults(size_t count) : mSink(BatchResultSink::OpenCurrent()) {
+    if (!mSink)
+      mItems.resize(count);
+  }
+
+  void Set(size_t i, string item) {
+    if (mSink)
+      mSink->Write(i, item);
+    else
+      mItems[i] = std::move(item);
+  }
+
+  // The array of results, or the summary of the streamed lines.
+  string Finish() {
+    return mSink ? BatchResultSink::SummaryJSON(mSink->Close()) : BatchJSON(mItems);
+  }
+
+private:
+  std::unique_ptr<BatchResultSink> mSink;
+  vector<string> mItems;
+};
+
+// Whether a protect or unprotect batch runs through the pipeline msipConfigureBatchPipeline set up. With
+// dedupe on, RunBatchOperation decides which files are processed at all, so those batches keep using it.
+bool UseBatchPipeline(size_t count) {
+  const auto options = ContextManager::Instance().GetBatchPipeline();
+  const bool configured = options.readWorkers || options.openWorkers || options.rightsWorkers ||
+      options.transformWorkers || options.commitWorkers;
+  return configured && count > 1 && ContextManager::Instance().GetBatchDedupe() == ContentDedupe::Mode::Off;
+}
+
+// A file of a batch on its way through the pipeline's stages.
+struct PipelinedFile {
+  shared_ptr<mip::Stream> stream;
+  shared_ptr<FileHandler> handler;
+  // Set by the stage that finished the file: the one that failed it, transform when there is nothing to
+  // commit, or commit.
+  string result;
+};
+
+// Runs the files of a protect or unprotect batch through the stages of msipConfigureBatchPipeline, each on
+// its own workers: the input is read, its handler created by open, which for a protected input is where
+// the SDK acquires the use license, the user's rights checked, the protection changed by transform, and the
+// output written by commit. Each file's result goes to finished(i, result) once it leaves the pipeline.
+void RunBatchPipeline(
+    const char* const* filePaths,
+    size_t count,
+    const std::function<shared_ptr<FileHandler>(const string& filePath, const shared_ptr<mip::Stream>& stream)>& open,
+    const std::function<void(const shared_ptr<FileHandler>& fileHandler, string& result)>& transform,
+    const std::function<string(const shared_ptr<FileHandler>& fileHandler)>& commit,
+    const std::function<void(size_t i, string result)>& finished) {
+  const auto options = ContextManager::Instance().GetBatchPipeline();
+  vector<PipelinedFile> files(count);
+  auto stage = [&files](const std::function<void(size_t i, PipelinedFile& file)>& run) -> StagedPipeline::Step {
+    return [&files, run](size_t i) {
+      try {
+        run(i, files[i]);
+      }
+      catch (const std::exception& ex) {
+        files[i].result = getUnprotectStatusJSON(false, ex.what(), "");
+      }
+      return files[i].result.empty();
+    };
+  };
+  StagedPipeline pipeline({
+      { "read", options.readWorkers, options.queueCapacity, stage([filePaths](size_t i, PipelinedFile& file) {
+          file.stream = GetLargeInputStream(filePaths[i]);
+        }) },
+      { "open", options.openWorkers, options.queueCapacity, stage([&](size_t i, PipelinedFile& file) {
+          file.handler = open(filePaths[i], file.stream);
+          file.stream.reset();
+        }) },
+      { "rights", options.rightsWorkers, options.queueCapacity, stage([](size_t, PipelinedFile& file) {
+          EnsureUserHasRights(file.handler);
+        }) },
+      { "transform", options.transformWorkers, options.queueCapacity, stage([&](size_t, PipelinedFile& file) {
+          transform(file.handler, file.result);
+        }) },
+      { "commit", options.commitWorkers, options.queueCapacity, stage([&](size_t, PipelinedFile& file) {
+          file.result = commit(file.handler);
+        }) },
+  });
+  const auto stats = pipeline.Run(count, [&](size_t i) {
+    finished(i, std::move(files[i].result));
+    // The handler holds the file's input and decrypted content; nothing of it is needed any more.
+    files[i] = PipelinedFile();
+  });
+  ContextManager::Instance().RecordBatchPipelineRun(stats);
+}
+
+shared_ptr<FileInspector> InspectFile(const shared_ptr<FileHandler>& fileHandler) {
+  auto inspectCompletion = AsyncCompletion<shared_ptr<FileInspector>>::Create();
+  auto inspectFuture = inspectCompletion->GetFuture();
+  SdkAsync::Inspect(fileHandler, inspectCompletion);
+  return inspectFuture.get();
+}
+
+bool IsMsgFile(const string& fileName) {
+  const auto extension = GetFileExtension(fileName);
+  return EqualsIgnoreCase(extension, ".msg") || EqualsIgnoreCase(extension, ".rpmsg");
+}
+
+// Describes one attachment of a message. Messages are opened and their attachments described in turn,
+// depth levels down. Attachments are read through the inspector's streams, so none is copied out of its
+// message. The attachments of the top message are handled in parallel, since a journal report carries the
+// journaled messages as its attachments; deeper levels stay on the worker that opened their message.
+string MsgNodeJSON(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<Stream>& stream,
+    const string& name,
+    size_t depth,
+    size_t maxDepth) {
+  std::ostringstream oss;
+  oss << "{\"name\": \"" << escapeJsonString(name) << "\", \"size\": " << stream->Size();
+  try {
+    if (depth > maxDepth) {
+      oss << ", \"inspected\": false, \"status\": true}";
+      return oss.str();
+    }
+
+    auto fileHandler = GetFileHandler(fileEngine, stream, name, DataState::REST, false, "" /*applicationScenarioId*/);
+    oss << ", \"protected\": " << (fileHandler->GetProtection() ? "true" : "false");
+    if (!IsMsgFile(name)) {
+      oss << ", \"inspected\": true, \"status\": true}";
+      return oss.str();
+    }
+
+    auto inspector = InspectFile(fileHandler);
+    if (!inspector || inspector->GetInspectorType() != InspectorType::Msg)
+      throw std::runtime_error("File is not a message");
+    const auto& attachments = std::static_pointer_cast<MsgInspector>(inspector)->GetAttachments();
+
+    vector<string> children(attachments.size());
+    auto describe = [&](size_t i) {
+      const auto& attachment = attachments[i];
+      const auto& attachmentName = attachment->GetLongName().empty() ? attachment->GetName() : attachment->GetLongName();
+      if (!attachment->GetPath().empty()) {
+        std::ostringstream reference;
+        reference << "{\"name\": \"" << escapeJsonString(attachmentName) << "\""
+                  << ", \"reference\": \"" << escapeJsonString(attachment->GetLongPath().empty() ? attachment->GetPath() : attachment->GetLongPath()) << "\""
+                  << ", \"status\": true}";
+        children[i] = reference.str();
+        return;
+      }
+      children[i] = MsgNodeJSON(fileEngine, attachment->GetStream(), attachmentName, depth + 1, maxDepth);
+    };
+    if (depth == 0) {
+      ForEachParallel(attachments.size(), describe);
+    } else {
+      for (size_t i = 0; i < attachments.size(); ++i)
+        describe(i);
+    }
+
+    oss << ", \"inspected\": true, \"attachments\": " << BatchJSON(children) << ", \"status\": true}";
+  }
+  catch (const std::exception& ex) {
+    oss << ", \"status\": false, \"error\": \"" << escapeJsonString(ex.what()) << "\"}";
+  }
+  return oss.str();
+}
+
+struct DelegatedUser {
+  string user;
+  DelegationLicenseCache::Entry entry;
+  bool cached;
+  string error;
+};
+
+// Delegation licenses of users for the file's publishing license. Users without a cached license are
+// requested together in one CreateDelegationLicenses call, and each license is turned into an offline
+// consumption handler so later access checks need no round trip.
+vector<DelegatedUser> GetDelegationLicenses(
+    const shared_ptr<ProtectionEngine>& protectionEngine,
+    const shared_ptr<MipContext>& mipContext,
+    const shared_ptr<MipContext>& inspectionContext,
+    const string& filePath,
+    const char** users,
+    size_t count,
+    string& contentId) {
+  auto publishingLicense = FileHandler::GetSerializedPublishingLicense(GetLargeInputStream(filePath), filePath, inspectionContext);
+  if (publishingLicense.empty())
+    throw std::runtime_error("File is not protected");
+  auto licenseInfo = ProtectionProfile::GetPublishingLicenseInfo(publishingLicense, mipContext);
+  contentId = licenseInfo->GetContentId();
+
+  auto& delegationLicenseCache = ContextManager::Instance().GetDelegationLicenseCache();
+  const string engineId = protectionEngine->GetSettings().GetEngineId();
+  vector<DelegatedUser> results(count);
+  vector<string> missing;
+  for (size_t i = 0; i < count; ++i) {
+    results[i].user = users[i];
+    results[i].cached = delegationLicenseCache.Find(engineId, contentId, results[i].user, results[i].entry);
+    if (!results[i].cached &&
+        std::none_of(missing.begin(), missing.end(), [&](const string& user) { return EqualsIgnoreCase(user, results[i].user); }))
+      missing.push_back(results[i].user);
+  }
+  if (missing.empty())
+    return results;
+
+  auto settings = mip::DelegationLicenseSettings::CreateDelegationLicenseSettings(mipContext, *licenseInfo, missing, true /*acquireEndUserLicenses*/);
+  vector<shared_ptr<mip::DelegationLicense>> licenses;
+  {
+    ScopedPhase phase(PhaseMetrics::Phase::LicenseAcquire);
+    licenses = protectionEngine->CreateDelegationLicenses(*settings, nullptr);
+  }
+  vector<DelegationLicenseCache::Entry> acquired(licenses.size());
+  vector<string> errors(licenses.size());
+  ForEachParallel(licenses.size(), [&](size_t i) {
+    try {
+      ProtectionHandler::ConsumptionSettings consumptionSettings(
+          licenses[i]->GetSerializedUserLicense(ProtectionHandler::PreLicenseFormat::Json), publishingLicense);
+      consumptionSettings.SetDelegatedUserEmail(licenses[i]->GetUser());
+      consumptionSettings.SetIsOfflineOnly(true);
+      acquired[i].license = licenses[i];
+      acquired[i].protection = protectionEngine->CreateProtectionHandlerForConsumption(consumptionSettings, nullptr);
+      delegationLicenseCache.Put(engineId, contentId, licenses[i]->GetUser(), acquired[i]);
+      ContextManager::Instance().GetRightsCache().Put(
+          contentId, licenses[i]->GetUser(), RightsCache::FromProtection(*acquired[i].protection));
+    }
+    catch (const std::exception& ex) {
+      errors[i] = ex.what();
+    }
+  });
+
+  for (auto& result : results) {
+    if (result.cached)
+      continue;
+    result.error = "No delegation license was issued for the user";
+    for (size_t i = 0; i < licenses.size(); ++i) {
+      if (EqualsIgnoreCase(licenses[i]->GetUser(), result.user)) {
+        result.entry = acquired[i];
+        result.error = errors[i];
+        break;
+      }
+    }
+  }
+  return results;
+}
+
+string DelegationLicensesJSON(const string& filePath, const string& contentId, const vector<DelegatedUser>& users) {
+  size_t cached = 0;
+  size_t acquired = 0;
+  vector<string> errors;
+  for (const auto& user : users) {
+    if (!user.error.empty()) {
+      errors.push_back("{\"user\": \"" + escapeJsonString(user.user) + "\", \"error\": \"" + escapeJsonString(user.error) + "\"}");
+      continue;
+    }
+    ++(user.cached ? cached : acquired);
+  }
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"path\": \"" << escapeJsonString(filePath) << "\""
+      << ", \"content_id\": \"" << escapeJsonString(contentId) << "\""
+      << ", \"users\": " << users.size()
+      << ", \"cached\": " << cached
+      << ", \"acquired\": " << acquired
+      << ", \"errors\": " << BatchJSON(errors) << "}";
+  return oss.str();
+}
+
+// With an empty right only the rights list is reported and allowed means a license was issued.
+string DelegatedAccessJSON(const string& filePath, const string& contentId, const string& right, const vector<DelegatedUser>& users) {
+  vector<string> items;
+  for (const auto& user : users) {
+    std::ostringstream item;
+    const bool licensed = user.error.empty() && user.entry.protection;
+    item << "{\"user\": \"" << escapeJsonString(user.user) << "\""
+         << ", \"allowed\": " << (licensed && (right.empty() || user.entry.protection->AccessCheck(right)) ? "true" : "false")
+         << ", \"rights\": [";
+    if (licensed) {
+      const auto rights = user.entry.protection->GetRights();
+      for (size_t i = 0; i < rights.size(); ++i)
+        item << (i ? ", " : "") << "\"" << escapeJsonString(rights[i]) << "\"";
+    }
+    item << "], \"cached\": " << (user.cached ? "true" : "false")
+         << ", \"error\": \"" << escapeJsonString(user.error) << "\"}";
+    items.push_back(item.str());
+  }
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"path\": \"" << escapeJsonString(filePath) << "\""
+      << ", \"content_id\": \"" << escapeJsonString(contentId) << "\""
+      << ", \"right\": \"" << escapeJsonString(right) << "\""
+      << ", \"results\": " << BatchJSON(items) << "}";
+  return oss.str();
+}
+
+// Each of rights is allowed only when the user's license grants it; allowed is true when all are.
+string RightsCheckJSON(
+    const string& filePath,
+    const string& contentId,
+    const string& user,
+    const vector<string>& rights,
+    const RightsCache::Entry& entry,
+    bool cached,
+    const string& error) {
+  bool allowed = error.empty();
+  std::ostringstream checks;
+  for (size_t i = 0; i < rights.size(); ++i) {
+    const bool granted = error.empty() && RightsCache::Allows(entry, rights[i]);
+    allowed = allowed && granted;
+    checks << (i ? ", " : "") << "{\"right\": \"" << escapeJsonString(rights[i]) << "\", \"allowed\": " << (granted ? "true" : "false") << "}";
+  }
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"path\": \"" << escapeJsonString(filePath) << "\""
+      << ", \"content_id\": \"" << escapeJsonString(contentId) << "\""
+      << ", \"user\": \"" << escapeJsonString(user) << "\""
+      << ", \"allowed\": " << (allowed ? "true" : "false")
+      << ", \"checks\": [" << checks.str() << "]"
+      << ", \"rights\": [";
+  for (size_t i = 0; i < entry.rights.size(); ++i)
+    oss << (i ? ", " : "") << "\"" << escapeJsonString(entry.rights[i]) << "\"";
+  oss << "], \"cached\": " << (cached ? "true" : "false")
+      << ", \"error\": \"" << escapeJsonString(error) << "\"}";
+  return oss.str();
+}
+
+struct PrefetchSummary {
+  size_t licenses;
+  size_t cached;
+  size_t acquired;
+  // Files that open with the license acquired for another file of the call.
+  size_t shared;
+  vector<string> errors;
+};
+
+// Groups files by the content id of their publishing license and opens one file per license the engine
+// does not hold yet, in parallel. With license caching on, every other file of that license then opens
+// without a service round trip, so a batch from one template acquires one license instead of one per file.
+PrefetchSummary PrefetchUseLicenses(
+    const shared_ptr<FileEngine>& fileEngine,
+    const shared_ptr<MipContext>& inspectionContext,
+    const char** filePaths,
+    size_t count) {
+  vector<string> contentIds(count);
+  vector<string> readErrors(count);
+  ForEachParallel(count, [&](size_t i) {
+    try {
+      contentIds[i] = ReadLicenseInfo(string(filePaths[i]), inspectionContext).contentId;
+    }
+    catch (const std::exception& ex) {
+      readErrors[i] = ex.what();
+    }
+  });
+
+  static auto& sharedLicenses = MetricsRegistry::Shared().GetCounter(
+      "msip_native_batch_licenses_shared_total", "Batch files that opened with a use license acquired for another file of the batch");
+  PrefetchSummary summary = { 0, 0, 0, 0, vector<string>() };
+  auto& useLicenseCache = ContextManager::Instance().GetUseLicenseCache();
+  const string engineId = fileEngine->GetSettings().GetEngineId();
+  std::map<string, size_t> representatives;
+  std::map<string, size_t> members;
+  for (size_t i = 0; i < count; ++i) {
+    if (!readErrors[i].empty()) {
+      summary.errors.push_back(FileStatusErrorJSON(string(filePaths[i]), readErrors[i]));
+      continue;
+    }
+    if (contentIds[i].empty())
+      continue;
+    ++members[contentIds[i]];
+    if (!representatives.count(contentIds[i]))
+      representatives[contentIds[i]] = i;
+  }
+  summary.licenses = representatives.size();
+
+  vector<std::pair<string, size_t>> pending;
+  for (const auto& entry : representatives) {
+    if (useLicenseCache.Find(engineId, entry.first))
+      ++summary.cached;
+    else
+      pending.push_back(entry);
+  }
+
+  vector<string> acquireErrors(pending.size());
+  ForEachParallel(pending.size(), [&](size_t i) {
+    const string filePath(filePaths[pending[i].second]);
+    try {
+      ScopedPhase phase(PhaseMetrics::Phase::LicenseAcquire);
+      auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+      useLicenseCache.Put(engineId, pending[i].first, fileHandler->GetProtection());
+    }
+    catch (const std::exception& ex) {
+      acquireErrors[i] = FileStatusErrorJSON(filePath, ex.what());
+    }
+  });
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (!acquireErrors[i].empty()) {
+      summary.errors.push_back(acquireErrors[i]);
+      continue;
+    }
+    ++summary.acquired;
+    summary.shared += members[pending[i].first] - 1;
+  }
+  sharedLicenses.Add(summary.shared);
+  return summary;
+}
+
+// The license stage of the batch calls that open protected inputs. Without license caching every file
+// acquires its own license anyway, so grouping would only add reads. Calls that mostly take plain inputs,
+// such as protect and label batches, pass onlyProtectedFormats: their files are sniffed first, and zip
+// packages and unknown formats, which cannot carry protection, are never opened for a license. Failures
+// are not fatal: the affected files report their own error when they are processed.
+void PrefetchBatchLicenses(
+    const shared_ptr<FileEngine>& fileEngine,
+    const string& applicationId,
+    const char** filePaths,
+    size_t count,
+    bool onlyProtectedFormats) {
+  if (count < 2 || !ContextManager::Instance().GetStorageOptions().canCacheLicenses)
+    return;
+  vector<const char*> candidates(filePaths, filePaths + count);
+  if (onlyProtectedFormats) {
+    vector<char> protectable(count, 0);
+    ForEachParallel(count, [&](size_t i) {
+      const FileFormat format = FormatSniffer::SniffFile(filePaths[i]).format;
+      protectable[i] = format == FileFormat::Cfb || format == FileFormat::Msg || format == FileFormat::Pdf || format == FileFormat::Pfile;
+    });
+    candidates.clear();
+    for (size_t i = 0; i < count; ++i) {
+      if (protectable[i])
+        candidates.push_back(filePaths[i]);
+    }
+    if (candidates.size() < 2)
+      return;
+  }
+  try {
+    PrefetchUseLicenses(fileEngine, ContextManager::Instance().GetInspectionContext(applicationId), candidates.data(), candidates.size());
+  }
+  catch (const std::exception&) {
+  }
+}
+
+string PrefetchJSON(size_t count, const PrefetchSummary& summary) {
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"files\": " << count
+      << ", \"licenses\": " << summary.licenses
+      << ", \"cached\": " << summary.cached
+      << ", \"acquired\": " << summary.acquired
+      << ", \"shared\": " << summary.shared
+      << ", \"errors\": " << BatchJSON(summary.errors) << "}";
+  return oss.str();
+}
+
+// Copies a batch result into a fixed-size buffer. Fails without truncating when resultSize is too small.
+int CopyBatchResult(int status, const string& json, char* result, size_t resultSize) {
+  if (json.size() < resultSize) {
+    strcpy(result, json.c_str());
+    return status;
+  }
+  std::ostringstream oss;
+  oss << "{\"status\": false, \"error\": \"Result buffer too small\", \"needed\": " << json.size() + 1 << "}";
+  const string error = oss.str();
+  if (error.size() < resultSize)
+    strcpy(result, error.c_str());
+  else if (resultSize > 0)
+    result[0] = '\0';
+  return EXIT_FAILURE;
+}
+
+// Returned by *_v2 exports when the result does not fit in the caller's buffer. *needed holds the
+// required size including the terminator, and msipTakeResult fetches the result without rerunning the call.
+static const int kResultTooSmall = 2;
+
+// The last *_v2 result on this thread that did not fit, so mutating calls never have to be retried.
+struct PendingResult {
+  bool valid = false;
+  int status = EXIT_FAILURE;
+  string json;
+};
+thread_local PendingResult tPendingResult;
+
+// Output of the last *ToBuffer call on this thread that did not fit the caller's memory.
+thread_local BufferPool::Buffer tPendingOutput;
+thread_local size_t tPendingOutputSize = 0;
+
+void KeepOverflowedOutput(OutputBufferStream& outputStream, size_t* dataSize) {
+  if (dataSize) *dataSize = static_cast<size_t>(outputStream.Size());
+  tPendingOutputSize = outputStream.Overflowed() ? static_cast<size_t>(outputStream.Size()) : 0;
+  if (outputStream.Overflowed())
+    tPendingOutput = outputStream.TakeOverflow();
+  else
+    tPendingOutput.Reset();
+}
+
+int WriteResult(int status, const string& json, char* out, size_t cap, size_t* needed) {
+  const size_t required = json.size() + 1;
+  if (needed) *needed = required;
+  if (out && cap >= required) {
+    memcpy(out, json.c_str(), required);
+    tPendingResult.valid = false;
+    return status;
+  }
+  tPendingResult.valid = true;
+  tPendingResult.status = status;
+  tPendingResult.json = json;
+  if (out && cap > 0) out[0] = '\0';
+  return kResultTooSmall;
+}
+
+// Returned instead of running an operation that admission control turned away (see msipConfigureAdmission).
+// Nothing was attempted, so the caller can retry it later or on another replica.
+static const int kOverloaded = 3;
+
+// Memory an operation over an input of size bytes is estimated to hold: the input and the output being
+// written, each capped at the largest file engines protect when that is configured.
+int64_t EstimateOperationBytesForSize(int64_t size) {
+  const int64_t maxFileSize = ContextManager::Instance().GetEngineOptions()->maxFileSizeForProtection;
+  if (maxFileSize > 0 && size > maxFileSize)
+    size = maxFileSize;
+  return 2 * size;
+}
+
+// Memory an operation over filePath is estimated to hold. Unreadable paths cost nothing.
+int64_t EstimateOperationBytes(const char* filePath) {
+  struct stat fileInfo;
+  if (!filePath || stat(filePath, &fileInfo) != 0)
+    return 0;
+  return EstimateOperationBytesForSize(fileInfo.st_size);
+}
+
+// What a traffic capture records of an operation's input (see msipStartCapture): the path or name hint
+// whose extension is its format, how many files it names, and their bytes, -1 when unknown.
+struct InputShape {
+  InputShape(const string& name = string(), int64_t sizeBytes = -1, uint32_t files = 1)
+      : name(name), sizeBytes(sizeBytes), files(files) {}
+
+  string name;
+  int64_t sizeBytes;
+  uint32_t files;
+};
+
+int RunUnderTicket(
+    const char* operation, int64_t bytes, const string& tenant, string& result, const std::function<int()>& run);
+
+// Runs run under an admission ticket of tenant (see RunAdmittedBytes), recording the operation's shape
+// while traffic is captured.
+int RunUnderTicket(
+    const char* operation, int64_t bytes, const string& tenant, string& result, const std::function<int()>& run,
+    const InputShape& shape) {
+  auto& capture = TrafficCapture::Instance();
+  if (!capture.Sample())
+    return RunUnderTicket(operation, bytes, tenant, result, run);
+  static auto& captured = MetricsRegistry::Shared().GetCounter(
+      "msip_native_captured_operations_total", "Operations recorded by the traffic capture");
+  TrafficCapture::Record record;
+  record.operation = operation;
+  record.name = shape.name;
+  record.files = shape.files;
+  record.sizeBytes = shape.sizeBytes;
+  record.tenant = tenant;
+  record.status = EXIT_FAILURE;
+  record.start = TrafficCapture::Clock::now();
+  {
+    sample::oplog::ScopedCacheTally tally;
+    try {
+      record.status = RunUnderTicket(operation, bytes, tenant, result, run);
+    }
+    catch (...) {
+      record.end = TrafficCapture::Clock::now();
+      record.cacheHits = tally.GetHits();
+      record.cacheMisses = tally.GetMisses();
+      capture.Add(record);
+      captured.Add(1);
+      throw;
+    }
+    record.cacheHits = tally.GetHits();
+    record.cacheMisses = tally.GetMisses();
+  }
+  record.end = TrafficCapture::Clock::now();
+  capture.Add(record);
+  captured.Add(1);
+  return record.status;
+}
+
+// Runs run under an admission ticket of tenant (see RunAdmittedBytes).
+int RunUnderTicket(
+    const char* operation, int64_t bytes, const string& tenant, string& result, const std::function<int()>& run) {
+  AdmissionController::Ticket ticket;
+  auto& contextManager = ContextManager::Instance();
+  auto& admission = contextManager.GetAdmissionController();
+  if (!admission.TryAdmit(bytes, tenant, sample::priority::Current(), operation, ticket)) {
+    contextManager.GetRecentOutcomes().Record(RecentOutcomes::Outcome::Rejected);
+    result = getUnprotectStatusJSON(false, admission.IsDraining() ? "Shutting down" : "Too many operations in flight", "");
+    return kOverloaded;
+  }
+  // Work the operation dispatches and the licenses it caches are accounted to its tenant, and what it costs
+  // to its tenant and operation type (see msipConfigureCostAccounting).
+  sample::tenant::ScopedTenant tenantScope(tenant);
+  sample::cost::ScopedKey costScope(sample::cost::OperationKey(tenant, operation));
+  sample::cost::Add(sample::cost::Counter::Operations, 1);
+  ScopedOperationBudget budget;
+  int status = EXIT_FAILURE;
+  try {
+    status = run();
+  }
+  catch (...) {
+    contextManager.GetRecentOutcomes().Record(RecentOutcomes::Outcome::Failed);
+    throw;
+  }
+  contextManager.GetRecentOutcomes().Record(
+      status == EXIT_SUCCESS ? RecentOutcomes::Outcome::Succeeded : RecentOutcomes::Outcome::Failed);
+  return status;
+}
+
+// Runs run as one operation of applicationId's tenant, estimated to hold bytes, when admission control
+// admits it at the caller's priority (see msipSetPriority) and under the adaptive limit of its operation
+// type, e.g. "status" or "protect" (see msipConfigureAdaptiveAdmission), and fails fast with
+// kOverloaded otherwise.
+// Its outcome is counted for msipHealth. An operation tagged with an idempotency key runs once per key
+// (see msipSetIdempotencyKey): a retry waits for or returns the original's result, which request, e.g.
+// the paths, must match, before it takes an admission ticket. shape describes the input to a traffic
+// capture (see msipStartCapture).
+int RunAdmittedBytes(
+    const char* operation,
+    int64_t bytes,
+    const char* applicationId,
+    string& result,
+    const std::function<int()>& run,
+    const string& request = string(),
+    const InputShape& shape = InputShape()) {
+  static auto& idempotentCalls = MetricsRegistry::Shared().GetCounter(
+      "msip_native_idempotent_calls_total", "Operations tagged with an idempotency key");
+  const string tenant = applicationId ? applicationId : "";
+  const string key = IdempotencyCache::TakeCurrentKey();
+  auto& idempotency = IdempotencyCache::Instance();
+  if (key.empty() || !idempotency.IsEnabled())
+    return RunUnderTicket(operation, bytes, tenant, result, run, shape);
+  idempotentCalls.Add(1);
+  return idempotency.Run(tenant + '\n' + key, request, result, [&]() {
+    return RunUnderTicket(operation, bytes, tenant, result, run, shape);
+  }, [](const string& error) { return getUnprotectStatusJSON(false, error, ""); });
+}
+
+// Runs run as one operation of applicationId's tenant over count paths (see RunAdmittedBytes). A batch
+// holds at most kMaxBatchWorkers files at a time, so only its largest files count toward the estimate.
+int RunAdmitted(
+    const char* operation,
+    const char* const* filePaths,
+    size_t count,
+    const char* applicationId,
+    string& result,
+    const std::function<int()>& run) {
+  // A single file the format gate turns away costs neither an admission ticket nor an engine.
+  if (count == 1 && filePaths[0]) {
+    const string rejection = FormatGate::Instance().CheckFile(filePaths[0]);
+    if (!CountRejection(rejection).empty()) {
+      result = getUnprotectStatusJSON(false, rejection, "");
+      return EXIT_FAILURE;
+    }
+    if (InputQuarantine::Instance().Contains(filePaths[0])) {
+      result = getUnprotectStatusJSON(false, kQuarantinedError, "");
+      return EXIT_FAILURE;
+    }
+  }
+  vector<int64_t> sizes(count);
+  for (size_t i = 0; i < count; ++i)
+    sizes[i] = EstimateOperationBytes(filePaths[i]);
+  const size_t concurrent = std::min(count, kMaxBatchWorkers);
+  std::partial_sort(sizes.begin(), sizes.begin() + concurrent, sizes.end(), std::greater<int64_t>());
+  int64_t bytes = 0;
+  for (size_t i = 0; i < concurrent; ++i)
+    bytes += sizes[i];
+  // Only an idempotency key compares it.
+  string request;
+  if (IdempotencyCache::Instance().IsEnabled()) {
+    for (size_t i = 0; i < count; ++i) {
+      request += filePaths[i] ? filePaths[i] : "";
+      request += '\0';
+    }
+  }
+  InputShape shape(count > 0 && filePaths[0] ? filePaths[0] : "", -1, static_cast<uint32_t>(count));
+  if (TrafficCapture::Instance().IsEnabled()) {
+    shape.sizeBytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+      struct stat fileInfo;
+      if (filePaths[i] && stat(filePaths[i], &fileInfo) == 0)
+        shape.sizeBytes += fileInfo.st_size;
+    }
+  }
+  return RunAdmittedBytes(operation, bytes, applicationId, result, run, request, shape);
+}
+
+// Gives the operation an operation log while slow operations are recorded or its timeline is, keeps and
+// logs it when it runs past the threshold, and keeps its timeline. Its allocations are accounted under its
+// name. The operation fails unless Succeeded is called before the scope ends.
+class ScopedSlowOperation final {
+public:
+  ScopedSlowOperation(const char* operation, const string& path)
+      : mAllocation(operation),
+        mOperation(operation),
+        mPath(path),
+        mSucceeded(false),
+        mTimeline(TimelineRecorder::Instance().ShouldRecord()) {
+    if (mTimeline || SlowOperationRecorder::Instance().GetThresholdMicros() > 0) {
+      mLog = make_shared<sample::oplog::OperationLog>(mTimeline ? TimelineRecorder::kMaxEvents : sample::oplog::OperationLog::kMaxEvents);
+      mScope.reset(new sample::oplog::ScopedOperationLog(mLog));
+    }
+  }
+
+  ~ScopedSlowOperation() {
+    if (!mLog)
+      return;
+    mScope.reset();
+    const auto end = sample::oplog::OperationLog::Clock::now();
+    if (mTimeline) {
+      try {
+        TimelineRecorder::Instance().Add(mOperation, mPath, mSucceeded, *mLog, end);
+      }
+      catch (const std::exception&) {
+      }
+    }
+    const auto threshold = SlowOperationRecorder::Instance().GetThresholdMicros();
+    if (threshold <= 0 || std::chrono::duration_cast<std::chrono::microseconds>(end - mLog->GetStart()).count() < threshold)
+      return;
+    try {
+      const auto record = SlowOperationRecorder::Instance().Add(mOperation, mPath, mSucceeded, *mLog, end);
+      ContextManager::Instance().GetLoggerDelegate()->WriteToLog(
+          mip::LogLevel::Warning, SlowOperationRecorder::Summarize(record), __func__, __FILE__, __LINE__);
+    }
+    catch (const std::exception&) {
+      // Recording is best effort; the operation's result stands.
+    }
+  }
+
+  ScopedSlowOperation(const ScopedSlowOperation&) = delete;
+  ScopedSlowOperation& operator=(const ScopedSlowOperation&) = delete;
+
+  void Succeeded() { mSucceeded = true; }
+
+private:
+  // Declared first, so it ends last and counts what recording the operation allocated too.
+  sample::alloc::ScopedOperation mAllocation;
+  const char* mOperation;
+  const string& mPath;
+  bool mSucceeded;
+  const bool mTimeline;
+  shared_ptr<sample::oplog::OperationLog> mLog;
+  std::unique_ptr<sample::oplog::ScopedOperationLog> mScope;
+};
+
+int RunGetFileStatus(const string& filePath, const string& applicationId, string& result) {
+  try {
+    auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    result = FileStatusJSON(filePath, mipContext);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Inspects the content of stream as a file named nameHint. The SDK picks the file's handler by nameHint's
+// extension; nothing is read from or written to disk, and the inspection cache is bypassed since nameHint
+// need not name a file.
+int RunGetStreamStatus(
+    const shared_ptr<Stream>& stream,
+    const string& nameHint,
+    const string& applicationId,
+    string& result,
+    uint64_t knownCleanKey = 0) {
+  try {
+    auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    result = FileStatusJSON(nameHint, ProbeKnownClean(knownCleanKey, [&]() {
+      return InspectFileStatus(nameHint, stream, mipContext);
+    }));
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(nameHint, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Members of an archive probed, and the bytes a deflated member may inflate to in memory to be probed.
+const size_t kMaxArchiveMembers = 10000;
+const size_t kMaxInflatedArchiveMemberBytes = 64 * 1024 * 1024;
+
+// The status of each member of the ZIP or tar archive at filePath, probed in parallel from the mapped
+// archive without extracting anything to disk: stored members are read in place and deflated ones are
+// inflated into memory. Members are named by their path in the archive, which picks their handler like
+// RunGetStreamStatus's nameHint. Nested archives are probed as files, not opened.
+int RunGetArchiveStatus(const string& filePath, const string& applicationId, string& result) {
+  static auto& members = MetricsRegistry::Shared().GetCounter(
+      "msip_native_archive_members_total", "Archive members probed by getArchiveStatus");
+  static auto& memberFailures = MetricsRegistry::Shared().GetCounter(
+      "msip_native_archive_member_failures_total", "Archive members getArchiveStatus could not probe");
+  shared_ptr<MipContext> mipContext;
+  shared_ptr<MappedFileStream> mapping;
+  size_t size = 0;
+  vector<ArchiveMember> entries;
+  bool truncated = false;
+  ArchiveFormat format = ArchiveFormat::None;
+  try {
+    mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    mapping = MapInput(filePath);
+    size = static_cast<size_t>(mapping->Size());
+    // The archive is untrusted input, so a listing that fails on it fails only this call.
+    if (mapping->Data())
+      format = ListArchiveMembers(mapping->Data(), size, kMaxArchiveMembers, entries, truncated);
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+
+  if (format == ArchiveFormat::None) {
+    result = FileStatusErrorJSON(filePath, "The file is not a ZIP or tar archive");
+    return EXIT_FAILURE;
+  }
+
+  // Aliases the mapping, so that member streams keep it alive.
+  const shared_ptr<const uint8_t> archive(mapping, mapping->Data());
+  std::atomic<size_t> protectedCount(0);
+  std::atomic<size_t> labeledCount(0);
+  std::atomic<size_t> failedCount(0);
+  BatchResults items(entries.size());
+  ForEachParallel(entries.size(), [&](size_t i) {
+    const auto& member = entries[i];
+    const string sizeField = ", \"size\": " + std::to_string(member.size);
+    try {
+      auto stream = OpenArchiveMember(archive, size, member, kMaxInflatedArchiveMemberBytes);
+      const auto status = InspectFileStatus(member.name, stream, mipContext);
+      if (status.isProtected)
+        ++protectedCount;
+      if (status.isLabeled)
+        ++labeledCount;
+      items.Set(i, FileStatusJSON(member.name, status, sizeField));
+    }
+    catch (const std::exception& ex) {
+      ++failedCount;
+      items.Set(i, FileStatusErrorJSON(member.name, ex.what()));
+    }
+  });
+  members.Add(entries.size());
+  memberFailures.Add(failedCount);
+
+  JsonWriter json(128 + filePath.size());
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("path").String(filePath)
+      .Key("format").String(ArchiveFormatName(format))
+      .Key("members").Int(static_cast<int64_t>(entries.size()))
+      .Key("truncated").Bool(truncated)
+      .Key("protected").Int(static_cast<int64_t>(protectedCount))
+      .Key("labeled").Int(static_cast<int64_t>(labeledCount))
+      .Key("failed").Int(static_cast<int64_t>(failedCount))
+      .Key("results").Raw(items.Finish())
+      .EndObject();
+  result = json.Take();
+  return EXIT_SUCCESS;
+}
+
+int RunInspectLicense(const string& filePath, const string& applicationId, string& result) {
+  try {
+    auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    result = LicenseInfoJSON(filePath, mipContext);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// What the decrypted content cache knows of an unprotect's input, once it was found small enough to cache.
+struct DecryptedContentLookup {
+  bool eligible = false;
+  DecryptedContentCache::Digest digest;
+  DecryptedContentCache::Identity identity;
+};
+
+// Serves filePath from the decrypted content cache (see msipConfigureDecryptedContentCache), writing its
+// plaintext where the unprotect would have committed it. Fills lookup for CacheDecryptedContent when the
+// file may be cached but was not served.
+bool ServeDecryptedContent(
+    const string& protectionToken,
+    const string& filePath,
+    const string& applicationId,
+    DecryptedContentLookup& lookup,
+    string& result) {
+  static const string kPfileExtension = ".pfile";
+  auto& contextManager = ContextManager::Instance();
+  auto& cache = contextManager.GetDecryptedContentCache();
+  struct stat info;
+  if (!cache.IsEnabled() || stat(filePath.c_str(), &info) != 0 || !cache.Admits(info.st_size))
+    return false;
+  DecryptedContentCache::HashFile(filePath, lookup.digest);
+  lookup.eligible = true;
+  lookup.identity.applicationId = applicationId;
+  string plaintext;
+  if (!cache.FindUser(applicationId, protectionToken, lookup.identity.user) ||
+      !cache.Find(lookup.digest, lookup.identity, contextManager.GetRightsCache(), plaintext))
+    return false;
+
+  // The SDK names the output of a pfile after the file it protects.
+  const bool pfile = EqualsIgnoreCase(GetFileExtension(filePath), kPfileExtension);
+  string outputFilePath = CreateProtectionOutputPath(pfile ? filePath.substr(0, filePath.size() - kPfileExtension.size()) : filePath);
+  {
+    ScopedPhase phase(PhaseMetrics::Phase::Commit);
+    std::ofstream output(FILENAME_STRING(outputFilePath), std::ios::binary | std::ios::trunc);
+    output.write(plaintext.data(), static_cast<std::streamsize>(plaintext.size()));
+    output.close();
+    if (!output)
+      throw std::runtime_error("Unable to write " + outputFilePath);
+  }
+  outputFilePath = PublishOutput(outputFilePath);
+  MSIP_EVENT(mip::LogLevel::Info, "output_written", {"path", outputFilePath}, {"writer", "decrypted_content_cache"});
+  contextManager.GetInspectionCache().Invalidate(outputFilePath);
+  result = getUnprotectStatusJSON(true, "", outputFilePath);
+  return true;
+}
+
+// Keeps the output an unprotect just committed for the next request of the same file and identity. A
+// failure to cache it leaves the unprotect as it was.
+void CacheDecryptedContent(
+    const DecryptedContentLookup& lookup,
+    const string& protectionToken,
+    const string& committedPath,
+    const shared_ptr<ProtectionHandler>& protection) {
+  if (!lookup.eligible || committedPath.empty() || !protection)
+    return;
+  try {
+    MappedFileStream output(committedPath);
+    string plaintext(static_cast<size_t>(output.Size()), '\0');
+    if (!plaintext.empty())
+      output.Read(reinterpret_cast<uint8_t*>(&plaintext[0]), output.Size());
+    const DecryptedContentCache::Identity identity = { lookup.identity.applicationId, protection->GetIssuedTo() };
+    ContextManager::Instance().GetDecryptedContentCache().Put(
+        lookup.digest, identity, protectionToken, protection->GetContentId(), RightsCache::FromProtection(*protection), plaintext);
+  } catch (const std::exception& ex) {
+    MSIP_EVENT(mip::LogLevel::Warning, "content_cache_failed", {"path", committedPath}, {"error", ex.what()});
+  }
+}
+
+int RunUnprotectFile(const string& protectionToken, const string& filePath, const string& applicationId, string& result) {
+  ScopedSlowOperation slow("unprotect", filePath);
+  try {
+    auto fileSampleWorkingDirectory = GetWorkingDirectory();
+
+    const string username = "";
+
+    auto mipContext = ContextManager::Instance().GetMipContext(applicationId);
+
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    DecryptedContentLookup lookup;
+    if (ServeDecryptedContent(protectionToken, filePath, applicationId, lookup, result)) {
+      slow.Succeeded();
+      return EXIT_SUCCESS;
+    }
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    string committedPath;
+    shared_ptr<ProtectionHandler> protection;
+    if (UnprotectPfile(engineKey, protectionToken, filePath, result, &committedPath, &protection)) {
+      CacheDecryptedContent(lookup, protectionToken, committedPath, protection);
+      slow.Succeeded();
+      return EXIT_SUCCESS;
+    }
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, fileSampleWorkingDirectory);
+
+    result = UnprotectFileJSON(fileEngine, mipContext, filePath, &committedPath, &protection);
+    CacheDecryptedContent(lookup, protectionToken, committedPath, protection);
+    slow.Succeeded();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunUnprotectFileToStream(
+    const string& protectionToken,
+    const string& filePath,
+    const shared_ptr<Stream>& outputStream,
+    const string& applicationId,
+    string& result) {
+  ScopedSlowOperation slow("unprotect", filePath);
+  try {
+    auto mipContext = ContextManager::Instance().GetMipContext(applicationId);
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+
+    shared_ptr<mip::Stream> fileStream = GetLargeInputStream(filePath);
+    auto fileHandler = GetFileHandler(fileEngine, fileStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    EnsureUserHasRights(fileHandler);
+    result = UnprotectToStream(fileHandler, outputStream);
+    slow.Succeeded();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Receives a piece of extracted text, or of plaintext, from extractText. Returning nonzero stops the extraction.
+typedef int (*MsipTextCallback)(const char* data, size_t size, void* userData);
+
+// Plaintext pieces extractText hands over in raw mode.
+const size_t kPlaintextChunkBytes = 64 * 1024;
+
+// Decrypts filePath into pool memory and hands its text to sink as each part is extracted, or with raw
+// the plaintext itself for an extractor of the caller's, e.g. for PDF. Unprotected files are read as they
+// are. No plaintext is written to disk, and the memory that held it is zeroed before it goes back to the
+// pool. Zip packages are decrypted whole before extraction starts, as their directory comes last.
+int RunExtractText(
+    const string& protectionToken,
+    const string& filePath,
+    const string& applicationId,
+    bool raw,
+    size_t maxBytes,
+    const TextSink& sink,
+    string& result) {
+  ScopedSlowOperation slow("extract", filePath);
+  try {
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+
+    shared_ptr<mip::Stream> fileStream = GetLargeInputStream(filePath);
+    const int64_t inputSize = fileStream->Size();
+    auto fileHandler = GetFileHandler(fileEngine, fileStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    EnsureUserHasRights(fileHandler);
+
+    // Decrypted content is about the size of the protected file, so this buffer usually holds all of it.
+    BufferPool::Buffer memory = BufferPool::Shared().Acquire(
+        std::max(static_cast<size_t>(std::max<int64_t>(inputSize, 0)), BufferPool::kMinClassBytes));
+    auto plaintext = make_shared<OutputBufferStream>(memory.Data(), static_cast<int64_t>(memory.Capacity()));
+    plaintext->WipeOnGrowth();
+    const bool isProtected = RemoveProtectionIfAny(fileHandler) && fileHandler->IsModified();
+    if (isProtected) {
+      if (!CommitInto(fileHandler, plaintext)) {
+        result = getUnprotectStatusJSON(false, "No changes to commit", "");
+        return EXIT_FAILURE;
+      }
+    } else {
+      fileStream->Seek(0);
+      vector<uint8_t> chunk(kPlaintextChunkBytes);
+      for (int64_t count; (count = fileStream->Read(chunk.data(), static_cast<int64_t>(chunk.size()))) > 0;)
+        plaintext->Write(chunk.data(), count);
+    }
+
+    const size_t size = static_cast<size_t>(plaintext->Size());
+    BufferPool::Buffer overflow;
+    if (plaintext->Overflowed())
+      overflow = plaintext->TakeOverflow();
+    uint8_t* data = overflow ? overflow.Data() : memory.Data();
+    size_t handed = 0;
+    bool stopped = false;
+    if (raw) {
+      for (size_t offset = 0; offset < size && offset < maxBytes && !stopped; offset += kPlaintextChunkBytes) {
+        const size_t count = std::min(std::min(kPlaintextChunkBytes, size - offset), maxBytes - offset);
+        stopped = !sink(reinterpret_cast<const char*>(data + offset), count);
+        handed += count;
+      }
+    } else {
+      handed = ExtractText(data, size, maxBytes, [&](const char* text, size_t textSize) {
+        stopped = !sink(text, textSize);
+        return !stopped;
+      });
+    }
+    memset(data, 0, size);
+
+    MSIP_EVENT(mip::LogLevel::Info, "text_extracted",
+        {"mode", raw ? "plaintext" : "text"},
+        {"protected", isProtected ? "true" : "false"},
+        {"bytes", std::to_string(handed)});
+    JsonWriter json(128 + filePath.size());
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("path").String(filePath)
+        .Key("protected").Bool(isProtected)
+        .Key("mode").String(raw ? "plaintext" : "text")
+        .Key("plaintext_bytes").UInt(size)
+        .Key("bytes").UInt(handed)
+        .Key("stopped").Bool(stopped)
+        .Key("error").String("")
+        .EndObject();
+    result = json.Take();
+    slow.Succeeded();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Decrypts into a temporary stream and hands it out as a stream handle, so the plaintext is never
+// committed next to the protected file. With the temp file pool configured (see msipConfigureTempFiles),
+// a protected file is committed into one of its files; otherwise the SDK creates the stream, and the handle
+// keeps the handler and its engine alive until msipClose.
+int RunOpenDecrypted(
+    const string& protectionToken,
+    const string& filePath,
+    const string& applicationId,
+    string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+
+    auto inputStream = GetLargeInputStream(filePath);
+    const int64_t inputSize = inputStream->Size();
+    auto fileHandler = GetFileHandler(fileEngine, inputStream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    EnsureUserHasRights(fileHandler);
+    shared_ptr<Stream> decryptedStream;
+    shared_ptr<void> owner;
+    auto& tempFiles = TempFilePool::Shared();
+    if (tempFiles.IsEnabled() && fileHandler->GetProtection()) {
+      // Decrypted content is about the size of its ciphertext.
+      decryptedStream = make_shared<TempFileStream>(tempFiles.Acquire(inputSize));
+      fileHandler->RemoveProtection();
+      CommitToStream(fileHandler, decryptedStream);
+      decryptedStream->Seek(0);
+    } else {
+      auto decryptedCompletion = AsyncCompletion<shared_ptr<Stream>>::Create();
+      auto decryptedFuture = decryptedCompletion->GetFuture();
+      fileHandler->GetDecryptedTemporaryStreamAsync(decryptedCompletion);
+      decryptedStream = decryptedFuture.get();
+      owner = make_shared<std::pair<shared_ptr<FileEngine>, shared_ptr<FileHandler>>>(fileEngine, fileHandler);
+    }
+    auto handle = ContextManager::Instance().GetStreamHandles().Open(decryptedStream, owner);
+    std::ostringstream oss;
+    oss << "{\"status\": true, \"path\": \"" << escapeJsonString(filePath) << "\""
+        << ", \"handle\": " << handle
+        << ", \"size\": " << decryptedStream->Size() << "}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Opens filePath once for a file session. Later session calls reuse the parsed file and the license
+// acquired here, and the session keeps the engine alive until it is closed or expires.
+int RunOpenFileSession(
+    const string& protectionToken,
+    const string& filePath,
+    const string& applicationId,
+    string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+    auto fileHandler = GetFileHandler(fileEngine, GetLargeInputStream(filePath), filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    auto& sessions = ContextManager::Instance().GetFileSessions();
+    const auto handle = sessions.Open(fileHandler, filePath, fileEngine);
+    sessions.With(handle, [&](const FileSessionTable::Session& session) {
+      result = FileSessionJSON(handle, session);
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+int RunFileSessionCall(
+    FileSessionTable::Handle handle,
+    const std::function<string(const FileSessionTable::Session& session)>& call,
+    string& result) {
+  string filePath;
+  try {
+    ContextManager::Instance().GetFileSessions().With(handle, [&](const FileSessionTable::Session& session) {
+      filePath = session.filePath;
+      result = call(session);
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+int RunProtectFile(
+    const string& protectionToken,
+    const string& filePath,
+    const string& encryptedFilePath,
+    const string& username,
+    const string& applicationId,
+    string& result,
+    const shared_ptr<Stream>& outputStream = nullptr) {
+  ScopedSlowOperation slow("protect", filePath);
+  try {
+    auto fileSampleWorkingDirectory = GetWorkingDirectory();
+
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, fileSampleWorkingDirectory);
+
+    result = ProtectFileJSON(fileEngine, GetReferenceProtection(fileEngine, encryptedFilePath), filePath, outputStream);
+    slow.Succeeded();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunProtectFileDetached(
+    const string& protectionToken,
+    const string& filePath,
+    const string& encryptedFilePath,
+    const string& username,
+    const string& applicationId,
+    string outputPath,
+    string licensePath,
+    string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+    auto protection = GetReferenceProtection(fileEngine, encryptedFilePath);
+
+    if (outputPath.empty())
+      outputPath = filePath + ".enc";
+    if (licensePath.empty())
+      licensePath = outputPath + ".pl";
+    const int64_t written = EncryptFileDetached(
+        protection, filePath, outputPath, licensePath, ContextManager::Instance().GetTaskDispatcher());
+
+    std::ostringstream oss;
+    oss << "{\"status\": true, \"path\": \"" << escapeJsonString(outputPath) << "\""
+        << ", \"license_path\": \"" << escapeJsonString(licensePath) << "\""
+        << ", \"bytes\": " << written << ", \"error\": \"\"}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Decrypts the raw ciphertext protectFileDetached wrote, with the publishing license stored next to it.
+int RunUnprotectFileDetached(
+    const string& protectionToken,
+    const string& filePath,
+    string licensePath,
+    const string& applicationId,
+    string outputPath,
+    string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto protectionEngine = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).engine;
+    if (licensePath.empty())
+      licensePath = filePath + ".pl";
+    if (outputPath.empty())
+      outputPath = filePath + ".dec";
+    ProtectionHandler::ConsumptionSettings consumptionSettings(ReadDetachedLicense(licensePath));
+    shared_ptr<ProtectionHandler> protection;
+    {
+      ScopedPhase phase(PhaseMetrics::Phase::LicenseAcquire);
+      protection = protectionEngine->CreateProtectionHandlerForConsumption(consumptionSettings, nullptr);
+    }
+    EnsureUserHasRights(protection);
+    const int64_t written = DecryptFileDetached(
+        protection, filePath, outputPath, ContextManager::Instance().GetTaskDispatcher());
+
+    std::ostringstream oss;
+    oss << "{\"status\": true, \"path\": \"" << escapeJsonString(outputPath) << "\""
+        << ", \"bytes\": " << written << ", \"error\": \"\"}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunGetFileStatusBatch(const char** filePaths, size_t count, const string& applicationId, string& result) {
+  shared_ptr<MipContext> mipContext;
+  try {
+    mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  BatchResults items(count);
+  auto readAhead = StartReadAhead(filePaths, BatchOrder(count));
+  ForEachParallel(count, [&](size_t i) {
+    const string filePath(filePaths[i]);
+    ScopedReadAheadInput input(filePaths[i], readAhead ? readAhead->Take(i) : nullptr);
+    try {
+      items.Set(i, FileStatusJSON(filePath, mipContext));
+    }
+    catch (const std::exception& ex) {
+      items.Set(i, FileStatusErrorJSON(filePath, ex.what()));
+    }
+  });
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+// getFileStatusBatch encoded as StatusRecords. With withLicense, protected files also carry the owner,
+// content, template and label of their publishing license, read offline.
+int RunGetFileStatusBatchBinary(const char** filePaths, size_t count, bool withLicense, const string& applicationId, string& result) {
+  vector<StatusRecords::Fields> items(count);
+  for (size_t i = 0; i < count; ++i)
+    items[i].path = filePaths[i];
+
+  shared_ptr<MipContext> mipContext;
+  try {
+    mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+  }
+  catch (const std::exception& ex) {
+    for (auto& item : items)
+      item.error = ex.what();
+    result = StatusRecords::Encode(items);
+    return EXIT_FAILURE;
+  }
+
+  auto readAhead = StartReadAhead(filePaths, BatchOrder(count));
+  ForEachParallel(count, [&](size_t i) {
+    auto& item = items[i];
+    ScopedReadAheadInput input(filePaths[i], readAhead ? readAhead->Take(i) : nullptr);
+    try {
+      const auto status = ProbeFileStatus(item.path, mipContext);
+      item.status = true;
+      item.flags = (status.isProtected ? StatusRecords::kProtected : 0)
+          | (status.isLabeled ? StatusRecords::kLabeled : 0)
+          | (status.containsProtectedObjects ? StatusRecords::kProtectedObjects : 0);
+      if (withLicense && status.isProtected) {
+        const auto info = ReadLicenseInfo(item.path, mipContext);
+        item.flags |= StatusRecords::kLicense;
+        item.issuedTime = info.issuedTime;
+        item.labelId = info.labelId;
+        item.owner = info.owner;
+        item.contentId = info.contentId;
+        item.templateId = info.templateId;
+        item.templateName = info.templateName;
+      }
+    }
+    catch (const std::exception& ex) {
+      item.error = ex.what();
+    }
+  });
+  try {
+    result = StatusRecords::Encode(items);
+  }
+  catch (const std::length_error&) {
+    // Too large for one result; the caller splits the batch.
+    result.clear();
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Writes all of data to fd, which may be a pipe or socket. False once the reader has gone away.
+bool WriteAllToFd(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t count = write(fd, data.data() + written, data.size() - written);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    written += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+// Probes every file under root that passes filters (see TreeScanner::ParseFilters) and writes one status
+// per line to outputFd, in the order files are found. Each scanner thread collects its lines and writes them
+// in blocks, so a crawl of millions of files makes few write calls and never holds its results in memory.
+// result summarizes the walk.
+int RunScanTree(const string& root, const string& filters, int outputFd, const string& applicationId, string& result) {
+  // Lines a thread collects before writing them out.
+  static const size_t kFlushBytes = 64 * 1024;
+  try {
+    if (outputFd < 0)
+      throw std::invalid_argument("Invalid output file descriptor");
+    auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    sample::tenant::ScopedTenant tenantScope(applicationId);
+    sample::cost::ScopedKey costScope(sample::cost::OperationKey(applicationId, "scan"));
+    sample::cost::Add(sample::cost::Counter::Operations, 1);
+    TreeScanner scanner(TreeScanner::ParseFilters(filters));
+
+    vector<string> pending(scanner.GetWorkerCount());
+    std::mutex outputMutex;
+    bool outputFailed = false;
+    int outputError = 0;
+    auto flush = [&](size_t worker) {
+      std::lock_guard<std::mutex> lock(outputMutex);
+      if (!outputFailed && !WriteAllToFd(outputFd, pending[worker])) {
+        outputFailed = true;
+        outputError = errno;
+      }
+      pending[worker].clear();
+      return !outputFailed;
+    };
+    auto emit = [&](size_t worker, const string& line) {
+      pending[worker] += line;
+      pending[worker] += '\n';
+      return pending[worker].size() < kFlushBytes || flush(worker);
+    };
+
+    const auto stats = scanner.Scan(root,
+        [&](size_t worker, const string& filePath) {
+          try {
+            return emit(worker, FileStatusJSON(filePath, mipContext));
+          } catch (const std::exception& ex) {
+            return emit(worker, FileStatusErrorJSON(filePath, ex.what()));
+          }
+        },
+        [&](size_t worker, const string& path, const string& error) {
+          return emit(worker, FileStatusErrorJSON(path, error));
+        });
+    for (size_t worker = 0; worker < pending.size(); ++worker) {
+      if (!pending[worker].empty())
+        flush(worker);
+    }
+    if (outputFailed)
+      throw std::runtime_error(string("Failed to write scan results: ") + strerror(outputError));
+
+    std::ostringstream oss;
+    oss << "{\"status\": true"
+        << ", \"directories\": " << stats.directories
+        << ", \"files\": " << stats.files
+        << ", \"matched\": " << stats.matched
+        << ", \"errors\": " << stats.errors
+        << ", \"stopped\": " << (stats.stopped ? "true" : "false")
+        << ", \"path\": \"" << escapeJsonString(root) << "\"}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Like RunScanTree, but diffs the walk against the journal at journalPath and writes only what changed: a
+// status line with "change" set to "added" or "modified" and the file's "label_id" (empty unless it is
+// protected), and a {"change": "removed"} line for every journaled file under root that the walk did not
+// find. A file whose identity matches its journal entry is not probed. The journal is created on first use,
+// so the first scan reports every file as added.
+int RunScanTreeIncremental(
+    const string& root,
+    const string& filters,
+    int outputFd,
+    const string& journalPath,
+    const string& applicationId,
+    string& result) {
+  static const size_t kFlushBytes = 64 * 1024;
+  try {
+    if (outputFd < 0)
+      throw std::invalid_argument("Invalid output file descriptor");
+    auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+    sample::tenant::ScopedTenant tenantScope(applicationId);
+    sample::cost::ScopedKey costScope(sample::cost::OperationKey(applicationId, "scan"));
+    sample::cost::Add(sample::cost::Counter::Operations, 1);
+    TreeScanner scanner(TreeScanner::ParseFilters(filters));
+    InspectionJournal journal(journalPath);
+
+    vector<string> pending(scanner.GetWorkerCount() + 1);
+    std::mutex outputMutex;
+    bool outputFailed = false;
+    int outputError = 0;
+    auto flush = [&](size_t worker) {
+      std::lock_guard<std::mutex> lock(outputMutex);
+      if (!outputFailed && !WriteAllToFd(outputFd, pending[worker])) {
+        outputFailed = true;
+        outputError = errno;
+      }
+      pending[worker].clear();
+      return !outputFailed;
+    };
+    auto emit = [&](size_t worker, const string& line) {
+      pending[worker] += line;
+      pending[worker] += '\n';
+      return pending[worker].size() < kFlushBytes || flush(worker);
+    };
+
+    std::atomic<uint64_t> added(0), modified(0), unchanged(0);
+    const auto stats = scanner.Scan(root,
+        [&](size_t worker, const string& filePath) {
+          try {
+            InspectionJournal::Entry entry;
+            FileIdentity identity;
+            if (!GetFileIdentity(filePath, identity))
+              throw std::runtime_error("Failed to stat '" + filePath + "': " + strerror(errno));
+            const bool known = journal.Find(filePath, entry);
+            if (known && entry.identity == identity) {
+              journal.Keep(filePath);
+              ++unchanged;
+              return true;
+            }
+
+            entry.path = filePath;
+            entry.identity = identity;
+            entry.fingerprint = InspectionCache::GetFingerprint(filePath, identity.size);
+            entry.status = ProbeFileStatus(filePath, mipContext);
+            entry.labelId.clear();
+            if (entry.status.isProtected) {
+              // Labels of unprotected files live in their metadata, which is not read offline.
+              try {
+                entry.labelId = ReadLicenseInfo(filePath, mipContext).labelId;
+              } catch (const std::exception&) {
+              }
+            }
+            journal.Record(entry);
+            ++(known ? modified : added);
+            return emit(worker, FileStatusJSON(filePath, entry.status,
+                string(", \"change\": \"") + (known ? "modified" : "added") + "\""
+                + ", \"label_id\": \"" + escapeJsonString(entry.labelId) + "\""));
+          } catch (const std::exception& ex) {
+            return emit(worker, FileStatusErrorJSON(filePath, ex.what()));
+          }
+        },
+        [&](size_t worker, const string& path, const string& error) {
+          return emit(worker, FileStatusErrorJSON(path, error));
+        });
+
+    // A stopped walk has not seen every file, so nothing it missed can be called removed.
+    uint64_t removed = 0;
+    const size_t last = pending.size() - 1;
+    if (!stats.stopped && !outputFailed) {
+      journal.FinishScan(root, [&](const string& path) {
+        ++removed;
+        emit(last, "{\"change\": \"removed\", \"path\": \"" + escapeJsonString(path) + "\", \"status\": true}");
+      });
+    }
+    for (size_t worker = 0; worker < pending.size(); ++worker) {
+      if (!pending[worker].empty())
+        flush(worker);
+    }
+    if (outputFailed)
+      throw std::runtime_error(string("Failed to write scan results: ") + strerror(outputError));
+
+    std::ostringstream oss;
+    oss << "{\"status\": true"
+        << ", \"directories\": " << stats.directories
+        << ", \"files\": " << stats.files
+        << ", \"matched\": " << stats.matched
+        << ", \"errors\": " << stats.errors
+        << ", \"added\": " << added.load()
+        << ", \"modified\": " << modified.load()
+        << ", \"unchanged\": " << unchanged.load()
+        << ", \"removed\": " << removed
+        << ", \"stopped\": " << (stats.stopped ? "true" : "false")
+        << ", \"path\": \"" << escapeJsonString(root) << "\"}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunUnprotectFileBatch(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const string& applicationId,
+    string& result) {
+  shared_ptr<MipContext> mipContext;
+  shared_ptr<FileEngine> fileEngine;
+  const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+  try {
+    mipContext = ContextManager::Instance().GetMipContext(applicationId);
+    fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  PrefetchBatchLicenses(fileEngine, applicationId, filePaths, count, false /*onlyProtectedFormats*/);
+  BatchResults items(count);
+  auto finished = [&items](size_t i, string item) { items.Set(i, std::move(item)); };
+  if (UseBatchPipeline(count)) {
+    RunBatchPipeline(filePaths, count, [&](const string& filePath, const shared_ptr<mip::Stream>& stream) {
+      return GetProtectedFileHandler(fileEngine, mipContext, stream, filePath);
+    }, [](const shared_ptr<FileHandler>& fileHandler, string& result) {
+      if (!RemoveProtectionIfAny(fileHandler))
+        result = NotProtectedJSON();
+    }, [](const shared_ptr<FileHandler>& fileHandler) {
+      return CommitUnprotectedFile(fileHandler);
+    }, finished);
+  } else {
+    RunBatchOperation(filePaths, count, [&](size_t i, string& committedPath) {
+      string item;
+      if (UnprotectPfile(engineKey, protectionToken, filePaths[i], item, &committedPath))
+        return item;
+      return UnprotectFileJSON(fileEngine, mipContext, string(filePaths[i]), &committedPath);
+    }, finished);
+  }
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+int RunPrefetchLicenses(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const string& applicationId,
+    string& result) {
+  try {
+    const string username = "";
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+    auto summary = PrefetchUseLicenses(fileEngine, ContextManager::Instance().GetInspectionContext(applicationId), filePaths, count);
+    result = PrefetchJSON(count, summary);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Most per-file failures and license sample paths a batch plan lists; the counts cover every file.
+const size_t kMaxPlanFailures = 100;
+const size_t kMaxPlanLicenseSamples = 4096;
+
+// What planning found out about one file of a batch.
+struct PlanItem {
+  int64_t bytes = 0;
+  FileFormat format = FileFormat::Unknown;
+  bool isProtected = false;
+  bool isLabeled = false;
+  bool doubleKey = false;
+  string contentId;
+  string tenant;
+  string templateId;
+  string labelId;
+  string error;
+};
+
+// Files and bytes of one group of a plan, and the distinct licenses among its files.
+struct PlanGroup {
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  std::set<string> licenses;
+};
+
+void AppendPlanGroups(JsonWriter& json, const char* key, const char* name, const std::map<string, PlanGroup>& groups) {
+  json.Key(key).BeginArray();
+  for (const auto& group : groups) {
+    json.BeginObject()
+        .Key(name).String(group.first)
+        .Key("files").UInt(group.second.files)
+        .Key("bytes").UInt(group.second.bytes)
+        .Key("licenses").UInt(group.second.licenses.size())
+        .EndObject();
+  }
+  json.EndArray();
+}
+
+// Sizes a batch before it runs, with the probes that need no engine or token: the format from the first
+// bytes, the protection status and the publishing license read offline, for every file in parallel. The
+// plan counts files and bytes by format, tenant, template and label, and the distinct licenses, with those
+// the use license cache already holds. license_samples holds one path per distinct license, which
+// prefetchLicenses acquires before the batch opens the files.
+int RunPlanBatch(const char** filePaths, size_t count, const string& applicationId, string& result) {
+  shared_ptr<MipContext> mipContext;
+  try {
+    mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  vector<PlanItem> items(count);
+  auto readAhead = StartReadAhead(filePaths, BatchOrder(count));
+  ForEachParallel(count, [&](size_t i) {
+    auto& item = items[i];
+    const string filePath(filePaths[i]);
+    ScopedReadAheadInput input(filePaths[i], readAhead ? readAhead->Take(i) : nullptr);
+    try {
+      const auto sniffed = FormatSniffer::SniffFile(filePath);
+      item.format = sniffed.format;
+      item.bytes = std::max<int64_t>(sniffed.sizeBytes, 0);
+      const auto status = ProbeFileStatus(filePath, mipContext);
+      item.isProtected = status.isProtected;
+      item.isLabeled = status.isLabeled;
+      if (!status.isProtected)
+        return;
+      const auto info = ReadLicenseInfo(filePath, mipContext);
+      item.contentId = info.contentId;
+      item.templateId = info.templateId;
+      item.labelId = info.labelId;
+      item.doubleKey = info.doubleKey;
+      // The label's tenant, or the owner's domain for protection without a label.
+      const auto at = info.owner.rfind('@');
+      item.tenant = !info.tenantId.empty() ? info.tenantId : at == string::npos ? "" : info.owner.substr(at + 1);
+    }
+    catch (const std::exception& ex) {
+      item.error = ex.what();
+    }
+  });
+
+  uint64_t bytes = 0, protectedFiles = 0, protectedBytes = 0, labeled = 0, doubleKey = 0, failed = 0;
+  std::map<string, PlanGroup> formats, tenants, templates, labels;
+  std::map<string, size_t> representatives;
+  vector<string> failures;
+  for (size_t i = 0; i < count; ++i) {
+    const auto& item = items[i];
+    if (!item.error.empty()) {
+      if (failed++ < kMaxPlanFailures)
+        failures.push_back(FileStatusErrorJSON(string(filePaths[i]), item.error));
+      continue;
+    }
+    const uint64_t size = static_cast<uint64_t>(item.bytes);
+    bytes += size;
+    labeled += item.isLabeled;
+    auto& format = formats[FormatSniffer::Name(item.format)];
+    ++format.files;
+    format.bytes += size;
+    if (!item.isProtected)
+      continue;
+    ++protectedFiles;
+    protectedBytes += size;
+    doubleKey += item.doubleKey;
+    auto addTo = [&](PlanGroup& group) {
+      ++group.files;
+      group.bytes += size;
+      if (!item.contentId.empty())
+        group.licenses.insert(item.contentId);
+    };
+    addTo(tenants[item.tenant]);
+    addTo(templates[item.templateId]);
+    addTo(labels[item.labelId]);
+    if (!item.contentId.empty()) {
+      format.licenses.insert(item.contentId);
+      representatives.insert(std::make_pair(item.contentId, i));
+    }
+  }
+
+  // Licenses the engine prefetchLicenses uses already holds; without license caching every protected file
+  // acquires its own.
+  auto& contextManager = ContextManager::Instance();
+  const EngineCache::Key engineKey = { applicationId, "", "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+  const string engineId = EngineCache::MakeEngineId(engineKey);
+  uint64_t cached = 0;
+  for (const auto& representative : representatives)
+    cached += contextManager.GetUseLicenseCache().Find(engineId, representative.first) != nullptr;
+  const uint64_t licenseCalls = contextManager.GetStorageOptions().canCacheLicenses
+      ? representatives.size() - cached : protectedFiles;
+
+  JsonWriter json(512 + representatives.size() * 64 + failures.size() * 128);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("files").UInt(count)
+      .Key("bytes").UInt(bytes)
+      .Key("protected").UInt(protectedFiles)
+      .Key("protected_bytes").UInt(protectedBytes)
+      .Key("labeled").UInt(labeled)
+      .Key("double_key").UInt(doubleKey)
+      .Key("failed").UInt(failed)
+      .Key("licenses").UInt(representatives.size())
+      .Key("licenses_cached").UInt(cached)
+      .Key("expected_license_calls").UInt(licenseCalls);
+  AppendPlanGroups(json, "formats", "format", formats);
+  AppendPlanGroups(json, "tenants", "tenant", tenants);
+  AppendPlanGroups(json, "templates", "template_id", templates);
+  AppendPlanGroups(json, "labels", "label_id", labels);
+  json.Key("license_samples").BeginArray();
+  size_t samples = 0;
+  for (const auto& representative : representatives) {
+    if (samples++ == kMaxPlanLicenseSamples)
+      break;
+    json.String(filePaths[representative.second]);
+  }
+  json.EndArray()
+      .Key("failures").Raw(BatchJSON(failures))
+      .EndObject();
+  result = json.Take();
+  return EXIT_SUCCESS;
+}
+
+int RunInspectMsg(
+    const string& protectionToken,
+    const string& filePath,
+    size_t maxDepth,
+    const string& applicationId,
+    string& result) {
+  try {
+    if (!IsMsgFile(filePath))
+      throw std::invalid_argument("Only .msg and .rpmsg files can be inspected");
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, true /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+
+    std::ostringstream oss;
+    oss << "{\"status\": true, \"path\": \"" << escapeJsonString(filePath) << "\""
+        << ", \"message\": " << MsgNodeJSON(fileEngine, GetLargeInputStream(filePath), filePath, 0, std::min(maxDepth, kMaxNestedProtectedMsgs)) << "}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// The publisher owns the protection, so the protection engine and the file engine both run as username.
+int RunProtectFileOffline(
+    const string& protectionToken,
+    const string& filePath,
+    const string& templateId,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  try {
+    if (templateId.empty())
+      throw std::invalid_argument("A template id is required");
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    auto fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+    auto publisher = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).publisher;
+    result = ProtectOfflineJSON(fileEngine, publisher, templateId, filePath);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunGetTenantInformation(const string& protectionToken, const string& username, const string& applicationId, string& result) {
+  try {
+    auto& tenantEndpoints = ContextManager::Instance().GetTenantEndpoints();
+    TenantEndpointCache::TenantInfo info;
+    const bool cached = tenantEndpoints.FindTenantInfo(username, info);
+    if (!cached) {
+      const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+      auto protectionEngine = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).engine;
+      auto tenant = protectionEngine->GetTenantInformation(mip::ProtectionCommonSettings(), nullptr);
+      if (!tenant)
+        throw std::runtime_error("The service returned no tenant information");
+      info.tenantId = tenant->GetTenantId();
+      info.issuerName = tenant->GetIssuerName();
+      info.extranetUrl = tenant->GetExtranetUrl();
+      info.intranetUrl = tenant->GetIntranetUrl();
+      tenantEndpoints.PutTenantInfo(username, info);
+    }
+    result = TenantInfoJSON(info, cached);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunPrepareOfflinePublishing(const string& protectionToken, const string& username, const string& applicationId, string& result) {
+  try {
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    auto publisher = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).publisher;
+    publisher->Prepare();
+    result = OfflinePublisherJSON(publisher->GetStats());
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Parts of msipWarmup beyond the profile and protection-only file engine every target gets.
+static const int kWarmupPolicy = 1;
+static const int kWarmupTemplates = 2;
+
+struct WarmupStep {
+  string applicationId;
+  string username;
+  const char* name;
+  std::function<string()> run;
+};
+
+// Loads what the first request for each target would otherwise wait for. Steps of every target run in
+// parallel; each reports its own outcome and time, and the call only succeeds when all of them did.
+int RunWarmup(
+    const string& protectionToken,
+    const char** applicationIds,
+    const char** usernames,
+    const int* parts,
+    size_t count,
+    string& result) {
+  const auto workingDirectory = GetWorkingDirectory();
+  vector<WarmupStep> steps;
+  for (size_t i = 0; i < count; ++i) {
+    const string applicationId(applicationIds[i]);
+    const string username(usernames ? usernames[i] : "");
+    const int targetParts = parts ? parts[i] : 0;
+
+    // getFileStatus uses the offline inspection context, which is loaded alongside the engine.
+    steps.push_back({ applicationId, username, "file_engine", [=]() {
+      ContextManager::Instance().GetInspectionContext(applicationId);
+      const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+      GetCachedFileEngine(engineKey, protectionToken, workingDirectory);
+      return string();
+    } });
+    if (targetParts & kWarmupPolicy) {
+      steps.push_back({ applicationId, username, "labels", [=]() {
+        const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+        auto labels = GetCachedFileEngineEntry(engineKey, protectionToken, workingDirectory).labels;
+        return ", \"labels\": " + std::to_string(labels->GetRecords().size());
+      } });
+    }
+    if (targetParts & kWarmupTemplates) {
+      steps.push_back({ applicationId, username, "templates", [=]() {
+        const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+        auto publisher = GetCachedProtectionEngine(engineKey, protectionToken, workingDirectory).publisher;
+        publisher->Prepare();
+        return ", \"templates\": " + std::to_string(publisher->GetStats().templates);
+      } });
+    }
+  }
+
+  // Every target's profile loads before its engines, since an engine load would block on it anyway.
+  std::set<string> applications;
+  for (size_t i = 0; i < count; ++i)
+    applications.insert(applicationIds[i]);
+  const vector<string> applicationList(applications.begin(), applications.end());
+  ForEachParallel(applicationList.size(), [&](size_t i) {
+    try {
+      ContextManager::Instance().GetProfile(applicationList[i]);
+    } catch (const std::exception&) {
+      // Reported by the steps of that application, which fail on the same call.
+    }
+  });
+
+  vector<string> items(steps.size());
+  std::atomic<bool> failed(false);
+  ForEachParallel(steps.size(), [&](size_t i) {
+    const auto& step = steps[i];
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    string details;
+    try {
+      details = step.run();
+    } catch (const std::exception& ex) {
+      ok = false;
+      failed = true;
+      details = ", \"error\": \"" + escapeJsonString(ex.what()) + "\"";
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::ostringstream oss;
+    oss << "{\"application_id\": \"" << escapeJsonString(step.applicationId) << "\""
+        << ", \"user\": \"" << escapeJsonString(step.username) << "\""
+        << ", \"step\": \"" << step.name << "\""
+        << ", \"status\": " << (ok ? "true" : "false")
+        << ", \"elapsed_ms\": " << elapsed.count() << details << "}";
+    items[i] = oss.str();
+  });
+  result = "{\"status\": " + string(failed ? "false" : "true") + ", \"steps\": " + BatchJSON(items) + "}";
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Engine ids the profile holds in its storage, from the engines it loaded in earlier runs.
+vector<string> ListProfileEngines(const shared_ptr<FileProfile>& profile) {
+  auto listCompletion = AsyncCompletion<vector<string>>::Create();
+  auto listFuture = listCompletion->GetFuture();
+  auto listControl = profile->ListEnginesAsync(listCompletion);
+  return WaitForOperation(listFuture, listControl);
+}
+
+// Reloads the file engines an earlier run stored on disk for applicationIds (every application in the
+// manifest when count is 0), so the first requests after a restart find them cached. The profile lists the
+// engine ids it holds and the manifest maps them back to their keys; each engine then loads from the user
+// certificate, policy and templates the SDK cached for it, and only calls the service for what expired.
+// Engines the profile no longer holds are dropped from the manifest and reported as "missing". At most the
+// engine cache's capacity is restored, most recently recorded first.
+int RunRestoreEngines(const string& protectionToken, const char** applicationIds, size_t count, string& result) {
+  static auto& restoredEngines = MetricsRegistry::Shared().GetCounter(
+      "msip_native_engines_restored_total", "File engines reloaded from on-disk storage by msipRestoreEngines");
+  auto& contextManager = ContextManager::Instance();
+  auto manifest = contextManager.GetEngineManifest();
+  if (!manifest) {
+    result = getUnprotectStatusJSON(false, "Restoring engines needs OnDisk or OnDiskEncrypted cache storage", "");
+    return EXIT_FAILURE;
+  }
+
+  std::set<string> applications;
+  for (size_t i = 0; i < count; ++i)
+    applications.insert(applicationIds[i]);
+  auto recorded = manifest->Load();
+  if (count == 0) {
+    for (const auto& entry : recorded)
+      applications.insert(entry.second.applicationId);
+  }
+
+  // Listed per application first, since an engine load would block on its profile anyway.
+  const vector<string> applicationList(applications.begin(), applications.end());
+  vector<vector<string>> stored(applicationList.size());
+  vector<string> listErrors(applicationList.size());
+  ForEachParallel(applicationList.size(), [&](size_t i) {
+    try {
+      stored[i] = ListProfileEngines(contextManager.GetProfile(applicationList[i]));
+    } catch (const std::exception& ex) {
+      listErrors[i] = ex.what();
+    }
+  });
+
+  vector<string> items;
+  vector<string> missing;
+  vector<EngineCache::Key> restore;
+  vector<string> restoreIds;
+  bool failed = false;
+  for (size_t i = 0; i < applicationList.size(); ++i) {
+    if (!listErrors[i].empty()) {
+      failed = true;
+      items.push_back("{\"application_id\": \"" + escapeJsonString(applicationList[i]) + "\", \"status\": false, \"error\": \"" +
+          escapeJsonString(listErrors[i]) + "\"}");
+    }
+  }
+  for (auto it = recorded.rbegin(); it != recorded.rend(); ++it) {
+    const auto application = std::find(applicationList.begin(), applicationList.end(), it->second.applicationId);
+    if (application == applicationList.end())
+      continue;
+    const size_t index = application - applicationList.begin();
+    if (!listErrors[index].empty())
+      continue;
+    if (std::find(stored[index].begin(), stored[index].end(), it->first) == stored[index].end()) {
+      missing.push_back(it->first);
+    } else {
+      restore.push_back(it->second);
+      restoreIds.push_back(it->first);
+    }
+  }
+  manifest->Remove(missing);
+  const size_t capacity = contextManager.GetEngineCache().GetStats().capacity;
+  const size_t skipped = restore.size() > capacity ? restore.size() - capacity : 0;
+  restore.resize(restore.size() - skipped);
+  restoreIds.resize(restore.size());
+
+  const auto workingDirectory = GetWorkingDirectory();
+  vector<string> restoreItems(restore.size());
+  std::atomic<size_t> restoreFailures(0);
+  ForEachParallel(restore.size(), [&](size_t i) {
+    const auto& key = restore[i];
+    const auto start = std::chrono::steady_clock::now();
+    string error;
+    try {
+      GetCachedFileEngineEntry(key, protectionToken, workingDirectory);
+      restoredEngines.Add(1);
+    } catch (const std::exception& ex) {
+      error = ex.what();
+      ++restoreFailures;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::ostringstream oss;
+    oss << "{\"application_id\": \"" << escapeJsonString(key.applicationId) << "\""
+        << ", \"user\": \"" << escapeJsonString(key.username) << "\""
+        << ", \"engine_id\": \"" << restoreIds[i] << "\""
+        << ", \"protection_only\": " << (key.protectionOnly ? "true" : "false")
+        << ", \"status\": " << (error.empty() ? "true" : "false")
+        << ", \"elapsed_ms\": " << elapsed.count();
+    if (!error.empty())
+      oss << ", \"error\": \"" << escapeJsonString(error) << "\"";
+    oss << "}";
+    restoreItems[i] = oss.str();
+  });
+  items.insert(items.end(), restoreItems.begin(), restoreItems.end());
+  failed = failed || restoreFailures > 0;
+
+  std::ostringstream oss;
+  oss << "{\"status\": " << (failed ? "false" : "true")
+      << ", \"restored\": " << restore.size() - restoreFailures
+      << ", \"failed\": " << restoreFailures
+      << ", \"missing\": " << missing.size()
+      << ", \"skipped\": " << skipped
+      << ", \"engines\": " << BatchJSON(items) << "}";
+  result = oss.str();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Seconds a reload waits for callers still holding a replaced engine before unloading it anyway.
+static const int64_t kDefaultReloadDrainSeconds = 60;
+
+// Replaces the custom setting called name, or adds it; an empty value removes it.
+void SetCustomSetting(vector<pair<string, string>>& settings, const string& name, const string& value) {
+  settings.erase(std::remove_if(settings.begin(), settings.end(), [&name](const pair<string, string>& setting) {
+    return setting.first == name;
+  }), settings.end());
+  if (!value.empty())
+    settings.emplace_back(name, value);
+}
+
+// Applies the settings present in config, a JSON object, while requests keep running. Every member is
+// checked before any is applied, so a bad document changes nothing. Cache sizes apply at once. Engine
+// settings apply to engines loaded afterwards, and every cached engine is replaced by one loaded with them
+// in the background, one at a time, while callers keep using the engine they have.
+int RunReloadConfig(const string& config, string& json) {
+  auto& contextManager = ContextManager::Instance();
+  vector<pair<string, std::function<void()>>> changes;
+  ContextManager::EngineOptions engineOptions = *contextManager.GetEngineOptions();
+  bool reloadEngines = false;
+  int64_t drainSeconds = kDefaultReloadDrainSeconds;
+  string error;
+  try {
+    const JsonValue document = JsonValue::Parse(config);
+    for (const auto& member : document.AsObject()) {
+      const string& name = member.first;
+      const JsonValue& value = member.second;
+      try {
+        if (name == "engine_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetEngineCache().SetCapacity(size); });
+        } else if (name == "policy_engine_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetEngineCache().SetPolicyCapacity(size); });
+        } else if (name == "tenant_engine_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetEngineCache().SetTenantCapacity(size); });
+        } else if (name == "protection_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetProtectionCache().SetCapacity(size); });
+        } else if (name == "license_info_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetLicenseInfoCache().SetCapacity(size); });
+        } else if (name == "use_license_cache_size") {
+          const size_t size = value.AsUInt();
+          changes.emplace_back(name, [&contextManager, size]() { contextManager.GetUseLicenseCache().SetCapacity(size); });
+        } else if (name == "policy_refresh_seconds") {
+          const std::chrono::seconds ttl(value.AsUInt());
+          changes.emplace_back(name, [&contextManager, ttl]() { contextManager.GetEngineCache().SetPolicyRefresh(ttl); });
+        } else if (name == "engine_idle_seconds") {
+          const std::chrono::seconds idle(value.AsUInt());
+          changes.emplace_back(name, [&contextManager, idle]() { contextManager.GetEngineCache().SetIdleTimeout(idle); });
+        } else if (name == "template_refresh_seconds") {
+          const std::chrono::seconds interval(value.AsUInt());
+          changes.emplace_back(name, [interval]() { TemplateCatalog::SetRefreshInterval(interval); });
+        } else if (name == "drain_timeout_seconds") {
+          drainSeconds = static_cast<int64_t>(value.AsUInt());
+        } else if (name == "locale") {
+          engineOptions.locale = value.AsString();
+          reloadEngines = true;
+        } else if (name == "flighting_features") {
+          engineOptions.featureSettings = SplitFeatures(value.AsString());
+          reloadEngines = true;
+        } else if (name == "enable_functionality") {
+          engineOptions.enabledFunctionality = CreateLabelFiltersFromString(value.AsString());
+          reloadEngines = true;
+        } else if (name == "disable_functionality") {
+          engineOptions.disabledFunctionality = CreateLabelFiltersFromString(value.AsString());
+          reloadEngines = true;
+        } else if (name == "task_timeout_ms") {
+          const uint64_t timeoutMs = value.AsUInt();
+          SetCustomSetting(engineOptions.customSettings, mip::GetCustomSettingTaskTimeoutMs(), timeoutMs > 0 ? std::to_string(timeoutMs) : "");
+          reloadEngines = true;
+        } else if (name == "max_file_size_for_protection") {
+          engineOptions.maxFileSizeForProtection = static_cast<int64_t>(value.AsUInt());
+          SetCustomSetting(engineOptions.customSettings, mip::GetCustomSettingMaxFileSizeForProtection(),
+              engineOptions.maxFileSizeForProtection > 0 ? std::to_string(engineOptions.maxFileSizeForProtection) : "");
+          reloadEngines = true;
+        } else if (name == "custom_settings") {
+          for (const auto& setting : value.AsObject()) {
+            if (setting.first.empty())
+              throw std::invalid_argument("Custom setting names cannot be empty");
+            SetCustomSetting(engineOptions.customSettings, setting.first, setting.second.AsString());
+          }
+          reloadEngines = true;
+        } else {
+          throw std::invalid_argument("Unknown setting");
+        }
+      } catch (const std::exception& e) {
+        throw std::invalid_argument(name + ": " + e.what());
+      }
+    }
+  } catch (const std::exception& e) {
+    error = e.what();
+  }
+
+  JsonWriter writer(128);
+  writer.BeginObject().Key("status").Bool(error.empty());
+  if (!error.empty()) {
+    writer.Key("error").String(error).EndObject();
+    json = writer.Take();
+    return EXIT_FAILURE;
+  }
+  writer.Key("applied").BeginArray();
+  for (const auto& change : changes) {
+    change.second();
+    writer.String(change.first);
+  }
+  writer.EndArray();
+  size_t reloading = 0;
+  if (reloadEngines) {
+    contextManager.SetEngineOptions(engineOptions);
+    reloading = contextManager.GetEngineCache().Reload(std::chrono::seconds(drainSeconds));
+  }
+  writer.Key("engine_options").Bool(reloadEngines)
+      .Key("engines_reloading").UInt(reloading)
+      .EndObject();
+  json = writer.Take();
+  return EXIT_SUCCESS;
+}
+
+// Delegation licenses are issued to the application's own identity on behalf of the users.
+int RunDelegatedCall(
+    const string& protectionToken,
+    const string& filePath,
+    const char** users,
+    size_t userCount,
+    const string& applicationId,
+    const std::function<string(const string& contentId, const vector<DelegatedUser>&)>& toJSON,
+    string& result) {
+  try {
+    const string username = "";
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    auto& contextManager = ContextManager::Instance();
+    auto mipContext = contextManager.GetMipContext(applicationId);
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    auto protectionEngine = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).engine;
+    string contentId;
+    auto delegatedUsers = GetDelegationLicenses(
+        protectionEngine, mipContext, contextManager.GetInspectionContext(applicationId), filePath, users, userCount, contentId);
+    result = toJSON(contentId, delegatedUsers);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Rights of user on the content of filePath. Only the publishing license's content id is read from the
+// file; the rights come from the rights cache once any license for the (content, user) pair was
+// consumed, and from a delegation license issued to the application for the user otherwise.
+int RunCheckRights(
+    const string& protectionToken,
+    const string& filePath,
+    const string& user,
+    const vector<string>& rights,
+    const string& applicationId,
+    string& result) {
+  try {
+    auto& contextManager = ContextManager::Instance();
+    auto inspectionContext = contextManager.GetInspectionContext(applicationId);
+    string contentId = ReadLicenseInfo(filePath, inspectionContext).contentId;
+    RightsCache::Entry entry;
+    if (contextManager.GetRightsCache().Find(contentId, user, entry)) {
+      result = RightsCheckJSON(filePath, contentId, user, rights, entry, true /*cached*/, "");
+      return EXIT_SUCCESS;
+    }
+
+    auto mipContext = contextManager.GetMipContext(applicationId);
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto protectionEngine = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).engine;
+    const char* users[] = { user.c_str() };
+    auto delegated = GetDelegationLicenses(protectionEngine, mipContext, inspectionContext, filePath, users, 1, contentId).front();
+    if (delegated.error.empty() && delegated.entry.protection)
+      entry = RightsCache::FromProtection(*delegated.entry.protection);
+    result = RightsCheckJSON(filePath, contentId, user, rights, entry, delegated.cached, delegated.error);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Registers filePaths for document tracking, or revokes them, with a protection engine of the application's
+// identity. Publishing licenses are read from the file headers in parallel without opening handlers,
+// then sent through ContentTracker, which keeps many requests in flight at once.
+int RunContentTracking(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    ContentTracker::Action action,
+    bool notifyOwner,
+    const string& applicationId,
+    string& result) {
+  try {
+    auto& contextManager = ContextManager::Instance();
+    auto inspectionContext = contextManager.GetInspectionContext(applicationId);
+    vector<ContentTracker::Item> items(count);
+    vector<string> contentIds(count);
+    ForEachParallel(count, [&](size_t i) {
+      const string filePath(filePaths[i]);
+      try {
+        items[i].publishingLicense = ReadPublishingLicense(filePath, inspectionContext);
+        contentIds[i] = ParseLicenseInfo(items[i].publishingLicense, inspectionContext).contentId;
+        items[i].contentName = filePath.substr(filePath.find_last_of('/') + 1);
+      }
+      catch (const std::exception& ex) {
+        items[i].error = ex.what();
+      }
+    });
+
+    const EngineCache::Key engineKey = { applicationId, "" /*username*/, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto protectionEngine = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).engine;
+    ContentTracker::Run(protectionEngine, action, notifyOwner, items);
+
+    size_t succeeded = 0;
+    vector<string> results(count);
+    for (size_t i = 0; i < count; ++i) {
+      succeeded += items[i].succeeded ? 1 : 0;
+      if (items[i].succeeded && action == ContentTracker::Action::Revoke)
+        contextManager.GetDecryptedContentCache().InvalidateContent(contentIds[i]);
+      results[i] = "{\"path\": \"" + escapeJsonString(filePaths[i]) + "\""
+          + ", \"content_id\": \"" + escapeJsonString(contentIds[i]) + "\""
+          + ", \"status\": " + (items[i].succeeded ? "true" : "false")
+          + ", \"error\": \"" + escapeJsonString(items[i].error) + "\"}";
+    }
+    result = "{\"status\": true, \"succeeded\": " + std::to_string(succeeded) + ", \"failed\": " + std::to_string(count - succeeded) +
+        ", \"results\": " + BatchJSON(results) + "}";
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Applies the protection of encryptedFilePath to every file in filePaths. The reference file is read at most once.
+int RunProtectFileBatch(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const string& encryptedFilePath,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  shared_ptr<FileEngine> fileEngine;
+  shared_ptr<ProtectionHandler> protection;
+  try {
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    fileEngine = GetCachedFileEngine(engineKey, protectionToken, GetWorkingDirectory());
+    protection = GetReferenceProtection(fileEngine, encryptedFilePath);
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  // Inputs that are already protected need their own use license before they are re-protected.
+  PrefetchBatchLicenses(fileEngine, applicationId, filePaths, count, true /*onlyProtectedFormats*/);
+  BatchResults items(count);
+  auto finished = [&items](size_t i, string item) { items.Set(i, std::move(item)); };
+  if (UseBatchPipeline(count)) {
+    RunBatchPipeline(filePaths, count, [&](const string& filePath, const shared_ptr<mip::Stream>& stream) {
+      return GetFileHandler(fileEngine, stream, filePath, DataState::REST, false, "" /*applicationScenarioId*/);
+    }, [&](const shared_ptr<FileHandler>& fileHandler, string&) {
+      fileHandler->SetProtection(protection);
+    }, [](const shared_ptr<FileHandler>& fileHandler) {
+      return CommitProtectedFile(fileHandler);
+    }, finished);
+  } else {
+    RunBatchOperation(filePaths, count, [&](size_t i, string& committedPath) {
+      return ProtectFileJSON(fileEngine, protection, string(filePaths[i]), nullptr /*outputStream*/, &committedPath);
+    }, finished);
+  }
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+// Runs a claimed shard as the batch export of its job's operation would, at bulk priority. A shard
+// admission refuses, e.g. while draining, is released for another replica; a batch that fails as a whole
+// counts each of its files as failed.
+ShardWorker::Outcome RunShard(const ShardCoordinator::Shard& shard) {
+  sample::priority::ScopedPriority priorityScope(sample::priority::Priority::Bulk);
+  const auto& job = shard.job;
+  sample::token::ScopedToken tokenScope(job.token);
+  vector<const char*> paths;
+  paths.reserve(shard.paths.size());
+  for (const auto& path : shard.paths)
+    paths.push_back(path.c_str());
+  const size_t count = paths.size();
+  string json;
+  int status = EXIT_FAILURE;
+  if (job.operation == "status") {
+    status = RunAdmitted("status", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunGetFileStatusBatch(paths.data(), count, job.applicationId, json);
+    });
+  } else if (job.operation == "unprotect") {
+    status = RunAdmitted("unprotect", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunUnprotectFileBatch(job.token, paths.data(), count, job.applicationId, json);
+    });
+  } else if (job.operation == "protect") {
+    status = RunAdmitted("protect", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunProtectFileBatch(job.token, paths.data(), count, job.encryptedFile, job.user, job.applicationId, json);
+    });
+  } else {
+    json = getUnprotectStatusJSON(false, "Unknown operation " + job.operation, "");
+  }
+
+  ShardWorker::Outcome outcome = ShardWorker::Outcome();
+  if (status == kOverloaded) {
+    outcome.retry = true;
+    return outcome;
+  }
+  outcome.failed = static_cast<int64_t>(count);
+  if (status == EXIT_SUCCESS) {
+    try {
+      outcome.failed = 0;
+      for (const auto& item : JsonValue::Parse(json).AsArray()) {
+        bool succeeded = false;
+        for (const auto& member : item.AsObject()) {
+          if (member.first == "status")
+            succeeded = member.second.AsBool();
+        }
+        ++(succeeded ? outcome.succeeded : outcome.failed);
+      }
+    }
+    catch (const std::invalid_argument&) {
+      outcome.succeeded = 0;
+      outcome.failed = static_cast<int64_t>(count);
+    }
+  }
+  JsonWriter results(64 + json.size());
+  results.BeginObject()
+      .Key("shard").Int(shard.index)
+      .Key("status").Bool(status == EXIT_SUCCESS)
+      .Key("results").Raw(json)
+      .EndObject();
+  outcome.results = results.Take();
+  return outcome;
+}
+
+// What msipConfigureWatch runs on the files its watcher reports.
+struct WatchJob {
+  string operation;
+  string token;
+  string encryptedFile;
+  string user;
+  string applicationId;
+  int outputFd;
+};
+
+// The _modified outputs protect and unprotect write next to their input, which must not be run again.
+bool IsModifiedOutput(const string& path) {
+  return path.find("_modified", path.find_last_of('/') + 1) != string::npos;
+}
+
+// Runs a batch of files the watcher reports as the batch export of the job's operation would, at bulk
+// priority, after dropping what the inspection cache holds for every path. Writes one JSON line per batch
+// to the job's output, when it has one: {"status": ..., "results": [...], "removed": [paths]}.
+void RunWatchBatch(const WatchJob& job, const vector<DirectoryWatcher::Event>& events) {
+  sample::priority::ScopedPriority priorityScope(sample::priority::Priority::Bulk);
+  sample::token::ScopedToken tokenScope(job.token);
+  auto& inspectionCache = ContextManager::Instance().GetInspectionCache();
+  vector<const char*> paths;
+  vector<const string*> removed;
+  for (const auto& event : events) {
+    inspectionCache.Invalidate(event.path);
+    if (event.change == DirectoryWatcher::Change::Removed)
+      removed.push_back(&event.path);
+    else if (job.operation == "status" || !IsModifiedOutput(event.path))
+      paths.push_back(event.path.c_str());
+  }
+  const size_t count = paths.size();
+  string json = "[]";
+  int status = EXIT_SUCCESS;
+  if (count > 0 && job.operation == "status") {
+    status = RunAdmitted("status", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunGetFileStatusBatch(paths.data(), count, job.applicationId, json);
+    });
+  } else if (count > 0 && job.operation == "unprotect") {
+    status = RunAdmitted("unprotect", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunUnprotectFileBatch(job.token, paths.data(), count, job.applicationId, json);
+    });
+  } else if (count > 0 && job.operation == "protect") {
+    status = RunAdmitted("protect", paths.data(), count, job.applicationId.c_str(), json, [&]() {
+      return RunProtectFileBatch(job.token, paths.data(), count, job.encryptedFile, job.user, job.applicationId, json);
+    });
+  }
+  if (job.outputFd < 0 || (count == 0 && removed.empty()))
+    return;
+
+  JsonWriter line(json.size() + 64 * (removed.size() + 1));
+  line.BeginObject()
+      .Key("status").Bool(status == EXIT_SUCCESS)
+      .Key("results").Raw(json)
+      .Key("removed").BeginArray();
+  for (const auto* path : removed)
+    line.String(*path);
+  line.EndArray().EndObject();
+  if (!WriteAllToFd(job.outputFd, line.Take() + "\n"))
+    MSIP_EVENT(mip::LogLevel::Warning, "watch_output_failed", {"error", strerror(errno)});
+}
+
+// Labels need the policy engine; templates only need protection.
+EngineCache::Key TemplateEngineKey(const string& applicationId, const string& username, const string& labelId) {
+  const string protectionBaseUrl = "";
+  const string policyBaseUrl = "";
+  return { applicationId, username, protectionBaseUrl, policyBaseUrl, labelId.empty() /*protectionOnly*/, false /*msgContainers*/ };
+}
+
+void ValidateTemplateOrLabel(const string& templateId, const string& labelId) {
+  if (templateId.empty() == labelId.empty())
+    throw std::invalid_argument("Exactly one of templateId and labelId must be set");
+}
+
+void AppendLabelRecordJSON(JsonWriter& json, const LabelIndex& labels, const LabelIndex::Record& record) {
+  json.BeginObject()
+      .Key("id").String(record.id)
+      .Key("name").String(record.name)
+      .Key("path").String(record.path)
+      .Key("parent_id");
+  if (record.parent == LabelIndex::kNoParent)
+    json.Null();
+  else
+    json.String(labels.GetRecords()[record.parent].id);
+  json.Key("parent").Int(record.parent)
+      .Key("depth").Int(record.depth)
+      .Key("children").Int(record.childCount)
+      .Key("sensitivity").Int(record.sensitivity)
+      .Key("active").Bool(record.active)
+      .Key("double_key").Bool(record.doubleKey)
+      .Key("color").String(record.color)
+      .Key("description").String(record.description)
+      .Key("tooltip").String(record.tooltip)
+      .EndObject();
+}
+
+// Calls read with the label index of the user's policy engine, built when the engine was loaded. A loaded
+// engine's index is read in place under a guard; when the engine has to be loaded, it is loaded with no
+// guard held and read holds a reference to its index instead.
+void ReadLabelIndex(const string& protectionToken, const string& username, const string& applicationId,
+    const std::function<void(const LabelIndex&)>& read) {
+  const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+  {
+    EpochReclaimer::ReadGuard guard;
+    if (const auto* entry = ContextManager::Instance().GetEngineCache().Find(ServiceEngineKey(engineKey))) {
+      read(*entry->labels);
+      return;
+    }
+  }
+  const auto labels = GetCachedFileEngineEntry(engineKey, protectionToken, GetWorkingDirectory()).labels;
+  read(*labels);
+}
+
+// Labels another process of the node published for the user's policy engine, read in place, while this
+// process has not loaded that engine. nullptr when shared labels are off or none were published.
+shared_ptr<const SharedLabelSnapshot> FindSharedLabels(const string& username, const string& applicationId) {
+  static auto& sharedReads = MetricsRegistry::Shared().GetCounter(
+      "msip_native_shared_label_reads_total", "Label lookups served from a label snapshot another process published");
+  auto& contextManager = ContextManager::Instance();
+  auto& snapshots = contextManager.GetSharedLabelSnapshots();
+  const auto engineKey = ServiceEngineKey({ applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ });
+  if (!snapshots.IsEnabled() || contextManager.GetEngineCache().Contains(engineKey))
+    return nullptr;
+  auto snapshot = snapshots.Find(EngineCache::MakeEngineId(engineKey));
+  if (snapshot)
+    sharedReads.Add(1);
+  return snapshot;
+}
+
+// AppendLabelRecordJSON for a label of a shared snapshot.
+void AppendSharedLabelJSON(JsonWriter& json, const SharedLabelSnapshot& labels, size_t index) {
+  const auto label = labels.Get(index);
+  json.BeginObject()
+      .Key("id").String(label.id.data, label.id.size)
+      .Key("name").String(label.name.data, label.name.size)
+      .Key("path").String(label.path.data, label.path.size)
+      .Key("parent_id");
+  if (label.parent == LabelIndex::kNoParent) {
+    json.Null();
+  } else {
+    const auto parent = labels.Get(static_cast<size_t>(label.parent));
+    json.String(parent.id.data, parent.id.size);
+  }
+  json.Key("parent").Int(label.parent)
+      .Key("depth").Int(label.depth)
+      .Key("children").Int(label.childCount)
+      .Key("sensitivity").Int(label.sensitivity)
+      .Key("active").Bool(label.active)
+      .Key("double_key").Bool(label.doubleKey)
+      .Key("color").String(label.color.data, label.color.size)
+      .Key("description").String(label.description.data, label.description.size)
+      .Key("tooltip").String(label.tooltip.data, label.tooltip.size)
+      .EndObject();
+}
+
+int RunListLabels(const string& protectionToken, const string& username, const string& applicationId, string& result) {
+  try {
+    if (auto shared = FindSharedLabels(username, applicationId)) {
+      JsonWriter json(64 + shared->GetCount() * 256);
+      json.BeginObject().Key("status").Bool(true).Key("labels").BeginArray();
+      for (size_t i = 0; i < shared->GetCount(); ++i)
+        AppendSharedLabelJSON(json, *shared, i);
+      json.EndArray().EndObject();
+      result = json.Take();
+      return EXIT_SUCCESS;
+    }
+    ReadLabelIndex(protectionToken, username, applicationId, [&result](const LabelIndex& labels) {
+      const auto& records = labels.GetRecords();
+      JsonWriter json(64 + records.size() * 256);
+      json.BeginObject().Key("status").Bool(true).Key("labels").BeginArray();
+      for (const auto& record : records)
+        AppendLabelRecordJSON(json, labels, record);
+      json.EndArray().EndObject();
+      result = json.Take();
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Label of filePath from the metadata it carries in the clear or, for a protected file whose metadata is
+// encrypted with its content, from its publishing license. Neither creates a handler nor acquires a
+// license. With a protection token, the name comes from the label index of username's policy engine;
+// otherwise it is the name the file recorded, if any.
+int RunReadLabel(const string& protectionToken, const string& filePath, const string& username, const string& applicationId, string& result) {
+  try {
+    auto stream = GetLargeInputStream(filePath);
+    if (!stream)
+      stream = GetInputStreamFromFilePath(filePath);
+    auto metadata = ReadLabelMetadata(*stream);
+    const char* source = "metadata";
+    if (metadata.labelId.empty()) {
+      auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+      if (ProbeFileStatus(filePath, mipContext).isProtected) {
+        const auto info = ReadLicenseInfo(filePath, mipContext);
+        metadata.labelId = info.labelId;
+        metadata.siteId = info.tenantId;
+        source = "publishing_license";
+      }
+    }
+    bool inPolicy = false;
+    string name = metadata.name;
+    string labelPath = metadata.name;
+    if (!metadata.labelId.empty() && !protectionToken.empty()) {
+      ReadLabelIndex(protectionToken, username, applicationId, [&](const LabelIndex& labels) {
+        if (const auto* record = labels.FindById(metadata.labelId)) {
+          inPolicy = true;
+          name = record->name;
+          labelPath = record->path;
+        }
+      });
+    }
+
+    string method = metadata.method;
+    std::transform(method.begin(), method.end(), method.begin(), ::tolower);
+    JsonWriter json(256 + filePath.size());
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("path").String(filePath)
+        .Key("labeled").Bool(!metadata.labelId.empty())
+        .Key("label_id").String(metadata.labelId)
+        .Key("name").String(name)
+        .Key("label_path").String(labelPath)
+        .Key("in_policy").Bool(inPolicy)
+        .Key("assignment_method").String(method)
+        .Key("site_id").String(metadata.siteId)
+        .Key("set_date").String(metadata.setDate)
+        .Key("source").String(metadata.labelId.empty() ? "" : source)
+        .EndObject();
+    result = json.Take();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Label and protection of filePath in one result, read with username's cached policy engine and named from
+// its label index. With the pfile fast path on, a .pfile is read from its header through the protection
+// engine and the use license cache, as unprotect reads it; any other file is opened once, reusing a use
+// license the engine already holds for its content.
+int RunDescribeFile(const string& protectionToken, const string& filePath, const string& username, const string& applicationId, string& result) {
+  try {
+    auto mipContext = ContextManager::Instance().GetMipContext(applicationId);
+    const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+    auto entry = GetCachedFileEngineEntry(engineKey, protectionToken, GetWorkingDirectory());
+
+    shared_ptr<mip::ContentLabel> label;
+    shared_ptr<ProtectionHandler> protection;
+    string labelId;
+    const char* source = "handler";
+    PfileHeader header;
+    bool pfile = false;
+    if (UsesPfileFastPath(filePath)) {
+      auto fileStream = GetLargeInputStream(filePath);
+      pfile = ReadPfileHeader(*fileStream, header);
+    }
+    if (pfile) {
+      const EngineCache::Key protectionKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+      protection = AcquirePfileProtection(protectionKey, protectionToken, header);
+      labelId = ParseLicenseInfo(header.publishingLicense, mipContext).labelId;
+      source = "publishing_license";
+    } else {
+      auto fileHandler = GetProtectedFileHandler(entry.engine, mipContext, GetLargeInputStream(filePath), filePath);
+      label = fileHandler->GetLabel();
+      protection = fileHandler->GetProtection();
+      if (label)
+        labelId = label->GetLabel()->GetId();
+    }
+
+    JsonWriter json(1024 + filePath.size());
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("path").String(filePath)
+        .Key("source").String(source)
+        .Key("labeled").Bool(!labelId.empty())
+        .Key("protected").Bool(protection != nullptr)
+        .Key("label");
+    if (!labelId.empty())
+      AppendDescribedLabelJSON(json, label, labelId, *entry.labels);
+    else
+      json.Null();
+    json.Key("protection");
+    if (protection)
+      AppendDescribedProtectionJSON(json, protection);
+    else
+      json.Null();
+    json.EndObject();
+    result = json.Take();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = FileStatusErrorJSON(filePath, ex.what());
+    return EXIT_FAILURE;
+  }
+}
+
+// Templates of the user's protection engine, from its catalogue. Only the first call for an engine can
+// wait for the service; later ones return the loaded templates while a stale catalogue refreshes.
+int RunListTemplates(const string& protectionToken, const string& username, const string& applicationId, string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto catalog = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).templates;
+    catalog->WaitLoaded();
+    std::chrono::steady_clock::time_point loadedAt;
+    EpochReclaimer::ReadGuard guard;
+    const auto& templates = catalog->Get(guard, &loadedAt);
+    JsonWriter json(64 + templates.size() * 160);
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("age_seconds").Int(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - loadedAt).count())
+        .Key("templates").BeginArray();
+    for (const auto& entry : templates) {
+      json.BeginObject()
+          .Key("id").String(entry.id)
+          .Key("name").String(entry.name)
+          .Key("description").String(entry.description)
+          .Key("owner_full_access").Bool(entry.ownerGrantedFullAccess)
+          .EndObject();
+    }
+    json.EndArray().EndObject();
+    result = json.Take();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunGetRightsForLabel(
+    const string& protectionToken,
+    const string& labelId,
+    const string& ownerEmail,
+    const string& delegatedUserEmail,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", true /*protectionOnly*/, false /*msgContainers*/ };
+    auto catalog = GetCachedProtectionEngine(engineKey, protectionToken, GetWorkingDirectory()).templates;
+    bool cached = false;
+    const auto rights = catalog->GetRightsForLabel(labelId, ownerEmail, delegatedUserEmail, &cached);
+    JsonWriter json(96 + rights.size() * 16);
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("label_id").String(labelId)
+        .Key("cached").Bool(cached)
+        .Key("rights").BeginArray();
+    for (const auto& right : rights)
+      json.String(right);
+    json.EndArray().EndObject();
+    result = json.Take();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunListSensitivityTypes(const string& protectionToken, const string& username, const string& applicationId, string& result) {
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+    auto sensitivityTypes = GetCachedFileEngineEntry(engineKey, protectionToken, GetWorkingDirectory()).sensitivityTypes;
+    if (!sensitivityTypes)
+      throw std::runtime_error("Classification is not enabled");
+    std::ostringstream oss;
+    oss << "{\"status\": true, \"file_id\": \"" << escapeJsonString(sensitivityTypes->GetFileId()) << "\""
+        << ", \"rule_packages\": " << sensitivityTypes->GetRulePackageCount()
+        << ", \"from_disk\": " << (sensitivityTypes->IsFromDisk() ? "true" : "false")
+        << ", \"sensitivity_types\": [";
+    const auto& entities = sensitivityTypes->GetEntities();
+    for (size_t i = 0; i < entities.size(); ++i) {
+      const auto& entity = entities[i];
+      oss << (i ? ", " : "") << "{\"id\": \"" << escapeJsonString(entity.id) << "\""
+          << ", \"name\": \"" << escapeJsonString(entity.name) << "\""
+          << ", \"rule_package_id\": \"" << escapeJsonString(entity.rulePackageId) << "\""
+          << ", \"recommended_confidence\": " << entity.recommendedConfidence
+          << ", \"terms\": " << entity.terms.size()
+          << ", \"regexes\": " << entity.regexes.size()
+          << ", \"functions\": [";
+      for (size_t j = 0; j < entity.functions.size(); ++j)
+        oss << (j ? ", " : "") << "\"" << escapeJsonString(entity.functions[j]) << "\"";
+      oss << "]}";
+    }
+    oss << "]}";
+    result = oss.str();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunClassifyFiles(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  EngineCache::Entry entry;
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+    entry = GetCachedFileEngineEntry(engineKey, protectionToken, GetWorkingDirectory());
+    if (!entry.classifier)
+      throw std::runtime_error("Classification is not enabled");
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  BatchResults items(count);
+  ForEachParallel(count, [&](size_t i) {
+    try {
+      items.Set(i, ClassifyFileJSON(entry.engine, entry.classifier, string(filePaths[i])));
+    }
+    catch (const std::exception& ex) {
+      items.Set(i, FileStatusErrorJSON(string(filePaths[i]), ex.what()));
+    }
+  });
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+int RunGetLabel(const string& protectionToken, const string& idOrName, const string& username, const string& applicationId, string& result) {
+  try {
+    if (auto shared = FindSharedLabels(username, applicationId)) {
+      const int64_t index = shared->Find(idOrName);
+      if (index == SharedLabelSnapshot::kNotFound)
+        throw std::runtime_error("Label not found: " + idOrName);
+      JsonWriter json;
+      json.BeginObject().Key("status").Bool(true).Key("label");
+      AppendSharedLabelJSON(json, *shared, static_cast<size_t>(index));
+      json.EndObject();
+      result = json.Take();
+      return EXIT_SUCCESS;
+    }
+    ReadLabelIndex(protectionToken, username, applicationId, [&](const LabelIndex& labels) {
+      const auto* record = labels.Find(idOrName);
+      if (!record)
+        throw std::runtime_error("Label not found: " + idOrName);
+      JsonWriter json;
+      json.BeginObject().Key("status").Bool(true).Key("label");
+      AppendLabelRecordJSON(json, labels, *record);
+      json.EndObject();
+      result = json.Take();
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// Files of a batch that get the same label, with the label resolved and its options built once for them.
+struct LabelGroup {
+  shared_ptr<Label> label;
+  LabelingOptions options;
+  vector<const char*> paths;
+  vector<size_t> indexes;
+};
+
+// Label and protection template filePath carries now, read without a handler or a license: from the publishing
+// license of a protected file, whose metadata is encrypted, and from the clear metadata otherwise.
+struct CurrentLabeling {
+  bool isProtected;
+  string labelId;
+  // As the metadata writes it; publishing licenses do not record it.
+  string method;
+  string templateId;
+};
+
+CurrentLabeling ReadCurrentLabeling(const string& filePath, const shared_ptr<MipContext>& mipContext) {
+  CurrentLabeling current;
+  current.isProtected = ProbeFileStatus(filePath, mipContext).isProtected;
+  if (current.isProtected) {
+    const auto info = ReadLicenseInfo(filePath, mipContext);
+    current.labelId = info.labelId;
+    current.templateId = info.templateId;
+    return current;
+  }
+  auto stream = GetLargeInputStream(filePath);
+  if (!stream)
+    stream = GetInputStreamFromFilePath(filePath);
+  const auto metadata = ReadLabelMetadata(*stream);
+  current.labelId = metadata.labelId;
+  current.method = metadata.method;
+  return current;
+}
+
+const char* AssignmentMethodName(AssignmentMethod method) {
+  switch (method) {
+    case AssignmentMethod::PRIVILEGED: return "Privileged";
+    case AssignmentMethod::AUTO: return "Auto";
+    default: return "Standard";
+  }
+}
+
+// Whether setting labelId with method leaves current as it is. A label read from a publishing license
+// matches whatever the method.
+bool HasLabel(const CurrentLabeling& current, const string& labelId, AssignmentMethod method) {
+  return !current.labelId.empty() && EqualsIgnoreCase(current.labelId, labelId) &&
+      (current.method.empty() || EqualsIgnoreCase(current.method, AssignmentMethodName(method)));
+}
+
+// Whether protecting with templateId, or labeling with labelId as ProtectWithTemplateJSON does, leaves current as it is.
+bool HasTemplateOrLabel(const CurrentLabeling& current, const string& templateId, const string& labelId) {
+  if (!labelId.empty())
+    return HasLabel(current, labelId, AssignmentMethod::STANDARD);
+  return current.isProtected && !current.templateId.empty() && EqualsIgnoreCase(current.templateId, templateId);
+}
+
+// The result of a file skipped because it already had the label or protection asked for. Shaped like the
+// "No changes to commit" result a handler would have given, so callers need not tell the two apart.
+string UnchangedJSON() {
+  JsonWriter json(96);
+  json.BeginObject()
+      .Key("status").Bool(false)
+      .Key("path").String("")
+      .Key("error").String("No changes to commit")
+      .Key("unchanged").Bool(true)
+      .EndObject();
+  return json.Take();
+}
+
+MetricsRegistry::Counter& UnchangedSkips() {
+  static auto& skipped = MetricsRegistry::Shared().GetCounter(
+      "msip_native_unchanged_skips_total", "Files not opened because they already had the label or protection asked for");
+  return skipped;
+}
+
+// Whether to skip one file when msipSetSkipUnchanged is on, as SkipUnchanged does for a batch.
+bool IsUnchanged(const string& applicationId, const std::function<bool(const shared_ptr<MipContext>&)>& matches) {
+  if (!ContextManager::Instance().GetSkipUnchanged())
+    return false;
+  try {
+    if (!matches(ContextManager::Instance().GetInspectionContext(applicationId)))
+      return false;
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  UnchangedSkips().Add(1);
+  return true;
+}
+
+// Skips files that already match, when msipSetSkipUnchanged is on: matches(i, mipContext) reads file i offline
+// with applicationId's inspection context and tells whether it matches, in parallel, and matching files get
+// UnchangedJSON in items. Returns the files still to process. A file that cannot be read offline is processed,
+// so the handler reports whatever is wrong with it.
+vector<bool> SkipUnchanged(
+    size_t count,
+    const string& applicationId,
+    BatchResults& items,
+    const std::function<bool(size_t, const shared_ptr<MipContext>&)>& matches) {
+  vector<bool> pending(count, true);
+  if (count == 0 || !ContextManager::Instance().GetSkipUnchanged())
+    return pending;
+  const auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+  // vector<bool> packs bits, so every worker writes its own byte first.
+  vector<char> unchanged(count, 0);
+  ForEachParallel(count, [&](size_t i) {
+    try {
+      unchanged[i] = matches(i, mipContext) ? 1 : 0;
+    }
+    catch (const std::exception&) {
+    }
+  });
+  for (size_t i = 0; i < count; ++i) {
+    if (unchanged[i]) {
+      pending[i] = false;
+      items.Set(i, UnchangedJSON());
+      UnchangedSkips().Add(1);
+    }
+  }
+  return pending;
+}
+
+MetricsRegistry::Counter& PlannedSkips() {
+  static auto& skipped = MetricsRegistry::Shared().GetCounter(
+      "msip_native_label_plan_skips_total", "Files not opened because a computed label action plan settled their result");
+  return skipped;
+}
+
+// Settles pending files whose result a plan computeLabelActions already computed decides, when the user's
+// policy engine is loaded: an unprotected file whose plan has no actions gets UnchangedJSON, and one whose
+// plan asks for a justification that is missing fails, both without opening it. labelOf(i) is the label
+// file i gets, empty for none, and pathOf(i) its path. Protected files and files without a plan are left
+// pending, as are files that cannot be read offline.
+void SkipPlanned(
+    const EngineCache::Key& key,
+    size_t count,
+    const string& applicationId,
+    AssignmentMethod method,
+    const string& justificationMessage,
+    BatchResults& items,
+    vector<bool>& pending,
+    const std::function<string(size_t)>& labelOf,
+    const std::function<string(size_t)>& pathOf) {
+  const auto planner = ContextManager::Instance().FindLabelActionPlanner(key);
+  if (!planner || count == 0)
+    return;
+  const auto mipContext = ContextManager::Instance().GetInspectionContext(applicationId);
+  const string content = mip::GetFileContentFormat();
+  vector<shared_ptr<const LabelActionPlanner::Plan>> plans(count);
+  ForEachParallel(count, [&](size_t i) {
+    const string labelId = pending[i] ? labelOf(i) : string();
+    if (labelId.empty())
+      return;
+    try {
+      const auto current = ReadCurrentLabeling(pathOf(i), mipContext);
+      if (!current.isProtected)
+        plans[i] = planner->Find(labelId, current.labelId, content, method);
+    }
+    catch (const std::exception&) {
+    }
+  });
+  for (size_t i = 0; i < count; ++i) {
+    if (!plans[i])
+      continue;
+    if (!LabelActionPlanner::Changes(*plans[i]))
+      items.Set(i, UnchangedJSON());
+    else if (LabelActionPlanner::NeedsJustification(*plans[i]) && justificationMessage.empty())
+      items.Set(i, getUnprotectStatusJSON(false, "Justification required to downgrade the label", ""));
+    else
+      continue;
+    pending[i] = false;
+    PlannedSkips().Add(1);
+  }
+}
+
+// Labels every path with one policy engine, each with labelIds[i], which may also be a label name or path as
+// for getLabel. Files are grouped by label and each group runs as one batch on up to kMaxBatchWorkers
+// workers, so batch dedupe and read-ahead apply within it: identical files getting the same label are
+// marked once. A label that is not found fails only its own files.
+int RunLabelFiles(
+    const string& protectionToken,
+    const char** filePaths,
+    const char** labelIds,
+    size_t count,
+    AssignmentMethod method,
+    const string& justificationMessage,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  shared_ptr<FileEngine> fileEngine;
+  vector<LabelGroup> groups;
+  // Files whose label is not found, with their label id.
+  vector<pair<size_t, string>> notFound;
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+    auto entry = GetCachedFileEngineEntry(engineKey, protectionToken, GetWorkingDirectory());
+    fileEngine = entry.engine;
+    const auto options = MakeLabelingOptions(method, justificationMessage, {} /*extendedProperties*/);
+    std::unordered_map<string, size_t> groupOfLabel;
+    for (size_t i = 0; i < count; ++i) {
+      const string labelId(labelIds[i]);
+      auto known = groupOfLabel.find(labelId);
+      if (known == groupOfLabel.end()) {
+        const auto* record = entry.labels->Find(labelId);
+        if (!record) {
+          notFound.emplace_back(i, labelId);
+          continue;
+        }
+        known = groupOfLabel.emplace(labelId, groups.size()).first;
+        groups.push_back(LabelGroup{ record->label, options, {}, {} });
+      }
+      groups[known->second].paths.push_back(filePaths[i]);
+      groups[known->second].indexes.push_back(i);
+    }
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  BatchResults items(count);
+  for (const auto& missing : notFound)
+    items.Set(missing.first, getUnprotectStatusJSON(false, "Label not found: " + missing.second, ""));
+  vector<const LabelGroup*> groupOf(count, nullptr);
+  for (const auto& group : groups) {
+    for (size_t i : group.indexes)
+      groupOf[i] = &group;
+  }
+  auto pending = SkipUnchanged(count, applicationId, items, [&](size_t i, const shared_ptr<MipContext>& mipContext) {
+    return groupOf[i] && HasLabel(ReadCurrentLabeling(filePaths[i], mipContext), groupOf[i]->label->GetId(), method);
+  });
+  SkipPlanned(ServiceEngineKey({ applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ }), count, applicationId, method,
+      justificationMessage, items, pending, [&](size_t i) { return groupOf[i] ? groupOf[i]->label->GetId() : string(); },
+      [&](size_t i) { return string(filePaths[i]); });
+  vector<const char*> pendingPaths;
+  for (auto& group : groups) {
+    size_t kept = 0;
+    for (size_t g = 0; g < group.indexes.size(); ++g) {
+      if (!pending[group.indexes[g]])
+        continue;
+      group.paths[kept] = group.paths[g];
+      group.indexes[kept++] = group.indexes[g];
+      pendingPaths.push_back(group.paths[g]);
+    }
+    group.paths.resize(kept);
+    group.indexes.resize(kept);
+  }
+  // One license stage for the whole call: files of different labels often share a publishing license.
+  PrefetchBatchLicenses(fileEngine, applicationId, pendingPaths.data(), pendingPaths.size(), true /*onlyProtectedFormats*/);
+  const string delegatedUser = DelegatedUserOf(applicationId, username);
+  for (const auto& group : groups) {
+    RunBatchOperation(group.paths.data(), group.paths.size(), [&](size_t g, string& committedPath) {
+      return LabelFileJSON(fileEngine, group.label, group.options, string(group.paths[g]), delegatedUser, committedPath);
+    }, [&](size_t g, string item) { items.Set(group.indexes[g], std::move(item)); });
+  }
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+int RunComputeLabelActions(
+    const string& protectionToken,
+    const string& labelId,
+    const string& priorLabelId,
+    const string& contentFormat,
+    AssignmentMethod method,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  static auto& computed = MetricsRegistry::Shared().GetCounter(
+      "msip_native_label_plans_computed_total", "Label action plans the policy handler computed");
+  static auto& reused = MetricsRegistry::Shared().GetCounter(
+      "msip_native_label_plans_cached_total", "Label action plans answered from those already computed");
+  try {
+    const EngineCache::Key engineKey = { applicationId, username, "", "", false /*protectionOnly*/, false /*msgContainers*/ };
+    auto entry = GetCachedPolicyEngine(engineKey, protectionToken, GetWorkingDirectory());
+    bool cached = false;
+    const auto plan = entry.planner->Compute(labelId, priorLabelId, contentFormat, method, cached);
+    (cached ? reused : computed).Add(1);
+    JsonWriter json(256 + plan->actions.size());
+    json.BeginObject()
+        .Key("status").Bool(true)
+        .Key("label_id").String(labelId)
+        .Key("prior_label_id").String(priorLabelId)
+        .Key("content_format").String(contentFormat)
+        .Key("assignment_method").String(AssignmentMethodName(method))
+        .Key("cached").Bool(cached)
+        .Key("changes").Bool(LabelActionPlanner::Changes(*plan))
+        .Key("protects").Bool(LabelActionPlanner::Protects(*plan))
+        .Key("requires_justification").Bool(LabelActionPlanner::NeedsJustification(*plan))
+        .Key("actions").Raw(plan->actions)
+        .EndObject();
+    result = json.Take();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+int RunProtectFileWithTemplate(
+    const string& protectionToken,
+    const string& filePath,
+    const string& templateId,
+    const string& labelId,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  try {
+    ValidateTemplateOrLabel(templateId, labelId);
+    if (IsUnchanged(applicationId, [&](const shared_ptr<MipContext>& mipContext) {
+          return HasTemplateOrLabel(ReadCurrentLabeling(filePath, mipContext), templateId, labelId);
+        })) {
+      result = UnchangedJSON();
+      return EXIT_SUCCESS;
+    }
+    auto fileEngine = GetCachedFileEngine(TemplateEngineKey(applicationId, username, labelId), protectionToken, GetWorkingDirectory());
+    result = ProtectWithTemplateJSON(fileEngine, templateId, labelId, filePath, DelegatedUserOf(applicationId, username));
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+}
+
+// The first file runs alone so the template's handler is created once; the rest reuse it in parallel.
+int RunProtectFileWithTemplateBatch(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const string& templateId,
+    const string& labelId,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  shared_ptr<FileEngine> fileEngine;
+  try {
+    ValidateTemplateOrLabel(templateId, labelId);
+    fileEngine = GetCachedFileEngine(TemplateEngineKey(applicationId, username, labelId), protectionToken, GetWorkingDirectory());
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  BatchResults items(count);
+  const auto pending = SkipUnchanged(count, applicationId, items, [&](size_t i, const shared_ptr<MipContext>& mipContext) {
+    return HasTemplateOrLabel(ReadCurrentLabeling(filePaths[i], mipContext), templateId, labelId);
+  });
+  vector<size_t> indexes;
+  vector<const char*> pendingPaths;
+  for (size_t i = 0; i < count; ++i) {
+    if (!pending[i])
+      continue;
+    indexes.push_back(i);
+    pendingPaths.push_back(filePaths[i]);
+  }
+  PrefetchBatchLicenses(fileEngine, applicationId, pendingPaths.data(), pendingPaths.size(), true /*onlyProtectedFormats*/);
+  const string delegatedUser = DelegatedUserOf(applicationId, username);
+  auto protectOne = [&](size_t i) {
+    try {
+      items.Set(i, ProtectWithTemplateJSON(fileEngine, templateId, labelId, string(filePaths[i]), delegatedUser));
+    }
+    catch (const std::exception& ex) {
+      items.Set(i, getUnprotectStatusJSON(false, ex.what(), ""));
+    }
+  };
+  if (!indexes.empty())
+    protectOne(indexes[0]);
+  if (indexes.size() > 1)
+    ForEachParallel(indexes.size() - 1, [&](size_t i) { protectOne(indexes[i + 1]); });
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+// Like RunProtectFileWithTemplateBatch, the first file runs alone so the handler for the permissions is
+// created once.
+int RunProtectFilesWithPermissions(
+    const string& protectionToken,
+    const char** filePaths,
+    size_t count,
+    const AdhocPermissions& permissions,
+    const string& username,
+    const string& applicationId,
+    string& result) {
+  shared_ptr<FileEngine> fileEngine;
+  ProtectionDescriptorInterner::Interned interned;
+  try {
+    interned = ContextManager::Instance().GetDescriptorInterner().Intern(permissions);
+    fileEngine = GetCachedFileEngine(TemplateEngineKey(applicationId, username, "" /*labelId*/), protectionToken, GetWorkingDirectory());
+  }
+  catch (const std::exception& ex) {
+    result = getUnprotectStatusJSON(false, ex.what(), "");
+    return EXIT_FAILURE;
+  }
+
+  PrefetchBatchLicenses(fileEngine, applicationId, filePaths, count, true /*onlyProtectedFormats*/);
+  const string delegatedUser = DelegatedUserOf(applicationId, username);
+  BatchResults items(count);
+  auto protectOne = [&](size_t i) {
+    try {
+      items.Set(i, ProtectWithPermissionsJSON(fileEngine, interned, string(filePaths[i]), delegatedUser));
+    }
+    catch (const std::exception& ex) {
+      items.Set(i, getUnprotectStatusJSON(false, ex.what(), ""));
+    }
+  };
+  if (count > 0)
+    protectOne(0);
+  if (count > 1)
+    ForEachParallel(count - 1, [&](size_t i) { protectOne(i + 1); });
+  result = items.Finish();
+  return EXIT_SUCCESS;
+}
+
+const char* WarmupStateName(ContextManager::WarmupState state) {
+  switch (state) {
+    case ContextManager::WarmupState::Running: return "running";
+    case ContextManager::WarmupState::Done: return "done";
+    case ContextManager::WarmupState::Incomplete: return "incomplete";
+    default: return "none";
+  }
+}
+
+void AppendOutcomes(std::ostringstream& oss, const char* name, const RecentOutcomes::Counts& counts) {
+  const uint64_t started = counts.succeeded + counts.failed;
+  const uint64_t total = started + counts.rejected;
+  oss << ", \"" << name << "\": {\"succeeded\": " << counts.succeeded << ", \"failed\": " << counts.failed
+      << ", \"rejected\": " << counts.rejected
+      << ", \"error_rate\": " << (started > 0 ? static_cast<double>(counts.failed) / started : 0.0)
+      << ", \"reject_rate\": " << (total > 0 ? static_cast<double>(counts.rejected) / total : 0.0) << "}";
+}
+
+void AppendFill(std::ostringstream& oss, const char* name, const ContextManager::Health::Fill& fill) {
+  oss << ", \"" << name << "\": {\"size\": " << fill.size << ", \"capacity\": " << fill.capacity << "}";
+}
+
+// Writes the warm caches to path for msipSnapshot: the label index of each loaded policy engine, tenant
+// endpoints and inspection results in the clear, and the rights and license details, which say what users
+// may open, sealed under key. Without a key those two are left out.
+string SnapshotCaches(const string& path, const string& key) {
+  auto& contextManager = ContextManager::Instance();
+  vector<CacheSnapshot::Section> sections;
+  for (const auto& labels : contextManager.GetEngineCache().GetLabelIndexes())
+    sections.push_back({ CacheSnapshot::SectionType::Labels, labels.first, false, SharedLabelSnapshot::Serialize(*labels.second) });
+  auto add = [&](CacheSnapshot::SectionType type, bool sealed, const std::function<void(SnapshotWriter&)>& write) {
+    if (sealed && key.empty())
+      return;
+    SnapshotWriter writer;
+    write(writer);
+    sections.push_back({ type, CacheSnapshot::TypeName(type), sealed, std::move(writer.Data()) });
+  };
+  add(CacheSnapshot::SectionType::Endpoints, false, [&](SnapshotWriter& writer) { contextManager.GetTenantEndpoints().SnapshotTo(writer); });
+  add(CacheSnapshot::SectionType::Inspection, false, [&](SnapshotWriter& writer) { contextManager.GetInspectionCache().SnapshotTo(writer); });
+  add(CacheSnapshot::SectionType::Rights, true, [&](SnapshotWriter& writer) { contextManager.GetRightsCache().SnapshotTo(writer); });
+  add(CacheSnapshot::SectionType::LicenseInfo, true, [&](SnapshotWriter& writer) { contextManager.GetLicenseInfoCache().SnapshotTo(writer); });
+  CacheSnapshot::Write(path, sections, key);
+
+  const auto snapshot = CacheSnapshot::Map(path);
+  JsonWriter json(256 + 96 * sections.size());
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("created_at").Int(snapshot->GetCreatedAt())
+      .Key("bytes").Int(snapshot->GetSize())
+      .Key("sealed").Bool(!key.empty())
+      .Key("sections").BeginArray();
+  for (const auto& section : snapshot->GetSections()) {
+    json.BeginObject()
+        .Key("type").String(CacheSnapshot::TypeName(section.type))
+        .Key("name").String(section.name)
+        .Key("sealed").Bool(section.sealed)
+        .Key("bytes").UInt(section.size)
+        .EndObject();
+  }
+  json.EndArray().EndObject();
+  return json.Take();
+}
+
+// Puts the caches of a snapshot from SnapshotCaches back for msipRestore. Label indexes become shared label
+// snapshots, which label lookups read until the engine is loaded, so they need shared labels configured and
+// never replace a snapshot already published. Sections this process cannot use are skipped with the reason.
+string RestoreCaches(const string& path, const string& key) {
+  auto& contextManager = ContextManager::Instance();
+  const auto snapshot = CacheSnapshot::Map(path);
+  std::map<string, size_t> restored = { {"labels", 0}, {"endpoints", 0}, {"inspection", 0}, {"rights", 0}, {"license_info", 0} };
+  JsonWriter skipped(256);
+  skipped.BeginArray();
+  auto skip = [&](const CacheSnapshot::View& section, const char* reason) {
+    skipped.BeginObject()
+        .Key("type").String(CacheSnapshot::TypeName(section.type))
+        .Key("name").String(section.name)
+        .Key("reason").String(reason)
+        .EndObject();
+  };
+  for (const auto& section : snapshot->GetSections()) {
+    string plaintext;
+    const char* data = section.data;
+    size_t size = section.size;
+    if (section.sealed) {
+      if (key.empty()) {
+        skip(section, "no key");
+        continue;
+      }
+      if (!CacheSnapshot::Unseal(section, key, plaintext)) {
+        skip(section, "wrong key");
+        continue;
+      }
+      data = plaintext.data();
+      size = plaintext.size();
+    }
+    if (section.type == CacheSnapshot::SectionType::Labels) {
+      auto& labels = contextManager.GetSharedLabelSnapshots();
+      if (!labels.IsEnabled())
+        skip(section, "shared labels off");
+      else if (!labels.Install(section.name, data, size))
+        skip(section, "already published");
+      else
+        ++restored["labels"];
+      continue;
+    }
+    SnapshotReader reader(data, size);
+    try {
+      switch (section.type) {
+        case CacheSnapshot::SectionType::Endpoints:
+          restored["endpoints"] += contextManager.GetTenantEndpoints().RestoreFrom(reader);
+          break;
+        case CacheSnapshot::SectionType::Inspection:
+          restored["inspection"] += contextManager.GetInspectionCache().RestoreFrom(reader);
+          break;
+        case CacheSnapshot::SectionType::Rights:
+          restored["rights"] += contextManager.GetRightsCache().RestoreFrom(reader);
+          break;
+        case CacheSnapshot::SectionType::LicenseInfo:
+          restored["license_info"] += contextManager.GetLicenseInfoCache().RestoreFrom(reader);
+          break;
+        default:
+          skip(section, "unknown type");
+          break;
+      }
+    } catch (const std::runtime_error&) {
+      // Entries read before the malformed one stay restored.
+      skip(section, "malformed");
+    }
+  }
+  skipped.EndArray();
+
+  JsonWriter json(512 + skipped.Str().size());
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("created_at").Int(snapshot->GetCreatedAt())
+      .Key("bytes").Int(snapshot->GetSize())
+      .Key("restored").BeginObject();
+  for (const auto& count : restored)
+    json.Key(count.first.c_str()).UInt(count.second);
+  json.EndObject()
+      .Key("skipped").Raw(skipped.Str())
+      .EndObject();
+  return json.Take();
+}
+
+} // namespace
+
+
+// Wall clock, in nanoseconds, when the dynamic loader started running this library's constructors. Priority
+// 101 runs it ahead of every static initializer here. The SDK libraries this one depends on are initialized
+// before it, so the caller can split its load time into linking and SDK initialization before this point
+// and the glue's own static initialization after it.
+static int64_t gConstructorTimeNs = 0;
+
+__attribute__((constructor(101))) static void RecordConstructorTime() {
+  gConstructorTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+extern "C" MSIP_EXPORT int msipGetStartupStats(char *result)
+{
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"constructor_time_ns\": " << gConstructorTimeNs << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Creates the shared MipContext and FileProfile for applicationId ahead of the first request.
+// Calling it is optional: every export initializes lazily on first use.
+extern "C" MSIP_EXPORT int msipInit(const char *applicationId_str, char *result)
+{
+  try {
+    ContextManager::Instance().Initialize(string(applicationId_str));
+    strcpy(result, getUnprotectStatusJSON(true, "", "").c_str());
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    strcpy(result, getUnprotectStatusJSON(false, ex.what(), "").c_str());
+    return EXIT_FAILURE;
+  }
+}
+
+// Selects fast (default) or graceful teardown for contexts created afterwards. Call before msipInit.
+extern "C" MSIP_EXPORT int msipSetFastShutdown(int enabled)
+{
+  ContextManager::Instance().SetFastShutdown(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Makes contexts created afterwards parse service responses with the library's own JSON parser instead of
+// the SDK's. Off by default. Call before msipInit.
+extern "C" MSIP_EXPORT int msipSetNativeJson(int enabled)
+{
+  ContextManager::Instance().SetNativeJson(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Makes contexts created afterwards parse policy and template XML with the library's own pull parser instead
+// of the SDK's, where the SDK allows it. Off by default. Call before msipInit.
+extern "C" MSIP_EXPORT int msipSetNativeXml(int enabled)
+{
+  ContextManager::Instance().SetNativeXml(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Makes label calls commit their _modified output into a reflink clone of the input, where the filesystem
+// supports it (XFS, btrfs), writing only the blocks the label change touched. Off by default.
+extern "C" MSIP_EXPORT int msipSetCloneLabelOutputs(int enabled)
+{
+  ContextManager::Instance().SetCloneLabelOutputs(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Makes unprotect calls decrypt .pfile inputs with a protection engine and the license from the pfile
+// header, skipping the file engine and its policy. Pfiles whose header is not recognized are still opened
+// through the File SDK. Off by default.
+extern "C" MSIP_EXPORT int msipSetPfileFastPath(int enabled)
+{
+  ContextManager::Instance().SetPfileFastPath(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Makes labelFiles and the template protect calls read each file's current label and template offline first,
+// from its metadata or publishing license, and skip files that already have what was asked for. They are
+// reported as "unchanged", without a handler or a license. Off by default.
+extern "C" MSIP_EXPORT int msipSetSkipUnchanged(int enabled)
+{
+  ContextManager::Instance().SetSkipUnchanged(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Sets how label changes to PDFs are written. keepLinearization makes engines loaded afterwards keep a
+// linearized PDF linearized; with incrementalUpdates, label commits of PDFs go to a reflink clone of their
+// input, so when the SDK appends its change as an incremental update only the update is written. Both
+// are off by default. Call before msipInit.
+extern "C" MSIP_EXPORT int msipConfigurePdf(int keepLinearization, int incrementalUpdates)
+{
+  ContextManager::PdfOptions options;
+  options.keepLinearization = keepLinearization != 0;
+  options.incrementalUpdates = incrementalUpdates != 0;
+  ContextManager::Instance().SetPdfOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Makes protectFileBatch and unprotectFileBatch process each distinct content of a batch once. mode is 0
+// (off, the default), 1 (duplicates get a copy of the output) or 2 (duplicates get a hard link to it).
+extern "C" MSIP_EXPORT int msipSetBatchDedupe(int mode)
+{
+  if (mode < static_cast<int>(ContentDedupe::Mode::Off) || mode > static_cast<int>(ContentDedupe::Mode::HardLink))
+    return EXIT_FAILURE;
+  ContextManager::Instance().SetBatchDedupe(static_cast<ContentDedupe::Mode>(mode));
+  return EXIT_SUCCESS;
+}
+
+// Makes getFileStatusBatch, protectFileBatch and unprotectFileBatch read their inputs ahead through io_uring,
+// queueDepth reads of up to bufferBytes at a time, holding at most maxBufferedBytes of inputs not yet taken
+// by a worker. queueDepth 0 turns read ahead off, which is the default. Fails when io_uring is unavailable.
+extern "C" MSIP_EXPORT int msipConfigureBatchReadAhead(size_t queueDepth, size_t bufferBytes, size_t maxBufferedBytes)
+{
+  if (queueDepth > AsyncFileReader::kMaxQueueDepth || (queueDepth > 0 && (bufferBytes == 0 || !AsyncFileReader::IsSupported())))
+    return EXIT_FAILURE;
+  AsyncFileReader::Settings settings = AsyncFileReader::Settings();
+  settings.queueDepth = queueDepth;
+  settings.bufferBytes = bufferBytes;
+  settings.maxBufferedBytes = maxBufferedBytes;
+  ContextManager::Instance().SetBatchReadAhead(settings);
+  return EXIT_SUCCESS;
+}
+
+// Makes getFileStatusBatch, protectFileBatch and unprotectFileBatch prefetch their inputs on threads of
+// their own when they do not read them ahead, depth files per worker ahead of the ones being processed,
+// so a worker busy with one file's license or crypto finds the next one in memory. Files below the mapped
+// threshold (see msipConfigureInputStreams) are read whole, holding at most maxBufferedBytes not yet taken;
+// larger ones are mapped and up to maxPrefaultBytes of their pages faulted in. Meant for inputs on network
+// filesystems, where the first read of a file is a round trip. depth 0 turns prefetch off, the default.
+extern "C" MSIP_EXPORT int msipConfigureBatchPrefetch(size_t depth, size_t maxBufferedBytes, int64_t maxPrefaultBytes)
+{
+  if (depth > BatchPrefetcher::kMaxDepth || maxPrefaultBytes < 0)
+    return EXIT_FAILURE;
+  BatchPrefetcher::Settings settings = BatchPrefetcher::Settings();
+  settings.depth = depth;
+  settings.maxBufferedBytes = maxBufferedBytes;
+  settings.maxPrefaultBytes = maxPrefaultBytes;
+  ContextManager::Instance().SetBatchPrefetch(settings);
+  return EXIT_SUCCESS;
+}
+
+// Runs the files of protectFileBatch and unprotectFileBatch through five stages, each with its own workers
+// and a bounded lock-free queue of queueCapacity files in front of it (0 for 16): reading the input,
+// creating its handler, which acquires use licenses, checking rights, removing or setting protection, and
+// committing the output. Files waiting on the service then overlap with the reads, decryption and writes of
+// the others. A stage given no workers while another has some gets one; all 0, the default, processes each
+// file in one call. Batches with dedupe on (msipSetBatchDedupe) keep processing each file in one call.
+extern "C" MSIP_EXPORT int msipConfigureBatchPipeline(
+    size_t readWorkers, size_t openWorkers, size_t rightsWorkers, size_t transformWorkers, size_t commitWorkers, size_t queueCapacity)
+{
+  static const size_t kMaxStageWorkers = 64;
+  static const size_t kMaxQueueCapacity = 4096;
+  if (std::max({ readWorkers, openWorkers, rightsWorkers, transformWorkers, commitWorkers }) > kMaxStageWorkers ||
+      queueCapacity > kMaxQueueCapacity)
+    return EXIT_FAILURE;
+  ContextManager::BatchPipelineOptions options;
+  options.readWorkers = readWorkers;
+  options.openWorkers = openWorkers;
+  options.rightsWorkers = rightsWorkers;
+  options.transformWorkers = transformWorkers;
+  options.commitWorkers = commitWorkers;
+  options.queueCapacity = queueCapacity ? queueCapacity : 16;
+  ContextManager::Instance().SetBatchPipeline(options);
+  return EXIT_SUCCESS;
+}
+
+// Per stage figures of the last batch run through the pipeline. A stage's utilization is the share of the
+// batch its workers spent running it and its occupancy how full its queue was on average, so the
+// bottleneck is the stage with the highest utilization, usually behind a queue that stays full while the
+// stages after it sit idle.
+extern "C" MSIP_EXPORT int msipGetBatchPipelineStats(char *out, size_t cap, size_t *needed)
+{
+  auto& contextManager = ContextManager::Instance();
+  const auto options = contextManager.GetBatchPipeline();
+  uint64_t batches = 0;
+  const auto stats = contextManager.GetLastBatchPipelineRun(batches);
+  JsonWriter json(256 + stats.stages.size() * 256);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("enabled").Bool(options.readWorkers || options.openWorkers || options.rightsWorkers ||
+          options.transformWorkers || options.commitWorkers)
+      .Key("batches").UInt(batches)
+      .Key("items").UInt(stats.items)
+      .Key("elapsed_ms").Double(stats.elapsedMicros / 1000.0)
+      .Key("bottleneck").String(StagedPipeline::Bottleneck(stats))
+      .Key("stages").BeginArray();
+  for (const auto& stage : stats.stages) {
+    const double available = static_cast<double>(stage.workers) * stats.elapsedMicros;
+    json.BeginObject()
+        .Key("name").String(stage.name)
+        .Key("workers").UInt(stage.workers)
+        .Key("capacity").UInt(stage.capacity)
+        .Key("processed").UInt(stage.processed)
+        .Key("busy_ms").Double(stage.busyMicros / 1000.0)
+        .Key("idle_ms").Double(stage.idleMicros / 1000.0)
+        .Key("blocked_ms").Double(stage.blockedMicros / 1000.0)
+        .Key("utilization").Double(available > 0 ? stage.busyMicros / available : 0)
+        .Key("max_queued").UInt(stage.maxQueued)
+        .Key("mean_queued").Double(stage.meanQueued)
+        .Key("occupancy").Double(stage.capacity ? stage.meanQueued / stage.capacity : 0)
+        .EndObject();
+  }
+  json.EndArray().EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// Pins batch workers round robin to the NUMA nodes this process may run on, and makes the buffer pool place
+// and reuse buffers by node, so a file's input, decryption and output stay on one node. Off by default, and
+// nothing changes on a host with one node. The result JSON has the node count.
+extern "C" MSIP_EXPORT int msipConfigureNumaPlacement(int enabled, char *out, size_t cap, size_t *needed)
+{
+  const size_t nodes = NumaTopology::Shared().NodeCount();
+  ContextManager::Instance().SetNumaPlacement(enabled != 0);
+  BufferPool::Shared().SetNumaPlacement(enabled != 0 && nodes > 1);
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"enabled\": " << (enabled != 0 ? "true" : "false") << ", \"nodes\": " << nodes << "}";
+  return WriteResult(EXIT_SUCCESS, oss.str(), out, cap, needed);
+}
+
+// Page hints for large in-memory inputs. hugePages asks for transparent huge pages for the buffer pool's
+// classes of 2 MiB and up (on by default) and for mapped inputs, so crypto and zip scans over them need
+// fewer TLB entries. Mapped inputs of prefaultMinBytes or more are faulted in when opened (0 to turn it
+// off), and with prefaultPool the pool faults in its large classes when it maps them, in one call each
+// instead of a fault per 4 KiB page. The result JSON has the kernel's "transparent_hugepage" mode, under
+// which huge pages only apply when it is "always" or "madvise".
+extern "C" MSIP_EXPORT int msipConfigureMemoryHints(int hugePages, int64_t prefaultMinBytes, int prefaultPool, char *out, size_t cap, size_t *needed)
+{
+  if (prefaultMinBytes < 0)
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, "prefaultMinBytes must not be negative", ""), out, cap, needed);
+  auto& contextManager = ContextManager::Instance();
+  InputStreams::Options options = contextManager.GetInputStreams();
+  options.hugePages = hugePages != 0;
+  options.prefaultMinBytes = prefaultMinBytes;
+  contextManager.SetInputStreams(options);
+  BufferPool::Shared().SetHugePages(hugePages != 0);
+  BufferPool::Shared().SetPrefault(prefaultPool != 0);
+
+  const string mode = TransparentHugePageMode();
+  if (hugePages != 0 && mode == "never")
+    MSIP_EVENT(mip::LogLevel::Warning, "huge_pages_unavailable", {"transparent_hugepage", mode});
+  JsonWriter json(128);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("huge_pages").Bool(hugePages != 0)
+      .Key("prefault_min_bytes").Int(prefaultMinBytes)
+      .Key("prefault_pool").Bool(prefaultPool != 0)
+      .Key("transparent_hugepage").String(mode)
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// Chooses how inputs opened by path are handed to the SDK by size: files smaller than pooledMaxBytes are
+// read whole into a pooled buffer, files of mappedMinBytes or more are mapped, and files of windowedMinBytes
+// or more are read through a window of windowBytes, asking the kernel to read readAheadBytes past it. The
+// SDK opens the rest by path. pooledMaxBytes and windowedMinBytes 0 turn those strategies off. The hints
+// of msipConfigureMemoryHints are kept.
+extern "C" MSIP_EXPORT int msipConfigureInputStreams(int64_t pooledMaxBytes, int64_t mappedMinBytes, int64_t windowedMinBytes, size_t windowBytes, size_t readAheadBytes)
+{
+  InputStreams::Options options = ContextManager::Instance().GetInputStreams();
+  options.pooledMaxBytes = pooledMaxBytes;
+  options.mappedMinBytes = mappedMinBytes;
+  options.windowedMinBytes = windowedMinBytes;
+  options.windowBytes = windowBytes;
+  options.readAheadBytes = readAheadBytes;
+  if (!InputStreams::IsValid(options))
+    return EXIT_FAILURE;
+  ContextManager::Instance().SetInputStreams(options);
+  return EXIT_SUCCESS;
+}
+
+// Makes protect, unprotect and label calls that commit to a _modified file write it through a buffer of
+// bufferBytes, in whole aligned blocks, instead of letting the SDK write it. directIo writes those blocks
+// with O_DIRECT, dropCache writes the output back and drops it from the page cache as it is written, and
+// preallocate reserves the input's size for it up front. bufferBytes 0 restores the SDK's writer.
+extern "C" MSIP_EXPORT int msipConfigureOutputWriter(size_t bufferBytes, int directIo, int dropCache, int preallocate)
+{
+  static const size_t kMaxBufferBytes = 64 * 1024 * 1024;
+  if (bufferBytes > kMaxBufferBytes)
+    return EXIT_FAILURE;
+  AlignedFileOutputStream::Options options = AlignedFileOutputStream::Options();
+  options.bufferBytes = bufferBytes;
+  options.directIo = directIo != 0;
+  options.dropCache = dropCache != 0;
+  options.preallocate = preallocate != 0;
+  ContextManager::Instance().SetOutputWriter(options);
+  return EXIT_SUCCESS;
+}
+
+// Makes unprotects of protected Office Open XML files write the package the SDK decrypts themselves instead
+// of committing through the SDK, which recompresses every part on one thread. Parts keep their compressed
+// bytes; stored parts of deflateMinBytes or more are deflated at level, on the dispatcher's workers at
+// once. Packages above maxPackageBytes, which are held in memory, and Zip64 packages still go to the SDK.
+extern "C" MSIP_EXPORT int msipConfigurePackageRepack(int enabled, int64_t maxPackageBytes, int64_t deflateMinBytes, int level)
+{
+  PackageRepacker::Options options = PackageRepacker::Options();
+  options.enabled = enabled != 0;
+  options.maxPackageBytes = maxPackageBytes;
+  options.deflateMinBytes = deflateMinBytes;
+  options.level = level;
+  if (!PackageRepacker::IsValid(options))
+    return EXIT_FAILURE;
+  ContextManager::Instance().SetPackageRepack(options);
+  return EXIT_SUCCESS;
+}
+
+// Selects where the SDK caches policy, licenses and engine state for contexts created afterwards. Call
+// before msipInit. storageType is 0 (in memory), 1 (on disk) or 2 (on disk, encrypted); storagePath may
+// be empty for the default directory; policyTtlDays 0 keeps the SDK's policy lifetime.
+extern "C" MSIP_EXPORT int msipConfigureStorage(const char *storagePath, int storageType, int cacheLicenses, int policyTtlDays)
+{
+  ContextManager::StorageOptions options = ContextManager::Instance().GetStorageOptions();
+  switch (storageType) {
+    case 0: options.cacheStorageType = mip::CacheStorageType::InMemory; break;
+    case 1: options.cacheStorageType = mip::CacheStorageType::OnDisk; break;
+    case 2: options.cacheStorageType = mip::CacheStorageType::OnDiskEncrypted; break;
+    default: return EXIT_FAILURE;
+  }
+  options.storagePath = storagePath ? storagePath : "";
+  options.canCacheLicenses = cacheLicenses != 0;
+  options.policyTtlDays = policyTtlDays > 0 ? policyTtlDays : 0;
+  ContextManager::Instance().SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Loads the policy of every policy engine created afterwards from the XML at path instead of the policy
+// service, for air-gapped or fast starts. With exportSnapshot set, engines download their policy and
+// write it to path, which produces the snapshot. An empty path turns both off.
+extern "C" MSIP_EXPORT int msipConfigurePolicySnapshot(const char *path, int exportSnapshot)
+{
+  ContextManager::StorageOptions options = ContextManager::Instance().GetStorageOptions();
+  options.policySnapshotPath = path ? path : "";
+  options.exportPolicySnapshot = exportSnapshot != 0;
+  if (!options.policySnapshotPath.empty() && !options.exportPolicySnapshot && access(options.policySnapshotPath.c_str(), R_OK) != 0)
+    return EXIT_FAILURE;
+  ContextManager::Instance().SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Publishes the label tree of every policy engine this process loads into directory, best on tmpfs, when no
+// other process of the node publishes it already, and answers listLabels and getLabel of a user whose policy
+// engine this process has not loaded from a label tree another process published there. An empty directory
+// turns both off. Fails when directory is not a writable directory.
+extern "C" MSIP_EXPORT int msipConfigureSharedLabels(const char *directory)
+{
+  const string path = directory ? directory : "";
+  struct stat info;
+  if (!path.empty() && (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || access(path.c_str(), W_OK) != 0))
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetSharedLabelSnapshots().SetDirectory(path);
+  return EXIT_SUCCESS;
+}
+
+// Makes policy engines created afterwards load the tenant's sensitivity types and compile their rule
+// packages for classification. The compiled form is cached in cacheDirectory, keyed by the engine's
+// sensitivity file id, and reused until the rule packages change; an empty directory keeps it in memory.
+extern "C" MSIP_EXPORT int msipConfigureClassification(int enabled, const char *cacheDirectory)
+{
+  ContextManager::StorageOptions options = ContextManager::Instance().GetStorageOptions();
+  options.loadSensitivityTypes = enabled != 0;
+  options.sensitivityTypeCachePath = cacheDirectory ? cacheDirectory : "";
+  ContextManager::Instance().SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Sets which service endpoints profiles consent to. Hosts in allowedHosts, and their subdomains, are always
+// accepted; other hosts are rejected when rejectOthers is set and accepted otherwise. Each URL is decided
+// once and the decision reused by every profile. Call before msipInit.
+extern "C" MSIP_EXPORT int msipConfigureConsent(const char **allowedHosts, size_t count, int rejectOthers)
+{
+  vector<string> hosts;
+  for (size_t i = 0; i < count; ++i) {
+    if (!allowedHosts[i])
+      return EXIT_FAILURE;
+    hosts.emplace_back(allowedHosts[i]);
+  }
+  if (rejectOthers && hosts.empty())
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetConsentDelegate().SetPolicy(hosts, rejectOthers != 0);
+  return EXIT_SUCCESS;
+}
+
+// Sets the locale, flighting features, label filters and custom settings of contexts and engines created
+// afterwards, so they are parsed once at start instead of on every engine load. flightingFeatures is
+// "<feature id>:true|false,...", the functionality lists are comma separated mip::LabelFilterType names.
+// taskTimeoutMs and maxFileSizeForProtection keep the SDK defaults when 0. Call before msipInit.
+extern "C" MSIP_EXPORT int msipConfigureEngines(
+    const char *locale,
+    const char *flightingFeatures,
+    const char *enableFunctionality,
+    const char *disableFunctionality,
+    int taskTimeoutMs,
+    int64_t maxFileSizeForProtection,
+    const char **customSettingNames,
+    const char **customSettingValues,
+    size_t customSettingCount)
+{
+  ContextManager::EngineOptions options;
+  options.maxFileSizeForProtection = maxFileSizeForProtection > 0 ? maxFileSizeForProtection : 0;
+  try {
+    options.locale = locale ? locale : "";
+    options.featureSettings = SplitFeatures(flightingFeatures ? flightingFeatures : "");
+    options.enabledFunctionality = CreateLabelFiltersFromString(enableFunctionality ? enableFunctionality : "");
+    options.disabledFunctionality = CreateLabelFiltersFromString(disableFunctionality ? disableFunctionality : "");
+  } catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+  if (taskTimeoutMs > 0)
+    options.customSettings.emplace_back(mip::GetCustomSettingTaskTimeoutMs(), std::to_string(taskTimeoutMs));
+  if (options.maxFileSizeForProtection > 0)
+    options.customSettings.emplace_back(mip::GetCustomSettingMaxFileSizeForProtection(), std::to_string(options.maxFileSizeForProtection));
+  for (size_t i = 0; i < customSettingCount; ++i) {
+    if (!customSettingNames[i] || !*customSettingNames[i])
+      return EXIT_FAILURE;
+    options.customSettings.emplace_back(customSettingNames[i], customSettingValues[i] ? customSettingValues[i] : "");
+  }
+  ContextManager::Instance().SetEngineOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Applies the members of the JSON object config while requests keep running: the engine, protection,
+// license info and use-license cache sizes, policy and template refresh, and the msipConfigureEngines
+// settings (locale, flighting_features, enable_functionality, disable_functionality, task_timeout_ms,
+// max_file_size_for_protection, and custom_settings, where an empty value removes one). New engine
+// settings replace every cached engine in the background; drain_timeout_seconds bounds how long a replaced
+// engine waits for its callers. An unknown or malformed member fails the call without applying anything.
+// The result JSON lists what was applied.
+extern "C" MSIP_EXPORT int msipReloadConfig(const char *config, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  const int status = RunReloadConfig(config ? config : "", json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Keeps the SDK's storage tables in Redis at redisUrl (redis://[:password@]host[:port][/db]) so replicas
+// share policy and license caches. Takes effect for contexts created afterwards and only for the OnDisk
+// storage types. Rows found by key are served locally for l1TtlSeconds. The columns the SDK marks as encrypted
+// are sealed under the 64 hex digit keyHex, which every replica must share; without it the call fails. Pass an
+// empty url to go back to SQLite.
+extern "C" MSIP_EXPORT int msipConfigureRedisStorage(const char *redisUrl, const char *keyPrefix, int l1TtlSeconds, const char *keyHex)
+{
+  auto& contextManager = ContextManager::Instance();
+  auto options = contextManager.GetStorageOptions();
+  if (!redisUrl || !*redisUrl) {
+    options.storageDelegate.reset();
+    contextManager.SetStorageOptions(options);
+    return EXIT_SUCCESS;
+  }
+
+  try {
+    const string key = sample::storage::EncryptedLogStorageDelegate::ParseHexKey(keyHex ? keyHex : "");
+    auto client = make_shared<sample::storage::RedisClient>(sample::storage::RedisClient::ParseUrl(redisUrl));
+    client->Execute({ "PING" });
+    options.storageDelegate = make_shared<sample::storage::RedisStorageDelegate>(
+        client, keyPrefix && *keyPrefix ? keyPrefix : "msip", std::chrono::seconds(l1TtlSeconds > 0 ? l1TtlSeconds : 0), key);
+  } catch (const std::exception& e) {
+    MSIP_EVENT(mip::LogLevel::Error, "storage_configuration_failed", {"storage", "redis"}, {"error", e.what()});
+    return EXIT_FAILURE;
+  }
+  contextManager.SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+
+// Splits bulk jobs into shards in Redis at redisUrl, under keyPrefix, for every replica configured with
+// the same store to work through. With threads above 0 this replica runs that many shards at a time as
+// workerId (hostname:pid when empty), leased for leaseMs and renewed while they run; a shard whose lease
+// lapses, because its replica died, is taken over by the next worker polling every pollMs. Pass an empty
+// url to stop, after the running shards finish.
+extern "C" MSIP_EXPORT int msipConfigureShards(const char *redisUrl, const char *keyPrefix, const char *workerId, size_t threads, int64_t leaseMs, int64_t pollMs)
+{
+  auto& contextManager = ContextManager::Instance();
+  if (!redisUrl || !*redisUrl) {
+    contextManager.ConfigureShards(nullptr, nullptr);
+    return EXIT_SUCCESS;
+  }
+  if (leaseMs <= 0 || pollMs <= 0)
+    return EXIT_FAILURE;
+
+  shared_ptr<ShardCoordinator> coordinator;
+  try {
+    auto client = make_shared<sample::storage::RedisClient>(sample::storage::RedisClient::ParseUrl(redisUrl));
+    client->Execute({ "PING" });
+    coordinator = make_shared<ShardCoordinator>(client, keyPrefix && *keyPrefix ? keyPrefix : "msip:shards:");
+  } catch (const std::exception& e) {
+    MSIP_EVENT(mip::LogLevel::Error, "shard_configuration_failed", {"error", e.what()});
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<ShardWorker> worker;
+  if (threads > 0) {
+    string id = workerId ? workerId : "";
+    if (id.empty()) {
+      char host[256] = {};
+      gethostname(host, sizeof(host) - 1);
+      id = string(host) + ":" + std::to_string(getpid());
+    }
+    worker.reset(new ShardWorker(
+        coordinator, id, threads, std::chrono::milliseconds(leaseMs), std::chrono::milliseconds(pollMs), RunShard));
+  }
+  contextManager.ConfigureShards(coordinator, std::move(worker));
+  return EXIT_SUCCESS;
+}
+
+// Watches every directory under roots, a comma or newline separated list, and runs operation "status",
+// "unprotect" or "protect" with the parameters of that batch export on each file under them that passes
+// filters (see TreeScanner::ParseFilters) once it is closed after writing or moved in, and has not changed
+// again for settleMs. Files come in batches of at most maxBatch (64 when 0), and a written or removed file's
+// inspection cache entry is dropped first. Each batch's results are written as one JSON line to outputFd,
+// unless it is negative; the descriptor must stay open until the watch stops. Pass empty roots to stop,
+// after the running batch finishes.
+extern "C" MSIP_EXPORT int msipConfigureWatch(const char *roots, const char *filters, const char *operation, const char* protectionToken_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, int outputFd, int64_t settleMs, size_t maxBatch)
+{
+  auto& contextManager = ContextManager::Instance();
+  DirectoryWatcher::Options options;
+  const string list = roots ? roots : "";
+  for (size_t begin = 0; begin < list.size();) {
+    size_t end = list.find_first_of(",\n", begin);
+    if (end == string::npos)
+      end = list.size();
+    const string root = list.substr(begin, end - begin);
+    if (!root.empty())
+      options.roots.push_back(root);
+    begin = end + 1;
+  }
+  if (options.roots.empty()) {
+    contextManager.ConfigureWatcher(nullptr);
+    return EXIT_SUCCESS;
+  }
+  WatchJob job;
+  job.operation = operation ? operation : "";
+  job.token = protectionToken_str ? protectionToken_str : "";
+  job.encryptedFile = encryptedFilePath_str ? encryptedFilePath_str : "";
+  job.user = username_str ? username_str : "";
+  job.applicationId = applicationId_str ? applicationId_str : "";
+  job.outputFd = outputFd;
+  if ((job.operation != "status" && job.operation != "unprotect" && job.operation != "protect") || settleMs < 0)
+    return EXIT_FAILURE;
+  options.extensions = TreeScanner::ParseFilters(filters ? filters : "");
+  options.settle = std::chrono::milliseconds(settleMs);
+  options.maxBatch = maxBatch;
+
+  // The current watcher is stopped first, so a root under both is not reported twice.
+  contextManager.ConfigureWatcher(nullptr);
+  std::unique_ptr<DirectoryWatcher> watcher;
+  try {
+    watcher.reset(new DirectoryWatcher(
+        options, [job](const vector<DirectoryWatcher::Event>& events) { RunWatchBatch(job, events); },
+        [](const string& path, const string& error) {
+          MSIP_EVENT(mip::LogLevel::Warning, "watch_failed", {"path", path}, {"error", error});
+        }));
+  } catch (const std::exception& e) {
+    MSIP_EVENT(mip::LogLevel::Error, "watch_configuration_failed", {"error", e.what()});
+    return EXIT_FAILURE;
+  }
+  contextManager.ConfigureWatcher(std::move(watcher));
+  return EXIT_SUCCESS;
+}
+
+// Records count filePaths as job jobId of shardSize files each, for the replicas' shard workers (see
+// msipConfigureShards) to run as operation "status", "unprotect" or "protect" with the parameters of that
+// batch export. The job's keys, results included, expire after ttlSeconds. Results use the _v2 buffer
+// convention: {"status": true, "job_id": ..., "shards": n}.
+extern "C" MSIP_EXPORT int msipSubmitShardedJob(const char *jobId, const char *operation, const char* protectionToken_str, const char **filePaths, size_t count, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, size_t shardSize, int64_t ttlSeconds, char *out, size_t cap, size_t *needed)
+{
+  auto coordinator = ContextManager::Instance().GetShardCoordinator();
+  const string id = jobId ? jobId : "";
+  ShardCoordinator::Job job;
+  job.operation = operation ? operation : "";
+  job.applicationId = applicationId_str ? applicationId_str : "";
+  job.token = protectionToken_str ? protectionToken_str : "";
+  job.user = username_str ? username_str : "";
+  job.encryptedFile = encryptedFilePath_str ? encryptedFilePath_str : "";
+  string error;
+  if (!coordinator)
+    error = "Shards are not configured";
+  else if (id.empty())
+    error = "Missing job id";
+  else if (job.operation != "status" && job.operation != "unprotect" && job.operation != "protect")
+    error = "Unknown operation " + job.operation;
+  else if (shardSize == 0 || ttlSeconds <= 0)
+    error = "Invalid shard size or TTL";
+  if (!error.empty())
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, error, ""), out, cap, needed);
+
+  vector<string> paths;
+  paths.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    paths.push_back(filePaths[i] ? filePaths[i] : "");
+  int64_t shards = 0;
+  try {
+    shards = coordinator->Submit(id, job, paths, shardSize, std::chrono::seconds(ttlSeconds));
+  } catch (const std::exception& e) {
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, e.what(), ""), out, cap, needed);
+  }
+  JsonWriter json(64 + id.size());
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("job_id").String(id)
+      .Key("shards").Int(shards)
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// Progress of a job submitted through msipSubmitShardedJob: its shards done, leased and pending, and the
+// files that succeeded and failed. "found" is false once the job has expired or was never submitted.
+extern "C" MSIP_EXPORT int msipGetShardedJobProgress(const char *jobId, char *out, size_t cap, size_t *needed)
+{
+  auto coordinator = ContextManager::Instance().GetShardCoordinator();
+  if (!coordinator)
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, "Shards are not configured", ""), out, cap, needed);
+  ShardCoordinator::Progress progress;
+  try {
+    progress = coordinator->GetProgress(jobId ? jobId : "");
+  } catch (const std::exception& e) {
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, e.what(), ""), out, cap, needed);
+  }
+  JsonWriter json(256);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("found").Bool(progress.found)
+      .Key("shards").Int(progress.shards)
+      .Key("files").Int(progress.files)
+      .Key("done").Int(progress.done)
+      .Key("leased").Int(progress.leased)
+      .Key("pending").Int(progress.pending)
+      .Key("succeeded").Int(progress.succeeded)
+      .Key("failed").Int(progress.failed)
+      .Key("stolen").Int(progress.stolen)
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// The results of a job's completed shards in the order they completed, from the first-th on, so a caller
+// can page through them as they arrive: {"status": true, "results": [{"shard": n, "status": ..., "results": ...}]}.
+extern "C" MSIP_EXPORT int msipGetShardedJobResults(const char *jobId, int64_t first, char *out, size_t cap, size_t *needed)
+{
+  auto coordinator = ContextManager::Instance().GetShardCoordinator();
+  if (!coordinator)
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, "Shards are not configured", ""), out, cap, needed);
+  vector<string> results;
+  try {
+    results = coordinator->GetResults(jobId ? jobId : "", first < 0 ? 0 : first);
+  } catch (const std::exception& e) {
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, e.what(), ""), out, cap, needed);
+  }
+  size_t size = 64;
+  for (const auto& result : results)
+    size += result.size() + 2;
+  JsonWriter json(size);
+  json.BeginObject().Key("status").Bool(true).Key("results").BeginArray();
+  for (const auto& result : results)
+    json.Raw(result);
+  json.EndArray().EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+// Keeps the SDK's storage tables in process memory, column by column and sorted by key, within budgetBytes
+// shared by every table; the least recently used rows are evicted beyond it. Takes effect for contexts
+// created afterwards and replaces any Redis storage. Pass 0 to go back to the SDK's own storage.
+extern "C" MSIP_EXPORT int msipConfigureMemoryStorage(uint64_t budgetBytes)
+{
+  auto& contextManager = ContextManager::Instance();
+  auto options = contextManager.GetStorageOptions();
+  if (budgetBytes == 0) {
+    if (std::dynamic_pointer_cast<sample::storage::ColumnarStorageDelegate>(options.storageDelegate))
+      options.storageDelegate.reset();
+  } else {
+    options.storageDelegate = make_shared<sample::storage::ColumnarStorageDelegate>(budgetBytes);
+  }
+  contextManager.SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Keeps the SDK's on-disk storage tables in append-only logs next to its storage path, each record sealed
+// with AES-256-GCM under the 64 hex digit keyHex. Reads map the logs and decrypt only the rows they return;
+// logs mostly made of replaced or deleted records are compacted in the background. Takes effect for contexts
+// created afterwards and replaces any Redis storage. Pass an empty key to go back to the SDK's own storage.
+extern "C" MSIP_EXPORT int msipConfigureEncryptedStorage(const char* keyHex)
+{
+  auto& contextManager = ContextManager::Instance();
+  auto options = contextManager.GetStorageOptions();
+  if (!keyHex || !*keyHex) {
+    if (std::dynamic_pointer_cast<sample::storage::EncryptedLogStorageDelegate>(options.storageDelegate))
+      options.storageDelegate.reset();
+  } else {
+    try {
+      options.storageDelegate = make_shared<sample::storage::EncryptedLogStorageDelegate>(
+          sample::storage::EncryptedLogStorageDelegate::ParseHexKey(keyHex));
+    } catch (const std::exception& e) {
+      MSIP_EVENT(mip::LogLevel::Error, "storage_configuration_failed", {"storage", "encrypted"}, {"error", e.what()});
+      return EXIT_FAILURE;
+    }
+  }
+  contextManager.SetStorageOptions(options);
+  return EXIT_SUCCESS;
+}
+
+// Replaces the SDK logger of contexts created afterwards with an asynchronous one writing JSON lines.
+// level is 0 (trace) to 3 (error), sink is 0 (mip_sdk.log under the storage path) or 1 (stdout) and
+// bufferSize is the number of records queued before new ones are dropped. Call before msipInit.
+extern "C" MSIP_EXPORT int msipConfigureLogging(int level, int sink, size_t bufferSize)
+{
+  if (level < 0 || level > 3 || sink < 0 || sink > 1)
+    return EXIT_FAILURE;
+  ContextManager::Instance().ConfigureLogging(
+      static_cast<mip::LogLevel>(level),
+      sink == 0 ? sample::log::AsyncLoggerDelegate::Sink::File : sample::log::AsyncLoggerDelegate::Sink::Stdout,
+      bufferSize > 0 ? bufferSize : sample::log::AsyncLoggerDelegate::kDefaultCapacity);
+  return EXIT_SUCCESS;
+}
+
+// Changes the log threshold at runtime. Raising it applies at once; records below the level a context
+// was created with are never produced, so lowering it fully applies to contexts created afterwards.
+extern "C" MSIP_EXPORT int msipSetLogLevel(int level)
+{
+  if (level < 0 || level > 3)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetLoggerDelegate()->SetLevel(static_cast<mip::LogLevel>(level));
+  return EXIT_SUCCESS;
+}
+
+// Keeps one record in sampleEvery and at most maxPerSecond records per second (0 for no limit) at level.
+extern "C" MSIP_EXPORT int msipSetLogLimits(int level, unsigned int sampleEvery, unsigned int maxPerSecond)
+{
+  if (level < 0 || level > 3)
+    return EXIT_FAILURE;
+  sample::log::AsyncLoggerDelegate::LevelLimits limits;
+  limits.sampleEvery = sampleEvery;
+  limits.maxPerSecond = maxPerSecond;
+  ContextManager::Instance().GetLoggerDelegate()->SetLevelLimits(static_cast<mip::LogLevel>(level), limits);
+  return EXIT_SUCCESS;
+}
+
+// Makes contexts created afterwards hand over records from level (0 trace to 3 error) up, so they can be
+// traced on demand without a restart while msipSetLogLevel keeps the threshold higher. Records under the
+// threshold are dropped after one relaxed load unless msipSetModuleTrace or msipSetRequestTrace asks for
+// them. Call before msipInit; the shared context keeps the level it was created with.
+extern "C" MSIP_EXPORT int msipSetLogCaptureLevel(int level)
+{
+  if (level < 0 || level > 3)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetLoggerDelegate()->SetCaptureLevel(static_cast<mip::LogLevel>(level));
+  return EXIT_SUCCESS;
+}
+
+// Writes every captured record whose SDK source path contains module, whatever the log level.
+extern "C" MSIP_EXPORT int msipSetModuleTrace(const char *module, int enabled)
+{
+  if (!module || !*module)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetLoggerDelegate()->SetModuleTrace(module, enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// Writes every captured record of the operations the calling thread runs next, and of the SDK work they
+// start, whatever the log level. msipSetTraceContext resets it.
+extern "C" MSIP_EXPORT int msipSetRequestTrace(int enabled)
+{
+  auto context = sample::trace::TraceContext::Current();
+  context.verbose = enabled != 0;
+  sample::trace::TraceContext::SetCurrent(context);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetLogStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetLoggerDelegate()->GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"written\": " << stats.written
+      << ", \"dropped_overflow\": " << stats.droppedOverflow
+      << ", \"dropped_sampled\": " << stats.droppedSampled
+      << ", \"dropped_rate_limited\": " << stats.droppedRateLimited
+      << ", \"dropped_below_level\": " << stats.droppedBelowLevel
+      << ", \"traced_below_level\": " << stats.tracedBelowLevel << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// mode 1 records the SDK's service responses to directory, mode 2 answers SDK requests from the recording
+// there after latencyMs plus up to jitterMs, mode 0 restores the live transport. Applies to contexts
+// created afterwards, so call before msipInit. Fails if a recording to replay cannot be read.
+extern "C" MSIP_EXPORT int msipConfigureHttpReplay(int mode, const char *directory, int latencyMs, int jitterMs)
+{
+  try {
+    sample::http::ReplayHttpDelegate::Settings settings;
+    if (mode == 1 || mode == 2) {
+      settings.mode = mode == 1 ? sample::http::ReplayHttpDelegate::Mode::Record : sample::http::ReplayHttpDelegate::Mode::Replay;
+      settings.directory = directory ? directory : "";
+      if (settings.directory.empty())
+        return EXIT_FAILURE;
+    } else if (mode != 0) {
+      return EXIT_FAILURE;
+    }
+    settings.latency = std::chrono::milliseconds(std::max(latencyMs, 0));
+    settings.jitter = std::chrono::milliseconds(std::max(jitterMs, 0));
+    ContextManager::Instance().ConfigureHttpReplay(settings);
+    return EXIT_SUCCESS;
+  } catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+extern "C" MSIP_EXPORT int msipGetHttpReplayStats(char *result)
+{
+  auto replayDelegate = ContextManager::Instance().GetReplayHttpDelegate();
+  if (!replayDelegate) {
+    strcpy(result, "{\"status\": true, \"enabled\": false}");
+    return EXIT_SUCCESS;
+  }
+  const auto stats = replayDelegate->GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"enabled\": true"
+      << ", \"requests\": " << stats.requests
+      << ", \"exact_matches\": " << stats.exactMatches
+      << ", \"path_matches\": " << stats.pathMatches
+      << ", \"misses\": " << stats.misses
+      << ", \"recorded\": " << stats.recorded
+      << ", \"recordings\": " << stats.recordings
+      << ", \"last_miss\": \"" << escapeJsonString(stats.lastMiss) << "\"}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Caches answers of the Double Key Encryption services under the comma-separated baseUrls for contexts
+// created afterwards: public keys for up to publicKeyTtlSeconds, bounded by the key's own expiry, and
+// unwrap results for up to unwrapTtlSeconds, per caller and key, at most capacity of them. An unwrap
+// result is dropped as soon as its key's public part changes. Empty baseUrls turns the cache off. Call
+// before msipInit.
+extern "C" MSIP_EXPORT int msipConfigureDkeCache(const char *baseUrls, int publicKeyTtlSeconds, int unwrapTtlSeconds, size_t capacity)
+{
+  try {
+    sample::http::DkeCacheHttpDelegate::Settings settings;
+    for (const auto& url : SplitString(baseUrls ? baseUrls : "", ',')) {
+      if (!url.empty())
+        settings.baseUrls.push_back(url);
+    }
+    if (publicKeyTtlSeconds < 0 || unwrapTtlSeconds < 0)
+      return EXIT_FAILURE;
+    settings.publicKeyTtl = std::chrono::seconds(publicKeyTtlSeconds);
+    settings.unwrapTtl = std::chrono::seconds(unwrapTtlSeconds);
+    settings.capacity = capacity;
+    ContextManager::Instance().ConfigureDkeCache(settings);
+    return EXIT_SUCCESS;
+  } catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+// Drops every cached DKE public key and unwrap result, e.g. after a key was revoked.
+extern "C" MSIP_EXPORT int msipClearDkeCache()
+{
+  if (auto dkeDelegate = ContextManager::Instance().GetDkeCacheHttpDelegate())
+    dkeDelegate->Clear();
+  return EXIT_SUCCESS;
+}
+
+// Sends audit and telemetry events of contexts created afterwards to endpoint as gzip-compressed JSON lines,
+// in batches of up to maxBatchEvents, at least every flushIntervalMs. authorization, when not empty, is
+// sent as the Authorization header. An empty endpoint keeps the SDK's own pipeline. Call before msipInit.
+extern "C" MSIP_EXPORT int msipConfigureDiagnosticUpload(const char *endpoint, const char *authorization, size_t queueCapacity,
+                                             size_t maxBatchEvents, int flushIntervalMs)
+{
+  try {
+    sample::diag::DiagnosticUploader::Settings settings;
+    settings.endpoint = endpoint ? endpoint : "";
+    settings.authorization = authorization ? authorization : "";
+    if (queueCapacity > 0)
+      settings.queueCapacity = queueCapacity;
+    if (maxBatchEvents > 0)
+      settings.maxBatchEvents = maxBatchEvents;
+    if (flushIntervalMs > 0)
+      settings.flushInterval = std::chrono::milliseconds(flushIntervalMs);
+    ContextManager::Instance().ConfigureDiagnosticUpload(settings);
+    return EXIT_SUCCESS;
+  } catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+extern "C" MSIP_EXPORT int msipGetDiagnosticUploadStats(char *result)
+{
+  auto uploader = ContextManager::Instance().GetDiagnosticUploader();
+  if (!uploader) {
+    strcpy(result, "{\"status\": true, \"enabled\": false}");
+    return EXIT_SUCCESS;
+  }
+  const auto stats = uploader->GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"enabled\": true"
+      << ", \"queued\": " << stats.queued
+      << ", \"uploaded\": " << stats.uploaded
+      << ", \"batches\": " << stats.batches
+      << ", \"failed_batches\": " << stats.failedBatches
+      << ", \"dropped_overflow\": " << stats.droppedOverflow
+      << ", \"dropped_failed\": " << stats.droppedFailed
+      << ", \"bytes_sent\": " << stats.bytesSent
+      << ", \"pending\": " << stats.pending << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Sets the client secret of the application id. Engines created afterwards use it to acquire tokens
+// in-process once a caller-supplied token has expired. Pass an empty string to clear it.
+extern "C" MSIP_EXPORT int msipSetClientSecret(const char *clientSecret)
+{
+  ContextManager::Instance().SetClientSecret(clientSecret ? clientSecret : "");
+  return EXIT_SUCCESS;
+}
+
+// Unloads cached engines and shuts down every shared MipContext. Must be called before process exit.
+extern "C" MSIP_EXPORT int msipShutdown()
+{
+  try {
+    ContextManager::Instance().ShutDown();
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+// Drops cached state so benchmarks start each operation from a known layer: 0 drops inspection results,
+// protection handlers, licenses and rights, 1 the loaded engines as well, 2 the contexts too, as msipShutdown
+// does. The next operations load what was dropped again.
+extern "C" MSIP_EXPORT int msipDropCaches(int layer)
+{
+  if (layer < 0 || layer > static_cast<int>(ContextManager::CacheLayer::Contexts))
+    return EXIT_FAILURE;
+  try {
+    ContextManager::Instance().DropCaches(static_cast<ContextManager::CacheLayer>(layer));
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+// Writes the warm caches to path, a versioned file of checksummed sections a new replica maps with
+// msipRestore instead of warming up against the services: label indexes of the loaded policy engines, tenant
+// endpoints, inspection results, and, sealed with AES-256-GCM under the 64 hex digit keyHex, rights and
+// license details. Without a key those two are left out. The file is replaced atomically. Results use the
+// _v2 buffer convention: {"status": true, "created_at": ms, "bytes": n, "sealed": ..., "sections": [...]}
+extern "C" MSIP_EXPORT int msipSnapshot(const char *path, const char *keyHex, char *out, size_t cap, size_t *needed)
+{
+  static auto& snapshots = MetricsRegistry::Shared().GetCounter(
+      "msip_native_cache_snapshots_total", "Snapshots of the warm caches written");
+  try {
+    if (!path || !*path)
+      throw std::invalid_argument("A snapshot path is required");
+    const string key = keyHex && *keyHex ? sample::storage::EncryptedLogStorageDelegate::ParseHexKey(keyHex) : string();
+    const string result = SnapshotCaches(path, key);
+    snapshots.Add(1);
+    MSIP_EVENT(mip::LogLevel::Info, "cache_snapshot_written", {"path", path});
+    return WriteResult(EXIT_SUCCESS, result, out, cap, needed);
+  }
+  catch (const std::exception& ex) {
+    MSIP_EVENT(mip::LogLevel::Error, "cache_snapshot_failed", {"error", ex.what()});
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, ex.what(), ""), out, cap, needed);
+  }
+}
+
+// Restores the caches msipSnapshot wrote to path, adding to what is cached and keeping entries with the
+// age they had, so expiry is unchanged. Label indexes need msipConfigureSharedLabels and are installed as
+// the node's shared label snapshots; sealed sections need the keyHex they were written with. Results use
+// the _v2 buffer convention: {"status": true, "created_at": ms, "bytes": n, "restored": {...}, "skipped": [...]}
+extern "C" MSIP_EXPORT int msipRestore(const char *path, const char *keyHex, char *out, size_t cap, size_t *needed)
+{
+  static auto& restores = MetricsRegistry::Shared().GetCounter(
+      "msip_native_cache_restores_total", "Snapshots of the warm caches restored");
+  try {
+    if (!path || !*path)
+      throw std::invalid_argument("A snapshot path is required");
+    const string key = keyHex && *keyHex ? sample::storage::EncryptedLogStorageDelegate::ParseHexKey(keyHex) : string();
+    const string result = RestoreCaches(path, key);
+    restores.Add(1);
+    MSIP_EVENT(mip::LogLevel::Info, "cache_snapshot_restored", {"path", path});
+    return WriteResult(EXIT_SUCCESS, result, out, cap, needed);
+  }
+  catch (const std::exception& ex) {
+    MSIP_EVENT(mip::LogLevel::Error, "cache_restore_failed", {"error", ex.what()});
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, ex.what(), ""), out, cap, needed);
+  }
+}
+
+// Graceful msipShutdown for SIGTERM: turns new operations away with status 3, waits up to timeoutMs for
+// the work in flight, flushes the audit, telemetry and log queues and syncs encrypted storage within
+// flushTimeoutMs, then shuts every MipContext down. Operations are turned away until the process exits.
+// Results use the _v2 buffer convention:
+// {"status": true, "drained": ..., "in_flight": n, "flushed": ..., "synced": ..., "wait_ms": n, "flush_ms": n}
+extern "C" MSIP_EXPORT int msipDrain(int64_t timeoutMs, int64_t flushTimeoutMs, char *out, size_t cap, size_t *needed)
+{
+  try {
+    const auto drain = ContextManager::Instance().Drain(std::chrono::milliseconds(std::max<int64_t>(timeoutMs, 0)),
+        std::chrono::milliseconds(std::max<int64_t>(flushTimeoutMs, 0)));
+    std::ostringstream oss;
+    oss << "{\"status\": true"
+        << ", \"drained\": " << (drain.drained ? "true" : "false")
+        << ", \"in_flight\": " << drain.inFlight
+        << ", \"flushed\": " << (drain.flushed ? "true" : "false")
+        << ", \"synced\": " << (drain.synced ? "true" : "false")
+        << ", \"wait_ms\": " << drain.waited.count()
+        << ", \"flush_ms\": " << drain.flushing.count() << "}";
+    return WriteResult(EXIT_SUCCESS, oss.str(), out, cap, needed);
+  }
+  catch (const std::exception& ex) {
+    return WriteResult(EXIT_FAILURE, string("{\"status\": false, \"error\": \"") + escapeJsonString(ex.what()) + "\"}", out, cap, needed);
+  }
+}
+
+// Stops the library's threads so the caller can fork() with the warmed contexts, engines and caches shared
+// copy-on-write, waiting up to timeoutMs for work in flight to finish. Once fork returns, the parent and
+// the child each call msipResumeAfterFork before anything else. Results use the _v2 buffer convention.
+extern "C" MSIP_EXPORT int msipPrepareFork(int64_t timeoutMs, char *out, size_t cap, size_t *needed)
+{
+  try {
+    ContextManager::Instance().PrepareFork(std::chrono::milliseconds(std::max<int64_t>(timeoutMs, 0)));
+    return WriteResult(EXIT_SUCCESS, "{\"status\": true}", out, cap, needed);
+  }
+  catch (const std::exception& ex) {
+    return WriteResult(EXIT_FAILURE, string("{\"status\": false, \"error\": \"") + escapeJsonString(ex.what()) + "\"}", out, cap, needed);
+  }
+}
+
+// Starts the threads msipPrepareFork stopped, in whichever process calls it.
+extern "C" MSIP_EXPORT int msipResumeAfterFork()
+{
+  ContextManager::Instance().ResumeAfterFork();
+  return EXIT_SUCCESS;
+}
+
+// Closes file sessions left unused for idleSeconds. 0 restores the default of 60 seconds.
+extern "C" MSIP_EXPORT int msipSetFileSessionIdleTimeout(int idleSeconds)
+{
+  if (idleSeconds < 0)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetFileSessions().SetIdleTimeout(std::chrono::seconds(idleSeconds));
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetFileSessionStats(char *result)
+{
+  auto& sessions = ContextManager::Instance().GetFileSessions();
+  auto stats = sessions.GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"open\": " << stats.open
+      << ", \"opened\": " << stats.opened
+      << ", \"expired\": " << stats.expired
+      << ", \"idle_timeout_seconds\": " << std::chrono::duration_cast<std::chrono::seconds>(sessions.GetIdleTimeout()).count() << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Limits the file operations running at once to maxInFlight and the memory they are estimated to hold to
+// memoryBudget bytes; 0 leaves either unbounded. An operation over a limit is not started: its export
+// returns 3 right away with an error result. Batches count as one operation.
+extern "C" MSIP_EXPORT int msipConfigureAdmission(size_t maxInFlight, int64_t memoryBudget)
+{
+  if (memoryBudget < 0)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetAdmissionController().SetLimits(maxInFlight, memoryBudget);
+  return EXIT_SUCCESS;
+}
+
+// Holds each operation type, "status", "unprotect", "protect" and "classify", to a concurrency limit of its
+// own learned from its latency, within minLimit and maxLimit and starting at initialLimit (see
+// adaptive_concurrency_limit.h). The limit grows while latency stays within tolerance times the latency a
+// probe at a lower limit measured, probing again every window operations of the type, and shrinks once it
+// rises beyond. enabled 0 turns it off; msipConfigureAdmission's limits apply either way. Reconfiguring
+// starts every limit afresh.
+extern "C" MSIP_EXPORT int msipConfigureAdaptiveAdmission(int enabled, size_t initialLimit, size_t minLimit, size_t maxLimit,
+                                                double tolerance, size_t window)
+{
+  if (enabled && (minLimit == 0 || maxLimit < minLimit || !(tolerance >= 1.0)))
+    return EXIT_FAILURE;
+  AdaptiveConcurrencyLimit::Options options;
+  options.initialLimit = initialLimit;
+  options.minLimit = minLimit;
+  options.maxLimit = maxLimit;
+  options.tolerance = tolerance;
+  options.minimumWindow = window;
+  ContextManager::Instance().GetAdmissionController().SetAdaptiveLimits(enabled != 0, options);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetAdmissionStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetAdmissionController().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"admitted\": " << stats.admitted
+      << ", \"rejected\": " << stats.rejected
+      << ", \"in_flight\": " << stats.inFlight
+      << ", \"bytes_in_flight\": " << stats.bytesInFlight
+      << ", \"max_in_flight\": " << stats.maxInFlight
+      << ", \"memory_budget\": " << stats.memoryBudget
+      << ", \"tenant_rejected\": " << stats.tenantRejected
+      << ", \"max_in_flight_per_tenant\": " << stats.maxInFlightPerTenant
+      << ", \"bulk_in_flight\": " << stats.bulkInFlight
+      << ", \"bulk_rejected\": " << stats.bulkRejected
+      << ", \"max_bulk_in_flight\": " << stats.maxBulkInFlight
+      << ", \"draining\": " << (stats.draining ? "true" : "false")
+      << ", \"drain_rejected\": " << stats.drainRejected
+      << ", \"adaptive\": " << (stats.adaptive ? "true" : "false")
+      << ", \"adaptive_rejected\": " << stats.adaptiveRejected
+      << ", \"operations\": {";
+  const char* separator = "";
+  for (const auto& operation : ContextManager::Instance().GetAdmissionController().GetOperationStats()) {
+    oss << separator << "\"" << operation.operation << "\": {\"in_flight\": " << operation.inFlight
+        << ", \"limit\": " << operation.limit
+        << ", \"latency_us\": " << operation.latencyMicros
+        << ", \"min_latency_us\": " << operation.minimumLatencyMicros << "}";
+    separator = ", ";
+  }
+  oss << "}}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Probe state read from atomics only, in constant time and without waiting on any lock the request path
+// holds. ready is false while a warm-up or engine restore runs and once draining. overloaded is true at the
+// in-flight limit or after admission control turned work away in the last 10 seconds, so load balancers can
+// shed traffic before callers fail. Outcomes count admitted file operations over the last 10 and 60
+// seconds. Results use the _v2 buffer convention.
+extern "C" MSIP_EXPORT int msipHealth(char *out, size_t cap, size_t *needed)
+{
+  const auto health = ContextManager::Instance().GetHealth();
+  const bool ready = !health.draining && health.warmup != ContextManager::WarmupState::Running;
+  const bool overloaded = (health.maxInFlight > 0 && health.inFlight >= health.maxInFlight) ||
+      health.last10Seconds.rejected > 0;
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"live\": true"
+      << ", \"ready\": " << (ready ? "true" : "false")
+      << ", \"overloaded\": " << (overloaded ? "true" : "false")
+      << ", \"draining\": " << (health.draining ? "true" : "false")
+      << ", \"contexts\": " << health.contexts
+      << ", \"warmup\": \"" << WarmupStateName(health.warmup) << "\""
+      << ", \"engines\": " << health.engines
+      << ", \"engine_capacity\": " << health.engineCapacity;
+  AppendFill(oss, "inspection_cache", health.inspectionCache);
+  AppendFill(oss, "protection_cache", health.protectionCache);
+  AppendFill(oss, "use_license_cache", health.useLicenseCache);
+  AppendFill(oss, "license_info_cache", health.licenseInfoCache);
+  oss << ", \"dispatcher_queue_depth\": " << health.dispatcherQueueDepth
+      << ", \"in_flight\": " << health.inFlight
+      << ", \"max_in_flight\": " << health.maxInFlight;
+  AppendOutcomes(oss, "last_10s", health.last10Seconds);
+  AppendOutcomes(oss, "last_60s", health.last60Seconds);
+  oss << "}";
+  return WriteResult(EXIT_SUCCESS, oss.str(), out, cap, needed);
+}
+
+// Sets the parts of budgets ResourceTuner derived from the cgroup limits, or from memory pressure.
+void ApplyResourceBudgets(const ResourceTuner::Budgets& budgets, int parts) {
+  auto& contextManager = ContextManager::Instance();
+  if (parts & ResourceTuner::kEngineCache)
+    contextManager.GetEngineCache().SetCapacity(budgets.engineCacheSize);
+  if (parts & ResourceTuner::kLicenseCaches) {
+    contextManager.GetProtectionCache().SetCapacity(budgets.protectionCacheSize);
+    contextManager.GetLicenseInfoCache().SetCapacity(budgets.licenseInfoCacheSize);
+    contextManager.GetUseLicenseCache().SetCapacity(budgets.useLicenseCacheSize);
+  }
+  if (parts & ResourceTuner::kBufferPool)
+    BufferPool::Shared().SetMaxRetainedBytes(static_cast<size_t>(budgets.bufferPoolBytes));
+  if (parts & ResourceTuner::kAdmissionBudget) {
+    auto& admission = contextManager.GetAdmissionController();
+    admission.SetLimits(admission.GetStats().maxInFlight, budgets.admissionMemoryBudget);
+  }
+}
+
+string ResourceTunerJSON(bool status) {
+  const auto stats = ResourceTuner::Shared().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": " << (status ? "true" : "false")
+      << ", \"cpus\": " << stats.limits.cpus
+      << ", \"memory_bytes\": " << stats.limits.memoryBytes
+      << ", \"memory_limited\": " << (stats.limits.memoryLimited ? "true" : "false")
+      << ", \"parts\": " << stats.parts
+      << ", \"watching_pressure\": " << (stats.watchingPressure ? "true" : "false")
+      << ", \"shrink\": " << stats.shrink
+      << ", \"pressure_events\": " << stats.pressureEvents
+      << ", \"engine_cache_size\": " << stats.budgets.engineCacheSize
+      << ", \"protection_cache_size\": " << stats.budgets.protectionCacheSize
+      << ", \"license_info_cache_size\": " << stats.budgets.licenseInfoCacheSize
+      << ", \"use_license_cache_size\": " << stats.budgets.useLicenseCacheSize
+      << ", \"buffer_pool_bytes\": " << stats.budgets.bufferPoolBytes
+      << ", \"admission_memory_budget\": " << stats.budgets.admissionMemoryBudget;
+  if (!status)
+    oss << ", \"error\": \"Cannot watch memory.pressure\"";
+  oss << "}";
+  return oss.str();
+}
+
+// Sizes the caches and byte budgets selected by parts (1 engine cache, 2 protection and license caches,
+// 4 buffer pool, 8 admission memory budget) from the cgroup's CPU and memory limits. With watchPressure,
+// they shrink while the cgroup reports memory pressure. The result JSON has the limits and the budgets in
+// effect; status is false, with the budgets applied, when memory.pressure cannot be watched.
+extern "C" MSIP_EXPORT int msipAutoTune(int parts, int watchPressure, char *out, size_t cap, size_t *needed)
+{
+  const bool watching = ResourceTuner::Shared().Start(ApplyResourceBudgets, parts, watchPressure != 0);
+  return WriteResult(watching ? EXIT_SUCCESS : EXIT_FAILURE, ResourceTunerJSON(watching), out, cap, needed);
+}
+
+extern "C" MSIP_EXPORT int msipGetResourceTunerStats(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, ResourceTunerJSON(true), out, cap, needed);
+}
+
+// Caps the bytes of freed input and output buffers kept for reuse across threads (see BufferPool). 0 frees
+// every buffer when it is released.
+extern "C" MSIP_EXPORT int msipConfigureBufferPool(size_t maxRetainedBytes)
+{
+  BufferPool::Shared().SetMaxRetainedBytes(maxRetainedBytes);
+  return EXIT_SUCCESS;
+}
+
+// Temporary files of decrypted content in directory, meant to be a tmpfs, with poolSize of them opened now
+// and recycled instead of closed. Content expected to be larger than maxFileBytes (0 for no limit) goes to
+// fallbackDirectory on disk, P_tmpdir when null or empty. TMPDIR is pointed at directory as well, for the
+// temporary files the SDK creates itself, so call this before msipInit. A null or empty directory turns
+// the pool off and leaves TMPDIR alone. Fails, keeping the previous setting, when directory cannot hold
+// temporary files.
+extern "C" MSIP_EXPORT int msipConfigureTempFiles(const char *directory, size_t poolSize, int64_t maxFileBytes, const char *fallbackDirectory)
+{
+  TempFilePool::Options options;
+  options.directory = directory ? directory : "";
+  options.poolSize = poolSize;
+  options.maxFileBytes = maxFileBytes > 0 ? maxFileBytes : 0;
+  options.fallbackDirectory = fallbackDirectory ? fallbackDirectory : "";
+  try {
+    TempFilePool::Shared().Configure(options);
+  } catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+  if (!options.directory.empty())
+    setenv("TMPDIR", options.directory.c_str(), 1);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetTempFileStats(char *result)
+{
+  auto stats = TempFilePool::Shared().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"enabled\": " << (stats.enabled ? "true" : "false")
+      << ", \"acquired\": " << stats.acquired
+      << ", \"reused\": " << stats.reused
+      << ", \"created\": " << stats.created
+      << ", \"fallbacks\": " << stats.fallbacks
+      << ", \"free\": " << stats.free
+      << ", \"pool_size\": " << stats.poolSize << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetBufferPoolStats(char *result)
+{
+  auto stats = BufferPool::Shared().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"oversized\": " << stats.oversized
+      << ", \"remote_hits\": " << stats.remoteHits
+      << ", \"retained_bytes\": " << stats.retainedBytes
+      << ", \"max_retained_bytes\": " << stats.maxRetainedBytes << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Heap figures of the allocator the library was built with (see SConstruct's --allocator), one entry per
+// arena, written like the other *_v2 results since the arena list grows with the thread count.
+extern "C" MSIP_EXPORT int msipGetAllocatorStats(char *out, size_t cap, size_t *needed)
+{
+  const auto stats = AllocatorStats::Read();
+  JsonWriter json(256 + stats.arenas.size() * 96);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("allocator").String(stats.allocator, strlen(stats.allocator))
+      .Key("allocated").UInt(stats.allocated)
+      .Key("active").UInt(stats.active)
+      .Key("resident").UInt(stats.resident)
+      .Key("mapped").UInt(stats.mapped)
+      .Key("retained").UInt(stats.retained)
+      .Key("process_resident").UInt(stats.processResident)
+      .Key("arenas").BeginArray();
+  for (const auto& arena : stats.arenas) {
+    json.BeginObject()
+        .Key("index").UInt(arena.index)
+        .Key("allocated").UInt(arena.allocated)
+        .Key("mapped").UInt(arena.mapped)
+        .Key("threads").UInt(arena.threads)
+        .EndObject();
+  }
+  json.EndArray().EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Str(), out, cap, needed);
+}
+
+// Charges each tenant's operations, per type, for the thread CPU time, bytes read and written, HTTP
+// requests and bytes and cache lookups they cost, and the tenant's HTTP requests and bytes per host (see
+// cost_account.h). The totals are exported by msipGetCosts and msipGetMetrics. enabled 0 stops charging;
+// what was charged is kept.
+extern "C" MSIP_EXPORT int msipConfigureCostAccounting(int enabled)
+{
+  sample::cost::SetEnabled(enabled != 0);
+  return EXIT_SUCCESS;
+}
+
+// What each tenant was charged since the library loaded (see msipConfigureCostAccounting), written like the
+// other *_v2 results since it grows with the tenants.
+extern "C" MSIP_EXPORT int msipGetCosts(char *out, size_t cap, size_t *needed)
+{
+  using sample::cost::Counter;
+  const auto costs = sample::cost::GetSnapshot();
+  auto value = [](const sample::cost::Entry& entry, Counter counter) {
+    return entry.values[static_cast<size_t>(counter)];
+  };
+  JsonWriter json(256 + (costs.operations.size() + costs.hosts.size()) * 256);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("enabled").Bool(costs.enabled)
+      .Key("keys").UInt(costs.keys)
+      .Key("operations").BeginArray();
+  for (const auto& entry : costs.operations) {
+    const uint64_t lookups = value(entry, Counter::CacheHits) + value(entry, Counter::CacheMisses);
+    json.BeginObject()
+        .Key("tenant").String(entry.tenant)
+        .Key("operation").String(entry.name)
+        .Key("operations").UInt(value(entry, Counter::Operations))
+        .Key("cpu_us").UInt(value(entry, Counter::CpuMicros))
+        .Key("read_bytes").UInt(value(entry, Counter::BytesRead))
+        .Key("written_bytes").UInt(value(entry, Counter::BytesWritten))
+        .Key("http_requests").UInt(value(entry, Counter::HttpRequests))
+        .Key("http_bytes").UInt(value(entry, Counter::HttpBytes))
+        .Key("cache_hits").UInt(value(entry, Counter::CacheHits))
+        .Key("cache_misses").UInt(value(entry, Counter::CacheMisses))
+        .Key("cache_hit_ratio");
+    if (lookups > 0)
+      json.Double(static_cast<double>(value(entry, Counter::CacheHits)) / lookups);
+    else
+      json.Null();
+    json.EndObject();
+  }
+  json.EndArray().Key("hosts").BeginArray();
+  for (const auto& entry : costs.hosts) {
+    json.BeginObject()
+        .Key("tenant").String(entry.tenant)
+        .Key("host").String(entry.name)
+        .Key("http_requests").UInt(value(entry, Counter::HttpRequests))
+        .Key("http_bytes").UInt(value(entry, Counter::HttpBytes))
+        .EndObject();
+  }
+  json.EndArray().EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Str(), out, cap, needed);
+}
+
+// Caps what each application id may hold: loaded engines, cached use and delegation licenses and rights, and file
+// operations in flight. A tenant over a cap gives up its own least recently used entries, or has its
+// operations rejected, instead of taking capacity from other tenants. 0 lifts a cap.
+extern "C" MSIP_EXPORT int msipConfigureTenantQuotas(size_t maxEngines, size_t maxLicenses, size_t maxInFlight)
+{
+  auto& contextManager = ContextManager::Instance();
+  contextManager.GetEngineCache().SetTenantCapacity(maxEngines);
+  contextManager.GetUseLicenseCache().SetTenantCapacity(maxLicenses);
+  contextManager.GetDelegationLicenseCache().SetTenantCapacity(maxLicenses);
+  contextManager.GetRightsCache().SetTenantCapacity(maxLicenses);
+  contextManager.GetAdmissionController().SetTenantLimit(maxInFlight);
+  return EXIT_SUCCESS;
+}
+
+// Reserves reservedWorkers of the task dispatcher's workers for interactive tasks, or keeps the default
+// of a quarter of them when negative, and bounds the bulk file operations in flight, 0 for no bound
+// beyond msipConfigureAdmission's.
+extern "C" MSIP_EXPORT int msipConfigurePriorities(int reservedWorkers, size_t maxBulkInFlight)
+{
+  auto& contextManager = ContextManager::Instance();
+  if (reservedWorkers >= 0)
+    contextManager.GetTaskDispatcher()->SetReservedWorkers(static_cast<size_t>(reservedWorkers));
+  contextManager.GetAdmissionController().SetBulkLimit(maxBulkInFlight);
+  return EXIT_SUCCESS;
+}
+
+// Sets how many of an application's SDK tasks run per turn when tenants compete for the task
+// dispatcher's workers. Tenants default to 1.
+extern "C" MSIP_EXPORT int msipSetTenantWeight(const char *applicationId_str, int weight)
+{
+  if (!applicationId_str || weight < 1)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetTaskDispatcher()->SetTenantWeight(applicationId_str, weight);
+  return EXIT_SUCCESS;
+}
+
+// Sets the maximum number of engines kept loaded. Least recently used engines beyond it are unloaded.
+extern "C" MSIP_EXPORT int msipSetEngineCacheSize(size_t maxEngines)
+{
+  ContextManager::Instance().GetEngineCache().SetCapacity(maxEngines);
+  return EXIT_SUCCESS;
+}
+
+// Sets the maximum number of policy engines, used by label operations, within the engine cache. Least
+// recently used policy engines beyond it are unloaded while protection-only engines stay. 0 lifts the cap.
+extern "C" MSIP_EXPORT int msipSetPolicyEngineCacheSize(size_t maxPolicyEngines)
+{
+  ContextManager::Instance().GetEngineCache().SetPolicyCapacity(maxPolicyEngines);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetEngineCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetEngineCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity
+      << ", \"policy_engines\": " << stats.policyEngines
+      << ", \"policy_capacity\": " << stats.policyCapacity
+      << ", \"tenant_capacity\": " << stats.tenantCapacity
+      << ", \"policy_refreshes\": " << stats.policyRefreshes
+      << ", \"policy_refresh_failures\": " << stats.policyRefreshFailures
+      << ", \"reloads\": " << stats.reloads
+      << ", \"reload_failures\": " << stats.reloadFailures
+      << ", \"draining\": " << stats.draining
+      << ", \"hibernations\": " << stats.hibernations
+      << ", \"restores\": " << stats.restores
+      << ", \"restore_ms\": " << stats.restoreMs
+      << ", \"hibernated\": " << stats.hibernated << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// The affinity key of a request of applicationId for username (see EngineCache::MakeAffinityKey), for an
+// ingress or sidecar that consistent-hashes requests to pods, so that each engine, and the licenses cached
+// with it, is warm on one pod instead of every pod. username is the engine's identity unless a service
+// identity is configured for the application (see msipConfigureDelegatedIdentity), which every user shares. The
+// key is "<applicationId>/<16 hex digits of FNV-1a 64 of the lowercased identity>", so a router can also
+// compute it itself. warm is whether that identity's protection engine is loaded on this pod.
+extern "C" MSIP_EXPORT int msipGetAffinityKey(const char *applicationId_str, const char *username_str, char *out, size_t cap, size_t *needed)
+{
+  const string applicationId = applicationId_str ? applicationId_str : "";
+  if (applicationId.empty())
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, "Missing application id", ""), out, cap, needed);
+  const EngineCache::Key engineKey = ServiceEngineKey({ applicationId, username_str ? username_str : "", "", "", true /*protectionOnly*/, false /*msgContainers*/ });
+  JsonWriter json(256);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("key").String(EngineCache::MakeAffinityKey(applicationId, engineKey.username))
+      .Key("tenant").String(applicationId)
+      .Key("warm").Bool(ContextManager::Instance().GetEngineCache().Contains(engineKey))
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Str(), out, cap, needed);
+}
+
+// The tenants warm on this pod: each application with engines loaded, or licenses cached, with how many
+// of each and how long since its engines were last used, for a router to prefer pods that already hold a
+// tenant (see msipGetAffinityKey).
+extern "C" MSIP_EXPORT int msipGetWarmTenants(char *out, size_t cap, size_t *needed)
+{
+  struct Warm {
+    size_t engines = 0;
+    size_t policyEngines = 0;
+    int64_t idleMs = -1;
+    size_t licenses = 0;
+  };
+  auto& contextManager = ContextManager::Instance();
+  std::map<string, Warm> tenants;
+  for (const auto& tenant : contextManager.GetEngineCache().GetTenants()) {
+    Warm& warm = tenants[tenant.applicationId];
+    warm.engines = tenant.engines;
+    warm.policyEngines = tenant.policyEngines;
+    warm.idleMs = tenant.idleMs;
+  }
+  for (const auto& sizes : { contextManager.GetUseLicenseCache().GetTenantSizes(),
+                             contextManager.GetDelegationLicenseCache().GetTenantSizes(),
+                             contextManager.GetRightsCache().GetTenantSizes() }) {
+    for (const auto& size : sizes)
+      tenants[size.first].licenses += size.second;
+  }
+  JsonWriter json(64 + tenants.size() * 128);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("tenants").BeginArray();
+  for (const auto& tenant : tenants) {
+    json.BeginObject()
+        .Key("application_id").String(tenant.first)
+        .Key("engines").UInt(tenant.second.engines)
+        .Key("policy_engines").UInt(tenant.second.policyEngines)
+        .Key("licenses").UInt(tenant.second.licenses)
+        .Key("idle_ms");
+    if (tenant.second.idleMs >= 0)
+      json.Int(tenant.second.idleMs);
+    else
+      json.Null();
+    json.EndObject();
+  }
+  json.EndArray().EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Str(), out, cap, needed);
+}
+
+// Replaces cached policy engines in the background once their policy is older than ttlSeconds, so labels
+// stay current without a request ever waiting on a policy download. 0 turns refreshing off.
+extern "C" MSIP_EXPORT int msipSetPolicyRefresh(int ttlSeconds)
+{
+  if (ttlSeconds < 0)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetEngineCache().SetPolicyRefresh(std::chrono::seconds(ttlSeconds));
+  return EXIT_SUCCESS;
+}
+
+// Unloads cached engines once unused for idleSeconds, keeping their engine ids, so a tenant that comes back
+// is restored from the profile storage instead of bootstrapped. 0 turns hibernation off.
+extern "C" MSIP_EXPORT int msipSetEngineIdleTimeout(int idleSeconds)
+{
+  if (idleSeconds < 0)
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetEngineCache().SetIdleTimeout(std::chrono::seconds(idleSeconds));
+  return EXIT_SUCCESS;
+}
+
+// Refreshes template catalogues in the background once they are older than refreshSeconds, and reuses
+// label rights that long. 0 restores the default of an hour.
+extern "C" MSIP_EXPORT int msipSetTemplateRefresh(int refreshSeconds)
+{
+  if (refreshSeconds < 0)
+    return EXIT_FAILURE;
+  TemplateCatalog::SetRefreshInterval(std::chrono::seconds(refreshSeconds));
+  return EXIT_SUCCESS;
+}
+
+// Enables the protection-status cache used by getFileStatus. capacity 0 disables it, ttlSeconds 0 keeps
+// entries until the file changes, and verifyContent also hashes the first and last 4 KiB on every hit.
+extern "C" MSIP_EXPORT int msipConfigureInspectionCache(size_t capacity, int ttlSeconds, int verifyContent)
+{
+  ContextManager::Instance().GetInspectionCache().Configure(
+      capacity, std::chrono::seconds(ttlSeconds > 0 ? ttlSeconds : 0), verifyContent != 0);
+  return EXIT_SUCCESS;
+}
+
+// Enables the known-clean filter that getObjectStatus consults before probing an object, keyed by its
+// entity tag and size. capacity keys per generation are held at falsePositiveRate, every key is probed again within
+// maxAgeSeconds (0 for never), and one positive answer in verifyOneIn is probed anyway. With a path the
+// filter is read back from it when it was saved with the same capacity and rate, and saved there on
+// shutdown. capacity 0 disables it, after saving it.
+extern "C" MSIP_EXPORT int msipConfigureKnownClean(size_t capacity, double falsePositiveRate, int64_t maxAgeSeconds, uint32_t verifyOneIn, const char *path)
+{
+  auto& knownClean = ContextManager::Instance().GetKnownCleanFilter();
+  if (maxAgeSeconds < 0)
+    return EXIT_FAILURE;
+  KnownCleanFilter::Settings settings;
+  settings.capacity = capacity;
+  settings.falsePositiveRate = falsePositiveRate;
+  settings.maxAge = std::chrono::seconds(maxAgeSeconds);
+  settings.verifyOneIn = verifyOneIn;
+  settings.path = path ? path : "";
+  knownClean.Save();
+  try {
+    const bool loaded = knownClean.Configure(settings);
+    MSIP_EVENT(mip::LogLevel::Info, "known_clean_configured", {"capacity", std::to_string(capacity)}, {"loaded", loaded ? "true" : "false"});
+  } catch (const std::exception& e) {
+    MSIP_EVENT(mip::LogLevel::Error, "known_clean_configuration_failed", {"error", e.what()});
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetInspectionCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetInspectionCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Sets how many reference-file protections protectFile keeps per engine and path. 0 disables the cache.
+extern "C" MSIP_EXPORT int msipSetProtectionCacheSize(size_t maxEntries)
+{
+  ContextManager::Instance().GetProtectionCache().SetCapacity(maxEntries);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetProtectionCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetProtectionCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Sets how many parsed publishing licenses inspectLicense keeps. 0 disables the cache.
+extern "C" MSIP_EXPORT int msipSetLicenseInfoCacheSize(size_t maxEntries)
+{
+  ContextManager::Instance().GetLicenseInfoCache().SetCapacity(maxEntries);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetLicenseInfoCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetLicenseInfoCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// Sets how many (user, content id) licenses prefetchLicenses remembers as held. 0 disables the cache.
+extern "C" MSIP_EXPORT int msipSetUseLicenseCacheSize(size_t maxEntries)
+{
+  ContextManager::Instance().GetUseLicenseCache().SetCapacity(maxEntries);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetUseLicenseCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetUseLicenseCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// capacity 0 disables the delegation license cache. ttlSeconds 0 keeps licenses until evicted or expired.
+extern "C" MSIP_EXPORT int msipConfigureDelegationLicenseCache(size_t capacity, int ttlSeconds)
+{
+  ContextManager::Instance().GetDelegationLicenseCache().Configure(capacity, std::chrono::seconds(ttlSeconds > 0 ? ttlSeconds : 0));
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetDelegationLicenseCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetDelegationLicenseCache().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+// capacity 0 disables the rights cache. ttlSeconds 0 keeps rights until evicted or the content expires.
+extern "C" MSIP_EXPORT int msipConfigureRightsCache(size_t capacity, int ttlSeconds)
+{
+  ContextManager::Instance().GetRightsCache().Configure(capacity, std::chrono::seconds(ttlSeconds > 0 ? ttlSeconds : 0));
+  return EXIT_SUCCESS;
+}
+
+// Keeps the plaintext of unprotected files in memory, sealed under a key that never leaves the process, so
+// the next unprotect of the same file by the same identity writes it out without a decrypt. Entries are only
+// served while the rights cache still grants EXPORT, so they never outlive msipConfigureRightsCache's TTL.
+// capacityBytes 0, the default, disables the cache. maxEntryBytes 0 caches files up to an eighth of it.
+extern "C" MSIP_EXPORT int msipConfigureDecryptedContentCache(size_t capacityBytes, size_t maxEntryBytes)
+{
+  ContextManager::Instance().GetDecryptedContentCache().Configure(capacityBytes, maxEntryBytes);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipClearDecryptedContentCache()
+{
+  ContextManager::Instance().GetDecryptedContentCache().Clear();
+  return EXIT_SUCCESS;
+}
+
+// Keeps the small reads an input's container structure was parsed from (ZIP and CFB directories, the
+// publishing license and label parts) for ttlMs, so the next operation on the same unchanged file reads
+// them from memory. capacity, in files, 0 disables the cache, the default. maxBytesPerFile 0 records up to
+// 256 KiB of each file.
+extern "C" MSIP_EXPORT int msipConfigureContainerCache(size_t capacity, int ttlMs, size_t maxBytesPerFile)
+{
+  ContextManager::Instance().GetContainerStructureCache().Configure(
+      capacity, std::chrono::milliseconds(ttlMs > 0 ? ttlMs : 0), maxBytesPerFile);
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipClearContainerCache()
+{
+  ContextManager::Instance().GetContainerStructureCache().Clear();
+  return EXIT_SUCCESS;
+}
+
+// capacity 0 disables the tenant endpoint cache. ttlSeconds 0 keeps tenants until evicted.
+extern "C" MSIP_EXPORT int msipConfigureTenantCache(size_t capacity, int ttlSeconds)
+{
+  ContextManager::Instance().GetTenantEndpoints().Configure(capacity, std::chrono::seconds(ttlSeconds > 0 ? ttlSeconds : 0));
+  return EXIT_SUCCESS;
+}
+
+// Routes applicationId's service calls to its region, or every tenant's without a region of their own when
+// applicationId is empty or null. dataBoundary is a mip::DataBoundary (0 for none, 1 United States,
+// 2 European Union, 3 Germany, 4 Japan, 5 Australia) set on engines loaded afterwards. dnsRedirection 0
+// keeps profiles created afterwards from following the DNS record of the user's domain. Endpoints the
+// tenant endpoint cache learned before may be another region's, so it is cleared.
+extern "C" MSIP_EXPORT int msipConfigureRegion(const char *applicationId_str, int dataBoundary, int dnsRedirection)
+{
+  if (dataBoundary < static_cast<int>(mip::DataBoundary::Default) || dataBoundary > static_cast<int>(mip::DataBoundary::Australia))
+    return EXIT_FAILURE;
+  ContextManager::RegionOptions options;
+  options.dataBoundary = static_cast<mip::DataBoundary>(dataBoundary);
+  options.dnsRedirection = dnsRedirection != 0 ? mip::DnsRedirection::MDEDiscovery : mip::DnsRedirection::Disabled;
+  auto& contextManager = ContextManager::Instance();
+  contextManager.SetRegionOptions(applicationId_str ? applicationId_str : "", options);
+  contextManager.GetTenantEndpoints().Clear();
+  return EXIT_SUCCESS;
+}
+
+// Puts applicationId in delegated mode: its engines load once as serviceIdentity, which needs the rights to
+// act for the application's users, and each protect or label operation publishes for the user it was called
+// with. An empty or null serviceIdentity returns to one engine per user. Applies to engines looked up afterwards;
+// users' engines loaded before are evicted as usual.
+extern "C" MSIP_EXPORT int msipConfigureDelegatedIdentity(const char *applicationId_str, const char *serviceIdentity_str)
+{
+  if (!applicationId_str || !*applicationId_str)
+    return EXIT_FAILURE;
+  ContextManager::Instance().SetServiceIdentity(applicationId_str, serviceIdentity_str ? serviceIdentity_str : "");
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetTenantCacheStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetTenantEndpoints().GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"hits\": " << stats.hits
+      << ", \"misses\": " << stats.misses
+      << ", \"evictions\": " << stats.evictions
+      << ", \"size\": " << stats.size
+      << ", \"capacity\": " << stats.capacity << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+extern "C" MSIP_EXPORT int msipGetTaskDispatcherStats(char *result)
+{
+  auto stats = ContextManager::Instance().GetTaskDispatcher()->GetStats();
+  std::ostringstream oss;
+  oss << "{\"status\": true"
+      << ", \"workers\": " << stats.workers
+      << ", \"queue_depth\": " << stats.queueDepth
+      << ", \"delayed\": " << stats.delayed
+      << ", \"executed\": " << stats.executed
+      << ", \"steals\": " << stats.steals
+      << ", \"cancelled\": " << stats.cancelled
+      << ", \"reserved_workers\": " << stats.reservedWorkers
+      << ", \"bulk_queue_depth\": " << stats.bulkQueueDepth
+      << ", \"bulk_executed\": " << stats.bulkExecuted << "}";
+  strcpy(result, oss.str().c_str());
+  return EXIT_SUCCESS;
+}
+
+
+// Latency of context creation, profile and engine loads, handler creation, license acquisition, commits
+// and shutdown, summed over every thread, of HTTP requests per host, and lock waits and holds per lock, as
+// histograms.
+extern "C" MSIP_EXPORT int msipGetMetrics(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, PhaseMetricsJSON(), out, cap, needed);
+}
+
+// Times one acquisition in every sampleEvery of each instrumented native lock, per thread; 1 times every
+// acquisition and 0 none. Contention is counted regardless. Applies at once to every lock.
+extern "C" MSIP_EXPORT int msipConfigureLockMetrics(uint32_t sampleEvery)
+{
+  sample::lock::SetSampling(sampleEvery);
+  return EXIT_SUCCESS;
+}
+
+
+// Every native metric in Prometheus text exposition format, written like the other *_v2 results.
+extern "C" MSIP_EXPORT int msipRenderMetrics(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, RenderPrometheus(), out, cap, needed);
+}
+
+
+// msipRenderMetrics without the latency histograms, which msipGetMetrics returns in bulk as JSON. A collector
+// that scrapes often reads both and skips parsing the histograms' text, which is most of the output.
+extern "C" MSIP_EXPORT int msipRenderCounters(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, RenderPrometheus(false), out, cap, needed);
+}
+
+
+// Sets the W3C traceparent of the operation the calling thread is about to run; SDK work it starts
+// inherits it. An empty or malformed value clears it, and nothing is recorded without a sampled context.
+extern "C" MSIP_EXPORT int msipSetTraceContext(const char *traceparent)
+{
+  const auto context = sample::trace::TraceContext::Parse(traceparent ? traceparent : "");
+  sample::trace::TraceContext::SetCurrent(context);
+  return context.IsValid() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Gives the operations the calling thread runs next timeoutMs to finish, usually what is left of the
+// caller's gRPC deadline. Engine loads and file handler creation still waiting then are cancelled and
+// fail with "Deadline exceeded", and HTTP requests made on their behalf time out with them. 0 clears it.
+extern "C" MSIP_EXPORT int msipSetDeadline(int64_t timeoutMs)
+{
+  sample::deadline::Deadline::SetCurrent(timeoutMs > 0
+      ? sample::deadline::Deadline::After(std::chrono::milliseconds(timeoutMs))
+      : sample::deadline::Deadline());
+  return EXIT_SUCCESS;
+}
+
+
+// Tags the next protect, unprotect or other admitted operation the calling thread runs with key, usually
+// one the caller keeps across its retries; empty clears it. Another call with the same key and the same
+// paths, while the first runs or after it succeeded, returns the first one's result instead of running
+// again (see msipConfigureIdempotency). Clear it after the call, since calls that fail before admission
+// leave it set.
+extern "C" MSIP_EXPORT int msipSetIdempotencyKey(const char *key)
+{
+  IdempotencyCache::SetCurrentKey(key ? key : "");
+  return EXIT_SUCCESS;
+}
+
+// Keeps the results of up to capacity operations tagged through msipSetIdempotencyKey for ttlSeconds, 0
+// to keep them until evicted. A capacity of 0, the default, ignores the keys.
+extern "C" MSIP_EXPORT int msipConfigureIdempotency(size_t capacity, int64_t ttlSeconds)
+{
+  if (ttlSeconds < 0)
+    return EXIT_FAILURE;
+  IdempotencyCache::Instance().Configure(capacity, std::chrono::seconds(ttlSeconds));
+  return EXIT_SUCCESS;
+}
+
+
+// Sets the priority of the operations the calling thread runs next: 0 interactive, the default, or 1
+// bulk. Bulk operations are admitted within their own limit (see msipConfigurePriorities), fan out to
+// fewer batch threads, and their SDK tasks wait for interactive ones and stay off reserved workers.
+extern "C" MSIP_EXPORT int msipSetPriority(int priority)
+{
+  if (priority < static_cast<int>(sample::priority::Priority::Interactive) || priority > static_cast<int>(sample::priority::Priority::Bulk))
+    return EXIT_FAILURE;
+  sample::priority::SetCurrent(static_cast<sample::priority::Priority>(priority));
+  return EXIT_SUCCESS;
+}
+
+// Streams the results of the batch exports the calling thread runs next as NDJSON, one
+// {"index": i, "result": ...} line per file as soon as it finishes, instead of returning them as one array:
+// to callback when given, else to outputFd, which stays open for the caller. Lines are written once
+// flushBytes are buffered (0 for 64 KiB) and at least every flushMs (0 for 100 ms, negative for only on
+// size). A streamed batch returns a summary with the lines written and whether every write succeeded.
+// Covers getFileStatusBatch, the unprotect, protect, template, permission and label batches and
+// classifyFiles. outputFd -1 without a callback goes back to returning arrays.
+extern "C" MSIP_EXPORT int msipStreamBatchResults(int outputFd, BatchResultSink::Callback callback, void *userData, size_t flushBytes, int flushMs)
+{
+  BatchResultSink::Settings settings;
+  settings.fd = outputFd;
+  settings.callback = callback;
+  settings.userData = userData;
+  if (flushBytes > 0)
+    settings.flushBytes = flushBytes;
+  if (flushMs != 0)
+    settings.flushInterval = std::chrono::milliseconds(flushMs > 0 ? flushMs : 0);
+  if (outputFd < 0 && !callback)
+    BatchResultSink::ClearCurrent();
+  else
+    BatchResultSink::SetCurrent(settings);
+  return EXIT_SUCCESS;
+}
+
+
+// Starts sampling the whole process's stacks hz times per CPU second, keeping at most maxSamples of them.
+// Fails when a profile is already running, or on hz outside 1..1000.
+extern "C" MSIP_EXPORT int msipStartCpuProfile(int hz, int64_t maxSamples)
+{
+  if (maxSamples <= 0)
+    return EXIT_FAILURE;
+  return CpuProfiler::Instance().Start(hz, static_cast<size_t>(maxSamples)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Stops the running profile and writes it to outputPath as gzipped pprof, which `go tool pprof` reads
+// directly. The result has the samples taken, those dropped on a full buffer and the profile's duration.
+extern "C" MSIP_EXPORT int msipStopCpuProfile(const char *outputPath_str, char *out, size_t cap, size_t *needed)
+{
+  CpuProfiler::Result result = {};
+  string error;
+  const bool written = CpuProfiler::Instance().Stop(string(outputPath_str), &result, &error);
+  std::ostringstream oss;
+  oss << "{\"status\": " << (written ? "true" : "false")
+      << ", \"path\": \"" << escapeJsonString(outputPath_str) << "\""
+      << ", \"samples\": " << result.samples
+      << ", \"dropped\": " << result.dropped
+      << ", \"duration_ms\": " << result.durationMs;
+  if (!written)
+    oss << ", \"error\": \"" << escapeJsonString(error) << "\"";
+  oss << "}";
+  return WriteResult(written ? EXIT_SUCCESS : EXIT_FAILURE, oss.str(), out, cap, needed);
+}
+
+
+// Lets signum toggle a profile of at most seconds, written to directory/cpu-<pid>-<unix time>.pb.gz, so a
+// production process can be profiled with kill and no attached debugger. Can only be enabled once.
+extern "C" MSIP_EXPORT int msipEnableCpuProfileSignal(int signum, int hz, int seconds, const char *directory_str)
+{
+  return CpuProfiler::Instance().EnableSignal(signum, hz, seconds, string(directory_str)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Turns away inputs larger than maxInputBytes (0 lifts the limit) and, with checkContent, inputs whose
+// Office, PDF or message extension does not match their content, before an engine or handler is built.
+extern "C" MSIP_EXPORT int msipConfigureFormatGate(int checkContent, int64_t maxInputBytes)
+{
+  if (maxInputBytes < 0)
+    return EXIT_FAILURE;
+  FormatGate::Instance().Configure(checkContent != 0, maxInputBytes);
+  return EXIT_SUCCESS;
+}
+
+// Gives every file operation a budget of cpuMs of CPU time and outputBytes written (0 lifts either), read
+// from the thread CPU clocks and byte counts of its streams. An operation over budget is cancelled and
+// its input quarantined for quarantineSeconds, so retries of the same content fail at once; 0 turns the
+// quarantine off.
+extern "C" MSIP_EXPORT int msipConfigureOperationBudget(int64_t cpuMs, int64_t outputBytes, int quarantineSeconds)
+{
+  if (cpuMs < 0 || outputBytes < 0 || quarantineSeconds < 0)
+    return EXIT_FAILURE;
+  OperationBudget::Limits limits;
+  limits.cpuMs = cpuMs;
+  limits.outputBytes = outputBytes;
+  OperationBudget::Configure(limits);
+  InputQuarantine::Instance().SetTtl(std::chrono::seconds(quarantineSeconds));
+  return EXIT_SUCCESS;
+}
+
+// Keeps the capacity most recent protect and unprotect operations that take thresholdMs or longer, with
+// the phases, HTTP requests and cache lookups they went through, and logs each one as a warning. A
+// threshold of 0 stops recording.
+extern "C" MSIP_EXPORT int msipConfigureSlowOperations(int64_t thresholdMs, size_t capacity)
+{
+  if (thresholdMs < 0)
+    return EXIT_FAILURE;
+  SlowOperationRecorder::Instance().Configure(thresholdMs, capacity);
+  return EXIT_SUCCESS;
+}
+
+
+// Removes and returns the slow operations kept so far, oldest first.
+extern "C" MSIP_EXPORT int msipTakeSlowOperations(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, SlowOperationRecorder::Instance().TakeJSON(), out, cap, needed);
+}
+
+
+// Records the shape of every operation admission control runs into path, for msip_loadgen --capture to
+// replay: the operation, its input's format, file count and size, a hash of the tenant, the duration, the
+// status and the cache hits and misses, never the files' names or content (see traffic_capture.h). Keeps
+// one operation in sampleEvery and stops recording after maxRecords, 0 for no limit. Starting again
+// replaces the capture in progress.
+extern "C" MSIP_EXPORT int msipStartCapture(const char *path, uint32_t sampleEvery, uint64_t maxRecords)
+{
+  if (!path || !*path)
+    return EXIT_FAILURE;
+  try {
+    TrafficCapture::Instance().Start(path, sampleEvery, maxRecords);
+    MSIP_EVENT(mip::LogLevel::Info, "traffic_capture_started", {"path", path});
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    MSIP_EVENT(mip::LogLevel::Error, "traffic_capture_failed", {"path", path}, {"error", ex.what()});
+    return EXIT_FAILURE;
+  }
+}
+
+// Stops the traffic capture and flushes it. Results use the _v2 buffer convention:
+// {"status": true, "path": ..., "recorded": n, "sampled_out": n, "over_limit": n}
+extern "C" MSIP_EXPORT int msipStopCapture(char *out, size_t cap, size_t *needed)
+{
+  const auto stats = TrafficCapture::Instance().Stop();
+  JsonWriter json(256 + stats.path.size());
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("path").String(stats.path)
+      .Key("recorded").UInt(stats.recorded)
+      .Key("sampled_out").UInt(stats.sampledOut)
+      .Key("over_limit").UInt(stats.overLimit)
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// Keeps the capacity most recent timelines of protect and unprotect operations, in the Chrome trace event
+// format, for one in sampleEvery operations (0 for none) and those requested with msipRequestTimelines.
+// A capacity of 0 stops recording.
+extern "C" MSIP_EXPORT int msipConfigureTimelines(uint32_t sampleEvery, size_t capacity)
+{
+  TimelineRecorder::Instance().Configure(sampleEvery, capacity);
+  return EXIT_SUCCESS;
+}
+
+// Records the timelines of the next count protect and unprotect operations, whatever the sampling.
+extern "C" MSIP_EXPORT int msipRequestTimelines(uint32_t count)
+{
+  TimelineRecorder::Instance().RequestNext(count);
+  return EXIT_SUCCESS;
+}
+
+// Removes and returns the timelines kept so far, oldest first.
+extern "C" MSIP_EXPORT int msipTakeTimelines(char *out, size_t cap, size_t *needed)
+{
+  return WriteResult(EXIT_SUCCESS, TimelineRecorder::Instance().TakeJSON(), out, cap, needed);
+}
+
+
+// Retries failed GETs up to maxRetries times after a jittered backoff from retryBaseMs up to retryMaxMs,
+// sends a GET again once it runs past its host's p95 latency (at least hedgeMinMs) when hedge is set,
+// and fails requests to a host fast for breakerOpenMs after breakerFailures consecutive failures.
+// 0 disables retries or the breaker. Applies to requests sent afterwards.
+extern "C" MSIP_EXPORT int msipConfigureHttpResilience(int maxRetries, int64_t retryBaseMs, int64_t retryMaxMs, int hedge,
+                                           int64_t hedgeMinMs, int breakerFailures, int64_t breakerOpenMs)
+{
+  if (maxRetries < 0 || retryBaseMs < 0 || retryMaxMs < 0 || hedgeMinMs < 0 || breakerFailures < 0 || breakerOpenMs < 0)
+    return EXIT_FAILURE;
+  sample::http::HttpDelegateImpl::ResiliencePolicy policy;
+  policy.maxRetries = maxRetries;
+  policy.retryBaseMs = retryBaseMs;
+  policy.retryMaxMs = retryMaxMs;
+  policy.hedge = hedge != 0;
+  policy.hedgeMinMs = hedgeMinMs;
+  policy.breakerFailures = breakerFailures;
+  policy.breakerOpenMs = breakerOpenMs;
+  ContextManager::Instance().GetHttpDelegate()->SetResiliencePolicy(policy);
+  return EXIT_SUCCESS;
+}
+
+// Limits each tenant's requests to a host once the host answers 429 or 503: the rate starts at decrease
+// times the rate that was throttled, is multiplied by it again on each further throttled response and raised by
+// increasePerSecond every second while requests wait for it, between minRate and maxRate (0 for no
+// ceiling, otherwise also a static limit). A Retry-After of up to maxRetryAfterMs holds the tenant's
+// requests to the host until it has passed. Requests over the rate wait in order rather than fail, and the
+// limit lifts after relaxAfterMs without throttling or waiting. enabled 0 turns it off. Applies to the
+// HTTP event loop's next iteration.
+extern "C" MSIP_EXPORT int msipConfigureHttpRateLimit(int enabled, double minRate, double maxRate, double increasePerSecond,
+                                           double decrease, int64_t maxRetryAfterMs, int64_t relaxAfterMs)
+{
+  sample::http::AdaptiveRateLimiter::Policy policy;
+  policy.enabled = enabled != 0;
+  policy.minRate = minRate;
+  policy.maxRate = maxRate;
+  policy.increasePerSecond = increasePerSecond;
+  policy.decrease = decrease;
+  policy.maxRetryAfterMs = maxRetryAfterMs;
+  policy.relaxAfterMs = relaxAfterMs;
+  if (!sample::http::AdaptiveRateLimiter::IsValid(policy))
+    return EXIT_FAILURE;
+  ContextManager::Instance().GetHttpDelegate()->SetRateLimitPolicy(policy);
+  return EXIT_SUCCESS;
+}
+
+
+// Bounds the buffer of finished spans waiting for msipTakeSpans; 0 stops recording.
+extern "C" MSIP_EXPORT int msipConfigureTracing(size_t bufferSize)
+{
+  ContextManager::Instance().GetTracingHttpDelegate()->SetCapacity(bufferSize);
+  return EXIT_SUCCESS;
+}
+
+
+// Removes up to maxCount finished HTTP spans, oldest first. A result that does not fit stays pending
+// for msipTakeResult, so no span is lost to a small buffer.
+extern "C" MSIP_EXPORT int msipTakeSpans(size_t maxCount, char *out, size_t cap, size_t *needed)
+{
+  const auto spans = ContextManager::Instance().GetTracingHttpDelegate()->TakeSpans(maxCount);
+  return WriteResult(EXIT_SUCCESS, HttpSpansJSON(spans), out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int getFileStatus(const char *filePath_str, const char *applicationId_str, char *result)
+{
+  string json;
+  auto status = RunGetFileStatus(string(filePath_str), string(applicationId_str), json);
+  strcpy(result, json.c_str());
+  return status;
+}
+
+
+extern "C" MSIP_EXPORT int unprotectFile(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, char *result)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunUnprotectFile(string(protectionToken_str), string(filePath_str), string(applicationId_str), json);
+  });
+  strcpy(result, json.c_str());
+  return status;
+}
+
+
+extern "C" MSIP_EXPORT int protectFile(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *result)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFile(
+        string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str), string(applicationId_str), json);
+  });
+  strcpy(result, json.c_str());
+  return status;
+}
+
+
+// Batch exports process count files with one shared MipContext and FileEngine, fanning the files out
+// over a worker pool. result receives a JSON array holding one object per input path, in input order,
+// shaped exactly like the single-file export's result. The call returns EXIT_SUCCESS once every file
+// has been attempted; per-file failures are reported in the array. EXIT_FAILURE means shared setup
+// failed or resultSize was too small, and result then holds a single error object.
+
+extern "C" MSIP_EXPORT int getFileStatusBatch(const char **filePaths, size_t count, const char *applicationId_str, char *result, size_t resultSize)
+{
+  string json;
+  auto status = RunGetFileStatusBatch(filePaths, count, string(applicationId_str), json);
+  return CopyBatchResult(status, json, result, resultSize);
+}
+
+
+extern "C" MSIP_EXPORT int unprotectFileBatch(const char* protectionToken_str, const char **filePaths, size_t count, const char *applicationId_str, char *result, size_t resultSize)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", filePaths, count, applicationId_str, json, [&]() {
+    return RunUnprotectFileBatch(string(protectionToken_str), filePaths, count, string(applicationId_str), json);
+  });
+  return CopyBatchResult(status, json, result, resultSize);
+}
+
+
+extern "C" MSIP_EXPORT int protectFileBatch(const char* protectionToken_str, const char **filePaths, size_t count, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *result, size_t resultSize)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+    return RunProtectFileBatch(
+        string(protectionToken_str), filePaths, count, string(encryptedFilePath_str), string(username_str), string(applicationId_str), json);
+  });
+  return CopyBatchResult(status, json, result, resultSize);
+}
+
+
+// The *_v2 exports write at most cap bytes into out and always store the full result size, including the
+// terminator, in *needed. They return the same status as the original export, or 2 when out was too small.
+// In that case the result is kept for the calling thread and msipTakeResult retrieves it, so an operation
+// that already modified files never has to be run again.
+
+extern "C" MSIP_EXPORT int msipTakeResult(char *out, size_t cap, size_t *needed)
+{
+  if (!tPendingResult.valid) {
+    if (needed) *needed = 0;
+    return EXIT_FAILURE;
+  }
+  const PendingResult pending = tPendingResult;
+  return WriteResult(pending.status, pending.json, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int getFileStatus_v2(const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunGetFileStatus(string(filePath_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Reports the status of each member of the ZIP or tar archive at filePath, without extracting it (see
+// RunGetArchiveStatus). out receives the archive's format and counts, and a getFileStatus_v2 result per
+// member with its uncompressed size, in the archive's order.
+extern "C" MSIP_EXPORT int getArchiveStatus(const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunAdmitted("status", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunGetArchiveStatus(string(filePath_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Walks root in parallel and streams the status of every file the SDK handles, one JSON object per line,
+// to outputFd (see RunScanTree). filters is a comma separated extension list; empty selects the types the
+// SDK supports and "*" every file. out receives the walk's counts once it is done.
+extern "C" MSIP_EXPORT int scanTree(const char *root_str, const char *filters_str, int outputFd, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunScanTree(string(root_str), filters_str ? string(filters_str) : "", outputFd, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Like scanTree, but writes only the files that changed since the last scan recorded in the journal at
+// journalPath (see RunScanTreeIncremental), and updates the journal.
+extern "C" MSIP_EXPORT int scanTreeIncremental(const char *root_str, const char *filters_str, int outputFd, const char *journalPath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunScanTreeIncremental(string(root_str), filters_str ? string(filters_str) : "", outputFd, string(journalPath_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Owner, content id and template of a protected file, read offline from its publishing license.
+extern "C" MSIP_EXPORT int inspectLicense(const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunInspectLicense(string(filePath_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int unprotectFile_v2(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunUnprotectFile(string(protectionToken_str), string(filePath_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Writes the unprotected content of filePath to outputFd (a file, pipe or socket left open for the caller)
+// instead of creating a "_modified" copy. The result JSON carries the number of bytes written.
+extern "C" MSIP_EXPORT int unprotectFileToFd(const char* protectionToken_str, const char *filePath_str, int outputFd, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  try {
+    status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+      return RunUnprotectFileToStream(string(protectionToken_str), string(filePath_str), make_shared<FdOutputStream>(outputFd), string(applicationId_str), json);
+    });
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Writes the unprotected content of filePath into caller memory: a buffer or a pre-sized mmap region of
+// dataCap bytes. *dataSize gets the output size. If it exceeds dataCap, the call still succeeds, the
+// memory content is undefined and msipTakeOutput fetches the output without running the call again.
+extern "C" MSIP_EXPORT int unprotectFileToBuffer(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, uint8_t *data, size_t dataCap, size_t *dataSize, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto outputStream = make_shared<OutputBufferStream>(data, static_cast<int64_t>(dataCap));
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunUnprotectFileToStream(string(protectionToken_str), string(filePath_str), outputStream, string(applicationId_str), json);
+  });
+  KeepOverflowedOutput(*outputStream, dataSize);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Opens the plaintext of a protected file for reading with msipRead. The result JSON has "handle" and
+// "size". The handle must be released with msipClose.
+extern "C" MSIP_EXPORT int openDecrypted(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunOpenDecrypted(string(protectionToken_str), string(filePath_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Hands the text of filePath, decrypted in memory, to callback a part at a time for search indexing,
+// without a "_modified" copy or any plaintext on disk. mode is "text" for the built-in extraction of
+// Office, text and printable runs, or "plaintext" for the decrypted bytes themselves, for an extractor of
+// the caller's. At most maxBytes (0 for no limit) are handed over; callback returns nonzero to stop
+// early. The result JSON has "protected", "bytes" handed over, "plaintext_bytes" and "stopped".
+extern "C" MSIP_EXPORT int extractText(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, const char *mode_str, uint64_t maxBytes, MsipTextCallback callback, void *userData, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  const string mode(mode_str ? mode_str : "text");
+  if (!callback || (mode != "text" && mode != "plaintext"))
+    return WriteResult(EXIT_FAILURE, getUnprotectStatusJSON(false, "A callback and a mode of text or plaintext are required", ""), out, cap, needed);
+  const size_t limit = maxBytes ? static_cast<size_t>(maxBytes) : std::numeric_limits<size_t>::max();
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunExtractText(string(protectionToken_str), string(filePath_str), string(applicationId_str), mode == "plaintext", limit,
+        [&](const char* data, size_t size) { return callback(data, size, userData) == 0; }, json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// File sessions open a file once for several calls, e.g. an inspect followed by an unprotect. A session
+// is closed by closeFileSession, by unprotectFileSession, or after msipSetFileSessionIdleTimeout of
+// inactivity. The result JSON of openFileSession has "session", "protected" and "labeled".
+extern "C" MSIP_EXPORT int openFileSession(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunOpenFileSession(string(protectionToken_str), string(filePath_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int getFileSessionStatus(uint64_t session, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunFileSessionCall(session, [session](const FileSessionTable::Session& fileSession) {
+    return FileSessionJSON(session, fileSession);
+  }, json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// "label" and "protection" objects, or null when the file has none.
+extern "C" MSIP_EXPORT int getFileSessionLabel(uint64_t session, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunFileSessionCall(session, FileSessionLabelJSON, json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Fails with the access-denied error unprotectFileSession would return when the user lacks EXPORT.
+extern "C" MSIP_EXPORT int checkFileSessionRights(uint64_t session, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunFileSessionCall(session, [session](const FileSessionTable::Session& fileSession) {
+    EnsureUserHasRights(fileSession.handler);
+    return FileSessionJSON(session, fileSession);
+  }, json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Unprotects the session's file like unprotectFile_v2, then closes the session.
+extern "C" MSIP_EXPORT int unprotectFileSession(uint64_t session, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunFileSessionCall(session, [](const FileSessionTable::Session& fileSession) {
+    EnsureUserHasRights(fileSession.handler);
+    return Unprotect(fileSession.handler, fileSession.filePath);
+  }, json);
+  ContextManager::Instance().GetFileSessions().Close(session);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int closeFileSession(uint64_t session)
+{
+  return ContextManager::Instance().GetFileSessions().Close(session) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Opens any file, e.g. protected output, as a read-only stream handle for msipRead. *handle is set to 0
+// when the file cannot be opened.
+extern "C" MSIP_EXPORT int msipOpen(const char *filePath_str, uint64_t *handle)
+{
+  *handle = 0;
+  try {
+    *handle = ContextManager::Instance().GetStreamHandles().Open(GetInputStreamFromFilePath(string(filePath_str)), nullptr);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception&) {
+    return EXIT_FAILURE;
+  }
+}
+
+
+// Reads up to length bytes from an open stream handle into buffer. Returns the bytes read, 0 at the end
+// of the stream, or -1 when the handle is not open or the read fails.
+extern "C" MSIP_EXPORT int64_t msipRead(uint64_t handle, uint8_t *buffer, size_t length)
+{
+  try {
+    return ContextManager::Instance().GetStreamHandles().Read(handle, buffer, static_cast<int64_t>(length));
+  }
+  catch (const std::exception&) {
+    return -1;
+  }
+}
+
+
+extern "C" MSIP_EXPORT int msipClose(uint64_t handle)
+{
+  return ContextManager::Instance().GetStreamHandles().Close(handle) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Protects filePath like protectFile_v2, writing the protected content to outputFd instead of a file.
+extern "C" MSIP_EXPORT int protectFileToFd(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, int outputFd, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  try {
+    status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+      return RunProtectFile(string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str), string(applicationId_str), json, make_shared<FdOutputStream>(outputFd));
+    });
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Protects filePath like protectFile_v2, writing the protected content into caller memory as
+// unprotectFileToBuffer does.
+extern "C" MSIP_EXPORT int protectFileToBuffer(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, uint8_t *data, size_t dataCap, size_t *dataSize, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto outputStream = make_shared<OutputBufferStream>(data, static_cast<int64_t>(dataCap));
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFile(string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str), string(applicationId_str), json, outputStream);
+  });
+  KeepOverflowedOutput(*outputStream, dataSize);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// The *Buffer exports read inputSize bytes of caller memory at input in place, as the content of a file
+// named nameHint, through the SDK's stream overloads. nameHint only selects the handler by its extension
+// and names the input in results; input must stay valid until the call returns.
+
+// Reports the status of the input like getFileStatus_v2.
+extern "C" MSIP_EXPORT int getBufferStatus(const uint8_t *input, size_t inputSize, const char *nameHint_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  auto status = RunAdmittedBytes("status", EstimateOperationBytesForSize(inputSize), applicationId_str, json, [&]() {
+    auto stream = make_shared<StreamOverBuffer>(input, static_cast<int64_t>(inputSize));
+    return RunGetStreamStatus(stream, nameHint, string(applicationId_str), json);
+  }, string(), InputShape(nameHint, static_cast<int64_t>(inputSize)));
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Decrypts the input like unprotectFileToBuffer.
+extern "C" MSIP_EXPORT int unprotectBufferToBuffer(const char* protectionToken_str, const uint8_t *input, size_t inputSize, const char *nameHint_str, const char *applicationId_str, uint8_t *data, size_t dataCap, size_t *dataSize, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  auto outputStream = make_shared<OutputBufferStream>(data, static_cast<int64_t>(dataCap));
+  auto status = RunAdmittedBytes("unprotect", EstimateOperationBytesForSize(inputSize), applicationId_str, json, [&]() {
+    ScopedReadAheadInput bufferInput(nameHint.c_str(), make_shared<StreamOverBuffer>(input, static_cast<int64_t>(inputSize)));
+    return RunUnprotectFileToStream(string(protectionToken_str), nameHint, outputStream, string(applicationId_str), json);
+  }, string(), InputShape(nameHint, static_cast<int64_t>(inputSize)));
+  KeepOverflowedOutput(*outputStream, dataSize);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Protects the input with the protection of encryptedFilePath like protectFileToBuffer.
+extern "C" MSIP_EXPORT int protectBufferToBuffer(const char* protectionToken_str, const uint8_t *input, size_t inputSize, const char *nameHint_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, uint8_t *data, size_t dataCap, size_t *dataSize, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  auto outputStream = make_shared<OutputBufferStream>(data, static_cast<int64_t>(dataCap));
+  auto status = RunAdmittedBytes("protect", EstimateOperationBytesForSize(inputSize), applicationId_str, json, [&]() {
+    ScopedReadAheadInput bufferInput(nameHint.c_str(), make_shared<StreamOverBuffer>(input, static_cast<int64_t>(inputSize)));
+    return RunProtectFile(string(protectionToken_str), nameHint, string(encryptedFilePath_str), string(username_str), string(applicationId_str), json, outputStream);
+  }, string(), InputShape(nameHint, static_cast<int64_t>(inputSize)));
+  KeepOverflowedOutput(*outputStream, dataSize);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// The *SharedMemory exports take the file's content from a shared-memory segment, a memfd or a POSIX shm
+// object another process on the node filled and handed over by descriptor, and write the output into a
+// second segment. The input is mapped in place and the output segment is truncated and written from
+// offset 0, so no copy of a large file passes through a socket or the caller's heap. Both descriptors are
+// left open; nameHint selects the handler like the *Buffer exports' does.
+
+// Size of the segment behind fd, or -1 when it cannot be read.
+int64_t SharedMemorySize(int fd) {
+  struct stat fileInfo;
+  return fstat(fd, &fileInfo) == 0 ? static_cast<int64_t>(fileInfo.st_size) : -1;
+}
+
+// Output stream over the shared-memory segment behind fd, emptied first. Emptying the input's own segment
+// would fault its mapping, so the two must differ.
+shared_ptr<Stream> OpenSharedMemoryOutput(int fd, int inputFd) {
+  struct stat outputInfo, inputInfo;
+  if (fstat(fd, &outputInfo) == 0 && fstat(inputFd, &inputInfo) == 0 &&
+      outputInfo.st_dev == inputInfo.st_dev && outputInfo.st_ino == inputInfo.st_ino)
+    throw std::runtime_error("The output segment must not be the input segment");
+  if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+    throw std::runtime_error(string("Failed to reset the output segment: ") + strerror(errno));
+  return make_shared<FdOutputStream>(fd);
+}
+
+// Reports the status of the input segment like getFileStatus_v2.
+extern "C" MSIP_EXPORT int getSharedMemoryStatus(int inputFd, const char *nameHint_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  int status;
   try {
-    shared_ptr<mip::Stream> fileStream = nullptr;
-    map<string, string> telemetrySettings;
-    const string filePath(filePath_str);
-    const string protectionToken(protectionToken_str);
-    const string applicationId(applicationId_str);
-    const string encryptedFilePath(encryptedFilePath_str);
-    const string username(username_str);
-    ApplicationInfo appInfo;
-    appInfo.applicationId = applicationId;
-    appInfo.applicationName = "MsipFileApp";
-    appInfo.applicationVersion = "1.0.0.0";
-    auto fileSampleWorkingDirectory = GetWorkingDirectory();
+    auto stream = MapInput(inputFd, nameHint);
+    status = RunAdmittedBytes("status", EstimateOperationBytesForSize(stream->Size()), applicationId_str, json, [&]() {
+      return RunGetStreamStatus(stream, nameHint, string(applicationId_str), json);
+    }, string(), InputShape(nameHint, stream->Size()));
+  } catch (const std::exception& ex) {
+    json = FileStatusErrorJSON(nameHint, ex.what());
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
 
-    const string password = "";
-    const string sccToken = "";
+// Decrypts the input segment into the output segment like unprotectFileToFd.
+extern "C" MSIP_EXPORT int unprotectSharedMemory(const char* protectionToken_str, int inputFd, const char *nameHint_str, const char *applicationId_str, int outputFd, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  int status;
+  try {
+    status = RunAdmittedBytes("unprotect", EstimateOperationBytesForSize(SharedMemorySize(inputFd)), applicationId_str, json, [&]() {
+      ScopedReadAheadInput sharedInput(nameHint.c_str(), MapInput(inputFd, nameHint));
+      return RunUnprotectFileToStream(string(protectionToken_str), nameHint, OpenSharedMemoryOutput(outputFd, inputFd), string(applicationId_str), json);
+    }, string(), InputShape(nameHint, SharedMemorySize(inputFd)));
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Protects the input segment into the output segment with the protection of encryptedFilePath like
+// protectFileToFd.
+extern "C" MSIP_EXPORT int protectSharedMemory(const char* protectionToken_str, int inputFd, const char *nameHint_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, int outputFd, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  const string nameHint(nameHint_str ? nameHint_str : "");
+  int status;
+  try {
+    status = RunAdmittedBytes("protect", EstimateOperationBytesForSize(SharedMemorySize(inputFd)), applicationId_str, json, [&]() {
+      ScopedReadAheadInput sharedInput(nameHint.c_str(), MapInput(inputFd, nameHint));
+      return RunProtectFile(string(protectionToken_str), nameHint, string(encryptedFilePath_str), string(username_str), string(applicationId_str), json, OpenSharedMemoryOutput(outputFd, inputFd));
+    }, string(), InputShape(nameHint, SharedMemorySize(inputFd)));
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// The *Object exports read inputs from object storage with range requests instead of from a file, and
+// upload outputs in parts as the SDK commits them. Objects are named by s3://bucket/key, signed with the
+// AWS credentials of the environment, by the https URL of an Azure blob carrying its SAS token, or, for
+// inputs, by any https URL that answers range requests, such as a presigned S3 URL. The last segment of
+// the key names the input in results and selects its handler.
+
+shared_ptr<ObjectInputStream> OpenObjectInput(const ObjectLocation& location) {
+  return make_shared<ObjectInputStream>(ObjectStoreClient::Shared(), location, ContextManager::Instance().GetObjectInputStream());
+}
+
+// Runs a call committing into an upload to destinationUri, and completes the upload when the call wrote an
+// output. Otherwise the upload is aborted and nothing appears at destinationUri.
+int RunToObject(const string& destinationUri, string& result, const std::function<int(const shared_ptr<Stream>&)>& run) {
+  auto& client = ObjectStoreClient::Shared();
+  auto output = make_shared<ObjectOutputStream>(client, client.Parse(destinationUri), ContextManager::Instance().GetObjectOutputStream());
+  const int status = run(output);
+  if (status != EXIT_SUCCESS || output->Size() == 0)
+    return status;
+  output->Finish();
+  std::ostringstream oss;
+  oss << "{\"status\": true, \"path\": \"" << escapeJsonString(destinationUri) << "\", \"bytes\": " << output->Size() << ", \"error\": \"\"}";
+  result = oss.str();
+  return EXIT_SUCCESS;
+}
+
+// Reports the status of the object at uri like getFileStatus_v2.
+extern "C" MSIP_EXPORT int getObjectStatus(const char *uri_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  const string uri(uri_str ? uri_str : "");
+  int status;
+  try {
+    const auto location = ObjectStoreClient::Shared().Parse(uri);
+    auto object = OpenObjectInput(location);
+    shared_ptr<Stream> input = object;
+    // The entity tag changes with the content, so an object whose tag was probed clean is not probed again.
+    const uint64_t knownCleanKey = KnownCleanFilter::ObjectKey(object->GetETag(), input->Size());
+    status = RunAdmittedBytes("status", EstimateOperationBytesForSize(input->Size()), applicationId_str, json, [&]() {
+      return RunGetStreamStatus(input, location.name, string(applicationId_str), json, knownCleanKey);
+    }, string(), InputShape(location.name, input->Size()));
+  } catch (const std::exception& ex) {
+    json = FileStatusErrorJSON(uri, ex.what());
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Decrypts the object at sourceUri into a new object at destinationUri, an s3:// URI or Azure blob URL.
+extern "C" MSIP_EXPORT int unprotectObject(const char* protectionToken_str, const char *sourceUri_str, const char *destinationUri_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  try {
+    const auto location = ObjectStoreClient::Shared().Parse(string(sourceUri_str));
+    auto input = OpenObjectInput(location);
+    status = RunAdmittedBytes("unprotect", EstimateOperationBytesForSize(input->Size()), applicationId_str, json, [&]() {
+      ScopedReadAheadInput objectInput(location.name.c_str(), input);
+      return RunToObject(string(destinationUri_str), json, [&](const shared_ptr<Stream>& output) {
+        return RunUnprotectFileToStream(string(protectionToken_str), location.name, output, string(applicationId_str), json);
+      });
+    }, string(), InputShape(location.name, input->Size()));
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Protects the object at sourceUri with the protection of encryptedFilePath into a new object at
+// destinationUri.
+extern "C" MSIP_EXPORT int protectObject(const char* protectionToken_str, const char *sourceUri_str, const char *destinationUri_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  try {
+    const auto location = ObjectStoreClient::Shared().Parse(string(sourceUri_str));
+    auto input = OpenObjectInput(location);
+    status = RunAdmittedBytes("protect", EstimateOperationBytesForSize(input->Size()), applicationId_str, json, [&]() {
+      ScopedReadAheadInput objectInput(location.name.c_str(), input);
+      return RunToObject(string(destinationUri_str), json, [&](const shared_ptr<Stream>& output) {
+        return RunProtectFile(string(protectionToken_str), location.name, string(encryptedFilePath_str), string(username_str), string(applicationId_str), json, output);
+      });
+    }, string(), InputShape(location.name, input->Size()));
+  } catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    status = EXIT_FAILURE;
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Sizes object storage transfers. Inputs are read in blocks of blockBytes, keeping cacheBlocks of them and
+// reading up to maxReadAheadBlocks ahead of a sequential reader; outputs are uploaded in parts of partBytes,
+// partsInFlight at a time. transferThreads bounds the prefetches and uploads running at once. 0 keeps a
+// setting's current value.
+extern "C" MSIP_EXPORT int msipConfigureObjectStorage(size_t blockBytes, size_t cacheBlocks, size_t maxReadAheadBlocks, size_t partBytes, size_t partsInFlight, size_t transferThreads)
+{
+  static const size_t kMaxTransferThreads = 256;
+  auto& contextManager = ContextManager::Instance();
+  auto input = contextManager.GetObjectInputStream();
+  auto output = contextManager.GetObjectOutputStream();
+  if (blockBytes)
+    input.blockBytes = blockBytes;
+  if (cacheBlocks)
+    input.cacheBlocks = cacheBlocks;
+  if (maxReadAheadBlocks)
+    input.maxReadAheadBlocks = maxReadAheadBlocks;
+  if (partBytes)
+    output.partBytes = partBytes;
+  if (partsInFlight)
+    output.partsInFlight = partsInFlight;
+  if (!ObjectInputStream::IsValid(input) || !ObjectOutputStream::IsValid(output) || transferThreads > kMaxTransferThreads)
+    return EXIT_FAILURE;
+  contextManager.SetObjectStreams(input, output);
+  if (transferThreads) {
+    auto& client = ObjectStoreClient::Shared();
+    auto options = client.GetOptions();
+    options.transferThreads = transferThreads;
+    client.Configure(options);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Requests made to object storage and bytes moved, since the library was loaded.
+extern "C" MSIP_EXPORT int msipGetObjectStorageStats(char *out, size_t cap, size_t *needed)
+{
+  const auto stats = ObjectStoreClient::Shared().GetStats();
+  JsonWriter json(256);
+  json.BeginObject()
+      .Key("status").Bool(true)
+      .Key("requests").UInt(stats.requests)
+      .Key("failed").UInt(stats.failed)
+      .Key("retries").UInt(stats.retries)
+      .Key("bytes_read").UInt(stats.bytesRead)
+      .Key("bytes_written").UInt(stats.bytesWritten)
+      .EndObject();
+  return WriteResult(EXIT_SUCCESS, json.Take(), out, cap, needed);
+}
+
+// Encrypts filePath with the protection of encryptedFilePath into raw ciphertext at outputPath, with the
+// publishing license stored next to it at licensePath. Large files are encrypted in block-aligned segments
+// on the shared worker pool. Empty paths default to "<filePath>.enc" and "<outputPath>.pl".
+extern "C" MSIP_EXPORT int protectFileDetached(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, const char *outputPath_str, const char *licensePath_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFileDetached(
+        string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str),
+        string(applicationId_str), string(outputPath_str ? outputPath_str : ""), string(licensePath_str ? licensePath_str : ""), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Decrypts raw ciphertext written by protectFileDetached into outputPath, consuming the publishing license at
+// licensePath. Segments are decrypted in parallel on the shared worker pool. Empty paths default to
+// "<filePath>.pl" and "<filePath>.dec".
+extern "C" MSIP_EXPORT int unprotectFileDetached(const char* protectionToken_str, const char *filePath_str, const char *licensePath_str, const char *applicationId_str, const char *outputPath_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunUnprotectFileDetached(
+        string(protectionToken_str), string(filePath_str), string(licensePath_str ? licensePath_str : ""),
+        string(applicationId_str), string(outputPath_str ? outputPath_str : ""), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Like protectFile_v2, but commits the output to outputPath instead of the "_modified" sibling of filePath:
+// a file, or a directory (ending in a separator, or existing) that receives the input's name. The output is
+// written to a temporary file next to it and renamed into place once committed. With
+// OutputDestination::kReplaceInput (1) in flags it replaces filePath instead, and outputPath is ignored.
+extern "C" MSIP_EXPORT int protectFileTo(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, const char *outputPath_str, int flags, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    try {
+      OutputDestination destination(string(filePath_str), string(outputPath_str ? outputPath_str : ""), flags);
+      OutputDestination::Scope scope(destination);
+      return RunProtectFile(
+          string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str), string(applicationId_str), json);
+    } catch (const std::exception& ex) {
+      json = getUnprotectStatusJSON(false, ex.what(), "");
+      return EXIT_FAILURE;
+    }
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Like unprotectFile_v2, but commits the output to outputPath as protectFileTo does.
+extern "C" MSIP_EXPORT int unprotectFileTo(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, const char *outputPath_str, int flags, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", &filePath_str, 1, applicationId_str, json, [&]() {
+    try {
+      OutputDestination destination(string(filePath_str), string(outputPath_str ? outputPath_str : ""), flags);
+      OutputDestination::Scope scope(destination);
+      return RunUnprotectFile(string(protectionToken_str), string(filePath_str), string(applicationId_str), json);
+    } catch (const std::exception& ex) {
+      json = getUnprotectStatusJSON(false, ex.what(), "");
+      return EXIT_FAILURE;
+    }
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Copies the output kept by the last *ToBuffer call on this thread that outgrew its memory, then drops it.
+extern "C" MSIP_EXPORT int msipTakeOutput(uint8_t *data, size_t dataCap, size_t *dataSize)
+{
+  if (dataSize) *dataSize = tPendingOutputSize;
+  if (!tPendingOutput || tPendingOutputSize > dataCap)
+    return !tPendingOutput ? EXIT_FAILURE : kResultTooSmall;
+  memcpy(data, tPendingOutput.Data(), tPendingOutputSize);
+  tPendingOutput.Reset();
+  tPendingOutputSize = 0;
+  return EXIT_SUCCESS;
+}
+
+
+extern "C" MSIP_EXPORT int protectFile_v2(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFile(
+        string(protectionToken_str), string(filePath_str), string(encryptedFilePath_str), string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int getFileStatusBatch_v2(const char **filePaths, size_t count, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunGetFileStatusBatch(filePaths, count, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Like getFileStatusBatch_v2, but out receives binary StatusRecords (see status_records.h) instead of JSON.
+// A result too large for cap is kept for msipTakeResult like any other.
+extern "C" MSIP_EXPORT int getFileStatusBatchBinary(const char **filePaths, size_t count, int withLicense, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string records;
+  auto status = RunGetFileStatusBatchBinary(filePaths, count, withLicense != 0, string(applicationId_str), records);
+  return WriteResult(status, records, out, cap, needed);
+}
+
+
+extern "C" MSIP_EXPORT int unprotectFileBatch_v2(const char* protectionToken_str, const char **filePaths, size_t count, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("unprotect", filePaths, count, applicationId_str, json, [&]() {
+    return RunUnprotectFileBatch(string(protectionToken_str), filePaths, count, string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Acquires the use licenses a later unprotect of filePaths needs, once per distinct publishing license.
+extern "C" MSIP_EXPORT int prefetchLicenses(const char* protectionToken_str, const char **filePaths, size_t count, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunPrefetchLicenses(string(protectionToken_str), filePaths, count, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Estimates the work of a batch over filePaths without opening an engine (see RunPlanBatch).
+extern "C" MSIP_EXPORT int planBatch(const char **filePaths, size_t count, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  string json;
+  auto status = RunPlanBatch(filePaths, count, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Acquires delegation licenses for users on the publishing license of filePath, in one service request.
+extern "C" MSIP_EXPORT int createDelegationLicenses(const char* protectionToken_str, const char *filePath_str, const char **users, size_t userCount, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  const string filePath(filePath_str);
+  string json;
+  auto status = RunDelegatedCall(string(protectionToken_str), filePath, users, userCount, string(applicationId_str),
+      [&](const string& contentId, const vector<DelegatedUser>& delegatedUsers) {
+    return DelegationLicensesJSON(filePath, contentId, delegatedUsers);
+  }, json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Checks right (for example "VIEW" or "EXTRACT") for every user, acquiring missing delegation licenses first.
+extern "C" MSIP_EXPORT int checkDelegatedAccess(const char* protectionToken_str, const char *filePath_str, const char **users, size_t userCount, const char *right_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  const string filePath(filePath_str);
+  const string right(right_str);
+  string json;
+  auto status = RunDelegatedCall(string(protectionToken_str), filePath, users, userCount, string(applicationId_str),
+      [&](const string& contentId, const vector<DelegatedUser>& delegatedUsers) {
+    return DelegatedAccessJSON(filePath, contentId, right, delegatedUsers);
+  }, json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Checks whether user holds every one of rights (for example "VIEW" or "EXPORT") on filePath. Answered
+// from the rights cache without a service round trip once a license for the content and user was used.
+extern "C" MSIP_EXPORT int checkRights(const char* protectionToken_str, const char *filePath_str, const char *user_str, const char **rights, size_t rightCount, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  vector<string> requested(rights, rights + rightCount);
+  string json;
+  auto status = RunCheckRights(string(protectionToken_str), string(filePath_str), string(user_str), requested, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Registers every file of filePaths for document tracking and revocation, notifying each owner when the
+// document is opened if notifyOwner is set. results holds one status per file, in order.
+extern "C" MSIP_EXPORT int registerContentForTracking(const char* protectionToken_str, const char **filePaths, size_t count, int notifyOwner, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunContentTracking(string(protectionToken_str), filePaths, count, ContentTracker::Action::Register, notifyOwner != 0,
+      string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Revokes the content of every file of filePaths, so no new licenses are issued for it. results holds one
+// status per file, in order.
+extern "C" MSIP_EXPORT int revokeContent(const char* protectionToken_str, const char **filePaths, size_t count, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunContentTracking(string(protectionToken_str), filePaths, count, ContentTracker::Action::Revoke, false,
+      string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Opens a message and describes its attachments, decrypting protected ones, down to maxDepth nested
+// messages (at most 8). The top message's attachments are inspected in parallel.
+extern "C" MSIP_EXPORT int inspectMsg(const char* protectionToken_str, const char *filePath_str, size_t maxDepth, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunInspectMsg(string(protectionToken_str), string(filePath_str), maxDepth, string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Protects filePath with templateId using a locally signed publishing license. The user certificate and
+// templates are loaded once per user and refreshed daily or when publishing fails.
+extern "C" MSIP_EXPORT int protectFileOffline(const char* protectionToken_str, const char *filePath_str, const char* templateId_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFileOffline(
+        string(protectionToken_str), string(filePath_str), string(templateId_str), string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
 
-    auto authDelegate = make_shared<AuthDelegateImpl>(false /*isVerbose*/, username, password, applicationId, sccToken, protectionToken, fileSampleWorkingDirectory);
 
-    auto consentDelegate = make_shared<ConsentDelegateImpl>(false /*isVerbose*/);
+// RMS tenant of username: id, issuer and licensing URLs. Cached per tenant (the user's domain) with the
+// protection endpoint the licensing URL points at, which new users' engines in the tenant then load from.
+extern "C" MSIP_EXPORT int getTenantInformation(const char* protectionToken_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunGetTenantInformation(string(protectionToken_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Loads the user certificate and templates protectFileOffline needs, e.g. at startup. Returns the publisher's counters.
+extern "C" MSIP_EXPORT int prepareOfflinePublishing(const char* protectionToken_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunPrepareOfflinePublishing(string(protectionToken_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Preloads count targets before the service takes traffic: per applicationIds[i] and usernames[i] (may
+// be null for no users), the profile and protection-only file engine, plus what parts[i] adds: 1 the
+// policy engine and its label index, 2 the user certificate and templates. Token requests fall back to
+// the client secret when protectionToken is empty. The result JSON has one entry per step in "steps".
+extern "C" MSIP_EXPORT int msipWarmup(const char* protectionToken_str, const char **applicationIds, const char **usernames, const int *parts, size_t count, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  auto& contextManager = ContextManager::Instance();
+  contextManager.SetWarmupState(ContextManager::WarmupState::Running);
+  string json;
+  auto status = RunWarmup(string(protectionToken_str), applicationIds, usernames, parts, count, json);
+  contextManager.SetWarmupState(
+      status == EXIT_SUCCESS ? ContextManager::WarmupState::Done : ContextManager::WarmupState::Incomplete);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Reloads the file engines an earlier run stored with on-disk storage for the count applicationIds, or for
+// every application that stored any when count is 0. Token requests for what expired fall back to the
+// client secret when protectionToken is empty. The result JSON counts restored, failed, missing and skipped
+// engines, with one entry per engine in "engines".
+extern "C" MSIP_EXPORT int msipRestoreEngines(const char* protectionToken_str, const char **applicationIds, size_t count, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  auto& contextManager = ContextManager::Instance();
+  contextManager.SetWarmupState(ContextManager::WarmupState::Running);
+  string json;
+  auto status = RunRestoreEngines(string(protectionToken_str), applicationIds, count, json);
+  contextManager.SetWarmupState(
+      status == EXIT_SUCCESS ? ContextManager::WarmupState::Done : ContextManager::WarmupState::Incomplete);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+extern "C" MSIP_EXPORT int protectFileBatch_v2(const char* protectionToken_str, const char **filePaths, size_t count, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+    return RunProtectFileBatch(
+        string(protectionToken_str), filePaths, count, string(encryptedFilePath_str), string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Protects with an RMS template (templateId) or a sensitivity label (labelId) instead of a reference
+// file. Pass exactly one of them; the other must be empty. Results use the _v2 buffer convention.
+extern "C" MSIP_EXPORT int protectFileWithTemplate(const char* protectionToken_str, const char *filePath_str, const char* templateId_str, const char* labelId_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", &filePath_str, 1, applicationId_str, json, [&]() {
+    return RunProtectFileWithTemplate(
+        string(protectionToken_str), string(filePath_str), string(templateId_str), string(labelId_str), string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+extern "C" MSIP_EXPORT int protectFileWithTemplateBatch(const char* protectionToken_str, const char **filePaths, size_t count, const char* templateId_str, const char* labelId_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+    return RunProtectFileWithTemplateBatch(
+        string(protectionToken_str), filePaths, count, string(templateId_str), string(labelId_str), string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Protects every path with custom permissions. Each grant is written "user[,user...]:permission[,permission...]"
+// with rights (e.g. VIEW,EDIT) or, when byRoles is set, roles (e.g. VIEWER). validUntil is in seconds since
+// the epoch, 0 for content that never expires. Results are a JSON array in input order, as for
+// protectFileWithTemplateBatch.
+extern "C" MSIP_EXPORT int protectFilesWithPermissions(const char* protectionToken_str, const char **filePaths, size_t count, const char **grants, size_t grantCount, int byRoles, int64_t validUntil, int allowOfflineAccess, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  AdhocPermissions permissions;
+  try {
+    for (size_t i = 0; i < grantCount; ++i)
+      permissions.grants.push_back(ProtectionDescriptorInterner::ParseGrant(string(grants[i])));
+  }
+  catch (const std::exception& ex) {
+    json = getUnprotectStatusJSON(false, ex.what(), "");
+    return WriteResult(EXIT_FAILURE, json, out, cap, needed);
+  }
+  permissions.byRoles = byRoles != 0;
+  permissions.validUntil = validUntil;
+  permissions.allowOfflineAccess = allowOfflineAccess != 0;
+
+  auto status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+    return RunProtectFilesWithPermissions(
+        string(protectionToken_str), filePaths, count, permissions, string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Applies a sensitivity label to every path, each into its own "_modified" copy, and returns a JSON
+// array with one result per path in input order. assignmentMethod is a mip::AssignmentMethod: 0
+// standard, 1 privileged, 2 auto. justification is needed to downgrade an existing label.
+extern "C" MSIP_EXPORT int labelFiles(const char* protectionToken_str, const char **filePaths, size_t count, const char* labelId_str, int assignmentMethod, const char* justification_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  if (assignmentMethod < static_cast<int>(AssignmentMethod::STANDARD) || assignmentMethod > static_cast<int>(AssignmentMethod::AUTO)) {
+    json = getUnprotectStatusJSON(false, "Unknown assignment method", "");
+    status = EXIT_FAILURE;
+  } else {
+    vector<const char*> labelIds(count, labelId_str);
+    status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+      return RunLabelFiles(
+          string(protectionToken_str), filePaths, labelIds.data(), count, static_cast<AssignmentMethod>(assignmentMethod),
+          string(justification_str), string(username_str), string(applicationId_str), json);
+    });
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Like labelFiles, with labelIds[i] for filePaths[i]. Files sharing a label are labeled together, so the label
+// is resolved once per batch and identical files under it, with batch dedupe on, are marked once.
+extern "C" MSIP_EXPORT int labelFilesByLabel(const char* protectionToken_str, const char **filePaths, const char **labelIds, size_t count, int assignmentMethod, const char* justification_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  if (assignmentMethod < static_cast<int>(AssignmentMethod::STANDARD) || assignmentMethod > static_cast<int>(AssignmentMethod::AUTO)) {
+    json = getUnprotectStatusJSON(false, "Unknown assignment method", "");
+    status = EXIT_FAILURE;
+  } else {
+    status = RunAdmitted("protect", filePaths, count, applicationId_str, json, [&]() {
+      return RunLabelFiles(
+          string(protectionToken_str), filePaths, labelIds, count, static_cast<AssignmentMethod>(assignmentMethod),
+          string(justification_str), string(username_str), string(applicationId_str), json);
+    });
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// The actions applying labelId with assignmentMethod takes on unprotected content of contentFormat ("file" or
+// "email", empty for "file") that carries priorLabelId (empty for none), computed by username's policy engine
+// without any content and kept per combination. Returns {"status", "label_id", "prior_label_id",
+// "content_format", "assignment_method", "cached", "changes", "protects", "requires_justification",
+// "actions"}, each action an object with its "type" and details. Once a plan is kept, labelFiles and
+// labelFilesByLabel do not open the unprotected files it settles: those it leaves unchanged, and those it
+// would need a missing justification for.
+extern "C" MSIP_EXPORT int computeLabelActions(const char* protectionToken_str, const char* labelId_str, const char* priorLabelId_str, const char* contentFormat_str, int assignmentMethod, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  int status;
+  const string contentFormat = contentFormat_str && *contentFormat_str ? contentFormat_str : mip::GetFileContentFormat();
+  if (assignmentMethod < static_cast<int>(AssignmentMethod::STANDARD) || assignmentMethod > static_cast<int>(AssignmentMethod::AUTO)) {
+    json = getUnprotectStatusJSON(false, "Unknown assignment method", "");
+    status = EXIT_FAILURE;
+  } else if (contentFormat != mip::GetFileContentFormat() && contentFormat != mip::GetEmailContentFormat()) {
+    json = getUnprotectStatusJSON(false, "Unknown content format: " + contentFormat, "");
+    status = EXIT_FAILURE;
+  } else {
+    status = RunComputeLabelActions(string(protectionToken_str), string(labelId_str), priorLabelId_str ? string(priorLabelId_str) : string(),
+        contentFormat, static_cast<AssignmentMethod>(assignmentMethod), string(username_str), string(applicationId_str), json);
+  }
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Sensitivity labels of username's policy, flattened in pre-order from an index built once per engine.
+// "parent" is the index of the parent in "labels", or -1 for a top-level label.
+extern "C" MSIP_EXPORT int listLabels(const char* protectionToken_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunListLabels(string(protectionToken_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Sensitivity label of filePath read offline, without a handler or a license: "label_id", "name",
+// "assignment_method" ("standard", "privileged" or "auto", empty when the file does not record it) and
+// "source", "metadata" or "publishing_license". protectionToken may be empty, which skips the policy
+// lookup of the name and so needs no engine.
+extern "C" MSIP_EXPORT int readLabel(const char* protectionToken_str, const char *filePath_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunReadLabel(string(protectionToken_str ? protectionToken_str : ""), string(filePath_str), string(username_str ? username_str : ""), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Label and protection of filePath in one call: "label" with id, name, path, in_policy, parent_id,
+// sensitivity, privileged, set_time and extended_properties, and "protection" with type, name, template_id,
+// owner, content_id, valid_until, granted_rights, user_rights and user_roles. Either is null when the file
+// has none. "source" is "publishing_license" for a pfile read through the fast path, else "handler".
+extern "C" MSIP_EXPORT int describeFile(const char* protectionToken_str, const char *filePath_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunDescribeFile(string(protectionToken_str), string(filePath_str), string(username_str ? username_str : ""), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Protection templates username may protect with, each with id, name, description and owner_full_access.
+// Served from the engine's template catalogue; age_seconds is how old it is.
+extern "C" MSIP_EXPORT int listTemplates(const char* protectionToken_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunListTemplates(string(protectionToken_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+
+// Rights labelId grants username on content owned by ownerEmail, or by delegatedUserEmail when
+// username acts on that user's behalf. Answers are reused per label, owner and delegated user.
+extern "C" MSIP_EXPORT int getRightsForLabel(const char* protectionToken_str, const char* labelId_str, const char* ownerEmail_str, const char* delegatedUserEmail_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunGetRightsForLabel(string(protectionToken_str), string(labelId_str), string(ownerEmail_str), string(delegatedUserEmail_str),
+      string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Resolves a label by id, or by name or "Parent\Child" path ignoring case, without walking the tree.
+extern "C" MSIP_EXPORT int getLabel(const char* protectionToken_str, const char* idOrName_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunGetLabel(string(protectionToken_str), string(idOrName_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
+
+// Sensitive information types of username's policy, compiled from its rule packages when the engine was
+// loaded. Needs msipConfigureClassification. "from_disk" is true when the compiled form was reused from
+// the cache directory instead of parsing the packages.
+extern "C" MSIP_EXPORT int listSensitivityTypes(const char* protectionToken_str, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunListSensitivityTypes(string(protectionToken_str), string(username_str), string(applicationId_str), json);
+  return WriteResult(status, json, out, cap, needed);
+}
 
-    auto diagnosticOverride = make_shared<mip::DiagnosticConfiguration>();
-    diagnosticOverride->customSettings = telemetrySettings;
-    diagnosticOverride->isAuditPriorityEnhanced = true;
-    diagnosticOverride->maxTeardownTimeSec = 2;
-    diagnosticOverride->isMaxTeardownTimeEnabled = true;
-    auto mipConfiguration = make_shared<mip::MipConfiguration>(appInfo, "file_sample_storage", mip::LogLevel::Trace, 0);
-    mipConfiguration->SetDiagnosticConfiguration(diagnosticOverride);
-    map<mip::FlightingFeature, bool> featureSettingsOverride;
-    mipConfiguration->SetFeatureSettings(featureSettingsOverride);
+// Runs the auto-labeling and recommendation rules of username's policy over every path, with the
+// sensitive information types found by the engine's native classifier, and returns a JSON array with
+// the resulting actions and the types found, one entry per path in input order. Files are not changed.
+// Needs msipConfigureClassification.
+extern "C" MSIP_EXPORT int classifyFiles(const char* protectionToken_str, const char **filePaths, size_t count, const char* username_str, const char *applicationId_str, char *out, size_t cap, size_t *needed)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  string json;
+  auto status = RunAdmitted("classify", filePaths, count, applicationId_str, json, [&]() {
+    return RunClassifyFiles(string(protectionToken_str), filePaths, count, string(username_str), string(applicationId_str), json);
+  });
+  return WriteResult(status, json, out, cap, needed);
+}
 
-    auto mipContext = MipContext::Create(mipConfiguration);
-    sample::ShutdownManager lifetimeManager(mipContext);
 
+// Async exports start the operation and return without waiting for the SDK. callback runs exactly once,
+// usually on an SDK thread, with the same status and JSON as the blocking export. result is only valid
+// for the duration of the callback. When setup fails the callback still runs, on the calling thread,
+// and the export returns EXIT_FAILURE.
+
+extern "C" MSIP_EXPORT int unprotectFileAsync(const char* protectionToken_str, const char *filePath_str, const char *applicationId_str, MsipResultCallback callback, void *userData)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  if (!callback)
+    return EXIT_FAILURE;
+  shared_ptr<AsyncFileOperation> operation;
+  try {
+    const string applicationId(applicationId_str);
+    const string username = "";
     const string protectionBaseUrl = "";
     const string policyBaseUrl = "";
-    const string policyPath = "";
-    const string enableFunctionality = "";
-    const string disableFunctionality = "";
-
-    auto profile = CreateProfile(mipContext, consentDelegate);   
-    auto fileEngine = GetFileEngine(
-        profile,
-        authDelegate,
-        username, // set for protect
-        protectionBaseUrl,
-        policyBaseUrl,
-        policyPath, 
-        false,
-        false,
-        false,
-        false,
-        true, // true for protect
-        "en-US",
-        enableFunctionality,
-        disableFunctionality,
-        false
-    );
-    
-    DataState dataState = DataState::REST;
-    string applicationScenarioId = "";
-    auto fileHandler = GetFileHandler(fileEngine, fileStream, filePath, dataState, false, applicationScenarioId);
-    auto encFileHandler = GetFileHandler(fileEngine, fileStream, encryptedFilePath, dataState, false, applicationScenarioId);
 
-    EnsureUserHasRights(fileHandler);
-    ProtectWithCustomPermissions(
-      fileHandler,
-      encFileHandler, 
-      result
-    );
-    return EXIT_SUCCESS;       
-  }
-  catch (const std::exception& ex) {    
-    strcpy(result, getUnprotectStatusJSON(false, ex.what(), "").c_str());
+    auto mipContext = ContextManager::Instance().GetMipContext(applicationId);
+    operation = make_shared<AsyncFileOperation>(mipContext, string(filePath_str), callback, userData);
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    WithCachedFileEngine(engineKey, string(protectionToken_str), operation, [operation](const shared_ptr<FileEngine>& fileEngine) {
+      operation->StartUnprotect(fileEngine);
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    if (operation)
+      operation->Fail(ex.what());
+    else
+      callback(EXIT_FAILURE, getUnprotectStatusJSON(false, ex.what(), "").c_str(), userData);
+    return EXIT_FAILURE;
+  }
+}
+
+
+extern "C" MSIP_EXPORT int protectFileAsync(const char* protectionToken_str, const char *filePath_str, const char* encryptedFilePath_str, const char* username_str, const char *applicationId_str, MsipResultCallback callback, void *userData)
+{
+  sample::token::ScopedToken tokenScope(protectionToken_str ? protectionToken_str : "");
+  if (!callback)
+    return EXIT_FAILURE;
+  shared_ptr<AsyncFileOperation> operation;
+  try {
+    const string applicationId(applicationId_str);
+    const string encryptedFilePath(encryptedFilePath_str);
+    const string username(username_str);
+    const string protectionBaseUrl = "";
+    const string policyBaseUrl = "";
+
+    auto mipContext = ContextManager::Instance().GetMipContext(applicationId);
+    operation = make_shared<AsyncFileOperation>(mipContext, string(filePath_str), callback, userData);
+
+    const EngineCache::Key engineKey = { applicationId, username, protectionBaseUrl, policyBaseUrl, true /*protectionOnly*/, false /*msgContainers*/ };
+    WithCachedFileEngine(engineKey, string(protectionToken_str), operation, [operation, encryptedFilePath](const shared_ptr<FileEngine>& fileEngine) {
+      operation->StartProtect(fileEngine, encryptedFilePath);
+    });
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception& ex) {
+    if (operation)
+      operation->Fail(ex.what());
+    else
+      callback(EXIT_FAILURE, getUnprotectStatusJSON(false, ex.what(), "").c_str(), userData);
     return EXIT_FAILURE;
   }
-}  
\ No newline at end of file
+}
+
+
+// Completion queues let an event loop wait for async exports on one descriptor instead of running code on
+// SDK threads. Pass msipQueueCompletion as the callback, with the queue handle in the top
+// CompletionQueueTable::kHandleShift bits of userData and the caller's call id below them. When the eventfd
+// is readable, msipTakeCompletions returns every queued result as records of CompletionQueue::kHeaderBytes
+// (uint64 id, int32 status, uint32 length, native byte order) followed by the result JSON.
+
+extern "C" MSIP_EXPORT int msipOpenCompletionQueue(int* eventFd)
+{
+  if (!eventFd)
+    return 0;
+  return ContextManager::Instance().GetCompletionQueues().Open(eventFd);
+}
+
+
+extern "C" MSIP_EXPORT int msipCloseCompletionQueue(int queue)
+{
+  return ContextManager::Instance().GetCompletionQueues().Close(queue) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+extern "C" MSIP_EXPORT void msipQueueCompletion(int status, const char* result, void* userData)
+{
+  const uint64_t tag = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(userData));
+  auto queue = ContextManager::Instance().GetCompletionQueues().Find(
+      static_cast<int>(tag >> CompletionQueueTable::kHandleShift));
+  if (queue)
+    queue->Push(tag & ((uint64_t(1) << CompletionQueueTable::kHandleShift) - 1), status, result);
+}
+
+
+// Writes the queued records that fit in cap. *remaining is the size of those left, so a caller whose
+// buffer was too small grows it to at least *remaining and calls again.
+extern "C" MSIP_EXPORT int msipTakeCompletions(int queue, uint8_t* out, size_t cap, size_t* written, size_t* remaining)
+{
+  if (!written || !remaining || (!out && cap))
+    return EXIT_FAILURE;
+  auto completions = ContextManager::Instance().GetCompletionQueues().Find(queue);
+  if (!completions)
+    return EXIT_FAILURE;
+  completions->Take(out, cap, written, remaining);
+  return EXIT_SUCCESS;
+}
+
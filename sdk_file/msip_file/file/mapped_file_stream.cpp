@@ -0,0 +1,155 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "mapped_file_stream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory_hints.h"
+#include "metrics_registry.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& InputBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_bytes_total", "Bytes the SDK read from mapped input files");
+  return counter;
+}
+
+MetricsRegistry::Counter& PrefaultedBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_input_prefaulted_bytes_total", "Bytes of mapped input files faulted in before the SDK read them");
+  return counter;
+}
+
+} // namespace
+
+MappedFileStream::MappedFileStream(const string& filePath, unsigned hints)
+    : mData(nullptr),
+      mSize(0),
+      mPosition(0) {
+  int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", filePath));
+  try {
+    Map(fd, filePath, hints);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  // The mapping keeps its own reference to the file.
+  close(fd);
+}
+
+MappedFileStream::MappedFileStream(int fd, const string& name, unsigned hints)
+    : mData(nullptr),
+      mSize(0),
+      mPosition(0) {
+  Map(fd, name, hints);
+}
+
+void MappedFileStream::Map(int fd, const string& name, unsigned hints) {
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0)
+    throw runtime_error(ErrnoMessage("Failed to stat", name));
+
+  mSize = static_cast<int64_t>(fileInfo.st_size);
+  if (mSize > 0) {
+    const size_t size = static_cast<size_t>(mSize);
+    const bool prefault = (hints & kPrefault) != 0;
+    const bool hugePages = (hints & kHugePages) != 0;
+    // With huge pages asked for, the pages are faulted in once the advice is in place, not by mmap.
+    const int flags = MAP_PRIVATE | (prefault && !hugePages ? MAP_POPULATE : 0);
+    void* mapping = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    if (mapping == MAP_FAILED)
+      throw runtime_error(ErrnoMessage("Failed to map", name));
+    // Advisory only; the SDK mostly scans inputs front to back.
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    if (hugePages) {
+      AdviseHugePages(mapping, size);
+      if (prefault)
+        PrefaultRead(mapping, size);
+    }
+    if (prefault)
+      PrefaultedBytes().Add(static_cast<uint64_t>(size));
+    mData = static_cast<const uint8_t*>(mapping);
+  }
+}
+
+MappedFileStream::~MappedFileStream() {
+  if (mData)
+    munmap(const_cast<uint8_t*>(mData), static_cast<size_t>(mSize));
+}
+
+int64_t MappedFileStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  if (bufferLength <= 0)
+    return 0;
+  auto bytesRead = (bufferLength <= mSize - mPosition) ? bufferLength : mSize - mPosition;
+  if (bytesRead) {
+    memcpy(buffer, mData + mPosition, static_cast<size_t>(bytesRead));
+    mPosition += bytesRead;
+    InputBytes().Add(static_cast<uint64_t>(bytesRead));
+  }
+  return bytesRead;
+}
+
+int64_t MappedFileStream::Write(const uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is read-only");
+}
+
+bool MappedFileStream::Flush() { return true; }
+
+void MappedFileStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (position > mSize)
+    throw runtime_error("Position must not be larger than size.");
+  mPosition = position;
+}
+
+bool MappedFileStream::CanRead() const { return true; }
+
+bool MappedFileStream::CanWrite() const { return false; }
+
+int64_t MappedFileStream::Position() { return mPosition; }
+
+int64_t MappedFileStream::Size() { return mSize; }
+
+void MappedFileStream::Size(int64_t /* value */) { throw runtime_error("Stream is read-only"); }
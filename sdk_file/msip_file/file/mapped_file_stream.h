@@ -0,0 +1,71 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_MAPPED_FILE_STREAM_H_
+#define SAMPLE_FILE_MAPPED_FILE_STREAM_H_
+
+#include <string>
+#include "mip/stream.h"
+
+// Read-only mip::Stream over a private mmap of a file. Pages are faulted in on demand, so large inputs
+// never need a resident heap copy.
+class MappedFileStream final : public mip::Stream {
+public:
+  // Hints for the mapping, combined with |. kPrefault maps every page up front (MAP_POPULATE), so the
+  // SDK's scans take no page faults. kHugePages asks for transparent huge pages, which file mappings get
+  // on a tmpfs or memfd mounted with huge= and, for read-only files, kernels built with READ_ONLY_THP_FOR_FS.
+  enum Hints : unsigned { kNoHints = 0, kPrefault = 1, kHugePages = 2 };
+
+  explicit MappedFileStream(const std::string& filePath, unsigned hints = kNoHints);
+  // Maps the file behind a caller-owned descriptor, such as a memfd or shared-memory segment, which is
+  // left open. name only appears in errors.
+  MappedFileStream(int fd, const std::string& name, unsigned hints = kNoHints);
+  ~MappedFileStream();
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+  // The whole mapping, for callers that hash or compare the file without copying it. nullptr when empty.
+  const uint8_t* Data() const { return mData; }
+
+private:
+  MappedFileStream(const MappedFileStream&) = delete;
+  MappedFileStream& operator=(const MappedFileStream&) = delete;
+  void Map(int fd, const std::string& name, unsigned hints);
+
+  const uint8_t* mData;
+  int64_t mSize;
+  int64_t mPosition;
+};
+
+#endif // SAMPLE_FILE_MAPPED_FILE_STREAM_H_
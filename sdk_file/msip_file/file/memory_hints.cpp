@@ -0,0 +1,93 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "memory_hints.h"
+
+#include <cstdint>
+#include <fstream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace {
+
+size_t PageBytes() {
+  static const size_t pageBytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return pageBytes;
+}
+
+} // namespace
+
+void PrefaultRead(const void* data, size_t size) {
+  if (!data || size == 0)
+    return;
+#ifdef MADV_POPULATE_READ
+  if (madvise(const_cast<void*>(data), size, MADV_POPULATE_READ) == 0)
+    return;
+#endif
+  const volatile uint8_t* bytes = static_cast<const volatile uint8_t*>(data);
+  uint8_t sum = 0;
+  for (size_t offset = 0; offset < size; offset += PageBytes())
+    sum ^= bytes[offset];
+  (void)sum;
+}
+
+void PrefaultWrite(void* data, size_t size) {
+  if (!data || size == 0)
+    return;
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(data, size, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  volatile uint8_t* bytes = static_cast<volatile uint8_t*>(data);
+  for (size_t offset = 0; offset < size; offset += PageBytes())
+    bytes[offset] = 0;
+}
+
+bool AdviseHugePages(void* data, size_t size) {
+#ifdef MADV_HUGEPAGE
+  return madvise(data, size, MADV_HUGEPAGE) == 0;
+#else
+  (void)data;
+  (void)size;
+  return false;
+#endif
+}
+
+string TransparentHugePageMode() {
+  // The active mode is the bracketed one, e.g. "always [madvise] never".
+  std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  string line;
+  if (!std::getline(in, line))
+    return string();
+  const size_t open = line.find('[');
+  const size_t close = line.find(']', open);
+  if (open == string::npos || close == string::npos)
+    return string();
+  return line.substr(open + 1, close - open - 1);
+}
@@ -0,0 +1,45 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_MEMORY_HINTS_H_
+#define SAMPLE_FILE_MEMORY_HINTS_H_
+
+#include <cstddef>
+#include <string>
+
+// Faults in every page of a mapping ahead of its use, so a scan over it takes no page faults: in one call
+// with MADV_POPULATE_READ or MADV_POPULATE_WRITE from Linux 5.14, otherwise by touching each page.
+// PrefaultWrite zeroes the memory on the fallback, so it is only for memory not written yet.
+void PrefaultRead(const void* data, size_t size);
+void PrefaultWrite(void* data, size_t size);
+
+// Asks for transparent huge pages over [data, data + size). Advisory: false when the kernel refused.
+bool AdviseHugePages(void* data, size_t size);
+
+// The kernel's transparent huge page policy: "always", "madvise" or "never", empty when unknown.
+std::string TransparentHugePageMode();
+
+#endif // SAMPLE_FILE_MEMORY_HINTS_H_
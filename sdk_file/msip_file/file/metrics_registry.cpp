@@ -0,0 +1,113 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "metrics_registry.h"
+
+#include <cmath>
+#include <limits>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace {
+
+// Help text escapes backslashes and newlines; label values also escape double quotes.
+string Escape(const string& value, bool quotes) {
+  string escaped;
+  escaped.reserve(value.size());
+  for (auto c : value) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else if (quotes && c == '"') {
+      escaped += "\\\"";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+} // namespace
+
+PrometheusWriter::PrometheusWriter() {
+  mOut.precision(std::numeric_limits<double>::digits10);
+}
+
+void PrometheusWriter::BeginFamily(const string& name, const string& help, const string& type) {
+  mOut << "# HELP " << name << " " << Escape(help, false) << "\n"
+       << "# TYPE " << name << " " << type << "\n";
+}
+
+void PrometheusWriter::AddSample(const string& name, const Labels& labels, double value) {
+  mOut << name;
+  if (!labels.empty()) {
+    mOut << "{";
+    for (size_t i = 0; i < labels.size(); ++i)
+      mOut << (i ? "," : "") << labels[i].first << "=\"" << Escape(labels[i].second, true) << "\"";
+    mOut << "}";
+  }
+  mOut << " ";
+  if (std::isinf(value)) {
+    mOut << (value > 0 ? "+Inf" : "-Inf");
+  } else {
+    mOut << value;
+  }
+  mOut << "\n";
+}
+
+void PrometheusWriter::AddCounter(const string& name, const string& help, double value) {
+  BeginFamily(name, help, "counter");
+  AddSample(name, Labels(), value);
+}
+
+void PrometheusWriter::AddGauge(const string& name, const string& help, double value) {
+  BeginFamily(name, help, "gauge");
+  AddSample(name, Labels(), value);
+}
+
+MetricsRegistry& MetricsRegistry::Shared() {
+  static MetricsRegistry* registry = new MetricsRegistry(); // Never destroyed; counters outlive static teardown.
+  return *registry;
+}
+
+MetricsRegistry::Counter& MetricsRegistry::GetCounter(const string& name, const string& help) {
+  lock_guard<mutex> lock(mMutex);
+  auto& entry = mCounters[name];
+  if (!entry.counter) {
+    entry.help = help;
+    entry.counter.reset(new Counter());
+  }
+  return *entry.counter;
+}
+
+void MetricsRegistry::Render(PrometheusWriter& writer) const {
+  lock_guard<mutex> lock(mMutex);
+  for (const auto& entry : mCounters)
+    writer.AddCounter(entry.first, entry.second.help, static_cast<double>(entry.second.counter->Get()));
+}
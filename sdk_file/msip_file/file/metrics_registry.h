@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_METRICS_REGISTRY_H_
+#define SAMPLE_FILE_METRICS_REGISTRY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Builds a Prometheus text exposition (version 0.0.4). Families are written in the order they are begun.
+class PrometheusWriter final {
+public:
+  typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+  PrometheusWriter();
+
+  // type is "counter", "gauge" or "histogram". Samples that follow belong to this family.
+  void BeginFamily(const std::string& name, const std::string& help, const std::string& type);
+
+  // name may extend the family name, e.g. with _bucket, _sum or _count.
+  void AddSample(const std::string& name, const Labels& labels, double value);
+
+  void AddCounter(const std::string& name, const std::string& help, double value);
+  void AddGauge(const std::string& name, const std::string& help, double value);
+
+  std::string ToString() const { return mOut.str(); }
+
+private:
+  std::ostringstream mOut;
+};
+
+// Process-wide counters for hot paths such as stream reads. Counters are created once by name and
+// updated with relaxed atomic adds, so recording takes no lock.
+class MetricsRegistry final {
+public:
+  class Counter final {
+  public:
+    Counter() : mValue(0) {}
+    void Add(uint64_t value) { mValue.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t Get() const { return mValue.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> mValue;
+  };
+
+  static MetricsRegistry& Shared();
+
+  // The counter registered under name, created on first use. The reference stays valid for the process
+  // lifetime, so callers can keep it in a function-local static.
+  Counter& GetCounter(const std::string& name, const std::string& help);
+
+  // Writes every counter as a Prometheus counter family, in name order.
+  void Render(PrometheusWriter& writer) const;
+
+private:
+  struct Entry {
+    std::string help;
+    std::unique_ptr<Counter> counter;
+  };
+
+  mutable std::mutex mMutex;
+  std::map<std::string, Entry> mCounters;
+};
+
+#endif // SAMPLE_FILE_METRICS_REGISTRY_H_
@@ -0,0 +1,132 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "numa_topology.h"
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// CPUs of a sysfs cpulist such as "0-3,8-11".
+vector<int> ParseCpuList(const string& list) {
+  vector<int> cpus;
+  size_t position = 0;
+  while (position < list.size()) {
+    size_t end = list.find(',', position);
+    if (end == string::npos)
+      end = list.size();
+    const string range = list.substr(position, end - position);
+    const size_t dash = range.find('-');
+    char* rest = nullptr;
+    const long first = strtol(range.c_str(), &rest, 10);
+    const long last = dash == string::npos ? first : strtol(range.c_str() + dash + 1, &rest, 10);
+    for (long cpu = first; cpu >= 0 && cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+      cpus.push_back(static_cast<int>(cpu));
+    position = end + 1;
+  }
+  return cpus;
+}
+
+} // namespace
+
+NumaTopology::NumaTopology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  const bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+  DIR* directory = opendir("/sys/devices/system/node");
+  if (directory) {
+    while (dirent* entry = readdir(directory)) {
+      if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+        continue;
+      std::ifstream file(string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+      string list;
+      if (!std::getline(file, list))
+        continue;
+      Node node;
+      node.id = atoi(entry->d_name + 4);
+      for (int cpu : ParseCpuList(list)) {
+        if (!haveAffinity || CPU_ISSET(cpu, &allowed))
+          node.cpus.push_back(cpu);
+      }
+      // Memory-only nodes, and nodes outside the cpuset, have no worker to place.
+      if (!node.cpus.empty())
+        mNodes.push_back(std::move(node));
+    }
+    closedir(directory);
+  }
+  std::sort(mNodes.begin(), mNodes.end(), [](const Node& a, const Node& b) { return a.id < b.id; });
+  // Without sysfs every CPU counts as one node.
+  if (mNodes.empty())
+    mNodes.push_back(Node{0, vector<int>()});
+}
+
+const NumaTopology& NumaTopology::Shared() {
+  static NumaTopology* topology = new NumaTopology(); // Never destroyed; pinned workers may outlive statics.
+  return *topology;
+}
+
+bool NumaTopology::PinCurrentThread(size_t index) const {
+  const Node& node = mNodes[index % mNodes.size()];
+  if (node.cpus.empty())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : node.cpus)
+    CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+int NumaTopology::CurrentNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return -1;
+  return static_cast<int>(node);
+}
+
+bool NumaTopology::PreferNode(void* data, size_t length, int node) {
+  if (node < 0)
+    return false;
+  const size_t bits = sizeof(unsigned long) * 8;
+  vector<unsigned long> mask(static_cast<size_t>(node) / bits + 1, 0);
+  mask[static_cast<size_t>(node) / bits] |= 1UL << (static_cast<size_t>(node) % bits);
+  // The kernel reads one bit fewer than maxnode.
+  return syscall(SYS_mbind, data, length, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1, 0) == 0;
+}
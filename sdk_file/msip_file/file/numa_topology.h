@@ -0,0 +1,66 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_NUMA_TOPOLOGY_H_
+#define SAMPLE_FILE_NUMA_TOPOLOGY_H_
+
+#include <cstddef>
+#include <vector>
+
+// The NUMA nodes holding CPUs this process may run on, read once from /sys/devices/system/node. A host
+// without NUMA, or a cgroup confined to one node, has a single node, and placement has nothing to do.
+class NumaTopology final {
+public:
+  static const NumaTopology& Shared();
+
+  size_t NodeCount() const { return mNodes.size(); }
+  // Kernel id of the index-th node.
+  int NodeId(size_t index) const { return mNodes[index].id; }
+
+  // Restricts the calling thread to the allowed CPUs of the index-th node, so the memory it first touches
+  // is allocated there. False when the kernel refused.
+  bool PinCurrentThread(size_t index) const;
+
+  // Kernel id of the node the calling thread is running on, -1 when unknown.
+  static int CurrentNode();
+
+  // Asks the kernel to place pages of [data, data + length) that are not touched yet on node. data is page
+  // aligned. False when the kernel refused, leaving placement to first touch.
+  static bool PreferNode(void* data, size_t length, int node);
+
+private:
+  struct Node {
+    int id;
+    std::vector<int> cpus;
+  };
+
+  NumaTopology();
+
+  std::vector<Node> mNodes;
+};
+
+#endif // SAMPLE_FILE_NUMA_TOPOLOGY_H_
@@ -0,0 +1,300 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "object_input_stream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "metrics_registry.h"
+#include "request_deadline.h"
+
+using sample::storage::ObjectLocation;
+using sample::storage::ObjectStoreClient;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+
+namespace {
+
+MetricsRegistry::Counter& InputBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_object_input_bytes_total", "Bytes the SDK read from object storage inputs");
+  return counter;
+}
+
+MetricsRegistry::Counter& BlockFetches() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_object_block_fetches_total", "Blocks of object storage inputs fetched with a range request");
+  return counter;
+}
+
+MetricsRegistry::Counter& BlockHits() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_object_block_hits_total", "Reads of object storage inputs served by a cached or prefetched block");
+  return counter;
+}
+
+} // namespace
+
+struct ObjectInputStream::Core {
+  struct Block {
+    std::vector<uint8_t> data;
+    bool ready = false;
+    bool used = false;
+    std::exception_ptr error;
+    uint64_t lastUse = 0;
+  };
+
+  Core(ObjectStoreClient& client, const ObjectLocation& location, const Options& options)
+      : client(client), location(location), options(options), size(0), clock(0), closed(false) {}
+
+  int64_t BlockCount() const {
+    return (size + static_cast<int64_t>(options.blockBytes) - 1) / static_cast<int64_t>(options.blockBytes);
+  }
+
+  // Reads block index into block, recording a failure instead of throwing it.
+  void Fill(Block& block, int64_t index) {
+    try {
+      const int64_t start = index * static_cast<int64_t>(options.blockBytes);
+      const size_t length = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(options.blockBytes), size - start));
+      block.data.resize(length);
+      const auto read = client.ReadRange(location, etag, start, block.data.data(), length);
+      BlockFetches().Add(1);
+      if (read.bytes != length)
+        throw runtime_error("Object ended before the size it reported");
+    }
+    catch (...) {
+      block.data.clear();
+      block.error = std::current_exception();
+    }
+  }
+
+  // The ready block index, fetched on this thread unless a prefetch has it already. Rethrows a failed fetch,
+  // which is dropped so the next read of the block tries again.
+  shared_ptr<Block> Get(int64_t index) {
+    unique_lock<std::mutex> lock(mutex);
+    auto found = blocks.find(index);
+    shared_ptr<Block> block;
+    if (found == blocks.end()) {
+      block = std::make_shared<Block>();
+      blocks[index] = block;
+      lock.unlock();
+      Fill(*block, index);
+      lock.lock();
+      block->ready = true;
+      condition.notify_all();
+    } else {
+      block = found->second;
+      BlockHits().Add(1);
+      condition.wait(lock, [&block]() { return block->ready; });
+    }
+    if (block->error) {
+      found = blocks.find(index);
+      if (found != blocks.end() && found->second == block)
+        blocks.erase(found);
+      std::rethrow_exception(block->error);
+    }
+    block->used = true;
+    block->lastUse = ++clock;
+    Evict();
+    return block;
+  }
+
+  // Starts fetching block index on a transfer thread, unless it is cached or on its way.
+  void Prefetch(const shared_ptr<Core>& self, int64_t index) {
+    shared_ptr<Block> block;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (blocks.count(index) != 0)
+        return;
+      block = std::make_shared<Block>();
+      blocks[index] = block;
+    }
+    const auto deadline = sample::deadline::Deadline::Current();
+    client.Submit([self, block, index, deadline]() {
+      sample::deadline::ScopedDeadline deadlineScope(deadline);
+      bool skip;
+      {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        skip = self->closed;
+      }
+      if (skip)
+        block->error = std::make_exception_ptr(runtime_error("Stream was closed"));
+      else
+        self->Fill(*block, index);
+      std::lock_guard<std::mutex> lock(self->mutex);
+      block->ready = true;
+      self->condition.notify_all();
+    });
+  }
+
+  // Drops the least recently read blocks beyond options.cacheBlocks. Prefetched blocks not read yet only
+  // go when nothing else can, and blocks on their way stay.
+  void Evict() {
+    while (blocks.size() > options.cacheBlocks) {
+      auto oldest = blocks.end();
+      for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+        const auto& block = *it->second;
+        if (!block.ready)
+          continue;
+        if (oldest == blocks.end() || (block.used && !oldest->second->used) ||
+            (block.used == oldest->second->used && block.lastUse < oldest->second->lastUse))
+          oldest = it;
+      }
+      if (oldest == blocks.end())
+        return;
+      blocks.erase(oldest);
+    }
+  }
+
+  ObjectStoreClient& client;
+  const ObjectLocation location;
+  const Options options;
+  int64_t size;
+  string etag;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::map<int64_t, shared_ptr<Block>> blocks;
+  uint64_t clock;
+  bool closed;
+};
+
+ObjectInputStream::Options ObjectInputStream::Defaults() {
+  Options options;
+  options.blockBytes = 256 * 1024;
+  options.cacheBlocks = 64;
+  options.maxReadAheadBlocks = 16;
+  return options;
+}
+
+bool ObjectInputStream::IsValid(const Options& options) {
+  return options.blockBytes >= kMinBlockBytes && options.blockBytes <= kMaxBlockBytes &&
+      options.cacheBlocks >= options.maxReadAheadBlocks + 2;
+}
+
+ObjectInputStream::ObjectInputStream(ObjectStoreClient& client, const ObjectLocation& location, const Options& options)
+    : mCore(std::make_shared<Core>(client, location, options)),
+      mPosition(0),
+      mLastBlock(-1),
+      mReadAheadBlocks(0) {
+  if (!IsValid(options))
+    throw runtime_error("Invalid object input stream options");
+  auto first = std::make_shared<Core::Block>();
+  first->data.resize(options.blockBytes);
+  const auto read = client.ReadRange(location, "", 0, first->data.data(), options.blockBytes);
+  BlockFetches().Add(1);
+  first->data.resize(read.bytes);
+  if (read.objectSize >= 0)
+    mCore->size = read.objectSize;
+  else if (read.bytes < options.blockBytes)
+    mCore->size = static_cast<int64_t>(read.bytes);
+  else
+    throw runtime_error(location.host + " did not report the size of " + location.name);
+  if (static_cast<int64_t>(read.bytes) != std::min<int64_t>(mCore->size, static_cast<int64_t>(options.blockBytes)))
+    throw runtime_error("Object ended before the size it reported");
+  mCore->etag = read.etag;
+  first->ready = true;
+  if (mCore->size > 0)
+    mCore->blocks[0] = first;
+  if (mCore->BlockCount() > 1)
+    mCore->Prefetch(mCore, mCore->BlockCount() - 1);
+}
+
+ObjectInputStream::~ObjectInputStream() {
+  std::lock_guard<std::mutex> lock(mCore->mutex);
+  mCore->closed = true;
+  mCore->blocks.clear();
+}
+
+const string& ObjectInputStream::GetETag() const { return mCore->etag; }
+
+void ObjectInputStream::UpdateReadAhead(int64_t index) {
+  if (index == mLastBlock)
+    return;
+  if (index == mLastBlock + 1)
+    mReadAheadBlocks = std::min(std::max<size_t>(mReadAheadBlocks * 2, 1), mCore->options.maxReadAheadBlocks);
+  else
+    mReadAheadBlocks = 0;
+  mLastBlock = index;
+  const int64_t end = std::min(mCore->BlockCount(), index + 1 + static_cast<int64_t>(mReadAheadBlocks));
+  for (int64_t next = index + 1; next < end; ++next)
+    mCore->Prefetch(mCore, next);
+}
+
+int64_t ObjectInputStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  const int64_t size = mCore->size;
+  if (bufferLength <= 0 || mPosition >= size)
+    return 0;
+  const int64_t blockBytes = static_cast<int64_t>(mCore->options.blockBytes);
+  const int64_t wanted = std::min(bufferLength, size - mPosition);
+  int64_t done = 0;
+  while (done < wanted) {
+    const int64_t position = mPosition + done;
+    const int64_t index = position / blockBytes;
+    UpdateReadAhead(index);
+    const auto block = mCore->Get(index);
+    const int64_t offset = position - index * blockBytes;
+    const int64_t count = std::min(wanted - done, static_cast<int64_t>(block->data.size()) - offset);
+    memcpy(buffer + done, block->data.data() + offset, static_cast<size_t>(count));
+    done += count;
+  }
+  mPosition += done;
+  InputBytes().Add(static_cast<uint64_t>(done));
+  return done;
+}
+
+int64_t ObjectInputStream::Write(const uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is read-only");
+}
+
+bool ObjectInputStream::Flush() { return true; }
+
+void ObjectInputStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (position > mCore->size)
+    throw runtime_error("Position must not be larger than size.");
+  mPosition = position;
+}
+
+bool ObjectInputStream::CanRead() const { return true; }
+
+bool ObjectInputStream::CanWrite() const { return false; }
+
+int64_t ObjectInputStream::Position() { return mPosition; }
+
+int64_t ObjectInputStream::Size() { return mCore->size; }
+
+void ObjectInputStream::Size(int64_t /* value */) { throw runtime_error("Stream is read-only"); }
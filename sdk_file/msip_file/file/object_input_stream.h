@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_OBJECT_INPUT_STREAM_H_
+#define SAMPLE_FILE_OBJECT_INPUT_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "mip/stream.h"
+
+#include "object_store_client.h"
+
+// Read-only mip::Stream over an object in S3 or Azure Blob storage, read with range requests. The object is
+// read in blocks kept in a small LRU cache, so the SDK's many small reads cost few requests. Opening reads
+// the first block, which also yields the object's size and entity tag, and prefetches the last one, since
+// zip containers and compound files keep their directories at the end. Reads of consecutive blocks double
+// a readahead window up to maxReadAheadBlocks, fetched in parallel on the client's transfer threads; a
+// jump elsewhere resets it. Every range is read with If-Match on the entity tag, so a stream never mixes
+// two versions of the object.
+class ObjectInputStream final : public mip::Stream {
+public:
+  struct Options {
+    size_t blockBytes;
+    // At least maxReadAheadBlocks + 2, so a readahead window never evicts the block being read.
+    size_t cacheBlocks;
+    size_t maxReadAheadBlocks;
+  };
+
+  static const size_t kMinBlockBytes = 4096;
+  static const size_t kMaxBlockBytes = 64 * 1024 * 1024;
+
+  // 256 KiB blocks, 64 of them cached, up to 16 read ahead.
+  static Options Defaults();
+  static bool IsValid(const Options& options);
+
+  // Reads the first block. Throws std::runtime_error when the object cannot be read.
+  ObjectInputStream(sample::storage::ObjectStoreClient& client, const sample::storage::ObjectLocation& location, const Options& options);
+  ~ObjectInputStream();
+
+  const std::string& GetETag() const;
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  ObjectInputStream(const ObjectInputStream&) = delete;
+  ObjectInputStream& operator=(const ObjectInputStream&) = delete;
+
+  // What prefetches still running after the stream is gone need, which they keep alive.
+  struct Core;
+
+  // Moves the readahead window for a read of block index, and starts fetching what it newly covers.
+  void UpdateReadAhead(int64_t index);
+
+  std::shared_ptr<Core> mCore;
+  int64_t mPosition;
+  int64_t mLastBlock;
+  size_t mReadAheadBlocks;
+};
+
+#endif // SAMPLE_FILE_OBJECT_INPUT_STREAM_H_
@@ -0,0 +1,246 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "object_output_stream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+#include "metrics_registry.h"
+#include "request_deadline.h"
+
+using sample::storage::ObjectLocation;
+using sample::storage::ObjectStoreClient;
+using std::runtime_error;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+MetricsRegistry::Counter& PartsUploaded() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_object_parts_uploaded_total", "Parts of object storage outputs uploaded");
+  return counter;
+}
+
+MetricsRegistry::Counter& OutputsCommitted() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_object_outputs_committed_total", "Object storage outputs whose upload was completed");
+  return counter;
+}
+
+} // namespace
+
+struct ObjectOutputStream::Uploads {
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t running = 0;
+  std::exception_ptr error;
+  // What CompleteUpload needs of each part sent, by index.
+  vector<string> parts;
+};
+
+ObjectOutputStream::Options ObjectOutputStream::Defaults() {
+  Options options;
+  options.partBytes = 8 * 1024 * 1024;
+  options.partsInFlight = 4;
+  return options;
+}
+
+bool ObjectOutputStream::IsValid(const Options& options) {
+  return options.partBytes >= kMinPartBytes && options.partBytes <= kMaxPartBytes && options.partsInFlight > 0;
+}
+
+ObjectOutputStream::ObjectOutputStream(ObjectStoreClient& client, const ObjectLocation& location, const Options& options)
+    : mClient(client),
+      mLocation(location),
+      mOptions(options),
+      mUploads(std::make_shared<Uploads>()),
+      mPosition(0),
+      mSize(0),
+      mFinished(false) {
+  if (!IsValid(options))
+    throw runtime_error("Invalid object output stream options");
+  mUploadId = client.BeginUpload(location);
+}
+
+ObjectOutputStream::~ObjectOutputStream() {
+  if (mFinished)
+    return;
+  try {
+    WaitForUploads();
+  }
+  catch (const std::exception&) {
+    // Aborted below either way.
+  }
+  mClient.AbortUpload(mLocation, mUploadId);
+}
+
+void ObjectOutputStream::StartUpload(size_t index, size_t length) {
+  auto data = std::make_shared<vector<uint8_t>>(std::move(mParts[index]));
+  mParts[index] = vector<uint8_t>();
+  mSent[index] = true;
+  data->resize(length);
+  {
+    unique_lock<std::mutex> lock(mUploads->mutex);
+    mUploads->condition.wait(lock, [this]() { return mUploads->running < mOptions.partsInFlight; });
+    if (mUploads->error)
+      std::rethrow_exception(mUploads->error);
+    ++mUploads->running;
+  }
+  auto uploads = mUploads;
+  auto& client = mClient;
+  const auto location = mLocation;
+  const auto uploadId = mUploadId;
+  const auto deadline = sample::deadline::Deadline::Current();
+  mClient.Submit([uploads, &client, location, uploadId, deadline, index, data]() {
+    sample::deadline::ScopedDeadline deadlineScope(deadline);
+    string part;
+    std::exception_ptr error;
+    try {
+      part = client.UploadPart(location, uploadId, static_cast<int>(index) + 1, data->data(), data->size());
+      PartsUploaded().Add(1);
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(uploads->mutex);
+    if (error && !uploads->error)
+      uploads->error = error;
+    if (uploads->parts.size() <= index)
+      uploads->parts.resize(index + 1);
+    uploads->parts[index] = part;
+    --uploads->running;
+    uploads->condition.notify_all();
+  });
+}
+
+void ObjectOutputStream::WaitForUploads() {
+  unique_lock<std::mutex> lock(mUploads->mutex);
+  mUploads->condition.wait(lock, [this]() { return mUploads->running == 0; });
+  if (mUploads->error)
+    std::rethrow_exception(mUploads->error);
+}
+
+void ObjectOutputStream::Finish() {
+  if (mFinished)
+    return;
+  const int64_t partBytes = static_cast<int64_t>(mOptions.partBytes);
+  // An empty object is still one, empty, part.
+  const size_t count = static_cast<size_t>(std::max<int64_t>((mSize + partBytes - 1) / partBytes, 1));
+  mParts.resize(std::max(mParts.size(), count));
+  mSent.resize(mParts.size(), false);
+  for (size_t index = 0; index < count; ++index) {
+    if (!mSent[index])
+      StartUpload(index, static_cast<size_t>(std::min(partBytes, std::max<int64_t>(mSize - static_cast<int64_t>(index) * partBytes, 0))));
+  }
+  WaitForUploads();
+  vector<string> parts(mUploads->parts.begin(), mUploads->parts.begin() + static_cast<std::ptrdiff_t>(count));
+  mClient.CompleteUpload(mLocation, mUploadId, parts);
+  mFinished = true;
+  mParts.clear();
+  OutputsCommitted().Add(1);
+}
+
+int64_t ObjectOutputStream::Read(uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is write-only");
+}
+
+int64_t ObjectOutputStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  if (mFinished)
+    throw runtime_error("Output '" + mLocation.name + "' was committed");
+  if (bufferLength <= 0)
+    return 0;
+  const int64_t partBytes = static_cast<int64_t>(mOptions.partBytes);
+  int64_t written = 0;
+  while (written < bufferLength) {
+    const int64_t position = mPosition + written;
+    const size_t index = static_cast<size_t>(position / partBytes);
+    if (index >= mParts.size()) {
+      mParts.resize(index + 1);
+      mSent.resize(index + 1, false);
+    }
+    if (mSent[index])
+      throw runtime_error("Output '" + mLocation.name + "' was uploaded past this position; only its first part can be rewritten");
+    const size_t offset = static_cast<size_t>(position - static_cast<int64_t>(index) * partBytes);
+    const size_t count = static_cast<size_t>(std::min<int64_t>(bufferLength - written, partBytes - static_cast<int64_t>(offset)));
+    auto& part = mParts[index];
+    if (part.size() < offset + count)
+      part.resize(offset + count);
+    memcpy(part.data() + offset, buffer + written, count);
+    written += static_cast<int64_t>(count);
+  }
+  mPosition += written;
+  mSize = std::max(mSize, mPosition);
+
+  // Parts before the one being written are complete; the first one waits for Finish.
+  const size_t current = static_cast<size_t>(mPosition / partBytes);
+  for (size_t index = 1; index < current && index < mParts.size(); ++index) {
+    if (!mSent[index])
+      StartUpload(index, mOptions.partBytes);
+  }
+  return written;
+}
+
+bool ObjectOutputStream::Flush() { return !mFinished; }
+
+void ObjectOutputStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  mPosition = position;
+}
+
+bool ObjectOutputStream::CanRead() const { return false; }
+
+bool ObjectOutputStream::CanWrite() const { return true; }
+
+int64_t ObjectOutputStream::Position() { return mPosition; }
+
+int64_t ObjectOutputStream::Size() { return mSize; }
+
+void ObjectOutputStream::Size(int64_t value) {
+  if (value == mSize)
+    return;
+  const int64_t partBytes = static_cast<int64_t>(mOptions.partBytes);
+  for (size_t index = 1; index < mSent.size(); ++index) {
+    if (mSent[index] && value < static_cast<int64_t>(index + 1) * partBytes)
+      throw runtime_error("Output '" + mLocation.name + "' cannot be resized below what was uploaded");
+  }
+  if (value < 0 || mFinished)
+    throw runtime_error("Output '" + mLocation.name + "' cannot be resized");
+  mSize = value;
+  // Growing the output again fills the cut off range with zeros.
+  for (size_t index = 0; index < mParts.size(); ++index) {
+    const int64_t keep = std::max<int64_t>(std::min(value - static_cast<int64_t>(index) * partBytes, partBytes), 0);
+    if (static_cast<int64_t>(mParts[index].size()) > keep)
+      mParts[index].resize(static_cast<size_t>(keep));
+  }
+}
@@ -0,0 +1,104 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_OBJECT_OUTPUT_STREAM_H_
+#define SAMPLE_FILE_OBJECT_OUTPUT_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/stream.h"
+
+#include "object_store_client.h"
+
+// Write-only mip::Stream that uploads an object to S3 or Azure Blob storage in parts, so a committed output
+// goes to the store as it is written instead of through a local file. A part is uploaded on the client's
+// transfer threads once a write goes past it, with at most partsInFlight uploads running and holding
+// memory. The first part stays in memory until Finish, because the SDK patches headers at the start of its
+// output after writing the rest; writing into any other part already sent throws. Nothing is visible in
+// the store before Finish, and an unfinished upload is aborted when the stream goes away.
+class ObjectOutputStream final : public mip::Stream {
+public:
+  struct Options {
+    // At least 5 MiB, the smallest part S3 accepts but for the last.
+    size_t partBytes;
+    size_t partsInFlight;
+  };
+
+  static const size_t kMinPartBytes = 5 * 1024 * 1024;
+  static const size_t kMaxPartBytes = 512 * 1024 * 1024;
+
+  // 8 MiB parts, 4 in flight.
+  static Options Defaults();
+  static bool IsValid(const Options& options);
+
+  // Starts the upload. Throws std::runtime_error.
+  ObjectOutputStream(sample::storage::ObjectStoreClient& client, const sample::storage::ObjectLocation& location, const Options& options);
+  ~ObjectOutputStream();
+
+  // Uploads the parts still in memory and commits the object. Throws when any part failed.
+  void Finish();
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  ObjectOutputStream(const ObjectOutputStream&) = delete;
+  ObjectOutputStream& operator=(const ObjectOutputStream&) = delete;
+
+  // Upload state shared with the transfer threads.
+  struct Uploads;
+
+  // Sends part index, padded or cut to length, once fewer than partsInFlight uploads are running.
+  void StartUpload(size_t index, size_t length);
+  // Waits for every running upload and rethrows the first failure.
+  void WaitForUploads();
+
+  sample::storage::ObjectStoreClient& mClient;
+  const sample::storage::ObjectLocation mLocation;
+  const Options mOptions;
+  std::string mUploadId;
+  std::shared_ptr<Uploads> mUploads;
+  // Content of the parts not sent yet, and which parts were.
+  std::vector<std::vector<uint8_t>> mParts;
+  std::vector<bool> mSent;
+  int64_t mPosition;
+  int64_t mSize;
+  bool mFinished;
+};
+
+#endif // SAMPLE_FILE_OBJECT_OUTPUT_STREAM_H_
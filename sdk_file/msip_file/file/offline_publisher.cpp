@@ -0,0 +1,137 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "offline_publisher.h"
+
+#include <stdexcept>
+
+#include "mip/protection/get_template_settings.h"
+#include "mip/protection/template_descriptor.h"
+#include "mip/protection_descriptor_builder.h"
+
+using mip::ProtectionDescriptor;
+using mip::ProtectionDescriptorBuilder;
+using mip::ProtectionEngine;
+using mip::ProtectionHandler;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+const std::chrono::hours OfflinePublisher::kRefreshInterval(24);
+
+OfflinePublisher::OfflinePublisher(const shared_ptr<ProtectionEngine>& engine)
+    : mEngine(engine),
+      mReady(false),
+      mLoads(0),
+      mPublished(0),
+      mRetries(0) {
+}
+
+void OfflinePublisher::Prepare() {
+  lock_guard<mutex> lock(mMutex);
+  if (!mReady || steady_clock::now() - mLoadedAt >= kRefreshInterval)
+    Load();
+}
+
+shared_ptr<ProtectionHandler> OfflinePublisher::Publish(const string& templateId) {
+#ifndef MIP_OFFLINE_PUBLISHING_ENABLED
+  (void)templateId;
+  throw std::runtime_error("Offline publishing is not enabled in this build");
+#else
+  for (int attempt = 0;; ++attempt) {
+    auto descriptor = GetDescriptor(templateId, attempt > 0);
+    try {
+      ProtectionHandler::PublishingSettings settings(descriptor);
+      settings.SetIsOfflineOnly(true);
+      auto protection = mEngine->CreateProtectionHandlerForPublishing(settings, nullptr);
+      lock_guard<mutex> lock(mMutex);
+      ++mPublished;
+      return protection;
+    }
+    catch (const std::exception&) {
+      if (attempt > 0)
+        throw;
+      // Usually an expired certificate: reload it and the templates, then try once more.
+      lock_guard<mutex> lock(mMutex);
+      ++mRetries;
+    }
+  }
+#endif // MIP_OFFLINE_PUBLISHING_ENABLED
+}
+
+OfflinePublisher::Stats OfflinePublisher::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  Stats stats;
+  stats.ready = mReady;
+  stats.templates = mDescriptors.size();
+  stats.loads = mLoads;
+  stats.published = mPublished;
+  stats.retries = mRetries;
+  return stats;
+}
+
+shared_ptr<ProtectionDescriptor> OfflinePublisher::GetDescriptor(const string& templateId, bool reload) {
+  // Loading holds the lock, so concurrent publishes wait for one certificate load instead of each starting one.
+  lock_guard<mutex> lock(mMutex);
+  if (reload || !mReady || steady_clock::now() - mLoadedAt >= kRefreshInterval)
+    Load();
+  auto it = mDescriptors.find(templateId);
+  if (it == mDescriptors.end())
+    throw std::runtime_error("Template is not available to this user: " + templateId);
+  return it->second;
+}
+
+void OfflinePublisher::Load() {
+  mReady = false;
+  mEngine->LoadUserCertSync(nullptr);
+
+  auto templateSettings = mip::GetTemplatesSettings::CreateGetTemplatesSettings();
+  templateSettings->EnableCaching(true);
+  templateSettings->ForceRefresh(mLoads > 0);
+#ifdef MIP_OFFLINE_PUBLISHING_ENABLED
+  templateSettings->SetFetchSerializedTemplates(true);
+#endif // MIP_OFFLINE_PUBLISHING_ENABLED
+  auto templates = mEngine->GetTemplates(nullptr, templateSettings);
+
+  // A serialized template carries the rights, so building from it needs no lookup when publishing.
+  std::map<string, shared_ptr<ProtectionDescriptor>> descriptors;
+  for (const auto& templateDescriptor : templates) {
+#ifdef MIP_OFFLINE_PUBLISHING_ENABLED
+    auto builder = templateDescriptor->HasSerializedTemplate()
+        ? ProtectionDescriptorBuilder::CreateFromSerializedTemplate(templateDescriptor->GetSerializedTemplate())
+        : ProtectionDescriptorBuilder::CreateFromTemplate(templateDescriptor->GetId());
+#else
+    auto builder = ProtectionDescriptorBuilder::CreateFromTemplate(templateDescriptor->GetId());
+#endif // MIP_OFFLINE_PUBLISHING_ENABLED
+    descriptors[templateDescriptor->GetId()] = builder->Build();
+  }
+  mDescriptors.swap(descriptors);
+  mLoadedAt = steady_clock::now();
+  mReady = true;
+  ++mLoads;
+}
@@ -0,0 +1,80 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_OFFLINE_PUBLISHER_H_
+#define SAMPLE_FILE_OFFLINE_PUBLISHER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "mip/protection/protection_engine.h"
+#include "mip/protection/protection_handler.h"
+#include "mip/protection_descriptor.h"
+
+// Publishes protection locally with one engine's cached user certificate (client licensor certificate)
+// and templates. Both are loaded once and refreshed after kRefreshInterval, or when a publish fails,
+// which is how an expired certificate shows up. Every other publish is CPU only.
+class OfflinePublisher final {
+public:
+  struct Stats {
+    bool ready;
+    size_t templates;
+    uint64_t loads;
+    uint64_t published;
+    uint64_t retries;
+  };
+
+  static const std::chrono::hours kRefreshInterval;
+
+  explicit OfflinePublisher(const std::shared_ptr<mip::ProtectionEngine>& engine);
+
+  // Loads the certificate and templates unless they are loaded and fresh. Goes online.
+  void Prepare();
+
+  // New publishing handler, with its own content key and publishing license, for templateId.
+  std::shared_ptr<mip::ProtectionHandler> Publish(const std::string& templateId);
+
+  Stats GetStats() const;
+
+private:
+  std::shared_ptr<mip::ProtectionDescriptor> GetDescriptor(const std::string& templateId, bool reload);
+  void Load();
+
+  std::shared_ptr<mip::ProtectionEngine> mEngine;
+  mutable std::mutex mMutex;
+  bool mReady;
+  std::chrono::steady_clock::time_point mLoadedAt;
+  std::map<std::string, std::shared_ptr<mip::ProtectionDescriptor>> mDescriptors;
+  uint64_t mLoads;
+  uint64_t mPublished;
+  uint64_t mRetries;
+};
+
+#endif // SAMPLE_FILE_OFFLINE_PUBLISHER_H_
@@ -0,0 +1,347 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "operation_budget.h"
+
+#include <time.h>
+
+#include "content_hash.h"
+#include "file_identity.h"
+#include "mapped_file_stream.h"
+#include "metrics_registry.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+// Stream calls between reads of the thread CPU clock, which is a system call.
+static const unsigned kCpuCheckInterval = 16;
+
+thread_local shared_ptr<OperationBudget> tCurrent;
+// The budget this thread last charged, and its CPU clock then.
+thread_local uint64_t tChargedId = 0;
+thread_local int64_t tChargedCpuNs = 0;
+thread_local unsigned tCalls = 0;
+
+int64_t ThreadCpuNs() {
+  struct timespec now;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0)
+    return 0;
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+} // namespace
+
+std::atomic<int64_t> OperationBudget::sCpuMs(0);
+std::atomic<int64_t> OperationBudget::sOutputBytes(0);
+std::atomic<uint64_t> OperationBudget::sNextId(1);
+
+void OperationBudget::Configure(const Limits& limits) {
+  sCpuMs = limits.cpuMs > 0 ? limits.cpuMs : 0;
+  sOutputBytes = limits.outputBytes > 0 ? limits.outputBytes : 0;
+}
+
+OperationBudget::Limits OperationBudget::GetLimits() {
+  Limits limits;
+  limits.cpuMs = sCpuMs.load();
+  limits.outputBytes = sOutputBytes.load();
+  return limits;
+}
+
+const shared_ptr<OperationBudget>& OperationBudget::Current() {
+  return tCurrent;
+}
+
+void OperationBudget::ThrowIfCurrentExceeded() {
+  if (tCurrent)
+    tCurrent->ThrowIfExceeded();
+}
+
+OperationBudget::OperationBudget(const Limits& limits)
+    : mId(sNextId++),
+      mCpuLimitNs(limits.cpuMs * 1000000),
+      mOutputLimit(limits.outputBytes),
+      mCpuNs(0),
+      mOutputBytes(0),
+      mExceeded(static_cast<int>(Resource::None)) {
+  // The thread starting the operation is charged from here on.
+  tChargedId = mId;
+  tChargedCpuNs = ThreadCpuNs();
+  tCalls = 0;
+}
+
+void OperationBudget::ChargeCpu() {
+  ThrowIfExceeded();
+  if (mCpuLimitNs == 0)
+    return;
+  if (tChargedId == mId && ++tCalls % kCpuCheckInterval != 0)
+    return;
+  const int64_t now = ThreadCpuNs();
+  // A thread that charged another budget since, such as an SDK worker shared by several files, starts
+  // counting afresh rather than charging this one for the other file's work.
+  const bool charging = tChargedId == mId;
+  const int64_t used = charging ? now - tChargedCpuNs : 0;
+  tChargedId = mId;
+  tChargedCpuNs = now;
+  tCalls = 0;
+  if (charging && mCpuNs.fetch_add(used, std::memory_order_relaxed) + used > mCpuLimitNs)
+    Exceed(Resource::Cpu);
+}
+
+void OperationBudget::ChargeOutput(int64_t bytes) {
+  ThrowIfExceeded();
+  if (mOutputLimit > 0 && mOutputBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes > mOutputLimit)
+    Exceed(Resource::Output);
+  ChargeCpu();
+}
+
+void OperationBudget::Watch(const shared_ptr<mip::AsyncControl>& control) {
+  if (!control)
+    return;
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (Exceeded() == Resource::None) {
+      for (auto it = mControls.begin(); it != mControls.end();)
+        it = it->expired() ? mControls.erase(it) : it + 1;
+      mControls.push_back(control);
+      return;
+    }
+  }
+  control->Cancel();
+}
+
+void OperationBudget::SetInput(const string& filePath) {
+  lock_guard<mutex> lock(mMutex);
+  mInput = filePath;
+}
+
+string OperationBudget::GetInput() const {
+  lock_guard<mutex> lock(mMutex);
+  return mInput;
+}
+
+void OperationBudget::Exceed(Resource resource) {
+  static auto& cpuExceeded = MetricsRegistry::Shared().GetCounter(
+      "msip_native_budget_cpu_exceeded_total", "File operations cancelled for using more CPU time than their budget");
+  static auto& outputExceeded = MetricsRegistry::Shared().GetCounter(
+      "msip_native_budget_output_exceeded_total", "File operations cancelled for writing more than their output budget");
+  int none = static_cast<int>(Resource::None);
+  if (mExceeded.compare_exchange_strong(none, static_cast<int>(resource), std::memory_order_acq_rel)) {
+    (resource == Resource::Cpu ? cpuExceeded : outputExceeded).Add(1);
+    std::vector<std::weak_ptr<mip::AsyncControl>> controls;
+    {
+      lock_guard<mutex> lock(mMutex);
+      controls.swap(mControls);
+    }
+    for (const auto& weak : controls) {
+      if (auto control = weak.lock())
+        control->Cancel();
+    }
+  }
+  ThrowIfExceeded();
+}
+
+void OperationBudget::ThrowIfExceeded() const {
+  const auto resource = Exceeded();
+  if (resource != Resource::None)
+    throw BudgetExceededError(resource);
+}
+
+BudgetExceededError::BudgetExceededError(OperationBudget::Resource resource)
+    : std::runtime_error(resource == OperationBudget::Resource::Cpu ? "Operation exceeded its CPU time budget"
+                                                                    : "Operation exceeded its output size budget"),
+      mResource(resource) {
+}
+
+ScopedOperationBudget::ScopedOperationBudget() {
+  const auto limits = OperationBudget::GetLimits();
+  if (limits.cpuMs == 0 && limits.outputBytes == 0)
+    return;
+  mPrevious = tCurrent;
+  mBudget = std::make_shared<OperationBudget>(limits);
+  tCurrent = mBudget;
+}
+
+ScopedOperationBudget::~ScopedOperationBudget() {
+  if (!mBudget)
+    return;
+  tCurrent = mPrevious;
+  if (mBudget->Exceeded() == OperationBudget::Resource::None)
+    return;
+  const string input = mBudget->GetInput();
+  if (input.empty())
+    return;
+  try {
+    InputQuarantine::Instance().Add(input);
+  }
+  catch (const std::exception&) {
+  }
+}
+
+shared_ptr<mip::Stream> BudgetedStream::Wrap(const shared_ptr<mip::Stream>& inner, const shared_ptr<OperationBudget>& budget) {
+  if (!inner || (!budget && sample::cost::CurrentKey() == sample::cost::kNoKey))
+    return inner;
+  return std::make_shared<BudgetedStream>(inner, budget);
+}
+
+BudgetedStream::BudgetedStream(const shared_ptr<mip::Stream>& inner, const shared_ptr<OperationBudget>& budget)
+    : mInner(inner), mBudget(budget), mCostKey(sample::cost::CurrentKey()) {
+}
+
+int64_t BudgetedStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  if (mBudget)
+    mBudget->ChargeCpu();
+  const int64_t read = mInner->Read(buffer, bufferLength);
+  if (read > 0)
+    sample::cost::Add(mCostKey, sample::cost::Counter::BytesRead, static_cast<uint64_t>(read));
+  return read;
+}
+
+int64_t BudgetedStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  // Charged before writing, so an expanding input never writes past its budget.
+  if (mBudget)
+    mBudget->ChargeOutput(bufferLength);
+  const int64_t written = mInner->Write(buffer, bufferLength);
+  if (written > 0)
+    sample::cost::Add(mCostKey, sample::cost::Counter::BytesWritten, static_cast<uint64_t>(written));
+  return written;
+}
+
+bool BudgetedStream::Flush() {
+  return mInner->Flush();
+}
+
+void BudgetedStream::Seek(int64_t position) {
+  mInner->Seek(position);
+}
+
+bool BudgetedStream::CanRead() const {
+  return mInner->CanRead();
+}
+
+bool BudgetedStream::CanWrite() const {
+  return mInner->CanWrite();
+}
+
+int64_t BudgetedStream::Position() {
+  return mInner->Position();
+}
+
+int64_t BudgetedStream::Size() {
+  return mInner->Size();
+}
+
+void BudgetedStream::Size(int64_t value) {
+  mInner->Size(value);
+}
+
+const int InputQuarantine::kDefaultTtlSeconds;
+const size_t InputQuarantine::kCapacity;
+
+InputQuarantine& InputQuarantine::Instance() {
+  static InputQuarantine instance;
+  return instance;
+}
+
+InputQuarantine::InputQuarantine() : mTtlSeconds(kDefaultTtlSeconds), mSize(0) {
+}
+
+void InputQuarantine::SetTtl(std::chrono::seconds ttl) {
+  lock_guard<mutex> lock(mMutex);
+  mTtlSeconds = ttl.count() > 0 ? ttl.count() : 0;
+  if (mTtlSeconds == 0)
+    mEntries.clear();
+  mSize = mEntries.size();
+}
+
+void InputQuarantine::Add(const string& filePath) {
+  static auto& quarantined = MetricsRegistry::Shared().GetCounter(
+      "msip_native_quarantined_inputs_total", "Inputs quarantined after going over their operation budget");
+  FileIdentity identity;
+  if (mTtlSeconds.load() == 0 || !GetFileIdentity(filePath, identity) || identity.size <= 0)
+    return;
+  MappedFileStream file(filePath);
+  const Key key(file.Size(), XxHash64(file.Data(), static_cast<size_t>(file.Size()), 0));
+  lock_guard<mutex> lock(mMutex);
+  const auto now = Clock::now();
+  mEntries[key] = now;
+  Prune(now);
+  mSize = mEntries.size();
+  quarantined.Add(1);
+}
+
+bool InputQuarantine::Contains(const string& filePath) {
+  static auto& rejected = MetricsRegistry::Shared().GetCounter(
+      "msip_native_quarantine_rejections_total", "Operations refused because their input is quarantined");
+  if (mSize.load(std::memory_order_relaxed) == 0)
+    return false;
+  FileIdentity identity;
+  if (!GetFileIdentity(filePath, identity) || identity.size <= 0)
+    return false;
+  const std::chrono::seconds ttl(mTtlSeconds.load());
+  {
+    lock_guard<mutex> lock(mMutex);
+    const auto now = Clock::now();
+    bool candidate = false;
+    for (auto it = mEntries.lower_bound(Key(identity.size, 0)); it != mEntries.end() && it->first.first == identity.size; ++it)
+      candidate = candidate || now - it->second < ttl;
+    if (!candidate)
+      return false;
+  }
+  uint64_t hash;
+  try {
+    MappedFileStream file(filePath);
+    hash = XxHash64(file.Data(), static_cast<size_t>(file.Size()), 0);
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  lock_guard<mutex> lock(mMutex);
+  auto it = mEntries.find(Key(identity.size, hash));
+  if (it == mEntries.end() || Clock::now() - it->second >= ttl)
+    return false;
+  rejected.Add(1);
+  return true;
+}
+
+void InputQuarantine::Prune(Clock::time_point now) {
+  const std::chrono::seconds ttl(mTtlSeconds.load());
+  auto oldest = mEntries.end();
+  for (auto it = mEntries.begin(); it != mEntries.end();) {
+    if (now - it->second >= ttl) {
+      it = mEntries.erase(it);
+      continue;
+    }
+    if (oldest == mEntries.end() || it->second < oldest->second)
+      oldest = it;
+    ++it;
+  }
+  if (mEntries.size() > kCapacity && oldest != mEntries.end())
+    mEntries.erase(oldest);
+}
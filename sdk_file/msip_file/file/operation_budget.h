@@ -0,0 +1,203 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_OPERATION_BUDGET_H_
+#define SAMPLE_FILE_OPERATION_BUDGET_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cost_account.h"
+#include "mip/common_types.h"
+#include "mip/stream.h"
+
+// CPU time and output bytes one file's operation may use, so that a crafted or corrupt input (a deeply
+// nested message, a zip bomb, a huge embedded object) fails on its own instead of pinning a worker. CPU
+// is read from the thread CPU clock of whichever thread reads or writes the operation's streams, SDK
+// workers included, and output bytes are counted as they are written. Once either limit is passed the
+// SDK operations being waited on are cancelled through their AsyncControl and every later stream call
+// throws BudgetExceededError.
+class OperationBudget final {
+public:
+  enum class Resource {
+    None = 0,
+    Cpu = 1,
+    Output = 2,
+  };
+
+  // 0 lifts a limit.
+  struct Limits {
+    int64_t cpuMs;
+    int64_t outputBytes;
+  };
+
+  // Applies to operations started afterwards.
+  static void Configure(const Limits& limits);
+  static Limits GetLimits();
+
+  // The budget of the operation running on this thread, or nullptr when none is installed.
+  static const std::shared_ptr<OperationBudget>& Current();
+
+  // Throws BudgetExceededError when this thread's budget is spent, for callers that want the budget,
+  // rather than the error the SDK gave for a cancelled operation, reported.
+  static void ThrowIfCurrentExceeded();
+
+  explicit OperationBudget(const Limits& limits);
+
+  // Adds the CPU this thread used since it last charged this budget. Throws when over.
+  void ChargeCpu();
+  // Adds bytes written, then charges CPU. Throws when over.
+  void ChargeOutput(int64_t bytes);
+
+  // Cancels control if the budget is spent while it runs. Controls are held weakly.
+  void Watch(const std::shared_ptr<mip::AsyncControl>& control);
+
+  Resource Exceeded() const { return static_cast<Resource>(mExceeded.load(std::memory_order_acquire)); }
+
+  // The file the operation opened, quarantined when it goes over.
+  void SetInput(const std::string& filePath);
+  std::string GetInput() const;
+
+  int64_t CpuNs() const { return mCpuNs.load(std::memory_order_relaxed); }
+  int64_t OutputBytes() const { return mOutputBytes.load(std::memory_order_relaxed); }
+
+private:
+  void Exceed(Resource resource);
+  void ThrowIfExceeded() const;
+
+  static std::atomic<int64_t> sCpuMs;
+  static std::atomic<int64_t> sOutputBytes;
+  static std::atomic<uint64_t> sNextId;
+
+  const uint64_t mId;
+  const int64_t mCpuLimitNs;
+  const int64_t mOutputLimit;
+  std::atomic<int64_t> mCpuNs;
+  std::atomic<int64_t> mOutputBytes;
+  std::atomic<int> mExceeded;
+  mutable std::mutex mMutex;
+  std::vector<std::weak_ptr<mip::AsyncControl>> mControls;
+  std::string mInput;
+};
+
+class BudgetExceededError final : public std::runtime_error {
+public:
+  explicit BudgetExceededError(OperationBudget::Resource resource);
+
+  OperationBudget::Resource GetResource() const { return mResource; }
+
+private:
+  OperationBudget::Resource mResource;
+};
+
+// Gives the operation running on this thread a budget of its own for the lifetime of the scope, when any
+// limit is configured, then restores the previous one. A budget that was spent quarantines its input.
+class ScopedOperationBudget final {
+public:
+  ScopedOperationBudget();
+  ~ScopedOperationBudget();
+
+  ScopedOperationBudget(const ScopedOperationBudget&) = delete;
+  ScopedOperationBudget& operator=(const ScopedOperationBudget&) = delete;
+
+private:
+  std::shared_ptr<OperationBudget> mBudget;
+  std::shared_ptr<OperationBudget> mPrevious;
+};
+
+// mip::Stream that charges every read and write of inner to a budget, and the bytes read and written to
+// the cost key current when it was wrapped (see cost_account.h).
+class BudgetedStream final : public mip::Stream {
+public:
+  // inner itself when there is neither a budget nor a cost key.
+  static std::shared_ptr<mip::Stream> Wrap(const std::shared_ptr<mip::Stream>& inner, const std::shared_ptr<OperationBudget>& budget);
+
+  BudgetedStream(const std::shared_ptr<mip::Stream>& inner, const std::shared_ptr<OperationBudget>& budget);
+
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  const std::shared_ptr<mip::Stream> mInner;
+  const std::shared_ptr<OperationBudget> mBudget;
+  const sample::cost::Key mCostKey;
+};
+
+// Content of inputs that went over their budget, keyed by size and XXH64, so retries of the same input,
+// under any name, fail at once instead of spending another budget. Entries expire after a TTL. Only
+// files whose size matches a quarantined one are hashed, and none while the quarantine is empty.
+class InputQuarantine final {
+public:
+  static const int kDefaultTtlSeconds = 600;
+  static const size_t kCapacity = 4096;
+
+  static InputQuarantine& Instance();
+
+  // ttl 0 turns the quarantine off and empties it.
+  void SetTtl(std::chrono::seconds ttl);
+
+  // Quarantines filePath's content. Files that cannot be read are ignored.
+  void Add(const std::string& filePath);
+
+  // True, counting a rejection, when filePath's content is quarantined.
+  bool Contains(const std::string& filePath);
+
+  size_t GetSize() const { return mSize.load(std::memory_order_relaxed); }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::pair<int64_t, uint64_t> Key;
+
+  InputQuarantine();
+
+  // Drops expired entries, and the oldest beyond kCapacity. With mMutex held. Lookups skip expired
+  // entries without dropping them.
+  void Prune(Clock::time_point now);
+
+  std::atomic<int64_t> mTtlSeconds;
+  // Entries held, read without the lock to skip the lookup while there are none.
+  std::atomic<size_t> mSize;
+  mutable std::mutex mMutex;
+  // When each entry was quarantined.
+  std::map<Key, Clock::time_point> mEntries;
+};
+
+#endif // SAMPLE_FILE_OPERATION_BUDGET_H_
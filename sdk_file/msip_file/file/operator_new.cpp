@@ -0,0 +1,92 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+// Replaces the global operator new and delete of the process with ones that count every allocation (see
+// allocation_account.h), in builds made with scons --allocation_accounting. They are exported, so the SDK
+// libraries loaded with aip_file.so bind to them as well. Sizes are taken from malloc_usable_size rather
+// than kept in a header, so memory allocated here and freed elsewhere, or the other way round, stays
+// valid: only the counts skew.
+#ifdef MSIP_ALLOCATION_ACCOUNTING
+
+#include <malloc.h>
+
+#include <cstdlib>
+#include <new>
+
+#include "allocation_account.h"
+
+#define MSIP_REPLACEMENT __attribute__((visibility("default")))
+
+namespace {
+
+void* TryAllocate(std::size_t size) {
+  void* data = malloc(size == 0 ? 1 : size);
+  if (data)
+    sample::alloc::OnAllocate(malloc_usable_size(data));
+  return data;
+}
+
+void* Allocate(std::size_t size) {
+  for (;;) {
+    if (void* data = TryAllocate(size))
+      return data;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+void* AllocateNoThrow(std::size_t size) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void Free(void* data) noexcept {
+  if (!data)
+    return;
+  sample::alloc::OnFree(malloc_usable_size(data));
+  free(data);
+}
+
+} // namespace
+
+MSIP_REPLACEMENT void* operator new(std::size_t size) { return Allocate(size); }
+MSIP_REPLACEMENT void* operator new[](std::size_t size) { return Allocate(size); }
+MSIP_REPLACEMENT void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return AllocateNoThrow(size); }
+MSIP_REPLACEMENT void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return AllocateNoThrow(size); }
+MSIP_REPLACEMENT void operator delete(void* data) noexcept { Free(data); }
+MSIP_REPLACEMENT void operator delete[](void* data) noexcept { Free(data); }
+MSIP_REPLACEMENT void operator delete(void* data, const std::nothrow_t&) noexcept { Free(data); }
+MSIP_REPLACEMENT void operator delete[](void* data, const std::nothrow_t&) noexcept { Free(data); }
+// Sized deallocation, for callers compiled as C++14 or later.
+MSIP_REPLACEMENT void operator delete(void* data, std::size_t) noexcept { Free(data); }
+MSIP_REPLACEMENT void operator delete[](void* data, std::size_t) noexcept { Free(data); }
+
+#endif // MSIP_ALLOCATION_ACCOUNTING
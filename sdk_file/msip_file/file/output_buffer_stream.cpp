@@ -0,0 +1,134 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "output_buffer_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "metrics_registry.h"
+
+using std::runtime_error;
+
+namespace {
+
+MetricsRegistry::Counter& OutputBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_output_bytes_total", "Bytes the SDK wrote to caller descriptors and buffers");
+  return counter;
+}
+
+} // namespace
+
+OutputBufferStream::OutputBufferStream(uint8_t* data, int64_t capacity)
+    : mData(data),
+      mCapacity(data ? capacity : 0),
+      mOverflowed(false),
+      mWipeOnGrowth(false),
+      mSize(0),
+      mPosition(0) {
+  if (capacity < 0)
+    throw std::invalid_argument("Capacity must not be negative.");
+}
+
+int64_t OutputBufferStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  auto bytesRead = mPosition + bufferLength <= mSize ? bufferLength : mSize - mPosition;
+  if (bytesRead > 0) {
+    memcpy(buffer, mData + mPosition, static_cast<size_t>(bytesRead));
+    mPosition += bytesRead;
+  }
+  return bytesRead > 0 ? bytesRead : 0;
+}
+
+int64_t OutputBufferStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  if (bufferLength <= 0)
+    return 0;
+  uint8_t* data = Reserve(mPosition + bufferLength);
+  memcpy(data + mPosition, buffer, static_cast<size_t>(bufferLength));
+  mPosition += bufferLength;
+  if (mPosition > mSize)
+    mSize = mPosition;
+  OutputBytes().Add(static_cast<uint64_t>(bufferLength));
+  return bufferLength;
+}
+
+bool OutputBufferStream::Flush() { return true; }
+
+void OutputBufferStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (position > mSize)
+    throw runtime_error("Position must not be larger than size.");
+  mPosition = position;
+}
+
+bool OutputBufferStream::CanRead() const { return true; }
+
+bool OutputBufferStream::CanWrite() const { return true; }
+
+int64_t OutputBufferStream::Position() { return mPosition; }
+
+int64_t OutputBufferStream::Size() { return mSize; }
+
+void OutputBufferStream::Size(int64_t value) {
+  if (value < 0)
+    throw runtime_error("Size must not be less than zero.");
+  if (value > mSize)
+    memset(Reserve(value) + mSize, 0, static_cast<size_t>(value - mSize));
+  mSize = value;
+  if (mPosition > mSize)
+    mPosition = mSize;
+}
+
+BufferPool::Buffer OutputBufferStream::TakeOverflow() {
+  BufferPool::Buffer overflow(std::move(mOverflow));
+  mData = nullptr;
+  mSize = 0;
+  mPosition = 0;
+  return overflow;
+}
+
+// Returns memory holding at least end bytes, leaving the caller's region once it is too small. Overflow
+// buffers at least double, and come from power-of-two pool classes, so growth copies stay rare.
+uint8_t* OutputBufferStream::Reserve(int64_t end) {
+  if (!mOverflowed && end <= mCapacity)
+    return mData;
+  const size_t required = static_cast<size_t>(end);
+  if (!mOverflowed || required > mOverflow.Capacity()) {
+    const size_t current = mOverflowed ? mOverflow.Capacity() : static_cast<size_t>(mCapacity);
+    BufferPool::Buffer grown = BufferPool::Shared().Acquire(std::max(required, 2 * current));
+    if (mSize > 0) {
+      memcpy(grown.Data(), mData, static_cast<size_t>(mSize));
+      if (mWipeOnGrowth)
+        memset(mData, 0, static_cast<size_t>(mSize));
+    }
+    mOverflow = std::move(grown);
+    mOverflowed = true;
+  }
+  mData = mOverflow.Data();
+  return mData;
+}
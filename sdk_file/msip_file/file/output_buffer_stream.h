@@ -0,0 +1,74 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_OUTPUT_BUFFER_STREAM_H_
+#define SAMPLE_FILE_OUTPUT_BUFFER_STREAM_H_
+
+#include "buffer_pool.h"
+#include "mip/stream.h"
+
+// Readable and writable mip::Stream that commits into caller-owned memory, such as a buffer or a
+// pre-sized mmap region. If the output outgrows capacity, the content written so far moves to a buffer from
+// the shared BufferPool and writing continues there, so the commit still succeeds and the caller can fetch
+// the result.
+class OutputBufferStream final : public mip::Stream {
+public:
+  OutputBufferStream(uint8_t* data, int64_t capacity);
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+  // True once the output no longer fits the caller's memory, whose content is then undefined.
+  bool Overflowed() const { return mOverflowed; }
+
+  // Moves out the full output after an overflow. Read Size() first: the buffer is larger than the output.
+  BufferPool::Buffer TakeOverflow();
+
+  // Zeroes the memory the output leaves when it grows, for plaintext that must not linger in pool buffers.
+  void WipeOnGrowth() { mWipeOnGrowth = true; }
+
+private:
+  OutputBufferStream(const OutputBufferStream&) = delete;
+  OutputBufferStream& operator=(const OutputBufferStream&) = delete;
+
+  uint8_t* Reserve(int64_t end);
+
+  uint8_t* mData;
+  const int64_t mCapacity;
+  bool mOverflowed;
+  bool mWipeOnGrowth;
+  BufferPool::Buffer mOverflow;
+  int64_t mSize;
+  int64_t mPosition;
+};
+
+#endif // SAMPLE_FILE_OUTPUT_BUFFER_STREAM_H_
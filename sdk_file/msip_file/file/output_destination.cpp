@@ -0,0 +1,130 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "output_destination.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+thread_local OutputDestination* tCurrent = nullptr;
+
+string ErrnoMessage(const string& what, const string& path) {
+  return what + " '" + path + "': " + strerror(errno);
+}
+
+string BaseName(const string& path) {
+  const auto separator = path.find_last_of('/');
+  return separator == string::npos ? path : path.substr(separator + 1);
+}
+
+string DirName(const string& path) {
+  const auto separator = path.find_last_of('/');
+  return separator == string::npos ? string() : path.substr(0, separator + 1);
+}
+
+bool IsDirectory(const string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+} // namespace
+
+const int OutputDestination::kReplaceInput;
+
+OutputDestination::OutputDestination(const string& inputPath, const string& outputPath, int flags)
+    : mInputPath(inputPath),
+      mReplaceInput((flags & kReplaceInput) != 0),
+      mPublished(false) {
+  if (mReplaceInput) {
+    mPath = inputPath;
+  } else if (outputPath.empty()) {
+    throw runtime_error("An output path is needed unless the input is replaced");
+  } else if (outputPath.back() == '/' || IsDirectory(outputPath)) {
+    mPath = outputPath + (outputPath.back() == '/' ? "" : "/") + BaseName(inputPath);
+  } else {
+    mPath = outputPath;
+  }
+}
+
+OutputDestination::~OutputDestination() {
+  if (!mStagingPath.empty() && !mPublished)
+    unlink(mStagingPath.c_str());
+}
+
+const string& OutputDestination::Stage() {
+  if (mStagingPath.empty()) {
+    // Unique among the processes and calls staging into one directory at the same time.
+    static std::atomic<uint64_t> sequence(0);
+    mStagingPath = DirName(mPath) + "." + BaseName(mPath) + "." + std::to_string(getpid()) + "." +
+        std::to_string(sequence.fetch_add(1, std::memory_order_relaxed)) + ".tmp";
+  }
+  return mStagingPath;
+}
+
+const string& OutputDestination::Publish() {
+  if (mStagingPath.empty())
+    throw runtime_error("Nothing was committed for '" + mPath + "'");
+  if (mReplaceInput) {
+    struct stat input;
+    if (stat(mInputPath.c_str(), &input) != 0)
+      throw runtime_error(ErrnoMessage("Cannot stat", mInputPath));
+    const int fd = open(mStagingPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw runtime_error(ErrnoMessage("Cannot open", mStagingPath));
+    const bool synced = fchmod(fd, input.st_mode & 07777) == 0 && fsync(fd) == 0;
+    close(fd);
+    if (!synced)
+      throw runtime_error(ErrnoMessage("Cannot sync", mStagingPath));
+  }
+  if (rename(mStagingPath.c_str(), mPath.c_str()) != 0)
+    throw runtime_error(ErrnoMessage("Cannot rename output to", mPath));
+  mPublished = true;
+  return mPath;
+}
+
+OutputDestination* OutputDestination::Current() {
+  return tCurrent;
+}
+
+OutputDestination::Scope::Scope(OutputDestination& destination)
+    : mPrevious(tCurrent) {
+  tCurrent = &destination;
+}
+
+OutputDestination::Scope::~Scope() {
+  tCurrent = mPrevious;
+}
@@ -0,0 +1,85 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_OUTPUT_DESTINATION_H_
+#define SAMPLE_FILE_OUTPUT_DESTINATION_H_
+
+#include <string>
+
+// Where a protect or unprotect commits its output instead of the input's "_modified" sibling: a file path,
+// a directory that receives the input's name, or the input itself. The output is committed to a hidden
+// temporary file in the destination's directory and renamed over the destination once complete, so readers
+// never see a partial file and nothing is copied between filesystems afterwards.
+class OutputDestination final {
+public:
+  // Flags of protectFileTo and unprotectFileTo. The output replaces the input and the output path is ignored.
+  static const int kReplaceInput = 1;
+
+  // outputPath ending in a separator, or naming an existing directory, receives the input's file name.
+  // Throws std::runtime_error when there is no output path and the input is not replaced.
+  OutputDestination(const std::string& inputPath, const std::string& outputPath, int flags);
+  // Removes a staged output that was never published.
+  ~OutputDestination();
+
+  const std::string& GetPath() const { return mPath; }
+
+  // The temporary file to commit to, next to the destination. It is only named here; the commit creates it.
+  const std::string& Stage();
+
+  // Renames the staged output over the destination and returns the destination. A replaced input's
+  // permissions carry over, and its replacement reaches the disk first, since the rename drops the original.
+  // Throws std::runtime_error.
+  const std::string& Publish();
+
+  // The destination outputs committed on this thread go to, or nullptr for "_modified" outputs.
+  static OutputDestination* Current();
+
+  // Sends this thread's outputs to destination while in scope.
+  class Scope final {
+  public:
+    explicit Scope(OutputDestination& destination);
+    ~Scope();
+
+  private:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    OutputDestination* mPrevious;
+  };
+
+private:
+  OutputDestination(const OutputDestination&) = delete;
+  OutputDestination& operator=(const OutputDestination&) = delete;
+
+  std::string mInputPath;
+  std::string mPath;
+  std::string mStagingPath;
+  bool mReplaceInput;
+  bool mPublished;
+};
+
+#endif // SAMPLE_FILE_OUTPUT_DESTINATION_H_
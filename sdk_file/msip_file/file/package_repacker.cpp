@@ -0,0 +1,438 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "package_repacker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef MSIP_LIBDEFLATE
+#include <libdeflate.h>
+#else
+#include <zlib.h>
+#endif
+
+using sample::task::TaskDispatcherImpl;
+using std::atomic;
+using std::exception_ptr;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const uint32_t kZip64LocatorSignature = 0x07064b50;
+const size_t kLocalHeaderSize = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfCentralDirectorySize = 22;
+const size_t kZip64LocatorSize = 20;
+const size_t kMaxCommentSize = 0xffff;
+const uint16_t kStored = 0;
+const uint16_t kDeflated = 8;
+const uint16_t kEncryptedFlag = 0x0001;
+const uint16_t kDataDescriptorFlag = 0x0008;
+// The version needed to extract a deflated entry.
+const uint16_t kDeflateVersion = 20;
+const size_t kWriteBufferBytes = 1024 * 1024;
+
+atomic<uint64_t> gRepackTaskCounter(0);
+
+struct Entry {
+  // Of the central directory header, and of the local header and the data after it.
+  size_t centralOffset;
+  size_t centralSize;
+  size_t localOffset;
+  size_t dataOffset;
+  uint16_t method;
+  uint32_t compressedSize;
+  uint32_t uncompressedSize;
+  // Deflated data to write instead of the stored bytes; empty to copy the entry.
+  string deflated;
+};
+
+// Progress shared with helper tasks, which may start after the call has returned and then find no work.
+struct DeflateState {
+  atomic<size_t> next;
+  size_t completed;
+  exception_ptr error;
+  mutex guard;
+  std::condition_variable done;
+};
+
+uint16_t ReadLe16(const uint8_t* data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLe32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void WriteLe16(uint8_t* data, uint16_t value) {
+  data[0] = static_cast<uint8_t>(value);
+  data[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void WriteLe32(uint8_t* data, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    data[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+// Offset of the end of central directory record, or size when there is none.
+size_t FindEndOfCentralDirectory(const uint8_t* package, size_t size) {
+  if (size < kEndOfCentralDirectorySize)
+    return size;
+  const size_t lowest = size - kEndOfCentralDirectorySize > kMaxCommentSize ? size - kEndOfCentralDirectorySize - kMaxCommentSize : 0;
+  for (size_t offset = size - kEndOfCentralDirectorySize + 1; offset-- > lowest;) {
+    if (ReadLe32(package + offset) == kEndOfCentralDirectorySignature &&
+        offset + kEndOfCentralDirectorySize + ReadLe16(package + offset + 20) == size)
+      return offset;
+  }
+  return size;
+}
+
+// The entries of the package in directory order, or false for a package Repack leaves to the SDK.
+bool ReadEntries(const uint8_t* package, size_t size, size_t& endOffset, vector<Entry>& entries) {
+  endOffset = FindEndOfCentralDirectory(package, size);
+  if (endOffset == size)
+    return false;
+  const uint8_t* end = package + endOffset;
+  const uint16_t count = ReadLe16(end + 10);
+  const uint32_t directorySize = ReadLe32(end + 12);
+  const uint32_t directoryOffset = ReadLe32(end + 16);
+  // Split archives, and Zip64 ones whose record fields hold the 0xffff... placeholders.
+  if (ReadLe16(end + 4) != 0 || ReadLe16(end + 6) != 0 || ReadLe16(end + 8) != count || count == 0xffff ||
+      directoryOffset == 0xffffffff || directorySize == 0xffffffff)
+    return false;
+  if (endOffset >= kZip64LocatorSize && ReadLe32(package + endOffset - kZip64LocatorSize) == kZip64LocatorSignature)
+    return false;
+  if (static_cast<uint64_t>(directoryOffset) + directorySize > endOffset)
+    return false;
+
+  entries.resize(count);
+  size_t offset = directoryOffset;
+  for (auto& entry : entries) {
+    if (offset + kCentralHeaderSize > static_cast<size_t>(directoryOffset) + directorySize)
+      return false;
+    const uint8_t* central = package + offset;
+    if (ReadLe32(central) != kCentralHeaderSignature || (ReadLe16(central + 8) & kEncryptedFlag) != 0)
+      return false;
+    entry.centralOffset = offset;
+    entry.centralSize = kCentralHeaderSize + ReadLe16(central + 28) + ReadLe16(central + 30) + ReadLe16(central + 32);
+    entry.method = ReadLe16(central + 10);
+    entry.compressedSize = ReadLe32(central + 20);
+    entry.uncompressedSize = ReadLe32(central + 24);
+    entry.localOffset = ReadLe32(central + 42);
+    if (entry.compressedSize == 0xffffffff || entry.uncompressedSize == 0xffffffff || entry.localOffset == 0xffffffff)
+      return false;
+    offset += entry.centralSize;
+
+    if (entry.localOffset + kLocalHeaderSize > directoryOffset)
+      return false;
+    const uint8_t* local = package + entry.localOffset;
+    if (ReadLe32(local) != kLocalHeaderSignature)
+      return false;
+    entry.dataOffset = entry.localOffset + kLocalHeaderSize + ReadLe16(local + 26) + ReadLe16(local + 28);
+    if (static_cast<uint64_t>(entry.dataOffset) + entry.compressedSize > directoryOffset)
+      return false;
+  }
+  return offset <= static_cast<size_t>(directoryOffset) + directorySize;
+}
+
+// Raw deflate of data, or an empty string when it would not come out smaller.
+string Deflate(const uint8_t* data, size_t size, int level) {
+  string out;
+#ifdef MSIP_LIBDEFLATE
+  std::unique_ptr<libdeflate_compressor, decltype(&libdeflate_free_compressor)> compressor(
+      libdeflate_alloc_compressor(level), &libdeflate_free_compressor);
+  if (!compressor)
+    throw runtime_error("Unable to allocate a deflate compressor");
+  out.resize(libdeflate_deflate_compress_bound(compressor.get(), size));
+  const size_t written = libdeflate_deflate_compress(compressor.get(), data, size, &out[0], out.size());
+#else
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw runtime_error("Unable to initialize deflate");
+  out.resize(deflateBound(&zs, static_cast<uLong>(size)));
+  zs.next_in = const_cast<Bytef*>(data);
+  zs.avail_in = static_cast<uInt>(size);
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = static_cast<uInt>(out.size());
+  const int status = deflate(&zs, Z_FINISH);
+  const size_t written = status == Z_STREAM_END ? static_cast<size_t>(zs.total_out) : 0;
+  deflateEnd(&zs);
+  if (status != Z_STREAM_END)
+    throw runtime_error("Deflate failed");
+#endif
+  if (written == 0 || written >= size)
+    return string();
+  out.resize(written);
+  return out;
+}
+
+// Deflates the candidates on the calling thread and on up to one helper per CPU beyond it.
+void DeflateParallel(
+    const uint8_t* package,
+    vector<Entry>& entries,
+    const vector<size_t>& candidates,
+    int level,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher) {
+  const size_t count = candidates.size();
+  if (count == 0)
+    return;
+  auto state = make_shared<DeflateState>();
+  state->next = 0;
+  state->completed = 0;
+  auto sharedCandidates = make_shared<vector<size_t>>(candidates);
+  Entry* entryData = entries.data();
+  auto work = [state, sharedCandidates, entryData, package, level, count]() {
+    for (size_t i = state->next++; i < count; i = state->next++) {
+      Entry& entry = entryData[(*sharedCandidates)[i]];
+      exception_ptr error;
+      try {
+        entry.deflated = Deflate(package + entry.dataOffset, entry.compressedSize, level);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock_guard<mutex> lock(state->guard);
+      if (error && !state->error)
+        state->error = error;
+      if (++state->completed == count)
+        state->done.notify_all();
+    }
+  };
+
+  const size_t helpers = dispatcher ? std::min(count, TaskDispatcherImpl::GetCpuQuota()) - 1 : 0;
+  for (size_t i = 0; i < helpers; ++i)
+    dispatcher->DispatchTask("package-repack-" + std::to_string(gRepackTaskCounter++), work);
+  work();
+
+  std::unique_lock<mutex> lock(state->guard);
+  state->done.wait(lock, [&state, count] { return state->completed == count; });
+  if (state->error)
+    std::rethrow_exception(state->error);
+}
+
+// Appends to a new file through one buffer; large writes go straight to the file.
+class OutputFile final {
+public:
+  explicit OutputFile(const string& filePath) : mFilePath(filePath), mWritten(0) {
+    mFd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0)
+      throw runtime_error(ErrnoMessage("Failed to create", filePath));
+    mBuffer.reserve(kWriteBufferBytes);
+  }
+
+  ~OutputFile() {
+    if (mFd >= 0) {
+      close(mFd);
+      unlink(mFilePath.c_str());
+    }
+  }
+
+  void Append(const uint8_t* data, size_t size) {
+    mWritten += size;
+    if (mBuffer.size() + size <= kWriteBufferBytes) {
+      mBuffer.append(reinterpret_cast<const char*>(data), size);
+      return;
+    }
+    Drain();
+    if (size < kWriteBufferBytes)
+      mBuffer.append(reinterpret_cast<const char*>(data), size);
+    else
+      WriteAll(data, size);
+  }
+
+  uint64_t Written() const { return mWritten; }
+
+  void Close() {
+    Drain();
+    const int fd = mFd;
+    mFd = -1;
+    if (close(fd) != 0) {
+      unlink(mFilePath.c_str());
+      throw runtime_error(ErrnoMessage("Failed to close", mFilePath));
+    }
+  }
+
+private:
+  OutputFile(const OutputFile&) = delete;
+  OutputFile& operator=(const OutputFile&) = delete;
+
+  void Drain() {
+    WriteAll(reinterpret_cast<const uint8_t*>(mBuffer.data()), mBuffer.size());
+    mBuffer.clear();
+  }
+
+  void WriteAll(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      const ssize_t count = write(mFd, data, size);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count < 0)
+        throw runtime_error(ErrnoMessage("Failed to write", mFilePath));
+      data += count;
+      size -= static_cast<size_t>(count);
+    }
+  }
+
+  const string mFilePath;
+  int mFd;
+  string mBuffer;
+  uint64_t mWritten;
+};
+
+uint32_t CheckedOffset(uint64_t offset) {
+  if (offset >= 0xffffffff)
+    throw runtime_error("Repacked package needs Zip64");
+  return static_cast<uint32_t>(offset);
+}
+
+} // namespace
+
+const int64_t PackageRepacker::kDefaultMaxPackageBytes;
+const int64_t PackageRepacker::kDefaultDeflateMinBytes;
+const int PackageRepacker::kDefaultLevel;
+
+PackageRepacker::Options PackageRepacker::Defaults() {
+  Options options = Options();
+  options.maxPackageBytes = kDefaultMaxPackageBytes;
+  options.deflateMinBytes = kDefaultDeflateMinBytes;
+  options.level = kDefaultLevel;
+  return options;
+}
+
+bool PackageRepacker::IsValid(const Options& options) {
+  return options.maxPackageBytes > 0 && options.deflateMinBytes >= 0 && options.level >= 1 && options.level <= 9;
+}
+
+bool PackageRepacker::Repack(
+    const uint8_t* package,
+    size_t size,
+    const string& outputPath,
+    const Options& options,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher,
+    Stats& stats) {
+  size_t endOffset = 0;
+  vector<Entry> entries;
+  if (!ReadEntries(package, size, endOffset, entries))
+    return false;
+
+  vector<size_t> candidates;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (options.deflateMinBytes > 0 && entries[i].method == kStored &&
+        entries[i].compressedSize == entries[i].uncompressedSize &&
+        entries[i].compressedSize >= static_cast<uint64_t>(options.deflateMinBytes))
+      candidates.push_back(i);
+  }
+  DeflateParallel(package, entries, candidates, options.level, dispatcher);
+
+  stats = Stats();
+  stats.parts = entries.size();
+  OutputFile output(outputPath);
+  vector<uint32_t> localOffsets(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    const uint8_t* central = package + entry.centralOffset;
+    const uint8_t* local = package + entry.localOffset;
+    const bool deflated = !entry.deflated.empty();
+    localOffsets[i] = CheckedOffset(output.Written());
+
+    // Sizes come from the directory, so a data descriptor after the data is neither needed nor written.
+    uint8_t header[kLocalHeaderSize];
+    std::memcpy(header, local, kLocalHeaderSize);
+    WriteLe16(header + 6, static_cast<uint16_t>(ReadLe16(local + 6) & ~kDataDescriptorFlag));
+    WriteLe32(header + 14, ReadLe32(central + 16));
+    WriteLe32(header + 22, entry.uncompressedSize);
+    if (deflated) {
+      WriteLe16(header + 4, std::max(ReadLe16(local + 4), kDeflateVersion));
+      WriteLe16(header + 8, kDeflated);
+      WriteLe32(header + 18, static_cast<uint32_t>(entry.deflated.size()));
+    } else {
+      WriteLe32(header + 18, entry.compressedSize);
+    }
+    output.Append(header, kLocalHeaderSize);
+    output.Append(local + kLocalHeaderSize, entry.dataOffset - entry.localOffset - kLocalHeaderSize);
+    if (deflated) {
+      output.Append(reinterpret_cast<const uint8_t*>(entry.deflated.data()), entry.deflated.size());
+      ++stats.deflated;
+    } else {
+      output.Append(package + entry.dataOffset, entry.compressedSize);
+      ++stats.copied;
+    }
+  }
+
+  const uint32_t directoryOffset = CheckedOffset(output.Written());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    const uint8_t* central = package + entry.centralOffset;
+    uint8_t header[kCentralHeaderSize];
+    std::memcpy(header, central, kCentralHeaderSize);
+    WriteLe16(header + 8, static_cast<uint16_t>(ReadLe16(central + 8) & ~kDataDescriptorFlag));
+    if (!entry.deflated.empty()) {
+      WriteLe16(header + 6, std::max(ReadLe16(central + 6), kDeflateVersion));
+      WriteLe16(header + 10, kDeflated);
+      WriteLe32(header + 20, static_cast<uint32_t>(entry.deflated.size()));
+    }
+    WriteLe32(header + 42, localOffsets[i]);
+    output.Append(header, kCentralHeaderSize);
+    output.Append(central + kCentralHeaderSize, entry.centralSize - kCentralHeaderSize);
+  }
+
+  uint8_t end[kEndOfCentralDirectorySize];
+  std::memcpy(end, package + endOffset, kEndOfCentralDirectorySize);
+  WriteLe32(end + 12, CheckedOffset(output.Written() - directoryOffset));
+  WriteLe32(end + 16, directoryOffset);
+  output.Append(end, kEndOfCentralDirectorySize);
+  output.Append(package + endOffset + kEndOfCentralDirectorySize, size - endOffset - kEndOfCentralDirectorySize);
+  stats.bytesWritten = static_cast<int64_t>(output.Written());
+  output.Close();
+  return true;
+}
@@ -0,0 +1,82 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_PACKAGE_REPACKER_H_
+#define SAMPLE_FILE_PACKAGE_REPACKER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "task_dispatcher_impl.h"
+
+// Writes a zip package, such as the Office Open XML package inside a protected Office file, out part by
+// part without inflating it: parts already compressed are copied as their compressed bytes, and only
+// stored parts large enough to be worth it are deflated, on the dispatcher's workers at once. Deflate is
+// libdeflate's when built with --deflate=libdeflate, zlib's otherwise.
+class PackageRepacker final {
+public:
+  struct Options {
+    // Off by default; unprotects then commit through the SDK, which recompresses every part on one thread.
+    bool enabled;
+    // Packages larger than this are left to the SDK, since they are held in memory while rewritten.
+    int64_t maxPackageBytes;
+    // Stored parts of at least this many bytes are deflated. 0 copies every part as it is.
+    int64_t deflateMinBytes;
+    // 1 (fastest) to 9 (smallest).
+    int level;
+  };
+
+  struct Stats {
+    size_t parts;
+    // Parts written with the bytes they had.
+    size_t copied;
+    size_t deflated;
+    int64_t bytesWritten;
+  };
+
+  static const int64_t kDefaultMaxPackageBytes = 256 * 1024 * 1024;
+  static const int64_t kDefaultDeflateMinBytes = 64 * 1024;
+  static const int kDefaultLevel = 6;
+
+  static Options Defaults();
+  static bool IsValid(const Options& options);
+
+  // Writes the package in package[0, size) to outputPath. Returns false, without creating outputPath, when
+  // it is not a zip this can rewrite: a split, Zip64 or encrypted archive, or one whose directory does not
+  // match its entries. Throws std::runtime_error when outputPath cannot be written, removing it.
+  static bool Repack(
+      const uint8_t* package,
+      size_t size,
+      const std::string& outputPath,
+      const Options& options,
+      const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher,
+      Stats& stats);
+};
+
+#endif // SAMPLE_FILE_PACKAGE_REPACKER_H_
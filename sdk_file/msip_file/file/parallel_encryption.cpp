@@ -0,0 +1,333 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "parallel_encryption.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using mip::ProtectionHandler;
+using sample::task::TaskDispatcherImpl;
+using std::atomic;
+using std::exception_ptr;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+struct Segment {
+  int64_t inputOffset;
+  int64_t inputSize;
+  int64_t outputOffset;
+  int64_t outputSize;
+  bool isFinal;
+};
+
+// Progress shared with helper tasks, which may start after the call has returned and then find no work.
+struct EncryptionState {
+  atomic<size_t> next;
+  size_t completed;
+  // What the final segment's call returned.
+  int64_t finalSize;
+  exception_ptr error;
+  mutex guard;
+  std::condition_variable done;
+};
+
+// EncryptBuffer or DecryptBuffer of one segment, returning the bytes it wrote.
+typedef std::function<int64_t(const Segment& segment)> SegmentCrypt;
+
+atomic<uint64_t> gEncryptionTaskCounter(0);
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+// Owns a file descriptor and mapping for the duration of one call.
+class Mapping final {
+public:
+  Mapping() : mFd(-1), mData(nullptr), mSize(0) {}
+  ~Mapping() {
+    if (mData)
+      munmap(mData, mSize);
+    if (mFd >= 0)
+      close(mFd);
+  }
+
+  void OpenInput(const string& filePath) {
+    mFd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (mFd < 0)
+      throw runtime_error(ErrnoMessage("Failed to open", filePath));
+    struct stat fileInfo;
+    if (fstat(mFd, &fileInfo) != 0)
+      throw runtime_error(ErrnoMessage("Failed to stat", filePath));
+    Map(filePath, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE);
+  }
+
+  void CreateOutput(const string& filePath, size_t size) {
+    mFd = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0)
+      throw runtime_error(ErrnoMessage("Failed to create", filePath));
+    if (ftruncate(mFd, static_cast<off_t>(size)) != 0)
+      throw runtime_error(ErrnoMessage("Failed to size", filePath));
+    Map(filePath, size, PROT_READ | PROT_WRITE, MAP_SHARED);
+  }
+
+  uint8_t* Data() const { return static_cast<uint8_t*>(mData); }
+  size_t Size() const { return mSize; }
+
+private:
+  void Map(const string& filePath, size_t size, int protection, int flags) {
+    mSize = size;
+    if (size == 0)
+      return;
+    mData = mmap(nullptr, size, protection, flags, mFd, 0);
+    if (mData == MAP_FAILED) {
+      mData = nullptr;
+      throw runtime_error(ErrnoMessage("Failed to map", filePath));
+    }
+  }
+
+  int mFd;
+  void* mData;
+  size_t mSize;
+};
+
+// Runs crypt over every segment, on the calling thread and on up to one helper per CPU beyond it, and
+// returns the end of the final segment's output.
+int64_t RunSegments(
+    vector<Segment>&& segments,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher,
+    const SegmentCrypt& crypt) {
+  auto state = make_shared<EncryptionState>();
+  state->next = 0;
+  state->completed = 0;
+  state->finalSize = 0;
+  auto sharedSegments = make_shared<vector<Segment>>(std::move(segments));
+  const size_t count = sharedSegments->size();
+  auto work = [state, sharedSegments, crypt, count]() {
+    for (size_t i = state->next++; i < count; i = state->next++) {
+      const Segment& segment = (*sharedSegments)[i];
+      exception_ptr error;
+      int64_t written = 0;
+      try {
+        written = crypt(segment);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock_guard<mutex> lock(state->guard);
+      if (error && !state->error)
+        state->error = error;
+      if (segment.isFinal)
+        state->finalSize = written;
+      if (++state->completed == count)
+        state->done.notify_all();
+    }
+  };
+
+  const size_t helpers = std::min(count, TaskDispatcherImpl::GetCpuQuota()) - 1;
+  for (size_t i = 0; i < helpers; ++i)
+    dispatcher->DispatchTask("parallel-encryption-" + std::to_string(gEncryptionTaskCounter++), work);
+  work();
+
+  unique_lock<mutex> lock(state->guard);
+  state->done.wait(lock, [&state, count] { return state->completed == count; });
+  if (state->error)
+    std::rethrow_exception(state->error);
+  return sharedSegments->back().outputOffset + state->finalSize;
+}
+
+int64_t AlignedSegmentSize(const shared_ptr<ProtectionHandler>& protection, int64_t segmentSize) {
+  const int64_t blockSize = protection->GetBlockSize() > 0 ? protection->GetBlockSize() : 1;
+  return segmentSize < blockSize ? blockSize : segmentSize - segmentSize % blockSize;
+}
+
+} // namespace
+
+int64_t EncryptParallel(
+    const shared_ptr<ProtectionHandler>& protection,
+    const uint8_t* input,
+    int64_t inputSize,
+    uint8_t* output,
+    int64_t outputSize,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher,
+    int64_t segmentSize) {
+  segmentSize = AlignedSegmentSize(protection, segmentSize);
+
+  // Every segment but the last ends on a block boundary, so its ciphertext lands at a fixed offset.
+  vector<Segment> segments;
+  for (int64_t offset = 0; offset < inputSize || segments.empty(); offset += segmentSize) {
+    Segment segment;
+    segment.inputOffset = offset;
+    segment.inputSize = std::min(segmentSize, inputSize - offset);
+    segment.isFinal = offset + segment.inputSize >= inputSize;
+    segment.outputOffset = protection->GetProtectedContentLength(offset, false);
+    segment.outputSize = protection->GetProtectedContentLength(segment.inputSize, segment.isFinal);
+    segments.push_back(segment);
+  }
+  const Segment& last = segments.back();
+  if (last.outputOffset + last.outputSize > outputSize)
+    throw runtime_error("Output buffer is too small for the protected content");
+
+  return RunSegments(std::move(segments), dispatcher, [protection, input, output](const Segment& segment) {
+    return protection->EncryptBuffer(
+        segment.inputOffset,
+        input + segment.inputOffset,
+        segment.inputSize,
+        output + segment.outputOffset,
+        segment.outputSize,
+        segment.isFinal);
+  });
+}
+
+int64_t DecryptParallel(
+    const shared_ptr<ProtectionHandler>& protection,
+    const uint8_t* input,
+    int64_t inputSize,
+    uint8_t* output,
+    int64_t outputSize,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher,
+    int64_t segmentSize) {
+  segmentSize = AlignedSegmentSize(protection, segmentSize);
+  if (outputSize < inputSize)
+    throw runtime_error("Output buffer is too small for the decrypted content");
+
+  // Only the final block carries padding, so every other segment decrypts to the offset it was read from.
+  vector<Segment> segments;
+  for (int64_t offset = 0; offset < inputSize || segments.empty(); offset += segmentSize) {
+    Segment segment;
+    segment.inputOffset = offset;
+    segment.inputSize = std::min(segmentSize, inputSize - offset);
+    segment.isFinal = offset + segment.inputSize >= inputSize;
+    segment.outputOffset = offset;
+    segment.outputSize = segment.inputSize;
+    segments.push_back(segment);
+  }
+
+  return RunSegments(std::move(segments), dispatcher, [protection, input, output](const Segment& segment) {
+    return protection->DecryptBuffer(
+        segment.inputOffset,
+        input + segment.inputOffset,
+        segment.inputSize,
+        output + segment.outputOffset,
+        segment.outputSize,
+        segment.isFinal);
+  });
+}
+
+int64_t EncryptFileDetached(
+    const shared_ptr<ProtectionHandler>& protection,
+    const string& inputPath,
+    const string& outputPath,
+    const string& licensePath,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher) {
+  Mapping input;
+  input.OpenInput(inputPath);
+  const int64_t inputSize = static_cast<int64_t>(input.Size());
+  const int64_t protectedSize = protection->GetProtectedContentLength(inputSize, true);
+
+  int64_t written;
+  {
+    Mapping output;
+    output.CreateOutput(outputPath, static_cast<size_t>(protectedSize));
+    written = EncryptParallel(protection, input.Data(), inputSize, output.Data(), protectedSize, dispatcher);
+  }
+  // Padding may come out shorter than the upper bound the handler reported.
+  if (written != protectedSize && truncate(outputPath.c_str(), static_cast<off_t>(written)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to size", outputPath));
+
+  const auto& license = protection->GetSerializedPublishingLicense();
+  std::ofstream licenseFile(licensePath, std::ios::binary | std::ios::trunc);
+  licenseFile.write(reinterpret_cast<const char*>(license.data()), static_cast<std::streamsize>(license.size()));
+  if (!licenseFile)
+    throw runtime_error("Failed to write publishing license '" + licensePath + "'");
+  return written;
+}
+
+vector<uint8_t> ReadDetachedLicense(const string& licensePath) {
+  std::ifstream licenseFile(licensePath, std::ios::binary);
+  if (!licenseFile)
+    throw runtime_error("Failed to open publishing license '" + licensePath + "'");
+  vector<uint8_t> license((std::istreambuf_iterator<char>(licenseFile)), std::istreambuf_iterator<char>());
+  if (license.empty())
+    throw runtime_error("Publishing license '" + licensePath + "' is empty");
+  return license;
+}
+
+int64_t DecryptFileDetached(
+    const shared_ptr<ProtectionHandler>& protection,
+    const string& inputPath,
+    const string& outputPath,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher) {
+  return DecryptFileRange(protection, inputPath, 0, -1, outputPath, dispatcher);
+}
+
+int64_t DecryptFileRange(
+    const shared_ptr<ProtectionHandler>& protection,
+    const string& inputPath,
+    int64_t contentStart,
+    int64_t plainSize,
+    const string& outputPath,
+    const shared_ptr<TaskDispatcherImpl>& dispatcher) {
+  Mapping input;
+  input.OpenInput(inputPath);
+  if (contentStart < 0 || static_cast<size_t>(contentStart) > input.Size())
+    throw runtime_error("Content of '" + inputPath + "' starts past its end");
+  const int64_t inputSize = static_cast<int64_t>(input.Size()) - contentStart;
+
+  int64_t written;
+  {
+    Mapping output;
+    output.CreateOutput(outputPath, static_cast<size_t>(inputSize));
+    written = DecryptParallel(protection, input.Data() + contentStart, inputSize, output.Data(), inputSize, dispatcher);
+  }
+  if (plainSize >= 0 && plainSize < written)
+    written = plainSize;
+  // The padding of the final block is dropped.
+  if (written != inputSize && truncate(outputPath.c_str(), static_cast<off_t>(written)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to size", outputPath));
+  return written;
+}
@@ -0,0 +1,97 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_PARALLEL_ENCRYPTION_H_
+#define SAMPLE_FILE_PARALLEL_ENCRYPTION_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/protection/protection_handler.h"
+#include "task_dispatcher_impl.h"
+
+// Segments are cut at multiples of the cipher block size, so each one encrypts independently at its own
+// offset. Larger segments amortize the dispatch overhead; this keeps a few per core even for 100 MB inputs.
+static const int64_t kDefaultEncryptionSegmentSize = 8 * 1024 * 1024;
+
+// Encrypts input into output with protection, spreading block-aligned segments over dispatcher's workers.
+// The calling thread encrypts segments too, so it never waits on a busy pool. output must hold at least
+// protection->GetProtectedContentLength(inputSize, true) bytes. Returns the number of bytes written.
+int64_t EncryptParallel(
+    const std::shared_ptr<mip::ProtectionHandler>& protection,
+    const uint8_t* input,
+    int64_t inputSize,
+    uint8_t* output,
+    int64_t outputSize,
+    const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher,
+    int64_t segmentSize = kDefaultEncryptionSegmentSize);
+
+// Decrypts raw ciphertext, as EncryptParallel wrote it, into output the same way. output must hold at least
+// inputSize bytes. Returns the number of bytes written, which the final block's padding makes smaller.
+int64_t DecryptParallel(
+    const std::shared_ptr<mip::ProtectionHandler>& protection,
+    const uint8_t* input,
+    int64_t inputSize,
+    uint8_t* output,
+    int64_t outputSize,
+    const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher,
+    int64_t segmentSize = kDefaultEncryptionSegmentSize);
+
+// Encrypts the content of inputPath into outputPath, which is created with its final size and written
+// through a shared mapping. The serialized publishing license goes to licensePath, since the raw
+// ciphertext carries no container header. Returns the number of bytes written to outputPath.
+int64_t EncryptFileDetached(
+    const std::shared_ptr<mip::ProtectionHandler>& protection,
+    const std::string& inputPath,
+    const std::string& outputPath,
+    const std::string& licensePath,
+    const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher);
+
+// The publishing license EncryptFileDetached wrote to licensePath. Throws when it is missing or empty.
+std::vector<uint8_t> ReadDetachedLicense(const std::string& licensePath);
+
+// Decrypts the raw ciphertext of inputPath, which protection was created for, into outputPath the way
+// EncryptFileDetached wrote it. Returns the number of bytes written to outputPath.
+int64_t DecryptFileDetached(
+    const std::shared_ptr<mip::ProtectionHandler>& protection,
+    const std::string& inputPath,
+    const std::string& outputPath,
+    const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher);
+
+// Decrypts the ciphertext that runs from contentStart to the end of inputPath, such as the content of a
+// .pfile after its header, into outputPath the same way. The output is cut to plainSize when that is
+// shorter than what decryption wrote. Returns the number of bytes written to outputPath.
+int64_t DecryptFileRange(
+    const std::shared_ptr<mip::ProtectionHandler>& protection,
+    const std::string& inputPath,
+    int64_t contentStart,
+    int64_t plainSize,
+    const std::string& outputPath,
+    const std::shared_ptr<sample::task::TaskDispatcherImpl>& dispatcher);
+
+#endif // SAMPLE_FILE_PARALLEL_ENCRYPTION_H_
@@ -0,0 +1,148 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "pfile_header.h"
+
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// ".pfile", followed by the little-endian header fields.
+static const uint8_t kSignature[] = { 0x2E, 0x70, 0x66, 0x69, 0x6C, 0x65 };
+// Versions from which the header also locates a metadata block, which this reader skips.
+static const uint32_t kMetadataMajorVersion = 3;
+static const uint32_t kMaxMajorVersion = 3;
+// Licenses are serialized XrML; anything larger than this is not a header the SDK wrote.
+static const uint32_t kMaxLicenseSize = 16 * 1024 * 1024;
+static const uint32_t kMaxExtensionSize = 256;
+
+class HeaderReader final {
+public:
+  HeaderReader(mip::Stream& stream, uint64_t size) : mStream(stream), mSize(size), mOffset(0) {}
+
+  bool Bytes(uint8_t* data, uint64_t offset, uint64_t count) {
+    if (offset > mSize || count > mSize - offset)
+      return false;
+    mStream.Seek(offset);
+    return static_cast<uint64_t>(mStream.Read(data, static_cast<int64_t>(count))) == count;
+  }
+
+  bool UInt32(uint32_t& value) {
+    uint8_t data[4];
+    if (!Bytes(data, mOffset, sizeof(data)))
+      return false;
+    mOffset += sizeof(data);
+    value = static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+        static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+    return true;
+  }
+
+  bool UInt64(uint64_t& value) {
+    uint32_t low;
+    uint32_t high;
+    if (!UInt32(low) || !UInt32(high))
+      return false;
+    value = static_cast<uint64_t>(high) << 32 | low;
+    return true;
+  }
+
+  void Skip(uint64_t count) { mOffset += count; }
+  uint64_t Offset() const { return mOffset; }
+
+private:
+  mip::Stream& mStream;
+  const uint64_t mSize;
+  uint64_t mOffset;
+};
+
+// Serialized licenses are XML, in UTF-8 or UTF-16, with or without a byte order mark.
+bool LooksLikeLicense(const vector<uint8_t>& license) {
+  if (license.size() < 2)
+    return false;
+  return license[0] == '<' || (license[0] == 0xEF && license[1] == 0xBB) || (license[0] == 0xFF && license[1] == 0xFE);
+}
+
+} // namespace
+
+bool ReadPfileHeader(mip::Stream& stream, PfileHeader& header) {
+  const int64_t streamSize = stream.Size();
+  if (streamSize <= 0)
+    return false;
+  const uint64_t size = static_cast<uint64_t>(streamSize);
+  HeaderReader reader(stream, size);
+
+  uint8_t signature[sizeof(kSignature)];
+  if (!reader.Bytes(signature, 0, sizeof(signature)) || !std::equal(signature, signature + sizeof(signature), kSignature))
+    return false;
+  reader.Skip(sizeof(kSignature));
+
+  uint32_t headerSize;
+  uint32_t extensionOffset;
+  uint32_t extensionSize;
+  uint32_t licenseOffset;
+  uint32_t licenseSize;
+  if (!reader.UInt32(headerSize) || !reader.UInt32(header.majorVersion) || !reader.UInt32(header.minorVersion) ||
+      header.majorVersion == 0 || header.majorVersion > kMaxMajorVersion ||
+      !reader.UInt32(extensionOffset) || !reader.UInt32(extensionSize) ||
+      !reader.UInt32(licenseOffset) || !reader.UInt32(licenseSize))
+    return false;
+  if (header.majorVersion >= kMetadataMajorVersion) {
+    uint32_t metadataOffset;
+    uint32_t metadataSize;
+    if (!reader.UInt32(metadataOffset) || !reader.UInt32(metadataSize) ||
+        metadataOffset > headerSize || metadataSize > headerSize - metadataOffset)
+      return false;
+  }
+  if (!reader.UInt64(header.originalSize))
+    return false;
+
+  // Every block the header points at lies inside it, after its fixed fields, and the ciphertext after it.
+  const uint64_t fixedSize = reader.Offset();
+  if (headerSize < fixedSize || headerSize > size ||
+      extensionSize == 0 || extensionSize > kMaxExtensionSize || extensionOffset < fixedSize ||
+      extensionOffset > headerSize || extensionSize > headerSize - extensionOffset ||
+      licenseSize == 0 || licenseSize > kMaxLicenseSize || licenseOffset < fixedSize ||
+      licenseOffset > headerSize || licenseSize > headerSize - licenseOffset ||
+      header.originalSize > size - headerSize)
+    return false;
+
+  string extension(extensionSize, '\0');
+  if (!reader.Bytes(reinterpret_cast<uint8_t*>(&extension[0]), extensionOffset, extensionSize) || extension[0] != '.' ||
+      extension.find('\0') != string::npos)
+    return false;
+  vector<uint8_t> license(licenseSize);
+  if (!reader.Bytes(license.data(), licenseOffset, licenseSize) || !LooksLikeLicense(license))
+    return false;
+
+  header.fileExtension.swap(extension);
+  header.publishingLicense.swap(license);
+  header.contentStart = headerSize;
+  return true;
+}
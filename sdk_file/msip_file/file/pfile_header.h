@@ -0,0 +1,54 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_PFILE_HEADER_H_
+#define SAMPLE_FILE_PFILE_HEADER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mip/stream.h"
+
+// Header of a .pfile, the generic container the SDK wraps formats it cannot protect natively in: the
+// original extension, the publishing license, and where the ciphertext starts. Reading it lets a pfile be
+// decrypted with a protection engine alone, without a file engine or its policy.
+struct PfileHeader {
+  uint32_t majorVersion;
+  uint32_t minorVersion;
+  // Extension of the protected file, with its leading dot.
+  std::string fileExtension;
+  std::vector<uint8_t> publishingLicense;
+  uint64_t contentStart;
+  uint64_t originalSize;
+};
+
+// False when stream does not start with a pfile header of a version this reader knows, or the header does
+// not fit the stream. Callers then open the file through the File SDK, which reads every version.
+bool ReadPfileHeader(mip::Stream& stream, PfileHeader& header);
+
+#endif  // SAMPLE_FILE_PFILE_HEADER_H_
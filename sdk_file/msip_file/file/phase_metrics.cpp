@@ -0,0 +1,168 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "phase_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "operation_log.h"
+
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+namespace {
+
+const size_t kPhaseCount = static_cast<size_t>(PhaseMetrics::Phase::Count);
+const int64_t kFirstBoundNanoseconds = 100 * 1000;
+
+// Written only by the owning thread, so relaxed load-and-store replaces an atomic read-modify-write.
+// The atomics only keep Snapshot's concurrent reads well defined.
+struct ThreadCounters {
+  atomic<uint64_t> count[kPhaseCount];
+  atomic<uint64_t> sumNanoseconds[kPhaseCount];
+  atomic<uint64_t> buckets[kPhaseCount][PhaseMetrics::kBucketCount + 1];
+
+  ThreadCounters() {
+    for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+      count[phase].store(0, std::memory_order_relaxed);
+      sumNanoseconds[phase].store(0, std::memory_order_relaxed);
+      for (auto& bucket : buckets[phase])
+        bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+void Add(atomic<uint64_t>& counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void AddTo(vector<PhaseMetrics::Histogram>& histograms, const ThreadCounters& counters) {
+  for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+    auto& histogram = histograms[phase];
+    histogram.count += counters.count[phase].load(std::memory_order_relaxed);
+    histogram.sumNanoseconds += counters.sumNanoseconds[phase].load(std::memory_order_relaxed);
+    for (size_t bucket = 0; bucket <= PhaseMetrics::kBucketCount; ++bucket)
+      histogram.buckets[bucket] += counters.buckets[phase][bucket].load(std::memory_order_relaxed);
+  }
+}
+
+class Registry final {
+public:
+  static Registry& Instance() {
+    static Registry* instance = new Registry(); // Never destroyed, so threads that exit late can still retire.
+    return *instance;
+  }
+
+  void Add(ThreadCounters* counters) {
+    lock_guard<mutex> lock(mMutex);
+    mThreads.push_back(counters);
+  }
+
+  void Retire(ThreadCounters* counters) {
+    lock_guard<mutex> lock(mMutex);
+    mThreads.erase(std::remove(mThreads.begin(), mThreads.end(), counters), mThreads.end());
+    AddTo(mRetired, *counters);
+  }
+
+  vector<PhaseMetrics::Histogram> Snapshot() {
+    lock_guard<mutex> lock(mMutex);
+    auto histograms = mRetired;
+    for (auto counters : mThreads)
+      AddTo(histograms, *counters);
+    return histograms;
+  }
+
+private:
+  Registry()
+      : mRetired(kPhaseCount, PhaseMetrics::Histogram()) {
+  }
+
+  mutex mMutex;
+  vector<ThreadCounters*> mThreads;
+  vector<PhaseMetrics::Histogram> mRetired;
+};
+
+struct ThreadSlot {
+  ThreadCounters counters;
+
+  ThreadSlot() { Registry::Instance().Add(&counters); }
+  ~ThreadSlot() { Registry::Instance().Retire(&counters); }
+};
+
+thread_local ThreadSlot tSlot;
+
+size_t GetBucket(int64_t nanoseconds) {
+  size_t bucket = 0;
+  for (int64_t bound = kFirstBoundNanoseconds; bucket < PhaseMetrics::kBucketCount && nanoseconds > bound; bound *= 2)
+    ++bucket;
+  return bucket;
+}
+
+} // namespace
+
+const size_t PhaseMetrics::kBucketCount;
+
+void PhaseMetrics::Record(Phase phase, std::chrono::nanoseconds elapsed) {
+  const auto index = static_cast<size_t>(phase);
+  if (index >= kPhaseCount)
+    return;
+  const auto nanoseconds = std::max<int64_t>(elapsed.count(), 0);
+  auto& counters = tSlot.counters;
+  Add(counters.count[index], 1);
+  Add(counters.sumNanoseconds[index], static_cast<uint64_t>(nanoseconds));
+  Add(counters.buckets[index][GetBucket(nanoseconds)], 1);
+}
+
+void PhaseMetrics::Record(Phase phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+  Record(phase, end - start);
+  if (sample::oplog::OperationLog::Current())
+    sample::oplog::Record("phase", GetName(phase), start, end, std::string());
+}
+
+vector<PhaseMetrics::Histogram> PhaseMetrics::Snapshot() {
+  return Registry::Instance().Snapshot();
+}
+
+const char* PhaseMetrics::GetName(Phase phase) {
+  switch (phase) {
+    case Phase::ContextCreate: return "context_create";
+    case Phase::ProfileLoad: return "profile_load";
+    case Phase::EngineLoad: return "engine_load";
+    case Phase::HandlerCreate: return "handler_create";
+    case Phase::LicenseAcquire: return "license_acquire";
+    case Phase::Commit: return "commit";
+    case Phase::ShutDown: return "shutdown";
+    default: return "unknown";
+  }
+}
+
+double PhaseMetrics::GetBucketBoundSeconds(size_t bucket) {
+  return static_cast<double>(kFirstBoundNanoseconds << bucket) / 1e9;
+}
@@ -0,0 +1,93 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_PHASE_METRICS_H_
+#define SAMPLE_FILE_PHASE_METRICS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Latency histograms of the SDK phases behind each export. Every thread records into its own counters,
+// so the hot path takes no lock and shares no cache line; Snapshot sums the threads' counters. Counters
+// of threads that exit are folded into a process-wide total.
+class PhaseMetrics final {
+public:
+  enum class Phase : size_t {
+    ContextCreate,
+    ProfileLoad,
+    EngineLoad,
+    HandlerCreate,
+    LicenseAcquire,
+    Commit,
+    ShutDown,
+    Count
+  };
+
+  // Upper bounds run from 100 us doubling to about 105 s, plus an overflow bucket.
+  static const size_t kBucketCount = 21;
+
+  struct Histogram {
+    uint64_t count;
+    uint64_t sumNanoseconds;
+    // Per-bucket (not cumulative) counts; the last entry counts samples above every bound.
+    uint64_t buckets[kBucketCount + 1];
+  };
+
+  static void Record(Phase phase, std::chrono::nanoseconds elapsed);
+  // Also adds the phase to the thread's operation log, if one is current.
+  static void Record(Phase phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+  // One histogram per phase, indexed by Phase.
+  static std::vector<Histogram> Snapshot();
+
+  static const char* GetName(Phase phase);
+
+  static double GetBucketBoundSeconds(size_t bucket);
+};
+
+// Records the time from construction to destruction against phase.
+class ScopedPhase final {
+public:
+  explicit ScopedPhase(PhaseMetrics::Phase phase)
+      : mPhase(phase),
+        mStart(std::chrono::steady_clock::now()) {
+  }
+
+  ~ScopedPhase() {
+    PhaseMetrics::Record(mPhase, mStart, std::chrono::steady_clock::now());
+  }
+
+  ScopedPhase(const ScopedPhase&) = delete;
+  ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+  PhaseMetrics::Phase mPhase;
+  std::chrono::steady_clock::time_point mStart;
+};
+
+#endif // SAMPLE_FILE_PHASE_METRICS_H_
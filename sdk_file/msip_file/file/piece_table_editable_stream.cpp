@@ -0,0 +1,375 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "piece_table_editable_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+using std::invalid_argument;
+using std::min;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+#ifdef _WIN32
+#define MEMCPY(dest, destSize, src, count) memcpy_s(dest, destSize, src, count)
+#else // _WIN32
+#define MEMCPY(dest, destSize, src, count) memcpy(dest, src, count)
+#endif // _WIN32
+
+namespace {
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& CopiedBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_editable_copied_bytes_total", "Unchanged bytes of edited files copied in the kernel");
+  return counter;
+}
+
+MetricsRegistry::Counter& WrittenBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_editable_written_bytes_total", "Bytes of edited files written from memory");
+  return counter;
+}
+
+void WriteAll(int fd, const uint8_t* data, int64_t length) {
+  WrittenBytes().Add(static_cast<uint64_t>(length));
+  while (length > 0) {
+    const ssize_t count = write(fd, data, static_cast<size_t>(length));
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw runtime_error(string("Failed to write edited stream: ") + strerror(count < 0 ? errno : EIO));
+    data += count;
+    length -= count;
+  }
+}
+
+// Copies length bytes at offset of inFd to outFd without passing them through user space. Returns false,
+// having copied nothing, when neither call supports this pair of files, e.g. across filesystems on older
+// kernels or into a pipe.
+bool CopyInKernel(int inFd, int64_t offset, int64_t length, int outFd) {
+  bool started = false;
+  bool useSendfile = false;
+  while (length > 0) {
+    ssize_t count;
+    if (!useSendfile) {
+      loff_t inOffset = static_cast<loff_t>(offset);
+      count = copy_file_range(inFd, &inOffset, outFd, nullptr, static_cast<size_t>(length), 0);
+    } else {
+      off_t inOffset = static_cast<off_t>(offset);
+      count = sendfile(outFd, inFd, &inOffset, static_cast<size_t>(length));
+    }
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0 && !started && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+      if (useSendfile)
+        return false;
+      useSendfile = true;
+      continue;
+    }
+    if (count < 0)
+      throw runtime_error(string("Failed to copy edited stream: ") + strerror(errno));
+    if (count == 0)
+      throw runtime_error("Failed to copy edited stream: the file shrank while it was being edited");
+    started = true;
+    offset += count;
+    length -= count;
+    CopiedBytes().Add(static_cast<uint64_t>(count));
+  }
+  return true;
+}
+
+} // namespace
+
+PieceTableEditableStream::PieceTableEditableStream(vector<uint8_t>&& buffer)
+    : mOriginalBuffer(std::move(buffer)),
+      mOriginal(mOriginalBuffer.data()),
+      mFd(-1),
+      mSize(static_cast<int64_t>(mOriginalBuffer.size())),
+      mPosition(0) {
+  if (mSize > 0)
+    mRoot = NewNode(Source::Original, 0, mSize);
+}
+
+PieceTableEditableStream::PieceTableEditableStream(const shared_ptr<const uint8_t>& data, int64_t size)
+    : mSharedOriginal(data),
+      mOriginal(data.get()),
+      mFd(-1),
+      mSize(size),
+      mPosition(0) {
+  if (size < 0 || (size > 0 && data == nullptr))
+    throw invalid_argument("Buffer must be non-null with a non-negative size.");
+  if (mSize > 0)
+    mRoot = NewNode(Source::Original, 0, mSize);
+}
+
+PieceTableEditableStream::PieceTableEditableStream(const string& filePath)
+    : mOriginal(nullptr),
+      mFd(-1),
+      mSize(0),
+      mPosition(0) {
+  mFd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (mFd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", filePath));
+  struct stat fileInfo;
+  if (fstat(mFd, &fileInfo) != 0) {
+    auto message = ErrnoMessage("Failed to stat", filePath);
+    close(mFd);
+    throw runtime_error(message);
+  }
+  const size_t size = static_cast<size_t>(fileInfo.st_size);
+  if (size > 0) {
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, mFd, 0);
+    if (mapping == MAP_FAILED) {
+      auto message = ErrnoMessage("Failed to map", filePath);
+      close(mFd);
+      throw runtime_error(message);
+    }
+    mSharedOriginal.reset(static_cast<const uint8_t*>(mapping), [size](const uint8_t* data) {
+      munmap(const_cast<uint8_t*>(data), size);
+    });
+    mOriginal = mSharedOriginal.get();
+    mSize = static_cast<int64_t>(size);
+    mRoot = NewNode(Source::Original, 0, mSize);
+  }
+}
+
+PieceTableEditableStream::~PieceTableEditableStream() {
+  if (mFd >= 0)
+    close(mFd);
+}
+
+int64_t PieceTableEditableStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  if (bufferLength <= 0)
+    return 0;
+  auto bytesRead = (bufferLength <= mSize - mPosition) ? bufferLength : mSize - mPosition;
+  if (bytesRead) {
+    ReadRange(mRoot.get(), mPosition, buffer, bytesRead);
+    mPosition += bytesRead;
+  }
+  return bytesRead;
+}
+
+int64_t PieceTableEditableStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  return Update(buffer, bufferLength, bufferLength);
+}
+
+int64_t PieceTableEditableStream::Insert(const uint8_t* buffer, int64_t bufferLength) {
+  if (bufferLength <= 0)
+    return 0;
+  if (std::numeric_limits<int64_t>::max() - mSize < bufferLength)
+    throw runtime_error("Inserting buffer would exceed maximum stream length.");
+  const auto start = static_cast<int64_t>(mAdded.size());
+  mAdded.insert(mAdded.end(), buffer, buffer + static_cast<size_t>(bufferLength));
+
+  unique_ptr<Node> left, right;
+  Split(std::move(mRoot), mPosition, left, right);
+  mRoot = Merge(Merge(std::move(left), NewNode(Source::Added, start, bufferLength)), std::move(right));
+  mSize += bufferLength;
+  mPosition += bufferLength;
+  return bufferLength;
+}
+
+int64_t PieceTableEditableStream::Update(const uint8_t* buffer, int64_t bufferLength, int64_t replaceLength) {
+  Delete(replaceLength);
+  return Insert(buffer, bufferLength);
+}
+
+int64_t PieceTableEditableStream::Delete(int64_t numBytes) {
+  if (numBytes <= 0)
+    return 0;
+  auto bytesDeleted = (numBytes <= mSize - mPosition) ? numBytes : mSize - mPosition;
+  if (bytesDeleted) {
+    unique_ptr<Node> left, middle, right;
+    Split(std::move(mRoot), mPosition, left, right);
+    Split(std::move(right), bytesDeleted, middle, right);
+    mRoot = Merge(std::move(left), std::move(right));
+    mSize -= bytesDeleted;
+  }
+  return bytesDeleted;
+}
+
+bool PieceTableEditableStream::Flush() { return true; }
+
+void PieceTableEditableStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (position > mSize)
+    throw runtime_error("Position must not be larger than size.");
+  mPosition = position;
+}
+
+bool PieceTableEditableStream::CanRead() const { return true; }
+
+bool PieceTableEditableStream::CanWrite() const { return true; }
+
+int64_t PieceTableEditableStream::Position() { return mPosition; }
+
+int64_t PieceTableEditableStream::Size() { return mSize; }
+
+void PieceTableEditableStream::Size(int64_t /* value */) {
+  throw runtime_error("Not Implemented");
+}
+
+vector<uint8_t> PieceTableEditableStream::Linearize() const {
+  vector<uint8_t> content(static_cast<size_t>(mSize));
+  if (mSize > 0)
+    ReadRange(mRoot.get(), 0, content.data(), mSize);
+  return content;
+}
+
+int64_t PieceTableEditableStream::WriteTo(int fd) const {
+  bool kernelCopy = mFd >= 0;
+  WriteRange(mRoot.get(), fd, kernelCopy);
+  return mSize;
+}
+
+// Writes node's subtree in order. kernelCopy is cleared the first time the kernel refuses a copy, and the
+// remaining spans are written from the mapping.
+void PieceTableEditableStream::WriteRange(const Node* node, int fd, bool& kernelCopy) const {
+  while (node) {
+    WriteRange(node->left.get(), fd, kernelCopy);
+    if (node->source == Source::Original && kernelCopy)
+      kernelCopy = CopyInKernel(mFd, node->start, node->length, fd);
+    if (node->source == Source::Added || !kernelCopy)
+      WriteAll(fd, Data(node->source) + node->start, node->length);
+    node = node->right.get();
+  }
+}
+
+unique_ptr<PieceTableEditableStream::Node> PieceTableEditableStream::NewNode(Source source, int64_t start, int64_t length) {
+  unique_ptr<Node> node(new Node());
+  node->source = source;
+  node->start = start;
+  node->length = length;
+  node->total = length;
+  node->priority = static_cast<uint32_t>(mRandom());
+  return node;
+}
+
+int64_t PieceTableEditableStream::Total(const unique_ptr<Node>& node) {
+  return node ? node->total : 0;
+}
+
+void PieceTableEditableStream::Refresh(Node* node) {
+  node->total = Total(node->left) + node->length + Total(node->right);
+}
+
+// Splits node so that left holds the first offset bytes and right holds the rest, cutting a piece in two
+// when the offset falls inside it.
+void PieceTableEditableStream::Split(
+    unique_ptr<Node> node,
+    int64_t offset,
+    unique_ptr<Node>& left,
+    unique_ptr<Node>& right) {
+  if (!node) {
+    left.reset();
+    right.reset();
+    return;
+  }
+  const auto leftTotal = Total(node->left);
+  if (offset <= leftTotal) {
+    unique_ptr<Node> subtree = std::move(node->left);
+    Split(std::move(subtree), offset, left, node->left);
+    Refresh(node.get());
+    right = std::move(node);
+  } else if (offset >= leftTotal + node->length) {
+    unique_ptr<Node> subtree = std::move(node->right);
+    Split(std::move(subtree), offset - leftTotal - node->length, node->right, right);
+    Refresh(node.get());
+    left = std::move(node);
+  } else {
+    const auto cut = offset - leftTotal;
+    auto tail = NewNode(node->source, node->start + cut, node->length - cut);
+    node->length = cut;
+    right = Merge(std::move(tail), std::move(node->right));
+    Refresh(node.get());
+    left = std::move(node);
+  }
+}
+
+unique_ptr<PieceTableEditableStream::Node> PieceTableEditableStream::Merge(unique_ptr<Node> left, unique_ptr<Node> right) {
+  if (!left)
+    return right;
+  if (!right)
+    return left;
+  if (left->priority > right->priority) {
+    left->right = Merge(std::move(left->right), std::move(right));
+    Refresh(left.get());
+    return left;
+  }
+  right->left = Merge(std::move(left), std::move(right->left));
+  Refresh(right.get());
+  return right;
+}
+
+// Copies length bytes starting at offset within node's subtree, visiting only the pieces that overlap.
+void PieceTableEditableStream::ReadRange(const Node* node, int64_t offset, uint8_t* buffer, int64_t length) const {
+  while (node && length > 0) {
+    const auto leftTotal = Total(node->left);
+    if (offset < leftTotal) {
+      const auto fromLeft = min(length, leftTotal - offset);
+      ReadRange(node->left.get(), offset, buffer, fromLeft);
+      buffer += fromLeft;
+      offset += fromLeft;
+      length -= fromLeft;
+    }
+    const auto pieceOffset = offset - leftTotal;
+    if (length > 0 && pieceOffset < node->length) {
+      const auto fromPiece = min(length, node->length - pieceOffset);
+      MEMCPY(buffer, static_cast<size_t>(length), Data(node->source) + node->start + pieceOffset, static_cast<size_t>(fromPiece));
+      buffer += fromPiece;
+      offset += fromPiece;
+      length -= fromPiece;
+    }
+    offset -= leftTotal + node->length;
+    node = node->right.get();
+  }
+}
+
+const uint8_t* PieceTableEditableStream::Data(Source source) const {
+  return source == Source::Original ? mOriginal : mAdded.data();
+}
@@ -0,0 +1,103 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_PIECE_TABLE_EDITABLE_STREAM_H_
+#define SAMPLE_FILE_PIECE_TABLE_EDITABLE_STREAM_H_
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "mip/editable_stream.h"
+
+// EditableStream that records edits as pieces over an immutable original buffer and an append-only
+// added buffer. Pieces live in an implicit treap ordered by stream offset, so Insert, Update and Delete
+// cost O(log n) in the number of edits instead of moving the tail of the document. Linearize() copies
+// the final content out once, when the caller commits.
+class PieceTableEditableStream final : public mip::EditableStream {
+public:
+  explicit PieceTableEditableStream(std::vector<uint8_t>&& memory);
+  // Edits memory kept alive by data without copying it. The original bytes are never modified.
+  PieceTableEditableStream(const std::shared_ptr<const uint8_t>& data, int64_t size);
+  // Edits a read-only mapping of filePath, which is never modified. Only the edits are held in memory, and
+  // WriteTo copies the unchanged spans from the file in the kernel. Throws std::runtime_error.
+  explicit PieceTableEditableStream(const std::string& filePath);
+  ~PieceTableEditableStream();
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Insert(const uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Update(const uint8_t* buffer, int64_t bufferLength, int64_t replaceLength) override;
+  int64_t Delete(int64_t numBytes) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+  std::vector<uint8_t> Linearize() const;
+  // Writes the content at fd's offset and returns the bytes written. Unchanged spans of a file opened by
+  // path go through copy_file_range, or sendfile where that is unsupported, so they are neither read into
+  // memory nor, on a filesystem that shares extents, copied on disk. Throws std::runtime_error.
+  int64_t WriteTo(int fd) const;
+
+private:
+  enum class Source { Original, Added };
+
+  struct Node {
+    Source source;
+    int64_t start;
+    int64_t length;
+    int64_t total;
+    uint32_t priority;
+    std::unique_ptr<Node> left;
+    std::unique_ptr<Node> right;
+  };
+
+  std::unique_ptr<Node> NewNode(Source source, int64_t start, int64_t length);
+  static int64_t Total(const std::unique_ptr<Node>& node);
+  static void Refresh(Node* node);
+  void Split(std::unique_ptr<Node> node, int64_t offset, std::unique_ptr<Node>& left, std::unique_ptr<Node>& right);
+  static std::unique_ptr<Node> Merge(std::unique_ptr<Node> left, std::unique_ptr<Node> right);
+  void ReadRange(const Node* node, int64_t offset, uint8_t* buffer, int64_t length) const;
+  const uint8_t* Data(Source source) const;
+  void WriteRange(const Node* node, int fd, bool& kernelCopy) const;
+
+  std::vector<uint8_t> mOriginalBuffer;
+  std::shared_ptr<const uint8_t> mSharedOriginal;
+  const uint8_t* mOriginal;
+  // The file behind mOriginal when opened by path, else -1.
+  int mFd;
+  std::vector<uint8_t> mAdded;
+  std::unique_ptr<Node> mRoot;
+  std::minstd_rand mRandom;
+  int64_t mSize;
+  int64_t mPosition;
+};
+
+#endif // SAMPLE_FILE_PIECE_TABLE_EDITABLE_STREAM_H_
@@ -27,30 +27,35 @@
 
 #include "profile_observer.h"
 
-#include <future>
+#include "async_completion.h"
 
 using std::exception_ptr;
-using std::promise;
 using std::shared_ptr;
+using std::string;
+using std::vector;
 using mip::FileEngine;
 using mip::FileProfile;
 
 void ProfileObserver::OnLoadSuccess(const shared_ptr<FileProfile>& profile, const shared_ptr<void>& context) {
-  auto profilePromise = static_cast<promise<shared_ptr<FileProfile>> *>(context.get());
-  profilePromise->set_value(profile);
+  AsyncCompletion<shared_ptr<FileProfile>>::FromContext(context).Succeed(profile);
 }
 
 void ProfileObserver::OnLoadFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto profilePromise = static_cast<promise<shared_ptr<FileProfile>> *>(context.get());
-  profilePromise->set_exception(error);
+  AsyncCompletion<shared_ptr<FileProfile>>::FromContext(context).Failed(error);
  }
 
 void ProfileObserver::OnAddEngineSuccess(const shared_ptr<FileEngine>& engine, const shared_ptr<void>& context) {
-  auto profilePromise = static_cast<promise<shared_ptr<FileEngine>> *>(context.get());
-  profilePromise->set_value(engine);
+  AsyncCompletion<shared_ptr<FileEngine>>::FromContext(context).Succeed(engine);
 }
 
 void ProfileObserver::OnAddEngineFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto profilePromise = static_cast<promise<shared_ptr<FileEngine>> *>(context.get());
-  profilePromise->set_exception(error);
+  AsyncCompletion<shared_ptr<FileEngine>>::FromContext(context).Failed(error);
+}
+
+void ProfileObserver::OnListEnginesSuccess(const vector<string>& engineIds, const shared_ptr<void>& context) {
+  AsyncCompletion<vector<string>>::FromContext(context).Succeed(engineIds);
+}
+
+void ProfileObserver::OnListEnginesFailure(const exception_ptr& error, const shared_ptr<void>& context) {
+  AsyncCompletion<vector<string>>::FromContext(context).Failed(error);
 }
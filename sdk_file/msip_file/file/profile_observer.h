@@ -29,6 +29,8 @@
 #define SAMPLE_PROFILE_OBSERVER_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "mip/file/file_profile.h"
 
@@ -40,6 +42,8 @@ public:
   void OnLoadFailure(const std::exception_ptr& error, const std::shared_ptr<void>& context) override;
   void OnAddEngineSuccess(const std::shared_ptr<mip::FileEngine>& engine, const std::shared_ptr<void>& context) override;
   void OnAddEngineFailure(const std::exception_ptr& error, const std::shared_ptr<void>& context) override;
+  void OnListEnginesSuccess(const std::vector<std::string>& engineIds, const std::shared_ptr<void>& context) override;
+  void OnListEnginesFailure(const std::exception_ptr& error, const std::shared_ptr<void>& context) override;
 };
 
 #endif // SAMPLE_PROFILE_OBSERVER_H_
\ No newline at end of file
@@ -0,0 +1,172 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "protection_cache.h"
+
+#include "allocation_account.h"
+
+using mip::ProtectionHandler;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+static const char kTemplateMarker = '\x1e';
+static const char kAdhocMarker = '\x1d';
+
+// Template and ad-hoc entries have no file behind them, so they all carry the same empty identity.
+const FileIdentity kNoIdentity = { 0, 0, 0, 0 };
+
+} // namespace
+
+const size_t ProtectionCache::kDefaultCapacity;
+
+ProtectionCache::ProtectionCache(size_t capacity)
+    : mEntries(capacity, "protection"),
+      mLoads(MetricsRegistry::Shared().GetCounter(
+          "msip_native_reference_loads_coalesced_total", "Reference file reads that waited for one already in flight")) {
+}
+
+shared_ptr<ProtectionHandler> ProtectionCache::GetOrLoad(
+    const string& engineId,
+    const string& referencePath,
+    const Loader& load) {
+  FileIdentity identity;
+  bool cacheable = false;
+  auto cached = Find(engineId, referencePath, identity, cacheable);
+  if (cached)
+    return cached;
+
+  // Loading opens the reference file and may acquire a license, so it runs without holding the lock.
+  // Concurrent misses for a cacheable reference share one load.
+  if (!cacheable)
+    return load();
+  return mLoads.Do(MakeKey(engineId, referencePath), [&]() {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    auto protection = load();
+    Put(engineId, referencePath, identity, protection);
+    return protection;
+  });
+}
+
+shared_ptr<ProtectionHandler> ProtectionCache::Find(
+    const string& engineId,
+    const string& referencePath,
+    FileIdentity& identity,
+    bool& cacheable) {
+  // The identity is taken before the reference is read, so a file replaced meanwhile misses next time.
+  const string key = MakeKey(engineId, referencePath);
+  cacheable = GetFileIdentity(referencePath, identity);
+  if (!cacheable) {
+    mEntries.RecordMiss(key);
+    return nullptr;
+  }
+
+  auto protection = Lookup(key, identity);
+  if (!protection)
+    cacheable = mEntries.GetCapacity() > 0;
+  return protection;
+}
+
+void ProtectionCache::Put(
+    const string& engineId,
+    const string& referencePath,
+    const FileIdentity& identity,
+    const shared_ptr<ProtectionHandler>& protection) {
+  Store(MakeKey(engineId, referencePath), identity, protection);
+}
+
+shared_ptr<ProtectionHandler> ProtectionCache::FindTemplate(const string& engineId, const string& templateId) {
+  return Lookup(MakeTemplateKey(engineId, templateId), kNoIdentity);
+}
+
+void ProtectionCache::PutTemplate(
+    const string& engineId,
+    const string& templateId,
+    const shared_ptr<ProtectionHandler>& protection) {
+  Store(MakeTemplateKey(engineId, templateId), kNoIdentity, protection);
+}
+
+shared_ptr<ProtectionHandler> ProtectionCache::FindAdhoc(const string& engineId, const string& descriptorKey) {
+  return Lookup(MakeAdhocKey(engineId, descriptorKey), kNoIdentity);
+}
+
+void ProtectionCache::PutAdhoc(
+    const string& engineId,
+    const string& descriptorKey,
+    const shared_ptr<ProtectionHandler>& protection) {
+  Store(MakeAdhocKey(engineId, descriptorKey), kNoIdentity, protection);
+}
+
+shared_ptr<ProtectionHandler> ProtectionCache::Lookup(const string& key, const FileIdentity& identity) {
+  Entry entry;
+  if (!mEntries.Find(key, entry, [&identity](const Entry& cached) { return cached.identity == identity; }))
+    return nullptr;
+  return entry.protection;
+}
+
+void ProtectionCache::Store(const string& key, const FileIdentity& identity, const shared_ptr<ProtectionHandler>& protection) {
+  if (!protection)
+    return;
+
+  Entry entry;
+  entry.identity = identity;
+  entry.protection = protection;
+  mEntries.Put(key, entry);
+}
+
+void ProtectionCache::SetCapacity(size_t capacity) {
+  mEntries.SetCapacity(capacity);
+}
+
+ProtectionCache::Stats ProtectionCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void ProtectionCache::Clear() {
+  mEntries.Clear();
+}
+
+string ProtectionCache::MakeKey(const string& engineId, const string& referencePath) {
+  return engineId + kKeySeparator + referencePath;
+}
+
+string ProtectionCache::MakeTemplateKey(const string& engineId, const string& templateId) {
+  return engineId + kKeySeparator + kTemplateMarker + templateId;
+}
+
+string ProtectionCache::MakeAdhocKey(const string& engineId, const string& descriptorKey) {
+  return engineId + kKeySeparator + kAdhocMarker + descriptorKey;
+}
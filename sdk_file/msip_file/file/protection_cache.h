@@ -0,0 +1,124 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_PROTECTION_CACHE_H_
+#define SAMPLE_FILE_PROTECTION_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "file_identity.h"
+#include "mip/protection/protection_handler.h"
+#include "sharded_lru.h"
+#include "single_flight.h"
+
+// LRU of ProtectionHandlers read from protectFile's reference ("template") files, keyed by engine id and
+// reference path. An entry is reused only while the reference file keeps the identity it had when it
+// was read, so bulk protects against one template open it and acquire its license once per engine.
+// Handlers created from RMS template ids and from custom permissions share the same LRU.
+class ProtectionCache final {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  // Reads the reference file. A null handler (unprotected reference) is returned but not cached.
+  typedef std::function<std::shared_ptr<mip::ProtectionHandler>()> Loader;
+
+  static const size_t kDefaultCapacity = 64;
+
+  explicit ProtectionCache(size_t capacity = kDefaultCapacity);
+
+  std::shared_ptr<mip::ProtectionHandler> GetOrLoad(
+      const std::string& engineId,
+      const std::string& referencePath,
+      const Loader& load);
+
+  // Split form of GetOrLoad for callers that read the reference asynchronously. Find fills identity
+  // with the reference file's current identity, which must be handed back to Put.
+  std::shared_ptr<mip::ProtectionHandler> Find(
+      const std::string& engineId,
+      const std::string& referencePath,
+      FileIdentity& identity,
+      bool& cacheable);
+  void Put(
+      const std::string& engineId,
+      const std::string& referencePath,
+      const FileIdentity& identity,
+      const std::shared_ptr<mip::ProtectionHandler>& protection);
+
+  // Handlers created from an RMS template. They stay valid until evicted, since nothing on disk backs them.
+  std::shared_ptr<mip::ProtectionHandler> FindTemplate(const std::string& engineId, const std::string& templateId);
+  void PutTemplate(
+      const std::string& engineId,
+      const std::string& templateId,
+      const std::shared_ptr<mip::ProtectionHandler>& protection);
+
+  // Handlers created from custom permissions, keyed by their interned descriptor's key (see
+  // protection_descriptor_interner.h). Like template handlers they stay valid until evicted.
+  std::shared_ptr<mip::ProtectionHandler> FindAdhoc(const std::string& engineId, const std::string& descriptorKey);
+  void PutAdhoc(
+      const std::string& engineId,
+      const std::string& descriptorKey,
+      const std::shared_ptr<mip::ProtectionHandler>& protection);
+
+  // Shrinking the capacity evicts least recently used entries immediately. Zero disables the cache.
+  void SetCapacity(size_t capacity);
+
+  Stats GetStats() const;
+
+  // Entries held and the most kept, without locking (see ShardedLru::GetSize).
+  size_t GetSize() const { return mEntries.GetSize(); }
+  size_t GetCapacity() const { return mEntries.GetCapacity(); }
+
+  // Drops every handler. Called before the engines they were created with are unloaded.
+  void Clear();
+
+private:
+  struct Entry {
+    FileIdentity identity;
+    std::shared_ptr<mip::ProtectionHandler> protection;
+  };
+
+  static std::string MakeKey(const std::string& engineId, const std::string& referencePath);
+  static std::string MakeTemplateKey(const std::string& engineId, const std::string& templateId);
+  static std::string MakeAdhocKey(const std::string& engineId, const std::string& descriptorKey);
+  std::shared_ptr<mip::ProtectionHandler> Lookup(const std::string& key, const FileIdentity& identity);
+  void Store(const std::string& key, const FileIdentity& identity, const std::shared_ptr<mip::ProtectionHandler>& protection);
+
+  ShardedLru<Entry> mEntries;
+  SingleFlight<std::shared_ptr<mip::ProtectionHandler>> mLoads;
+};
+
+#endif // SAMPLE_FILE_PROTECTION_CACHE_H_
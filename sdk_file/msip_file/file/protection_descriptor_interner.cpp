@@ -0,0 +1,199 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "protection_descriptor_interner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+
+#include "mip/protection_descriptor_builder.h"
+#include "mip/user_rights.h"
+#include "mip/user_roles.h"
+
+using mip::ProtectionDescriptor;
+using mip::ProtectionDescriptorBuilder;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+static const char kGrantSeparator = '\x1e';
+static const char kListSeparator = '\x1d';
+
+string Trim(const string& value) {
+  const auto begin = value.find_first_not_of(" \t");
+  if (begin == string::npos)
+    return string();
+  return value.substr(begin, value.find_last_not_of(" \t") - begin + 1);
+}
+
+vector<string> SplitList(const string& list) {
+  vector<string> items;
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    auto end = list.find(',', begin);
+    if (end == string::npos)
+      end = list.size();
+    auto item = Trim(list.substr(begin, end - begin));
+    if (!item.empty())
+      items.push_back(item);
+    begin = end + 1;
+  }
+  return items;
+}
+
+void SortUnique(vector<string>& items) {
+  std::sort(items.begin(), items.end());
+  items.erase(std::unique(items.begin(), items.end()), items.end());
+}
+
+string Join(const vector<string>& items) {
+  string joined;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (i)
+      joined += kListSeparator;
+    joined += items[i];
+  }
+  return joined;
+}
+
+} // namespace
+
+const size_t ProtectionDescriptorInterner::kDefaultCapacity;
+
+ProtectionDescriptorInterner::ProtectionDescriptorInterner(size_t capacity)
+    : mDescriptors(capacity, "protection_descriptor") {
+}
+
+ProtectionDescriptorInterner::Interned ProtectionDescriptorInterner::Intern(const AdhocPermissions& permissions) {
+  const auto canonical = Canonicalize(permissions);
+  if (canonical.grants.empty())
+    throw std::invalid_argument("Custom permissions need at least one user and right");
+
+  Interned interned;
+  interned.key = MakeKey(canonical);
+  if (!mDescriptors.Find(interned.key, interned.descriptor)) {
+    // Concurrent misses may both build; the descriptors are equivalent and the last one stays.
+    interned.descriptor = Build(canonical);
+    mDescriptors.Put(interned.key, interned.descriptor);
+  }
+  return interned;
+}
+
+AdhocPermissions ProtectionDescriptorInterner::Canonicalize(const AdhocPermissions& permissions) {
+  std::map<vector<string>, vector<string>> grantsByUsers;
+  for (const auto& grant : permissions.grants) {
+    auto users = grant.users;
+    for (auto& user : users)
+      std::transform(user.begin(), user.end(), user.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    SortUnique(users);
+    if (users.empty() || grant.permissions.empty())
+      continue;
+    auto& merged = grantsByUsers[users];
+    merged.insert(merged.end(), grant.permissions.begin(), grant.permissions.end());
+  }
+
+  AdhocPermissions canonical;
+  canonical.byRoles = permissions.byRoles;
+  canonical.validUntil = permissions.validUntil;
+  canonical.allowOfflineAccess = permissions.allowOfflineAccess;
+  for (auto& entry : grantsByUsers) {
+    AdhocPermissions::Grant grant;
+    grant.users = entry.first;
+    grant.permissions = std::move(entry.second);
+    SortUnique(grant.permissions);
+    canonical.grants.push_back(std::move(grant));
+  }
+  return canonical;
+}
+
+string ProtectionDescriptorInterner::MakeKey(const AdhocPermissions& canonical) {
+  string key = canonical.byRoles ? "roles" : "rights";
+  key += kKeySeparator + std::to_string(canonical.validUntil);
+  key += kKeySeparator;
+  key += canonical.allowOfflineAccess ? '1' : '0';
+  for (const auto& grant : canonical.grants) {
+    key += kKeySeparator + Join(grant.users);
+    key += kGrantSeparator + Join(grant.permissions);
+  }
+  return key;
+}
+
+AdhocPermissions::Grant ProtectionDescriptorInterner::ParseGrant(const string& grant) {
+  const auto colon = grant.find(':');
+  if (colon == string::npos)
+    throw std::invalid_argument("Grant must be written users:permissions: " + grant);
+  AdhocPermissions::Grant parsed;
+  parsed.users = SplitList(grant.substr(0, colon));
+  parsed.permissions = SplitList(grant.substr(colon + 1));
+  if (parsed.users.empty() || parsed.permissions.empty())
+    throw std::invalid_argument("Grant needs at least one user and permission: " + grant);
+  return parsed;
+}
+
+void ProtectionDescriptorInterner::SetCapacity(size_t capacity) {
+  mDescriptors.SetCapacity(capacity);
+}
+
+ProtectionDescriptorInterner::Stats ProtectionDescriptorInterner::GetStats() const {
+  const auto entries = mDescriptors.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void ProtectionDescriptorInterner::Clear() {
+  mDescriptors.Clear();
+}
+
+shared_ptr<ProtectionDescriptor> ProtectionDescriptorInterner::Build(const AdhocPermissions& canonical) {
+  shared_ptr<ProtectionDescriptorBuilder> builder;
+  if (canonical.byRoles) {
+    vector<mip::UserRoles> userRoles;
+    for (const auto& grant : canonical.grants)
+      userRoles.emplace_back(grant.users, grant.permissions);
+    builder = ProtectionDescriptorBuilder::CreateFromUserRoles(userRoles);
+  } else {
+    vector<mip::UserRights> userRights;
+    for (const auto& grant : canonical.grants)
+      userRights.emplace_back(grant.users, grant.permissions);
+    builder = ProtectionDescriptorBuilder::CreateFromUserRights(userRights);
+  }
+  if (canonical.validUntil > 0)
+    builder->SetContentValidUntil(std::chrono::system_clock::from_time_t(static_cast<time_t>(canonical.validUntil)));
+  builder->SetAllowOfflineAccess(canonical.allowOfflineAccess);
+  return builder->Build();
+}
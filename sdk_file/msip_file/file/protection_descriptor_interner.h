@@ -0,0 +1,106 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_PROTECTION_DESCRIPTOR_INTERNER_H_
+#define SAMPLE_FILE_PROTECTION_DESCRIPTOR_INTERNER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/protection_descriptor.h"
+#include "sharded_lru.h"
+
+// Custom (ad-hoc) permissions for protecting content: who gets which rights or roles, until when, and
+// whether they may open it offline.
+struct AdhocPermissions {
+  struct Grant {
+    std::vector<std::string> users;
+    // Rights (mip::rights) or, when byRoles is set, roles (mip::roles).
+    std::vector<std::string> permissions;
+  };
+
+  std::vector<Grant> grants;
+  bool byRoles = false;
+  // Seconds since the epoch after which the content can no longer be opened. Zero never expires.
+  int64_t validUntil = 0;
+  bool allowOfflineAccess = true;
+};
+
+// LRU of the ProtectionDescriptors built for custom permissions, keyed by their canonical form. Grants
+// that only differ in order, duplicates or the case of user names map to the same key, so bulk ad-hoc
+// protections with identical ACLs build one descriptor, and through ProtectionCache::FindAdhoc share
+// the handler created from it. Descriptors hold no engine state.
+class ProtectionDescriptorInterner final {
+public:
+  struct Interned {
+    std::string key;
+    std::shared_ptr<mip::ProtectionDescriptor> descriptor;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  static const size_t kDefaultCapacity = 1024;
+
+  explicit ProtectionDescriptorInterner(size_t capacity = kDefaultCapacity);
+
+  // The descriptor for permissions, built on first use. Throws std::invalid_argument for permissions
+  // without a user or a right.
+  Interned Intern(const AdhocPermissions& permissions);
+
+  // Users lowercased; users and permissions sorted and deduplicated; grants for the same users merged
+  // and sorted.
+  static AdhocPermissions Canonicalize(const AdhocPermissions& permissions);
+
+  // The interning key of already canonical permissions.
+  static std::string MakeKey(const AdhocPermissions& canonical);
+
+  // Parses a grant written "user[,user...]:permission[,permission...]".
+  static AdhocPermissions::Grant ParseGrant(const std::string& grant);
+
+  // Zero disables the cache.
+  void SetCapacity(size_t capacity);
+
+  Stats GetStats() const;
+
+  void Clear();
+
+private:
+  static std::shared_ptr<mip::ProtectionDescriptor> Build(const AdhocPermissions& canonical);
+
+  ShardedLru<std::shared_ptr<mip::ProtectionDescriptor>> mDescriptors;
+};
+
+#endif // SAMPLE_FILE_PROTECTION_DESCRIPTOR_INTERNER_H_
@@ -0,0 +1,73 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "recent_outcomes.h"
+
+#include <algorithm>
+#include <chrono>
+
+const int64_t RecentOutcomes::kWindowSeconds;
+const int64_t RecentOutcomes::kUnused;
+
+RecentOutcomes::RecentOutcomes() {
+  for (auto& bucket : mBuckets) {
+    bucket.second.store(kUnused, std::memory_order_relaxed);
+    for (auto& count : bucket.counts)
+      count.store(0, std::memory_order_relaxed);
+  }
+}
+
+int64_t RecentOutcomes::Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecentOutcomes::Record(Outcome outcome) {
+  const int64_t now = Now();
+  Bucket& bucket = mBuckets[static_cast<size_t>(now % kWindowSeconds)];
+  int64_t second = bucket.second.load(std::memory_order_acquire);
+  // The first outcome of a new second takes the bucket over from the second a window ago.
+  if (second != now && bucket.second.compare_exchange_strong(second, now, std::memory_order_acq_rel)) {
+    for (auto& count : bucket.counts)
+      count.store(0, std::memory_order_relaxed);
+  }
+  bucket.counts[static_cast<size_t>(outcome)].fetch_add(1, std::memory_order_relaxed);
+}
+
+RecentOutcomes::Counts RecentOutcomes::Get(int64_t seconds) const {
+  seconds = std::min(std::max<int64_t>(seconds, 1), kWindowSeconds);
+  const int64_t now = Now();
+  Counts counts = {};
+  for (const auto& bucket : mBuckets) {
+    const int64_t second = bucket.second.load(std::memory_order_acquire);
+    if (second == kUnused || second > now || now - second >= seconds)
+      continue;
+    counts.succeeded += bucket.counts[static_cast<size_t>(Outcome::Succeeded)].load(std::memory_order_relaxed);
+    counts.failed += bucket.counts[static_cast<size_t>(Outcome::Failed)].load(std::memory_order_relaxed);
+    counts.rejected += bucket.counts[static_cast<size_t>(Outcome::Rejected)].load(std::memory_order_relaxed);
+  }
+  return counts;
+}
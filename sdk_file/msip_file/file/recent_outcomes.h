@@ -0,0 +1,79 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_RECENT_OUTCOMES_H_
+#define SAMPLE_FILE_RECENT_OUTCOMES_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Outcomes of the file operations of the last kWindowSeconds, counted in one bucket per second of the
+// steady clock. Recording and reading take no lock, so a probe can read the error rate while the request
+// path keeps recording. An outcome racing the turn of its bucket's second may be lost, which shifts a rate
+// by at most that outcome.
+class RecentOutcomes final {
+public:
+  enum class Outcome : size_t {
+    Succeeded,
+    Failed,
+    // Turned away by admission control before it started.
+    Rejected,
+    Count
+  };
+
+  static const int64_t kWindowSeconds = 60;
+
+  struct Counts {
+    uint64_t succeeded;
+    uint64_t failed;
+    uint64_t rejected;
+  };
+
+  RecentOutcomes();
+
+  void Record(Outcome outcome);
+
+  // Outcomes of the last seconds, this one included, up to kWindowSeconds.
+  Counts Get(int64_t seconds) const;
+
+private:
+  struct Bucket {
+    // Steady clock second the counts belong to, or kUnused.
+    std::atomic<int64_t> second;
+    std::atomic<uint64_t> counts[static_cast<size_t>(Outcome::Count)];
+  };
+
+  static const int64_t kUnused = -1;
+
+  static int64_t Now();
+
+  std::array<Bucket, kWindowSeconds> mBuckets;
+};
+
+#endif // SAMPLE_FILE_RECENT_OUTCOMES_H_
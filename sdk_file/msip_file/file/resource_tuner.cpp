@@ -0,0 +1,259 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "resource_tuner.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "task_dispatcher_impl.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::chrono::steady_clock;
+
+namespace {
+
+const uint64_t kMiB = 1024 * 1024;
+const char kMemoryPressurePath[] = "/sys/fs/cgroup/memory.pressure";
+// Tasks stalled on memory for 100 ms within a second count as pressure.
+const char kPressureTrigger[] = "some 100000 1000000";
+// Budgets grow back one step after this long without a pressure event.
+const std::chrono::seconds kRelaxInterval(30);
+const unsigned kMaxShrink = 3;
+
+uint64_t Clamp(uint64_t value, uint64_t low, uint64_t high) {
+  return std::min(std::max(value, low), high);
+}
+
+// 0 for "max" and for files that cannot be read.
+uint64_t ReadLimitFile(const char* path) {
+  std::ifstream file(path);
+  string value;
+  if (!(file >> value) || value == "max")
+    return 0;
+  try {
+    return std::stoull(value);
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+} // namespace
+
+ResourceTuner::ResourceTuner()
+    : mLimits(), mBase(), mParts(0), mPaused(false), mShrink(0), mPressureEvents(0), mWakeFd(-1) {
+}
+
+ResourceTuner& ResourceTuner::Shared() {
+  static ResourceTuner* tuner = new ResourceTuner(); // Never destroyed; the watcher may still run at exit.
+  return *tuner;
+}
+
+ResourceTuner::Limits ResourceTuner::ReadLimits() {
+  Limits limits;
+  limits.cpus = sample::task::TaskDispatcherImpl::GetCpuQuota();
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long pageSize = sysconf(_SC_PAGE_SIZE);
+  const uint64_t host = pages > 0 && pageSize > 0 ? static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize) : 0;
+  uint64_t limit = ReadLimitFile("/sys/fs/cgroup/memory.max");
+  if (limit == 0)
+    limit = ReadLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+  // cgroup v1 reports no limit as a number far above the host's memory.
+  limits.memoryLimited = limit > 0 && (host == 0 || limit < host);
+  limits.memoryBytes = limits.memoryLimited ? limit : host;
+  return limits;
+}
+
+ResourceTuner::Budgets ResourceTuner::Derive(const Limits& limits) {
+  // At 1 GiB every budget but admission's is the library's default.
+  const uint64_t memory = limits.memoryBytes > 0 ? limits.memoryBytes : 1024 * kMiB;
+  Budgets budgets;
+  budgets.engineCacheSize = static_cast<size_t>(Clamp(memory / (64 * kMiB), 4, 256));
+  budgets.protectionCacheSize = static_cast<size_t>(Clamp(memory / (16 * kMiB), 16, 1024));
+  budgets.licenseInfoCacheSize = static_cast<size_t>(Clamp(memory / (4 * kMiB), 64, 4096));
+  budgets.useLicenseCacheSize = static_cast<size_t>(Clamp(memory / kMiB, 256, 16384));
+  budgets.bufferPoolBytes = Clamp(memory / 4, 16 * kMiB, 1024 * kMiB);
+  // Operations in flight may hold half the limit, leaving the rest to engines, caches and the runtime.
+  budgets.admissionMemoryBudget = limits.memoryLimited ? static_cast<int64_t>(memory / 2) : 0;
+  return budgets;
+}
+
+ResourceTuner::Budgets ResourceTuner::Shrink(const Budgets& budgets, unsigned shrink) {
+  Budgets shrunk = budgets;
+  shrunk.engineCacheSize = std::max<size_t>(budgets.engineCacheSize >> shrink, 1);
+  shrunk.protectionCacheSize = std::max<size_t>(budgets.protectionCacheSize >> shrink, 1);
+  shrunk.licenseInfoCacheSize = std::max<size_t>(budgets.licenseInfoCacheSize >> shrink, 1);
+  shrunk.useLicenseCacheSize = std::max<size_t>(budgets.useLicenseCacheSize >> shrink, 1);
+  shrunk.bufferPoolBytes = budgets.bufferPoolBytes >> shrink;
+  shrunk.admissionMemoryBudget = budgets.admissionMemoryBudget >> shrink;
+  return shrunk;
+}
+
+bool ResourceTuner::Start(const Apply& apply, int parts, bool watchPressure) {
+  Stop();
+  Budgets budgets;
+  {
+    lock_guard<mutex> lock(mMutex);
+    mApply = apply;
+    mLimits = ReadLimits();
+    mBase = Derive(mLimits);
+    mParts = parts & kAllParts;
+    mPaused = false;
+    mShrink = 0;
+    budgets = mBase;
+  }
+  apply(budgets, parts & kAllParts);
+  if (!watchPressure)
+    return true;
+  lock_guard<mutex> lock(mMutex);
+  return StartWatcher();
+}
+
+ResourceTuner::Stats ResourceTuner::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  Stats stats;
+  stats.limits = mLimits;
+  stats.budgets = Shrink(mBase, mShrink);
+  stats.parts = mParts;
+  stats.watchingPressure = mWatcher.joinable();
+  stats.shrink = mShrink;
+  stats.pressureEvents = mPressureEvents;
+  return stats;
+}
+
+void ResourceTuner::PauseThreads() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (!mWatcher.joinable())
+      return;
+    mPaused = true;
+  }
+  Stop();
+}
+
+void ResourceTuner::ResumeThreads() {
+  lock_guard<mutex> lock(mMutex);
+  if (!mPaused)
+    return;
+  mPaused = false;
+  // The trigger belongs to the descriptor, so each process registers its own.
+  StartWatcher();
+}
+
+void ResourceTuner::Stop() {
+  std::thread watcher;
+  int wakeFd;
+  {
+    lock_guard<mutex> lock(mMutex);
+    watcher.swap(mWatcher);
+    wakeFd = mWakeFd;
+    mWakeFd = -1;
+  }
+  if (watcher.joinable()) {
+    const uint64_t wake = 1;
+    if (write(wakeFd, &wake, sizeof(wake)) < 0) {
+      // The watcher also leaves on its own once the descriptor fails.
+    }
+    watcher.join();
+  }
+  if (wakeFd >= 0)
+    close(wakeFd);
+}
+
+bool ResourceTuner::StartWatcher() {
+  const int pressureFd = open(kMemoryPressurePath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (pressureFd < 0)
+    return false;
+  if (write(pressureFd, kPressureTrigger, strlen(kPressureTrigger) + 1) < 0) {
+    close(pressureFd);
+    return false;
+  }
+  const int wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd < 0) {
+    close(pressureFd);
+    return false;
+  }
+  mWakeFd = wakeFd;
+  mWatcher = std::thread(&ResourceTuner::WatchLoop, this, pressureFd, wakeFd);
+  return true;
+}
+
+void ResourceTuner::WatchLoop(int pressureFd, int wakeFd) {
+  auto lastChange = steady_clock::now();
+  for (;;) {
+    pollfd fds[2] = {{pressureFd, POLLPRI, 0}, {wakeFd, POLLIN, 0}};
+    const int ready = poll(fds, 2, 1000);
+    if (ready < 0 && errno != EINTR)
+      break;
+    // POLLERR means the cgroup went away.
+    if (fds[1].revents != 0 || (fds[0].revents & POLLERR) != 0)
+      break;
+    unsigned shrink;
+    {
+      lock_guard<mutex> lock(mMutex);
+      shrink = mShrink;
+      if (fds[0].revents & POLLPRI)
+        ++mPressureEvents;
+    }
+    const auto now = steady_clock::now();
+    if (fds[0].revents & POLLPRI) {
+      lastChange = now;
+      if (shrink < kMaxShrink)
+        ApplyShrink(shrink + 1);
+    } else if (shrink > 0 && now - lastChange >= kRelaxInterval) {
+      lastChange = now;
+      ApplyShrink(shrink - 1);
+    }
+  }
+  close(pressureFd);
+}
+
+void ResourceTuner::ApplyShrink(unsigned shrink) {
+  Apply apply;
+  Budgets budgets;
+  int parts;
+  {
+    lock_guard<mutex> lock(mMutex);
+    mShrink = shrink;
+    apply = mApply;
+    budgets = Shrink(mBase, shrink);
+    parts = mParts;
+  }
+  if (apply)
+    apply(budgets, parts);
+}
@@ -0,0 +1,121 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_RESOURCE_TUNER_H_
+#define SAMPLE_FILE_RESOURCE_TUNER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Sizes caches and byte budgets from the CPUs and memory the cgroup grants, so one build fits a 1-vCPU
+// sidecar and a 32-vCPU batch node. While the cgroup reports memory pressure (cgroup v2 PSI), the budgets
+// are halved, down to an eighth, and they grow back one step per quiet interval.
+class ResourceTuner final {
+public:
+  struct Limits {
+    size_t cpus;
+    uint64_t memoryBytes;
+    // False when memoryBytes is the host's memory rather than a cgroup limit.
+    bool memoryLimited;
+  };
+
+  struct Budgets {
+    size_t engineCacheSize;
+    size_t protectionCacheSize;
+    size_t licenseInfoCacheSize;
+    size_t useLicenseCacheSize;
+    uint64_t bufferPoolBytes;
+    // 0 when memory is not limited, leaving admission control without a memory budget.
+    int64_t admissionMemoryBudget;
+  };
+
+  // Budgets Apply may set, so settings the operator chose stay theirs.
+  enum Parts {
+    kEngineCache = 1,
+    kLicenseCaches = 2,
+    kBufferPool = 4,
+    kAdmissionBudget = 8,
+    kAllParts = 15,
+  };
+
+  typedef std::function<void(const Budgets& budgets, int parts)> Apply;
+
+  struct Stats {
+    Limits limits;
+    Budgets budgets;
+    int parts;
+    bool watchingPressure;
+    // Halvings in effect, 0 without pressure.
+    unsigned shrink;
+    uint64_t pressureEvents;
+  };
+
+  static ResourceTuner& Shared();
+
+  // cgroup v2 cpu.max and memory.max, with the v1 files and then the host as fallbacks.
+  static Limits ReadLimits();
+  static Budgets Derive(const Limits& limits);
+
+  // Applies the parts of the budgets derived from the current limits through apply, and with watchPressure
+  // starts watching memory.pressure. Returns false, with the budgets applied, when pressure cannot be
+  // watched. Calling it again replaces the previous configuration.
+  bool Start(const Apply& apply, int parts, bool watchPressure);
+
+  Stats GetStats() const;
+
+  // Joins the pressure watcher so the process can fork. ResumeThreads starts it again when it was running.
+  void PauseThreads();
+  void ResumeThreads();
+
+private:
+  ResourceTuner();
+  ResourceTuner(const ResourceTuner&) = delete;
+  ResourceTuner& operator=(const ResourceTuner&) = delete;
+
+  static Budgets Shrink(const Budgets& budgets, unsigned shrink);
+  void Stop();
+  bool StartWatcher();
+  void WatchLoop(int pressureFd, int wakeFd);
+  void ApplyShrink(unsigned shrink);
+
+  mutable std::mutex mMutex;
+  Apply mApply;
+  Limits mLimits;
+  Budgets mBase;
+  int mParts;
+  bool mPaused;
+  unsigned mShrink;
+  uint64_t mPressureEvents;
+  int mWakeFd;
+  std::thread mWatcher;
+};
+
+#endif // SAMPLE_FILE_RESOURCE_TUNER_H_
@@ -0,0 +1,170 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "rights_cache.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "mip/protection/rights.h"
+#include "mip/protection_descriptor.h"
+#include "tenant_context.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::string;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+
+bool EqualsIgnoreCase(const string& a, const string& b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+    return std::tolower(x) == std::tolower(y);
+  });
+}
+
+} // namespace
+
+const size_t RightsCache::kDefaultCapacity;
+const int RightsCache::kDefaultTtlSeconds;
+
+RightsCache::RightsCache() : mEntries(kDefaultCapacity, "rights"), mTtlSeconds(kDefaultTtlSeconds) {
+}
+
+void RightsCache::Configure(size_t capacity, seconds ttl) {
+  mTtlSeconds = ttl.count();
+  mEntries.SetCapacity(capacity);
+}
+
+void RightsCache::SetTenantCapacity(size_t capacity) {
+  mEntries.SetGroupCapacity(capacity);
+}
+
+bool RightsCache::Find(const string& contentId, const string& user, Entry& entry) {
+  const seconds ttl(mTtlSeconds.load());
+  Slot slot;
+  if (!mEntries.Find(MakeKey(contentId, user), slot, [ttl](const Slot& cached) { return !IsExpired(cached, ttl); }))
+    return false;
+  entry = slot.entry;
+  return true;
+}
+
+void RightsCache::Put(const string& contentId, const string& user, const Entry& entry) {
+  if (contentId.empty() || user.empty())
+    return;
+
+  Slot slot;
+  slot.insertedAt = steady_clock::now();
+  slot.entry = entry;
+  mEntries.Put(MakeKey(contentId, user), slot, sample::tenant::Current());
+}
+
+void RightsCache::SnapshotTo(SnapshotWriter& writer) const {
+  const seconds ttl(mTtlSeconds.load());
+  const auto now = steady_clock::now();
+  mEntries.ForEach([&](const string& key, const Slot& slot, const string& tenant) {
+    if (IsExpired(slot, ttl))
+      return;
+    writer.PutString(key);
+    writer.PutString(tenant);
+    writer.PutI64(std::chrono::duration_cast<milliseconds>(now - slot.insertedAt).count());
+    writer.PutBool(slot.entry.expires);
+    writer.PutI64(std::chrono::duration_cast<milliseconds>(slot.entry.validUntil.time_since_epoch()).count());
+    writer.PutU32(static_cast<uint32_t>(slot.entry.rights.size()));
+    for (const auto& right : slot.entry.rights)
+      writer.PutString(right);
+  });
+}
+
+size_t RightsCache::RestoreFrom(SnapshotReader& reader) {
+  const seconds ttl(mTtlSeconds.load());
+  const auto now = steady_clock::now();
+  size_t restored = 0;
+  while (!reader.AtEnd()) {
+    const string key = reader.GetString();
+    const string tenant = reader.GetString();
+    Slot slot;
+    slot.insertedAt = now - milliseconds(reader.GetI64());
+    slot.entry.expires = reader.GetBool();
+    slot.entry.validUntil = system_clock::time_point(milliseconds(reader.GetI64()));
+    const uint32_t rights = reader.GetU32();
+    for (uint32_t i = 0; i < rights; ++i)
+      slot.entry.rights.push_back(reader.GetString());
+    if (mEntries.GetCapacity() == 0 || IsExpired(slot, ttl))
+      continue;
+    mEntries.Put(key, slot, tenant);
+    ++restored;
+  }
+  return restored;
+}
+
+void RightsCache::Clear() {
+  mEntries.Clear();
+}
+
+RightsCache::Stats RightsCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+RightsCache::Entry RightsCache::FromProtection(mip::ProtectionHandler& protection) {
+  Entry entry;
+  entry.rights = protection.GetRights();
+  auto descriptor = protection.GetProtectionDescriptor();
+  entry.expires = descriptor && descriptor->DoesContentExpire();
+  if (entry.expires)
+    entry.validUntil = descriptor->GetContentValidUntil();
+  return entry;
+}
+
+bool RightsCache::Allows(const Entry& entry, const string& right) {
+  const string owner = mip::rights::Owner();
+  return std::any_of(entry.rights.begin(), entry.rights.end(), [&](const string& granted) {
+    return EqualsIgnoreCase(granted, right) || EqualsIgnoreCase(granted, owner);
+  });
+}
+
+string RightsCache::MakeKey(const string& contentId, const string& user) {
+  string lowerUser(user);
+  std::transform(lowerUser.begin(), lowerUser.end(), lowerUser.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return contentId + kKeySeparator + lowerUser;
+}
+
+bool RightsCache::IsExpired(const Slot& slot, seconds ttl) {
+  if (ttl.count() > 0 && steady_clock::now() - slot.insertedAt >= ttl)
+    return true;
+  return slot.entry.expires && slot.entry.validUntil <= std::chrono::system_clock::now();
+}
@@ -0,0 +1,110 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_RIGHTS_CACHE_H_
+#define SAMPLE_FILE_RIGHTS_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mip/protection/protection_handler.h"
+#include "cache_snapshot.h"
+#include "sharded_lru.h"
+
+// LRU of the rights users hold on protected content, keyed by content id and user. Entries are filled
+// whenever a license is consumed (opening a file, or a delegation license), so later rights-only checks
+// for the same (content, user) pair need neither the file's publishing license nor a license request.
+// Entries expire after a TTL and, for content with an expiry, once that passes.
+class RightsCache final {
+public:
+  struct Entry {
+    std::vector<std::string> rights;
+    bool expires;
+    std::chrono::system_clock::time_point validUntil;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  static const size_t kDefaultCapacity = 16384;
+  static const int kDefaultTtlSeconds = 3600;
+
+  RightsCache();
+
+  // capacity 0 disables the cache and drops every entry. ttl 0 keeps entries until evicted or expired.
+  void Configure(size_t capacity, std::chrono::seconds ttl);
+
+  // Caps the entries put by each tenant (see tenant_context.h). Zero lifts the cap.
+  void SetTenantCapacity(size_t capacity);
+
+  // False when nothing valid is cached for the user. Users compare case-insensitively.
+  bool Find(const std::string& contentId, const std::string& user, Entry& entry);
+
+  void Put(const std::string& contentId, const std::string& user, const Entry& entry);
+
+  // Writes the unexpired entries to a snapshot section (see cache_snapshot.h), and puts a section's entries back,
+  // returning how many. RestoreFrom throws std::runtime_error for a malformed section.
+  void SnapshotTo(SnapshotWriter& writer) const;
+  size_t RestoreFrom(SnapshotReader& reader);
+
+  void Clear();
+
+  Stats GetStats() const;
+
+  // Entries each tenant put, by tenant (see SetTenantCapacity).
+  std::map<std::string, size_t> GetTenantSizes() const { return mEntries.GetGroupSizes(); }
+
+  // The rights protection grants its user, and when they lapse.
+  static Entry FromProtection(mip::ProtectionHandler& protection);
+
+  // Whether entry grants right, compared case-insensitively. OWNER grants every right.
+  static bool Allows(const Entry& entry, const std::string& right);
+
+private:
+  struct Slot {
+    std::chrono::steady_clock::time_point insertedAt;
+    Entry entry;
+  };
+
+  static std::string MakeKey(const std::string& contentId, const std::string& user);
+  static bool IsExpired(const Slot& slot, std::chrono::seconds ttl);
+
+  ShardedLru<Slot> mEntries;
+  std::atomic<int64_t> mTtlSeconds;
+};
+
+#endif // SAMPLE_FILE_RIGHTS_CACHE_H_
@@ -0,0 +1,245 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "sensitivity_type_classifier.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+#include "metrics_registry.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Bounds the time a regex that matches everywhere can take.
+const uint32_t kMaxRegexMatches = 1000;
+
+class ClassificationResultImpl final : public mip::ClassificationResult {
+public:
+  ClassificationResultImpl(const string& id, const string& name, int count, int confidenceLevel)
+    : mId(id), mName(name), mCount(count), mConfidenceLevel(confidenceLevel) {}
+
+  string GetId() const override { return mId; }
+  string GetName() const override { return mName; }
+  int GetCount() const override { return mCount; }
+  int GetConfidenceLevel() const override { return mConfidenceLevel; }
+  string GetSensitiveInformationDetections() const override { return string(); }
+
+private:
+  string mId;
+  string mName;
+  int mCount;
+  int mConfidenceLevel;
+};
+
+unsigned char Fold(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c - 'A' + 'a') : c;
+}
+
+MetricsRegistry::Counter& ClassifiedBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_classified_bytes_total", "Bytes of extracted text scanned for sensitive information types");
+  return counter;
+}
+
+MetricsRegistry::Counter& ClassificationCacheHits() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_classification_cache_hits_total", "Classifications answered from the per-content result cache");
+  return counter;
+}
+
+} // namespace
+
+SensitivityTypeClassifier::SensitivityTypeClassifier(shared_ptr<const SensitivityTypeIndex> index, size_t cacheCapacity)
+  : mIndex(std::move(index)),
+    mClassCount(1),
+    mSkippedRegexes(0),
+    mCache(cacheCapacity, "classification") {
+  const auto& entities = mIndex->GetEntities();
+  mRegexes.resize(entities.size());
+  for (size_t i = 0; i < entities.size(); ++i) {
+    for (const auto& regex : entities[i].regexes) {
+      // Rule packages are written for .NET, which takes the case flag inline.
+      string pattern(regex);
+      auto flags = std::regex::ECMAScript | std::regex::optimize;
+      if (pattern.compare(0, 4, "(?i)") == 0) {
+        pattern.erase(0, 4);
+        flags |= std::regex::icase;
+      }
+      try {
+        mRegexes[i].emplace_back(pattern, flags);
+      } catch (const std::regex_error&) {
+        ++mSkippedRegexes;
+      }
+    }
+  }
+  BuildAutomaton();
+}
+
+shared_ptr<mip::ClassificationResults> SensitivityTypeClassifier::Classify(
+    const string& text,
+    const vector<string>& classificationIds) const {
+  vector<string> ids(classificationIds);
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  string key = std::to_string(std::hash<string>()(text)) + ":" + std::to_string(text.size());
+  for (const auto& id : ids)
+    key += "\n" + id;
+
+  shared_ptr<mip::ClassificationResults> results;
+  if (mCache.Find(key, results)) {
+    ClassificationCacheHits().Add(1);
+    return results;
+  }
+
+  ClassifiedBytes().Add(text.size());
+  const auto& entities = mIndex->GetEntities();
+  vector<uint32_t> counts(entities.size(), 0);
+  if (!mTerms.empty())
+    CountTerms(text, counts);
+
+  results = make_shared<mip::ClassificationResults>();
+  for (const auto& id : ids) {
+    const auto* entity = mIndex->Find(id);
+    if (!entity)
+      continue;
+    const auto index = static_cast<size_t>(entity - entities.data());
+    uint32_t count = counts[index];
+    for (const auto& regex : mRegexes[index]) {
+      uint32_t matches = 0;
+      for (std::sregex_iterator it(text.begin(), text.end(), regex), end; it != end && matches < kMaxRegexMatches; ++it)
+        ++matches;
+      count += matches;
+    }
+    if (count > 0) {
+      (*results)[id] = make_shared<ClassificationResultImpl>(
+          entity->id, entity->name, static_cast<int>(count), entity->recommendedConfidence);
+    }
+  }
+  mCache.Put(key, results);
+  return results;
+}
+
+void SensitivityTypeClassifier::BuildAutomaton() {
+  const auto& entities = mIndex->GetEntities();
+
+  // Bytes no term uses share class 0, so the table is only as wide as the terms' alphabet.
+  mClassOf.fill(0);
+  for (const auto& entity : entities) {
+    for (const auto& term : entity.terms) {
+      for (char c : term) {
+        auto& byteClass = mClassOf[Fold(static_cast<unsigned char>(c))];
+        if (byteClass == 0)
+          byteClass = static_cast<uint16_t>(mClassCount++);
+      }
+    }
+  }
+  for (size_t c = 'A'; c <= 'Z'; ++c)
+    mClassOf[c] = mClassOf[Fold(static_cast<unsigned char>(c))];
+
+  // Trie, with 0 meaning no edge: no edge leads back to the root.
+  mNext.assign(mClassCount, 0);
+  mOutputs.assign(1, vector<uint32_t>());
+  for (uint32_t e = 0; e < entities.size(); ++e) {
+    for (const auto& term : entities[e].terms) {
+      if (term.empty())
+        continue;
+      uint32_t state = 0;
+      for (char c : term) {
+        const size_t edge = state * mClassCount + mClassOf[static_cast<unsigned char>(c)];
+        if (mNext[edge] == 0) {
+          mNext[edge] = static_cast<uint32_t>(mOutputs.size());
+          mNext.resize(mNext.size() + mClassCount, 0);
+          mOutputs.emplace_back();
+        }
+        state = mNext[edge];
+      }
+      mOutputs[state].push_back(static_cast<uint32_t>(mTerms.size()));
+      mTerms.push_back({ e, static_cast<uint32_t>(term.size()) });
+    }
+  }
+
+  // Breadth-first, so a state's failure target is complete before the state is: missing edges take the
+  // failure target's edge, and each state also reports the terms that end at its failure target.
+  vector<uint32_t> failure(mOutputs.size(), 0);
+  vector<uint32_t> queue;
+  queue.reserve(mOutputs.size());
+  for (uint32_t c = 0; c < mClassCount; ++c) {
+    if (mNext[c] != 0)
+      queue.push_back(mNext[c]);
+  }
+  for (size_t head = 0; head < queue.size(); ++head) {
+    const uint32_t state = queue[head];
+    const auto& inherited = mOutputs[failure[state]];
+    mOutputs[state].insert(mOutputs[state].end(), inherited.begin(), inherited.end());
+    for (uint32_t c = 0; c < mClassCount; ++c) {
+      auto& next = mNext[state * mClassCount + c];
+      const uint32_t fallback = mNext[failure[state] * mClassCount + c];
+      if (next != 0) {
+        failure[next] = fallback;
+        queue.push_back(next);
+      } else {
+        next = fallback;
+      }
+    }
+  }
+
+  // Transitions hold the target's row offset, which saves the multiply per byte when scanning.
+  if (mNext.size() >= kAcceptingFlag)
+    throw std::length_error("Too many sensitive information type terms for one automaton");
+  for (auto& next : mNext)
+    next = (next * mClassCount) | (mOutputs[next].empty() ? 0 : kAcceptingFlag);
+}
+
+void SensitivityTypeClassifier::CountTerms(const string& text, vector<uint32_t>& counts) const {
+  const uint32_t* next = mNext.data();
+  const uint16_t* classOf = mClassOf.data();
+  uint32_t row = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    const uint32_t transition = next[row + classOf[static_cast<unsigned char>(text[i])]];
+    row = transition & ~kAcceptingFlag;
+    if ((transition & kAcceptingFlag) == 0)
+      continue;
+    for (uint32_t termIndex : mOutputs[row / mClassCount]) {
+      const auto& term = mTerms[termIndex];
+      const size_t start = i + 1 - term.length;
+      if ((start == 0 || !IsWordByte(text, start - 1)) && !IsWordByte(text, i + 1))
+        ++counts[term.entity];
+    }
+  }
+}
+
+bool SensitivityTypeClassifier::IsWordByte(const string& text, size_t position) {
+  if (position >= text.size())
+    return false;
+  const auto c = static_cast<unsigned char>(text[position]);
+  return (c >= '0' && c <= '9') || (Fold(c) >= 'a' && Fold(c) <= 'z');
+}
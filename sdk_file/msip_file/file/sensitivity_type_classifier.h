@@ -0,0 +1,86 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_SENSITIVITY_TYPE_CLASSIFIER_H_
+#define SAMPLE_FILE_SENSITIVITY_TYPE_CLASSIFIER_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "classifier.h"
+#include "sensitivity_type_index.h"
+#include "sharded_lru.h"
+
+// Classifier over an engine's compiled sensitivity types. Every keyword term of every entity goes into
+// one Aho-Corasick automaton, built once, with a dense transition table over the byte classes the
+// terms use. A text is scanned in a single pass of one table lookup per byte, whatever the number of
+// terms, matching ASCII case-insensitively on word boundaries. Regexes run only for requested
+// entities; ones std::regex cannot compile are skipped, as are the built-in functions. An entity's
+// count is the sum of its keyword and regex hits, and its confidence the recommended one. Results are
+// cached by content hash and requested ids, so the same content is never scanned twice.
+class SensitivityTypeClassifier final : public Classifier {
+public:
+  SensitivityTypeClassifier(std::shared_ptr<const SensitivityTypeIndex> index, size_t cacheCapacity);
+
+  std::shared_ptr<mip::ClassificationResults> Classify(
+      const std::string& text,
+      const std::vector<std::string>& classificationIds) const override;
+
+  size_t GetTermCount() const { return mTerms.size(); }
+  size_t GetStateCount() const { return mOutputs.size(); }
+  // Regexes of the rule packages that std::regex rejected.
+  size_t GetSkippedRegexCount() const { return mSkippedRegexes; }
+
+private:
+  // Set on transitions into a state that ends at least one term.
+  static const uint32_t kAcceptingFlag = 0x80000000u;
+
+  struct Term {
+    uint32_t entity;
+    uint32_t length;
+  };
+
+  void BuildAutomaton();
+  void CountTerms(const std::string& text, std::vector<uint32_t>& counts) const;
+  static bool IsWordByte(const std::string& text, size_t position);
+
+  std::shared_ptr<const SensitivityTypeIndex> mIndex;
+  std::array<uint16_t, 256> mClassOf;
+  uint32_t mClassCount;
+  std::vector<uint32_t> mNext;
+  std::vector<std::vector<uint32_t>> mOutputs;
+  std::vector<Term> mTerms;
+  std::vector<std::vector<std::regex>> mRegexes;
+  size_t mSkippedRegexes;
+  mutable ShardedLru<std::shared_ptr<mip::ClassificationResults>> mCache;
+};
+
+#endif // SAMPLE_FILE_SENSITIVITY_TYPE_CLASSIFIER_H_
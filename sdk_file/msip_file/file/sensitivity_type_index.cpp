@@ -0,0 +1,311 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "sensitivity_type_index.h"
+#include "xml_scanner.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unordered_set>
+#include <utility>
+
+#include <unistd.h>
+
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+using mip::SensitivityTypesRulePackage;
+
+namespace {
+
+const char kFormat[] = "msip-sit 1";
+
+string Trim(const string& value) {
+  const auto first = value.find_first_not_of(" \t\r\n");
+  if (first == string::npos)
+    return string();
+  return value.substr(first, value.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+// Fields of the compiled form are tab separated, one record per line.
+string Escape(const string& value) {
+  string out;
+  out.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '\\': out += "\\\\"; break;
+      case '\t': out += "\\t"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      default: out += c;
+    }
+  }
+  return out;
+}
+
+vector<string> SplitFields(const string& line) {
+  vector<string> fields(1);
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == '\t') {
+      fields.emplace_back();
+    } else if (line[i] == '\\' && i + 1 < line.size()) {
+      const char next = line[++i];
+      fields.back() += next == 't' ? '\t' : next == 'n' ? '\n' : next == 'r' ? '\r' : next;
+    } else {
+      fields.back() += line[i];
+    }
+  }
+  return fields;
+}
+
+string CacheFileName(const string& fileId) {
+  string name(fileId);
+  for (auto& c : name) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.' && c != '_')
+      c = '_';
+  }
+  return name + ".sit";
+}
+
+} // namespace
+
+shared_ptr<const SensitivityTypeIndex> SensitivityTypeIndex::Load(
+    const string& fileId,
+    const vector<shared_ptr<SensitivityTypesRulePackage>>& packages,
+    const string& cacheDirectory) {
+  shared_ptr<SensitivityTypeIndex> index(new SensitivityTypeIndex());
+  index->mFileId = fileId;
+  for (const auto& package : packages) {
+    if (package)
+      index->mPackages.push_back({ package->GetRulePackageId(), package->GetRulePackage().size() });
+  }
+
+  const string path = cacheDirectory.empty() || fileId.empty() ? string() : cacheDirectory + "/" + CacheFileName(fileId);
+  if (!path.empty() && index->Read(path)) {
+    index->mFromDisk = true;
+  } else {
+    index->mEntities.clear();
+    for (const auto& package : packages) {
+      if (package)
+        index->Parse(package->GetRulePackageId(), package->GetRulePackage());
+    }
+    if (!path.empty()) {
+      mkdir(cacheDirectory.c_str(), 0700);
+      index->Write(path);
+    }
+  }
+  index->BuildLookup();
+  return index;
+}
+
+const SensitivityTypeIndex::Entity* SensitivityTypeIndex::Find(const string& id) const {
+  auto it = mById.find(id);
+  return it == mById.end() ? nullptr : &mEntities[it->second];
+}
+
+void SensitivityTypeIndex::Parse(const string& rulePackageId, const string& xml) {
+  const string text = ToUtf8(xml);
+  XmlScanner scanner(text);
+
+  struct ParsedEntity {
+    Entity entity;
+    vector<string> refs;
+  };
+  vector<ParsedEntity> entities;
+  unordered_map<string, vector<string>> keywords;
+  unordered_map<string, string> regexes;
+  unordered_map<string, pair<string, bool>> names; // Resource idRef -> (name, default)
+
+  bool inEntity = false;
+  string keywordId, resourceId, captureId;
+  string* capture = nullptr;
+  string captured;
+  bool nameDefault = false;
+
+  for (auto token = scanner.Next(); token != XmlScanner::Token::End; token = scanner.Next()) {
+    const string& element = scanner.Name();
+    if (token == XmlScanner::Token::Text) {
+      if (capture)
+        *capture += scanner.Text();
+    } else if (token == XmlScanner::Token::Open) {
+      if (element == "Entity") {
+        ParsedEntity parsed;
+        parsed.entity.id = scanner.Attribute("id");
+        parsed.entity.rulePackageId = rulePackageId;
+        parsed.entity.recommendedConfidence = std::atoi(scanner.Attribute("recommendedConfidence").c_str());
+        entities.push_back(std::move(parsed));
+        inEntity = true;
+      } else if (inEntity && (element == "IdMatch" || element == "Match")) {
+        const string ref = scanner.Attribute("idRef");
+        if (!ref.empty())
+          entities.back().refs.push_back(ref);
+      } else if (element == "Keyword") {
+        keywordId = scanner.Attribute("id");
+      } else if (element == "Term" && !keywordId.empty()) {
+        captured.clear();
+        capture = &captured;
+      } else if (element == "Regex") {
+        captureId = scanner.Attribute("id");
+        captured.clear();
+        capture = &captured;
+      } else if (element == "Resource") {
+        resourceId = scanner.Attribute("idRef");
+      } else if (element == "Name" && !resourceId.empty()) {
+        nameDefault = scanner.Attribute("default") == "true";
+        captured.clear();
+        capture = &captured;
+      }
+    } else {
+      if (element == "Entity") {
+        inEntity = false;
+      } else if (element == "Keyword") {
+        keywordId.clear();
+      } else if (element == "Term" && capture) {
+        const string term = Trim(captured);
+        if (!term.empty())
+          keywords[keywordId].push_back(term);
+        capture = nullptr;
+      } else if (element == "Regex" && capture) {
+        regexes[captureId] = captured;
+        capture = nullptr;
+      } else if (element == "Resource") {
+        resourceId.clear();
+      } else if (element == "Name" && capture) {
+        auto existing = names.find(resourceId);
+        // The default-language name wins, otherwise the first one seen.
+        if (existing == names.end() || (nameDefault && !existing->second.second))
+          names[resourceId] = std::make_pair(Trim(captured), nameDefault);
+        capture = nullptr;
+      }
+    }
+  }
+
+  for (auto& parsed : entities) {
+    auto& entity = parsed.entity;
+    auto name = names.find(entity.id);
+    entity.name = name == names.end() ? entity.id : name->second.first;
+    std::unordered_set<string> seen;
+    for (const auto& ref : parsed.refs) {
+      if (!seen.insert(ref).second)
+        continue;
+      auto keyword = keywords.find(ref);
+      auto regex = regexes.find(ref);
+      if (keyword != keywords.end())
+        entity.terms.insert(entity.terms.end(), keyword->second.begin(), keyword->second.end());
+      else if (regex != regexes.end())
+        entity.regexes.push_back(regex->second);
+      else
+        entity.functions.push_back(ref);
+    }
+    mEntities.push_back(std::move(entity));
+  }
+}
+
+// Only accepted when it was compiled from the same file id and the same packages, compared by id and size.
+bool SensitivityTypeIndex::Read(const string& path) {
+  std::ifstream file(path, std::ios::binary);
+  string line;
+  if (!file || !std::getline(file, line) || line != kFormat)
+    return false;
+
+  size_t package = 0;
+  bool sawFileId = false;
+  while (std::getline(file, line)) {
+    const auto fields = SplitFields(line);
+    const string& kind = fields[0];
+    if (kind == "file" && fields.size() == 2) {
+      if (fields[1] != mFileId)
+        return false;
+      sawFileId = true;
+    } else if (kind == "package" && fields.size() == 3) {
+      if (package >= mPackages.size() || mPackages[package].id != fields[1] ||
+          std::to_string(mPackages[package].size) != fields[2])
+        return false;
+      ++package;
+    } else if (kind == "entity" && fields.size() == 5) {
+      Entity entity;
+      entity.id = fields[1];
+      entity.name = fields[2];
+      entity.rulePackageId = fields[3];
+      entity.recommendedConfidence = std::atoi(fields[4].c_str());
+      mEntities.push_back(std::move(entity));
+    } else if (!mEntities.empty() && fields.size() == 2 && kind == "term") {
+      mEntities.back().terms.push_back(fields[1]);
+    } else if (!mEntities.empty() && fields.size() == 2 && kind == "regex") {
+      mEntities.back().regexes.push_back(fields[1]);
+    } else if (!mEntities.empty() && fields.size() == 2 && kind == "function") {
+      mEntities.back().functions.push_back(fields[1]);
+    } else if (kind == "end") {
+      return sawFileId && package == mPackages.size();
+    } else {
+      return false;
+    }
+  }
+  return false; // truncated
+}
+
+// Written to a temporary name and renamed, so a concurrent reader sees the old file or the whole new one.
+void SensitivityTypeIndex::Write(const string& path) const {
+  static std::atomic<unsigned> sequence(0);
+  const string temporary = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(sequence++);
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file << kFormat << "\n" << "file\t" << Escape(mFileId) << "\n";
+    for (const auto& package : mPackages)
+      file << "package\t" << Escape(package.id) << "\t" << package.size << "\n";
+    for (const auto& entity : mEntities) {
+      file << "entity\t" << Escape(entity.id) << "\t" << Escape(entity.name) << "\t" << Escape(entity.rulePackageId)
+           << "\t" << entity.recommendedConfidence << "\n";
+      for (const auto& term : entity.terms)
+        file << "term\t" << Escape(term) << "\n";
+      for (const auto& regex : entity.regexes)
+        file << "regex\t" << Escape(regex) << "\n";
+      for (const auto& function : entity.functions)
+        file << "function\t" << Escape(function) << "\n";
+    }
+    file << "end\n";
+    if (!file.flush()) {
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    std::remove(temporary.c_str());
+}
+
+void SensitivityTypeIndex::BuildLookup() {
+  mById.reserve(mEntities.size());
+  for (size_t i = 0; i < mEntities.size(); ++i)
+    mById.emplace(mEntities[i].id, i);
+}
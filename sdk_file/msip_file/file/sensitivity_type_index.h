@@ -0,0 +1,92 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_SENSITIVITY_TYPE_INDEX_H_
+#define SAMPLE_FILE_SENSITIVITY_TYPE_INDEX_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mip/upe/sensitivity_types_rule_package.h"
+
+// Sensitive information types of an engine's rule packages, compiled once into the entity, keyword and
+// regex lists a classifier needs. Parsing a rule package costs far more than reading the result back, so
+// the compiled form is kept on disk under the engine's sensitivity file id and reused by later engines
+// with the same rule packages, including those of a restarted process. Immutable and safe to share
+// between threads.
+class SensitivityTypeIndex final {
+public:
+  struct Entity {
+    std::string id;
+    std::string name;
+    std::string rulePackageId;
+    int recommendedConfidence;
+    // Terms of the keyword lists the entity's patterns match.
+    std::vector<std::string> terms;
+    std::vector<std::string> regexes;
+    // References the rule package does not define, i.e. built-in functions such as Func_credit_card.
+    std::vector<std::string> functions;
+  };
+
+  // Reads the compiled form from cacheDirectory when one matches fileId and the packages, otherwise
+  // parses the packages and writes it there. An empty cacheDirectory or fileId skips the disk.
+  static std::shared_ptr<const SensitivityTypeIndex> Load(
+      const std::string& fileId,
+      const std::vector<std::shared_ptr<mip::SensitivityTypesRulePackage>>& packages,
+      const std::string& cacheDirectory);
+
+  const std::string& GetFileId() const { return mFileId; }
+  size_t GetRulePackageCount() const { return mPackages.size(); }
+  const std::vector<Entity>& GetEntities() const { return mEntities; }
+  // True when the compiled form came from disk and no package was parsed.
+  bool IsFromDisk() const { return mFromDisk; }
+
+  // nullptr when no entity has that id.
+  const Entity* Find(const std::string& id) const;
+
+private:
+  struct Package {
+    std::string id;
+    size_t size;
+  };
+
+  SensitivityTypeIndex() : mFromDisk(false) {}
+
+  void Parse(const std::string& rulePackageId, const std::string& xml);
+  bool Read(const std::string& path);
+  void Write(const std::string& path) const;
+  void BuildLookup();
+
+  std::string mFileId;
+  std::vector<Package> mPackages;
+  std::vector<Entity> mEntities;
+  std::unordered_map<std::string, size_t> mById;
+  bool mFromDisk;
+};
+
+#endif // SAMPLE_FILE_SENSITIVITY_TYPE_INDEX_H_
@@ -0,0 +1,390 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "shard_coordinator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+using sample::storage::RedisClient;
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// KEYS[1] the job list. ARGV: key prefix, now, lease expiry, worker. Returns {job, shard, stolen} or nil.
+// Jobs whose keys expired are dropped from the list on the way. A released shard's lease is at 0, so it is
+// taken again first without counting as stolen.
+static const char kClaimScript[] =
+    "for _, job in ipairs(redis.call('LRANGE', KEYS[1], 0, -1)) do\n"
+    "  local base = ARGV[1] .. job\n"
+    "  local ttl = redis.call('PTTL', base .. ':meta')\n"
+    "  if ttl < 0 then\n"
+    "    redis.call('LREM', KEYS[1], 0, job)\n"
+    "  else\n"
+    "    local stolen = 0\n"
+    "    local expired = redis.call('ZRANGEBYSCORE', base .. ':leases', '-inf', ARGV[2], 'WITHSCORES', 'LIMIT', 0, 1)\n"
+    "    local shard = expired[1]\n"
+    "    if shard then\n"
+    "      if tonumber(expired[2]) > 0 then stolen = 1 end\n"
+    "    else\n"
+    "      shard = redis.call('LPOP', base .. ':pending')\n"
+    "    end\n"
+    "    if shard then\n"
+    "      redis.call('ZADD', base .. ':leases', ARGV[3], shard)\n"
+    "      redis.call('HSET', base .. ':owners', shard, ARGV[4])\n"
+    "      redis.call('PEXPIRE', base .. ':leases', ttl)\n"
+    "      redis.call('PEXPIRE', base .. ':owners', ttl)\n"
+    "      if stolen == 1 then redis.call('HINCRBY', base .. ':meta', 'stolen', 1) end\n"
+    "      return {job, shard, stolen}\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "return nil\n";
+
+// KEYS[1] leases, KEYS[2] owners. ARGV: shard, worker, new score. Moves the lease only while worker holds it.
+static const char kRenewScript[] =
+    "if redis.call('HGET', KEYS[2], ARGV[1]) ~= ARGV[2] then return 0 end\n"
+    "redis.call('ZADD', KEYS[1], 'XX', ARGV[3], ARGV[1])\n"
+    "return 1\n";
+
+// KEYS[1] the job list, KEYS[2] leases, KEYS[3] owners, KEYS[4] meta, KEYS[5] results. ARGV: job, shard,
+// worker, succeeded, failed, results. A finished job leaves the job list.
+static const char kCompleteScript[] =
+    "if redis.call('HGET', KEYS[3], ARGV[2]) ~= ARGV[3] then return 0 end\n"
+    "redis.call('ZREM', KEYS[2], ARGV[2])\n"
+    "redis.call('HDEL', KEYS[3], ARGV[2])\n"
+    "redis.call('HINCRBY', KEYS[4], 'succeeded', ARGV[4])\n"
+    "redis.call('HINCRBY', KEYS[4], 'failed', ARGV[5])\n"
+    "redis.call('RPUSH', KEYS[5], ARGV[6])\n"
+    "redis.call('PEXPIRE', KEYS[5], redis.call('PTTL', KEYS[4]))\n"
+    "local done = redis.call('HINCRBY', KEYS[4], 'done', 1)\n"
+    "if done >= tonumber(redis.call('HGET', KEYS[4], 'shards')) then redis.call('LREM', KEYS[1], 0, ARGV[1]) end\n"
+    "return 1\n";
+
+// Length-prefixed paths, so any byte can appear in one.
+string EncodePaths(vector<string>::const_iterator begin, vector<string>::const_iterator end) {
+  string encoded;
+  for (auto it = begin; it != end; ++it) {
+    encoded += std::to_string(it->size());
+    encoded += ':';
+    encoded += *it;
+  }
+  return encoded;
+}
+
+vector<string> DecodePaths(const string& encoded) {
+  vector<string> paths;
+  size_t position = 0;
+  while (position < encoded.size()) {
+    const size_t colon = encoded.find(':', position);
+    if (colon == string::npos)
+      throw runtime_error("Corrupt shard in Redis");
+    const size_t length = strtoul(encoded.c_str() + position, nullptr, 10);
+    if (colon + 1 + length > encoded.size())
+      throw runtime_error("Corrupt shard in Redis");
+    paths.push_back(encoded.substr(colon + 1, length));
+    position = colon + 1 + length;
+  }
+  return paths;
+}
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t ToInt(const string& value) {
+  return value.empty() ? 0 : strtoll(value.c_str(), nullptr, 10);
+}
+
+} // namespace
+
+ShardCoordinator::ShardCoordinator(const shared_ptr<RedisClient>& client, const string& prefix)
+    : mClient(client), mPrefix(prefix) {
+}
+
+int64_t ShardCoordinator::Submit(
+    const string& jobId,
+    const Job& job,
+    const vector<string>& paths,
+    size_t shardSize,
+    std::chrono::seconds ttl) {
+  if (jobId.empty() || paths.empty() || shardSize == 0 || ttl.count() <= 0)
+    throw std::invalid_argument("A job needs an id, paths, a shard size and a TTL");
+  const string meta = JobKey(jobId, "meta");
+  const int64_t shards = static_cast<int64_t>((paths.size() + shardSize - 1) / shardSize);
+  const string seconds = std::to_string(ttl.count());
+  // The id is taken atomically, so two submissions of one job cannot both write its shards.
+  auto created = mClient->Execute({"SET", JobKey(jobId, "id"), "1", "NX", "EX", seconds});
+  if (created.type == RedisClient::Reply::Type::Nil)
+    throw runtime_error("Job " + jobId + " already exists");
+
+  vector<RedisClient::Command> commands;
+  commands.push_back({"HSET", meta, "shards", std::to_string(shards), "operation", job.operation, "application_id", job.applicationId, "token", job.token,
+      "user", job.user, "encrypted_file", job.encryptedFile, "files", std::to_string(paths.size()), "done", "0",
+      "succeeded", "0", "failed", "0", "stolen", "0"});
+  commands.push_back({"EXPIRE", meta, seconds});
+  RedisClient::Command pending = {"RPUSH", JobKey(jobId, "pending")};
+  for (int64_t shard = 0; shard < shards; ++shard) {
+    const auto begin = paths.begin() + static_cast<ptrdiff_t>(static_cast<size_t>(shard) * shardSize);
+    const auto end = paths.end() - begin > static_cast<ptrdiff_t>(shardSize) ? begin + static_cast<ptrdiff_t>(shardSize) : paths.end();
+    commands.push_back({"SET", JobKey(jobId, "shard:") + std::to_string(shard), EncodePaths(begin, end), "EX", seconds});
+    pending.push_back(std::to_string(shard));
+  }
+  commands.push_back(pending);
+  commands.push_back({"EXPIRE", JobKey(jobId, "pending"), seconds});
+  commands.push_back({"RPUSH", mPrefix + "jobs", jobId});
+  for (const auto& reply : mClient->Pipeline(commands)) {
+    if (reply.type == RedisClient::Reply::Type::Error)
+      throw runtime_error("Unable to record job " + jobId + ": " + reply.str);
+  }
+  return shards;
+}
+
+bool ShardCoordinator::Claim(const string& worker, milliseconds lease, Shard& shard) {
+  const int64_t now = NowMs();
+  auto claimed = mClient->Execute({"EVAL", kClaimScript, "1", mPrefix + "jobs", mPrefix, std::to_string(now),
+      std::to_string(now + lease.count()), worker});
+  if (claimed.type != RedisClient::Reply::Type::Array || claimed.elements.size() != 3)
+    return false;
+  shard.jobId = claimed.elements[0].str;
+  shard.index = ToInt(claimed.elements[1].str);
+  shard.stolen = claimed.elements[2].integer != 0;
+
+  auto replies = mClient->Pipeline({
+      {"GET", JobKey(shard.jobId, "shard:") + std::to_string(shard.index)},
+      {"HMGET", JobKey(shard.jobId, "meta"), "operation", "application_id", "token", "user", "encrypted_file"}});
+  if (replies[0].type != RedisClient::Reply::Type::Bulk || replies[1].elements.size() != 5)
+    throw runtime_error("Shard " + std::to_string(shard.index) + " of job " + shard.jobId + " is missing");
+  shard.paths = DecodePaths(replies[0].str);
+  shard.job.operation = replies[1].elements[0].str;
+  shard.job.applicationId = replies[1].elements[1].str;
+  shard.job.token = replies[1].elements[2].str;
+  shard.job.user = replies[1].elements[3].str;
+  shard.job.encryptedFile = replies[1].elements[4].str;
+  return true;
+}
+
+bool ShardCoordinator::Renew(const Shard& shard, const string& worker, milliseconds lease) {
+  auto renewed = mClient->Execute({"EVAL", kRenewScript, "2", JobKey(shard.jobId, "leases"), JobKey(shard.jobId, "owners"),
+      std::to_string(shard.index), worker, std::to_string(NowMs() + lease.count())});
+  return renewed.integer != 0;
+}
+
+bool ShardCoordinator::Release(const Shard& shard, const string& worker) {
+  // A lease that expired at 0 is the first one the next claim steals.
+  auto released = mClient->Execute({"EVAL", kRenewScript, "2", JobKey(shard.jobId, "leases"), JobKey(shard.jobId, "owners"),
+      std::to_string(shard.index), worker, "0"});
+  return released.integer != 0;
+}
+
+bool ShardCoordinator::Complete(const Shard& shard, const string& worker, int64_t succeeded, int64_t failed, const string& results) {
+  auto completed = mClient->Execute({"EVAL", kCompleteScript, "5", mPrefix + "jobs", JobKey(shard.jobId, "leases"),
+      JobKey(shard.jobId, "owners"), JobKey(shard.jobId, "meta"), JobKey(shard.jobId, "results"), shard.jobId,
+      std::to_string(shard.index), worker, std::to_string(succeeded), std::to_string(failed), results});
+  return completed.integer != 0;
+}
+
+ShardCoordinator::Progress ShardCoordinator::GetProgress(const string& jobId) {
+  auto replies = mClient->Pipeline({
+      {"HMGET", JobKey(jobId, "meta"), "shards", "files", "done", "succeeded", "failed", "stolen"},
+      {"ZCARD", JobKey(jobId, "leases")},
+      {"LLEN", JobKey(jobId, "pending")}});
+  Progress progress = Progress();
+  const auto& meta = replies[0].elements;
+  progress.found = meta.size() == 6 && meta[0].type == RedisClient::Reply::Type::Bulk;
+  if (!progress.found)
+    return progress;
+  progress.shards = ToInt(meta[0].str);
+  progress.files = ToInt(meta[1].str);
+  progress.done = ToInt(meta[2].str);
+  progress.succeeded = ToInt(meta[3].str);
+  progress.failed = ToInt(meta[4].str);
+  progress.stolen = ToInt(meta[5].str);
+  progress.leased = replies[1].integer;
+  progress.pending = replies[2].integer;
+  return progress;
+}
+
+vector<string> ShardCoordinator::GetResults(const string& jobId, int64_t first) {
+  auto reply = mClient->Execute({"LRANGE", JobKey(jobId, "results"), std::to_string(first), "-1"});
+  vector<string> results;
+  for (const auto& element : reply.elements)
+    results.push_back(element.str);
+  return results;
+}
+
+string ShardCoordinator::JobKey(const string& jobId, const char* part) const {
+  return mPrefix + jobId + ":" + part;
+}
+
+ShardWorker::ShardWorker(
+    const shared_ptr<ShardCoordinator>& coordinator,
+    const string& workerId,
+    size_t threads,
+    milliseconds lease,
+    milliseconds poll,
+    const Runner& run)
+    : mCoordinator(coordinator),
+      mWorkerId(workerId),
+      mLease(lease),
+      mPoll(poll),
+      mRun(run),
+      mStopping(false),
+      mRenewerStopping(false),
+      mClaimed(0),
+      mStolen(0),
+      mCompleted(0),
+      mReleased(0),
+      mLostLeases(0),
+      mErrors(0) {
+  for (size_t i = 0; i < threads; ++i)
+    mThreads.emplace_back(&ShardWorker::Work, this);
+  mThreads.emplace_back(&ShardWorker::Renew, this);
+}
+
+ShardWorker::~ShardWorker() {
+  Stop();
+  // The renewer, started last, keeps the running shards leased until their workers are done.
+  for (size_t i = 0; i + 1 < mThreads.size(); ++i)
+    mThreads[i].join();
+  {
+    lock_guard<mutex> lock(mMutex);
+    mRenewerStopping = true;
+  }
+  mWake.notify_all();
+  mThreads.back().join();
+}
+
+void ShardWorker::Stop() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mWake.notify_all();
+}
+
+ShardWorker::Stats ShardWorker::GetStats() const {
+  Stats stats;
+  stats.claimed = mClaimed.load();
+  stats.stolen = mStolen.load();
+  stats.completed = mCompleted.load();
+  stats.released = mReleased.load();
+  stats.lostLeases = mLostLeases.load();
+  stats.errors = mErrors.load();
+  return stats;
+}
+
+void ShardWorker::Work() {
+  while (true) {
+    {
+      lock_guard<mutex> lock(mMutex);
+      if (mStopping)
+        return;
+    }
+    ShardCoordinator::Shard shard;
+    try {
+      if (!mCoordinator->Claim(mWorkerId, mLease, shard)) {
+        if (!Sleep(mPoll, mStopping))
+          return;
+        continue;
+      }
+    }
+    catch (const std::exception&) {
+      // Redis is unreachable or a shard is corrupt; try again after a poll.
+      ++mErrors;
+      if (!Sleep(mPoll, mStopping))
+        return;
+      continue;
+    }
+    ++mClaimed;
+    if (shard.stolen)
+      ++mStolen;
+    {
+      lock_guard<mutex> lock(mMutex);
+      mRunning[std::this_thread::get_id()] = shard;
+    }
+    Outcome outcome = Outcome();
+    try {
+      outcome = mRun(shard);
+    }
+    catch (const std::exception&) {
+      outcome.retry = true;
+    }
+    {
+      lock_guard<mutex> lock(mMutex);
+      mRunning.erase(std::this_thread::get_id());
+    }
+    try {
+      if (outcome.retry) {
+        mCoordinator->Release(shard, mWorkerId);
+        ++mReleased;
+        if (!Sleep(mPoll, mStopping))
+          return;
+      } else if (mCoordinator->Complete(shard, mWorkerId, outcome.succeeded, outcome.failed, outcome.results)) {
+        ++mCompleted;
+      } else {
+        ++mLostLeases;
+      }
+    }
+    catch (const std::exception&) {
+      // The lease runs out and another worker takes the shard over.
+      ++mErrors;
+    }
+  }
+}
+
+void ShardWorker::Renew() {
+  const milliseconds interval(std::max<int64_t>(mLease.count() / 3, 1));
+  while (Sleep(interval, mRenewerStopping)) {
+    vector<ShardCoordinator::Shard> running;
+    {
+      lock_guard<mutex> lock(mMutex);
+      for (const auto& entry : mRunning)
+        running.push_back(entry.second);
+    }
+    for (const auto& shard : running) {
+      try {
+        mCoordinator->Renew(shard, mWorkerId, mLease);
+      }
+      catch (const std::exception&) {
+        ++mErrors;
+      }
+    }
+  }
+}
+
+bool ShardWorker::Sleep(milliseconds duration, const bool& stopping) {
+  std::unique_lock<mutex> lock(mMutex);
+  mWake.wait_for(lock, duration, [&stopping]() { return stopping; });
+  return !stopping;
+}
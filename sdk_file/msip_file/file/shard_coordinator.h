@@ -0,0 +1,184 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_SHARD_COORDINATOR_H_
+#define SAMPLE_FILE_SHARD_COORDINATOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "redis_client.h"
+
+// Bulk jobs split into shards of files in Redis, for every replica to work through. Each shard is claimed
+// under a lease that its worker renews while it runs; a shard whose lease expires, because its replica
+// died or stalled, is stolen by the next claim. Claims, renewals and completions are Lua scripts, so
+// replicas never double-count a shard, and only the worker holding a shard's lease may complete it.
+// Every key of a job expires with the job's TTL.
+class ShardCoordinator final {
+public:
+  // What every file of the job gets done, and the parameters of that batch export.
+  struct Job {
+    // "status", "unprotect" or "protect".
+    std::string operation;
+    std::string applicationId;
+    std::string token;
+    std::string user;
+    std::string encryptedFile;
+  };
+
+  struct Shard {
+    std::string jobId;
+    int64_t index;
+    // Claimed after another worker's lease on it expired.
+    bool stolen;
+    Job job;
+    std::vector<std::string> paths;
+  };
+
+  struct Progress {
+    bool found;
+    int64_t shards;
+    int64_t files;
+    int64_t done;
+    int64_t leased;
+    int64_t pending;
+    int64_t succeeded;
+    int64_t failed;
+    int64_t stolen;
+  };
+
+  ShardCoordinator(const std::shared_ptr<sample::storage::RedisClient>& client, const std::string& prefix);
+
+  // Records the job's paths as shards of shardSize files. Throws std::runtime_error when the job exists.
+  // Returns the number of shards.
+  int64_t Submit(
+      const std::string& jobId,
+      const Job& job,
+      const std::vector<std::string>& paths,
+      size_t shardSize,
+      std::chrono::seconds ttl);
+
+  // Claims an expired shard of any job, else a pending one, leased to worker for lease. False when every
+  // shard is done or leased.
+  bool Claim(const std::string& worker, std::chrono::milliseconds lease, Shard& shard);
+
+  // False when worker no longer holds the shard's lease.
+  bool Renew(const Shard& shard, const std::string& worker, std::chrono::milliseconds lease);
+
+  // Gives the shard up for the next claim, e.g. when this replica is draining.
+  bool Release(const Shard& shard, const std::string& worker);
+
+  // Records the shard's outcome, with results the JSON of its batch. False, with nothing recorded, when
+  // the lease was lost and another worker took the shard over.
+  bool Complete(const Shard& shard, const std::string& worker, int64_t succeeded, int64_t failed, const std::string& results);
+
+  Progress GetProgress(const std::string& jobId);
+
+  // The results recorded for the job's shards, from the first-th on, as one JSON object per shard.
+  std::vector<std::string> GetResults(const std::string& jobId, int64_t first);
+
+private:
+  std::string JobKey(const std::string& jobId, const char* part) const;
+
+  std::shared_ptr<sample::storage::RedisClient> mClient;
+  const std::string mPrefix;
+};
+
+// Threads that claim shards, run them and record their outcomes until stopped, renewing every running
+// shard's lease at a third of its length.
+class ShardWorker final {
+public:
+  struct Outcome {
+    // The shard was not run, e.g. while draining, and is released for another replica.
+    bool retry;
+    int64_t succeeded;
+    int64_t failed;
+    std::string results;
+  };
+
+  typedef std::function<Outcome(const ShardCoordinator::Shard& shard)> Runner;
+
+  struct Stats {
+    uint64_t claimed;
+    uint64_t stolen;
+    uint64_t completed;
+    uint64_t released;
+    uint64_t lostLeases;
+    uint64_t errors;
+  };
+
+  ShardWorker(
+      const std::shared_ptr<ShardCoordinator>& coordinator,
+      const std::string& workerId,
+      size_t threads,
+      std::chrono::milliseconds lease,
+      std::chrono::milliseconds poll,
+      const Runner& run);
+  // Stops claiming and waits for the running shards.
+  ~ShardWorker();
+
+  // Stops claiming without waiting; the running shards finish and stay leased until destruction.
+  void Stop();
+
+  const std::string& GetWorkerId() const { return mWorkerId; }
+  Stats GetStats() const;
+
+private:
+  void Work();
+  void Renew();
+  // Sleeps up to duration; false once stopping is set.
+  bool Sleep(std::chrono::milliseconds duration, const bool& stopping);
+
+  std::shared_ptr<ShardCoordinator> mCoordinator;
+  const std::string mWorkerId;
+  const std::chrono::milliseconds mLease;
+  const std::chrono::milliseconds mPoll;
+  const Runner mRun;
+  std::mutex mMutex;
+  std::condition_variable mWake;
+  bool mStopping;
+  bool mRenewerStopping;
+  // Running shards by thread, for the renewer.
+  std::map<std::thread::id, ShardCoordinator::Shard> mRunning;
+  std::atomic<uint64_t> mClaimed;
+  std::atomic<uint64_t> mStolen;
+  std::atomic<uint64_t> mCompleted;
+  std::atomic<uint64_t> mReleased;
+  std::atomic<uint64_t> mLostLeases;
+  std::atomic<uint64_t> mErrors;
+  std::vector<std::thread> mThreads;
+};
+
+#endif // SAMPLE_FILE_SHARD_COORDINATOR_H_
@@ -0,0 +1,519 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_SHARDED_LRU_H_
+#define SAMPLE_FILE_SHARDED_LRU_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "allocation_account.h"
+#include "epoch_reclaimer.h"
+#include "instrumented_mutex.h"
+#include "operation_log.h"
+
+// String-keyed cache split into kShardCount shards, read without locks. Each shard keeps its entries in
+// an open-addressing table of immutable nodes; Find probes the table under an EpochReclaimer guard and
+// copies the value out, so a hit takes no lock and writes nothing shared but the shard's hit counter and,
+// the first time after a sweep, the entry's reference bit. Writers take their shard's lock, publish
+// new nodes with release stores and retire the ones they unlink, so a concurrent reader still sees a
+// whole entry. Eviction approximates LRU per shard with CLOCK: the hand sweeps the table, clearing
+// reference bits, and evicts the first entry not used since its last pass. Each shard holds capacity /
+// kShardCount entries, rounded up. Values are copied out and copied on Upsert, so keep them cheap to copy
+// (shared_ptrs, PODs).
+// Entries may be put under a group, e.g. the tenant they belong to, whose entries are capped the same way
+// by SetGroupCapacity so one group cannot fill the cache. A named cache adds its lookups to the current
+// operation log. Entries are allocated and freed under the caches' allocation subsystem. Writes that found
+// their shard's lock held are counted as lock waits, and the shard locks report to the lock metrics under
+// the cache's name. The number of entries is also kept in an atomic, so
+// GetSize locks no shard.
+template <typename Value>
+class ShardedLru final {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that had to wait for their shard's lock. Lookups never lock.
+    uint64_t lockWaits;
+  };
+
+  static const size_t kShardCount = 16;
+
+  explicit ShardedLru(size_t capacity, const char* name = nullptr) : mName(name), mCapacity(capacity), mGroupCapacity(0), mSize(0) {
+    for (auto& shard : mShards) {
+      shard.mutex.reset(new sample::lock::InstrumentedMutex(name ? name : "cache"));
+      shard.capacity = ShardCapacity(capacity);
+      shard.table.store(new Table(kMinTableSize), std::memory_order_relaxed);
+    }
+  }
+
+  ~ShardedLru() {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    for (auto& shard : mShards) {
+      Table* table = shard.table.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < table->size; ++i) {
+        Node* node = table->slots[i].load(std::memory_order_relaxed);
+        if (IsLive(node))
+          delete node;
+      }
+      delete table;
+    }
+  }
+
+  ShardedLru(const ShardedLru&) = delete;
+  ShardedLru& operator=(const ShardedLru&) = delete;
+
+  // Copies the entry for key into value and marks it used. An entry isValid rejects is dropped and counts
+  // as a miss. isValid runs without the shard's lock and may run on several threads at once.
+  template <typename Predicate>
+  bool Find(const std::string& key, Value& value, Predicate isValid) {
+    const size_t hash = Hash(key);
+    Shard& shard = GetShard(hash);
+    EpochReclaimer::ReadGuard guard;
+    Table* table = shard.table.load(std::memory_order_acquire);
+    size_t slot = 0;
+    Node* node = Probe(*table, key, hash, slot);
+    if (node) {
+      if (isValid(node->value)) {
+        value = node->value;
+        if (!node->referenced.load(std::memory_order_relaxed))
+          node->referenced.store(true, std::memory_order_relaxed);
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        RecordLookup(true);
+        return true;
+      }
+      // The guard keeps node alive, so only the entry this lookup rejected is dropped.
+      sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+      ShardLock lock(shard);
+      SizeUpdate sizeUpdate(*this, shard);
+      Table& current = *shard.table.load(std::memory_order_relaxed);
+      if (Probe(current, key, hash, slot) == node)
+        Remove(shard, current, slot);
+    }
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    RecordLookup(false);
+    return false;
+  }
+
+  bool Find(const std::string& key, Value& value) {
+    return Find(key, value, [](const Value&) { return true; });
+  }
+
+  // Counts a miss for a lookup the caller could not make, e.g. because the key could not be built.
+  void RecordMiss(const std::string& key) {
+    GetShard(Hash(key)).misses.fetch_add(1, std::memory_order_relaxed);
+    RecordLookup(false);
+  }
+
+  // Replaces any entry for key, counting it against group unless that is empty. Does nothing while the
+  // capacity is zero.
+  void Put(const std::string& key, const Value& value, const std::string& group = std::string()) {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    const size_t hash = Hash(key);
+    Shard& shard = GetShard(hash);
+    ShardLock lock(shard);
+    SizeUpdate sizeUpdate(*this, shard);
+    if (shard.capacity == 0)
+      return;
+    Insert(shard, new Node(key, hash, value, group));
+    if (!group.empty())
+      EvictOverGroupCapacity(shard, group);
+    EvictOverCapacity(shard);
+  }
+
+  // Applies update to a copy of the entry for key, or to a default-constructed value, and publishes the
+  // result in its place marked used. The entry keeps its group. Counts neither a hit nor a miss. Does
+  // nothing while the capacity is zero.
+  template <typename Update>
+  void Upsert(const std::string& key, Update update) {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    const size_t hash = Hash(key);
+    Shard& shard = GetShard(hash);
+    ShardLock lock(shard);
+    SizeUpdate sizeUpdate(*this, shard);
+    if (shard.capacity == 0)
+      return;
+    size_t slot = 0;
+    Node* existing = Probe(*shard.table.load(std::memory_order_relaxed), key, hash, slot);
+    Value value = existing ? existing->value : Value();
+    update(value);
+    Insert(shard, new Node(key, hash, value, existing ? existing->group : std::string()));
+    if (!existing)
+      EvictOverCapacity(shard);
+  }
+
+  // Drops every entry matches accepts. Visits the whole cache, so keep it off hot paths.
+  template <typename Predicate>
+  void EraseIf(Predicate matches) {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    for (auto& shard : mShards) {
+      ShardLock lock(shard);
+      SizeUpdate sizeUpdate(*this, shard);
+      Table& table = *shard.table.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < table.size; ++i) {
+        Node* node = table.slots[i].load(std::memory_order_relaxed);
+        if (IsLive(node) && matches(node->value))
+          Remove(shard, table, i);
+      }
+    }
+  }
+
+  // Calls visit(key, value, group) for every entry, one shard at a time with its lock held, so visit must
+  // not call back into the cache. Visits the whole cache, so keep it off hot paths.
+  template <typename Visitor>
+  void ForEach(Visitor visit) const {
+    for (const auto& shard : mShards) {
+      std::lock_guard<sample::lock::InstrumentedMutex> lock(*shard.mutex);
+      const Table& table = *shard.table.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < table.size; ++i) {
+        const Node* node = table.slots[i].load(std::memory_order_relaxed);
+        if (IsLive(node))
+          visit(node->key, node->value, node->group);
+      }
+    }
+  }
+
+  // Shrinking the capacity evicts entries immediately. Zero disables the cache.
+  void SetCapacity(size_t capacity) {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    mCapacity = capacity;
+    for (auto& shard : mShards) {
+      ShardLock lock(shard);
+      SizeUpdate sizeUpdate(*this, shard);
+      shard.capacity = ShardCapacity(capacity);
+      EvictOverCapacity(shard);
+    }
+  }
+
+  // Caps the entries of each group the same way, evicting the group's entries beyond it on its next Put.
+  // Zero lifts the cap.
+  void SetGroupCapacity(size_t capacity) {
+    mGroupCapacity = capacity;
+    for (auto& shard : mShards) {
+      ShardLock lock(shard);
+      shard.groupCapacity = capacity == 0 ? 0 : ShardCapacity(capacity);
+    }
+  }
+
+  size_t GetCapacity() const { return mCapacity; }
+
+  size_t GetGroupCapacity() const { return mGroupCapacity; }
+
+  // Entries held, without locking. May lag a concurrent change.
+  size_t GetSize() const { return mSize.load(std::memory_order_relaxed); }
+
+  Stats GetStats() const {
+    Stats stats = {};
+    for (const auto& shard : mShards) {
+      stats.hits += shard.hits.load(std::memory_order_relaxed);
+      stats.misses += shard.misses.load(std::memory_order_relaxed);
+      stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+      stats.lockWaits += shard.lockWaits.load(std::memory_order_relaxed);
+    }
+    stats.size = GetSize();
+    stats.capacity = mCapacity;
+    return stats;
+  }
+
+  // Entries held in each group.
+  std::map<std::string, size_t> GetGroupSizes() const {
+    std::map<std::string, size_t> sizes;
+    for (const auto& shard : mShards) {
+      std::lock_guard<sample::lock::InstrumentedMutex> lock(*shard.mutex);
+      for (const auto& group : shard.groupSizes)
+        sizes[group.first] += group.second;
+    }
+    return sizes;
+  }
+
+  void Clear() {
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    for (auto& shard : mShards) {
+      ShardLock lock(shard);
+      SizeUpdate sizeUpdate(*this, shard);
+      // Unlinked with their table before they are retired.
+      Table* table = shard.table.load(std::memory_order_relaxed);
+      shard.table.store(new Table(kMinTableSize), std::memory_order_release);
+      for (size_t i = 0; i < table->size; ++i) {
+        Node* node = table->slots[i].load(std::memory_order_relaxed);
+        if (IsLive(node))
+          EpochReclaimer::Shared().Retire(node);
+      }
+      EpochReclaimer::Shared().Retire(table);
+      shard.count = 0;
+      shard.used = 0;
+      shard.hand = 0;
+      shard.groupSizes.clear();
+    }
+    EpochReclaimer::Shared().Reclaim();
+  }
+
+private:
+  // Tables stay at most half full, counting removed slots, so a probe always ends at an empty one.
+  static const size_t kMinTableSize = 16;
+
+  struct Node {
+    Node(const std::string& key, size_t hash, const Value& value, const std::string& group)
+        : key(key), hash(hash), value(value), group(group), referenced(true) {}
+
+    const std::string key;
+    const size_t hash;
+    const Value value;
+    const std::string group;
+    // Set by hits, cleared by the CLOCK hand.
+    std::atomic<bool> referenced;
+  };
+
+  struct Table {
+    explicit Table(size_t size) : size(size), slots(new std::atomic<Node*>[size]) {
+      for (size_t i = 0; i < size; ++i)
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    const size_t size;
+    std::unique_ptr<std::atomic<Node*>[]> slots;
+  };
+
+  struct Shard {
+    Shard() : table(nullptr), hits(0), misses(0), evictions(0), lockWaits(0), count(0), used(0), hand(0), capacity(0), groupCapacity(0) {}
+
+    std::atomic<Table*> table;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+    std::atomic<uint64_t> lockWaits;
+    // Named after the cache, so its shards' lock metrics add up. The rest is read and written with it held.
+    std::unique_ptr<sample::lock::InstrumentedMutex> mutex;
+    // Live entries, and slots holding a live or removed entry.
+    size_t count;
+    size_t used;
+    // Next slot the CLOCK hand inspects.
+    size_t hand;
+    // The number of keys in each group.
+    std::unordered_map<std::string, size_t> groupSizes;
+    size_t capacity;
+    size_t groupCapacity;
+    // Keeps the next shard's hit counter off this one's cache line.
+    char padding[64];
+  };
+
+  // The shard's lock, counting a wait when it is held already.
+  class ShardLock final {
+  public:
+    explicit ShardLock(Shard& shard) : mLock(*shard.mutex, std::try_to_lock) {
+      if (!mLock.owns_lock()) {
+        shard.lockWaits.fetch_add(1, std::memory_order_relaxed);
+        mLock.lock();
+      }
+    }
+
+  private:
+    std::unique_lock<sample::lock::InstrumentedMutex> mLock;
+  };
+
+  // Adds the change in the shard's entries over its lifetime to mSize. Declared after the shard's lock.
+  class SizeUpdate final {
+  public:
+    SizeUpdate(ShardedLru& cache, const Shard& shard) : mCache(cache), mShard(shard), mBefore(shard.count) {}
+    ~SizeUpdate() { mCache.mSize.fetch_add(mShard.count - mBefore, std::memory_order_relaxed); }
+
+  private:
+    ShardedLru& mCache;
+    const Shard& mShard;
+    const size_t mBefore;
+  };
+
+  static size_t ShardCapacity(size_t capacity) {
+    return (capacity + kShardCount - 1) / kShardCount;
+  }
+
+  static size_t Hash(const std::string& key) {
+    return std::hash<std::string>()(key);
+  }
+
+  Shard& GetShard(size_t hash) {
+    return mShards[hash % kShardCount];
+  }
+
+  // Marks a slot whose entry was removed, so probes continue past it.
+  static Node* Removed() {
+    static char marker;
+    return reinterpret_cast<Node*>(&marker);
+  }
+
+  static bool IsLive(const Node* node) {
+    return node && node != Removed();
+  }
+
+  // The first slot of hash's probe sequence. The low bits picked the shard.
+  static size_t FirstSlot(const Table& table, size_t hash) {
+    return (hash / kShardCount) & (table.size - 1);
+  }
+
+  // The live entry for key and its slot, or nullptr.
+  static Node* Probe(const Table& table, const std::string& key, size_t hash, size_t& slot) {
+    for (size_t i = FirstSlot(table, hash), probed = 0; probed < table.size; i = (i + 1) & (table.size - 1), ++probed) {
+      Node* node = table.slots[i].load(std::memory_order_acquire);
+      if (!node)
+        return nullptr;
+      if (node != Removed() && node->hash == hash && node->key == key) {
+        slot = i;
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  void RecordLookup(bool hit) const {
+    if (mName)
+      sample::oplog::RecordCacheLookup(mName, hit);
+  }
+
+  static void Ungroup(Shard& shard, const Node& node) {
+    if (node.group.empty())
+      return;
+    auto size = shard.groupSizes.find(node.group);
+    if (--size->second == 0)
+      shard.groupSizes.erase(size);
+  }
+
+  // Publishes node, replacing any entry for its key. With the shard's lock held.
+  static void Insert(Shard& shard, Node* node) {
+    if ((shard.used + 1) * 2 > shard.table.load(std::memory_order_relaxed)->size)
+      Rehash(shard);
+    Table& table = *shard.table.load(std::memory_order_relaxed);
+    size_t slot = 0;
+    Node* existing = Probe(table, node->key, node->hash, slot);
+    if (!existing) {
+      // The first removed or empty slot of the probe sequence.
+      slot = FirstSlot(table, node->hash);
+      while (IsLive(table.slots[slot].load(std::memory_order_relaxed)))
+        slot = (slot + 1) & (table.size - 1);
+      if (!table.slots[slot].load(std::memory_order_relaxed))
+        ++shard.used;
+      ++shard.count;
+    }
+    if (!node->group.empty())
+      ++shard.groupSizes[node->group];
+    table.slots[slot].store(node, std::memory_order_release);
+    if (existing) {
+      Ungroup(shard, *existing);
+      EpochReclaimer::Shared().Retire(existing);
+    }
+  }
+
+  // With the shard's lock held.
+  static void Remove(Shard& shard, Table& table, size_t slot) {
+    Node* node = table.slots[slot].load(std::memory_order_relaxed);
+    table.slots[slot].store(Removed(), std::memory_order_release);
+    --shard.count;
+    Ungroup(shard, *node);
+    EpochReclaimer::Shared().Retire(node);
+  }
+
+  // Moves the live entries to a table sized for twice as many, dropping removed slots. Readers still
+  // probing the old table find the same nodes there until it is reclaimed.
+  static void Rehash(Shard& shard) {
+    Table* old = shard.table.load(std::memory_order_relaxed);
+    size_t size = kMinTableSize;
+    while (size < (shard.count + 1) * 4)
+      size *= 2;
+    Table* table = new Table(size);
+    for (size_t i = 0; i < old->size; ++i) {
+      Node* node = old->slots[i].load(std::memory_order_relaxed);
+      if (!IsLive(node))
+        continue;
+      size_t slot = FirstSlot(*table, node->hash);
+      while (table->slots[slot].load(std::memory_order_relaxed))
+        slot = (slot + 1) & (size - 1);
+      table->slots[slot].store(node, std::memory_order_relaxed);
+    }
+    shard.table.store(table, std::memory_order_release);
+    shard.used = shard.count;
+    shard.hand = 0;
+    EpochReclaimer::Shared().Retire(old);
+  }
+
+  // Advances the CLOCK hand to the next entry group accepts that was not used since the hand last
+  // passed it and evicts it. After two passes the reference bits are clear, so that ends the sweep.
+  template <typename Accepts>
+  static bool EvictOne(Shard& shard, Accepts accepts) {
+    Table& table = *shard.table.load(std::memory_order_relaxed);
+    for (size_t swept = 0; swept < table.size * 2; ++swept) {
+      const size_t slot = shard.hand;
+      shard.hand = (shard.hand + 1) & (table.size - 1);
+      Node* node = table.slots[slot].load(std::memory_order_relaxed);
+      if (!IsLive(node) || !accepts(*node))
+        continue;
+      if (node->referenced.load(std::memory_order_relaxed)) {
+        node->referenced.store(false, std::memory_order_relaxed);
+        continue;
+      }
+      Remove(shard, table, slot);
+      shard.evictions.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  static void EvictOverGroupCapacity(Shard& shard, const std::string& group) {
+    if (shard.groupCapacity == 0)
+      return;
+    while (shard.groupSizes[group] > shard.groupCapacity &&
+           EvictOne(shard, [&group](const Node& node) { return node.group == group; })) {
+    }
+  }
+
+  static void EvictOverCapacity(Shard& shard) {
+    while (shard.count > shard.capacity && EvictOne(shard, [](const Node&) { return true; })) {
+    }
+  }
+
+  const char* const mName;
+  std::atomic<size_t> mCapacity;
+  std::atomic<size_t> mGroupCapacity;
+  std::atomic<size_t> mSize;
+  std::array<Shard, kShardCount> mShards;
+};
+
+template <typename Value>
+const size_t ShardedLru<Value>::kShardCount;
+
+template <typename Value>
+const size_t ShardedLru<Value>::kMinTableSize;
+
+#endif // SAMPLE_FILE_SHARDED_LRU_H_
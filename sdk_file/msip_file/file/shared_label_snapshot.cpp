@@ -0,0 +1,357 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "shared_label_snapshot.h"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+const char kMagic[8] = { 'M', 'S', 'I', 'P', 'L', 'B', 'L', '1' };
+
+enum TextField { kId, kName, kPath, kDescription, kColor, kTooltip, kTextFields };
+
+struct StoredText {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct StoredLabel {
+  StoredText texts[kTextFields];
+  int32_t parent;
+  uint32_t depth;
+  uint32_t childCount;
+  int32_t sensitivity;
+  uint8_t active;
+  uint8_t doubleKey;
+  uint8_t reserved[6];
+};
+
+struct Header {
+  char magic[8];
+  uint32_t count;
+  uint32_t stringsSize;
+  int64_t publishedAt;
+};
+
+static_assert(sizeof(StoredLabel) == 72, "StoredLabel is part of the snapshot format");
+static_assert(sizeof(Header) == 24, "Header is part of the snapshot format");
+
+const StoredLabel* Labels(const uint8_t* data) {
+  return reinterpret_cast<const StoredLabel*>(data + sizeof(Header));
+}
+
+const char* Strings(const uint8_t* data, size_t count) {
+  return reinterpret_cast<const char*>(data + sizeof(Header) + count * sizeof(StoredLabel));
+}
+
+bool EqualsFolded(const SharedLabelSnapshot::Text& text, const string& value) {
+  if (text.size != value.size())
+    return false;
+  for (size_t i = 0; i < text.size; ++i) {
+    if (std::tolower(static_cast<unsigned char>(text.data[i])) != std::tolower(static_cast<unsigned char>(value[i])))
+      return false;
+  }
+  return true;
+}
+
+string ErrnoMessage(const string& what, const string& path) {
+  return what + " '" + path + "': " + strerror(errno);
+}
+
+// Writes size bytes of data to path, created under a name of its own for the caller to rename or link into
+// place, so a reader maps either the whole earlier snapshot or the whole new one.
+void WriteTemporary(const string& path, const char* data, size_t size) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("Failed to create", path));
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t count = write(fd, data + written, size - written);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0) {
+      const string error = ErrnoMessage("Failed to write", path);
+      close(fd);
+      unlink(path.c_str());
+      throw runtime_error(error);
+    }
+    written += static_cast<size_t>(count);
+  }
+  close(fd);
+}
+
+string TemporaryOf(const string& path) {
+  return path + "." + std::to_string(getpid()) + ".tmp";
+}
+
+} // namespace
+
+void SharedLabelSnapshot::Write(const string& path, const LabelIndex& labels) {
+  const string contents = Serialize(labels);
+  const string temporary = TemporaryOf(path);
+  WriteTemporary(temporary, contents.data(), contents.size());
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    const string error = ErrnoMessage("Failed to publish", path);
+    unlink(temporary.c_str());
+    throw runtime_error(error);
+  }
+}
+
+string SharedLabelSnapshot::Serialize(const LabelIndex& labels) {
+  const auto& records = labels.GetRecords();
+  string strings;
+  std::vector<StoredLabel> stored(records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto& record = records[i];
+    auto& label = stored[i];
+    memset(&label, 0, sizeof(label));
+    const string* texts[kTextFields] = {
+        &record.id, &record.name, &record.path, &record.description, &record.color, &record.tooltip };
+    for (size_t field = 0; field < kTextFields; ++field) {
+      label.texts[field] = { static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(texts[field]->size()) };
+      strings += *texts[field];
+    }
+    label.parent = record.parent;
+    label.depth = record.depth;
+    label.childCount = record.childCount;
+    label.sensitivity = record.sensitivity;
+    label.active = record.active;
+    label.doubleKey = record.doubleKey;
+  }
+  if (strings.size() > UINT32_MAX)
+    throw runtime_error("Labels too large for a shared snapshot");
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.count = static_cast<uint32_t>(records.size());
+  header.stringsSize = static_cast<uint32_t>(strings.size());
+  header.publishedAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+  contents.append(reinterpret_cast<const char*>(stored.data()), stored.size() * sizeof(StoredLabel));
+  contents += strings;
+  return contents;
+}
+
+shared_ptr<const SharedLabelSnapshot> SharedLabelSnapshot::Map(const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (data == MAP_FAILED)
+    return nullptr;
+  shared_ptr<const SharedLabelSnapshot> snapshot(new SharedLabelSnapshot(static_cast<const uint8_t*>(data), size));
+  return snapshot->Validate() ? snapshot : nullptr;
+}
+
+SharedLabelSnapshot::SharedLabelSnapshot(const uint8_t* data, size_t size)
+    : mData(data),
+      mSize(size),
+      mCount(0),
+      mPublishedAt(0) {
+  Header header;
+  memcpy(&header, mData, sizeof(header));
+  mCount = header.count;
+  mPublishedAt = header.publishedAt;
+}
+
+SharedLabelSnapshot::~SharedLabelSnapshot() {
+  munmap(const_cast<uint8_t*>(mData), mSize);
+}
+
+bool SharedLabelSnapshot::Validate() const {
+  Header header;
+  memcpy(&header, mData, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    return false;
+  if (mSize != sizeof(Header) + static_cast<size_t>(header.count) * sizeof(StoredLabel) + header.stringsSize)
+    return false;
+  const auto* labels = Labels(mData);
+  for (size_t i = 0; i < mCount; ++i) {
+    for (const auto& text : labels[i].texts) {
+      if (static_cast<uint64_t>(text.offset) + text.size > header.stringsSize)
+        return false;
+    }
+    if (labels[i].parent != LabelIndex::kNoParent && (labels[i].parent < 0 || static_cast<size_t>(labels[i].parent) >= i))
+      return false;
+  }
+  return true;
+}
+
+SharedLabelSnapshot::Label SharedLabelSnapshot::Get(size_t index) const {
+  const auto& stored = Labels(mData)[index];
+  const char* strings = Strings(mData, mCount);
+  auto text = [&](TextField field) {
+    return Text { strings + stored.texts[field].offset, stored.texts[field].size };
+  };
+  Label label;
+  label.id = text(kId);
+  label.name = text(kName);
+  label.path = text(kPath);
+  label.description = text(kDescription);
+  label.color = text(kColor);
+  label.tooltip = text(kTooltip);
+  label.parent = stored.parent;
+  label.depth = stored.depth;
+  label.childCount = stored.childCount;
+  label.sensitivity = stored.sensitivity;
+  label.active = stored.active != 0;
+  label.doubleKey = stored.doubleKey != 0;
+  return label;
+}
+
+int64_t SharedLabelSnapshot::FindById(const string& id) const {
+  for (size_t i = 0; i < mCount; ++i) {
+    const auto label = Get(i);
+    if (label.id.size == id.size() && memcmp(label.id.data, id.data(), id.size()) == 0)
+      return static_cast<int64_t>(i);
+  }
+  return kNotFound;
+}
+
+int64_t SharedLabelSnapshot::FindByName(const string& name) const {
+  for (size_t i = 0; i < mCount; ++i) {
+    const auto label = Get(i);
+    if (EqualsFolded(label.name, name) || (label.parent != LabelIndex::kNoParent && EqualsFolded(label.path, name)))
+      return static_cast<int64_t>(i);
+  }
+  return kNotFound;
+}
+
+int64_t SharedLabelSnapshot::Find(const string& idOrName) const {
+  const int64_t index = FindById(idOrName);
+  return index != kNotFound ? index : FindByName(idOrName);
+}
+
+SharedLabelSnapshots::SharedLabelSnapshots() {
+}
+
+SharedLabelSnapshots::~SharedLabelSnapshots() {
+  for (const auto& owned : mOwned)
+    close(owned.second);
+}
+
+void SharedLabelSnapshots::SetDirectory(const string& directory) {
+  lock_guard<mutex> lock(mMutex);
+  mDirectory = directory;
+  mMapped.clear();
+}
+
+bool SharedLabelSnapshots::IsEnabled() const {
+  lock_guard<mutex> lock(mMutex);
+  return !mDirectory.empty();
+}
+
+string SharedLabelSnapshots::PathOf(const string& engineId) const {
+  return mDirectory + "/msip-labels-" + engineId;
+}
+
+void SharedLabelSnapshots::Publish(const string& engineId, const LabelIndex& labels) {
+  lock_guard<mutex> lock(mMutex);
+  if (mDirectory.empty())
+    return;
+  const string path = PathOf(engineId);
+  if (!mOwned.count(engineId)) {
+    // Held until the process exits, so the snapshot gets a new owner once its owner is gone.
+    const string lockPath = path + ".owner";
+    const int fd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      close(fd);
+      return;
+    }
+    mOwned[engineId] = fd;
+  }
+  try {
+    SharedLabelSnapshot::Write(path, labels);
+  } catch (const std::exception&) {
+  }
+}
+
+shared_ptr<const SharedLabelSnapshot> SharedLabelSnapshots::Find(const string& engineId) {
+  lock_guard<mutex> lock(mMutex);
+  if (mDirectory.empty())
+    return nullptr;
+  const string path = PathOf(engineId);
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    mMapped.erase(engineId);
+    return nullptr;
+  }
+  auto& mapped = mMapped[engineId];
+  if (!mapped.snapshot || mapped.device != static_cast<uint64_t>(info.st_dev) ||
+      mapped.inode != static_cast<uint64_t>(info.st_ino)) {
+    mapped.device = static_cast<uint64_t>(info.st_dev);
+    mapped.inode = static_cast<uint64_t>(info.st_ino);
+    mapped.snapshot = SharedLabelSnapshot::Map(path);
+  }
+  return mapped.snapshot;
+}
+
+bool SharedLabelSnapshots::Install(const string& engineId, const char* data, size_t size) {
+  lock_guard<mutex> lock(mMutex);
+  if (mDirectory.empty())
+    return false;
+  const string path = PathOf(engineId);
+  const string temporary = TemporaryOf(path);
+  try {
+    WriteTemporary(temporary, data, size);
+  } catch (const std::exception&) {
+    return false;
+  }
+  // Linked rather than renamed, so a snapshot published meanwhile is kept.
+  const bool installed = SharedLabelSnapshot::Map(temporary) != nullptr && link(temporary.c_str(), path.c_str()) == 0;
+  unlink(temporary.c_str());
+  return installed;
+}
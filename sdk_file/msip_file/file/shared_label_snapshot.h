@@ -0,0 +1,143 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_SHARED_LABEL_SNAPSHOT_H_
+#define SAMPLE_FILE_SHARED_LABEL_SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "label_index.h"
+
+// A policy engine's label tree published by one process of a node into a read-only file on tmpfs, which
+// every other process maps instead of loading the policy engine to list or find a label. Labels are read
+// in place from the mapping; nothing is copied to the heap. One record per label, in LabelIndex's
+// pre-order, and its strings after them.
+class SharedLabelSnapshot final {
+public:
+  // A string inside the mapping, not terminated.
+  struct Text {
+    const char* data;
+    size_t size;
+
+    std::string ToString() const { return std::string(data, size); }
+  };
+
+  struct Label {
+    Text id;
+    Text name;
+    Text path;
+    Text description;
+    Text color;
+    Text tooltip;
+    int32_t parent;
+    uint32_t depth;
+    uint32_t childCount;
+    int32_t sensitivity;
+    bool active;
+    bool doubleKey;
+  };
+
+  static const int64_t kNotFound = -1;
+
+  // Writes labels to path atomically, replacing any earlier snapshot while processes that mapped it keep
+  // reading theirs.
+  static void Write(const std::string& path, const LabelIndex& labels);
+  // The snapshot file's contents for labels, as Write writes them.
+  static std::string Serialize(const LabelIndex& labels);
+
+  // nullptr when path does not exist or holds no valid snapshot.
+  static std::shared_ptr<const SharedLabelSnapshot> Map(const std::string& path);
+
+  ~SharedLabelSnapshot();
+
+  size_t GetCount() const { return mCount; }
+  Label Get(size_t index) const;
+  // When the snapshot was written, in milliseconds since the epoch.
+  int64_t GetPublishedAt() const { return mPublishedAt; }
+
+  // Index of the label, or kNotFound. Matches like LabelIndex's lookups of the same name.
+  int64_t FindById(const std::string& id) const;
+  int64_t FindByName(const std::string& name) const;
+  int64_t Find(const std::string& idOrName) const;
+
+private:
+  SharedLabelSnapshot(const uint8_t* data, size_t size);
+  bool Validate() const;
+
+  const uint8_t* mData;
+  size_t mSize;
+  size_t mCount;
+  int64_t mPublishedAt;
+};
+
+// The node's label snapshots of each policy engine, in one directory, best on tmpfs such as /dev/shm so
+// they stay in memory. The first process to publish an engine's labels owns its snapshot, holding a lock on it until it
+// exits, and publishes it again on every load of that engine, policy refresh included; the others only map
+// it. A mapping is reused until the snapshot file is replaced.
+class SharedLabelSnapshots final {
+public:
+  SharedLabelSnapshots();
+  ~SharedLabelSnapshots();
+
+  // Empty disables publishing and lookups.
+  void SetDirectory(const std::string& directory);
+  bool IsEnabled() const;
+
+  // Publishes labels as the snapshot of engineId when this process owns it. Failures are ignored: other
+  // processes then load the policy engine as they would without a snapshot.
+  void Publish(const std::string& engineId, const LabelIndex& labels);
+
+  // The current snapshot of engineId, nullptr when none was published.
+  std::shared_ptr<const SharedLabelSnapshot> Find(const std::string& engineId);
+
+  // Installs size bytes of an earlier Serialize as the snapshot of engineId, for a restore of the warm
+  // caches. Nothing is replaced: false when publishing is disabled, engineId already has a snapshot, or the
+  // bytes are no valid snapshot.
+  bool Install(const std::string& engineId, const char* data, size_t size);
+
+private:
+  struct Mapped {
+    uint64_t device;
+    uint64_t inode;
+    std::shared_ptr<const SharedLabelSnapshot> snapshot;
+  };
+
+  std::string PathOf(const std::string& engineId) const;
+
+  mutable std::mutex mMutex;
+  std::string mDirectory;
+  // Lock file descriptors of the snapshots this process owns, by engine id.
+  std::map<std::string, int> mOwned;
+  std::map<std::string, Mapped> mMapped;
+};
+
+#endif // SAMPLE_FILE_SHARED_LABEL_SNAPSHOT_H_
@@ -0,0 +1,89 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_SINGLE_FLIGHT_H_
+#define SAMPLE_FILE_SINGLE_FLIGHT_H_
+
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "metrics_registry.h"
+#include "request_deadline.h"
+
+// Runs at most one load per key at a time. A caller asking for a key whose load is in flight waits for
+// that load's value or exception, up to its own deadline, instead of starting another one. Callers that
+// arrive after a load finished start a new one, so T is best fed into a cache by the load itself.
+template <typename T>
+class SingleFlight final {
+public:
+  // Waiters are counted in coalesced.
+  explicit SingleFlight(MetricsRegistry::Counter& coalesced) : mCoalesced(coalesced) {}
+
+  template <typename Load>
+  T Do(const std::string& key, const Load& load) {
+    std::promise<T> loading;
+    std::shared_future<T> pending;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      auto it = mInFlight.find(key);
+      if (it != mInFlight.end())
+        pending = it->second;
+      else
+        mInFlight[key] = loading.get_future().share();
+    }
+    if (pending.valid()) {
+      mCoalesced.Add(1);
+      return sample::deadline::WaitUntilDeadline(pending);
+    }
+
+    // The load takes service round trips, so it runs without holding the lock.
+    try {
+      T value = load();
+      Finish(key);
+      loading.set_value(value);
+      return value;
+    } catch (...) {
+      Finish(key);
+      loading.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+private:
+  void Finish(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mInFlight.erase(key);
+  }
+
+  MetricsRegistry::Counter& mCoalesced;
+  std::mutex mMutex;
+  std::map<std::string, std::shared_future<T>> mInFlight;
+};
+
+#endif // SAMPLE_FILE_SINGLE_FLIGHT_H_
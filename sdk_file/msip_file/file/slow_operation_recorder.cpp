@@ -0,0 +1,183 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "slow_operation_recorder.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+#include "json_writer.h"
+
+using sample::oplog::OperationLog;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Events named in a record's log line.
+const size_t kSummaryEvents = 3;
+
+string GetFormat(const string& path) {
+  const auto slash = path.find_last_of('/');
+  const auto dot = path.find_last_of('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return string();
+  string format = path.substr(dot + 1);
+  std::transform(format.begin(), format.end(), format.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return format;
+}
+
+int64_t GetSize(const string& path) {
+  struct stat fileInfo;
+  if (path.empty() || stat(path.c_str(), &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode))
+    return -1;
+  return static_cast<int64_t>(fileInfo.st_size);
+}
+
+void WriteRecord(JsonWriter& json, const SlowOperationRecorder::Record& record) {
+  json.BeginObject()
+      .Key("operation").String(record.operation)
+      .Key("path").String(record.path)
+      .Key("format").String(record.format)
+      .Key("size_bytes").Int(record.sizeBytes)
+      .Key("succeeded").Bool(record.succeeded)
+      .Key("duration_ms").Double(record.durationMicros / 1000.0)
+      .Key("time_ms").Int(record.unixMillis)
+      .Key("events").BeginArray();
+  for (const auto& event : record.events) {
+    json.BeginObject()
+        .Key("kind").String(event.kind)
+        .Key("name").String(event.name)
+        .Key("offset_ms").Double(event.offsetMicros / 1000.0);
+    if (event.durationMicros >= 0)
+      json.Key("duration_ms").Double(event.durationMicros / 1000.0);
+    if (!event.detail.empty())
+      json.Key("detail").String(event.detail);
+    json.EndObject();
+  }
+  json.EndArray()
+      .Key("dropped_events").UInt(record.droppedEvents)
+      .EndObject();
+}
+
+} // namespace
+
+SlowOperationRecorder& SlowOperationRecorder::Instance() {
+  static SlowOperationRecorder* instance = new SlowOperationRecorder(); // Never destroyed, like the SDK's threads.
+  return *instance;
+}
+
+SlowOperationRecorder::SlowOperationRecorder()
+    : mThresholdMicros(0),
+      mCapacity(0),
+      mDropped(0) {
+}
+
+void SlowOperationRecorder::Configure(int64_t thresholdMillis, size_t capacity) {
+  lock_guard<mutex> lock(mMutex);
+  mCapacity = capacity;
+  while (mRecords.size() > mCapacity) {
+    mRecords.pop_front();
+    ++mDropped;
+  }
+  mThresholdMicros.store(thresholdMillis > 0 && capacity > 0 ? thresholdMillis * 1000 : 0, std::memory_order_relaxed);
+}
+
+SlowOperationRecorder::Record SlowOperationRecorder::Add(
+    const string& operation,
+    const string& path,
+    bool succeeded,
+    const OperationLog& log,
+    OperationLog::Clock::time_point end) {
+  Record record;
+  record.operation = operation;
+  record.path = path;
+  record.format = GetFormat(path);
+  record.sizeBytes = GetSize(path);
+  record.succeeded = succeeded;
+  record.durationMicros = std::chrono::duration_cast<std::chrono::microseconds>(end - log.GetStart()).count();
+  record.unixMillis = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  record.events = log.GetEvents(&record.droppedEvents);
+
+  lock_guard<mutex> lock(mMutex);
+  if (mCapacity == 0)
+    return record;
+  if (mRecords.size() >= mCapacity) {
+    mRecords.pop_front();
+    ++mDropped;
+  }
+  mRecords.push_back(record);
+  return record;
+}
+
+string SlowOperationRecorder::TakeJSON() {
+  std::deque<Record> records;
+  uint64_t dropped;
+  {
+    lock_guard<mutex> lock(mMutex);
+    records.swap(mRecords);
+    dropped = mDropped;
+    mDropped = 0;
+  }
+  JsonWriter json;
+  json.BeginObject().Key("operations").BeginArray();
+  for (const auto& record : records)
+    WriteRecord(json, record);
+  json.EndArray().Key("dropped").UInt(dropped).EndObject();
+  return json.Take();
+}
+
+string SlowOperationRecorder::Summarize(const Record& record) {
+  string summary = "Slow " + record.operation + " of " + record.path + " took " +
+      std::to_string(record.durationMicros / 1000) + " ms (" + (record.succeeded ? "succeeded" : "failed");
+  if (!record.format.empty())
+    summary += ", " + record.format;
+  if (record.sizeBytes >= 0)
+    summary += ", " + std::to_string(record.sizeBytes) + " bytes";
+  summary += ")";
+
+  vector<const OperationLog::Event*> slowest;
+  for (const auto& event : record.events) {
+    if (event.durationMicros >= 0)
+      slowest.push_back(&event);
+  }
+  const size_t count = std::min(slowest.size(), kSummaryEvents);
+  std::partial_sort(slowest.begin(), slowest.begin() + count, slowest.end(),
+      [](const OperationLog::Event* a, const OperationLog::Event* b) { return a->durationMicros > b->durationMicros; });
+  for (size_t i = 0; i < count; ++i) {
+    const auto& event = *slowest[i];
+    summary += (i == 0 ? "; slowest: " : ", ") + event.kind + " " + event.name + " " + std::to_string(event.durationMicros / 1000) + " ms";
+    if (!event.detail.empty())
+      summary += " (" + event.detail + ")";
+  }
+  return summary;
+}
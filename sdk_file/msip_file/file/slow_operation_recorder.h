@@ -0,0 +1,93 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_SLOW_OPERATION_RECORDER_H_
+#define SAMPLE_FILE_SLOW_OPERATION_RECORDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "operation_log.h"
+
+// Keeps what happened during the most recent protect and unprotect operations that ran longer than a
+// threshold: the phases, HTTP requests and cache lookups their operation log collected, along with the
+// file they worked on. Operations are only logged while a threshold is set, so a disabled recorder costs
+// one relaxed load per operation.
+class SlowOperationRecorder final {
+public:
+  struct Record {
+    std::string operation;
+    std::string path;
+    std::string format;    // The path's extension, lower-cased, without the dot.
+    int64_t sizeBytes;     // -1 when the path is not a file, e.g. a stream's name hint.
+    bool succeeded;
+    int64_t durationMicros;
+    int64_t unixMillis;    // When the operation ended.
+    std::vector<sample::oplog::OperationLog::Event> events;
+    uint64_t droppedEvents;
+  };
+
+  static SlowOperationRecorder& Instance();
+
+  // Keeps up to capacity operations of at least thresholdMillis; a threshold of 0 stops recording.
+  void Configure(int64_t thresholdMillis, size_t capacity);
+
+  // 0 while disabled.
+  int64_t GetThresholdMicros() const { return mThresholdMicros.load(std::memory_order_relaxed); }
+
+  // Builds the record of an operation log past the threshold, stats path for its size, and keeps it,
+  // dropping the oldest one when full.
+  Record Add(
+      const std::string& operation,
+      const std::string& path,
+      bool succeeded,
+      const sample::oplog::OperationLog& log,
+      sample::oplog::OperationLog::Clock::time_point end);
+
+  // {"operations":[...],"dropped":n}: the kept operations, oldest first, which are removed, and how many
+  // were dropped since the last call because the buffer was full.
+  std::string TakeJSON();
+
+  // One line for the log: the operation, its duration and its slowest events.
+  static std::string Summarize(const Record& record);
+
+private:
+  SlowOperationRecorder();
+
+  std::atomic<int64_t> mThresholdMicros;
+  std::mutex mMutex;
+  size_t mCapacity;
+  std::deque<Record> mRecords;
+  uint64_t mDropped;
+};
+
+#endif // SAMPLE_FILE_SLOW_OPERATION_RECORDER_H_
@@ -0,0 +1,295 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "staged_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <semaphore.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <thread>
+
+#include "cost_account.h"
+#include "mpmc_ring.h"
+#include "protection_token_context.h"
+#include "request_deadline.h"
+#include "tenant_context.h"
+#include "work_priority.h"
+
+using sample::queue::MpmcRing;
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Bounds each queue's semaphore count.
+const size_t kMaxCapacity = 1 << 16;
+
+uint64_t MicrosBetween(Clock::time_point start, Clock::time_point end) {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+}
+
+void Wait(sem_t* semaphore) {
+  while (sem_wait(semaphore) != 0 && errno == EINTR) {}
+}
+
+// The queue in front of a stage. The ring holds item indexes; mItems counts the items that can be taken
+// and mSpaces the room left, so producers wait when the stage falls behind and workers when it has no work.
+class StageQueue final {
+public:
+  explicit StageQueue(size_t capacity)
+    : mRing(capacity),
+      mStopped(false),
+      mQueued(0),
+      mMaxQueued(0),
+      mQueuedSum(0),
+      mSamples(0) {
+    sem_init(&mItems, 0, 0);
+    sem_init(&mSpaces, 0, static_cast<unsigned int>(capacity));
+  }
+
+  ~StageQueue() {
+    sem_destroy(&mItems);
+    sem_destroy(&mSpaces);
+  }
+
+  StageQueue(const StageQueue&) = delete;
+  StageQueue& operator=(const StageQueue&) = delete;
+
+  void Push(size_t item) {
+    Wait(&mSpaces);
+    // The room mSpaces granted can still be held by a pop that has not finished; it is released shortly.
+    while (!mRing.TryPush(item))
+      std::this_thread::yield();
+    const size_t queued = ++mQueued;
+    size_t max = mMaxQueued.load(std::memory_order_relaxed);
+    while (queued > max && !mMaxQueued.compare_exchange_weak(max, queued, std::memory_order_relaxed)) {}
+    mQueuedSum.fetch_add(queued, std::memory_order_relaxed);
+    mSamples.fetch_add(1, std::memory_order_relaxed);
+    sem_post(&mItems);
+  }
+
+  // Waits for an item. false once the queue is stopped.
+  bool Pop(size_t& item) {
+    Wait(&mItems);
+    if (mStopped.load(std::memory_order_acquire))
+      return false;
+    // An item pushed after one whose push is still finishing waits for it.
+    while (!mRing.TryPop(item))
+      std::this_thread::yield();
+    --mQueued;
+    sem_post(&mSpaces);
+    return true;
+  }
+
+  // Wakes waiting workers to exit. Only called once every item has finished, so nothing is queued.
+  void Stop(size_t workers) {
+    mStopped.store(true, std::memory_order_release);
+    for (size_t i = 0; i < workers; ++i)
+      sem_post(&mItems);
+  }
+
+  size_t MaxQueued() const { return mMaxQueued.load(); }
+
+  double MeanQueued() const {
+    const uint64_t samples = mSamples.load();
+    return samples ? static_cast<double>(mQueuedSum.load()) / samples : 0;
+  }
+
+private:
+  MpmcRing<size_t> mRing;
+  sem_t mItems;
+  sem_t mSpaces;
+  std::atomic<bool> mStopped;
+  std::atomic<size_t> mQueued;
+  std::atomic<size_t> mMaxQueued;
+  std::atomic<uint64_t> mQueuedSum;
+  std::atomic<uint64_t> mSamples;
+};
+
+// The ring's positions are over-aligned, which new only honours from C++17 on.
+struct StageQueueDeleter {
+  void operator()(StageQueue* queue) const {
+    queue->~StageQueue();
+    free(queue);
+  }
+};
+typedef std::unique_ptr<StageQueue, StageQueueDeleter> StageQueuePtr;
+
+StageQueuePtr NewStageQueue(size_t capacity) {
+  void* memory = nullptr;
+  if (posix_memalign(&memory, alignof(StageQueue), sizeof(StageQueue)) != 0)
+    throw std::bad_alloc();
+  try {
+    return StageQueuePtr(new (memory) StageQueue(capacity));
+  }
+  catch (...) {
+    free(memory);
+    throw;
+  }
+}
+
+struct StageCounters {
+  StageCounters() : processed(0), busyMicros(0), idleMicros(0), blockedMicros(0) {}
+
+  std::atomic<uint64_t> processed;
+  std::atomic<uint64_t> busyMicros;
+  std::atomic<uint64_t> idleMicros;
+  std::atomic<uint64_t> blockedMicros;
+};
+
+} // namespace
+
+StagedPipeline::StagedPipeline(vector<Stage> stages) : mStages(std::move(stages)) {
+  for (auto& stage : mStages) {
+    if (!stage.step)
+      throw std::invalid_argument("Pipeline stage " + stage.name + " has no step");
+    stage.workers = std::max<size_t>(stage.workers, 1);
+    stage.capacity = std::min(std::max<size_t>(stage.capacity, 1), kMaxCapacity);
+  }
+}
+
+StagedPipeline::Stats StagedPipeline::Run(size_t count, const std::function<void(size_t item)>& finished) {
+  Stats stats;
+  stats.items = count;
+  stats.elapsedMicros = 0;
+  const auto start = Clock::now();
+  const size_t stageCount = mStages.size();
+  vector<StageQueuePtr> queues;
+  vector<size_t> workers(stageCount);
+  for (size_t s = 0; s < stageCount; ++s) {
+    queues.push_back(NewStageQueue(mStages[s].capacity));
+    workers[s] = count ? std::min(mStages[s].workers, count) : 0;
+  }
+  std::unique_ptr<StageCounters[]> counters(new StageCounters[stageCount]);
+
+  std::atomic<size_t> remaining(count);
+  std::mutex doneMutex;
+  std::condition_variable doneCondition;
+  bool done = false;
+  auto finish = [&](size_t item) {
+    finished(item);
+    if (remaining.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(doneMutex);
+      done = true;
+      doneCondition.notify_all();
+    }
+  };
+
+  const auto deadline = sample::deadline::Deadline::Current();
+  const string tenant = sample::tenant::Current();
+  const auto priority = sample::priority::Current();
+  const auto costKey = sample::cost::CurrentKey();
+  const auto protectionToken = sample::token::Current();
+  auto work = [&](size_t s) {
+    sample::deadline::ScopedDeadline deadlineScope(deadline);
+    sample::tenant::ScopedTenant tenantScope(tenant);
+    sample::priority::ScopedPriority priorityScope(priority);
+    sample::cost::ScopedKey costScope(costKey);
+    sample::token::ScopedToken tokenScope(protectionToken);
+    uint64_t processed = 0, busy = 0, idle = 0, blocked = 0;
+    auto waited = Clock::now();
+    size_t item;
+    while (queues[s]->Pop(item)) {
+      const auto popped = Clock::now();
+      idle += MicrosBetween(waited, popped);
+      const bool next = mStages[s].step(item);
+      waited = Clock::now();
+      busy += MicrosBetween(popped, waited);
+      ++processed;
+      if (next && s + 1 < stageCount) {
+        queues[s + 1]->Push(item);
+        const auto pushed = Clock::now();
+        blocked += MicrosBetween(waited, pushed);
+        waited = pushed;
+      } else {
+        finish(item);
+      }
+    }
+    counters[s].processed += processed;
+    counters[s].busyMicros += busy;
+    counters[s].idleMicros += idle;
+    counters[s].blockedMicros += blocked;
+  };
+
+  vector<std::thread> threads;
+  if (count && stageCount) {
+    for (size_t s = 0; s < stageCount; ++s) {
+      for (size_t w = 0; w < workers[s]; ++w)
+        threads.emplace_back(work, s);
+    }
+    for (size_t i = 0; i < count; ++i)
+      queues[0]->Push(i);
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&done]() { return done; });
+  } else {
+    for (size_t i = 0; i < count; ++i)
+      finished(i);
+  }
+  for (size_t s = 0; s < stageCount; ++s)
+    queues[s]->Stop(workers[s]);
+  for (auto& thread : threads)
+    thread.join();
+
+  stats.elapsedMicros = MicrosBetween(start, Clock::now());
+  for (size_t s = 0; s < stageCount; ++s) {
+    StageStats stage;
+    stage.name = mStages[s].name;
+    stage.workers = workers[s];
+    stage.capacity = mStages[s].capacity;
+    stage.processed = counters[s].processed;
+    stage.busyMicros = counters[s].busyMicros;
+    stage.idleMicros = counters[s].idleMicros;
+    stage.blockedMicros = counters[s].blockedMicros;
+    stage.maxQueued = queues[s]->MaxQueued();
+    stage.meanQueued = queues[s]->MeanQueued();
+    stats.stages.push_back(std::move(stage));
+  }
+  return stats;
+}
+
+string StagedPipeline::Bottleneck(const Stats& stats) {
+  string bottleneck;
+  double highest = -1;
+  for (const auto& stage : stats.stages) {
+    const double available = static_cast<double>(std::max<size_t>(stage.workers, 1)) * std::max<uint64_t>(stats.elapsedMicros, 1);
+    const double utilization = stage.busyMicros / available;
+    if (utilization > highest) {
+      highest = utilization;
+      bottleneck = stage.name;
+    }
+  }
+  return bottleneck;
+}
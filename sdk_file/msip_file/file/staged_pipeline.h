@@ -0,0 +1,96 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_STAGED_PIPELINE_H_
+#define SAMPLE_FILE_STAGED_PIPELINE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs the items of a batch through a sequence of stages, such as read, open, license, transform and
+// commit, each with its own workers and a bounded lock-free queue in front of it (see MpmcRing). While one
+// item waits on the network in a slow stage, the workers of the other stages read, decrypt and write the
+// next ones. A stage whose next queue is full waits for room, so a slow stage holds back the ones before it
+// instead of letting finished work pile up. The stats say where the batch spent its time: the bottleneck is
+// the stage whose workers are busiest and whose queue stays full.
+class StagedPipeline final {
+public:
+  // Runs item through the stage. false when the item is finished, e.g. because it failed, and skips the
+  // stages after it. Must not throw.
+  typedef std::function<bool(size_t item)> Step;
+
+  struct Stage {
+    std::string name;
+    size_t workers;
+    // Items the queue in front of the stage holds.
+    size_t capacity;
+    Step step;
+  };
+
+  struct StageStats {
+    std::string name;
+    size_t workers;
+    size_t capacity;
+    uint64_t processed;
+    // Summed over the stage's workers: running the step, waiting for an item, and waiting for room in the
+    // next stage's queue.
+    uint64_t busyMicros;
+    uint64_t idleMicros;
+    uint64_t blockedMicros;
+    // Items in the stage's queue, sampled whenever one is added.
+    size_t maxQueued;
+    double meanQueued;
+  };
+
+  struct Stats {
+    uint64_t items;
+    uint64_t elapsedMicros;
+    std::vector<StageStats> stages;
+  };
+
+  // Stages without workers get one; capacities are at least one item.
+  explicit StagedPipeline(std::vector<Stage> stages);
+
+  StagedPipeline(const StagedPipeline&) = delete;
+  StagedPipeline& operator=(const StagedPipeline&) = delete;
+
+  // Runs items [0, count) through the stages and returns once every one finished. finished(i) is called
+  // once per item, on the worker of the stage it left the pipeline from; it must not throw. The caller's
+  // deadline, tenant, priority and protection token apply to every step. The calling thread feeds the first queue.
+  Stats Run(size_t count, const std::function<void(size_t item)>& finished);
+
+  // Name of the stage whose workers were busy the largest share of the batch, empty without stages.
+  static std::string Bottleneck(const Stats& stats);
+
+private:
+  std::vector<Stage> mStages;
+};
+
+#endif  // SAMPLE_FILE_STAGED_PIPELINE_H_
@@ -0,0 +1,85 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "status_records.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+void AppendString(std::string& strings, const std::string& value, StatusRecords::StringRef& ref) {
+  ref.offset = static_cast<uint32_t>(strings.size());
+  ref.length = static_cast<uint32_t>(value.size());
+  strings += value;
+}
+
+}  // namespace
+
+std::string StatusRecords::Encode(const std::vector<Fields>& items) {
+  size_t stringsSize = 0;
+  for (const auto& item : items) {
+    stringsSize += item.path.size() + item.error.size() + item.labelId.size() + item.owner.size()
+        + item.contentId.size() + item.templateId.size() + item.templateName.size();
+  }
+  const size_t stringsOffset = sizeof(Header) + items.size() * sizeof(Record);
+  if (stringsOffset + stringsSize > std::numeric_limits<uint32_t>::max())
+    throw std::length_error("Status records exceed 4 GiB");
+
+  std::vector<Record> records(items.size());
+  std::string strings;
+  strings.reserve(stringsSize);
+  for (size_t i = 0; i < items.size(); ++i) {
+    const auto& item = items[i];
+    auto& record = records[i];
+    memset(&record, 0, sizeof(record));
+    record.status = item.status ? 1 : 0;
+    record.flags = item.flags;
+    record.issuedTime = item.issuedTime;
+    AppendString(strings, item.path, record.path);
+    AppendString(strings, item.error, record.error);
+    AppendString(strings, item.labelId, record.labelId);
+    AppendString(strings, item.owner, record.owner);
+    AppendString(strings, item.contentId, record.contentId);
+    AppendString(strings, item.templateId, record.templateId);
+    AppendString(strings, item.templateName, record.templateName);
+  }
+
+  Header header;
+  memcpy(header.magic, "MSR1", sizeof(header.magic));
+  header.count = static_cast<uint32_t>(items.size());
+  header.recordSize = sizeof(Record);
+  header.stringsOffset = static_cast<uint32_t>(stringsOffset);
+
+  std::string result;
+  result.reserve(stringsOffset + strings.size());
+  result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!records.empty())
+    result.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+  result += strings;
+  return result;
+}
@@ -0,0 +1,109 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_STATUS_RECORDS_H_
+#define SAMPLE_FILE_STATUS_RECORDS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compact binary encoding of file status results, an alternative to JSON for batches large enough that
+// encoding and decoding text across the library boundary shows up as CPU time. A result is a Header, then
+// Header::count fixed-size Records, then a table of UTF-8 strings that records refer to by offset and
+// length. Every field is in host byte order, which is little-endian on the supported platforms, and the
+// structs have no implicit padding, so a reader can map them in place, e.g. with ctypes from_buffer over a
+// memoryview, without copying or parsing. Strings are not NUL-terminated.
+//
+// Version 1 layout:
+//   Header (16 bytes)   magic "MSR1", count, recordSize, stringsOffset
+//   Record (72 bytes)   status, flags, reserved, issuedTime, then seven StringRefs: path, error, labelId,
+//                       owner, contentId, templateId, templateName
+class StatusRecords {
+public:
+  enum Flags : uint8_t {
+    kProtected = 1 << 0,
+    kLabeled = 1 << 1,
+    kProtectedObjects = 1 << 2,
+    // The owner, content, template and issued time fields were read from the publishing license.
+    kLicense = 1 << 3,
+  };
+
+  struct StringRef {
+    uint32_t offset;  // From the start of the string table.
+    uint32_t length;
+  };
+
+  struct Header {
+    char magic[4];
+    uint32_t count;
+    // sizeof(Record), so readers can tell when the layout has grown.
+    uint32_t recordSize;
+    // From the start of the result to the string table.
+    uint32_t stringsOffset;
+  };
+
+  struct Record {
+    uint8_t status;  // 1 when the file was inspected, 0 when error says why not.
+    uint8_t flags;
+    uint16_t reserved0;
+    uint32_t reserved1;
+    int64_t issuedTime;  // Seconds since the epoch, 0 without a license.
+    StringRef path;
+    StringRef error;
+    StringRef labelId;
+    StringRef owner;
+    StringRef contentId;
+    StringRef templateId;
+    StringRef templateName;
+  };
+
+  // One result before encoding.
+  struct Fields {
+    Fields() : status(false), flags(0), issuedTime(0) {}
+
+    bool status;
+    uint8_t flags;
+    int64_t issuedTime;
+    std::string path;
+    std::string error;
+    std::string labelId;
+    std::string owner;
+    std::string contentId;
+    std::string templateId;
+    std::string templateName;
+  };
+
+  // Throws std::length_error when the strings do not fit the 32-bit offsets.
+  static std::string Encode(const std::vector<Fields>& items);
+};
+
+static_assert(sizeof(StatusRecords::Header) == 16, "StatusRecords::Header layout is part of the ABI");
+static_assert(sizeof(StatusRecords::Record) == 72, "StatusRecords::Record layout is part of the ABI");
+
+#endif  // SAMPLE_FILE_STATUS_RECORDS_H_
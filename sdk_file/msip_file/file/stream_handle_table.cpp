@@ -0,0 +1,115 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "stream_handle_table.h"
+
+#include <stdexcept>
+
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::shared_ptr;
+using std::unordered_map;
+using mip::Stream;
+
+StreamHandleTable::StreamHandleTable()
+    : mNextHandle(1) {
+}
+
+StreamHandleTable::Handle StreamHandleTable::Open(const shared_ptr<Stream>& stream, const shared_ptr<void>& owner) {
+  if (!stream)
+    throw std::invalid_argument("Stream must not be null");
+  auto entry = make_shared<Entry>();
+  entry->stream = stream;
+  entry->owner = owner;
+
+  lock_guard<mutex> lock(mMutex);
+  const auto handle = mNextHandle++;
+  mEntries.emplace(handle, entry);
+  return handle;
+}
+
+int64_t StreamHandleTable::Read(Handle handle, uint8_t* buffer, int64_t length) {
+  if (length < 0 || (length > 0 && buffer == nullptr))
+    throw std::invalid_argument("Buffer must be non-null with a non-negative length");
+  auto entry = Find(handle);
+  // The stream is read outside the table lock, so a slow read never holds up other handles.
+  lock_guard<mutex> lock(entry->mutex);
+  if (!entry->stream)
+    throw std::invalid_argument("Stream handle is not open");
+  return entry->stream->Read(buffer, length);
+}
+
+int64_t StreamHandleTable::Size(Handle handle) {
+  auto entry = Find(handle);
+  lock_guard<mutex> lock(entry->mutex);
+  if (!entry->stream)
+    throw std::invalid_argument("Stream handle is not open");
+  return entry->stream->Size();
+}
+
+bool StreamHandleTable::Close(Handle handle) {
+  shared_ptr<Entry> entry;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mEntries.find(handle);
+    if (it == mEntries.end())
+      return false;
+    entry = it->second;
+    mEntries.erase(it);
+  }
+  // Waits for a read in flight, then releases the stream and its owner outside the table lock.
+  lock_guard<mutex> lock(entry->mutex);
+  entry->stream.reset();
+  entry->owner.reset();
+  return true;
+}
+
+size_t StreamHandleTable::Count() const {
+  lock_guard<mutex> lock(mMutex);
+  return mEntries.size();
+}
+
+void StreamHandleTable::Clear() {
+  unordered_map<Handle, shared_ptr<Entry>> entries;
+  {
+    lock_guard<mutex> lock(mMutex);
+    entries.swap(mEntries);
+  }
+  for (auto& entry : entries) {
+    lock_guard<mutex> lock(entry.second->mutex);
+    entry.second->stream.reset();
+    entry.second->owner.reset();
+  }
+}
+
+shared_ptr<StreamHandleTable::Entry> StreamHandleTable::Find(Handle handle) const {
+  lock_guard<mutex> lock(mMutex);
+  auto it = mEntries.find(handle);
+  if (it == mEntries.end())
+    throw std::invalid_argument("Stream handle is not open");
+  return it->second;
+}
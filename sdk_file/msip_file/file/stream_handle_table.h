@@ -0,0 +1,77 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_STREAM_HANDLE_TABLE_H_
+#define SAMPLE_FILE_STREAM_HANDLE_TABLE_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "mip/stream.h"
+
+// Open mip::Streams handed to callers of the C ABI as opaque handles, so content can be read in chunks
+// without being committed to disk or held in memory. Each stream keeps its owner (e.g. the FileHandler
+// that decrypts it) alive until it is closed. Reads on one handle are serialized; handles are independent.
+class StreamHandleTable final {
+public:
+  // Zero is never issued, so callers can use it as "no handle".
+  typedef uint64_t Handle;
+
+  StreamHandleTable();
+
+  Handle Open(const std::shared_ptr<mip::Stream>& stream, const std::shared_ptr<void>& owner);
+
+  // Reads up to length bytes from the stream's current position. Returns 0 at the end of the stream.
+  // Throws std::invalid_argument for a handle that is not open.
+  int64_t Read(Handle handle, uint8_t* buffer, int64_t length);
+
+  int64_t Size(Handle handle);
+
+  // Returns false when the handle was not open.
+  bool Close(Handle handle);
+
+  size_t Count() const;
+
+  // Closes every stream. Called before the engines their owners belong to are unloaded.
+  void Clear();
+
+private:
+  struct Entry {
+    std::shared_ptr<mip::Stream> stream;
+    std::shared_ptr<void> owner;
+    std::mutex mutex;
+  };
+
+  std::shared_ptr<Entry> Find(Handle handle) const;
+
+  mutable std::mutex mMutex;
+  Handle mNextHandle;
+  std::unordered_map<Handle, std::shared_ptr<Entry>> mEntries;
+};
+
+#endif // SAMPLE_FILE_STREAM_HANDLE_TABLE_H_
@@ -30,6 +30,7 @@
 #include <stdexcept>
 #include <vector>
 
+using std::shared_ptr;
 using std::vector;
 
 #ifdef _WIN32
@@ -39,24 +40,42 @@ using std::vector;
 #endif // _WIN32
 
 StreamOverBuffer::StreamOverBuffer(vector<uint8_t>&& buffer, const int64_t end)
-    : mBuffer(buffer),
-      mSize(static_cast<uint64_t>(buffer.size())),
+    : mBuffer(std::move(buffer)),
+      mData(mBuffer.data()),
+      mIsWritable(true),
+      mSize(static_cast<int64_t>(mBuffer.size())),
       mPosition(0) {
         mEnd = end < 0 ? mSize : end;
 }
 
+StreamOverBuffer::StreamOverBuffer(const uint8_t* data, int64_t size)
+    : mData(data),
+      mIsWritable(false),
+      mSize(size),
+      mPosition(0),
+      mEnd(size) {
+  if (size < 0 || (size > 0 && data == nullptr))
+    throw std::invalid_argument("Buffer must be non-null with a non-negative size.");
+}
+
+StreamOverBuffer::StreamOverBuffer(const shared_ptr<const uint8_t>& data, int64_t size)
+    : StreamOverBuffer(data.get(), size) {
+  mSharedData = data;
+}
+
 StreamOverBuffer::~StreamOverBuffer() { }
 
 int64_t StreamOverBuffer::Read(uint8_t* buffer, int64_t bufferLength) {
   auto bytesRead = mPosition + bufferLength <= mSize ? bufferLength : mSize - mPosition;
   if (bytesRead) {
-    MEMCPY(buffer, static_cast<size_t>(bufferLength), &mBuffer[static_cast<size_t>(mPosition)], static_cast<size_t>(bytesRead));
+    MEMCPY(buffer, static_cast<size_t>(bufferLength), mData + mPosition, static_cast<size_t>(bytesRead));
     mPosition += bytesRead;
   }
   return bytesRead;
 }
 
 int64_t StreamOverBuffer::Write(const uint8_t* buffer, int64_t bufferLength) {
+  if (!mIsWritable) throw std::runtime_error("Stream is read-only.");
   const auto bytesWritten = mPosition + bufferLength <= mSize ? bufferLength : mSize - mPosition;
   if (bytesWritten) {
     MEMCPY(&mBuffer[static_cast<size_t>(mPosition)], static_cast<size_t>(mSize - mPosition), buffer, static_cast<size_t>(bytesWritten));
@@ -77,7 +96,7 @@ void StreamOverBuffer::Seek(int64_t position) {
 
 bool StreamOverBuffer::CanRead() const { return true; }
 
-bool StreamOverBuffer::CanWrite() const { return true; }
+bool StreamOverBuffer::CanWrite() const { return mIsWritable; }
 
 int64_t StreamOverBuffer::Position() { return mPosition; }
 
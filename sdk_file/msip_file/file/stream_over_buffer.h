@@ -28,12 +28,17 @@
 #ifndef SAMPLE_STREAM_OVER_BUFFER_H_
 #define SAMPLE_STREAM_OVER_BUFFER_H_
 
+#include <memory>
 #include <vector>
 #include "mip/stream.h"
 
 class StreamOverBuffer final : public mip::Stream {
 public:
   StreamOverBuffer(std::vector<uint8_t>&& memory, const int64_t end = -1);
+  // Reads caller-owned memory in place. The stream is read-only and data must outlive it.
+  StreamOverBuffer(const uint8_t* data, int64_t size);
+  // Reads memory kept alive by data, which may be shared with other streams. The stream is read-only.
+  StreamOverBuffer(const std::shared_ptr<const uint8_t>& data, int64_t size);
   ~StreamOverBuffer();
   int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
   int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
@@ -47,6 +52,9 @@ public:
 
 private:
   std::vector<uint8_t> mBuffer;
+  std::shared_ptr<const uint8_t> mSharedData;
+  const uint8_t* mData;
+  bool mIsWritable;
   int64_t mSize;
   int64_t mPosition;
   int64_t mEnd;
@@ -0,0 +1,195 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "temp_file_pool.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using sample::lock::InstrumentedMutex;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace {
+
+string ErrnoMessage(const string& what, const string& directory) {
+  return what + " in " + directory + ": " + strerror(errno);
+}
+
+} // namespace
+
+TempFilePool::File::File(File&& other)
+    : mPool(other.mPool), mFd(other.mFd), mGeneration(other.mGeneration), mPooled(other.mPooled) {
+  other.mFd = -1;
+}
+
+TempFilePool::File& TempFilePool::File::operator=(File&& other) {
+  if (this != &other) {
+    Reset();
+    mPool = other.mPool;
+    mFd = other.mFd;
+    mGeneration = other.mGeneration;
+    mPooled = other.mPooled;
+    other.mFd = -1;
+  }
+  return *this;
+}
+
+void TempFilePool::File::Reset() {
+  if (mFd < 0)
+    return;
+  if (mPooled)
+    mPool->Release(mFd, mGeneration);
+  else
+    close(mFd);
+  mFd = -1;
+}
+
+TempFilePool& TempFilePool::Shared() {
+  // Leaked, so files released by other statics' destructors still find it.
+  static TempFilePool* pool = new TempFilePool();
+  return *pool;
+}
+
+TempFilePool::TempFilePool()
+    : mGeneration(0),
+      mAcquired(0),
+      mReused(0),
+      mCreated(0),
+      mFallbacks(0) {
+  mOptions.poolSize = 0;
+  mOptions.maxFileBytes = 0;
+}
+
+int TempFilePool::Open(const string& directory) {
+  int fd;
+#ifdef O_TMPFILE
+  fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0)
+    return fd;
+  // Filesystems without O_TMPFILE support report one of these; anything else is the directory's fault.
+  if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+    throw std::runtime_error(ErrnoMessage("Failed to open a temporary file", directory));
+#endif
+  string path = directory + "/msip-XXXXXX";
+  fd = mkostemp(&path[0], O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error(ErrnoMessage("Failed to create a temporary file", directory));
+  unlink(path.c_str());
+  return fd;
+}
+
+void TempFilePool::Configure(const Options& options) {
+  std::vector<int> opened;
+  if (!options.directory.empty()) {
+    try {
+      // One file is opened even for an empty pool, so a bad directory fails here rather than on first use.
+      for (size_t i = 0; i < (options.poolSize > 0 ? options.poolSize : 1); ++i)
+        opened.push_back(Open(options.directory));
+    } catch (...) {
+      for (int fd : opened)
+        close(fd);
+      throw;
+    }
+    if (options.poolSize == 0) {
+      close(opened.back());
+      opened.clear();
+    }
+  }
+
+  std::vector<int> previous;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    mOptions = options;
+    ++mGeneration;
+    previous.swap(mFree);
+    mFree.swap(opened);
+  }
+  for (int fd : previous)
+    close(fd);
+}
+
+TempFilePool::File TempFilePool::Acquire(int64_t expectedSize) {
+  ++mAcquired;
+  string fallbackDirectory;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    const bool fits = mOptions.maxFileBytes <= 0 || expectedSize <= mOptions.maxFileBytes;
+    if (!mOptions.directory.empty() && fits) {
+      const uint64_t generation = mGeneration;
+      if (!mFree.empty()) {
+        const int fd = mFree.back();
+        mFree.pop_back();
+        ++mReused;
+        return File(this, fd, generation, true);
+      }
+      ++mCreated;
+      // Opened under the lock, so a concurrent Configure cannot pair the file with the new generation.
+      return File(this, Open(mOptions.directory), generation, true);
+    }
+    fallbackDirectory = mOptions.fallbackDirectory.empty() ? P_tmpdir : mOptions.fallbackDirectory;
+  }
+  ++mFallbacks;
+  return File(this, Open(fallbackDirectory), 0, false);
+}
+
+void TempFilePool::Release(int fd, uint64_t generation) {
+  // Truncating frees the content's pages; the file itself stays open for the next caller.
+  const bool reusable = ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0;
+  {
+    lock_guard<InstrumentedMutex> lock(mMutex);
+    if (reusable && generation == mGeneration && mFree.size() < mOptions.poolSize) {
+      mFree.push_back(fd);
+      return;
+    }
+  }
+  close(fd);
+}
+
+bool TempFilePool::IsEnabled() {
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  return !mOptions.directory.empty();
+}
+
+TempFilePool::Stats TempFilePool::GetStats() {
+  Stats stats;
+  stats.acquired = mAcquired;
+  stats.reused = mReused;
+  stats.created = mCreated;
+  stats.fallbacks = mFallbacks;
+  lock_guard<InstrumentedMutex> lock(mMutex);
+  stats.free = mFree.size();
+  stats.poolSize = mOptions.poolSize;
+  stats.enabled = !mOptions.directory.empty();
+  return stats;
+}
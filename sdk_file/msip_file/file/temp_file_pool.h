@@ -0,0 +1,135 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_TEMP_FILE_POOL_H_
+#define SAMPLE_FILE_TEMP_FILE_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "instrumented_mutex.h"
+
+// Anonymous temporary files for decrypted content, in a directory meant to be a tmpfs. Files are opened
+// with O_TMPFILE, so they have no name to create, look up or unlink, and the pool keeps a set of them open:
+// a released file is truncated and handed to the next caller instead of being closed. Where O_TMPFILE is not
+// supported, a file is created with mkstemp and unlinked at once. Files expected to be larger than
+// maxFileBytes, or any file while no directory is configured, go to the fallback directory on disk instead,
+// so a large decrypt cannot fill the tmpfs.
+class TempFilePool final {
+public:
+  struct Options {
+    // Directory of pooled files. Empty disables the pool.
+    std::string directory;
+    // Files opened when configured and kept open for reuse.
+    size_t poolSize;
+    // Largest expected size served from directory, 0 for any size.
+    int64_t maxFileBytes;
+    // Directory of the other files, P_tmpdir when empty.
+    std::string fallbackDirectory;
+  };
+
+  // An open temporary file, returned to its pool on destruction.
+  class File final {
+  public:
+    File() : mPool(nullptr), mFd(-1), mGeneration(0), mPooled(false) {}
+    File(File&& other);
+    File& operator=(File&& other);
+    ~File() { Reset(); }
+
+    int Fd() const { return mFd; }
+    // Whether the file is in the pool's directory rather than the fallback directory.
+    bool IsPooled() const { return mPooled; }
+    explicit operator bool() const { return mFd >= 0; }
+
+    // Truncates the file and returns it to the pool, or closes it when the pool is full or was reconfigured.
+    void Reset();
+
+  private:
+    friend class TempFilePool;
+    File(TempFilePool* pool, int fd, uint64_t generation, bool pooled)
+        : mPool(pool), mFd(fd), mGeneration(generation), mPooled(pooled) {}
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    TempFilePool* mPool;
+    int mFd;
+    uint64_t mGeneration;
+    bool mPooled;
+  };
+
+  struct Stats {
+    uint64_t acquired;
+    // Acquisitions served with a recycled file.
+    uint64_t reused;
+    // Files opened in the pool's directory because none was free.
+    uint64_t created;
+    // Acquisitions sent to the fallback directory.
+    uint64_t fallbacks;
+    size_t free;
+    size_t poolSize;
+    bool enabled;
+  };
+
+  static TempFilePool& Shared();
+
+  // Closes the free files of the previous configuration and opens poolSize files in the new directory.
+  // Throws std::runtime_error, keeping the previous configuration, when the directory cannot hold them.
+  void Configure(const Options& options);
+
+  // A file for content of about expectedSize bytes, -1 when unknown. Throws std::runtime_error.
+  File Acquire(int64_t expectedSize);
+
+  bool IsEnabled();
+
+  Stats GetStats();
+
+private:
+  TempFilePool();
+  TempFilePool(const TempFilePool&) = delete;
+  TempFilePool& operator=(const TempFilePool&) = delete;
+
+  // Opens an anonymous read-write file in directory. Throws std::runtime_error.
+  static int Open(const std::string& directory);
+
+  void Release(int fd, uint64_t generation);
+
+  sample::lock::InstrumentedMutex mMutex{"temp_file_pool"};
+  Options mOptions;
+  // Incremented by Configure, so files of an earlier configuration are closed instead of recycled.
+  uint64_t mGeneration;
+  std::vector<int> mFree;
+  std::atomic<uint64_t> mAcquired;
+  std::atomic<uint64_t> mReused;
+  std::atomic<uint64_t> mCreated;
+  std::atomic<uint64_t> mFallbacks;
+};
+
+#endif // SAMPLE_FILE_TEMP_FILE_POOL_H_
@@ -0,0 +1,116 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "temp_file_stream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+string ErrnoMessage(const string& what) {
+  return what + ": " + strerror(errno);
+}
+
+} // namespace
+
+TempFileStream::TempFileStream(TempFilePool::File&& file)
+    : mFile(std::move(file)),
+      mPosition(0),
+      mSize(0) {
+  if (!mFile)
+    throw runtime_error("Invalid temporary file");
+}
+
+int64_t TempFileStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  const int64_t count = bufferLength < mSize - mPosition ? bufferLength : mSize - mPosition;
+  int64_t done = 0;
+  while (done < count) {
+    const ssize_t read = pread(mFile.Fd(), buffer + done, static_cast<size_t>(count - done), static_cast<off_t>(mPosition + done));
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read < 0)
+      throw runtime_error(ErrnoMessage("Failed to read temporary file"));
+    if (read == 0)
+      break;
+    done += read;
+  }
+  mPosition += done;
+  return done;
+}
+
+int64_t TempFileStream::Write(const uint8_t* buffer, int64_t bufferLength) {
+  int64_t written = 0;
+  while (written < bufferLength) {
+    const ssize_t count = pwrite(mFile.Fd(), buffer + written, static_cast<size_t>(bufferLength - written), static_cast<off_t>(mPosition));
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw runtime_error(ErrnoMessage("Failed to write temporary file"));
+    written += count;
+    mPosition += count;
+  }
+  if (mPosition > mSize)
+    mSize = mPosition;
+  return written;
+}
+
+bool TempFileStream::Flush() {
+  // Temporary content is never meant to reach the disk.
+  return true;
+}
+
+void TempFileStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  mPosition = position;
+}
+
+bool TempFileStream::CanRead() const { return true; }
+
+bool TempFileStream::CanWrite() const { return true; }
+
+int64_t TempFileStream::Position() { return mPosition; }
+
+int64_t TempFileStream::Size() { return mSize; }
+
+void TempFileStream::Size(int64_t value) {
+  if (value < 0)
+    throw runtime_error("Size must not be less than zero.");
+  if (ftruncate(mFile.Fd(), static_cast<off_t>(value)) != 0)
+    throw runtime_error(ErrnoMessage("Failed to resize temporary file"));
+  mSize = value;
+  if (mPosition > mSize)
+    mPosition = mSize;
+}
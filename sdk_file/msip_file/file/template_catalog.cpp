@@ -0,0 +1,191 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "template_catalog.h"
+
+#include "mip/protection/get_template_settings.h"
+#include "mip/protection/template_descriptor.h"
+#include "request_deadline.h"
+
+using mip::ProtectionEngine;
+using mip::TemplateDescriptor;
+using sample::deadline::Deadline;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+
+class CatalogObserver final : public ProtectionEngine::Observer {
+public:
+  void OnGetTemplatesSuccess(const vector<shared_ptr<TemplateDescriptor>>& templateDescriptors, const shared_ptr<void>& context) override {
+    if (auto catalog = static_cast<std::weak_ptr<TemplateCatalog>*>(context.get())->lock())
+      catalog->OnLoaded(templateDescriptors);
+  }
+
+  void OnGetTemplatesFailure(const std::exception_ptr& error, const shared_ptr<void>& context) override {
+    if (auto catalog = static_cast<std::weak_ptr<TemplateCatalog>*>(context.get())->lock())
+      catalog->OnLoadFailed(error);
+  }
+};
+
+} // namespace
+
+const int TemplateCatalog::kDefaultRefreshSeconds;
+const size_t TemplateCatalog::kLabelRightsCapacity;
+std::atomic<int64_t> TemplateCatalog::sRefreshSeconds(TemplateCatalog::kDefaultRefreshSeconds);
+
+void TemplateCatalog::SetRefreshInterval(seconds interval) {
+  sRefreshSeconds = interval.count() > 0 ? interval.count() : kDefaultRefreshSeconds;
+}
+
+TemplateCatalog::TemplateCatalog(const shared_ptr<ProtectionEngine>& engine)
+    : mEngine(engine),
+      mLoading(false),
+      mLoads(0),
+      mLoadFailures(0),
+      mLabelRights(kLabelRightsCapacity, "label_rights") {
+}
+
+void TemplateCatalog::Prefetch() {
+  StartLoad();
+}
+
+void TemplateCatalog::WaitLoaded() {
+  // Only compared with nullptr, so no guard is needed: once loaded, the catalogue always has templates.
+  if (mCurrent.Load())
+    return;
+  if (!mLoading.load(std::memory_order_relaxed))
+    StartLoad();
+  std::unique_lock<mutex> lock(mMutex);
+  auto ready = [this]() { return mCurrent.Load() || !mLoading; };
+  const Deadline& deadline = Deadline::Current();
+  if (deadline.IsSet()) {
+    if (!mLoaded.wait_until(lock, deadline.GetExpiry(), ready))
+      throw sample::deadline::DeadlineExceededError();
+  } else {
+    mLoaded.wait(lock, ready);
+  }
+  if (!mCurrent.Load()) {
+    if (mError)
+      std::rethrow_exception(mError);
+    throw std::runtime_error("Templates could not be loaded");
+  }
+}
+
+const TemplateCatalog::Templates& TemplateCatalog::Get(const EpochReclaimer::ReadGuard&, steady_clock::time_point* loadedAt) {
+  const Loaded* current = mCurrent.Load();
+  if ((!current || steady_clock::now() - current->loadedAt >= seconds(sRefreshSeconds.load())) &&
+      !mLoading.load(std::memory_order_relaxed))
+    StartLoad();
+
+  if (!current)
+    throw std::runtime_error("Templates are not loaded");
+  if (loadedAt)
+    *loadedAt = current->loadedAt;
+  return current->templates;
+}
+
+vector<string> TemplateCatalog::GetRightsForLabel(const string& labelId, const string& ownerEmail, const string& delegatedUserEmail, bool* cached) {
+  const string key = labelId + kKeySeparator + ownerEmail + kKeySeparator + delegatedUserEmail;
+  const seconds ttl(sRefreshSeconds.load());
+  LabelRights entry;
+  *cached = mLabelRights.Find(key, entry, [ttl](const LabelRights& known) { return steady_clock::now() - known.loadedAt < ttl; });
+  if (*cached)
+    return entry.rights;
+
+  entry.rights = mEngine->GetRightsForLabelId("" /*documentId*/, labelId, ownerEmail, delegatedUserEmail, nullptr);
+  entry.loadedAt = steady_clock::now();
+  mLabelRights.Put(key, entry);
+  return entry.rights;
+}
+
+TemplateCatalog::Stats TemplateCatalog::GetStats() const {
+  const auto labelRights = mLabelRights.GetStats();
+  EpochReclaimer::ReadGuard guard;
+  lock_guard<mutex> lock(mMutex);
+  const Loaded* current = mCurrent.Load();
+  Stats stats;
+  stats.ready = current != nullptr;
+  stats.templates = current ? current->templates.size() : 0;
+  stats.loads = mLoads;
+  stats.loadFailures = mLoadFailures;
+  stats.rightsHits = labelRights.hits;
+  stats.rightsMisses = labelRights.misses;
+  return stats;
+}
+
+void TemplateCatalog::OnLoaded(const vector<shared_ptr<TemplateDescriptor>>& descriptors) {
+  std::unique_ptr<Loaded> loaded(new Loaded());
+  loaded->templates.reserve(descriptors.size());
+  for (const auto& descriptor : descriptors) {
+    if (descriptor)
+      loaded->templates.push_back({ descriptor->GetId(), descriptor->GetName(), descriptor->GetDescription(), descriptor->GetIsOwnerGrantedFullAccess() });
+  }
+  loaded->loadedAt = steady_clock::now();
+  lock_guard<mutex> lock(mMutex);
+  mCurrent.Store(loaded.release());
+  mError = nullptr;
+  mLoading = false;
+  ++mLoads;
+  mLoaded.notify_all();
+}
+
+void TemplateCatalog::OnLoadFailed(const std::exception_ptr& error) {
+  lock_guard<mutex> lock(mMutex);
+  mError = error;
+  mLoading = false;
+  ++mLoadFailures;
+  mLoaded.notify_all();
+}
+
+void TemplateCatalog::StartLoad() {
+  bool forceRefresh;
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mLoading)
+      return;
+    mLoading = true;
+    forceRefresh = mLoads > 0;
+  }
+  // Outside the lock: the SDK may report the result before GetTemplatesAsync returns.
+  try {
+    auto settings = mip::GetTemplatesSettings::CreateGetTemplatesSettings();
+    settings->EnableCaching(true);
+    settings->ForceRefresh(forceRefresh);
+    auto context = std::make_shared<std::weak_ptr<TemplateCatalog>>(shared_from_this());
+    mEngine->GetTemplatesAsync(std::make_shared<CatalogObserver>(), context, settings);
+  }
+  catch (...) {
+    OnLoadFailed(std::current_exception());
+  }
+}
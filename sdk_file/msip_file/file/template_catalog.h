@@ -0,0 +1,133 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_TEMPLATE_CATALOG_H_
+#define SAMPLE_FILE_TEMPLATE_CATALOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "epoch_reclaimer.h"
+#include "mip/protection/protection_engine.h"
+#include "sharded_lru.h"
+
+// Protection templates available to one engine's identity, and the rights its labels grant. Only the
+// template fields callers list are kept, not the SDK's descriptors. The first load starts in the
+// background when the engine is created (Prefetch). Once the templates are older than the refresh
+// interval, Get keeps returning them while GetTemplatesAsync fetches the next set, so only the very first
+// caller can wait on the service. Loaded templates are read in place under an epoch guard, so callers of
+// a ready catalogue take no lock and no reference.
+class TemplateCatalog final : public std::enable_shared_from_this<TemplateCatalog> {
+public:
+  struct Template {
+    std::string id;
+    std::string name;
+    std::string description;
+    bool ownerGrantedFullAccess;
+  };
+
+  typedef std::vector<Template> Templates;
+
+  struct Stats {
+    bool ready;
+    size_t templates;
+    uint64_t loads;
+    uint64_t loadFailures;
+    uint64_t rightsHits;
+    uint64_t rightsMisses;
+  };
+
+  static const int kDefaultRefreshSeconds = 3600;
+  static const size_t kLabelRightsCapacity = 1024;
+
+  // Applies to every catalogue. Also bounds how long label rights are reused.
+  static void SetRefreshInterval(std::chrono::seconds interval);
+
+  explicit TemplateCatalog(const std::shared_ptr<mip::ProtectionEngine>& engine);
+
+  // Starts the first load without waiting for it.
+  void Prefetch();
+
+  // Waits for the first load, up to the calling thread's deadline, and throws if it failed. Called before
+  // taking the guard Get needs, so that no guard is held while the service answers.
+  void WaitLoaded();
+
+  // The current templates and when they were loaded, valid while guard is held. Throws unless WaitLoaded
+  // returned; a failed refresh keeps the previous templates.
+  const Templates& Get(const EpochReclaimer::ReadGuard& guard, std::chrono::steady_clock::time_point* loadedAt = nullptr);
+
+  // GetRightsForLabelId for the engine's identity, reused per label, owner and delegated user. *cached
+  // tells whether the service was asked.
+  std::vector<std::string> GetRightsForLabel(
+      const std::string& labelId,
+      const std::string& ownerEmail,
+      const std::string& delegatedUserEmail,
+      bool* cached);
+
+  Stats GetStats() const;
+
+  // Called by the GetTemplatesAsync observer.
+  void OnLoaded(const std::vector<std::shared_ptr<mip::TemplateDescriptor>>& descriptors);
+  void OnLoadFailed(const std::exception_ptr& error);
+
+private:
+  // Replaced as a whole by each load.
+  struct Loaded {
+    Templates templates;
+    std::chrono::steady_clock::time_point loadedAt;
+  };
+
+  struct LabelRights {
+    std::chrono::steady_clock::time_point loadedAt;
+    std::vector<std::string> rights;
+  };
+
+  // Starts a load unless one is running.
+  void StartLoad();
+
+  static std::atomic<int64_t> sRefreshSeconds;
+
+  std::shared_ptr<mip::ProtectionEngine> mEngine;
+  mutable std::mutex mMutex;
+  std::condition_variable mLoaded;
+  // Stored with the mutex held.
+  EpochPointer<Loaded> mCurrent;
+  std::exception_ptr mError;
+  // Written with the mutex held; atomic so that Get checks it without locking.
+  std::atomic<bool> mLoading;
+  uint64_t mLoads;
+  uint64_t mLoadFailures;
+  ShardedLru<LabelRights> mLabelRights;
+};
+
+#endif // SAMPLE_FILE_TEMPLATE_CATALOG_H_
@@ -0,0 +1,190 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "tenant_endpoint_cache.h"
+
+#include <algorithm>
+#include <cctype>
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::string;
+
+namespace {
+
+// Scheme and host of an absolute URL, e.g. the RMS base URL of a tenant's extranet licensing URL.
+string GetBaseUrl(const string& url) {
+  auto hostStart = url.find("://");
+  if (hostStart == string::npos)
+    return "";
+  auto pathStart = url.find_first_of("/?#", hostStart + 3);
+  return url.substr(0, pathStart);
+}
+
+} // namespace
+
+const size_t TenantEndpointCache::kDefaultCapacity;
+const int TenantEndpointCache::kDefaultTtlSeconds;
+
+TenantEndpointCache::TenantEndpointCache() : mEntries(kDefaultCapacity, "tenant_endpoint"), mTtlSeconds(kDefaultTtlSeconds) {
+}
+
+void TenantEndpointCache::Configure(size_t capacity, seconds ttl) {
+  mTtlSeconds = ttl.count();
+  mEntries.SetCapacity(capacity);
+}
+
+string TenantEndpointCache::GetTenant(const string& username) {
+  auto at = username.rfind('@');
+  if (at == string::npos || at + 1 == username.size())
+    return "";
+  string tenant = username.substr(at + 1);
+  std::transform(tenant.begin(), tenant.end(), tenant.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return tenant;
+}
+
+bool TenantEndpointCache::FindEndpoints(const string& username, Endpoints& endpoints) {
+  Slot slot;
+  if (!Find(GetTenant(username), slot) ||
+      (slot.endpoints.protectionBaseUrl.empty() && slot.endpoints.policyBaseUrl.empty()))
+    return false;
+  endpoints = slot.endpoints;
+  return true;
+}
+
+void TenantEndpointCache::PutEndpoints(const string& username, const Endpoints& endpoints) {
+  Update(GetTenant(username), [&](Slot& slot) {
+    if (!endpoints.protectionBaseUrl.empty())
+      slot.endpoints.protectionBaseUrl = endpoints.protectionBaseUrl;
+    if (!endpoints.policyBaseUrl.empty())
+      slot.endpoints.policyBaseUrl = endpoints.policyBaseUrl;
+  });
+}
+
+bool TenantEndpointCache::FindTenantInfo(const string& username, TenantInfo& info) {
+  Slot slot;
+  if (!Find(GetTenant(username), slot) || !slot.hasInfo)
+    return false;
+  info = slot.info;
+  return true;
+}
+
+void TenantEndpointCache::PutTenantInfo(const string& username, const TenantInfo& info) {
+  Update(GetTenant(username), [&](Slot& slot) {
+    slot.hasInfo = true;
+    slot.info = info;
+    if (slot.endpoints.protectionBaseUrl.empty())
+      slot.endpoints.protectionBaseUrl = GetBaseUrl(info.extranetUrl);
+  });
+}
+
+void TenantEndpointCache::Forget(const string& username) {
+  const string tenant = GetTenant(username);
+  if (!tenant.empty())
+    mEntries.EraseIf([&](const Slot& slot) { return slot.tenant == tenant; });
+}
+
+TenantEndpointCache::Stats TenantEndpointCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void TenantEndpointCache::SnapshotTo(SnapshotWriter& writer) const {
+  const auto now = steady_clock::now();
+  mEntries.ForEach([&](const string& key, const Slot& slot, const string&) {
+    if (IsExpired(slot))
+      return;
+    writer.PutString(key);
+    writer.PutI64(std::chrono::duration_cast<milliseconds>(now - slot.insertedAt).count());
+    writer.PutString(slot.endpoints.protectionBaseUrl);
+    writer.PutString(slot.endpoints.policyBaseUrl);
+    writer.PutBool(slot.hasInfo);
+    writer.PutString(slot.info.tenantId);
+    writer.PutString(slot.info.issuerName);
+    writer.PutString(slot.info.extranetUrl);
+    writer.PutString(slot.info.intranetUrl);
+  });
+}
+
+size_t TenantEndpointCache::RestoreFrom(SnapshotReader& reader) {
+  const auto now = steady_clock::now();
+  size_t restored = 0;
+  while (!reader.AtEnd()) {
+    const string key = reader.GetString();
+    Slot slot;
+    slot.tenant = key;
+    slot.insertedAt = now - milliseconds(reader.GetI64());
+    slot.endpoints.protectionBaseUrl = reader.GetString();
+    slot.endpoints.policyBaseUrl = reader.GetString();
+    slot.hasInfo = reader.GetBool();
+    slot.info.tenantId = reader.GetString();
+    slot.info.issuerName = reader.GetString();
+    slot.info.extranetUrl = reader.GetString();
+    slot.info.intranetUrl = reader.GetString();
+    if (mEntries.GetCapacity() == 0 || IsExpired(slot))
+      continue;
+    mEntries.Put(key, slot);
+    ++restored;
+  }
+  return restored;
+}
+
+void TenantEndpointCache::Clear() {
+  mEntries.Clear();
+}
+
+bool TenantEndpointCache::Find(const string& tenant, Slot& slot) {
+  if (tenant.empty())
+    return false;
+  return mEntries.Find(tenant, slot, [this](const Slot& cached) { return !IsExpired(cached); });
+}
+
+void TenantEndpointCache::Update(const string& tenant, const std::function<void(Slot&)>& change) {
+  if (tenant.empty())
+    return;
+  mEntries.Upsert(tenant, [&](Slot& slot) {
+    // An expired entry starts over, so one learned URL cannot keep stale ones alive.
+    if (slot.tenant.empty() || IsExpired(slot)) {
+      slot = Slot();
+      slot.tenant = tenant;
+      slot.insertedAt = steady_clock::now();
+    }
+    change(slot);
+  });
+}
+
+bool TenantEndpointCache::IsExpired(const Slot& slot) const {
+  const seconds ttl(mTtlSeconds.load());
+  return ttl.count() > 0 && steady_clock::now() - slot.insertedAt >= ttl;
+}
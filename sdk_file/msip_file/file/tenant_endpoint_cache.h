@@ -0,0 +1,122 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_TENANT_ENDPOINT_CACHE_H_
+#define SAMPLE_FILE_TENANT_ENDPOINT_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "cache_snapshot.h"
+#include "sharded_lru.h"
+
+// Service endpoints and RMS tenant information learned per tenant, keyed by the domain of the user's
+// email address. Engines for new users of a known tenant are created with its endpoints, so the SDK
+// skips service discovery. Entries expire after a TTL, so a tenant that moves is discovered again.
+class TenantEndpointCache final {
+public:
+  // Either URL may be empty while only the other is known.
+  struct Endpoints {
+    std::string protectionBaseUrl;
+    std::string policyBaseUrl;
+  };
+
+  // Copy of mip::TenantInformation, which does not outlive the engine that returned it.
+  struct TenantInfo {
+    std::string tenantId;
+    std::string issuerName;
+    std::string extranetUrl;
+    std::string intranetUrl;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  static const size_t kDefaultCapacity = 1024;
+  static const int kDefaultTtlSeconds = 86400;
+
+  TenantEndpointCache();
+
+  // capacity 0 disables the cache and drops every entry. ttl 0 keeps entries until evicted.
+  void Configure(size_t capacity, std::chrono::seconds ttl);
+
+  // Lower-cased domain of username, or empty when it has none.
+  static std::string GetTenant(const std::string& username);
+
+  // False when no endpoint is cached for the user's tenant.
+  bool FindEndpoints(const std::string& username, Endpoints& endpoints);
+
+  // Merges the non-empty URLs into the tenant's entry.
+  void PutEndpoints(const std::string& username, const Endpoints& endpoints);
+
+  bool FindTenantInfo(const std::string& username, TenantInfo& info);
+
+  // Also records the protection base URL the extranet licensing URL points at, if none is known yet.
+  void PutTenantInfo(const std::string& username, const TenantInfo& info);
+
+  // Drops the tenant's entry, e.g. after an engine failed to load with its endpoints.
+  void Forget(const std::string& username);
+
+  Stats GetStats() const;
+
+  // Writes the unexpired entries to a snapshot section (see cache_snapshot.h), and puts a section's entries back,
+  // returning how many. RestoreFrom throws std::runtime_error for a malformed section.
+  void SnapshotTo(SnapshotWriter& writer) const;
+  size_t RestoreFrom(SnapshotReader& reader);
+
+  void Clear();
+
+private:
+  struct Slot {
+    std::string tenant;
+    std::chrono::steady_clock::time_point insertedAt;
+    Endpoints endpoints;
+    bool hasInfo;
+    TenantInfo info;
+
+    Slot() : hasInfo(false) {}
+  };
+
+  bool Find(const std::string& tenant, Slot& slot);
+  void Update(const std::string& tenant, const std::function<void(Slot&)>& change);
+  bool IsExpired(const Slot& slot) const;
+
+  ShardedLru<Slot> mEntries;
+  std::atomic<int64_t> mTtlSeconds;
+};
+
+#endif // SAMPLE_FILE_TENANT_ENDPOINT_CACHE_H_
@@ -0,0 +1,271 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "text_extractor.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "xml_scanner.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Zip local file headers, central directory records and the end of central directory record.
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const size_t kLocalHeaderSize = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfCentralDirectorySize = 22;
+const uint16_t kStored = 0;
+const uint16_t kDeflated = 8;
+const size_t kMinPrintableRun = 4;
+// Printable runs and plain text are handed to a sink in pieces of about this size.
+const size_t kSinkChunkBytes = 64 * 1024;
+
+uint16_t ReadLe16(const uint8_t* data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLe32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool StartsWith(const string& value, const char* prefix) {
+  return value.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+// Parts that hold document text. Relationship, style, theme and property parts are skipped.
+bool IsTextPart(const string& name) {
+  if (name.size() < 4 || name.compare(name.size() - 4, 4, ".xml") != 0 || name.find("_rels/") != string::npos)
+    return false;
+  if (StartsWith(name, "word/"))
+    return name == "word/document.xml" || StartsWith(name, "word/header") || StartsWith(name, "word/footer") ||
+           name == "word/footnotes.xml" || name == "word/endnotes.xml" || name == "word/comments.xml";
+  return StartsWith(name, "ppt/slides/") || StartsWith(name, "ppt/notesSlides/") ||
+         name == "xl/sharedStrings.xml" || StartsWith(name, "xl/worksheets/");
+}
+
+// Text extracted so far, either collected whole or handed to a sink whenever a piece is done.
+class TextOutput {
+public:
+  TextOutput(size_t maxBytes, const TextSink* sink) : mMaxBytes(maxBytes), mSink(sink), mFlushed(0), mStopped(false) {}
+
+  string& Text() { return mText; }
+  size_t Size() const { return mFlushed + mText.size(); }
+  bool Full() const { return mStopped || Size() >= mMaxBytes; }
+  size_t Flushed() const { return mFlushed; }
+
+  // Hands the pending text, cut to maxBytes overall, to the sink. Without a sink the text stays collected.
+  void Flush() {
+    if (!mSink || mStopped)
+      return;
+    const size_t room = mMaxBytes > mFlushed ? mMaxBytes - mFlushed : 0;
+    if (mText.size() > room)
+      mText.resize(room);
+    if (!mText.empty()) {
+      mStopped = !(*mSink)(mText.data(), mText.size());
+      mFlushed += mText.size();
+    }
+    mText.clear();
+  }
+
+private:
+  const size_t mMaxBytes;
+  const TextSink* mSink;
+  string mText;
+  size_t mFlushed;
+  bool mStopped;
+};
+
+bool Inflate(const uint8_t* data, size_t size, size_t expected, string& out) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    return false;
+  out.resize(expected);
+  zs.next_in = const_cast<Bytef*>(data);
+  zs.avail_in = static_cast<uInt>(size);
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = static_cast<uInt>(expected);
+  const int status = expected ? inflate(&zs, Z_FINISH) : Z_STREAM_END;
+  out.resize(zs.total_out);
+  inflateEnd(&zs);
+  return status == Z_STREAM_END;
+}
+
+// Text of an Office XML part. Runs of a paragraph are concatenated so words split across runs still match.
+void AppendPartText(const string& xml, TextOutput& out) {
+  XmlScanner scanner(xml);
+  string& text = out.Text();
+  for (auto token = scanner.Next(); token != XmlScanner::Token::End && !out.Full(); token = scanner.Next()) {
+    if (token == XmlScanner::Token::Text) {
+      text += scanner.Text();
+    } else {
+      const string& name = scanner.Name();
+      if ((token == XmlScanner::Token::Close && (name == "p" || name == "si" || name == "c" || name == "tc")) ||
+          name == "tab" || name == "br" || name == "cr")
+        text += ' ';
+    }
+  }
+}
+
+// Returns false when data is not a zip that could be read, so the caller falls back to plain bytes.
+bool ExtractZipText(const uint8_t* data, size_t dataSize, TextOutput& out) {
+  if (dataSize < kEndOfCentralDirectorySize)
+    return false;
+  // The end record is last, followed by a comment of at most 64 KiB.
+  size_t end = dataSize - kEndOfCentralDirectorySize;
+  const size_t lowest = end > 0xFFFF ? end - 0xFFFF : 0;
+  while (ReadLe32(&data[end]) != kEndOfCentralDirectorySignature) {
+    if (end == lowest)
+      return false;
+    --end;
+  }
+  const uint16_t entries = ReadLe16(&data[end + 10]);
+  size_t offset = ReadLe32(&data[end + 16]);
+
+  bool sawTextPart = false;
+  for (uint16_t i = 0; i < entries && !out.Full(); ++i) {
+    if (offset + kCentralHeaderSize > dataSize || ReadLe32(&data[offset]) != kCentralHeaderSignature)
+      return sawTextPart;
+    const uint8_t* header = &data[offset];
+    const uint16_t method = ReadLe16(header + 10);
+    const uint32_t compressedSize = ReadLe32(header + 20);
+    const uint32_t size = ReadLe32(header + 24);
+    const uint16_t nameLength = ReadLe16(header + 28);
+    const size_t extraLength = ReadLe16(header + 30) + ReadLe16(header + 32);
+    const size_t localOffset = ReadLe32(header + 42);
+    if (offset + kCentralHeaderSize + nameLength > dataSize)
+      return sawTextPart;
+    const string name(reinterpret_cast<const char*>(header + kCentralHeaderSize), nameLength);
+    offset += kCentralHeaderSize + nameLength + extraLength;
+
+    if (!IsTextPart(name) || (method != kStored && method != kDeflated))
+      continue;
+    if (localOffset + kLocalHeaderSize > dataSize || ReadLe32(&data[localOffset]) != kLocalHeaderSignature)
+      continue;
+    const size_t dataOffset = localOffset + kLocalHeaderSize + ReadLe16(&data[localOffset + 26]) + ReadLe16(&data[localOffset + 28]);
+    if (dataOffset + compressedSize > dataSize)
+      continue;
+
+    string xml;
+    if (method == kStored)
+      xml.assign(reinterpret_cast<const char*>(&data[dataOffset]), compressedSize);
+    else if (!Inflate(&data[dataOffset], compressedSize, size, xml))
+      continue;
+    sawTextPart = true;
+    AppendPartText(xml, out);
+    out.Text() += ' ';
+    out.Flush();
+  }
+  return sawTextPart;
+}
+
+void ExtractPrintableRuns(const uint8_t* data, size_t size, TextOutput& out) {
+  string& text = out.Text();
+  size_t runStart = 0;
+  for (size_t i = 0; i <= size && !out.Full(); ++i) {
+    const bool printable = i < size && ((data[i] >= 0x20 && data[i] < 0x7F) || data[i] == '\t');
+    if (printable)
+      continue;
+    if (i - runStart >= kMinPrintableRun) {
+      text.append(reinterpret_cast<const char*>(&data[runStart]), i - runStart);
+      text += ' ';
+      if (text.size() >= kSinkChunkBytes)
+        out.Flush();
+    }
+    runStart = i + 1;
+  }
+}
+
+// Binary formats have zero bytes within their first few KiB; UTF-8 and ASCII text never does.
+bool LooksLikeText(const uint8_t* data, size_t size) {
+  const size_t sample = std::min<size_t>(size, 4096);
+  return std::memchr(data, 0, sample) == nullptr;
+}
+
+void Extract(const uint8_t* data, size_t size, TextOutput& out) {
+  const bool isZip = size >= 4 && ReadLe32(data) == kLocalHeaderSignature;
+  if (isZip && ExtractZipText(data, size, out))
+    return;
+  // Nothing was flushed yet: zip text is only flushed once a text part was read.
+  out.Text().clear();
+  const bool hasByteOrderMark = size >= 2 && ((data[0] == 0xFF && data[1] == 0xFE) || (data[0] == 0xFE && data[1] == 0xFF));
+  if (!hasByteOrderMark && !LooksLikeText(data, size)) {
+    ExtractPrintableRuns(data, size, out);
+    return;
+  }
+  out.Text() = ToUtf8(string(reinterpret_cast<const char*>(data), size));
+}
+
+} // namespace
+
+string ExtractText(mip::Stream& stream, size_t maxBytes) {
+  const int64_t size = stream.Size();
+  vector<uint8_t> data(static_cast<size_t>(size > 0 ? size : 0));
+  stream.Seek(0);
+  size_t read = 0;
+  while (read < data.size()) {
+    const int64_t count = stream.Read(&data[read], static_cast<int64_t>(data.size() - read));
+    if (count <= 0)
+      break;
+    read += static_cast<size_t>(count);
+  }
+  data.resize(read);
+
+  TextOutput out(maxBytes, nullptr);
+  Extract(data.data(), data.size(), out);
+  string& text = out.Text();
+  if (text.size() > maxBytes)
+    text.resize(maxBytes);
+  return text;
+}
+
+size_t ExtractText(const uint8_t* data, size_t size, size_t maxBytes, const TextSink& sink) {
+  TextOutput out(maxBytes, &sink);
+  Extract(data, size, out);
+  // Plain text is converted whole, then handed over in pieces.
+  string& text = out.Text();
+  if (text.size() > kSinkChunkBytes) {
+    string pending;
+    pending.swap(text);
+    for (size_t offset = 0; offset < pending.size() && !out.Full(); offset += kSinkChunkBytes) {
+      text.assign(pending, offset, kSinkChunkBytes);
+      out.Flush();
+    }
+  }
+  out.Flush();
+  return out.Flushed();
+}
@@ -0,0 +1,53 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_TEXT_EXTRACTOR_H_
+#define SAMPLE_FILE_TEXT_EXTRACTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "mip/stream.h"
+
+// Text to classify, extracted from unprotected content without going through the SDK:
+// - Office Open XML packages (.docx, .xlsx, .pptx): the text of the body, header, footer, note, comment,
+//   slide and cell parts, inflated straight out of the zip;
+// - UTF-8 and UTF-16 text: as is, converted to UTF-8;
+// - anything else: runs of at least four printable ASCII characters, like strings(1).
+// Paragraph and cell boundaries become spaces. At most maxBytes are returned. Reads stream from 0.
+std::string ExtractText(mip::Stream& stream, size_t maxBytes);
+
+// Receives extracted text in document order, a part or a run of parts at a time. Returning false stops
+// the extraction.
+typedef std::function<bool(const char* text, size_t size)> TextSink;
+
+// Extracts like the above from size bytes at data, handing the text to sink as each part is done instead
+// of collecting it, so only one part's text is held at a time. Returns the bytes handed to sink.
+size_t ExtractText(const uint8_t* data, size_t size, size_t maxBytes, const TextSink& sink);
+
+#endif // SAMPLE_FILE_TEXT_EXTRACTOR_H_
@@ -0,0 +1,200 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "timeline_recorder.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <set>
+
+#include "json_writer.h"
+#include "trace_context.h"
+
+using sample::oplog::OperationLog;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace {
+
+// Timelines kept until the first Configure, so RequestNext works on its own.
+const size_t kDefaultCapacity = 16;
+
+void WriteThreadName(JsonWriter& json, int64_t pid, uint32_t thread, const string& name) {
+  json.BeginObject()
+      .Key("name").String("thread_name")
+      .Key("ph").String("M")
+      .Key("pid").Int(pid)
+      .Key("tid").UInt(thread)
+      .Key("args").BeginObject().Key("name").String(name).EndObject()
+      .EndObject();
+}
+
+string BuildTimeline(
+    const string& operation,
+    const string& path,
+    bool succeeded,
+    const OperationLog& log,
+    OperationLog::Clock::time_point end) {
+  uint64_t dropped = 0;
+  const auto events = log.GetEvents(&dropped);
+  const int64_t pid = getpid();
+  const uint32_t caller = log.GetThread();
+  const int64_t durationMicros = std::chrono::duration_cast<std::chrono::microseconds>(end - log.GetStart()).count();
+  const int64_t startUnixMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count() - durationMicros;
+
+  JsonWriter json(1024 + events.size() * 128);
+  json.BeginObject().Key("traceEvents").BeginArray();
+  std::set<uint32_t> threads;
+  threads.insert(caller);
+  for (const auto& event : events)
+    threads.insert(event.thread);
+  for (auto thread : threads)
+    WriteThreadName(json, pid, thread, thread == caller ? operation : "worker " + std::to_string(thread));
+
+  json.BeginObject()
+      .Key("name").String(operation)
+      .Key("cat").String("operation")
+      .Key("ph").String("X")
+      .Key("ts").Int(0)
+      .Key("dur").Int(durationMicros)
+      .Key("pid").Int(pid)
+      .Key("tid").UInt(caller)
+      .Key("args").BeginObject()
+          .Key("path").String(path)
+          .Key("succeeded").Bool(succeeded)
+          .EndObject()
+      .EndObject();
+  for (const auto& event : events) {
+    json.BeginObject()
+        .Key("name").String(event.name)
+        .Key("cat").String(event.kind)
+        .Key("ts").Int(event.offsetMicros)
+        .Key("pid").Int(pid)
+        .Key("tid").UInt(event.thread);
+    if (event.durationMicros >= 0)
+      json.Key("ph").String("X").Key("dur").Int(event.durationMicros);
+    else
+      json.Key("ph").String("i").Key("s").String("t");
+    if (!event.detail.empty())
+      json.Key("args").BeginObject().Key("detail").String(event.detail).EndObject();
+    json.EndObject();
+  }
+  json.EndArray()
+      .Key("displayTimeUnit").String("ms")
+      .Key("otherData").BeginObject()
+          .Key("operation").String(operation)
+          .Key("path").String(path)
+          .Key("succeeded").Bool(succeeded)
+          .Key("start_unix_us").Int(startUnixMicros)
+          .Key("dropped_events").UInt(dropped)
+          .EndObject()
+      .EndObject();
+  return json.Take();
+}
+
+} // namespace
+
+const size_t TimelineRecorder::kMaxEvents;
+
+TimelineRecorder& TimelineRecorder::Instance() {
+  static TimelineRecorder* instance = new TimelineRecorder(); // Never destroyed, like the SDK's threads.
+  return *instance;
+}
+
+TimelineRecorder::TimelineRecorder()
+    : mSampleEvery(0),
+      mRequested(0),
+      mOperations(0),
+      mEnabled(true),
+      mCapacity(kDefaultCapacity),
+      mDropped(0) {
+}
+
+void TimelineRecorder::Configure(uint32_t sampleEvery, size_t capacity) {
+  lock_guard<mutex> lock(mMutex);
+  mCapacity = capacity;
+  while (mTimelines.size() > mCapacity) {
+    mTimelines.pop_front();
+    ++mDropped;
+  }
+  mSampleEvery.store(sampleEvery, std::memory_order_relaxed);
+  mEnabled.store(capacity > 0, std::memory_order_relaxed);
+}
+
+void TimelineRecorder::RequestNext(uint32_t count) {
+  mRequested.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool TimelineRecorder::ShouldRecord() {
+  if (!mEnabled.load(std::memory_order_relaxed))
+    return false;
+  if (sample::trace::TraceContext::Current().verbose)
+    return true;
+  uint32_t requested = mRequested.load(std::memory_order_relaxed);
+  while (requested > 0) {
+    if (mRequested.compare_exchange_weak(requested, requested - 1, std::memory_order_relaxed))
+      return true;
+  }
+  const uint32_t sampleEvery = mSampleEvery.load(std::memory_order_relaxed);
+  return sampleEvery > 0 && mOperations.fetch_add(1, std::memory_order_relaxed) % sampleEvery == 0;
+}
+
+void TimelineRecorder::Add(
+    const string& operation,
+    const string& path,
+    bool succeeded,
+    const OperationLog& log,
+    OperationLog::Clock::time_point end) {
+  string timeline = BuildTimeline(operation, path, succeeded, log, end);
+  lock_guard<mutex> lock(mMutex);
+  if (mCapacity == 0)
+    return;
+  if (mTimelines.size() >= mCapacity) {
+    mTimelines.pop_front();
+    ++mDropped;
+  }
+  mTimelines.push_back(std::move(timeline));
+}
+
+string TimelineRecorder::TakeJSON() {
+  std::deque<string> timelines;
+  uint64_t dropped;
+  {
+    lock_guard<mutex> lock(mMutex);
+    timelines.swap(mTimelines);
+    dropped = mDropped;
+    mDropped = 0;
+  }
+  JsonWriter json;
+  json.BeginObject().Key("timelines").BeginArray();
+  for (const auto& timeline : timelines)
+    json.Raw(timeline);
+  json.EndArray().Key("dropped").UInt(dropped).EndObject();
+  return json.Take();
+}
@@ -0,0 +1,88 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_TIMELINE_RECORDER_H_
+#define SAMPLE_FILE_TIMELINE_RECORDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "operation_log.h"
+
+// Keeps timelines of single protect and unprotect operations in the Chrome trace event format, which
+// chrome://tracing and ui.perfetto.dev open as they are: the operation, its phases, the SDK tasks it
+// dispatched with their queueing, its HTTP requests, storage table calls and cache lookups, each on the
+// thread it ran on. Where the slow operation recorder keeps what a slow operation spent its time on, a
+// timeline shows what overlapped and what waited. An operation is recorded when sampled one in
+// sampleEvery, when requested ahead, or when its caller turned on msipSetRequestTrace.
+class TimelineRecorder final {
+public:
+  // Events an operation's log keeps for its timeline.
+  static const size_t kMaxEvents = 4096;
+
+  static TimelineRecorder& Instance();
+
+  // Samples one in sampleEvery operations, 0 for none, and keeps up to capacity timelines, dropping the
+  // oldest; a capacity of 0 stops recording.
+  void Configure(uint32_t sampleEvery, size_t capacity);
+
+  // Records the next count operations, whatever the sampling.
+  void RequestNext(uint32_t count);
+
+  // Whether the operation starting on this thread gets a timeline. A few relaxed loads and a thread-local
+  // check while nothing is sampled or requested.
+  bool ShouldRecord();
+
+  void Add(
+      const std::string& operation,
+      const std::string& path,
+      bool succeeded,
+      const sample::oplog::OperationLog& log,
+      sample::oplog::OperationLog::Clock::time_point end);
+
+  // {"timelines":[...],"dropped":n}: the kept timelines, oldest first, each a Chrome trace JSON object,
+  // which are removed, and how many were dropped since the last call because the buffer was full.
+  std::string TakeJSON();
+
+private:
+  TimelineRecorder();
+
+  std::atomic<uint32_t> mSampleEvery;
+  std::atomic<uint32_t> mRequested;
+  std::atomic<uint64_t> mOperations;
+  std::atomic<bool> mEnabled;
+  std::mutex mMutex;
+  size_t mCapacity;
+  std::deque<std::string> mTimelines;
+  uint64_t mDropped;
+};
+
+#endif // SAMPLE_FILE_TIMELINE_RECORDER_H_
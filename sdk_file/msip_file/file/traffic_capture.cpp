@@ -0,0 +1,167 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "traffic_capture.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace {
+
+// stdio buffer of the capture file, so a line costs a copy rather than a write.
+const size_t kBufferSize = 256 * 1024;
+
+int64_t ToMicros(TrafficCapture::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+} // namespace
+
+const char* const TrafficCapture::kHeader = "# msip-capture 1";
+
+TrafficCapture& TrafficCapture::Instance() {
+  static TrafficCapture instance;
+  return instance;
+}
+
+TrafficCapture::TrafficCapture()
+    : mEnabled(false),
+      mSeen(0),
+      mFile(nullptr),
+      mSampleEvery(1),
+      mMaxRecords(0),
+      mRecorded(0),
+      mOverLimit(0) {
+}
+
+void TrafficCapture::Start(const string& path, uint32_t sampleEvery, uint64_t maxRecords) {
+  // Shapes only, but still what the service was asked to do, so readable by the service user alone.
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0)
+    throw std::runtime_error("Failed to create '" + path + "': " + strerror(errno));
+  FILE* file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    throw std::runtime_error("Failed to open '" + path + "': " + strerror(errno));
+  }
+  setvbuf(file, nullptr, _IOFBF, kBufferSize);
+  fprintf(file, "%s\n# offset_us\toperation\tformat\tfiles\tsize_bytes\ttenant\tduration_us\tstatus\tcache_hits\tcache_misses\n", kHeader);
+
+  lock_guard<mutex> lock(mMutex);
+  if (mFile)
+    fclose(mFile);
+  mFile = file;
+  mPath = path;
+  mStart = Clock::now();
+  mSampleEvery = std::max<uint32_t>(sampleEvery, 1);
+  mMaxRecords = maxRecords;
+  mRecorded = 0;
+  mOverLimit = 0;
+  mSeen = 0;
+  mEnabled = true;
+}
+
+TrafficCapture::Stats TrafficCapture::Stop() {
+  lock_guard<mutex> lock(mMutex);
+  mEnabled = false;
+  const Stats stats = StatsLocked();
+  if (mFile) {
+    fclose(mFile);
+    mFile = nullptr;
+  }
+  return stats;
+}
+
+TrafficCapture::Stats TrafficCapture::GetStats() const {
+  lock_guard<mutex> lock(mMutex);
+  return StatsLocked();
+}
+
+TrafficCapture::Stats TrafficCapture::StatsLocked() const {
+  const uint64_t seen = mSeen.load(std::memory_order_relaxed);
+  const uint64_t sampled = (seen + mSampleEvery - 1) / mSampleEvery;
+  return Stats{ mEnabled.load(std::memory_order_relaxed), mPath, mRecorded, seen - sampled, mOverLimit };
+}
+
+bool TrafficCapture::Sample() {
+  if (!IsEnabled())
+    return false;
+  return mSeen.fetch_add(1, std::memory_order_relaxed) % mSampleEvery == 0;
+}
+
+void TrafficCapture::Add(const Record& record) {
+  const string format = FormatOf(record.name);
+  const string tenant = HashTenant(record.tenant);
+  lock_guard<mutex> lock(mMutex);
+  if (!mFile)
+    return;
+  if (mMaxRecords > 0 && mRecorded >= mMaxRecords) {
+    ++mOverLimit;
+    return;
+  }
+  // Formats come from file names, so one with a tab or newline is written as unknown.
+  const bool plain = format.find_first_of("\t\n\r") == string::npos;
+  fprintf(mFile, "%" PRId64 "\t%s\t%s\t%" PRIu32 "\t%" PRId64 "\t%s\t%" PRId64 "\t%d\t%" PRIu32 "\t%" PRIu32 "\n",
+      std::max<int64_t>(ToMicros(record.start - mStart), 0), record.operation.c_str(), plain ? format.c_str() : "",
+      record.files, record.sizeBytes, tenant.c_str(), ToMicros(record.end - record.start), record.status,
+      record.cacheHits, record.cacheMisses);
+  ++mRecorded;
+}
+
+string TrafficCapture::FormatOf(const string& name) {
+  const auto slash = name.find_last_of('/');
+  const auto dot = name.find_last_of('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return string();
+  string format = name.substr(dot + 1);
+  std::transform(format.begin(), format.end(), format.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return format;
+}
+
+string TrafficCapture::HashTenant(const string& tenant) {
+  if (tenant.empty())
+    return string();
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : tenant) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return string(hex);
+}
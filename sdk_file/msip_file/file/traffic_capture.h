@@ -0,0 +1,113 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_TRAFFIC_CAPTURE_H_
+#define SAMPLE_FILE_TRAFFIC_CAPTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+// Records the shape of the operations the library serves, never their content or names, so a load test can
+// replay the production mix (see msip_loadgen --capture). Each operation is one tab-separated line after a
+// "# msip-capture 1" header: when it started in microseconds since the capture did, the operation, its
+// input's format, file count and size, a hash of its tenant, its duration, status, and the cache hits and
+// misses on the calling thread. Off by default, when IsEnabled is one relaxed load.
+class TrafficCapture final {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Record {
+    std::string operation;
+    // The input's path or name hint, of which only the extension is written.
+    std::string name;
+    uint32_t files;
+    // -1 when unknown.
+    int64_t sizeBytes;
+    std::string tenant;
+    Clock::time_point start;
+    Clock::time_point end;
+    int status;
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+  };
+
+  struct Stats {
+    bool enabled;
+    std::string path;
+    uint64_t recorded;
+    // Operations left out by sampling, and past the record limit.
+    uint64_t sampledOut;
+    uint64_t overLimit;
+  };
+
+  static const char* const kHeader;
+
+  static TrafficCapture& Instance();
+
+  // Starts writing to path, truncating it and ending any capture in progress. Keeps one operation in
+  // sampleEvery (0 counts as 1) and stops recording after maxRecords of them, 0 for no limit. Throws
+  // std::runtime_error when path cannot be created.
+  void Start(const std::string& path, uint32_t sampleEvery, uint64_t maxRecords);
+
+  // Flushes and closes the capture, returning what it recorded.
+  Stats Stop();
+
+  Stats GetStats() const;
+
+  bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+  // Whether the next operation is sampled. Call once per operation, before it runs.
+  bool Sample();
+
+  void Add(const Record& record);
+
+  // The lower-cased extension of name without the dot, empty when it has none.
+  static std::string FormatOf(const std::string& name);
+  // FNV-1a 64 of tenant as 16 hex digits, empty for no tenant.
+  static std::string HashTenant(const std::string& tenant);
+
+private:
+  TrafficCapture();
+  Stats StatsLocked() const;
+
+  std::atomic<bool> mEnabled;
+  std::atomic<uint64_t> mSeen;
+  mutable std::mutex mMutex;
+  FILE* mFile;
+  std::string mPath;
+  Clock::time_point mStart;
+  uint32_t mSampleEvery;
+  uint64_t mMaxRecords;
+  uint64_t mRecorded;
+  uint64_t mOverLimit;
+};
+
+#endif // SAMPLE_FILE_TRAFFIC_CAPTURE_H_
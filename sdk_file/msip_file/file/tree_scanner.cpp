@@ -0,0 +1,296 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "tree_scanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cost_account.h"
+#include "protection_token_context.h"
+#include "request_deadline.h"
+#include "tenant_context.h"
+#include "work_priority.h"
+
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unordered_set;
+using std::vector;
+
+namespace {
+
+// Office Open XML, PDF, XPS and Outlook types are labeled in place, the text and image types are
+// protected natively, and their protected forms and .pfile are what those protections write.
+const char* const kDefaultExtensions[] = {
+    ".docx", ".docm", ".dotx", ".dotm", ".xlsx", ".xlsm", ".xltx", ".xltm", ".xlsb",
+    ".pptx", ".pptm", ".potx", ".potm", ".ppsx", ".ppsm",
+    ".vsdx", ".vsdm", ".vssx", ".vssm", ".vstx", ".vstm",
+    ".pdf", ".xps", ".oxps", ".msg", ".rpmsg",
+    ".txt", ".xml", ".jpg", ".jpeg", ".jpe", ".jfif", ".jt", ".png", ".tif", ".tiff", ".bmp", ".gif",
+    ".ptxt", ".pxml", ".pjpg", ".pjpeg", ".pjpe", ".pjfif", ".pjt", ".ppng", ".ptif", ".ptiff", ".pbmp", ".pgif",
+    ".ppdf", ".pfile",
+};
+
+// How long an idle thread waits for another to find a directory before looking again.
+const std::chrono::milliseconds kIdleWait(1);
+
+string ToLower(string value) {
+  std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return value;
+}
+
+string Trim(const string& value) {
+  const auto first = value.find_first_not_of(" \t");
+  if (first == string::npos)
+    return "";
+  return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
+string JoinPath(const string& directory, const char* name) {
+  if (!directory.empty() && directory.back() == '/')
+    return directory + name;
+  return directory + '/' + name;
+}
+
+struct DirectoryQueue {
+  std::mutex mutex;
+  std::deque<string> directories;
+};
+
+} // namespace
+
+const size_t TreeScanner::kMaxWorkers;
+
+TreeScanner::TreeScanner(const unordered_set<string>& extensions, size_t workerCount)
+    : mExtensions(extensions),
+      mWorkerCount(workerCount > 0 ? workerCount : std::max<size_t>(1, 2 * std::thread::hardware_concurrency())) {
+  mWorkerCount = std::min(mWorkerCount, kMaxWorkers);
+}
+
+unordered_set<string> TreeScanner::ParseFilters(const string& filters) {
+  unordered_set<string> extensions;
+  if (Trim(filters) == "*")
+    return extensions;
+  if (Trim(filters).empty()) {
+    extensions.insert(std::begin(kDefaultExtensions), std::end(kDefaultExtensions));
+    return extensions;
+  }
+  size_t start = 0;
+  while (start <= filters.size()) {
+    auto end = filters.find(',', start);
+    if (end == string::npos)
+      end = filters.size();
+    string extension = ToLower(Trim(filters.substr(start, end - start)));
+    if (!extension.empty())
+      extensions.insert(extension[0] == '.' ? extension : "." + extension);
+    start = end + 1;
+  }
+  return extensions;
+}
+
+bool TreeScanner::Matches(const string& fileName) const {
+  if (mExtensions.empty())
+    return true;
+  const auto dot = fileName.rfind('.');
+  if (dot == string::npos || fileName.find('/', dot) != string::npos)
+    return false;
+  return mExtensions.count(ToLower(fileName.substr(dot))) > 0;
+}
+
+TreeScanner::Stats TreeScanner::Scan(const string& root, const FileVisitor& visitFile, const ErrorVisitor& visitError) const {
+  atomic<uint64_t> directories(0);
+  atomic<uint64_t> files(0);
+  atomic<uint64_t> matched(0);
+  atomic<uint64_t> errors(0);
+  atomic<bool> stop(false);
+  const auto deadline = sample::deadline::Deadline::Current();
+  const string tenant = sample::tenant::Current();
+  const auto priority = sample::priority::Current();
+  const auto costKey = sample::cost::CurrentKey();
+  const auto protectionToken = sample::token::Current();
+
+  auto finish = [&]() {
+    Stats stats;
+    stats.directories = directories;
+    stats.files = files;
+    stats.matched = matched;
+    stats.errors = errors;
+    stats.stopped = stop;
+    return stats;
+  };
+
+  struct stat rootInfo;
+  if (stat(root.c_str(), &rootInfo) != 0) {
+    ++errors;
+    if (!visitError(0, root, strerror(errno)))
+      stop = true;
+    return finish();
+  }
+  if (!S_ISDIR(rootInfo.st_mode)) {
+    if (S_ISREG(rootInfo.st_mode)) {
+      ++files;
+      if (Matches(root)) {
+        ++matched;
+        if (!visitFile(0, root))
+          stop = true;
+      }
+    }
+    return finish();
+  }
+
+  vector<std::unique_ptr<DirectoryQueue>> queues;
+  for (size_t i = 0; i < mWorkerCount; ++i)
+    queues.emplace_back(new DirectoryQueue());
+  queues[0]->directories.push_back(root);
+  // Directories queued or being listed. The walk is over when it drops to zero.
+  atomic<size_t> pending(1);
+  mutex idleMutex;
+  std::condition_variable found;
+
+  // Own directories come off the back, stolen ones off the front.
+  auto pop = [&](size_t index, string& directory) {
+    for (size_t offset = 0; offset < queues.size(); ++offset) {
+      auto& queue = *queues[(index + offset) % queues.size()];
+      lock_guard<mutex> lock(queue.mutex);
+      if (queue.directories.empty())
+        continue;
+      if (offset == 0) {
+        directory = std::move(queue.directories.back());
+        queue.directories.pop_back();
+      } else {
+        directory = std::move(queue.directories.front());
+        queue.directories.pop_front();
+      }
+      return true;
+    }
+    return false;
+  };
+
+  auto list = [&](size_t index, const string& directory) {
+    DIR* handle = opendir(directory.c_str());
+    if (!handle) {
+      ++errors;
+      if (!visitError(index, directory, strerror(errno)))
+        stop = true;
+      return;
+    }
+    ++directories;
+    vector<string> subdirectories;
+    while (!stop) {
+      errno = 0;
+      const dirent* entry = readdir(handle);
+      if (!entry) {
+        if (errno != 0) {
+          ++errors;
+          if (!visitError(index, directory, strerror(errno)))
+            stop = true;
+        }
+        break;
+      }
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+      const string path = JoinPath(directory, entry->d_name);
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN) {
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0)
+          continue;
+        type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_LNK;
+      }
+      if (type == DT_DIR) {
+        subdirectories.push_back(path);
+      } else if (type == DT_REG) {
+        ++files;
+        if (Matches(entry->d_name)) {
+          ++matched;
+          if (!visitFile(index, path))
+            stop = true;
+        }
+      }
+    }
+    closedir(handle);
+
+    if (subdirectories.empty())
+      return;
+    pending += subdirectories.size();
+    {
+      auto& queue = *queues[index];
+      lock_guard<mutex> lock(queue.mutex);
+      // Reversed, so the first subdirectory listed comes off the back first.
+      queue.directories.insert(queue.directories.end(), subdirectories.rbegin(), subdirectories.rend());
+    }
+    found.notify_all();
+  };
+
+  auto work = [&](size_t index) {
+    sample::deadline::ScopedDeadline deadlineScope(deadline);
+    sample::tenant::ScopedTenant tenantScope(tenant);
+    sample::priority::ScopedPriority priorityScope(priority);
+    sample::cost::ScopedKey costScope(costKey);
+    sample::token::ScopedToken tokenScope(protectionToken);
+    string directory;
+    while (!stop) {
+      if (deadline.HasExpired()) {
+        stop = true;
+        break;
+      }
+      if (!pop(index, directory)) {
+        if (pending == 0)
+          break;
+        std::unique_lock<mutex> lock(idleMutex);
+        found.wait_for(lock, kIdleWait);
+        continue;
+      }
+      list(index, directory);
+      if (--pending == 0)
+        found.notify_all();
+    }
+  };
+
+  vector<std::thread> threads;
+  for (size_t i = 1; i < mWorkerCount; ++i)
+    threads.emplace_back(work, i);
+  work(0);
+  for (auto& thread : threads)
+    thread.join();
+  return finish();
+}
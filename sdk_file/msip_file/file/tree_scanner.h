@@ -0,0 +1,85 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_TREE_SCANNER_H_
+#define SAMPLE_FILE_TREE_SCANNER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+// Walks a directory tree on a pool of threads and hands every regular file whose extension passes the
+// filter to a visitor. Each thread keeps its own queue of directories still to be read and takes the most
+// recently found one, so the walk stays depth first and its queues small; an idle thread steals the oldest
+// directory of another thread, which is the root of the largest subtree left. Directories are listed with
+// readdir's entry types, so no file is stat'ed unless the file system leaves its type unknown. Symbolic
+// links are not followed, which keeps a link cycle from being walked forever.
+class TreeScanner final {
+public:
+  struct Stats {
+    uint64_t directories;
+    uint64_t files;
+    uint64_t matched;
+    uint64_t errors;
+    // The walk ended early, because a visitor asked to or the caller's deadline passed.
+    bool stopped;
+  };
+
+  // Called on a scanner thread; worker is that thread's index in [0, GetWorkerCount()). Returning false
+  // stops the walk.
+  typedef std::function<bool(size_t worker, const std::string& path)> FileVisitor;
+  // Called for a directory that could not be read, or for a root that does not exist.
+  typedef std::function<bool(size_t worker, const std::string& path, const std::string& error)> ErrorVisitor;
+
+  // Listing a directory mostly waits on the disk or the network share, so the walk runs more threads than
+  // there are cores.
+  static const size_t kMaxWorkers = 32;
+
+  // extensions are lowercase with their dot, e.g. ".docx". Empty accepts every file. workerCount 0 picks
+  // twice the core count, up to kMaxWorkers.
+  TreeScanner(const std::unordered_set<std::string>& extensions, size_t workerCount = 0);
+
+  // Comma separated extensions, with or without their dot and in any case. Empty selects the types the
+  // File SDK labels or protects natively, and "*" accepts every file.
+  static std::unordered_set<std::string> ParseFilters(const std::string& filters);
+
+  // Walks root, which may also be a single file. Runs under the caller's deadline and tenant, and returns
+  // once every thread has finished.
+  Stats Scan(const std::string& root, const FileVisitor& visitFile, const ErrorVisitor& visitError) const;
+
+  bool Matches(const std::string& fileName) const;
+
+  size_t GetWorkerCount() const { return mWorkerCount; }
+
+private:
+  std::unordered_set<std::string> mExtensions;
+  size_t mWorkerCount;
+};
+
+#endif // SAMPLE_FILE_TREE_SCANNER_H_
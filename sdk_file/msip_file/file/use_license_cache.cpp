@@ -0,0 +1,113 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "use_license_cache.h"
+
+#include <chrono>
+
+#include "allocation_account.h"
+#include "mip/protection_descriptor.h"
+#include "tenant_context.h"
+
+using mip::ProtectionHandler;
+using std::shared_ptr;
+using std::string;
+
+namespace {
+
+static const char kKeySeparator = '\x1f';
+
+bool HasExpired(const shared_ptr<ProtectionHandler>& protection) {
+  auto descriptor = protection->GetProtectionDescriptor();
+  return descriptor && descriptor->DoesContentExpire() &&
+      descriptor->GetContentValidUntil() <= std::chrono::system_clock::now();
+}
+
+} // namespace
+
+const size_t UseLicenseCache::kDefaultCapacity;
+
+UseLicenseCache::UseLicenseCache(size_t capacity)
+    : mEntries(capacity, "use_license"),
+      mAcquisitions(MetricsRegistry::Shared().GetCounter(
+          "msip_native_license_acquisitions_coalesced_total", "Use license acquisitions that waited for one already in flight")) {
+}
+
+shared_ptr<ProtectionHandler> UseLicenseCache::Find(const string& engineId, const string& contentId) {
+  shared_ptr<ProtectionHandler> protection;
+  mEntries.Find(MakeKey(engineId, contentId), protection, [](const shared_ptr<ProtectionHandler>& cached) { return !HasExpired(cached); });
+  return protection;
+}
+
+void UseLicenseCache::Put(const string& engineId, const string& contentId, const shared_ptr<ProtectionHandler>& protection) {
+  if (!protection || contentId.empty())
+    return;
+  mEntries.Put(MakeKey(engineId, contentId), protection, sample::tenant::Current());
+}
+
+shared_ptr<ProtectionHandler> UseLicenseCache::GetOrAcquire(
+    const string& engineId,
+    const string& contentId,
+    const Acquirer& acquire) {
+  auto protection = Find(engineId, contentId);
+  if (protection)
+    return protection;
+  return mAcquisitions.Do(MakeKey(engineId, contentId), [&]() {
+    // The handler is counted as cache memory, since the cache is what keeps it alive.
+    sample::alloc::ScopedSubsystem subsystem(sample::alloc::Subsystem::Caches);
+    auto acquired = acquire();
+    Put(engineId, contentId, acquired);
+    return acquired;
+  });
+}
+
+void UseLicenseCache::SetCapacity(size_t capacity) {
+  mEntries.SetCapacity(capacity);
+}
+
+void UseLicenseCache::SetTenantCapacity(size_t capacity) {
+  mEntries.SetGroupCapacity(capacity);
+}
+
+UseLicenseCache::Stats UseLicenseCache::GetStats() const {
+  const auto entries = mEntries.GetStats();
+  Stats stats;
+  stats.hits = entries.hits;
+  stats.misses = entries.misses;
+  stats.evictions = entries.evictions;
+  stats.size = entries.size;
+  stats.capacity = entries.capacity;
+  stats.lockWaits = entries.lockWaits;
+  return stats;
+}
+
+void UseLicenseCache::Clear() {
+  mEntries.Clear();
+}
+
+string UseLicenseCache::MakeKey(const string& engineId, const string& contentId) {
+  return engineId + kKeySeparator + contentId;
+}
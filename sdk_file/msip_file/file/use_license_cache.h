@@ -0,0 +1,103 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_USE_LICENSE_CACHE_H_
+#define SAMPLE_FILE_USE_LICENSE_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "mip/protection/protection_handler.h"
+#include "sharded_lru.h"
+#include "single_flight.h"
+
+// LRU of consumption handlers keyed by engine id (which covers the user) and content id. An entry means
+// the engine already holds a use license for that content, so later files from the same publishing
+// license open against the SDK's license cache instead of the service. Entries for content with an
+// expiry are dropped once it passes.
+class UseLicenseCache final {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+    // Writes that waited for a shard lock (see ShardedLru::Stats).
+    uint64_t lockWaits;
+  };
+
+  // Opens a file of the content through the service and returns its handler.
+  typedef std::function<std::shared_ptr<mip::ProtectionHandler>()> Acquirer;
+
+  static const size_t kDefaultCapacity = 1024;
+
+  explicit UseLicenseCache(size_t capacity = kDefaultCapacity);
+
+  std::shared_ptr<mip::ProtectionHandler> Find(const std::string& engineId, const std::string& contentId);
+
+  void Put(
+      const std::string& engineId,
+      const std::string& contentId,
+      const std::shared_ptr<mip::ProtectionHandler>& protection);
+
+  // Find, or on a miss acquire and Put. Concurrent misses for the same engine and content share one
+  // acquisition, so a burst of opens for cold content asks the service once.
+  std::shared_ptr<mip::ProtectionHandler> GetOrAcquire(
+      const std::string& engineId,
+      const std::string& contentId,
+      const Acquirer& acquire);
+
+  // Shrinking the capacity evicts least recently used entries immediately. Zero disables the cache.
+  void SetCapacity(size_t capacity);
+
+  // Caps the handlers put by each tenant (see tenant_context.h), so one tenant's bulk job cannot evict
+  // every other tenant's licenses. Zero lifts the cap.
+  void SetTenantCapacity(size_t capacity);
+
+  Stats GetStats() const;
+
+  // Entries each tenant put, by tenant (see SetTenantCapacity).
+  std::map<std::string, size_t> GetTenantSizes() const { return mEntries.GetGroupSizes(); }
+
+  // Entries held and the most kept, without locking (see ShardedLru::GetSize).
+  size_t GetSize() const { return mEntries.GetSize(); }
+  size_t GetCapacity() const { return mEntries.GetCapacity(); }
+
+  // Drops every handler. Called before the engines they were created with are unloaded.
+  void Clear();
+
+private:
+  static std::string MakeKey(const std::string& engineId, const std::string& contentId);
+
+  ShardedLru<std::shared_ptr<mip::ProtectionHandler>> mEntries;
+  SingleFlight<std::shared_ptr<mip::ProtectionHandler>> mAcquisitions;
+};
+
+#endif // SAMPLE_FILE_USE_LICENSE_CACHE_H_
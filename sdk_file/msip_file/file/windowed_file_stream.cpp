@@ -0,0 +1,187 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "windowed_file_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+// Windows start on page boundaries, which keeps the reads behind them aligned for the page cache.
+const int64_t kPageSize = 4096;
+
+string ErrnoMessage(const string& what, const string& filePath) {
+  return what + " '" + filePath + "': " + strerror(errno);
+}
+
+MetricsRegistry::Counter& InputBytes() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_windowed_input_bytes_total", "Bytes the SDK read from windowed input files");
+  return counter;
+}
+
+MetricsRegistry::Counter& Refills() {
+  static auto& counter = MetricsRegistry::Shared().GetCounter(
+      "msip_native_windowed_input_refills_total", "Windows read from disk for windowed input files");
+  return counter;
+}
+
+} // namespace
+
+WindowedFileStream::WindowedFileStream(const string& filePath, size_t windowBytes, size_t readAheadBytes)
+    : mFilePath(filePath),
+      mFd(-1),
+      mSize(0),
+      mPosition(0),
+      mWindowStart(0),
+      mWindowLength(0),
+      mReadAheadBytes(readAheadBytes),
+      mReadAheadEnd(0) {
+  if (windowBytes < static_cast<size_t>(kPageSize))
+    throw runtime_error("Window must be at least one page");
+  mFd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (mFd < 0)
+    throw runtime_error(ErrnoMessage("Failed to open", filePath));
+
+  struct stat fileInfo;
+  if (fstat(mFd, &fileInfo) != 0) {
+    auto message = ErrnoMessage("Failed to stat", filePath);
+    close(mFd);
+    throw runtime_error(message);
+  }
+  mSize = static_cast<int64_t>(fileInfo.st_size);
+  // Advisory only: doubles the kernel's own readahead for the front to back scans the SDK mostly does.
+  posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  try {
+    mWindow = BufferPool::Shared().Acquire(windowBytes);
+  } catch (...) {
+    close(mFd);
+    throw;
+  }
+}
+
+WindowedFileStream::~WindowedFileStream() {
+  close(mFd);
+}
+
+size_t WindowedFileStream::ReadAt(uint8_t* buffer, size_t length, int64_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    const ssize_t count = pread(mFd, buffer + done, length - done, static_cast<off_t>(offset + done));
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      throw runtime_error(ErrnoMessage("Failed to read", mFilePath));
+    if (count == 0)
+      break;
+    done += static_cast<size_t>(count);
+  }
+  return done;
+}
+
+void WindowedFileStream::Refill(int64_t position) {
+  mWindowStart = position - position % kPageSize;
+  const size_t length = static_cast<size_t>(std::min<int64_t>(
+      static_cast<int64_t>(mWindow.Capacity()), mSize - mWindowStart));
+  mWindowLength = ReadAt(mWindow.Data(), length, mWindowStart);
+  Refills().Add(1);
+
+  const int64_t windowEnd = mWindowStart + static_cast<int64_t>(mWindowLength);
+  if (mReadAheadBytes > 0 && windowEnd < mSize) {
+    // Only the part not asked for already, so a scan issues one advice per window.
+    const int64_t aheadStart = std::max(windowEnd, mReadAheadEnd);
+    const int64_t aheadEnd = std::min(mSize, windowEnd + static_cast<int64_t>(mReadAheadBytes));
+    if (aheadEnd > aheadStart) {
+      posix_fadvise(mFd, static_cast<off_t>(aheadStart), static_cast<off_t>(aheadEnd - aheadStart), POSIX_FADV_WILLNEED);
+      mReadAheadEnd = aheadEnd;
+    }
+  }
+}
+
+int64_t WindowedFileStream::Read(uint8_t* buffer, int64_t bufferLength) {
+  if (bufferLength <= 0 || mPosition >= mSize)
+    return 0;
+  const int64_t wanted = std::min(bufferLength, mSize - mPosition);
+  int64_t done = 0;
+  while (done < wanted) {
+    const int64_t position = mPosition + done;
+    const int64_t windowEnd = mWindowStart + static_cast<int64_t>(mWindowLength);
+    if (position >= mWindowStart && position < windowEnd) {
+      const int64_t count = std::min(wanted - done, windowEnd - position);
+      memcpy(buffer + done, mWindow.Data() + (position - mWindowStart), static_cast<size_t>(count));
+      done += count;
+    } else if (wanted - done >= static_cast<int64_t>(mWindow.Capacity())) {
+      // Copying through the window would only add a copy.
+      const size_t count = ReadAt(buffer + done, static_cast<size_t>(wanted - done), position);
+      done += static_cast<int64_t>(count);
+      if (count == 0)
+        break;
+    } else {
+      Refill(position);
+      if (position >= mWindowStart + static_cast<int64_t>(mWindowLength))
+        break;  // The file shrank under us.
+    }
+  }
+  mPosition += done;
+  InputBytes().Add(static_cast<uint64_t>(done));
+  return done;
+}
+
+int64_t WindowedFileStream::Write(const uint8_t* /* buffer */, int64_t /* bufferLength */) {
+  throw runtime_error("Stream is read-only");
+}
+
+bool WindowedFileStream::Flush() { return true; }
+
+void WindowedFileStream::Seek(int64_t position) {
+  if (position < 0)
+    throw runtime_error("Position must not be less than zero.");
+  if (position > mSize)
+    throw runtime_error("Position must not be larger than size.");
+  mPosition = position;
+}
+
+bool WindowedFileStream::CanRead() const { return true; }
+
+bool WindowedFileStream::CanWrite() const { return false; }
+
+int64_t WindowedFileStream::Position() { return mPosition; }
+
+int64_t WindowedFileStream::Size() { return mSize; }
+
+void WindowedFileStream::Size(int64_t /* value */) { throw runtime_error("Stream is read-only"); }
@@ -0,0 +1,77 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_WINDOWED_FILE_STREAM_H_
+#define SAMPLE_FILE_WINDOWED_FILE_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "mip/stream.h"
+
+#include "buffer_pool.h"
+
+// Read-only mip::Stream over a file that holds at most one window of it in memory, for inputs too large to
+// map without their pages counting towards RSS. Reads inside the window are copies; a read outside it
+// refills the window with pread, and reads of a window or more go straight into the caller's buffer. After
+// each refill the kernel is asked to start reading the next readAheadBytes, so a front to back scan rarely
+// waits on the disk.
+class WindowedFileStream final : public mip::Stream {
+public:
+  WindowedFileStream(const std::string& filePath, size_t windowBytes, size_t readAheadBytes);
+  ~WindowedFileStream();
+  int64_t Read(uint8_t* buffer, int64_t bufferLength) override;
+  int64_t Write(const uint8_t* buffer, int64_t bufferLength) override;
+  bool Flush() override;
+  void Seek(int64_t position) override;
+  bool CanRead() const override;
+  bool CanWrite() const override;
+  int64_t Position() override;
+  int64_t Size() override;
+  void Size(int64_t value) override;
+
+private:
+  WindowedFileStream(const WindowedFileStream&) = delete;
+  WindowedFileStream& operator=(const WindowedFileStream&) = delete;
+
+  // Reads length bytes at offset into buffer, fewer only at the end of the file.
+  size_t ReadAt(uint8_t* buffer, size_t length, int64_t offset);
+  void Refill(int64_t position);
+
+  std::string mFilePath;
+  int mFd;
+  int64_t mSize;
+  int64_t mPosition;
+  BufferPool::Buffer mWindow;
+  int64_t mWindowStart;
+  size_t mWindowLength;
+  size_t mReadAheadBytes;
+  // End of the range the kernel was last asked to read ahead.
+  int64_t mReadAheadEnd;
+};
+
+#endif // SAMPLE_FILE_WINDOWED_FILE_STREAM_H_
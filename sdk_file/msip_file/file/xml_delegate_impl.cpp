@@ -0,0 +1,1190 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "xml_delegate_impl.h"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "mip/error.h"
+#include "mip/xml_document.h"
+#include "mip/xml_node.h"
+#include "mip/xml_reader.h"
+#include "xml_scanner.h"
+
+using mip::xml::XmlNodeType;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Deeper than any policy, so a hostile document cannot exhaust the stack of the recursive serializer.
+const size_t kMaxDepth = 1024;
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool IsNameEnd(char c) {
+  return IsSpace(c) || c == '>' || c == '/' || c == '=' || c == '?' || c == '<' || c == '"' || c == '\'';
+}
+
+// The part of a qualified name after its prefix.
+string LocalName(const string& name) {
+  const auto colon = name.find(':');
+  return colon == string::npos ? name : name.substr(colon + 1);
+}
+
+bool IsNamespaceDeclaration(const string& name) {
+  return name == "xmlns" || name.compare(0, 6, "xmlns:") == 0;
+}
+
+// A run of the input, which outlives it.
+struct Slice {
+  const char* data;
+  size_t size;
+
+  string ToString() const { return string(data, size); }
+  bool IsBlank() const {
+    for (size_t i = 0; i < size; ++i) {
+      if (!IsSpace(data[i]))
+        return false;
+    }
+    return true;
+  }
+};
+
+string Decode(const Slice& raw) {
+  if (!memchr(raw.data, '&', raw.size))
+    return raw.ToString();
+  return DecodeEntities(raw.ToString());
+}
+
+// Each distinct name of a document is stored once, so names compare by address and element names cost one
+// allocation per document rather than one per element. Open addressing over FNV-1a hashes.
+class NameTable final {
+public:
+  NameTable() : mSlots(256, nullptr), mCount(0) {}
+
+  const string* Intern(const char* name, size_t size) {
+    size_t i = Hash(name, size) & (mSlots.size() - 1);
+    for (; mSlots[i]; i = (i + 1) & (mSlots.size() - 1)) {
+      if (mSlots[i]->size() == size && memcmp(mSlots[i]->data(), name, size) == 0)
+        return mSlots[i];
+    }
+    mNames.emplace_back(name, size);
+    const string* interned = &mNames.back();
+    mSlots[i] = interned;
+    if (++mCount * 2 > mSlots.size())
+      Grow();
+    return interned;
+  }
+
+  const string* Intern(const string& name) { return Intern(name.data(), name.size()); }
+
+private:
+  static size_t Hash(const char* name, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+      hash ^= static_cast<unsigned char>(name[i]);
+      hash *= 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+  }
+
+  void Grow() {
+    vector<const string*> slots(mSlots.size() * 2, nullptr);
+    for (const auto* name : mSlots) {
+      if (!name)
+        continue;
+      size_t i = Hash(name->data(), name->size()) & (slots.size() - 1);
+      while (slots[i])
+        i = (i + 1) & (slots.size() - 1);
+      slots[i] = name;
+    }
+    mSlots.swap(slots);
+  }
+
+  // A deque never moves its elements, so interned names keep their addresses.
+  std::deque<string> mNames;
+  vector<const string*> mSlots;
+  size_t mCount;
+};
+
+struct Attribute {
+  const string* name;
+  Slice value;
+};
+
+// Splits the input into markup and text without copying any of it.
+class Tokenizer final {
+public:
+  enum class Kind { Start, End, Text, CData, Comment, Instruction, Declaration, Doctype, Eof };
+
+  Tokenizer(const string& input, NameTable& names)
+      : mBegin(input.data()),
+        mPos(input.data()),
+        mEnd(input.data() + input.size()),
+        mTokenBegin(input.data()),
+        mNames(names),
+        mName(nullptr),
+        mContent{input.data(), 0},
+        mSelfClosing(false) {
+    if (input.compare(0, 3, "\xEF\xBB\xBF") == 0)
+      mPos += 3;
+  }
+
+  Kind Next() {
+    mAttributes.clear();
+    mSelfClosing = false;
+    mName = nullptr;
+    mTokenBegin = mPos;
+    if (mPos == mEnd)
+      return Kind::Eof;
+    if (*mPos != '<') {
+      const auto* open = static_cast<const char*>(memchr(mPos, '<', mEnd - mPos));
+      const char* end = open ? open : mEnd;
+      mContent = Slice{mPos, static_cast<size_t>(end - mPos)};
+      mPos = end;
+      return Kind::Text;
+    }
+    if (StartsWith("<!--"))
+      return ReadDelimited(4, "-->", Kind::Comment);
+    if (StartsWith("<![CDATA["))
+      return ReadDelimited(9, "]]>", Kind::CData);
+    if (StartsWith("<!DOCTYPE"))
+      return ReadDoctype();
+    if (StartsWith("<?"))
+      return ReadInstruction();
+    if (StartsWith("</")) {
+      mPos += 2;
+      mName = ReadName();
+      SkipSpace();
+      if (mPos == mEnd || *mPos != '>')
+        Fail("expected '>'");
+      ++mPos;
+      return Kind::End;
+    }
+    if (StartsWith("<!"))
+      Fail("unsupported markup");
+    ++mPos;
+    mName = ReadName();
+    ReadAttributes();
+    return Kind::Start;
+  }
+
+  // The whole token as written.
+  Slice Raw() const { return Slice{mTokenBegin, static_cast<size_t>(mPos - mTokenBegin)}; }
+  // Of an element, the target of an instruction or the root named by a doctype.
+  const string* Name() const { return mName; }
+  // Raw text, the inside of a CDATA section or comment, or the data of an instruction.
+  const Slice& Content() const { return mContent; }
+  bool IsSelfClosing() const { return mSelfClosing; }
+  const vector<Attribute>& Attributes() const { return mAttributes; }
+
+  [[noreturn]] void Fail(const char* what) const {
+    throw mip::BadInputError(string("Invalid XML at offset ") + std::to_string(mTokenBegin - mBegin) + ": " + what);
+  }
+
+private:
+  bool StartsWith(const char* prefix) const {
+    const size_t size = strlen(prefix);
+    return static_cast<size_t>(mEnd - mPos) >= size && memcmp(mPos, prefix, size) == 0;
+  }
+
+  const char* Find(const char* from, const char* needle) const {
+    const size_t size = strlen(needle);
+    while (static_cast<size_t>(mEnd - from) >= size) {
+      const auto* first = static_cast<const char*>(memchr(from, needle[0], mEnd - from - size + 1));
+      if (!first)
+        return nullptr;
+      if (memcmp(first, needle, size) == 0)
+        return first;
+      from = first + 1;
+    }
+    return nullptr;
+  }
+
+  void SkipSpace() {
+    while (mPos < mEnd && IsSpace(*mPos))
+      ++mPos;
+  }
+
+  const string* ReadName() {
+    const char* start = mPos;
+    while (mPos < mEnd && !IsNameEnd(*mPos))
+      ++mPos;
+    if (mPos == start)
+      Fail("expected a name");
+    return mNames.Intern(start, mPos - start);
+  }
+
+  Kind ReadDelimited(size_t openSize, const char* close, Kind kind) {
+    const char* start = mPos + openSize;
+    const char* end = Find(start, close);
+    if (!end)
+      Fail("unterminated markup");
+    mContent = Slice{start, static_cast<size_t>(end - start)};
+    mPos = end + strlen(close);
+    return kind;
+  }
+
+  Kind ReadDoctype() {
+    mPos += 9;
+    SkipSpace();
+    mName = ReadName();
+    // The internal subset may hold '>' of its own declarations.
+    int depth = 0;
+    while (mPos < mEnd) {
+      const char c = *mPos++;
+      if (c == '[')
+        ++depth;
+      else if (c == ']')
+        --depth;
+      else if (c == '>' && depth <= 0)
+        return Kind::Doctype;
+    }
+    Fail("unterminated doctype");
+  }
+
+  Kind ReadInstruction() {
+    mPos += 2;
+    mName = ReadName();
+    const char* end = Find(mPos, "?>");
+    if (!end)
+      Fail("unterminated processing instruction");
+    SkipSpace();
+    const char* data = mPos < end ? mPos : end;
+    mContent = Slice{data, static_cast<size_t>(end - data)};
+    mPos = end + 2;
+    return *mName == "xml" ? Kind::Declaration : Kind::Instruction;
+  }
+
+  void ReadAttributes() {
+    for (;;) {
+      SkipSpace();
+      if (mPos == mEnd)
+        Fail("unterminated start tag");
+      if (*mPos == '>') {
+        ++mPos;
+        return;
+      }
+      if (*mPos == '/') {
+        if (mEnd - mPos < 2 || mPos[1] != '>')
+          Fail("expected '/>'");
+        mPos += 2;
+        mSelfClosing = true;
+        return;
+      }
+      const string* name = ReadName();
+      SkipSpace();
+      if (mPos == mEnd || *mPos != '=')
+        Fail("expected '='");
+      ++mPos;
+      SkipSpace();
+      if (mPos == mEnd || (*mPos != '"' && *mPos != '\''))
+        Fail("expected a quoted attribute value");
+      const char quote = *mPos++;
+      const auto* close = static_cast<const char*>(memchr(mPos, quote, mEnd - mPos));
+      if (!close)
+        Fail("unterminated attribute value");
+      mAttributes.push_back(Attribute{name, Slice{mPos, static_cast<size_t>(close - mPos)}});
+      mPos = close + 1;
+      if (mPos < mEnd && !IsSpace(*mPos) && *mPos != '>' && *mPos != '/')
+        Fail("expected whitespace between attributes");
+    }
+  }
+
+  const char* const mBegin;
+  const char* mPos;
+  const char* const mEnd;
+  const char* mTokenBegin;
+  NameTable& mNames;
+  const string* mName;
+  Slice mContent;
+  bool mSelfClosing;
+  vector<Attribute> mAttributes;
+};
+
+// Pulls one node at a time off the tokens, checking that elements nest. An empty element is one ELEMENT
+// node, without an END_ELEMENT.
+class Reader final : public mip::xml::XmlReader {
+public:
+  Reader(const shared_ptr<const string>& input, const shared_ptr<NameTable>& names)
+      : mInput(input),
+        mNames(names),
+        mTokenizer(*input, *names),
+        mType(XmlNodeType::NONE),
+        mPop(false),
+        mRootClosed(false),
+        mAttribute(-1) {
+  }
+
+  bool Read() override {
+    if (mPop) {
+      mOpen.pop_back();
+      mPop = false;
+      mRootClosed = mOpen.empty();
+    }
+    mAttribute = -1;
+    for (;;) {
+      switch (mTokenizer.Next()) {
+        case Tokenizer::Kind::Eof:
+          if (!mOpen.empty())
+            mTokenizer.Fail("unclosed element");
+          if (!mRootClosed)
+            mTokenizer.Fail("no root element");
+          mType = XmlNodeType::NONE;
+          return false;
+        case Tokenizer::Kind::Start:
+          if (mOpen.empty() && mRootClosed)
+            mTokenizer.Fail("more than one root element");
+          if (mOpen.size() == kMaxDepth)
+            mTokenizer.Fail("nested too deeply");
+          mOpen.push_back(Open{mTokenizer.Name(), mTokenizer.Raw()});
+          mPop = mTokenizer.IsSelfClosing();
+          mType = XmlNodeType::ELEMENT;
+          return true;
+        case Tokenizer::Kind::End:
+          if (mOpen.empty() || mOpen.back().name != mTokenizer.Name())
+            mTokenizer.Fail("mismatched end tag");
+          mPop = true;
+          mType = XmlNodeType::END_ELEMENT;
+          return true;
+        case Tokenizer::Kind::Text:
+          if (mTokenizer.Content().IsBlank()) {
+            if (mOpen.empty())
+              continue;
+            mType = XmlNodeType::SIGNIFICANT_WHITESPACE;
+            return true;
+          }
+          if (mOpen.empty())
+            mTokenizer.Fail("text outside the root element");
+          mType = XmlNodeType::TEXT;
+          return true;
+        case Tokenizer::Kind::CData:
+          if (mOpen.empty())
+            mTokenizer.Fail("CDATA outside the root element");
+          mType = XmlNodeType::CDATA;
+          return true;
+        case Tokenizer::Kind::Comment:
+          mType = XmlNodeType::COMMENT;
+          return true;
+        case Tokenizer::Kind::Instruction:
+          mType = XmlNodeType::PROCESSING_INSTRUCTION;
+          return true;
+        case Tokenizer::Kind::Declaration:
+          continue;
+        case Tokenizer::Kind::Doctype:
+          mType = XmlNodeType::DOCUMENT_TYPE;
+          return true;
+      }
+    }
+  }
+
+  XmlNodeType GetNodeType() const override {
+    return mAttribute >= 0 ? XmlNodeType::ATTRIBUTE : mType;
+  }
+
+  string GetName() const override {
+    string name;
+    if (!GetName(name))
+      throw mip::BadInputError("The XML reader is not on a node");
+    return name;
+  }
+
+  bool GetName(string& name) const override {
+    switch (GetNodeType()) {
+      case XmlNodeType::ATTRIBUTE: name = *CurrentAttribute().name; return true;
+      case XmlNodeType::ELEMENT:
+      case XmlNodeType::END_ELEMENT: name = *mOpen.back().name; return true;
+      case XmlNodeType::PROCESSING_INSTRUCTION:
+      case XmlNodeType::DOCUMENT_TYPE: name = *mTokenizer.Name(); return true;
+      case XmlNodeType::TEXT:
+      case XmlNodeType::SIGNIFICANT_WHITESPACE: name = "#text"; return true;
+      case XmlNodeType::CDATA: name = "#cdata-section"; return true;
+      case XmlNodeType::COMMENT: name = "#comment"; return true;
+      default: return false;
+    }
+  }
+
+  bool Skip() override {
+    MoveToElement();
+    if (mType == XmlNodeType::ELEMENT && !mTokenizer.IsSelfClosing())
+      SkipToEnd();
+    return Read();
+  }
+
+  bool GetValue(string& value) const override {
+    switch (GetNodeType()) {
+      case XmlNodeType::ATTRIBUTE: value = Decode(CurrentAttribute().value); return true;
+      case XmlNodeType::TEXT:
+      case XmlNodeType::SIGNIFICANT_WHITESPACE: value = Decode(mTokenizer.Content()); return true;
+      case XmlNodeType::CDATA:
+      case XmlNodeType::COMMENT:
+      case XmlNodeType::PROCESSING_INSTRUCTION: value = mTokenizer.Content().ToString(); return true;
+      default: return false;
+    }
+  }
+
+  string GetAncestors() const override {
+    string ancestors;
+    for (const auto& open : mOpen)
+      ancestors.append(open.startTag.data, open.startTag.size);
+    return ancestors;
+  }
+
+  bool IsEmptyElement() const override {
+    return mType == XmlNodeType::ELEMENT && mTokenizer.IsSelfClosing();
+  }
+
+  bool GetAttribute(const string& attributeName, string& attribute) const override {
+    if (mType != XmlNodeType::ELEMENT)
+      return false;
+    for (const auto& candidate : mTokenizer.Attributes()) {
+      if (*candidate.name == attributeName) {
+        attribute = Decode(candidate.value);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool HasAttributes() const override {
+    return mType == XmlNodeType::ELEMENT && !mTokenizer.Attributes().empty();
+  }
+
+  bool MoveToFirstAttribute() override {
+    if (!HasAttributes())
+      return false;
+    mAttribute = 0;
+    return true;
+  }
+
+  bool MoveToNextAttribute() override {
+    if (mType != XmlNodeType::ELEMENT || static_cast<size_t>(mAttribute + 1) >= mTokenizer.Attributes().size())
+      return false;
+    ++mAttribute;
+    return true;
+  }
+
+  bool MoveToElement() override {
+    if (mAttribute < 0)
+      return false;
+    mAttribute = -1;
+    return true;
+  }
+
+  string DumpNode() override {
+    MoveToElement();
+    const Slice start = mTokenizer.Raw();
+    if (mType != XmlNodeType::ELEMENT || mTokenizer.IsSelfClosing())
+      return start.ToString();
+    SkipToEnd();
+    const Slice end = mTokenizer.Raw();
+    return string(start.data, end.data + end.size);
+  }
+
+  // The token of the current node, for building documents.
+  const Tokenizer& Token() const { return mTokenizer; }
+  const shared_ptr<NameTable>& Names() const { return mNames; }
+
+private:
+  struct Open {
+    const string* name;
+    Slice startTag;
+  };
+
+  const Attribute& CurrentAttribute() const { return mTokenizer.Attributes()[mAttribute]; }
+
+  // From a non-empty element to its END_ELEMENT.
+  void SkipToEnd() {
+    const size_t depth = mOpen.size();
+    do {
+      Read();
+    } while (!(mType == XmlNodeType::END_ELEMENT && mOpen.size() == depth));
+  }
+
+  shared_ptr<const string> mInput;
+  shared_ptr<NameTable> mNames;
+  Tokenizer mTokenizer;
+  XmlNodeType mType;
+  vector<Open> mOpen;
+  // Whether the element on top of mOpen ends with the current node.
+  bool mPop;
+  bool mRootClosed;
+  int mAttribute;
+};
+
+struct DomNode {
+  explicit DomNode(XmlNodeType nodeType)
+      : type(nodeType), name(nullptr), parent(nullptr), firstChild(nullptr), lastChild(nullptr), prev(nullptr), next(nullptr) {
+  }
+
+  XmlNodeType type;
+  // Qualified name of an element, or the target of an instruction.
+  const string* name;
+  // Decoded text of a text node, the inside of a CDATA section or comment, the data of an instruction,
+  // or a doctype as written.
+  string text;
+  vector<std::pair<const string*, string>> attributes;
+  DomNode* parent;
+  DomNode* firstChild;
+  DomNode* lastChild;
+  DomNode* prev;
+  DomNode* next;
+};
+
+// Owns every node of a document; the nodes handed out keep it alive.
+struct DomState {
+  DomState() : names(make_shared<NameTable>()), document(New(XmlNodeType::DOCUMENT)) {}
+
+  DomNode* New(XmlNodeType type) {
+    nodes.emplace_back(type);
+    return &nodes.back();
+  }
+
+  static void Append(DomNode* parent, DomNode* child) {
+    child->parent = parent;
+    child->prev = parent->lastChild;
+    if (parent->lastChild)
+      parent->lastChild->next = child;
+    else
+      parent->firstChild = child;
+    parent->lastChild = child;
+  }
+
+  static void Unlink(DomNode* node) {
+    if (node->prev)
+      node->prev->next = node->next;
+    else if (node->parent)
+      node->parent->firstChild = node->next;
+    if (node->next)
+      node->next->prev = node->prev;
+    else if (node->parent)
+      node->parent->lastChild = node->prev;
+    node->parent = node->prev = node->next = nullptr;
+  }
+
+  shared_ptr<NameTable> names;
+  std::deque<DomNode> nodes;
+  DomNode* document;
+};
+
+DomNode* NewChild(DomState& state, DomNode* parent, XmlNodeType type, const string& text) {
+  DomNode* node = state.New(type);
+  node->text = text;
+  DomState::Append(parent, node);
+  return node;
+}
+
+void Build(Reader& reader, DomState& state) {
+  DomNode* current = state.document;
+  while (reader.Read()) {
+    const Tokenizer& token = reader.Token();
+    switch (reader.GetNodeType()) {
+      case XmlNodeType::ELEMENT: {
+        DomNode* element = state.New(XmlNodeType::ELEMENT);
+        element->name = token.Name();
+        element->attributes.reserve(token.Attributes().size());
+        for (const auto& attribute : token.Attributes())
+          element->attributes.emplace_back(attribute.name, Decode(attribute.value));
+        DomState::Append(current, element);
+        if (!token.IsSelfClosing())
+          current = element;
+        break;
+      }
+      case XmlNodeType::END_ELEMENT:
+        current = current->parent;
+        break;
+      case XmlNodeType::TEXT:
+      case XmlNodeType::SIGNIFICANT_WHITESPACE:
+        NewChild(state, current, XmlNodeType::TEXT, Decode(token.Content()));
+        break;
+      case XmlNodeType::CDATA:
+      case XmlNodeType::COMMENT:
+        NewChild(state, current, reader.GetNodeType(), token.Content().ToString());
+        break;
+      case XmlNodeType::PROCESSING_INSTRUCTION:
+        NewChild(state, current, XmlNodeType::PROCESSING_INSTRUCTION, token.Content().ToString())->name = token.Name();
+        break;
+      case XmlNodeType::DOCUMENT_TYPE:
+        NewChild(state, current, XmlNodeType::DOCUMENT_TYPE, token.Raw().ToString());
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void AppendEscaped(string& out, const string& text, bool attribute) {
+  for (char c : text) {
+    switch (c) {
+      case '&': out += "&amp;"; break;
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      case '"':
+        if (attribute)
+          out += "&quot;";
+        else
+          out += c;
+        break;
+      default: out += c;
+    }
+  }
+}
+
+void Serialize(const DomNode& node, string& out) {
+  switch (node.type) {
+    case XmlNodeType::DOCUMENT:
+      for (const DomNode* child = node.firstChild; child; child = child->next)
+        Serialize(*child, out);
+      break;
+    case XmlNodeType::ELEMENT:
+      out += '<';
+      out += *node.name;
+      for (const auto& attribute : node.attributes) {
+        out += ' ';
+        out += *attribute.first;
+        out += "=\"";
+        AppendEscaped(out, attribute.second, true);
+        out += '"';
+      }
+      if (!node.firstChild) {
+        out += "/>";
+        break;
+      }
+      out += '>';
+      for (const DomNode* child = node.firstChild; child; child = child->next)
+        Serialize(*child, out);
+      out += "</";
+      out += *node.name;
+      out += '>';
+      break;
+    case XmlNodeType::TEXT: AppendEscaped(out, node.text, false); break;
+    case XmlNodeType::CDATA: out += "<![CDATA[" + node.text + "]]>"; break;
+    case XmlNodeType::COMMENT: out += "<!--" + node.text + "-->"; break;
+    case XmlNodeType::PROCESSING_INSTRUCTION:
+      out += "<?" + *node.name;
+      if (!node.text.empty())
+        out += ' ' + node.text;
+      out += "?>";
+      break;
+    case XmlNodeType::DOCUMENT_TYPE: out += node.text; break;
+    default: break;
+  }
+}
+
+void AppendText(const DomNode& node, string& out) {
+  if (node.type == XmlNodeType::TEXT || node.type == XmlNodeType::CDATA) {
+    out += node.text;
+    return;
+  }
+  if (node.type != XmlNodeType::ELEMENT && node.type != XmlNodeType::DOCUMENT)
+    return;
+  for (const DomNode* child = node.firstChild; child; child = child->next)
+    AppendText(*child, out);
+}
+
+// The namespace URI prefix is bound to where node is, empty when unbound.
+string LookupNamespace(const DomNode* node, const string& prefix) {
+  const string declaration = prefix.empty() ? string("xmlns") : "xmlns:" + prefix;
+  for (; node; node = node->parent) {
+    for (const auto& attribute : node->attributes) {
+      if (*attribute.first == declaration)
+        return attribute.second;
+    }
+  }
+  return string();
+}
+
+// The prefix bound to uri where node is; false when none is.
+bool LookupPrefix(const DomNode* node, const string& uri, string& prefix) {
+  for (; node; node = node->parent) {
+    for (const auto& attribute : node->attributes) {
+      if (attribute.second != uri || !IsNamespaceDeclaration(*attribute.first))
+        continue;
+      prefix = attribute.first->size() > 6 ? attribute.first->substr(6) : string();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Evaluates the XPath subset the header lists.
+class XPath final {
+public:
+  static vector<DomNode*> Select(const string& xpath, DomNode* context, DomNode* document) {
+    if (xpath.empty())
+      Unsupported(xpath);
+    vector<DomNode*> nodes(1, xpath[0] == '/' ? document : context);
+    size_t pos = 0;
+    if (xpath == "/")
+      return nodes;
+    bool first = xpath[0] != '/';
+    while (pos < xpath.size()) {
+      bool descendants = false;
+      if (xpath.compare(pos, 2, "//") == 0) {
+        descendants = true;
+        pos += 2;
+      } else if (xpath[pos] == '/') {
+        ++pos;
+      } else if (!first) {
+        Unsupported(xpath);
+      }
+      first = false;
+      const size_t end = StepEnd(xpath, pos);
+      if (end == pos)
+        Unsupported(xpath);
+      const Step step = ParseStep(xpath, xpath.substr(pos, end - pos));
+      pos = end;
+      if (descendants)
+        nodes = DescendantsOrSelf(nodes);
+      nodes = Apply(step, nodes, descendants, xpath);
+    }
+    return nodes;
+  }
+
+private:
+  enum class Test { Self, Parent, Element, AnyElement, Text, AnyNode };
+
+  struct Predicate {
+    // 0 for an attribute predicate.
+    size_t position;
+    string attribute;
+    bool hasValue;
+    string value;
+  };
+
+  struct Step {
+    Test test;
+    string name;
+    vector<Predicate> predicates;
+  };
+
+  [[noreturn]] static void Unsupported(const string& xpath) {
+    throw mip::BadInputError("Unsupported XPath: " + xpath);
+  }
+
+  // The end of the step starting at pos: the next '/' outside predicates and quotes.
+  static size_t StepEnd(const string& xpath, size_t pos) {
+    int depth = 0;
+    char quote = 0;
+    for (; pos < xpath.size(); ++pos) {
+      const char c = xpath[pos];
+      if (quote) {
+        if (c == quote)
+          quote = 0;
+      } else if (c == '\'' || c == '"') {
+        quote = c;
+      } else if (c == '[') {
+        ++depth;
+      } else if (c == ']') {
+        --depth;
+      } else if (c == '/' && depth == 0) {
+        break;
+      }
+    }
+    return pos;
+  }
+
+  // The ']' closing the predicate opened at pos, outside quotes.
+  static size_t PredicateEnd(const string& text, size_t pos) {
+    char quote = 0;
+    for (++pos; pos < text.size(); ++pos) {
+      const char c = text[pos];
+      if (quote) {
+        if (c == quote)
+          quote = 0;
+      } else if (c == '\'' || c == '"') {
+        quote = c;
+      } else if (c == ']') {
+        return pos;
+      }
+    }
+    return string::npos;
+  }
+
+  static string Trim(const string& text) {
+    size_t begin = 0;
+    size_t end = text.size();
+    while (begin < end && IsSpace(text[begin]))
+      ++begin;
+    while (end > begin && IsSpace(text[end - 1]))
+      --end;
+    return text.substr(begin, end - begin);
+  }
+
+  static Predicate ParsePredicate(const string& xpath, const string& text) {
+    Predicate predicate{0, string(), false, string()};
+    if (!text.empty() && text.find_first_not_of("0123456789") == string::npos) {
+      predicate.position = std::stoul(text);
+      if (predicate.position == 0)
+        Unsupported(xpath);
+      return predicate;
+    }
+    if (text.size() < 2 || text[0] != '@')
+      Unsupported(xpath);
+    const auto equals = text.find('=');
+    predicate.attribute = Trim(text.substr(1, equals == string::npos ? string::npos : equals - 1));
+    if (predicate.attribute.empty())
+      Unsupported(xpath);
+    if (equals == string::npos)
+      return predicate;
+    const string value = Trim(text.substr(equals + 1));
+    if (value.size() < 2 || (value[0] != '\'' && value[0] != '"') || value.back() != value[0])
+      Unsupported(xpath);
+    predicate.hasValue = true;
+    predicate.value = value.substr(1, value.size() - 2);
+    return predicate;
+  }
+
+  static Step ParseStep(const string& xpath, const string& text) {
+    Step step;
+    const auto bracket = text.find('[');
+    const string test = text.substr(0, bracket);
+    if (test == ".")
+      step.test = Test::Self;
+    else if (test == "..")
+      step.test = Test::Parent;
+    else if (test == "*")
+      step.test = Test::AnyElement;
+    else if (test == "text()")
+      step.test = Test::Text;
+    else if (test == "node()")
+      step.test = Test::AnyNode;
+    else if (!test.empty() && test.find_first_of("()@=[]' \"") == string::npos && test.find(':') == test.rfind(':'))
+      step.test = Test::Element;
+    else
+      Unsupported(xpath);
+    step.name = test;
+    for (size_t pos = bracket; pos < text.size();) {
+      const size_t end = PredicateEnd(text, pos);
+      if (text[pos] != '[' || end == string::npos)
+        Unsupported(xpath);
+      step.predicates.push_back(ParsePredicate(xpath, Trim(text.substr(pos + 1, end - pos - 1))));
+      pos = end + 1;
+    }
+    return step;
+  }
+
+  static bool Matches(const Step& step, const DomNode* node) {
+    switch (step.test) {
+      case Test::AnyElement: return node->type == XmlNodeType::ELEMENT;
+      case Test::Text: return node->type == XmlNodeType::TEXT || node->type == XmlNodeType::CDATA;
+      case Test::AnyNode: return true;
+      case Test::Element:
+        // An unprefixed name matches the element in any namespace, as policy XPaths do not bind prefixes.
+        return node->type == XmlNodeType::ELEMENT &&
+            (*node->name == step.name || (step.name.find(':') == string::npos && LocalName(*node->name) == step.name));
+      default: return false;
+    }
+  }
+
+  static bool Holds(const Predicate& predicate, const DomNode* node) {
+    for (const auto& attribute : node->attributes) {
+      if (*attribute.first == predicate.attribute)
+        return !predicate.hasValue || attribute.second == predicate.value;
+    }
+    return false;
+  }
+
+  // Subtrees of several nodes can nest, so they are deduplicated; one node's needs no set.
+  static vector<DomNode*> DescendantsOrSelf(const vector<DomNode*>& nodes) {
+    vector<DomNode*> expanded;
+    std::unordered_set<const DomNode*> seen;
+    vector<DomNode*> pending;
+    for (auto* node : nodes) {
+      pending.push_back(node);
+      while (!pending.empty()) {
+        DomNode* current = pending.back();
+        pending.pop_back();
+        if (nodes.size() > 1 && !seen.insert(current).second)
+          continue;
+        expanded.push_back(current);
+        for (DomNode* child = current->lastChild; child; child = child->prev)
+          pending.push_back(child);
+      }
+    }
+    return expanded;
+  }
+
+  static vector<DomNode*> Apply(const Step& step, const vector<DomNode*>& contexts, bool descendants, const string& xpath) {
+    vector<DomNode*> selected;
+    std::unordered_set<const DomNode*> seen;
+    vector<DomNode*> candidates;
+    for (auto* context : contexts) {
+      candidates.clear();
+      if (step.test == Test::Self) {
+        candidates.push_back(context);
+      } else if (step.test == Test::Parent) {
+        if (descendants)
+          Unsupported(xpath);
+        if (context->parent)
+          candidates.push_back(context->parent);
+      } else {
+        for (DomNode* child = context->firstChild; child; child = child->next) {
+          if (Matches(step, child))
+            candidates.push_back(child);
+        }
+      }
+      for (const auto& predicate : step.predicates) {
+        vector<DomNode*> kept;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+          if (predicate.position ? i + 1 == predicate.position : Holds(predicate, candidates[i]))
+            kept.push_back(candidates[i]);
+        }
+        candidates.swap(kept);
+      }
+      // Children of distinct nodes are distinct; only . and .. can select a node twice.
+      for (auto* candidate : candidates) {
+        if ((step.test != Test::Self && step.test != Test::Parent) || seen.insert(candidate).second)
+          selected.push_back(candidate);
+      }
+    }
+    return selected;
+  }
+};
+
+class Node final : public mip::xml::XmlNode {
+public:
+  Node(const shared_ptr<DomState>& state, DomNode* node) : mState(state), mNode(node) {}
+
+  DomNode* GetDomNode() const { return mNode; }
+  const shared_ptr<DomState>& GetState() const { return mState; }
+
+  string GetAttributeValue(const string& attributeName) const override {
+    if (!mNode)
+      return string();
+    for (const auto& attribute : mNode->attributes) {
+      if (*attribute.first == attributeName)
+        return attribute.second;
+    }
+    if (attributeName.find(':') != string::npos)
+      return string();
+    for (const auto& attribute : mNode->attributes) {
+      if (!IsNamespaceDeclaration(*attribute.first) && LocalName(*attribute.first) == attributeName)
+        return attribute.second;
+    }
+    return string();
+  }
+
+  vector<std::pair<string, string>> GetAttributes() const override {
+    vector<std::pair<string, string>> attributes;
+    if (!mNode)
+      return attributes;
+    for (const auto& attribute : mNode->attributes) {
+      if (!IsNamespaceDeclaration(*attribute.first))
+        attributes.emplace_back(*attribute.first, attribute.second);
+    }
+    return attributes;
+  }
+
+  shared_ptr<mip::xml::XmlNode> GetNextNode() const override {
+    return make_shared<Node>(mState, mNode ? mNode->next : nullptr);
+  }
+
+  shared_ptr<mip::xml::XmlNode> GetFirstChild() const override {
+    return make_shared<Node>(mState, mNode ? mNode->firstChild : nullptr);
+  }
+
+  string GetName() const override {
+    if (!mNode)
+      return string();
+    switch (mNode->type) {
+      case XmlNodeType::ELEMENT: return LocalName(*mNode->name);
+      case XmlNodeType::PROCESSING_INSTRUCTION: return *mNode->name;
+      case XmlNodeType::TEXT: return "text";
+      case XmlNodeType::COMMENT: return "comment";
+      default: return string();
+    }
+  }
+
+  string GetContent() const override {
+    string content;
+    if (!mNode)
+      return content;
+    if (mNode->type != XmlNodeType::ELEMENT && mNode->type != XmlNodeType::DOCUMENT)
+      return mNode->text;
+    AppendText(*mNode, content);
+    return content;
+  }
+
+  string GetInnerText() const override { return GetContent(); }
+
+  mip::xml::XmlNamespace GetNamespace() const override {
+    mip::xml::XmlNamespace xmlNamespace;
+    if (!mNode || mNode->type != XmlNodeType::ELEMENT)
+      return xmlNamespace;
+    const auto colon = mNode->name->find(':');
+    xmlNamespace.prefix = colon == string::npos ? string() : mNode->name->substr(0, colon);
+    xmlNamespace.uri = LookupNamespace(mNode, xmlNamespace.prefix);
+    return xmlNamespace;
+  }
+
+  XmlNodeType GetNodeType() const override { return mNode ? mNode->type : XmlNodeType::NONE; }
+
+  bool IsNull() const override { return mNode == nullptr; }
+
+  void AddAttribute(const string& attributeName, const string& attributeValue) override {
+    ExpectElement();
+    const string* name = mState->names->Intern(attributeName);
+    for (auto& attribute : mNode->attributes) {
+      if (attribute.first == name) {
+        attribute.second = attributeValue;
+        return;
+      }
+    }
+    mNode->attributes.emplace_back(name, attributeValue);
+  }
+
+  int RemoveAttribute(const string& attributeName) override {
+    if (!mNode)
+      return -1;
+    for (auto it = mNode->attributes.begin(); it != mNode->attributes.end(); ++it) {
+      if (*it->first == attributeName) {
+        mNode->attributes.erase(it);
+        return 0;
+      }
+    }
+    return -1;
+  }
+
+  shared_ptr<mip::xml::XmlNode> AddNewChild(const string& name) override {
+    ExpectElement();
+    DomNode* child = mState->New(XmlNodeType::ELEMENT);
+    child->name = mState->names->Intern(name);
+    DomState::Append(mNode, child);
+    return make_shared<Node>(mState, child);
+  }
+
+  shared_ptr<mip::xml::XmlNode> AddNewChild(const string& name, const string& namespaceName) override {
+    ExpectElement();
+    string prefix;
+    const bool bound = LookupPrefix(mNode, namespaceName, prefix);
+    DomNode* child = mState->New(XmlNodeType::ELEMENT);
+    child->name = mState->names->Intern(prefix.empty() ? name : prefix + ":" + name);
+    if (!bound)
+      child->attributes.emplace_back(mState->names->Intern("xmlns"), namespaceName);
+    DomState::Append(mNode, child);
+    return make_shared<Node>(mState, child);
+  }
+
+  bool AddContent(const string& content) override {
+    if (!mNode)
+      return false;
+    if (mNode->type == XmlNodeType::TEXT || mNode->type == XmlNodeType::CDATA || mNode->type == XmlNodeType::COMMENT) {
+      mNode->text += content;
+      return true;
+    }
+    if (mNode->type != XmlNodeType::ELEMENT)
+      return false;
+    if (mNode->lastChild && mNode->lastChild->type == XmlNodeType::TEXT)
+      mNode->lastChild->text += content;
+    else
+      NewChild(*mState, mNode, XmlNodeType::TEXT, content);
+    return true;
+  }
+
+  bool RemoveNodeFromDocument() override {
+    if (!mNode || !mNode->parent)
+      return false;
+    DomState::Unlink(mNode);
+    return true;
+  }
+
+private:
+  void ExpectElement() const {
+    if (!mNode || mNode->type != XmlNodeType::ELEMENT)
+      throw mip::BadInputError("XML node is not an element");
+  }
+
+  shared_ptr<DomState> mState;
+  DomNode* mNode;
+};
+
+class Document final : public mip::xml::XmlDocument {
+public:
+  explicit Document(const shared_ptr<DomState>& state) : mState(state) {}
+
+  vector<shared_ptr<mip::xml::XmlNode>> SelectNodes(
+      const string& xpath,
+      const shared_ptr<mip::xml::XmlNode>& node) const override {
+    DomNode* context = mState->document;
+    if (node) {
+      const auto* own = dynamic_cast<const Node*>(node.get());
+      if (!own || own->GetState() != mState || own->IsNull())
+        throw mip::BadInputError("XPath context node is not a node of this document");
+      context = own->GetDomNode();
+    }
+    vector<shared_ptr<mip::xml::XmlNode>> nodes;
+    for (auto* selected : XPath::Select(xpath, context, mState->document))
+      nodes.push_back(make_shared<Node>(mState, selected));
+    return nodes;
+  }
+
+  string GetXmlContent() const override {
+    string content;
+    Serialize(*mState->document, content);
+    return content;
+  }
+
+  shared_ptr<mip::xml::XmlNode> GetRootNode() const override {
+    DomNode* root = mState->document->firstChild;
+    while (root && root->type != XmlNodeType::ELEMENT)
+      root = root->next;
+    return make_shared<Node>(mState, root);
+  }
+
+private:
+  shared_ptr<DomState> mState;
+};
+
+} // namespace
+
+mip::xml::XmlReaderResult XmlDelegateImpl::CreateXmlReader(const string& xmlParserInput) const {
+  return mip::xml::XmlReaderResult(make_shared<Reader>(make_shared<const string>(xmlParserInput), make_shared<NameTable>()));
+}
+
+mip::xml::XmlDocumentResult XmlDelegateImpl::ParseData(const string& data) const {
+  try {
+    auto state = make_shared<DomState>();
+    // The input is only read while the document is built, so the reader borrows it.
+    Reader reader(shared_ptr<const string>(shared_ptr<const string>(), &data), state->names);
+    Build(reader, *state);
+    return mip::xml::XmlDocumentResult(make_shared<Document>(state));
+  } catch (...) {
+    return mip::xml::XmlDocumentResult(std::current_exception());
+  }
+}
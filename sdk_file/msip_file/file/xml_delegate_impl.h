@@ -0,0 +1,49 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_FILE_XML_DELEGATE_IMPL_H_
+#define SAMPLE_FILE_XML_DELEGATE_IMPL_H_
+
+#include <string>
+
+#include "mip/xml_delegate.h"
+
+// XmlDelegate for the policy and template XML the protection SDK parses on every engine creation, which
+// for large tenants is megabytes. Readers pull nodes straight off one copy of the input: names are
+// interned once per document, and text and attribute values are slices of the input decoded only when
+// read. Documents are built by the same reader into nodes owned by the document.
+//
+// Documents answer the XPath subset of location paths: absolute, relative and // steps, ., .., *, text(),
+// node() and names, with [n], [@name] and [@name='value'] predicates. Any other XPath throws a
+// mip::BadInputError, as malformed XML does.
+class XmlDelegateImpl final : public mip::xml::XmlDelegate {
+public:
+  mip::xml::XmlReaderResult CreateXmlReader(const std::string& xmlParserInput) const override;
+  mip::xml::XmlDocumentResult ParseData(const std::string& data) const override;
+};
+
+#endif // SAMPLE_FILE_XML_DELEGATE_IMPL_H_
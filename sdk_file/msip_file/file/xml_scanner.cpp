@@ -0,0 +1,213 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "xml_scanner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+using std::string;
+
+void AppendUtf8(string& out, uint32_t codePoint) {
+  if (codePoint < 0x80) {
+    out += static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    out += static_cast<char>(0xC0 | (codePoint >> 6));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    out += static_cast<char>(0xE0 | (codePoint >> 12));
+    out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (codePoint >> 18));
+    out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  }
+}
+
+// Rule packages exported from the compliance center are usually UTF-16 with a byte order mark.
+string ToUtf8(const string& xml) {
+  if (xml.size() >= 3 && xml.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    return xml.substr(3);
+  const bool littleEndian = xml.size() >= 2 && xml[0] == '\xFF' && xml[1] == '\xFE';
+  const bool bigEndian = xml.size() >= 2 && xml[0] == '\xFE' && xml[1] == '\xFF';
+  if (!littleEndian && !bigEndian)
+    return xml;
+
+  string out;
+  out.reserve(xml.size() / 2);
+  auto unit = [&](size_t i) {
+    const auto first = static_cast<unsigned char>(xml[i]);
+    const auto second = static_cast<unsigned char>(xml[i + 1]);
+    return static_cast<uint32_t>(littleEndian ? first | (second << 8) : (first << 8) | second);
+  };
+  for (size_t i = 2; i + 1 < xml.size(); i += 2) {
+    uint32_t codePoint = unit(i);
+    if (codePoint >= 0xD800 && codePoint < 0xDC00 && i + 3 < xml.size()) {
+      const uint32_t low = unit(i + 2);
+      if (low >= 0xDC00 && low < 0xE000) {
+        codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        i += 2;
+      }
+    }
+    AppendUtf8(out, codePoint);
+  }
+  return out;
+}
+
+string DecodeEntities(const string& raw) {
+  if (raw.find('&') == string::npos)
+    return raw;
+  string out;
+  out.reserve(raw.size());
+  for (size_t i = 0; i < raw.size(); ++i) {
+    const auto end = raw[i] == '&' ? raw.find(';', i) : string::npos;
+    if (end == string::npos) {
+      out += raw[i];
+      continue;
+    }
+    const string name = raw.substr(i + 1, end - i - 1);
+    if (name == "amp") out += '&';
+    else if (name == "lt") out += '<';
+    else if (name == "gt") out += '>';
+    else if (name == "quot") out += '"';
+    else if (name == "apos") out += '\'';
+    else if (name.size() > 1 && name[0] == '#')
+      AppendUtf8(out, static_cast<uint32_t>(name[1] == 'x' || name[1] == 'X'
+          ? std::strtoul(name.c_str() + 2, nullptr, 16)
+          : std::strtoul(name.c_str() + 1, nullptr, 10)));
+    else {
+      out += raw[i];
+      continue;
+    }
+    i = end;
+  }
+  return out;
+}
+
+XmlScanner::Token XmlScanner::Next() {
+  if (mPendingClose) {
+    mPendingClose = false;
+    return Token::Close;
+  }
+  while (mPos < mXml.size()) {
+    if (mXml[mPos] != '<') {
+      const auto end = std::min(mXml.find('<', mPos), mXml.size());
+      mText = DecodeEntities(mXml.substr(mPos, end - mPos));
+      mPos = end;
+      return Token::Text;
+    }
+    if (mXml.compare(mPos, 4, "<!--") == 0) {
+      Skip("-->");
+    } else if (mXml.compare(mPos, 9, "<![CDATA[") == 0) {
+      const auto end = std::min(mXml.find("]]>", mPos), mXml.size());
+      mText = mXml.substr(mPos + 9, end - std::min(end, mPos + 9));
+      mPos = std::min(end + 3, mXml.size());
+      return Token::Text;
+    } else if (mXml.compare(mPos, 2, "<?") == 0 || mXml.compare(mPos, 2, "<!") == 0) {
+      Skip(">");
+    } else if (mXml.compare(mPos, 2, "</") == 0) {
+      mPos += 2;
+      mName = ReadName();
+      Skip(">");
+      return Token::Close;
+    } else {
+      ++mPos;
+      mName = ReadName();
+      ReadAttributes();
+      return Token::Open;
+    }
+  }
+  return Token::End;
+}
+
+string XmlScanner::Attribute(const string& name) const {
+  for (const auto& attribute : mAttributes) {
+    if (attribute.first == name)
+      return attribute.second;
+  }
+  return string();
+}
+
+void XmlScanner::Skip(const char* terminator) {
+  const auto end = mXml.find(terminator, mPos);
+  mPos = end == string::npos ? mXml.size() : end + std::char_traits<char>::length(terminator);
+}
+
+void XmlScanner::SkipSpace() {
+  while (mPos < mXml.size() && std::isspace(static_cast<unsigned char>(mXml[mPos])))
+    ++mPos;
+}
+
+string XmlScanner::ReadName() {
+  SkipSpace();
+  const auto start = mPos;
+  while (mPos < mXml.size() && !std::isspace(static_cast<unsigned char>(mXml[mPos])) &&
+         mXml[mPos] != '>' && mXml[mPos] != '/' && mXml[mPos] != '=')
+    ++mPos;
+  string name = mXml.substr(start, mPos - start);
+  const auto colon = name.find(':');
+  return colon == string::npos ? name : name.substr(colon + 1);
+}
+
+void XmlScanner::ReadAttributes() {
+  mAttributes.clear();
+  while (true) {
+    SkipSpace();
+    if (mPos >= mXml.size())
+      return;
+    if (mXml[mPos] == '>') {
+      ++mPos;
+      return;
+    }
+    if (mXml[mPos] == '/') {
+      mPendingClose = true;
+      Skip(">");
+      return;
+    }
+    string name = ReadName();
+    SkipSpace();
+    string value;
+    if (mPos < mXml.size() && mXml[mPos] == '=') {
+      ++mPos;
+      SkipSpace();
+      const char quote = mPos < mXml.size() ? mXml[mPos] : '"';
+      const auto end = mXml.find(quote, mPos + 1);
+      if (end == string::npos) {
+        mPos = mXml.size();
+        return;
+      }
+      value = DecodeEntities(mXml.substr(mPos + 1, end - mPos - 1));
+      mPos = end + 1;
+    } else if (name.empty()) {
+      ++mPos; // stray character
+      continue;
+    }
+    mAttributes.emplace_back(std::move(name), std::move(value));
+  }
+}
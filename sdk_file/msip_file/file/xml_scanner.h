@@ -0,0 +1,78 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_FILE_XML_SCANNER_H_
+#define SAMPLE_FILE_XML_SCANNER_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Encodes codePoint as UTF-8 onto out.
+void AppendUtf8(std::string& out, uint32_t codePoint);
+
+// Converts UTF-16 text with a byte order mark to UTF-8 and strips a UTF-8 byte order mark. Anything
+// else is returned unchanged.
+std::string ToUtf8(const std::string& text);
+
+// Expands the predefined and numeric character references.
+std::string DecodeEntities(const std::string& raw);
+
+// Forward-only reader for the subset of XML that rule packages and Office parts use: elements,
+// attributes, text and CDATA. Comments, declarations and processing instructions are skipped and
+// namespace prefixes dropped. A self-closing element is reported as an Open followed by a Close. The
+// scanner keeps a reference to xml, which must outlive it.
+class XmlScanner final {
+public:
+  enum class Token { Open, Close, Text, End };
+
+  explicit XmlScanner(const std::string& xml) : mXml(xml), mPos(0), mPendingClose(false) {}
+
+  Token Next();
+
+  // Local name of the element of the last Open or Close.
+  const std::string& Name() const { return mName; }
+  // Decoded text of the last Text.
+  const std::string& Text() const { return mText; }
+  // Attribute of the last Open, empty when absent.
+  std::string Attribute(const std::string& name) const;
+
+private:
+  void Skip(const char* terminator);
+  void SkipSpace();
+  std::string ReadName();
+  void ReadAttributes();
+
+  const std::string& mXml;
+  size_t mPos;
+  bool mPendingClose;
+  std::string mName;
+  std::string mText;
+  std::vector<std::pair<std::string, std::string>> mAttributes;
+};
+
+#endif // SAMPLE_FILE_XML_SCANNER_H_
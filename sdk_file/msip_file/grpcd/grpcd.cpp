@@ -0,0 +1,582 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/generic/async_generic_service.h>
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/health_check_service_interface.h>
+#include <grpcpp/support/proto_buffer_reader.h>
+
+#include "msip_file.pb.h"
+#include "msip_library.h"
+
+using msip::file::v1::ContentResult;
+using msip::file::v1::FileData;
+using msip::file::v1::FileResult;
+using msip::file::v1::InspectUpload;
+using msip::file::v1::ProtectFileData;
+using msip::file::v1::ProtectUpload;
+using msip::file::v1::UnprotectFileData;
+using msip::file::v1::UnprotectUpload;
+using sample::bench::MsipLibrary;
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// gRPC server for aip_file.so: serves the MsipFile service of msip_file.proto straight from native code,
+// so a deployment that only needs the file calls runs without the Python service. Requests are parsed
+// into the library's C ABI arguments and results go back as the export's JSON, without the Dapr, Python
+// and ctypes hops in between. Each thread drives its own completion queue and runs the SDK calls of the
+// requests it takes itself. Streamed uploads are gathered in memory and handed to the in-memory exports.
+// Options:
+//   --library=PATH           aip_file.so to load (default: next to this executable)
+//   --address=ADDRESSES      comma-separated addresses to listen on, "unix:PATH" for a Unix socket
+//                            (default: 0.0.0.0:50051)
+//   --application_id=ID      application id msipInit loads the context for
+//   --threads=N              threads serving calls (default: hardware threads)
+//   --max_upload_mb=N        largest content an upload or download may carry (default: 1024)
+//   --record=DIR --replay=DIR --latency_ms=N --jitter_ms=N
+//                            record or replay service responses, see msipConfigureHttpReplay
+
+namespace {
+
+// Status of the library's admission control, as kOverloaded in main.cpp. Such calls fail with
+// RESOURCE_EXHAUSTED instead of returning a result.
+const int kOverloaded = 3;
+const size_t kInitialResultBytes = 8192;
+// Room for what protection adds to the content, so most outputs fit the first buffer.
+const size_t kContentSlackBytes = 64 * 1024;
+const std::chrono::seconds kShutdownGrace(30);
+const char kServicePrefix[] = "/msip.file.v1.MsipFile/";
+
+typedef int (*StatusFn)(const char*, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectFn)(const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*ProtectFn)(const char*, const char*, const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*BufferStatusFn)(const uint8_t*, size_t, const char*, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectBufferFn)(const char*, const uint8_t*, size_t, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*ProtectBufferFn)(const char*, const uint8_t*, size_t, const char*, const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*TakeResultFn)(char*, size_t, size_t*);
+typedef int (*TakeOutputFn)(uint8_t*, size_t, size_t*);
+typedef int (*SetDeadlineFn)(int64_t);
+
+typedef std::function<int(char*, size_t, size_t*)> ResultCall;
+typedef std::function<int(uint8_t*, size_t, size_t*, char*, size_t, size_t*)> ContentCall;
+
+map<string, string> ParseArguments(int argc, char** argv) {
+  map<string, string> options;
+  for (int i = 1; i < argc; ++i) {
+    string argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0)
+      throw std::invalid_argument("Unexpected argument " + argument);
+    auto equals = argument.find('=');
+    options[argument.substr(2, equals == string::npos ? string::npos : equals - 2)] =
+        equals == string::npos ? "true" : argument.substr(equals + 1);
+  }
+  return options;
+}
+
+string GetOption(const map<string, string>& options, const string& name, const string& fallback = string()) {
+  auto it = options.find(name);
+  return it == options.end() ? fallback : it->second;
+}
+
+vector<string> SplitList(const string& list) {
+  vector<string> items;
+  std::istringstream stream(list);
+  string item;
+  while (std::getline(stream, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+const uint8_t* Bytes(const string& content) {
+  return reinterpret_cast<const uint8_t*>(content.data());
+}
+
+grpc::Status Parse(grpc::ByteBuffer& buffer, google::protobuf::Message& message) {
+  grpc::ProtoBufferReader reader(&buffer);
+  if (!message.ParseFromZeroCopyStream(&reader))
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Cannot parse " + message.GetTypeName());
+  return grpc::Status::OK;
+}
+
+// The serialized message becomes the slice's memory, so large content is not copied again.
+void Serialize(const google::protobuf::Message& message, grpc::ByteBuffer& buffer) {
+  auto bytes = new string();
+  message.SerializeToString(bytes);
+  grpc::Slice slice(&(*bytes)[0], bytes->size(), [](void* data) { delete static_cast<string*>(data); }, bytes);
+  grpc::ByteBuffer(&slice, 1).Swap(&buffer);
+}
+
+// The exports the server calls, looked up once. Methods whose export the library lacks are not served.
+class FileOperations final {
+public:
+  explicit FileOperations(const MsipLibrary& library)
+    : getFileStatus(library.Symbol<StatusFn>("getFileStatus_v2")),
+      inspectLicense(library.Symbol<StatusFn>("inspectLicense")),
+      unprotectFile(library.Symbol<UnprotectFn>("unprotectFile_v2")),
+      protectFile(library.Symbol<ProtectFn>("protectFile_v2")),
+      getBufferStatus(library.Symbol<BufferStatusFn>("getBufferStatus")),
+      unprotectBuffer(library.Symbol<UnprotectBufferFn>("unprotectBufferToBuffer")),
+      protectBuffer(library.Symbol<ProtectBufferFn>("protectBufferToBuffer")),
+      mTakeResult(library.Symbol<TakeResultFn>("msipTakeResult")),
+      mTakeOutput(library.Symbol<TakeOutputFn>("msipTakeOutput")),
+      mSetDeadline(library.Symbol<SetDeadlineFn>("msipSetDeadline")) {
+    if (!mTakeResult)
+      throw std::runtime_error("Library does not export msipTakeResult");
+  }
+
+  // Runs an export on this thread under timeoutMs (0 for none), growing the result through msipTakeResult.
+  int Run(int64_t timeoutMs, string& json, const ResultCall& call) const {
+    thread_local vector<char> result(kInitialResultBytes);
+    // Deadlines are per thread in the library, like the service's in-process calls set them.
+    if (mSetDeadline && timeoutMs)
+      mSetDeadline(timeoutMs);
+    size_t needed = 0;
+    int status = call(result.data(), result.size(), &needed);
+    if (status == MsipLibrary::kResultTooSmall) {
+      result.resize(needed);
+      status = mTakeResult(result.data(), result.size(), &needed);
+    }
+    if (mSetDeadline && timeoutMs)
+      mSetDeadline(0);
+    json.assign(result.data(), strnlen(result.data(), result.size()));
+    return status;
+  }
+
+  // Run for a *ToBuffer export of input, whose output is written straight into content. An output larger
+  // than the first guess is kept by the library and taken with msipTakeOutput.
+  int RunToContent(int64_t timeoutMs, const string& input, string& json, string& content, const ContentCall& call) const {
+    content.resize(input.size() + input.size() / 16 + kContentSlackBytes);
+    size_t contentSize = 0;
+    int status = Run(timeoutMs, json, [&](char* out, size_t cap, size_t* needed) {
+      return call(reinterpret_cast<uint8_t*>(&content[0]), content.size(), &contentSize, out, cap, needed);
+    });
+    if (status == EXIT_SUCCESS && contentSize > content.size()) {
+      content.resize(contentSize);
+      if (!mTakeOutput || mTakeOutput(reinterpret_cast<uint8_t*>(&content[0]), content.size(), &contentSize) != EXIT_SUCCESS)
+        contentSize = 0;
+    }
+    content.resize(status == EXIT_SUCCESS ? contentSize : 0);
+    return status;
+  }
+
+  const StatusFn getFileStatus;
+  const StatusFn inspectLicense;
+  const UnprotectFn unprotectFile;
+  const ProtectFn protectFile;
+  const BufferStatusFn getBufferStatus;
+  const UnprotectBufferFn unprotectBuffer;
+  const ProtectBufferFn protectBuffer;
+
+private:
+  const TakeResultFn mTakeResult;
+  const TakeOutputFn mTakeOutput;
+  const SetDeadlineFn mSetDeadline;
+};
+
+// One call of an MsipFile method: takes the request messages the client sends, then runs the operation.
+class Method {
+public:
+  virtual ~Method() {}
+  virtual grpc::Status Add(grpc::ByteBuffer& message) = 0;
+  // Runs once the client has sent everything; an OK status means response holds the reply.
+  virtual grpc::Status Finish(int64_t timeoutMs, grpc::ByteBuffer& response) = 0;
+};
+
+grpc::Status ReplyStatus(int status, const string& json) {
+  return status == kOverloaded ? grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, json) : grpc::Status::OK;
+}
+
+template <typename Request>
+class UnaryMethod final : public Method {
+public:
+  typedef std::function<int(const Request&, char*, size_t, size_t*)> Export;
+
+  UnaryMethod(const FileOperations& operations, const Export& call)
+    : mOperations(operations), mCall(call), mReceived(false) {}
+
+  grpc::Status Add(grpc::ByteBuffer& message) override {
+    if (mReceived)
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Expected one request message");
+    mReceived = true;
+    return Parse(message, mRequest);
+  }
+
+  grpc::Status Finish(int64_t timeoutMs, grpc::ByteBuffer& response) override {
+    FileResult result;
+    const int status = mOperations.Run(timeoutMs, *result.mutable_result(), [this](char* out, size_t cap, size_t* needed) {
+      return mCall(mRequest, out, cap, needed);
+    });
+    result.set_status(status);
+    Serialize(result, response);
+    return ReplyStatus(status, result.result());
+  }
+
+private:
+  const FileOperations& mOperations;
+  const Export mCall;
+  Request mRequest;
+  bool mReceived;
+};
+
+// A client-streamed upload. The first message holds the request and all of them hold content, which is
+// gathered into the first message so the operation sees one request with the whole content.
+template <typename Upload, typename Response>
+class UploadMethod final : public Method {
+public:
+  typedef std::function<int(const FileOperations&, int64_t, const Upload&, Response&)> Operation;
+
+  UploadMethod(const FileOperations& operations, const Operation& operation, size_t maxUploadBytes)
+    : mOperations(operations), mOperation(operation), mMaxUploadBytes(maxUploadBytes), mReceived(false) {}
+
+  grpc::Status Add(grpc::ByteBuffer& message) override {
+    grpc::Status status;
+    if (!mReceived) {
+      mReceived = true;
+      status = Parse(message, mUpload);
+    } else {
+      Upload chunk;
+      status = Parse(message, chunk);
+      if (status.ok()) {
+        if (mUpload.content().size() + chunk.content().size() > mMaxUploadBytes)
+          return TooLarge();
+        mUpload.mutable_content()->append(chunk.content());
+      }
+    }
+    return status.ok() && mUpload.content().size() > mMaxUploadBytes ? TooLarge() : status;
+  }
+
+  grpc::Status Finish(int64_t timeoutMs, grpc::ByteBuffer& response) override {
+    Response result;
+    const int status = mOperation(mOperations, timeoutMs, mUpload, result);
+    result.set_status(status);
+    // The content is not needed past this point; drop it before the reply is serialized.
+    Upload().Swap(&mUpload);
+    Serialize(result, response);
+    return ReplyStatus(status, result.result());
+  }
+
+private:
+  grpc::Status TooLarge() const {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Upload is larger than " + std::to_string(mMaxUploadBytes) + " bytes");
+  }
+
+  const FileOperations& mOperations;
+  const Operation mOperation;
+  const size_t mMaxUploadBytes;
+  Upload mUpload;
+  bool mReceived;
+};
+
+typedef std::function<unique_ptr<Method>()> MethodFactory;
+
+template <typename Request>
+MethodFactory Unary(const FileOperations& operations, const typename UnaryMethod<Request>::Export& call) {
+  return [&operations, call]() { return unique_ptr<Method>(new UnaryMethod<Request>(operations, call)); };
+}
+
+template <typename Upload, typename Response>
+MethodFactory Streamed(const FileOperations& operations, size_t maxUploadBytes,
+                       const typename UploadMethod<Upload, Response>::Operation& operation) {
+  return [&operations, maxUploadBytes, operation]() {
+    return unique_ptr<Method>(new UploadMethod<Upload, Response>(operations, operation, maxUploadBytes));
+  };
+}
+
+map<string, MethodFactory> BindMethods(const FileOperations& ops, size_t maxUploadBytes) {
+  map<string, MethodFactory> methods;
+  const string prefix = kServicePrefix;
+  if (auto fn = ops.getFileStatus)
+    methods[prefix + "InspectFile"] = Unary<FileData>(ops, [fn](const FileData& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.file().c_str(), r.application_id().c_str(), out, cap, needed);
+    });
+  if (auto fn = ops.inspectLicense)
+    methods[prefix + "InspectLicense"] = Unary<FileData>(ops, [fn](const FileData& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.file().c_str(), r.application_id().c_str(), out, cap, needed);
+    });
+  if (auto fn = ops.unprotectFile)
+    methods[prefix + "UnprotectFile"] = Unary<UnprotectFileData>(ops, [fn](const UnprotectFileData& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.scc_token().c_str(), r.file().c_str(), r.application_id().c_str(), out, cap, needed);
+    });
+  if (auto fn = ops.protectFile)
+    methods[prefix + "ProtectFile"] = Unary<ProtectFileData>(ops, [fn](const ProtectFileData& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.scc_token().c_str(), r.file().c_str(), r.encrypted_file().c_str(), r.user().c_str(),
+                r.application_id().c_str(), out, cap, needed);
+    });
+  if (auto fn = ops.getBufferStatus)
+    methods[prefix + "InspectContent"] = Streamed<InspectUpload, FileResult>(ops, maxUploadBytes,
+        [fn](const FileOperations& o, int64_t timeoutMs, const InspectUpload& u, FileResult& result) {
+      const FileData& r = u.request();
+      return o.Run(timeoutMs, *result.mutable_result(), [&](char* out, size_t cap, size_t* needed) {
+        return fn(Bytes(u.content()), u.content().size(), r.file().c_str(), r.application_id().c_str(), out, cap, needed);
+      });
+    });
+  if (auto fn = ops.unprotectBuffer)
+    methods[prefix + "UnprotectContent"] = Streamed<UnprotectUpload, ContentResult>(ops, maxUploadBytes,
+        [fn](const FileOperations& o, int64_t timeoutMs, const UnprotectUpload& u, ContentResult& result) {
+      const UnprotectFileData& r = u.request();
+      return o.RunToContent(timeoutMs, u.content(), *result.mutable_result(), *result.mutable_content(),
+          [&](uint8_t* data, size_t dataCap, size_t* dataSize, char* out, size_t cap, size_t* needed) {
+        return fn(r.scc_token().c_str(), Bytes(u.content()), u.content().size(), r.file().c_str(), r.application_id().c_str(),
+                  data, dataCap, dataSize, out, cap, needed);
+      });
+    });
+  if (auto fn = ops.protectBuffer)
+    methods[prefix + "ProtectContent"] = Streamed<ProtectUpload, ContentResult>(ops, maxUploadBytes,
+        [fn](const FileOperations& o, int64_t timeoutMs, const ProtectUpload& u, ContentResult& result) {
+      const ProtectFileData& r = u.request();
+      return o.RunToContent(timeoutMs, u.content(), *result.mutable_result(), *result.mutable_content(),
+          [&](uint8_t* data, size_t dataCap, size_t* dataSize, char* out, size_t cap, size_t* needed) {
+        return fn(r.scc_token().c_str(), Bytes(u.content()), u.content().size(), r.file().c_str(),
+                  r.encrypted_file().c_str(), r.user().c_str(), r.application_id().c_str(), data, dataCap, dataSize, out, cap, needed);
+      });
+    });
+  return methods;
+}
+
+class Server;
+
+// One RPC on a completion queue, from the request for it to the final status. Its address is the tag.
+class Call final {
+public:
+  Call(Server& server, grpc::ServerCompletionQueue* queue);
+  void Proceed(bool ok);
+
+private:
+  enum class State { kRequested, kReading, kFinishing };
+
+  void Finish(const grpc::Status& status) {
+    mState = State::kFinishing;
+    mStream.Finish(status, this);
+  }
+
+  Server& mServer;
+  grpc::ServerCompletionQueue* const mQueue;
+  grpc::GenericServerContext mContext;
+  grpc::GenericServerAsyncReaderWriter mStream;
+  grpc::ByteBuffer mMessage;
+  unique_ptr<Method> mMethod;
+  State mState;
+};
+
+class Server final {
+public:
+  Server(const MsipLibrary& library, size_t maxUploadBytes)
+    : mOperations(library),
+      mMethods(BindMethods(mOperations, maxUploadBytes)),
+      mMaxUploadBytes(maxUploadBytes),
+      mServed(0),
+      mRejected(0) {}
+
+  void Start(const vector<string>& addresses, size_t threads) {
+    grpc::EnableDefaultHealthCheckService(true);
+    grpc::ServerBuilder builder;
+    for (const auto& address : addresses)
+      builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+    builder.RegisterAsyncGenericService(&mService);
+    // Uploads stream in chunks, but a single message may still carry the whole content, as replies do.
+    const int maxMessageBytes = static_cast<int>(std::min<size_t>(mMaxUploadBytes + kContentSlackBytes, INT32_MAX));
+    builder.SetMaxReceiveMessageSize(maxMessageBytes);
+    builder.SetMaxSendMessageSize(maxMessageBytes);
+    for (size_t i = 0; i < threads; ++i)
+      mQueues.push_back(builder.AddCompletionQueue());
+    mServer = builder.BuildAndStart();
+    if (!mServer)
+      throw std::runtime_error("Failed to listen on the given addresses");
+    for (const auto& queue : mQueues) {
+      grpc::ServerCompletionQueue* const served = queue.get();
+      mThreads.emplace_back([this, served]() { Serve(served); });
+    }
+  }
+
+  // Lets calls in progress finish for up to kShutdownGrace, then drains the completion queues.
+  void Stop() {
+    mServer->Shutdown(std::chrono::system_clock::now() + kShutdownGrace);
+    for (auto& queue : mQueues)
+      queue->Shutdown();
+    for (auto& thread : mThreads)
+      thread.join();
+  }
+
+  unique_ptr<Method> CreateMethod(const string& name) const {
+    auto it = mMethods.find(name);
+    return it == mMethods.end() ? nullptr : it->second();
+  }
+
+  grpc::AsyncGenericService& Service() { return mService; }
+  void CountReply(const grpc::Status& status) {
+    if (status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED)
+      ++mRejected;
+    else
+      ++mServed;
+  }
+
+  size_t GetMethodCount() const { return mMethods.size(); }
+  uint64_t GetServed() const { return mServed; }
+  uint64_t GetRejected() const { return mRejected; }
+
+private:
+  void Serve(grpc::ServerCompletionQueue* queue) {
+    new Call(*this, queue);
+    void* tag = nullptr;
+    bool ok = false;
+    while (queue->Next(&tag, &ok))
+      static_cast<Call*>(tag)->Proceed(ok);
+  }
+
+  const FileOperations mOperations;
+  const map<string, MethodFactory> mMethods;
+  const size_t mMaxUploadBytes;
+  grpc::AsyncGenericService mService;
+  vector<unique_ptr<grpc::ServerCompletionQueue>> mQueues;
+  unique_ptr<grpc::Server> mServer;
+  vector<std::thread> mThreads;
+  std::atomic<uint64_t> mServed;
+  std::atomic<uint64_t> mRejected;
+};
+
+Call::Call(Server& server, grpc::ServerCompletionQueue* queue)
+  : mServer(server), mQueue(queue), mStream(&mContext), mState(State::kRequested) {
+  server.Service().RequestCall(&mContext, &mStream, queue, queue, this);
+}
+
+void Call::Proceed(bool ok) {
+  switch (mState) {
+    case State::kRequested:
+      // Not ok once the server shuts down.
+      if (!ok) {
+        delete this;
+        return;
+      }
+      new Call(mServer, mQueue);
+      mMethod = mServer.CreateMethod(mContext.method());
+      if (!mMethod)
+        return Finish(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "Unknown method " + mContext.method()));
+      mState = State::kReading;
+      mStream.Read(&mMessage, this);
+      return;
+    case State::kReading: {
+      if (ok) {
+        const grpc::Status status = mMethod->Add(mMessage);
+        mMessage.Clear();
+        if (!status.ok())
+          return Finish(status);
+        mStream.Read(&mMessage, this);
+        return;
+      }
+      // The client half-closed: the request is complete.
+      int64_t timeoutMs = 0;
+      const auto deadline = mContext.deadline();
+      if (deadline != std::chrono::system_clock::time_point::max()) {
+        timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::system_clock::now()).count();
+        if (timeoutMs <= 0)
+          return Finish(grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline passed before the call ran"));
+      }
+      grpc::ByteBuffer response;
+      const grpc::Status status = mMethod->Finish(timeoutMs, response);
+      mMethod.reset();
+      mServer.CountReply(status);
+      if (!status.ok())
+        return Finish(status);
+      mState = State::kFinishing;
+      mStream.WriteAndFinish(response, grpc::WriteOptions(), grpc::Status::OK, this);
+      return;
+    }
+    case State::kFinishing:
+      delete this;
+      return;
+  }
+}
+
+int Run(const map<string, string>& options) {
+  const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t threads = static_cast<size_t>(std::max(1, std::stoi(GetOption(options, "threads", std::to_string(hardwareThreads)))));
+  const size_t maxUploadBytes = static_cast<size_t>(std::max(1, std::stoi(GetOption(options, "max_upload_mb", "1024")))) << 20;
+  const vector<string> addresses = SplitList(GetOption(options, "address", "0.0.0.0:50051"));
+  if (addresses.empty())
+    throw std::invalid_argument("No address to listen on");
+
+  // Every thread started from here on, the SDK's and gRPC's included, inherits the mask, so only sigwait
+  // below sees these signals.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  MsipLibrary library(GetOption(options, "library"));
+  string error = library.GetError();
+  if (error.empty() && (!library.ConfigureHttpReplay(GetOption(options, "record"), GetOption(options, "replay"),
+                            std::stoi(GetOption(options, "latency_ms", "0")), std::stoi(GetOption(options, "jitter_ms", "0"))) ||
+                        !library.Initialize(GetOption(options, "application_id"))))
+    error = library.GetError();
+  if (!error.empty()) {
+    std::cerr << error << "\n";
+    return EXIT_FAILURE;
+  }
+
+  Server server(library, maxUploadBytes);
+  server.Start(addresses, threads);
+  std::cerr << "msip_grpcd serving " << server.GetMethodCount() << " methods on " << GetOption(options, "address", "0.0.0.0:50051")
+            << " with " << threads << " threads\n";
+  int received = 0;
+  sigwait(&signals, &received);
+  server.Stop();
+  std::cerr << "msip_grpcd stopped after " << server.GetServed() << " calls, " << server.GetRejected() << " rejected\n";
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  try {
+    return Run(ParseArguments(argc, argv));
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << "\n";
+    return EXIT_FAILURE;
+  }
+}
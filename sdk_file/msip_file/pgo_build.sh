@@ -0,0 +1,38 @@
+#!/bin/bash
+# Builds the release aip_file.so with profile guided and link time optimization:
+#   1. an instrumented aip_file.so plus msip_bench and msip_loadgen,
+#   2. training runs of msip_bench and msip_loadgen, which write the profiles as they exit,
+#   3. the final aip_file.so, rebuilt with -fprofile-use -flto from those profiles.
+# Training inputs come from MSIP_PGO_BENCH_ARGS and MSIP_PGO_LOADGEN_ARGS, e.g. --application_id, a corpus
+# and --replay=<dir> so no tenant is needed. The profile should come from the mix production runs.
+# Other arguments, such as --arch, are passed to both builds.
+set -euo pipefail
+cd "$(dirname "$0")"
+
+target_arch=x86_64
+for arg in "$@"; do
+  case "$arg" in
+    --arch=x86) target_arch=i386 ;;
+  esac
+done
+bins="$(cd .. && pwd)/bins/release/$target_arch"
+pgo_dir=${MSIP_PGO_DIR:-$bins/pgo}
+bench_args=${MSIP_PGO_BENCH_ARGS:-"--corpus=../../app/tests/fixtures"}
+loadgen_args=${MSIP_PGO_LOADGEN_ARGS:-}
+
+rm -rf "$pgo_dir"
+scons --configuration=release-pgo --pgo=generate --pgo-dir="$pgo_dir" "$@" "$bins/aip_file.so" bench
+
+# Word splitting of the argument lists is intended.
+# shellcheck disable=SC2086
+"$bins/msip_bench" --min_time=1 $bench_args
+if [ -n "$loadgen_args" ]; then
+  # shellcheck disable=SC2086
+  "$bins/msip_loadgen" --duration=120 $loadgen_args
+fi
+
+if [ -z "$(find "$pgo_dir" -name '*.gcda' -print -quit)" ]; then
+  echo "pgo_build.sh: training wrote no profiles to $pgo_dir" >&2
+  exit 1
+fi
+scons --configuration=release-pgo --pgo=use --pgo-dir="$pgo_dir" "$@" "$bins/aip_file.so"
@@ -0,0 +1,739 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+// msip_native: a CPython extension over aip_file.so for the service's hot file calls. It calls the same C
+// ABI as the ctypes bindings, but converts arguments without intermediate Python objects, keeps each
+// thread's result buffer in native memory, builds result dicts straight from the JSON the library writes,
+// and releases the GIL for the whole SDK call, so threads of one process run file operations in parallel.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+namespace {
+
+typedef int (*StatusFn)(const char*, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectFn)(const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*ProtectFn)(const char*, const char*, const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*BatchFn)(const char**, size_t, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectToBufferFn)(const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*ProtectToBufferFn)(const char*, const char*, const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*BufferStatusFn)(const uint8_t*, size_t, const char*, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectBufferFn)(const char*, const uint8_t*, size_t, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*ProtectBufferFn)(const char*, const uint8_t*, size_t, const char*, const char*, const char*, const char*, uint8_t*, size_t, size_t*, char*, size_t, size_t*);
+typedef int (*TakeResultFn)(char*, size_t, size_t*);
+typedef int (*TakeOutputFn)(uint8_t*, size_t, size_t*);
+
+// Status the *_v2 and *ToBuffer exports return when their result JSON outgrew the caller's buffer.
+const int kResultTooSmall = 2;
+const size_t kInitialResultBytes = 8192;
+// Room left above the input size for *ToBuffer output, as the ctypes bindings leave.
+const size_t kOutputSlack = 64 * 1024;
+
+struct Library {
+  void* handle;
+  StatusFn getFileStatus;
+  StatusFn inspectLicense;
+  UnprotectFn unprotectFile;
+  ProtectFn protectFile;
+  BatchFn getFileStatusBatch;
+  UnprotectToBufferFn unprotectFileToBuffer;
+  ProtectToBufferFn protectFileToBuffer;
+  BufferStatusFn getBufferStatus;
+  UnprotectBufferFn unprotectBufferToBuffer;
+  ProtectBufferFn protectBufferToBuffer;
+  TakeResultFn takeResult;
+  TakeOutputFn takeOutput;
+};
+
+Library gLibrary;
+
+// Grows to the largest result seen on the thread, like the ctypes bindings' buffers.
+thread_local std::vector<char> tResult;
+
+// Builds Python objects from the library's JSON results. The library only writes valid UTF-8 JSON, so
+// errors are reported without positions.
+class JsonParser final {
+public:
+  JsonParser(const char* data, size_t length) : mPosition(data), mEnd(data + length) {}
+
+  PyObject* ParseDocument() {
+    PyObject* value = ParseValue();
+    if (value) {
+      SkipSpace();
+      if (mPosition != mEnd) {
+        Py_DECREF(value);
+        return Fail("Trailing characters after JSON result");
+      }
+    }
+    return value;
+  }
+
+private:
+  PyObject* Fail(const char* message) {
+    if (!PyErr_Occurred())
+      PyErr_SetString(PyExc_ValueError, message);
+    return nullptr;
+  }
+
+  void SkipSpace() {
+    while (mPosition != mEnd && (*mPosition == ' ' || *mPosition == '\n' || *mPosition == '\r' || *mPosition == '\t'))
+      ++mPosition;
+  }
+
+  bool Consume(const char* literal) {
+    const size_t length = strlen(literal);
+    if (static_cast<size_t>(mEnd - mPosition) < length || memcmp(mPosition, literal, length) != 0)
+      return false;
+    mPosition += length;
+    return true;
+  }
+
+  PyObject* ParseValue() {
+    SkipSpace();
+    if (mPosition == mEnd)
+      return Fail("Unexpected end of JSON result");
+    switch (*mPosition) {
+      case '{': return ParseObject();
+      case '[': return ParseArray();
+      case '"': return ParseString();
+      case 't': if (Consume("true")) Py_RETURN_TRUE; break;
+      case 'f': if (Consume("false")) Py_RETURN_FALSE; break;
+      case 'n': if (Consume("null")) Py_RETURN_NONE; break;
+      default: return ParseNumber();
+    }
+    return Fail("Invalid JSON literal");
+  }
+
+  PyObject* ParseObject() {
+    ++mPosition;
+    PyObject* object = PyDict_New();
+    if (!object)
+      return nullptr;
+    SkipSpace();
+    if (mPosition != mEnd && *mPosition == '}') {
+      ++mPosition;
+      return object;
+    }
+    while (true) {
+      SkipSpace();
+      if (mPosition == mEnd || *mPosition != '"')
+        break;
+      PyObject* key = ParseString();
+      if (!key)
+        break;
+      SkipSpace();
+      if (mPosition == mEnd || *mPosition != ':') {
+        Py_DECREF(key);
+        break;
+      }
+      ++mPosition;
+      PyObject* value = ParseValue();
+      const int stored = value ? PyDict_SetItem(object, key, value) : -1;
+      Py_DECREF(key);
+      Py_XDECREF(value);
+      if (stored != 0)
+        break;
+      SkipSpace();
+      if (mPosition != mEnd && *mPosition == ',') {
+        ++mPosition;
+        continue;
+      }
+      if (mPosition != mEnd && *mPosition == '}') {
+        ++mPosition;
+        return object;
+      }
+      break;
+    }
+    Py_DECREF(object);
+    return Fail("Invalid JSON object");
+  }
+
+  PyObject* ParseArray() {
+    ++mPosition;
+    PyObject* array = PyList_New(0);
+    if (!array)
+      return nullptr;
+    SkipSpace();
+    if (mPosition != mEnd && *mPosition == ']') {
+      ++mPosition;
+      return array;
+    }
+    while (true) {
+      PyObject* value = ParseValue();
+      const int appended = value ? PyList_Append(array, value) : -1;
+      Py_XDECREF(value);
+      if (appended != 0)
+        break;
+      SkipSpace();
+      if (mPosition != mEnd && *mPosition == ',') {
+        ++mPosition;
+        continue;
+      }
+      if (mPosition != mEnd && *mPosition == ']') {
+        ++mPosition;
+        return array;
+      }
+      break;
+    }
+    Py_DECREF(array);
+    return Fail("Invalid JSON array");
+  }
+
+  static int HexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool ParseHex4(uint32_t& value) {
+    if (mEnd - mPosition < 4)
+      return false;
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+      const int digit = HexDigit(*mPosition++);
+      if (digit < 0)
+        return false;
+      value = (value << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+  }
+
+  static void AppendUtf8(std::string& out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+      out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+      out += static_cast<char>(0xc0 | (codePoint >> 6));
+      out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    } else if (codePoint < 0x10000) {
+      out += static_cast<char>(0xe0 | (codePoint >> 12));
+      out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    } else {
+      out += static_cast<char>(0xf0 | (codePoint >> 18));
+      out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+      out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+  }
+
+  PyObject* ParseString() {
+    ++mPosition;
+    // Strings without escapes, nearly all of them, are decoded in place.
+    const char* start = mPosition;
+    while (mPosition != mEnd && *mPosition != '"' && *mPosition != '\\')
+      ++mPosition;
+    if (mPosition != mEnd && *mPosition == '"')
+      return PyUnicode_DecodeUTF8(start, mPosition++ - start, "surrogateescape");
+
+    std::string text(start, mPosition);
+    while (mPosition != mEnd && *mPosition != '"') {
+      if (*mPosition != '\\') {
+        text += *mPosition++;
+        continue;
+      }
+      if (++mPosition == mEnd)
+        break;
+      const char escape = *mPosition++;
+      switch (escape) {
+        case '"': text += '"'; break;
+        case '\\': text += '\\'; break;
+        case '/': text += '/'; break;
+        case 'b': text += '\b'; break;
+        case 'f': text += '\f'; break;
+        case 'n': text += '\n'; break;
+        case 'r': text += '\r'; break;
+        case 't': text += '\t'; break;
+        case 'u': {
+          uint32_t codePoint;
+          if (!ParseHex4(codePoint))
+            return Fail("Invalid JSON string escape");
+          uint32_t low;
+          if (codePoint >= 0xd800 && codePoint < 0xdc00 && mEnd - mPosition >= 6 &&
+              mPosition[0] == '\\' && mPosition[1] == 'u') {
+            const char* pair = mPosition;
+            mPosition += 2;
+            if (ParseHex4(low) && low >= 0xdc00 && low < 0xe000)
+              codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+            else
+              mPosition = pair;
+          }
+          AppendUtf8(text, codePoint);
+          break;
+        }
+        default:
+          return Fail("Invalid JSON string escape");
+      }
+    }
+    if (mPosition == mEnd)
+      return Fail("Unterminated JSON string");
+    ++mPosition;
+    return PyUnicode_DecodeUTF8(text.data(), static_cast<Py_ssize_t>(text.size()), "surrogatepass");
+  }
+
+  PyObject* ParseNumber() {
+    const char* start = mPosition;
+    bool fraction = false;
+    if (mPosition != mEnd && *mPosition == '-')
+      ++mPosition;
+    while (mPosition != mEnd) {
+      const char c = *mPosition;
+      if (c == '.' || c == 'e' || c == 'E' || c == '+' || (c == '-' && mPosition != start))
+        fraction = true;
+      else if (c < '0' || c > '9')
+        break;
+      ++mPosition;
+    }
+    if (mPosition == start || (mPosition - start == 1 && *start == '-'))
+      return Fail("Invalid JSON value");
+    const std::string number(start, mPosition);
+    if (fraction) {
+      char* end = nullptr;
+      const double value = PyOS_string_to_double(number.c_str(), &end, nullptr);
+      if (value == -1.0 && PyErr_Occurred())
+        return nullptr;
+      if (end != number.c_str() + number.size())
+        return Fail("Invalid JSON number");
+      return PyFloat_FromDouble(value);
+    }
+    return PyLong_FromString(number.c_str(), nullptr, 10);
+  }
+
+  const char* mPosition;
+  const char* mEnd;
+};
+
+// "O&" converter to a std::string for text and path arguments: str (encoded as the filesystem encoding,
+// which is UTF-8 here), bytes, or an os.PathLike.
+int ToString(PyObject* object, void* address) {
+  PyObject* path = PyOS_FSPath(object);
+  if (!path)
+    return 0;
+  PyObject* bytes = nullptr;
+  if (PyUnicode_Check(path)) {
+    bytes = PyUnicode_EncodeFSDefault(path);
+  } else if (PyBytes_Check(path)) {
+    bytes = path;
+    Py_INCREF(bytes);
+  }
+  Py_DECREF(path);
+  if (!bytes)
+    return 0;
+  static_cast<std::string*>(address)->assign(PyBytes_AS_STRING(bytes), static_cast<size_t>(PyBytes_GET_SIZE(bytes)));
+  Py_DECREF(bytes);
+  return 1;
+}
+
+bool CheckLoaded() {
+  if (gLibrary.handle)
+    return true;
+  PyErr_SetString(PyExc_RuntimeError, "msip_native.load() has not been called");
+  return false;
+}
+
+// Returns (status, result) for the status a call into the library returned, with its result taken from
+// this thread's buffer, or from msipTakeResult when it did not fit. Runs with the GIL held.
+PyObject* ResultTuple(int status, size_t needed) {
+  size_t length = needed > 0 ? needed - 1 : 0;
+  if (length >= tResult.size())
+    length = strnlen(tResult.data(), tResult.size());
+  PyObject* result = nullptr;
+  if (length == 0) {
+    result = PyDict_New();
+  } else {
+    JsonParser parser(tResult.data(), length);
+    result = parser.ParseDocument();
+  }
+  if (!result)
+    return nullptr;
+  PyObject* tuple = Py_BuildValue("(iN)", status, result);
+  return tuple;
+}
+
+// Calls call(out, cap, needed) and, when the result outgrew the buffer, fetches it with msipTakeResult.
+// Must be called without the GIL.
+template <typename Call>
+int CallWithResult(const Call& call, size_t& needed) {
+  if (tResult.size() < kInitialResultBytes)
+    tResult.resize(kInitialResultBytes);
+  needed = 0;
+  int status = call(tResult.data(), tResult.size(), &needed);
+  if (status == kResultTooSmall) {
+    tResult.resize(needed);
+    status = gLibrary.takeResult(tResult.data(), tResult.size(), &needed);
+  }
+  return status;
+}
+
+PyObject* Load(PyObject* /* self */, PyObject* args) {
+  std::string path;
+  if (!PyArg_ParseTuple(args, "O&:load", ToString, &path))
+    return nullptr;
+  // The library the ctypes bindings loaded already: dlopen returns the same handle, so both share the
+  // library's state. Lazy binding is left to the first load.
+  void* handle = dlopen(path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+  if (!handle)
+    return PyErr_Format(PyExc_OSError, "Failed to load %s: %s", path.c_str(), dlerror());
+  Library library;
+  library.handle = handle;
+  library.getFileStatus = reinterpret_cast<StatusFn>(dlsym(handle, "getFileStatus_v2"));
+  library.inspectLicense = reinterpret_cast<StatusFn>(dlsym(handle, "inspectLicense"));
+  library.unprotectFile = reinterpret_cast<UnprotectFn>(dlsym(handle, "unprotectFile_v2"));
+  library.protectFile = reinterpret_cast<ProtectFn>(dlsym(handle, "protectFile_v2"));
+  library.getFileStatusBatch = reinterpret_cast<BatchFn>(dlsym(handle, "getFileStatusBatch_v2"));
+  library.unprotectFileToBuffer = reinterpret_cast<UnprotectToBufferFn>(dlsym(handle, "unprotectFileToBuffer"));
+  library.protectFileToBuffer = reinterpret_cast<ProtectToBufferFn>(dlsym(handle, "protectFileToBuffer"));
+  library.getBufferStatus = reinterpret_cast<BufferStatusFn>(dlsym(handle, "getBufferStatus"));
+  library.unprotectBufferToBuffer = reinterpret_cast<UnprotectBufferFn>(dlsym(handle, "unprotectBufferToBuffer"));
+  library.protectBufferToBuffer = reinterpret_cast<ProtectBufferFn>(dlsym(handle, "protectBufferToBuffer"));
+  library.takeResult = reinterpret_cast<TakeResultFn>(dlsym(handle, "msipTakeResult"));
+  library.takeOutput = reinterpret_cast<TakeOutputFn>(dlsym(handle, "msipTakeOutput"));
+  if (!library.getFileStatus || !library.inspectLicense || !library.unprotectFile || !library.protectFile ||
+      !library.getFileStatusBatch || !library.unprotectFileToBuffer || !library.protectFileToBuffer ||
+      !library.getBufferStatus || !library.unprotectBufferToBuffer || !library.protectBufferToBuffer ||
+      !library.takeResult || !library.takeOutput) {
+    dlclose(handle);
+    return PyErr_Format(PyExc_OSError, "%s does not export the functions msip_native calls", path.c_str());
+  }
+  if (gLibrary.handle)
+    dlclose(gLibrary.handle);
+  gLibrary = library;
+  Py_RETURN_NONE;
+}
+
+PyObject* GetFileStatus(PyObject* /* self */, PyObject* args) {
+  std::string filePath, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&:get_file_status", ToString, &filePath, ToString, &applicationId) || !CheckLoaded())
+    return nullptr;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.getFileStatus(filePath.c_str(), applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return ResultTuple(status, needed);
+}
+
+PyObject* InspectLicense(PyObject* /* self */, PyObject* args) {
+  std::string filePath, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&:inspect_license", ToString, &filePath, ToString, &applicationId) || !CheckLoaded())
+    return nullptr;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.inspectLicense(filePath.c_str(), applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return ResultTuple(status, needed);
+}
+
+PyObject* UnprotectFile(PyObject* /* self */, PyObject* args) {
+  std::string token, filePath, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&O&:unprotect_file", ToString, &token, ToString, &filePath, ToString, &applicationId) ||
+      !CheckLoaded())
+    return nullptr;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.unprotectFile(token.c_str(), filePath.c_str(), applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return ResultTuple(status, needed);
+}
+
+PyObject* ProtectFile(PyObject* /* self */, PyObject* args) {
+  std::string token, filePath, encryptedFilePath, user, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&O&O&O&:protect_file", ToString, &token, ToString, &filePath, ToString,
+                        &encryptedFilePath, ToString, &user, ToString, &applicationId) ||
+      !CheckLoaded())
+    return nullptr;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.protectFile(token.c_str(), filePath.c_str(), encryptedFilePath.c_str(), user.c_str(),
+                                applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return ResultTuple(status, needed);
+}
+
+PyObject* GetFileStatusBatch(PyObject* /* self */, PyObject* args) {
+  PyObject* files;
+  std::string applicationId;
+  if (!PyArg_ParseTuple(args, "OO&:get_file_status_batch", &files, ToString, &applicationId) || !CheckLoaded())
+    return nullptr;
+  PyObject* sequence = PySequence_Fast(files, "files must be a sequence of paths");
+  if (!sequence)
+    return nullptr;
+  const Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+  std::vector<std::string> paths(static_cast<size_t>(count));
+  for (Py_ssize_t i = 0; i < count; ++i) {
+    if (!ToString(PySequence_Fast_GET_ITEM(sequence, i), &paths[static_cast<size_t>(i)])) {
+      Py_DECREF(sequence);
+      return nullptr;
+    }
+  }
+  Py_DECREF(sequence);
+  std::vector<const char*> pathPointers;
+  pathPointers.reserve(paths.size());
+  for (const auto& path : paths)
+    pathPointers.push_back(path.c_str());
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.getFileStatusBatch(pathPointers.data(), pathPointers.size(), applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return ResultTuple(status, needed);
+}
+
+// Output for a *ToBuffer call over an input of inputSize bytes, sized like the ctypes bindings size theirs.
+// The library writes straight into the bytes object, which is trimmed, or replaced by the output the
+// library kept when it did not fit, once the call returns.
+PyObject* NewOutput(size_t inputSize) {
+  return PyBytes_FromStringAndSize(nullptr, static_cast<Py_ssize_t>(inputSize + kOutputSlack));
+}
+
+PyObject* NewOutput(const std::string& filePath) {
+  struct stat fileInfo;
+  return NewOutput(stat(filePath.c_str(), &fileInfo) == 0 ? static_cast<size_t>(fileInfo.st_size) : 0);
+}
+
+PyObject* OutputTuple(int status, size_t needed, PyObject* output, size_t outputSize) {
+  if (outputSize > static_cast<size_t>(PyBytes_GET_SIZE(output))) {
+    Py_DECREF(output);
+    output = PyBytes_FromStringAndSize(nullptr, static_cast<Py_ssize_t>(outputSize));
+    if (!output)
+      return nullptr;
+    uint8_t* data = reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(output));
+    Py_BEGIN_ALLOW_THREADS
+    gLibrary.takeOutput(data, outputSize, &outputSize);
+    Py_END_ALLOW_THREADS
+  }
+  if (_PyBytes_Resize(&output, static_cast<Py_ssize_t>(outputSize)) != 0)
+    return nullptr;
+  PyObject* result = ResultTuple(status, needed);
+  if (!result) {
+    Py_DECREF(output);
+    return nullptr;
+  }
+  PyObject* tuple = Py_BuildValue("(OON)", PyTuple_GET_ITEM(result, 0), PyTuple_GET_ITEM(result, 1), output);
+  Py_DECREF(result);
+  return tuple;
+}
+
+PyObject* UnprotectFileToBytes(PyObject* /* self */, PyObject* args) {
+  std::string token, filePath, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&O&:unprotect_file_to_bytes", ToString, &token, ToString, &filePath, ToString,
+                        &applicationId) ||
+      !CheckLoaded())
+    return nullptr;
+  PyObject* output = NewOutput(filePath);
+  if (!output)
+    return nullptr;
+  uint8_t* data = reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(output));
+  const size_t capacity = static_cast<size_t>(PyBytes_GET_SIZE(output));
+  size_t outputSize = 0;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.unprotectFileToBuffer(token.c_str(), filePath.c_str(), applicationId.c_str(), data, capacity,
+                                          &outputSize, out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return OutputTuple(status, needed, output, outputSize);
+}
+
+PyObject* ProtectFileToBytes(PyObject* /* self */, PyObject* args) {
+  std::string token, filePath, encryptedFilePath, user, applicationId;
+  if (!PyArg_ParseTuple(args, "O&O&O&O&O&:protect_file_to_bytes", ToString, &token, ToString, &filePath, ToString,
+                        &encryptedFilePath, ToString, &user, ToString, &applicationId) ||
+      !CheckLoaded())
+    return nullptr;
+  PyObject* output = NewOutput(filePath);
+  if (!output)
+    return nullptr;
+  uint8_t* data = reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(output));
+  const size_t capacity = static_cast<size_t>(PyBytes_GET_SIZE(output));
+  size_t outputSize = 0;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.protectFileToBuffer(token.c_str(), filePath.c_str(), encryptedFilePath.c_str(), user.c_str(),
+                                        applicationId.c_str(), data, capacity, &outputSize, out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  return OutputTuple(status, needed, output, outputSize);
+}
+
+// The *_buffer calls take the file's content as any contiguous bytes-like object, read in place while the
+// GIL is released: the buffer stays exported, so a bytearray cannot be resized under the library.
+PyObject* GetBufferStatus(PyObject* /* self */, PyObject* args) {
+  Py_buffer content;
+  std::string nameHint, applicationId;
+  if (!PyArg_ParseTuple(args, "y*O&O&:get_buffer_status", &content, ToString, &nameHint, ToString, &applicationId))
+    return nullptr;
+  if (!CheckLoaded()) {
+    PyBuffer_Release(&content);
+    return nullptr;
+  }
+  const uint8_t* input = static_cast<const uint8_t*>(content.buf);
+  const size_t inputSize = static_cast<size_t>(content.len);
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.getBufferStatus(input, inputSize, nameHint.c_str(), applicationId.c_str(), out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&content);
+  return ResultTuple(status, needed);
+}
+
+PyObject* UnprotectBuffer(PyObject* /* self */, PyObject* args) {
+  Py_buffer content;
+  std::string token, nameHint, applicationId;
+  if (!PyArg_ParseTuple(args, "O&y*O&O&:unprotect_buffer", ToString, &token, &content, ToString, &nameHint, ToString,
+                        &applicationId))
+    return nullptr;
+  const uint8_t* input = static_cast<const uint8_t*>(content.buf);
+  const size_t inputSize = static_cast<size_t>(content.len);
+  PyObject* output = CheckLoaded() ? NewOutput(inputSize) : nullptr;
+  if (!output) {
+    PyBuffer_Release(&content);
+    return nullptr;
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(output));
+  const size_t capacity = static_cast<size_t>(PyBytes_GET_SIZE(output));
+  size_t outputSize = 0;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.unprotectBufferToBuffer(token.c_str(), input, inputSize, nameHint.c_str(), applicationId.c_str(), data,
+                                            capacity, &outputSize, out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&content);
+  return OutputTuple(status, needed, output, outputSize);
+}
+
+PyObject* ProtectBuffer(PyObject* /* self */, PyObject* args) {
+  Py_buffer content;
+  std::string token, nameHint, encryptedFilePath, user, applicationId;
+  if (!PyArg_ParseTuple(args, "O&y*O&O&O&O&:protect_buffer", ToString, &token, &content, ToString, &nameHint, ToString,
+                        &encryptedFilePath, ToString, &user, ToString, &applicationId))
+    return nullptr;
+  const uint8_t* input = static_cast<const uint8_t*>(content.buf);
+  const size_t inputSize = static_cast<size_t>(content.len);
+  PyObject* output = CheckLoaded() ? NewOutput(inputSize) : nullptr;
+  if (!output) {
+    PyBuffer_Release(&content);
+    return nullptr;
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(PyBytes_AS_STRING(output));
+  const size_t capacity = static_cast<size_t>(PyBytes_GET_SIZE(output));
+  size_t outputSize = 0;
+  int status;
+  size_t needed;
+  Py_BEGIN_ALLOW_THREADS
+  status = CallWithResult([&](char* out, size_t cap, size_t* size) {
+    return gLibrary.protectBufferToBuffer(token.c_str(), input, inputSize, nameHint.c_str(), encryptedFilePath.c_str(),
+                                          user.c_str(), applicationId.c_str(), data, capacity, &outputSize, out, cap, size);
+  }, needed);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&content);
+  return OutputTuple(status, needed, output, outputSize);
+}
+
+PyObject* ParseResult(PyObject* /* self */, PyObject* args) {
+  const char* data;
+  Py_ssize_t length;
+  if (!PyArg_ParseTuple(args, "y#:parse_result", &data, &length))
+    return nullptr;
+  JsonParser parser(data, static_cast<size_t>(length));
+  return parser.ParseDocument();
+}
+
+PyMethodDef kMethods[] = {
+  {"load", Load, METH_VARARGS,
+   "load(path): binds the module to aip_file.so at path, normally the library the ctypes bindings loaded."},
+  {"get_file_status", GetFileStatus, METH_VARARGS,
+   "get_file_status(path, application_id) -> (status, result)"},
+  {"inspect_license", InspectLicense, METH_VARARGS,
+   "inspect_license(path, application_id) -> (status, result)"},
+  {"unprotect_file", UnprotectFile, METH_VARARGS,
+   "unprotect_file(token, path, application_id) -> (status, result)"},
+  {"protect_file", ProtectFile, METH_VARARGS,
+   "protect_file(token, path, encrypted_path, user, application_id) -> (status, result)"},
+  {"get_file_status_batch", GetFileStatusBatch, METH_VARARGS,
+   "get_file_status_batch(paths, application_id) -> (status, results)"},
+  {"unprotect_file_to_bytes", UnprotectFileToBytes, METH_VARARGS,
+   "unprotect_file_to_bytes(token, path, application_id) -> (status, result, content)"},
+  {"protect_file_to_bytes", ProtectFileToBytes, METH_VARARGS,
+   "protect_file_to_bytes(token, path, encrypted_path, user, application_id) -> (status, result, content)"},
+  {"get_buffer_status", GetBufferStatus, METH_VARARGS,
+   "get_buffer_status(content, name_hint, application_id) -> (status, result)"},
+  {"unprotect_buffer", UnprotectBuffer, METH_VARARGS,
+   "unprotect_buffer(token, content, name_hint, application_id) -> (status, result, content)"},
+  {"protect_buffer", ProtectBuffer, METH_VARARGS,
+   "protect_buffer(token, content, name_hint, encrypted_path, user, application_id) -> (status, result, content)"},
+  {"parse_result", ParseResult, METH_VARARGS,
+   "parse_result(json_bytes): the object a result decodes to, as the calls above build it."},
+  {nullptr, nullptr, 0, nullptr}
+};
+
+PyModuleDef kModule = {
+  PyModuleDef_HEAD_INIT,
+  "msip_native",
+  "Native bindings for aip_file.so's file calls. Every call releases the GIL while the library runs.",
+  -1,
+  kMethods,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_msip_native() {
+  return PyModule_Create(&kModule);
+}
@@ -0,0 +1,199 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "worker_protocol.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using std::runtime_error;
+using std::string;
+
+namespace sample {
+namespace workerd {
+
+namespace {
+
+// id, timeout_ms and argument count, after the length.
+const size_t kRequestHeaderBytes = 4 + 4 + 2;
+
+string ErrnoMessage(const string& what) {
+  return what + ": " + strerror(errno);
+}
+
+// Reads exactly length bytes, collecting any descriptors that arrive with them. Returns the bytes read
+// before the peer closed the connection, which is less than length only then.
+size_t ReadFully(int socketFd, uint8_t* buffer, size_t length, Descriptors& descriptors) {
+  size_t total = 0;
+  while (total < length) {
+    iovec io = { buffer + total, length - total };
+    union {
+      cmsghdr header;
+      char space[CMSG_SPACE(sizeof(int) * kMaxDescriptors)];
+    } control;
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    const ssize_t received = recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+      if (errno == EINTR)
+        continue;
+      throw runtime_error(ErrnoMessage("Failed to read a request"));
+    }
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+      if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+        continue;
+      const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < count; ++i) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+        descriptors.Add(fd);
+      }
+    }
+    if (message.msg_flags & MSG_CTRUNC)
+      throw runtime_error("A request carried more descriptors than the protocol allows");
+    if (received == 0)
+      break;
+    total += static_cast<size_t>(received);
+  }
+  return total;
+}
+
+uint32_t ReadUint32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+} // namespace
+
+Descriptors::~Descriptors() {
+  Close();
+}
+
+Descriptors::Descriptors(Descriptors&& other) : mFds(std::move(other.mFds)) {
+  other.mFds.clear();
+}
+
+Descriptors& Descriptors::operator=(Descriptors&& other) {
+  if (this != &other) {
+    Close();
+    mFds = std::move(other.mFds);
+    other.mFds.clear();
+  }
+  return *this;
+}
+
+void Descriptors::Close() {
+  for (int fd : mFds)
+    close(fd);
+  mFds.clear();
+}
+
+bool ReadRequest(int socketFd, Request& request) {
+  request.arguments.clear();
+  request.descriptors = Descriptors();
+  uint8_t lengthBytes[4];
+  const size_t read = ReadFully(socketFd, lengthBytes, sizeof(lengthBytes), request.descriptors);
+  if (read == 0)
+    return false;
+  if (read < sizeof(lengthBytes))
+    throw runtime_error("Connection closed inside a request");
+  const uint32_t length = ReadUint32(lengthBytes);
+  if (length < kRequestHeaderBytes || length > kMaxFrameBytes)
+    throw runtime_error("Request frame has an invalid length");
+
+  std::vector<uint8_t> frame(length);
+  if (ReadFully(socketFd, frame.data(), frame.size(), request.descriptors) < frame.size())
+    throw runtime_error("Connection closed inside a request");
+  request.id = ReadUint32(frame.data());
+  request.timeoutMs = ReadUint32(frame.data() + 4);
+  uint16_t count;
+  memcpy(&count, frame.data() + 8, sizeof(count));
+
+  size_t offset = kRequestHeaderBytes;
+  request.arguments.reserve(count);
+  for (uint16_t i = 0; i < count; ++i) {
+    if (frame.size() - offset < 4)
+      throw runtime_error("Request frame is truncated");
+    const uint32_t argumentLength = ReadUint32(frame.data() + offset);
+    offset += 4;
+    if (frame.size() - offset < argumentLength)
+      throw runtime_error("Request frame is truncated");
+    request.arguments.emplace_back(reinterpret_cast<const char*>(frame.data() + offset), argumentLength);
+    offset += argumentLength;
+  }
+  if (offset != frame.size())
+    throw runtime_error("Request frame has trailing bytes");
+  return true;
+}
+
+void WriteResponse(int socketFd, uint32_t id, int32_t status, const string& json) {
+  if (json.size() > kMaxFrameBytes - 8)
+    throw runtime_error("Response is too large for one frame");
+  uint8_t header[12];
+  const uint32_t length = static_cast<uint32_t>(8 + json.size());
+  memcpy(header, &length, 4);
+  memcpy(header + 4, &id, 4);
+  memcpy(header + 8, &status, 4);
+  iovec io[2] = { { header, sizeof(header) }, { const_cast<char*>(json.data()), json.size() } };
+  size_t remaining = sizeof(header) + json.size();
+  int first = 0;
+  while (remaining > 0) {
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = io + first;
+    message.msg_iovlen = 2 - first;
+    // A client that went away must not kill the daemon with SIGPIPE.
+    const ssize_t written = sendmsg(socketFd, &message, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw runtime_error(ErrnoMessage("Failed to write a response"));
+    }
+    remaining -= static_cast<size_t>(written);
+    size_t advance = static_cast<size_t>(written);
+    while (first < 2 && advance >= io[first].iov_len) {
+      advance -= io[first].iov_len;
+      ++first;
+    }
+    if (first < 2) {
+      io[first].iov_base = static_cast<char*>(io[first].iov_base) + advance;
+      io[first].iov_len -= advance;
+    }
+  }
+}
+
+} // namespace workerd
+} // namespace sample
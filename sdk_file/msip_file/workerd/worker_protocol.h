@@ -0,0 +1,85 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SAMPLE_WORKERD_WORKER_PROTOCOL_H_
+#define SAMPLE_WORKERD_WORKER_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sample {
+namespace workerd {
+
+// Frames msip_workerd exchanges with its clients over a Unix stream socket, in host byte order since both
+// ends run on the same node. app/pubsub/worker_client.py writes the same layout.
+//   request:  u32 length of the rest, u32 id, u32 timeout_ms, u16 argument count,
+//             then per argument a u32 length and its bytes
+//   response: u32 length of the rest, u32 id, i32 status, then the result JSON
+// The first argument names the export to call. Descriptors of shared-memory segments travel as
+// SCM_RIGHTS ancillary data on the request's bytes.
+const uint32_t kMaxFrameBytes = 64 * 1024 * 1024;
+const size_t kMaxDescriptors = 4;
+
+// Descriptors received with a request, closed when it is destroyed.
+class Descriptors final {
+public:
+  Descriptors() {}
+  ~Descriptors();
+  Descriptors(Descriptors&& other);
+  Descriptors& operator=(Descriptors&& other);
+  Descriptors(const Descriptors&) = delete;
+  Descriptors& operator=(const Descriptors&) = delete;
+
+  void Add(int fd) { mFds.push_back(fd); }
+  size_t Count() const { return mFds.size(); }
+  int operator[](size_t index) const { return mFds[index]; }
+
+private:
+  void Close();
+
+  std::vector<int> mFds;
+};
+
+struct Request {
+  uint32_t id;
+  uint32_t timeoutMs;
+  std::vector<std::string> arguments;
+  Descriptors descriptors;
+};
+
+// Reads the next request from socketFd. Returns false when the peer closed the connection between
+// requests, and throws std::runtime_error on a read error or a malformed or truncated frame.
+bool ReadRequest(int socketFd, Request& request);
+
+// Writes one response, retrying short writes. Throws std::runtime_error when the peer is gone.
+void WriteResponse(int socketFd, uint32_t id, int32_t status, const std::string& json);
+
+} // namespace workerd
+} // namespace sample
+
+#endif // SAMPLE_WORKERD_WORKER_PROTOCOL_H_
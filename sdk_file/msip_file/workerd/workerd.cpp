@@ -0,0 +1,445 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpmc_ring.h"
+#include "msip_library.h"
+#include "worker_protocol.h"
+
+using sample::bench::MsipLibrary;
+using sample::queue::MpmcRing;
+using sample::workerd::Request;
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+// Worker daemon for aip_file.so: one long-lived process holds the MIP context and the engine, protection
+// and license caches, and serves the file calls of every service replica on the node over a Unix socket
+// (see worker_protocol.h). Connections are read on their own threads, which hand requests to a fixed pool
+// of workers through a lock-free ring, so SDK and crypto work runs on every core however many Python
+// processes or threads send it. A full ring is answered at once with status 3, as admission control
+// answers an overloaded library. Options:
+//   --library=PATH           aip_file.so to load (default: next to this executable)
+//   --socket=PATH            Unix socket to listen on (default: /tmp/msip_workerd.sock)
+//   --socket_mode=OCTAL      permissions of the socket (default: 660)
+//   --application_id=ID      application id msipInit loads the context for
+//   --workers=N              worker threads (default: hardware threads)
+//   --queue=N                requests queued for the workers before new ones are rejected (default: 1024)
+//   --record=DIR --replay=DIR --latency_ms=N --jitter_ms=N
+//                            record or replay service responses, see msipConfigureHttpReplay
+
+namespace {
+
+// Status of a request the daemon turned away without calling the library, as kOverloaded in main.cpp.
+const int kOverloaded = 3;
+const size_t kInitialResultBytes = 8192;
+
+typedef int (*StatusFn)(const char*, const char*, char*, size_t, size_t*);
+typedef int (*UnprotectFn)(const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*ProtectFn)(const char*, const char*, const char*, const char*, const char*, char*, size_t, size_t*);
+typedef int (*BatchFn)(const char**, size_t, const char*, char*, size_t, size_t*);
+typedef int (*SharedStatusFn)(int, const char*, const char*, char*, size_t, size_t*);
+typedef int (*SharedUnprotectFn)(const char*, int, const char*, const char*, int, char*, size_t, size_t*);
+typedef int (*SharedProtectFn)(const char*, int, const char*, const char*, const char*, const char*, int, char*, size_t, size_t*);
+typedef int (*TakeResultFn)(char*, size_t, size_t*);
+typedef int (*SetDeadlineFn)(int64_t);
+
+map<string, string> ParseArguments(int argc, char** argv) {
+  map<string, string> options;
+  for (int i = 1; i < argc; ++i) {
+    string argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0)
+      throw std::invalid_argument("Unexpected argument " + argument);
+    auto equals = argument.find('=');
+    options[argument.substr(2, equals == string::npos ? string::npos : equals - 2)] =
+        equals == string::npos ? "true" : argument.substr(equals + 1);
+  }
+  return options;
+}
+
+string GetOption(const map<string, string>& options, const string& name, const string& fallback = string()) {
+  auto it = options.find(name);
+  return it == options.end() ? fallback : it->second;
+}
+
+string EscapeJson(const string& value) {
+  string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+string ErrorJSON(const string& error) {
+  return "{\"status\": false, \"error\": \"" + EscapeJson(error) + "\"}";
+}
+
+// An export requests may call, with the arguments after the operation name and the descriptors it takes.
+// Batches take any number of paths before the application id, so maxArguments is 0 for them.
+struct Operation {
+  size_t minArguments;
+  size_t maxArguments;
+  size_t descriptors;
+  std::function<int(const Request&, char*, size_t, size_t*)> call;
+};
+
+// The exports the daemon serves, looked up once. Missing ones are left out, so a library older than the
+// daemon still serves the calls it has.
+map<string, Operation> BindOperations(const MsipLibrary& library) {
+  map<string, Operation> operations;
+  const char* const statusNames[] = { "getFileStatus_v2", "inspectLicense" };
+  for (const char* name : statusNames) {
+    if (auto fn = library.Symbol<StatusFn>(name))
+      operations[name] = { 2, 2, 0, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+        return fn(r.arguments[1].c_str(), r.arguments[2].c_str(), out, cap, needed);
+      } };
+  }
+  if (auto fn = library.Symbol<UnprotectFn>("unprotectFile_v2"))
+    operations["unprotectFile_v2"] = { 3, 3, 0, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.arguments[1].c_str(), r.arguments[2].c_str(), r.arguments[3].c_str(), out, cap, needed);
+    } };
+  if (auto fn = library.Symbol<ProtectFn>("protectFile_v2"))
+    operations["protectFile_v2"] = { 5, 5, 0, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.arguments[1].c_str(), r.arguments[2].c_str(), r.arguments[3].c_str(), r.arguments[4].c_str(),
+                r.arguments[5].c_str(), out, cap, needed);
+    } };
+  if (auto fn = library.Symbol<BatchFn>("getFileStatusBatch_v2"))
+    operations["getFileStatusBatch_v2"] = { 1, 0, 0, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      vector<const char*> paths;
+      for (size_t i = 1; i + 1 < r.arguments.size(); ++i)
+        paths.push_back(r.arguments[i].c_str());
+      return fn(paths.data(), paths.size(), r.arguments.back().c_str(), out, cap, needed);
+    } };
+  if (auto fn = library.Symbol<SharedStatusFn>("getSharedMemoryStatus"))
+    operations["getSharedMemoryStatus"] = { 2, 2, 1, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.descriptors[0], r.arguments[1].c_str(), r.arguments[2].c_str(), out, cap, needed);
+    } };
+  if (auto fn = library.Symbol<SharedUnprotectFn>("unprotectSharedMemory"))
+    operations["unprotectSharedMemory"] = { 3, 3, 2, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.arguments[1].c_str(), r.descriptors[0], r.arguments[2].c_str(), r.arguments[3].c_str(),
+                r.descriptors[1], out, cap, needed);
+    } };
+  if (auto fn = library.Symbol<SharedProtectFn>("protectSharedMemory"))
+    operations["protectSharedMemory"] = { 5, 5, 2, [fn](const Request& r, char* out, size_t cap, size_t* needed) {
+      return fn(r.arguments[1].c_str(), r.descriptors[0], r.arguments[2].c_str(), r.arguments[3].c_str(),
+                r.arguments[4].c_str(), r.arguments[5].c_str(), r.descriptors[1], out, cap, needed);
+    } };
+  return operations;
+}
+
+// A client connection. Workers answer its requests in any order, so writes are serialized here.
+struct Connection {
+  explicit Connection(int socketFd) : fd(socketFd) {}
+  ~Connection() { close(fd); }
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  void Respond(uint32_t id, int status, const string& json) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    try {
+      sample::workerd::WriteResponse(fd, id, status, json);
+    } catch (const std::exception&) {
+      // The client is gone; its reader thread sees the connection close.
+    }
+  }
+
+  const int fd;
+  std::mutex writeMutex;
+};
+
+struct Job {
+  shared_ptr<Connection> connection;
+  Request request;
+};
+
+class Server final {
+public:
+  Server(const MsipLibrary& library, size_t workers, size_t queueCapacity)
+    : mOperations(BindOperations(library)),
+      mTakeResult(library.Symbol<TakeResultFn>("msipTakeResult")),
+      mSetDeadline(library.Symbol<SetDeadlineFn>("msipSetDeadline")),
+      mWorkerCount(workers),
+      mRing(queueCapacity),
+      mListenFd(-1),
+      mStopping(false),
+      mDraining(false),
+      mActiveReaders(0),
+      mServed(0),
+      mRejected(0) {
+    if (!mTakeResult)
+      throw std::runtime_error("Library does not export msipTakeResult");
+    sem_init(&mQueued, 0, 0);
+  }
+
+  ~Server() { sem_destroy(&mQueued); }
+
+  void Listen(const string& socketPath, mode_t mode) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+      throw std::invalid_argument("Socket path is too long: " + socketPath);
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mListenFd < 0)
+      throw std::runtime_error(string("Failed to create the socket: ") + strerror(errno));
+    // A socket left by a daemon that did not shut down cleanly would fail the bind.
+    unlink(socketPath.c_str());
+    if (bind(mListenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        chmod(socketPath.c_str(), mode) != 0 || listen(mListenFd, SOMAXCONN) != 0)
+      throw std::runtime_error("Failed to listen on " + socketPath + ": " + strerror(errno));
+    mSocketPath = socketPath;
+  }
+
+  void Start() {
+    for (size_t i = 0; i < mWorkerCount; ++i)
+      mWorkers.emplace_back([this]() { Work(); });
+    mAcceptor = std::thread([this]() { Accept(); });
+  }
+
+  // Stops accepting, lets the readers finish the requests they are reading, then drains the ring.
+  void Stop() {
+    mStopping = true;
+    shutdown(mListenFd, SHUT_RDWR);
+    mAcceptor.join();
+    {
+      std::unique_lock<std::mutex> lock(mConnectionsMutex);
+      for (const auto& connection : mConnections)
+        shutdown(connection->fd, SHUT_RD);
+      mReadersDone.wait(lock, [this]() { return mActiveReaders == 0; });
+    }
+    mDraining = true;
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+      sem_post(&mQueued);
+    for (auto& worker : mWorkers)
+      worker.join();
+    close(mListenFd);
+    unlink(mSocketPath.c_str());
+  }
+
+  size_t GetOperationCount() const { return mOperations.size(); }
+  uint64_t GetServed() const { return mServed; }
+  uint64_t GetRejected() const { return mRejected; }
+
+private:
+  void Accept() {
+    while (!mStopping) {
+      const int fd = accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (!mStopping)
+          std::cerr << "accept failed: " << strerror(errno) << "\n";
+        return;
+      }
+      auto connection = std::make_shared<Connection>(fd);
+      {
+        std::lock_guard<std::mutex> lock(mConnectionsMutex);
+        mConnections.insert(connection);
+        ++mActiveReaders;
+      }
+      std::thread([this, connection]() { Read(connection); }).detach();
+    }
+  }
+
+  void Read(shared_ptr<Connection> connection) {
+    try {
+      Job job;
+      while (sample::workerd::ReadRequest(connection->fd, job.request)) {
+        job.connection = connection;
+        if (mRing.TryPush(job)) {
+          sem_post(&mQueued);
+        } else {
+          ++mRejected;
+          connection->Respond(job.request.id, kOverloaded, ErrorJSON("Worker queue is full"));
+        }
+        job = Job();
+      }
+    } catch (const std::exception& ex) {
+      if (!mStopping)
+        std::cerr << "Dropping a connection: " << ex.what() << "\n";
+    }
+    std::lock_guard<std::mutex> lock(mConnectionsMutex);
+    mConnections.erase(connection);
+    if (--mActiveReaders == 0)
+      mReadersDone.notify_all();
+  }
+
+  void Work() {
+    vector<char> result(kInitialResultBytes);
+    Job job;
+    while (true) {
+      while (sem_wait(&mQueued) != 0 && errno == EINTR) {}
+      // A request pushed after one whose push is still finishing waits for it; once draining, an empty
+      // ring means everything queued has been served.
+      while (!mRing.TryPop(job)) {
+        if (mDraining)
+          return;
+        std::this_thread::yield();
+      }
+      int status;
+      const string json = Execute(job.request, result, status);
+      job.connection->Respond(job.request.id, status, json);
+      ++mServed;
+      job = Job();
+    }
+  }
+
+  string Execute(const Request& request, vector<char>& result, int& status) {
+    if (request.arguments.empty()) {
+      status = EXIT_FAILURE;
+      return ErrorJSON("Request names no operation");
+    }
+    auto it = mOperations.find(request.arguments[0]);
+    const size_t arguments = request.arguments.size() - 1;
+    if (it == mOperations.end()) {
+      status = EXIT_FAILURE;
+      return ErrorJSON("Unknown operation " + request.arguments[0]);
+    }
+    const Operation& operation = it->second;
+    if (arguments < operation.minArguments || (operation.maxArguments && arguments > operation.maxArguments) ||
+        request.descriptors.Count() != operation.descriptors) {
+      status = EXIT_FAILURE;
+      return ErrorJSON("Wrong arguments for " + request.arguments[0]);
+    }
+
+    // Deadlines are per thread in the library, like the service's in-process calls set them.
+    if (mSetDeadline && request.timeoutMs)
+      mSetDeadline(request.timeoutMs);
+    size_t needed = 0;
+    status = operation.call(request, result.data(), result.size(), &needed);
+    if (status == MsipLibrary::kResultTooSmall) {
+      result.resize(needed);
+      status = mTakeResult(result.data(), result.size(), &needed);
+    }
+    if (mSetDeadline && request.timeoutMs)
+      mSetDeadline(0);
+    return string(result.data(), strnlen(result.data(), result.size()));
+  }
+
+  const map<string, Operation> mOperations;
+  const TakeResultFn mTakeResult;
+  const SetDeadlineFn mSetDeadline;
+  const size_t mWorkerCount;
+  MpmcRing<Job> mRing;
+  sem_t mQueued;
+  int mListenFd;
+  string mSocketPath;
+  std::atomic<bool> mStopping;
+  std::atomic<bool> mDraining;
+  std::thread mAcceptor;
+  vector<std::thread> mWorkers;
+  std::mutex mConnectionsMutex;
+  std::condition_variable mReadersDone;
+  std::set<shared_ptr<Connection>> mConnections;
+  size_t mActiveReaders;
+  std::atomic<uint64_t> mServed;
+  std::atomic<uint64_t> mRejected;
+};
+
+int Run(const map<string, string>& options) {
+  const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t workers = static_cast<size_t>(std::max(1, std::stoi(GetOption(options, "workers", std::to_string(hardwareThreads)))));
+  const size_t queue = static_cast<size_t>(std::max(1, std::stoi(GetOption(options, "queue", "1024"))));
+  const string socketPath = GetOption(options, "socket", "/tmp/msip_workerd.sock");
+  const mode_t socketMode = static_cast<mode_t>(std::stoi(GetOption(options, "socket_mode", "660"), nullptr, 8));
+
+  // Every thread started from here on, the SDK's included, inherits the mask, so only sigwait below sees these signals.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  MsipLibrary library(GetOption(options, "library"));
+  string error = library.GetError();
+  if (error.empty() && (!library.ConfigureHttpReplay(GetOption(options, "record"), GetOption(options, "replay"),
+                            std::stoi(GetOption(options, "latency_ms", "0")), std::stoi(GetOption(options, "jitter_ms", "0"))) ||
+                        !library.Initialize(GetOption(options, "application_id"))))
+    error = library.GetError();
+  if (!error.empty()) {
+    std::cerr << error << "\n";
+    return EXIT_FAILURE;
+  }
+
+  Server server(library, workers, queue);
+  server.Listen(socketPath, socketMode);
+  server.Start();
+  std::cerr << "msip_workerd serving " << server.GetOperationCount() << " operations on " << socketPath << " with "
+            << workers << " workers\n";
+  int received = 0;
+  sigwait(&signals, &received);
+  server.Stop();
+  std::cerr << "msip_workerd stopped after " << server.GetServed() << " requests, " << server.GetRejected()
+            << " rejected\n";
+  return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  try {
+    return Run(ParseArguments(argc, argv));
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << "\n";
+    return EXIT_FAILURE;
+  }
+}